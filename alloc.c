@@ -34,6 +34,7 @@ struct alloc_state {
 	/* bookkeeping of allocations */
 	void **slabs;
 	int slab_nr, slab_alloc;
+	size_t slab_bytes; /* total size of the slabs, for trace2 */
 };
 
 struct alloc_state *allocate_alloc_state(void)
@@ -47,6 +48,8 @@ void clear_alloc_state(struct alloc_state *s)
 		s->slab_nr--;
 		free(s->slabs[s->slab_nr]);
 	}
+	trace2_memory_add(TRACE2_MEMORY_ID_OBJECTS, -(intmax_t)s->slab_bytes);
+	s->slab_bytes = 0;
 
 	FREE_AND_NULL(s->slabs);
 }
@@ -55,9 +58,13 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 {
 	void *ret;
 
+	parsed_object_lock();
 	if (!s->nr) {
 		s->nr = BLOCKING;
 		s->p = xmalloc(BLOCKING * node_size);
+		s->slab_bytes += BLOCKING * node_size;
+		trace2_memory_add(TRACE2_MEMORY_ID_OBJECTS,
+				  BLOCKING * node_size);
 
 		ALLOC_GROW(s->slabs, s->slab_nr + 1, s->slab_alloc);
 		s->slabs[s->slab_nr++] = s->p;
@@ -66,6 +73,7 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 	s->count++;
 	ret = s->p;
 	s->p = (char *)s->p + node_size;
+	parsed_object_unlock();
 	memset(ret, 0, node_size);
 
 	return ret;
@@ -119,7 +127,10 @@ void init_commit_node(struct commit *c)
 void *alloc_commit_node(struct repository *r)
 {
 	struct commit *c = alloc_node(r->parsed_objects->commit_state, sizeof(struct commit));
+
+	parsed_object_lock();
 	init_commit_node(c);
+	parsed_object_unlock();
 	return c;
 }
 
@@ -22,6 +22,8 @@
 #include "rerere.h"
 #include "apply.h"
 #include "entry.h"
+#include "strmap.h"
+#include "thread-utils.h"
 
 struct gitdiff_data {
 	struct strbuf *root;
@@ -3031,6 +3033,11 @@ static int apply_one_fragment(struct apply_state *state,
 		    preimage.nr + applied_pos >= img->nr &&
 		    (ws_rule & WS_BLANK_AT_EOF) &&
 		    state->ws_error_action != nowarn_ws_error) {
+			if (state->jobs) {
+				/* threads do not report; have it redone */
+				applied_pos = -1;
+				goto out;
+			}
 			record_ws_error(state, WS_BLANK_AT_EOF, "+", 1,
 					found_new_blank_lines_at_end);
 			if (state->ws_error_action == correct_ws_error) {
@@ -3064,10 +3071,15 @@ static int apply_one_fragment(struct apply_state *state,
 		 * of context lines.
 		 */
 		if ((leading != frag->leading ||
-		     trailing != frag->trailing) && state->apply_verbosity > verbosity_silent)
+		     trailing != frag->trailing) && state->apply_verbosity > verbosity_silent) {
+			if (state->jobs) {
+				applied_pos = -1;
+				goto out;
+			}
 			fprintf_ln(stderr, _("Context reduced to (%ld/%ld)"
 					     " to apply fragment at %d"),
 				   leading, trailing, applied_pos+1);
+		}
 		update_image(state, img, applied_pos, &preimage, &postimage);
 	} else {
 		if (state->apply_verbosity > verbosity_normal)
@@ -3226,6 +3238,8 @@ static int apply_fragments(struct apply_state *state, struct image *img, struct
 	while (frag) {
 		nth++;
 		if (apply_one_fragment(state, img, frag, inaccurate_eof, ws_rule, nth)) {
+			if (state->jobs)
+				return -1;
 			error(_("patch failed: %s:%ld"), name, frag->oldpos);
 			if (!state->apply_with_reject)
 				return -1;
@@ -3628,6 +3642,68 @@ static int try_threeway(struct apply_state *state,
 	return 0;
 }
 
+/*
+ * While check_patch_list() runs the checks of one patch after another,
+ * threads apply the fragments of the patches already checked.  What the
+ * checks report is held back until the patches before have been dealt
+ * with, so that the output comes out in the same order as without them.
+ */
+struct apply_job {
+	struct patch *patch;
+	struct stat st;
+	const struct cache_entry *ce;
+	struct image image;
+	struct string_list messages;
+	int status;
+	unsigned deferred:1;
+};
+
+struct apply_jobs {
+	struct apply_state *state;
+	struct apply_job *job;
+	int nr;
+	int *queue;
+	int queued, taken;
+	unsigned done:1;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/* Hand the fragments of the patch being checked to the threads. */
+static int defer_fragments(struct apply_state *state, struct patch *patch,
+			   struct stat *st, const struct cache_entry *ce,
+			   struct image *image)
+{
+	struct apply_jobs *jobs = state->jobs;
+	int nr = jobs->nr - 1;
+	struct apply_job *job = jobs->job + nr;
+
+	job->st = *st;
+	job->ce = ce;
+	job->image = *image;
+	job->deferred = 1;
+
+	pthread_mutex_lock(&jobs->mutex);
+	jobs->queue[jobs->queued++] = nr;
+	pthread_cond_signal(&jobs->cond);
+	pthread_mutex_unlock(&jobs->mutex);
+	return 0;
+}
+
+static int finish_apply_data(struct apply_state *state, struct patch *patch,
+			     struct image *image)
+{
+	patch->result = image->buf;
+	patch->resultsize = image->len;
+	add_to_fn_table(state, patch);
+	free(image->line_allocated);
+
+	if (0 < patch->is_delete && patch->resultsize)
+		return error(_("removal patch leaves file contents"));
+
+	return 0;
+}
+
 static int apply_data(struct apply_state *state, struct patch *patch,
 		      struct stat *st, const struct cache_entry *ce)
 {
@@ -3636,6 +3712,9 @@ static int apply_data(struct apply_state *state, struct patch *patch,
 	if (load_preimage(state, &image, patch, st, ce) < 0)
 		return -1;
 
+	if (state->jobs && !patch->is_binary)
+		return defer_fragments(state, patch, st, ce, &image);
+
 	if (!state->threeway || try_threeway(state, &image, patch, st, ce) < 0) {
 		if (state->apply_verbosity > verbosity_silent &&
 		    state->threeway && !patch->direct_to_threeway)
@@ -3645,15 +3724,7 @@ static int apply_data(struct apply_state *state, struct patch *patch,
 		if (patch->direct_to_threeway || apply_fragments(state, &image, patch) < 0)
 			return -1;
 	}
-	patch->result = image.buf;
-	patch->resultsize = image.len;
-	add_to_fn_table(state, patch);
-	free(image.line_allocated);
-
-	if (0 < patch->is_delete && patch->resultsize)
-		return error(_("removal patch leaves file contents"));
-
-	return 0;
+	return finish_apply_data(state, patch, &image);
 }
 
 /*
@@ -4007,12 +4078,210 @@ static int check_patch(struct apply_state *state, struct patch *patch)
 	return 0;
 }
 
+#define MIN_PATCHES_PER_THREAD 32
+
+/*
+ * Returns how many threads to apply the fragments of the patches in
+ * "list" with, or 0 if it is to be done as we go.  A patch can only be
+ * checked against the result of the ones before it if they touch the
+ * same paths, and we do not try that.  Neither do we when applying is
+ * more than matching the fragments, or is to be narrated.
+ */
+static int apply_threads(struct apply_state *state, struct patch *list)
+{
+	struct strset paths = STRSET_INIT;
+	struct patch *patch;
+	int nr = 0, threads;
+
+	if (!HAVE_THREADS || state->threeway ||
+	    state->ws_error_action == correct_ws_error ||
+	    state->apply_verbosity > verbosity_normal)
+		return 0;
+
+	for (patch = list; patch; patch = patch->next)
+		nr++;
+	threads = git_env_ulong("GIT_TEST_APPLY_THREADS", 0);
+	if (!threads) {
+		threads = online_cpus();
+		if (threads > nr / MIN_PATCHES_PER_THREAD)
+			threads = nr / MIN_PATCHES_PER_THREAD;
+		if (threads < 2)
+			return 0;
+	}
+
+	strset_init(&paths);
+	for (patch = list; threads && patch; patch = patch->next) {
+		if (patch->old_name && !strset_add(&paths, patch->old_name))
+			threads = 0;
+		else if (patch->new_name &&
+			 (!patch->old_name ||
+			  strcmp(patch->old_name, patch->new_name)) &&
+			 !strset_add(&paths, patch->new_name))
+			threads = 0;
+	}
+	strset_clear(&paths);
+	return threads;
+}
+
+static void *apply_thread(void *data)
+{
+	struct apply_jobs *jobs = data;
+
+	trace2_thread_start("apply");
+	for (;;) {
+		struct apply_job *job;
+
+		pthread_mutex_lock(&jobs->mutex);
+		while (jobs->taken == jobs->queued && !jobs->done)
+			pthread_cond_wait(&jobs->cond, &jobs->mutex);
+		if (jobs->taken == jobs->queued) {
+			pthread_mutex_unlock(&jobs->mutex);
+			break;
+		}
+		job = jobs->job + jobs->queue[jobs->taken++];
+		pthread_mutex_unlock(&jobs->mutex);
+
+		job->status = apply_fragments(jobs->state, &job->image,
+					      job->patch);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+/* Where error() and warning() go while the threads are running */
+static struct string_list *held_messages;
+
+static void hold_error(const char *err, va_list params)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_vaddf(&sb, err, params);
+	string_list_append_nodup(held_messages,
+				 strbuf_detach(&sb, NULL))->util = (void *)1;
+}
+
+static void hold_warning(const char *warn, va_list params)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_vaddf(&sb, warn, params);
+	string_list_append_nodup(held_messages, strbuf_detach(&sb, NULL));
+}
+
+/*
+ * Report what checking the patch of "job" said, and finish applying it
+ * if its fragments were left to the threads.  Those that the threads
+ * did not manage to apply, or would have had to say something about,
+ * are applied again, this time with the reports.
+ */
+static int finish_job(struct apply_state *state, struct apply_job *job)
+{
+	struct patch *patch = job->patch;
+	const char *name = patch->old_name ? patch->old_name : patch->new_name;
+	struct string_list_item *item;
+	int res;
+
+	for_each_string_list_item(item, &job->messages) {
+		if (item->util)
+			error("%s", item->string);
+		else
+			warning("%s", item->string);
+	}
+	string_list_clear(&job->messages, 0);
+
+	if (!job->deferred)
+		return 0;
+	if (!job->status) {
+		res = finish_apply_data(state, patch, &job->image);
+	} else {
+		clear_image(&job->image);
+		res = apply_data(state, patch, &job->st, job->ce);
+	}
+	if (res < 0) {
+		patch->rejected = 1;
+		return error(_("%s: patch does not apply"), name);
+	}
+	return 0;
+}
+
+static int check_patch_list_threaded(struct apply_state *state,
+				     struct patch *patch, int nr_threads)
+{
+	struct apply_jobs jobs = { .state = state };
+	report_fn error_routine = get_error_routine();
+	report_fn warn_routine = get_warn_routine();
+	pthread_t *threads;
+	struct patch *p;
+	int nr = 0, i, err = 0;
+
+	for (p = patch; p; p = p->next)
+		nr++;
+	CALLOC_ARRAY(jobs.job, nr);
+	ALLOC_ARRAY(jobs.queue, nr);
+	pthread_mutex_init(&jobs.mutex, NULL);
+	pthread_cond_init(&jobs.cond, NULL);
+
+	trace2_data_intmax("apply", state->repo, "threads", nr_threads);
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL, apply_thread, &jobs);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	state->jobs = &jobs;
+	set_error_routine(hold_error);
+	set_warn_routine(hold_warning);
+	for (p = patch; p; p = p->next) {
+		struct apply_job *job = jobs.job + jobs.nr++;
+		int res;
+
+		job->patch = p;
+		string_list_init_dup(&job->messages);
+		held_messages = &job->messages;
+		res = check_patch(state, p);
+		if (res == -128) {
+			err = res;
+			break;
+		}
+		err |= res;
+	}
+	set_error_routine(error_routine);
+	set_warn_routine(warn_routine);
+	held_messages = NULL;
+
+	pthread_mutex_lock(&jobs.mutex);
+	jobs.done = 1;
+	pthread_cond_broadcast(&jobs.cond);
+	pthread_mutex_unlock(&jobs.mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	state->jobs = NULL;
+
+	for (i = 0; i < jobs.nr; i++) {
+		int res = finish_job(state, jobs.job + i);
+
+		if (err != -128)
+			err |= res;
+	}
+
+	free(threads);
+	free(jobs.queue);
+	free(jobs.job);
+	pthread_cond_destroy(&jobs.cond);
+	pthread_mutex_destroy(&jobs.mutex);
+	return err;
+}
+
 static int check_patch_list(struct apply_state *state, struct patch *patch)
 {
-	int err = 0;
+	int err = 0, threads;
 
 	prepare_symlink_changes(state, patch);
 	prepare_fn_table(state, patch);
+	threads = apply_threads(state, patch);
+	if (threads)
+		return check_patch_list_threaded(state, patch, threads);
 	while (patch) {
 		int res;
 		if (state->apply_verbosity > verbosity_normal)
@@ -5,6 +5,7 @@
 #include "lockfile.h"
 #include "string-list.h"
 
+struct apply_jobs;
 struct repository;
 
 enum apply_ws_error_action {
@@ -101,6 +102,12 @@ struct apply_state {
 	 */
 	struct string_list fn_table;
 
+	/*
+	 * Set while check_patch_list() leaves applying the fragments
+	 * of the patches to threads.
+	 */
+	struct apply_jobs *jobs;
+
 	/*
 	 * This is to save reporting routines before using
 	 * set_error_routine() or set_warn_routine() to install muting
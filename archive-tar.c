@@ -8,6 +8,7 @@
 #include "object-store.h"
 #include "streaming.h"
 #include "run-command.h"
+#include "thread-utils.h"
 
 #define RECORDSIZE	(512)
 #define BLOCKSIZE	(RECORDSIZE * 20)
@@ -16,10 +17,228 @@ static char block[BLOCKSIZE];
 static unsigned long offset;
 
 static int tar_umask = 002;
+static int tar_threads;
 
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args);
 
+/*
+ * With "git archive gzip" as the command of a tar filter, we compress
+ * the archive ourselves.  It is cut into chunks of GZIP_CHUNK_SIZE
+ * bytes, each of which becomes a gzip member of its own; a gzip file
+ * may consist of several members, and gunzip outputs them one after
+ * another.  The chunks are compressed by tar.threads threads and
+ * written out in order.  As they do not depend on the number of
+ * threads, neither does the output.
+ */
+#define INTERNAL_GZIP_COMMAND "git archive gzip"
+#define GZIP_CHUNK_SIZE (1024 * 1024)
+
+struct gzip_chunk {
+	unsigned char *in, *out;
+	size_t in_len, out_len;
+	int done;
+};
+
+static struct {
+	int active;
+	int level;
+	unsigned char *in;
+	size_t in_len;
+
+	/* the ring of chunks being compressed by the threads */
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct gzip_chunk *chunks;
+	unsigned int alloc, first, nr, next;
+	int stop;
+} gzip;
+
+static void put_le32(unsigned char *p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static void compress_gzip_chunk(struct gzip_chunk *chunk)
+{
+	/* no name, no mtime, from Unix, as "gzip -n" writes it */
+	static const unsigned char header[10] = {
+		0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+	};
+	git_zstream s;
+	size_t bound;
+
+	git_deflate_init_raw(&s, gzip.level);
+	bound = git_deflate_bound(&s, chunk->in_len);
+	chunk->out = xmalloc(sizeof(header) + bound + 8);
+	memcpy(chunk->out, header, sizeof(header));
+	s.next_in = chunk->in;
+	s.avail_in = chunk->in_len;
+	s.next_out = chunk->out + sizeof(header);
+	s.avail_out = bound;
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+
+	chunk->out_len = sizeof(header) + s.total_out;
+	put_le32(chunk->out + chunk->out_len,
+		 crc32(crc32(0, NULL, 0), chunk->in, chunk->in_len));
+	put_le32(chunk->out + chunk->out_len + 4, chunk->in_len);
+	chunk->out_len += 8;
+	FREE_AND_NULL(chunk->in);
+}
+
+static void write_gzip_chunk(struct gzip_chunk *chunk)
+{
+	write_or_die(1, chunk->out, chunk->out_len);
+	FREE_AND_NULL(chunk->out);
+}
+
+static void *gzip_thread(void *data)
+{
+	pthread_mutex_lock(&gzip.mutex);
+	for (;;) {
+		struct gzip_chunk *chunk;
+
+		while (!gzip.stop && gzip.next == gzip.first + gzip.nr)
+			pthread_cond_wait(&gzip.cond, &gzip.mutex);
+		if (gzip.next == gzip.first + gzip.nr)
+			break;
+		chunk = &gzip.chunks[gzip.next++ % gzip.alloc];
+		pthread_mutex_unlock(&gzip.mutex);
+
+		compress_gzip_chunk(chunk);
+
+		pthread_mutex_lock(&gzip.mutex);
+		chunk->done = 1;
+		pthread_cond_broadcast(&gzip.cond);
+	}
+	pthread_mutex_unlock(&gzip.mutex);
+	return NULL;
+}
+
+/* Write out the oldest chunk, waiting for it if "wait" is set. */
+static int write_oldest_gzip_chunk(int wait)
+{
+	struct gzip_chunk *chunk = &gzip.chunks[gzip.first % gzip.alloc];
+
+	pthread_mutex_lock(&gzip.mutex);
+	while (wait && !chunk->done)
+		pthread_cond_wait(&gzip.cond, &gzip.mutex);
+	pthread_mutex_unlock(&gzip.mutex);
+	if (!chunk->done)
+		return -1;
+
+	write_gzip_chunk(chunk);
+
+	pthread_mutex_lock(&gzip.mutex);
+	gzip.first++;
+	gzip.nr--;
+	pthread_mutex_unlock(&gzip.mutex);
+	return 0;
+}
+
+static void flush_gzip_chunk(void)
+{
+	struct gzip_chunk chunk = { gzip.in, NULL, gzip.in_len, 0, 0 };
+
+	if (!gzip.in_len)
+		return;
+	gzip.in = NULL;
+	gzip.in_len = 0;
+
+	if (!gzip.threads) {
+		compress_gzip_chunk(&chunk);
+		write_gzip_chunk(&chunk);
+		return;
+	}
+
+	while (gzip.nr == gzip.alloc)
+		write_oldest_gzip_chunk(1);
+	pthread_mutex_lock(&gzip.mutex);
+	gzip.chunks[(gzip.first + gzip.nr++) % gzip.alloc] = chunk;
+	pthread_cond_broadcast(&gzip.cond);
+	pthread_mutex_unlock(&gzip.mutex);
+
+	/* write out what is ready, but do not wait for it */
+	while (gzip.nr && !write_oldest_gzip_chunk(0))
+		; /* nothing */
+}
+
+static void start_gzip(int level)
+{
+	int i;
+
+	memset(&gzip, 0, sizeof(gzip));
+	gzip.active = 1;
+	gzip.level = level;
+	gzip.nr_threads = tar_threads ? tar_threads : online_cpus();
+	if (!HAVE_THREADS || gzip.nr_threads <= 1)
+		return;
+
+	pthread_mutex_init(&gzip.mutex, NULL);
+	pthread_cond_init(&gzip.cond, NULL);
+	gzip.alloc = 2 * gzip.nr_threads;
+	CALLOC_ARRAY(gzip.chunks, gzip.alloc);
+	CALLOC_ARRAY(gzip.threads, gzip.nr_threads);
+	for (i = 0; i < gzip.nr_threads; i++)
+		if (pthread_create(&gzip.threads[i], NULL, gzip_thread, NULL))
+			die(_("unable to create thread"));
+}
+
+static void finish_gzip(void)
+{
+	int i;
+
+	flush_gzip_chunk();
+	gzip.active = 0;
+	if (!gzip.threads)
+		return;
+
+	while (gzip.nr)
+		write_oldest_gzip_chunk(1);
+	pthread_mutex_lock(&gzip.mutex);
+	gzip.stop = 1;
+	pthread_cond_broadcast(&gzip.cond);
+	pthread_mutex_unlock(&gzip.mutex);
+	for (i = 0; i < gzip.nr_threads; i++)
+		pthread_join(gzip.threads[i], NULL);
+	FREE_AND_NULL(gzip.threads);
+	FREE_AND_NULL(gzip.chunks);
+	pthread_cond_destroy(&gzip.cond);
+	pthread_mutex_destroy(&gzip.mutex);
+}
+
+/* write to stdout, or to the internal gzip */
+static void tar_write(const void *data, size_t size)
+{
+	const unsigned char *buf = data;
+
+	if (!gzip.active) {
+		write_or_die(1, data, size);
+		return;
+	}
+	while (size) {
+		size_t chunk = GZIP_CHUNK_SIZE - gzip.in_len;
+
+		if (chunk > size)
+			chunk = size;
+		if (!gzip.in)
+			gzip.in = xmalloc(GZIP_CHUNK_SIZE);
+		memcpy(gzip.in + gzip.in_len, buf, chunk);
+		gzip.in_len += chunk;
+		buf += chunk;
+		size -= chunk;
+		if (gzip.in_len == GZIP_CHUNK_SIZE)
+			flush_gzip_chunk();
+	}
+}
+
 /*
  * This is the max value that a ustar size header can specify, as it is fixed
  * at 11 octal digits. POSIX specifies that we switch to extended headers at
@@ -42,7 +261,7 @@ static int write_tar_filter_archive(const struct archiver *ar,
 static void write_if_needed(void)
 {
 	if (offset == BLOCKSIZE) {
-		write_or_die(1, block, BLOCKSIZE);
+		tar_write(block, BLOCKSIZE);
 		offset = 0;
 	}
 }
@@ -66,7 +285,7 @@ static void do_write_blocked(const void *data, unsigned long size)
 		write_if_needed();
 	}
 	while (size >= BLOCKSIZE) {
-		write_or_die(1, buf, BLOCKSIZE);
+		tar_write(buf, BLOCKSIZE);
 		size -= BLOCKSIZE;
 		buf += BLOCKSIZE;
 	}
@@ -101,10 +320,10 @@ static void write_trailer(void)
 {
 	int tail = BLOCKSIZE - offset;
 	memset(block + offset, 0, tail);
-	write_or_die(1, block, BLOCKSIZE);
+	tar_write(block, BLOCKSIZE);
 	if (tail < 2 * RECORDSIZE) {
 		memset(block, 0, offset);
-		write_or_die(1, block, BLOCKSIZE);
+		tar_write(block, BLOCKSIZE);
 	}
 }
 
@@ -400,6 +619,13 @@ static int tar_filter_config(const char *var, const char *value, void *data)
 
 static int git_tar_config(const char *var, const char *value, void *cb)
 {
+	if (!strcmp(var, "tar.threads")) {
+		tar_threads = git_config_int(var, value);
+		if (tar_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    tar_threads, var);
+		return 0;
+	}
 	if (!strcmp(var, "tar.umask")) {
 		if (value && !strcmp(value, "user")) {
 			tar_umask = umask(0);
@@ -436,6 +662,16 @@ static int write_tar_filter_archive(const struct archiver *ar,
 	if (!ar->data)
 		BUG("tar-filter archiver called with no filter defined");
 
+	if (!strcmp(ar->data, INTERNAL_GZIP_COMMAND)) {
+		if (args->compression_level > 9)
+			die(_("compression level %d not supported by the internal gzip"),
+			    args->compression_level);
+		start_gzip(args->compression_level);
+		r = write_tar_archive(ar, args);
+		finish_gzip();
+		return r;
+	}
+
 	strbuf_addstr(&cmd, ar->data);
 	if (args->compression_level >= 0)
 		strbuf_addf(&cmd, " -%d", args->compression_level);
@@ -474,9 +710,9 @@ void init_tar_archiver(void)
 	int i;
 	register_archiver(&tar_archiver);
 
-	tar_filter_config("tar.tgz.command", "gzip -cn", NULL);
+	tar_filter_config("tar.tgz.command", INTERNAL_GZIP_COMMAND, NULL);
 	tar_filter_config("tar.tgz.remote", "true", NULL);
-	tar_filter_config("tar.tar.gz.command", "gzip -cn", NULL);
+	tar_filter_config("tar.tar.gz.command", INTERNAL_GZIP_COMMAND, NULL);
 	tar_filter_config("tar.tar.gz.remote", "true", NULL);
 	git_config(git_tar_config, NULL);
 	for (i = 0; i < nr_tar_filters; i++) {
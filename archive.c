@@ -9,6 +9,8 @@
 #include "parse-options.h"
 #include "unpack-trees.h"
 #include "dir.h"
+#include "run-command.h"
+#include "tempfile.h"
 
 static char const * const archive_usage[] = {
 	N_("git archive [<options>] <tree-ish> [<path>...]"),
@@ -90,8 +92,10 @@ static void *object_file_to_archive(const struct archiver_args *args,
 
 		strbuf_attach(&buf, buffer, *sizep, *sizep + 1);
 		convert_to_working_tree(args->repo->index, path, buf.buf, buf.len, &buf, &meta);
-		if (commit)
+		if (commit) {
 			format_subst(commit, buf.buf, buf.len, &buf, args->pretty_ctx);
+			((struct archiver_args *)args)->substituted = 1;
+		}
 		buffer = strbuf_detach(&buf, &size);
 		*sizep = size;
 	}
@@ -621,10 +625,258 @@ static int parse_archive_args(int argc, const char **argv,
 	args->base = base;
 	args->baselen = strlen(base);
 	args->worktree_attributes = worktree_attributes;
+	args->substituted = 0;
 
 	return argc;
 }
 
+static int add_config_to_cache_key(const char *var, const char *value,
+				   void *data)
+{
+	strbuf_addf(data, "config %s=%s\n", var, value ? value : "");
+	return 0;
+}
+
+static void add_attr_file_to_cache_key(const char *path, void *data)
+{
+	struct strbuf *key = data;
+	struct strbuf contents = STRBUF_INIT;
+
+	/*
+	 * Only the contents count: the same file may be named by
+	 * different paths, e.g. through upload-archive.
+	 */
+	if (strbuf_read_file(&contents, path, 0) < 0)
+		strbuf_addstr(key, "attributes none\n");
+	else
+		strbuf_addf(key, "attributes %"PRIuMAX"\n%s",
+			    (uintmax_t)contents.len, contents.buf);
+	strbuf_release(&contents);
+}
+
+/*
+ * Everything the bytes of the archive depend on, short of the
+ * export-subst placeholders, goes into the key.  The whole configuration
+ * is in there too, so that changing a filter, tar.umask or the
+ * compression command does not serve stale archives, and so are the
+ * attributes files outside of the tree, which can mark paths
+ * export-ignore or give them an eol or filter.
+ */
+static char *archive_cache_path(const struct archiver *ar,
+				struct archiver_args *args)
+{
+	struct strbuf key = STRBUF_INIT;
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	int i;
+
+	strbuf_addf(&key, "format %s\n", ar->name);
+	strbuf_addf(&key, "level %d\n", args->compression_level);
+	strbuf_addf(&key, "prefix %s\n", args->base);
+	strbuf_addf(&key, "tree %s\n", oid_to_hex(&args->tree->object.oid));
+	strbuf_addf(&key, "commit %s\n",
+		    args->commit_oid ? oid_to_hex(args->commit_oid) : "none");
+	strbuf_addf(&key, "time %"PRItime"\n", args->time);
+	for (i = 0; i < args->pathspec.nr; i++)
+		strbuf_addf(&key, "path %s\n", args->pathspec.items[i].original);
+	git_config(add_config_to_cache_key, &key);
+	for_each_external_attr_file(add_attr_file_to_cache_key, &key);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, key.buf, key.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_release(&key);
+
+	return git_pathdup("archive-cache/%s", hash_to_hex(hash));
+}
+
+static int serve_cached_archive(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	int ret;
+
+	if (fd < 0)
+		return -1;
+	ret = copy_fd(fd, 1);
+	close(fd);
+	if (ret)
+		die(_("unable to write cached archive '%s'"), path);
+	/* the mtime tells archive.cacheLimit what was used last */
+	utime(path, NULL);
+	return 0;
+}
+
+struct archive_cache_entry {
+	char *path;
+	off_t size;
+	timestamp_t mtime;
+};
+
+static int archive_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct archive_cache_entry *a = va, *b = vb;
+
+	return a->mtime < b->mtime ? -1 : a->mtime > b->mtime;
+}
+
+/* Drop the least recently used archives until we are within "limit". */
+static void trim_archive_cache(unsigned long limit)
+{
+	char *dirpath = git_pathdup("archive-cache");
+	struct archive_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(dirpath);
+	if (!dir) {
+		free(dirpath);
+		return;
+	}
+	while ((de = readdir(dir))) {
+		struct stat st;
+		char *path;
+
+		if (starts_with(de->d_name, "tmp_") || is_dot_or_dotdot(de->d_name))
+			continue;
+		path = xstrfmt("%s/%s", dirpath, de->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = path;
+		entries[nr].size = st.st_size;
+		entries[nr].mtime = st.st_mtime;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entries, nr, archive_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > limit && !unlink(entries[i].path))
+			total -= entries[i].size;
+		free(entries[i].path);
+	}
+	free(entries);
+	free(dirpath);
+}
+
+struct archive_tee {
+	int cache_fd;
+};
+
+/*
+ * Copy what the archiver writes to our real standard output, and to the
+ * cache file as long as that works.  Returns 1 if the cache file is
+ * incomplete, and 2 if the output itself failed.
+ */
+static int tee_archive(int in, int out, void *data)
+{
+	struct archive_tee *tee = data;
+	int cache_fd = tee->cache_fd;
+	char buf[65536];
+	ssize_t len;
+	int ret = 0;
+
+	while ((len = xread(in, buf, sizeof(buf))) > 0) {
+		if (write_in_full(out, buf, len) < 0) {
+			ret = 2;
+			break;
+		}
+		if (cache_fd >= 0 && write_in_full(cache_fd, buf, len) < 0) {
+			cache_fd = -1;
+			ret = 1;
+		}
+	}
+	if (len < 0 && !ret)
+		ret = 1;
+	close(in);
+	close(out);
+	return ret;
+}
+
+static int write_cached_archive(const struct archiver *ar,
+				struct archiver_args *args,
+				const char *path, unsigned long limit)
+{
+	struct strbuf tmp_path = STRBUF_INIT;
+	struct tempfile *tmp;
+	struct archive_tee tee;
+	struct async async = { 0 };
+	int saved_stdout, tee_ret, rc;
+
+	strbuf_addstr(&tmp_path, path);
+	strbuf_setlen(&tmp_path, find_last_dir_sep(tmp_path.buf) + 1 - tmp_path.buf);
+	strbuf_addstr(&tmp_path, "tmp_XXXXXX");
+	if (safe_create_leading_directories(tmp_path.buf) ||
+	    !(tmp = mks_tempfile(tmp_path.buf))) {
+		warning_errno(_("unable to create archive cache file"));
+		strbuf_release(&tmp_path);
+		return ar->write_archive(ar, args);
+	}
+	strbuf_release(&tmp_path);
+
+	tee.cache_fd = get_tempfile_fd(tmp);
+	async.proc = tee_archive;
+	async.data = &tee;
+	async.in = -1;
+	async.out = xdup(1);
+	if (start_async(&async))
+		die(_("unable to fork"));
+
+	saved_stdout = xdup(1);
+	if (dup2(async.in, 1) < 0)
+		die_errno(_("unable to redirect the archive"));
+	close(async.in);
+
+	rc = ar->write_archive(ar, args);
+
+	fflush(stdout);
+	if (dup2(saved_stdout, 1) < 0)
+		die_errno(_("unable to restore standard output"));
+	close(saved_stdout);
+	tee_ret = finish_async(&async);
+
+	if (tee_ret == 2)
+		rc = error(_("unable to write archive"));
+	if (rc || tee_ret || args->substituted) {
+		delete_tempfile(&tmp);
+		return rc;
+	}
+	if (rename_tempfile(&tmp, path))
+		warning_errno(_("unable to store archive in cache"));
+	else if (limit)
+		trim_archive_cache(limit);
+	return 0;
+}
+
+static int write_archive_or_use_cache(const struct archiver *ar,
+				      struct archiver_args *args)
+{
+	int use_cache = 0;
+	unsigned long limit = 0;
+	char *path;
+	int rc;
+
+	git_config_get_bool("archive.cache", &use_cache);
+	git_config_get_ulong("archive.cachelimit", &limit);
+
+	/* nothing outside of the object store can go into the key */
+	if (!use_cache || args->worktree_attributes || args->extra_files.nr)
+		return ar->write_archive(ar, args);
+
+	path = archive_cache_path(ar, args);
+	if (!serve_cached_archive(path))
+		rc = 0;
+	else
+		rc = write_cached_archive(ar, args, path, limit);
+	free(path);
+	return rc;
+}
+
 int write_archive(int argc, const char **argv, const char *prefix,
 		  struct repository *repo,
 		  const char *name_hint, int remote)
@@ -659,7 +911,7 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	parse_treeish_arg(argv, &args, prefix, remote);
 	parse_pathspec_arg(argv + 1, &args);
 
-	rc = ar->write_archive(ar, &args);
+	rc = write_archive_or_use_cache(ar, &args);
 
 	string_list_clear_func(&args.extra_files, extra_file_info_clear);
 	free(args.refname);
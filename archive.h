@@ -21,6 +21,8 @@ struct archiver_args {
 	unsigned int verbose : 1;
 	unsigned int worktree_attributes : 1;
 	unsigned int convert : 1;
+	/* set once export-subst made the output depend on more than the tree */
+	unsigned int substituted : 1;
 	int compression_level;
 	struct string_list extra_files;
 	struct pretty_print_context *pretty_ctx;
@@ -14,6 +14,7 @@
 #include "utf8.h"
 #include "quote.h"
 #include "thread-utils.h"
+#include "strmap.h"
 
 const char git_attr__true[] = "(builtin)true";
 const char git_attr__false[] = "\0(builtin)false";
@@ -440,6 +441,12 @@ static struct match_attr *parse_attr_line(const char *line, const char *src,
  * .gitignore file and info/excludes file as a fallback.
  */
 
+/* Indices into attr_stack->attrs, in increasing order */
+struct attr_match_list {
+	int nr, alloc;
+	int *idx;
+};
+
 struct attr_stack {
 	struct attr_stack *prev;
 	char *origin;
@@ -447,6 +454,16 @@ struct attr_stack {
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
+
+	/*
+	 * Patterns of the form "*.<ext>" can only match paths whose
+	 * basename ends in ".<ext>", so once a frame is looked at often
+	 * enough they are filed under <ext> in "by_ext" and the remaining
+	 * non-macro ones go to "others"; see index_attr_stack().
+	 */
+	unsigned indexed : 1;
+	struct strmap by_ext;
+	struct attr_match_list others;
 };
 
 static void attr_stack_free(struct attr_stack *e)
@@ -469,6 +486,17 @@ static void attr_stack_free(struct attr_stack *e)
 		free(a);
 	}
 	free(e->attrs);
+	if (e->indexed) {
+		struct hashmap_iter iter;
+		struct strmap_entry *ent;
+
+		strmap_for_each_entry(&e->by_ext, &iter, ent) {
+			struct attr_match_list *list = ent->value;
+			free(list->idx);
+		}
+		strmap_clear(&e->by_ext, 1);
+		free(e->others.idx);
+	}
 	free(e);
 }
 
@@ -843,6 +871,17 @@ static int git_attr_system(void)
 
 static GIT_PATH_FUNC(git_path_info_attributes, INFOATTRIBUTES_FILE)
 
+void for_each_external_attr_file(void (*fn)(const char *path, void *data),
+				 void *data)
+{
+	if (git_attr_system())
+		fn(git_etc_gitattributes(), data);
+	if (get_home_gitattributes())
+		fn(get_home_gitattributes(), data);
+	if (startup_info->have_repository)
+		fn(git_path_info_attributes(), data);
+}
+
 static void push_stack(struct attr_stack **attr_stack_p,
 		       struct attr_stack *elem, char *origin, size_t originlen)
 {
@@ -1036,21 +1075,155 @@ static int fill_one(const char *what, struct all_attrs_item *all_attrs,
 	return rem;
 }
 
+/* Frames with fewer patterns than this are simply scanned */
+#define MIN_INDEXED_MATCHES 16
+
+/* Longest extension we look up in attr_stack->by_ext */
+#define MAX_INDEXED_EXT 64
+
+static const char *last_dot(const char *p, int len)
+{
+	while (len-- > 0)
+		if (p[len] == '.')
+			return p + len;
+	return NULL;
+}
+
+/*
+ * Return the extension "*.<ext>" pattern "pat" is filed under in "buf",
+ * or -1 if it cannot be filed.  "<ext>" is what follows the last dot and is
+ * folded to lowercase when we ignore case, just like attr_ext() does.
+ */
+static int pattern_ext(const struct pattern *pat, char *buf)
+{
+	const char *dot;
+	int i, len;
+
+	if ((pat->flags & (PATTERN_FLAG_NODIR | PATTERN_FLAG_ENDSWITH)) !=
+	    (PATTERN_FLAG_NODIR | PATTERN_FLAG_ENDSWITH))
+		return -1;
+	dot = last_dot(pat->pattern + 1, pat->patternlen - 1);
+	if (!dot)
+		return -1;
+	len = pat->pattern + pat->patternlen - dot - 1;
+	if (len >= MAX_INDEXED_EXT)
+		return -1;
+	for (i = 0; i < len; i++)
+		buf[i] = ignore_case ? tolower(dot[i + 1]) : dot[i + 1];
+	buf[len] = '\0';
+	return 0;
+}
+
+/*
+ * The same for "path"; returns 1 if its basename has no dot at all and
+ * -1 if its extension is too long to be looked up.
+ */
+static int attr_ext(const char *path, int pathlen, int basename_offset,
+		    char *buf)
+{
+	const char *basename = path + basename_offset;
+	int baselen = pathlen - basename_offset;
+	const char *dot;
+	int i, len;
+
+	if (baselen && basename[baselen - 1] == '/')
+		baselen--;
+	dot = last_dot(basename, baselen);
+	if (!dot)
+		return 1;
+	len = basename + baselen - dot - 1;
+	if (len >= MAX_INDEXED_EXT)
+		return -1;
+	for (i = 0; i < len; i++)
+		buf[i] = ignore_case ? tolower(dot[i + 1]) : dot[i + 1];
+	buf[len] = '\0';
+	return 0;
+}
+
+static void index_attr_stack(struct attr_stack *stack)
+{
+	char ext[MAX_INDEXED_EXT];
+	int i;
+
+	strmap_init(&stack->by_ext);
+	for (i = 0; i < stack->num_matches; i++) {
+		const struct match_attr *a = stack->attrs[i];
+		struct attr_match_list *list;
+
+		if (a->is_macro)
+			continue;
+		if (pattern_ext(&a->u.pat, ext)) {
+			list = &stack->others;
+		} else {
+			list = strmap_get(&stack->by_ext, ext);
+			if (!list) {
+				CALLOC_ARRAY(list, 1);
+				strmap_put(&stack->by_ext, ext, list);
+			}
+		}
+		ALLOC_GROW(list->idx, list->nr + 1, list->alloc);
+		list->idx[list->nr++] = i;
+	}
+	stack->indexed = 1;
+}
+
+static int fill_match(const char *path, int pathlen, int basename_offset,
+		      const struct attr_stack *stack, int i,
+		      struct all_attrs_item *all_attrs, int rem)
+{
+	const struct match_attr *a = stack->attrs[i];
+	const char *base = stack->origin ? stack->origin : "";
+
+	if (path_matches(path, pathlen, basename_offset,
+			 &a->u.pat, base, stack->originlen))
+		rem = fill_one("fill", all_attrs, a, rem);
+	return rem;
+}
+
 static int fill(const char *path, int pathlen, int basename_offset,
-		const struct attr_stack *stack,
+		struct attr_stack *stack,
 		struct all_attrs_item *all_attrs, int rem)
 {
+	char ext[MAX_INDEXED_EXT];
+	int ext_ret = attr_ext(path, pathlen, basename_offset, ext);
+	int have_ext = ext_ret >= 0;
+
 	for (; rem > 0 && stack; stack = stack->prev) {
-		int i;
-		const char *base = stack->origin ? stack->origin : "";
-
-		for (i = stack->num_matches - 1; 0 < rem && 0 <= i; i--) {
-			const struct match_attr *a = stack->attrs[i];
-			if (a->is_macro)
-				continue;
-			if (path_matches(path, pathlen, basename_offset,
-					 &a->u.pat, base, stack->originlen))
-				rem = fill_one("fill", all_attrs, a, rem);
+		const struct attr_match_list *by_ext;
+		int i, j;
+
+		if (!stack->indexed && have_ext &&
+		    stack->num_matches >= MIN_INDEXED_MATCHES)
+			index_attr_stack(stack);
+
+		if (!stack->indexed || !have_ext) {
+			for (i = stack->num_matches - 1; 0 < rem && 0 <= i; i--) {
+				if (stack->attrs[i]->is_macro)
+					continue;
+				rem = fill_match(path, pathlen, basename_offset,
+						 stack, i, all_attrs, rem);
+			}
+			continue;
+		}
+
+		/*
+		 * Only the patterns filed under our extension and those
+		 * that are not filed at all can match; walk both lists
+		 * from the end, keeping the order of the whole frame.
+		 */
+		by_ext = ext_ret ? NULL : strmap_get(&stack->by_ext, ext);
+		i = stack->others.nr - 1;
+		j = by_ext ? by_ext->nr - 1 : -1;
+		while (0 < rem && (0 <= i || 0 <= j)) {
+			int k;
+
+			if (j < 0 ||
+			    (0 <= i && stack->others.idx[i] > by_ext->idx[j]))
+				k = stack->others.idx[i--];
+			else
+				k = by_ext->idx[j--];
+			rem = fill_match(path, pathlen, basename_offset,
+					 stack, k, all_attrs, rem);
 		}
 	}
 
@@ -200,6 +200,15 @@ void git_check_attr(struct index_state *istate,
 void git_all_attrs(struct index_state *istate,
 		   const char *path, struct attr_check *check);
 
+/*
+ * Call "fn" with the path of each attributes file that is read from
+ * outside of the tree: the system-wide one (unless GIT_ATTR_NOSYSTEM is
+ * set), the one named by core.attributesFile and, in a repository,
+ * $GIT_DIR/info/attributes.  The files need not exist.
+ */
+void for_each_external_attr_file(void (*fn)(const char *path, void *data),
+				 void *data);
+
 enum git_attr_direction {
 	GIT_ATTR_CHECKIN,
 	GIT_ATTR_CHECKOUT,
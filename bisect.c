@@ -14,7 +14,9 @@
 #include "strvec.h"
 #include "commit-slab.h"
 #include "commit-reach.h"
+#include "commit-graph.h"
 #include "object-store.h"
+#include "prio-queue.h"
 #include "dir.h"
 
 static struct oid_array good_revs;
@@ -256,6 +258,171 @@ static struct commit_list *best_bisection_sorted(struct commit_list *list, int n
 	return list;
 }
 
+/*
+ * With generation numbers from the commit-graph, the weights of all the
+ * commits can be had in one pass over them in order of generation,
+ * parents first, instead of a count_distance() walk down the whole
+ * history below each merge.  A merge reaches what its first interesting
+ * parent reaches, itself, and whatever only its other parents reach.
+ * The last is found by walking down from all the parents at once in
+ * generation order, which can stop as soon as nothing is left in the
+ * queue that only the other parents reach; the walk covers the side
+ * branches and the stretch of the first parent's history beside them.
+ */
+#define PAINT_FIRST	(1u<<0)
+#define PAINT_OTHER	(1u<<1)
+#define PAINT_QUEUED	(1u<<2)
+
+define_commit_slab(bisect_paint, unsigned char);
+
+struct paint_walk {
+	struct bisect_paint paint;
+	struct prio_queue queue;
+	struct commit **touched;
+	size_t touched_nr, touched_alloc;
+	/* queued commits that only the other parents reach */
+	int other_only;
+};
+
+static void paint_commit(struct paint_walk *w, struct commit *commit,
+			 unsigned flags)
+{
+	unsigned char *paint;
+	unsigned old;
+
+	if (commit->object.flags & UNINTERESTING)
+		return;
+	paint = bisect_paint_at(&w->paint, commit);
+	old = *paint;
+	if ((old & flags) == flags)
+		return;
+
+	if (!old) {
+		ALLOC_GROW(w->touched, w->touched_nr + 1, w->touched_alloc);
+		w->touched[w->touched_nr++] = commit;
+	}
+	*paint |= flags;
+	if (old & PAINT_QUEUED) {
+		if ((old & (PAINT_FIRST | PAINT_OTHER)) == PAINT_OTHER)
+			w->other_only--;
+	} else if (!old) {
+		*paint |= PAINT_QUEUED;
+		prio_queue_put(&w->queue, commit);
+		if (flags == PAINT_OTHER)
+			w->other_only++;
+	}
+}
+
+/*
+ * Count the tree-changing commits that the interesting parents of
+ * "merge" other than the first reach, but the first does not.
+ */
+static int count_other_side(struct paint_walk *w, struct commit *merge)
+{
+	struct commit_list *p;
+	unsigned flags = PAINT_FIRST;
+	int nr = 0;
+	size_t i;
+
+	for (p = merge->parents; p; p = p->next) {
+		if (p->item->object.flags & UNINTERESTING)
+			continue;
+		paint_commit(w, p->item, flags);
+		flags = PAINT_OTHER;
+	}
+
+	while (w->other_only > 0) {
+		struct commit *commit = prio_queue_get(&w->queue);
+		unsigned char *paint = bisect_paint_at(&w->paint, commit);
+
+		*paint &= ~PAINT_QUEUED;
+		flags = *paint;
+		if (flags == PAINT_OTHER) {
+			w->other_only--;
+			if (!(commit->object.flags & TREESAME))
+				nr++;
+		}
+		for (p = commit->parents; p; p = p->next)
+			paint_commit(w, p->item, flags);
+	}
+
+	clear_prio_queue(&w->queue);
+	for (i = 0; i < w->touched_nr; i++)
+		*bisect_paint_at(&w->paint, w->touched[i]) = 0;
+	w->touched_nr = 0;
+	return nr;
+}
+
+static int compare_by_generation(const void *a_, const void *b_)
+{
+	const struct commit *a = (*(const struct commit_list **)a_)->item;
+	const struct commit *b = (*(const struct commit_list **)b_)->item;
+	timestamp_t generation_a = commit_graph_generation(a);
+	timestamp_t generation_b = commit_graph_generation(b);
+
+	if (generation_a < generation_b)
+		return -1;
+	return generation_a > generation_b;
+}
+
+/*
+ * Compute the weights of all the commits on "list" as described above,
+ * in an array parallel to "weights".  Returns NULL when not all of the
+ * commits have generation numbers to order them by.
+ */
+static int *weights_by_generation(struct commit_list *list, int on_list,
+				  int *weights)
+{
+	struct paint_walk w = { .queue = { compare_commits_by_gen_then_commit_date } };
+	struct commit_list **sorted, *p;
+	int *exact;
+	int i, n;
+
+	if (!generation_numbers_enabled(the_repository))
+		return NULL;
+	for (p = list; p; p = p->next) {
+		timestamp_t generation = commit_graph_generation(p->item);
+
+		if (generation == GENERATION_NUMBER_INFINITY ||
+		    generation == GENERATION_NUMBER_ZERO)
+			return NULL;
+	}
+
+	ALLOC_ARRAY(sorted, on_list);
+	for (n = 0, p = list; p; p = p->next)
+		sorted[n++] = p;
+	QSORT(sorted, n, compare_by_generation);
+
+	CALLOC_ARRAY(exact, on_list);
+	init_bisect_paint(&w.paint);
+	for (i = 0; i < n; i++) {
+		struct commit *commit = sorted[i]->item;
+		struct commit_list *first = NULL;
+		int nr_interesting = 0, weight = 0;
+
+		for (p = commit->parents; p; p = p->next) {
+			if (p->item->object.flags & UNINTERESTING)
+				continue;
+			if (!first)
+				first = p;
+			nr_interesting++;
+		}
+		if (!(commit->object.flags & TREESAME))
+			weight++;
+		if (first)
+			weight += exact[*commit_weight_at(&commit_weight,
+							  first->item) - weights];
+		if (nr_interesting > 1)
+			weight += count_other_side(&w, commit);
+		exact[*commit_weight_at(&commit_weight, commit) - weights] = weight;
+	}
+
+	clear_bisect_paint(&w.paint);
+	free(w.touched);
+	free(sorted);
+	return exact;
+}
+
 /*
  * zero or positive weight is the number of interesting commits it can
  * reach, including itself.  Especially, weight = 0 means it does not
@@ -275,6 +442,7 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 {
 	int n, counted;
 	struct commit_list *p;
+	int *exact = NULL;
 
 	counted = 0;
 
@@ -307,6 +475,9 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 
 	show_list("bisection 2 initialize", counted, nr, list);
 
+	if (!(bisect_flags & FIND_BISECTION_FIRST_PARENT_ONLY))
+		exact = weights_by_generation(list, n, weights);
+
 	/*
 	 * If you have only one parent in the resulting set
 	 * then you can reach one commit more than that parent
@@ -328,15 +499,23 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 			continue;
 		if (bisect_flags & FIND_BISECTION_FIRST_PARENT_ONLY)
 			BUG("shouldn't be calling count-distance in fp mode");
-		weight_set(p, count_distance(p));
-		clear_distance(list);
+		if (exact) {
+			weight_set(p, exact[*commit_weight_at(&commit_weight,
+							      p->item) - weights]);
+		} else {
+			weight_set(p, count_distance(p));
+			clear_distance(list);
+		}
 
 		/* Does it happen to be at half-way? */
 		if (!(bisect_flags & FIND_BISECTION_ALL) &&
-		      approx_halfway(p, nr))
+		      approx_halfway(p, nr)) {
+			free(exact);
 			return p;
+		}
 		counted++;
 	}
+	free(exact);
 
 	show_list("bisection 2 count_distance", counted, nr, list);
 
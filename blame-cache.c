@@ -0,0 +1,191 @@
+#include "cache.h"
+#include "blame-cache.h"
+#include "lockfile.h"
+#include "repository.h"
+
+#define BLAME_CACHE_SIGNATURE "git blame cache 1\n"
+
+static char *blame_cache_path(struct repository *r, const char *options,
+			      const struct object_id *commit, const char *path)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const char *hex;
+
+	r->hash_algo->init_fn(&ctx);
+	r->hash_algo->update_fn(&ctx, commit->hash, r->hash_algo->rawsz);
+	r->hash_algo->update_fn(&ctx, path, strlen(path) + 1);
+	r->hash_algo->update_fn(&ctx, options, strlen(options) + 1);
+	r->hash_algo->final_fn(hash, &ctx);
+	hex = hash_to_hex_algop(hash, r->hash_algo);
+
+	return repo_git_path(r, "blame-cache/%.2s/%s", hex, hex + 2);
+}
+
+struct cache_parser {
+	const char *p, *end;
+};
+
+static int parse_number(struct cache_parser *cp, int *value, char sep)
+{
+	char *ep;
+	unsigned long v;
+
+	if (cp->p >= cp->end || !isdigit(*cp->p))
+		return -1;
+	errno = 0;
+	v = strtoul(cp->p, &ep, 10);
+	if (errno || v > INT_MAX || ep >= cp->end || *ep != sep)
+		return -1;
+	*value = v;
+	cp->p = ep + 1;
+	return 0;
+}
+
+static int parse_oid(struct cache_parser *cp, struct repository *r,
+		     struct object_id *oid, char sep)
+{
+	const char *ep;
+
+	if (cp->end - cp->p <= r->hash_algo->hexsz ||
+	    parse_oid_hex_algop(cp->p, oid, &ep, r->hash_algo) ||
+	    *ep != sep)
+		return -1;
+	cp->p = ep + 1;
+	return 0;
+}
+
+/* "<len>:<bytes><sep>" */
+static int parse_string(struct cache_parser *cp, char **value, char sep)
+{
+	int len;
+
+	if (parse_number(cp, &len, ':') ||
+	    cp->end - cp->p <= len || cp->p[len] != sep)
+		return -1;
+	*value = xmemdupz(cp->p, len);
+	cp->p += len + 1;
+	return 0;
+}
+
+static void add_string(struct strbuf *sb, const char *value, char sep)
+{
+	strbuf_addf(sb, "%"PRIuMAX":%s%c", (uintmax_t)strlen(value), value, sep);
+}
+
+int blame_cache_read(struct repository *r, const char *options,
+		     const struct object_id *commit, const char *path,
+		     struct blame_cache *cache)
+{
+	char *filename = blame_cache_path(r, options, commit, path);
+	struct strbuf buf = STRBUF_INIT;
+	struct cache_parser cp;
+	struct object_id oid;
+	char *s_path = NULL, *s_options = NULL;
+	int i, nr, lno = 0, ret = -1;
+
+	if (strbuf_read_file(&buf, filename, 0) < 0)
+		goto out;
+	cp.p = buf.buf;
+	cp.end = buf.buf + buf.len;
+
+	if (!skip_prefix(cp.p, BLAME_CACHE_SIGNATURE, &cp.p) ||
+	    parse_oid(&cp, r, &oid, '\n') || !oideq(&oid, commit) ||
+	    parse_string(&cp, &s_path, '\n') || strcmp(s_path, path) ||
+	    parse_string(&cp, &s_options, '\n') || strcmp(s_options, options) ||
+	    parse_number(&cp, &nr, '\n'))
+		goto out;
+
+	for (i = 0; i < nr; i++) {
+		struct blame_cache_range *range = blame_cache_append(cache);
+		int boundary;
+
+		if (parse_number(&cp, &range->lno, ' ') ||
+		    parse_number(&cp, &range->num_lines, ' ') ||
+		    parse_number(&cp, &range->s_lno, ' ') ||
+		    parse_number(&cp, &boundary, ' ') ||
+		    parse_oid(&cp, r, &range->commit, ' ') ||
+		    parse_oid(&cp, r, &range->prev_commit, ' ') ||
+		    parse_string(&cp, &range->path, ' ') ||
+		    parse_string(&cp, &range->prev_path, '\n'))
+			goto out;
+		range->boundary = !!boundary;
+
+		/* the ranges must cover the file without gaps */
+		if (range->lno != lno || !range->num_lines)
+			goto out;
+		lno += range->num_lines;
+	}
+	if (cp.p != cp.end)
+		goto out;
+	ret = 0;
+
+out:
+	if (ret)
+		blame_cache_clear(cache);
+	free(s_path);
+	free(s_options);
+	strbuf_release(&buf);
+	free(filename);
+	return ret;
+}
+
+int blame_cache_write(struct repository *r, const char *options,
+		      const struct object_id *commit, const char *path,
+		      const struct blame_cache *cache)
+{
+	char *filename = blame_cache_path(r, options, commit, path);
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	int i, ret = -1;
+
+	strbuf_addstr(&buf, BLAME_CACHE_SIGNATURE);
+	strbuf_addf(&buf, "%s\n", oid_to_hex(commit));
+	add_string(&buf, path, '\n');
+	add_string(&buf, options, '\n');
+	strbuf_addf(&buf, "%d\n", cache->nr);
+	for (i = 0; i < cache->nr; i++) {
+		const struct blame_cache_range *range = &cache->range[i];
+
+		strbuf_addf(&buf, "%d %d %d %d %s ",
+			    range->lno, range->num_lines, range->s_lno,
+			    range->boundary, oid_to_hex(&range->commit));
+		strbuf_addf(&buf, "%s ", oid_to_hex(&range->prev_commit));
+		add_string(&buf, range->path, ' ');
+		add_string(&buf, range->prev_path ? range->prev_path : "", '\n');
+	}
+
+	if (safe_create_leading_directories(filename) ||
+	    hold_lock_file_for_update(&lk, filename, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lk)) {
+		rollback_lock_file(&lk);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	strbuf_release(&buf);
+	free(filename);
+	return ret;
+}
+
+struct blame_cache_range *blame_cache_append(struct blame_cache *cache)
+{
+	ALLOC_GROW(cache->range, cache->nr + 1, cache->alloc);
+	memset(&cache->range[cache->nr], 0, sizeof(cache->range[0]));
+	return &cache->range[cache->nr++];
+}
+
+void blame_cache_clear(struct blame_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->nr; i++) {
+		free(cache->range[i].path);
+		free(cache->range[i].prev_path);
+	}
+	FREE_AND_NULL(cache->range);
+	cache->nr = cache->alloc = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef BLAME_CACHE_H
+#define BLAME_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * The final blame of a whole file at a commit, as a list of ranges
+ * sorted by line number that together cover the whole file.  All line
+ * numbers are 0 based, as in blame.h.
+ */
+struct blame_cache_range {
+	/* the lines of the blamed file this range covers */
+	int lno, num_lines;
+
+	/* the commit and path these lines are blamed on */
+	struct object_id commit;
+	char *path;
+	int s_lno;
+	unsigned boundary : 1;
+
+	/* the preceding version of "path", if any (null oid if none) */
+	struct object_id prev_commit;
+	char *prev_path;
+};
+
+struct blame_cache {
+	struct blame_cache_range *range;
+	int nr, alloc;
+};
+
+#define BLAME_CACHE_INIT { 0 }
+
+/*
+ * Blame results are stored in $GIT_DIR/blame-cache/, keyed by the
+ * commit, the path and "options", a string describing everything else
+ * that may change the result.
+ */
+
+/*
+ * Read the cached blame of "path" at "commit" into "cache".  Returns 0
+ * on success, and -1 when there is none or it is not usable.
+ */
+int blame_cache_read(struct repository *r, const char *options,
+		     const struct object_id *commit, const char *path,
+		     struct blame_cache *cache);
+
+/* Store "cache" as the blame of "path" at "commit". */
+int blame_cache_write(struct repository *r, const char *options,
+		      const struct object_id *commit, const char *path,
+		      const struct blame_cache *cache);
+
+struct blame_cache_range *blame_cache_append(struct blame_cache *cache);
+void blame_cache_clear(struct blame_cache *cache);
+
+#endif /* BLAME_CACHE_H */
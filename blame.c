@@ -11,6 +11,10 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "blame-cache.h"
+#include "oid-array.h"
+#include "prio-queue.h"
+#include "promisor-remote.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -1014,6 +1018,67 @@ static void drop_origin_fingerprints(struct blame_origin *o)
  * Given an origin, prepare mmfile_t structure to be used by the
  * diff machinery
  */
+/*
+ * In a partial clone, the blobs blame needs are often all missing, and
+ * fetching them one at a time as we get to them costs a round trip
+ * each.  When we find the blob of "origin" missing, walk ahead in the
+ * history of its commit and fetch the versions of its path we are
+ * likely to need next together with it.
+ */
+#define BLAME_PREFETCH_COMMITS 1024
+#define BLAME_PREFETCH_BLOBS 512
+
+static int blob_is_missing(struct repository *r, const struct object_id *oid)
+{
+	return oid_object_info_extended(r, oid, NULL, OBJECT_INFO_FOR_PREFETCH);
+}
+
+static void prefetch_origin_blobs(struct repository *r,
+				  struct blame_origin *origin)
+{
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct oidset seen = OIDSET_INIT;
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	struct commit *commit;
+	int nr_commits = 0;
+
+	if (!(S_ISREG(origin->mode) || S_ISLNK(origin->mode)) ||
+	    !repo_has_promisor_remote(r) ||
+	    !blob_is_missing(r, &origin->blob_oid))
+		return;
+
+	oidset_insert(&seen, &origin->blob_oid);
+	oid_array_append(&to_fetch, &origin->blob_oid);
+
+	oidset_insert(&seen, &origin->commit->object.oid);
+	prio_queue_put(&queue, origin->commit);
+	while ((commit = prio_queue_get(&queue)) &&
+	       nr_commits++ < BLAME_PREFETCH_COMMITS &&
+	       to_fetch.nr < BLAME_PREFETCH_BLOBS) {
+		struct commit_list *parent;
+		struct object_id oid;
+		unsigned short mode;
+
+		if (repo_parse_commit(r, commit))
+			continue;
+		if (!get_tree_entry(r, get_commit_tree_oid(commit),
+				    origin->path, &oid, &mode) &&
+		    (S_ISREG(mode) || S_ISLNK(mode)) &&
+		    !oidset_insert(&seen, &oid) &&
+		    blob_is_missing(r, &oid))
+			oid_array_append(&to_fetch, &oid);
+
+		for (parent = commit->parents; parent; parent = parent->next)
+			if (!oidset_insert(&seen, &parent->item->object.oid))
+				prio_queue_put(&queue, parent->item);
+	}
+
+	promisor_remote_get_direct(r, to_fetch.oid, to_fetch.nr);
+	clear_prio_queue(&queue);
+	oidset_clear(&seen);
+	oid_array_clear(&to_fetch);
+}
+
 static void fill_origin_blob(struct diff_options *opt,
 			     struct blame_origin *o, mmfile_t *file,
 			     int *num_read_blob, int fill_fingerprints)
@@ -1023,6 +1088,7 @@ static void fill_origin_blob(struct diff_options *opt,
 		unsigned long file_size;
 
 		(*num_read_blob)++;
+		prefetch_origin_blobs(opt->repo, o);
 		if (opt->flags.allow_textconv &&
 		    textconv_object(opt->repo, o->path, o->mode,
 				    &o->blob_oid, 1, &file->ptr, &file_size))
@@ -1240,6 +1306,7 @@ static int fill_blob_sha1_and_mode(struct repository *r,
 		return 0;
 	if (get_tree_entry(r, &origin->commit->object.oid, origin->path, &origin->blob_oid, &origin->mode))
 		goto error_out;
+	prefetch_origin_blobs(r, origin);
 	if (oid_object_info(r, &origin->blob_oid, NULL) != OBJ_BLOB)
 		goto error_out;
 	return 0;
@@ -2582,6 +2649,146 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
  * to its parents. */
+static int find_cache_range(const struct blame_cache *cache, int lno)
+{
+	int lo = 0, hi = cache->nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		const struct blame_cache_range *range = &cache->range[mi];
+
+		if (lno < range->lno)
+			hi = mi;
+		else if (range->lno + range->num_lines <= lno)
+			lo = mi + 1;
+		else
+			return mi;
+	}
+	return -1;
+}
+
+/*
+ * If the final blame of the suspect's file is in the blame cache,
+ * ship all of the suspect's entries to the scoreboard, split by the
+ * cached ranges and blamed on their final origins, and return 1.
+ */
+static int blame_from_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *suspect)
+{
+	struct blame_cache cache = BLAME_CACHE_INIT;
+	struct commit **commits = NULL;
+	struct blame_entry *e, *next;
+	int i, ret = 0;
+
+	if (blame_cache_read(sb->repo, sb->cache_options,
+			     &suspect->commit->object.oid, suspect->path,
+			     &cache))
+		return 0;
+
+	/* make sure we can use it before touching anything */
+	for (e = suspect->suspects; e; e = e->next)
+		if (!cache.nr ||
+		    cache.range[cache.nr - 1].lno +
+		    cache.range[cache.nr - 1].num_lines < e->s_lno + e->num_lines)
+			goto out;
+	ALLOC_ARRAY(commits, cache.nr);
+	for (i = 0; i < cache.nr; i++) {
+		commits[i] = lookup_commit_reference_gently(sb->repo,
+							    &cache.range[i].commit, 1);
+		if (!commits[i] || parse_commit(commits[i]))
+			goto out;
+	}
+
+	for (e = suspect->suspects; e; e = next) {
+		int lno = e->s_lno, end = e->s_lno + e->num_lines;
+
+		next = e->next;
+		for (i = find_cache_range(&cache, lno); lno < end; i++) {
+			const struct blame_cache_range *range = &cache.range[i];
+			int num = range->lno + range->num_lines - lno;
+			struct blame_entry *n;
+			struct blame_origin *o;
+
+			if (lno + num > end)
+				num = end - lno;
+			o = get_origin(commits[i], range->path);
+			if (!o->previous && !is_null_oid(&range->prev_commit)) {
+				struct commit *prev;
+
+				prev = lookup_commit_reference_gently(sb->repo,
+								      &range->prev_commit, 1);
+				if (prev)
+					o->previous = get_origin(prev, range->prev_path);
+			}
+			if (range->boundary)
+				commits[i]->object.flags |= UNINTERESTING;
+			o->guilty = 1;
+
+			CALLOC_ARRAY(n, 1);
+			n->lno = e->lno + lno - e->s_lno;
+			n->num_lines = num;
+			n->suspect = o;
+			n->s_lno = range->s_lno + lno - range->lno;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(n, sb->found_guilty_entry_data);
+			n->next = sb->ent;
+			sb->ent = n;
+
+			lno += num;
+		}
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	suspect->suspects = NULL;
+	ret = 1;
+
+out:
+	free(commits);
+	blame_cache_clear(&cache);
+	return ret;
+}
+
+/*
+ * Store the final blame of the whole file, sorted and coalesced, in
+ * the blame cache.
+ */
+void write_blame_cache(struct blame_scoreboard *sb)
+{
+	struct blame_cache cache = BLAME_CACHE_INIT;
+	struct blame_entry *e;
+	int lno = 0;
+
+	if (!sb->cache_options || is_null_oid(&sb->final->object.oid))
+		return;
+
+	for (e = sb->ent; e; e = e->next) {
+		struct blame_cache_range *range;
+		struct blame_origin *o = e->suspect;
+
+		if (e->lno != lno)
+			goto out; /* not the whole file */
+		range = blame_cache_append(&cache);
+		range->lno = e->lno;
+		range->num_lines = e->num_lines;
+		oidcpy(&range->commit, &o->commit->object.oid);
+		range->path = xstrdup(o->path);
+		range->s_lno = e->s_lno;
+		range->boundary = !!(o->commit->object.flags & UNINTERESTING);
+		if (o->previous) {
+			oidcpy(&range->prev_commit, &o->previous->commit->object.oid);
+			range->prev_path = xstrdup(o->previous->path);
+		}
+		lno += e->num_lines;
+	}
+	if (lno != sb->num_lines)
+		goto out;
+
+	blame_cache_write(sb->repo, sb->cache_options,
+			  &sb->final->object.oid, sb->path, &cache);
+out:
+	blame_cache_clear(&cache);
+}
+
 void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
@@ -2608,7 +2815,11 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		 */
 		blame_origin_incref(suspect);
 		parse_commit(commit);
-		if (sb->reverse ||
+		if (sb->cache_options &&
+		    !(commit->object.flags & UNINTERESTING) &&
+		    blame_from_cache(sb, suspect))
+			; /* all of its lines are accounted for */
+		else if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
 		     !(revs->max_age != -1 && commit->date < revs->max_age)))
 			pass_blame(sb, suspect, opt);
@@ -153,6 +153,13 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/*
+	 * When not NULL, final blames of whole files may be taken from
+	 * and stored in the blame cache; this describes the options
+	 * the results depend on (see blame-cache.h).
+	 */
+	const char *cache_options;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
@@ -177,6 +184,7 @@ void blame_coalesce(struct blame_scoreboard *sb);
 void blame_sort_final(struct blame_scoreboard *sb);
 unsigned blame_entry_score(struct blame_scoreboard *sb, struct blame_entry *e);
 void assign_blame(struct blame_scoreboard *sb, int opt);
+void write_blame_cache(struct blame_scoreboard *sb);
 const char *blame_nth_line(struct blame_scoreboard *sb, long lno);
 
 void init_scoreboard(struct blame_scoreboard *sb);
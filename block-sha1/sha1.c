@@ -10,6 +10,7 @@
 #include "../git-compat-util.h"
 
 #include "sha1.h"
+#include "../hash-accel.h"
 
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
@@ -203,6 +204,18 @@ void blk_SHA1_Init(blk_SHA_CTX *ctx)
 	ctx->H[4] = 0xc3d2e1f0;
 }
 
+static void blk_SHA1_Blocks(blk_SHA_CTX *ctx, const void *data, size_t nr)
+{
+	sha1_blocks_fn accel = sha1_accel_blocks();
+
+	if (accel) {
+		accel((uint32_t *)ctx->H, data, nr);
+		return;
+	}
+	for (; nr; nr--, data = (const char *)data + 64)
+		blk_SHA1_Block(ctx, data);
+}
+
 void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, size_t len)
 {
 	unsigned int lenW = ctx->size & 63;
@@ -220,12 +233,12 @@ void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, size_t len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return;
-		blk_SHA1_Block(ctx, ctx->W);
+		blk_SHA1_Blocks(ctx, ctx->W, 1);
 	}
-	while (len >= 64) {
-		blk_SHA1_Block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		blk_SHA1_Blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~(size_t)63));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
@@ -1,7 +1,6 @@
 #include "git-compat-util.h"
 #include "bloom.h"
 #include "diff.h"
-#include "diffcore.h"
 #include "revision.h"
 #include "hashmap.h"
 #include "commit-graph.h"
@@ -10,6 +9,7 @@
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
 static struct bloom_filter_slab bloom_filters;
+static struct bloom_filter_slab merge_bloom_filters;
 
 struct pathmap_hash_entry {
     struct hashmap_entry entry;
@@ -59,6 +59,35 @@ static int load_bloom_filter_from_graph(struct commit_graph *g,
 	return 1;
 }
 
+static int load_merge_bloom_filter_from_graph(struct commit_graph *g,
+					      struct bloom_filter *filter,
+					      struct commit *c)
+{
+	uint32_t lex_pos, start_index, end_index;
+	uint32_t graph_pos = commit_graph_position(c);
+
+	while (graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	if (!g->chunk_bloom_merge_indexes)
+		return 0;
+
+	lex_pos = graph_pos - g->num_commits_in_base;
+
+	end_index = get_be32(g->chunk_bloom_merge_indexes + 4 * lex_pos);
+
+	if (lex_pos > 0)
+		start_index = get_be32(g->chunk_bloom_merge_indexes + 4 * (lex_pos - 1));
+	else
+		start_index = 0;
+
+	filter->len = end_index - start_index;
+	filter->data = (unsigned char *)(g->chunk_bloom_merge_data +
+					sizeof(unsigned char) * start_index);
+
+	return 1;
+}
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -144,6 +173,47 @@ void clear_bloom_key(struct bloom_key *key)
 	FREE_AND_NULL(key->hashes);
 }
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	const char *p;
+	size_t count = 1;
+
+	/*
+	 * At this point, the path is normalized to use Unix-style path
+	 * separators. This is required due to how the changed-path Bloom
+	 * filters store the paths.
+	 */
+	for (p = path; p < path + len; p++)
+		if (*p == '/')
+			count++;
+
+	vec = xcalloc(1, st_add(sizeof(*vec),
+				st_mult(sizeof(struct bloom_key), count)));
+	vec->count = count;
+
+	fill_bloom_key(path, len, &vec->key[0], settings);
+	count = 1;
+	for (p = path + len - 1; p > path; p--)
+		if (*p == '/')
+			fill_bloom_key(path, p - path, &vec->key[count++],
+				       settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	size_t i;
+
+	if (!vec)
+		return;
+	for (i = 0; i < vec->count; i++)
+		clear_bloom_key(&vec->key[i]);
+	free(vec);
+}
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings)
@@ -162,6 +232,7 @@ void add_key_to_filter(const struct bloom_key *key,
 void init_bloom_filters(void)
 {
 	init_bloom_filter_slab(&bloom_filters);
+	init_bloom_filter_slab(&merge_bloom_filters);
 }
 
 static int pathmap_cmp(const void *hashmap_cmp_fn_data,
@@ -184,94 +255,136 @@ static void init_truncated_large_filter(struct bloom_filter *filter)
 	filter->len = 1;
 }
 
-struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
-						 struct commit *c,
-						 int compute_if_not_present,
-						 const struct bloom_filter_settings *settings,
-						 enum bloom_filter_computed *computed)
+/*
+ * Collects the changed paths of a tree diff (and their leading
+ * directories) for compute_bloom_filter(). The diff machinery's global
+ * queue is not used, so that filters can be computed by several threads
+ * at once.
+ */
+struct bloom_diff_data {
+	struct hashmap pathmap;
+	int nr_changes;
+	int max_changes;
+};
+
+static void bloom_diff_add_path(struct diff_options *opt, const char *fullpath)
 {
-	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
+	struct bloom_diff_data *data = opt->change_fn_data;
+	struct pathmap_hash_entry *e;
+	char *path, *to_free;
+
+	if (++data->nr_changes > data->max_changes) {
+		/* The filter will be truncated anyway; stop the tree walk. */
+		opt->flags.has_changes = 1;
+		return;
+	}
 
-	if (computed)
-		*computed = BLOOM_NOT_COMPUTED;
+	path = to_free = xstrdup(fullpath);
 
-	if (!bloom_filters.slab_size)
-		return NULL;
+	/*
+	 * Add each leading directory of the changed file, i.e. for
+	 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
+	 * the Bloom filter could be used to speed up commands like
+	 * 'git log dir/subdir', too.
+	 *
+	 * Note that directories are added without the trailing '/'.
+	 */
+	do {
+		char *last_slash = strrchr(path, '/');
 
-	filter = bloom_filter_slab_at(&bloom_filters, c);
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->entry, strhash(path));
 
-	if (!filter->data) {
-		load_commit_graph_info(r, c);
-		if (commit_graph_position(c) != COMMIT_NOT_FROM_GRAPH)
-			load_bloom_filter_from_graph(r->objects->commit_graph, filter, c);
-	}
+		if (!hashmap_get(&data->pathmap, &e->entry, NULL))
+			hashmap_add(&data->pathmap, &e->entry);
+		else
+			free(e);
 
-	if (filter->data && filter->len)
-		return filter;
-	if (!compute_if_not_present)
-		return NULL;
+		if (!last_slash)
+			last_slash = path;
+		*last_slash = '\0';
+
+	} while (*path);
+
+	free(to_free);
+}
+
+static void bloom_diff_change(struct diff_options *opt,
+			      unsigned old_mode, unsigned new_mode,
+			      const struct object_id *old_oid,
+			      const struct object_id *new_oid,
+			      int old_oid_valid, int new_oid_valid,
+			      const char *fullpath,
+			      unsigned old_dirty_submodule,
+			      unsigned new_dirty_submodule)
+{
+	bloom_diff_add_path(opt, fullpath);
+}
+
+static void bloom_diff_add_remove(struct diff_options *opt,
+				  int addremove, unsigned mode,
+				  const struct object_id *oid,
+				  int oid_valid,
+				  const char *fullpath,
+				  unsigned dirty_submodule)
+{
+	bloom_diff_add_path(opt, fullpath);
+}
+
+/*
+ * Fill "filter" with the paths changed in "c" relative to its first
+ * parent or, with "merge", relative to any of its other parents.
+ */
+static void fill_bloom_filter(struct repository *r,
+			      struct commit *c,
+			      struct bloom_filter *filter,
+			      int merge,
+			      const struct bloom_filter_settings *settings,
+			      enum bloom_filter_computed *computed)
+{
+	struct diff_options diffopt;
+	struct bloom_diff_data data;
 
 	repo_diff_setup(r, &diffopt);
 	diffopt.flags.recursive = 1;
+	diffopt.flags.quick = 1;
+	/* each filter is computed once, and we may be one of several threads */
+	diffopt.flags.no_tree_diff_cache = 1;
 	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
+	diffopt.change = bloom_diff_change;
+	diffopt.add_remove = bloom_diff_add_remove;
+	diffopt.change_fn_data = &data;
 	diff_setup_done(&diffopt);
 
+	hashmap_init(&data.pathmap, pathmap_cmp, NULL, 0);
+	data.nr_changes = 0;
+	data.max_changes = settings->max_changed_paths;
+
 	/* ensure commit is parsed so we have parent information */
 	repo_parse_commit(r, c);
 
-	if (c->parents)
+	if (merge) {
+		struct commit_list *p;
+
+		for (p = c->parents ? c->parents->next : NULL;
+		     p && data.nr_changes <= data.max_changes;
+		     p = p->next)
+			diff_tree_oid(&p->item->object.oid, &c->object.oid, "", &diffopt);
+	} else if (c->parents)
 		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
 	else
 		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
 
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
-		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
+	if (data.nr_changes > settings->max_changed_paths ||
+	    hashmap_get_size(&data.pathmap) > settings->max_changed_paths) {
+		init_truncated_large_filter(filter);
+		if (computed)
+			*computed |= BLOOM_TRUNC_LARGE;
+	} else {
 		struct pathmap_hash_entry *e;
 		struct hashmap_iter iter;
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		}
-
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
-			init_truncated_large_filter(filter);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
-			goto cleanup;
-		}
-
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+		filter->len = (hashmap_get_size(&data.pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
 		if (!filter->len) {
 			if (computed)
 				*computed |= BLOOM_TRUNC_EMPTY;
@@ -279,33 +392,123 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		}
 		CALLOC_ARRAY(filter->data, filter->len);
 
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
+		hashmap_for_each_entry(&data.pathmap, &iter, e, entry) {
 			struct bloom_key key;
 			fill_bloom_key(e->path, strlen(e->path), &key, settings);
 			add_key_to_filter(&key, filter, settings);
 			clear_bloom_key(&key);
 		}
-
-	cleanup:
-		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
-	} else {
-		for (i = 0; i < diff_queued_diff.nr; i++)
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		init_truncated_large_filter(filter);
-
-		if (computed)
-			*computed |= BLOOM_TRUNC_LARGE;
 	}
 
 	if (computed)
 		*computed |= BLOOM_COMPUTED;
 
-	free(diff_queued_diff.queue);
-	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	hashmap_clear_and_free(&data.pathmap, struct pathmap_hash_entry, entry);
+}
 
+struct bloom_filter *compute_bloom_filter(struct repository *r,
+					  struct commit *c,
+					  const struct bloom_filter_settings *settings,
+					  enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	/*
+	 * Only look up the slot; get_or_compute_bloom_filter() has
+	 * allocated it already, and the slab may not grow under other
+	 * threads' feet.
+	 */
+	filter = bloom_filter_slab_peek(&bloom_filters, c);
+	if (!filter)
+		BUG("computing Bloom filter for unknown commit %s",
+		    oid_to_hex(&c->object.oid));
+
+	fill_bloom_filter(r, c, filter, 0, settings, computed);
 	return filter;
 }
 
+struct bloom_filter *compute_merge_bloom_filter(struct repository *r,
+						struct commit *c,
+						const struct bloom_filter_settings *settings,
+						enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	filter = bloom_filter_slab_peek(&merge_bloom_filters, c);
+	if (!filter)
+		BUG("computing merge Bloom filter for unknown commit %s",
+		    oid_to_hex(&c->object.oid));
+
+	fill_bloom_filter(r, c, filter, 1, settings, computed);
+	return filter;
+}
+
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!bloom_filters.slab_size)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+
+	if (!filter->data) {
+		load_commit_graph_info(r, c);
+		if (commit_graph_position(c) != COMMIT_NOT_FROM_GRAPH)
+			load_bloom_filter_from_graph(r->objects->commit_graph, filter, c);
+	}
+
+	if (filter->data && filter->len)
+		return filter;
+	if (!compute_if_not_present)
+		return NULL;
+
+	return compute_bloom_filter(r, c, settings, computed);
+}
+
+struct bloom_filter *get_or_compute_merge_bloom_filter(struct repository *r,
+						       struct commit *c,
+						       int compute_if_not_present,
+						       const struct bloom_filter_settings *settings,
+						       enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!merge_bloom_filters.slab_size)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&merge_bloom_filters, c);
+
+	if (!filter->data) {
+		load_commit_graph_info(r, c);
+		if (commit_graph_position(c) != COMMIT_NOT_FROM_GRAPH)
+			load_merge_bloom_filter_from_graph(r->objects->commit_graph, filter, c);
+	}
+
+	if (filter->data && filter->len)
+		return filter;
+	if (!compute_if_not_present)
+		return NULL;
+
+	return compute_merge_bloom_filter(r, c, settings, computed);
+}
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings)
@@ -325,3 +528,16 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 
 	return 1;
 }
+
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings)
+{
+	int ret = 1;
+	size_t i;
+
+	for (i = 0; ret > 0 && i < vec->count; i++)
+		ret = bloom_filter_contains(filter, &vec->key[i], settings);
+
+	return ret;
+}
@@ -83,6 +83,24 @@ void fill_bloom_key(const char *data,
 		    const struct bloom_filter_settings *settings);
 void clear_bloom_key(struct bloom_key *key);
 
+/*
+ * A bloom_keyvec holds the keys of a path and of each of its leading
+ * directories, e.g. "a/b/c", "a/b" and "a". A filter can only contain
+ * a change to the path if it contains all of them.
+ */
+struct bloom_keyvec {
+	size_t count;
+	struct bloom_key key[FLEX_ARRAY];
+};
+
+/*
+ * Create a bloom_keyvec for the "len" bytes of "path", which must not
+ * end with a slash.
+ */
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings);
@@ -102,11 +120,53 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 const struct bloom_filter_settings *settings,
 						 enum bloom_filter_computed *computed);
 
+/*
+ * Compute the changed-path Bloom filter of "c" from a diff against its
+ * first parent, replacing whatever the slot holds. The commit must have
+ * been looked up with get_or_compute_bloom_filter() before (which
+ * allocates its slot) and must already be parsed. With object reading
+ * protected by enable_obj_read_lock(), several threads may compute the
+ * filters of different commits at the same time.
+ */
+struct bloom_filter *compute_bloom_filter(struct repository *r,
+					  struct commit *c,
+					  const struct bloom_filter_settings *settings,
+					  enum bloom_filter_computed *computed);
+
 #define get_bloom_filter(r, c) get_or_compute_bloom_filter( \
 	(r), (c), 0, NULL, NULL)
 
+/*
+ * Like get_or_compute_bloom_filter() and compute_bloom_filter(), but
+ * for the filter of the paths a merge commit changes relative to any
+ * of its parents but the first, i.e. of the union of the diffs against
+ * its second and later parents. A commit that does not contain a path
+ * in that filter is TREESAME to all of these parents for that path.
+ */
+struct bloom_filter *get_or_compute_merge_bloom_filter(struct repository *r,
+						       struct commit *c,
+						       int compute_if_not_present,
+						       const struct bloom_filter_settings *settings,
+						       enum bloom_filter_computed *computed);
+struct bloom_filter *compute_merge_bloom_filter(struct repository *r,
+						struct commit *c,
+						const struct bloom_filter_settings *settings,
+						enum bloom_filter_computed *computed);
+
+#define get_merge_bloom_filter(r, c) get_or_compute_merge_bloom_filter( \
+	(r), (c), 0, NULL, NULL)
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Like bloom_filter_contains(), but check all the keys of "vec": return
+ * 1 if the filter may contain all of them, 0 if it definitely does
+ * not, and -1 if the filter is empty.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings);
+
 #endif
@@ -111,6 +111,16 @@ void setup_auto_pager(const char *cmd, int def);
 
 int is_builtin(const char *s);
 
+/**
+ * Run the built-in named by `argv[0]` in a process where the repository
+ * has been set up already, as if from the subdirectory `prefix` of its
+ * worktree (NULL for the top), and return its exit code. This is how
+ * `git command--daemon` runs the commands of its clients. Only the
+ * built-ins that would set up the repository themselves can be run this
+ * way; for the others, an error is reported and -1 returned.
+ */
+int run_set_up_builtin(int argc, const char **argv, const char *prefix);
+
 int cmd_add(int argc, const char **argv, const char *prefix);
 int cmd_am(int argc, const char **argv, const char *prefix);
 int cmd_annotate(int argc, const char **argv, const char *prefix);
@@ -137,6 +147,7 @@ int cmd_column(int argc, const char **argv, const char *prefix);
 int cmd_commit(int argc, const char **argv, const char *prefix);
 int cmd_commit_graph(int argc, const char **argv, const char *prefix);
 int cmd_commit_tree(int argc, const char **argv, const char *prefix);
+int cmd_command__daemon(int argc, const char **argv, const char *prefix);
 int cmd_config(int argc, const char **argv, const char *prefix);
 int cmd_count_objects(int argc, const char **argv, const char *prefix);
 int cmd_credential(int argc, const char **argv, const char *prefix);
@@ -159,6 +170,7 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix);
 int cmd_for_each_repo(int argc, const char **argv, const char *prefix);
 int cmd_format_patch(int argc, const char **argv, const char *prefix);
 int cmd_fsck(int argc, const char **argv, const char *prefix);
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix);
 int cmd_gc(int argc, const char **argv, const char *prefix);
 int cmd_get_tar_commit_id(int argc, const char **argv, const char *prefix);
 int cmd_grep(int argc, const char **argv, const char *prefix);
@@ -55,6 +55,7 @@ static char repeated_meta_color[COLOR_MAXLEN];
 static int coloring_mode;
 static struct string_list ignore_revs_file_list = STRING_LIST_INIT_NODUP;
 static int mark_unblamable_lines;
+static int use_blame_cache;
 static int mark_ignored_lines;
 
 static struct date_mode blame_date_mode = { DATE_ISO8601 };
@@ -681,6 +682,26 @@ static const char *add_prefix(const char *prefix, const char *path)
 	return prefix_path(prefix, prefix ? strlen(prefix) : 0, path);
 }
 
+/*
+ * The blame cache stores the blame of whole files all the way back to
+ * the root commits; anything that stops the walk early or makes it see
+ * history differently would make its contents wrong.
+ */
+static int can_use_blame_cache(struct blame_scoreboard *sb, int opt,
+			       const char *revs_file)
+{
+	int i;
+
+	if (sb->reverse || opt || revs_file ||
+	    oidset_size(&sb->ignore_list) ||
+	    sb->revs->max_age != -1)
+		return 0;
+	for (i = 0; i < sb->revs->pending.nr; i++)
+		if (sb->revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 0;
+	return 1;
+}
+
 static int git_blame_config(const char *var, const char *value, void *cb)
 {
 	if (!strcmp(var, "blame.showroot")) {
@@ -715,6 +736,10 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		string_list_insert(&ignore_revs_file_list, str);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.markunblamablelines")) {
 		mark_unblamable_lines = git_config_bool(var, value);
 		return 0;
@@ -904,6 +929,10 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	setup_default_color_by_age();
 	git_config(git_blame_config, &output_option);
+
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
+
 	repo_init_revisions(the_repository, &revs, NULL);
 	revs.date_mode = blame_date_mode;
 	revs.diffopt.flags.allow_textconv = 1;
@@ -1085,6 +1114,12 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	build_ignorelist(&sb, &ignore_revs_file_list, &ignore_rev_list);
 	string_list_clear(&ignore_revs_file_list, 0);
 	string_list_clear(&ignore_rev_list, 0);
+	if (use_blame_cache && can_use_blame_cache(&sb, opt, revs_file))
+		sb.cache_options = xstrfmt("xdl=%d root=%d follow=%d first-parent=%d textconv=%d",
+					   xdl_opts, show_root,
+					   !no_whole_file_rename,
+					   revs.first_parent_only,
+					   revs.diffopt.flags.allow_textconv);
 	setup_scoreboard(&sb, &o);
 
 	/*
@@ -1169,6 +1204,8 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	blame_coalesce(&sb);
 
+	write_blame_cache(&sb);
+
 	if (!(output_option & (OUTPUT_COLOR_LINE | OUTPUT_SHOW_AGE_WITH_COLOR)))
 		output_option |= coloring_mode;
 
@@ -1185,6 +1222,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	output(&sb, output_option);
 	free((void *)sb.final_buf);
+	free((char *)sb.cache_options);
 	for (ent = sb.ent; ent; ) {
 		struct blame_entry *e = ent->next;
 		free(ent);
@@ -13,6 +13,7 @@
 #include "streaming.h"
 #include "tree-walk.h"
 #include "oid-array.h"
+#include "pack-oidset.h"
 #include "packfile.h"
 #include "object-store.h"
 #include "promisor-remote.h"
@@ -380,61 +381,279 @@ static void batch_object_write(const char *obj_name,
 	}
 }
 
-static void batch_one_object(const char *obj_name,
-			     struct strbuf *scratch,
-			     struct batch_options *opt,
-			     struct expand_data *data)
+/*
+ * Resolve "obj_name" into "oid".  If it does not name an object that
+ * is to be shown, describe why in "msg" and return -1.
+ */
+static int batch_resolve_name(const char *obj_name, struct batch_options *opt,
+			      struct object_id *oid, struct strbuf *msg)
 {
 	struct object_context ctx;
 	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
 	enum get_oid_result result;
 
 	result = get_oid_with_context(the_repository, obj_name,
-				      flags, &data->oid, &ctx);
+				      flags, oid, &ctx);
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
-			printf("%s missing\n", obj_name);
+			strbuf_addf(msg, "%s missing\n", obj_name);
 			break;
 		case SHORT_NAME_AMBIGUOUS:
-			printf("%s ambiguous\n", obj_name);
+			strbuf_addf(msg, "%s ambiguous\n", obj_name);
 			break;
 		case DANGLING_SYMLINK:
-			printf("dangling %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(msg, "dangling %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case SYMLINK_LOOP:
-			printf("loop %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(msg, "loop %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case NOT_DIR:
-			printf("notdir %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(msg, "notdir %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		default:
 			BUG("unknown get_sha1_with_context result %d\n",
 			       result);
 			break;
 		}
-		fflush(stdout);
-		return;
+		return -1;
 	}
 
 	if (ctx.mode == 0) {
-		printf("symlink %"PRIuMAX"\n%s\n",
-		       (uintmax_t)ctx.symlink_path.len,
-		       ctx.symlink_path.buf);
+		strbuf_addf(msg, "symlink %"PRIuMAX"\n%s\n",
+			    (uintmax_t)ctx.symlink_path.len,
+			    ctx.symlink_path.buf);
+		strbuf_release(&ctx.symlink_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void batch_one_object(const char *obj_name,
+			     struct strbuf *scratch,
+			     struct batch_options *opt,
+			     struct expand_data *data)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (batch_resolve_name(obj_name, opt, &data->oid, &msg)) {
+		fputs(msg.buf, stdout);
 		fflush(stdout);
+		strbuf_release(&msg);
 		return;
 	}
 
 	batch_object_write(obj_name, scratch, opt, data);
 }
 
+/*
+ * With --buffer, the caller does not wait for the answer to one
+ * request before sending the next one, so we are free to read a
+ * number of requests ahead.  The objects of such a group are looked
+ * up in the order of their place in the packs, which turns random
+ * reads into mostly sequential ones, and small objects are read in
+ * that order too when their contents are wanted.  The answers are
+ * still written in the order of the requests.
+ */
+#define BATCH_READAHEAD_DEFAULT 4096
+#define BATCH_PRELOAD_LIMIT (32 * 1024 * 1024)
+
+struct batch_request {
+	char *name;
+	struct expand_data data;
+	struct pack_entry e;
+	unsigned found : 1,
+		 missing : 1;
+	struct strbuf msg;
+	void *contents;
+	unsigned long contents_size;
+};
+
+static void batch_request_init(struct batch_request *req,
+			       const struct expand_data *tmpl,
+			       struct batch_options *opt)
+{
+	memset(req, 0, sizeof(*req));
+	req->data = *tmpl;
+	/* point the object_info at our own copy of the fields */
+	if (tmpl->info.typep)
+		req->data.info.typep = &req->data.type;
+	/* the size also tells batch_preload() what it can afford */
+	if (tmpl->info.sizep || opt->print_contents)
+		req->data.info.sizep = &req->data.size;
+	if (tmpl->info.disk_sizep)
+		req->data.info.disk_sizep = &req->data.disk_size;
+	if (tmpl->info.delta_base_oid)
+		req->data.info.delta_base_oid = &req->data.delta_base_oid;
+	strbuf_init(&req->msg, 0);
+}
+
+static int compare_batch_requests(const void *va, const void *vb)
+{
+	const struct batch_request *a = *(const struct batch_request **)va;
+	const struct batch_request *b = *(const struct batch_request **)vb;
+
+	/* loose objects last */
+	if (!a->e.p || !b->e.p)
+		return !a->e.p - !b->e.p;
+	if (a->e.p != b->e.p)
+		return (uintptr_t)a->e.p < (uintptr_t)b->e.p ? -1 : 1;
+	if (a->e.offset != b->e.offset)
+		return a->e.offset < b->e.offset ? -1 : 1;
+	return 0;
+}
+
+static void batch_preload(struct batch_options *opt,
+			  struct batch_request **sorted, size_t nr)
+{
+	size_t budget = BATCH_PRELOAD_LIMIT;
+	size_t i;
+
+	/* converted contents and large blobs are produced when written */
+	if (!opt->print_contents || opt->cmdmode)
+		return;
+
+	for (i = 0; i < nr; i++) {
+		struct batch_request *req = sorted[i];
+		enum object_type type;
+
+		if (req->missing || req->data.size >= budget ||
+		    (req->data.type == OBJ_BLOB &&
+		     req->data.size > big_file_threshold))
+			continue;
+		req->contents = read_object_file(&req->data.oid, &type,
+						 &req->contents_size);
+		if (!req->contents)
+			continue;
+		if (type != req->data.type ||
+		    req->contents_size != req->data.size) {
+			/* let the usual checks complain */
+			FREE_AND_NULL(req->contents);
+			continue;
+		}
+		budget -= req->contents_size;
+	}
+}
+
+static void batch_request_write(struct batch_request *req,
+				struct strbuf *scratch,
+				struct batch_options *opt)
+{
+	if (!req->found) {
+		fputs(req->msg.buf, stdout);
+		fflush(stdout);
+		return;
+	}
+	if (req->missing) {
+		printf("%s missing\n", req->name);
+		fflush(stdout);
+		return;
+	}
+
+	strbuf_reset(scratch);
+	strbuf_expand(scratch, opt->format, expand_format, &req->data);
+	strbuf_addch(scratch, '\n');
+	batch_write(opt, scratch->buf, scratch->len);
+
+	if (opt->print_contents) {
+		if (req->contents)
+			batch_write(opt, req->contents, req->contents_size);
+		else
+			print_object_or_die(opt, &req->data);
+		batch_write(opt, "\n", 1);
+	}
+}
+
+static int batch_objects_readahead(struct batch_options *opt,
+				   struct expand_data *tmpl,
+				   struct strbuf *output)
+{
+	size_t readahead = git_env_ulong("GIT_TEST_CAT_FILE_READAHEAD",
+					 BATCH_READAHEAD_DEFAULT);
+	struct batch_request *reqs;
+	struct batch_request **sorted;
+	struct strbuf input = STRBUF_INIT;
+	int eof = 0;
+
+	if (!readahead)
+		readahead = 1;
+	CALLOC_ARRAY(reqs, readahead);
+	ALLOC_ARRAY(sorted, readahead);
+
+	while (!eof) {
+		size_t nr = 0, sorted_nr = 0, i;
+
+		while (nr < readahead) {
+			struct batch_request *req = &reqs[nr];
+
+			if (strbuf_getline(&input, stdin) == EOF) {
+				eof = 1;
+				break;
+			}
+			batch_request_init(req, tmpl, opt);
+			req->name = strbuf_detach(&input, NULL);
+			if (tmpl->split_on_whitespace) {
+				char *p = strpbrk(req->name, " \t");
+				if (p) {
+					while (*p && strchr(" \t", *p))
+						*p++ = '\0';
+				}
+				req->data.rest = p;
+			}
+			nr++;
+		}
+
+		for (i = 0; i < nr; i++) {
+			struct batch_request *req = &reqs[i];
+
+			if (batch_resolve_name(req->name, opt,
+					       &req->data.oid, &req->msg))
+				continue;
+			req->found = 1;
+			if (!find_pack_entry(the_repository, &req->data.oid,
+					     &req->e))
+				req->e.p = NULL;
+			sorted[sorted_nr++] = req;
+		}
+		QSORT(sorted, sorted_nr, compare_batch_requests);
+
+		if (!tmpl->skip_object_info) {
+			for (i = 0; i < sorted_nr; i++) {
+				struct batch_request *req = sorted[i];
+
+				if (oid_object_info_extended(the_repository,
+							     &req->data.oid,
+							     &req->data.info,
+							     OBJECT_INFO_LOOKUP_REPLACE) < 0)
+					req->missing = 1;
+			}
+		}
+		batch_preload(opt, sorted, sorted_nr);
+
+		for (i = 0; i < nr; i++) {
+			struct batch_request *req = &reqs[i];
+
+			batch_request_write(req, output, opt);
+			free(req->contents);
+			free(req->name);
+			strbuf_release(&req->msg);
+		}
+	}
+
+	strbuf_release(&input);
+	free(reqs);
+	free(sorted);
+	return 0;
+}
+
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
-	struct oidset *seen;
+	struct pack_oidset *seen;
 	struct strbuf *scratch;
 };
 
@@ -467,7 +686,7 @@ static int batch_unordered_object(const struct object_id *oid, void *vdata)
 {
 	struct object_cb_data *data = vdata;
 
-	if (oidset_insert(data->seen, oid))
+	if (pack_oidset_insert(data->seen, oid))
 		return 0;
 
 	return batch_object_cb(oid, data);
@@ -483,9 +702,14 @@ static int batch_unordered_loose(const struct object_id *oid,
 static int batch_unordered_packed(const struct object_id *oid,
 				  struct packed_git *pack,
 				  uint32_t pos,
-				  void *data)
+				  void *vdata)
 {
-	return batch_unordered_object(oid, data);
+	struct object_cb_data *data = vdata;
+
+	if (pack_oidset_insert_packed(data->seen, oid, pack, pos))
+		return 0;
+
+	return batch_object_cb(oid, data);
 }
 
 static int batch_objects(struct batch_options *opt)
@@ -534,15 +758,16 @@ static int batch_objects(struct batch_options *opt)
 		cb.scratch = &output;
 
 		if (opt->unordered) {
-			struct oidset seen = OIDSET_INIT;
+			struct pack_oidset seen;
 
+			pack_oidset_init(&seen, the_repository);
 			cb.seen = &seen;
 
 			for_each_loose_object(batch_unordered_loose, &cb, 0);
 			for_each_packed_object(batch_unordered_packed, &cb,
 					       FOR_EACH_OBJECT_PACK_ORDER);
 
-			oidset_clear(&seen);
+			pack_oidset_clear(&seen);
 		} else {
 			struct oid_array sa = OID_ARRAY_INIT;
 
@@ -568,6 +793,13 @@ static int batch_objects(struct batch_options *opt)
 	save_warning = warn_on_object_refname_ambiguity;
 	warn_on_object_refname_ambiguity = 0;
 
+	if (opt->buffer_output) {
+		retval = batch_objects_readahead(opt, &data, &output);
+		strbuf_release(&output);
+		warn_on_object_refname_ambiguity = save_warning;
+		return retval;
+	}
+
 	while (strbuf_getline(&input, stdin) != EOF) {
 		if (data.split_on_whitespace) {
 			/*
@@ -4,6 +4,7 @@
 #include "parallel-checkout.h"
 #include "parse-options.h"
 #include "pkt-line.h"
+#include "strmap.h"
 
 static void packet_to_pc_item(const char *buffer, int len,
 			      struct parallel_checkout_item *pc_item)
@@ -19,7 +20,8 @@ static void packet_to_pc_item(const char *buffer, int len,
 	fixed_portion = (struct pc_item_fixed_portion *)buffer;
 
 	if (len - sizeof(struct pc_item_fixed_portion) !=
-		fixed_portion->name_len + fixed_portion->working_tree_encoding_len)
+		fixed_portion->name_len + fixed_portion->working_tree_encoding_len +
+		fixed_portion->driver_len)
 		BUG("checkout worker received corrupted item");
 
 	variant = buffer + sizeof(struct pc_item_fixed_portion);
@@ -39,6 +41,16 @@ static void packet_to_pc_item(const char *buffer, int len,
 	}
 
 	memset(pc_item, 0, sizeof(*pc_item));
+	if (fixed_portion->driver_len) {
+		char *driver = xmemdupz(variant, fixed_portion->driver_len);
+
+		if (convert_attrs_set_driver(&pc_item->ca, driver))
+			die("checkout worker: filter driver '%s' is not configured",
+			    driver);
+		free(driver);
+		variant += fixed_portion->driver_len;
+	}
+
 	pc_item->ce = make_empty_transient_cache_entry(fixed_portion->name_len, NULL);
 	pc_item->ce->ce_namelen = fixed_portion->name_len;
 	pc_item->ce->ce_mode = fixed_portion->ce_mode;
@@ -74,12 +86,79 @@ static void release_pc_item_data(struct parallel_checkout_item *pc_item)
 {
 	free((char *)pc_item->ca.working_tree_encoding);
 	discard_cache_entry(pc_item->ce);
+	pc_item->ce = NULL;
+}
+
+/*
+ * Ask the filters that delayed some of the items for them until they
+ * have none left, as finish_delayed_checkout() does, and report each
+ * item once it is written.
+ */
+static void finish_delayed_items(struct checkout *state,
+				 struct parallel_checkout_item *items,
+				 size_t nr)
+{
+	struct delayed_checkout *dco = state->delayed_checkout;
+	struct string_list_item *filter, *path;
+	struct strmap delayed = STRMAP_INIT;
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		if (items[i].status == PC_ITEM_DELAYED)
+			strmap_put(&delayed, items[i].ce->name, &items[i]);
+
+	dco->state = CE_RETRY;
+	while (dco->filters.nr > 0) {
+		for_each_string_list_item(filter, &dco->filters) {
+			struct string_list available_paths = STRING_LIST_INIT_NODUP;
+
+			if (!async_query_available_blobs(filter->string,
+							 &available_paths) ||
+			    !available_paths.nr) {
+				/* the filter is done, or failed */
+				filter->string = "";
+				continue;
+			}
+
+			for_each_string_list_item(path, &available_paths) {
+				struct parallel_checkout_item *pc_item;
+
+				pc_item = strmap_get(&delayed, path->string);
+				if (!pc_item ||
+				    pc_item->status != PC_ITEM_DELAYED) {
+					error("external filter '%s' signaled that '%s' "
+					      "is now available although it has not been "
+					      "delayed earlier",
+					      filter->string, path->string);
+					filter->string = "";
+					continue;
+				}
+				string_list_remove(&dco->paths, path->string, 0);
+				write_pc_item(pc_item, state);
+				if (pc_item->status == PC_ITEM_DELAYED)
+					pc_item->status = PC_ITEM_FAILED;
+				report_result(pc_item);
+			}
+			string_list_clear(&available_paths, 0);
+		}
+		string_list_remove_empty_items(&dco->filters, 0);
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (items[i].status != PC_ITEM_DELAYED)
+			continue;
+		error("'%s' was not filtered properly", items[i].ce->name);
+		items[i].status = PC_ITEM_FAILED;
+		report_result(&items[i]);
+	}
+	strmap_clear(&delayed, 0);
 }
 
 static void worker_loop(struct checkout *state)
 {
 	struct parallel_checkout_item *items = NULL;
 	size_t i, nr = 0, alloc = 0;
+	int have_delayed = 0;
 
 	while (1) {
 		int len = packet_read(0, NULL, NULL, packet_buffer,
@@ -97,10 +176,22 @@ static void worker_loop(struct checkout *state)
 	for (i = 0; i < nr; i++) {
 		struct parallel_checkout_item *pc_item = &items[i];
 		write_pc_item(pc_item, state);
+		if (pc_item->status == PC_ITEM_DELAYED) {
+			/* the filter keeps a pointer to the name */
+			have_delayed = 1;
+			continue;
+		}
 		report_result(pc_item);
 		release_pc_item_data(pc_item);
 	}
 
+	if (have_delayed) {
+		finish_delayed_items(state, items, nr);
+		for (i = 0; i < nr; i++)
+			if (items[i].ce)
+				release_pc_item_data(&items[i]);
+	}
+
 	packet_flush(1);
 
 	free(items);
@@ -114,9 +205,18 @@ static const char * const checkout_worker_usage[] = {
 int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 {
 	struct checkout state = CHECKOUT_INIT;
+	int delay = 0;
+	const char *refname = NULL, *treeish = NULL;
+	struct object_id treeish_oid;
 	struct option checkout_worker_options[] = {
 		OPT_STRING(0, "prefix", &state.base_dir, N_("string"),
 			N_("when creating files, prepend <string>")),
+		OPT_BOOL(0, "delay", &delay,
+			N_("let process filters delay entries")),
+		OPT_STRING(0, "refname", &refname, N_("ref"),
+			N_("ref being checked out, for process filters")),
+		OPT_STRING(0, "treeish", &treeish, N_("tree-ish"),
+			N_("tree-ish being checked out, for process filters")),
 		OPT_END()
 	};
 
@@ -133,6 +233,13 @@ int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 	if (state.base_dir)
 		state.base_dir_len = strlen(state.base_dir);
 
+	if (treeish && get_oid_hex(treeish, &treeish_oid))
+		die("checkout worker: invalid tree-ish '%s'", treeish);
+	init_checkout_metadata(&state.meta, refname,
+			       treeish ? &treeish_oid : NULL, NULL);
+	if (delay)
+		enable_delayed_checkout(&state);
+
 	/*
 	 * Setting this on a worker won't actually update the index. We just
 	 * need to tell the checkout machinery to lstat() the written entries,
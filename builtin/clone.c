@@ -32,6 +32,7 @@
 #include "connected.h"
 #include "packfile.h"
 #include "list-objects-filter-options.h"
+#include "bundle-uri.h"
 
 /*
  * Overall FIXMEs:
@@ -52,6 +53,14 @@ static int option_no_tags;
 static int option_shallow_submodules;
 static int option_reject_shallow = -1;    /* unspecified */
 static int config_reject_shallow = -1;    /* unspecified */
+enum reflink_mode {
+	REFLINK_NEVER,
+	REFLINK_AUTO,
+	REFLINK_ALWAYS
+};
+static int option_reflink = -1;    /* unspecified */
+static int config_reflink = -1;    /* unspecified */
+static enum reflink_mode reflink;
 static int deepen;
 static char *option_template, *option_depth, *option_since;
 static char *option_origin = NULL;
@@ -72,6 +81,7 @@ static int max_jobs = -1;
 static struct string_list option_recurse_submodules = STRING_LIST_INIT_NODUP;
 static struct list_objects_filter_options filter_options;
 static struct string_list server_options = STRING_LIST_INIT_NODUP;
+static struct string_list bundle_uris = STRING_LIST_INIT_NODUP;
 static int option_remote_submodules;
 
 static int recurse_submodules_cb(const struct option *opt,
@@ -88,6 +98,36 @@ static int recurse_submodules_cb(const struct option *opt,
 	return 0;
 }
 
+static int parse_reflink_mode(const char *arg)
+{
+	switch (git_parse_maybe_bool(arg)) {
+	case 0:
+		return REFLINK_NEVER;
+	case 1:
+		return REFLINK_ALWAYS;
+	}
+	if (!strcmp(arg, "auto"))
+		return REFLINK_AUTO;
+	if (!strcmp(arg, "always"))
+		return REFLINK_ALWAYS;
+	if (!strcmp(arg, "never"))
+		return REFLINK_NEVER;
+	return -1;
+}
+
+static int reflink_cb(const struct option *opt, const char *arg, int unset)
+{
+	int *value = opt->value;
+
+	if (unset)
+		*value = REFLINK_NEVER;
+	else if (!arg)
+		*value = REFLINK_ALWAYS;
+	else if ((*value = parse_reflink_mode(arg)) < 0)
+		return error(_("invalid value for '%s': '%s'"), "--reflink", arg);
+	return 0;
+}
+
 static struct option builtin_clone_options[] = {
 	OPT__VERBOSITY(&option_verbosity),
 	OPT_BOOL(0, "progress", &option_progress,
@@ -105,6 +145,9 @@ static struct option builtin_clone_options[] = {
 		N_("to clone from a local repository")),
 	OPT_BOOL(0, "no-hardlinks", &option_no_hardlinks,
 		    N_("don't use local hardlinks, always copy")),
+	OPT_CALLBACK_F(0, "reflink", &option_reflink, N_("(always|auto|never)"),
+		       N_("clone local files copy-on-write instead of hardlinking them"),
+		       PARSE_OPT_OPTARG, reflink_cb),
 	OPT_BOOL('s', "shared", &option_shared,
 		    N_("setup as shared repository")),
 	{ OPTION_CALLBACK, 0, "recurse-submodules", &option_recurse_submodules,
@@ -152,6 +195,8 @@ static struct option builtin_clone_options[] = {
 	OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 	OPT_BOOL(0, "remote-submodules", &option_remote_submodules,
 		    N_("any cloned submodules will use their remote-tracking branch")),
+	OPT_STRING_LIST(0, "bundle-uri", &bundle_uris, N_("uri"),
+			N_("fetch a bundle from the given URI before the remote")),
 	OPT_BOOL(0, "sparse", &option_sparse_checkout,
 		    N_("initialize sparse-checkout file to include only files at root")),
 	OPT_END()
@@ -459,6 +504,14 @@ static void copy_or_link_directory(struct strbuf *src, struct strbuf *dest,
 
 		if (unlink(dest->buf) && errno != ENOENT)
 			die_errno(_("failed to unlink '%s'"), dest->buf);
+		if (reflink != REFLINK_NEVER) {
+			if (!reflink_file_with_time(dest->buf, src->buf, 0666))
+				continue;
+			if (reflink == REFLINK_ALWAYS)
+				die_errno(_("failed to reflink '%s'"), dest->buf);
+			/* no point in trying again for the other files */
+			reflink = REFLINK_NEVER;
+		}
 		if (!option_no_hardlinks) {
 			strbuf_realpath(&realpath, src->buf, 1);
 			if (!link(realpath.buf, dest->buf))
@@ -603,9 +656,7 @@ static struct ref *wanted_peer_refs(const struct ref *refs,
 			get_fetch_map(remote_head, tag_refspec, &tail, 0);
 		}
 	} else {
-		int i;
-		for (i = 0; i < refspec->nr; i++)
-			get_fetch_map(refs, &refspec->items[i], &tail, 0);
+		get_fetch_maps(refs, refspec, &tail, 0);
 	}
 
 	if (!option_mirror && !option_single_branch && !option_no_tags)
@@ -864,6 +915,12 @@ static int git_clone_config(const char *k, const char *v, void *cb)
 	}
 	if (!strcmp(k, "clone.rejectshallow"))
 		config_reject_shallow = git_config_bool(k, v);
+	if (!strcmp(k, "clone.reflink")) {
+		if (!v)
+			return config_error_nonbool(k);
+		if ((config_reflink = parse_reflink_mode(v)) < 0)
+			return error(_("invalid value for '%s': '%s'"), k, v);
+	}
 
 	return git_default_config(k, v, cb);
 }
@@ -986,6 +1043,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	struct remote *remote;
 	int err = 0, complete_refs_before_fetch = 1;
 	int submodule_progress;
+	struct string_list_item *item;
 
 	struct transport_ls_refs_options transport_ls_refs_options =
 		TRANSPORT_LS_REFS_OPTIONS_INIT;
@@ -1173,6 +1231,12 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		reject_shallow = config_reject_shallow;
 	if (option_reject_shallow != -1)
 		reject_shallow = option_reject_shallow;
+	if (config_reflink != -1)
+		reflink = config_reflink;
+	if (option_reflink != -1)
+		reflink = option_reflink;
+	if (reflink != REFLINK_NEVER)
+		option_no_hardlinks = 1;
 
 	/*
 	 * apply the remote name provided by --origin only after this second
@@ -1243,6 +1307,8 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	}
 	if (option_local > 0 && !is_local)
 		warning(_("--local is ignored"));
+	if (option_reflink > REFLINK_NEVER && !is_local)
+		warning(_("--reflink is ignored"));
 	transport->cloning = 1;
 
 	transport_set_option(transport, TRANS_OPT_KEEP, "yes");
@@ -1280,6 +1346,15 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		transport->smart_options->check_self_contained_and_connected = 1;
 
 
+	/*
+	 * Before talking to the remote, unbundle what we can get from
+	 * elsewhere, so that we only need to fetch what is newer.
+	 */
+	for_each_string_list_item(item, &bundle_uris)
+		if (fetch_bundle_uri(the_repository, item->string))
+			warning(_("failed to fetch objects from bundle URI '%s'"),
+				item->string);
+
 	strvec_push(&transport_ls_refs_options.ref_prefixes, "HEAD");
 	refspec_ref_prefixes(&remote->fetch,
 			     &transport_ls_refs_options.ref_prefixes);
@@ -0,0 +1,685 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "quote.h"
+#include "refs.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "run-command.h"
+#include "simple-ipc.h"
+#include "strvec.h"
+
+static const char * const builtin_command__daemon_usage[] = {
+	N_("git command--daemon start [<options>]"),
+	N_("git command--daemon run [<options>]"),
+	N_("git command--daemon stop"),
+	N_("git command--daemon status"),
+	N_("git command--daemon exec <command> [<args>...]"),
+	NULL
+};
+
+/*
+ * A "run" request is made of the prefix of the command, the number of
+ * GIT_* variables in the environment of the client, those variables and
+ * the command itself, all quoted with sq_quote_buf().
+ *
+ * The answer to a "run" request is a sequence of records, each made of
+ * a band character, four hex digits giving the length of its payload,
+ * and the payload itself: what the command wrote to its standard output
+ * (band '1') or error (band '2'), and finally its exit code in decimal
+ * (band 'x'). A lone record of band 'r' tells the client to run the
+ * command itself instead.
+ */
+#define BAND_STDOUT '1'
+#define BAND_STDERR '2'
+#define BAND_EXIT 'x'
+#define BAND_RETRY 'r'
+
+#ifdef SUPPORTS_SIMPLE_IPC
+static const char *command_daemon_ipc_path(void)
+{
+	static char *ret;
+
+	if (!ret)
+		ret = git_pathdup("command--daemon.ipc");
+	return ret;
+}
+
+/*
+ * These are set by git itself from where it was run, which the IPC path
+ * and the prefix sent along with a request already account for, or for
+ * each child it spawns.
+ */
+static const char *const ignored_environment[] = {
+	"GIT_DIR",
+	"GIT_PREFIX",
+	"GIT_TRACE2_PARENT_NAME",
+	"GIT_TRACE2_PARENT_SID",
+	NULL
+};
+
+static int cmp_environment(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/*
+ * Collect the GIT_* variables of the environment into "env", sorted,
+ * as "NAME=value".
+ */
+static void git_environment(struct strvec *env)
+{
+	extern char **environ;
+	char **e;
+
+	for (e = environ; e && *e; e++) {
+		const char *eq = strchr(*e, '=');
+		const char *const *ign;
+
+		if (!eq || !starts_with(*e, "GIT_"))
+			continue;
+		for (ign = ignored_environment; *ign; ign++)
+			if (strlen(*ign) == eq - *e &&
+			    !strncmp(*e, *ign, eq - *e))
+				break;
+		if (!*ign)
+			strvec_push(env, *e);
+	}
+	QSORT(env->v, env->nr, cmp_environment);
+}
+#endif
+
+/*
+ * Ask the daemon, if there is one, to run "argv" from "prefix", and
+ * relay what the command writes and its exit code. Without a daemon to
+ * answer, or one whose GIT_* environment differs from ours, run the
+ * command in this process instead.
+ */
+static int do_as_client__exec(int argc, const char **argv, const char *prefix)
+{
+	int ret = -1;
+#ifdef SUPPORTS_SIMPLE_IPC
+	struct ipc_client_connect_options options
+		= IPC_CLIENT_CONNECT_OPTIONS_INIT;
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	struct strvec env = STRVEC_INIT;
+	const char *p, *end;
+#endif
+
+	if (!argc)
+		die(_("no command given to exec"));
+
+#ifdef SUPPORTS_SIMPLE_IPC
+	options.wait_if_busy = 1;
+	git_environment(&env);
+	strbuf_addstr(&request, "run ");
+	sq_quote_buf(&request, prefix ? prefix : "");
+	strbuf_addf(&request, " '%"PRIuMAX"'", (uintmax_t)env.nr);
+	sq_quote_argv(&request, env.v);
+	sq_quote_argv(&request, argv);
+
+	if (ipc_get_active_state(command_daemon_ipc_path()) !=
+	    IPC_STATE__LISTENING ||
+	    ipc_client_send_command(command_daemon_ipc_path(), &options,
+				    request.buf, &answer))
+		goto local;
+
+	p = answer.buf;
+	end = answer.buf + answer.len;
+	while (p + 5 <= end) {
+		char band = *p;
+		int hi = hex2chr(p + 1), lo = hex2chr(p + 3);
+		int len = hi << 8 | lo;
+
+		p += 5;
+		if (hi < 0 || lo < 0 || p + len > end)
+			break;
+		if (band == BAND_STDOUT)
+			write_or_die(1, p, len);
+		else if (band == BAND_STDERR)
+			write_in_full(2, p, len);
+		else if (band == BAND_EXIT)
+			ret = atoi(p);
+		else if (band == BAND_RETRY)
+			goto local;
+		p += len;
+	}
+	if (ret < 0)
+		die(_("incomplete answer from command--daemon"));
+	goto done;
+
+local:
+#endif
+	trace2_data_string("command_daemon", the_repository, "exec", "local");
+	ret = run_set_up_builtin(argc, argv, prefix);
+	if (ret < 0)
+		ret = 128;
+#ifdef SUPPORTS_SIMPLE_IPC
+done:
+	strbuf_release(&request);
+	strbuf_release(&answer);
+	strvec_clear(&env);
+#endif
+	return ret;
+}
+
+#if defined(SUPPORTS_SIMPLE_IPC) && !defined(GIT_WINDOWS_NATIVE)
+
+/*
+ * Global state loaded from config.
+ */
+#define COMMAND_DAEMON__IPC_THREADS "commanddaemon.ipcthreads"
+static int command_daemon__ipc_threads = 8;
+
+#define COMMAND_DAEMON__START_TIMEOUT "commanddaemon.starttimeout"
+static int command_daemon__start_timeout_sec = 60;
+
+static int command_daemon_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, COMMAND_DAEMON__IPC_THREADS)) {
+		int i = git_config_int(var, value);
+		if (i < 1)
+			return error(_("value of '%s' out of range: %d"),
+				     COMMAND_DAEMON__IPC_THREADS, i);
+		command_daemon__ipc_threads = i;
+		return 0;
+	}
+
+	if (!strcmp(var, COMMAND_DAEMON__START_TIMEOUT)) {
+		int i = git_config_int(var, value);
+		if (i < 0)
+			return error(_("value of '%s' out of range: %d"),
+				     COMMAND_DAEMON__START_TIMEOUT, i);
+		command_daemon__start_timeout_sec = i;
+		return 0;
+	}
+
+	return git_default_config(var, value, cb);
+}
+
+/*
+ * A configuration file the daemon has read, and what it looked like
+ * then.
+ */
+struct config_file_stat {
+	char *path;
+	struct stat st;
+	int exists;
+};
+
+struct command_daemon_state {
+	/*
+	 * Held while forking a child for a request, so that the
+	 * children do not inherit the pipes of one another.
+	 */
+	pthread_mutex_t fork_lock;
+
+	struct config_file_stat *config_files;
+	int config_files_nr, config_files_alloc;
+
+	/*
+	 * The GIT_* environment of the daemon. The configuration, the
+	 * object directories, the index file and so on were all looked
+	 * up with it before any request came in, so a child cannot be
+	 * made to honor another one: requests made with a different
+	 * environment are left for the client to run.
+	 */
+	struct strvec env;
+};
+
+static void add_config_file(struct command_daemon_state *state, char *path)
+{
+	struct config_file_stat *f;
+
+	if (!path)
+		return;
+	ALLOC_GROW(state->config_files, state->config_files_nr + 1,
+		   state->config_files_alloc);
+	f = &state->config_files[state->config_files_nr++];
+	f->path = path;
+	f->exists = !stat(path, &f->st);
+}
+
+/*
+ * The children run with the configuration read by the daemon. Tell
+ * whether one of the files it came from has been modified since, in
+ * which case the daemon is out of date.
+ */
+static int config_is_stale(struct command_daemon_state *state)
+{
+	int i;
+
+	for (i = 0; i < state->config_files_nr; i++) {
+		struct config_file_stat *f = &state->config_files[i];
+		struct stat st;
+		int exists = !stat(f->path, &st);
+
+		if (exists != f->exists)
+			return 1;
+		if (exists &&
+		    (st.st_ino != f->st.st_ino ||
+		     st.st_size != f->st.st_size ||
+		     st.st_mtime != f->st.st_mtime ||
+		     ST_MTIME_NSEC(st) != ST_MTIME_NSEC(f->st)))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Load what most commands need before they can do anything, so that
+ * the children forked for the requests find it ready.
+ */
+static void warm_up(struct command_daemon_state *state)
+{
+	struct packed_git *p;
+	char *user, *xdg;
+
+	add_config_file(state, git_system_config());
+	git_global_config(&user, &xdg);
+	add_config_file(state, user);
+	add_config_file(state, xdg);
+	add_config_file(state, xstrdup(git_common_path("config")));
+
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		open_pack_index(p);
+	get_main_ref_store(the_repository);
+}
+
+static int send_record(ipc_server_reply_cb *reply,
+		       struct ipc_server_reply_data *reply_data,
+		       char band, const char *buf, size_t len)
+{
+	char hdr[6];
+
+	xsnprintf(hdr, sizeof(hdr), "%c%04x", band, (unsigned)len);
+	if (reply(reply_data, hdr, 5) < 0)
+		return -1;
+	if (len && reply(reply_data, buf, len) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Relay what the child writes to "out" and "err" until it closes both.
+ */
+static void relay_output(int out, int err,
+			 ipc_server_reply_cb *reply,
+			 struct ipc_server_reply_data *reply_data)
+{
+	struct pollfd pfd[2];
+	char buf[8192];
+	int nr = 2, i;
+
+	pfd[0].fd = out;
+	pfd[1].fd = err;
+	while (nr) {
+		pfd[0].events = pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("poll failed"));
+			return;
+		}
+		for (i = 0; i < 2; i++) {
+			ssize_t len;
+
+			if (pfd[i].fd < 0 ||
+			    !(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			len = xread(pfd[i].fd, buf, sizeof(buf));
+			if (len > 0) {
+				/* the client may have gone; drain anyway */
+				send_record(reply, reply_data,
+					    i ? BAND_STDERR : BAND_STDOUT,
+					    buf, len);
+				continue;
+			}
+			pfd[i].fd = -1;
+			nr--;
+		}
+	}
+}
+
+/*
+ * The children are forked while the other IPC threads keep running, and
+ * inherit every lock those threads held at that moment, held by nobody.
+ * Those threads only relay output and report errors, so the locks they
+ * may hold that a child could need are those of trace2 and of stdio
+ * (which error() flushes); the C library takes care of its allocator.
+ * Take them before forking, so that no other thread holds them, and
+ * release them on both sides afterwards.
+ */
+static void fork_prepare(void)
+{
+	trace2_fork_prepare();
+	flockfile(stdout);
+	flockfile(stderr);
+}
+
+static void fork_parent(void)
+{
+	funlockfile(stderr);
+	funlockfile(stdout);
+	trace2_fork_parent();
+}
+
+static void fork_child(void)
+{
+	funlockfile(stderr);
+	funlockfile(stdout);
+	trace2_fork_child();
+}
+
+static int do_run(struct command_daemon_state *state, const char *request,
+		  ipc_server_reply_cb *reply,
+		  struct ipc_server_reply_data *reply_data)
+{
+	char *buf = xstrdup(request);
+	struct strvec args = STRVEC_INIT;
+	const char *prefix, **argv;
+	int out[2], err[2];
+	int status, code, env_nr, i;
+	char code_buf[16];
+	pid_t pid;
+
+	if (sq_dequote_to_strvec(buf, &args) || args.nr < 3 ||
+	    strtol_i(args.v[1], 10, &env_nr) || env_nr < 0 ||
+	    args.nr < 3 + env_nr) {
+		error(_("malformed request to command--daemon"));
+		goto done;
+	}
+	prefix = *args.v[0] ? args.v[0] : NULL;
+	argv = args.v + 2 + env_nr;
+
+	if (env_nr != state->env.nr) {
+		send_record(reply, reply_data, BAND_RETRY, NULL, 0);
+		goto done;
+	}
+	for (i = 0; i < env_nr; i++)
+		if (strcmp(args.v[2 + i], state->env.v[i]))
+			break;
+	if (i < env_nr) {
+		send_record(reply, reply_data, BAND_RETRY, NULL, 0);
+		goto done;
+	}
+
+	pthread_mutex_lock(&state->fork_lock);
+	if (config_is_stale(state)) {
+		pthread_mutex_unlock(&state->fork_lock);
+		send_record(reply, reply_data, BAND_RETRY, NULL, 0);
+		free(buf);
+		strvec_clear(&args);
+		/* let the client do it, and make way for a new daemon */
+		return SIMPLE_IPC_QUIT;
+	}
+	if (pipe(out) < 0) {
+		pthread_mutex_unlock(&state->fork_lock);
+		error_errno(_("cannot create pipe"));
+		goto done;
+	}
+	if (pipe(err) < 0) {
+		close(out[0]);
+		close(out[1]);
+		pthread_mutex_unlock(&state->fork_lock);
+		error_errno(_("cannot create pipe"));
+		goto done;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (!pid) {
+		int null_fd = open("/dev/null", O_RDONLY);
+		sigset_t sigpipe;
+
+		/* the IPC threads block it, but the command should not */
+		sigemptyset(&sigpipe);
+		sigaddset(&sigpipe, SIGPIPE);
+		pthread_sigmask(SIG_UNBLOCK, &sigpipe, NULL);
+
+		if (null_fd >= 0) {
+			dup2(null_fd, 0);
+			close(null_fd);
+		}
+		dup2(out[1], 1);
+		dup2(err[1], 2);
+		close(out[0]);
+		close(out[1]);
+		close(err[0]);
+		close(err[1]);
+		code = run_set_up_builtin(args.nr - 2 - env_nr, argv, prefix);
+		exit(code < 0 ? 128 : code);
+	}
+	close(out[1]);
+	close(err[1]);
+	pthread_mutex_unlock(&state->fork_lock);
+	if (pid < 0) {
+		error_errno(_("fork failed"));
+		close(out[0]);
+		close(err[0]);
+		goto done;
+	}
+
+	relay_output(out[0], err[0], reply, reply_data);
+	close(out[0]);
+	close(err[0]);
+
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		; /* nothing */
+	if (WIFEXITED(status))
+		code = WEXITSTATUS(status);
+	else if (WIFSIGNALED(status))
+		code = WTERMSIG(status) + 128;
+	else
+		code = 128;
+	xsnprintf(code_buf, sizeof(code_buf), "%d", code);
+	send_record(reply, reply_data, BAND_EXIT, code_buf, strlen(code_buf));
+
+done:
+	free(buf);
+	strvec_clear(&args);
+	return 0;
+}
+
+static ipc_server_application_cb handle_client;
+
+static int handle_client(void *data, const char *command,
+			 ipc_server_reply_cb *reply,
+			 struct ipc_server_reply_data *reply_data)
+{
+	struct command_daemon_state *state = data;
+	const char *request;
+
+	if (!strcmp(command, "quit"))
+		return SIMPLE_IPC_QUIT;
+	if (skip_prefix(command, "run ", &request))
+		return do_run(state, request, reply, reply_data);
+
+	error(_("command--daemon: unknown request '%s'"), command);
+	return 0;
+}
+
+static int command_daemon_run(void)
+{
+	struct command_daemon_state state;
+	struct ipc_server_opts ipc_opts = {
+		.nr_threads = command_daemon__ipc_threads,
+
+		/*
+		 * We know that there are no other active threads yet,
+		 * so we can let the IPC layer temporarily chdir() if
+		 * it needs to when creating the server side of the
+		 * Unix domain socket.
+		 */
+		.uds_disallow_chdir = 0
+	};
+	int i, ret;
+
+	memset(&state, 0, sizeof(state));
+	if (pthread_atfork(fork_prepare, fork_parent, fork_child))
+		return error(_("could not install fork handlers"));
+	pthread_mutex_init(&state.fork_lock, NULL);
+	strvec_init(&state.env);
+	git_environment(&state.env);
+	warm_up(&state);
+
+	ret = ipc_server_run(command_daemon_ipc_path(), &ipc_opts,
+			     handle_client, &state);
+	if (ret == -2)
+		error(_("command--daemon is already running in '%s'"),
+		      get_git_dir());
+	else if (ret)
+		error_errno(_("could not start IPC thread pool on '%s'"),
+			    command_daemon_ipc_path());
+
+	for (i = 0; i < state.config_files_nr; i++)
+		free(state.config_files[i].path);
+	free(state.config_files);
+	strvec_clear(&state.env);
+	pthread_mutex_destroy(&state.fork_lock);
+	return ret;
+}
+
+static int try_to_run_foreground_daemon(int detach)
+{
+	if (ipc_get_active_state(command_daemon_ipc_path()) ==
+	    IPC_STATE__LISTENING)
+		die(_("command--daemon is already running in '%s'"),
+		    get_git_dir());
+
+	if (detach && daemonize())
+		die_errno(_("could not detach from the terminal"));
+
+	return !!command_daemon_run();
+}
+
+static int try_to_start_background_daemon(void)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	uint64_t deadline;
+
+	if (ipc_get_active_state(command_daemon_ipc_path()) ==
+	    IPC_STATE__LISTENING)
+		die(_("command--daemon is already running in '%s'"),
+		    get_git_dir());
+
+	strvec_pushl(&cp.args, "command--daemon", "run", "--detach", NULL);
+	strvec_pushf(&cp.args, "--ipc-threads=%d",
+		     command_daemon__ipc_threads);
+	cp.git_cmd = 1;
+	cp.no_stdin = 1;
+	cp.trace2_child_class = "command--daemon";
+	if (run_command(&cp))
+		return error(_("could not spawn command--daemon in the background"));
+
+	deadline = getnanotime() +
+		(uint64_t)command_daemon__start_timeout_sec * 1000000000;
+	for (;;) {
+		if (ipc_get_active_state(command_daemon_ipc_path()) ==
+		    IPC_STATE__LISTENING)
+			return 0;
+		if (getnanotime() > deadline)
+			return error(_("command--daemon not online yet"));
+		sleep_millisec(50);
+	}
+}
+
+static int do_as_client__send_stop(void)
+{
+	struct ipc_client_connect_options options
+		= IPC_CLIENT_CONNECT_OPTIONS_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	int ret;
+
+	ret = ipc_client_send_command(command_daemon_ipc_path(), &options,
+				      "quit", &answer);
+	strbuf_release(&answer);
+	if (ret)
+		return ret;
+
+	while (ipc_get_active_state(command_daemon_ipc_path()) ==
+	       IPC_STATE__LISTENING)
+		sleep_millisec(50);
+	return 0;
+}
+
+static int do_as_client__status(void)
+{
+	if (ipc_get_active_state(command_daemon_ipc_path()) ==
+	    IPC_STATE__LISTENING) {
+		printf(_("command--daemon is running in '%s'\n"),
+		       get_git_dir());
+		return 0;
+	}
+	printf(_("command--daemon is not running in '%s'\n"), get_git_dir());
+	return 1;
+}
+
+int cmd_command__daemon(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	int detach = 0;
+
+	struct option options[] = {
+		OPT_BOOL(0, "detach", &detach,
+			 N_("detach from the terminal (with 'run')")),
+		OPT_INTEGER(0, "ipc-threads",
+			    &command_daemon__ipc_threads,
+			    N_("use <n> ipc worker threads")),
+		OPT_INTEGER(0, "start-timeout",
+			    &command_daemon__start_timeout_sec,
+			    N_("max seconds to wait for background daemon startup")),
+
+		OPT_END()
+	};
+
+	/* the options after "exec" are those of the command */
+	if (argc > 1 && !strcmp(argv[1], "exec"))
+		return do_as_client__exec(argc - 2, argv + 2, prefix);
+
+	git_config(command_daemon_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_command__daemon_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_command__daemon_usage, options);
+	subcmd = argv[0];
+
+	if (command_daemon__ipc_threads < 1)
+		die(_("invalid 'ipc-threads' value (%d)"),
+		    command_daemon__ipc_threads);
+
+	if (!strcmp(subcmd, "start"))
+		return !!try_to_start_background_daemon();
+
+	if (!strcmp(subcmd, "run"))
+		return !!try_to_run_foreground_daemon(detach);
+
+	if (!strcmp(subcmd, "stop"))
+		return !!do_as_client__send_stop();
+
+	if (!strcmp(subcmd, "status"))
+		return !!do_as_client__status();
+
+	die(_("Unhandled subcommand '%s'"), subcmd);
+}
+
+#else
+int cmd_command__daemon(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_command__daemon_usage, options);
+
+	/* without a daemon, the commands are simply run here */
+	if (argc > 1 && !strcmp(argv[1], "exec"))
+		return do_as_client__exec(argc - 2, argv + 2, prefix);
+
+	die(_("command--daemon not supported on this platform"));
+}
+#endif
@@ -13,7 +13,9 @@ static char const * const builtin_commit_graph_usage[] = {
 	N_("git commit-graph verify [--object-dir <objdir>] [--shallow] [--[no-]progress]"),
 	N_("git commit-graph write [--object-dir <objdir>] [--append] "
 	   "[--split[=<strategy>]] [--reachable|--stdin-packs|--stdin-commits] "
-	   "[--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress] "
+	   "[--changed-paths] [--[no-]merge-changed-paths] "
+	   "[--[no-]max-new-filters <n>] [--[no-]progress] "
+	   "[--[no-]commit-metadata] "
 	   "<split options>"),
 	NULL
 };
@@ -26,7 +28,9 @@ static const char * const builtin_commit_graph_verify_usage[] = {
 static const char * const builtin_commit_graph_write_usage[] = {
 	N_("git commit-graph write [--object-dir <objdir>] [--append] "
 	   "[--split[=<strategy>]] [--reachable|--stdin-packs|--stdin-commits] "
-	   "[--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress] "
+	   "[--changed-paths] [--[no-]merge-changed-paths] "
+	   "[--[no-]max-new-filters <n>] [--[no-]progress] "
+	   "[--[no-]commit-metadata] "
 	   "<split options>"),
 	NULL
 };
@@ -41,6 +45,8 @@ static struct opts_commit_graph {
 	int shallow;
 	int progress;
 	int enable_changed_paths;
+	int enable_merge_changed_paths;
+	int enable_commit_metadata;
 } opts;
 
 static struct object_directory *find_odb(struct repository *r,
@@ -219,6 +225,10 @@ static int graph_write(int argc, const char **argv)
 			N_("include all commits already in the commit-graph file")),
 		OPT_BOOL(0, "changed-paths", &opts.enable_changed_paths,
 			N_("enable computation for changed paths")),
+		OPT_BOOL(0, "merge-changed-paths", &opts.enable_merge_changed_paths,
+			N_("also compute changed paths for merges' other parents")),
+		OPT_BOOL(0, "commit-metadata", &opts.enable_commit_metadata,
+			N_("store authors, committers and subjects of commits")),
 		OPT_BOOL(0, "progress", &opts.progress, N_("force progress reporting")),
 		OPT_CALLBACK_F(0, "split", &write_opts.split_flags, NULL,
 			N_("allow writing an incremental commit-graph file"),
@@ -238,6 +248,8 @@ static int graph_write(int argc, const char **argv)
 
 	opts.progress = isatty(2);
 	opts.enable_changed_paths = -1;
+	opts.enable_merge_changed_paths = -1;
+	opts.enable_commit_metadata = -1;
 	write_opts.size_multiple = 2;
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
@@ -266,6 +278,18 @@ static int graph_write(int argc, const char **argv)
 	if (opts.enable_changed_paths == 1 ||
 	    git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
 		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	if (!opts.enable_merge_changed_paths)
+		flags |= COMMIT_GRAPH_NO_WRITE_MERGE_BLOOM_FILTERS;
+	if (opts.enable_merge_changed_paths == 1) {
+		if (!opts.enable_changed_paths)
+			die(_("--merge-changed-paths cannot be used with --no-changed-paths"));
+		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS |
+			 COMMIT_GRAPH_WRITE_MERGE_BLOOM_FILTERS;
+	}
+	if (!opts.enable_commit_metadata)
+		flags |= COMMIT_GRAPH_NO_WRITE_COMMIT_METADATA;
+	if (opts.enable_commit_metadata == 1)
+		flags |= COMMIT_GRAPH_WRITE_COMMIT_METADATA;
 
 	read_replace_refs = 0;
 	odb = find_odb(the_repository, opts.obj_dir);
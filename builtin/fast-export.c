@@ -24,6 +24,9 @@
 #include "remote.h"
 #include "blob.h"
 #include "commit-slab.h"
+#include "csum-file.h"
+#include "replace-object.h"
+#include "thread-utils.h"
 
 static const char *fast_export_usage[] = {
 	N_("git fast-export [rev-list-opts]"),
@@ -47,6 +50,20 @@ static struct refspec refspecs = REFSPEC_INIT_FETCH;
 static int anonymize;
 static struct hashmap anonymized_seeds;
 static struct revision_sources revision_sources;
+static int nr_threads;
+static int binary_marks;
+
+static int parse_opt_marks_format(const struct option *opt,
+				  const char *arg, int unset)
+{
+	if (unset || !strcmp(arg, "text"))
+		binary_marks = 0;
+	else if (!strcmp(arg, "binary"))
+		binary_marks = 1;
+	else
+		return error("Unknown marks format: %s", arg);
+	return 0;
+}
 
 static int parse_opt_signed_tag_mode(const struct option *opt,
 				     const char *arg, int unset)
@@ -285,35 +302,66 @@ static char *anonymize_blob(unsigned long *size)
 	return strbuf_detach(&out, NULL);
 }
 
-static void export_blob(const struct object_id *oid)
+/*
+ * A blob read, possibly ahead of time by read_blobs_ahead(), and its
+ * verdict: -1 if it could not be read, -2 if it does not hash to its
+ * name.
+ */
+struct blob_read {
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	char *buf;
+	int status;
+	int done;
+};
+
+static void read_blob(struct blob_read *blob)
+{
+	blob->buf = read_object_file(&blob->oid, &blob->type, &blob->size);
+	if (!blob->buf)
+		blob->status = -1;
+	else if (check_object_signature(the_repository, &blob->oid,
+					blob->buf, blob->size,
+					type_name(blob->type)) < 0)
+		blob->status = -2;
+}
+
+static int blob_is_shown(const struct object_id *oid)
 {
+	struct object *object = lookup_object(the_repository, oid);
+
+	return object && object->flags & SHOWN;
+}
+
+static void export_blob_read(struct blob_read *blob)
+{
+	const struct object_id *oid = &blob->oid;
 	unsigned long size;
 	enum object_type type;
 	char *buf;
 	struct object *object;
 	int eaten;
 
-	if (no_data)
-		return;
-
-	if (is_null_oid(oid))
-		return;
-
-	object = lookup_object(the_repository, oid);
-	if (object && object->flags & SHOWN)
+	if (blob_is_shown(oid)) {
+		free(blob->buf);
 		return;
+	}
 
 	if (anonymize) {
 		buf = anonymize_blob(&size);
 		object = (struct object *)lookup_blob(the_repository, oid);
 		eaten = 0;
 	} else {
-		buf = read_object_file(oid, &type, &size);
-		if (!buf)
+		if (!blob->done)
+			read_blob(blob);
+		if (blob->status == -1)
 			die("could not read blob %s", oid_to_hex(oid));
-		if (check_object_signature(the_repository, oid, buf, size,
-					   type_name(type)) < 0)
+		if (blob->status == -2)
 			die("oid mismatch in blob %s", oid_to_hex(oid));
+		buf = blob->buf;
+		size = blob->size;
+		type = blob->type;
 		object = parse_object_buffer(the_repository, oid, type,
 					     size, buf, &eaten);
 	}
@@ -338,6 +386,106 @@ static void export_blob(const struct object_id *oid)
 		free(buf);
 }
 
+static void export_blob(const struct object_id *oid)
+{
+	struct blob_read blob = { 0 };
+
+	if (no_data || is_null_oid(oid))
+		return;
+	oidcpy(&blob.oid, oid);
+	export_blob_read(&blob);
+}
+
+/*
+ * With several threads, the blobs a commit touches are read and
+ * checked ahead of their output, at most this many per thread at a
+ * time to bound the memory they hold.
+ */
+#define BLOBS_AHEAD_PER_THREAD 4
+
+struct blob_reader {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct blob_read *blobs;
+	size_t nr, next, written;
+	size_t window;
+};
+
+static void *blob_reader_thread(void *data)
+{
+	struct blob_reader *br = data;
+
+	pthread_mutex_lock(&br->mutex);
+	for (;;) {
+		struct blob_read *blob;
+
+		while (br->next < br->nr &&
+		       br->next >= br->written + br->window)
+			pthread_cond_wait(&br->cond, &br->mutex);
+		if (br->next >= br->nr)
+			break;
+		blob = &br->blobs[br->next++];
+		pthread_mutex_unlock(&br->mutex);
+
+		read_blob(blob);
+
+		pthread_mutex_lock(&br->mutex);
+		blob->done = 1;
+		pthread_cond_broadcast(&br->cond);
+	}
+	pthread_mutex_unlock(&br->mutex);
+	return NULL;
+}
+
+static void export_blobs(struct blob_read *blobs, size_t nr)
+{
+	struct blob_reader br = { .blobs = blobs, .nr = nr };
+	pthread_t *threads;
+	int i, n = nr_threads;
+	size_t j;
+
+	if (n > nr)
+		n = (int)nr;
+	if (!HAVE_THREADS || n <= 1 || anonymize) {
+		for (j = 0; j < nr; j++)
+			export_blob_read(&blobs[j]);
+		return;
+	}
+
+	/* set up the replace map before the threads race for it */
+	lookup_replace_object(the_repository, &blobs[0].oid);
+
+	br.window = st_mult(nr_threads, BLOBS_AHEAD_PER_THREAD);
+	pthread_mutex_init(&br.mutex, NULL);
+	pthread_cond_init(&br.cond, NULL);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(threads, n);
+	for (i = 0; i < n; i++)
+		if (pthread_create(&threads[i], NULL, blob_reader_thread, &br))
+			die(_("unable to create thread"));
+
+	for (j = 0; j < nr; j++) {
+		pthread_mutex_lock(&br.mutex);
+		while (!blobs[j].done)
+			pthread_cond_wait(&br.cond, &br.mutex);
+		pthread_mutex_unlock(&br.mutex);
+
+		export_blob_read(&blobs[j]);
+
+		pthread_mutex_lock(&br.mutex);
+		br.written++;
+		pthread_cond_broadcast(&br.cond);
+		pthread_mutex_unlock(&br.mutex);
+	}
+
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_obj_read_lock();
+	pthread_cond_destroy(&br.cond);
+	pthread_mutex_destroy(&br.mutex);
+}
+
 static int depth_first(const void *a_, const void *b_)
 {
 	const struct diff_filepair *a = *((const struct diff_filepair **)a_);
@@ -661,9 +809,22 @@ static void handle_commit(struct commit *commit, struct rev_info *rev,
 				   "", &rev->diffopt);
 
 	/* Export the referenced blobs, and remember the marks. */
-	for (i = 0; i < diff_queued_diff.nr; i++)
-		if (!S_ISGITLINK(diff_queued_diff.queue[i]->two->mode))
-			export_blob(&diff_queued_diff.queue[i]->two->oid);
+	if (!no_data) {
+		struct blob_read *blobs;
+		size_t nr = 0;
+
+		CALLOC_ARRAY(blobs, diff_queued_diff.nr);
+		for (i = 0; i < diff_queued_diff.nr; i++) {
+			struct diff_filespec *two = diff_queued_diff.queue[i]->two;
+
+			if (S_ISGITLINK(two->mode) || is_null_oid(&two->oid) ||
+			    blob_is_shown(&two->oid))
+				continue;
+			oidcpy(&blobs[nr++].oid, &two->oid);
+		}
+		export_blobs(blobs, nr);
+		free(blobs);
+	}
 
 	refname = *revision_sources_at(&revision_sources, commit);
 	/*
@@ -1052,6 +1213,65 @@ static void handle_tags_and_duplicates(struct string_list *extras)
 	}
 }
 
+/*
+ * The binary marks format starts with BINARY_MARKS_SIGNATURE, the
+ * version, the format id of the hash algorithm and the number of
+ * marks, in network byte order.  Then come the marks of the exported
+ * commits, in increasing order, each as a 4-byte mark followed by the
+ * raw object name, and finally the checksum of all of the above.  As
+ * only commits are recorded, the marks can be used again without
+ * looking up what they name.
+ */
+#define BINARY_MARKS_SIGNATURE 0x464d524b /* "FMRK" */
+#define BINARY_MARKS_VERSION 1
+#define BINARY_MARKS_HEADER_SIZE 16
+
+struct mark_entry {
+	uint32_t mark;
+	const struct object_id *oid;
+};
+
+static int mark_entry_cmp(const void *a_, const void *b_)
+{
+	const struct mark_entry *a = a_, *b = b_;
+
+	return a->mark < b->mark ? -1 : a->mark > b->mark;
+}
+
+static void export_binary_marks(char *file)
+{
+	struct decoration_entry *deco = idnums.entries;
+	struct mark_entry *entries;
+	struct hashfile *f;
+	unsigned int i;
+	size_t nr = 0;
+	int fd;
+
+	ALLOC_ARRAY(entries, idnums.nr);
+	for (i = 0; i < idnums.size; i++, deco++) {
+		if (!deco->base || deco->base->type != OBJ_COMMIT)
+			continue;
+		entries[nr].mark = ptr_to_mark(deco->decoration);
+		entries[nr++].oid = &deco->base->oid;
+	}
+	QSORT(entries, nr, mark_entry_cmp);
+
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		die_errno("Unable to open marks file %s for writing.", file);
+	f = hashfd(fd, file);
+	hashwrite_be32(f, BINARY_MARKS_SIGNATURE);
+	hashwrite_be32(f, BINARY_MARKS_VERSION);
+	hashwrite_be32(f, the_hash_algo->format_id);
+	hashwrite_be32(f, nr);
+	for (i = 0; i < nr; i++) {
+		hashwrite_be32(f, entries[i].mark);
+		hashwrite(f, entries[i].oid->hash, the_hash_algo->rawsz);
+	}
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE);
+	free(entries);
+}
+
 static void export_marks(char *file)
 {
 	unsigned int i;
@@ -1060,6 +1280,11 @@ static void export_marks(char *file)
 	FILE *f;
 	int e = 0;
 
+	if (binary_marks) {
+		export_binary_marks(file);
+		return;
+	}
+
 	f = fopen_for_writing(file);
 	if (!f)
 		die_errno("Unable to open marks file %s for writing.", file);
@@ -1082,16 +1307,72 @@ static void export_marks(char *file)
 		error("Unable to write marks file %s.", file);
 }
 
+static void import_binary_marks(const char *input_file,
+				const unsigned char *data, size_t len)
+{
+	size_t stride = 4 + the_hash_algo->rawsz;
+	const unsigned char *p;
+	uint32_t i, nr;
+
+	if (len < BINARY_MARKS_HEADER_SIZE + the_hash_algo->rawsz ||
+	    get_be32(data + 4) != BINARY_MARKS_VERSION ||
+	    get_be32(data + 8) != the_hash_algo->format_id)
+		die("unsupported marks file %s", input_file);
+	nr = get_be32(data + 12);
+	if ((len - BINARY_MARKS_HEADER_SIZE - the_hash_algo->rawsz) / stride != nr ||
+	    (len - BINARY_MARKS_HEADER_SIZE - the_hash_algo->rawsz) % stride ||
+	    !hashfile_checksum_valid(data, len))
+		die("corrupt marks file %s", input_file);
+
+	p = data + BINARY_MARKS_HEADER_SIZE;
+	for (i = 0; i < nr; i++, p += stride) {
+		uint32_t mark = get_be32(p);
+		struct object_id oid;
+		struct commit *commit;
+
+		if (!mark)
+			die("corrupt marks file %s", input_file);
+		oidread(&oid, p + 4);
+		if (last_idnum < mark)
+			last_idnum = mark;
+
+		commit = lookup_commit(the_repository, &oid);
+		if (!commit)
+			die("not a commit? can't happen: %s", oid_to_hex(&oid));
+		if (commit->object.flags & SHOWN)
+			error("Object %s already has a mark", oid_to_hex(&oid));
+
+		mark_object(&commit->object, mark);
+		commit->object.flags |= SHOWN;
+	}
+}
+
 static void import_marks(char *input_file, int check_exists)
 {
 	char line[512];
 	FILE *f;
 	struct stat sb;
+	unsigned char signature[4];
 
 	if (check_exists && stat(input_file, &sb))
 		return;
 
 	f = xfopen(input_file, "r");
+	if (fread(signature, 1, 4, f) == 4 &&
+	    get_be32(signature) == BINARY_MARKS_SIGNATURE) {
+		size_t len;
+		void *data;
+
+		if (fstat(fileno(f), &sb))
+			die_errno("could not stat %s", input_file);
+		len = xsize_t(sb.st_size);
+		data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		fclose(f);
+		import_binary_marks(input_file, data, len);
+		munmap(data, len);
+		return;
+	}
+	rewind(f);
 	while (fgets(line, sizeof(line), f)) {
 		uint32_t mark;
 		char *line_end, *mark_end;
@@ -1208,6 +1489,9 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 			     N_("dump marks to this file")),
 		OPT_STRING(0, "import-marks", &import_filename, N_("file"),
 			     N_("import marks from this file")),
+		OPT_CALLBACK(0, "marks-format", NULL, N_("format"),
+			     N_("write marks as 'text' or 'binary'"),
+			     parse_opt_marks_format),
 		OPT_STRING(0, "import-marks-if-exists",
 			     &import_filename_if_exists,
 			     N_("file"),
@@ -1231,6 +1515,8 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 			    N_("show original object ids of blobs/commits")),
 		OPT_BOOL(0, "mark-tags", &mark_tags,
 			    N_("label tags with mark ids")),
+		OPT_INTEGER(0, "threads", &nr_threads,
+			    N_("read blobs ahead with <n> threads")),
 
 		OPT_END()
 	};
@@ -1255,6 +1541,13 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 	if (anonymized_seeds.cmpfn && !anonymize)
 		die(_("--anonymize-map without --anonymize does not make sense"));
 
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	else if (!HAVE_THREADS && nr_threads != 1) {
+		warning(_("no threads support, ignoring --threads"));
+		nr_threads = 1;
+	}
+
 	if (refspecs_list.nr) {
 		int i;
 
@@ -19,6 +19,7 @@
 #include "mem-pool.h"
 #include "commit-reach.h"
 #include "khash.h"
+#include "thread-utils.h"
 
 #define PACK_ID_BITS 16
 #define MAX_PACK_ID ((1<<PACK_ID_BITS)-1)
@@ -79,7 +80,7 @@ struct mark_set {
 
 struct last_object {
 	struct strbuf data;
-	off_t offset;
+	struct object_entry *entry;
 	unsigned int depth;
 	unsigned no_swap : 1;
 };
@@ -156,6 +157,7 @@ typedef void (*each_mark_fn_t)(uintmax_t mark, void *obj, void *cbp);
 /* Configured limits on output */
 static unsigned long max_depth = 50;
 static off_t max_packsize;
+static int nr_threads = 1;
 static int unpack_limit = 100;
 static int force_update;
 
@@ -205,7 +207,7 @@ static int import_marks_file_done;
 static int relative_marks_paths;
 
 /* Our last blob */
-static struct last_object last_blob = { STRBUF_INIT, 0, 0, 0 };
+static struct last_object last_blob = { STRBUF_INIT, NULL, 0, 0 };
 
 /* Tree management */
 static unsigned int tree_entry_alloc = 1000;
@@ -396,6 +398,7 @@ static void write_crash_report(const char *err)
 }
 
 static void end_packfile(void);
+static void flush_store_jobs(void);
 static void unkeep_all_packs(void);
 static void dump_marks(void);
 
@@ -845,6 +848,7 @@ static void end_packfile(void)
 	if (running || !pack_data)
 		return;
 
+	flush_store_jobs();
 	running = 1;
 	clear_delta_base_cache();
 	if (object_count) {
@@ -910,7 +914,7 @@ static void end_packfile(void)
 
 	/* We can't carry a delta across packfiles. */
 	strbuf_release(&last_blob.data);
-	last_blob.offset = 0;
+	last_blob.entry = NULL;
 	last_blob.depth = 0;
 }
 
@@ -920,110 +924,127 @@ static void cycle_packfile(void)
 	start_packfile();
 }
 
-static int store_object(
-	enum object_type type,
-	struct strbuf *dat,
-	struct last_object *last,
-	struct object_id *oidout,
-	uintmax_t mark)
-{
-	void *out, *delta;
+/*
+ * An object on its way into the pack: store_object() fills in what it is
+ * and what to delta it against, after which it is compressed and written
+ * out at the end of the pack.
+ */
+struct store_job {
 	struct object_entry *e;
-	unsigned char hdr[96];
-	struct object_id oid;
-	unsigned long hdrlen, deltalen;
-	git_hash_ctx c;
-	git_zstream s;
-
-	hdrlen = xsnprintf((char *)hdr, sizeof(hdr), "%s %lu",
-			   type_name(type), (unsigned long)dat->len) + 1;
-	the_hash_algo->init_fn(&c);
-	the_hash_algo->update_fn(&c, hdr, hdrlen);
-	the_hash_algo->update_fn(&c, dat->buf, dat->len);
-	the_hash_algo->final_oid_fn(&oid, &c);
-	if (oidout)
-		oidcpy(oidout, &oid);
-
-	e = insert_object(&oid);
-	if (mark)
-		insert_mark(&marks, mark, e);
-	if (e->idx.offset) {
-		duplicate_count_by_type[type]++;
-		return 1;
-	} else if (find_sha1_pack(oid.hash,
-				  get_all_packs(the_repository))) {
-		e->type = type;
-		e->pack_id = MAX_PACK_ID;
-		e->idx.offset = 1; /* just not zero! */
-		duplicate_count_by_type[type]++;
-		return 1;
-	}
-
-	if (last && last->data.len && last->data.buf && last->depth < max_depth
-		&& dat->len > the_hash_algo->rawsz) {
+	struct object_entry *base;
+	enum object_type type;
+	const char *data, *base_data;
+	unsigned long len, base_len;
+	unsigned int depth;
+	unsigned owned : 1,
+		 done : 1;
+
+	/* results of compress_store_job() */
+	void *delta;
+	unsigned long deltalen;
+	void *out;
+	unsigned long outlen;
+};
 
-		delta_count_attempts_by_type[type]++;
-		delta = diff_delta(last->data.buf, last->data.len,
-			dat->buf, dat->len,
-			&deltalen, dat->len - the_hash_algo->rawsz);
-	} else
-		delta = NULL;
+/*
+ * With --threads, the objects are compressed by worker threads while we
+ * go on parsing the stream.  They are written to the pack in the order
+ * they were stored, by the main thread, once all those stored before
+ * are written; until then, their object_entry has an offset of 1 (so
+ * that duplicates are still recognized) and a depth that assumes the
+ * delta will be used.  Anything that reads back from or writes to the
+ * current pack must call flush_store_jobs() first.
+ */
+static struct store_job *store_jobs;
+static unsigned int store_jobs_alloc;
+static unsigned int store_jobs_first; /* oldest not yet written */
+static unsigned int store_jobs_nr; /* queued and not yet written */
+static unsigned int store_jobs_next; /* next one for a worker */
+static int store_jobs_writing;
+static int store_threads_stop;
+static pthread_t *store_threads;
+static pthread_mutex_t store_mutex;
+static pthread_cond_t store_work_cond;
+static pthread_cond_t store_done_cond;
+
+static void *deflate_buffer(const void *buf, unsigned long len,
+			    unsigned long *outlen)
+{
+	git_zstream s;
+	void *out;
 
 	git_deflate_init(&s, pack_compression_level);
-	if (delta) {
-		s.next_in = delta;
-		s.avail_in = deltalen;
-	} else {
-		s.next_in = (void *)dat->buf;
-		s.avail_in = dat->len;
-	}
+	s.next_in = (void *)buf;
+	s.avail_in = len;
 	s.avail_out = git_deflate_bound(&s, s.avail_in);
 	s.next_out = out = xmalloc(s.avail_out);
 	while (git_deflate(&s, Z_FINISH) == Z_OK)
 		; /* nothing */
 	git_deflate_end(&s);
+	*outlen = s.total_out;
+	return out;
+}
+
+static void compress_store_job(struct store_job *job)
+{
+	if (job->base_data)
+		job->delta = diff_delta(job->base_data, job->base_len,
+					job->data, job->len, &job->deltalen,
+					job->len - the_hash_algo->rawsz);
+	if (job->delta)
+		job->out = deflate_buffer(job->delta, job->deltalen,
+					  &job->outlen);
+	else
+		job->out = deflate_buffer(job->data, job->len, &job->outlen);
+}
+
+static void write_store_job(struct store_job *job)
+{
+	struct object_entry *e = job->e;
+	unsigned char hdr[96];
+	unsigned long hdrlen;
+	unsigned int i;
 
 	/* Determine if we should auto-checkpoint. */
 	if ((max_packsize
-		&& (pack_size + PACK_SIZE_THRESHOLD + s.total_out) > max_packsize)
-		|| (pack_size + PACK_SIZE_THRESHOLD + s.total_out) < pack_size) {
+		&& (pack_size + PACK_SIZE_THRESHOLD + job->outlen) > max_packsize)
+		|| (pack_size + PACK_SIZE_THRESHOLD + job->outlen) < pack_size) {
 
-		/* This new object needs to *not* have the current pack_id. */
+		/*
+		 * This new object, and those queued after it, need to
+		 * *not* have the current pack_id.
+		 */
 		e->pack_id = pack_id + 1;
+		for (i = 1; i < store_jobs_nr; i++)
+			store_jobs[(store_jobs_first + i) % store_jobs_alloc].e->pack_id = pack_id + 1;
 		cycle_packfile();
+	}
 
-		/* We cannot carry a delta into the new pack. */
-		if (delta) {
-			FREE_AND_NULL(delta);
-
-			git_deflate_init(&s, pack_compression_level);
-			s.next_in = (void *)dat->buf;
-			s.avail_in = dat->len;
-			s.avail_out = git_deflate_bound(&s, s.avail_in);
-			s.next_out = out = xrealloc(out, s.avail_out);
-			while (git_deflate(&s, Z_FINISH) == Z_OK)
-				; /* nothing */
-			git_deflate_end(&s);
-		}
+	/* We cannot carry a delta into the new pack. */
+	if (job->delta && job->base->pack_id != pack_id) {
+		FREE_AND_NULL(job->delta);
+		free(job->out);
+		job->out = deflate_buffer(job->data, job->len, &job->outlen);
 	}
 
-	e->type = type;
+	e->type = job->type;
 	e->pack_id = pack_id;
 	e->idx.offset = pack_size;
 	object_count++;
-	object_count_by_type[type]++;
+	object_count_by_type[job->type]++;
 
 	crc32_begin(pack_file);
 
-	if (delta) {
-		off_t ofs = e->idx.offset - last->offset;
+	if (job->delta) {
+		off_t ofs = e->idx.offset - job->base->idx.offset;
 		unsigned pos = sizeof(hdr) - 1;
 
-		delta_count_by_type[type]++;
-		e->depth = last->depth + 1;
+		delta_count_by_type[job->type]++;
+		e->depth = job->depth;
 
 		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
-						      OBJ_OFS_DELTA, deltalen);
+						      OBJ_OFS_DELTA,
+						      job->deltalen);
 		hashwrite(pack_file, hdr, hdrlen);
 		pack_size += hdrlen;
 
@@ -1035,25 +1056,207 @@ static int store_object(
 	} else {
 		e->depth = 0;
 		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
-						      type, dat->len);
+						      job->type, job->len);
 		hashwrite(pack_file, hdr, hdrlen);
 		pack_size += hdrlen;
 	}
 
-	hashwrite(pack_file, out, s.total_out);
-	pack_size += s.total_out;
+	hashwrite(pack_file, job->out, job->outlen);
+	pack_size += job->outlen;
 
 	e->idx.crc32 = crc32_end(pack_file);
 
-	free(out);
-	free(delta);
+	free(job->out);
+	free(job->delta);
+	if (job->owned) {
+		free((char *)job->data);
+		free((char *)job->base_data);
+	}
+}
+
+static void *store_worker(void *data)
+{
+	pthread_mutex_lock(&store_mutex);
+	for (;;) {
+		struct store_job *job;
+
+		while (!store_threads_stop &&
+		       store_jobs_next == store_jobs_first + store_jobs_nr)
+			pthread_cond_wait(&store_work_cond, &store_mutex);
+		if (store_jobs_next == store_jobs_first + store_jobs_nr)
+			break;
+		job = &store_jobs[store_jobs_next++ % store_jobs_alloc];
+		pthread_mutex_unlock(&store_mutex);
+
+		compress_store_job(job);
+
+		pthread_mutex_lock(&store_mutex);
+		job->done = 1;
+		pthread_cond_signal(&store_done_cond);
+	}
+	pthread_mutex_unlock(&store_mutex);
+	return NULL;
+}
+
+static void start_store_threads(void)
+{
+	int i;
+
+	pthread_mutex_init(&store_mutex, NULL);
+	pthread_cond_init(&store_work_cond, NULL);
+	pthread_cond_init(&store_done_cond, NULL);
+	store_jobs_alloc = 2 * nr_threads;
+	CALLOC_ARRAY(store_jobs, store_jobs_alloc);
+	CALLOC_ARRAY(store_threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&store_threads[i], NULL, store_worker, NULL))
+			die(_("unable to create thread"));
+}
+
+/* Write out the oldest job, waiting for it if "wait" is set. */
+static int write_oldest_store_job(int wait)
+{
+	struct store_job *job = &store_jobs[store_jobs_first % store_jobs_alloc];
+
+	pthread_mutex_lock(&store_mutex);
+	while (wait && !job->done)
+		pthread_cond_wait(&store_done_cond, &store_mutex);
+	pthread_mutex_unlock(&store_mutex);
+	if (!job->done)
+		return -1;
+
+	store_jobs_writing = 1;
+	write_store_job(job);
+	store_jobs_writing = 0;
+
+	pthread_mutex_lock(&store_mutex);
+	store_jobs_first++;
+	store_jobs_nr--;
+	pthread_mutex_unlock(&store_mutex);
+	return 0;
+}
+
+static void queue_store_job(struct store_job *job)
+{
+	if (!store_threads)
+		start_store_threads();
+	while (store_jobs_nr == store_jobs_alloc)
+		write_oldest_store_job(1);
+
+	job->owned = 1;
+	job->data = xmemdupz(job->data, job->len);
+	if (job->base_data)
+		job->base_data = xmemdupz(job->base_data, job->base_len);
+
+	pthread_mutex_lock(&store_mutex);
+	store_jobs[(store_jobs_first + store_jobs_nr++) % store_jobs_alloc] = *job;
+	pthread_cond_signal(&store_work_cond);
+	pthread_mutex_unlock(&store_mutex);
+
+	/* Write out what is ready, but do not wait for it */
+	while (store_jobs_nr && !write_oldest_store_job(0))
+		; /* nothing */
+}
+
+static void flush_store_jobs(void)
+{
+	/* the pack is being cycled by write_store_job() itself */
+	if (store_jobs_writing)
+		return;
+	while (store_jobs_nr)
+		write_oldest_store_job(1);
+}
+
+static void stop_store_threads(void)
+{
+	int i;
+
+	if (!store_threads)
+		return;
+	flush_store_jobs();
+	pthread_mutex_lock(&store_mutex);
+	store_threads_stop = 1;
+	pthread_cond_broadcast(&store_work_cond);
+	pthread_mutex_unlock(&store_mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(store_threads[i], NULL);
+	FREE_AND_NULL(store_threads);
+	FREE_AND_NULL(store_jobs);
+	pthread_cond_destroy(&store_work_cond);
+	pthread_cond_destroy(&store_done_cond);
+	pthread_mutex_destroy(&store_mutex);
+}
+
+static int store_object(
+	enum object_type type,
+	struct strbuf *dat,
+	struct last_object *last,
+	struct object_id *oidout,
+	uintmax_t mark)
+{
+	struct store_job job = { 0 };
+	struct object_entry *e;
+	unsigned char hdr[96];
+	struct object_id oid;
+	unsigned long hdrlen;
+	git_hash_ctx c;
+
+	hdrlen = xsnprintf((char *)hdr, sizeof(hdr), "%s %lu",
+			   type_name(type), (unsigned long)dat->len) + 1;
+	the_hash_algo->init_fn(&c);
+	the_hash_algo->update_fn(&c, hdr, hdrlen);
+	the_hash_algo->update_fn(&c, dat->buf, dat->len);
+	the_hash_algo->final_oid_fn(&oid, &c);
+	if (oidout)
+		oidcpy(oidout, &oid);
+
+	e = insert_object(&oid);
+	if (mark)
+		insert_mark(&marks, mark, e);
+	if (e->idx.offset) {
+		duplicate_count_by_type[type]++;
+		return 1;
+	} else if (find_sha1_pack(oid.hash,
+				  get_all_packs(the_repository))) {
+		e->type = type;
+		e->pack_id = MAX_PACK_ID;
+		e->idx.offset = 1; /* just not zero! */
+		duplicate_count_by_type[type]++;
+		return 1;
+	}
+
+	job.e = e;
+	job.type = type;
+	job.data = dat->buf;
+	job.len = dat->len;
+	if (last && last->data.len && last->data.buf && last->depth < max_depth
+		&& dat->len > the_hash_algo->rawsz) {
+
+		delta_count_attempts_by_type[type]++;
+		job.base = last->entry;
+		job.base_data = last->data.buf;
+		job.base_len = last->data.len;
+		job.depth = last->depth + 1;
+	}
+
+	if (HAVE_THREADS && nr_threads > 1) {
+		e->type = type;
+		e->pack_id = pack_id;
+		e->idx.offset = 1; /* just not zero! */
+		e->depth = job.depth;
+		queue_store_job(&job);
+	} else {
+		compress_store_job(&job);
+		write_store_job(&job);
+	}
+
 	if (last) {
 		if (last->no_swap) {
 			last->data = *dat;
 		} else {
 			strbuf_swap(&last->data, dat);
 		}
-		last->offset = e->idx.offset;
+		last->entry = e;
 		last->depth = e->depth;
 	}
 	return 0;
@@ -1080,6 +1283,8 @@ static void stream_blob(uintmax_t len, struct object_id *oidout, uintmax_t mark)
 	struct hashfile_checkpoint checkpoint;
 	int status = Z_OK;
 
+	flush_store_jobs();
+
 	/* Determine if we should auto-checkpoint. */
 	if ((max_packsize
 		&& (pack_size + PACK_SIZE_THRESHOLD + len) > max_packsize)
@@ -1195,7 +1400,11 @@ static void *gfi_unpack_entry(
 	unsigned long *sizep)
 {
 	enum object_type type;
-	struct packed_git *p = all_packs[oe->pack_id];
+	struct packed_git *p;
+
+	if (oe->pack_id == pack_id)
+		flush_store_jobs();
+	p = all_packs[oe->pack_id];
 	if (p == pack_data && p->pack_size < (pack_size + the_hash_algo->rawsz)) {
 		/* The object is stored in the packfile we are writing to
 		 * and we have modified it since the last time we scanned
@@ -1353,7 +1562,7 @@ static void store_tree(struct tree_entry *root)
 	if (S_ISDIR(root->versions[0].mode) && le && le->pack_id == pack_id) {
 		mktree(t, 0, &old_tree);
 		lo.data = old_tree;
-		lo.offset = le->idx.offset;
+		lo.entry = le;
 		lo.depth = t->delta_depth;
 	}
 
@@ -1996,7 +2205,7 @@ static void parse_and_store_blob(
 	else {
 		if (last) {
 			strbuf_release(&last->data);
-			last->offset = 0;
+			last->entry = NULL;
 			last->depth = 0;
 		}
 		stream_blob(len, oidout, mark);
@@ -2957,7 +3166,7 @@ static void cat_blob(struct object_entry *oe, struct object_id *oid)
 	cat_blob_write(buf, size);
 	cat_blob_write("\n", 1);
 	if (oe && oe->pack_id == pack_id) {
-		last_blob.offset = oe->idx.offset;
+		last_blob.entry = oe;
 		strbuf_attach(&last_blob.data, buf, size, size);
 		last_blob.depth = oe->depth;
 	} else
@@ -3189,6 +3398,7 @@ static void parse_ls(const char *p, struct branch *b)
 static void checkpoint(void)
 {
 	checkpoint_requested = 0;
+	flush_store_jobs();
 	if (object_count) {
 		cycle_packfile();
 	}
@@ -3287,6 +3497,17 @@ static void option_depth(const char *depth)
 		die("--depth cannot exceed %u", MAX_DEPTH);
 }
 
+static void option_threads(const char *threads)
+{
+	nr_threads = ulong_arg("--threads", threads);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS && nr_threads != 1) {
+		warning(_("no threads support, ignoring --threads"));
+		nr_threads = 1;
+	}
+}
+
 static void option_active_branches(const char *branches)
 {
 	max_active_branches = ulong_arg("--active-branches", branches);
@@ -3354,6 +3575,8 @@ static int parse_one_option(const char *option)
 		big_file_threshold = v;
 	} else if (skip_prefix(option, "depth=", &option)) {
 		option_depth(option);
+	} else if (skip_prefix(option, "threads=", &option)) {
+		option_threads(option);
 	} else if (skip_prefix(option, "active-branches=", &option)) {
 		option_active_branches(option);
 	} else if (skip_prefix(option, "export-pack-edges=", &option)) {
@@ -3595,6 +3818,7 @@ int cmd_fast_import(int argc, const char **argv, const char *prefix)
 	if (require_explicit_termination && feof(stdin))
 		die("stream ends early");
 
+	stop_store_threads();
 	end_packfile();
 
 	dump_branches();
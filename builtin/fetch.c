@@ -28,6 +28,8 @@
 #include "promisor-remote.h"
 #include "commit-graph.h"
 #include "shallow.h"
+#include "strmap.h"
+#include "bundle-uri.h"
 
 #define FORCED_UPDATES_DELAY_WARNING_IN_MS (10 * 1000)
 
@@ -48,6 +50,7 @@ enum {
 static int fetch_prune_config = -1; /* unspecified */
 static int fetch_show_forced_updates = 1;
 static uint64_t forced_updates_ms = 0;
+static struct strintmap fast_forwards = STRINTMAP_INIT;
 static int prefetch = 0;
 static int prune = -1; /* unspecified */
 #define PRUNE_BY_DEFAULT 0 /* do we prune by default? */
@@ -81,7 +84,9 @@ static struct refspec refmap = REFSPEC_INIT_FETCH;
 static struct list_objects_filter_options filter_options;
 static struct string_list server_options = STRING_LIST_INIT_DUP;
 static struct string_list negotiation_tip = STRING_LIST_INIT_NODUP;
+static struct string_list bundle_uris = STRING_LIST_INIT_NODUP;
 static int fetch_write_commit_graph = -1;
+static struct oidset fetched_tips = OIDSET_INIT;
 static int stdin_refspecs = 0;
 static int negotiate_only;
 
@@ -206,6 +211,8 @@ static struct option builtin_fetch_options[] = {
 			TRANSPORT_FAMILY_IPV6),
 	OPT_STRING_LIST(0, "negotiation-tip", &negotiation_tip, N_("revision"),
 			N_("report that we have only objects reachable from this object")),
+	OPT_STRING_LIST(0, "bundle-uri", &bundle_uris, N_("uri"),
+			N_("fetch a bundle from the given URI before the remotes")),
 	OPT_BOOL(0, "negotiate-only", &negotiate_only,
 		 N_("do not fetch a packfile; instead, print ancestors of negotiation tips")),
 	OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
@@ -490,6 +497,7 @@ static void filter_prefetch_refspec(struct refspec *rs)
 
 		free(old_dst);
 	}
+	refspec_forget_index(rs);
 }
 
 static struct ref *get_ref_map(struct remote *remote,
@@ -515,11 +523,10 @@ static struct ref *get_ref_map(struct remote *remote,
 	if (rs->nr) {
 		struct refspec *fetch_refspec;
 
-		for (i = 0; i < rs->nr; i++) {
-			get_fetch_map(remote_refs, &rs->items[i], &tail, 0);
+		get_fetch_maps(remote_refs, rs, &tail, 0);
+		for (i = 0; i < rs->nr; i++)
 			if (rs->items[i].dst && rs->items[i].dst[0])
 				*autotags = 1;
-		}
 		/* Merge everything on the command line (but not --tags) */
 		for (rm = ref_map; rm; rm = rm->next)
 			rm->fetch_head_status = FETCH_HEAD_MERGE;
@@ -549,8 +556,7 @@ static struct ref *get_ref_map(struct remote *remote,
 		else
 			fetch_refspec = &remote->fetch;
 
-		for (i = 0; i < fetch_refspec->nr; i++)
-			get_fetch_map(ref_map, &fetch_refspec->items[i], &oref_tail, 1);
+		get_fetch_maps(ref_map, fetch_refspec, &oref_tail, 1);
 	} else if (refmap.nr) {
 		die("--refmap option is only meaningful with command-line refspec(s).");
 	} else {
@@ -561,15 +567,19 @@ static struct ref *get_ref_map(struct remote *remote,
 		    (remote->fetch.nr ||
 		     /* Note: has_merge implies non-NULL branch->remote_name */
 		     (has_merge && !strcmp(branch->remote_name, remote->name)))) {
-			for (i = 0; i < remote->fetch.nr; i++) {
-				get_fetch_map(remote_refs, &remote->fetch.items[i], &tail, 0);
+			get_fetch_maps(remote_refs, &remote->fetch, &tail, 0);
+			for (i = 0; i < remote->fetch.nr; i++)
 				if (remote->fetch.items[i].dst &&
 				    remote->fetch.items[i].dst[0])
 					*autotags = 1;
-				if (!i && !has_merge && ref_map &&
-				    !remote->fetch.items[0].pattern)
-					ref_map->fetch_head_status = FETCH_HEAD_MERGE;
-			}
+			/*
+			 * The first ref of the map comes from the first
+			 * refspec, unless that one is negative.
+			 */
+			if (!has_merge && ref_map &&
+			    !remote->fetch.items[0].pattern &&
+			    !remote->fetch.items[0].negative)
+				ref_map->fetch_head_status = FETCH_HEAD_MERGE;
 			/*
 			 * if the remote we're fetching from is the same
 			 * as given in branch.<name>.remote, we add the
@@ -926,7 +936,9 @@ static int update_local_ref(struct ref *ref,
 
 	if (fetch_show_forced_updates) {
 		uint64_t t_before = getnanotime();
-		fast_forward = in_merge_bases(current, updated);
+		fast_forward = strintmap_get(&fast_forwards, ref->name);
+		if (fast_forward < 0)
+			fast_forward = in_merge_bases(current, updated);
 		forced_updates_ms += (getnanotime() - t_before) / 1000000;
 	} else {
 		fast_forward = 1;
@@ -1032,22 +1044,17 @@ static void append_fetch_head(struct fetch_head *fetch_head,
 		else
 			strbuf_addch(&fetch_head->buf, url[i]);
 	strbuf_addch(&fetch_head->buf, '\n');
-
-	/*
-	 * When using an atomic fetch, we do not want to update FETCH_HEAD if
-	 * any of the reference updates fails. We thus have to write all
-	 * updates to a buffer first and only commit it as soon as all
-	 * references have been successfully updated.
-	 */
-	if (!atomic_fetch) {
-		strbuf_write(&fetch_head->buf, fetch_head->fp);
-		strbuf_reset(&fetch_head->buf);
-	}
 }
 
+/*
+ * The entries are only written out once the references have been
+ * updated: an atomic fetch must not update FETCH_HEAD if any of the
+ * reference updates fails, and a batched update may have to be
+ * redone one reference at a time, appending the entries again.
+ */
 static void commit_fetch_head(struct fetch_head *fetch_head)
 {
-	if (!fetch_head->fp || !atomic_fetch)
+	if (!fetch_head->fp)
 		return;
 	strbuf_write(&fetch_head->buf, fetch_head->fp);
 }
@@ -1070,48 +1077,97 @@ N_("It took %.2f seconds to check forced updates. You can use\n"
    "'--no-show-forced-updates' or run 'git config fetch.showForcedUpdates false'\n"
    " to avoid this check.\n");
 
-static int store_updated_refs(const char *raw_url, const char *remote_name,
-			      int connectivity_checked, struct ref *ref_map)
+/*
+ * Find out at once which of the updates of existing branches in
+ * "ref_map" are fast-forwards, with one walk that is shared by all of
+ * them, rather than with a separate walk for each.  The answers are
+ * left in "fast_forwards", keyed by the name of the local ref; refs
+ * that are not there are checked by update_local_ref() itself.
+ */
+static void compute_fast_forwards(struct ref *ref_map)
 {
-	struct fetch_head fetch_head;
-	struct commit *commit;
-	int url_len, i, rc = 0;
-	struct strbuf note = STRBUF_INIT, err = STRBUF_INIT;
-	struct ref_transaction *transaction = NULL;
-	const char *what, *kind;
+	struct commit **commits = NULL;
+	struct ahead_behind_count *counts = NULL;
+	const char **names = NULL;
+	size_t commits_nr = 0, commits_alloc = 0;
+	size_t counts_nr = 0, counts_alloc = 0, names_alloc = 0;
 	struct ref *rm;
-	char *url;
-	int want_status;
-	int summary_width = transport_summary_width(ref_map);
+	size_t i;
 
-	rc = open_fetch_head(&fetch_head);
-	if (rc)
-		return -1;
+	if (!fetch_show_forced_updates || dry_run)
+		return;
 
-	if (raw_url)
-		url = transport_anonymize_url(raw_url);
-	else
-		url = xstrdup("foreign");
+	/*
+	 * Without generation numbers the shared walk would first have to
+	 * go over all of history, which is more than the walks of a few
+	 * refs would cost.
+	 */
+	if (!generation_numbers_enabled(the_repository))
+		return;
 
-	if (!connectivity_checked) {
-		struct check_connected_options opt = CHECK_CONNECTED_INIT;
+	for (rm = ref_map; rm; rm = rm->next) {
+		struct commit *current, *updated;
 
-		rm = ref_map;
-		if (check_connected(iterate_ref_map, &rm, &opt)) {
-			rc = error(_("%s did not send all necessary objects\n"), url);
-			goto abort;
-		}
+		if (rm->status == REF_STATUS_REJECT_SHALLOW || !rm->peer_ref ||
+		    is_null_oid(&rm->peer_ref->old_oid) ||
+		    oideq(&rm->peer_ref->old_oid, &rm->old_oid) ||
+		    starts_with(rm->peer_ref->name, "refs/tags/"))
+			continue;
+
+		current = lookup_commit_reference_gently(the_repository,
+							 &rm->peer_ref->old_oid, 1);
+		updated = lookup_commit_reference_gently(the_repository,
+							 &rm->old_oid, 1);
+		if (!current || !updated)
+			continue;
+
+		ALLOC_GROW(commits, commits_nr + 2, commits_alloc);
+		ALLOC_GROW(counts, counts_nr + 1, counts_alloc);
+		ALLOC_GROW(names, counts_nr + 1, names_alloc);
+		counts[counts_nr].tip_index = commits_nr;
+		commits[commits_nr++] = updated;
+		counts[counts_nr].base_index = commits_nr;
+		commits[commits_nr++] = current;
+		names[counts_nr++] = rm->peer_ref->name;
 	}
 
-	if (atomic_fetch) {
-		transaction = ref_transaction_begin(&err);
-		if (!transaction) {
-			error("%s", err.buf);
-			goto abort;
-		}
+	if (counts_nr > 1) {
+		uint64_t t_before = getnanotime();
+
+		trace2_region_enter("fetch", "fast_forward_checks", the_repository);
+		ahead_behind(the_repository, commits, commits_nr,
+			     counts, counts_nr);
+		for (i = 0; i < counts_nr; i++)
+			strintmap_set(&fast_forwards, names[i],
+				      !counts[i].behind);
+		trace2_region_leave("fetch", "fast_forward_checks", the_repository);
+		trace2_data_intmax("fetch", the_repository,
+				   "fast_forward_checks/refs", counts_nr);
+		forced_updates_ms += (getnanotime() - t_before) / 1000000;
 	}
 
-	prepare_format_display(ref_map);
+	free(commits);
+	free(counts);
+	free(names);
+}
+
+/*
+ * Update the local refs of "ref_map" and record them for FETCH_HEAD.
+ * The updates are queued in "transaction" if there is one, and made
+ * one at a time otherwise.  The lines describing the updates go to
+ * "out" if it is given, and are shown right away otherwise.
+ */
+static int store_ref_map(struct ref *ref_map, const char *url,
+			 struct ref_transaction *transaction,
+			 struct fetch_head *fetch_head,
+			 int summary_width, struct strbuf *out)
+{
+	struct commit *commit;
+	int url_len, i, rc = 0;
+	struct strbuf note = STRBUF_INIT;
+	const char *what, *kind;
+	struct ref *rm;
+	int want_status;
 
 	/*
 	 * We do a pass for each fetch_head_status type in their enum order, so
@@ -1140,6 +1196,8 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 			if (rm->fetch_head_status != want_status)
 				continue;
 
+			oidset_insert(&fetched_tips, &rm->old_oid);
+
 			if (rm->peer_ref) {
 				ref = alloc_ref(rm->peer_ref->name);
 				oidcpy(&ref->old_oid, &rm->peer_ref->old_oid);
@@ -1181,7 +1239,7 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 				strbuf_addf(&note, "'%s' of ", what);
 			}
 
-			append_fetch_head(&fetch_head, &rm->old_oid,
+			append_fetch_head(fetch_head, &rm->old_oid,
 					  rm->fetch_head_status,
 					  note.buf, url, url_len);
 
@@ -1201,27 +1259,110 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 					       *what ? what : "HEAD",
 					       "FETCH_HEAD", summary_width);
 			}
-			if (note.len) {
-				if (verbosity >= 0 && !shown_url) {
-					fprintf(stderr, _("From %.*s\n"),
+			if (note.len && verbosity >= 0) {
+				if (!shown_url) {
+					if (out)
+						strbuf_addf(out, _("From %.*s\n"),
+							    url_len, url);
+					else
+						fprintf(stderr, _("From %.*s\n"),
 							url_len, url);
 					shown_url = 1;
 				}
-				if (verbosity >= 0)
+				if (out)
+					strbuf_addf(out, " %s\n", note.buf);
+				else
 					fprintf(stderr, " %s\n", note.buf);
 			}
 		}
 	}
 
-	if (!rc && transaction) {
-		rc = ref_transaction_commit(transaction, &err);
-		if (rc) {
+	strbuf_release(&note);
+	return rc;
+}
+
+static int store_updated_refs(const char *raw_url, const char *remote_name,
+			      int connectivity_checked, struct ref *ref_map)
+{
+	struct fetch_head fetch_head;
+	int rc = 0;
+	struct strbuf err = STRBUF_INIT, out = STRBUF_INIT;
+	struct ref_transaction *transaction = NULL;
+	struct ref *rm;
+	char *url;
+	int summary_width = transport_summary_width(ref_map);
+
+	rc = open_fetch_head(&fetch_head);
+	if (rc)
+		return -1;
+
+	if (raw_url)
+		url = transport_anonymize_url(raw_url);
+	else
+		url = xstrdup("foreign");
+
+	if (!connectivity_checked) {
+		struct check_connected_options opt = CHECK_CONNECTED_INIT;
+
+		rm = ref_map;
+		if (check_connected(iterate_ref_map, &rm, &opt)) {
+			rc = error(_("%s did not send all necessary objects\n"), url);
+			goto abort;
+		}
+	}
+
+	/*
+	 * Without --atomic, the updates are still queued in a single
+	 * transaction, as committing them all at once is much cheaper
+	 * than committing each of them.  When that fails, they are
+	 * redone one at a time below, so that one ref that cannot be
+	 * updated does not hold back the others.
+	 */
+	if (atomic_fetch || !dry_run) {
+		transaction = ref_transaction_begin(&err);
+		if (!transaction) {
 			error("%s", err.buf);
 			goto abort;
 		}
 	}
 
-	if (!rc)
+	strintmap_init(&fast_forwards, -1);
+	compute_fast_forwards(ref_map);
+
+	prepare_format_display(ref_map);
+
+	trace2_region_enter("fetch", "update_refs", the_repository);
+	if (atomic_fetch) {
+		rc = store_ref_map(ref_map, url, transaction, &fetch_head,
+				   summary_width, NULL);
+		if (!rc && ref_transaction_commit(transaction, &err)) {
+			rc = error("%s", err.buf);
+			trace2_region_leave("fetch", "update_refs", the_repository);
+			strintmap_clear(&fast_forwards);
+			goto abort;
+		}
+	} else {
+		int saved_shown_url = shown_url;
+
+		rc = store_ref_map(ref_map, url, transaction, &fetch_head,
+				   summary_width, transaction ? &out : NULL);
+		if (transaction && ref_transaction_commit(transaction, &err)) {
+			trace2_data_string("fetch", the_repository,
+					   "update_refs/batch_failed", err.buf);
+			ref_transaction_free(transaction);
+			transaction = NULL;
+			strbuf_reset(&out);
+			strbuf_reset(&fetch_head.buf);
+			shown_url = saved_shown_url;
+			rc = store_ref_map(ref_map, url, NULL, &fetch_head,
+					   summary_width, NULL);
+		}
+		fputs(out.buf, stderr);
+	}
+	trace2_region_leave("fetch", "update_refs", the_repository);
+	strintmap_clear(&fast_forwards);
+
+	if (!rc || !atomic_fetch)
 		commit_fetch_head(&fetch_head);
 
 	if (rc & STORE_REF_ERROR_DF_CONFLICT)
@@ -1239,8 +1380,8 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 	}
 
  abort:
-	strbuf_release(&note);
 	strbuf_release(&err);
+	strbuf_release(&out);
 	ref_transaction_free(transaction);
 	free(url);
 	close_fetch_head(&fetch_head);
@@ -2051,6 +2192,18 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 		}
 	}
 
+	if (negotiate_only && bundle_uris.nr)
+		die(_("--negotiate-only and --bundle-uri are incompatible"));
+
+	/*
+	 * Unbundle before fetching, in this process only, so that the
+	 * remotes only need to send what is newer.
+	 */
+	for (i = 0; i < bundle_uris.nr; i++)
+		if (fetch_bundle_uri(the_repository, bundle_uris.items[i].string))
+			warning(_("failed to fetch objects from bundle URI '%s'"),
+				bundle_uris.items[i].string);
+
 	if (negotiate_only) {
 		struct oidset acked_commits = OIDSET_INIT;
 		struct oidset_iter iter;
@@ -2130,10 +2283,21 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 		if (progress)
 			commit_graph_flags |= COMMIT_GRAPH_WRITE_PROGRESS;
 
-		write_commit_graph_reachable(the_repository->objects->odb,
-					     commit_graph_flags,
-					     NULL);
+		/*
+		 * When we fetched from a single remote, everything new is
+		 * reachable from what we fetched; there is no need to look
+		 * at all the refs.
+		 */
+		if (remote && !bundle_uris.nr)
+			write_commit_graph_for_tips(the_repository->objects->odb,
+						    &fetched_tips,
+						    commit_graph_flags);
+		else
+			write_commit_graph_reachable(the_repository->objects->odb,
+						     commit_graph_flags,
+						     NULL);
 	}
+	oidset_clear(&fetched_tips);
 
 	close_object_store(the_repository->objects);
 
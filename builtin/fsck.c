@@ -21,6 +21,7 @@
 #include "object-store.h"
 #include "run-command.h"
 #include "worktree.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -44,6 +45,7 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int nr_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -51,6 +53,29 @@ static int name_objects;
 #define ERROR_COMMIT_GRAPH 020
 #define ERROR_MULTI_PACK_INDEX 040
 
+/*
+ * While the objects of a pack are checked by several threads, this
+ * serializes everything but the checks of the object contents
+ * themselves: the object table, the output and describe_object().
+ */
+static int fsck_threads_active;
+static pthread_mutex_t fsck_mutex;
+static pthread_key_t fsck_options_key;
+static struct fsck_options **thread_options;
+static int thread_options_nr, thread_options_alloc;
+
+static void fsck_lock(void)
+{
+	if (fsck_threads_active)
+		pthread_mutex_lock(&fsck_mutex);
+}
+
+static void fsck_unlock(void)
+{
+	if (fsck_threads_active)
+		pthread_mutex_unlock(&fsck_mutex);
+}
+
 static const char *describe_object(const struct object_id *oid)
 {
 	return fsck_describe_object(&fsck_walk_options, oid);
@@ -88,23 +113,30 @@ static int fsck_error_func(struct fsck_options *o,
 			   enum fsck_msg_id msg_id,
 			   const char *message)
 {
+	int ret;
+
+	fsck_lock();
 	switch (msg_type) {
 	case FSCK_WARN:
 		/* TRANSLATORS: e.g. warning in tree 01bfda: <more explanation> */
 		fprintf_ln(stderr, _("warning in %s %s: %s"),
 			   printable_type(oid, object_type),
 			   describe_object(oid), message);
-		return 0;
+		ret = 0;
+		break;
 	case FSCK_ERROR:
 		/* TRANSLATORS: e.g. error in tree 01bfda: <more explanation> */
 		fprintf_ln(stderr, _("error in %s %s: %s"),
 			   printable_type(oid, object_type),
 			   describe_object(oid), message);
-		return 1;
+		ret = 1;
+		break;
 	default:
 		BUG("%d (FSCK_IGNORE?) should never trigger this callback",
 		    msg_type);
 	}
+	fsck_unlock();
+	return ret;
 }
 
 static struct object_array pending;
@@ -394,7 +426,12 @@ static void check_connectivity(void)
 	}
 }
 
-static int fsck_obj(struct object *obj, void *buffer, unsigned long size)
+/*
+ * If "checked" is not NULL, the contents of "obj" have already been
+ * checked with fsck_buffer(), with this result.
+ */
+static int fsck_obj(struct object *obj, void *buffer, unsigned long size,
+		    const int *checked)
 {
 	int err;
 
@@ -409,7 +446,10 @@ static int fsck_obj(struct object *obj, void *buffer, unsigned long size)
 
 	if (fsck_walk(obj, NULL, &fsck_obj_options))
 		objerror(obj, _("broken links"));
-	err = fsck_object(obj, buffer, size, &fsck_obj_options);
+	if (checked)
+		err = *checked;
+	else
+		err = fsck_object(obj, buffer, size, &fsck_obj_options);
 	if (err)
 		goto out;
 
@@ -442,6 +482,60 @@ static int fsck_obj(struct object *obj, void *buffer, unsigned long size)
 	return err;
 }
 
+/*
+ * The options a thread checks object contents with.  They share the
+ * configuration of fsck_obj_options, but collect the .gitmodules blobs
+ * they find on their own, until
+ * merge_thread_fsck_options() hands them to fsck_finish().
+ */
+static struct fsck_options *thread_fsck_options(void)
+{
+	struct fsck_options *o = pthread_getspecific(fsck_options_key);
+
+	if (!o) {
+		o = xmalloc(sizeof(*o));
+		*o = fsck_obj_options;
+		oidset_init(&o->gitmodules_found, 0);
+		oidset_init(&o->gitmodules_done, 0);
+		pthread_setspecific(fsck_options_key, o);
+
+		fsck_lock();
+		ALLOC_GROW(thread_options, thread_options_nr + 1,
+			   thread_options_alloc);
+		thread_options[thread_options_nr++] = o;
+		fsck_unlock();
+	}
+	return o;
+}
+
+static void merge_oidset(struct oidset *dst, struct oidset *src)
+{
+	struct oidset_iter iter;
+	const struct object_id *oid;
+
+	oidset_iter_init(src, &iter);
+	while ((oid = oidset_iter_next(&iter)))
+		oidset_insert(dst, oid);
+	oidset_clear(src);
+}
+
+static void merge_thread_fsck_options(void)
+{
+	int i;
+
+	for (i = 0; i < thread_options_nr; i++) {
+		struct fsck_options *o = thread_options[i];
+
+		merge_oidset(&fsck_obj_options.gitmodules_found,
+			     &o->gitmodules_found);
+		merge_oidset(&fsck_obj_options.gitmodules_done,
+			     &o->gitmodules_done);
+		free(o);
+	}
+	FREE_AND_NULL(thread_options);
+	thread_options_nr = thread_options_alloc = 0;
+}
+
 static int fsck_obj_buffer(const struct object_id *oid, enum object_type type,
 			   unsigned long size, void *buffer, int *eaten)
 {
@@ -450,16 +544,34 @@ static int fsck_obj_buffer(const struct object_id *oid, enum object_type type,
 	 * verify_packfile(), data_valid variable for details.
 	 */
 	struct object *obj;
+	int checked, ret;
+
+	/*
+	 * Check the contents before taking the lock, so that threads
+	 * can do that at the same time.  Blobs are left for later, as
+	 * checking the .gitmodules ones means parsing them as config,
+	 * which only one thread may do at a time.
+	 */
+	if (fsck_threads_active && type != OBJ_BLOB)
+		checked = fsck_buffer(oid, type, buffer, size,
+				      thread_fsck_options());
+
+	fsck_lock();
 	obj = parse_object_buffer(the_repository, oid, type, size, buffer,
 				  eaten);
 	if (!obj) {
 		errors_found |= ERROR_OBJECT;
-		return error(_("%s: object corrupt or missing"),
-			     oid_to_hex(oid));
+		ret = error(_("%s: object corrupt or missing"),
+			    oid_to_hex(oid));
+	} else {
+		obj->flags &= ~(REACHABLE | SEEN);
+		obj->flags |= HAS_OBJ;
+		ret = fsck_obj(obj, buffer, size,
+			       fsck_threads_active && type != OBJ_BLOB ?
+			       &checked : NULL);
 	}
-	obj->flags &= ~(REACHABLE | SEEN);
-	obj->flags |= HAS_OBJ;
-	return fsck_obj(obj, buffer, size);
+	fsck_unlock();
+	return ret;
 }
 
 static int default_refs;
@@ -625,7 +737,7 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 
 	obj->flags &= ~(REACHABLE | SEEN);
 	obj->flags |= HAS_OBJ;
-	if (fsck_obj(obj, contents, size))
+	if (fsck_obj(obj, contents, size, NULL))
 		errors_found |= ERROR_OBJECT;
 
 	if (!eaten)
@@ -767,6 +879,7 @@ static struct option fsck_opts[] = {
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
+	OPT_INTEGER(0, "threads", &nr_threads, N_("use <n> threads to check packed objects")),
 	OPT_END(),
 };
 
@@ -804,6 +917,15 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	git_config(git_fsck_config, &fsck_obj_options);
 
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+	if (!HAVE_THREADS && nr_threads > 1) {
+		warning(_("no threads support, ignoring --threads"));
+		nr_threads = 1;
+	}
+	if (!nr_threads)
+		nr_threads = HAVE_THREADS ? online_cpus() : 1;
+
 	if (connectivity_only) {
 		for_each_loose_object(mark_loose_for_connectivity, NULL, 0);
 		for_each_packed_object(mark_packed_for_connectivity, NULL, 0);
@@ -817,6 +939,12 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 			uint32_t total = 0, count = 0;
 			struct progress *progress = NULL;
 
+			if (nr_threads > 1) {
+				init_recursive_mutex(&fsck_mutex);
+				pthread_key_create(&fsck_options_key, NULL);
+				fsck_threads_active = 1;
+			}
+
 			if (show_progress) {
 				for (p = get_all_packs(the_repository); p;
 				     p = p->next) {
@@ -832,11 +960,18 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
 			stop_progress(&progress);
+
+			if (fsck_threads_active) {
+				merge_thread_fsck_options();
+				pthread_key_delete(fsck_options_key);
+				pthread_mutex_destroy(&fsck_mutex);
+				fsck_threads_active = 0;
+			}
 		}
 
 		if (fsck_finish(&fsck_obj_options))
@@ -0,0 +1,556 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
+#include "compat/fsmonitor/fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "simple-ipc.h"
+
+static const char * const builtin_fsmonitor__daemon_usage[] = {
+	N_("git fsmonitor--daemon start [<options>]"),
+	N_("git fsmonitor--daemon run [<options>]"),
+	N_("git fsmonitor--daemon stop"),
+	N_("git fsmonitor--daemon status"),
+	NULL
+};
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+/*
+ * Global state loaded from config.
+ */
+#define FSMONITOR__IPC_THREADS "fsmonitor.ipcthreads"
+static int fsmonitor__ipc_threads = 8;
+
+#define FSMONITOR__START_TIMEOUT "fsmonitor.starttimeout"
+static int fsmonitor__start_timeout_sec = 60;
+
+static int fsmonitor_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, FSMONITOR__IPC_THREADS)) {
+		int i = git_config_int(var, value);
+		if (i < 1)
+			return error(_("value of '%s' out of range: %d"),
+				     FSMONITOR__IPC_THREADS, i);
+		fsmonitor__ipc_threads = i;
+		return 0;
+	}
+
+	if (!strcmp(var, FSMONITOR__START_TIMEOUT)) {
+		int i = git_config_int(var, value);
+		if (i < 0)
+			return error(_("value of '%s' out of range: %d"),
+				     FSMONITOR__START_TIMEOUT, i);
+		fsmonitor__start_timeout_sec = i;
+		return 0;
+	}
+
+	return git_default_config(var, value, cb);
+}
+
+/*
+ * Once this many changes are retained, drop them all: a client that
+ * has not asked for so long is better off rescanning the worktree.
+ */
+#define FSMONITOR_MAX_CHANGES (1024 * 1024)
+
+/* How long a client waits for the daemon to see its cookie file. */
+#define FSMONITOR_COOKIE_TIMEOUT_SEC 1
+
+enum fsmonitor_cookie_state {
+	FCIS_PENDING = 1,
+	FCIS_SEEN,
+};
+
+static void with_lock__new_token_id(struct fsmonitor_daemon_state *state)
+{
+	static int counter;
+	size_t i;
+
+	strbuf_reset(&state->token_id);
+	strbuf_addf(&state->token_id, "%"PRIuMAX".%"PRIuMAX".%d",
+		    (uintmax_t)getpid(), (uintmax_t)time(NULL), counter++);
+
+	for (i = 0; i < state->changes_nr; i++)
+		free(state->changes[i].path);
+	state->changes_nr = 0;
+}
+
+void fsmonitor_force_resync(struct fsmonitor_daemon_state *state)
+{
+	pthread_mutex_lock(&state->main_lock);
+	trace2_data_string("fsmonitor", the_repository, "resync",
+			   state->token_id.buf);
+	with_lock__new_token_id(state);
+	pthread_mutex_unlock(&state->main_lock);
+}
+
+void fsmonitor_publish(struct fsmonitor_daemon_state *state,
+		       const struct string_list *paths,
+		       const struct string_list *cookie_names)
+{
+	size_t i;
+
+	pthread_mutex_lock(&state->main_lock);
+
+	if (paths->nr) {
+		state->current_seq++;
+		if (state->changes_nr + paths->nr > FSMONITOR_MAX_CHANGES)
+			with_lock__new_token_id(state);
+		ALLOC_GROW(state->changes, state->changes_nr + paths->nr,
+			   state->changes_alloc);
+		for (i = 0; i < paths->nr; i++) {
+			struct fsmonitor_change *c =
+				&state->changes[state->changes_nr++];
+
+			c->seq = state->current_seq;
+			c->path = xstrdup(paths->items[i].string);
+		}
+	}
+
+	for (i = 0; i < cookie_names->nr; i++) {
+		const char *name = cookie_names->items[i].string;
+
+		if (strintmap_get(&state->cookies, name) == FCIS_PENDING)
+			strintmap_set(&state->cookies, name, FCIS_SEEN);
+	}
+	if (cookie_names->nr)
+		pthread_cond_broadcast(&state->cookies_cond);
+
+	pthread_mutex_unlock(&state->main_lock);
+}
+
+/*
+ * Create a cookie file and wait until the listener has seen it, so
+ * that all the events for changes the client made before asking us
+ * are accounted for. Called and returns with main_lock held.
+ */
+static void with_lock__wait_for_cookie(struct fsmonitor_daemon_state *state)
+{
+	struct strbuf name = STRBUF_INIT, path = STRBUF_INIT;
+	struct timespec ts;
+	int fd;
+
+	strbuf_addf(&name, "%"PRIuMAX"-%d",
+		    (uintmax_t)getpid(), state->cookie_seq++);
+	strbuf_addf(&path, "%s/%s", state->path_cookie_dir.buf, name.buf);
+	strintmap_set(&state->cookies, name.buf, FCIS_PENDING);
+
+	pthread_mutex_unlock(&state->main_lock);
+	fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL | O_TRUNC, 0600);
+	if (fd >= 0)
+		close(fd);
+	else
+		error_errno(_("could not create fsmonitor cookie '%s'"),
+			    path.buf);
+	pthread_mutex_lock(&state->main_lock);
+
+	if (fd >= 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += FSMONITOR_COOKIE_TIMEOUT_SEC;
+		while (strintmap_get(&state->cookies, name.buf) == FCIS_PENDING)
+			if (pthread_cond_timedwait(&state->cookies_cond,
+						   &state->main_lock, &ts)) {
+				trace2_data_string("fsmonitor", the_repository,
+						   "cookie/timeout", name.buf);
+				break;
+			}
+	}
+
+	strintmap_remove(&state->cookies, name.buf);
+	unlink(path.buf);
+
+	strbuf_release(&name);
+	strbuf_release(&path);
+}
+
+static void with_lock__format_token(struct fsmonitor_daemon_state *state,
+				    struct strbuf *buf)
+{
+	strbuf_addf(buf, "builtin:%s:%"PRIu64,
+		    state->token_id.buf, state->current_seq);
+}
+
+/*
+ * Parse a token we handed out earlier. Return 0 and the sequence number
+ * it was handed out at if it is from the current token id.
+ */
+static int with_lock__parse_token(struct fsmonitor_daemon_state *state,
+				  const char *token, uint64_t *seq)
+{
+	const char *p;
+	char *end;
+
+	if (!skip_prefix(token, "builtin:", &token) ||
+	    !skip_prefix(token, state->token_id.buf, &p) ||
+	    *p++ != ':')
+		return -1;
+
+	errno = 0;
+	*seq = strtoumax(p, &end, 10);
+	if (errno || end == p || *end || *seq > state->current_seq)
+		return -1;
+	return 0;
+}
+
+static int do_handle_query(struct fsmonitor_daemon_state *state,
+			   const char *token,
+			   ipc_server_reply_cb *reply,
+			   struct ipc_server_reply_data *reply_data)
+{
+	struct strbuf response = STRBUF_INIT;
+	struct strset seen = STRSET_INIT;
+	uint64_t since;
+	size_t lo, hi;
+	int ret;
+
+	pthread_mutex_lock(&state->main_lock);
+
+	with_lock__wait_for_cookie(state);
+
+	with_lock__format_token(state, &response);
+	strbuf_addch(&response, '\0');
+
+	if (with_lock__parse_token(state, token, &since)) {
+		/* Everything may have changed. */
+		strbuf_addch(&response, '/');
+		strbuf_addch(&response, '\0');
+		trace2_data_intmax("fsmonitor", the_repository,
+				   "response/trivial", 1);
+	} else {
+		/* Find the first change after "since". */
+		lo = 0;
+		hi = state->changes_nr;
+		while (lo < hi) {
+			size_t mi = lo + (hi - lo) / 2;
+
+			if (state->changes[mi].seq <= since)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+
+		for (; lo < state->changes_nr; lo++) {
+			const char *path = state->changes[lo].path;
+
+			if (!strset_add(&seen, path))
+				continue;
+			strbuf_addstr(&response, path);
+			strbuf_addch(&response, '\0');
+		}
+		trace2_data_intmax("fsmonitor", the_repository,
+				   "response/count/files",
+				   strset_get_size(&seen));
+	}
+
+	pthread_mutex_unlock(&state->main_lock);
+
+	ret = reply(reply_data, response.buf, response.len);
+
+	strset_clear(&seen);
+	strbuf_release(&response);
+	return ret;
+}
+
+static ipc_server_application_cb handle_client;
+
+static int handle_client(void *data, const char *command,
+			 ipc_server_reply_cb *reply,
+			 struct ipc_server_reply_data *reply_data)
+{
+	struct fsmonitor_daemon_state *state = data;
+	int result;
+
+	trace2_region_enter("fsmonitor", "handle_client", the_repository);
+	trace2_data_string("fsmonitor", the_repository, "request", command);
+
+	if (!strcmp(command, "quit")) {
+		/*
+		 * The main thread stops the listener once the IPC
+		 * thread pool has shut down.
+		 */
+		result = SIMPLE_IPC_QUIT;
+	} else if (!strcmp(command, "flush")) {
+		/*
+		 * Forget everything and hand out a new token id (mostly
+		 * for testing).
+		 */
+		fsmonitor_force_resync(state);
+		result = 0;
+	} else
+		result = do_handle_query(state, command, reply, reply_data);
+
+	trace2_region_leave("fsmonitor", "handle_client", the_repository);
+	return result;
+}
+
+static void *fsm_listen__thread_proc(void *_state)
+{
+	struct fsmonitor_daemon_state *state = _state;
+
+	trace2_thread_start("fsm-listen");
+
+	fsm_listen__loop(state);
+
+	/*
+	 * If the listener stops on its own (e.g. because the worktree
+	 * went away), take the IPC server down with it.
+	 */
+	ipc_server_stop_async(state->ipc_server_data);
+
+	trace2_thread_exit();
+	return NULL;
+}
+
+static int fsmonitor_run_daemon(void)
+{
+	struct fsmonitor_daemon_state state;
+	struct ipc_server_opts ipc_opts = {
+		.nr_threads = fsmonitor__ipc_threads,
+
+		/*
+		 * We know that there are no other active threads yet,
+		 * so we can let the IPC layer temporarily chdir() if
+		 * it needs to when creating the server side of the
+		 * Unix domain socket.
+		 */
+		.uds_disallow_chdir = 0
+	};
+	int err;
+
+	memset(&state, 0, sizeof(state));
+	strbuf_init(&state.token_id, 0);
+	strbuf_init(&state.path_worktree_watch, 0);
+	strbuf_init(&state.path_cookie_dir, 0);
+	pthread_mutex_init(&state.main_lock, NULL);
+	pthread_cond_init(&state.cookies_cond, NULL);
+	strintmap_init(&state.cookies, 0);
+	with_lock__new_token_id(&state);
+
+	strbuf_addstr(&state.path_worktree_watch,
+		      absolute_path(get_git_work_tree()));
+	strbuf_addstr(&state.path_cookie_dir,
+		      absolute_path(git_path("fsmonitor--daemon/cookies")));
+	if (safe_create_leading_directories_const(state.path_cookie_dir.buf) ||
+	    (mkdir(state.path_cookie_dir.buf, 0777) && errno != EEXIST)) {
+		err = error_errno(_("could not create '%s'"),
+				  state.path_cookie_dir.buf);
+		goto done;
+	}
+
+	/*
+	 * Do not keep the worktree busy as our current directory: on
+	 * Linux, that would keep its inode alive after it is removed, and
+	 * the listener would never learn that it went away.  All the paths
+	 * we still need are absolute.
+	 */
+	fsmonitor_ipc__get_path();
+	if (chdir("/")) {
+		err = error_errno(_("could not chdir to '/'"));
+		goto done;
+	}
+
+	if (fsm_listen__ctor(&state)) {
+		err = error(_("could not initialize listener thread"));
+		goto done;
+	}
+
+	/*
+	 * Start the IPC thread pool only now that we are watching, so
+	 * that no client is handed a token before that.
+	 */
+	err = ipc_server_run_async(&state.ipc_server_data,
+				   fsmonitor_ipc__get_path(), &ipc_opts,
+				   handle_client, &state);
+	if (err) {
+		if (err == -2)
+			error(_("fsmonitor--daemon is already running '%s'"),
+			      the_repository->worktree);
+		else
+			error_errno(_("could not start IPC thread pool on '%s'"),
+				    fsmonitor_ipc__get_path());
+		err = -1;
+		goto done;
+	}
+
+	if (pthread_create(&state.listener_thread, NULL,
+			   fsm_listen__thread_proc, &state) < 0) {
+		ipc_server_stop_async(state.ipc_server_data);
+		ipc_server_await(state.ipc_server_data);
+		err = error(_("could not start fsmonitor listener thread"));
+		goto done;
+	}
+
+	/* Wait for a "quit" command, or for the listener to give up. */
+	ipc_server_await(state.ipc_server_data);
+
+	fsm_listen__stop_async(&state);
+	pthread_join(state.listener_thread, NULL);
+
+	err = state.error_code;
+
+done:
+	ipc_server_free(state.ipc_server_data);
+	fsm_listen__dtor(&state);
+
+	with_lock__new_token_id(&state);
+	free(state.changes);
+	strintmap_clear(&state.cookies);
+	strbuf_release(&state.token_id);
+	strbuf_release(&state.path_worktree_watch);
+	strbuf_release(&state.path_cookie_dir);
+	pthread_cond_destroy(&state.cookies_cond);
+	pthread_mutex_destroy(&state.main_lock);
+	return err;
+}
+
+static int try_to_run_foreground_daemon(int detach)
+{
+	/*
+	 * Technically, we don't need to probe for an existing daemon
+	 * process, since we could just call `fsmonitor_run_daemon()`
+	 * and let it fail if the pipe/socket is busy. But this gives
+	 * a nicer error message.
+	 */
+	if (fsmonitor_ipc__get_state() == IPC_STATE__LISTENING)
+		die(_("fsmonitor--daemon is already running '%s'"),
+		    the_repository->worktree);
+
+	if (detach && daemonize())
+		die_errno(_("could not detach from the terminal"));
+
+	return !!fsmonitor_run_daemon();
+}
+
+static int try_to_start_background_daemon(void)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	uint64_t deadline;
+
+	/*
+	 * Before we try to create a background daemon process, see
+	 * if a daemon process is already listening.  This makes it
+	 * easier for us to report an already-listening error to the
+	 * console, since our spawn/daemon can only report the success
+	 * of creating the background process (and not whether it
+	 * immediately exited).
+	 */
+	if (fsmonitor_ipc__get_state() == IPC_STATE__LISTENING)
+		die(_("fsmonitor--daemon is already running '%s'"),
+		    the_repository->worktree);
+
+	strvec_pushl(&cp.args, "fsmonitor--daemon", "run", "--detach", NULL);
+	cp.git_cmd = 1;
+	cp.no_stdin = 1;
+	cp.trace2_child_class = "fsmonitor";
+	if (run_command(&cp))
+		return error(_("could not spawn fsmonitor--daemon in the background"));
+
+	deadline = getnanotime() +
+		(uint64_t)fsmonitor__start_timeout_sec * 1000000000;
+	for (;;) {
+		if (fsmonitor_ipc__get_state() == IPC_STATE__LISTENING)
+			return 0;
+		if (getnanotime() > deadline)
+			return error(_("fsmonitor--daemon not online yet"));
+		sleep_millisec(50);
+	}
+}
+
+static int do_as_client__send_stop(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+	int ret;
+
+	ret = fsmonitor_ipc__send_command("quit", &answer);
+
+	/* The quit command does not return any response data. */
+	strbuf_release(&answer);
+
+	if (ret)
+		return ret;
+
+	trace2_region_enter("fsm_client", "polling-for-daemon-exit", NULL);
+	while (fsmonitor_ipc__get_state() == IPC_STATE__LISTENING)
+		sleep_millisec(50);
+	trace2_region_leave("fsm_client", "polling-for-daemon-exit", NULL);
+
+	return 0;
+}
+
+static int do_as_client__status(void)
+{
+	enum ipc_active_state state = fsmonitor_ipc__get_state();
+
+	switch (state) {
+	case IPC_STATE__LISTENING:
+		printf(_("fsmonitor-daemon is watching '%s'\n"),
+		       the_repository->worktree);
+		return 0;
+
+	default:
+		printf(_("fsmonitor-daemon is not watching '%s'\n"),
+		       the_repository->worktree);
+		return 1;
+	}
+}
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	int detach = 0;
+
+	struct option options[] = {
+		OPT_BOOL(0, "detach", &detach,
+			 N_("detach from the terminal (with 'run')")),
+		OPT_INTEGER(0, "ipc-threads",
+			    &fsmonitor__ipc_threads,
+			    N_("use <n> ipc worker threads")),
+		OPT_INTEGER(0, "start-timeout",
+			    &fsmonitor__start_timeout_sec,
+			    N_("max seconds to wait for background daemon startup")),
+
+		OPT_END()
+	};
+
+	git_config(fsmonitor_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_fsmonitor__daemon_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+	subcmd = argv[0];
+
+	if (fsmonitor__ipc_threads < 1)
+		die(_("invalid 'ipc-threads' value (%d)"),
+		    fsmonitor__ipc_threads);
+
+	if (!strcmp(subcmd, "start"))
+		return !!try_to_start_background_daemon();
+
+	if (!strcmp(subcmd, "run"))
+		return !!try_to_run_foreground_daemon(detach);
+
+	if (!strcmp(subcmd, "stop"))
+		return !!do_as_client__send_stop();
+
+	if (!strcmp(subcmd, "status"))
+		return !!do_as_client__status();
+
+	die(_("Unhandled subcommand '%s'"), subcmd);
+}
+
+#else
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	die(_("fsmonitor--daemon not supported on this platform"));
+}
+#endif
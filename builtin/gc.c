@@ -32,6 +32,10 @@
 #include "remote.h"
 #include "object-store.h"
 #include "exec-cmd.h"
+#include "oidset.h"
+#include "oid-array.h"
+#include "pathspec.h"
+#include "split-index.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -47,6 +51,7 @@ static int aggressive_window = 250;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
 static int detach_auto = 1;
+static int cruft_packs;
 static timestamp_t gc_log_expire_time;
 static const char *gc_log_expire = "1.day.ago";
 static const char *prune_expire = "2.weeks.ago";
@@ -152,6 +157,7 @@ static void gc_config(void)
 	git_config_get_int("gc.auto", &gc_auto_threshold);
 	git_config_get_int("gc.autopacklimit", &gc_auto_pack_limit);
 	git_config_get_bool("gc.autodetach", &detach_auto);
+	git_config_get_bool("gc.cruftpacks", &cruft_packs);
 	git_config_get_expiry("gc.pruneexpire", &prune_expire);
 	git_config_get_expiry("gc.worktreepruneexpire", &prune_worktrees_expire);
 	git_config_get_expiry("gc.logexpiry", &gc_log_expire);
@@ -307,7 +313,7 @@ static uint64_t estimate_repack_memory(struct packed_git *pack)
 	 */
 	heap += sizeof(struct tree) * nr_objects / 2;
 	/* and then obj_hash[], underestimated in fact */
-	heap += sizeof(struct object *) * nr_objects;
+	heap += 2 * sizeof(struct object *) * nr_objects;
 	/* revindex is used also */
 	heap += (sizeof(off_t) + sizeof(uint32_t)) * nr_objects;
 	/*
@@ -331,7 +337,11 @@ static void add_repack_all_option(struct string_list *keep_pack)
 {
 	if (prune_expire && !strcmp(prune_expire, "now"))
 		strvec_push(&repack, "-a");
-	else {
+	else if (cruft_packs) {
+		strvec_push(&repack, "--cruft");
+		if (prune_expire)
+			strvec_pushf(&repack, "--cruft-expiration=%s", prune_expire);
+	} else {
 		strvec_push(&repack, "-A");
 		if (prune_expire)
 			strvec_pushf(&repack, "--unpack-unreachable=%s", prune_expire);
@@ -550,6 +560,7 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 		{ OPTION_STRING, 0, "prune", &prune_expire, N_("date"),
 			N_("prune unreferenced objects"),
 			PARSE_OPT_OPTARG, NULL, (intptr_t)prune_expire },
+		OPT_BOOL(0, "cruft", &cruft_packs, N_("pack unreferenced objects separately")),
 		OPT_BOOL(0, "aggressive", &aggressive, N_("be more thorough (increased runtime)")),
 		OPT_BOOL_F(0, "auto", &auto_gc, N_("enable auto-gc mode"),
 			   PARSE_OPT_NOCOMPLETE),
@@ -909,6 +920,115 @@ static int maintenance_task_prefetch(struct maintenance_run_opts *opts)
 	return 0;
 }
 
+/*
+ * The commits whose trees we expect to be checked out next: HEAD, the
+ * last few commits HEAD pointed at, and the upstream of the current
+ * branch, as fetched or as prefetched by the "prefetch" task.
+ */
+#define PROMISOR_PREFETCH_REFLOG_ENTRIES 10
+
+struct promisor_prefetch_data {
+	struct oidset seen;
+	struct oid_array commits;
+	struct oid_array to_fetch;
+};
+
+static void add_promisor_prefetch_commit(struct promisor_prefetch_data *data,
+					 const struct object_id *oid)
+{
+	if (!is_null_oid(oid) && !oidset_insert(&data->seen, oid))
+		oid_array_append(&data->commits, oid);
+}
+
+static int add_promisor_prefetch_reflog(struct object_id *old_oid,
+					struct object_id *new_oid,
+					const char *committer,
+					timestamp_t timestamp, int tz,
+					const char *msg, void *cb_data)
+{
+	struct promisor_prefetch_data *data = cb_data;
+
+	add_promisor_prefetch_commit(data, new_oid);
+	return data->commits.nr >= PROMISOR_PREFETCH_REFLOG_ENTRIES;
+}
+
+static void add_promisor_prefetch_ref(struct promisor_prefetch_data *data,
+				      const char *refname)
+{
+	struct object_id oid;
+
+	if (!read_ref(refname, &oid))
+		add_promisor_prefetch_commit(data, &oid);
+}
+
+static int collect_promised_blob(const struct object_id *oid,
+				 struct strbuf *base, const char *path,
+				 unsigned int mode, void *context)
+{
+	struct promisor_prefetch_data *data = context;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	if (S_ISREG(mode) && !oidset_insert(&data->seen, oid) &&
+	    oid_object_info_extended(the_repository, oid, NULL,
+				     OBJECT_INFO_FOR_PREFETCH))
+		oid_array_append(&data->to_fetch, oid);
+	return 0;
+}
+
+static int maintenance_task_promisor_prefetch(struct maintenance_run_opts *opts)
+{
+	struct promisor_prefetch_data data = {
+		.seen = OIDSET_INIT,
+		.commits = OID_ARRAY_INIT,
+		.to_fetch = OID_ARRAY_INIT,
+	};
+	struct pathspec pathspec = { 0 };
+	struct branch *branch;
+	const char *upstream;
+	size_t i;
+	int ret = 0;
+
+	if (!has_promisor_remote())
+		return 0;
+
+	for_each_reflog_ent_reverse("HEAD", add_promisor_prefetch_reflog, &data);
+	add_promisor_prefetch_ref(&data, "HEAD");
+	branch = branch_get(NULL);
+	upstream = branch ? branch_get_upstream(branch, NULL) : NULL;
+	if (upstream) {
+		const char *rest;
+		char *prefetch_ref;
+
+		add_promisor_prefetch_ref(&data, upstream);
+		if (skip_prefix(upstream, "refs/", &rest)) {
+			prefetch_ref = xstrfmt("refs/prefetch/%s", rest);
+			add_promisor_prefetch_ref(&data, prefetch_ref);
+			free(prefetch_ref);
+		}
+	}
+
+	for (i = 0; i < data.commits.nr; i++) {
+		struct tree *tree = parse_tree_indirect(&data.commits.oid[i]);
+
+		if (tree)
+			read_tree(the_repository, tree, &pathspec,
+				  collect_promised_blob, &data);
+	}
+
+	if (data.to_fetch.nr &&
+	    promisor_remote_get_direct(the_repository, data.to_fetch.oid,
+				       data.to_fetch.nr)) {
+		error(_("failed to prefetch promised objects"));
+		ret = 1;
+	}
+
+	oidset_clear(&data.seen);
+	oid_array_clear(&data.commits);
+	oid_array_clear(&data.to_fetch);
+	return ret;
+}
+
 static int maintenance_task_gc(struct maintenance_run_opts *opts)
 {
 	struct child_process child = CHILD_PROCESS_INIT;
@@ -927,6 +1047,31 @@ static int maintenance_task_gc(struct maintenance_run_opts *opts)
 	return run_command(&child);
 }
 
+static int split_index_auto_condition(void)
+{
+	struct index_state *istate = the_repository->index;
+	int ret;
+
+	if (is_bare_repository() || repo_read_index(the_repository) < 0)
+		return 0;
+
+	ret = istate->split_index && too_many_not_shared_entries(istate);
+	discard_index(istate);
+	return ret;
+}
+
+static int maintenance_task_split_index(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	if (!split_index_auto_condition())
+		return 0;
+
+	child.git_cmd = 1;
+	strvec_pushl(&child.args, "update-index", "--split-index", NULL);
+	return run_command(&child);
+}
+
 static int prune_packed(struct maintenance_run_opts *opts)
 {
 	struct child_process child = CHILD_PROCESS_INIT;
@@ -958,9 +1103,88 @@ static int loose_object_count(const struct object_id *oid,
 	return 0;
 }
 
+/*
+ * With core.looseObjectJournal, the loose objects to pack are those
+ * listed in the journal that write_loose_object() appends to, instead
+ * of all those found in the object directory.  The journal is created
+ * before the object directory is scanned for the last time, so that it
+ * lists everything written since, and is trusted as long as it exists.
+ *
+ * To consume the journal, it is hard-linked to "loose-journal.packing"
+ * and then replaced with an empty one, so that there always is one to
+ * append to.  A ".packing" journal left behind by a run that failed is
+ * consumed before the journal itself.
+ */
+static int loose_journal_size(off_t *size)
+{
+	char *journal = loose_object_journal_path(the_repository, NULL);
+	char *packing = loose_object_journal_path(the_repository, ".packing");
+	struct stat st;
+	int ret = -1;
+
+	if (core_loose_object_journal && !stat(journal, &st)) {
+		*size = st.st_size;
+		if (!stat(packing, &st))
+			*size += st.st_size;
+		ret = 0;
+	}
+	free(journal);
+	free(packing);
+	return ret;
+}
+
+static void start_loose_journal(void)
+{
+	char *journal = loose_object_journal_path(the_repository, NULL);
+	char *packing = loose_object_journal_path(the_repository, ".packing");
+	int fd;
+
+	unlink(packing);
+	fd = open(journal, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd >= 0) {
+		close(fd);
+		if (adjust_shared_perm(journal))
+			unlink(journal);
+	}
+	free(journal);
+	free(packing);
+}
+
+static void stop_loose_journal(void)
+{
+	char *journal = loose_object_journal_path(the_repository, NULL);
+	char *packing = loose_object_journal_path(the_repository, ".packing");
+
+	/* it misses what is written from now on, and must not be trusted */
+	unlink(journal);
+	unlink(packing);
+	free(journal);
+	free(packing);
+}
+
+static int rotate_loose_journal(const char *packing)
+{
+	char *journal = loose_object_journal_path(the_repository, NULL);
+	char *fresh = loose_object_journal_path(the_repository, ".new");
+	int fd, ret = 0;
+
+	unlink(fresh);
+	fd = open(fresh, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0 || close(fd) || adjust_shared_perm(fresh) ||
+	    link(journal, packing) || rename(fresh, journal)) {
+		ret = error_errno(_("unable to rotate '%s'"), journal);
+		unlink(fresh);
+		stop_loose_journal();
+	}
+	free(journal);
+	free(fresh);
+	return ret;
+}
+
 static int loose_object_auto_condition(void)
 {
 	int count = 0;
+	off_t size;
 
 	git_config_get_int("maintenance.loose-objects.auto",
 			   &loose_object_auto_limit);
@@ -970,6 +1194,13 @@ static int loose_object_auto_condition(void)
 	if (loose_object_auto_limit < 0)
 		return 1;
 
+	/*
+	 * Entries may be duplicates or name objects that are gone by
+	 * now, but telling so would cost what the journal is to save.
+	 */
+	if (!loose_journal_size(&size))
+		return size / (the_hash_algo->hexsz + 1) >= loose_object_auto_limit;
+
 	return for_each_loose_file_in_objdir(the_repository->objects->odb->path,
 					     loose_object_count,
 					     NULL, NULL, &count);
@@ -993,12 +1224,109 @@ static int write_loose_object_to_stdin(const struct object_id *oid,
 	return ++(d->count) > d->batch_size;
 }
 
+static int start_pack_loose(struct maintenance_run_opts *opts,
+			    struct child_process *pack_proc)
+{
+	pack_proc->git_cmd = 1;
+
+	strvec_push(&pack_proc->args, "pack-objects");
+	if (opts->quiet)
+		strvec_push(&pack_proc->args, "--quiet");
+	strvec_pushf(&pack_proc->args, "%s/pack/loose",
+		     the_repository->objects->odb->path);
+
+	pack_proc->in = -1;
+
+	if (start_command(pack_proc))
+		return error(_("failed to start 'git pack-objects' process"));
+	return 0;
+}
+
+/*
+ * Feed the objects named in the journal that are still loose to
+ * pack-objects as they are read.  Those beyond the batch size go
+ * back to the journal for the next run.  Returns -1 if the journal
+ * could not be used, so that the object directory should be scanned.
+ */
+static int pack_loose_from_journal(struct maintenance_run_opts *opts)
+{
+	struct repository *r = the_repository;
+	char *packing = loose_object_journal_path(r, ".packing");
+	struct child_process pack_proc = CHILD_PROCESS_INIT;
+	struct oidset seen = OIDSET_INIT;
+	struct strbuf line = STRBUF_INIT, path = STRBUF_INIT;
+	FILE *fp, *in = NULL;
+	int count = 0, batch_size = 50000;
+	int result = 0;
+
+	if (!file_exists(packing) && rotate_loose_journal(packing)) {
+		free(packing);
+		return -1;
+	}
+	fp = fopen(packing, "r");
+	if (!fp) {
+		error_errno(_("could not open '%s'"), packing);
+		free(packing);
+		stop_loose_journal();
+		return -1;
+	}
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct object_id oid;
+		const char *end;
+
+		if (parse_oid_hex(line.buf, &oid, &end) || *end ||
+		    oidset_insert(&seen, &oid) ||
+		    !file_exists(loose_object_path(r, &path, &oid)))
+			continue;
+		if (count++ >= batch_size) {
+			journal_loose_object(r, &oid);
+			continue;
+		}
+		if (!in) {
+			if (start_pack_loose(opts, &pack_proc)) {
+				result = 1;
+				break;
+			}
+			in = xfdopen(pack_proc.in, "w");
+		}
+		fprintf(in, "%s\n", oid_to_hex(&oid));
+	}
+	fclose(fp);
+
+	if (in) {
+		fclose(in);
+		if (finish_command(&pack_proc)) {
+			error(_("failed to finish 'git pack-objects' process"));
+			result = 1;
+		}
+	}
+	if (!result)
+		unlink_or_warn(packing);
+
+	oidset_clear(&seen);
+	strbuf_release(&line);
+	strbuf_release(&path);
+	free(packing);
+	return result;
+}
+
 static int pack_loose(struct maintenance_run_opts *opts)
 {
 	struct repository *r = the_repository;
 	int result = 0;
 	struct write_loose_object_data data;
 	struct child_process pack_proc = CHILD_PROCESS_INIT;
+	off_t size;
+
+	if (!core_loose_object_journal)
+		stop_loose_journal();
+	else if (loose_journal_size(&size))
+		start_loose_journal();
+	else if ((result = pack_loose_from_journal(opts)) >= 0)
+		return result;
+	else
+		result = 0;
 
 	/*
 	 * Do not start pack-objects process
@@ -1009,19 +1337,8 @@ static int pack_loose(struct maintenance_run_opts *opts)
 					   NULL, NULL, NULL))
 		return 0;
 
-	pack_proc.git_cmd = 1;
-
-	strvec_push(&pack_proc.args, "pack-objects");
-	if (opts->quiet)
-		strvec_push(&pack_proc.args, "--quiet");
-	strvec_pushf(&pack_proc.args, "%s/pack/loose", r->objects->odb->path);
-
-	pack_proc.in = -1;
-
-	if (start_command(&pack_proc)) {
-		error(_("failed to start 'git pack-objects' process"));
+	if (start_pack_loose(opts, &pack_proc))
 		return 1;
-	}
 
 	data.in = xfdopen(pack_proc.in, "w");
 	data.count = 0;
@@ -1212,11 +1529,13 @@ struct maintenance_task {
 
 enum maintenance_task_label {
 	TASK_PREFETCH,
+	TASK_PROMISOR_PREFETCH,
 	TASK_LOOSE_OBJECTS,
 	TASK_INCREMENTAL_REPACK,
 	TASK_GC,
 	TASK_COMMIT_GRAPH,
 	TASK_PACK_REFS,
+	TASK_SPLIT_INDEX,
 
 	/* Leave as final value */
 	TASK__COUNT
@@ -1227,6 +1546,10 @@ static struct maintenance_task tasks[] = {
 		"prefetch",
 		maintenance_task_prefetch,
 	},
+	[TASK_PROMISOR_PREFETCH] = {
+		"promisor-prefetch",
+		maintenance_task_promisor_prefetch,
+	},
 	[TASK_LOOSE_OBJECTS] = {
 		"loose-objects",
 		maintenance_task_loose_objects,
@@ -1253,6 +1576,11 @@ static struct maintenance_task tasks[] = {
 		maintenance_task_pack_refs,
 		NULL,
 	},
+	[TASK_SPLIT_INDEX] = {
+		"split-index",
+		maintenance_task_split_index,
+		split_index_auto_condition,
+	},
 };
 
 static int compare_tasks_by_selection(const void *a_, const void *b_)
@@ -25,6 +25,10 @@
 #include "submodule-config.h"
 #include "object-store.h"
 #include "packfile.h"
+#include "list.h"
+#include "oid-array.h"
+#include "promisor-remote.h"
+#include "xdiff-interface.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -206,6 +210,7 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_result, NULL);
 	grep_use_locks = 1;
 	enable_obj_read_lock();
+	enable_xdiff_regex_lock();
 
 	for (i = 0; i < ARRAY_SIZE(todo); i++) {
 		strbuf_init(&todo[i].out, 0);
@@ -225,6 +230,134 @@ static void start_threads(struct grep_opt *opt)
 	}
 }
 
+/*
+ * When grepping trees with threads, the subtrees the producer is going
+ * to descend into are read ahead by "tree readers", so that inflating
+ * and resolving deltas of trees happens in parallel with the walk.
+ * Subtrees of the tree being walked are queued in front of those of its
+ * parents, in the order the walk needs them.
+ */
+struct tree_read {
+	struct list_head list; /* in "tree_reads" while queued */
+	struct object_id oid;
+	void *data;
+	unsigned long size;
+	enum object_type type;
+	enum {
+		TREE_READ_QUEUED,
+		TREE_READ_BUSY,
+		TREE_READ_DONE
+	} state;
+};
+
+static LIST_HEAD(tree_reads);
+static pthread_t *tree_readers;
+static int nr_tree_readers;
+static int tree_readers_stop;
+static pthread_mutex_t tree_read_mutex;
+static pthread_cond_t tree_read_cond;
+
+static void *run_tree_reader(void *unused)
+{
+	pthread_mutex_lock(&tree_read_mutex);
+	for (;;) {
+		struct tree_read *r;
+
+		while (list_empty(&tree_reads) && !tree_readers_stop)
+			pthread_cond_wait(&tree_read_cond, &tree_read_mutex);
+		if (list_empty(&tree_reads))
+			break;
+		r = list_first_entry(&tree_reads, struct tree_read, list);
+		list_del(&r->list);
+		r->state = TREE_READ_BUSY;
+		pthread_mutex_unlock(&tree_read_mutex);
+
+		r->data = read_object_file(&r->oid, &r->type, &r->size);
+
+		pthread_mutex_lock(&tree_read_mutex);
+		r->state = TREE_READ_DONE;
+		pthread_cond_broadcast(&tree_read_cond);
+	}
+	pthread_mutex_unlock(&tree_read_mutex);
+	return NULL;
+}
+
+static void start_tree_readers(void)
+{
+	int i;
+
+	pthread_mutex_init(&tree_read_mutex, NULL);
+	pthread_cond_init(&tree_read_cond, NULL);
+	tree_readers_stop = 0;
+
+	nr_tree_readers = DIV_ROUND_UP(num_threads, 2);
+	CALLOC_ARRAY(tree_readers, nr_tree_readers);
+	for (i = 0; i < nr_tree_readers; i++) {
+		int err = pthread_create(&tree_readers[i], NULL,
+					 run_tree_reader, NULL);
+		if (err)
+			die(_("grep: failed to create thread: %s"),
+			    strerror(err));
+	}
+}
+
+static void stop_tree_readers(void)
+{
+	int i;
+
+	pthread_mutex_lock(&tree_read_mutex);
+	tree_readers_stop = 1;
+	pthread_cond_broadcast(&tree_read_cond);
+	pthread_mutex_unlock(&tree_read_mutex);
+
+	for (i = 0; i < nr_tree_readers; i++)
+		pthread_join(tree_readers[i], NULL);
+	FREE_AND_NULL(tree_readers);
+	nr_tree_readers = 0;
+
+	pthread_mutex_destroy(&tree_read_mutex);
+	pthread_cond_destroy(&tree_read_cond);
+}
+
+static void queue_tree_reads(struct tree_read **reads, int nr)
+{
+	int i;
+
+	pthread_mutex_lock(&tree_read_mutex);
+	for (i = nr - 1; i >= 0; i--)
+		list_add(&reads[i]->list, &tree_reads);
+	pthread_cond_broadcast(&tree_read_cond);
+	pthread_mutex_unlock(&tree_read_mutex);
+}
+
+/*
+ * Return the data of a queued tree read and free it.  A read no
+ * reader has picked up yet is done right here instead of waiting.
+ */
+static void *finish_tree_read(struct tree_read *r, enum object_type *type,
+			      unsigned long *size)
+{
+	void *data;
+
+	pthread_mutex_lock(&tree_read_mutex);
+	if (r->state == TREE_READ_QUEUED) {
+		list_del(&r->list);
+		pthread_mutex_unlock(&tree_read_mutex);
+		data = read_object_file(&r->oid, type, size);
+		free(r);
+		return data;
+	}
+	while (r->state != TREE_READ_DONE)
+		pthread_cond_wait(&tree_read_cond, &tree_read_mutex);
+	pthread_mutex_unlock(&tree_read_mutex);
+
+	data = r->data;
+	*type = r->type;
+	*size = r->size;
+	free(r);
+	return data;
+}
+
 static int wait_all(void)
 {
 	int hit = 0;
@@ -260,6 +393,7 @@ static int wait_all(void)
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
 	grep_use_locks = 0;
+	disable_xdiff_regex_lock();
 	disable_obj_read_lock();
 
 	return hit;
@@ -504,8 +638,6 @@ static int grep_cache(struct grep_opt *opt,
 	if (repo_read_index(repo) < 0)
 		die(_("index file corrupt"));
 
-	/* TODO: audit for interaction with sparse-index. */
-	ensure_full_index(repo->index);
 	for (nr = 0; nr < repo->index->cache_nr; nr++) {
 		const struct cache_entry *ce = repo->index->cache[nr];
 
@@ -515,7 +647,27 @@ static int grep_cache(struct grep_opt *opt,
 		strbuf_setlen(&name, name_base_len);
 		strbuf_addstr(&name, ce->name);
 
-		if (S_ISREG(ce->ce_mode) &&
+		if (S_ISSPARSEDIR(ce->ce_mode)) {
+			/*
+			 * A sparse directory stands for the tree it
+			 * records; only --cached can get here, as the
+			 * entry is marked skip-worktree. Do not look up
+			 * attributes for the paths inside, as that would
+			 * expand the index again.
+			 */
+			enum object_type type;
+			struct tree_desc tree;
+			void *data;
+			unsigned long size;
+
+			data = read_object_file(&ce->oid, &type, &size);
+			if (!data)
+				die(_("unable to read tree (%s)"),
+				    oid_to_hex(&ce->oid));
+			init_tree_desc(&tree, data, size);
+			hit |= grep_tree(opt, pathspec, &tree, &name, 0, 0);
+			free(data);
+		} else if (S_ISREG(ce->ce_mode) &&
 		    match_pathspec(repo->index, pathspec, name.buf, name.len, 0, NULL,
 				   S_ISDIR(ce->ce_mode) ||
 				   S_ISGITLINK(ce->ce_mode))) {
@@ -566,11 +718,43 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 	int old_baselen = base->len;
 	struct strbuf name = STRBUF_INIT;
 	int name_base_len = 0;
+	struct tree_read **reads = NULL;
+	int nr_reads = 0, alloc_reads = 0, next_read = 0;
+
 	if (repo->submodule_prefix) {
 		strbuf_addstr(&name, repo->submodule_prefix);
 		name_base_len = name.len;
 	}
 
+	if (nr_tree_readers) {
+		struct tree_desc scan = *tree;
+
+		while (tree_entry(&scan, &entry)) {
+			if (match != all_entries_interesting) {
+				strbuf_addstr(&name, base->buf + tn_len);
+				match = tree_entry_interesting(repo->index,
+							       &entry, &name,
+							       0, pathspec);
+				strbuf_setlen(&name, name_base_len);
+
+				if (match == all_entries_not_interesting)
+					break;
+				if (match == entry_not_interesting)
+					continue;
+			}
+			if (S_ISDIR(entry.mode)) {
+				struct tree_read *r;
+
+				CALLOC_ARRAY(r, 1);
+				oidcpy(&r->oid, &entry.oid);
+				ALLOC_GROW(reads, nr_reads + 1, alloc_reads);
+				reads[nr_reads++] = r;
+			}
+		}
+		queue_tree_reads(reads, nr_reads);
+		match = entry_not_interesting;
+	}
+
 	while (tree_entry(tree, &entry)) {
 		int te_len = tree_entry_len(&entry);
 
@@ -598,7 +782,12 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			void *data;
 			unsigned long size;
 
-			data = read_object_file(&entry.oid, &type, &size);
+			if (next_read < nr_reads &&
+			    oideq(&reads[next_read]->oid, &entry.oid))
+				data = finish_tree_read(reads[next_read++],
+							&type, &size);
+			else
+				data = read_object_file(&entry.oid, &type, &size);
 			if (!data)
 				die(_("unable to read tree (%s)"),
 				    oid_to_hex(&entry.oid));
@@ -620,6 +809,15 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			break;
 	}
 
+	/* the walk may have stopped early */
+	while (next_read < nr_reads) {
+		enum object_type type;
+		unsigned long size;
+
+		free(finish_tree_read(reads[next_read++], &type, &size));
+	}
+	free(reads);
+
 	strbuf_release(&name);
 	return hit;
 }
@@ -658,6 +856,57 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 	die(_("unable to grep from object of type %s"), type_name(obj->type));
 }
 
+static int collect_missing_blob(const struct object_id *oid,
+				struct strbuf *base, const char *path,
+				unsigned int mode, void *context)
+{
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	if (S_ISREG(mode) &&
+	    oid_object_info_extended(the_repository, oid, NULL,
+				     OBJECT_INFO_FOR_PREFETCH))
+		oid_array_append(context, oid);
+	return 0;
+}
+
+/*
+ * In a partial clone, ask for all the blobs we are going to look at
+ * in one go, instead of faulting them in one by one as the tree walk
+ * gets to them.
+ */
+static void prefetch_objects(struct grep_opt *opt,
+			     const struct pathspec *pathspec,
+			     const struct object_array *list)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	unsigned int i;
+
+	if (!repo_has_promisor_remote(opt->repo))
+		return;
+
+	for (i = 0; i < list->nr; i++) {
+		struct object *obj = deref_tag(opt->repo, list->objects[i].item,
+					       NULL, 0);
+		struct tree *tree;
+
+		if (!obj)
+			continue;
+		if (obj->type == OBJ_BLOB) {
+			if (oid_object_info_extended(opt->repo, &obj->oid, NULL,
+						     OBJECT_INFO_FOR_PREFETCH))
+				oid_array_append(&to_fetch, &obj->oid);
+			continue;
+		}
+		tree = parse_tree_indirect(&obj->oid);
+		if (tree)
+			read_tree(opt->repo, tree, pathspec,
+				  collect_missing_blob, &to_fetch);
+	}
+
+	promisor_remote_get_direct(opt->repo, to_fetch.oid, to_fetch.nr);
+	oid_array_clear(&to_fetch);
+}
+
 static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 			const struct object_array *list)
 {
@@ -665,6 +914,11 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 	int hit = 0;
 	const unsigned int nr = list->nr;
 
+	prefetch_objects(opt, pathspec, list);
+
+	if (num_threads > 1)
+		start_tree_readers();
+
 	for (i = 0; i < nr; i++) {
 		struct object *real_obj;
 
@@ -698,6 +952,9 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 				break;
 		}
 	}
+
+	if (nr_tree_readers)
+		stop_tree_readers();
 	return hit;
 }
 
@@ -976,6 +1233,11 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 			/* die the same way as if we did it at the beginning */
 			setup_git_directory();
 	}
+	if (startup_info->have_repository) {
+		prepare_repo_settings(the_repository);
+		the_repository->settings.command_requires_full_index = 0;
+	}
+
 	/* Ignore --recurse-submodules if --no-index is given or implied */
 	if (!use_index)
 		recurse_submodules = 0;
@@ -15,6 +15,7 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "hash-batch.h"
 
 static const char index_pack_usage[] =
 "git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
@@ -89,6 +90,7 @@ static size_t base_cache_limit;
 struct thread_local {
 	pthread_t thread;
 	int pack_fd;
+	struct fsck_options *fsck_options;
 };
 
 /* Remember to update object flag allocation in object.h */
@@ -128,9 +130,17 @@ static int check_self_contained_and_connected;
 
 static struct progress *progress;
 
-/* We always read in 4kB chunks. */
-static unsigned char input_buffer[4096];
+/*
+ * We always read in 4kB chunks.  A pack file given on the command line
+ * is instead mapped as a whole (input_map), and input_buffer walks over
+ * the mapping, exposing at most MAPPED_INPUT_WINDOW bytes at a time.
+ */
+static unsigned char input_chunk[4096];
+static unsigned char *input_buffer = input_chunk;
 static unsigned int input_offset, input_len;
+static unsigned char *input_map;
+static size_t input_map_size;
+#define MAPPED_INPUT_WINDOW (1024 * 1024)
 static off_t consumed_bytes;
 static off_t max_input_size;
 static unsigned deepest_delta;
@@ -161,6 +171,30 @@ static pthread_mutex_t deepest_delta_mutex;
 
 static pthread_key_t key;
 
+/*
+ * With several threads, the first pass only inflates the objects while
+ * reading them from the input; base objects are handed over to worker
+ * threads that hash and check them.
+ *
+ * The queue is guarded by base_queue_mutex. The reader waits on
+ * base_queue_space when the queue is full (or holds too much data),
+ * and the workers wait on base_queue_work when it is empty.
+ */
+struct base_queue_entry {
+	int obj_no;
+	void *data;
+};
+
+#define BASE_QUEUE_SIZE 1024
+
+static struct base_queue_entry base_queue[BASE_QUEUE_SIZE];
+static int base_queue_first, base_queue_nr, base_queue_eof;
+static size_t base_queue_bytes;
+static int hash_in_workers;
+static pthread_mutex_t base_queue_mutex;
+static pthread_cond_t base_queue_space;
+static pthread_cond_t base_queue_work;
+
 static inline void lock_mutex(pthread_mutex_t *mutex)
 {
 	if (threads_active)
@@ -173,6 +207,64 @@ static inline void unlock_mutex(pthread_mutex_t *mutex)
 		pthread_mutex_unlock(mutex);
 }
 
+/*
+ * Each thread checks trees, commits and tags with its own copy of
+ * fsck_options, which shares the message types and the skiplist but
+ * collects the .gitmodules blobs it finds on its own, so that the
+ * checks do not have to hold read_lock().  Blobs are checked with the
+ * global options under the lock, and what the threads found is folded
+ * back into the global options once they are done.
+ */
+static int fsck_error_locked(struct fsck_options *o,
+			     const struct object_id *oid,
+			     enum object_type object_type,
+			     enum fsck_msg_type msg_type,
+			     enum fsck_msg_id msg_id,
+			     const char *message)
+{
+	int ret;
+
+	read_lock();
+	ret = fsck_options.error_func(o, oid, object_type,
+				      msg_type, msg_id, message);
+	read_unlock();
+	return ret;
+}
+
+static void init_thread_fsck_options(struct thread_local *data)
+{
+	if (!do_fsck_object)
+		return;
+	fsck_prepare_for_threads();
+	data->fsck_options = xmalloc(sizeof(*data->fsck_options));
+	memcpy(data->fsck_options, &fsck_options, sizeof(fsck_options));
+	data->fsck_options->error_func = fsck_error_locked;
+	oidset_init(&data->fsck_options->gitmodules_found, 0);
+	oidset_init(&data->fsck_options->gitmodules_done, 0);
+}
+
+static void merge_oidset(struct oidset *dst, struct oidset *src)
+{
+	struct oidset_iter iter;
+	const struct object_id *oid;
+
+	oidset_iter_init(src, &iter);
+	while ((oid = oidset_iter_next(&iter)))
+		oidset_insert(dst, oid);
+	oidset_clear(src);
+}
+
+static void merge_thread_fsck_options(struct thread_local *data)
+{
+	if (!data->fsck_options)
+		return;
+	merge_oidset(&fsck_options.gitmodules_found,
+		     &data->fsck_options->gitmodules_found);
+	merge_oidset(&fsck_options.gitmodules_done,
+		     &data->fsck_options->gitmodules_done);
+	FREE_AND_NULL(data->fsck_options);
+}
+
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
  */
@@ -190,6 +282,7 @@ static void init_thread(void)
 		thread_data[i].pack_fd = open(curr_pack, O_RDONLY);
 		if (thread_data[i].pack_fd == -1)
 			die_errno(_("unable to open %s"), curr_pack);
+		init_thread_fsck_options(&thread_data[i]);
 	}
 
 	threads_active = 1;
@@ -206,8 +299,10 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&work_mutex);
 	if (show_stat)
 		pthread_mutex_destroy(&deepest_delta_mutex);
-	for (i = 0; i < nr_threads; i++)
+	for (i = 0; i < nr_threads; i++) {
 		close(thread_data[i].pack_fd);
+		merge_thread_fsck_options(&thread_data[i]);
+	}
 	pthread_key_delete(key);
 	free(thread_data);
 }
@@ -278,7 +373,10 @@ static void flush(void)
 		if (output_fd >= 0)
 			write_or_die(output_fd, input_buffer, input_offset);
 		the_hash_algo->update_fn(&input_ctx, input_buffer, input_offset);
-		memmove(input_buffer, input_buffer + input_offset, input_len);
+		if (input_map)
+			input_buffer += input_offset;
+		else
+			memmove(input_buffer, input_buffer + input_offset, input_len);
 		input_offset = 0;
 	}
 }
@@ -291,7 +389,17 @@ static void *fill(int min)
 {
 	if (min <= input_len)
 		return input_buffer + input_offset;
-	if (min > sizeof(input_buffer))
+	if (input_map) {
+		size_t left;
+
+		flush();
+		left = input_map + input_map_size - input_buffer;
+		input_len = left < MAPPED_INPUT_WINDOW ? left : MAPPED_INPUT_WINDOW;
+		if (input_len < min)
+			die(_("early EOF"));
+		return input_buffer;
+	}
+	if (min > sizeof(input_chunk))
 		die(Q_("cannot fill %d byte",
 		       "cannot fill %d bytes",
 		       min),
@@ -299,7 +407,7 @@ static void *fill(int min)
 	flush();
 	do {
 		ssize_t ret = xread(input_fd, input_buffer + input_len,
-				sizeof(input_buffer) - input_len);
+				sizeof(input_chunk) - input_len);
 		if (ret <= 0) {
 			if (!ret)
 				die(_("early EOF"));
@@ -344,11 +452,30 @@ static const char *open_pack_file(const char *pack_name)
 		}
 		nothread_data.pack_fd = output_fd;
 	} else {
+		struct stat st;
+
 		input_fd = open(pack_name, O_RDONLY);
 		if (input_fd < 0)
 			die_errno(_("cannot open packfile '%s'"), pack_name);
 		output_fd = -1;
 		nothread_data.pack_fd = input_fd;
+#ifndef NO_MMAP
+		/*
+		 * Read the pack straight from a mapping of it, in both
+		 * passes, rather than copying it through input_chunk[]
+		 * and pread() buffers.
+		 */
+		if (!fstat(input_fd, &st) && S_ISREG(st.st_mode) &&
+		    st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX) {
+			void *map = xmmap_gently(NULL, st.st_size, PROT_READ,
+						 MAP_PRIVATE, input_fd, 0);
+			if (map != MAP_FAILED) {
+				input_map = map;
+				input_map_size = st.st_size;
+				input_buffer = input_map;
+			}
+		}
+#endif
 	}
 	the_hash_algo->init_fn(&input_ctx);
 	return pack_name;
@@ -453,18 +580,24 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
-				   type_name(type),(uintmax_t)size) + 1;
-		the_hash_algo->init_fn(&c);
-		the_hash_algo->update_fn(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	/*
+	 * Objects we keep in memory are hashed by the workers, if we have
+	 * any; large blobs are streamed, so we must hash them here.
+	 */
+	if (is_delta_type(type) || (hash_in_workers && buf != fixed_buf))
+		oid = NULL;
+	if (oid) {
+		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
+				   type_name(type),(uintmax_t)size) + 1;
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -568,6 +701,25 @@ static void *unpack_data(struct object_entry *obj,
 	git_zstream stream;
 	int status;
 
+	if (!consume && HAVE_INFLATE_BUFFER && input_map) {
+		data = xmallocz(obj->size);
+		if (!git_inflate_buffer(data, obj->size, input_map + from, len))
+			return data;
+		/* let the code below diagnose the problem */
+		free(data);
+	} else if (!consume && HAVE_INFLATE_BUFFER) {
+		data = xmallocz(obj->size);
+		inbuf = xmalloc(len);
+		if (pread_in_full(get_thread_data()->pack_fd, inbuf, len, from) == len &&
+		    !git_inflate_buffer(data, obj->size, inbuf, len)) {
+			free(inbuf);
+			return data;
+		}
+		/* let the code below diagnose the problem */
+		free(inbuf);
+		free(data);
+	}
+
 	data = xmallocz(consume ? 64*1024 : obj->size);
 	inbuf = xmalloc((len < 64*1024) ? (int)len : 64*1024);
 
@@ -578,7 +730,10 @@ static void *unpack_data(struct object_entry *obj,
 
 	do {
 		ssize_t n = (len < 64*1024) ? (ssize_t)len : 64*1024;
-		n = xpread(get_thread_data()->pack_fd, inbuf, n, from);
+		if (input_map)
+			stream.next_in = input_map + from;
+		else
+			n = xpread(get_thread_data()->pack_fd, inbuf, n, from);
 		if (n < 0)
 			die_errno(_("cannot pread pack file"));
 		if (!n)
@@ -588,7 +743,8 @@ static void *unpack_data(struct object_entry *obj,
 			    (uintmax_t)len);
 		from += n;
 		len -= n;
-		stream.next_in = inbuf;
+		if (!input_map)
+			stream.next_in = inbuf;
 		stream.avail_in = n;
 		if (!consume)
 			status = git_inflate(&stream, 0);
@@ -793,7 +949,8 @@ static int check_collison(struct object_entry *entry)
 
 static void sha1_object(const void *data, struct object_entry *obj_entry,
 			unsigned long size, enum object_type type,
-			const struct object_id *oid)
+			const struct object_id *oid,
+			struct thread_local *thread)
 {
 	void *new_data = NULL;
 	int collision_test_needed = 0;
@@ -846,10 +1003,13 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 			if (do_fsck_object &&
 			    fsck_object(&blob->object, (void *)data, size, &fsck_options))
 				die(_("fsck error in packed object"));
+			read_unlock();
 		} else {
 			struct object *obj;
 			int eaten;
 			void *buf = (void *) data;
+			struct fsck_options *options = thread->fsck_options ?
+				thread->fsck_options : &fsck_options;
 
 			assert(data && "data can only be NULL for large _blobs_");
 
@@ -862,9 +1022,6 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 						  &eaten);
 			if (!obj)
 				die(_("invalid %s"), type_name(type));
-			if (do_fsck_object &&
-			    fsck_object(obj, buf, size, &fsck_options))
-				die(_("fsck error in packed object"));
 			if (strict && fsck_walk(obj, NULL, &fsck_options))
 				die(_("Not all child objects of %s are reachable"), oid_to_hex(&obj->oid));
 
@@ -879,8 +1036,12 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 					BUG("parse_object_buffer transmogrified our buffer");
 			}
 			obj->flags |= FLAG_CHECKED;
+			read_unlock();
+
+			if (do_fsck_object &&
+			    fsck_buffer(oid, type, buf, size, options))
+				die(_("fsck error in packed object"));
 		}
-		read_unlock();
 	}
 
 	free(new_data);
@@ -890,7 +1051,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
  * Ensure that this node has been reconstructed and return its contents.
  *
  * In the typical and best case, this node would already be reconstructed
- * (through the invocation to resolve_delta() in threaded_second_pass()) and it
+ * (through the invocation to resolve_deltas_of() in threaded_second_pass()) and it
  * would not be pruned. However, if pruning of this node was necessary due to
  * reaching delta_base_cache_limit, this function will find the closest
  * ancestor with reconstructed data that has not been pruned (or if there is
@@ -951,44 +1112,64 @@ static struct base_data *make_base(struct object_entry *obj,
 	return base;
 }
 
-static struct base_data *resolve_delta(struct object_entry *delta_obj,
-				       struct base_data *base)
+/*
+ * The maximum number of children of one base that a thread resolves
+ * in one go; their names are then computed together.
+ */
+#define RESOLVE_BATCH 8
+
+static void resolve_deltas_of(struct object_entry **delta_obj,
+			      struct base_data **result, int nr,
+			      struct base_data *base)
 {
-	void *delta_data, *result_data;
-	struct base_data *result;
-	unsigned long result_size;
+	struct hash_batch_item items[RESOLVE_BATCH];
+	void *result_data[RESOLVE_BATCH];
+	unsigned long result_size[RESOLVE_BATCH];
+	int k;
 
-	if (show_stat) {
-		int i = delta_obj - objects;
-		int j = base->obj - objects;
-		obj_stat[i].delta_depth = obj_stat[j].delta_depth + 1;
-		deepest_delta_lock();
-		if (deepest_delta < obj_stat[i].delta_depth)
-			deepest_delta = obj_stat[i].delta_depth;
-		deepest_delta_unlock();
-		obj_stat[i].base_object_no = j;
-	}
-	delta_data = get_data_from_pack(delta_obj);
 	assert(base->data);
-	result_data = patch_delta(base->data, base->size,
-				  delta_data, delta_obj->size, &result_size);
-	free(delta_data);
-	if (!result_data)
-		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
-	hash_object_file(the_hash_algo, result_data, result_size,
-			 type_name(delta_obj->real_type), &delta_obj->idx.oid);
-	sha1_object(result_data, NULL, result_size, delta_obj->real_type,
-		    &delta_obj->idx.oid);
-
-	result = make_base(delta_obj, base);
-	result->data = result_data;
-	result->size = result_size;
+	for (k = 0; k < nr; k++) {
+		void *delta_data;
+
+		if (show_stat) {
+			int i = delta_obj[k] - objects;
+			int j = base->obj - objects;
+			obj_stat[i].delta_depth = obj_stat[j].delta_depth + 1;
+			deepest_delta_lock();
+			if (deepest_delta < obj_stat[i].delta_depth)
+				deepest_delta = obj_stat[i].delta_depth;
+			deepest_delta_unlock();
+			obj_stat[i].base_object_no = j;
+		}
+		delta_data = get_data_from_pack(delta_obj[k]);
+		result_data[k] = patch_delta(base->data, base->size,
+					     delta_data, delta_obj[k]->size,
+					     &result_size[k]);
+		free(delta_data);
+		if (!result_data[k])
+			bad_object(delta_obj[k]->idx.offset,
+				   _("failed to apply delta"));
+
+		items[k].type = type_name(delta_obj[k]->real_type);
+		items[k].buf = result_data[k];
+		items[k].len = result_size[k];
+		items[k].oid = &delta_obj[k]->idx.oid;
+	}
+	hash_object_file_batch(the_hash_algo, items, nr);
+
+	for (k = 0; k < nr; k++) {
+		sha1_object(result_data[k], NULL, result_size[k],
+			    delta_obj[k]->real_type, &delta_obj[k]->idx.oid,
+			    get_thread_data());
+
+		result[k] = make_base(delta_obj[k], base);
+		result[k]->data = result_data[k];
+		result[k]->size = result_size[k];
+	}
 
 	counter_lock();
-	nr_resolved_deltas++;
+	nr_resolved_deltas += nr;
 	counter_unlock();
-
-	return result;
 }
 
 static int compare_ofs_delta_entry(const void *a, const void *b)
@@ -1015,8 +1196,9 @@ static void *threaded_second_pass(void *data)
 		set_thread_data(data);
 	for (;;) {
 		struct base_data *parent = NULL;
-		struct object_entry *child_obj;
-		struct base_data *child;
+		struct object_entry *child_obj[RESOLVE_BATCH];
+		struct base_data *child[RESOLVE_BATCH];
+		int nr_children = 0, k;
 
 		counter_lock();
 		display_progress(progress, nr_resolved_deltas);
@@ -1034,39 +1216,45 @@ static void *threaded_second_pass(void *data)
 				work_unlock();
 				break;
 			}
-			child_obj = &objects[nr_dispatched++];
+			child_obj[nr_children++] = &objects[nr_dispatched++];
 		} else {
 			/*
-			 * Peek at the top of the stack, and take a child from
-			 * it.
+			 * Peek at the top of the stack, and take children
+			 * from it.
 			 */
 			parent = list_first_entry(&work_head, struct base_data,
 						  list);
 
-			if (parent->ref_first <= parent->ref_last) {
-				int offset = ref_deltas[parent->ref_first++].obj_no;
-				child_obj = objects + offset;
-				if (child_obj->real_type != OBJ_REF_DELTA)
-					die("REF_DELTA at offset %"PRIuMAX" already resolved (duplicate base %s?)",
-					    (uintmax_t) child_obj->idx.offset,
-					    oid_to_hex(&parent->obj->idx.oid));
-				child_obj->real_type = parent->obj->real_type;
-			} else {
-				child_obj = objects +
-					ofs_deltas[parent->ofs_first++].obj_no;
-				assert(child_obj->real_type == OBJ_OFS_DELTA);
-				child_obj->real_type = parent->obj->real_type;
-			}
-
-			if (parent->ref_first > parent->ref_last &&
-			    parent->ofs_first > parent->ofs_last) {
-				/*
-				 * This parent has run out of children, so move
-				 * it to done_head.
-				 */
-				list_del(&parent->list);
-				list_add(&parent->list, &done_head);
-			}
+			do {
+				struct object_entry *obj;
+
+				if (parent->ref_first <= parent->ref_last) {
+					int offset = ref_deltas[parent->ref_first++].obj_no;
+					obj = objects + offset;
+					if (obj->real_type != OBJ_REF_DELTA)
+						die("REF_DELTA at offset %"PRIuMAX" already resolved (duplicate base %s?)",
+						    (uintmax_t) obj->idx.offset,
+						    oid_to_hex(&parent->obj->idx.oid));
+					obj->real_type = parent->obj->real_type;
+				} else {
+					obj = objects +
+						ofs_deltas[parent->ofs_first++].obj_no;
+					assert(obj->real_type == OBJ_OFS_DELTA);
+					obj->real_type = parent->obj->real_type;
+				}
+				child_obj[nr_children++] = obj;
+
+				if (parent->ref_first > parent->ref_last &&
+				    parent->ofs_first > parent->ofs_last) {
+					/*
+					 * This parent has run out of children,
+					 * so move it to done_head.
+					 */
+					list_del(&parent->list);
+					list_add(&parent->list, &done_head);
+					break;
+				}
+			} while (nr_children < RESOLVE_BATCH);
 
 			/*
 			 * Ensure that the parent has data, since we will need
@@ -1085,12 +1273,13 @@ static void *threaded_second_pass(void *data)
 		work_unlock();
 
 		if (parent) {
-			child = resolve_delta(child_obj, parent);
-			if (!child->children_remaining)
-				FREE_AND_NULL(child->data);
+			resolve_deltas_of(child_obj, child, nr_children, parent);
+			for (k = 0; k < nr_children; k++)
+				if (!child[k]->children_remaining)
+					FREE_AND_NULL(child[k]->data);
 		} else {
-			child = make_base(child_obj, NULL);
-			if (child->children_remaining) {
+			child[0] = make_base(child_obj[0], NULL);
+			if (child[0]->children_remaining) {
 				/*
 				 * Since this child has its own delta children,
 				 * we will need this data in the future.
@@ -1098,43 +1287,45 @@ static void *threaded_second_pass(void *data)
 				 * have access to this object's data while
 				 * outside the work mutex.
 				 */
-				child->data = get_data_from_pack(child_obj);
-				child->size = child_obj->size;
+				child[0]->data = get_data_from_pack(child_obj[0]);
+				child[0]->size = child_obj[0]->size;
 			}
 		}
 
 		work_lock();
 		if (parent)
 			parent->retain_data--;
-		if (child->data) {
-			/*
-			 * This child has its own children, so add it to
-			 * work_head.
-			 */
-			list_add(&child->list, &work_head);
-			base_cache_used += child->size;
-			prune_base_data(NULL);
-		} else {
-			/*
-			 * This child does not have its own children. It may be
-			 * the last descendant of its ancestors; free those
-			 * that we can.
-			 */
-			struct base_data *p = parent;
+		for (k = 0; k < nr_children; k++) {
+			if (child[k]->data) {
+				/*
+				 * This child has its own children, so add it
+				 * to work_head.
+				 */
+				list_add(&child[k]->list, &work_head);
+				base_cache_used += child[k]->size;
+				prune_base_data(NULL);
+			} else {
+				/*
+				 * This child does not have its own children.
+				 * It may be the last descendant of its
+				 * ancestors; free those that we can.
+				 */
+				struct base_data *p = parent;
 
-			while (p) {
-				struct base_data *next_p;
+				while (p) {
+					struct base_data *next_p;
 
-				p->children_remaining--;
-				if (p->children_remaining)
-					break;
+					p->children_remaining--;
+					if (p->children_remaining)
+						break;
 
-				next_p = p->base;
-				free_base_data(p);
-				list_del(&p->list);
-				free(p);
+					next_p = p->base;
+					free_base_data(p);
+					list_del(&p->list);
+					free(p);
 
-				p = next_p;
+					p = next_p;
+				}
 			}
 		}
 		work_unlock();
@@ -1142,6 +1333,103 @@ static void *threaded_second_pass(void *data)
 	return NULL;
 }
 
+static void *first_pass_worker(void *data)
+{
+	for (;;) {
+		struct base_queue_entry e;
+		struct object_entry *obj;
+
+		pthread_mutex_lock(&base_queue_mutex);
+		while (!base_queue_nr && !base_queue_eof)
+			pthread_cond_wait(&base_queue_work, &base_queue_mutex);
+		if (!base_queue_nr) {
+			pthread_mutex_unlock(&base_queue_mutex);
+			break;
+		}
+		e = base_queue[base_queue_first];
+		base_queue_first = (base_queue_first + 1) % BASE_QUEUE_SIZE;
+		base_queue_nr--;
+		base_queue_bytes -= objects[e.obj_no].size;
+		pthread_cond_signal(&base_queue_space);
+		pthread_mutex_unlock(&base_queue_mutex);
+
+		obj = &objects[e.obj_no];
+		hash_object_file(the_hash_algo, e.data, obj->size,
+				 type_name(obj->type), &obj->idx.oid);
+		sha1_object(e.data, NULL, obj->size, obj->type,
+			    &obj->idx.oid, data);
+		free(e.data);
+	}
+	return NULL;
+}
+
+static void queue_base_object(int obj_no, void *data)
+{
+	size_t size = objects[obj_no].size;
+
+	pthread_mutex_lock(&base_queue_mutex);
+	/*
+	 * Bound the memory held by queued objects, but always accept at
+	 * least one object, however large.
+	 */
+	while (base_queue_nr == BASE_QUEUE_SIZE ||
+	       (base_queue_nr && base_queue_bytes + size > base_cache_limit))
+		pthread_cond_wait(&base_queue_space, &base_queue_mutex);
+	base_queue[(base_queue_first + base_queue_nr) % BASE_QUEUE_SIZE].obj_no = obj_no;
+	base_queue[(base_queue_first + base_queue_nr) % BASE_QUEUE_SIZE].data = data;
+	base_queue_nr++;
+	base_queue_bytes += size;
+	pthread_cond_signal(&base_queue_work);
+	pthread_mutex_unlock(&base_queue_mutex);
+}
+
+static void start_first_pass_workers(void)
+{
+	int i;
+
+	init_recursive_mutex(&read_mutex);
+	pthread_mutex_init(&base_queue_mutex, NULL);
+	pthread_cond_init(&base_queue_space, NULL);
+	pthread_cond_init(&base_queue_work, NULL);
+	base_cache_limit = delta_base_cache_limit * nr_threads;
+	CALLOC_ARRAY(thread_data, nr_threads);
+	threads_active = 1;
+	hash_in_workers = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		int ret;
+
+		init_thread_fsck_options(&thread_data[i]);
+		ret = pthread_create(&thread_data[i].thread, NULL,
+				     first_pass_worker, &thread_data[i]);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void finish_first_pass_workers(void)
+{
+	int i;
+
+	pthread_mutex_lock(&base_queue_mutex);
+	base_queue_eof = 1;
+	pthread_cond_broadcast(&base_queue_work);
+	pthread_mutex_unlock(&base_queue_mutex);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(thread_data[i].thread, NULL);
+		merge_thread_fsck_options(&thread_data[i]);
+	}
+
+	hash_in_workers = 0;
+	threads_active = 0;
+	FREE_AND_NULL(thread_data);
+	pthread_cond_destroy(&base_queue_work);
+	pthread_cond_destroy(&base_queue_space);
+	pthread_mutex_destroy(&base_queue_mutex);
+	pthread_mutex_destroy(&read_mutex);
+}
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -1159,6 +1447,8 @@ static void parse_pack_objects(unsigned char *hash)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+	if (HAVE_THREADS && (nr_threads > 1 || getenv("GIT_FORCE_THREADS")))
+		start_first_pass_workers();
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
@@ -1178,13 +1468,18 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (hash_in_workers) {
+			queue_base_object(i, data);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
-				    &obj->idx.oid);
+				    &obj->idx.oid, &nothread_data);
 		free(data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	if (hash_in_workers)
+		finish_first_pass_workers();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1195,11 +1490,16 @@ static void parse_pack_objects(unsigned char *hash)
 	use(the_hash_algo->rawsz);
 
 	/* If input_fd is a file, we should have reached its end now. */
-	if (fstat(input_fd, &st))
-		die_errno(_("cannot fstat packfile"));
-	if (S_ISREG(st.st_mode) &&
-			lseek(input_fd, 0, SEEK_CUR) - input_len != st.st_size)
-		die(_("pack has junk at the end"));
+	if (input_map) {
+		if (input_buffer + input_offset != input_map + input_map_size)
+			die(_("pack has junk at the end"));
+	} else {
+		if (fstat(input_fd, &st))
+			die_errno(_("cannot fstat packfile"));
+		if (S_ISREG(st.st_mode) &&
+		    lseek(input_fd, 0, SEEK_CUR) - input_len != st.st_size)
+			die(_("pack has junk at the end"));
+	}
 
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
@@ -1207,7 +1507,7 @@ static void parse_pack_objects(unsigned char *hash)
 			continue;
 		obj->real_type = obj->type;
 		sha1_object(NULL, obj, obj->size, obj->type,
-			    &obj->idx.oid);
+			    &obj->idx.oid, &nothread_data);
 		nr_delays--;
 	}
 	if (nr_delays)
@@ -1330,6 +1630,118 @@ static int write_compressed(struct hashfile *f, void *in, unsigned int size)
 	return size;
 }
 
+/*
+ * The local objects that complete a thin pack are read ahead of their
+ * use by prefetch threads, in the order in which they are stored, while
+ * the main thread appends them in pack position order and resolves the
+ * deltas against them.  The state of the bases is guarded by
+ * thin_base_mutex; the prefetchers wait on thin_base_cond when they
+ * have read too much ahead, and the main thread when a base it needs
+ * is being read.
+ */
+enum thin_base_state {
+	THIN_BASE_WAITING,
+	THIN_BASE_READING,
+	THIN_BASE_READ,
+	THIN_BASE_TAKEN,
+};
+
+struct thin_base {
+	struct object_id oid;
+	struct packed_git *pack;
+	off_t offset;
+	void *data;
+	unsigned long size;
+	enum object_type type;
+	enum thin_base_state state;
+	unsigned corrupt:1;
+};
+
+static struct thin_base *thin_bases;
+static struct thin_base **thin_base_order;
+static int nr_thin_bases, thin_base_next;
+static size_t thin_base_bytes;
+static pthread_mutex_t thin_base_mutex;
+static pthread_cond_t thin_base_cond;
+
+static int thin_base_cmp(const void *va, const void *vb)
+{
+	const struct thin_base *a = *(const struct thin_base **)va;
+	const struct thin_base *b = *(const struct thin_base **)vb;
+
+	/* bases that are not packed, or are missing, go last */
+	if (!a->pack || !b->pack)
+		return !a->pack - !b->pack;
+	if (a->pack != b->pack)
+		return strcmp(a->pack->pack_name, b->pack->pack_name);
+	return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+static void read_thin_base(struct thin_base *b)
+{
+	b->data = read_object_file(&b->oid, &b->type, &b->size);
+	if (b->data &&
+	    check_object_signature(the_repository, &b->oid, b->data, b->size,
+				   type_name(b->type)))
+		b->corrupt = 1;
+}
+
+static void *prefetch_thin_bases(void *unused)
+{
+	pthread_mutex_lock(&thin_base_mutex);
+	for (;;) {
+		struct thin_base *b;
+
+		while (thin_base_next < nr_thin_bases &&
+		       thin_base_order[thin_base_next]->state != THIN_BASE_WAITING)
+			thin_base_next++;
+		if (thin_base_next >= nr_thin_bases)
+			break;
+		if (thin_base_bytes > base_cache_limit) {
+			pthread_cond_wait(&thin_base_cond, &thin_base_mutex);
+			continue;
+		}
+
+		b = thin_base_order[thin_base_next++];
+		b->state = THIN_BASE_READING;
+		pthread_mutex_unlock(&thin_base_mutex);
+		read_thin_base(b);
+		pthread_mutex_lock(&thin_base_mutex);
+		b->state = THIN_BASE_READ;
+		thin_base_bytes += b->size;
+		pthread_cond_broadcast(&thin_base_cond);
+	}
+	pthread_mutex_unlock(&thin_base_mutex);
+	return NULL;
+}
+
+/*
+ * Hand the base over to the main thread, reading it right away if no
+ * prefetcher got to it yet.
+ */
+static void take_thin_base(struct thin_base *b)
+{
+	int unread;
+
+	pthread_mutex_lock(&thin_base_mutex);
+	while (b->state == THIN_BASE_READING)
+		pthread_cond_wait(&thin_base_cond, &thin_base_mutex);
+	unread = b->state == THIN_BASE_WAITING;
+	if (unread)
+		b->state = THIN_BASE_READING;
+	else
+		thin_base_bytes -= b->size;
+	pthread_mutex_unlock(&thin_base_mutex);
+
+	if (unread)
+		read_thin_base(b);
+
+	pthread_mutex_lock(&thin_base_mutex);
+	b->state = THIN_BASE_TAKEN;
+	pthread_cond_broadcast(&thin_base_cond);
+	pthread_mutex_unlock(&thin_base_mutex);
+}
+
 static struct object_entry *append_obj_to_pack(struct hashfile *f,
 			       const unsigned char *sha1, void *buf,
 			       unsigned long size, enum object_type type)
@@ -1370,6 +1782,10 @@ static int delta_pos_compare(const void *_a, const void *_b)
 static void fix_unresolved_deltas(struct hashfile *f)
 {
 	struct ref_delta_entry **sorted_by_pos;
+	int *base_of;
+	char *base_taken;
+	pthread_t *prefetchers = NULL;
+	int nr_prefetchers = 0;
 	int i;
 
 	/*
@@ -1405,33 +1821,104 @@ static void fix_unresolved_deltas(struct hashfile *f)
 		oid_array_clear(&to_fetch);
 	}
 
+	/*
+	 * ref_deltas[] is sorted by base, so that the deltas against
+	 * the same base are next to each other.
+	 */
+	ALLOC_ARRAY(base_of, nr_ref_deltas);
+	CALLOC_ARRAY(thin_bases, nr_ref_deltas);
+	nr_thin_bases = 0;
 	for (i = 0; i < nr_ref_deltas; i++) {
-		struct ref_delta_entry *d = sorted_by_pos[i];
-		enum object_type type;
-		void *data;
-		unsigned long size;
+		struct object_info oi = OBJECT_INFO_INIT;
+		struct thin_base *b;
 
-		if (objects[d->obj_no].real_type != OBJ_REF_DELTA)
+		if (i && oideq(&ref_deltas[i].oid, &ref_deltas[i - 1].oid)) {
+			base_of[i] = nr_thin_bases - 1;
 			continue;
-		data = read_object_file(&d->oid, &type, &size);
-		if (!data)
+		}
+		base_of[i] = nr_thin_bases;
+		b = &thin_bases[nr_thin_bases++];
+		oidcpy(&b->oid, &ref_deltas[i].oid);
+		if (!oid_object_info_extended(the_repository, &b->oid, &oi,
+					      OBJECT_INFO_QUICK |
+					      OBJECT_INFO_SKIP_FETCH_OBJECT) &&
+		    oi.whence == OI_PACKED) {
+			b->pack = oi.u.packed.pack;
+			b->offset = oi.u.packed.offset;
+		}
+	}
+	CALLOC_ARRAY(base_taken, nr_thin_bases);
+	ALLOC_ARRAY(thin_base_order, nr_thin_bases);
+	for (i = 0; i < nr_thin_bases; i++)
+		thin_base_order[i] = &thin_bases[i];
+	QSORT(thin_base_order, nr_thin_bases, thin_base_cmp);
+	thin_base_next = 0;
+	thin_base_bytes = 0;
+
+	if (HAVE_THREADS && nr_thin_bases > 1) {
+		nr_prefetchers = nr_threads < nr_thin_bases ?
+				 nr_threads : nr_thin_bases;
+		enable_obj_read_lock();
+		pthread_mutex_init(&thin_base_mutex, NULL);
+		pthread_cond_init(&thin_base_cond, NULL);
+		CALLOC_ARRAY(prefetchers, nr_prefetchers);
+		for (i = 0; i < nr_prefetchers; i++) {
+			int ret = pthread_create(&prefetchers[i], NULL,
+						 prefetch_thin_bases, NULL);
+			if (ret)
+				die(_("unable to create thread: %s"),
+				    strerror(ret));
+		}
+	}
+
+	for (i = 0; i < nr_ref_deltas; i++) {
+		struct ref_delta_entry *d = sorted_by_pos[i];
+		int nr = base_of[d - ref_deltas];
+		struct thin_base *b = &thin_bases[nr];
+
+		/*
+		 * All deltas against this base were resolved when it was
+		 * first taken, whether it was appended or not.
+		 */
+		if (base_taken[nr])
 			continue;
+		base_taken[nr] = 1;
+		take_thin_base(b);
 
-		if (check_object_signature(the_repository, &d->oid,
-					   data, size,
-					   type_name(type)))
-			die(_("local object %s is corrupt"), oid_to_hex(&d->oid));
+		if (objects[d->obj_no].real_type != OBJ_REF_DELTA ||
+		    !b->data) {
+			FREE_AND_NULL(b->data);
+			continue;
+		}
+		if (b->corrupt)
+			die(_("local object %s is corrupt"), oid_to_hex(&b->oid));
 
 		/*
 		 * Add this as an object to the objects array and call
 		 * threaded_second_pass() (which will pick up the added
 		 * object).
 		 */
-		append_obj_to_pack(f, d->oid.hash, data, size, type);
+		append_obj_to_pack(f, b->oid.hash, b->data, b->size, b->type);
+		FREE_AND_NULL(b->data);
 		threaded_second_pass(NULL);
 
 		display_progress(progress, nr_resolved_deltas);
 	}
+
+	if (nr_prefetchers) {
+		for (i = 0; i < nr_prefetchers; i++)
+			pthread_join(prefetchers[i], NULL);
+		free(prefetchers);
+		pthread_cond_destroy(&thin_base_cond);
+		pthread_mutex_destroy(&thin_base_mutex);
+		disable_obj_read_lock();
+	}
+	trace2_data_intmax("index-pack", the_repository, "thin_bases",
+			   nr_thin_bases);
+	FREE_AND_NULL(thin_base_order);
+	FREE_AND_NULL(thin_bases);
+	free(base_taken);
+	free(base_of);
 	free(sorted_by_pos);
 }
 
@@ -51,6 +51,7 @@ static int default_encode_email_headers = 1;
 static int decoration_style;
 static int decoration_given;
 static int use_mailmap_config = 1;
+static int format_wants_signature;
 static const char *fmt_patch_subject_prefix = "PATCH";
 static int fmt_patch_name_max = FORMAT_PATCH_NAME_MAX_DEFAULT;
 static const char *fmt_pretty;
@@ -224,6 +225,8 @@ static void cmd_log_init_finish(int argc, const char **argv, const char *prefix,
 	    rev->diffopt.filter || rev->diffopt.flags.follow_renames)
 		rev->always_show_header = 0;
 
+	format_wants_signature = w.signature;
+
 	if (source || w.source) {
 		init_revision_sources(&revision_sources);
 		rev->sources = &revision_sources;
@@ -401,9 +404,53 @@ static void finish_early_output(struct rev_info *rev)
 	show_early_header(rev, "done", n);
 }
 
+/*
+ * With --show-signature, most of the time goes to waiting for the
+ * verifier of each commit in turn.  Read a batch of commits ahead of
+ * the one being shown, and have their signatures verified at once.
+ */
+struct signature_lookahead {
+	struct commit *commits[SIGNATURE_PREFETCH_MAX];
+	int nr, pos;
+};
+
+static int want_signature_lookahead(struct rev_info *rev)
+{
+	/*
+	 * Reading ahead must not change what the walk returns: the graph
+	 * is drawn and the reflog and --follow state updated as commits
+	 * are shown.
+	 */
+	return (rev->show_signature || format_wants_signature) &&
+	       !rev->graph && !rev->reflog_info &&
+	       !rev->diffopt.flags.follow_renames &&
+	       get_signature_verify_jobs() > 1;
+}
+
+static struct commit *get_revision_lookahead(struct rev_info *rev,
+					     struct signature_lookahead *la)
+{
+	if (!la)
+		return get_revision(rev);
+
+	if (la->pos == la->nr) {
+		struct commit *commit;
+
+		la->nr = la->pos = 0;
+		while (la->nr < SIGNATURE_PREFETCH_MAX &&
+		       (commit = get_revision(rev)))
+			la->commits[la->nr++] = commit;
+		prefetch_commit_signatures(la->commits, la->nr);
+		if (!la->nr)
+			return NULL;
+	}
+	return la->commits[la->pos++];
+}
+
 static int cmd_log_walk(struct rev_info *rev)
 {
 	struct commit *commit;
+	struct signature_lookahead *la = NULL;
 	int saved_nrl = 0;
 	int saved_dcctc = 0;
 
@@ -422,7 +469,9 @@ static int cmd_log_walk(struct rev_info *rev)
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
 	rev->diffopt.no_free = 1;
-	while ((commit = get_revision(rev)) != NULL) {
+	if (want_signature_lookahead(rev))
+		CALLOC_ARRAY(la, 1);
+	while ((commit = get_revision_lookahead(rev, la)) != NULL) {
 		if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
 			/*
 			 * We decremented max_count in get_revision,
@@ -444,6 +493,7 @@ static int cmd_log_walk(struct rev_info *rev)
 		if (rev->diffopt.degraded_cc_to_c)
 			saved_dcctc = 1;
 	}
+	free(la);
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
 	rev->diffopt.no_free = 0;
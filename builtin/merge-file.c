@@ -57,6 +57,7 @@ int cmd_merge_file(int argc, const char **argv, const char *prefix)
 		git_config(git_xmerge_config, NULL);
 		if (0 <= git_xmerge_style)
 			xmp.style = git_xmerge_style;
+		xmp.segment_size = git_xmerge_segment_size;
 	}
 
 	argc = parse_options(argc, argv, prefix, options, merge_file_usage, 0);
@@ -9,6 +9,7 @@
 #include "prio-queue.h"
 #include "hash-lookup.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
 
 /*
  * One day.  See the 'name a rev shortly after epoch' test in t6120 when
@@ -27,8 +28,22 @@ struct rev_name {
 define_commit_slab(commit_rev_name, struct rev_name);
 
 static timestamp_t cutoff = TIME_MAX;
+static timestamp_t generation_cutoff = GENERATION_NUMBER_INFINITY;
 static struct commit_rev_name rev_names;
 
+/*
+ * Commits older than the cutoff date, or of a lower generation than
+ * all the commits we are asked to name, cannot lead to any of them.
+ * The generation numbers from the commit-graph are exact, while the
+ * date is only a heuristic; commits outside the commit-graph have an
+ * infinite generation and are never cut off by it.
+ */
+static int is_cut_off(struct commit *commit)
+{
+	return commit->date < cutoff ||
+	       commit_graph_generation(commit) < generation_cutoff;
+}
+
 /* How many generations are maximally preferred over _one_ merge traversal? */
 #define MERGE_TRAVERSAL_WEIGHT 65535
 
@@ -142,7 +157,7 @@ static void name_rev(struct commit *start_commit,
 	struct rev_name *start_name;
 
 	parse_commit(start_commit);
-	if (start_commit->date < cutoff)
+	if (is_cut_off(start_commit))
 		return;
 
 	start_name = create_or_update_name(start_commit, taggerdate, 0, 0,
@@ -172,7 +187,7 @@ static void name_rev(struct commit *start_commit,
 			int generation, distance;
 
 			parse_commit(parent);
-			if (parent->date < cutoff)
+			if (is_cut_off(parent))
 				continue;
 
 			if (parent_number > 1) {
@@ -519,6 +534,7 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 {
 	struct object_array revs = OBJECT_ARRAY_INIT;
 	int all = 0, transform_stdin = 0, allow_undefined = 1, always = 0, peel_tag = 0;
+	int want_generation_cutoff;
 	struct name_ref_data data = { 0, 0, STRING_LIST_INIT_NODUP, STRING_LIST_INIT_NODUP };
 	struct option opts[] = {
 		OPT_BOOL(0, "name-only", &data.name_only, N_("print only ref-based names (no object names)")),
@@ -551,6 +567,7 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 	}
 	if (all || transform_stdin)
 		cutoff = 0;
+	want_generation_cutoff = cutoff && generation_numbers_enabled(the_repository);
 
 	for (; argc; argc--, argv++) {
 		struct object_id oid;
@@ -579,8 +596,14 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		}
 
 		if (commit) {
+			timestamp_t generation = commit_graph_generation(commit);
+
 			if (cutoff > commit->date)
 				cutoff = commit->date;
+			if (generation == GENERATION_NUMBER_INFINITY)
+				want_generation_cutoff = 0;
+			else if (generation_cutoff > generation)
+				generation_cutoff = generation;
 		}
 
 		if (peel_tag) {
@@ -594,6 +617,8 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		add_object_array(object, *argv, &revs);
 	}
 
+	if (!want_generation_cutoff || generation_cutoff == GENERATION_NUMBER_INFINITY)
+		generation_cutoff = 0;
 	if (cutoff) {
 		/* check for undeflow */
 		if (cutoff > TIME_MIN + CUTOFF_DATE_SLOP)
@@ -22,6 +22,7 @@
 #include "string-list.h"
 #include "notes-merge.h"
 #include "notes-utils.h"
+#include "notes-index.h"
 #include "worktree.h"
 
 static const char * const git_notes_usage[] = {
@@ -37,6 +38,7 @@ static const char * const git_notes_usage[] = {
 	N_("git notes [--ref <notes-ref>] remove [<object>...]"),
 	N_("git notes [--ref <notes-ref>] prune [-n] [-v]"),
 	N_("git notes [--ref <notes-ref>] get-ref"),
+	N_("git notes [--ref <notes-ref>] write-index"),
 	NULL
 };
 
@@ -93,6 +95,11 @@ static const char * const git_notes_get_ref_usage[] = {
 	NULL
 };
 
+static const char * const git_notes_write_index_usage[] = {
+	N_("git notes write-index"),
+	NULL
+};
+
 static const char note_template[] =
 	N_("Write/edit the notes for the following object:");
 
@@ -990,6 +997,25 @@ static int get_ref(int argc, const char **argv, const char *prefix)
 	return 0;
 }
 
+static int write_index(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = { OPT_END() };
+	const char *ref = default_notes_ref();
+	struct object_id oid;
+
+	argc = parse_options(argc, argv, prefix, options,
+			     git_notes_write_index_usage, 0);
+
+	if (argc) {
+		error(_("too many arguments"));
+		usage_with_options(git_notes_write_index_usage, options);
+	}
+
+	if (read_ref(ref, &oid))
+		return error(_("notes ref %s does not exist"), ref);
+	return update_notes_index(the_repository, &oid);
+}
+
 int cmd_notes(int argc, const char **argv, const char *prefix)
 {
 	int result;
@@ -1030,6 +1056,8 @@ int cmd_notes(int argc, const char **argv, const char *prefix)
 		result = prune(argc, argv, prefix);
 	else if (!strcmp(argv[0], "get-ref"))
 		result = get_ref(argc, argv, prefix);
+	else if (!strcmp(argv[0], "write-index"))
+		result = write_index(argc, argv, prefix);
 	else {
 		result = error(_("unknown subcommand: %s"), argv[0]);
 		usage_with_options(git_notes_usage, options);
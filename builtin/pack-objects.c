@@ -11,6 +11,7 @@
 #include "delta.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "pack-mtimes.h"
 #include "csum-file.h"
 #include "tree-walk.h"
 #include "diff.h"
@@ -25,6 +26,7 @@
 #include "thread-utils.h"
 #include "pack-bitmap.h"
 #include "delta-islands.h"
+#include "delta-decisions.h"
 #include "reachable.h"
 #include "oid-array.h"
 #include "strvec.h"
@@ -33,6 +35,7 @@
 #include "object-store.h"
 #include "dir.h"
 #include "midx.h"
+#include "pack-oidset.h"
 #include "trace2.h"
 #include "shallow.h"
 #include "promisor-remote.h"
@@ -166,6 +169,7 @@ static inline void oe_set_delta_size(struct packing_data *pack,
 }
 
 #define IN_PACK(obj) oe_in_pack(&to_pack, obj)
+#define IN_PACK_OFFSET(obj) oe_in_pack_offset(&to_pack, obj)
 #define SIZE(obj) oe_size(&to_pack, obj)
 #define SET_SIZE(obj,size) oe_set_size(&to_pack, obj, size)
 #define DELTA_SIZE(obj) oe_delta_size(&to_pack, obj)
@@ -194,6 +198,8 @@ static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static timestamp_t unpack_unreachable_expiration;
 static int pack_loose_unreachable;
+static int cruft;
+static timestamp_t cruft_expiration;
 static int local;
 static int have_non_local_packs;
 static int incremental;
@@ -213,13 +219,15 @@ static int thin;
 static int num_preferred_base;
 static struct progress *progress_state;
 
-static struct packed_git *reuse_packfile;
+static struct bitmapped_pack *reuse_packfiles;
+static size_t reuse_packfiles_nr;
 static uint32_t reuse_packfile_objects;
 static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
 static int allow_pack_reuse = 1;
+static int spill_cold;
 static enum {
 	WRITE_BITMAP_FALSE = 0,
 	WRITE_BITMAP_QUIET,
@@ -231,6 +239,15 @@ static int exclude_promisor_objects;
 
 static int use_delta_islands;
 
+static int use_delta_decisions;
+static struct delta_decisions *delta_decisions;
+static struct object_id delta_decisions_key;
+static uint32_t delta_decisions_hits;
+
+static const char *access_profile;
+static uint32_t *profiled_objects;
+static uint32_t profiled_nr, profiled_alloc;
+
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
 static unsigned long cache_max_small_delta_size = 1000;
@@ -258,6 +275,21 @@ static struct oidmap configured_exclusions;
 
 static struct oidset excluded_by_config;
 
+/*
+ * A whole pack of ours, configured with uploadpack.packPackfileUri,
+ * which a client that has nothing yet can download from "uri" instead
+ * of getting its objects from us.
+ */
+struct configured_pack_exclusion {
+	char *pack_hash_hex;
+	char *uri;
+	struct packed_git *p;
+	unsigned used : 1;
+};
+static struct configured_pack_exclusion *pack_exclusions;
+static int nr_pack_exclusions, alloc_pack_exclusions;
+static int use_pack_exclusions;
+
 /*
  * stats
  */
@@ -281,7 +313,7 @@ static void index_commit_for_bitmap(struct commit *commit)
 	indexed_commits[indexed_commits_nr++] = commit;
 }
 
-static void *get_delta(struct object_entry *entry)
+static void *get_delta(struct object_entry *entry, struct object_entry *base)
 {
 	unsigned long size, base_size, delta_size;
 	void *buf, *base_buf, *delta_buf;
@@ -290,11 +322,9 @@ static void *get_delta(struct object_entry *entry)
 	buf = read_object_file(&entry->idx.oid, &type, &size);
 	if (!buf)
 		die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
-	base_buf = read_object_file(&DELTA(entry)->idx.oid, &type,
-				    &base_size);
+	base_buf = read_object_file(&base->idx.oid, &type, &base_size);
 	if (!base_buf)
-		die("unable to read %s",
-		    oid_to_hex(&DELTA(entry)->idx.oid));
+		die("unable to read %s", oid_to_hex(&base->idx.oid));
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
 	/*
@@ -334,6 +364,13 @@ static unsigned long do_compress(void **pptr, unsigned long size)
 	return stream.total_out;
 }
 
+static void close_stream(struct git_istream *st)
+{
+	obj_read_lock();
+	close_istream(st);
+	obj_read_unlock();
+}
+
 static unsigned long write_large_blob_data(struct git_istream *st, struct hashfile *f,
 					   const struct object_id *oid)
 {
@@ -347,7 +384,9 @@ static unsigned long write_large_blob_data(struct git_istream *st, struct hashfi
 	for (;;) {
 		ssize_t readlen;
 		int zret = Z_OK;
+		obj_read_lock();
 		readlen = read_istream(st, ibuf, sizeof(ibuf));
+		obj_read_unlock();
 		if (readlen == -1)
 			die(_("unable to read %s"), oid_to_hex(oid));
 
@@ -433,6 +472,297 @@ static inline int oe_size_greater_than(struct packing_data *pack,
 	return oe_get_size_slow(pack, lhs) > rhs;
 }
 
+static int want_reuse(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!IN_PACK(entry))
+		return 0;	/* can't reuse what we don't have */
+	else if (oe_type(entry) == OBJ_REF_DELTA ||
+		 oe_type(entry) == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (oe_type(entry) != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (DELTA(entry))
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+/*
+ * While a single pack is written, threads deflate the objects that
+ * cannot be reused from an existing pack ahead of the writer, in write
+ * order, so that the writer mostly copies out what they left it.  An
+ * object that is written before its turn (the base of a delta) and has
+ * not been picked up by a thread yet is deflated by the writer itself.
+ *
+ * The threads stay at most WRITE_AHEAD_NR objects and (roughly)
+ * WRITE_AHEAD_LIMIT bytes of deflated data ahead.  Everybody takes
+ * turns at the object store with obj_read_lock().
+ */
+#define WRITE_AHEAD_NR 1024
+#define WRITE_AHEAD_LIMIT (64 * 1024 * 1024)
+
+/* in write_ahead.pos[], for objects the writer takes care of itself */
+#define WRITE_AHEAD_TAKEN UINT32_MAX
+
+enum write_ahead_state {
+	WRITE_AHEAD_FREE,
+	WRITE_AHEAD_WORKING,
+	WRITE_AHEAD_DONE
+};
+
+struct write_ahead_slot {
+	enum write_ahead_state state;
+	unsigned is_delta : 1;
+	enum object_type type;
+	unsigned long size, datalen;
+	void *buf;
+};
+
+static struct write_ahead {
+	int active;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int nr_threads;
+
+	struct object_entry **order;
+	uint32_t nr, next, writer_pos;
+	size_t pending;
+	uint32_t nr_deflated;
+
+	/*
+	 * For each object in to_pack, its position in "order" plus one
+	 * while it has a slot, or WRITE_AHEAD_TAKEN.
+	 */
+	uint32_t *pos;
+	struct write_ahead_slot slot[WRITE_AHEAD_NR];
+} write_ahead;
+
+static int write_ahead_wanted(struct object_entry *entry)
+{
+	/* without a pack size limit, usable_delta is just this */
+	struct object_entry *base = DELTA(entry);
+
+	if (entry->preferred_base || want_reuse(entry, !!base))
+		return 0;
+	if (base)
+		return !entry->z_delta_size;
+	return !(oe_type(entry) == OBJ_BLOB &&
+		 oe_size_greater_than(&to_pack, entry, big_file_threshold));
+}
+
+static void write_ahead_deflate(struct object_entry *entry,
+				struct write_ahead_slot *slot)
+{
+	struct object_entry *base = DELTA(entry);
+	void *buf;
+
+	if (base) {
+		if (entry->delta_data) {
+			buf = entry->delta_data;
+			entry->delta_data = NULL;
+		} else {
+			buf = get_delta(entry, base);
+		}
+		slot->size = DELTA_SIZE(entry);
+		slot->is_delta = 1;
+	} else {
+		buf = read_object_file(&entry->idx.oid, &slot->type,
+				       &slot->size);
+		if (!buf)
+			die(_("unable to read %s"),
+			    oid_to_hex(&entry->idx.oid));
+		slot->is_delta = 0;
+	}
+	slot->datalen = do_compress(&buf, slot->size);
+	slot->buf = buf;
+}
+
+static void *write_ahead_thread(void *data)
+{
+	struct write_ahead *wa = data;
+
+	pthread_mutex_lock(&wa->mutex);
+	for (;;) {
+		struct object_entry *entry;
+		struct write_ahead_slot *slot;
+		uint32_t k, *pos;
+		int wanted;
+
+		while (wa->next < wa->nr &&
+		       (wa->next >= wa->writer_pos + WRITE_AHEAD_NR ||
+			wa->pending >= WRITE_AHEAD_LIMIT))
+			pthread_cond_wait(&wa->cond, &wa->mutex);
+		if (wa->next >= wa->nr)
+			break;
+		k = wa->next++;
+		entry = wa->order[k];
+		pthread_mutex_unlock(&wa->mutex);
+
+		wanted = write_ahead_wanted(entry);
+
+		pthread_mutex_lock(&wa->mutex);
+		pos = &wa->pos[entry - to_pack.objects];
+		if (!wanted || *pos || k < wa->writer_pos)
+			continue;
+		slot = &wa->slot[k % WRITE_AHEAD_NR];
+		slot->state = WRITE_AHEAD_WORKING;
+		*pos = k + 1;
+		pthread_mutex_unlock(&wa->mutex);
+
+		write_ahead_deflate(entry, slot);
+
+		pthread_mutex_lock(&wa->mutex);
+		slot->state = WRITE_AHEAD_DONE;
+		wa->pending += slot->datalen;
+		wa->nr_deflated++;
+		pthread_cond_broadcast(&wa->cond);
+	}
+	pthread_mutex_unlock(&wa->mutex);
+	return NULL;
+}
+
+static void start_write_ahead(struct object_entry **order, uint32_t nr)
+{
+	struct write_ahead *wa = &write_ahead;
+	int i;
+
+	if (!HAVE_THREADS || delta_search_threads <= 1 ||
+	    pack_size_limit || nr < 2)
+		return;
+
+	wa->order = order;
+	wa->nr = nr;
+	wa->next = wa->writer_pos = 0;
+	wa->pending = 0;
+	wa->nr_deflated = 0;
+	CALLOC_ARRAY(wa->pos, to_pack.nr_objects);
+	memset(wa->slot, 0, sizeof(wa->slot));
+	pthread_mutex_init(&wa->mutex, NULL);
+	pthread_cond_init(&wa->cond, NULL);
+	enable_obj_read_lock();
+	wa->active = 1;
+
+	wa->nr_threads = delta_search_threads;
+	CALLOC_ARRAY(wa->threads, wa->nr_threads);
+	for (i = 0; i < wa->nr_threads; i++)
+		if (pthread_create(&wa->threads[i], NULL,
+				   write_ahead_thread, wa))
+			die(_("unable to create thread"));
+}
+
+static void release_write_ahead_slot(struct write_ahead *wa,
+				     struct write_ahead_slot *slot)
+{
+	while (slot->state == WRITE_AHEAD_WORKING)
+		pthread_cond_wait(&wa->cond, &wa->mutex);
+	wa->pending -= slot->datalen;
+	slot->state = WRITE_AHEAD_FREE;
+	slot->buf = NULL;
+	slot->datalen = 0;
+}
+
+/*
+ * Take what the threads prepared for "entry", if anything.  Returns 1
+ * and fills in the deflated data if it can be written as it is.
+ */
+static int take_write_ahead(struct object_entry *entry, int usable_delta,
+			    enum object_type *type, unsigned long *size,
+			    void **buf, unsigned long *datalen)
+{
+	struct write_ahead *wa = &write_ahead;
+	struct write_ahead_slot *slot;
+	uint32_t *pos;
+	int ret = 0;
+
+	if (!wa->active)
+		return 0;
+
+	pthread_mutex_lock(&wa->mutex);
+	pos = &wa->pos[entry - to_pack.objects];
+	if (*pos && *pos != WRITE_AHEAD_TAKEN) {
+		slot = &wa->slot[(*pos - 1) % WRITE_AHEAD_NR];
+		while (slot->state == WRITE_AHEAD_WORKING)
+			pthread_cond_wait(&wa->cond, &wa->mutex);
+		/* the delta may have been dropped since */
+		if (slot->is_delta == !!usable_delta) {
+			*type = slot->type;
+			*size = slot->size;
+			*buf = slot->buf;
+			*datalen = slot->datalen;
+			ret = 1;
+		} else {
+			free(slot->buf);
+		}
+		release_write_ahead_slot(wa, slot);
+		pthread_cond_broadcast(&wa->cond);
+	}
+	*pos = WRITE_AHEAD_TAKEN;
+	pthread_mutex_unlock(&wa->mutex);
+	return ret;
+}
+
+/* The writer is done with the objects before write order "end". */
+static void advance_write_ahead(uint32_t end)
+{
+	struct write_ahead *wa = &write_ahead;
+
+	if (!wa->active)
+		return;
+
+	pthread_mutex_lock(&wa->mutex);
+	for (; wa->writer_pos < end; wa->writer_pos++) {
+		uint32_t k = wa->writer_pos;
+		uint32_t *pos = &wa->pos[wa->order[k] - to_pack.objects];
+		struct write_ahead_slot *slot = &wa->slot[k % WRITE_AHEAD_NR];
+
+		if (*pos != k + 1)
+			continue;
+		/* not written after all; nobody needs it anymore */
+		while (slot->state == WRITE_AHEAD_WORKING)
+			pthread_cond_wait(&wa->cond, &wa->mutex);
+		free(slot->buf);
+		release_write_ahead_slot(wa, slot);
+		*pos = WRITE_AHEAD_TAKEN;
+	}
+	if (wa->next < end)
+		wa->next = end;
+	pthread_cond_broadcast(&wa->cond);
+	pthread_mutex_unlock(&wa->mutex);
+}
+
+static void stop_write_ahead(void)
+{
+	struct write_ahead *wa = &write_ahead;
+	int i;
+
+	if (!wa->active)
+		return;
+
+	pthread_mutex_lock(&wa->mutex);
+	wa->next = wa->nr;
+	pthread_cond_broadcast(&wa->cond);
+	pthread_mutex_unlock(&wa->mutex);
+	for (i = 0; i < wa->nr_threads; i++)
+		pthread_join(wa->threads[i], NULL);
+	advance_write_ahead(wa->nr);
+
+	trace2_data_intmax("pack-objects", the_repository,
+			   "write_ahead_deflated", wa->nr_deflated);
+	wa->active = 0;
+	disable_obj_read_lock();
+	pthread_cond_destroy(&wa->cond);
+	pthread_mutex_destroy(&wa->mutex);
+	FREE_AND_NULL(wa->threads);
+	FREE_AND_NULL(wa->pos);
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct hashfile *f, struct object_entry *entry,
 					   unsigned long limit, int usable_delta)
@@ -445,12 +775,22 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	void *buf;
 	struct git_istream *st = NULL;
 	const unsigned hashsz = the_hash_algo->rawsz;
-
-	if (!usable_delta) {
+	int deflated = 0;
+
+	if (take_write_ahead(entry, usable_delta, &type, &size, &buf, &datalen)) {
+		deflated = 1;
+		if (usable_delta)
+			type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+	} else if (!usable_delta) {
 		if (oe_type(entry) == OBJ_BLOB &&
-		    oe_size_greater_than(&to_pack, entry, big_file_threshold) &&
-		    (st = open_istream(the_repository, &entry->idx.oid, &type,
-				       &size, NULL)) != NULL)
+		    oe_size_greater_than(&to_pack, entry, big_file_threshold)) {
+			obj_read_lock();
+			st = open_istream(the_repository, &entry->idx.oid,
+					  &type, &size, NULL);
+			obj_read_unlock();
+		}
+		if (st)
 			buf = NULL;
 		else {
 			buf = read_object_file(&entry->idx.oid, &type, &size);
@@ -471,13 +811,15 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else {
-		buf = get_delta(entry);
+		buf = get_delta(entry, DELTA(entry));
 		size = DELTA_SIZE(entry);
 		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (deflated)
+		; /* done by a write-ahead thread */
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -504,7 +846,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 			dheader[--pos] = 128 | (--ofs & 127);
 		if (limit && hdrlen + sizeof(dheader) - pos + datalen + hashsz >= limit) {
 			if (st)
-				close_istream(st);
+				close_stream(st);
 			free(buf);
 			return 0;
 		}
@@ -518,7 +860,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		 */
 		if (limit && hdrlen + hashsz + datalen + hashsz >= limit) {
 			if (st)
-				close_istream(st);
+				close_stream(st);
 			free(buf);
 			return 0;
 		}
@@ -528,7 +870,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	} else {
 		if (limit && hdrlen + datalen + hashsz >= limit) {
 			if (st)
-				close_istream(st);
+				close_stream(st);
 			free(buf);
 			return 0;
 		}
@@ -536,7 +878,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	}
 	if (st) {
 		datalen = write_large_blob_data(st, f, &entry->idx.oid);
-		close_istream(st);
+		close_stream(st);
 	} else {
 		hashwrite(f, buf, datalen);
 		free(buf);
@@ -567,7 +909,9 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	hdrlen = encode_in_pack_object_header(header, sizeof(header),
 					      type, entry_size);
 
-	offset = entry->in_pack_offset;
+	obj_read_lock();
+
+	offset = IN_PACK_OFFSET(entry);
 	if (offset_to_pack_pos(p, offset, &pos) < 0)
 		die(_("write_reuse_object: could not locate %s, expected at "
 		      "offset %"PRIuMAX" in pack %s"),
@@ -580,6 +924,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
+		obj_read_unlock();
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
@@ -591,6 +936,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("corrupt packed object for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
+		obj_read_unlock();
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
@@ -602,6 +948,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 			dheader[--pos] = 128 | (--ofs & 127);
 		if (limit && hdrlen + sizeof(dheader) - pos + datalen + hashsz >= limit) {
 			unuse_pack(&w_curs);
+			obj_read_unlock();
 			return 0;
 		}
 		hashwrite(f, header, hdrlen);
@@ -611,6 +958,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	} else if (type == OBJ_REF_DELTA) {
 		if (limit && hdrlen + hashsz + datalen + hashsz >= limit) {
 			unuse_pack(&w_curs);
+			obj_read_unlock();
 			return 0;
 		}
 		hashwrite(f, header, hdrlen);
@@ -620,12 +968,14 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	} else {
 		if (limit && hdrlen + datalen + hashsz >= limit) {
 			unuse_pack(&w_curs);
+			obj_read_unlock();
 			return 0;
 		}
 		hashwrite(f, header, hdrlen);
 	}
 	copy_pack_data(f, p, &w_curs, offset, datalen);
 	unuse_pack(&w_curs);
+	obj_read_unlock();
 	reused++;
 	return hdrlen + datalen;
 }
@@ -665,24 +1015,7 @@ static off_t write_object(struct hashfile *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!IN_PACK(entry))
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (oe_type(entry) == OBJ_REF_DELTA ||
-		 oe_type(entry) == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (oe_type(entry) != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (DELTA(entry))
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
-
+	to_reuse = want_reuse(entry, usable_delta);
 	if (!to_reuse)
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
 	else
@@ -851,6 +1184,14 @@ static void compute_layer_order(struct object_entry **wo, unsigned int *wo_end)
 	unsigned int i, last_untagged;
 	struct object_entry *objects = to_pack.objects;
 
+	/*
+	 * Objects from the access profile come first, in the order they
+	 * were first accessed, so that what is read together is stored
+	 * together.
+	 */
+	for (i = 0; i < profiled_nr; i++)
+		add_to_write_order(wo, wo_end, &objects[profiled_objects[i]]);
+
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		if (objects[i].tagged)
 			break;
@@ -894,6 +1235,72 @@ static void compute_layer_order(struct object_entry **wo, unsigned int *wo_end)
 	}
 }
 
+/*
+ * A line of an access profile is either an object name, or a
+ * "<pack> <offset>" line as logged by GIT_TRACE_PACK_ACCESS (possibly
+ * preceded by the trace timestamp and location), which is resolved
+ * while that pack still exists.
+ */
+static int parse_access_profile_line(const char *line, struct object_id *oid)
+{
+	const char *end, *sp, *name;
+	char *ofs_end;
+	struct packed_git *p;
+	uintmax_t ofs;
+
+	if (!parse_oid_hex(line, oid, &end) && !*end)
+		return 0;
+
+	sp = strrchr(line, ' ');
+	if (!sp || !isdigit(sp[1]))
+		return -1;
+	ofs = strtoumax(sp + 1, &ofs_end, 10);
+	if (*ofs_end)
+		return -1;
+	for (name = sp; name > line && name[-1] != '/' && name[-1] != ' '; name--)
+		; /* nothing */
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *base = pack_basename(p);
+		uint32_t pos;
+
+		if (strncmp(base, name, sp - name) || base[sp - name])
+			continue;
+		if (open_pack_index(p) ||
+		    offset_to_pack_pos(p, ofs, &pos) < 0)
+			return -1;
+		return nth_packed_object_id(oid, p, pack_pos_to_index(p, pos));
+	}
+	return -1;
+}
+
+static void read_access_profile(void)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct oidset seen = OIDSET_INIT;
+	FILE *fp = xfopen(access_profile, "r");
+
+	while (strbuf_getline(&line, fp) != EOF) {
+		struct object_id oid;
+		struct object_entry *e;
+
+		if (parse_access_profile_line(line.buf, &oid) ||
+		    oidset_insert(&seen, &oid))
+			continue;
+		e = packlist_find(&to_pack, &oid);
+		if (!e)
+			continue;
+		ALLOC_GROW(profiled_objects, profiled_nr + 1, profiled_alloc);
+		profiled_objects[profiled_nr++] = e - to_pack.objects;
+	}
+
+	trace2_data_intmax("pack-objects", the_repository,
+			   "access_profile_objects", profiled_nr);
+	oidset_clear(&seen);
+	strbuf_release(&line);
+	fclose(fp);
+}
+
 static struct object_entry **compute_write_order(void)
 {
 	uint32_t max_layers = 1;
@@ -931,6 +1338,9 @@ static struct object_entry **compute_write_order(void)
 	if (use_delta_islands)
 		max_layers = compute_pack_layers(&to_pack);
 
+	if (access_profile)
+		read_access_profile();
+
 	ALLOC_ARRAY(wo, to_pack.nr_objects);
 	wo_end = 0;
 
@@ -941,6 +1351,9 @@ static struct object_entry **compute_write_order(void)
 		die(_("ordered %u objects, expected %"PRIu32),
 		    wo_end, to_pack.nr_objects);
 
+	FREE_AND_NULL(profiled_objects);
+	profiled_nr = profiled_alloc = 0;
+
 	return wo;
 }
 
@@ -962,9 +1375,16 @@ static struct reused_chunk {
 static int reused_chunks_nr;
 static int reused_chunks_alloc;
 
-static void record_reused_object(off_t where, off_t offset)
+/*
+ * The chunks of each of reuse_packfiles[] are recorded one pack after
+ * the other; reused_chunks_start[i] is the first chunk of pack "i".
+ */
+static int *reused_chunks_start;
+
+static void record_reused_object(size_t pack_nr, off_t where, off_t offset)
 {
-	if (reused_chunks_nr && reused_chunks[reused_chunks_nr-1].difference == offset)
+	if (reused_chunks_nr > reused_chunks_start[pack_nr] &&
+	    reused_chunks[reused_chunks_nr-1].difference == offset)
 		return;
 
 	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1,
@@ -975,14 +1395,20 @@ static void record_reused_object(off_t where, off_t offset)
 }
 
 /*
- * Binary search to find the chunk that "where" is in. Note
- * that we're not looking for an exact match, just the first
- * chunk that contains it (which implicitly ends at the start
- * of the next chunk.
+ * Binary search to find the chunk of pack "pack_nr" that "where" is
+ * in. Note that we're not looking for an exact match, just the first
+ * chunk that contains it (which implicitly ends at the start of the
+ * next chunk.
  */
-static off_t find_reused_offset(off_t where)
+static off_t find_reused_offset(size_t pack_nr, off_t where)
 {
-	int lo = 0, hi = reused_chunks_nr;
+	int first = reused_chunks_start[pack_nr];
+	int lo = first, hi = reused_chunks_nr;
+
+	if (pack_nr + 1 < reuse_packfiles_nr &&
+	    reused_chunks_start[pack_nr + 1] >= 0)
+		hi = reused_chunks_start[pack_nr + 1];
+
 	while (lo < hi) {
 		int mi = lo + ((hi - lo) / 2);
 		if (where == reused_chunks[mi].original)
@@ -994,138 +1420,211 @@ static off_t find_reused_offset(off_t where)
 	}
 
 	/*
-	 * The first chunk starts at zero, so we can't have gone below
-	 * there.
+	 * The object was written, so its pack has a chunk starting at
+	 * or before it.
 	 */
-	assert(lo);
+	assert(lo > first);
 	return reused_chunks[lo-1].difference;
 }
 
-static void write_reused_pack_one(size_t pos, struct hashfile *out,
+/* Find which of reuse_packfiles[] bitmap position "pos" belongs to. */
+static size_t find_reused_pack(uint32_t pos)
+{
+	size_t lo = 0, hi = reuse_packfiles_nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		struct bitmapped_pack *pack = &reuse_packfiles[mi];
+
+		if (pos < pack->bitmap_pos)
+			hi = mi;
+		else if (pos >= pack->bitmap_pos + pack->bitmap_nr)
+			lo = mi + 1;
+		else
+			return mi;
+	}
+	BUG("bitmap position %"PRIu32" is not in any reused pack", pos);
+}
+
+static void write_reused_pack_one(size_t pack_nr, uint32_t pos,
+				  struct hashfile *out,
 				  struct pack_window **w_curs)
 {
+	struct bitmapped_pack *pack = &reuse_packfiles[pack_nr];
+	struct packed_git *p = pack->p;
 	off_t offset, next, cur;
 	enum object_type type;
 	unsigned long size;
+	uint32_t pack_pos;
 
-	offset = pack_pos_to_offset(reuse_packfile, pos);
-	next = pack_pos_to_offset(reuse_packfile, pos + 1);
+	offset = bitmap_reused_offset(bitmap_git, pack, pos, &pack_pos);
+	if (!offset)
+		die(_("reused object %"PRIu32" is not in pack %s"),
+		    pos, p->pack_name);
+	next = pack_pos_to_offset(p, pack_pos + 1);
 
-	record_reused_object(offset, offset - hashfile_total(out));
+	record_reused_object(pack_nr, offset, offset - hashfile_total(out));
 
 	cur = offset;
-	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
+	type = unpack_object_header(p, w_curs, &cur, &size);
 	assert(type >= 0);
 
 	if (type == OBJ_OFS_DELTA) {
 		off_t base_offset;
-		off_t fixup;
+		uint32_t base_pack_pos;
 
 		unsigned char header[MAX_PACK_OBJECT_HEADER];
 		unsigned len;
 
-		base_offset = get_delta_base(reuse_packfile, w_curs, &cur, type, offset);
+		base_offset = get_delta_base(p, w_curs, &cur, type, offset);
 		assert(base_offset != 0);
 
+		if (offset_to_pack_pos(p, base_offset, &base_pack_pos) < 0)
+			die(_("expected object at offset %"PRIuMAX" "
+			      "in pack %s"),
+			    (uintmax_t)base_offset, p->pack_name);
+
 		/* Convert to REF_DELTA if we must... */
 		if (!allow_ofs_delta) {
-			uint32_t base_pos;
 			struct object_id base_oid;
 
-			if (offset_to_pack_pos(reuse_packfile, base_offset, &base_pos) < 0)
-				die(_("expected object at offset %"PRIuMAX" "
-				      "in pack %s"),
-				    (uintmax_t)base_offset,
-				    reuse_packfile->pack_name);
-
-			nth_packed_object_id(&base_oid, reuse_packfile,
-					     pack_pos_to_index(reuse_packfile, base_pos));
+			nth_packed_object_id(&base_oid, p,
+					     pack_pos_to_index(p, base_pack_pos));
 
 			len = encode_in_pack_object_header(header, sizeof(header),
 							   OBJ_REF_DELTA, size);
 			hashwrite(out, header, len);
 			hashwrite(out, base_oid.hash, the_hash_algo->rawsz);
-			copy_pack_data(out, reuse_packfile, w_curs, cur, next - cur);
+			copy_pack_data(out, p, w_curs, cur, next - cur);
 			return;
 		}
 
-		/* Otherwise see if we need to rewrite the offset... */
-		fixup = find_reused_offset(offset) -
-			find_reused_offset(base_offset);
-		if (fixup) {
-			unsigned char ofs_header[10];
-			unsigned i, ofs_len;
-			off_t ofs = offset - base_offset - fixup;
-
-			len = encode_in_pack_object_header(header, sizeof(header),
-							   OBJ_OFS_DELTA, size);
-
-			i = sizeof(ofs_header) - 1;
-			ofs_header[i] = ofs & 127;
-			while (ofs >>= 7)
-				ofs_header[--i] = 128 | (--ofs & 127);
-
-			ofs_len = sizeof(ofs_header) - i;
-
-			hashwrite(out, header, len);
-			hashwrite(out, ofs_header + sizeof(ofs_header) - ofs_len, ofs_len);
-			copy_pack_data(out, reuse_packfile, w_curs, cur, next - cur);
-			return;
+		/*
+		 * Otherwise see if we need to rewrite the offset, because
+		 * of the objects left out before us, or because the base
+		 * was written from another pack.
+		 */
+		{
+			uint32_t base_pos;
+			size_t base_pack_nr;
+			off_t base_original, ofs;
+
+			if (bitmap_reused_base_position(bitmap_git, pack,
+							base_pack_pos, &base_pos) < 0)
+				BUG("reused delta base is not in the bitmap");
+			base_pack_nr = find_reused_pack(base_pos);
+			base_original = bitmap_reused_offset(bitmap_git,
+						&reuse_packfiles[base_pack_nr],
+						base_pos, NULL);
+			ofs = hashfile_total(out) -
+			      (base_original -
+			       find_reused_offset(base_pack_nr, base_original));
+
+			if (ofs != offset - base_offset) {
+				unsigned char ofs_header[10];
+				unsigned i, ofs_len;
+
+				len = encode_in_pack_object_header(header, sizeof(header),
+								   OBJ_OFS_DELTA, size);
+
+				i = sizeof(ofs_header) - 1;
+				ofs_header[i] = ofs & 127;
+				while (ofs >>= 7)
+					ofs_header[--i] = 128 | (--ofs & 127);
+
+				ofs_len = sizeof(ofs_header) - i;
+
+				hashwrite(out, header, len);
+				hashwrite(out, ofs_header + sizeof(ofs_header) - ofs_len, ofs_len);
+				copy_pack_data(out, p, w_curs, cur, next - cur);
+				return;
+			}
 		}
 
 		/* ...otherwise we have no fixup, and can write it verbatim */
 	}
 
-	copy_pack_data(out, reuse_packfile, w_curs, offset, next - offset);
+	copy_pack_data(out, p, w_curs, offset, next - offset);
 }
 
 static size_t write_reused_pack_verbatim(struct hashfile *out,
 					 struct pack_window **w_curs)
 {
+	struct bitmapped_pack *pack = &reuse_packfiles[0];
 	size_t pos = 0;
 
+	/*
+	 * Only the first pack can be copied in whole words of objects,
+	 * and only when its positions are the positions in the pack.
+	 */
+	if (pack->bitmap_nr != pack->p->num_objects)
+		return 0;
+
 	while (pos < reuse_packfile_bitmap->word_alloc &&
-			reuse_packfile_bitmap->words[pos] == (eword_t)~0)
+	       pos < pack->bitmap_nr / BITS_IN_EWORD &&
+	       reuse_packfile_bitmap->words[pos] == (eword_t)~0)
 		pos++;
 
 	if (pos) {
 		off_t to_write;
 
 		written = (pos * BITS_IN_EWORD);
-		to_write = pack_pos_to_offset(reuse_packfile, written)
+		to_write = pack_pos_to_offset(pack->p, written)
 			- sizeof(struct pack_header);
 
 		/* We're recording one chunk, not one object. */
-		record_reused_object(sizeof(struct pack_header), 0);
+		record_reused_object(0, sizeof(struct pack_header), 0);
 		hashflush(out);
-		copy_pack_data(out, reuse_packfile, w_curs,
+		copy_pack_data(out, pack->p, w_curs,
 			sizeof(struct pack_header), to_write);
 
 		display_progress(progress_state, written);
 	}
-	return pos;
+	return pos * BITS_IN_EWORD;
 }
 
 static void write_reused_pack(struct hashfile *f)
 {
-	size_t i = 0;
-	uint32_t offset;
+	size_t pack_nr, pos = 0;
 	struct pack_window *w_curs = NULL;
 
+	ALLOC_ARRAY(reused_chunks_start, reuse_packfiles_nr);
+	for (pack_nr = 0; pack_nr < reuse_packfiles_nr; pack_nr++)
+		reused_chunks_start[pack_nr] = -1;
+	reused_chunks_start[0] = 0;
+
 	if (allow_ofs_delta)
-		i = write_reused_pack_verbatim(f, &w_curs);
+		pos = write_reused_pack_verbatim(f, &w_curs);
 
-	for (; i < reuse_packfile_bitmap->word_alloc; ++i) {
-		eword_t word = reuse_packfile_bitmap->words[i];
-		size_t pos = (i * BITS_IN_EWORD);
+	for (pack_nr = 0; pack_nr < reuse_packfiles_nr; pack_nr++) {
+		struct bitmapped_pack *pack = &reuse_packfiles[pack_nr];
+		size_t end = pack->bitmap_pos + pack->bitmap_nr;
 
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			if ((word >> offset) == 0)
-				break;
+		if (pack_nr) {
+			/* windows belong to a single pack */
+			unuse_pack(&w_curs);
+			reused_chunks_start[pack_nr] = reused_chunks_nr;
+		}
+		if (pos < pack->bitmap_pos)
+			pos = pack->bitmap_pos;
 
-			offset += ewah_bit_ctz64(word >> offset);
-			write_reused_pack_one(pos + offset, f, &w_curs);
+		while (pos < end) {
+			size_t i = pos / BITS_IN_EWORD;
+			eword_t word;
+
+			if (i >= reuse_packfile_bitmap->word_alloc)
+				break;
+			word = reuse_packfile_bitmap->words[i] >> (pos % BITS_IN_EWORD);
+			if (!word) {
+				pos = (i + 1) * BITS_IN_EWORD;
+				continue;
+			}
+			pos += ewah_bit_ctz64(word);
+			if (pos >= end)
+				break;
+			write_reused_pack_one(pack_nr, pos, f, &w_curs);
 			display_progress(progress_state, ++written);
+			pos++;
 		}
 	}
 
@@ -1136,6 +1635,7 @@ static void write_excluded_by_configs(void)
 {
 	struct oidset_iter iter;
 	const struct object_id *oid;
+	int i;
 
 	oidset_iter_init(&excluded_by_config, &iter);
 	while ((oid = oidset_iter_next(&iter))) {
@@ -1149,17 +1649,52 @@ static void write_excluded_by_configs(void)
 		write_in_full(1, ex->uri, strlen(ex->uri));
 		write_in_full(1, "\n", 1);
 	}
+
+	for (i = 0; i < nr_pack_exclusions; i++) {
+		struct configured_pack_exclusion *ex = &pack_exclusions[i];
+
+		if (!ex->used)
+			continue;
+		write_in_full(1, ex->pack_hash_hex, strlen(ex->pack_hash_hex));
+		write_in_full(1, " ", 1);
+		write_in_full(1, ex->uri, strlen(ex->uri));
+		write_in_full(1, "\n", 1);
+	}
 }
 
 static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
 
+/*
+ * The written_list is in index order by now, which is the order of
+ * the .mtimes file.
+ */
+static void write_cruft_mtimes(struct strbuf *name_buffer,
+			       struct pack_idx_entry **written_list,
+			       uint32_t nr_written,
+			       const unsigned char *hash)
+{
+	size_t basename_len = name_buffer->len;
+	uint32_t *mtimes;
+	uint32_t i;
+
+	ALLOC_ARRAY(mtimes, nr_written);
+	for (i = 0; i < nr_written; i++)
+		mtimes[i] = oe_cruft_mtime(&to_pack,
+					   (struct object_entry *)written_list[i]);
+
+	strbuf_addf(name_buffer, "%s.mtimes", hash_to_hex(hash));
+	write_mtimes_file(name_buffer->buf, mtimes, nr_written, hash);
+	strbuf_setlen(name_buffer, basename_len);
+	free(mtimes);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
 	struct hashfile *f;
-	off_t offset;
+	off_t offset, *disk_sizes = NULL;
 	uint32_t nr_remaining = nr_result;
 	time_t last_mtime = 0;
 	struct object_entry **write_order;
@@ -1177,22 +1712,26 @@ static void write_pack_file(void)
 			f = hashfd_throughput(1, "<stdout>", progress_state);
 		else
 			f = create_tmp_packfile(&pack_tmp_name);
+		hashfile_write_in_background(f);
 
 		offset = write_pack_header(f, nr_remaining);
 
-		if (reuse_packfile) {
+		if (reuse_packfiles_nr) {
 			assert(pack_to_stdout);
 			write_reused_pack(f);
 			offset = hashfile_total(f);
 		}
 
 		nr_written = 0;
-		for (; i < to_pack.nr_objects; i++) {
+		start_write_ahead(write_order + i, to_pack.nr_objects - i);
+		for (j = 0; i < to_pack.nr_objects; i++, j++) {
 			struct object_entry *e = write_order[i];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
+			advance_write_ahead(j + 1);
 			display_progress(progress_state, written);
 		}
+		stop_write_ahead();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -1245,10 +1784,30 @@ static void write_pack_file(void)
 					&to_pack, written_list, nr_written);
 			}
 
+			/*
+			 * The objects were written in the order of
+			 * their bit positions, and the list is still
+			 * in that order until finish_tmp_packfile().
+			 */
+			if (write_bitmap_index &&
+			    (write_bitmap_options & BITMAP_OPT_COMMIT_STATS)) {
+				ALLOC_ARRAY(disk_sizes, nr_written);
+				for (j = 0; j < nr_written; j++) {
+					off_t end = j + 1 < nr_written ?
+						written_list[j + 1]->offset : offset;
+					disk_sizes[j] = end - written_list[j]->offset;
+				}
+				bitmap_writer_set_disk_sizes(disk_sizes);
+			}
+
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
 					    written_list, nr_written,
 					    &pack_idx_opts, hash);
 
+			if (cruft)
+				write_cruft_mtimes(&tmpname, written_list,
+						   nr_written, hash);
+
 			if (write_bitmap_index) {
 				strbuf_addf(&tmpname, "%s.bitmap", hash_to_hex(hash));
 
@@ -1260,6 +1819,7 @@ static void write_pack_file(void)
 				bitmap_writer_finish(written_list, nr_written,
 						     tmpname.buf, write_bitmap_options);
 				write_bitmap_index = 0;
+				FREE_AND_NULL(disk_sizes);
 			}
 
 			strbuf_release(&tmpname);
@@ -1430,6 +1990,33 @@ static int want_object_in_pack_one(struct packed_git *p,
  * function finds if there is any pack that has the object and returns the pack
  * and its offset in these variables.
  */
+static int uri_protocol_allowed(const char *uri)
+{
+	const char *p;
+	int i;
+
+	for (i = 0; i < uri_protocols.nr; i++)
+		if (skip_prefix(uri, uri_protocols.items[i].string, &p) &&
+		    *p == ':')
+			return 1;
+	return 0;
+}
+
+static int excluded_by_pack_uri(const struct object_id *oid)
+{
+	int i;
+
+	for (i = 0; i < nr_pack_exclusions; i++) {
+		struct configured_pack_exclusion *ex = &pack_exclusions[i];
+
+		if (ex->p && find_pack_entry_one(oid->hash, ex->p)) {
+			ex->used = 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static int want_object_in_pack(const struct object_id *oid,
 			       int exclude,
 			       struct packed_git **found_pack,
@@ -1441,6 +2028,8 @@ static int want_object_in_pack(const struct object_id *oid,
 
 	if (!exclude && local && has_loose_object_nonlocal(oid))
 		return 0;
+	if (!exclude && use_pack_exclusions && excluded_by_pack_uri(oid))
+		return 0;
 
 	/*
 	 * If we already know the pack object lives in, start checks from that
@@ -1475,19 +2064,10 @@ static int want_object_in_pack(const struct object_id *oid,
 	if (uri_protocols.nr) {
 		struct configured_exclusion *ex =
 			oidmap_get(&configured_exclusions, oid);
-		int i;
-		const char *p;
 
-		if (ex) {
-			for (i = 0; i < uri_protocols.nr; i++) {
-				if (skip_prefix(ex->uri,
-						uri_protocols.items[i].string,
-						&p) &&
-				    *p == ':') {
-					oidset_insert(&excluded_by_config, oid);
-					return 0;
-				}
-			}
+		if (ex && uri_protocol_allowed(ex->uri)) {
+			oidset_insert(&excluded_by_config, oid);
+			return 0;
 		}
 	}
 
@@ -1513,7 +2093,7 @@ static void create_object_entry(const struct object_id *oid,
 		nr_result++;
 	if (found_pack) {
 		oe_set_in_pack(&to_pack, entry, found_pack);
-		entry->in_pack_offset = found_offset;
+		oe_set_in_pack_offset(&to_pack, entry, found_offset);
 	}
 
 	entry->no_try_delta = no_try_delta;
@@ -1918,7 +2498,7 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 		enum object_type type;
 		unsigned long in_pack_size;
 
-		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
+		buf = use_pack(p, &w_curs, IN_PACK_OFFSET(entry), &avail);
 
 		/*
 		 * We want in_pack_type even if we do not reuse delta
@@ -1953,7 +2533,7 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			if (reuse_delta && !entry->preferred_base) {
 				oidread(&base_ref,
 					use_pack(p, &w_curs,
-						 entry->in_pack_offset + used,
+						 IN_PACK_OFFSET(entry) + used,
 						 NULL));
 				have_base = 1;
 			}
@@ -1961,7 +2541,7 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			break;
 		case OBJ_OFS_DELTA:
 			buf = use_pack(p, &w_curs,
-				       entry->in_pack_offset + used, NULL);
+				       IN_PACK_OFFSET(entry) + used, NULL);
 			used_0 = 0;
 			c = buf[used_0++];
 			ofs = c & 127;
@@ -1975,8 +2555,8 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 				c = buf[used_0++];
 				ofs = (ofs << 7) + (c & 127);
 			}
-			ofs = entry->in_pack_offset - ofs;
-			if (ofs <= 0 || ofs >= entry->in_pack_offset) {
+			ofs = IN_PACK_OFFSET(entry) - ofs;
+			if (ofs <= 0 || ofs >= IN_PACK_OFFSET(entry)) {
 				error(_("delta base offset out of bound for %s"),
 				      oid_to_hex(&entry->idx.oid));
 				goto give_up;
@@ -2019,7 +2599,7 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
-			delta_pos = entry->in_pack_offset + entry->in_pack_header_size;
+			delta_pos = IN_PACK_OFFSET(entry) + entry->in_pack_header_size;
 			canonical_size = get_size_from_delta(p, &w_curs, delta_pos);
 			if (canonical_size == 0)
 				goto give_up;
@@ -2076,8 +2656,8 @@ static int pack_offset_sort(const void *_a, const void *_b)
 		return -1;
 	if (a_in_pack > b_in_pack)
 		return 1;
-	return a->in_pack_offset < b->in_pack_offset ? -1 :
-			(a->in_pack_offset > b->in_pack_offset);
+	return IN_PACK_OFFSET(a) < IN_PACK_OFFSET(b) ? -1 :
+			(IN_PACK_OFFSET(a) > IN_PACK_OFFSET(b));
 }
 
 /*
@@ -2113,7 +2693,7 @@ static void drop_reused_delta(struct object_entry *entry)
 
 	oi.sizep = &size;
 	oi.typep = &type;
-	if (packed_object_info(the_repository, IN_PACK(entry), entry->in_pack_offset, &oi) < 0) {
+	if (packed_object_info(the_repository, IN_PACK(entry), IN_PACK_OFFSET(entry), &oi) < 0) {
 		/*
 		 * We failed to get the info from this pack for some reason;
 		 * fall back to oid_object_info, which may find another copy.
@@ -2419,14 +2999,16 @@ unsigned long oe_get_size_slow(struct packing_data *pack,
 		BUG("when e->type is a delta, it must belong to a pack");
 
 	packing_data_lock(&to_pack);
+	obj_read_lock();
 	w_curs = NULL;
-	buf = use_pack(p, &w_curs, e->in_pack_offset, &avail);
+	buf = use_pack(p, &w_curs, IN_PACK_OFFSET(e), &avail);
 	used = unpack_object_header_buffer(buf, avail, &type, &size);
 	if (used == 0)
 		die(_("unable to parse object header of %s"),
 		    oid_to_hex(&e->idx.oid));
 
 	unuse_pack(&w_curs);
+	obj_read_unlock();
 	packing_data_unlock(&to_pack);
 	return size;
 }
@@ -2561,10 +3143,13 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	cache_lock();
 	if (trg_entry->delta_data) {
 		delta_cache_size -= DELTA_SIZE(trg_entry);
+		trace2_memory_add(TRACE2_MEMORY_ID_DELTA_CACHE,
+				  -(intmax_t)DELTA_SIZE(trg_entry));
 		trg_entry->delta_data = NULL;
 	}
 	if (delta_cacheable(src_size, trg_size, delta_size)) {
 		delta_cache_size += delta_size;
+		trace2_memory_add(TRACE2_MEMORY_ID_DELTA_CACHE, delta_size);
 		cache_unlock();
 		trg_entry->delta_data = xrealloc(delta_buf, delta_size);
 	} else {
@@ -2606,6 +3191,36 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
+/*
+ * Return the slot in the window holding the base an earlier run chose
+ * for "entry" (according to the delta-decisions file), or -1.
+ */
+static int find_decided_base(struct unpacked *array, int window,
+			     uint32_t idx, struct object_entry *entry)
+{
+	const unsigned char *hash;
+	struct object_id base_oid;
+	struct object_entry *base;
+	int j;
+
+	hash = delta_decision_base(delta_decisions, &entry->idx.oid);
+	if (!hash)
+		return -1;
+	oidread(&base_oid, hash);
+	base = packlist_find(&to_pack, &base_oid);
+	if (!base)
+		return -1;
+
+	for (j = 1; j < window; j++) {
+		uint32_t other_idx = idx + j;
+		if (other_idx >= window)
+			other_idx -= window;
+		if (array[other_idx].entry == base)
+			return other_idx;
+	}
+	return -1;
+}
+
 static void find_deltas(struct object_entry **list, unsigned *list_size,
 			int window, int depth, unsigned *processed)
 {
@@ -2662,6 +3277,23 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 				goto next;
 		}
 
+		/*
+		 * If the base we settled on last time is still in the
+		 * window, try it alone and skip the search when it still
+		 * yields a delta.
+		 */
+		if (delta_decisions) {
+			best_base = find_decided_base(array, window, idx, entry);
+			if (best_base >= 0 &&
+			    try_delta(n, array + best_base, max_depth, &mem_usage) > 0) {
+				cache_lock();
+				delta_decisions_hits++;
+				cache_unlock();
+				goto found;
+			}
+			best_base = -1;
+		}
+
 		j = window;
 		while (--j > 0) {
 			int ret;
@@ -2679,6 +3311,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 				best_base = other_idx;
 		}
 
+		found:
 		/*
 		 * If we decided to cache the delta data, then it is best
 		 * to compress it right away.  First because we have to do
@@ -2702,6 +3335,9 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 				cache_lock();
 				delta_cache_size -= DELTA_SIZE(entry);
 				delta_cache_size += entry->z_delta_size;
+				trace2_memory_add(TRACE2_MEMORY_ID_DELTA_CACHE,
+						  (intmax_t)entry->z_delta_size -
+						  (intmax_t)DELTA_SIZE(entry));
 				cache_unlock();
 			} else {
 				FREE_AND_NULL(entry->delta_data);
@@ -3080,10 +3716,79 @@ static void prepare_pack(int window, int depth)
 		stop_progress(&progress_state);
 		if (nr_done != nr_deltas)
 			die(_("inconsistency with delta count"));
+		if (use_delta_decisions)
+			trace2_data_intmax("pack-objects", the_repository,
+					   "delta_decisions_hits",
+					   delta_decisions_hits);
 	}
 	free(delta_list);
 }
 
+static void prepare_delta_decisions_key(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	git_hash_ctx ctx;
+
+	strbuf_addstr(&buf, "islands\n");
+	if (use_delta_islands)
+		describe_delta_islands(&buf);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, buf.buf, buf.len);
+	the_hash_algo->final_oid_fn(&delta_decisions_key, &ctx);
+	strbuf_release(&buf);
+}
+
+static void load_delta_decisions_file(void)
+{
+	char *path = delta_decisions_filename(get_object_directory());
+
+	prepare_delta_decisions_key();
+	delta_decisions = load_delta_decisions(path, &delta_decisions_key);
+	free(path);
+}
+
+/*
+ * Record the bases chosen by this run, keeping the earlier decisions
+ * about objects that we did not pack this time.
+ */
+static void write_delta_decisions_file(void)
+{
+	char *path = delta_decisions_filename(get_object_directory());
+	struct delta_decision *list = NULL;
+	size_t nr = 0, alloc = 0;
+	uint32_t i;
+
+	for (i = 0; i < to_pack.nr_objects; i++) {
+		struct object_entry *e = &to_pack.objects[i];
+
+		if (e->preferred_base || !DELTA(e))
+			continue;
+		ALLOC_GROW(list, nr + 1, alloc);
+		oidcpy(&list[nr].oid, &e->idx.oid);
+		oidcpy(&list[nr].base, &DELTA(e)->idx.oid);
+		nr++;
+	}
+
+	if (delta_decisions) {
+		size_t old_nr = delta_decisions_nr(delta_decisions);
+		size_t j;
+
+		for (j = 0; j < old_nr; j++) {
+			ALLOC_GROW(list, nr + 1, alloc);
+			nth_delta_decision(delta_decisions, j, &list[nr]);
+			if (!packlist_find(&to_pack, &list[nr].oid))
+				nr++;
+		}
+	}
+
+	if (write_delta_decisions(path, &delta_decisions_key, list, nr))
+		warning(_("failed to write delta decisions to %s"), path);
+
+	free(list);
+	free(path);
+}
+
 static int git_pack_config(const char *k, const char *v, void *cb)
 {
 	if (!strcmp(k, "pack.window")) {
@@ -3112,6 +3817,22 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	}
+	if (!strcmp(k, "pack.writebitmapcommitstats")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_COMMIT_STATS;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_COMMIT_STATS;
+	}
+	if (!strcmp(k, "pack.deltadecisions")) {
+		use_delta_decisions = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -3120,6 +3841,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		allow_pack_reuse = git_config_bool(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.spillcoldfields")) {
+		spill_cold = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		delta_search_threads = git_config_int(k, v);
 		if (delta_search_threads < 0)
@@ -3168,6 +3893,24 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		ex->uri = xstrdup(pack_end + 1);
 		oidmap_put(&configured_exclusions, ex);
 	}
+	if (!strcmp(k, "uploadpack.packpackfileuri")) {
+		struct configured_pack_exclusion *ex;
+		struct object_id pack_hash;
+		const char *pack_end;
+
+		if (!v)
+			return config_error_nonbool(k);
+		if (parse_oid_hex(v, &pack_hash, &pack_end) ||
+		    *pack_end != ' ')
+			die(_("value of uploadpack.packpackfileuri must be "
+			      "of the form '<pack-hash> <uri>' (got '%s')"), v);
+		ALLOC_GROW(pack_exclusions, nr_pack_exclusions + 1,
+			   alloc_pack_exclusions);
+		ex = &pack_exclusions[nr_pack_exclusions++];
+		memset(ex, 0, sizeof(*ex));
+		ex->pack_hash_hex = xmemdupz(v, pack_end - v);
+		ex->uri = xstrdup(pack_end + 1);
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -3257,32 +4000,19 @@ static int pack_mtime_cmp(const void *_a, const void *_b)
 		return 0;
 }
 
-static void read_packs_list_from_stdin(void)
+/*
+ * Read the names of the packs whose objects are wanted from stdin, along
+ * with those of the packs whose objects are not, prefixed with '^'.
+ * The latter are marked as kept in-core, and the former are returned in
+ * "include_packs", ordered by descending mtime.
+ */
+static void read_stdin_packs(struct string_list *include_packs)
 {
 	struct strbuf buf = STRBUF_INIT;
-	struct string_list include_packs = STRING_LIST_INIT_DUP;
 	struct string_list exclude_packs = STRING_LIST_INIT_DUP;
 	struct string_list_item *item = NULL;
 
 	struct packed_git *p;
-	struct rev_info revs;
-
-	repo_init_revisions(the_repository, &revs, NULL);
-	/*
-	 * Use a revision walk to fill in the namehash of objects in the include
-	 * packs. To save time, we'll avoid traversing through objects that are
-	 * in excluded packs.
-	 *
-	 * That may cause us to avoid populating all of the namehash fields of
-	 * all included objects, but our goal is best-effort, since this is only
-	 * an optimization during delta selection.
-	 */
-	revs.no_kept_objects = 1;
-	revs.keep_pack_cache_flags |= IN_CORE_KEEP_PACKS;
-	revs.blob_objects = 1;
-	revs.tree_objects = 1;
-	revs.tag_objects = 1;
-	revs.ignore_missing_links = 1;
 
 	while (strbuf_getline(&buf, stdin) != EOF) {
 		if (!buf.len)
@@ -3291,18 +4021,18 @@ static void read_packs_list_from_stdin(void)
 		if (*buf.buf == '^')
 			string_list_append(&exclude_packs, buf.buf + 1);
 		else
-			string_list_append(&include_packs, buf.buf);
+			string_list_append(include_packs, buf.buf);
 
 		strbuf_reset(&buf);
 	}
 
-	string_list_sort(&include_packs);
+	string_list_sort(include_packs);
 	string_list_sort(&exclude_packs);
 
 	for (p = get_all_packs(the_repository); p; p = p->next) {
 		const char *pack_name = pack_basename(p);
 
-		item = string_list_lookup(&include_packs, pack_name);
+		item = string_list_lookup(include_packs, pack_name);
 		if (!item)
 			item = string_list_lookup(&exclude_packs, pack_name);
 
@@ -3321,7 +4051,7 @@ static void read_packs_list_from_stdin(void)
 	 * bad case here, we don't need to report the first/last one,
 	 * or all of them.
 	 */
-	for_each_string_list_item(item, &include_packs) {
+	for_each_string_list_item(item, include_packs) {
 		struct packed_git *p = item->util;
 		if (!p)
 			die(_("could not find pack '%s'"), item->string);
@@ -3344,12 +4074,39 @@ static void read_packs_list_from_stdin(void)
 	 * string_list_item's ->util pointer, which string_list_sort() does not
 	 * provide.
 	 */
-	QSORT(include_packs.items, include_packs.nr, pack_mtime_cmp);
+	QSORT(include_packs->items, include_packs->nr, pack_mtime_cmp);
+
+	strbuf_release(&buf);
+	string_list_clear(&exclude_packs, 0);
+}
+
+static void read_packs_list_from_stdin(void)
+{
+	struct string_list include_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item = NULL;
+	struct rev_info revs;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	/*
+	 * Use a revision walk to fill in the namehash of objects in the include
+	 * packs. To save time, we'll avoid traversing through objects that are
+	 * in excluded packs.
+	 *
+	 * That may cause us to avoid populating all of the namehash fields of
+	 * all included objects, but our goal is best-effort, since this is only
+	 * an optimization during delta selection.
+	 */
+	revs.no_kept_objects = 1;
+	revs.keep_pack_cache_flags |= IN_CORE_KEEP_PACKS;
+	revs.blob_objects = 1;
+	revs.tree_objects = 1;
+	revs.tag_objects = 1;
+	revs.ignore_missing_links = 1;
+
+	read_stdin_packs(&include_packs);
 
 	for_each_string_list_item(item, &include_packs) {
 		struct packed_git *p = item->util;
-		if (!p)
-			die(_("could not find pack '%s'"), item->string);
 		for_each_object_in_pack(p,
 					add_object_entry_from_pack,
 					&revs,
@@ -3368,9 +4125,161 @@ static void read_packs_list_from_stdin(void)
 	trace2_data_intmax("pack-objects", the_repository, "stdin_packs_hints",
 			   stdin_packs_hints_nr);
 
-	strbuf_release(&buf);
 	string_list_clear(&include_packs, 0);
-	string_list_clear(&exclude_packs, 0);
+}
+
+/*
+ * In --cruft mode, we pack the objects of the packs listed on stdin
+ * (but not those of the excluded ones) and the loose objects, along
+ * with the time each was last modified.  Objects older than the
+ * --cruft-expiration date are left out, unless a more recent one
+ * refers to them.
+ */
+static int cruft_object_seen(const struct object_id *oid, uint32_t mtime)
+{
+	struct object_entry *entry = packlist_find(&to_pack, oid);
+
+	if (!entry)
+		return 0;
+	/* keep the most recent mtime of all of its copies */
+	if (oe_cruft_mtime(&to_pack, entry) < mtime)
+		oe_set_cruft_mtime(&to_pack, entry, mtime);
+	return 1;
+}
+
+static void add_cruft_object_entry(const struct object_id *oid,
+				   enum object_type type,
+				   struct packed_git *pack, off_t offset,
+				   const char *name, uint32_t mtime)
+{
+	if (!want_object_in_pack(oid, 0, &pack, &offset))
+		return;
+	create_object_entry(oid, type, pack_name_hash(name), 0,
+			    name && no_try_delta(name), pack, offset);
+	oe_set_cruft_mtime(&to_pack, &to_pack.objects[to_pack.nr_objects - 1],
+			   mtime);
+}
+
+static int cruft_object_expired(timestamp_t mtime)
+{
+	return cruft_expiration && mtime <= cruft_expiration;
+}
+
+static int add_cruft_object_from_pack(const struct object_id *oid,
+				      struct packed_git *p,
+				      uint32_t pos,
+				      void *data)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	uint32_t mtime = p->mtime;
+	off_t ofs;
+
+	display_progress(progress_state, ++nr_seen);
+
+	if (p->is_cruft)
+		mtime = nth_packed_mtime(p, pos);
+	if (cruft_object_expired(mtime) || cruft_object_seen(oid, mtime))
+		return 0;
+
+	ofs = nth_packed_object_offset(p, pos);
+	oi.typep = &type;
+	if (packed_object_info(the_repository, p, ofs, &oi) < 0)
+		die(_("could not get type of object %s in pack %s"),
+		    oid_to_hex(oid), p->pack_name);
+	add_cruft_object_entry(oid, type, p, ofs, NULL, mtime);
+	return 0;
+}
+
+static int add_cruft_loose_object(const struct object_id *oid,
+				  const char *path, void *data)
+{
+	enum object_type type;
+	struct stat st;
+
+	display_progress(progress_state, ++nr_seen);
+
+	if (stat(path, &st) < 0) {
+		/* it may have been packed and pruned in the meantime */
+		if (errno == ENOENT)
+			return 0;
+		return error_errno(_("unable to stat %s"), path);
+	}
+	if (cruft_object_expired(st.st_mtime) ||
+	    cruft_object_seen(oid, st.st_mtime))
+		return 0;
+
+	type = oid_object_info(the_repository, oid, NULL);
+	if (type < 0) {
+		warning(_("loose object at %s could not be examined"), path);
+		return 0;
+	}
+	add_cruft_object_entry(oid, type, NULL, 0, NULL, st.st_mtime);
+	return 0;
+}
+
+static void show_cruft_object(struct object *obj, const char *name, void *data)
+{
+	/*
+	 * This object is old enough to go, but a recent one refers to
+	 * it.  Keep it with the oldest possible mtime, so that it goes
+	 * as soon as nothing recent needs it anymore.
+	 */
+	if (packlist_find(&to_pack, &obj->oid) ||
+	    !has_object_file(&obj->oid))
+		return;
+	add_cruft_object_entry(&obj->oid, obj->type, NULL, 0, name, 0);
+}
+
+static void show_cruft_commit(struct commit *commit, void *data)
+{
+	show_cruft_object((struct object *)commit, NULL, data);
+}
+
+static void add_objects_reachable_from_recent_cruft(void)
+{
+	struct rev_info revs;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	revs.ignore_missing_links = 1;
+	/* what is in the excluded packs is kept anyway */
+	revs.no_kept_objects = 1;
+	revs.keep_pack_cache_flags |= IN_CORE_KEEP_PACKS;
+
+	if (add_unseen_recent_objects_to_traversal(&revs, cruft_expiration, 1))
+		die(_("unable to add recent objects"));
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, show_cruft_commit, show_cruft_object, NULL);
+}
+
+static void read_cruft_objects(void)
+{
+	struct string_list include_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+
+	read_stdin_packs(&include_packs);
+
+	for_each_string_list_item(item, &include_packs) {
+		struct packed_git *p = item->util;
+
+		if (p->is_cruft && load_pack_mtimes(p) < 0)
+			die(_("could not load cruft pack .mtimes"));
+		for_each_object_in_pack(p, add_cruft_object_from_pack, NULL,
+					FOR_EACH_OBJECT_PACK_ORDER);
+	}
+
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      add_cruft_loose_object,
+				      NULL, NULL, NULL);
+
+	if (cruft_expiration)
+		add_objects_reachable_from_recent_cruft();
+
+	string_list_clear(&include_packs, 0);
 }
 
 static void read_object_list_from_stdin(void)
@@ -3507,7 +4416,8 @@ static void show_edge(struct commit *commit)
 
 struct in_pack_object {
 	off_t offset;
-	struct object *object;
+	struct object_id oid;
+	enum object_type type;
 };
 
 struct in_pack {
@@ -3516,10 +4426,14 @@ struct in_pack {
 	struct in_pack_object *array;
 };
 
-static void mark_in_pack_object(struct object *object, struct packed_git *p, struct in_pack *in_pack)
+static void mark_in_pack_object(const struct object_id *oid,
+				enum object_type type,
+				struct packed_git *p, uint32_t pos,
+				struct in_pack *in_pack)
 {
-	in_pack->array[in_pack->nr].offset = find_pack_entry_one(object->oid.hash, p);
-	in_pack->array[in_pack->nr].object = object;
+	in_pack->array[in_pack->nr].offset = nth_packed_object_offset(p, pos);
+	oidcpy(&in_pack->array[in_pack->nr].oid, oid);
+	in_pack->array[in_pack->nr].type = type;
 	in_pack->nr++;
 }
 
@@ -3537,17 +4451,24 @@ static int ofscmp(const void *a_, const void *b_)
 	else if (a->offset > b->offset)
 		return 1;
 	else
-		return oidcmp(&a->object->oid, &b->object->oid);
+		return oidcmp(&a->oid, &b->oid);
 }
 
 static void add_objects_in_unpacked_packs(void)
 {
 	struct packed_git *p;
 	struct in_pack in_pack;
+	struct pack_oidset seen;
 	uint32_t i;
 
 	memset(&in_pack, 0, sizeof(in_pack));
 
+	/*
+	 * Objects the traversal added are flagged; the others only
+	 * need to be told apart from their copies in other packs,
+	 * which the set does without allocating an object for each.
+	 */
+	pack_oidset_init(&seen, the_repository);
 	for (p = get_all_packs(the_repository); p; p = p->next) {
 		struct object_id oid;
 		struct object *o;
@@ -3563,17 +4484,20 @@ static void add_objects_in_unpacked_packs(void)
 
 		for (i = 0; i < p->num_objects; i++) {
 			nth_packed_object_id(&oid, p, i);
-			o = lookup_unknown_object(the_repository, &oid);
-			if (!(o->flags & OBJECT_ADDED))
-				mark_in_pack_object(o, p, &in_pack);
-			o->flags |= OBJECT_ADDED;
+			o = lookup_object(the_repository, &oid);
+			if ((o && (o->flags & OBJECT_ADDED)) ||
+			    pack_oidset_insert_packed(&seen, &oid, p, i))
+				continue;
+			mark_in_pack_object(&oid, o ? o->type : OBJ_NONE,
+					    p, i, &in_pack);
 		}
 	}
+	pack_oidset_clear(&seen);
 
 	if (in_pack.nr) {
 		QSORT(in_pack.array, in_pack.nr, ofscmp);
 		for (i = 0; i < in_pack.nr; i++) {
-			struct object *o = in_pack.array[i].object;
+			struct in_pack_object *o = &in_pack.array[i];
 			add_object_entry(&o->oid, o->type, "", 0);
 		}
 	}
@@ -3665,13 +4589,19 @@ static void loosen_unused_packed_objects(void)
 
 		if (open_pack_index(p))
 			die(_("cannot open pack index"));
+		if (p->is_cruft && load_pack_mtimes(p) < 0)
+			die(_("could not load cruft pack .mtimes"));
 
 		for (i = 0; i < p->num_objects; i++) {
+			time_t mtime = p->mtime;
+
+			if (p->is_cruft)
+				mtime = nth_packed_mtime(p, i);
 			nth_packed_object_id(&oid, p, i);
 			if (!packlist_find(&to_pack, &oid) &&
 			    !has_sha1_pack_kept_or_nonlocal(&oid) &&
-			    !loosened_object_can_be_discarded(&oid, p->mtime)) {
-				if (force_object_loose(&oid, p->mtime))
+			    !loosened_object_can_be_discarded(&oid, mtime)) {
+				if (force_object_loose(&oid, mtime))
 					die(_("unable to force loose object"));
 				loosened_objects_nr++;
 			}
@@ -3690,6 +4620,7 @@ static void loosen_unused_packed_objects(void)
 static int pack_options_allow_reuse(void)
 {
 	return allow_pack_reuse &&
+	       !use_pack_exclusions &&
 	       pack_to_stdout &&
 	       !ignore_packed_keep_on_disk &&
 	       !ignore_packed_keep_in_core &&
@@ -3697,6 +4628,36 @@ static int pack_options_allow_reuse(void)
 	       !incremental;
 }
 
+/*
+ * Find the packs configured with uploadpack.packPackfileUri.  They are
+ * only worth sending to a client that wants everything they contain,
+ * i.e. one that has nothing yet, and asks neither for a shallow nor a
+ * filtered history.
+ */
+static void prepare_pack_exclusions(void)
+{
+	int i;
+
+	for (i = 0; i < nr_pack_exclusions; i++) {
+		struct configured_pack_exclusion *ex = &pack_exclusions[i];
+		struct packed_git *p;
+
+		if (!uri_protocol_allowed(ex->uri))
+			continue;
+		for (p = get_all_packs(the_repository); p; p = p->next)
+			if (p->pack_local &&
+			    !strcmp(hash_to_hex(p->hash), ex->pack_hash_hex))
+				break;
+		if (!p || open_pack_index(p) || !is_pack_valid(p)) {
+			warning(_("ignoring uploadpack.packpackfileuri for "
+				  "missing pack %s"), ex->pack_hash_hex);
+			continue;
+		}
+		ex->p = p;
+		use_pack_exclusions = 1;
+	}
+}
+
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
 	if (!(bitmap_git = prepare_bitmap_walk(revs, &filter_options, 0)))
@@ -3705,7 +4666,8 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	if (pack_options_allow_reuse() &&
 	    !reuse_partial_packfile_from_bitmap(
 			bitmap_git,
-			&reuse_packfile,
+			&reuse_packfiles,
+			&reuse_packfiles_nr,
 			&reuse_packfile_objects,
 			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
@@ -3771,6 +4733,7 @@ static void get_object_list(int ac, const char **av)
 	char line[1000];
 	int flags = 0;
 	int save_warning;
+	int want_everything = 1;
 
 	repo_init_revisions(the_repository, &revs, NULL);
 	save_commit_buffer = 0;
@@ -3800,16 +4763,23 @@ static void get_object_list(int ac, const char **av)
 					die("not an object name '%s'", line + 10);
 				register_shallow(the_repository, &oid);
 				use_bitmap_index = 0;
+				want_everything = 0;
 				continue;
 			}
 			die(_("not a rev '%s'"), line);
 		}
 		if (handle_revision_arg(line, &revs, flags, REVARG_CANNOT_BE_FILENAME))
 			die(_("bad revision '%s'"), line);
+		if (flags & UNINTERESTING)
+			want_everything = 0;
 	}
 
 	warn_on_object_refname_ambiguity = save_warning;
 
+	if (uri_protocols.nr && nr_pack_exclusions && want_everything &&
+	    !filter_options.choice && !is_repository_shallow(the_repository))
+		prepare_pack_exclusions();
+
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
@@ -3832,7 +4802,7 @@ static void get_object_list(int ac, const char **av)
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
 		if (add_unseen_recent_objects_to_traversal(&revs,
-				unpack_unreachable_expiration))
+				unpack_unreachable_expiration, 0))
 			die(_("unable to add recent objects"));
 		if (prepare_revision_walk(&revs))
 			die(_("revision walk setup failed"));
@@ -3909,6 +4879,16 @@ static int option_parse_unpack_unreachable(const struct option *opt,
 	return 0;
 }
 
+static int option_parse_cruft_expiration(const struct option *opt,
+					 const char *arg, int unset)
+{
+	if (unset)
+		cruft_expiration = 0;
+	else
+		cruft_expiration = approxidate(arg);
+	return 0;
+}
+
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
@@ -3981,6 +4961,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		OPT_CALLBACK_F(0, "unpack-unreachable", NULL, N_("time"),
 		  N_("unpack unreachable objects newer than <time>"),
 		  PARSE_OPT_OPTARG, option_parse_unpack_unreachable),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("create a cruft pack")),
+		OPT_CALLBACK_F(0, "cruft-expiration", NULL, N_("time"),
+		  N_("expire cruft objects older than <time>"),
+		  0, option_parse_cruft_expiration),
 		OPT_BOOL(0, "sparse", &sparse,
 			 N_("use the sparse reachability algorithm")),
 		OPT_BOOL(0, "thin", &thin,
@@ -4012,6 +4997,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not pack objects in promisor packfiles")),
 		OPT_BOOL(0, "delta-islands", &use_delta_islands,
 			 N_("respect islands during delta compression")),
+		OPT_BOOL(0, "delta-decisions", &use_delta_decisions,
+			 N_("reuse and record delta base choices across runs")),
+		OPT_FILENAME(0, "access-profile", &access_profile,
+			     N_("write objects in the order they were accessed in <file>")),
 		OPT_STRING_LIST(0, "uri-protocol", &uri_protocols,
 				N_("protocol"),
 				N_("exclude any configured uploadpack.blobpackfileuri with this protocol")),
@@ -4132,6 +5121,17 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (stdin_packs && use_internal_rev_list)
 		die(_("cannot use internal rev list with --stdin-packs"));
 
+	if (cruft) {
+		if (use_internal_rev_list)
+			die(_("cannot use internal rev list with --cruft"));
+		if (stdin_packs)
+			die(_("cannot use --stdin-packs with --cruft"));
+		if (pack_to_stdout)
+			die(_("cannot use --stdout with --cruft"));
+	} else if (cruft_expiration) {
+		die(_("--cruft-expiration requires --cruft"));
+	}
+
 	/*
 	 * "soft" reasons not to use bitmaps - for on-disk repack by default we want
 	 *
@@ -4157,6 +5157,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (use_delta_islands)
 		strvec_push(&rp, "--topo-order");
 
+	if (pack_to_stdout)
+		use_delta_decisions = 0;
+
 	if (progress && all_progress_implied)
 		progress = 2;
 
@@ -4187,10 +5190,16 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	trace2_region_enter("pack-objects", "enumerate-objects",
 			    the_repository);
 	prepare_packing_data(the_repository, &to_pack);
+	if (spill_cold && spill_cold_fields(&to_pack) < 0)
+		warning(_("unable to keep object details in a temporary file"));
 
 	if (progress)
 		progress_state = start_progress(_("Enumerating objects"), 0);
-	if (stdin_packs) {
+	if (cruft) {
+		/* avoids adding objects in excluded packs */
+		ignore_packed_keep_in_core = 1;
+		read_cruft_objects();
+	} else if (stdin_packs) {
 		/* avoids adding objects in excluded packs */
 		ignore_packed_keep_in_core = 1;
 		read_packs_list_from_stdin();
@@ -4214,6 +5223,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (nr_result) {
 		trace2_region_enter("pack-objects", "prepare-pack",
 				    the_repository);
+		if (use_delta_decisions)
+			load_delta_decisions_file();
 		prepare_pack(window, depth);
 		trace2_region_leave("pack-objects", "prepare-pack",
 				    the_repository);
@@ -4224,6 +5235,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	write_pack_file();
 	trace2_region_leave("pack-objects", "write-pack-file", the_repository);
 
+	if (use_delta_decisions && nr_result)
+		write_delta_decisions_file();
+	free_delta_decisions(delta_decisions);
+
 	if (progress)
 		fprintf_ln(stderr,
 			   _("Total %"PRIu32" (delta %"PRIu32"),"
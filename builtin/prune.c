@@ -9,17 +9,31 @@
 #include "prune-packed.h"
 #include "object-store.h"
 #include "shallow.h"
+#include "string-list.h"
+#include "thread-utils.h"
 
 static const char * const prune_usage[] = {
-	N_("git prune [-n] [-v] [--progress] [--expire <time>] [--] [<head>...]"),
+	N_("git prune [-n] [-v] [--progress] [--expire <time>] [--threads=<n>] [--] [<head>...]"),
 	NULL
 };
 static int show_only;
 static int verbose;
 static timestamp_t expire;
 static int show_progress = -1;
+static int nr_threads;
 
-static int prune_tmp_file(const char *fullpath)
+/*
+ * What pruning one fan-out directory found: the report to print and
+ * the files to remove, which are only removed once the directory has
+ * been read through.
+ */
+struct prune_batch {
+	struct rev_info *revs;
+	struct strbuf out;
+	struct string_list unlink;
+};
+
+static int prune_tmp_file(const char *fullpath, struct prune_batch *batch)
 {
 	struct stat st;
 	if (lstat(fullpath, &st))
@@ -27,12 +41,22 @@ static int prune_tmp_file(const char *fullpath)
 	if (st.st_mtime > expire)
 		return 0;
 	if (show_only || verbose)
-		printf("Removing stale temporary file %s\n", fullpath);
+		strbuf_addf(&batch->out, "Removing stale temporary file %s\n",
+			    fullpath);
 	if (!show_only)
-		unlink_or_warn(fullpath);
+		string_list_append(&batch->unlink, fullpath);
 	return 0;
 }
 
+static void flush_prune_batch(struct prune_batch *batch)
+{
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, &batch->unlink)
+		unlink_or_warn(item->string);
+	string_list_clear(&batch->unlink, 0);
+}
+
 static void perform_reachability_traversal(struct rev_info *revs)
 {
 	static int initialized;
@@ -62,10 +86,10 @@ static int is_object_reachable(const struct object_id *oid,
 static int prune_object(const struct object_id *oid, const char *fullpath,
 			void *data)
 {
-	struct rev_info *revs = data;
+	struct prune_batch *batch = data;
 	struct stat st;
 
-	if (is_object_reachable(oid, revs))
+	if (is_object_reachable(oid, batch->revs))
 		return 0;
 
 	if (lstat(fullpath, &st)) {
@@ -78,28 +102,135 @@ static int prune_object(const struct object_id *oid, const char *fullpath,
 	if (show_only || verbose) {
 		enum object_type type = oid_object_info(the_repository, oid,
 							NULL);
-		printf("%s %s\n", oid_to_hex(oid),
-		       (type > 0) ? type_name(type) : "unknown");
+		strbuf_addf(&batch->out, "%s %s\n", oid_to_hex(oid),
+			    (type > 0) ? type_name(type) : "unknown");
 	}
 	if (!show_only)
-		unlink_or_warn(fullpath);
+		string_list_append(&batch->unlink, fullpath);
 	return 0;
 }
 
 static int prune_cruft(const char *basename, const char *path, void *data)
 {
 	if (starts_with(basename, "tmp_obj_"))
-		prune_tmp_file(path);
+		prune_tmp_file(path, data);
 	else
 		fprintf(stderr, "bad sha1 file: %s\n", path);
 	return 0;
 }
 
-static int prune_subdir(unsigned int nr, const char *path, void *data)
+static int bail_on_loose(const struct object_id *oid, const char *path,
+			 void *data)
 {
-	if (!show_only)
-		rmdir(path);
-	return 0;
+	return 1;
+}
+
+/*
+ * The 256 fan-out directories are handed out to the threads one at a
+ * time.  What they report is printed in the order of the directories,
+ * as soon as all those before are done, so that the output is the
+ * same whatever the number of threads.
+ */
+struct prune_threads {
+	pthread_mutex_t mutex;
+	struct rev_info *revs;
+	const char *objdir;
+	struct progress *progress;
+	unsigned int next_subdir;
+	unsigned int next_output;
+	unsigned int nr_done;
+	struct strbuf output[256];
+	unsigned char done[256];
+};
+
+static void *prune_subdirs(void *data)
+{
+	struct prune_threads *pt = data;
+	struct prune_batch batch = {
+		.revs = pt->revs,
+		.out = STRBUF_INIT,
+		.unlink = STRING_LIST_INIT_DUP,
+	};
+	struct strbuf path = STRBUF_INIT;
+
+	for (;;) {
+		unsigned int nr;
+
+		pthread_mutex_lock(&pt->mutex);
+		nr = pt->next_subdir++;
+		pthread_mutex_unlock(&pt->mutex);
+		if (nr > 0xff)
+			break;
+
+		strbuf_reset(&path);
+		strbuf_addstr(&path, pt->objdir);
+		for_each_file_in_obj_subdir(nr, &path, prune_object,
+					    prune_cruft, NULL, &batch);
+		flush_prune_batch(&batch);
+		if (!show_only)
+			rmdir(path.buf);
+
+		pthread_mutex_lock(&pt->mutex);
+		strbuf_swap(&pt->output[nr], &batch.out);
+		pt->done[nr] = 1;
+		while (pt->next_output <= 0xff && pt->done[pt->next_output]) {
+			struct strbuf *out = &pt->output[pt->next_output++];
+
+			fwrite(out->buf, 1, out->len, stdout);
+			strbuf_release(out);
+		}
+		display_progress(pt->progress, ++pt->nr_done);
+		pthread_mutex_unlock(&pt->mutex);
+	}
+
+	strbuf_release(&batch.out);
+	strbuf_release(&path);
+	return NULL;
+}
+
+static void prune_loose_objects(struct rev_info *revs)
+{
+	struct prune_threads pt = { .revs = revs };
+	int threaded = HAVE_THREADS && nr_threads > 1;
+	int i;
+
+	/*
+	 * The threads need the traversal done before they start, but
+	 * there is no need for it (nor for them) if nothing is loose.
+	 */
+	if (!for_each_loose_file_in_objdir(get_object_directory(),
+					   bail_on_loose, NULL, NULL, NULL))
+		threaded = 0;
+	else if (threaded)
+		perform_reachability_traversal(revs);
+
+	pt.objdir = get_object_directory();
+	pthread_mutex_init(&pt.mutex, NULL);
+	for (i = 0; i < ARRAY_SIZE(pt.output); i++)
+		strbuf_init(&pt.output[i], 0);
+	if (show_progress)
+		pt.progress = start_delayed_progress(_("Pruning loose objects"),
+						     256);
+
+	if (!threaded) {
+		prune_subdirs(&pt);
+	} else {
+		pthread_t *threads;
+
+		enable_obj_read_lock();
+		enable_parsed_object_lock();
+		CALLOC_ARRAY(threads, nr_threads);
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL, prune_subdirs, &pt))
+				die(_("unable to create thread"));
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+		disable_parsed_object_lock();
+		disable_obj_read_lock();
+	}
+	pthread_mutex_destroy(&pt.mutex);
+	stop_progress(&pt.progress);
 }
 
 /*
@@ -110,6 +241,10 @@ static int prune_subdir(unsigned int nr, const char *path, void *data)
  */
 static void remove_temporary_files(const char *path)
 {
+	struct prune_batch batch = {
+		.out = STRBUF_INIT,
+		.unlink = STRING_LIST_INIT_DUP,
+	};
 	DIR *dir;
 	struct dirent *de;
 
@@ -120,8 +255,12 @@ static void remove_temporary_files(const char *path)
 	}
 	while ((de = readdir(dir)) != NULL)
 		if (starts_with(de->d_name, "tmp_"))
-			prune_tmp_file(mkpath("%s/%s", path, de->d_name));
+			prune_tmp_file(mkpath("%s/%s", path, de->d_name),
+				       &batch);
 	closedir(dir);
+	fwrite(batch.out.buf, 1, batch.out.len, stdout);
+	flush_prune_batch(&batch);
+	strbuf_release(&batch.out);
 }
 
 int cmd_prune(int argc, const char **argv, const char *prefix)
@@ -136,6 +275,8 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 				N_("expire objects older than <time>")),
 		OPT_BOOL(0, "exclude-promisor-objects", &exclude_promisor_objects,
 			 N_("limit traversal to objects outside promisor packfiles")),
+		OPT_INTEGER(0, "threads", &nr_threads,
+			    N_("prune loose objects with <n> threads")),
 		OPT_END()
 	};
 	char *s;
@@ -171,8 +312,9 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 		revs.exclude_promisor_objects = 1;
 	}
 
-	for_each_loose_file_in_objdir(get_object_directory(), prune_object,
-				      prune_cruft, prune_subdir, &revs);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	prune_loose_objects(&revs);
 
 	prune_packed_objects(show_only ? PRUNE_PACKED_DRY_RUN : 0);
 	remove_temporary_files(get_object_directory());
@@ -29,6 +29,7 @@
 #include "commit-reach.h"
 #include "worktree.h"
 #include "shallow.h"
+#include "commit-graph.h"
 
 static const char * const receive_pack_usage[] = {
 	N_("git receive-pack <git-dir>"),
@@ -66,6 +67,7 @@ static int quiet;
 static int prefer_ofs_delta = 1;
 static int auto_update_server_info;
 static int auto_gc = 1;
+static int receive_write_commit_graph;
 static int reject_thin;
 static int stateless_rpc;
 static const char *service_dir;
@@ -209,6 +211,11 @@ static int receive_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (strcmp(var, "receive.writecommitgraph") == 0) {
+		receive_write_commit_graph = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (strcmp(var, "receive.shallowupdate") == 0) {
 		shallow_update = git_config_bool(var, value);
 		return 0;
@@ -1912,6 +1919,27 @@ static void execute_commands_atomic(struct command *commands,
 	strbuf_release(&err);
 }
 
+/*
+ * Add the commits just pushed to the commit-graph, in a layer of their
+ * own, rather than leave them for the next "git gc" or maintenance run.
+ */
+static void update_commit_graph(struct command *commands)
+{
+	struct oidset tips = OIDSET_INIT;
+	struct command *cmd;
+
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (cmd->error_string || is_null_oid(&cmd->new_oid))
+			continue;
+		oidset_insert(&tips, &cmd->new_oid);
+	}
+
+	if (oidset_size(&tips) &&
+	    write_commit_graph_for_tips(the_repository->objects->odb, &tips, 0))
+		rp_warning("failed to write the commit-graph");
+	oidset_clear(&tips);
+}
+
 static void execute_commands(struct command *commands,
 			     const char *unpacker_error,
 			     struct shallow_info *si,
@@ -2571,6 +2599,8 @@ int cmd_receive_pack(int argc, const char **argv, const char *prefix)
 				 &push_options);
 		run_update_post_hook(commands);
 		string_list_clear(&push_options, 0);
+		if (receive_write_commit_graph)
+			update_commit_graph(commands);
 		if (auto_gc) {
 			const char *argv_gc_auto[] = {
 				"gc", "--auto", "--quiet", NULL,
@@ -43,6 +43,7 @@ struct expire_reflog_policy_cb {
 	} unreachable_expire_kind;
 	struct commit_list *mark_list;
 	unsigned long mark_limit;
+	unsigned mark_prepared:1;
 	struct cmd_reflog_expire_cb cmd;
 	struct commit *tip_commit;
 	struct commit_list *tips;
@@ -261,6 +262,44 @@ static void mark_reachable(struct expire_reflog_policy_cb *cb)
 	cb->mark_list = leftover;
 }
 
+static int push_tip_to_list(const char *refname, const struct object_id *oid,
+			    int flags, void *cb_data)
+{
+	struct commit_list **list = cb_data;
+	struct commit *tip_commit;
+	if (flags & REF_ISSYMREF)
+		return 0;
+	tip_commit = lookup_commit_reference_gently(the_repository, oid, 1);
+	if (!tip_commit)
+		return 0;
+	commit_list_insert(tip_commit, list);
+	return 0;
+}
+
+/*
+ * Start marking the commits reachable from the tip(s) the first time
+ * an entry needs it; reflogs whose entries are all younger than the
+ * unreachable expiry (the common case for most refs) never walk.
+ */
+static void prepare_mark_reachable(struct expire_reflog_policy_cb *cb)
+{
+	if (cb->mark_prepared)
+		return;
+	cb->mark_prepared = 1;
+
+	if (cb->unreachable_expire_kind == UE_HEAD) {
+		struct commit_list *elem;
+
+		for_each_ref(push_tip_to_list, &cb->tips);
+		for (elem = cb->tips; elem; elem = elem->next)
+			commit_list_insert(elem->item, &cb->mark_list);
+	} else {
+		commit_list_insert(cb->tip_commit, &cb->mark_list);
+	}
+	cb->mark_limit = cb->cmd.expire_total;
+	mark_reachable(cb);
+}
+
 static int unreachable(struct expire_reflog_policy_cb *cb, struct commit *commit, struct object_id *oid)
 {
 	/*
@@ -279,6 +318,8 @@ static int unreachable(struct expire_reflog_policy_cb *cb, struct commit *commit
 			return 0;
 	}
 
+	prepare_mark_reachable(cb);
+
 	/* Reachable from the current ref?  Don't prune. */
 	if (commit->object.flags & REACHABLE)
 		return 0;
@@ -322,20 +363,6 @@ static int should_expire_reflog_ent(struct object_id *ooid, struct object_id *no
 	return 0;
 }
 
-static int push_tip_to_list(const char *refname, const struct object_id *oid,
-			    int flags, void *cb_data)
-{
-	struct commit_list **list = cb_data;
-	struct commit *tip_commit;
-	if (flags & REF_ISSYMREF)
-		return 0;
-	tip_commit = lookup_commit_reference_gently(the_repository, oid, 1);
-	if (!tip_commit)
-		return 0;
-	commit_list_insert(tip_commit, list);
-	return 0;
-}
-
 static int is_head(const char *refname)
 {
 	switch (ref_type(refname)) {
@@ -373,26 +400,14 @@ static void reflog_expiry_prepare(const char *refname,
 
 	cb->mark_list = NULL;
 	cb->tips = NULL;
-	if (cb->unreachable_expire_kind != UE_ALWAYS) {
-		if (cb->unreachable_expire_kind == UE_HEAD) {
-			struct commit_list *elem;
-
-			for_each_ref(push_tip_to_list, &cb->tips);
-			for (elem = cb->tips; elem; elem = elem->next)
-				commit_list_insert(elem->item, &cb->mark_list);
-		} else {
-			commit_list_insert(cb->tip_commit, &cb->mark_list);
-		}
-		cb->mark_limit = cb->cmd.expire_total;
-		mark_reachable(cb);
-	}
+	cb->mark_prepared = 0;
 }
 
 static void reflog_expiry_cleanup(void *cb_data)
 {
 	struct expire_reflog_policy_cb *cb = cb_data;
 
-	if (cb->unreachable_expire_kind != UE_ALWAYS) {
+	if (cb->mark_prepared) {
 		if (cb->unreachable_expire_kind == UE_HEAD) {
 			struct commit_list *elem;
 			for (elem = cb->tips; elem; elem = elem->next)
@@ -401,6 +416,7 @@ static void reflog_expiry_cleanup(void *cb_data)
 		} else {
 			clear_commit_marks(cb->tip_commit, REACHABLE);
 		}
+		free_commit_list(cb->mark_list);
 	}
 }
 
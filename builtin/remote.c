@@ -348,12 +348,8 @@ static int get_ref_states(const struct ref *remote_refs, struct ref_states *stat
 {
 	struct ref *fetch_map = NULL, **tail = &fetch_map;
 	struct ref *ref, *stale_refs;
-	int i;
 
-	for (i = 0; i < states->remote->fetch.nr; i++)
-		if (get_fetch_map(remote_refs, &states->remote->fetch.items[i], &tail, 1))
-			die(_("Could not get fetch map for refspec %s"),
-				states->remote->fetch.raw[i]);
+	get_fetch_maps(remote_refs, &states->remote->fetch, &tail, 1);
 
 	states->new_refs.strdup_strings = 1;
 	states->tracked.strdup_strings = 1;
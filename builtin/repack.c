@@ -149,6 +149,7 @@ struct pack_objects_args {
 	const char *depth;
 	const char *threads;
 	const char *max_pack_size;
+	const char *access_profile;
 	int no_reuse_delta;
 	int no_reuse_object;
 	int quiet;
@@ -169,6 +170,8 @@ static void prepare_pack_objects(struct child_process *cmd,
 		strvec_pushf(&cmd->args, "--threads=%s", args->threads);
 	if (args->max_pack_size)
 		strvec_pushf(&cmd->args, "--max-pack-size=%s", args->max_pack_size);
+	if (args->access_profile)
+		strvec_pushf(&cmd->args, "--access-profile=%s", args->access_profile);
 	if (args->no_reuse_delta)
 		strvec_pushf(&cmd->args, "--no-reuse-delta");
 	if (args->no_reuse_object)
@@ -212,6 +215,7 @@ static struct {
 	{".rev", 1},
 	{".bitmap", 1},
 	{".promisor", 1},
+	{".mtimes", 1},
 };
 
 static unsigned populate_pack_exts(char *name)
@@ -296,6 +300,59 @@ static void repack_promisor_objects(const struct pack_objects_args *args,
 
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
+#define PACK_CRUFT 4
+
+/*
+ * Write the objects of the packs that are about to be deleted and the
+ * loose objects, except those that made it into the packs we just
+ * wrote, to a cruft pack, and add its name to "names".
+ */
+static int write_cruft_pack(const struct pack_objects_args *args,
+			    const char *cruft_expiration,
+			    struct string_list *names,
+			    const struct string_list *existing_packs,
+			    const struct string_list *keep_pack_list)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct string_list_item *item;
+	FILE *in, *out;
+	int ret;
+
+	prepare_pack_objects(&cmd, args);
+
+	strvec_push(&cmd.args, "--cruft");
+	if (cruft_expiration)
+		strvec_pushf(&cmd.args, "--cruft-expiration=%s",
+			     cruft_expiration);
+	strvec_push(&cmd.args, "--honor-pack-keep");
+	for_each_string_list_item(item, keep_pack_list)
+		strvec_pushf(&cmd.args, "--keep-pack=%s", item->string);
+	strvec_push(&cmd.args, "--non-empty");
+	cmd.in = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "^%s-%s.pack\n", packtmp_name, item->string);
+	for_each_string_list_item(item, existing_packs)
+		fprintf(in, "%s.pack\n", item->string);
+	fclose(in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != the_hash_algo->hexsz)
+			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	return finish_command(&cmd);
+}
 
 struct pack_geometry {
 	struct packed_git **pack;
@@ -433,6 +490,37 @@ static void clear_pack_geometry(struct pack_geometry *geometry)
 	geometry->split = 0;
 }
 
+static void write_midx_included_packs(struct pack_geometry *geometry,
+				      struct string_list *names,
+				      int show_progress, int write_bitmaps)
+{
+	struct strbuf preferred = STRBUF_INIT;
+	unsigned flags = 0;
+
+	/*
+	 * Prefer the largest pack that the geometric repack left alone;
+	 * it is where most objects will be reused from when serving
+	 * fetches out of the multi-pack bitmap.  Without a geometry, a
+	 * single new pack is the natural choice.
+	 */
+	if (geometry && geometry->split < geometry->pack_nr)
+		strbuf_addstr(&preferred,
+			      pack_basename(geometry->pack[geometry->pack_nr - 1]));
+	else if (names->nr == 1)
+		strbuf_addf(&preferred, "pack-%s.pack", names->items[0].string);
+
+	if (show_progress)
+		flags |= MIDX_PROGRESS;
+	if (write_bitmaps > 0)
+		flags |= MIDX_WRITE_BITMAP | MIDX_WRITE_REV_INDEX;
+
+	if (write_midx_file(get_object_directory(),
+			    preferred.len ? preferred.buf : NULL, flags))
+		die(_("could not write multi-pack-index"));
+
+	strbuf_release(&preferred);
+}
+
 int cmd_repack(int argc, const char **argv, const char *prefix)
 {
 	struct child_process cmd = CHILD_PROCESS_INIT;
@@ -449,11 +537,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int pack_everything = 0;
 	int delete_redundant = 0;
 	const char *unpack_unreachable = NULL;
+	const char *cruft_expiration = NULL;
 	int keep_unreachable = 0;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	int no_update_server_info = 0;
 	struct pack_objects_args po_args = {NULL};
 	int geometric_factor = 0;
+	int write_midx = 0;
 
 	struct option builtin_repack_options[] = {
 		OPT_BIT('a', NULL, &pack_everything,
@@ -461,6 +551,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		OPT_BIT('A', NULL, &pack_everything,
 				N_("same as -a, and turn unreachable objects loose"),
 				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_BIT(0, "cruft", &pack_everything,
+				N_("same as -a, and pack unreachable objects separately"),
+				   PACK_CRUFT | ALL_INTO_ONE),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, expire objects older than this")),
 		OPT_BOOL('d', NULL, &delete_redundant,
 				N_("remove redundant packs, and run git-prune-packed")),
 		OPT_BOOL('f', NULL, &po_args.no_reuse_delta,
@@ -490,12 +585,16 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("limits the maximum number of threads")),
 		OPT_STRING(0, "max-pack-size", &po_args.max_pack_size, N_("bytes"),
 				N_("maximum size of each packfile")),
+		OPT_FILENAME(0, "access-profile", &po_args.access_profile,
+			     N_("lay out objects in the order they were accessed in <file>")),
 		OPT_BOOL(0, "pack-kept-objects", &pack_kept_objects,
 				N_("repack objects in packs marked with .keep")),
 		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
 				N_("do not repack this pack")),
 		OPT_INTEGER('g', "geometric", &geometric_factor,
 			    N_("find a geometric progression with factor <N>")),
+		OPT_BOOL('m', "write-midx", &write_midx,
+			   N_("write a multi-pack index of the resulting packs")),
 		OPT_END()
 	};
 
@@ -511,6 +610,15 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (pack_everything & PACK_CRUFT) {
+		if (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE))
+			die(_("--cruft and -A are incompatible"));
+		if (keep_unreachable)
+			die(_("--cruft and --keep-unreachable are incompatible"));
+	} else if (cruft_expiration) {
+		die(_("--cruft-expiration requires --cruft"));
+	}
+
 	if (write_bitmaps < 0) {
 		if (!(pack_everything & ALL_INTO_ONE) ||
 		    !is_bare_repository())
@@ -519,7 +627,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps > 0;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
+	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE) && !write_midx)
 		die(_(incremental_bitmap_conflict_error));
 
 	if (geometric_factor) {
@@ -561,7 +669,9 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	}
 	if (has_promisor_remote())
 		strvec_push(&cmd.args, "--exclude-promisor-objects");
-	if (write_bitmaps > 0)
+	if (write_midx)
+		; /* any bitmap is written for the multi-pack index instead */
+	else if (write_bitmaps > 0)
 		strvec_push(&cmd.args, "--write-bitmap-index");
 	else if (write_bitmaps < 0)
 		strvec_push(&cmd.args, "--write-bitmap-index-quiet");
@@ -638,6 +748,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (!names.nr && !po_args.quiet)
 		printf_ln(_("Nothing new to pack."));
 
+	if ((pack_everything & PACK_CRUFT) && delete_redundant) {
+		ret = write_cruft_pack(&po_args, cruft_expiration, &names,
+				       &existing_packs, &keep_pack_list);
+		if (ret)
+			return ret;
+	}
+
 	for_each_string_list_item(item, &names) {
 		item->util = (void *)(uintptr_t)populate_pack_exts(item->string);
 	}
@@ -725,7 +842,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		update_server_info(0);
 	remove_temporary_files();
 
-	if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
+	if (write_midx)
+		write_midx_included_packs(geometry, &names,
+					  !po_args.quiet && isatty(2),
+					  write_bitmaps);
+	else if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
 		write_midx_file(get_object_directory(), NULL, 0);
 
 	string_list_clear(&names, 0);
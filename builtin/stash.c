@@ -7,6 +7,7 @@
 #include "cache-tree.h"
 #include "unpack-trees.h"
 #include "merge-recursive.h"
+#include "merge-ort.h"
 #include "strvec.h"
 #include "run-command.h"
 #include "dir.h"
@@ -322,7 +323,7 @@ static void add_diff_to_buf(struct diff_queue_struct *q,
 	for (i = 0; i < q->nr; i++) {
 		strbuf_addstr(data, q->queue[i]->one->path);
 
-		/* NUL-terminate: will be fed to update-index -z */
+		/* NUL-terminate: walked by stash_working_tree() */
 		strbuf_addch(data, '\0');
 	}
 }
@@ -358,6 +359,74 @@ static int restore_untracked(struct object_id *u_tree)
 	return res;
 }
 
+/*
+ * Stashes are applied with merge-ort, which merges the trees in memory
+ * and then only touches the index entries and files that the merge
+ * changed; the test suite can still ask for merge-recursive.
+ */
+static int use_merge_ort(void)
+{
+	const char *algo = getenv("GIT_TEST_MERGE_ALGORITHM");
+
+	return !algo || !strcmp(algo, "ort");
+}
+
+/*
+ * Apply the changes the stash made to the index on top of the current
+ * index tree c_tree, without touching the index.
+ */
+static int merge_stash_index(struct stash_info *info,
+			     struct object_id *c_tree,
+			     struct object_id *index_tree)
+{
+	struct merge_options o;
+	struct merge_result result = { 0 };
+	struct tree *base, *head, *merge;
+
+	base = parse_tree_indirect(&info->b_tree);
+	head = parse_tree_indirect(c_tree);
+	merge = parse_tree_indirect(&info->i_tree);
+	if (!base || !head || !merge)
+		return -1;
+
+	init_merge_options(&o, the_repository);
+	o.ancestor = "stash base";
+	o.branch1 = "Current index";
+	o.branch2 = "Stashed index";
+	merge_incore_nonrecursive(&o, base, head, merge, &result);
+	if (result.clean > 0)
+		oidcpy(index_tree, &result.tree->object.oid);
+	merge_finalize(&o, &result);
+	return result.clean > 0 ? 0 : -1;
+}
+
+static int merge_stash_ort(struct merge_options *o,
+			   struct object_id *c_tree,
+			   struct stash_info *info, int quiet)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct merge_result result = { 0 };
+	struct tree *base, *head, *merge;
+
+	base = parse_tree_indirect(&info->b_tree);
+	head = parse_tree_indirect(c_tree);
+	merge = parse_tree_indirect(&info->w_tree);
+	if (!base || !head || !merge)
+		return error(_("could not read the trees of the stash"));
+
+	repo_hold_locked_index(the_repository, &lock, LOCK_DIE_ON_ERROR);
+	o->ancestor = "constructed merge base";
+	merge_incore_nonrecursive(o, base, head, merge, &result);
+	merge_switch_to_result(o, head, &result, 1, !quiet);
+	if (result.clean < 0) {
+		rollback_lock_file(&lock);
+		return -1;
+	}
+	if (write_locked_index(&the_index, &lock, COMMIT_LOCK | SKIP_IF_UNCHANGED))
+		return error(_("unable to write new index file"));
+	return !result.clean;
+}
+
 static void unstage_changes_unless_new(struct object_id *orig_tree)
 {
 	/*
@@ -495,6 +564,10 @@ static int do_apply_stash(const char *prefix, struct stash_info *info,
 		if (oideq(&info->b_tree, &info->i_tree) ||
 		    oideq(&c_tree, &info->i_tree)) {
 			has_index = 0;
+		} else if (use_merge_ort()) {
+			if (merge_stash_index(info, &c_tree, &index_tree))
+				return error(_("conflicts in index. "
+					       "Try without --index."));
 		} else {
 			struct strbuf out = STRBUF_INIT;
 
@@ -540,8 +613,11 @@ static int do_apply_stash(const char *prefix, struct stash_info *info,
 
 	bases[0] = &info->b_tree;
 
-	ret = merge_recursive_generic(&o, &c_tree, &info->w_tree, 1, bases,
-				      &result);
+	if (use_merge_ort())
+		ret = merge_stash_ort(&o, &c_tree, info, quiet);
+	else
+		ret = merge_recursive_generic(&o, &c_tree, &info->w_tree, 1,
+					      bases, &result);
 	if (ret) {
 		rerere(0);
 
@@ -1178,24 +1254,50 @@ static int stash_patch(struct stash_info *info, const struct pathspec *ps,
 	return ret;
 }
 
+/*
+ * Record the working tree version of "path" in the in-core index, the
+ * way "update-index --add --remove --ignore-skip-worktree-entries"
+ * would.
+ */
+static int stash_working_tree_path(const char *path)
+{
+	struct stat st;
+	int pos = index_name_pos(&the_index, path, strlen(path));
+	const struct cache_entry *ce = pos >= 0 ? active_cache[pos] : NULL;
+
+	if (ce && ce_skip_worktree(ce))
+		return 0;
+
+	if (lstat(path, &st)) {
+		if (!is_missing_file_error(errno))
+			return error_errno(_("cannot stat '%s'"), path);
+		return remove_file_from_index(&the_index, path);
+	}
+	if (S_ISDIR(st.st_mode)) {
+		struct object_id oid;
+
+		if (resolve_gitlink_ref(path, "HEAD", &oid) < 0) {
+			/* an uninitialized submodule is left alone */
+			if (ce && S_ISGITLINK(ce->ce_mode))
+				return 0;
+			/* a directory replaced the path */
+			return remove_file_from_index(&the_index, path);
+		}
+	}
+	return add_to_index(&the_index, path, &st, 0);
+}
+
 static int stash_working_tree(struct stash_info *info, const struct pathspec *ps)
 {
 	int ret = 0;
 	struct rev_info rev;
-	struct child_process cp_upd_index = CHILD_PROCESS_INIT;
 	struct strbuf diff_output = STRBUF_INIT;
-	struct index_state istate = { NULL };
+	const char *p, *end;
+	int i;
 
 	init_revisions(&rev, NULL);
 	copy_pathspec(&rev.prune_data, ps);
 
-	set_alternate_index_output(stash_index_path.buf);
-	if (reset_tree(&info->i_tree, 0, 0)) {
-		ret = -1;
-		goto done;
-	}
-	set_alternate_index_output(NULL);
-
 	rev.diffopt.output_format = DIFF_FORMAT_CALLBACK;
 	rev.diffopt.format_callback = add_diff_to_buf;
 	rev.diffopt.format_callback_data = &diff_output;
@@ -1212,32 +1314,39 @@ static int stash_working_tree(struct stash_info *info, const struct pathspec *ps
 		goto done;
 	}
 
-	cp_upd_index.git_cmd = 1;
-	strvec_pushl(&cp_upd_index.args, "update-index",
-		     "--ignore-skip-worktree-entries",
-		     "-z", "--add", "--remove", "--stdin", NULL);
-	strvec_pushf(&cp_upd_index.env_array, "GIT_INDEX_FILE=%s",
-		     stash_index_path.buf);
-
-	if (pipe_command(&cp_upd_index, diff_output.buf, diff_output.len,
-			 NULL, 0, NULL, 0)) {
-		ret = -1;
-		goto done;
+	/*
+	 * The in-core index still matches i_tree: update the changed
+	 * paths in it and write out its tree, but not the index itself.
+	 * Except that an intent-to-add entry has no place in i_tree.
+	 */
+	ensure_full_index(&the_index);
+	for (i = 0; i < active_nr; i++) {
+		if (ce_intent_to_add(active_cache[i])) {
+			ret = error(_("cannot stash intent-to-add path '%s'"),
+				    active_cache[i]->name);
+			goto done;
+		}
+	}
+	end = diff_output.buf + diff_output.len;
+	for (p = diff_output.buf; p < end; p += strlen(p) + 1) {
+		if (stash_working_tree_path(p)) {
+			ret = -1;
+			goto done;
+		}
 	}
 
-	if (write_index_as_tree(&info->w_tree, &istate, stash_index_path.buf, 0,
-				NULL)) {
+	if (cache_tree_update(&the_index, 0)) {
 		ret = -1;
 		goto done;
 	}
+	oidcpy(&info->w_tree, &the_index.cache_tree->oid);
 
 done:
-	discard_index(&istate);
+	discard_cache();
 	UNLEAK(rev);
 	object_array_clear(&rev.pending);
 	clear_pathspec(&rev.prune_data);
 	strbuf_release(&diff_output);
-	remove_path(stash_index_path.buf);
 	return ret;
 }
 
@@ -320,10 +320,115 @@ static void added_object(unsigned nr, enum object_type type,
 	}
 }
 
+struct input_zstream_data {
+	git_zstream *zstream;
+	unsigned char buf[8192];
+	int status;
+};
+
+static const void *feed_input_zstream(struct input_stream *in_stream,
+				      unsigned long *readlen)
+{
+	struct input_zstream_data *data = in_stream->data;
+	git_zstream *zstream = data->zstream;
+	void *in = fill(1);
+
+	if (in_stream->is_finished) {
+		*readlen = 0;
+		return NULL;
+	}
+
+	zstream->next_out = data->buf;
+	zstream->avail_out = sizeof(data->buf);
+	zstream->next_in = in;
+	zstream->avail_in = len;
+
+	data->status = git_inflate(zstream, 0);
+
+	in_stream->is_finished = data->status != Z_OK;
+	use(len - zstream->avail_in);
+	*readlen = sizeof(data->buf) - zstream->avail_out;
+
+	return data->buf;
+}
+
+/*
+ * Is any of the deltas we could not resolve yet waiting for the nr-th
+ * object as its base?
+ */
+static int has_pending_delta(unsigned nr)
+{
+	struct delta_info *info;
+
+	for (info = delta_list; info; info = info->next)
+		if (oideq(&info->base_oid, &obj_list[nr].oid) ||
+		    info->base_offset == obj_list[nr].offset)
+			return 1;
+	return 0;
+}
+
+/*
+ * Write a blob too large to be held in core straight to a loose
+ * object, inflating it from the pack a buffer at a time.
+ */
+static void stream_blob(unsigned long size, unsigned nr)
+{
+	git_zstream zstream = { 0 };
+	struct input_zstream_data data = { 0 };
+	struct input_stream in_stream = {
+		.read = feed_input_zstream,
+		.data = &data,
+	};
+	struct obj_info *info = &obj_list[nr];
+
+	data.zstream = &zstream;
+	git_inflate_init(&zstream);
+
+	if (stream_loose_object(&in_stream, size, &info->oid))
+		die(_("failed to write object in stream"));
+
+	if (data.status != Z_STREAM_END)
+		die(_("inflate returned (%d)"), data.status);
+	git_inflate_end(&zstream);
+
+	if (strict) {
+		struct blob *blob = lookup_blob(the_repository, &info->oid);
+
+		if (!blob)
+			die(_("invalid blob object from stream"));
+		blob->object.flags |= FLAG_WRITTEN;
+	}
+	info->obj = NULL;
+
+	/*
+	 * A delta that came before its base in the pack needs the
+	 * data after all; this is rare enough to read it back.
+	 */
+	if (has_pending_delta(nr)) {
+		enum object_type type;
+		unsigned long base_size;
+		void *base = read_object_file(&info->oid, &type, &base_size);
+
+		if (!base)
+			die(_("unable to read back object %s"),
+			    oid_to_hex(&info->oid));
+		added_object(nr, type, base, base_size);
+		free(base);
+	}
+}
+
 static void unpack_non_delta_entry(enum object_type type, unsigned long size,
 				   unsigned nr)
 {
-	void *buf = get_data(size);
+	void *buf;
+
+	/* Write large blobs in stream without allocating full buffer. */
+	if (!dry_run && type == OBJ_BLOB && size > big_file_threshold) {
+		stream_blob(size, nr);
+		return;
+	}
+
+	buf = get_data(size);
 
 	if (!dry_run && buf)
 		write_object(nr, type, buf, size);
@@ -32,6 +32,7 @@ int cmd_upload_pack(int argc, const char **argv, const char *prefix)
 
 	packet_trace_identity("upload-pack");
 	read_replace_refs = 0;
+	upload_pack_pack_objects = cmd_pack_objects;
 
 	argc = parse_options(argc, argv, prefix, options, upload_pack_usage, 0);
 
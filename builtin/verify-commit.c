@@ -52,6 +52,31 @@ static int verify_commit(const char *name, unsigned flags)
 	return run_gpg_verify((struct commit *)obj, flags);
 }
 
+/*
+ * Let the verifiers for a batch of the commits run at once; any errors
+ * are left for verify_commit() to report, in order.
+ */
+static void prefetch_signatures_of(const char **names, int nr)
+{
+	struct commit **commits;
+	int i, commits_nr = 0;
+
+	ALLOC_ARRAY(commits, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_id oid;
+		struct commit *commit;
+
+		if (get_oid(names[i], &oid) ||
+		    oid_object_info(the_repository, &oid, NULL) != OBJ_COMMIT)
+			continue;
+		commit = lookup_commit(the_repository, &oid);
+		if (commit)
+			commits[commits_nr++] = commit;
+	}
+	prefetch_commit_signatures(commits, commits_nr);
+	free(commits);
+}
+
 static int git_verify_commit_config(const char *var, const char *value, void *cb)
 {
 	int status = git_gpg_config(var, value, cb);
@@ -83,8 +108,14 @@ int cmd_verify_commit(int argc, const char **argv, const char *prefix)
 	/* sometimes the program was terminated because this signal
 	 * was received in the process of writing the gpg input: */
 	signal(SIGPIPE, SIG_IGN);
-	while (i < argc)
-		if (verify_commit(argv[i++], flags))
-			had_error = 1;
+	while (i < argc) {
+		int end = i + SIGNATURE_PREFETCH_MAX < argc ?
+			i + SIGNATURE_PREFETCH_MAX : argc;
+
+		prefetch_signatures_of(argv + i, end - i);
+		while (i < end)
+			if (verify_commit(argv[i++], flags))
+				had_error = 1;
+	}
 	return had_error;
 }
@@ -9,10 +9,21 @@
 #include "strbuf.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "tempfile.h"
+#include "tmp-objdir.h"
+#include "oidset.h"
+#include "oid-array.h"
+#include "config.h"
+#include "thread-utils.h"
 
-static struct bulk_checkin_state {
-	unsigned plugged:1;
+static int bulk_checkin_plugged;
+static int bulk_checkin_all_files;
 
+static int bulk_fsync_plugged;
+static struct tmp_objdir *bulk_fsync_objdir;
+static struct oid_array bulk_fsync_journal;
+
+struct bulk_checkin_state {
 	char *pack_tmp_name;
 	struct hashfile *f;
 	off_t offset;
@@ -21,9 +32,46 @@ static struct bulk_checkin_state {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
-} state;
+};
 
-static void finish_bulk_checkin(struct bulk_checkin_state *state)
+static struct bulk_checkin_state state;
+
+/*
+ * While plugged, objects are compressed by a pool of worker threads,
+ * each writing to a pack of its own.  The main thread only hashes
+ * the files to learn their object names, and queues those not
+ * already in the repository or in the queue.
+ */
+struct bulk_checkin_job {
+	struct bulk_checkin_job *next;
+	struct object_id oid;
+	int fd;
+	size_t size;
+	enum object_type type;
+	char *path;
+};
+
+static struct bulk_checkin_workers {
+	int max_threads;
+	int nr_threads;
+	pthread_t *threads;
+	struct bulk_checkin_state *states;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t space_cond;
+	struct bulk_checkin_job *head, **tail;
+	int nr_queued;
+	int done;
+
+	struct oidset queued;
+} workers;
+
+/*
+ * Write out the pack in progress, if any, but do not tell the object
+ * store about it; this is safe to call from a worker thread.
+ */
+static void finish_pack(struct bulk_checkin_state *state)
 {
 	struct object_id oid;
 	struct strbuf packname = STRBUF_INIT;
@@ -58,6 +106,13 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 	memset(state, 0, sizeof(*state));
 
 	strbuf_release(&packname);
+}
+
+static void finish_bulk_checkin(struct bulk_checkin_state *state)
+{
+	if (!state->f)
+		return;
+	finish_pack(state);
 	/* Make objects we just wrote available to ourselves */
 	reprepare_packed_git(the_repository);
 }
@@ -186,11 +241,16 @@ static void prepare_to_stream(struct bulk_checkin_state *state,
 		die_errno("unable to write pack header");
 }
 
+/*
+ * A worker thread passes "threaded", as it must not look up objects
+ * in the repository; the main thread made sure that the objects it
+ * queued are new.
+ */
 static int deflate_to_pack(struct bulk_checkin_state *state,
 			   struct object_id *result_oid,
 			   int fd, size_t size,
 			   enum object_type type, const char *path,
-			   unsigned flags)
+			   unsigned flags, int threaded)
 {
 	off_t seekback, already_hashed_to;
 	git_hash_ctx ctx;
@@ -233,7 +293,10 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 			BUG("should not happen");
 		hashfile_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
-		finish_bulk_checkin(state);
+		if (threaded)
+			finish_pack(state);
+		else
+			finish_bulk_checkin(state);
 		if (lseek(fd, seekback, SEEK_SET) == (off_t) -1)
 			return error("cannot seek back");
 	}
@@ -242,7 +305,7 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 		return 0;
 
 	idx->crc32 = crc32_end(state->f);
-	if (already_written(state, result_oid)) {
+	if (!threaded && already_written(state, result_oid)) {
 		hashfile_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
 		free(idx);
@@ -256,25 +319,305 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	return 0;
 }
 
+/*
+ * Make the loose objects written while we were plugged durable with a
+ * single flush of the disk cache, then move them into the real object
+ * directory.  Until they have been moved, no ref can point at them, so
+ * a crash before then leaves at worst some garbage in an "incoming-"
+ * directory.
+ */
+static void flush_batch_fsync(void)
+{
+	struct strbuf temp_path = STRBUF_INIT;
+	struct tempfile *temp;
+	size_t i;
+
+	if (!bulk_fsync_objdir)
+		return;
+
+	/*
+	 * Each object has already been written out to the disk by
+	 * fsync_loose_object_bulk_checkin(); on common filesystems,
+	 * fsync()ing any file on the same device issues the one
+	 * hardware flush needed to make all of them durable.
+	 */
+	strbuf_addf(&temp_path, "%s/bulk_fsync_XXXXXX",
+		    tmp_objdir_path(bulk_fsync_objdir));
+	temp = xmks_tempfile(temp_path.buf);
+	fsync_or_die(get_tempfile_fd(temp), get_tempfile_path(temp));
+	delete_tempfile(&temp);
+	strbuf_release(&temp_path);
+
+	if (tmp_objdir_migrate(bulk_fsync_objdir))
+		die(_("failed to move loose objects to the object directory"));
+	bulk_fsync_objdir = NULL;
+
+	for (i = 0; i < bulk_fsync_journal.nr; i++)
+		journal_loose_object(the_repository, &bulk_fsync_journal.oid[i]);
+	oid_array_clear(&bulk_fsync_journal);
+
+	/* Make objects we just moved available to ourselves */
+	reprepare_packed_git(the_repository);
+}
+
+void journal_loose_object_bulk_checkin(const struct object_id *oid)
+{
+	if (core_loose_object_journal)
+		oid_array_append(&bulk_fsync_journal, oid);
+}
+
+const char *prepare_loose_object_bulk_checkin(void)
+{
+	if (!bulk_fsync_plugged ||
+	    fsync_object_files != FSYNC_OBJECT_FILES_BATCH)
+		return NULL;
+
+	if (!bulk_fsync_objdir) {
+		bulk_fsync_objdir = tmp_objdir_create();
+		if (!bulk_fsync_objdir) {
+			/* Fall back to fsync()ing each object */
+			bulk_fsync_plugged = 0;
+			return NULL;
+		}
+		tmp_objdir_add_as_alternate(bulk_fsync_objdir);
+	}
+	return tmp_objdir_path(bulk_fsync_objdir);
+}
+
+void fsync_loose_object_bulk_checkin(int fd, const char *filename)
+{
+	/*
+	 * Without a temporary object directory, or when the platform
+	 * cannot write a file out without also flushing the disk
+	 * cache, do a full fsync() of every object.
+	 */
+	if (!bulk_fsync_objdir ||
+	    git_fsync(fd, FSYNC_WRITEOUT_ONLY) < 0)
+		fsync_or_die(fd, filename);
+}
+
+static void write_job(struct bulk_checkin_state *state,
+		      struct bulk_checkin_job *job)
+{
+	struct object_id oid;
+
+	if (deflate_to_pack(state, &oid, job->fd, job->size, job->type,
+			    job->path, HASH_WRITE_OBJECT, 1))
+		die(_("unable to write '%s' to a pack"), job->path);
+	if (!oideq(&oid, &job->oid))
+		die(_("confused by unstable object source data for %s"),
+		    oid_to_hex(&job->oid));
+	close(job->fd);
+	free(job->path);
+	free(job);
+}
+
+static void *bulk_checkin_worker(void *data)
+{
+	struct bulk_checkin_state *state = data;
+
+	for (;;) {
+		struct bulk_checkin_job *job;
+
+		pthread_mutex_lock(&workers.mutex);
+		while (!workers.head && !workers.done)
+			pthread_cond_wait(&workers.work_cond, &workers.mutex);
+		job = workers.head;
+		if (job) {
+			workers.head = job->next;
+			if (!workers.head)
+				workers.tail = &workers.head;
+			workers.nr_queued--;
+			pthread_cond_signal(&workers.space_cond);
+		}
+		pthread_mutex_unlock(&workers.mutex);
+
+		if (!job)
+			break;
+		write_job(state, job);
+	}
+	finish_pack(state);
+	return NULL;
+}
+
+static void queue_job(struct bulk_checkin_job *job)
+{
+	if (!workers.threads) {
+		ALLOC_ARRAY(workers.threads, workers.max_threads);
+		CALLOC_ARRAY(workers.states, workers.max_threads);
+		pthread_mutex_init(&workers.mutex, NULL);
+		pthread_cond_init(&workers.work_cond, NULL);
+		pthread_cond_init(&workers.space_cond, NULL);
+		workers.tail = &workers.head;
+		/* computed lazily; make sure no worker races to do it */
+		get_shared_repository();
+	}
+
+	pthread_mutex_lock(&workers.mutex);
+	/* Keep the number of open files in check */
+	while (workers.nr_queued >= 2 * workers.max_threads)
+		pthread_cond_wait(&workers.space_cond, &workers.mutex);
+	*workers.tail = job;
+	workers.tail = &job->next;
+	workers.nr_queued++;
+	pthread_cond_signal(&workers.work_cond);
+	pthread_mutex_unlock(&workers.mutex);
+
+	if (workers.nr_threads < workers.max_threads) {
+		int i = workers.nr_threads;
+		int err = pthread_create(&workers.threads[i], NULL,
+					 bulk_checkin_worker,
+					 &workers.states[i]);
+		if (err)
+			die(_("unable to create bulk checkin thread: %s"),
+			    strerror(err));
+		workers.nr_threads++;
+	}
+}
+
+static void stop_workers(void)
+{
+	int i;
+
+	if (!workers.threads)
+		return;
+
+	pthread_mutex_lock(&workers.mutex);
+	workers.done = 1;
+	pthread_cond_broadcast(&workers.work_cond);
+	pthread_mutex_unlock(&workers.mutex);
+
+	for (i = 0; i < workers.nr_threads; i++)
+		pthread_join(workers.threads[i], NULL);
+
+	pthread_mutex_destroy(&workers.mutex);
+	pthread_cond_destroy(&workers.work_cond);
+	pthread_cond_destroy(&workers.space_cond);
+	free(workers.threads);
+	free(workers.states);
+	oidset_clear(&workers.queued);
+	workers.threads = NULL;
+	workers.states = NULL;
+	workers.nr_threads = 0;
+	workers.done = 0;
+
+	/* Make objects we just wrote available to ourselves */
+	reprepare_packed_git(the_repository);
+}
+
+static int hash_stream(struct object_id *result_oid, int fd, size_t size,
+		       enum object_type type, const char *path)
+{
+	git_hash_ctx ctx;
+	unsigned char buf[65536];
+	unsigned header_len;
+
+	header_len = xsnprintf((char *)buf, sizeof(buf), "%s %" PRIuMAX,
+			       type_name(type), (uintmax_t)size) + 1;
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, buf, header_len);
+
+	while (size) {
+		size_t rsize = size < sizeof(buf) ? size : sizeof(buf);
+		ssize_t read_result = read_in_full(fd, buf, rsize);
+
+		if (read_result < 0)
+			return error_errno("failed to read from '%s'", path);
+		if (read_result != rsize)
+			return error("failed to read %d bytes from '%s'",
+				     (int)rsize, path);
+		the_hash_algo->update_fn(&ctx, buf, rsize);
+		size -= rsize;
+	}
+	the_hash_algo->final_oid_fn(result_oid, &ctx);
+	return 0;
+}
+
+static int queue_bulk_checkin(struct object_id *oid,
+			      int fd, size_t size, enum object_type type,
+			      const char *path)
+{
+	struct bulk_checkin_job *job;
+	off_t seekback;
+	int job_fd;
+
+	seekback = lseek(fd, 0, SEEK_CUR);
+	if (seekback == (off_t) -1)
+		return error("cannot find the current offset");
+	if (hash_stream(oid, fd, size, type, path))
+		return -1;
+	if (has_object_file(oid) || oidset_contains(&workers.queued, oid))
+		return 0;
+
+	/*
+	 * The caller closes "fd" as soon as we return, so hand the
+	 * worker a copy, rewound to where the object starts.
+	 */
+	if (lseek(fd, seekback, SEEK_SET) == (off_t) -1)
+		return error("cannot seek back");
+	job_fd = dup(fd);
+	if (job_fd < 0)
+		return error_errno("cannot duplicate file descriptor for '%s'",
+				   path);
+
+	CALLOC_ARRAY(job, 1);
+	oidcpy(&job->oid, oid);
+	job->fd = job_fd;
+	job->size = size;
+	job->type = type;
+	job->path = xstrdup(path ? path : "");
+	oidset_insert(&workers.queued, oid);
+	queue_job(job);
+	return 0;
+}
+
 int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
 {
-	int status = deflate_to_pack(&state, oid, fd, size, type,
-				     path, flags);
-	if (!state.plugged)
+	int status;
+
+	if (bulk_checkin_plugged && workers.max_threads > 1 &&
+	    (flags & HASH_WRITE_OBJECT))
+		return queue_bulk_checkin(oid, fd, size, type, path);
+
+	status = deflate_to_pack(&state, oid, fd, size, type,
+				 path, flags, 0);
+	if (!bulk_checkin_plugged)
 		finish_bulk_checkin(&state);
 	return status;
 }
 
+int bulk_checkin_wants_all_files(void)
+{
+	return bulk_checkin_plugged && bulk_checkin_all_files;
+}
+
 void plug_bulk_checkin(void)
 {
-	state.plugged = 1;
+	int threads;
+
+	bulk_checkin_plugged = 1;
+	bulk_fsync_plugged = 1;
+
+	if (git_config_get_bool("core.bulkcheckinallfiles",
+				&bulk_checkin_all_files))
+		bulk_checkin_all_files = 0;
+	if (git_config_get_int("core.bulkcheckinthreads", &threads))
+		threads = 1;
+	else if (threads < 1)
+		threads = online_cpus();
+	if (!HAVE_THREADS)
+		threads = 1;
+	workers.max_threads = threads;
 }
 
 void unplug_bulk_checkin(void)
 {
-	state.plugged = 0;
-	if (state.f)
-		finish_bulk_checkin(&state);
+	bulk_checkin_plugged = 0;
+	stop_workers();
+	finish_bulk_checkin(&state);
+
+	bulk_fsync_plugged = 0;
+	flush_batch_fsync();
 }
@@ -10,6 +10,42 @@ int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags);
 
+/*
+ * With core.fsyncObjectFiles=batch, loose objects written while bulk
+ * checkin is plugged go to a temporary object directory, whose path
+ * this returns (NULL when objects should be written to the object
+ * directory as usual).  They are made durable and moved into place
+ * together by unplug_bulk_checkin().
+ */
+const char *prepare_loose_object_bulk_checkin(void);
+
+/*
+ * Sync a loose object file written to the directory returned by
+ * prepare_loose_object_bulk_checkin() as cheaply as the platform
+ * allows.
+ */
+void fsync_loose_object_bulk_checkin(int fd, const char *filename);
+
+/*
+ * Journal (see journal_loose_object()) a loose object written to the
+ * directory returned by prepare_loose_object_bulk_checkin() once it
+ * has been moved to the object directory.
+ */
+void journal_loose_object_bulk_checkin(const struct object_id *oid);
+
+/*
+ * Whether index_fd() should send even small blobs to
+ * index_bulk_checkin(), so that they end up in a pack rather than as
+ * loose objects (core.bulkCheckinAllFiles).
+ */
+int bulk_checkin_wants_all_files(void);
+
+/*
+ * While bulk checkin is plugged, objects given to index_bulk_checkin()
+ * are compressed by up to core.bulkCheckinThreads threads, each of
+ * which writes its own pack; the packs are completed, and the objects
+ * become available, only when it is unplugged.
+ */
 void plug_bulk_checkin(void);
 void unplug_bulk_checkin(void);
 
@@ -0,0 +1,19 @@
+#ifndef BUNDLE_URI_H
+#define BUNDLE_URI_H
+
+struct repository;
+
+/*
+ * Fetch the bundle at the given URI and unbundle it into the object
+ * store of the given repository, storing its branches as refs under
+ * "refs/bundles/", where a later fetch finds them as things it has.
+ *
+ * The URI may be a local path or a "file://" URI, or an "http://" or
+ * "https://" URL, which is downloaded by the "git-remote-https"
+ * helper.  Returns non-zero, after showing why, if the bundle could
+ * not be downloaded or applied, e.g. because it needs objects that
+ * are not in the repository yet.
+ */
+int fetch_bundle_uri(struct repository *r, const char *uri);
+
+#endif
@@ -11,6 +11,7 @@
 #include "run-command.h"
 #include "refs.h"
 #include "strvec.h"
+#include "trace2.h"
 
 
 static const char v2_bundle_signature[] = "# v2 git bundle\n";
@@ -478,6 +479,31 @@ static void write_bundle_prerequisites(struct commit *commit, void *data)
 	strbuf_release(&buf);
 }
 
+/*
+ * Prerequisites are the boundary commits of the walk over what the
+ * bundle contains, and a tip is left out if the walk does not show
+ * it.  When nothing is excluded and nothing limits the walk, there
+ * is no boundary and every tip is shown, so the walk over the whole
+ * history, which can take long in a large repository, can be
+ * skipped; pack-objects is left alone to enumerate the objects,
+ * with reachability bitmaps if there are any.
+ */
+static int bundle_needs_walk(struct rev_info *revs)
+{
+	int i;
+
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 1;
+	return revs->max_count >= 0 || revs->skip_count >= 0 ||
+	       revs->max_age != -1 || revs->min_age != -1 ||
+	       revs->min_parents || revs->max_parents >= 0 ||
+	       revs->prune_data.nr || revs->bisect ||
+	       revs->grep_filter.pattern_list ||
+	       revs->grep_filter.header_list ||
+	       revs->simplify_by_decoration || revs->line_level_traverse;
+}
+
 int create_bundle(struct repository *r, const char *path,
 		  int argc, const char **argv, struct strvec *pack_options, int version)
 {
@@ -539,12 +565,22 @@ int create_bundle(struct repository *r, const char *path,
 	}
 
 	/* write prerequisites */
-	revs.boundary = 1;
-	if (prepare_revision_walk(&revs))
-		die("revision walk setup failed");
-	bpi.fd = bundle_fd;
-	bpi.pending = &revs_copy.pending;
-	traverse_commit_list(&revs, write_bundle_prerequisites, NULL, &bpi);
+	if (bundle_needs_walk(&revs)) {
+		trace2_region_enter("bundle", "write-prerequisites", r);
+		revs.boundary = 1;
+		if (prepare_revision_walk(&revs))
+			die("revision walk setup failed");
+		bpi.fd = bundle_fd;
+		bpi.pending = &revs_copy.pending;
+		traverse_commit_list(&revs, write_bundle_prerequisites, NULL, &bpi);
+		trace2_region_leave("bundle", "write-prerequisites", r);
+	} else {
+		for (i = 0; i < revs_copy.pending.nr; i++) {
+			struct object *obj = revs_copy.pending.objects[i].item;
+			if (obj->type == OBJ_COMMIT)
+				obj->flags |= SHOWN;
+		}
+	}
 	object_array_remove_duplicates(&revs_copy.pending);
 
 	/* write bundle refs */
@@ -7,6 +7,8 @@
 #include "replace-object.h"
 #include "promisor-remote.h"
 #include "sparse-index.h"
+#include "config.h"
+#include "thread-utils.h"
 
 #ifndef DEBUG_CACHE_TREE
 #define DEBUG_CACHE_TREE 0
@@ -242,24 +244,64 @@ static int must_check_existence(const struct cache_entry *ce)
 	return !(has_promisor_remote() && ce_skip_worktree(ce));
 }
 
-static int update_one(struct cache_tree *it,
-		      struct cache_entry **cache,
-		      int entries,
-		      const char *base,
-		      int baselen,
-		      int *skip_count,
-		      int flags)
-{
+/*
+ * A directory whose tree object has to be (re)built by update_one().
+ * The directories are found by collect_one() in a first pass over the
+ * index, and then built one level at a time, deepest first, so that
+ * the object names of all the subtrees of a directory are known by the
+ * time its own tree is built. The directories of a level do not depend
+ * on each other and can be built by several threads; their tree objects
+ * are then written out by the main thread, in index order, so that the
+ * result does not depend on how the work was split.
+ */
+struct cache_tree_job {
+	struct cache_tree *it;
+	struct cache_entry **cache;
+	int entries;
+	const char *base;
+	int baselen;
+	int depth;
+	int parent;
+
+	/* entries of the index covered by this directory */
+	int count;
+	/* entries directly in this directory, i.e. files and subtrees */
+	int nr_direct;
+	int skip_count;
+	int to_invalidate;
+
+	/* set by build_one() */
+	int ret;
+	unsigned bad_mode;
+	struct object_id bad_oid;
+	const char *bad_path;
+	int bad_len;
 	struct strbuf buffer;
-	int missing_ok = flags & WRITE_TREE_MISSING_OK;
-	int dryrun = flags & WRITE_TREE_DRY_RUN;
-	int repair = flags & WRITE_TREE_REPAIR;
-	int to_invalidate = 0;
-	int i;
+};
 
-	assert(!(dryrun && repair));
+struct cache_tree_jobs {
+	struct cache_tree_job *job;
+	int nr, alloc;
+	int max_depth;
+};
 
-	*skip_count = 0;
+/*
+ * Find the directories under "it" that need a new tree object, and
+ * update the shape of the cache-tree to that of the index. Returns the
+ * number of index entries covered by "it".
+ */
+static int collect_one(struct cache_tree_jobs *jobs,
+		       struct cache_tree *it,
+		       struct cache_entry **cache,
+		       int entries,
+		       const char *base,
+		       int baselen,
+		       int depth,
+		       int parent)
+{
+	struct cache_tree_job *job;
+	int job_nr, nr_direct = 0;
+	int i;
 
 	/*
 	 * If the first entry of this region is a sparse directory
@@ -282,6 +324,21 @@ static int update_one(struct cache_tree *it,
 	if (0 <= it->entry_count && has_object_file(&it->oid))
 		return it->entry_count;
 
+	ALLOC_GROW(jobs->job, jobs->nr + 1, jobs->alloc);
+	job_nr = jobs->nr++;
+	job = &jobs->job[job_nr];
+	memset(job, 0, sizeof(*job));
+	job->it = it;
+	job->cache = cache;
+	job->entries = entries;
+	job->base = base;
+	job->baselen = baselen;
+	job->depth = depth;
+	job->parent = parent;
+	strbuf_init(&job->buffer, 0);
+	if (jobs->max_depth < depth)
+		jobs->max_depth = depth;
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -298,13 +355,14 @@ static int update_one(struct cache_tree *it,
 		const struct cache_entry *ce = cache[i];
 		struct cache_tree_sub *sub;
 		const char *path, *slash;
-		int pathlen, sublen, subcnt, subskip;
+		int pathlen, sublen, subcnt;
 
 		path = ce->name;
 		pathlen = ce_namelen(ce);
 		if (pathlen <= baselen || memcmp(base, path, baselen))
 			break; /* at the end of this level */
 
+		nr_direct++;
 		slash = strchr(path + baselen, '/');
 		if (!slash) {
 			i++;
@@ -319,31 +377,48 @@ static int update_one(struct cache_tree *it,
 		sub = find_subtree(it, path + baselen, sublen, 1);
 		if (!sub->cache_tree)
 			sub->cache_tree = cache_tree();
-		subcnt = update_one(sub->cache_tree,
-				    cache + i, entries - i,
-				    path,
-				    baselen + sublen + 1,
-				    &subskip,
-				    flags);
-		if (subcnt < 0)
-			return subcnt;
+		subcnt = collect_one(jobs, sub->cache_tree,
+				     cache + i, entries - i,
+				     path,
+				     baselen + sublen + 1,
+				     depth + 1,
+				     job_nr);
 		if (!subcnt)
 			die("index cache-tree records empty sub-tree");
 		i += subcnt;
-		sub->count = subcnt; /* to be used in the next loop */
-		*skip_count += subskip;
+		sub->count = subcnt; /* to be used in build_one() */
 		sub->used = 1;
 	}
 
 	discard_unused_subtrees(it);
 
-	/*
-	 * Then write out the tree object for this level.
-	 */
-	strbuf_init(&buffer, 8192);
+	/* "jobs->job" may have been reallocated by the recursion */
+	jobs->job[job_nr].count = i;
+	jobs->job[job_nr].nr_direct = nr_direct;
+	return i;
+}
+
+/*
+ * Prepare the tree object for the directory of "job", whose subtrees
+ * have all been updated already. This only reads from the object
+ * store and may run in a thread of its own.
+ */
+static void build_one(struct cache_tree_job *job, int flags)
+{
+	struct cache_tree *it = job->it;
+	struct cache_entry **cache = job->cache;
+	const char *base = job->base;
+	int baselen = job->baselen;
+	struct strbuf *buffer = &job->buffer;
+	int missing_ok = flags & WRITE_TREE_MISSING_OK;
+	int dryrun = flags & WRITE_TREE_DRY_RUN;
+	int repair = flags & WRITE_TREE_REPAIR;
+	int i;
+
+	strbuf_grow(buffer, 8192);
 
 	i = 0;
-	while (i < entries) {
+	while (i < job->entries) {
 		const struct cache_entry *ce = cache[i];
 		struct cache_tree_sub *sub = NULL;
 		const char *path, *slash;
@@ -371,7 +446,7 @@ static int update_one(struct cache_tree *it,
 			mode = S_IFDIR;
 			contains_ita = sub->cache_tree->entry_count < 0;
 			if (contains_ita) {
-				to_invalidate = 1;
+				job->to_invalidate = 1;
 				expected_missing = 1;
 			}
 		}
@@ -386,11 +461,18 @@ static int update_one(struct cache_tree *it,
 			!must_check_existence(ce);
 		if (is_null_oid(oid) ||
 		    (!ce_missing_ok && !has_object_file(oid))) {
-			strbuf_release(&buffer);
-			if (expected_missing)
-				return -1;
-			return error("invalid object %06o %s for '%.*s'",
-				mode, oid_to_hex(oid), entlen+baselen, path);
+			strbuf_release(buffer);
+			if (expected_missing) {
+				job->ret = -1;
+				return;
+			}
+			/* reported by the main thread */
+			job->ret = 1;
+			job->bad_mode = mode;
+			oidcpy(&job->bad_oid, oid);
+			job->bad_path = path;
+			job->bad_len = entlen + baselen;
+			return;
 		}
 
 		/*
@@ -399,7 +481,7 @@ static int update_one(struct cache_tree *it,
 		 * with the future on-disk index.
 		 */
 		if (ce->ce_flags & CE_REMOVE) {
-			*skip_count = *skip_count + 1;
+			job->skip_count++;
 			continue;
 		}
 
@@ -409,7 +491,7 @@ static int update_one(struct cache_tree *it,
 		 * to root to force cache-tree users to read elsewhere.
 		 */
 		if (!sub && ce_intent_to_add(ce)) {
-			to_invalidate = 1;
+			job->to_invalidate = 1;
 			continue;
 		}
 
@@ -419,9 +501,9 @@ static int update_one(struct cache_tree *it,
 		if (contains_ita && is_empty_tree_oid(oid))
 			continue;
 
-		strbuf_grow(&buffer, entlen + 100);
-		strbuf_addf(&buffer, "%o %.*s%c", mode, entlen, path + baselen, '\0');
-		strbuf_add(&buffer, oid->hash, the_hash_algo->rawsz);
+		strbuf_grow(buffer, entlen + 100);
+		strbuf_addf(buffer, "%o %.*s%c", mode, entlen, path + baselen, '\0');
+		strbuf_add(buffer, oid->hash, the_hash_algo->rawsz);
 
 #if DEBUG_CACHE_TREE
 		fprintf(stderr, "cache-tree update-one %o %.*s\n",
@@ -431,34 +513,174 @@ static int update_one(struct cache_tree *it,
 
 	if (repair) {
 		struct object_id oid;
-		hash_object_file(the_hash_algo, buffer.buf, buffer.len,
+		hash_object_file(the_hash_algo, buffer->buf, buffer->len,
 				 tree_type, &oid);
 		if (has_object_file_with_flags(&oid, OBJECT_INFO_SKIP_FETCH_OBJECT))
 			oidcpy(&it->oid, &oid);
 		else
-			to_invalidate = 1;
+			job->to_invalidate = 1;
 	} else if (dryrun) {
-		hash_object_file(the_hash_algo, buffer.buf, buffer.len,
+		hash_object_file(the_hash_algo, buffer->buf, buffer->len,
 				 tree_type, &it->oid);
-	} else if (write_object_file(buffer.buf, buffer.len, tree_type,
-				     &it->oid)) {
-		strbuf_release(&buffer);
-		return -1;
 	}
+}
+
+/*
+ * Write out the tree object prepared by build_one(), and account for
+ * it in the parent directory.
+ */
+static int finish_one(struct cache_tree_jobs *jobs,
+		      struct cache_tree_job *job, int flags)
+{
+	struct cache_tree *it = job->it;
+
+	if (job->ret < 0)
+		return -1;
+	if (job->ret)
+		return error("invalid object %06o %s for '%.*s'",
+			     job->bad_mode, oid_to_hex(&job->bad_oid),
+			     job->bad_len, job->bad_path);
+
+	if (!(flags & (WRITE_TREE_DRY_RUN | WRITE_TREE_REPAIR)) &&
+	    write_object_file(job->buffer.buf, job->buffer.len, tree_type,
+			      &it->oid))
+		return -1;
 
-	strbuf_release(&buffer);
-	it->entry_count = to_invalidate ? -1 : i - *skip_count;
+	strbuf_release(&job->buffer);
+	it->entry_count = job->to_invalidate ? -1 : job->count - job->skip_count;
+	if (job->parent >= 0)
+		jobs->job[job->parent].skip_count += job->skip_count;
 #if DEBUG_CACHE_TREE
 	fprintf(stderr, "cache-tree update-one (%d ent, %d subtree) %s\n",
 		it->entry_count, it->subtree_nr,
 		oid_to_hex(&it->oid));
 #endif
-	return i;
+	return 0;
+}
+
+/* directory entries to check before another thread is worth it */
+#define CACHE_TREE_THREAD_COST 1000
+
+struct build_level {
+	struct cache_tree_job **job;
+	int nr;
+	int next;
+	int flags;
+	pthread_mutex_t mutex;
+};
+
+static void *build_level_thread(void *data)
+{
+	struct build_level *level = data;
+
+	trace2_thread_start("cache_tree");
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&level->mutex);
+		i = level->next++;
+		pthread_mutex_unlock(&level->mutex);
+		if (i >= level->nr)
+			break;
+		build_one(level->job[i], level->flags);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void build_level(struct build_level *level, int nr_threads)
+{
+	pthread_t *threads;
+	int i;
+
+	if (nr_threads < 2) {
+		for (i = 0; i < level->nr; i++)
+			build_one(level->job[i], level->flags);
+		return;
+	}
+
+	ALLOC_ARRAY(threads, nr_threads);
+	level->next = 0;
+	pthread_mutex_init(&level->mutex, NULL);
+	enable_obj_read_lock();
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 build_level_thread, level);
+		if (err)
+			die(_("unable to create cache-tree thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&level->mutex);
+	free(threads);
+}
+
+static int update_one(struct cache_tree *it,
+		      struct cache_entry **cache,
+		      int entries,
+		      int flags)
+{
+	struct cache_tree_jobs jobs = { 0 };
+	struct build_level level = { 0 };
+	int nr_threads, max_threads = 0;
+	int depth, i, ret = 0;
+
+	assert(!((flags & WRITE_TREE_DRY_RUN) && (flags & WRITE_TREE_REPAIR)));
+
+	collect_one(&jobs, it, cache, entries, "", 0, 0, -1);
+	if (!jobs.nr)
+		return 0;
+
+	/*
+	 * index.threads gives the number of threads to use, or 0 to
+	 * go by the size of each level.
+	 */
+	if (!HAVE_THREADS || git_config_get_index_threads(&max_threads))
+		max_threads = 1;
+	if (max_threads != 1) {
+		/* set up the lazily initialized state before threading */
+		has_promisor_remote();
+	}
+
+	level.flags = flags;
+	ALLOC_ARRAY(level.job, jobs.nr);
+	for (depth = jobs.max_depth; depth >= 0 && !ret; depth--) {
+		int nr_direct = 0;
+
+		level.nr = 0;
+		for (i = 0; i < jobs.nr; i++) {
+			if (jobs.job[i].depth != depth)
+				continue;
+			level.job[level.nr++] = &jobs.job[i];
+			nr_direct += jobs.job[i].nr_direct;
+		}
+
+		if (max_threads)
+			nr_threads = max_threads;
+		else
+			nr_threads = nr_direct / CACHE_TREE_THREAD_COST;
+		if (nr_threads > level.nr)
+			nr_threads = level.nr;
+		if (!max_threads && nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		build_level(&level, nr_threads);
+
+		for (i = 0; i < level.nr && !ret; i++)
+			ret = finish_one(&jobs, level.job[i], flags);
+	}
+
+	for (i = 0; i < jobs.nr; i++)
+		strbuf_release(&jobs.job[i].buffer);
+	free(jobs.job);
+	free(level.job);
+	return ret;
 }
 
 int cache_tree_update(struct index_state *istate, int flags)
 {
-	int skip, i;
+	int i;
 
 	i = verify_cache(istate, flags);
 
@@ -474,7 +696,7 @@ int cache_tree_update(struct index_state *istate, int flags)
 	trace_performance_enter();
 	trace2_region_enter("cache_tree", "update", the_repository);
 	i = update_one(istate->cache_tree, istate->cache, istate->cache_nr,
-		       "", 0, &skip, flags);
+		       flags);
 	trace2_region_leave("cache_tree", "update", the_repository);
 	trace_performance_leave("cache_tree_update");
 	if (i < 0)
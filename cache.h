@@ -43,6 +43,24 @@ int git_deflate_end_gently(git_zstream *);
 int git_deflate(git_zstream *, int flush);
 unsigned long git_deflate_bound(git_zstream *, unsigned long);
 
+/*
+ * Inflate a complete zlib stream that is known to produce exactly
+ * "outlen" bytes from "in" into "out" in one go.  "in" may extend past
+ * the end of the stream.  This is much faster than git_inflate() when
+ * Git is built with USE_LIBDEFLATE; otherwise HAVE_INFLATE_BUFFER is 0
+ * and this always fails.  Returns 0 on success, and -1 on any failure
+ * (including corrupt data and short input), in which case the caller
+ * should retry with git_inflate(), which can also report what went
+ * wrong.
+ */
+#ifdef USE_LIBDEFLATE
+#define HAVE_INFLATE_BUFFER 1
+#else
+#define HAVE_INFLATE_BUFFER 0
+#endif
+int git_inflate_buffer(void *out, unsigned long outlen,
+		       const void *in, unsigned long inlen);
+
 #if defined(DT_UNKNOWN) && !defined(NO_D_TYPE_IN_DIRENT)
 #define DTYPE(de)	((de)->d_type)
 #else
@@ -331,7 +349,14 @@ struct index_state {
 		  * entries exist. Requires sparse-checkout
 		  * in cone mode.
 		  */
-		 sparse_index : 1;
+		 sparse_index : 1,
+
+		 /*
+		  * partially_read == 1 when only the entries below
+		  * some prefix were read (see read_index_prefix_from()).
+		  * Such an index must not be written out.
+		  */
+		 partially_read : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	struct object_id oid;
@@ -747,6 +772,17 @@ int do_read_index(struct index_state *istate, const char *path,
 		  int must_exist); /* for testting only! */
 int read_index_from(struct index_state *, const char *path,
 		    const char *gitdir);
+
+/*
+ * Read only the entries whose names start with "prefix", skipping over
+ * the others without decoding them, and none of the extensions. This
+ * is cheapest when the index has an offset table and an end of index
+ * entries extension (see "index.threads"). Returns -1 if the index
+ * cannot be read this way (e.g. because it is a split or a sparse
+ * index), in which case the caller should read it in full instead.
+ */
+int read_index_prefix_from(struct index_state *, const char *path,
+			   const char *prefix, size_t prefix_len);
 int is_index_unborn(struct index_state *);
 
 void ensure_full_index(struct index_state *istate);
@@ -865,6 +901,7 @@ int chmod_index_entry(struct index_state *, struct cache_entry *ce, char flip);
 int ce_same_name(const struct cache_entry *a, const struct cache_entry *b);
 void set_object_name_for_intent_to_add_entry(struct cache_entry *ce);
 int index_name_is_other(struct index_state *, const char *, int);
+const struct object_id *blob_oid_from_index(struct index_state *, const char *);
 void *read_blob_data_from_index(struct index_state *, const char *, unsigned long *);
 
 /* do stat comparison even if CE_VALID is true */
@@ -962,7 +999,10 @@ extern int core_compression_level;
 extern int pack_compression_level;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
+extern int packed_git_map_whole;
+extern int commit_slab_huge_pages;
 extern size_t delta_base_cache_limit;
+extern size_t tree_diff_cache_limit;
 extern unsigned long big_file_threshold;
 extern unsigned long pack_size_limit_cfg;
 
@@ -985,12 +1025,20 @@ void reset_shared_repository(void);
 extern int read_replace_refs;
 extern char *git_replace_ref_base;
 
-extern int fsync_object_files;
+enum fsync_object_files_mode {
+	FSYNC_OBJECT_FILES_OFF,
+	FSYNC_OBJECT_FILES_ON,
+	FSYNC_OBJECT_FILES_BATCH
+};
+extern enum fsync_object_files_mode fsync_object_files;
+extern enum fsync_object_files_mode fsync_ref_files;
+extern int core_loose_object_journal;
 extern int core_preload_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
 extern const char *core_fsmonitor;
+extern int core_use_builtin_fsmonitor;
 
 extern int core_apply_sparse_checkout;
 extern int core_sparse_checkout_cone;
@@ -1062,6 +1110,7 @@ extern int grafts_replace_parents;
 #define GIT_REPO_VERSION_READ 1
 extern int repository_format_precious_objects;
 extern int repository_format_worktree_config;
+extern int repository_format_packed_refs_delta;
 
 /*
  * You _have_ to initialize a `struct repository_format` using
@@ -1072,6 +1121,7 @@ struct repository_format {
 	int precious_objects;
 	char *partial_clone; /* value of extensions.partialclone */
 	int worktree_config;
+	int packed_refs_delta;
 	int is_bare;
 	int hash_algo;
 	int sparse_index;
@@ -1672,6 +1722,7 @@ int has_symlink_leading_path(const char *name, int len);
 int threaded_has_symlink_leading_path(struct cache_def *, const char *, int);
 int check_leading_path(const char *name, int len, int warn_on_lstat_err);
 int has_dirs_only_path(const char *name, int len, int prefix_len);
+int threaded_has_dirs_only_path(struct cache_def *, const char *name, int len, int prefix_len);
 void invalidate_lstat_cache(void);
 void schedule_dir_for_removal(const char *name, int len);
 void remove_scheduled_dirs(void);
@@ -1745,11 +1796,23 @@ int copy_fd(int ifd, int ofd);
 int copy_file(const char *dst, const char *src, int mode);
 int copy_file_with_time(const char *dst, const char *src, int mode);
 
+/*
+ * Make "ofd" (or "dst", created like copy_file_with_time() does) a
+ * copy-on-write clone of "ifd" ("src") that shares its blocks until
+ * either is modified.  Returns -1 with errno set when the filesystem
+ * cannot, e.g. ENOTSUP, EOPNOTSUPP or EXDEV, in which case "dst" is
+ * not left behind.
+ */
+int clone_fd(int ifd, int ofd);
+int reflink_file_with_time(const char *dst, const char *src, int mode);
+
 void write_or_die(int fd, const void *buf, size_t count);
 void fsync_or_die(int fd, const char *);
 
 ssize_t read_in_full(int fd, void *buf, size_t count);
 ssize_t write_in_full(int fd, const void *buf, size_t count);
+/* Like write_in_full(), but consumes the entries of "iov" as it goes. */
+ssize_t writev_in_full(int fd, struct iovec *iov, int iovcnt);
 ssize_t pread_in_full(int fd, void *buf, size_t count, off_t offset);
 
 static inline ssize_t write_str_in_full(int fd, const char *str)
@@ -12,6 +12,8 @@
 #include "userdiff.h"
 #include "oid-array.h"
 #include "revision.h"
+#include "promisor-remote.h"
+#include "thread-utils.h"
 
 static int compare_paths(const struct combine_diff_path *one,
 			  const struct diff_filespec *two)
@@ -319,7 +321,10 @@ static char *grab_blob(struct repository *r,
 
 	if (S_ISGITLINK(mode)) {
 		struct strbuf buf = STRBUF_INIT;
-		strbuf_addf(&buf, "Subproject commit %s\n", oid_to_hex(oid));
+		char hex[GIT_MAX_HEXSZ + 1];
+		/* not oid_to_hex(), this may run in several threads */
+		strbuf_addf(&buf, "Subproject commit %s\n",
+			    oid_to_hex_r(hex, oid));
 		*size = buf.len;
 		blob = strbuf_detach(&buf, NULL);
 	} else if (is_null_oid(oid)) {
@@ -420,27 +425,17 @@ static int consume_line(void *state_, char *line, unsigned long len)
 	return 0;
 }
 
-static void combine_diff(struct repository *r,
-			 const struct object_id *parent, unsigned int mode,
-			 mmfile_t *result_file,
+static void combine_diff(const struct object_id *parent,
+			 mmfile_t *parent_file, mmfile_t *result_file,
 			 struct sline *sline, unsigned int cnt, int n,
-			 int num_parent, int result_deleted,
-			 struct userdiff_driver *textconv,
-			 const char *path, long flags)
+			 int num_parent, long flags)
 {
 	unsigned int p_lno, lno;
 	unsigned long nmask = (1UL << n);
 	xpparam_t xpp;
 	xdemitconf_t xecfg;
-	mmfile_t parent_file;
 	struct combine_diff_state state;
-	unsigned long sz;
 
-	if (result_deleted)
-		return; /* result deleted */
-
-	parent_file.ptr = grab_blob(r, parent, mode, &sz, textconv, path);
-	parent_file.size = sz;
 	memset(&xpp, 0, sizeof(xpp));
 	xpp.flags = flags;
 	memset(&xecfg, 0, sizeof(xecfg));
@@ -451,11 +446,10 @@ static void combine_diff(struct repository *r,
 	state.num_parent = num_parent;
 	state.n = n;
 
-	if (xdi_diff_outf(&parent_file, result_file, consume_hunk,
+	if (xdi_diff_outf(parent_file, result_file, consume_hunk,
 			  consume_line, &state, &xpp, &xecfg))
 		die("unable to generate combined diff for %s",
 		    oid_to_hex(parent));
-	free(parent_file.ptr);
 
 	/* Assign line numbers for this parent.
 	 *
@@ -1012,35 +1006,54 @@ static void show_combined_header(struct combine_diff_path *elem,
 				 line_prefix, c_meta, c_reset);
 }
 
-static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
-			    int working_tree_file,
-			    struct rev_info *rev)
-{
-	struct diff_options *opt = &rev->diffopt;
-	unsigned long result_size, cnt, lno;
-	int result_deleted = 0;
-	char *result, *cp;
-	struct sline *sline; /* survived lines */
-	int mode_differs = 0;
-	int i, show_hunks;
-	mmfile_t result_file;
+/*
+ * The combined patch of a path is looked up and read (prepare), then
+ * computed (compute) and finally shown (emit). Only the computation may
+ * be done by another thread, and only for a patch without a textconv
+ * filter: it merely reads blobs and runs xdiff.
+ */
+struct combine_patch {
+	struct combine_diff_path *elem;
 	struct userdiff_driver *userdiff;
-	struct userdiff_driver *textconv = NULL;
+	struct userdiff_driver *textconv;
+	char *result;
+	unsigned long result_size;
+	int result_deleted;
+	int mode_differs;
 	int is_binary;
-	const char *line_prefix = diff_line_prefix(opt);
+	int show_hunks;
+	unsigned long cnt;
+	struct sline *sline;
+	mmfile_t *parent_file;
+};
+
+/*
+ * Find the diff driver of the path and, for diff-files and diff-index,
+ * read the result from the working tree. Returns -1 if the path cannot
+ * be shown.
+ */
+static int prepare_combined_patch(struct combine_patch *patch,
+				  struct combine_diff_path *elem,
+				  int num_parent, int working_tree_file,
+				  struct rev_info *rev)
+{
+	struct diff_options *opt = &rev->diffopt;
+	char *result;
+	unsigned long result_size;
+
+	memset(patch, 0, sizeof(*patch));
+	patch->elem = elem;
 
 	context = opt->context;
-	userdiff = userdiff_find_by_path(opt->repo->index, elem->path);
-	if (!userdiff)
-		userdiff = userdiff_find_by_name("default");
+	patch->userdiff = userdiff_find_by_path(opt->repo->index, elem->path);
+	if (!patch->userdiff)
+		patch->userdiff = userdiff_find_by_name("default");
 	if (opt->flags.allow_textconv)
-		textconv = userdiff_get_textconv(opt->repo, userdiff);
+		patch->textconv = userdiff_get_textconv(opt->repo,
+							patch->userdiff);
 
-	/* Read the result of merge first */
-	if (!working_tree_file)
-		result = grab_blob(opt->repo, &elem->oid, elem->mode, &result_size,
-				   textconv, elem->path);
-	else {
+	/* Otherwise the result of merge is read by compute_combined_patch() */
+	if (working_tree_file) {
 		/* Used by diff-tree to read from the working tree */
 		struct stat st;
 		int fd = -1;
@@ -1051,10 +1064,8 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 		if (S_ISLNK(st.st_mode)) {
 			struct strbuf buf = STRBUF_INIT;
 
-			if (strbuf_readlink(&buf, elem->path, st.st_size) < 0) {
-				error_errno("readlink(%s)", elem->path);
-				return;
-			}
+			if (strbuf_readlink(&buf, elem->path, st.st_size) < 0)
+				return error_errno("readlink(%s)", elem->path);
 			result_size = buf.len;
 			result = strbuf_detach(&buf, NULL);
 			elem->mode = canon_mode(st.st_mode);
@@ -1067,10 +1078,11 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 			else
 				result = grab_blob(opt->repo, &oid, elem->mode,
 						   &result_size, NULL, NULL);
-		} else if (textconv) {
+		} else if (patch->textconv) {
 			struct diff_filespec *df = alloc_filespec(elem->path);
 			fill_filespec(df, null_oid(), 0, st.st_mode);
-			result_size = fill_textconv(opt->repo, textconv, df, &result);
+			result_size = fill_textconv(opt->repo, patch->textconv,
+						    df, &result);
 			free_filespec(df);
 		} else if (0 <= (fd = open(elem->path, O_RDONLY))) {
 			size_t len = xsize_t(st.st_size);
@@ -1110,7 +1122,7 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 		}
 		else {
 		deleted_file:
-			result_deleted = 1;
+			patch->result_deleted = 1;
 			result_size = 0;
 			elem->mode = 0;
 			result = xcalloc(1, 1);
@@ -1118,40 +1130,75 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 
 		if (0 <= fd)
 			close(fd);
+
+		patch->result = result;
+		patch->result_size = result_size;
 	}
+	return 0;
+}
+
+/*
+ * Read the blob of parent i, once: the same blob serves to tell whether
+ * the path is binary and to diff against.
+ */
+static mmfile_t *grab_parent_blob(struct repository *r,
+				  struct combine_patch *patch, int i)
+{
+	struct combine_diff_path *elem = patch->elem;
+	mmfile_t *file = &patch->parent_file[i];
+	unsigned long size;
+
+	if (!file->ptr) {
+		file->ptr = grab_blob(r, &elem->parent[i].oid,
+				      elem->parent[i].mode, &size,
+				      patch->textconv, elem->path);
+		file->size = size;
+	}
+	return file;
+}
+
+static void compute_combined_patch(struct combine_patch *patch,
+				   int num_parent, int working_tree_file,
+				   struct rev_info *rev)
+{
+	struct diff_options *opt = &rev->diffopt;
+	struct combine_diff_path *elem = patch->elem;
+	unsigned long result_size, cnt, lno;
+	char *result, *cp;
+	struct sline *sline; /* survived lines */
+	mmfile_t result_file;
+	int i;
+
+	/* Read the result of merge first */
+	if (!working_tree_file)
+		patch->result = grab_blob(opt->repo, &elem->oid, elem->mode,
+					  &patch->result_size, patch->textconv,
+					  elem->path);
+	result = patch->result;
+	result_size = patch->result_size;
+	CALLOC_ARRAY(patch->parent_file, num_parent);
 
 	for (i = 0; i < num_parent; i++) {
 		if (elem->parent[i].mode != elem->mode) {
-			mode_differs = 1;
+			patch->mode_differs = 1;
 			break;
 		}
 	}
 
-	if (textconv)
-		is_binary = 0;
-	else if (userdiff->binary != -1)
-		is_binary = userdiff->binary;
+	if (patch->textconv)
+		patch->is_binary = 0;
+	else if (patch->userdiff->binary != -1)
+		patch->is_binary = patch->userdiff->binary;
 	else {
-		is_binary = buffer_is_binary(result, result_size);
-		for (i = 0; !is_binary && i < num_parent; i++) {
-			char *buf;
-			unsigned long size;
-			buf = grab_blob(opt->repo,
-					&elem->parent[i].oid,
-					elem->parent[i].mode,
-					&size, NULL, NULL);
-			if (buffer_is_binary(buf, size))
-				is_binary = 1;
-			free(buf);
+		patch->is_binary = buffer_is_binary(result, result_size);
+		for (i = 0; !patch->is_binary && i < num_parent; i++) {
+			mmfile_t *file = grab_parent_blob(opt->repo, patch, i);
+			if (buffer_is_binary(file->ptr, file->size))
+				patch->is_binary = 1;
 		}
 	}
-	if (is_binary) {
-		show_combined_header(elem, num_parent, rev,
-				     line_prefix, mode_differs, 0);
-		printf("Binary files differ\n");
-		free(result);
-		return;
-	}
+	if (patch->is_binary)
+		goto out;
 
 	for (cnt = 0, cp = result; cp < result + result_size; cp++) {
 		if (*cp == '\n')
@@ -1192,26 +1239,51 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 				break;
 			}
 		}
-		if (i <= j)
-			combine_diff(opt->repo,
-				     &elem->parent[i].oid,
-				     elem->parent[i].mode,
+		if (i <= j && !patch->result_deleted)
+			combine_diff(&elem->parent[i].oid,
+				     grab_parent_blob(opt->repo, patch, i),
 				     &result_file, sline,
-				     cnt, i, num_parent, result_deleted,
-				     textconv, elem->path, opt->xdl_opts);
+				     cnt, i, num_parent, opt->xdl_opts);
+		FREE_AND_NULL(patch->parent_file[i].ptr);
 	}
 
-	show_hunks = make_hunks(sline, cnt, num_parent, rev->dense_combined_merges);
+	patch->show_hunks = make_hunks(sline, cnt, num_parent,
+				       rev->dense_combined_merges);
+	patch->sline = sline;
+	patch->cnt = cnt;
 
-	if (show_hunks || mode_differs || working_tree_file) {
-		show_combined_header(elem, num_parent, rev,
-				     line_prefix, mode_differs, 1);
-		dump_sline(sline, line_prefix, cnt, num_parent,
-			   opt->use_color, result_deleted);
+out:
+	for (i = 0; i < num_parent; i++)
+		free(patch->parent_file[i].ptr);
+	FREE_AND_NULL(patch->parent_file);
+}
+
+static void emit_combined_patch(struct combine_patch *patch,
+				int num_parent, int working_tree_file,
+				struct rev_info *rev)
+{
+	struct diff_options *opt = &rev->diffopt;
+	const char *line_prefix = diff_line_prefix(opt);
+	struct sline *sline = patch->sline;
+	unsigned long lno;
+
+	if (patch->is_binary) {
+		show_combined_header(patch->elem, num_parent, rev,
+				     line_prefix, patch->mode_differs, 0);
+		printf("Binary files differ\n");
+		free(patch->result);
+		return;
+	}
+
+	if (patch->show_hunks || patch->mode_differs || working_tree_file) {
+		show_combined_header(patch->elem, num_parent, rev,
+				     line_prefix, patch->mode_differs, 1);
+		dump_sline(sline, line_prefix, patch->cnt, num_parent,
+			   opt->use_color, patch->result_deleted);
 	}
-	free(result);
+	free(patch->result);
 
-	for (lno = 0; lno < cnt; lno++) {
+	for (lno = 0; lno < patch->cnt; lno++) {
 		if (sline[lno].lost) {
 			struct lline *ll = sline[lno].lost;
 			while (ll) {
@@ -1225,6 +1297,118 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	free(sline);
 }
 
+static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
+			    int working_tree_file,
+			    struct rev_info *rev)
+{
+	struct combine_patch patch;
+
+	if (prepare_combined_patch(&patch, elem, num_parent,
+				   working_tree_file, rev))
+		return;
+	compute_combined_patch(&patch, num_parent, working_tree_file, rev);
+	emit_combined_patch(&patch, num_parent, working_tree_file, rev);
+}
+
+struct combine_patch_work {
+	struct rev_info *rev;
+	int num_parent;
+	struct combine_patch *patch;
+	int nr, next;
+	pthread_mutex_t mutex;
+};
+
+/* paths whose combined patches are computed ahead of their output */
+#define COMBINE_PATCH_WINDOW 256
+
+static void *combine_patch_thread(void *data)
+{
+	struct combine_patch_work *work = data;
+
+	trace2_thread_start("combine-diff");
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&work->mutex);
+		i = work->next++;
+		pthread_mutex_unlock(&work->mutex);
+		if (i >= work->nr)
+			break;
+		if (!work->patch[i].textconv)
+			compute_combined_patch(&work->patch[i],
+					       work->num_parent, 0, work->rev);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void compute_combined_patches(struct combine_patch_work *work,
+				     int nr_threads)
+{
+	pthread_t *threads;
+	int i;
+
+	if (nr_threads > work->nr)
+		nr_threads = work->nr;
+	ALLOC_ARRAY(threads, nr_threads);
+	work->next = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 combine_patch_thread, work);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	/* textconv filters are run by this thread alone */
+	for (i = 0; i < work->nr; i++)
+		if (work->patch[i].textconv)
+			compute_combined_patch(&work->patch[i],
+					       work->num_parent, 0, work->rev);
+}
+
+/*
+ * Show the combined patches of paths like show_patch_diff() does, but
+ * have nr_threads threads compute them, in windows of paths shown in
+ * order by this thread.
+ */
+static void show_patch_diffs_parallel(struct combine_diff_path *paths,
+				      int num_parent, struct rev_info *rev,
+				      int nr_threads)
+{
+	struct repository *r = rev->diffopt.repo;
+	struct combine_patch_work work = { 0 };
+	struct combine_diff_path *p = paths;
+	int i;
+
+	work.rev = rev;
+	work.num_parent = num_parent;
+	ALLOC_ARRAY(work.patch, COMBINE_PATCH_WINDOW);
+	pthread_mutex_init(&work.mutex, NULL);
+	/* initialize it before threads may need to fetch missing blobs */
+	has_promisor_remote();
+	enable_obj_read_lock();
+	trace2_region_enter("diff", "combined-patch-threads", r);
+	trace2_data_intmax("diff", r, "combined-patch-threads", nr_threads);
+
+	while (p) {
+		for (work.nr = 0; p && work.nr < COMBINE_PATCH_WINDOW; p = p->next)
+			if (!prepare_combined_patch(&work.patch[work.nr], p,
+						    num_parent, 0, rev))
+				work.nr++;
+		compute_combined_patches(&work, nr_threads);
+		for (i = 0; i < work.nr; i++)
+			emit_combined_patch(&work.patch[i], num_parent, 0, rev);
+	}
+
+	trace2_region_leave("diff", "combined-patch-threads", r);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&work.mutex);
+	free(work.patch);
+}
+
 static void show_raw_diff(struct combine_diff_path *p, int num_parent, struct rev_info *rev)
 {
 	struct diff_options *opt = &rev->diffopt;
@@ -1496,7 +1680,7 @@ void diff_tree_combined(const struct object_id *oid,
 	struct diff_options diffopts;
 	struct combine_diff_path *p, *paths;
 	int i, num_paths, needsep, show_log_first, num_parent = parents->nr;
-	int need_generic_pathscan;
+	int need_generic_pathscan, nr_threads;
 
 	/* nothing to do, if no parents */
 	if (!num_parent)
@@ -1618,8 +1802,13 @@ void diff_tree_combined(const struct object_id *oid,
 			if (needsep)
 				printf("%s%c", diff_line_prefix(opt),
 				       opt->line_termination);
-			for (p = paths; p; p = p->next)
-				show_patch_diff(p, num_parent, 0, rev);
+			nr_threads = diff_patch_threads(opt->repo, num_paths);
+			if (nr_threads > 1)
+				show_patch_diffs_parallel(paths, num_parent,
+							  rev, nr_threads);
+			else
+				for (p = paths; p; p = p->next)
+					show_patch_diff(p, num_parent, 0, rev);
 		}
 	}
 
@@ -20,6 +20,9 @@
 #include "json-writer.h"
 #include "trace2.h"
 #include "chunk-format.h"
+#include "thread-utils.h"
+#include "strmap.h"
+#include "pretty.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -44,7 +47,11 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_BLOOMMERGEINDEXES 0x424d4958 /* "BMIX" */
+#define GRAPH_CHUNKID_BLOOMMERGEDATA 0x424d4454 /* "BMDT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define GRAPH_CHUNKID_COMMITMETADATA 0x434d4554 /* "CMET" */
+#define GRAPH_CHUNKID_COMMITSTRINGS 0x43535452 /* "CSTR" */
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
 
@@ -57,6 +64,9 @@ void git_test_write_commit_graph_or_die(void)
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define GRAPH_METADATA_WIDTH 36
+#define GRAPH_METADATA_NONE 0xffffffff
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * CHUNK_TOC_ENTRY_SIZE \
@@ -333,6 +343,30 @@ static int graph_read_bloom_data(const unsigned char *chunk_start,
 	return 0;
 }
 
+static int graph_read_commit_metadata(const unsigned char *chunk_start,
+				      size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+
+	if (chunk_size != st_mult(g->num_commits, GRAPH_METADATA_WIDTH))
+		return 0;
+	g->chunk_commit_metadata = chunk_start;
+	return 0;
+}
+
+static int graph_read_commit_strings(const unsigned char *chunk_start,
+				     size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+
+	/* all strings must be terminated inside the chunk */
+	if (!chunk_size || chunk_start[chunk_size - 1])
+		return 0;
+	g->chunk_commit_strings = chunk_start;
+	g->commit_strings_size = chunk_size;
+	return 0;
+}
+
 struct commit_graph *parse_commit_graph(struct repository *r,
 					void *graph_map, size_t graph_size)
 {
@@ -414,6 +448,19 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 			   &graph->chunk_bloom_indexes);
 		read_chunk(cf, GRAPH_CHUNKID_BLOOMDATA,
 			   graph_read_bloom_data, graph);
+		pair_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEINDEXES,
+			   &graph->chunk_bloom_merge_indexes);
+		pair_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEDATA,
+			   &graph->chunk_bloom_merge_data);
+	}
+
+	read_chunk(cf, GRAPH_CHUNKID_COMMITMETADATA,
+		   graph_read_commit_metadata, graph);
+	read_chunk(cf, GRAPH_CHUNKID_COMMITSTRINGS,
+		   graph_read_commit_strings, graph);
+	if (!graph->chunk_commit_metadata || !graph->chunk_commit_strings) {
+		graph->chunk_commit_metadata = NULL;
+		graph->chunk_commit_strings = NULL;
 	}
 
 	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data) {
@@ -425,6 +472,13 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 		FREE_AND_NULL(graph->bloom_filter_settings);
 	}
 
+	/* The merge filters use the settings of the other Bloom chunks. */
+	if (!graph->chunk_bloom_data || !graph->chunk_bloom_merge_indexes ||
+	    !graph->chunk_bloom_merge_data) {
+		graph->chunk_bloom_merge_indexes = NULL;
+		graph->chunk_bloom_merge_data = NULL;
+	}
+
 	oidread(&graph->oid, graph->data + graph->data_len - graph->hash_len);
 
 	if (verify_commit_graph_lite(graph))
@@ -723,7 +777,7 @@ void close_commit_graph(struct raw_object_store *o)
 	o->commit_graph = NULL;
 }
 
-static int bsearch_graph(struct commit_graph *g, struct object_id *oid, uint32_t *pos)
+static int bsearch_graph(struct commit_graph *g, const struct object_id *oid, uint32_t *pos)
 {
 	return bsearch_hash(oid->hash, g->chunk_oid_fanout,
 			    g->chunk_oid_lookup, g->hash_len, pos);
@@ -916,6 +970,32 @@ int parse_commit_in_graph(struct repository *r, struct commit *item)
 	return parse_commit_in_graph_one(r, r->objects->commit_graph, item);
 }
 
+struct commit *lookup_commit_in_graph(struct repository *r,
+				      const struct object_id *oid)
+{
+	struct commit_graph *g;
+	struct commit *commit;
+	uint32_t lex_index;
+
+	if (!prepare_commit_graph(r))
+		return NULL;
+
+	for (g = r->objects->commit_graph; g; g = g->base_graph)
+		if (bsearch_graph(g, oid, &lex_index))
+			break;
+	if (!g || !repo_has_object_file(r, oid))
+		return NULL;
+
+	commit = lookup_commit(r, oid);
+	if (!commit)
+		return NULL;
+	if (!commit->object.parsed &&
+	    !fill_commit_in_graph(r, commit, r->objects->commit_graph,
+				  lex_index + g->num_commits_in_base))
+		return NULL;
+	return commit;
+}
+
 void load_commit_graph_info(struct repository *r, struct commit *item)
 {
 	uint32_t pos;
@@ -962,6 +1042,46 @@ struct tree *get_commit_tree_in_graph(struct repository *r, const struct commit
 	return get_commit_tree_in_graph_one(r, r->objects->commit_graph, c);
 }
 
+int commit_graph_metadata(struct repository *r, const struct commit *c,
+			  struct commit_graph_metadata *md)
+{
+	struct commit_graph *g;
+	const unsigned char *record;
+	const char *strings;
+	uint32_t pos, off[3];
+	int i;
+
+	if (!prepare_commit_graph(r) ||
+	    !find_commit_in_graph((struct commit *)c, r->objects->commit_graph, &pos))
+		return -1;
+
+	g = r->objects->commit_graph;
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g->chunk_commit_metadata ||
+	    pos >= g->num_commits + g->num_commits_in_base)
+		return -1;
+
+	record = g->chunk_commit_metadata +
+		 GRAPH_METADATA_WIDTH * (pos - g->num_commits_in_base);
+	off[0] = get_be32(record);
+	off[1] = get_be32(record + 16);
+	off[2] = get_be32(record + 32);
+	for (i = 0; i < ARRAY_SIZE(off); i++)
+		if (off[i] >= g->commit_strings_size)
+			return -1; /* includes GRAPH_METADATA_NONE */
+
+	strings = (const char *)g->chunk_commit_strings;
+	md->author = strings + off[0];
+	md->author_date = get_be64(record + 4);
+	md->author_tz = (int32_t)get_be32(record + 12);
+	md->committer = strings + off[1];
+	md->committer_date = get_be64(record + 20);
+	md->committer_tz = (int32_t)get_be32(record + 28);
+	md->subject = strings + off[2];
+	return 0;
+}
+
 struct packed_commit_list {
 	struct commit **list;
 	size_t nr;
@@ -994,19 +1114,27 @@ struct write_commit_graph_context {
 		 report_progress:1,
 		 split:1,
 		 changed_paths:1,
+		 merge_changed_paths:1,
 		 order_by_pack:1,
+		 commit_metadata:1,
 		 write_generation_data:1,
 		 trust_generation_numbers:1;
 
 	struct topo_level_slab *topo_levels;
 	const struct commit_graph_opts *opts;
 	size_t total_bloom_filter_data_size;
+	size_t total_merge_bloom_filter_data_size;
 	const struct bloom_filter_settings *bloom_settings;
 
 	int count_bloom_filter_computed;
 	int count_bloom_filter_not_computed;
 	int count_bloom_filter_trunc_empty;
 	int count_bloom_filter_trunc_large;
+	int count_merge_bloom_filter_computed;
+
+	unsigned char *commit_metadata_records;
+	struct strbuf commit_strings;
+	struct strintmap commit_string_pos;
 };
 
 static int write_graph_chunk_fanout(struct hashfile *f,
@@ -1319,6 +1447,204 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_bloom_merge_indexes(struct hashfile *f,
+						 void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+	uint32_t cur_pos = 0;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_merge_bloom_filter(ctx->r, *list);
+		size_t len = filter ? filter->len : 0;
+		cur_pos += len;
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_bloom_merge_data(struct hashfile *f,
+					      void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_merge_bloom_filter(ctx->r, *list);
+		size_t len = filter ? filter->len : 0;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		if (len)
+			hashwrite(f, filter->data, len * sizeof(unsigned char));
+		list++;
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_commit_metadata(struct hashfile *f,
+					     void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+
+	hashwrite(f, ctx->commit_metadata_records,
+		  st_mult(GRAPH_METADATA_WIDTH, ctx->commits.nr));
+	return 0;
+}
+
+static int write_graph_chunk_commit_strings(struct hashfile *f,
+					    void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+
+	hashwrite(f, ctx->commit_strings.buf, ctx->commit_strings.len);
+	return 0;
+}
+
+static uint32_t add_commit_string(struct write_commit_graph_context *ctx,
+				  const char *str)
+{
+	int pos = strintmap_get(&ctx->commit_string_pos, str);
+
+	if (pos < 0) {
+		if (ctx->commit_strings.len > INT_MAX - strlen(str) - 1)
+			return GRAPH_METADATA_NONE;
+		pos = ctx->commit_strings.len;
+		strbuf_add(&ctx->commit_strings, str, strlen(str) + 1);
+		strintmap_set(&ctx->commit_string_pos, str, pos);
+	}
+	return pos;
+}
+
+/*
+ * Split the ident "line" into "Name <email>", date and timezone, but
+ * only if putting them back together gives exactly the same line, so
+ * that whoever formats it from the commit-graph shows the same thing.
+ */
+static int split_metadata_ident(const char *line, size_t len,
+				struct strbuf *ident,
+				timestamp_t *date, int *tz)
+{
+	struct ident_split s;
+	struct strbuf check = STRBUF_INIT;
+	int ret;
+
+	if (split_ident_line(&s, line, len) < 0 ||
+	    !s.date_begin || !s.tz_begin || s.mail_end >= line + len)
+		return -1;
+
+	strbuf_reset(ident);
+	strbuf_add(ident, line, s.mail_end + 1 - line);
+	*date = parse_timestamp(s.date_begin, NULL, 10);
+	*tz = strtol(s.tz_begin, NULL, 10);
+
+	strbuf_addf(&check, "%s %"PRItime" %+05d", ident->buf, *date, *tz);
+	ret = check.len == len && !memcmp(check.buf, line, len) ? 0 : -1;
+	strbuf_release(&check);
+	return ret;
+}
+
+/*
+ * Fill the metadata record of "c".  The headers are looked at the way
+ * pretty.c does for a user format; commits whose message would have to
+ * be re-encoded are left out.
+ */
+static int fill_commit_metadata(struct write_commit_graph_context *ctx,
+				struct commit *c, unsigned char *record)
+{
+	const char *msg = repo_get_commit_buffer(ctx->r, c, NULL);
+	const char *author = NULL, *committer = NULL, *name;
+	size_t author_len = 0, committer_len = 0;
+	struct strbuf ident = STRBUF_INIT, subject = STRBUF_INIT;
+	timestamp_t date;
+	uint32_t off;
+	int i, eol, tz, ret = -1;
+
+	if (!msg)
+		return -1;
+
+	for (i = 0; msg[i]; i++) {
+		eol = strchrnul(msg + i, '\n') - msg;
+		if (i == eol)
+			break;
+		if (skip_prefix(msg + i, "author ", &name)) {
+			author = name;
+			author_len = msg + eol - name;
+		} else if (skip_prefix(msg + i, "committer ", &name)) {
+			committer = name;
+			committer_len = msg + eol - name;
+		} else if (starts_with(msg + i, "encoding ")) {
+			goto out;
+		}
+		i = eol;
+	}
+	if (!author || !committer)
+		goto out;
+
+	format_subject(&subject, skip_blank_lines(msg + i), " ");
+
+	if (split_metadata_ident(author, author_len, &ident, &date, &tz) ||
+	    (off = add_commit_string(ctx, ident.buf)) == GRAPH_METADATA_NONE)
+		goto out;
+	put_be32(record, off);
+	put_be64(record + 4, date);
+	put_be32(record + 12, tz);
+
+	if (split_metadata_ident(committer, committer_len, &ident, &date, &tz) ||
+	    (off = add_commit_string(ctx, ident.buf)) == GRAPH_METADATA_NONE)
+		goto out;
+	put_be32(record + 16, off);
+	put_be64(record + 20, date);
+	put_be32(record + 28, tz);
+
+	if ((off = add_commit_string(ctx, subject.buf)) == GRAPH_METADATA_NONE)
+		goto out;
+	put_be32(record + 32, off);
+	ret = 0;
+
+out:
+	repo_unuse_commit_buffer(ctx->r, c, msg);
+	strbuf_release(&ident);
+	strbuf_release(&subject);
+	return ret;
+}
+
+static void compute_commit_metadata(struct write_commit_graph_context *ctx)
+{
+	struct progress *progress = NULL;
+	int i;
+
+	if (ctx->report_progress)
+		progress = start_delayed_progress(
+			_("Collecting commit metadata"),
+			ctx->commits.nr);
+
+	strintmap_init(&ctx->commit_string_pos, -1);
+	strbuf_init(&ctx->commit_strings, 0);
+	add_commit_string(ctx, "");
+	CALLOC_ARRAY(ctx->commit_metadata_records,
+		     st_mult(GRAPH_METADATA_WIDTH, ctx->commits.nr));
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		unsigned char *record = ctx->commit_metadata_records +
+					GRAPH_METADATA_WIDTH * i;
+
+		if (fill_commit_metadata(ctx, ctx->commits.list[i], record)) {
+			memset(record, 0, GRAPH_METADATA_WIDTH);
+			put_be32(record, GRAPH_METADATA_NONE);
+		}
+		display_progress(progress, i + 1);
+	}
+
+	strintmap_clear(&ctx->commit_string_pos);
+	stop_progress(&progress);
+}
+
 static int add_packed_commits(const struct object_id *oid,
 			      struct packed_git *pack,
 			      uint32_t pos,
@@ -1542,6 +1868,121 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_trunc_empty);
 	trace2_data_intmax("commit-graph", ctx->r, "filter-trunc-large",
 			   ctx->count_bloom_filter_trunc_large);
+	if (ctx->merge_changed_paths)
+		trace2_data_intmax("commit-graph", ctx->r, "merge-filter-computed",
+				   ctx->count_merge_bloom_filter_computed);
+}
+
+struct bloom_worker_data {
+	pthread_t thread;
+	struct write_commit_graph_context *ctx;
+	struct bloom_work *work;
+	int nr_computed;
+};
+
+/*
+ * Commits whose filters are to be computed (in parallel), and the outcome
+ * of each computation. The first "nr_first_parent" are computed with
+ * compute_bloom_filter(), the rest with compute_merge_bloom_filter().
+ */
+struct bloom_work {
+	struct commit **commits;
+	enum bloom_filter_computed *computed;
+	size_t nr, next, nr_first_parent;
+	pthread_mutex_t mutex;
+	struct progress *progress;
+	uint64_t progress_done;
+};
+
+static void compute_work_filter(struct write_commit_graph_context *ctx,
+				struct bloom_work *work, size_t i)
+{
+	if (i < work->nr_first_parent)
+		compute_bloom_filter(ctx->r, work->commits[i],
+				     ctx->bloom_settings, &work->computed[i]);
+	else
+		compute_merge_bloom_filter(ctx->r, work->commits[i],
+					   ctx->bloom_settings,
+					   &work->computed[i]);
+}
+
+static void *compute_bloom_filters_thread(void *data)
+{
+	struct bloom_worker_data *me = data;
+	struct bloom_work *work = me->work;
+
+	trace2_thread_start("bloom");
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&work->mutex);
+		i = work->next++;
+		pthread_mutex_unlock(&work->mutex);
+		if (i >= work->nr)
+			break;
+
+		compute_work_filter(me->ctx, work, i);
+		me->nr_computed++;
+		if (i >= work->nr_first_parent)
+			continue;
+
+		pthread_mutex_lock(&work->mutex);
+		display_progress(work->progress, ++work->progress_done);
+		pthread_mutex_unlock(&work->mutex);
+	}
+
+	trace2_data_intmax("commit-graph", me->ctx->r, "bloom/thread-filters",
+			   me->nr_computed);
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void compute_bloom_filters_parallel(struct write_commit_graph_context *ctx,
+					   struct bloom_work *work,
+					   int nr_threads)
+{
+	struct bloom_worker_data *workers;
+	int i;
+
+	CALLOC_ARRAY(workers, nr_threads);
+	pthread_mutex_init(&work->mutex, NULL);
+	enable_obj_read_lock();
+
+	for (i = 0; i < nr_threads; i++) {
+		int err;
+
+		workers[i].ctx = ctx;
+		workers[i].work = work;
+		err = pthread_create(&workers[i].thread, NULL,
+				     compute_bloom_filters_thread, &workers[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&work->mutex);
+	free(workers);
+}
+
+static int commit_graph_threads(struct repository *r)
+{
+	int nr_threads = 0;
+
+	if (repo_config_get_int(r, "commitgraph.threads", &nr_threads) ||
+	    nr_threads < 0)
+		nr_threads = 0;
+	if (!HAVE_THREADS) {
+		if (nr_threads > 1)
+			warning(_("no threads support, ignoring %s"),
+				"commitGraph.threads");
+		nr_threads = 1;
+	}
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
 }
 
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
@@ -1549,7 +1990,9 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
-	int max_new_filters;
+	struct bloom_work work = { 0 };
+	int max_new_filters, max_new_merge_filters;
+	int nr_threads;
 
 	init_bloom_filters();
 
@@ -1569,31 +2012,104 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	/*
+	 * First pick up the filters we already have, and decide which
+	 * ones to compute; the tree diffs are then spread over the worker
+	 * threads.
+	 */
+	ALLOC_ARRAY(work.commits, ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
 		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
 		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
-		if (computed & BLOOM_COMPUTED) {
-			ctx->count_bloom_filter_computed++;
-			if (computed & BLOOM_TRUNC_EMPTY)
-				ctx->count_bloom_filter_trunc_empty++;
-			if (computed & BLOOM_TRUNC_LARGE)
-				ctx->count_bloom_filter_trunc_large++;
-		} else if (computed & BLOOM_NOT_COMPUTED)
-			ctx->count_bloom_filter_not_computed++;
+			ctx->r, c, 0, ctx->bloom_settings, &computed);
+
+		if (!filter && work.nr < max_new_filters) {
+			/* compute_bloom_filter() needs parent information */
+			repo_parse_commit(ctx->r, c);
+			work.commits[work.nr++] = c;
+			continue;
+		}
+
+		ctx->count_bloom_filter_not_computed++;
+		ctx->total_bloom_filter_data_size += filter
+			? sizeof(unsigned char) * filter->len : 0;
+		display_progress(progress, ++work.progress_done);
+	}
+	work.nr_first_parent = work.nr;
+
+	/*
+	 * Then the filters of merge commits' other parents, which are
+	 * limited separately and not counted in the progress.
+	 */
+	if (ctx->merge_changed_paths)
+		REALLOC_ARRAY(work.commits, st_mult(ctx->commits.nr, 2));
+	max_new_merge_filters = work.nr + max_new_filters;
+	for (i = 0; ctx->merge_changed_paths && i < ctx->commits.nr; i++) {
+		struct commit *c = sorted_commits[i];
+		struct bloom_filter *filter;
+
+		repo_parse_commit(ctx->r, c);
+		if (!c->parents || !c->parents->next)
+			continue;
+
+		filter = get_or_compute_merge_bloom_filter(ctx->r, c, 0,
+							   ctx->bloom_settings,
+							   NULL);
+		if (!filter && work.nr < max_new_merge_filters) {
+			work.commits[work.nr++] = c;
+			continue;
+		}
+
+		ctx->total_merge_bloom_filter_data_size += filter
+			? sizeof(unsigned char) * filter->len : 0;
+	}
+
+	CALLOC_ARRAY(work.computed, work.nr);
+	nr_threads = commit_graph_threads(ctx->r);
+	if (nr_threads > work.nr)
+		nr_threads = work.nr;
+	trace2_data_intmax("commit-graph", ctx->r, "bloom/threads", nr_threads);
+
+	if (nr_threads > 1) {
+		work.progress = progress;
+		compute_bloom_filters_parallel(ctx, &work, nr_threads);
+	} else {
+		for (i = 0; i < work.nr; i++) {
+			compute_work_filter(ctx, &work, i);
+			if (i < work.nr_first_parent)
+				display_progress(progress, ++work.progress_done);
+		}
+	}
+
+	for (i = work.nr_first_parent; i < work.nr; i++) {
+		struct bloom_filter *filter = get_merge_bloom_filter(ctx->r,
+								     work.commits[i]);
+
+		ctx->count_merge_bloom_filter_computed++;
+		ctx->total_merge_bloom_filter_data_size += filter
+			? sizeof(unsigned char) * filter->len : 0;
+	}
+
+	for (i = 0; i < work.nr_first_parent; i++) {
+		enum bloom_filter_computed computed = work.computed[i];
+		struct bloom_filter *filter = get_bloom_filter(ctx->r,
+							       work.commits[i]);
+
+		ctx->count_bloom_filter_computed++;
+		if (computed & BLOOM_TRUNC_EMPTY)
+			ctx->count_bloom_filter_trunc_empty++;
+		if (computed & BLOOM_TRUNC_LARGE)
+			ctx->count_bloom_filter_trunc_large++;
 		ctx->total_bloom_filter_data_size += filter
 			? sizeof(unsigned char) * filter->len : 0;
-		display_progress(progress, i + 1);
 	}
 
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
+	free(work.commits);
+	free(work.computed);
 	free(sorted_commits);
 	stop_progress(&progress);
 }
@@ -1645,6 +2161,33 @@ int write_commit_graph_reachable(struct object_directory *odb,
 	return result;
 }
 
+int write_commit_graph_for_tips(struct object_directory *odb,
+				struct oidset *tips,
+				enum commit_graph_write_flags flags)
+{
+	struct oidset commits = OIDSET_INIT;
+	struct oidset_iter iter;
+	const struct object_id *oid;
+	int result = 0;
+
+	oidset_iter_init(tips, &iter);
+	while ((oid = oidset_iter_next(&iter))) {
+		struct commit *commit =
+			lookup_commit_reference_gently(the_repository, oid, 1);
+
+		if (commit)
+			oidset_insert(&commits, &commit->object.oid);
+	}
+
+	if (oidset_size(&commits))
+		result = write_commit_graph(odb, NULL, &commits,
+					    flags | COMMIT_GRAPH_WRITE_SPLIT,
+					    NULL);
+
+	oidset_clear(&commits);
+	return result;
+}
+
 static int fill_oids_from_packs(struct write_commit_graph_context *ctx,
 				struct string_list *pack_indexes)
 {
@@ -1839,6 +2382,7 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 		fd = get_lock_file_fd(&lk);
 		f = hashfd(fd, get_lock_file_path(&lk));
 	}
+	hashfile_write_in_background(f);
 
 	cf = init_chunkfile(f);
 
@@ -1870,6 +2414,22 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 				+ ctx->total_bloom_filter_data_size,
 			  write_graph_chunk_bloom_data);
 	}
+	if (ctx->changed_paths && ctx->merge_changed_paths) {
+		add_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEINDEXES,
+			  sizeof(uint32_t) * ctx->commits.nr,
+			  write_graph_chunk_bloom_merge_indexes);
+		add_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEDATA,
+			  ctx->total_merge_bloom_filter_data_size,
+			  write_graph_chunk_bloom_merge_data);
+	}
+	if (ctx->commit_metadata) {
+		add_chunk(cf, GRAPH_CHUNKID_COMMITMETADATA,
+			  st_mult(GRAPH_METADATA_WIDTH, ctx->commits.nr),
+			  write_graph_chunk_commit_metadata);
+		add_chunk(cf, GRAPH_CHUNKID_COMMITSTRINGS,
+			  ctx->commit_strings.len,
+			  write_graph_chunk_commit_strings);
+	}
 	if (ctx->num_commit_graphs_after > 1)
 		add_chunk(cf, GRAPH_CHUNKID_BASE,
 			  hashsz * (ctx->num_commit_graphs_after - 1),
@@ -2293,6 +2853,28 @@ int write_commit_graph(struct object_directory *odb,
 		}
 	}
 
+	if (flags & COMMIT_GRAPH_WRITE_MERGE_BLOOM_FILTERS)
+		ctx->merge_changed_paths = 1;
+	if (!(flags & COMMIT_GRAPH_NO_WRITE_MERGE_BLOOM_FILTERS)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		/* Keep the merge commits' filters too if we have them. */
+		if (g && g->chunk_bloom_merge_data)
+			ctx->merge_changed_paths = 1;
+	}
+	if (!ctx->changed_paths)
+		ctx->merge_changed_paths = 0;
+
+	if (flags & COMMIT_GRAPH_WRITE_COMMIT_METADATA)
+		ctx->commit_metadata = 1;
+	if (!(flags & COMMIT_GRAPH_NO_WRITE_COMMIT_METADATA)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		/* Likewise keep the commit metadata if we have it. */
+		if (g && g->chunk_commit_metadata)
+			ctx->commit_metadata = 1;
+	}
+
 	if (ctx->split) {
 		struct commit_graph *g = ctx->r->objects->commit_graph;
 
@@ -2373,6 +2955,9 @@ int write_commit_graph(struct object_directory *odb,
 	if (ctx->changed_paths)
 		compute_bloom_filters(ctx);
 
+	if (ctx->commit_metadata)
+		compute_commit_metadata(ctx);
+
 	res = write_commit_graph_file(ctx);
 
 	if (ctx->split)
@@ -2383,6 +2968,8 @@ int write_commit_graph(struct object_directory *odb,
 cleanup:
 	free(ctx->graph_name);
 	free(ctx->commits.list);
+	free(ctx->commit_metadata_records);
+	strbuf_release(&ctx->commit_strings);
 	oid_array_clear(&ctx->oids);
 	clear_topo_level_slab(&topo_levels);
 
@@ -2428,12 +3015,109 @@ static int commit_graph_checksum_valid(struct commit_graph *g)
 	return hashfile_checksum_valid(g->data, g->data_len);
 }
 
+/*
+ * Reading the commits from the object database is the expensive part of
+ * verify_commit_graph(), so it is done ahead of the checks, a batch of
+ * commits at a time, by several threads. The checks themselves (and the
+ * reports) stay in the main thread and in the order of the graph.
+ */
+#define VERIFY_COMMIT_GRAPH_BATCH 8192
+
+struct verify_odb_commit {
+	struct object_id tree;
+	struct oid_array parents;
+	timestamp_t date;
+	int failed;
+};
+
+struct verify_odb_work {
+	struct repository *r;
+	struct commit_graph *g;
+	struct verify_odb_commit *commits;
+	uint32_t start, nr, next;
+	pthread_mutex_t mutex;
+};
+
+static void read_verify_odb_commit(struct verify_odb_work *work, uint32_t i)
+{
+	struct verify_odb_commit *c = &work->commits[i];
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	oidread(&oid, work->g->chunk_oid_lookup +
+		work->g->hash_len * (work->start + i));
+	buf = repo_read_object_file(work->r, &oid, &type, &size);
+	c->failed = !buf || type != OBJ_COMMIT ||
+		parse_commit_buffer_oids(buf, size, &c->tree, &c->parents,
+					 &c->date);
+	free(buf);
+}
+
+static void *read_verify_odb_commits_thread(void *data)
+{
+	struct verify_odb_work *work = data;
+
+	for (;;) {
+		uint32_t i;
+
+		pthread_mutex_lock(&work->mutex);
+		i = work->next++;
+		pthread_mutex_unlock(&work->mutex);
+		if (i >= work->nr)
+			break;
+
+		read_verify_odb_commit(work, i);
+	}
+	return NULL;
+}
+
+static void read_verify_odb_commits(struct verify_odb_work *work,
+				    int nr_threads)
+{
+	pthread_t *threads;
+	int i;
+
+	if (nr_threads > work->nr)
+		nr_threads = work->nr;
+	if (nr_threads <= 1) {
+		uint32_t j;
+
+		for (j = 0; j < work->nr; j++)
+			read_verify_odb_commit(work, j);
+		return;
+	}
+
+	work->next = 0;
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 read_verify_odb_commits_thread, work);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static void clear_verify_odb_commits(struct verify_odb_work *work)
+{
+	uint32_t i;
+
+	for (i = 0; i < work->nr; i++)
+		oid_array_clear(&work->commits[i].parents);
+}
+
 int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 {
 	uint32_t i, cur_fanout_pos = 0;
 	struct object_id prev_oid, cur_oid;
 	int generation_zero = 0;
 	struct progress *progress = NULL;
+	struct verify_odb_work work = { 0 };
+	int nr_threads;
 	int local_error = 0;
 
 	if (!g) {
@@ -2494,58 +3178,82 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 		progress = start_progress(_("Verifying commits in commit graph"),
 					g->num_commits);
 
+	nr_threads = commit_graph_threads(r);
+	trace2_data_intmax("commit-graph", r, "verify/threads", nr_threads);
+	work.r = r;
+	work.g = g;
+	CALLOC_ARRAY(work.commits, VERIFY_COMMIT_GRAPH_BATCH);
+	if (nr_threads > 1) {
+		pthread_mutex_init(&work.mutex, NULL);
+		enable_obj_read_lock();
+	}
+
 	for (i = 0; i < g->num_commits; i++) {
-		struct commit *graph_commit, *odb_commit;
-		struct commit_list *graph_parents, *odb_parents;
+		struct commit *graph_commit;
+		struct verify_odb_commit *odb_commit;
+		struct commit_list *graph_parents;
+		size_t nth_parent;
 		timestamp_t max_generation = 0;
 		timestamp_t generation;
 
+		if (i == work.start + work.nr) {
+			clear_verify_odb_commits(&work);
+			work.start = i;
+			work.nr = g->num_commits - i;
+			if (work.nr > VERIFY_COMMIT_GRAPH_BATCH)
+				work.nr = VERIFY_COMMIT_GRAPH_BATCH;
+			read_verify_odb_commits(&work, nr_threads);
+		}
+		odb_commit = &work.commits[i - work.start];
+
 		display_progress(progress, i + 1);
 		oidread(&cur_oid, g->chunk_oid_lookup + g->hash_len * i);
 
 		graph_commit = lookup_commit(r, &cur_oid);
-		odb_commit = (struct commit *)create_object(r, &cur_oid, alloc_commit_node(r));
-		if (parse_commit_internal(odb_commit, 0, 0)) {
+		if (odb_commit->failed) {
 			graph_report(_("failed to parse commit %s from object database for commit-graph"),
 				     oid_to_hex(&cur_oid));
 			continue;
 		}
 
 		if (!oideq(&get_commit_tree_in_graph_one(r, g, graph_commit)->object.oid,
-			   get_commit_tree_oid(odb_commit)))
+			   &odb_commit->tree))
 			graph_report(_("root tree OID for commit %s in commit-graph is %s != %s"),
 				     oid_to_hex(&cur_oid),
 				     oid_to_hex(get_commit_tree_oid(graph_commit)),
-				     oid_to_hex(get_commit_tree_oid(odb_commit)));
+				     oid_to_hex(&odb_commit->tree));
 
 		graph_parents = graph_commit->parents;
-		odb_parents = odb_commit->parents;
+		nth_parent = 0;
 
 		while (graph_parents) {
-			if (odb_parents == NULL) {
+			const struct object_id *odb_parent;
+
+			if (nth_parent >= odb_commit->parents.nr) {
 				graph_report(_("commit-graph parent list for commit %s is too long"),
 					     oid_to_hex(&cur_oid));
 				break;
 			}
+			odb_parent = &odb_commit->parents.oid[nth_parent];
 
 			/* parse parent in case it is in a base graph */
 			parse_commit_in_graph_one(r, g, graph_parents->item);
 
-			if (!oideq(&graph_parents->item->object.oid, &odb_parents->item->object.oid))
+			if (!oideq(&graph_parents->item->object.oid, odb_parent))
 				graph_report(_("commit-graph parent for %s is %s != %s"),
 					     oid_to_hex(&cur_oid),
 					     oid_to_hex(&graph_parents->item->object.oid),
-					     oid_to_hex(&odb_parents->item->object.oid));
+					     oid_to_hex(odb_parent));
 
 			generation = commit_graph_generation(graph_parents->item);
 			if (generation > max_generation)
 				max_generation = generation;
 
 			graph_parents = graph_parents->next;
-			odb_parents = odb_parents->next;
+			nth_parent++;
 		}
 
-		if (odb_parents != NULL)
+		if (nth_parent < odb_commit->parents.nr)
 			graph_report(_("commit-graph parent list for commit %s terminates early"),
 				     oid_to_hex(&cur_oid));
 
@@ -2585,6 +3293,13 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	}
 	stop_progress(&progress);
 
+	if (nr_threads > 1) {
+		disable_obj_read_lock();
+		pthread_mutex_destroy(&work.mutex);
+	}
+	clear_verify_odb_commits(&work);
+	free(work.commits);
+
 	local_error = verify_commit_graph_error;
 
 	if (!(flags & COMMIT_GRAPH_VERIFY_SHALLOW) && g->base_graph)
@@ -40,6 +40,16 @@ int open_commit_graph(const char *graph_file, int *fd, struct stat *st);
  */
 int parse_commit_in_graph(struct repository *r, struct commit *item);
 
+/*
+ * Look up the commit named by oid in the commit-graph and return it
+ * with its date, tree and parents filled from there, or NULL if the
+ * commit-graph does not know about that object.  Unlike lookup_commit(),
+ * this never creates a commit object for an oid of another type, so it
+ * is safe to call on arbitrary object names, e.g. the tips of refs.
+ */
+struct commit *lookup_commit_in_graph(struct repository *r,
+				      const struct object_id *oid);
+
 /*
  * It is possible that we loaded commit contents from the commit buffer,
  * but we also want to ensure the commit-graph content is correctly
@@ -51,6 +61,29 @@ void load_commit_graph_info(struct repository *r, struct commit *item);
 struct tree *get_commit_tree_in_graph(struct repository *r,
 				      const struct commit *c);
 
+/*
+ * What the commit metadata chunk of a commit-graph records about a
+ * commit: enough to show its author, committer and subject without
+ * reading the commit object.  The strings point into the commit-graph.
+ */
+struct commit_graph_metadata {
+	/* "Name <email>" of the author and of the committer */
+	const char *author, *committer;
+	timestamp_t author_date, committer_date;
+	int author_tz, committer_tz;
+
+	/* the subject, its lines joined by spaces as "%s" shows it */
+	const char *subject;
+};
+
+/*
+ * Look "c" up in the commit metadata chunk of the commit-graph layer it
+ * is in.  Returns 0 on success, and -1 when the layer has no such chunk
+ * or the commit is not in the commit-graph at all.
+ */
+int commit_graph_metadata(struct repository *r, const struct commit *c,
+			  struct commit_graph_metadata *md);
+
 struct commit_graph {
 	const unsigned char *data;
 	size_t data_len;
@@ -75,6 +108,11 @@ struct commit_graph {
 	const unsigned char *chunk_base_graphs;
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
+	const unsigned char *chunk_bloom_merge_indexes;
+	const unsigned char *chunk_bloom_merge_data;
+	const unsigned char *chunk_commit_metadata;
+	const unsigned char *chunk_commit_strings;
+	size_t commit_strings_size;
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
@@ -108,6 +146,10 @@ enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_COMMIT_METADATA = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_COMMIT_METADATA = (1 << 6),
+	COMMIT_GRAPH_WRITE_MERGE_BLOOM_FILTERS = (1 << 7),
+	COMMIT_GRAPH_NO_WRITE_MERGE_BLOOM_FILTERS = (1 << 8),
 };
 
 enum commit_graph_split_flags {
@@ -133,6 +175,16 @@ struct commit_graph_opts {
 int write_commit_graph_reachable(struct object_directory *odb,
 				 enum commit_graph_write_flags flags,
 				 const struct commit_graph_opts *opts);
+/*
+ * Write a new layer on top of the commit-graph chain with the commits
+ * reachable from "tips" (which may also point at tags) that the
+ * commit-graph does not cover yet, e.g. the commits just fetched or
+ * pushed. Unlike write_commit_graph_reachable(), this does not look at
+ * every ref.
+ */
+int write_commit_graph_for_tips(struct object_directory *odb,
+				struct oidset *tips,
+				enum commit_graph_write_flags flags);
 int write_commit_graph(struct object_directory *odb,
 		       struct string_list *pack_indexes,
 		       struct oidset *commits,
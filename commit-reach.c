@@ -8,6 +8,7 @@
 #include "revision.h"
 #include "tag.h"
 #include "commit-reach.h"
+#include "ewah/ewok.h"
 
 /* Remember to update object flag allocation in object.h */
 #define PARENT1		(1u<<16)
@@ -53,13 +54,13 @@ static struct commit_list *paint_down_to_common(struct repository *r,
 						struct commit **twos,
 						timestamp_t min_generation)
 {
-	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue queue = { .key = commit_key_by_gen_then_commit_date };
 	struct commit_list *result = NULL;
 	int i;
 	timestamp_t last_gen = GENERATION_NUMBER_INFINITY;
 
 	if (!min_generation && !corrected_commit_dates_enabled(r))
-		queue.compare = compare_commits_by_commit_date;
+		queue.key = commit_key_by_commit_date;
 
 	one->object.flags |= PARENT1;
 	if (!n) {
@@ -655,12 +656,12 @@ static void push_to_contains_stack(struct commit *candidate, struct contains_sta
 	contains_stack->contains_stack[contains_stack->nr++].parents = candidate->parents;
 }
 
-static enum contains_result contains_tag_algo(struct commit *candidate,
-					      const struct commit_list *want,
-					      struct contains_cache *cache)
+/*
+ * The lowest generation number among "want"; no commit below it can
+ * reach any of them.
+ */
+static timestamp_t contains_cutoff(const struct commit_list *want)
 {
-	struct contains_stack contains_stack = { 0, 0, NULL };
-	enum contains_result result;
 	timestamp_t cutoff = GENERATION_NUMBER_INFINITY;
 	const struct commit_list *p;
 
@@ -672,6 +673,16 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		if (generation < cutoff)
 			cutoff = generation;
 	}
+	return cutoff;
+}
+
+static enum contains_result contains_tag_algo(struct commit *candidate,
+					      const struct commit_list *want,
+					      struct contains_cache *cache,
+					      timestamp_t cutoff)
+{
+	struct contains_stack contains_stack = { 0, 0, NULL };
+	enum contains_result result;
 
 	result = contains_test(candidate, want, cache, cutoff);
 	if (result != CONTAINS_UNKNOWN)
@@ -711,8 +722,17 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 int commit_contains(struct ref_filter *filter, struct commit *commit,
 		    struct commit_list *list, struct contains_cache *cache)
 {
-	if (filter->with_commit_tag_algo)
-		return contains_tag_algo(commit, list, cache) == CONTAINS_YES;
+	timestamp_t cutoff = contains_cutoff(list);
+
+	/*
+	 * The cache remembers the answer for every commit walked over,
+	 * so that asking about many candidates walks each part of the
+	 * history only once.  Without generation numbers, that means
+	 * walking all of it; that is what tags, which are typically old
+	 * and many, want anyway, but not for a handful of branches.
+	 */
+	if (filter->with_commit_tag_algo || cutoff != GENERATION_NUMBER_INFINITY)
+		return contains_tag_algo(commit, list, cache, cutoff) == CONTAINS_YES;
 	return repo_is_descendant_of(the_repository, commit, list);
 }
 
@@ -884,7 +904,7 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 	timestamp_t min_generation = GENERATION_NUMBER_INFINITY;
 	int num_to_find = 0;
 
-	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue queue = { .key = commit_key_by_gen_then_commit_date };
 
 	for (item = to; item < to_last; item++) {
 		timestamp_t generation;
@@ -942,3 +962,187 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 
 	return found_commits;
 }
+
+struct ahead_behind_data {
+	/*
+	 * Orders the walk: higher than that of any of the parents.  Zero
+	 * until computed.
+	 */
+	timestamp_t generation;
+
+	/* the indexes of the commits passed to ahead_behind() reaching us */
+	struct bitmap *reached_from;
+};
+
+define_commit_slab(ahead_behind_slab, struct ahead_behind_data);
+
+static timestamp_t known_generation(struct ahead_behind_slab *slab,
+				    struct commit *c)
+{
+	timestamp_t generation = commit_graph_generation(c);
+
+	if (generation != GENERATION_NUMBER_INFINITY &&
+	    generation != GENERATION_NUMBER_ZERO)
+		return generation;
+	return ahead_behind_slab_at(slab, c)->generation;
+}
+
+/*
+ * Commits in the commit-graph are ordered by their generation number
+ * from it.  Give all others a generation that is higher than that of
+ * any parent (and, like corrected commit dates, at least their commit
+ * date).
+ */
+static void compute_generations(struct repository *r,
+				struct ahead_behind_slab *slab,
+				struct commit **commits, size_t commits_nr)
+{
+	struct commit_list *list = NULL;
+	size_t i;
+
+	for (i = 0; i < commits_nr; i++) {
+		if (known_generation(slab, commits[i]))
+			continue;
+
+		commit_list_insert(commits[i], &list);
+		while (list) {
+			struct commit *current = list->item;
+			struct commit_list *parent;
+			int all_parents_computed = 1;
+			timestamp_t max_generation = 0;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				timestamp_t generation;
+
+				repo_parse_commit(r, parent->item);
+				generation = known_generation(slab, parent->item);
+
+				if (!generation) {
+					all_parents_computed = 0;
+					commit_list_insert(parent->item, &list);
+					break;
+				}
+				if (generation > max_generation)
+					max_generation = generation;
+			}
+
+			if (all_parents_computed) {
+				pop_commit(&list);
+
+				if (current->date > max_generation)
+					max_generation = current->date - 1;
+				ahead_behind_slab_at(slab, current)->generation =
+					max_generation + 1;
+			}
+		}
+	}
+}
+
+static int compare_commits_by_walk_generation(const void *a_, const void *b_,
+					      void *cb_data)
+{
+	struct ahead_behind_slab *slab = cb_data;
+	timestamp_t generation_a = known_generation(slab, (struct commit *)a_);
+	timestamp_t generation_b = known_generation(slab, (struct commit *)b_);
+
+	/* children first */
+	if (generation_a < generation_b)
+		return 1;
+	else if (generation_a > generation_b)
+		return -1;
+	return 0;
+}
+
+static struct bitmap *reached_from(struct ahead_behind_slab *slab,
+				   struct commit *c, size_t width)
+{
+	struct ahead_behind_data *data = ahead_behind_slab_at(slab, c);
+
+	if (!data->reached_from)
+		data->reached_from = bitmap_word_alloc(width);
+	return data->reached_from;
+}
+
+void ahead_behind(struct repository *r,
+		  struct commit **commits, size_t commits_nr,
+		  struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct ahead_behind_slab slab;
+	struct prio_queue queue = { compare_commits_by_walk_generation };
+	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
+	size_t i;
+
+	for (i = 0; i < counts_nr; i++)
+		counts[i].ahead = counts[i].behind = 0;
+	if (!commits_nr || !counts_nr)
+		return;
+
+	init_ahead_behind_slab(&slab);
+	queue.cb_data = &slab;
+
+	for (i = 0; i < commits_nr; i++)
+		repo_parse_commit(r, commits[i]);
+	compute_generations(r, &slab, commits, commits_nr);
+
+	for (i = 0; i < commits_nr; i++) {
+		struct commit *c = commits[i];
+
+		bitmap_set(reached_from(&slab, c, width), i);
+		if (!(c->object.flags & PARENT2)) {
+			c->object.flags |= PARENT2;
+			prio_queue_put(&queue, c);
+		}
+	}
+
+	/*
+	 * Once a commit is reachable from all of "commits", so are its
+	 * ancestors, and none of them count for any pair.
+	 */
+	while (queue_has_nonstale(&queue)) {
+		struct commit *c = prio_queue_get(&queue);
+		struct ahead_behind_data *data = ahead_behind_slab_at(&slab, c);
+		struct bitmap *bits = data->reached_from;
+		struct commit_list *p;
+
+		for (i = 0; i < counts_nr; i++) {
+			int from_tip = !!bitmap_get(bits, counts[i].tip_index);
+			int from_base = !!bitmap_get(bits, counts[i].base_index);
+
+			if (from_tip && !from_base)
+				counts[i].ahead++;
+			else if (from_base && !from_tip)
+				counts[i].behind++;
+		}
+
+		for (p = c->parents; p; p = p->next) {
+			struct commit *parent = p->item;
+			struct bitmap *parent_bits;
+
+			repo_parse_commit(r, parent);
+			parent_bits = reached_from(&slab, parent, width);
+			bitmap_or(parent_bits, bits);
+			if (bitmap_popcount(parent_bits) == commits_nr)
+				parent->object.flags |= STALE;
+
+			if (!(parent->object.flags & PARENT2)) {
+				parent->object.flags |= PARENT2;
+				prio_queue_put(&queue, parent);
+			}
+		}
+
+		/* all children of "c" have been seen before it */
+		bitmap_free(bits);
+		data->reached_from = NULL;
+	}
+
+	while (queue.nr) {
+		struct commit *c = prio_queue_get(&queue);
+		struct ahead_behind_data *data = ahead_behind_slab_at(&slab, c);
+
+		bitmap_free(data->reached_from);
+		data->reached_from = NULL;
+	}
+	clear_commit_marks_many(commits_nr, commits, PARENT2 | STALE);
+	clear_prio_queue(&queue);
+	clear_ahead_behind_slab(&slab);
+}
@@ -104,4 +104,37 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 					 struct commit **to, int nr_to,
 					 unsigned int reachable_flag);
 
+struct ahead_behind_count {
+	/*
+	 * As input, the indexes in the commits array of ahead_behind()
+	 * of the tip and the base to compare.
+	 */
+	size_t tip_index;
+	size_t base_index;
+
+	/*
+	 * As output, the number of commits reachable from the tip but
+	 * not the base, and from the base but not the tip.
+	 */
+	unsigned int ahead;
+	unsigned int behind;
+};
+
+/*
+ * Compute the ahead/behind counts of all the given (tip, base) pairs of
+ * "commits" at once, in a single walk that carries along, for each
+ * commit it visits, which of "commits" can reach it.  This costs about
+ * as much as computing a single pair, however many there are.
+ *
+ * The walk needs to see every commit before its parents.  Without a
+ * commit-graph covering "commits", that is ensured by first walking
+ * all of their history.
+ *
+ * This method uses the PARENT2 and STALE flags during its operation,
+ * so be sure these flags are not set before calling the method.
+ */
+void ahead_behind(struct repository *r,
+		  struct commit **commits, size_t commits_nr,
+		  struct ahead_behind_count *counts, size_t counts_nr);
+
 #endif
@@ -6,6 +6,11 @@
 #define COMMIT_SLAB_SIZE (512*1024-32)
 #endif
 
+/* ...or only ~4kB at once for slabs set up with init_*_sparse() */
+#ifndef COMMIT_SLAB_SPARSE_SIZE
+#define COMMIT_SLAB_SPARSE_SIZE (4*1024-32)
+#endif
+
 #define declare_commit_slab(slabname, elemtype) 			\
 									\
 struct slabname {							\
@@ -27,10 +32,21 @@ struct slabname {							\
 	(stride), 0, NULL \
 }
 
+/*
+ * Statically initialize a sparse commit slab named "var", see
+ * init_*_sparse() in commit-slab.h.  The elements must be smaller
+ * than COMMIT_SLAB_SPARSE_SIZE.
+ */
+#define COMMIT_SLAB_INIT_SPARSE(var) { \
+	COMMIT_SLAB_SPARSE_SIZE / sizeof(**((var).slab)), \
+	1, 0, NULL \
+}
+
 #define declare_commit_slab_prototypes(slabname, elemtype)		\
 									\
 void init_ ##slabname## _with_stride(struct slabname *s, unsigned stride); \
 void init_ ##slabname(struct slabname *s);				\
+void init_ ##slabname## _sparse(struct slabname *s);			\
 void clear_ ##slabname(struct slabname *s);				\
 void deep_clear_ ##slabname(struct slabname *s, void (*free_fn)(elemtype *ptr)); \
 elemtype *slabname## _at_peek(struct slabname *s, const struct commit *c, int add_if_missing); \
@@ -3,6 +3,10 @@
 
 #include "git-compat-util.h"
 
+/* Allocate zeroed memory for, or free, the chunks of a slab. */
+void *commit_slab_alloc_chunk(size_t size);
+void commit_slab_free_chunk(void *ptr, size_t size);
+
 #define implement_static_commit_slab(slabname, elemtype) \
 	implement_commit_slab(slabname, elemtype, MAYBE_UNUSED static)
 
@@ -29,11 +33,20 @@ scope void init_ ##slabname(struct slabname *s)				\
 	init_ ##slabname## _with_stride(s, 1);				\
 }									\
 									\
+scope void init_ ##slabname## _sparse(struct slabname *s)		\
+{									\
+	init_ ##slabname## _with_stride(s, 1);				\
+	s->slab_size = COMMIT_SLAB_SPARSE_SIZE / sizeof(elemtype);	\
+	if (!s->slab_size)						\
+		s->slab_size = 1;					\
+}									\
+									\
 scope void clear_ ##slabname(struct slabname *s)			\
 {									\
 	unsigned int i;							\
 	for (i = 0; i < s->slab_count; i++)				\
-		free(s->slab[i]);					\
+		commit_slab_free_chunk(s->slab[i], s->slab_size *	\
+				       sizeof(**s->slab) * s->stride);	\
 	s->slab_count = 0;						\
 	FREE_AND_NULL(s->slab);						\
 }									\
@@ -72,8 +85,8 @@ scope elemtype *slabname## _at_peek(struct slabname *s,			\
 	if (!s->slab[nth_slab]) {					\
 		if (!add_if_missing)					\
 			return NULL;					\
-		s->slab[nth_slab] = xcalloc(s->slab_size,		\
-					    sizeof(**s->slab) * s->stride);		\
+		s->slab[nth_slab] = commit_slab_alloc_chunk(s->slab_size * \
+					    sizeof(**s->slab) * s->stride);	\
 	}								\
 	return &s->slab[nth_slab][nth_slot * s->stride];		\
 }									\
@@ -0,0 +1,131 @@
+/*
+ * Storage for the chunks of commit slabs.
+ */
+
+#include "cache.h"
+#include "commit-slab.h"
+#include "thread-utils.h"
+
+#if defined(MADV_HUGEPAGE) && !defined(NO_MMAP)
+/*
+ * With core.commitSlabHugePages, the chunks of dense slabs are carved
+ * out of blocks of memory aligned to and as large as a huge page, so
+ * that the kernel can back each block with one.  The chunks of all
+ * slabs share the blocks, and a chunk that is freed goes to a free
+ * list for the next slab to reuse; the blocks themselves are kept
+ * until the process exits.
+ */
+#define ARENA_BLOCK_SIZE (2 * 1024 * 1024)
+#define ARENA_CHUNK_SIZE (COMMIT_SLAB_SIZE + 32)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+};
+
+static struct arena_chunk *free_chunks;
+static char *block_next, *block_end;
+static char **blocks;
+static size_t blocks_nr, blocks_alloc;
+#ifndef NO_PTHREADS
+static pthread_mutex_t arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+#else
+static pthread_mutex_t arena_mutex;
+#endif
+
+static int new_block(void)
+{
+	char *p, *block;
+	size_t len = 2 * ARENA_BLOCK_SIZE;
+	size_t head;
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return -1;
+
+	/* keep only the aligned block in the middle */
+	block = (char *)(((uintptr_t)p + ARENA_BLOCK_SIZE - 1) &
+			 ~(uintptr_t)(ARENA_BLOCK_SIZE - 1));
+	head = block - p;
+	if (head)
+		munmap(p, head);
+	if (len - head > ARENA_BLOCK_SIZE)
+		munmap(block + ARENA_BLOCK_SIZE, len - head - ARENA_BLOCK_SIZE);
+	madvise(block, ARENA_BLOCK_SIZE, MADV_HUGEPAGE);
+
+	ALLOC_GROW(blocks, blocks_nr + 1, blocks_alloc);
+	blocks[blocks_nr++] = block;
+	block_next = block;
+	block_end = block + ARENA_BLOCK_SIZE;
+	trace2_memory_add(TRACE2_MEMORY_ID_COMMIT_SLAB, ARENA_BLOCK_SIZE);
+	return 0;
+}
+
+static void *arena_alloc(void)
+{
+	void *ret = NULL;
+
+	pthread_mutex_lock(&arena_mutex);
+	if (free_chunks) {
+		ret = free_chunks;
+		free_chunks = free_chunks->next;
+		memset(ret, 0, ARENA_CHUNK_SIZE);
+	} else if (block_next < block_end || !new_block()) {
+		/* fresh anonymous memory is already zeroed */
+		ret = block_next;
+		block_next += ARENA_CHUNK_SIZE;
+	}
+	pthread_mutex_unlock(&arena_mutex);
+	return ret;
+}
+
+static int arena_free(void *ptr)
+{
+	size_t i;
+	int found = 0;
+
+	pthread_mutex_lock(&arena_mutex);
+	for (i = 0; i < blocks_nr; i++) {
+		if (blocks[i] <= (char *)ptr &&
+		    (char *)ptr < blocks[i] + ARENA_BLOCK_SIZE) {
+			struct arena_chunk *chunk = ptr;
+			chunk->next = free_chunks;
+			free_chunks = chunk;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&arena_mutex);
+	return found;
+}
+#else
+static void *arena_alloc(void)
+{
+	return NULL;
+}
+
+static int arena_free(void *ptr)
+{
+	return 0;
+}
+#define ARENA_CHUNK_SIZE 0
+#endif
+
+void *commit_slab_alloc_chunk(size_t size)
+{
+	void *ret;
+
+	if (commit_slab_huge_pages && size > COMMIT_SLAB_SPARSE_SIZE &&
+	    size <= ARENA_CHUNK_SIZE && (ret = arena_alloc()))
+		return ret;
+	trace2_memory_add(TRACE2_MEMORY_ID_COMMIT_SLAB, size);
+	return xcalloc(1, size);
+}
+
+void commit_slab_free_chunk(void *ptr, size_t size)
+{
+	if (!ptr || arena_free(ptr))
+		return;
+	trace2_memory_add(TRACE2_MEMORY_ID_COMMIT_SLAB, -(intmax_t)size);
+	free(ptr);
+}
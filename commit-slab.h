@@ -39,6 +39,15 @@
  *   that is initialized by the variant without "_with_stride" associates
  *   each commit with an array of one integer.
  *
+ * - void init_indegree_sparse(struct indegree *);
+ *
+ *   Like init_indegree(), but the slab allocates its storage in much
+ *   smaller chunks.  Use this for slabs that only ever hold data for a
+ *   few of the commits a process knows about, e.g. the ones that are
+ *   named by refs, which would otherwise allocate a big chunk for
+ *   every one of them that is far from the others in the order in
+ *   which commits were first looked up.
+ *
  * - void clear_indegree(struct indegree *);
  *
  *   Empties the slab.  The slab can be reused with the same stride
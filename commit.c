@@ -21,6 +21,7 @@
 #include "commit-reach.h"
 #include "run-command.h"
 #include "shallow.h"
+#include "oid-array.h"
 
 static struct commit_extra_header *read_commit_extra_header_lines(const char *buf, size_t len, const char **);
 
@@ -468,6 +469,35 @@ int parse_commit_buffer(struct repository *r, struct commit *item, const void *b
 	return 0;
 }
 
+int parse_commit_buffer_oids(const void *buffer, unsigned long size,
+			     struct object_id *tree, struct oid_array *parents,
+			     timestamp_t *date)
+{
+	const char *tail = (const char *)buffer + size;
+	const char *bufptr = buffer;
+	const int tree_entry_len = the_hash_algo->hexsz + 5;
+	const int parent_entry_len = the_hash_algo->hexsz + 7;
+
+	if (tail <= bufptr + tree_entry_len + 1 || memcmp(bufptr, "tree ", 5) ||
+	    bufptr[tree_entry_len] != '\n' || get_oid_hex(bufptr + 5, tree))
+		return -1;
+	bufptr += tree_entry_len + 1;
+
+	while (bufptr + parent_entry_len < tail && !memcmp(bufptr, "parent ", 7)) {
+		struct object_id parent;
+
+		if (tail <= bufptr + parent_entry_len + 1 ||
+		    get_oid_hex(bufptr + 7, &parent) ||
+		    bufptr[parent_entry_len] != '\n')
+			return -1;
+		oid_array_append(parents, &parent);
+		bufptr += parent_entry_len + 1;
+	}
+
+	*date = parse_commit_date(bufptr, tail);
+	return 0;
+}
+
 int repo_parse_commit_internal(struct repository *r,
 			       struct commit *item,
 			       int quiet_on_missing,
@@ -795,6 +825,24 @@ int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused)
 	return 0;
 }
 
+void commit_key_by_commit_date(const void *commit, uint64_t *key, void *unused)
+{
+	const struct commit *c = commit;
+
+	/* newer commits with larger date first */
+	key[0] = ~(uint64_t)c->date;
+	key[1] = 0;
+}
+
+void commit_key_by_gen_then_commit_date(const void *commit, uint64_t *key, void *unused)
+{
+	const struct commit *c = commit;
+
+	/* newer commits first, then by date like above */
+	key[0] = ~(uint64_t)commit_graph_generation(c);
+	key[1] = ~(uint64_t)c->date;
+}
+
 /*
  * Performs an in-place topological sort on the list supplied.
  */
@@ -1220,6 +1268,38 @@ int check_commit_signature(const struct commit *commit, struct signature_check *
 	return ret;
 }
 
+void prefetch_commit_signatures(struct commit **commits, size_t nr)
+{
+	struct signed_payload *items;
+	size_t i, items_nr = 0;
+
+	if (nr <= 1 || get_signature_verify_jobs() <= 1)
+		return;
+
+	CALLOC_ARRAY(items, nr);
+	for (i = 0; i < nr; i++) {
+		struct signed_payload *item = &items[items_nr];
+
+		strbuf_init(&item->payload, 0);
+		strbuf_init(&item->signature, 0);
+		if (parse_signed_commit(commits[i], &item->payload,
+					&item->signature, the_hash_algo) > 0) {
+			items_nr++;
+			continue;
+		}
+		strbuf_release(&item->payload);
+		strbuf_release(&item->signature);
+	}
+
+	prefetch_signatures(items, items_nr);
+
+	for (i = 0; i < items_nr; i++) {
+		strbuf_release(&items[i].payload);
+		strbuf_release(&items[i].signature);
+	}
+	free(items);
+}
+
 void verify_merge_signature(struct commit *commit, int verbosity,
 			    int check_trust)
 {
@@ -1570,7 +1650,7 @@ int commit_tree_extended(const char *msg, size_t msg_len,
 }
 
 define_commit_slab(merge_desc_slab, struct merge_remote_desc *);
-static struct merge_desc_slab merge_desc_slab = COMMIT_SLAB_INIT(1, merge_desc_slab);
+static struct merge_desc_slab merge_desc_slab = COMMIT_SLAB_INIT_SPARSE(merge_desc_slab);
 
 struct merge_remote_desc *merge_remote_util(struct commit *commit)
 {
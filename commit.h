@@ -79,6 +79,17 @@ struct commit *lookup_commit_reference_by_name(const char *name);
 struct commit *lookup_commit_or_die(const struct object_id *oid, const char *ref_name);
 
 int parse_commit_buffer(struct repository *r, struct commit *item, const void *buffer, unsigned long size, int check_graph);
+
+/*
+ * Parse the tree, the parents (appended to "parents") and the committer
+ * date out of the buffer of a commit object like parse_commit_buffer(),
+ * but without looking up any object, so that several threads may do it
+ * at once. Grafts are not applied. Return -1 if the buffer is bogus.
+ */
+struct oid_array;
+int parse_commit_buffer_oids(const void *buffer, unsigned long size,
+			     struct object_id *tree, struct oid_array *parents,
+			     timestamp_t *date);
 int repo_parse_commit_internal(struct repository *r, struct commit *item,
 			       int quiet_on_missing, int use_commit_graph);
 int repo_parse_commit_gently(struct repository *r,
@@ -335,6 +346,13 @@ int remove_signature(struct strbuf *buf);
  */
 int check_commit_signature(const struct commit *commit, struct signature_check *sigc);
 
+/*
+ * Verify the signatures of the given commits with several verifiers at
+ * once (see prefetch_signatures()), so that check_commit_signature() on
+ * them afterwards returns without waiting.
+ */
+void prefetch_commit_signatures(struct commit **commits, size_t nr);
+
 /* record author-date for each commit object */
 struct author_date_slab;
 void record_author_date(struct author_date_slab *author_date,
@@ -362,6 +380,13 @@ void verify_merge_signature(struct commit *commit, int verbose,
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
 int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
+/*
+ * Sort keys for a prio_queue that orders commits like the comparison
+ * functions above, for commits that are parsed before they are queued.
+ */
+void commit_key_by_commit_date(const void *commit, uint64_t *key, void *unused);
+void commit_key_by_gen_then_commit_date(const void *commit, uint64_t *key, void *unused);
+
 LAST_ARG_MUST_BE_NULL
 int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
 
@@ -0,0 +1,339 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include <sys/inotify.h>
+#include <poll.h>
+
+/*
+ * inotify only watches single directories, so we add a watch for
+ * every directory of the worktree (but not for the contents of any
+ * ".git" directory), and for the cookie directory, and keep track of
+ * which path each watch descriptor stands for.
+ */
+struct fsm_listen_data {
+	int fd_inotify;
+	int fd_shutdown[2];
+
+	/* Indexed by watch descriptor; relative paths, "" for the root. */
+	char **wd_paths;
+	int wd_alloc;
+
+	int wd_root;
+	int wd_cookies;
+};
+
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+		    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		    IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+static int add_watch(struct fsm_listen_data *data, const char *abs_path,
+		     const char *rel_path)
+{
+	int wd = inotify_add_watch(data->fd_inotify, abs_path, WATCH_MASK);
+
+	if (wd < 0) {
+		/* It may have disappeared (or be a symlink now). */
+		if (errno == ENOENT || errno == ENOTDIR)
+			return -2;
+		if (errno == ENOSPC)
+			return error(_("inotify watch limit reached; consider "
+				       "raising fs.inotify.max_user_watches"));
+		return error_errno(_("could not watch '%s'"), abs_path);
+	}
+
+	if (wd >= data->wd_alloc) {
+		int old_alloc = data->wd_alloc;
+
+		ALLOC_GROW(data->wd_paths, wd + 1, data->wd_alloc);
+		memset(data->wd_paths + old_alloc, 0,
+		       (data->wd_alloc - old_alloc) * sizeof(*data->wd_paths));
+	}
+	free(data->wd_paths[wd]);
+	data->wd_paths[wd] = xstrdup(rel_path);
+	return wd;
+}
+
+/*
+ * Watch the directory "rel_path" of the worktree and all directories
+ * below it.
+ */
+static int add_watch_recursive(struct fsmonitor_daemon_state *state,
+			       const char *rel_path)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf abs = STRBUF_INIT, rel = STRBUF_INIT;
+	size_t abs_len, rel_len;
+	struct dirent *de;
+	DIR *dir;
+	int ret;
+
+	strbuf_addbuf(&abs, &state->path_worktree_watch);
+	if (*rel_path)
+		strbuf_addf(&abs, "/%s", rel_path);
+	ret = add_watch(data, abs.buf, rel_path);
+	if (ret < 0) {
+		strbuf_release(&abs);
+		return ret == -2 ? 0 : -1;
+	}
+
+	dir = opendir(abs.buf);
+	if (!dir) {
+		strbuf_release(&abs);
+		return 0;
+	}
+
+	strbuf_addch(&abs, '/');
+	abs_len = abs.len;
+	strbuf_addstr(&rel, rel_path);
+	if (rel.len)
+		strbuf_addch(&rel, '/');
+	rel_len = rel.len;
+
+	ret = 0;
+	while (!ret && (de = readdir(dir))) {
+		int dtype = DTYPE(de);
+
+		if (is_dot_or_dotdot(de->d_name) || !strcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_setlen(&abs, abs_len);
+		strbuf_addstr(&abs, de->d_name);
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+
+			if (lstat(abs.buf, &st))
+				continue;
+			dtype = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		}
+		if (dtype != DT_DIR)
+			continue;
+
+		strbuf_setlen(&rel, rel_len);
+		strbuf_addstr(&rel, de->d_name);
+		ret = add_watch_recursive(state, rel.buf);
+	}
+
+	closedir(dir);
+	strbuf_release(&abs);
+	strbuf_release(&rel);
+	return ret;
+}
+
+/*
+ * A directory was moved away; its watches (and those of everything
+ * below it) now report events under a path we do not know about.
+ */
+static void remove_watch_recursive(struct fsm_listen_data *data,
+				   const char *rel_path)
+{
+	size_t len = strlen(rel_path);
+	int wd;
+
+	for (wd = 0; wd < data->wd_alloc; wd++) {
+		const char *p = data->wd_paths[wd];
+
+		if (!p || wd == data->wd_root || wd == data->wd_cookies)
+			continue;
+		if (strncmp(p, rel_path, len) || (p[len] && p[len] != '/'))
+			continue;
+		inotify_rm_watch(data->fd_inotify, wd);
+		FREE_AND_NULL(data->wd_paths[wd]);
+	}
+}
+
+static int handle_events(struct fsmonitor_daemon_state *state,
+			 const char *buf, ssize_t len)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	struct string_list cookies = STRING_LIST_INIT_DUP;
+	struct strbuf rel = STRBUF_INIT;
+	const char *p;
+	int ret = 0;
+
+	for (p = buf; p < buf + len; ) {
+		const struct inotify_event *ev = (const struct inotify_event *)p;
+		const char *dir_path;
+
+		p += sizeof(*ev) + ev->len;
+
+		if (ev->mask & IN_Q_OVERFLOW) {
+			fsmonitor_force_resync(state);
+			continue;
+		}
+		if (ev->wd < 0 || ev->wd >= data->wd_alloc ||
+		    !(dir_path = data->wd_paths[ev->wd]))
+			continue;
+		if (ev->mask & IN_IGNORED) {
+			FREE_AND_NULL(data->wd_paths[ev->wd]);
+			continue;
+		}
+
+		if (ev->wd == data->wd_cookies) {
+			if (ev->len && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+				string_list_append(&cookies, ev->name);
+			else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				ret = error(_("cookie directory '%s' was removed"),
+					    state->path_cookie_dir.buf);
+				break;
+			}
+			continue;
+		}
+
+		if (!ev->len) {
+			if (ev->wd == data->wd_root &&
+			    (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))) {
+				ret = error(_("worktree '%s' was removed"),
+					    state->path_worktree_watch.buf);
+				break;
+			}
+			continue;
+		}
+
+		strbuf_reset(&rel);
+		if (*dir_path)
+			strbuf_addf(&rel, "%s/", dir_path);
+		strbuf_addstr(&rel, ev->name);
+
+		if (!(ev->mask & IN_ISDIR)) {
+			string_list_append(&paths, rel.buf);
+			continue;
+		}
+
+		if (!strcmp(ev->name, ".git"))
+			continue;
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			/*
+			 * Anything created in there before we started
+			 * watching is covered by reporting the directory
+			 * itself.
+			 */
+			if (add_watch_recursive(state, rel.buf)) {
+				ret = -1;
+				break;
+			}
+		} else if (ev->mask & IN_MOVED_FROM)
+			remove_watch_recursive(data, rel.buf);
+		else if (!(ev->mask & IN_DELETE))
+			continue;
+
+		strbuf_addch(&rel, '/');
+		string_list_append(&paths, rel.buf);
+	}
+
+	if (paths.nr || cookies.nr)
+		fsmonitor_publish(state, &paths, &cookies);
+
+	string_list_clear(&paths, 0);
+	string_list_clear(&cookies, 0);
+	strbuf_release(&rel);
+	return ret;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+	data->fd_shutdown[0] = data->fd_shutdown[1] = -1;
+	data->wd_root = data->wd_cookies = -1;
+
+	data->fd_inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (data->fd_inotify < 0)
+		return error_errno(_("could not initialize inotify"));
+	if (pipe(data->fd_shutdown) < 0)
+		return error_errno(_("could not create pipe"));
+
+	data->wd_cookies = add_watch(data, state->path_cookie_dir.buf,
+				     state->path_cookie_dir.buf);
+	if (data->wd_cookies < 0)
+		return error(_("could not watch cookie directory '%s'"),
+			     state->path_cookie_dir.buf);
+
+	/*
+	 * Watching the root again below gives us the same descriptor; we
+	 * only need to remember which one it is.
+	 */
+	data->wd_root = add_watch(data, state->path_worktree_watch.buf, "");
+	if (data->wd_root < 0)
+		return error(_("could not watch worktree '%s'"),
+			     state->path_worktree_watch.buf);
+
+	return add_watch_recursive(state, "");
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	int wd;
+
+	if (!data)
+		return;
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_shutdown[0] >= 0)
+		close(data->fd_shutdown[0]);
+	if (data->fd_shutdown[1] >= 0)
+		close(data->fd_shutdown[1]);
+	for (wd = 0; wd < data->wd_alloc; wd++)
+		free(data->wd_paths[wd]);
+	free(data->wd_paths);
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	if (write(data->fd_shutdown[1], "q", 1) < 0)
+		error_errno(_("could not stop the fsmonitor listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	/* malloc()ed, so suitably aligned for struct inotify_event */
+	const size_t buf_size = 64 * 1024;
+	char *buf = xmalloc(buf_size);
+
+	for (;;) {
+		struct pollfd pfd[2];
+		ssize_t len;
+
+		pfd[0].fd = data->fd_inotify;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = data->fd_shutdown[0];
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("poll failed"));
+			state->error_code = -1;
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+		if (!pfd[0].revents)
+			continue;
+
+		len = read(data->fd_inotify, buf, buf_size);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			error_errno(_("could not read inotify events"));
+			state->error_code = -1;
+			break;
+		}
+
+		if (handle_events(state, buf, len)) {
+			state->error_code = -1;
+			break;
+		}
+	}
+
+	free(buf);
+}
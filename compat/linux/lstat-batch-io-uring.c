@@ -0,0 +1,218 @@
+#include "git-compat-util.h"
+#include "compat/lstat-batch.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/*
+ * A minimal io_uring client that only knows how to issue
+ * IORING_OP_STATX requests (Linux 5.6 and later).  We talk to the
+ * kernel directly instead of depending on liburing; all we need is
+ * one submission ring, one completion ring and the array of
+ * submission queue entries, all shared with the kernel via mmap().
+ *
+ * The ring heads and tails are written by one side and read by the
+ * other, so they are accessed with acquire/release semantics.
+ */
+struct lstat_batch {
+	int fd;
+	unsigned nr;
+	unsigned broken : 1;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct statx *stx;
+	int *res;
+};
+
+#define RING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static void *map_ring(int fd, size_t size, off_t offset)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, offset);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+struct lstat_batch *lstat_batch_init(unsigned nr)
+{
+	struct io_uring_params params;
+	struct lstat_batch *b;
+	int fd;
+
+	memset(&params, 0, sizeof(params));
+	fd = syscall(__NR_io_uring_setup, nr, &params);
+	if (fd < 0)
+		return NULL; /* e.g. ENOSYS, or EPERM under seccomp */
+
+	CALLOC_ARRAY(b, 1);
+	b->fd = fd;
+	b->nr = nr;
+
+	b->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	b->sq_ring = map_ring(fd, b->sq_ring_size, IORING_OFF_SQ_RING);
+	b->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	b->sqes = map_ring(fd, b->sqes_size, IORING_OFF_SQES);
+	b->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	b->cq_ring = map_ring(fd, b->cq_ring_size, IORING_OFF_CQ_RING);
+	if (!b->sq_ring || !b->sqes || !b->cq_ring) {
+		lstat_batch_release(b);
+		return NULL;
+	}
+
+	b->sq_tail = (unsigned *)((char *)b->sq_ring + params.sq_off.tail);
+	b->sq_mask = (unsigned *)((char *)b->sq_ring + params.sq_off.ring_mask);
+	b->sq_array = (unsigned *)((char *)b->sq_ring + params.sq_off.array);
+	b->cq_head = (unsigned *)((char *)b->cq_ring + params.cq_off.head);
+	b->cq_tail = (unsigned *)((char *)b->cq_ring + params.cq_off.tail);
+	b->cq_mask = (unsigned *)((char *)b->cq_ring + params.cq_off.ring_mask);
+	b->cqes = (struct io_uring_cqe *)((char *)b->cq_ring + params.cq_off.cqes);
+
+	ALLOC_ARRAY(b->stx, nr);
+	ALLOC_ARRAY(b->res, nr);
+	return b;
+}
+
+void lstat_batch_release(struct lstat_batch *b)
+{
+	if (!b)
+		return;
+	if (b->sq_ring)
+		munmap(b->sq_ring, b->sq_ring_size);
+	if (b->sqes)
+		munmap(b->sqes, b->sqes_size);
+	if (b->cq_ring)
+		munmap(b->cq_ring, b->cq_ring_size);
+	close(b->fd);
+	/*
+	 * Requests of a broken batch may still be in flight, and the
+	 * kernel could write their results after we are gone.
+	 */
+	if (!b->broken)
+		free(b->stx);
+	free(b->res);
+	free(b);
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/*
+ * Queue and submit one statx request per path, then wait for all of
+ * them to complete.  Returns the number of requests that are known
+ * to have completed; anything else must be redone by the caller.
+ */
+static unsigned run_batch(struct lstat_batch *b, unsigned nr, const char **path)
+{
+	unsigned mask = *b->sq_mask;
+	unsigned tail = *b->sq_tail;
+	unsigned submitted = 0, done = 0, i;
+
+	for (i = 0; i < nr; i++) {
+		unsigned idx = tail & mask;
+		struct io_uring_sqe *sqe = &b->sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)path[i];
+		sqe->len = STATX_BASIC_STATS;
+		sqe->off = (uintptr_t)&b->stx[i];
+		sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+		sqe->user_data = i;
+		b->sq_array[idx] = idx;
+		tail++;
+		b->res[i] = -EAGAIN;
+	}
+	RING_STORE(b->sq_tail, tail);
+
+	while (done < nr) {
+		unsigned head, cq_tail;
+		int ret;
+
+		ret = syscall(__NR_io_uring_enter, b->fd, nr - submitted,
+			      nr - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			break;
+		}
+		submitted += ret;
+
+		head = *b->cq_head;
+		cq_tail = RING_LOAD(b->cq_tail);
+		while (head != cq_tail) {
+			const struct io_uring_cqe *cqe = &b->cqes[head & *b->cq_mask];
+
+			if (cqe->user_data < nr) {
+				b->res[cqe->user_data] = cqe->res;
+				done++;
+			}
+			head++;
+		}
+		RING_STORE(b->cq_head, head);
+	}
+	return done;
+}
+
+void lstat_batch(struct lstat_batch *b, unsigned nr,
+		 const char **path, struct stat *st, int *err)
+{
+	unsigned i;
+
+	if (nr > b->nr)
+		BUG("lstat batch of %u paths exceeds its size %u", nr, b->nr);
+
+	if (!b->broken && run_batch(b, nr, path) < nr) {
+		/*
+		 * The ring is in a state we do not understand; stop
+		 * using it, and let lstat() handle everything from here
+		 * on.
+		 */
+		b->broken = 1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		int res = b->broken ? -EAGAIN : b->res[i];
+
+		if (!res) {
+			statx_to_stat(&b->stx[i], &st[i]);
+			err[i] = 0;
+		} else if (res == -ENOENT || res == -ENOTDIR) {
+			err[i] = -res;
+		} else if (lstat(path[i], &st[i])) {
+			/* statx itself may be unsupported (EINVAL) etc. */
+			err[i] = errno;
+		} else {
+			err[i] = 0;
+		}
+	}
+}
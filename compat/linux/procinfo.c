@@ -1,8 +1,10 @@
 #include "cache.h"
 
+#include "json-writer.h"
 #include "strbuf.h"
 #include "strvec.h"
 #include "trace2.h"
+#include <sys/resource.h>
 
 static void get_ancestry_names(struct strvec *names)
 {
@@ -28,14 +30,38 @@ static void get_ancestry_names(struct strvec *names)
 	/* NEEDSWORK: add non-procfs-linux implementations here */
 }
 
+/*
+ * Emit JSON data with the peak memory usage of the current process,
+ * like the "windows/memory" event does.
+ */
+static void get_peak_memory_info(void)
+{
+	struct rusage ru;
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return;
+
+	jw_object_begin(&jw, 0);
+	/* ru_maxrss is in kilobytes */
+	jw_object_intmax(&jw, "peak_rss_bytes", (intmax_t)ru.ru_maxrss * 1024);
+	jw_object_intmax(&jw, "minor_faults", (intmax_t)ru.ru_minflt);
+	jw_object_intmax(&jw, "major_faults", (intmax_t)ru.ru_majflt);
+	jw_end(&jw);
+
+	trace2_data_json("process", the_repository, "linux/memory", &jw);
+	jw_release(&jw);
+}
+
 void trace2_collect_process_info(enum trace2_process_info_reason reason)
 {
 	if (!trace2_is_enabled())
 		return;
 
-	/* someday we may want to write something extra here, but not today */
-	if (reason == TRACE2_PROCESS_INFO_EXIT)
+	if (reason == TRACE2_PROCESS_INFO_EXIT) {
+		get_peak_memory_info();
 		return;
+	}
 
 	if (reason == TRACE2_PROCESS_INFO_STARTUP) {
 		/*
@@ -0,0 +1,53 @@
+#ifndef COMPAT_LSTAT_BATCH_H
+#define COMPAT_LSTAT_BATCH_H
+
+/*
+ * Run lstat() on many paths at once, on platforms that can hand a
+ * whole batch of requests to the kernel in a single system call.
+ *
+ * lstat_batch_init() returns NULL when this is not supported (at
+ * build time or by the running kernel); callers are then expected to
+ * call lstat() themselves.  A batch is not thread-safe; each thread
+ * needs its own.
+ */
+struct lstat_batch;
+
+#ifdef USE_IO_URING
+
+/*
+ * Prepare for batches of up to "nr" paths.
+ */
+struct lstat_batch *lstat_batch_init(unsigned nr);
+
+/*
+ * lstat() the "nr" paths "path[0..nr-1]", storing the results in
+ * "st[i]", and 0 or the errno value lstat() would have given in
+ * "err[i]".  "nr" must not exceed the size the batch was created
+ * with.  This never fails as a whole; when the kernel refuses to
+ * handle a request, the path is given to lstat() instead.
+ */
+void lstat_batch(struct lstat_batch *batch, unsigned nr,
+		 const char **path, struct stat *st, int *err);
+
+void lstat_batch_release(struct lstat_batch *batch);
+
+#else
+
+static inline struct lstat_batch *lstat_batch_init(unsigned nr)
+{
+	return NULL;
+}
+
+static inline void lstat_batch(struct lstat_batch *batch, unsigned nr,
+			       const char **path, struct stat *st, int *err)
+{
+	BUG("lstat_batch() called without USE_IO_URING");
+}
+
+static inline void lstat_batch_release(struct lstat_batch *batch)
+{
+}
+
+#endif
+
+#endif /* COMPAT_LSTAT_BATCH_H */
@@ -14,6 +14,8 @@ typedef _sigset_t sigset_t;
 int mingw_core_config(const char *var, const char *value, void *cb);
 #define platform_core_config mingw_core_config
 
+#include "win32/fscache.h"
+
 /*
  * things that are not available in header files
  */
@@ -0,0 +1,236 @@
+#include "../../git-compat-util.h"
+#include "../../hashmap.h"
+#include "../../strbuf.h"
+#include "../win32.h"
+#include "fscache.h"
+
+int core_fscache;
+
+/* nesting depth of fscache_enable(), and whether the cache is in use */
+static int nesting;
+static int active;
+static int initialized;
+static CRITICAL_SECTION mutex;
+
+/* the directories looked at, with their listings */
+static struct hashmap dirs;
+
+struct fscache_dir {
+	struct hashmap_entry ent;
+	/* the files in the directory; empty if it could not be listed */
+	struct hashmap files;
+	unsigned listed:1;
+	size_t len;
+	char path[FLEX_ARRAY];
+};
+
+struct fscache_file {
+	struct hashmap_entry ent;
+	struct stat st;
+	/* symbolic links and other reparse points are left to lstat() */
+	unsigned must_stat:1;
+	char name[FLEX_ARRAY];
+};
+
+struct dir_key {
+	const char *path;
+	size_t len;
+};
+
+static int dir_cmp(const void *cmp_data,
+		   const struct hashmap_entry *eptr,
+		   const struct hashmap_entry *entry_or_key,
+		   const void *keydata)
+{
+	const struct fscache_dir *d = container_of(eptr, const struct fscache_dir, ent);
+	const struct dir_key *key = keydata;
+
+	if (!key) {
+		const struct fscache_dir *d2;
+
+		d2 = container_of(entry_or_key, const struct fscache_dir, ent);
+		return d->len != d2->len || strncasecmp(d->path, d2->path, d->len);
+	}
+	return d->len != key->len || strncasecmp(d->path, key->path, d->len);
+}
+
+static int file_cmp(const void *cmp_data,
+		    const struct hashmap_entry *eptr,
+		    const struct hashmap_entry *entry_or_key,
+		    const void *keydata)
+{
+	const struct fscache_file *f = container_of(eptr, const struct fscache_file, ent);
+	const struct fscache_file *f2;
+
+	if (keydata)
+		return strcasecmp(f->name, keydata);
+	f2 = container_of(entry_or_key, const struct fscache_file, ent);
+	return strcasecmp(f->name, f2->name);
+}
+
+/*
+ * The cache only knows relative paths of plain components, in the
+ * form Git itself uses for working tree paths; anything else goes to
+ * lstat().
+ */
+static int fscache_can_handle(const char *path)
+{
+	const char *p = path;
+
+	if (!*path || is_absolute_path(path) || has_dos_drive_prefix(path))
+		return 0;
+	for (;;) {
+		const char *end = strchrnul(p, '/');
+		size_t len = end - p;
+
+		if (!len || (len == 1 && p[0] == '.') ||
+		    (len == 2 && p[0] == '.' && p[1] == '.'))
+			return 0;
+		if (memchr(p, '\\', len) || memchr(p, ':', len))
+			return 0;
+		if (!*end)
+			return end - path < MAX_PATH;
+		p = end + 1;
+	}
+}
+
+static int add_file(struct fscache_dir *d, const WIN32_FIND_DATAW *fdata)
+{
+	char name[MAX_PATH * 3];
+	struct fscache_file *f;
+
+	if (!wcscmp(fdata->cFileName, L".") || !wcscmp(fdata->cFileName, L".."))
+		return 0;
+	if (xwcstoutf(name, fdata->cFileName, sizeof(name)) < 0)
+		return -1;
+
+	FLEX_ALLOC_STR(f, name, name);
+	f->st.st_mode = file_attr_to_st_mode(fdata->dwFileAttributes);
+	f->st.st_size = fdata->nFileSizeLow |
+		(((off_t)fdata->nFileSizeHigh) << 32);
+	f->st.st_nlink = 1;
+	filetime_to_timespec(&fdata->ftLastAccessTime, &f->st.st_atim);
+	filetime_to_timespec(&fdata->ftLastWriteTime, &f->st.st_mtim);
+	filetime_to_timespec(&fdata->ftCreationTime, &f->st.st_ctim);
+	f->must_stat = !!(fdata->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+
+	hashmap_entry_init(&f->ent, strihash(f->name));
+	hashmap_add(&d->files, &f->ent);
+	return 0;
+}
+
+static struct fscache_dir *list_directory(const char *path, size_t len,
+					  unsigned int hash)
+{
+	struct fscache_dir *d;
+	struct strbuf pattern = STRBUF_INIT;
+	wchar_t wpattern[MAX_PATH];
+	WIN32_FIND_DATAW fdata;
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	int err;
+
+	FLEX_ALLOC_MEM(d, path, path, len);
+	d->len = len;
+	hashmap_init(&d->files, file_cmp, NULL, 0);
+	hashmap_entry_init(&d->ent, hash);
+	hashmap_add(&dirs, &d->ent);
+
+	strbuf_add(&pattern, path, len);
+	if (len)
+		strbuf_addch(&pattern, '/');
+	strbuf_addch(&pattern, '*');
+	if (xutftowcs_path(wpattern, pattern.buf) >= 0)
+		handle = FindFirstFileExW(wpattern, FindExInfoBasic, &fdata,
+					  FindExSearchNameMatch, NULL,
+					  FIND_FIRST_EX_LARGE_FETCH);
+	strbuf_release(&pattern);
+	if (handle == INVALID_HANDLE_VALUE)
+		return d;
+
+	do {
+		err = add_file(d, &fdata);
+	} while (!err && FindNextFileW(handle, &fdata));
+	d->listed = !err && GetLastError() == ERROR_NO_MORE_FILES;
+	FindClose(handle);
+
+	if (!d->listed) {
+		/* a partial listing must not turn into false ENOENTs */
+		hashmap_clear_and_free(&d->files, struct fscache_file, ent);
+		hashmap_init(&d->files, file_cmp, NULL, 0);
+	}
+	return d;
+}
+
+int fscache_lstat(const char *file_name, struct stat *buf)
+{
+	const char *slash, *base;
+	struct dir_key key;
+	unsigned int hash;
+	struct fscache_dir *d;
+	struct fscache_file *f;
+	int ret = 1;
+
+	if (!fscache_can_handle(file_name))
+		return 1;
+
+	slash = strrchr(file_name, '/');
+	key.path = file_name;
+	key.len = slash ? slash - file_name : 0;
+	base = slash ? slash + 1 : file_name;
+	hash = memihash(key.path, key.len);
+
+	EnterCriticalSection(&mutex);
+	d = hashmap_get_entry_from_hash(&dirs, hash, &key,
+					struct fscache_dir, ent);
+	if (!d)
+		d = list_directory(key.path, key.len, hash);
+	if (d->listed) {
+		f = hashmap_get_entry_from_hash(&d->files, strihash(base), base,
+						struct fscache_file, ent);
+		if (!f) {
+			errno = ENOENT;
+			ret = -1;
+		} else if (!f->must_stat) {
+			*buf = f->st;
+			ret = 0;
+		}
+	}
+	LeaveCriticalSection(&mutex);
+	return ret;
+}
+
+/*
+ * Enabling and disabling happens on the main thread, around the scans
+ * that may then lstat() from several threads.
+ */
+void fscache_enable(void)
+{
+	if (nesting++)
+		return;
+	if (!core_fscache)
+		return;
+	if (!initialized) {
+		InitializeCriticalSection(&mutex);
+		initialized = 1;
+	}
+	hashmap_init(&dirs, dir_cmp, NULL, 0);
+	active = 1;
+}
+
+void fscache_disable(void)
+{
+	struct hashmap_iter iter;
+	struct fscache_dir *d;
+
+	if (!nesting || --nesting || !active)
+		return;
+	active = 0;
+	hashmap_for_each_entry(&dirs, &iter, d, ent)
+		hashmap_clear_and_free(&d->files, struct fscache_file, ent);
+	hashmap_clear_and_free(&dirs, struct fscache_dir, ent);
+}
+
+int fscache_enabled(void)
+{
+	return active;
+}
@@ -0,0 +1,32 @@
+#ifndef FSCACHE_H
+#define FSCACHE_H
+
+/*
+ * A cache of lstat() results for Windows, where every lstat() is a
+ * separate, and slow, query of the filesystem.  While the cache is
+ * enabled, the first lstat() of a path in a directory lists the whole
+ * directory with a single FindFirstFileExW() enumeration, and the other
+ * paths in it are answered from that listing.
+ *
+ * The cache is only used if core.fscache is set, and only between
+ * enable_fscache() and the matching disable_fscache().  Callers must
+ * only enable it around scans of the working tree that do not write
+ * to it themselves.  Calls may be nested.
+ */
+
+extern int core_fscache;
+
+void fscache_enable(void);
+void fscache_disable(void);
+int fscache_enabled(void);
+
+/*
+ * Returns 0 or -1, with errno set, as lstat() would when the cache can
+ * answer for the path, or 1 when the caller has to stat it itself.
+ */
+int fscache_lstat(const char *file_name, struct stat *buf);
+
+#define enable_fscache() fscache_enable()
+#define disable_fscache() fscache_disable()
+
+#endif
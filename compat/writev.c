@@ -0,0 +1,21 @@
+#include "../git-compat-util.h"
+
+ssize_t git_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		ssize_t written;
+
+		if (!iov[i].iov_len)
+			continue;
+		written = write(fd, iov[i].iov_base, iov[i].iov_len);
+		if (written < 0)
+			return total ? total : -1;
+		total += written;
+		if (written < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
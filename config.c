@@ -20,7 +20,9 @@
 #include "utf8.h"
 #include "dir.h"
 #include "color.h"
+#include "fsmonitor-ipc.h"
 #include "refs.h"
+#include "csum-file.h"
 
 struct config_source {
 	struct config_source *prev;
@@ -128,6 +130,42 @@ static const char include_depth_advice[] = N_(
 "from\n"
 "	%s\n"
 "This might be due to circular includes.");
+/*
+ * While a config snapshot is being prepared, the files the configuration
+ * was read from, or would have been read from had they existed, along
+ * with their stat data.
+ */
+struct config_snapshot_dep {
+	unsigned exists : 1;
+	struct stat_data sd;
+};
+static struct string_list *config_snapshot_deps;
+static time_t config_snapshot_start;
+static int config_snapshot_racy;
+
+static void config_snapshot_note_file(const char *path)
+{
+	struct config_snapshot_dep *dep;
+	struct stat st;
+
+	if (!config_snapshot_deps ||
+	    unsorted_string_list_lookup(config_snapshot_deps, path))
+		return;
+
+	CALLOC_ARRAY(dep, 1);
+	if (!stat(path, &st)) {
+		dep->exists = 1;
+		fill_stat_data(&dep->sd, &st);
+		/*
+		 * A change later within the same second would go unnoticed,
+		 * just like a racily clean index entry.
+		 */
+		if (st.st_mtime >= config_snapshot_start)
+			config_snapshot_racy = 1;
+	}
+	string_list_append(config_snapshot_deps, path)->util = dep;
+}
+
 static int handle_path_include(const char *path, struct config_include_data *inc)
 {
 	int ret = 0;
@@ -159,6 +197,7 @@ static int handle_path_include(const char *path, struct config_include_data *inc
 		path = buf.buf;
 	}
 
+	config_snapshot_note_file(path);
 	if (!access_or_die(path, R_OK, 0)) {
 		if (++inc->depth > MAX_INCLUDE_DEPTH)
 			die(_(include_depth_advice), MAX_INCLUDE_DEPTH, path,
@@ -281,6 +320,8 @@ static int include_by_branch(const char *cond, size_t cond_len)
 		NULL : resolve_ref_unsafe("HEAD", 0, NULL, &flags);
 	const char *shortname;
 
+	if (the_repository->gitdir)
+		config_snapshot_note_file(mkpath("%s/HEAD", the_repository->gitdir));
 	if (!refname || !(flags & REF_ISSYMREF)	||
 			!skip_prefix(refname, "refs/heads/", &shortname))
 		return 0;
@@ -1431,11 +1472,26 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.packedgitmapwhole")) {
+		packed_git_map_whole = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.commitslabhugepages")) {
+		commit_slab_huge_pages = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.deltabasecachelimit")) {
 		delta_base_cache_limit = git_config_ulong(var, value);
 		return 0;
 	}
 
+	if (!strcmp(var, "core.treediffcachelimit")) {
+		tree_diff_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.autocrlf")) {
 		if (value && !strcasecmp(value, "input")) {
 			auto_crlf = AUTO_CRLF_INPUT;
@@ -1509,7 +1565,27 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 	}
 
 	if (!strcmp(var, "core.fsyncobjectfiles")) {
-		fsync_object_files = git_config_bool(var, value);
+		if (value && !strcasecmp(value, "batch"))
+			fsync_object_files = FSYNC_OBJECT_FILES_BATCH;
+		else if (git_config_bool(var, value))
+			fsync_object_files = FSYNC_OBJECT_FILES_ON;
+		else
+			fsync_object_files = FSYNC_OBJECT_FILES_OFF;
+		return 0;
+	}
+
+	if (!strcmp(var, "core.fsyncreffiles")) {
+		if (value && !strcasecmp(value, "batch"))
+			fsync_ref_files = FSYNC_OBJECT_FILES_BATCH;
+		else if (git_config_bool(var, value))
+			fsync_ref_files = FSYNC_OBJECT_FILES_ON;
+		else
+			fsync_ref_files = FSYNC_OBJECT_FILES_OFF;
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectjournal")) {
+		core_loose_object_journal = git_config_bool(var, value);
 		return 0;
 	}
 
@@ -2057,12 +2133,12 @@ static struct config_set_element *configset_find_element(struct config_set *cs,
 	return found_entry;
 }
 
-static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+static void configset_add_entry(struct config_set *cs, const char *key,
+				const char *value, struct key_value_info *kv_info)
 {
 	struct config_set_element *e;
 	struct string_list_item *si;
 	struct configset_list_item *l_item;
-	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
 	e = configset_find_element(cs, key);
 	/*
@@ -2082,6 +2158,12 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 	l_item = &cs->list.items[cs->list.nr++];
 	l_item->e = e;
 	l_item->value_index = e->value_list.nr - 1;
+	si->util = kv_info;
+}
+
+static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+{
+	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
 	if (!cf)
 		BUG("configset_add_value has no source");
@@ -2096,7 +2178,7 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 		kv_info->origin_type = CONFIG_ORIGIN_CMDLINE;
 	}
 	kv_info->scope = current_parsing_scope;
-	si->util = kv_info;
+	configset_add_entry(cs, key, value, kv_info);
 
 	return 0;
 }
@@ -2264,6 +2346,368 @@ int git_configset_get_pathname(struct config_set *cs, const char *key, const cha
 }
 
 /* Functions use to read configuration from a repository */
+/*
+ * A config snapshot, "$GIT_DIR/config-snapshot", keeps what the
+ * configuration files of a repository gave the last time they were
+ * parsed, so that we can skip parsing them again as long as none of
+ * them changed.  It consists of
+ *
+ *  - CONFIG_SNAPSHOT_SIGNATURE, the version and the format id of the
+ *    hash algorithm of the trailer, all in network byte order;
+ *
+ *  - the $GIT_DIR it was written for, NUL-terminated;
+ *
+ *  - the number of files the regular lookup sequence would read, and
+ *    their NUL-terminated names;
+ *
+ *  - the number of files the configuration depends on, and for each
+ *    of them its NUL-terminated name, whether it exists and its stat
+ *    data;
+ *
+ *  - the number of entries, and for each of them its scope, origin
+ *    type, line number and flags, followed by the NUL-terminated key,
+ *    value and file name, the latter two only if the flags say so;
+ *
+ *  - a checksum of all of the above.
+ *
+ * Values given on the command line are never part of it.
+ */
+#define CONFIG_SNAPSHOT_SIGNATURE 0x43464753 /* "CFGS" */
+#define CONFIG_SNAPSHOT_VERSION 1
+#define CONFIG_SNAPSHOT_HEADER_SIZE 12
+
+#define CONFIG_SNAPSHOT_HAS_VALUE (1u<<0)
+#define CONFIG_SNAPSHOT_HAS_FILENAME (1u<<1)
+
+struct config_snapshot_reader {
+	const char *p, *end;
+	unsigned bad : 1;
+};
+
+static uint32_t snapshot_read_be32(struct config_snapshot_reader *r)
+{
+	uint32_t value;
+
+	if (r->end - r->p < 4) {
+		r->bad = 1;
+		return 0;
+	}
+	value = get_be32(r->p);
+	r->p += 4;
+	return value;
+}
+
+static const char *snapshot_read_str(struct config_snapshot_reader *r)
+{
+	const char *s = r->p;
+	const char *nul = memchr(s, '\0', r->end - s);
+
+	if (!nul) {
+		r->bad = 1;
+		return "";
+	}
+	r->p = nul + 1;
+	return s;
+}
+
+static void snapshot_read_stat_data(struct config_snapshot_reader *r,
+				    struct stat_data *sd)
+{
+	sd->sd_ctime.sec = snapshot_read_be32(r);
+	sd->sd_ctime.nsec = snapshot_read_be32(r);
+	sd->sd_mtime.sec = snapshot_read_be32(r);
+	sd->sd_mtime.nsec = snapshot_read_be32(r);
+	sd->sd_ino = snapshot_read_be32(r);
+	sd->sd_size = snapshot_read_be32(r);
+}
+
+static void snapshot_add_be32(struct strbuf *sb, uint32_t value)
+{
+	value = htonl(value);
+	strbuf_add(sb, &value, sizeof(value));
+}
+
+static void snapshot_add_stat_data(struct strbuf *sb, const struct stat_data *sd)
+{
+	snapshot_add_be32(sb, sd->sd_ctime.sec);
+	snapshot_add_be32(sb, sd->sd_ctime.nsec);
+	snapshot_add_be32(sb, sd->sd_mtime.sec);
+	snapshot_add_be32(sb, sd->sd_mtime.nsec);
+	snapshot_add_be32(sb, sd->sd_ino);
+	snapshot_add_be32(sb, sd->sd_size);
+}
+
+static int snapshot_dep_is_fresh(const char *path, int exists,
+				 const struct stat_data *sd)
+{
+	struct stat st;
+	struct stat_data now;
+
+	if (stat(path, &st))
+		return !exists && errno == ENOENT;
+	if (!exists)
+		return 0;
+	fill_stat_data(&now, &st);
+	return now.sd_ctime.sec == sd->sd_ctime.sec &&
+	       now.sd_ctime.nsec == sd->sd_ctime.nsec &&
+	       now.sd_mtime.sec == sd->sd_mtime.sec &&
+	       now.sd_mtime.nsec == sd->sd_mtime.nsec &&
+	       now.sd_ino == sd->sd_ino &&
+	       now.sd_size == sd->sd_size;
+}
+
+/* The files the regular lookup sequence reads, whether they exist or not */
+static void config_snapshot_sequence(const struct config_options *opts,
+				     struct string_list *files)
+{
+	char *system_config = git_system_config();
+	char *xdg_config = NULL;
+	char *user_config = NULL;
+
+	if (git_config_system() && system_config)
+		string_list_append(files, system_config);
+	git_global_config(&user_config, &xdg_config);
+	if (xdg_config)
+		string_list_append(files, xdg_config);
+	if (user_config)
+		string_list_append(files, user_config);
+	if (!opts->ignore_repo)
+		string_list_append_nodup(files,
+					 mkpathdup("%s/config", opts->commondir));
+	if (!opts->ignore_worktree && repository_format_worktree_config)
+		string_list_append_nodup(files, git_pathdup("config.worktree"));
+
+	free(system_config);
+	free(xdg_config);
+	free(user_config);
+}
+
+/*
+ * Fill "cs" from the snapshot at "path".  Returns 0 if it was used, -1
+ * if there is none, and 1 if it is stale or broken.
+ */
+static int load_config_snapshot(struct config_set *cs, const char *path,
+				const char *git_dir,
+				const struct string_list *sequence)
+{
+	struct config_snapshot_reader r;
+	const struct git_hash_algo *algo;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	struct stat st;
+	size_t size;
+	uint32_t nr, i;
+	char *map;
+	int fd, algo_id, ret = 1;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < CONFIG_SNAPSHOT_HEADER_SIZE) {
+		close(fd);
+		return 1;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap_gently(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 1;
+
+	algo_id = hash_algo_by_id(get_be32(map + 8));
+	if (get_be32(map) != CONFIG_SNAPSHOT_SIGNATURE ||
+	    get_be32(map + 4) != CONFIG_SNAPSHOT_VERSION ||
+	    algo_id == GIT_HASH_UNKNOWN)
+		goto out;
+	algo = &hash_algos[algo_id];
+	if (size < CONFIG_SNAPSHOT_HEADER_SIZE + algo->rawsz)
+		goto out;
+	algo->init_fn(&ctx);
+	algo->update_fn(&ctx, map, size - algo->rawsz);
+	algo->final_fn(hash, &ctx);
+	if (memcmp(hash, map + size - algo->rawsz, algo->rawsz))
+		goto out;
+
+	r.p = map + CONFIG_SNAPSHOT_HEADER_SIZE;
+	r.end = map + size - algo->rawsz;
+	r.bad = 0;
+
+	if (strcmp(snapshot_read_str(&r), git_dir))
+		goto out;
+	nr = snapshot_read_be32(&r);
+	if (nr != sequence->nr)
+		goto out;
+	for (i = 0; i < nr; i++)
+		if (strcmp(snapshot_read_str(&r), sequence->items[i].string))
+			goto out;
+
+	nr = snapshot_read_be32(&r);
+	for (i = 0; i < nr && !r.bad; i++) {
+		const char *dep = snapshot_read_str(&r);
+		int exists = snapshot_read_be32(&r);
+		struct stat_data sd;
+
+		snapshot_read_stat_data(&r, &sd);
+		if (r.bad || !snapshot_dep_is_fresh(dep, exists, &sd))
+			goto out;
+	}
+
+	nr = snapshot_read_be32(&r);
+	for (i = 0; i < nr && !r.bad; i++) {
+		struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
+		const char *key, *value = NULL;
+		unsigned flags;
+
+		kv_info->scope = snapshot_read_be32(&r);
+		kv_info->origin_type = snapshot_read_be32(&r);
+		kv_info->linenr = (int)snapshot_read_be32(&r);
+		flags = snapshot_read_be32(&r);
+		key = snapshot_read_str(&r);
+		if (flags & CONFIG_SNAPSHOT_HAS_VALUE)
+			value = snapshot_read_str(&r);
+		kv_info->filename = flags & CONFIG_SNAPSHOT_HAS_FILENAME ?
+			strintern(snapshot_read_str(&r)) : NULL;
+		if (r.bad) {
+			free(kv_info);
+			break;
+		}
+		configset_add_entry(cs, key, value, kv_info);
+	}
+	if (!r.bad)
+		ret = 0;
+
+out:
+	munmap(map, size);
+	return ret;
+}
+
+static int write_config_snapshot(struct config_set *cs, const char *path,
+				  const char *git_dir,
+				  const struct string_list *sequence,
+				  const struct string_list *deps)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct hashfile *f;
+	int i;
+
+	if (hold_lock_file_for_update(&lk, path, 0) < 0)
+		return -1;
+
+	snapshot_add_be32(&buf, CONFIG_SNAPSHOT_SIGNATURE);
+	snapshot_add_be32(&buf, CONFIG_SNAPSHOT_VERSION);
+	snapshot_add_be32(&buf, the_hash_algo->format_id);
+	strbuf_add(&buf, git_dir, strlen(git_dir) + 1);
+
+	snapshot_add_be32(&buf, sequence->nr);
+	for (i = 0; i < sequence->nr; i++)
+		strbuf_add(&buf, sequence->items[i].string,
+			   strlen(sequence->items[i].string) + 1);
+
+	snapshot_add_be32(&buf, deps->nr);
+	for (i = 0; i < deps->nr; i++) {
+		struct config_snapshot_dep *dep = deps->items[i].util;
+
+		strbuf_add(&buf, deps->items[i].string,
+			   strlen(deps->items[i].string) + 1);
+		snapshot_add_be32(&buf, dep->exists);
+		snapshot_add_stat_data(&buf, &dep->sd);
+	}
+
+	snapshot_add_be32(&buf, cs->list.nr);
+	for (i = 0; i < cs->list.nr; i++) {
+		struct config_set_element *e = cs->list.items[i].e;
+		struct string_list_item *si =
+			&e->value_list.items[cs->list.items[i].value_index];
+		struct key_value_info *kv_info = si->util;
+		unsigned flags = 0;
+
+		if (si->string)
+			flags |= CONFIG_SNAPSHOT_HAS_VALUE;
+		if (kv_info->filename)
+			flags |= CONFIG_SNAPSHOT_HAS_FILENAME;
+		snapshot_add_be32(&buf, kv_info->scope);
+		snapshot_add_be32(&buf, kv_info->origin_type);
+		snapshot_add_be32(&buf, (uint32_t)kv_info->linenr);
+		snapshot_add_be32(&buf, flags);
+		strbuf_add(&buf, e->key, strlen(e->key) + 1);
+		if (si->string)
+			strbuf_add(&buf, si->string, strlen(si->string) + 1);
+		if (kv_info->filename)
+			strbuf_add(&buf, kv_info->filename,
+				   strlen(kv_info->filename) + 1);
+	}
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite(f, buf.buf, buf.len);
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM);
+	strbuf_release(&buf);
+	return commit_lock_file(&lk);
+}
+
+/*
+ * Read the configuration files through the snapshot if it is fresh, or
+ * parse them and, if core.configSnapshot says so, write a new one.
+ * The command line is parsed on top either way.
+ */
+static void read_config_with_snapshot(struct config_set *cs,
+				      const struct config_options *opts)
+{
+	struct config_options file_opts = *opts;
+	struct string_list sequence = STRING_LIST_INIT_DUP;
+	struct string_list deps = STRING_LIST_INIT_DUP;
+	struct config_include_data inc = CONFIG_INCLUDE_INIT;
+	enum config_scope prev_parsing_scope = current_parsing_scope;
+	char *path = mkpathdup("%s/config-snapshot", opts->git_dir);
+	int i, loaded, wanted = 0;
+
+	config_snapshot_sequence(opts, &sequence);
+	loaded = load_config_snapshot(cs, path, opts->git_dir, &sequence);
+	if (!loaded) {
+		trace2_data_string("config", NULL, "snapshot", "used");
+	} else {
+		git_configset_clear(cs);
+		git_configset_init(cs);
+
+		config_snapshot_start = time(NULL);
+		config_snapshot_racy = 0;
+		config_snapshot_deps = &deps;
+		for (i = 0; i < sequence.nr; i++)
+			config_snapshot_note_file(sequence.items[i].string);
+
+		file_opts.ignore_cmdline = 1;
+		if (config_with_options(config_set_callback, cs, NULL, &file_opts) < 0)
+			die(_("unknown error occurred while reading the configuration files"));
+		config_snapshot_deps = NULL;
+
+		if (!git_configset_get_bool(cs, "core.configsnapshot", &wanted) &&
+		    wanted) {
+			if (!config_snapshot_racy &&
+			    !write_config_snapshot(cs, path, opts->git_dir,
+						   &sequence, &deps))
+				trace2_data_string("config", NULL, "snapshot",
+						   "written");
+		} else if (loaded > 0) {
+			unlink(path);
+		}
+	}
+
+	if (!opts->ignore_cmdline) {
+		inc.fn = config_set_callback;
+		inc.data = cs;
+		inc.opts = opts;
+		current_parsing_scope = CONFIG_SCOPE_COMMAND;
+		if (git_config_from_parameters(git_config_include, &inc) < 0)
+			die(_("unable to parse command-line config"));
+		current_parsing_scope = prev_parsing_scope;
+	}
+
+	for (i = 0; i < deps.nr; i++)
+		free(deps.items[i].util);
+	string_list_clear(&deps, 0);
+	string_list_clear(&sequence, 0);
+	free(path);
+}
+
 static void repo_read_config(struct repository *repo)
 {
 	struct config_options opts = { 0 };
@@ -2279,6 +2723,11 @@ static void repo_read_config(struct repository *repo)
 
 	git_configset_init(repo->config);
 
+	if (repo == the_repository && repo->gitdir && repo->commondir) {
+		read_config_with_snapshot(repo->config, &opts);
+		return;
+	}
+
 	if (config_with_options(config_set_callback, repo->config, NULL, &opts) < 0)
 		/*
 		 * config_with_options() normally returns only
@@ -2517,14 +2966,49 @@ int git_config_get_max_percent_split_change(void)
 	return -1; /* default value */
 }
 
+int git_config_get_defer_shared_index(void)
+{
+	int val;
+
+	if (!git_config_get_bool("splitindex.defersharedindex", &val))
+		return val;
+
+	return 0; /* default value */
+}
+
 int git_config_get_fsmonitor(void)
 {
+	static int warned_unsupported;
+
 	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
 		core_fsmonitor = getenv("GIT_TEST_FSMONITOR");
 
 	if (core_fsmonitor && !*core_fsmonitor)
 		core_fsmonitor = NULL;
 
+	/*
+	 * A boolean value selects (or turns off) the built-in daemon
+	 * instead of naming a hook.
+	 */
+	core_use_builtin_fsmonitor = 0;
+	if (core_fsmonitor) {
+		switch (git_parse_maybe_bool(core_fsmonitor)) {
+		case 0:
+			core_fsmonitor = NULL;
+			break;
+		case 1:
+			if (fsmonitor_ipc__is_supported()) {
+				core_use_builtin_fsmonitor = 1;
+				break;
+			}
+			if (!warned_unsupported++)
+				warning(_("the built-in file system monitor is "
+					  "not supported on this platform"));
+			core_fsmonitor = NULL;
+			break;
+		}
+	}
+
 	if (core_fsmonitor)
 		return 1;
 
@@ -6,6 +6,134 @@
 #include "transport.h"
 #include "packfile.h"
 #include "promisor-remote.h"
+#include "config.h"
+#include "revision.h"
+#include "pack-bitmap.h"
+#include "oidset.h"
+#include "commit.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "tag.h"
+#include "progress.h"
+
+/* Queue the objects "oid" points to, or return -1 if it is missing. */
+static int push_links(struct repository *r, const struct object_id *oid,
+		      struct oid_array *stack)
+{
+	switch (oid_object_info(r, oid, NULL)) {
+	case OBJ_COMMIT: {
+		struct commit *commit = lookup_commit(r, oid);
+		struct commit_list *parents;
+
+		if (!commit || repo_parse_commit(r, commit))
+			return -1;
+		oid_array_append(stack, get_commit_tree_oid(commit));
+		for (parents = commit->parents; parents; parents = parents->next)
+			oid_array_append(stack, &parents->item->object.oid);
+		return 0;
+	}
+	case OBJ_TREE: {
+		struct tree *tree = lookup_tree(r, oid);
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		if (!tree || parse_tree_gently(tree, 1) < 0)
+			return -1;
+		init_tree_desc(&desc, tree->buffer, tree->size);
+		while (tree_entry(&desc, &entry))
+			if (!S_ISGITLINK(entry.mode))
+				oid_array_append(stack, &entry.oid);
+		free_tree_buffer(tree);
+		return 0;
+	}
+	case OBJ_TAG: {
+		struct tag *tag = lookup_tag(r, oid);
+
+		if (!tag || parse_tag(tag))
+			return -1;
+		oid_array_append(stack, get_tagged_oid(tag));
+		return 0;
+	}
+	case OBJ_BLOB:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Prove in-process that everything reachable from "tips" is there, by
+ * walking from them until we reach objects that the reachability
+ * bitmaps say are reachable from our refs (and therefore complete), or
+ * that are in "new_pack", which index-pack found to be self-contained.
+ *
+ * Returns 0 if that worked, and -1 if it did not, which includes the
+ * case of missing objects; the caller then asks rev-list, which knows
+ * how to complain about them.
+ */
+static int check_connected_with_bitmaps(struct oid_array *tips,
+					struct packed_git *new_pack,
+					struct check_connected_options *opt)
+{
+	const char *argv[] = { "rev-list", "--objects", "--all", NULL };
+	struct repository *r = the_repository;
+	struct rev_info revs;
+	struct bitmap_index *bitmap_git;
+	struct oidset seen = OIDSET_INIT;
+	struct oid_array stack = OID_ARRAY_INIT;
+	struct progress *progress = NULL;
+	uint64_t nr = 0;
+	int i, ret = -1;
+
+	repo_init_revisions(r, &revs, NULL);
+	setup_revisions(ARRAY_SIZE(argv) - 1, argv, &revs, NULL);
+	bitmap_git = prepare_bitmap_walk(&revs, NULL, 0);
+	reset_revision_walk();
+	if (!bitmap_git)
+		return -1;
+
+	if (opt->progress)
+		progress = start_delayed_progress(_("Checking connectivity"), 0);
+
+	for (i = 0; i < tips->nr; i++)
+		oid_array_append(&stack, &tips->oid[i]);
+	while (stack.nr) {
+		struct object_id oid;
+
+		oidcpy(&oid, &stack.oid[--stack.nr]);
+		if (oidset_insert(&seen, &oid) ||
+		    bitmap_has_oid_in_result(bitmap_git, &oid) ||
+		    (new_pack && find_pack_entry_one(oid.hash, new_pack)))
+			continue;
+		display_progress(progress, ++nr);
+		if (push_links(r, &oid, &stack))
+			goto out;
+	}
+	ret = 0;
+
+out:
+	trace2_data_intmax("connectivity", r, "bitmap/walked", nr);
+	stop_progress(&progress);
+	oid_array_clear(&stack);
+	oidset_clear(&seen);
+	free_bitmap_index(bitmap_git);
+	return ret;
+}
+
+struct tips_iterator {
+	struct oid_array *tips;
+	size_t pos;
+};
+
+static int iterate_tips(void *cb_data, struct object_id *oid)
+{
+	struct tips_iterator *iter = cb_data;
+
+	if (iter->pos >= iter->tips->nr)
+		return -1;
+	oidcpy(oid, &iter->tips->oid[iter->pos++]);
+	return 0;
+}
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -28,6 +156,9 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	int err = 0;
 	struct packed_git *new_pack = NULL;
 	struct transport *transport;
+	struct oid_array tips = OID_ARRAY_INIT;
+	struct tips_iterator tips_iter = { &tips };
+	int use_bitmaps = 1;
 	size_t base_len;
 
 	if (!opt)
@@ -88,6 +219,29 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	}
 
 no_promisor_pack_found:
+	git_config_get_bool("transfer.connectivitybitmaps", &use_bitmaps);
+	if (use_bitmaps && !opt->shallow_file && !opt->is_deepening_fetch &&
+	    !has_promisor_remote()) {
+		do {
+			if (new_pack && find_pack_entry_one(oid.hash, new_pack))
+				continue;
+			oid_array_append(&tips, &oid);
+		} while (!fn(cb_data, &oid));
+
+		if (!tips.nr || !check_connected_with_bitmaps(&tips, new_pack,
+							      opt)) {
+			if (opt->err_fd)
+				close(opt->err_fd);
+			oid_array_clear(&tips);
+			return 0;
+		}
+
+		/* let rev-list check what the bitmaps could not */
+		fn = iterate_tips;
+		cb_data = &tips_iter;
+		fn(cb_data, &oid);
+	}
+
 	if (opt->shallow_file) {
 		strvec_push(&rev_list.args, "--shallow-file");
 		strvec_push(&rev_list.args, opt->shallow_file);
@@ -149,5 +303,6 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		err = error_errno(_("failed to close rev-list's stdin"));
 
 	sigchain_pop(SIGPIPE);
+	oid_array_clear(&tips);
 	return finish_command(&rev_list) || err;
 }
@@ -55,6 +55,10 @@ struct check_connected_options {
  * either exist in our object store or (if the repository is a partial
  * clone) are promised to be available.
  *
+ * When the repository has reachability bitmaps, this is done in-process
+ * (see transfer.connectivityBitmaps); otherwise, or if that fails,
+ * "git rev-list" is run to do it.
+ *
  * Return 0 if Ok, non zero otherwise (i.e. some missing objects)
  *
  * If "opt" is NULL, behaves as if CHECK_CONNECTED_INIT was passed.
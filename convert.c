@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "object-store.h"
+#include "oidmap.h"
 #include "attr.h"
 #include "run-command.h"
 #include "quote.h"
@@ -32,6 +33,26 @@ struct text_stat {
 	unsigned printable, nonprintable;
 };
 
+/*
+ * Bytes that gather_stats() only has to count as printable, i.e. all
+ * but control characters and DEL, are by far the most common in text.
+ * Check eight of them at a time with the usual bit tricks: a byte
+ * below 0x20 borrows in "x - 0x20" without having its top bit set in
+ * x, and a DEL is a zero byte of "x ^ 0x7f".
+ */
+#define BYTES_ONE  ((uint64_t)0x0101010101010101ULL)
+#define BYTES_HIGH ((uint64_t)0x8080808080808080ULL)
+
+static int all_plain_printable(const char *buf)
+{
+	uint64_t x, del;
+
+	memcpy(&x, buf, sizeof(x));
+	del = x ^ (BYTES_ONE * 0x7f);
+	return !(((x - BYTES_ONE * 0x20) & ~x & BYTES_HIGH) |
+		 ((del - BYTES_ONE) & ~del & BYTES_HIGH));
+}
+
 static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
 {
 	unsigned long i;
@@ -39,7 +60,17 @@ static void gather_stats(const char *buf, unsigned long size, struct text_stat *
 	memset(stats, 0, sizeof(*stats));
 
 	for (i = 0; i < size; i++) {
-		unsigned char c = buf[i];
+		unsigned char c;
+
+		while (i + sizeof(uint64_t) <= size &&
+		       all_plain_printable(buf + i)) {
+			stats->printable += sizeof(uint64_t);
+			i += sizeof(uint64_t);
+		}
+		if (i == size)
+			break;
+
+		c = buf[i];
 		if (c == '\r') {
 			if (i+1 < size && buf[i+1] == '\n') {
 				stats->crlf++;
@@ -109,10 +140,8 @@ static unsigned int gather_convert_stats(const char *data, unsigned long size)
 	return ret;
 }
 
-static const char *gather_convert_stats_ascii(const char *data, unsigned long size)
+static const char *convert_stats_ascii(unsigned int convert_stats)
 {
-	unsigned int convert_stats = gather_convert_stats(data, size);
-
 	if (convert_stats & CONVERT_STAT_BITS_BIN)
 		return "-text";
 	switch (convert_stats) {
@@ -127,15 +156,49 @@ static const char *gather_convert_stats_ascii(const char *data, unsigned long si
 	}
 }
 
+/*
+ * The stats of a blob never change, and the same index blobs are
+ * looked at again and again, e.g. by the safer autocrlf check of every
+ * "git add" or content comparison of a file.  Remember them.
+ */
+struct blob_convert_stats {
+	struct oidmap_entry entry;
+	unsigned int stats;
+};
+
+static struct oidmap blob_convert_stats = OIDMAP_INIT;
+
+static unsigned int gather_index_convert_stats(struct index_state *istate,
+					       const char *path)
+{
+	const struct object_id *oid = blob_oid_from_index(istate, path);
+	struct blob_convert_stats *e;
+	enum object_type type;
+	unsigned long sz;
+	void *data;
+
+	if (!oid)
+		return 0;
+	e = oidmap_get(&blob_convert_stats, oid);
+	if (!e) {
+		data = read_object_file(oid, &type, &sz);
+		if (!data || type != OBJ_BLOB) {
+			free(data);
+			return 0;
+		}
+		CALLOC_ARRAY(e, 1);
+		oidcpy(&e->entry.oid, oid);
+		e->stats = gather_convert_stats(data, sz);
+		oidmap_put(&blob_convert_stats, e);
+		free(data);
+	}
+	return e->stats;
+}
+
 const char *get_cached_convert_stats_ascii(struct index_state *istate,
 					   const char *path)
 {
-	const char *ret;
-	unsigned long sz;
-	void *data = read_blob_data_from_index(istate, path, &sz);
-	ret = gather_convert_stats_ascii(data, sz);
-	free(data);
-	return ret;
+	return convert_stats_ascii(gather_index_convert_stats(istate, path));
 }
 
 const char *get_wt_convert_stats_ascii(const char *path)
@@ -143,7 +206,7 @@ const char *get_wt_convert_stats_ascii(const char *path)
 	const char *ret = "";
 	struct strbuf sb = STRBUF_INIT;
 	if (strbuf_read_file(&sb, path, 0) >= 0)
-		ret = gather_convert_stats_ascii(sb.buf, sb.len);
+		ret = convert_stats_ascii(gather_convert_stats(sb.buf, sb.len));
 	strbuf_release(&sb);
 	return ret;
 }
@@ -213,25 +276,10 @@ static void check_global_conv_flags_eol(const char *path,
 
 static int has_crlf_in_index(struct index_state *istate, const char *path)
 {
-	unsigned long sz;
-	void *data;
-	const char *crp;
-	int has_crlf = 0;
+	unsigned int ret_stats = gather_index_convert_stats(istate, path);
 
-	data = read_blob_data_from_index(istate, path, &sz);
-	if (!data)
-		return 0;
-
-	crp = memchr(data, '\r', sz);
-	if (crp) {
-		unsigned int ret_stats;
-		ret_stats = gather_convert_stats(data, sz);
-		if (!(ret_stats & CONVERT_STAT_BITS_BIN) &&
-		    (ret_stats & CONVERT_STAT_BITS_TXT_CRLF))
-			has_crlf = 1;
-	}
-	free(data);
-	return has_crlf;
+	return !(ret_stats & CONVERT_STAT_BITS_BIN) &&
+		(ret_stats & CONVERT_STAT_BITS_TXT_CRLF);
 }
 
 static int will_convert_lf_to_crlf(struct text_stat *stats,
@@ -492,7 +540,7 @@ static int crlf_to_git(struct index_state *istate,
 {
 	struct text_stat stats;
 	char *dst;
-	int convert_crlf_into_lf;
+	int convert_crlf_into_lf, guessed;
 
 	if (crlf_action == CRLF_BINARY ||
 	    (src && !len))
@@ -552,23 +600,24 @@ static int crlf_to_git(struct index_state *istate,
 	if (strbuf_avail(buf) + buf->len < len)
 		strbuf_grow(buf, len - buf->len);
 	dst = buf->buf;
-	if (crlf_action == CRLF_AUTO || crlf_action == CRLF_AUTO_INPUT || crlf_action == CRLF_AUTO_CRLF) {
-		/*
-		 * If we guessed, we already know we rejected a file with
-		 * lone CR, and we can strip a CR without looking at what
-		 * follow it.
-		 */
-		do {
-			unsigned char c = *src++;
-			if (c != '\r')
-				*dst++ = c;
-		} while (--len);
-	} else {
-		do {
-			unsigned char c = *src++;
-			if (! (c == '\r' && (1 < len && *src == '\n')))
-				*dst++ = c;
-		} while (--len);
+	/*
+	 * If we guessed, we already know we rejected a file with lone CR,
+	 * and we can strip a CR without looking at what follows it.
+	 */
+	guessed = crlf_action == CRLF_AUTO || crlf_action == CRLF_AUTO_INPUT || crlf_action == CRLF_AUTO_CRLF;
+	for (;;) {
+		const char *cr = memchr(src, '\r', len);
+		size_t run = cr ? cr - src : len;
+		int drop = cr && (guessed || (run + 1 < len && cr[1] == '\n'));
+
+		if (cr && !drop)
+			run++;
+		memmove(dst, src, run);
+		dst += run;
+		src += run + drop;
+		len -= run + drop;
+		if (!cr)
+			break;
 	}
 	strbuf_setlen(buf, dst - buf->buf);
 	return 1;
@@ -978,6 +1027,7 @@ static struct convert_driver {
 	const char *clean;
 	const char *process;
 	int required;
+	int parallel;
 } *user_convert, **user_convert_tail;
 
 static int apply_filter(const char *path, const char *src, size_t len,
@@ -1053,6 +1103,11 @@ static int read_convert_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp("parallel", key)) {
+		drv->parallel = git_config_bool(var, value);
+		return 0;
+	}
+
 	return 0;
 }
 
@@ -1295,6 +1350,14 @@ static int git_path_check_ident(struct attr_check_item *check)
 
 static struct attr_check *check;
 
+static void read_convert_drivers(void)
+{
+	if (user_convert_tail)
+		return;
+	user_convert_tail = &user_convert;
+	git_config(read_convert_config, NULL);
+}
+
 void convert_attrs(struct index_state *istate,
 		   struct conv_attrs *ca, const char *path)
 {
@@ -1304,8 +1367,7 @@ void convert_attrs(struct index_state *istate,
 		check = attr_check_initl("crlf", "ident", "filter",
 					 "eol", "text", "working-tree-encoding",
 					 NULL);
-		user_convert_tail = &user_convert;
-		git_config(read_convert_config, NULL);
+		read_convert_drivers();
 	}
 
 	git_check_attr(istate, path, check);
@@ -2017,6 +2079,28 @@ void clone_checkout_metadata(struct checkout_metadata *dst,
 		oidcpy(&dst->blob, blob);
 }
 
+const char *convert_driver_name(const struct conv_attrs *ca)
+{
+	return ca->drv ? ca->drv->name : NULL;
+}
+
+int convert_driver_is_parallel(const struct conv_attrs *ca)
+{
+	return ca->drv && ca->drv->parallel;
+}
+
+int convert_attrs_set_driver(struct conv_attrs *ca, const char *name)
+{
+	struct convert_driver *drv;
+
+	read_convert_drivers();
+	for (drv = user_convert; drv; drv = drv->next)
+		if (!strcmp(name, drv->name))
+			break;
+	ca->drv = drv;
+	return drv ? 0 : -1;
+}
+
 enum conv_attrs_classification classify_conv_attrs(const struct conv_attrs *ca)
 {
 	if (ca->drv) {
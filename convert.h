@@ -233,4 +233,19 @@ enum conv_attrs_classification {
 enum conv_attrs_classification classify_conv_attrs(
 	const struct conv_attrs *ca);
 
+/*
+ * The name of the filter driver of "ca", or NULL if it has none, and
+ * whether the driver is configured with "filter.<driver>.parallel" as
+ * safe to run in several processes at once.
+ */
+const char *convert_driver_name(const struct conv_attrs *ca);
+int convert_driver_is_parallel(const struct conv_attrs *ca);
+
+/*
+ * Set the filter driver of "ca" to the one configured under "name",
+ * for a process that got the attributes from elsewhere. Returns -1
+ * (and leaves "ca" without a driver) if there is no such driver.
+ */
+int convert_attrs_set_driver(struct conv_attrs *ca, const char *name);
+
 #endif /* CONVERT_H */
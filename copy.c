@@ -1,5 +1,10 @@
 #include "cache.h"
 
+#ifdef HAVE_FICLONE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
 int copy_fd(int ifd, int ofd)
 {
 	while (1) {
@@ -15,6 +20,34 @@ int copy_fd(int ifd, int ofd)
 	return 0;
 }
 
+int clone_fd(int ifd, int ofd)
+{
+#ifdef HAVE_FICLONE
+	return ioctl(ofd, FICLONE, ifd) ? -1 : 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*
+ * Copy the rest of "ifd" to "ofd" without bringing it into user space
+ * (and sharing the blocks where the filesystem does that on its own).
+ * Whatever is left when the kernel cannot do it, e.g. between two
+ * filesystems, is for copy_fd() to copy.
+ */
+static void copy_fd_in_kernel(int ifd, int ofd)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+	for (;;) {
+		ssize_t len = copy_file_range(ifd, NULL, ofd, NULL,
+					      1 << 30, 0);
+		if (len <= 0 && (len == 0 || errno != EINTR))
+			break;
+	}
+#endif
+}
+
 static int copy_times(const char *dst, const char *src)
 {
 	struct stat st;
@@ -39,6 +72,7 @@ int copy_file(const char *dst, const char *src, int mode)
 		close(fdi);
 		return fdo;
 	}
+	copy_fd_in_kernel(fdi, fdo);
 	status = copy_fd(fdi, fdo);
 	switch (status) {
 	case COPY_READ_ERROR:
@@ -65,3 +99,32 @@ int copy_file_with_time(const char *dst, const char *src, int mode)
 		return copy_times(dst, src);
 	return status;
 }
+
+int reflink_file_with_time(const char *dst, const char *src, int mode)
+{
+	int fdi, fdo, status;
+
+	mode = (mode & 0111) ? 0777 : 0666;
+	if ((fdi = open(src, O_RDONLY)) < 0)
+		return fdi;
+	if ((fdo = open(dst, O_WRONLY | O_CREAT | O_EXCL, mode)) < 0) {
+		close(fdi);
+		return fdo;
+	}
+	status = clone_fd(fdi, fdo);
+	if (status) {
+		int saved_errno = errno;
+
+		close(fdi);
+		close(fdo);
+		unlink(dst);
+		errno = saved_errno;
+		return status;
+	}
+	close(fdi);
+	if (close(fdo) != 0)
+		return error_errno("%s: close error", dst);
+	if (adjust_shared_perm(dst))
+		return -1;
+	return copy_times(dst, src);
+}
@@ -10,6 +10,31 @@
 #include "cache.h"
 #include "progress.h"
 #include "csum-file.h"
+#include "thread-utils.h"
+
+/*
+ * The number of buffers a hashfile writing in the background cycles
+ * through: one being filled by hashwrite(), the others waiting to be
+ * (or being) hashed and written out by the writer thread.
+ */
+#define WRITER_BUFFERS 4
+
+struct hashfile_writer {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned char *buffers[WRITER_BUFFERS];
+
+	/* filled buffers, oldest first */
+	unsigned char *queue[WRITER_BUFFERS];
+	unsigned int queue_len[WRITER_BUFFERS];
+	int queue_first, queue_nr;
+
+	unsigned char *spare[WRITER_BUFFERS];
+	int spare_nr;
+
+	int stop;
+};
 
 static void verify_buffer_or_die(struct hashfile *f,
 				 const void *buf,
@@ -25,7 +50,7 @@ static void verify_buffer_or_die(struct hashfile *f,
 		die("sha1 file '%s' validation error", f->name);
 }
 
-static void flush(struct hashfile *f, const void *buf, unsigned int count)
+static void write_buffer(struct hashfile *f, const void *buf, unsigned int count)
 {
 	if (0 <= f->check_fd && count)
 		verify_buffer_or_die(f, buf, count);
@@ -35,15 +60,148 @@ static void flush(struct hashfile *f, const void *buf, unsigned int count)
 			die("sha1 file '%s' write error. Out of diskspace", f->name);
 		die_errno("sha1 file '%s' write error", f->name);
 	}
+}
 
+static void flush(struct hashfile *f, const void *buf, unsigned int count)
+{
+	write_buffer(f, buf, count);
 	f->total += count;
 	display_throughput(f->tp, f->total);
 }
 
+static void *writer_thread(void *data)
+{
+	struct hashfile *f = data;
+	struct hashfile_writer *w = f->writer;
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;) {
+		unsigned char *buf;
+		unsigned int len;
+
+		while (!w->queue_nr && !w->stop)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (!w->queue_nr)
+			break;
+		buf = w->queue[w->queue_first];
+		len = w->queue_len[w->queue_first];
+		pthread_mutex_unlock(&w->mutex);
+
+		/* f->ctx belongs to us until the queue is empty */
+		the_hash_algo->update_fn(&f->ctx, buf, len);
+		write_buffer(f, buf, len);
+
+		pthread_mutex_lock(&w->mutex);
+		w->queue_first = (w->queue_first + 1) % WRITER_BUFFERS;
+		w->queue_nr--;
+		w->spare[w->spare_nr++] = buf;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+/*
+ * Queue the buffer for the writer thread, and continue with a spare
+ * one.
+ */
+static void hand_off_buffer(struct hashfile *f)
+{
+	struct hashfile_writer *w = f->writer;
+
+	f->total += f->offset;
+	display_throughput(f->tp, f->total);
+
+	pthread_mutex_lock(&w->mutex);
+	w->queue[(w->queue_first + w->queue_nr) % WRITER_BUFFERS] = f->buffer;
+	w->queue_len[(w->queue_first + w->queue_nr) % WRITER_BUFFERS] = f->offset;
+	w->queue_nr++;
+	pthread_cond_broadcast(&w->cond);
+	while (!w->spare_nr)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	f->buffer = w->spare[--w->spare_nr];
+	pthread_mutex_unlock(&w->mutex);
+
+	f->offset = 0;
+}
+
+static void wait_for_writer(struct hashfile *f)
+{
+	struct hashfile_writer *w = f->writer;
+
+	if (!w)
+		return;
+	pthread_mutex_lock(&w->mutex);
+	while (w->queue_nr)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static void stop_writer(struct hashfile *f)
+{
+	struct hashfile_writer *w = f->writer;
+	int i;
+
+	if (!w)
+		return;
+	pthread_mutex_lock(&w->mutex);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->thread, NULL);
+
+	pthread_mutex_destroy(&w->mutex);
+	pthread_cond_destroy(&w->cond);
+	for (i = 0; i < WRITER_BUFFERS; i++)
+		if (w->buffers[i] != f->buffer)
+			free(w->buffers[i]);
+	FREE_AND_NULL(f->writer);
+}
+
+void hashfile_write_in_background(struct hashfile *f)
+{
+	struct hashfile_writer *w;
+	int i, err;
+
+	if (!HAVE_THREADS || f->writer)
+		return;
+	if (f->offset || f->total)
+		BUG("hashfile_write_in_background() after hashwrite()");
+
+	CALLOC_ARRAY(w, 1);
+	w->buffers[0] = f->buffer;
+	for (i = 1; i < WRITER_BUFFERS; i++) {
+		w->buffers[i] = xmalloc(f->buffer_len);
+		w->spare[w->spare_nr++] = w->buffers[i];
+	}
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	f->writer = w;
+
+	err = pthread_create(&w->thread, NULL, writer_thread, f);
+	if (err) {
+		/* not fatal; just write in the foreground */
+		warning(_("unable to create hashfile writer thread: %s"),
+			strerror(err));
+		pthread_mutex_destroy(&w->mutex);
+		pthread_cond_destroy(&w->cond);
+		for (i = 1; i < WRITER_BUFFERS; i++)
+			free(w->buffers[i]);
+		FREE_AND_NULL(f->writer);
+	}
+}
+
 void hashflush(struct hashfile *f)
 {
 	unsigned offset = f->offset;
 
+	if (f->writer) {
+		if (offset)
+			hand_off_buffer(f);
+		wait_for_writer(f);
+		return;
+	}
+
 	if (offset) {
 		the_hash_algo->update_fn(&f->ctx, f->buffer, offset);
 		flush(f, f->buffer, offset);
@@ -63,6 +221,7 @@ int finalize_hashfile(struct hashfile *f, unsigned char *result, unsigned int fl
 	int fd;
 
 	hashflush(f);
+	stop_writer(f);
 	the_hash_algo->final_fn(f->buffer, &f->ctx);
 	if (result)
 		hashcpy(result, f->buffer);
@@ -100,7 +259,7 @@ void hashwrite(struct hashfile *f, const void *buf, unsigned int count)
 		if (f->do_crc)
 			f->crc32 = crc32(f->crc32, buf, nr);
 
-		if (nr == f->buffer_len) {
+		if (nr == f->buffer_len && !f->writer) {
 			/*
 			 * Flush a full batch worth of data directly
 			 * from the input, skipping the memcpy() to
@@ -117,8 +276,12 @@ void hashwrite(struct hashfile *f, const void *buf, unsigned int count)
 			memcpy(f->buffer + f->offset, buf, nr);
 			f->offset += nr;
 			left -= nr;
-			if (!left)
-				hashflush(f);
+			if (!left) {
+				if (f->writer)
+					hand_off_buffer(f);
+				else
+					hashflush(f);
+			}
 		}
 
 		count -= nr;
@@ -161,6 +324,7 @@ static struct hashfile *hashfd_internal(int fd, const char *name,
 	f->buffer_len = buffer_len;
 	f->buffer = xmalloc(buffer_len);
 	f->check_buffer = NULL;
+	f->writer = NULL;
 
 	return f;
 }
@@ -197,6 +361,7 @@ int hashfile_truncate(struct hashfile *f, struct hashfile_checkpoint *checkpoint
 {
 	off_t offset = checkpoint->offset;
 
+	wait_for_writer(f);
 	if (ftruncate(f->fd, offset) ||
 	    lseek(f->fd, offset, SEEK_SET) != offset)
 		return -1;
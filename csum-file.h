@@ -4,6 +4,7 @@
 #include "hash.h"
 
 struct progress;
+struct hashfile_writer;
 
 /* A SHA1-protected file */
 struct hashfile {
@@ -19,6 +20,7 @@ struct hashfile {
 	size_t buffer_len;
 	unsigned char *buffer;
 	unsigned char *check_buffer;
+	struct hashfile_writer *writer;
 };
 
 /* Checkpoint */
@@ -39,6 +41,18 @@ struct hashfile *hashfd(int fd, const char *name);
 struct hashfile *hashfd_check(const char *name);
 struct hashfile *hashfd_throughput(int fd, const char *name, struct progress *tp);
 int finalize_hashfile(struct hashfile *, unsigned char *, unsigned int);
+
+/*
+ * Hash and write out the data given to hashwrite() on a thread of its
+ * own, so that the caller can prepare the next buffer in the meantime.
+ * This must be called before anything is written to the hashfile.
+ * hashflush(), hashfile_checkpoint(), hashfile_truncate() and
+ * finalize_hashfile() wait for the thread to catch up, so that the
+ * caller may use "fd" directly after them, as usual.  Without thread
+ * support, this does nothing.
+ */
+void hashfile_write_in_background(struct hashfile *);
+
 void hashwrite(struct hashfile *, const void *, unsigned int);
 void hashflush(struct hashfile *f);
 void crc32_begin(struct hashfile *);
@@ -22,6 +22,7 @@ static int informative_errors;
 static const char daemon_usage[] =
 "git daemon [--verbose] [--syslog] [--export-all]\n"
 "           [--timeout=<n>] [--init-timeout=<n>] [--max-connections=<n>]\n"
+"           [--workers=<n>]\n"
 "           [--strict-paths] [--base-path=<path>] [--base-path-relaxed]\n"
 "           [--user-path | --user-path=<path>]\n"
 "           [--interpolated-path=<path>]\n"
@@ -893,6 +894,27 @@ static void check_dead_children(void)
 			cradle = &blanket->next;
 }
 
+static void add_remote_env(struct strvec *env, struct sockaddr *addr)
+{
+	if (addr->sa_family == AF_INET) {
+		char buf[128] = "";
+		struct sockaddr_in *sin_addr = (void *) addr;
+		inet_ntop(addr->sa_family, &sin_addr->sin_addr, buf, sizeof(buf));
+		strvec_pushf(env, "REMOTE_ADDR=%s", buf);
+		strvec_pushf(env, "REMOTE_PORT=%d",
+			     ntohs(sin_addr->sin_port));
+#ifndef NO_IPV6
+	} else if (addr->sa_family == AF_INET6) {
+		char buf[128] = "";
+		struct sockaddr_in6 *sin6_addr = (void *) addr;
+		inet_ntop(AF_INET6, &sin6_addr->sin6_addr, buf, sizeof(buf));
+		strvec_pushf(env, "REMOTE_ADDR=[%s]", buf);
+		strvec_pushf(env, "REMOTE_PORT=%d",
+			     ntohs(sin6_addr->sin6_port));
+#endif
+	}
+}
+
 static struct strvec cld_argv = STRVEC_INIT;
 static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 {
@@ -909,23 +931,7 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 		}
 	}
 
-	if (addr->sa_family == AF_INET) {
-		char buf[128] = "";
-		struct sockaddr_in *sin_addr = (void *) addr;
-		inet_ntop(addr->sa_family, &sin_addr->sin_addr, buf, sizeof(buf));
-		strvec_pushf(&cld.env_array, "REMOTE_ADDR=%s", buf);
-		strvec_pushf(&cld.env_array, "REMOTE_PORT=%d",
-			     ntohs(sin_addr->sin_port));
-#ifndef NO_IPV6
-	} else if (addr->sa_family == AF_INET6) {
-		char buf[128] = "";
-		struct sockaddr_in6 *sin6_addr = (void *) addr;
-		inet_ntop(AF_INET6, &sin6_addr->sin6_addr, buf, sizeof(buf));
-		strvec_pushf(&cld.env_array, "REMOTE_ADDR=[%s]", buf);
-		strvec_pushf(&cld.env_array, "REMOTE_PORT=%d",
-			     ntohs(sin6_addr->sin6_port));
-#endif
-	}
+	add_remote_env(&cld.env_array, addr);
 
 	cld.argv = cld_argv.v;
 	cld.in = incoming;
@@ -1198,6 +1204,187 @@ static int service_loop(struct socketlist *socklist)
 	}
 }
 
+/*
+ * With --workers, a fixed number of worker processes is forked once
+ * and for all.  They all accept connections on the listening sockets
+ * themselves and serve them one at a time, so that a burst of clients
+ * waits in the listen backlog instead of each costing us a fork and
+ * exec of "git daemon --serve" first.
+ */
+static int nr_workers;
+
+static void set_nonblocking(int fd, int on)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0)
+		return;
+	fcntl(fd, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+/*
+ * Each request is still served by a child of the worker, which runs
+ * execute() without exec'ing anything first: whatever it does to the
+ * process, such as moving into the repository, reading its config or
+ * dying, is then not carried over to the next request.
+ */
+static void serve_in_worker(int incoming, struct sockaddr *addr,
+			    struct socketlist *socklist, int parent_fd)
+{
+	uint64_t start = getnanotime();
+	const char *dead = "";
+	int status;
+	pid_t pid;
+
+	set_nonblocking(incoming, 0);
+	pid = fork();
+	if (pid < 0) {
+		logerror("unable to fork");
+		close(incoming);
+		return;
+	}
+	if (!pid) {
+		struct strvec env = STRVEC_INIT;
+		int i;
+
+		for (i = 0; i < socklist->nr; i++)
+			close(socklist->list[i]);
+		close(parent_fd);
+		add_remote_env(&env, addr);
+		for (i = 0; i < env.nr; i++)
+			putenv((char *)env.v[i]);
+		if (dup2(incoming, 0) < 0 || dup2(incoming, 1) < 0)
+			exit(1);
+		close(incoming);
+		exit(execute() ? 1 : 0);
+	}
+
+	close(incoming);
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR) {
+			status = 0;
+			break;
+		}
+	if (status)
+		dead = " (with error)";
+	loginfo("[%"PRIuMAX"] Disconnected%s after %"PRIuMAX" ms",
+		(uintmax_t)pid, dead, (uintmax_t)((getnanotime() - start) / 1000000));
+}
+
+/*
+ * The last entry of "pfd" is the end of a pipe the parent keeps open
+ * for as long as it lives; we leave when it goes away.
+ */
+static void NORETURN worker_loop(struct socketlist *socklist, int parent_fd)
+{
+	struct pollfd *pfd;
+	int i;
+
+	CALLOC_ARRAY(pfd, socklist->nr + 1);
+	for (i = 0; i < socklist->nr; i++) {
+		pfd[i].fd = socklist->list[i];
+		pfd[i].events = POLLIN;
+		/* another worker may beat us to it */
+		set_nonblocking(pfd[i].fd, 1);
+	}
+	pfd[socklist->nr].fd = parent_fd;
+	pfd[socklist->nr].events = POLLIN;
+
+	signal(SIGCHLD, SIG_DFL);
+
+	for (;;) {
+		if (poll(pfd, socklist->nr + 1, -1) < 0) {
+			if (errno != EINTR) {
+				logerror("Poll failed, resuming: %s",
+				      strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+
+		if (pfd[socklist->nr].revents)
+			exit(0);
+
+		for (i = 0; i < socklist->nr; i++) {
+			if (pfd[i].revents & POLLIN) {
+				union {
+					struct sockaddr sa;
+					struct sockaddr_in sai;
+#ifndef NO_IPV6
+					struct sockaddr_in6 sai6;
+#endif
+				} ss;
+				socklen_t sslen = sizeof(ss);
+				int incoming = accept(pfd[i].fd, &ss.sa, &sslen);
+				if (incoming < 0) {
+					switch (errno) {
+					case EAGAIN:
+					case EINTR:
+					case ECONNABORTED:
+						continue;
+					default:
+						die_errno("accept returned");
+					}
+				}
+				serve_in_worker(incoming, &ss.sa, socklist,
+						parent_fd);
+			}
+		}
+	}
+}
+
+static int worker_pool_loop(struct socketlist *socklist)
+{
+	pid_t *workers;
+	int parent_pipe[2];
+	int i;
+
+	if (pipe(parent_pipe) < 0)
+		die_errno("unable to create pipe for the workers");
+	CALLOC_ARRAY(workers, nr_workers);
+
+	for (;;) {
+		int status;
+		pid_t pid;
+
+		for (i = 0; i < nr_workers; i++) {
+			if (workers[i])
+				continue;
+			pid = fork();
+			if (pid < 0) {
+				logerror("unable to fork worker: %s",
+					 strerror(errno));
+				sleep(1);
+				continue;
+			}
+			if (!pid) {
+				close(parent_pipe[1]);
+				worker_loop(socklist, parent_pipe[0]);
+			}
+			workers[i] = pid;
+		}
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno != EINTR) {
+				logerror("waitpid failed, resuming: %s",
+					 strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+		for (i = 0; i < nr_workers; i++)
+			if (workers[i] == pid) {
+				logerror("Worker [%"PRIuMAX"] exited%s",
+					 (uintmax_t)pid,
+					 status ? " with error" : "");
+				workers[i] = 0;
+				/* do not let a broken worker keep us busy */
+				sleep(1);
+			}
+	}
+}
+
 #ifdef NO_POSIX_GOODIES
 
 struct credentials;
@@ -1264,6 +1451,8 @@ static int serve(struct string_list *listen_addr, int listen_port,
 
 	loginfo("Ready to rumble");
 
+	if (nr_workers)
+		return worker_pool_loop(&socklist);
 	return service_loop(&socklist);
 }
 
@@ -1345,6 +1534,12 @@ int cmd_main(int argc, const char **argv)
 				max_connections = 0;	        /* unlimited */
 			continue;
 		}
+		if (skip_prefix(arg, "--workers=", &v)) {
+			nr_workers = atoi(v);
+			if (nr_workers < 0)
+				nr_workers = 0;
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
@@ -1441,6 +1636,9 @@ int cmd_main(int argc, const char **argv)
 	if (inetd_mode && (detach || group_name || user_name))
 		die("--detach, --user and --group are incompatible with --inetd");
 
+	if (inetd_mode && nr_workers)
+		die("--workers is incompatible with --inetd");
+
 	if (inetd_mode && (listen_port || (listen_addr.nr > 0)))
 		die("--listen= and --port= are incompatible with --inetd");
 	else if (listen_port == 0)
@@ -0,0 +1,201 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "delta-decisions.h"
+#include "lockfile.h"
+
+#define DELTA_DECISIONS_SIGNATURE 0x44444543 /* "DDEC" */
+#define DELTA_DECISIONS_VERSION 1
+
+/*
+ * The file consists of:
+ *
+ *   - a 4-byte signature, "DDEC"
+ *   - a 4-byte version number (1)
+ *   - a 4-byte hash function identifier (1 == SHA-1, 2 == SHA-256)
+ *   - a 4-byte count of records
+ *   - the key the decisions were made under (one hash)
+ *   - the records, each made of the object id of a delta and the
+ *     object id of its base, sorted by the former
+ *   - a trailing checksum of all of the above
+ *
+ * All integers are in network byte order.
+ */
+struct delta_decisions_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t hash_id;
+	uint32_t nr;
+};
+
+struct delta_decisions {
+	const unsigned char *map;
+	size_t map_size;
+	const unsigned char *records;
+	uint32_t nr;
+};
+
+char *delta_decisions_filename(const char *object_dir)
+{
+	return xstrfmt("%s/info/delta-decisions", object_dir);
+}
+
+struct delta_decisions *load_delta_decisions(const char *path,
+					     const struct object_id *key)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	struct delta_decisions *dd;
+	const struct delta_decisions_header *hdr;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), path);
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < sizeof(*hdr) + 2 * rawsz) {
+		error(_("delta-decisions file %s is too small"), path);
+		close(fd);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr->signature) != DELTA_DECISIONS_SIGNATURE) {
+		error(_("delta-decisions file %s has unknown signature"), path);
+		goto bad;
+	}
+	if (ntohl(hdr->version) != DELTA_DECISIONS_VERSION) {
+		error(_("delta-decisions file %s has unsupported version %"PRIu32),
+		      path, ntohl(hdr->version));
+		goto bad;
+	}
+	if (ntohl(hdr->hash_id) != hash_algo_by_ptr(the_hash_algo))
+		goto bad;
+	if (size != sizeof(*hdr) + 2 * rawsz +
+		    st_mult(2 * rawsz, ntohl(hdr->nr))) {
+		error(_("delta-decisions file %s is corrupt"), path);
+		goto bad;
+	}
+	if (!hashfile_checksum_valid(map, size)) {
+		error(_("delta-decisions file %s has a bad checksum"), path);
+		goto bad;
+	}
+	if (!hasheq((const unsigned char *)map + sizeof(*hdr), key->hash))
+		goto bad;
+
+	CALLOC_ARRAY(dd, 1);
+	dd->map = map;
+	dd->map_size = size;
+	dd->records = dd->map + sizeof(*hdr) + rawsz;
+	dd->nr = ntohl(hdr->nr);
+	return dd;
+
+bad:
+	munmap(map, size);
+	return NULL;
+}
+
+const unsigned char *delta_decision_base(struct delta_decisions *dd,
+					 const struct object_id *oid)
+{
+	const size_t stride = 2 * the_hash_algo->rawsz;
+	uint32_t lo = 0, hi = dd->nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *rec = dd->records + st_mult(mi, stride);
+		int cmp = hashcmp(oid->hash, rec);
+
+		if (!cmp)
+			return rec + the_hash_algo->rawsz;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return NULL;
+}
+
+size_t delta_decisions_nr(struct delta_decisions *dd)
+{
+	return dd->nr;
+}
+
+void nth_delta_decision(struct delta_decisions *dd, size_t n,
+			struct delta_decision *out)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	const unsigned char *rec;
+
+	if (n >= dd->nr)
+		BUG("delta decision %"PRIuMAX" out of range", (uintmax_t)n);
+
+	rec = dd->records + st_mult(n, 2 * rawsz);
+	oidread(&out->oid, rec);
+	oidread(&out->base, rec + rawsz);
+}
+
+void free_delta_decisions(struct delta_decisions *dd)
+{
+	if (!dd)
+		return;
+	munmap((void *)dd->map, dd->map_size);
+	free(dd);
+}
+
+static int delta_decision_cmp(const void *va, const void *vb)
+{
+	const struct delta_decision *a = va, *b = vb;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+int write_delta_decisions(const char *path, const struct object_id *key,
+			  struct delta_decision *decisions, size_t nr)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	size_t i, j;
+	int fd;
+
+	QSORT(decisions, nr, delta_decision_cmp);
+	for (i = j = 0; i < nr; i++) {
+		if (j && oideq(&decisions[j - 1].oid, &decisions[i].oid))
+			continue;
+		decisions[j++] = decisions[i];
+	}
+	nr = j;
+
+	if (nr > UINT32_MAX)
+		return error(_("too many delta decisions to write"));
+
+	if (safe_create_leading_directories_const(path))
+		return error_errno(_("unable to create leading directories of %s"),
+				   path);
+	fd = hold_lock_file_for_update(&lk, path, 0);
+	if (fd < 0)
+		return error_errno(_("unable to create '%s.lock'"), path);
+
+	f = hashfd(fd, get_lock_file_path(&lk));
+	hashwrite_be32(f, DELTA_DECISIONS_SIGNATURE);
+	hashwrite_be32(f, DELTA_DECISIONS_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(the_hash_algo));
+	hashwrite_be32(f, nr);
+	hashwrite(f, key->hash, the_hash_algo->rawsz);
+	for (i = 0; i < nr; i++) {
+		hashwrite(f, decisions[i].oid.hash, the_hash_algo->rawsz);
+		hashwrite(f, decisions[i].base.hash, the_hash_algo->rawsz);
+	}
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+
+	if (commit_lock_file(&lk) < 0)
+		return error_errno(_("unable to write '%s'"), path);
+	return 0;
+}
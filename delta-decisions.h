@@ -0,0 +1,56 @@
+#ifndef DELTA_DECISIONS_H
+#define DELTA_DECISIONS_H
+
+#include "hash.h"
+
+/*
+ * A delta-decisions file remembers, for each object that an earlier
+ * pack-objects run stored as a delta, the base it chose. A later run
+ * (e.g. "git repack -adf") can then try that base first, and skip the
+ * rest of the sliding-window search when it still produces a delta.
+ *
+ * Each file is keyed by an opaque object id describing the settings
+ * under which its decisions were made (such as the delta island
+ * configuration). A file whose key does not match is ignored.
+ */
+
+struct delta_decisions;
+
+struct delta_decision {
+	struct object_id oid;
+	struct object_id base;
+};
+
+/*
+ * Return the path of the repository's delta-decisions file. The caller
+ * must free() the result.
+ */
+char *delta_decisions_filename(const char *object_dir);
+
+/*
+ * Load the decisions stored in "path". Return NULL (without an error)
+ * if the file does not exist or was written with a different key.
+ */
+struct delta_decisions *load_delta_decisions(const char *path,
+					     const struct object_id *key);
+
+/*
+ * Return the base recorded for "oid", or NULL if there is none.
+ */
+const unsigned char *delta_decision_base(struct delta_decisions *dd,
+					 const struct object_id *oid);
+
+size_t delta_decisions_nr(struct delta_decisions *dd);
+void nth_delta_decision(struct delta_decisions *dd, size_t n,
+			struct delta_decision *out);
+
+void free_delta_decisions(struct delta_decisions *dd);
+
+/*
+ * Atomically replace "path" with the given decisions, which are sorted
+ * (and deduplicated by "oid") as a side effect.
+ */
+int write_delta_decisions(const char *path, const struct object_id *key,
+			  struct delta_decision *decisions, size_t nr);
+
+#endif /* DELTA_DECISIONS_H */
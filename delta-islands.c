@@ -22,7 +22,7 @@
 
 KHASH_INIT(str, const char *, void *, 1, kh_str_hash_func, kh_str_hash_equal)
 
-static kh_oid_map_t *island_marks;
+static kh_oid_pos_t *island_marks;
 static unsigned island_counter;
 static unsigned island_counter_core;
 
@@ -33,35 +33,119 @@ struct remote_island {
 	struct oid_array oids;
 };
 
+/*
+ * A set of islands.  Objects are in far fewer distinct sets than there
+ * are objects, so each set is kept only once ("interned" in
+ * island_bitmaps, by its contents), is never modified once it is, and
+ * is freed when no object is in it anymore.  island_marks maps each
+ * object to the position of its set in island_sets.
+ */
 struct island_bitmap {
+	struct hashmap_entry ent;
 	uint32_t refcount;
+	int id;
+	/* unlike the id, never reused for another set */
+	uint32_t serial;
 	uint32_t bits[FLEX_ARRAY];
 };
 
 static uint32_t island_bitmap_size;
 
+static struct hashmap island_bitmaps;
+static struct island_bitmap **island_sets;
+static int island_sets_nr, island_sets_alloc;
+static int *free_island_ids;
+static int free_island_ids_nr, free_island_ids_alloc;
+
+/* where new sets are put together before they are interned */
+static struct island_bitmap *island_scratch;
+static uint32_t island_serial;
+
 /*
- * Allocate a new bitmap; if "old" is not NULL, the new bitmap will be a copy
- * of "old". Otherwise, the new bitmap is empty.
+ * The unions of two sets made recently by set_island_marks(), which
+ * merges the same sets over and over again as it goes down the trees.
  */
-static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+struct island_union {
+	uint32_t a, b, result;	/* serials */
+	int result_id;
+};
+#define ISLAND_UNION_CACHE_SIZE 4096
+static struct island_union island_union_cache[ISLAND_UNION_CACHE_SIZE];
+
+static int island_bitmap_cmp(const void *unused_cmp_data,
+			     const struct hashmap_entry *eptr,
+			     const struct hashmap_entry *entry_or_key,
+			     const void *unused_keydata)
 {
-	size_t size = sizeof(struct island_bitmap) + (island_bitmap_size * 4);
-	struct island_bitmap *b = xcalloc(1, size);
+	const struct island_bitmap *a, *b;
+
+	a = container_of(eptr, const struct island_bitmap, ent);
+	b = container_of(entry_or_key, const struct island_bitmap, ent);
+	return memcmp(a->bits, b->bits, island_bitmap_size * 4);
+}
 
-	if (old)
-		memcpy(b, old, size);
+static unsigned int island_bitmap_hash(const struct island_bitmap *b)
+{
+	unsigned int hash = 0x811c9dc5;
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		hash = (hash ^ b->bits[i]) * 0x01000193;
+	return hash;
+}
+
+static void init_island_bitmaps(void)
+{
+	hashmap_init(&island_bitmaps, island_bitmap_cmp, NULL, 0);
+	island_scratch = xcalloc(1, st_add(sizeof(struct island_bitmap),
+					   st_mult(island_bitmap_size, 4)));
+}
 
+/*
+ * Return the id of the set in island_scratch, with a reference to it
+ * taken for the caller.
+ */
+static int intern_island_scratch(void)
+{
+	size_t size = st_mult(island_bitmap_size, 4);
+	struct hashmap_entry *e;
+	struct island_bitmap *b;
+
+	hashmap_entry_init(&island_scratch->ent, island_bitmap_hash(island_scratch));
+	e = hashmap_get(&island_bitmaps, &island_scratch->ent, NULL);
+	if (e) {
+		b = container_of(e, struct island_bitmap, ent);
+		b->refcount++;
+		return b->id;
+	}
+
+	b = xmalloc(st_add(sizeof(*b), size));
+	memcpy(b, island_scratch, sizeof(*b) + size);
 	b->refcount = 1;
-	return b;
+	b->serial = ++island_serial;
+	if (free_island_ids_nr) {
+		b->id = free_island_ids[--free_island_ids_nr];
+	} else {
+		ALLOC_GROW(island_sets, island_sets_nr + 1, island_sets_alloc);
+		b->id = island_sets_nr++;
+	}
+	island_sets[b->id] = b;
+	hashmap_add(&island_bitmaps, &b->ent);
+	return b->id;
 }
 
-static void island_bitmap_or(struct island_bitmap *a, const struct island_bitmap *b)
+static void unref_island_set(int id)
 {
-	uint32_t i;
+	struct island_bitmap *b = island_sets[id];
 
-	for (i = 0; i < island_bitmap_size; ++i)
-		a->bits[i] |= b->bits[i];
+	if (--b->refcount)
+		return;
+	hashmap_remove(&island_bitmaps, &b->ent, NULL);
+	island_sets[id] = NULL;
+	ALLOC_GROW(free_island_ids, free_island_ids_nr + 1,
+		   free_island_ids_alloc);
+	free_island_ids[free_island_ids_nr++] = id;
+	free(b);
 }
 
 static int island_bitmap_is_subset(struct island_bitmap *self,
@@ -83,19 +167,23 @@ static int island_bitmap_is_subset(struct island_bitmap *self,
 #define ISLAND_BITMAP_BLOCK(x) (x / 32)
 #define ISLAND_BITMAP_MASK(x) (1 << (x % 32))
 
-static void island_bitmap_set(struct island_bitmap *self, uint32_t i)
+static int island_bitmap_get(struct island_bitmap *self, uint32_t i)
 {
-	self->bits[ISLAND_BITMAP_BLOCK(i)] |= ISLAND_BITMAP_MASK(i);
+	return (self->bits[ISLAND_BITMAP_BLOCK(i)] & ISLAND_BITMAP_MASK(i)) != 0;
 }
 
-static int island_bitmap_get(struct island_bitmap *self, uint32_t i)
+static struct island_bitmap *get_island_marks(const struct object_id *oid)
 {
-	return (self->bits[ISLAND_BITMAP_BLOCK(i)] & ISLAND_BITMAP_MASK(i)) != 0;
+	khiter_t pos = kh_get_oid_pos(island_marks, *oid);
+
+	if (pos >= kh_end(island_marks))
+		return NULL;
+	return island_sets[kh_value(island_marks, pos)];
 }
 
 int in_same_island(const struct object_id *trg_oid, const struct object_id *src_oid)
 {
-	khiter_t trg_pos, src_pos;
+	struct island_bitmap *trg, *src;
 
 	/* If we aren't using islands, assume everything goes together. */
 	if (!island_marks)
@@ -105,37 +193,30 @@ int in_same_island(const struct object_id *trg_oid, const struct object_id *src_
 	 * If we don't have a bitmap for the target, we can delta it
 	 * against anything -- it's not an important object
 	 */
-	trg_pos = kh_get_oid_map(island_marks, *trg_oid);
-	if (trg_pos >= kh_end(island_marks))
+	trg = get_island_marks(trg_oid);
+	if (!trg)
 		return 1;
 
 	/*
 	 * if the source (our delta base) doesn't have a bitmap,
 	 * we don't want to base any deltas on it!
 	 */
-	src_pos = kh_get_oid_map(island_marks, *src_oid);
-	if (src_pos >= kh_end(island_marks))
+	src = get_island_marks(src_oid);
+	if (!src)
 		return 0;
 
-	return island_bitmap_is_subset(kh_value(island_marks, trg_pos),
-				kh_value(island_marks, src_pos));
+	return island_bitmap_is_subset(trg, src);
 }
 
 int island_delta_cmp(const struct object_id *a, const struct object_id *b)
 {
-	khiter_t a_pos, b_pos;
-	struct island_bitmap *a_bitmap = NULL, *b_bitmap = NULL;
+	struct island_bitmap *a_bitmap, *b_bitmap;
 
 	if (!island_marks)
 		return 0;
 
-	a_pos = kh_get_oid_map(island_marks, *a);
-	if (a_pos < kh_end(island_marks))
-		a_bitmap = kh_value(island_marks, a_pos);
-
-	b_pos = kh_get_oid_map(island_marks, *b);
-	if (b_pos < kh_end(island_marks))
-		b_bitmap = kh_value(island_marks, b_pos);
+	a_bitmap = get_island_marks(a);
+	b_bitmap = get_island_marks(b);
 
 	if (a_bitmap) {
 		if (!b_bitmap || !island_bitmap_is_subset(a_bitmap, b_bitmap))
@@ -149,45 +230,74 @@ int island_delta_cmp(const struct object_id *a, const struct object_id *b)
 	return 0;
 }
 
-static struct island_bitmap *create_or_get_island_marks(struct object *obj)
+/*
+ * Put "obj" in the set it is already in (if any) plus the islands in
+ * island_scratch, which is clobbered, and return the id of that set.
+ */
+static int add_scratch_to_island_marks(struct object *obj)
 {
 	khiter_t pos;
-	int hash_ret;
+	int hash_ret, id;
+	uint32_t i;
 
-	pos = kh_put_oid_map(island_marks, obj->oid, &hash_ret);
-	if (hash_ret)
-		kh_value(island_marks, pos) = island_bitmap_new(NULL);
+	pos = kh_put_oid_pos(island_marks, obj->oid, &hash_ret);
+	if (!hash_ret) {
+		int old = kh_value(island_marks, pos);
 
-	return kh_value(island_marks, pos);
+		for (i = 0; i < island_bitmap_size; i++)
+			island_scratch->bits[i] |= island_sets[old]->bits[i];
+		id = kh_value(island_marks, pos) = intern_island_scratch();
+		unref_island_set(old);
+	} else {
+		id = kh_value(island_marks, pos) = intern_island_scratch();
+	}
+	return id;
+}
+
+static void add_island_mark(struct object *obj, uint32_t island)
+{
+	memset(island_scratch->bits, 0, st_mult(island_bitmap_size, 4));
+	island_scratch->bits[ISLAND_BITMAP_BLOCK(island)] |=
+		ISLAND_BITMAP_MASK(island);
+	add_scratch_to_island_marks(obj);
 }
 
 static void set_island_marks(struct object *obj, struct island_bitmap *marks)
 {
-	struct island_bitmap *b;
+	struct island_bitmap *old;
+	struct island_union *u;
 	khiter_t pos;
 	int hash_ret;
 
-	pos = kh_put_oid_map(island_marks, obj->oid, &hash_ret);
+	pos = kh_put_oid_pos(island_marks, obj->oid, &hash_ret);
 	if (hash_ret) {
-		/*
-		 * We don't have one yet; make a copy-on-write of the
-		 * parent.
-		 */
+		/* We don't have one yet; share the parent's. */
 		marks->refcount++;
-		kh_value(island_marks, pos) = marks;
+		kh_value(island_marks, pos) = marks->id;
 		return;
 	}
 
-	/*
-	 * We do have it. Make sure we split any copy-on-write before
-	 * updating.
-	 */
-	b = kh_value(island_marks, pos);
-	if (b->refcount > 1) {
-		b->refcount--;
-		b = kh_value(island_marks, pos) = island_bitmap_new(b);
+	old = island_sets[kh_value(island_marks, pos)];
+	if (island_bitmap_is_subset(marks, old))
+		return;
+
+	u = &island_union_cache[(old->serial * 0x9e3779b1u ^ marks->serial) %
+				ISLAND_UNION_CACHE_SIZE];
+	if (u->a == old->serial && u->b == marks->serial &&
+	    island_sets[u->result_id] &&
+	    island_sets[u->result_id]->serial == u->result) {
+		island_sets[u->result_id]->refcount++;
+		kh_value(island_marks, pos) = u->result_id;
+		unref_island_set(old->id);
+		return;
 	}
-	island_bitmap_or(b, marks);
+
+	u->a = old->serial;
+	u->b = marks->serial;
+	memcpy(island_scratch->bits, marks->bits,
+	       st_mult(island_bitmap_size, 4));
+	u->result_id = add_scratch_to_island_marks(obj);
+	u->result = island_sets[u->result_id]->serial;
 }
 
 static void mark_remote_island_1(struct repository *r,
@@ -197,14 +307,12 @@ static void mark_remote_island_1(struct repository *r,
 	uint32_t i;
 
 	for (i = 0; i < rl->oids.nr; ++i) {
-		struct island_bitmap *marks;
 		struct object *obj = parse_object(r, &rl->oids.oid[i]);
 
 		if (!obj)
 			continue;
 
-		marks = create_or_get_island_marks(obj);
-		island_bitmap_set(marks, island_counter);
+		add_island_mark(obj, island_counter);
 
 		if (is_core_island && obj->type == OBJ_COMMIT)
 			obj->flags |= NEEDS_BITMAP;
@@ -214,8 +322,7 @@ static void mark_remote_island_1(struct repository *r,
 			obj = ((struct tag *)obj)->tagged;
 			if (obj) {
 				parse_object(r, &obj->oid);
-				marks = create_or_get_island_marks(obj);
-				island_bitmap_set(marks, island_counter);
+				add_island_mark(obj, island_counter);
 			}
 		}
 	}
@@ -277,14 +384,11 @@ void resolve_tree_islands(struct repository *r,
 		struct tree *tree;
 		struct tree_desc desc;
 		struct name_entry entry;
-		khiter_t pos;
 
-		pos = kh_get_oid_map(island_marks, ent->idx.oid);
-		if (pos >= kh_end(island_marks))
+		root_marks = get_island_marks(&ent->idx.oid);
+		if (!root_marks)
 			continue;
 
-		root_marks = kh_value(island_marks, pos);
-
 		tree = lookup_tree(r, &ent->idx.oid);
 		if (!tree || parse_tree(tree) < 0)
 			die(_("bad tree object %s"), oid_to_hex(&ent->idx.oid));
@@ -310,6 +414,9 @@ void resolve_tree_islands(struct repository *r,
 
 	stop_progress(&progress_state);
 	free(todo);
+
+	trace2_data_intmax("pack-objects", r, "island-sets",
+			   hashmap_get_size(&island_bitmaps));
 }
 
 static regex_t *island_regexes;
@@ -344,6 +451,20 @@ static int island_config_callback(const char *k, const char *v, void *cb)
 	return 0;
 }
 
+static int describe_island_config(const char *k, const char *v, void *cb)
+{
+	struct strbuf *out = cb;
+
+	if (!strcmp(k, "pack.island") || !strcmp(k, "pack.islandcore"))
+		strbuf_addf(out, "%s=%s\n", k, v ? v : "");
+	return 0;
+}
+
+void describe_delta_islands(struct strbuf *out)
+{
+	git_config(describe_island_config, out);
+}
+
 static void add_ref_to_island(const char *island_name, const struct object_id *oid)
 {
 	uint64_t sha_core;
@@ -445,6 +566,7 @@ static void deduplicate_islands(struct repository *r)
 	}
 
 	island_bitmap_size = (island_count / 32) + 1;
+	init_island_bitmaps();
 	core = get_core_island();
 
 	for (i = 0; i < island_count; ++i) {
@@ -456,7 +578,7 @@ static void deduplicate_islands(struct repository *r)
 
 void load_delta_islands(struct repository *r, int progress)
 {
-	island_marks = kh_init_oid_map();
+	island_marks = kh_init_oid_pos();
 	remote_islands = kh_init_str();
 
 	git_config(island_config_callback, NULL);
@@ -469,11 +591,10 @@ void load_delta_islands(struct repository *r, int progress)
 
 void propagate_island_marks(struct commit *commit)
 {
-	khiter_t pos = kh_get_oid_map(island_marks, commit->object.oid);
+	struct island_bitmap *root_marks = get_island_marks(&commit->object.oid);
 
-	if (pos < kh_end(island_marks)) {
+	if (root_marks) {
 		struct commit_list *p;
-		struct island_bitmap *root_marks = kh_value(island_marks, pos);
 
 		parse_commit(commit);
 		set_island_marks(&get_commit_tree(commit)->object, root_marks);
@@ -491,16 +612,12 @@ int compute_pack_layers(struct packing_data *to_pack)
 
 	for (i = 0; i < to_pack->nr_objects; ++i) {
 		struct object_entry *entry = &to_pack->objects[i];
-		khiter_t pos = kh_get_oid_map(island_marks, entry->idx.oid);
+		struct island_bitmap *bitmap = get_island_marks(&entry->idx.oid);
 
 		oe_set_layer(to_pack, entry, 1);
 
-		if (pos < kh_end(island_marks)) {
-			struct island_bitmap *bitmap = kh_value(island_marks, pos);
-
-			if (island_bitmap_get(bitmap, island_counter_core))
-				oe_set_layer(to_pack, entry, 0);
-		}
+		if (bitmap && island_bitmap_get(bitmap, island_counter_core))
+			oe_set_layer(to_pack, entry, 0);
 	}
 
 	return 2;
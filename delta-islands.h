@@ -5,6 +5,7 @@ struct commit;
 struct object_id;
 struct packing_data;
 struct repository;
+struct strbuf;
 
 int island_delta_cmp(const struct object_id *a, const struct object_id *b);
 int in_same_island(const struct object_id *, const struct object_id *);
@@ -15,4 +16,10 @@ void load_delta_islands(struct repository *r, int progress);
 void propagate_island_marks(struct commit *commit);
 int compute_pack_layers(struct packing_data *to_pack);
 
+/*
+ * Append the configuration that determines island membership to "out",
+ * so that callers can tell whether two runs used the same islands.
+ */
+void describe_delta_islands(struct strbuf *out);
+
 #endif /* DELTA_ISLANDS_H */
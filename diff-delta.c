@@ -130,9 +130,32 @@ struct delta_index {
 	struct index_entry *hash[FLEX_ARRAY];
 };
 
+/* Number of blocks whose fingerprints are computed side by side */
+#define INDEX_STRIDE 4
+
+/*
+ * Compute the fingerprints of the "nr" blocks that start right after
+ * data, data - RABIN_WINDOW, data - 2 * RABIN_WINDOW, ...  Each one is
+ * a chain of dependent table lookups; interleaving a few of them lets
+ * the CPU work on all of them at once.
+ */
+static inline void block_fingerprints(const unsigned char *data,
+				      unsigned int *val, int nr)
+{
+	int i, j;
+
+	for (j = 0; j < nr; j++)
+		val[j] = 0;
+	for (i = 1; i <= RABIN_WINDOW; i++)
+		for (j = 0; j < nr; j++) {
+			unsigned int c = data[i - j * RABIN_WINDOW];
+			val[j] = ((val[j] << 8) | c) ^ T[val[j] >> RABIN_SHIFT];
+		}
+}
+
 struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 {
-	unsigned int i, hsize, hmask, entries, prev_val, *hash_count;
+	unsigned int i, j, hsize, hmask, entries, prev_val, *hash_count;
 	const unsigned char *data, *buffer = buf;
 	struct delta_index *index;
 	struct unpacked_index_entry *entry, **hash;
@@ -180,24 +203,32 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 
 	/* then populate the index */
 	prev_val = ~0;
-	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
-	     data >= buffer;
-	     data -= RABIN_WINDOW) {
-		unsigned int val = 0;
-		for (i = 1; i <= RABIN_WINDOW; i++)
-			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
-		if (val == prev_val) {
-			/* keep the lowest of consecutive identical blocks */
-			entry[-1].entry.ptr = data + RABIN_WINDOW;
-			--entries;
-		} else {
-			prev_val = val;
-			i = val & hmask;
-			entry->entry.ptr = data + RABIN_WINDOW;
-			entry->entry.val = val;
-			entry->next = hash[i];
-			hash[i] = entry++;
-			hash_count[i]++;
+	for (j = entries; j; ) {
+		unsigned int vals[INDEX_STRIDE];
+		int k, nr = j < INDEX_STRIDE ? j : INDEX_STRIDE;
+
+		data = buffer + (j - 1) * RABIN_WINDOW;
+		if (nr == INDEX_STRIDE)
+			block_fingerprints(data, vals, INDEX_STRIDE);
+		else
+			block_fingerprints(data, vals, nr);
+
+		for (k = 0; k < nr; k++, j--, data -= RABIN_WINDOW) {
+			unsigned int val = vals[k];
+
+			if (val == prev_val) {
+				/* keep the lowest of consecutive identical blocks */
+				entry[-1].entry.ptr = data + RABIN_WINDOW;
+				--entries;
+			} else {
+				prev_val = val;
+				i = val & hmask;
+				entry->entry.ptr = data + RABIN_WINDOW;
+				entry->entry.val = val;
+				entry->next = hash[i];
+				hash[i] = entry++;
+				hash_count[i]++;
+			}
 		}
 	}
 
@@ -308,6 +339,29 @@ unsigned long sizeof_delta_index(struct delta_index *index)
 		return 0;
 }
 
+/*
+ * Return how many bytes "a" and "b" have in common at their start,
+ * up to "max", comparing a word at a time.
+ */
+static inline size_t common_prefix(const unsigned char *a,
+				   const unsigned char *b, size_t max)
+{
+	size_t n = 0;
+
+	while (max - n >= sizeof(uint64_t)) {
+		uint64_t x, y;
+
+		memcpy(&x, a + n, sizeof(x));
+		memcpy(&y, b + n, sizeof(y));
+		if (x != y)
+			break;
+		n += sizeof(x);
+	}
+	while (n < max && a[n] == b[n])
+		n++;
+	return n;
+}
+
 /*
  * The maximum size for any opcode sequence, including the initial header
  * plus Rabin window plus biggest copy.
@@ -378,19 +432,18 @@ create_delta(const struct delta_index *index,
 			i = val & index->hash_mask;
 			for (entry = index->hash[i]; entry < index->hash[i+1]; entry++) {
 				const unsigned char *ref = entry->ptr;
-				const unsigned char *src = data;
 				unsigned int ref_size = ref_top - ref;
+				size_t len;
 				if (entry->val != val)
 					continue;
-				if (ref_size > top - src)
-					ref_size = top - src;
+				if (ref_size > top - data)
+					ref_size = top - data;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < ref - entry->ptr) {
+				len = common_prefix(ref, data, ref_size);
+				if (msize < len) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
+					msize = len;
 					moff = entry->ptr - ref_data;
 					if (msize >= 4096) /* good enough */
 						break;
@@ -67,27 +67,87 @@ static int check_removed(const struct index_state *istate, const struct cache_en
  * modified at all but wants to know all the conditions that are met (new
  * commits, untracked content and/or modified content).
  */
+/*
+ * Decide whether the submodule at gitlink "ce" has to be asked if it is
+ * dirty, and if so whether it should ignore untracked files.  "changed"
+ * is cleared when the submodule is to be ignored altogether.
+ */
+static int wants_submodule_status(struct diff_options *diffopt,
+				  const struct cache_entry *ce,
+				  int *changed, int *ignore_untracked)
+{
+	struct diff_flags orig_flags = diffopt->flags;
+	int wants = 0;
+
+	if (!diffopt->flags.override_submodule_config)
+		set_diffopt_flags_from_submodule_config(diffopt, ce->name);
+	if (diffopt->flags.ignore_submodules)
+		*changed = 0;
+	else if (!diffopt->flags.ignore_dirty_submodules &&
+		 (!*changed || diffopt->flags.dirty_submodules)) {
+		*ignore_untracked = diffopt->flags.ignore_untracked_in_submodules;
+		wants = 1;
+	}
+	diffopt->flags = orig_flags;
+	return wants;
+}
+
 static int match_stat_with_submodule(struct diff_options *diffopt,
 				     const struct cache_entry *ce,
 				     struct stat *st, unsigned ce_option,
 				     unsigned *dirty_submodule)
 {
 	int changed = ie_match_stat(diffopt->repo->index, ce, st, ce_option);
-	if (S_ISGITLINK(ce->ce_mode)) {
-		struct diff_flags orig_flags = diffopt->flags;
-		if (!diffopt->flags.override_submodule_config)
-			set_diffopt_flags_from_submodule_config(diffopt, ce->name);
-		if (diffopt->flags.ignore_submodules)
-			changed = 0;
-		else if (!diffopt->flags.ignore_dirty_submodules &&
-			 (!changed || diffopt->flags.dirty_submodules))
-			*dirty_submodule = is_submodule_modified(ce->name,
-								 diffopt->flags.ignore_untracked_in_submodules);
-		diffopt->flags = orig_flags;
-	}
+	int ignore_untracked;
+
+	if (S_ISGITLINK(ce->ce_mode) &&
+	    wants_submodule_status(diffopt, ce, &changed, &ignore_untracked))
+		*dirty_submodule = is_submodule_modified(ce->name,
+							 ignore_untracked);
 	return changed;
 }
 
+/*
+ * Find the submodules whose dirtiness match_stat_with_submodule() will
+ * want to know about, and ask them all up front, in parallel.
+ */
+static void prefetch_submodules_status(struct rev_info *revs,
+				       unsigned ce_option)
+{
+	struct diff_options *diffopt = &revs->diffopt;
+	struct index_state *istate = diffopt->repo->index;
+	struct string_list paths = STRING_LIST_INIT_NODUP;
+	int i;
+
+	/* with --quiet we would stop at the first difference */
+	if (diffopt->flags.quick || submodule_diff_jobs(diffopt->repo) <= 1)
+		return;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		int changed, ignore_untracked;
+		struct stat st;
+
+		if (!S_ISGITLINK(ce->ce_mode) || ce_stage(ce) ||
+		    ce_uptodate(ce) || ce_skip_worktree(ce) ||
+		    (ce->ce_flags & (CE_VALID | CE_FSMONITOR_VALID)))
+			continue;
+		if (!ce_path_match(istate, ce, &revs->prune_data, NULL))
+			continue;
+		if (check_removed(istate, ce, &st))
+			continue;
+
+		changed = ie_match_stat(istate, ce, &st, ce_option);
+		if (wants_submodule_status(diffopt, ce, &changed,
+					   &ignore_untracked))
+			string_list_append(&paths, ce->name)->util =
+				ignore_untracked ? (void *)1 : NULL;
+	}
+
+	get_submodules_status(diffopt->repo, &paths);
+	string_list_clear(&paths, 0);
+}
+
 int run_diff_files(struct rev_info *revs, unsigned int option)
 {
 	int entries, i;
@@ -103,6 +163,7 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 
 	if (diff_unmerged_stage < 0)
 		diff_unmerged_stage = 2;
+	prefetch_submodules_status(revs, ce_option);
 	entries = istate->cache_nr;
 	for (i = 0; i < entries; i++) {
 		unsigned int oldmode, newmode;
@@ -257,6 +318,7 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 			    ce->name, 0, dirty_submodule);
 
 	}
+	clear_submodules_status();
 	diffcore_std(&revs->diffopt);
 	diff_flush(&revs->diffopt);
 	trace_performance_since(start, "diff-files");
@@ -615,8 +677,11 @@ int run_diff_index(struct rev_info *revs, unsigned int option)
 		name = ent->name;
 	}
 
+	if (!cached)
+		prefetch_submodules_status(revs, 0);
 	if (diff_cache(revs, &oid, name, cached))
 		exit(128);
+	clear_submodules_status();
 
 	diff_set_mnemonic_prefix(&revs->diffopt, "c/", cached ? "i/" : "w/");
 	diffcore_fix_diff_index();
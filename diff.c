@@ -26,6 +26,7 @@
 #include "parse-options.h"
 #include "help.h"
 #include "promisor-remote.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -779,8 +780,10 @@ struct emitted_diff_symbol {
 struct emitted_diff_symbols {
 	struct emitted_diff_symbol *buf;
 	int nr, alloc;
+	/* if set, the lines are allocated from it and not free()d */
+	struct mem_pool *pool;
 };
-#define EMITTED_DIFF_SYMBOLS_INIT {NULL, 0, 0}
+#define EMITTED_DIFF_SYMBOLS_INIT {NULL, 0, 0, NULL}
 
 static void append_emitted_diff_symbol(struct diff_options *o,
 				       struct emitted_diff_symbol *e)
@@ -793,7 +796,17 @@ static void append_emitted_diff_symbol(struct diff_options *o,
 	f = &o->emitted_symbols->buf[o->emitted_symbols->nr++];
 
 	memcpy(f, e, sizeof(struct emitted_diff_symbol));
-	f->line = e->line ? xmemdupz(e->line, e->len) : NULL;
+	if (!e->line) {
+		f->line = NULL;
+	} else if (o->emitted_symbols->pool) {
+		char *line = mem_pool_alloc(o->emitted_symbols->pool, e->len + 1);
+
+		memcpy(line, e->line, e->len);
+		line[e->len] = '\0';
+		f->line = line;
+	} else {
+		f->line = xmemdupz(e->line, e->len);
+	}
 }
 
 struct moved_entry {
@@ -2251,11 +2264,10 @@ static void init_diff_words_data(struct emit_callback *ecbdata,
 	if (!o->word_regex)
 		o->word_regex = diff_word_regex_cfg;
 	if (o->word_regex) {
-		ecbdata->diff_words->word_regex = (regex_t *)
-			xmalloc(sizeof(regex_t));
-		if (regcomp(ecbdata->diff_words->word_regex,
-			    o->word_regex,
-			    REG_EXTENDED | REG_NEWLINE))
+		ecbdata->diff_words->word_regex =
+			xdiff_get_regex(o->word_regex,
+					REG_EXTENDED | REG_NEWLINE);
+		if (!ecbdata->diff_words->word_regex)
 			die("invalid regular expression: %s",
 			    o->word_regex);
 	}
@@ -2284,10 +2296,8 @@ static void free_diff_words_data(struct emit_callback *ecbdata)
 		free (ecbdata->diff_words->minus.orig);
 		free (ecbdata->diff_words->plus.text.ptr);
 		free (ecbdata->diff_words->plus.orig);
-		if (ecbdata->diff_words->word_regex) {
-			regfree(ecbdata->diff_words->word_regex);
-			free(ecbdata->diff_words->word_regex);
-		}
+		if (ecbdata->diff_words->word_regex)
+			xdiff_put_regex(ecbdata->diff_words->word_regex);
 		FREE_AND_NULL(ecbdata->diff_words);
 	}
 }
@@ -3356,6 +3366,13 @@ static void emit_binary_diff(struct diff_options *o,
 	emit_binary_diff_body(o, two, one);
 }
 
+int diff_filespec_driver_binary(struct repository *r,
+				struct diff_filespec *one)
+{
+	diff_filespec_load_driver(one, r->index);
+	return one->driver->binary;
+}
+
 int diff_filespec_is_binary(struct repository *r,
 			    struct diff_filespec *one)
 {
@@ -3412,7 +3429,8 @@ static void builtin_diff(const char *name_a,
 			 const char *xfrm_msg,
 			 int must_show_header,
 			 struct diff_options *o,
-			 int complete_rewrite)
+			 int complete_rewrite,
+			 int ws_rule)
 {
 	mmfile_t mf1, mf2;
 	const char *lbl[2];
@@ -3585,7 +3603,8 @@ static void builtin_diff(const char *name_a,
 			lbl[0] = NULL;
 		ecbdata.label_path = lbl;
 		ecbdata.color_diff = want_color(o->use_color);
-		ecbdata.ws_rule = whitespace_rule(o->repo->index, name_b);
+		ecbdata.ws_rule = ws_rule >= 0 ? ws_rule :
+			whitespace_rule(o->repo->index, name_b);
 		if (ecbdata.ws_rule & WS_BLANK_AT_EOF)
 			check_blank_at_eof(&mf1, &mf2, &ecbdata);
 		ecbdata.opt = o;
@@ -4421,7 +4440,7 @@ static void run_diff_cmd(const char *pgm,
 	if (one && two)
 		builtin_diff(name, other ? other : name,
 			     one, two, xfrm_msg, must_show_header,
-			     o, complete_rewrite);
+			     o, complete_rewrite, -1);
 	else
 		fprintf(o->file, "* Unmerged path %s\n", name);
 }
@@ -6317,15 +6336,263 @@ void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc)
 		warning(_(rename_limit_advice), varname, needed);
 }
 
+/*
+ * The patches of many file pairs can be computed by several threads,
+ * each into a buffer of diff symbols of its own, which are then emitted
+ * in the order of the queue. Everything that looks at attributes, the
+ * configuration or the working tree, or could otherwise not be done
+ * from several threads at once (finding the diff driver, the whitespace
+ * rules and the abbreviated object names of the header) is done by the
+ * main thread beforehand; the pairs that need more than reading two
+ * blobs (textconv, external diff drivers, submodules, rewrites, files
+ * from the working tree, ...) are left to the main thread altogether.
+ */
+struct patch_job {
+	struct diff_filepair *p;
+	const char *name, *other;
+	struct strbuf msg;
+	int must_show_header;
+	int ws_rule;
+	int found_changes;
+	struct emitted_diff_symbols esm;
+};
+
+struct patch_work {
+	struct diff_options *o;
+	struct patch_job *job;
+	int nr, next;
+	pthread_mutex_t mutex;
+	/* the lines of the patches, until they are emitted */
+	struct mem_pool_set pools;
+};
+
+/* file pairs to have in the queue before another thread is worth it */
+#define PATCH_PAIRS_PER_THREAD 64
+/* file pairs computed ahead of their output */
+#define PATCH_WINDOW 1024
+
+int diff_patch_threads(struct repository *r, int nr_files)
+{
+	int nr = git_env_ulong("GIT_TEST_DIFF_THREADS", 0);
+
+	if (!HAVE_THREADS)
+		return 1;
+	if (nr)
+		return nr;
+	if (repo_config_get_int(r, "diff.threads", &nr) || nr < 0)
+		nr = 0;
+	if (!nr) {
+		nr = nr_files / PATCH_PAIRS_PER_THREAD;
+		if (nr > online_cpus())
+			nr = online_cpus();
+	}
+	return nr ? nr : 1;
+}
+
+static int patch_threads(struct diff_options *o, int nr_pairs)
+{
+	if (o->color_moved || o->output_prefix ||
+	    (o->repo->index && o->repo->index->cache))
+		return 1;
+	return diff_patch_threads(o->repo, nr_pairs);
+}
+
+static int is_blob_for_thread(struct diff_filespec *one)
+{
+	if (!DIFF_FILE_VALID(one))
+		return 1;
+	return one->oid_valid && !one->is_stdin && one->count <= 1 &&
+		(S_ISREG(one->mode) || S_ISLNK(one->mode));
+}
+
+/*
+ * Prepare the patch of "p" to be computed by a thread, doing what the
+ * thread cannot do itself, or return 0 if it has to be done by
+ * diff_flush_patch() instead.
+ */
+static int prepare_patch_job(struct diff_options *o, struct diff_filepair *p,
+			     struct patch_job *job)
+{
+	struct diff_filespec *one = p->one, *two = p->two;
+	const char *name_a, *name_b;
+
+	if (DIFF_PAIR_UNMERGED(p) ||
+	    !is_blob_for_thread(one) || !is_blob_for_thread(two) ||
+	    (DIFF_FILE_VALID(one) && DIFF_FILE_VALID(two) &&
+	     (S_IFMT & one->mode) != (S_IFMT & two->mode)) ||
+	    (p->status == DIFF_STATUS_MODIFIED && p->score))
+		return 0;
+
+	diff_filespec_load_driver(one, o->repo->index);
+	diff_filespec_load_driver(two, o->repo->index);
+	if (o->flags.allow_external &&
+	    (external_diff() || one->driver->external))
+		return 0;
+	if (o->flags.allow_textconv &&
+	    (one->driver->textconv || two->driver->textconv))
+		return 0;
+
+	memset(job, 0, sizeof(*job));
+	job->p = p;
+	job->name = one->path;
+	job->other = strcmp(one->path, two->path) ? two->path : NULL;
+	if (o->prefix_length)
+		strip_prefix(o->prefix_length, &job->name, &job->other);
+
+	/* as in builtin_diff() */
+	name_a = job->name;
+	name_b = job->other ? job->other : job->name;
+	name_a = DIFF_FILE_VALID(one) ? name_a : name_b;
+	name_b = DIFF_FILE_VALID(two) ? name_b : name_a;
+	job->ws_rule = whitespace_rule(o->repo->index, name_b);
+
+	fill_metainfo(&job->msg, job->name, job->other, one, two, o, p,
+		      &job->must_show_header, want_color(o->use_color));
+	return 1;
+}
+
+static void compute_patch_job(struct diff_options *o, struct patch_job *job)
+{
+	struct diff_options opt;
+
+	memcpy(&opt, o, sizeof(opt));
+	opt.emitted_symbols = &job->esm;
+	opt.found_changes = 0;
+	builtin_diff(job->name, job->other ? job->other : job->name,
+		     job->p->one, job->p->two,
+		     job->msg.len ? job->msg.buf : NULL,
+		     job->must_show_header, &opt, 0, job->ws_rule);
+	job->found_changes = opt.found_changes;
+}
+
+static void *patch_thread(void *data)
+{
+	struct patch_work *work = data;
+
+	trace2_thread_start("diff-patch");
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&work->mutex);
+		i = work->next++;
+		pthread_mutex_unlock(&work->mutex);
+		if (i >= work->nr)
+			break;
+		work->job[i].esm.pool = mem_pool_set_get(&work->pools);
+		compute_patch_job(work->o, &work->job[i]);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void compute_patch_jobs(struct patch_work *work, int nr_threads)
+{
+	pthread_t *threads;
+	int i;
+
+	if (nr_threads > work->nr)
+		nr_threads = work->nr;
+	ALLOC_ARRAY(threads, nr_threads);
+	work->next = 0;
+	mem_pool_set_init(&work->pools, 0);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, patch_thread, work);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static void emit_patch_jobs(struct diff_options *o, struct patch_work *work)
+{
+	int i, j;
+
+	for (i = 0; i < work->nr; i++) {
+		struct patch_job *job = &work->job[i];
+
+		for (j = 0; j < job->esm.nr; j++)
+			emit_diff_symbol_from_struct(o, &job->esm.buf[j]);
+		free(job->esm.buf);
+		strbuf_release(&job->msg);
+		if (job->found_changes)
+			o->found_changes = 1;
+	}
+	mem_pool_set_discard(&work->pools, 0);
+	work->nr = 0;
+}
+
+static void diff_flush_patch_parallel(struct diff_options *o, int nr_threads)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct patch_work work = { 0 };
+	int i = 0;
+
+	/* builtin_diff() would set it up in each thread */
+	diff_set_mnemonic_prefix(o, "a/", "b/");
+
+	work.o = o;
+	ALLOC_ARRAY(work.job, PATCH_WINDOW);
+	pthread_mutex_init(&work.mutex, NULL);
+	enable_obj_read_lock();
+	enable_xdiff_regex_lock();
+	trace2_region_enter("diff", "patch-threads", o->repo);
+	trace2_data_intmax("diff", o->repo, "patch-threads", nr_threads);
+
+	while (i < q->nr) {
+		struct diff_filepair *p = NULL;
+
+		while (i < q->nr && work.nr < PATCH_WINDOW) {
+			p = q->queue[i];
+			if (!check_pair_status(p) || diff_unmodified_pair(p) ||
+			    (DIFF_FILE_VALID(p->one) && S_ISDIR(p->one->mode)) ||
+			    (DIFF_FILE_VALID(p->two) && S_ISDIR(p->two->mode))) {
+				p = NULL;
+				i++;
+				continue;
+			}
+			if (!prepare_patch_job(o, p, &work.job[work.nr]))
+				break;
+			work.nr++;
+			p = NULL;
+			i++;
+		}
+
+		if (work.nr) {
+			compute_patch_jobs(&work, nr_threads);
+			emit_patch_jobs(o, &work);
+		}
+		if (p) {
+			/* one for this thread alone */
+			diff_flush_patch(p, o);
+			i++;
+		}
+	}
+
+	trace2_region_leave("diff", "patch-threads", o->repo);
+	disable_xdiff_regex_lock();
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&work.mutex);
+	free(work.job);
+}
+
 static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 {
 	int i;
 	static struct emitted_diff_symbols esm = EMITTED_DIFF_SYMBOLS_INIT;
 	struct diff_queue_struct *q = &diff_queued_diff;
+	int nr_threads;
 
 	if (WSEH_NEW & WS_RULE_MASK)
 		BUG("WS rules bit mask overlaps with diff symbol flags");
 
+	nr_threads = patch_threads(o, q->nr);
+	if (nr_threads > 1) {
+		diff_flush_patch_parallel(o, nr_threads);
+		return;
+	}
+
 	if (o->color_moved)
 		o->emitted_symbols = &esm;
 
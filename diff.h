@@ -153,6 +153,12 @@ struct diff_flags {
 
 	unsigned quick;
 
+	/*
+	 * Do not look up or store the result of a tree diff in the
+	 * tree-diff cache, e.g. because it runs in a thread of its own.
+	 */
+	unsigned no_tree_diff_cache;
+
 	/**
 	 * Tells diff-files that the input is not tracked files but files in random
 	 * locations on the filesystem.
@@ -598,6 +604,13 @@ void diff_flush(struct diff_options*);
 void diff_free(struct diff_options*);
 void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc);
 
+/*
+ * Return the number of threads to compute the patches of nr_files files
+ * with, as configured by diff.threads or picked by the number of files
+ * and of CPUs; 1 means not to use threads.
+ */
+int diff_patch_threads(struct repository *r, int nr_files);
+
 /* diff-raw status letters */
 #define DIFF_STATUS_ADDED		'A'
 #define DIFF_STATUS_COPIED		'C'
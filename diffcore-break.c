@@ -70,8 +70,17 @@ static int should_break(struct repository *r,
 		options.missing_object_data = r;
 	}
 
-	if (diff_populate_filespec(r, src, &options) ||
-	    diff_populate_filespec(r, dst, &options))
+	if (!src->cnt_data)
+		src->cnt_data = diffcore_count_cached(r, src);
+	if (!dst->cnt_data)
+		dst->cnt_data = diffcore_count_cached(r, dst);
+
+	/* with the span hashes at hand, we only need the size */
+	options.check_size_only = !!src->cnt_data;
+	if (diff_populate_filespec(r, src, &options))
+		return 0; /* error but caught downstream */
+	options.check_size_only = !!dst->cnt_data;
+	if (diff_populate_filespec(r, dst, &options))
 		return 0; /* error but caught downstream */
 
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
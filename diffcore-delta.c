@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "oidmap.h"
 
 /*
  * Idea here is very simple.
@@ -163,6 +164,87 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	return hash;
 }
 
+void *diffcore_count_prepare(struct repository *r,
+			     struct diff_filespec *one)
+{
+	return hash_chars(r, one);
+}
+
+/* Stop remembering new span hashes once they take this much memory */
+#define SPANHASH_CACHE_LIMIT (64 * 1024 * 1024)
+
+struct spanhash_cache_entry {
+	struct oidmap_entry entry;
+	/*
+	 * Whether the span hashes skip the CR of CRLF, and whether that
+	 * was decided by looking at the contents rather than by a diff
+	 * driver.
+	 */
+	unsigned is_text : 1,
+		 from_contents : 1;
+	struct spanhash_top *hash;
+};
+
+static struct oidmap spanhash_cache = OIDMAP_INIT;
+static size_t spanhash_cache_size;
+
+static size_t spanhash_size(const struct spanhash_top *hash)
+{
+	return st_add(sizeof(*hash),
+		      st_mult(sizeof(struct spanhash), 1 << hash->alloc_log2));
+}
+
+static int spanhash_cacheable(struct diff_filespec *one)
+{
+	return one->oid_valid && DIFF_FILE_VALID(one) && S_ISREG(one->mode);
+}
+
+void *diffcore_count_cached(struct repository *r,
+			    struct diff_filespec *one)
+{
+	struct spanhash_cache_entry *e;
+	int driver_binary;
+
+	if (!spanhash_cacheable(one) ||
+	    !(e = oidmap_get(&spanhash_cache, &one->oid)))
+		return NULL;
+
+	driver_binary = diff_filespec_driver_binary(r, one);
+	if (driver_binary == -1) {
+		if (!e->from_contents)
+			return NULL;
+		one->is_binary = !e->is_text;
+	} else if (e->is_text != !driver_binary)
+		return NULL;
+
+	return xmemdupz(e->hash, spanhash_size(e->hash));
+}
+
+void diffcore_count_remember(struct repository *r,
+			     struct diff_filespec *one,
+			     void *count)
+{
+	struct spanhash_top *hash = count;
+	struct spanhash_cache_entry *e;
+	size_t size;
+
+	if (!spanhash_cacheable(one) || one->is_binary == -1)
+		return;
+	size = spanhash_size(hash);
+	if (spanhash_cache_size + size > SPANHASH_CACHE_LIMIT)
+		return;
+	if (oidmap_get(&spanhash_cache, &one->oid))
+		return;
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->entry.oid, &one->oid);
+	e->is_text = !one->is_binary;
+	e->from_contents = diff_filespec_driver_binary(r, one) == -1;
+	e->hash = xmemdupz(hash, size);
+	oidmap_put(&spanhash_cache, e);
+	spanhash_cache_size += size;
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
@@ -180,6 +262,7 @@ int diffcore_count_changes(struct repository *r,
 		src_count = *src_count_p;
 	if (!src_count) {
 		src_count = hash_chars(r, src);
+		diffcore_count_remember(r, src, src_count);
 		if (src_count_p)
 			*src_count_p = src_count;
 	}
@@ -187,6 +270,7 @@ int diffcore_count_changes(struct repository *r,
 		dst_count = *dst_count_p;
 	if (!dst_count) {
 		dst_count = hash_chars(r, dst);
+		diffcore_count_remember(r, dst, dst_count);
 		if (dst_count_p)
 			*dst_count_p = dst_count;
 	}
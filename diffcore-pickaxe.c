@@ -3,12 +3,14 @@
  * Copyright (C) 2010 Google Inc.
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "xdiff-interface.h"
 #include "kwset.h"
 #include "commit.h"
 #include "quote.h"
+#include "pickaxe-index.h"
 
 typedef int (*pickaxe_fn)(mmfile_t *one, mmfile_t *two,
 			  struct diff_options *o,
@@ -122,8 +124,31 @@ static int has_changes(mmfile_t *one, mmfile_t *two,
 	return c1 != c2;
 }
 
+/*
+ * Whether the filespec may contain the -S needle, according to the
+ * pickaxe index if it knows about it.
+ */
+static int may_contain_needle(struct diff_options *o,
+			      struct diff_filespec *spec)
+{
+	if (!DIFF_FILE_VALID(spec))
+		return 0;
+	if (!spec->oid_valid)
+		return 1;
+	return !!pickaxe_index_may_contain(o->repo, &spec->oid, o->pickaxe,
+					   strlen(o->pickaxe));
+}
+
+static void add_to_pickaxe_index(struct diff_options *o,
+				 struct diff_filespec *spec, mmfile_t *mf)
+{
+	if (DIFF_FILE_VALID(spec) && spec->oid_valid)
+		pickaxe_index_add(o->repo, &spec->oid, mf->ptr, mf->size);
+}
+
 static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
-			 regex_t *regexp, kwset_t kws, pickaxe_fn fn)
+			 regex_t *regexp, kwset_t kws, pickaxe_fn fn,
+			 int use_index)
 {
 	struct userdiff_driver *textconv_one = NULL;
 	struct userdiff_driver *textconv_two = NULL;
@@ -156,6 +181,16 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 	if (textconv_one == textconv_two && diff_unmodified_pair(p))
 		return 0;
 
+	/*
+	 * The index knows about the blobs, not what textconv makes of
+	 * them.
+	 */
+	if (textconv_one || textconv_two)
+		use_index = 0;
+	if (use_index &&
+	    !may_contain_needle(o, p->one) && !may_contain_needle(o, p->two))
+		return 0;
+
 	if ((o->pickaxe_opts & DIFF_PICKAXE_KIND_G) &&
 	    !o->flags.text &&
 	    ((!textconv_one && diff_filespec_is_binary(o->repo, p->one)) ||
@@ -165,6 +200,11 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 	mf1.size = fill_textconv(o->repo, textconv_one, p->one, &mf1.ptr);
 	mf2.size = fill_textconv(o->repo, textconv_two, p->two, &mf2.ptr);
 
+	if (use_index) {
+		add_to_pickaxe_index(o, p->one, &mf1);
+		add_to_pickaxe_index(o, p->two, &mf2);
+	}
+
 	ret = fn(&mf1, &mf2, o, regexp, kws);
 
 	if (textconv_one)
@@ -178,7 +218,8 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 }
 
 static void pickaxe(struct diff_queue_struct *q, struct diff_options *o,
-		    regex_t *regexp, kwset_t kws, pickaxe_fn fn)
+		    regex_t *regexp, kwset_t kws, pickaxe_fn fn,
+		    int use_index)
 {
 	int i;
 	struct diff_queue_struct outq;
@@ -189,7 +230,7 @@ static void pickaxe(struct diff_queue_struct *q, struct diff_options *o,
 		/* Showing the whole changeset if needle exists */
 		for (i = 0; i < q->nr; i++) {
 			struct diff_filepair *p = q->queue[i];
-			if (pickaxe_match(p, o, regexp, kws, fn))
+			if (pickaxe_match(p, o, regexp, kws, fn, use_index))
 				return; /* do not munge the queue */
 		}
 
@@ -204,7 +245,7 @@ static void pickaxe(struct diff_queue_struct *q, struct diff_options *o,
 		/* Showing only the filepairs that has the needle */
 		for (i = 0; i < q->nr; i++) {
 			struct diff_filepair *p = q->queue[i];
-			if (pickaxe_match(p, o, regexp, kws, fn))
+			if (pickaxe_match(p, o, regexp, kws, fn, use_index))
 				diff_q(&outq, p);
 			else
 				diff_free_filepair(p);
@@ -233,6 +274,7 @@ void diffcore_pickaxe(struct diff_options *o)
 	regex_t regex, *regexp = NULL;
 	kwset_t kws = NULL;
 	pickaxe_fn fn;
+	int use_index = 0;
 
 	if (opts & ~DIFF_PICKAXE_KIND_OBJFIND &&
 	    (!needle || !*needle))
@@ -272,6 +314,10 @@ void diffcore_pickaxe(struct diff_options *o)
 				       ? tolower_trans_tbl : NULL);
 			kwsincr(kws, needle, strlen(needle));
 			kwsprep(kws);
+
+			if (repo_config_get_bool(o->repo, "diff.pickaxeindex",
+						 &use_index))
+				use_index = 0;
 		}
 		fn = has_changes;
 	} else if (opts & DIFF_PICKAXE_KIND_OBJFIND) {
@@ -280,7 +326,7 @@ void diffcore_pickaxe(struct diff_options *o)
 		BUG("unknown pickaxe_opts flag");
 	}
 
-	pickaxe(&diff_queued_diff, o, regexp, kws, fn);
+	pickaxe(&diff_queued_diff, o, regexp, kws, fn, use_index);
 
 	if (regexp)
 		regfree(regexp);
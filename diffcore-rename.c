@@ -3,6 +3,7 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "object-store.h"
@@ -10,6 +11,7 @@
 #include "progress.h"
 #include "promisor-remote.h"
 #include "strmap.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -184,6 +186,11 @@ static int estimate_similarity(struct repository *r,
 	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
 		return 0;
 
+	if (!src->cnt_data)
+		src->cnt_data = diffcore_count_cached(r, src);
+	if (!dst->cnt_data)
+		dst->cnt_data = diffcore_count_cached(r, dst);
+
 	dpf_opt->check_size_only = 0;
 
 	if (!src->cnt_data && diff_populate_filespec(r, src, dpf_opt))
@@ -206,6 +213,39 @@ static int estimate_similarity(struct repository *r,
 	return score;
 }
 
+/*
+ * Like estimate_similarity(), but only using the sizes and span hashes
+ * that prepare_similarity() filled in, which makes it safe to call on
+ * several threads at once.
+ */
+static int similarity_of_counts(struct diff_filespec *src,
+				struct diff_filespec *dst,
+				int minimum_score)
+{
+	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
+
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
+		return 0;
+	if (!src->cnt_data || !dst->cnt_data)
+		return 0;
+
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	base_size = ((src->size < dst->size) ? src->size : dst->size);
+	delta_size = max_size - base_size;
+	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+		return 0;
+
+	/* with both counts given, this does not look at the blobs */
+	if (diffcore_count_changes(NULL, src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   &src_copied, &literal_added))
+		return 0;
+
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
 static void record_rename_pair(int dst_index, int src_index, int score)
 {
 	struct diff_filepair *src = rename_src[src_index].p;
@@ -1071,6 +1111,188 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * Below this many source/destination pairs, the similarity matrix is
+ * not worth spreading across threads.
+ */
+#define MIN_THREADED_RENAME_PAIRS 256
+
+struct inexact_rename_threads {
+	struct repository *repo;
+	int minimum_score;
+	int skip_unmodified;
+	struct diff_score *mx;
+	int *rows; /* index into rename_dst of each row of mx */
+	int nr_rows;
+
+	/* protected by "mutex" */
+	pthread_mutex_t mutex;
+	struct diff_filespec **prepare;
+	int nr_prepare, next_prepare;
+	int next_row;
+	struct progress *progress;
+	uint64_t done;
+};
+
+/*
+ * Read "one" and compute its span hashes, so that similarity_of_counts()
+ * need not touch the blob.  Populating the filespec may read objects,
+ * the working tree and attributes, none of which is thread-safe, so only
+ * the hashing is done without holding the lock.
+ */
+static void prepare_similarity(struct inexact_rename_threads *t,
+			       struct diff_filespec *one)
+{
+	struct diff_populate_filespec_options dpf_opt = { 0 };
+	int ok;
+
+	pthread_mutex_lock(&t->mutex);
+	one->cnt_data = diffcore_count_cached(t->repo, one);
+	dpf_opt.check_size_only = !!one->cnt_data;
+	ok = !diff_populate_filespec(t->repo, one, &dpf_opt);
+	if (ok && !one->cnt_data)
+		diff_filespec_is_binary(t->repo, one);
+	pthread_mutex_unlock(&t->mutex);
+
+	if (!ok || one->cnt_data) {
+		diff_free_filespec_blob(one);
+		return;
+	}
+
+	one->cnt_data = diffcore_count_prepare(t->repo, one);
+	diff_free_filespec_blob(one);
+
+	pthread_mutex_lock(&t->mutex);
+	diffcore_count_remember(t->repo, one, one->cnt_data);
+	pthread_mutex_unlock(&t->mutex);
+}
+
+static void *inexact_rename_worker(void *data)
+{
+	struct inexact_rename_threads *t = data;
+
+	for (;;) {
+		struct diff_filespec *one;
+
+		pthread_mutex_lock(&t->mutex);
+		if (t->next_prepare >= t->nr_prepare) {
+			pthread_mutex_unlock(&t->mutex);
+			break;
+		}
+		one = t->prepare[t->next_prepare++];
+		pthread_mutex_unlock(&t->mutex);
+
+		prepare_similarity(t, one);
+	}
+
+	return NULL;
+}
+
+static void *inexact_rename_matrix_worker(void *data)
+{
+	struct inexact_rename_threads *t = data;
+
+	for (;;) {
+		struct diff_filespec *two;
+		struct diff_score *m;
+		int row, i, j;
+
+		pthread_mutex_lock(&t->mutex);
+		row = t->next_row++;
+		pthread_mutex_unlock(&t->mutex);
+		if (row >= t->nr_rows)
+			break;
+
+		i = t->rows[row];
+		two = rename_dst[i].p->two;
+		m = &t->mx[row * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		for (j = 0; j < rename_src_nr; j++) {
+			struct diff_filespec *one = rename_src[j].p->one;
+			struct diff_score this_src;
+
+			if (t->skip_unmodified &&
+			    diff_unmodified_pair(rename_src[j].p))
+				continue;
+
+			this_src.score = similarity_of_counts(one, two,
+							      t->minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = i;
+			this_src.src = j;
+			record_if_better(m, &this_src);
+		}
+
+		pthread_mutex_lock(&t->mutex);
+		t->done += rename_src_nr;
+		display_progress(t->progress, t->done);
+		pthread_mutex_unlock(&t->mutex);
+	}
+
+	return NULL;
+}
+
+static void run_inexact_rename_workers(struct inexact_rename_threads *t,
+				       int nr_threads,
+				       void *(*fn)(void *))
+{
+	pthread_t *threads;
+	int i, nr_started;
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (nr_started = 0; nr_started < nr_threads; nr_started++)
+		if (pthread_create(&threads[nr_started], NULL, fn, t))
+			break;
+	if (!nr_started)
+		fn(t);
+	for (i = 0; i < nr_started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*
+ * Fill the similarity matrix "mx" like the single-threaded loop in
+ * diffcore_rename_extended() does, with the same result, but first
+ * computing the span hashes of all candidates and then the rows of
+ * the matrix on "nr_threads" threads.  Returns the number of rows.
+ */
+static int fill_inexact_matrix_threaded(struct inexact_rename_threads *t,
+					int nr_threads)
+{
+	int i, j;
+
+	ALLOC_ARRAY(t->rows, rename_dst_nr);
+	ALLOC_ARRAY(t->prepare, st_add(rename_src_nr, rename_dst_nr));
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+
+		if (t->skip_unmodified && diff_unmodified_pair(rename_src[j].p))
+			continue;
+		if (S_ISREG(one->mode) && !one->cnt_data)
+			t->prepare[t->nr_prepare++] = one;
+	}
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].p->two;
+
+		if (rename_dst[i].is_rename)
+			continue; /* exact or basename match already handled */
+		t->rows[t->nr_rows++] = i;
+		if (S_ISREG(two->mode) && !two->cnt_data)
+			t->prepare[t->nr_prepare++] = two;
+	}
+
+	pthread_mutex_init(&t->mutex, NULL);
+	run_inexact_rename_workers(t, nr_threads, inexact_rename_worker);
+	run_inexact_rename_workers(t, nr_threads, inexact_rename_matrix_worker);
+	pthread_mutex_destroy(&t->mutex);
+
+	free(t->prepare);
+	free(t->rows);
+	return t->nr_rows;
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -1384,7 +1606,7 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
 	int i, j, rename_count, skip_unmodified = 0;
-	int num_destinations, dst_cnt;
+	int num_destinations, dst_cnt, nr_threads;
 	int num_sources, want_copies;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
@@ -1573,45 +1795,61 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	nr_threads = git_env_ulong("GIT_TEST_RENAME_THREADS", 0);
+	if (!nr_threads &&
+	    (uint64_t)num_destinations * num_sources >= MIN_THREADED_RENAME_PAIRS)
+		nr_threads = online_cpus();
+	if (HAVE_THREADS && nr_threads > 1 && !dpf_options.missing_object_cb) {
+		struct inexact_rename_threads t = {
+			.repo = options->repo,
+			.minimum_score = minimum_score,
+			.skip_unmodified = skip_unmodified,
+			.mx = mx,
+			.progress = progress,
+		};
+
+		dst_cnt = fill_inexact_matrix_threaded(&t, nr_threads);
+	} else {
+		for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+			struct diff_filespec *two = rename_dst[i].p->two;
+			struct diff_score *m;
+
+			if (rename_dst[i].is_rename)
+				continue; /* exact or basename match already handled */
+
+			m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+			for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+				m[j].dst = -1;
+
+			for (j = 0; j < rename_src_nr; j++) {
+				struct diff_filespec *one = rename_src[j].p->one;
+				struct diff_score this_src;
+
+				assert(!one->rename_used || want_copies || break_idx);
+
+				if (skip_unmodified &&
+				    diff_unmodified_pair(rename_src[j].p))
+					continue;
+
+				this_src.score = estimate_similarity(options->repo,
+								     one, two,
+								     minimum_score,
+								     &dpf_options);
+				this_src.name_score = basename_same(one, two);
+				this_src.dst = i;
+				this_src.src = j;
+				record_if_better(m, &this_src);
+				/*
+				 * Once we run estimate_similarity,
+				 * We do not need the text anymore.
+				 */
+				diff_free_filespec_blob(one);
+				diff_free_filespec_blob(two);
+			}
+			dst_cnt++;
+			display_progress(progress,
+					 (uint64_t)dst_cnt * (uint64_t)num_sources);
 		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
 	}
 	stop_progress(&progress);
 
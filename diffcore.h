@@ -90,6 +90,12 @@ void diff_free_filespec_data(struct diff_filespec *);
 void diff_free_filespec_blob(struct diff_filespec *);
 int diff_filespec_is_binary(struct repository *, struct diff_filespec *);
 
+/*
+ * Returns 1 or 0 when the diff driver of the filespec says it is binary
+ * or text, and -1 when that is left to its contents.
+ */
+int diff_filespec_driver_binary(struct repository *, struct diff_filespec *);
+
 /**
  * This records a pair of `struct diff_filespec`; the filespec for a file in
  * the "old" set (i.e. preimage) is called `one`, and the filespec for a file
@@ -216,6 +222,30 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Compute the span hashes diffcore_count_changes() works on, for use as
+ * its "src_count_p" or "dst_count_p".  "one" must already be populated.
+ */
+void *diffcore_count_prepare(struct repository *r,
+			     struct diff_filespec *one);
+
+/*
+ * The span hashes of blobs are remembered by object name for the rest
+ * of the process, so that a blob seen again by a later rename or break
+ * detection need not be read and hashed again.
+ *
+ * diffcore_count_cached() returns a copy of the remembered span hashes
+ * for "one", suitable as its "cnt_data", or NULL.  "one" need not be
+ * populated.  diffcore_count_changes() remembers the span hashes it
+ * computes itself; those from diffcore_count_prepare() are remembered
+ * with diffcore_count_remember().  None of these is thread-safe.
+ */
+void *diffcore_count_cached(struct repository *r,
+			    struct diff_filespec *one);
+void diffcore_count_remember(struct repository *r,
+			     struct diff_filespec *one,
+			     void *count);
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
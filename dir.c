@@ -18,6 +18,7 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "thread-utils.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -47,6 +48,55 @@ struct cached_dir {
 	struct untracked_cache_dir *ucd;
 };
 
+/*
+ * When several threads search the worktree, the directories that are
+ * still to be scanned are kept on a stack shared by all of them. Each
+ * thread works on its own copy of the dir_struct, with its own stack
+ * of per-directory exclude patterns and its own result lists.
+ */
+struct scan_dir_item {
+	char *path;
+	int len;
+};
+
+struct parallel_scan {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct scan_dir_item *todo;
+	size_t todo_nr, todo_alloc;
+	int busy;
+
+	/* read_gitfile_gently() is not thread-safe */
+	pthread_mutex_t gitfile_mutex;
+
+	struct index_state *istate;
+	const struct pathspec *pathspec;
+};
+
+static void queue_scan_dir(struct parallel_scan *scan,
+			   const char *path, int len)
+{
+	pthread_mutex_lock(&scan->mutex);
+	ALLOC_GROW(scan->todo, scan->todo_nr + 1, scan->todo_alloc);
+	scan->todo[scan->todo_nr].path = xmemdupz(path, len);
+	scan->todo[scan->todo_nr].len = len;
+	scan->todo_nr++;
+	pthread_cond_signal(&scan->cond);
+	pthread_mutex_unlock(&scan->mutex);
+}
+
+static void lock_gitfile_check(struct dir_struct *dir)
+{
+	if (dir->scan)
+		pthread_mutex_lock(&dir->scan->gitfile_mutex);
+}
+
+static void unlock_gitfile_check(struct dir_struct *dir)
+{
+	if (dir->scan)
+		pthread_mutex_unlock(&dir->scan->gitfile_mutex);
+}
+
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 	struct index_state *istate, const char *path, int len,
 	struct untracked_cache_dir *untracked,
@@ -444,13 +494,74 @@ static int match_pathspec_item(struct index_state *istate,
  * pathspec did not match any names, which could indicate that the
  * user mistyped the nth pathspec.
  */
+static int match_pathspec_nth(struct index_state *istate,
+			      const struct pathspec *ps, int i,
+			      const char *name, int namelen,
+			      int prefix, char *seen, unsigned flags)
+{
+	int how, exclude = flags & DO_MATCH_EXCLUDE;
+
+	if ((!exclude &&   ps->items[i].magic & PATHSPEC_EXCLUDE) ||
+	    ( exclude && !(ps->items[i].magic & PATHSPEC_EXCLUDE)))
+		return 0;
+
+	if (seen && seen[i] == MATCHED_EXACTLY)
+		return 0;
+	/*
+	 * Make exclude patterns optional and never report
+	 * "pathspec ':(exclude)foo' matches no files"
+	 */
+	if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
+		seen[i] = MATCHED_FNMATCH;
+	how = match_pathspec_item(istate, ps->items+i, prefix, name,
+				  namelen, flags);
+	if (ps->recursive &&
+	    (ps->magic & PATHSPEC_MAXDEPTH) &&
+	    ps->max_depth != -1 &&
+	    how && how != MATCHED_FNMATCH) {
+		int len = ps->items[i].len;
+		if (name[len] == '/')
+			len++;
+		if (within_depth(name+len, namelen-len, 0, ps->max_depth))
+			how = MATCHED_EXACTLY;
+		else
+			how = 0;
+	}
+	if (how && seen && seen[i] < how)
+		seen[i] = how;
+	return how;
+}
+
+struct match_pathspec_data {
+	struct index_state *istate;
+	const struct pathspec *ps;
+	const char *name;
+	int namelen, prefix;
+	char *seen;
+	unsigned flags;
+	int retval;
+};
+
+static void match_candidate_pathspec(int i, void *data)
+{
+	struct match_pathspec_data *d = data;
+	int how = match_pathspec_nth(d->istate, d->ps, i, d->name, d->namelen,
+				     d->prefix, d->seen, d->flags);
+
+	if (d->retval < how)
+		d->retval = how;
+}
+
 static int do_match_pathspec(struct index_state *istate,
 			     const struct pathspec *ps,
 			     const char *name, int namelen,
 			     int prefix, char *seen,
 			     unsigned flags)
 {
-	int i, retval = 0, exclude = flags & DO_MATCH_EXCLUDE;
+	struct match_pathspec_data data = {
+		istate, ps, name + prefix, namelen - prefix, prefix, seen, flags
+	};
+	int i, retval = 0;
 
 	GUARD_PATHSPEC(ps,
 		       PATHSPEC_FROMTOP |
@@ -473,44 +584,24 @@ static int do_match_pathspec(struct index_state *istate,
 			return 0;
 	}
 
+	/*
+	 * With many pathspecs, only try those that can match; those
+	 * without wildcards must be a leading part of the name.
+	 */
+	if (!for_each_candidate_pathspec_item(ps, name, namelen, prefix,
+					      (flags & DO_MATCH_LEADING_PATHSPEC) &&
+					      !(flags & DO_MATCH_EXCLUDE),
+					      match_candidate_pathspec, &data))
+		return data.retval;
+
 	name += prefix;
 	namelen -= prefix;
 
 	for (i = ps->nr - 1; i >= 0; i--) {
-		int how;
-
-		if ((!exclude &&   ps->items[i].magic & PATHSPEC_EXCLUDE) ||
-		    ( exclude && !(ps->items[i].magic & PATHSPEC_EXCLUDE)))
-			continue;
-
-		if (seen && seen[i] == MATCHED_EXACTLY)
-			continue;
-		/*
-		 * Make exclude patterns optional and never report
-		 * "pathspec ':(exclude)foo' matches no files"
-		 */
-		if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
-			seen[i] = MATCHED_FNMATCH;
-		how = match_pathspec_item(istate, ps->items+i, prefix, name,
-					  namelen, flags);
-		if (ps->recursive &&
-		    (ps->magic & PATHSPEC_MAXDEPTH) &&
-		    ps->max_depth != -1 &&
-		    how && how != MATCHED_FNMATCH) {
-			int len = ps->items[i].len;
-			if (name[len] == '/')
-				len++;
-			if (within_depth(name+len, namelen-len, 0, ps->max_depth))
-				how = MATCHED_EXACTLY;
-			else
-				how = 0;
-		}
-		if (how) {
-			if (retval < how)
-				retval = how;
-			if (seen && seen[i] < how)
-				seen[i] = how;
-		}
+		int how = match_pathspec_nth(istate, ps, i, name, namelen,
+					     prefix, seen, flags);
+		if (retval < how)
+			retval = how;
 	}
 	return retval;
 }
@@ -872,6 +963,120 @@ int hashmap_contains_parent(struct hashmap *map,
 	return 0;
 }
 
+/* Below this many patterns in a list, we just try them all */
+#define MIN_INDEXED_PATTERNS 32
+
+struct literal_pattern {
+	struct hashmap_entry ent;
+	const char *key;
+	int len;
+	int nr;
+	char *to_free;
+};
+
+struct literal_pattern_key {
+	const char *name;
+	int len;
+};
+
+struct pattern_literals {
+	/* patterns without wildcards by the basename they match ... */
+	struct hashmap basenames;
+	/* ... or the path, for those with a slash */
+	struct hashmap paths;
+	/* the other patterns, in order */
+	int *others;
+	int others_nr, others_alloc;
+};
+
+static unsigned int fspathhash_mem(const char *buf, size_t len)
+{
+	return ignore_case ? memihash(buf, len) : memhash(buf, len);
+}
+
+static int literal_pattern_cmp(const void *unused_cmp_data,
+			       const struct hashmap_entry *eptr,
+			       const struct hashmap_entry *entry_or_key,
+			       const void *keydata)
+{
+	const struct literal_pattern *e1, *e2;
+	const struct literal_pattern_key *key = keydata;
+
+	e1 = container_of(eptr, const struct literal_pattern, ent);
+	if (!key) {
+		e2 = container_of(entry_or_key, const struct literal_pattern, ent);
+		return e1->len != e2->len || fspathncmp(e1->key, e2->key, e1->len);
+	}
+	return e1->len != key->len || fspathncmp(e1->key, key->name, key->len);
+}
+
+static void index_pattern(struct pattern_literals *literals,
+			  struct path_pattern *pattern, int nr)
+{
+	struct literal_pattern *e;
+	struct hashmap *map;
+
+	if (pattern->nowildcardlen < pattern->patternlen ||
+	    !pattern->patternlen) {
+		ALLOC_GROW(literals->others, literals->others_nr + 1,
+			   literals->others_alloc);
+		literals->others[literals->others_nr++] = nr;
+		return;
+	}
+
+	CALLOC_ARRAY(e, 1);
+	e->nr = nr;
+	if (pattern->flags & PATTERN_FLAG_NODIR) {
+		map = &literals->basenames;
+		e->key = pattern->pattern;
+		e->len = pattern->patternlen;
+	} else {
+		/* see match_pathname() */
+		const char *p = pattern->pattern;
+		int len = pattern->patternlen;
+
+		if (*p == '/') {
+			p++;
+			len--;
+		}
+		map = &literals->paths;
+		e->to_free = xstrfmt("%.*s%.*s", pattern->baselen,
+				     pattern->base, len, p);
+		e->key = e->to_free;
+		e->len = pattern->baselen + len;
+	}
+	hashmap_entry_init(&e->ent, fspathhash_mem(e->key, e->len));
+	hashmap_add(map, &e->ent);
+}
+
+static void index_patterns(struct pattern_list *pl)
+{
+	struct pattern_literals *literals;
+	int i;
+
+	CALLOC_ARRAY(literals, 1);
+	hashmap_init(&literals->basenames, literal_pattern_cmp, NULL, pl->nr);
+	hashmap_init(&literals->paths, literal_pattern_cmp, NULL, 0);
+	for (i = 0; i < pl->nr; i++)
+		index_pattern(literals, pl->patterns[i], i);
+	pl->literals = literals;
+}
+
+static void free_pattern_literals(struct pattern_literals *literals)
+{
+	struct hashmap_iter iter;
+	struct literal_pattern *e;
+
+	if (!literals)
+		return;
+	hashmap_for_each_entry(&literals->paths, &iter, e, ent)
+		free(e->to_free);
+	hashmap_clear_and_free(&literals->basenames, struct literal_pattern, ent);
+	hashmap_clear_and_free(&literals->paths, struct literal_pattern, ent);
+	free(literals->others);
+	free(literals);
+}
+
 void add_pattern(const char *string, const char *base,
 		 int baselen, struct pattern_list *pl, int srcpos)
 {
@@ -898,6 +1103,11 @@ void add_pattern(const char *string, const char *base,
 	pattern->pl = pl;
 
 	add_pattern_to_hashsets(pl, pattern);
+
+	if (pl->literals)
+		index_pattern(pl->literals, pattern, pl->nr - 1);
+	else if (pl->nr == MIN_INDEXED_PATTERNS)
+		index_patterns(pl);
 }
 
 static int read_skip_worktree_file_from_index(struct index_state *istate,
@@ -931,6 +1141,7 @@ void clear_pattern_list(struct pattern_list *pl)
 	free(pl->filebuf);
 	hashmap_clear_and_free(&pl->recursive_hashmap, struct pattern_entry, ent);
 	hashmap_clear_and_free(&pl->parent_hashmap, struct pattern_entry, ent);
+	free_pattern_literals(pl->literals);
 
 	memset(pl, 0, sizeof(*pl));
 }
@@ -1309,6 +1520,59 @@ int match_pathname(const char *pathname, int pathlen,
  * any, determines the fate.  Returns the exclude_list element which
  * matched, or NULL for undecided.
  */
+static int path_pattern_matches(struct path_pattern *pattern,
+				const char *pathname, int pathlen,
+				const char *basename, int *dtype,
+				struct index_state *istate)
+{
+	const char *exclude = pattern->pattern;
+	int prefix = pattern->nowildcardlen;
+
+	if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
+		*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (pattern->flags & PATTERN_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      exclude, prefix, pattern->patternlen,
+				      pattern->flags);
+
+	assert(pattern->baselen == 0 ||
+	       pattern->base[pattern->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      pattern->base,
+			      pattern->baselen ? pattern->baselen - 1 : 0,
+			      exclude, prefix, pattern->patternlen,
+			      pattern->flags);
+}
+
+/*
+ * Returns the index of the last of the patterns without wildcards
+ * looked up as "name" in "map" that matches, if it is after "best".
+ */
+static int last_matching_literal(struct hashmap *map,
+				 const char *name, int len, int best,
+				 struct pattern_list *pl,
+				 const char *pathname, int pathlen,
+				 const char *basename, int *dtype,
+				 struct index_state *istate)
+{
+	struct literal_pattern_key key = { name, len };
+	struct literal_pattern *e;
+
+	e = hashmap_get_entry_from_hash(map, fspathhash_mem(name, len), &key,
+					struct literal_pattern, ent);
+	for (; e; e = hashmap_get_next_entry(map, e, ent))
+		if (e->nr > best &&
+		    path_pattern_matches(pl->patterns[e->nr], pathname, pathlen,
+					 basename, dtype, istate))
+			best = e->nr;
+	return best;
+}
+
 static struct path_pattern *last_matching_pattern_from_list(const char *pathname,
 						       int pathlen,
 						       const char *basename,
@@ -1316,46 +1580,39 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct pattern_list *pl,
 						       struct index_state *istate)
 {
-	struct path_pattern *res = NULL; /* undecided */
-	int i;
+	struct pattern_literals *literals = pl->literals;
+	int i, best;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
-	for (i = pl->nr - 1; 0 <= i; i--) {
-		struct path_pattern *pattern = pl->patterns[i];
-		const char *exclude = pattern->pattern;
-		int prefix = pattern->nowildcardlen;
-
-		if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
-			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
-
-		if (pattern->flags & PATTERN_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, pattern->patternlen,
-					   pattern->flags)) {
-				res = pattern;
-				break;
-			}
-			continue;
-		}
-
-		assert(pattern->baselen == 0 ||
-		       pattern->base[pattern->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   pattern->base,
-				   pattern->baselen ? pattern->baselen - 1 : 0,
-				   exclude, prefix, pattern->patternlen,
-				   pattern->flags)) {
-			res = pattern;
-			break;
-		}
+	if (!literals) {
+		for (i = pl->nr - 1; 0 <= i; i--)
+			if (path_pattern_matches(pl->patterns[i], pathname,
+						 pathlen, basename, dtype,
+						 istate))
+				return pl->patterns[i];
+		return NULL;
 	}
-	return res;
+
+	/*
+	 * The last pattern that matches decides.  Look up those without
+	 * wildcards, then try the others that come after the best of them.
+	 */
+	best = last_matching_literal(&literals->basenames, basename,
+				     pathlen - (basename - pathname), -1,
+				     pl, pathname, pathlen, basename, dtype,
+				     istate);
+	best = last_matching_literal(&literals->paths, pathname, pathlen, best,
+				     pl, pathname, pathlen, basename, dtype,
+				     istate);
+	for (i = literals->others_nr - 1;
+	     0 <= i && literals->others[i] > best; i--)
+		if (path_pattern_matches(pl->patterns[literals->others[i]],
+					 pathname, pathlen, basename, dtype,
+					 istate))
+			return pl->patterns[literals->others[i]];
+	return best < 0 ? NULL : pl->patterns[best];
 }
 
 /*
@@ -1827,7 +2084,9 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 		!(dir->flags & DIR_NO_GITLINKS)) {
 		struct strbuf sb = STRBUF_INIT;
 		strbuf_addstr(&sb, dirname);
+		lock_gitfile_check(dir);
 		nested_repo = is_nonbare_repository_dir(&sb);
+		unlock_gitfile_check(dir);
 		strbuf_release(&sb);
 	}
 	if (nested_repo) {
@@ -1957,8 +2216,10 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 	/* Actually recurse into dirname now, we'll fixup the state later. */
 	untracked = lookup_untracked(dir->untracked, untracked,
 				     dirname + baselen, len - baselen);
+	dir->scan_nested++;
 	state = read_directory_recursive(dir, istate, dirname, len, untracked,
 					 check_only, stop_early, pathspec);
+	dir->scan_nested--;
 
 	/* There are a variety of reasons we may need to fixup the state... */
 	if (state == path_excluded) {
@@ -2493,16 +2754,24 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 		/* recurse into subdir if instructed by treat_path */
 		if (state == path_recurse) {
-			struct untracked_cache_dir *ud;
-			ud = lookup_untracked(dir->untracked, untracked,
-					      path.buf + baselen,
-					      path.len - baselen);
-			subdir_state =
-				read_directory_recursive(dir, istate, path.buf,
-							 path.len, ud,
-							 check_only, stop_at_first_file, pathspec);
-			if (subdir_state > dir_state)
-				dir_state = subdir_state;
+			if (dir->scan && !check_only && !dir->scan_nested) {
+				/*
+				 * Nobody looks at the state of this subdir,
+				 * so whichever thread is idle can scan it.
+				 */
+				queue_scan_dir(dir->scan, path.buf, path.len);
+			} else {
+				struct untracked_cache_dir *ud;
+				ud = lookup_untracked(dir->untracked, untracked,
+						      path.buf + baselen,
+						      path.len - baselen);
+				subdir_state =
+					read_directory_recursive(dir, istate, path.buf,
+								 path.len, ud,
+								 check_only, stop_at_first_file, pathspec);
+				if (subdir_state > dir_state)
+					dir_state = subdir_state;
+			}
 
 			if (pathspec &&
 			    !match_pathspec(istate, pathspec, path.buf, path.len,
@@ -2835,9 +3104,181 @@ static void emit_traversal_statistics(struct dir_struct *dir,
 			   "opendir", dir->untracked->dir_opened);
 }
 
+#define SCAN_THREAD_COST 500
+#define SCAN_MAX_THREADS 20
+
+static int scan_threads(struct dir_struct *dir, struct index_state *istate,
+			const struct pathspec *pathspec)
+{
+	int nr;
+
+	if (!HAVE_THREADS || dir->untracked || istate->sparse_index ||
+	    (pathspec && (pathspec->magic & PATHSPEC_ATTR)))
+		return 1;
+
+	if (git_config_get_int("core.untrackedthreads", &nr) || nr < 1) {
+		/*
+		 * The size of the index is the best guess we have at how
+		 * wide the worktree is.
+		 */
+		nr = istate->cache_nr / SCAN_THREAD_COST;
+		if (nr > online_cpus())
+			nr = online_cpus();
+	}
+	return nr > SCAN_MAX_THREADS ? SCAN_MAX_THREADS : nr;
+}
+
+struct scan_worker {
+	pthread_t thread;
+	struct dir_struct dir;
+	struct parallel_scan *scan;
+};
+
+static void *scan_worker_thread(void *data)
+{
+	struct scan_worker *w = data;
+	struct parallel_scan *scan = w->scan;
+
+	trace2_thread_start("read_directory");
+
+	pthread_mutex_lock(&scan->mutex);
+	for (;;) {
+		struct scan_dir_item item;
+
+		while (!scan->todo_nr && scan->busy)
+			pthread_cond_wait(&scan->cond, &scan->mutex);
+		if (!scan->todo_nr)
+			break;
+		item = scan->todo[--scan->todo_nr];
+		scan->busy++;
+		pthread_mutex_unlock(&scan->mutex);
+
+		read_directory_recursive(&w->dir, scan->istate, item.path,
+					 item.len, NULL, 0, 0, scan->pathspec);
+		free(item.path);
+
+		pthread_mutex_lock(&scan->mutex);
+		if (!--scan->busy && !scan->todo_nr)
+			pthread_cond_broadcast(&scan->cond);
+	}
+	pthread_mutex_unlock(&scan->mutex);
+
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void init_scan_worker(struct scan_worker *w, struct dir_struct *dir,
+			     struct parallel_scan *scan)
+{
+	struct dir_struct *copy = &w->dir;
+
+	/* share the command-line and global exclude patterns */
+	memcpy(copy, dir, sizeof(*copy));
+	copy->nr = copy->alloc = 0;
+	copy->entries = NULL;
+	copy->ignored_nr = copy->ignored_alloc = 0;
+	copy->ignored = NULL;
+	memset(&copy->exclude_list_group[EXC_DIRS], 0,
+	       sizeof(copy->exclude_list_group[EXC_DIRS]));
+	copy->exclude_stack = NULL;
+	copy->pattern = NULL;
+	strbuf_init(&copy->basebuf, PATH_MAX);
+	copy->visited_paths = copy->visited_directories = 0;
+	copy->scan = scan;
+	copy->scan_nested = 0;
+	w->scan = scan;
+}
+
+static void finish_scan_worker(struct scan_worker *w, struct dir_struct *dir)
+{
+	struct dir_struct *copy = &w->dir;
+	struct exclude_list_group *group = &copy->exclude_list_group[EXC_DIRS];
+	struct exclude_stack *stk;
+	int i;
+
+	for (i = 0; i < group->nr; i++) {
+		free((char *)group->pl[i].src);
+		clear_pattern_list(&group->pl[i]);
+	}
+	free(group->pl);
+	while ((stk = copy->exclude_stack)) {
+		copy->exclude_stack = stk->prev;
+		free(stk);
+	}
+	strbuf_release(&copy->basebuf);
+
+	ALLOC_GROW(dir->entries, dir->nr + copy->nr, dir->alloc);
+	COPY_ARRAY(dir->entries + dir->nr, copy->entries, copy->nr);
+	dir->nr += copy->nr;
+	free(copy->entries);
+
+	ALLOC_GROW(dir->ignored, dir->ignored_nr + copy->ignored_nr,
+		   dir->ignored_alloc);
+	COPY_ARRAY(dir->ignored + dir->ignored_nr, copy->ignored,
+		   copy->ignored_nr);
+	dir->ignored_nr += copy->ignored_nr;
+	free(copy->ignored);
+
+	dir->visited_paths += copy->visited_paths;
+	dir->visited_directories += copy->visited_directories;
+}
+
+/*
+ * Like read_directory_recursive() at the top level, but with "nr"
+ * threads. The results come out in a different order, which does not
+ * matter as the caller sorts them.
+ */
+static void read_directory_parallel(struct dir_struct *dir,
+				    struct index_state *istate,
+				    const char *path, int len,
+				    const struct pathspec *pathspec, int nr)
+{
+	struct parallel_scan scan = { 0 };
+	struct scan_worker *workers;
+	int i, err;
+
+	pthread_mutex_init(&scan.mutex, NULL);
+	pthread_cond_init(&scan.cond, NULL);
+	pthread_mutex_init(&scan.gitfile_mutex, NULL);
+	scan.istate = istate;
+	scan.pathspec = pathspec;
+	queue_scan_dir(&scan, path, len);
+
+	/*
+	 * The name hash is initialized lazily on first use; do it now
+	 * rather than have all threads race for it. And per-directory
+	 * exclude files may need to be read from the object store.
+	 */
+	index_file_exists(istate, "", 0, 0);
+	enable_obj_read_lock();
+
+	trace2_data_intmax("read_directory", istate->repo, "threads", nr);
+	CALLOC_ARRAY(workers, nr);
+	for (i = 0; i < nr; i++) {
+		init_scan_worker(&workers[i], dir, &scan);
+		err = pthread_create(&workers[i].thread, NULL,
+				     scan_worker_thread, &workers[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr; i++) {
+		pthread_join(workers[i].thread, NULL);
+		finish_scan_worker(&workers[i], dir);
+	}
+
+	disable_obj_read_lock();
+	free(workers);
+	free(scan.todo);
+	pthread_mutex_destroy(&scan.gitfile_mutex);
+	pthread_cond_destroy(&scan.cond);
+	pthread_mutex_destroy(&scan.mutex);
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
+	int nr_threads;
+
 	struct untracked_cache_dir *untracked;
 
 	trace2_region_enter("dir", "read_directory", istate->repo);
@@ -2856,8 +3297,17 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
-		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+	enable_fscache();
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		nr_threads = scan_threads(dir, istate, pathspec);
+		if (nr_threads > 1)
+			read_directory_parallel(dir, istate, path, len,
+						pathspec, nr_threads);
+		else
+			read_directory_recursive(dir, istate, path, len,
+						 untracked, 0, 0, pathspec);
+	}
+	disable_fscache();
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
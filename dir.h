@@ -115,6 +115,12 @@ struct pattern_list {
 	 * Used to check single-level parents of blobs.
 	 */
 	struct hashmap parent_hashmap;
+
+	/*
+	 * With many patterns, those without wildcards are looked up by
+	 * the basename or path they match instead; see dir.c.
+	 */
+	struct pattern_literals *literals;
 };
 
 /*
@@ -340,6 +346,16 @@ struct dir_struct {
 	/* Stats about the traversal */
 	unsigned visited_paths;
 	unsigned visited_directories;
+
+	/*
+	 * Set in the per-thread copies made when read_directory() lets
+	 * several threads search the worktree (see "core.untrackedThreads").
+	 * "scan_nested" counts the traversals whose results the caller
+	 * still needs to look at, which must not be handed off to other
+	 * threads.
+	 */
+	struct parallel_scan *scan;
+	unsigned scan_nested;
 };
 
 #define DIR_INIT { 0 }
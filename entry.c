@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "blob.h"
 #include "object-store.h"
 #include "dir.h"
@@ -8,12 +9,26 @@
 #include "fsmonitor.h"
 #include "entry.h"
 #include "parallel-checkout.h"
+#include "thread-utils.h"
+
+#ifdef GIT_WINDOWS_NATIVE
+/* closing a new file is what costs most there, see enable_async_close() */
+#define DEFAULT_CLOSE_THREADS 4
+#else
+#define DEFAULT_CLOSE_THREADS 0
+#endif
+
+/*
+ * How many files each close thread may have waiting for it.  They are all
+ * open, and there may not be many file descriptors to spare.
+ */
+#define CLOSE_QUEUE_PER_THREAD 4
 
 static void create_directories(const char *path, int path_len,
 			       const struct checkout *state)
 {
 	char *buf = xmallocz(path_len);
-	int len = 0;
+	int len = 0, created = 0;
 
 	while (len < path_len) {
 		do {
@@ -31,7 +46,12 @@ static void create_directories(const char *path, int path_len,
 		 * we test the path components of the prefix with the
 		 * stat() function instead of the lstat() function.
 		 */
-		if (has_dirs_only_path(buf, len, state->base_dir_len))
+		/*
+		 * Nothing can be in a directory we have just created, so
+		 * the rest of the leading directories do not need to be
+		 * looked at before they are made.
+		 */
+		if (!created && has_dirs_only_path(buf, len, state->base_dir_len))
 			continue; /* ok, it is already a directory. */
 
 		/*
@@ -46,6 +66,7 @@ static void create_directories(const char *path, int path_len,
 				continue;
 			die_errno("cannot create directory at '%s'", buf);
 		}
+		created = 1;
 	}
 	free(buf);
 }
@@ -117,27 +138,6 @@ int fstat_checkout_output(int fd, const struct checkout *state, struct stat *st)
 	return 0;
 }
 
-static int streaming_write_entry(const struct cache_entry *ce, char *path,
-				 struct stream_filter *filter,
-				 const struct checkout *state, int to_tempfile,
-				 int *fstat_done, struct stat *statbuf)
-{
-	int result = 0;
-	int fd;
-
-	fd = open_output_fd(path, ce, to_tempfile);
-	if (fd < 0)
-		return -1;
-
-	result |= stream_blob_to_fd(fd, &ce->oid, filter, 1);
-	*fstat_done = fstat_checkout_output(fd, state, statbuf);
-	result |= close(fd);
-
-	if (result)
-		unlink(path);
-	return result;
-}
-
 void enable_delayed_checkout(struct checkout *state)
 {
 	if (!state->delayed_checkout) {
@@ -261,13 +261,275 @@ void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
 	}
 }
 
+/*
+ * On some filesystems, most notably NTFS with a virus scanner watching,
+ * close() is by far the most expensive part of writing a new file.  When
+ * async_close is enabled, write_entry() hands its files over to a few
+ * threads that close them and then stat them, and finish_async_close()
+ * updates the entries from these stats on the main thread.
+ */
+struct pending_close {
+	struct hashmap_entry ent;
+	int fd;
+	int err;
+	int done;
+	struct cache_entry *ce;
+	struct stat st;
+	char path[FLEX_ARRAY];
+};
+
+struct async_close {
+	int nr_threads, nr_running;
+	int stat_files;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int stopping;
+	struct pending_close **queue;
+	size_t nr, alloc, next;
+	/* how many of the queued files are not closed yet */
+	int nr_open;
+	/* the errors of the files already taken off the queue */
+	int errs;
+	/* the paths of the queued files, to flush them before reuse */
+	struct hashmap paths;
+};
+
+static int pending_close_cmp(const void *cmp_data,
+			     const struct hashmap_entry *eptr,
+			     const struct hashmap_entry *entry_or_key,
+			     const void *keydata)
+{
+	const struct pending_close *a, *b;
+
+	a = container_of(eptr, const struct pending_close, ent);
+	b = container_of(entry_or_key, const struct pending_close, ent);
+	return !fspatheq(a->path, keydata ? keydata : b->path);
+}
+
+void enable_async_close(struct checkout *state)
+{
+	struct async_close *ac;
+	int nr_threads;
+
+	if (!HAVE_THREADS || state->async_close)
+		return;
+	if (git_config_get_int("checkout.closethreads", &nr_threads))
+		nr_threads = DEFAULT_CLOSE_THREADS;
+	if (nr_threads <= 0)
+		return;
+
+	CALLOC_ARRAY(ac, 1);
+	ac->nr_threads = nr_threads;
+	/* the same condition as fstat_checkout_output() */
+	ac->stat_files = state->refresh_cache && !state->base_dir_len;
+	hashmap_init(&ac->paths, pending_close_cmp, NULL, 0);
+	state->async_close = ac;
+}
+
+#ifndef NO_PTHREADS
+static void *close_files(void *data)
+{
+	struct async_close *ac = data;
+
+	for (;;) {
+		struct pending_close *pc;
+
+		pthread_mutex_lock(&ac->mutex);
+		while (ac->next == ac->nr && !ac->stopping)
+			pthread_cond_wait(&ac->cond, &ac->mutex);
+		if (ac->next == ac->nr) {
+			pthread_mutex_unlock(&ac->mutex);
+			break;
+		}
+		pc = ac->queue[ac->next++];
+		pthread_mutex_unlock(&ac->mutex);
+
+		if (close(pc->fd) ||
+		    (ac->stat_files && lstat(pc->path, &pc->st)))
+			pc->err = errno;
+
+		pthread_mutex_lock(&ac->mutex);
+		pc->done = 1;
+		ac->nr_open--;
+		/* queue_close() may be waiting for room */
+		pthread_cond_broadcast(&ac->cond);
+		pthread_mutex_unlock(&ac->mutex);
+	}
+	return NULL;
+}
+
+static int finish_close(const struct checkout *state, struct pending_close *pc)
+{
+	if (pc->err) {
+		errno = pc->err;
+		return error_errno("unable to close file %s", pc->path);
+	}
+	if (state->async_close->stat_files)
+		update_ce_after_write(state, pc->ce, &pc->st);
+	return 0;
+}
+
+static void queue_close(const struct checkout *state, int fd,
+			struct cache_entry *ce, const char *path)
+{
+	struct async_close *ac = state->async_close;
+	struct pending_close *pc;
+	size_t done;
+
+	FLEX_ALLOC_STR(pc, path, path);
+	pc->fd = fd;
+	pc->ce = ce;
+	hashmap_entry_init(&pc->ent, fspathhash(pc->path));
+	hashmap_add(&ac->paths, &pc->ent);
+
+	if (!ac->nr_running) {
+		int i;
+
+		pthread_mutex_init(&ac->mutex, NULL);
+		pthread_cond_init(&ac->cond, NULL);
+		ac->stopping = 0;
+		ALLOC_ARRAY(ac->threads, ac->nr_threads);
+		for (i = 0; i < ac->nr_threads; i++) {
+			int err = pthread_create(&ac->threads[i], NULL,
+						 close_files, ac);
+			if (err)
+				die(_("unable to create thread: %s"),
+				    strerror(err));
+		}
+		ac->nr_running = ac->nr_threads;
+	}
+
+	pthread_mutex_lock(&ac->mutex);
+	while (ac->nr_open >= ac->nr_threads * CLOSE_QUEUE_PER_THREAD)
+		pthread_cond_wait(&ac->cond, &ac->mutex);
+
+	/* take the files closed so far off the queue */
+	for (done = 0; done < ac->next && ac->queue[done]->done; done++) {
+		struct pending_close *closed = ac->queue[done];
+
+		ac->errs |= finish_close(state, closed);
+		hashmap_remove(&ac->paths, &closed->ent, closed->path);
+		free(closed);
+	}
+	if (done) {
+		MOVE_ARRAY(ac->queue, ac->queue + done, ac->nr - done);
+		ac->nr -= done;
+		ac->next -= done;
+	}
+
+	ALLOC_GROW(ac->queue, ac->nr + 1, ac->alloc);
+	ac->queue[ac->nr++] = pc;
+	ac->nr_open++;
+	pthread_cond_signal(&ac->cond);
+	pthread_mutex_unlock(&ac->mutex);
+}
+
+static int flush_async_close(const struct checkout *state)
+{
+	struct async_close *ac = state->async_close;
+	int errs = ac->errs;
+	size_t i;
+
+	ac->errs = 0;
+	if (!ac->nr_running)
+		return errs;
+
+	pthread_mutex_lock(&ac->mutex);
+	ac->stopping = 1;
+	pthread_cond_broadcast(&ac->cond);
+	pthread_mutex_unlock(&ac->mutex);
+	for (i = 0; i < ac->nr_running; i++)
+		pthread_join(ac->threads[i], NULL);
+	FREE_AND_NULL(ac->threads);
+	ac->nr_running = 0;
+	pthread_cond_destroy(&ac->cond);
+	pthread_mutex_destroy(&ac->mutex);
+
+	for (i = 0; i < ac->nr; i++)
+		errs |= finish_close(state, ac->queue[i]);
+	hashmap_clear_and_free(&ac->paths, struct pending_close, ent);
+	hashmap_init(&ac->paths, pending_close_cmp, NULL, 0);
+	ac->nr = ac->next = 0;
+	return errs;
+}
+
+static int flush_async_close_of(const struct checkout *state, const char *path)
+{
+	struct hashmap_entry key;
+
+	if (!state->async_close)
+		return 0;
+	hashmap_entry_init(&key, fspathhash(path));
+	if (!hashmap_get(&state->async_close->paths, &key, path))
+		return 0;
+	return flush_async_close(state);
+}
+#else
+static void queue_close(const struct checkout *state, int fd,
+			struct cache_entry *ce, const char *path)
+{
+	BUG("async close without threads");
+}
+
+static int flush_async_close(const struct checkout *state)
+{
+	return 0;
+}
+
+static int flush_async_close_of(const struct checkout *state, const char *path)
+{
+	return 0;
+}
+#endif
+
+int finish_async_close(struct checkout *state)
+{
+	int errs;
+
+	if (!state->async_close)
+		return 0;
+	errs = flush_async_close(state);
+	hashmap_clear(&state->async_close->paths);
+	free(state->async_close->queue);
+	FREE_AND_NULL(state->async_close);
+	return errs;
+}
+
+static int streaming_write_entry(struct cache_entry *ce, char *path,
+				 struct stream_filter *filter,
+				 const struct checkout *state, int to_tempfile,
+				 int *fstat_done, struct stat *statbuf,
+				 int *queued)
+{
+	int result = 0;
+	int fd;
+
+	fd = open_output_fd(path, ce, to_tempfile);
+	if (fd < 0)
+		return -1;
+
+	result |= stream_blob_to_fd(fd, &ce->oid, filter, 1);
+	if (!result && !to_tempfile && state->async_close) {
+		queue_close(state, fd, ce, path);
+		*queued = 1;
+		return 0;
+	}
+	*fstat_done = fstat_checkout_output(fd, state, statbuf);
+	result |= close(fd);
+
+	if (result)
+		unlink(path);
+	return result;
+}
+
 /* Note: ca is used (and required) iff the entry refers to a regular file. */
 static int write_entry(struct cache_entry *ce, char *path, struct conv_attrs *ca,
 		       const struct checkout *state, int to_tempfile)
 {
 	unsigned int ce_mode_s_ifmt = ce->ce_mode & S_IFMT;
 	struct delayed_checkout *dco = state->delayed_checkout;
-	int fd, ret, fstat_done = 0;
+	int fd, ret, fstat_done = 0, queued = 0;
 	char *new_blob;
 	struct strbuf buf = STRBUF_INIT;
 	unsigned long size;
@@ -284,7 +546,7 @@ static int write_entry(struct cache_entry *ce, char *path, struct conv_attrs *ca
 		if (filter &&
 		    !streaming_write_entry(ce, path, filter,
 					   state, to_tempfile,
-					   &fstat_done, &st))
+					   &fstat_done, &st, &queued))
 			goto finish;
 	}
 
@@ -358,10 +620,15 @@ static int write_entry(struct cache_entry *ce, char *path, struct conv_attrs *ca
 		}
 
 		wrote = write_in_full(fd, new_blob, size);
+		free(new_blob);
+		if (wrote >= 0 && !to_tempfile && state->async_close) {
+			queue_close(state, fd, ce, path);
+			queued = 1;
+			break;
+		}
 		if (!to_tempfile)
 			fstat_done = fstat_checkout_output(fd, state, &st);
 		close(fd);
-		free(new_blob);
 		if (wrote < 0)
 			return error("unable to write file %s", path);
 		break;
@@ -383,7 +650,8 @@ static int write_entry(struct cache_entry *ce, char *path, struct conv_attrs *ca
 	}
 
 finish:
-	if (state->refresh_cache) {
+	/* a queued entry is updated by finish_async_close() */
+	if (state->refresh_cache && !queued) {
 		if (!fstat_done && lstat(ce->name, &st) < 0)
 			return error_errno("unable to stat just-written file %s",
 					   ce->name);
@@ -480,6 +748,13 @@ int checkout_entry_ca(struct cache_entry *ce, struct conv_attrs *ca,
 	strbuf_add(&path, state->base_dir, state->base_dir_len);
 	strbuf_add(&path, ce->name, ce_namelen(ce));
 
+	/*
+	 * A file we wrote ourselves (or one it collides with) must be
+	 * closed, and its entry updated, before it is compared or replaced.
+	 */
+	if (flush_async_close_of(state, path.buf))
+		return -1;
+
 	if (!check_path(path.buf, path.len, &st, state->base_dir_len)) {
 		const struct submodule *sub;
 		unsigned changed = ie_match_stat(state->istate, ce, &st,
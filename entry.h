@@ -4,11 +4,14 @@
 #include "cache.h"
 #include "convert.h"
 
+struct async_close;
+
 struct checkout {
 	struct index_state *istate;
 	const char *base_dir;
 	int base_dir_len;
 	struct delayed_checkout *delayed_checkout;
+	struct async_close *async_close;
 	struct checkout_metadata meta;
 	unsigned force:1,
 		 quiet:1,
@@ -45,6 +48,15 @@ static inline int checkout_entry(struct cache_entry *ce,
 void enable_delayed_checkout(struct checkout *state);
 int finish_delayed_checkout(struct checkout *state, int *nr_checkouts);
 
+/*
+ * Let the files written by checkout_entry() be closed by background
+ * threads, as configured by checkout.closeThreads. The entries that
+ * were written get their stat data only in finish_async_close(), which
+ * must be called before the index is used again.
+ */
+void enable_async_close(struct checkout *state);
+int finish_async_close(struct checkout *state);
+
 /*
  * Unlink the last component and schedule the leading directories for
  * removal, such that empty directories get removed.
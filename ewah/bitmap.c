@@ -18,6 +18,7 @@
  */
 #include "cache.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
@@ -100,21 +101,67 @@ struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
 	return ewah;
 }
 
-struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+/*
+ * The number of literal words following the marker word at "pointer",
+ * not counting those cut off by the end of the buffer.
+ */
+static size_t ewah_literal_words(struct ewah_bitmap *ewah, size_t pointer)
+{
+	size_t literals = rlw_get_literal_words(&ewah->buffer[pointer]);
+
+	if (literals > ewah->buffer_size - pointer - 1)
+		literals = ewah->buffer_size - pointer - 1;
+	return literals;
+}
+
+/* The number of words of "ewah" once uncompressed */
+static size_t ewah_word_count(struct ewah_bitmap *ewah)
 {
-	struct bitmap *bitmap = bitmap_new();
-	struct ewah_iterator it;
-	eword_t blowup;
-	size_t i = 0;
+	size_t pointer = 0, words = 0;
 
-	ewah_iterator_init(&it, ewah);
+	while (pointer < ewah->buffer_size) {
+		size_t literals = ewah_literal_words(ewah, pointer);
 
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
+		words += rlw_get_running_len(&ewah->buffer[pointer]) + literals;
+		pointer += 1 + literals;
 	}
+	return words;
+}
 
-	bitmap->word_alloc = i;
+/*
+ * OR "ewah" into "words", which must have room for all of it.  This
+ * goes a whole run at a time rather than a word at a time as
+ * ewah_iterator_next() does: runs of zeroes are skipped, runs of ones
+ * are filled in, and literal words are OR'ed in a tight loop that the
+ * compiler can vectorize.
+ */
+static void ewah_or_words(eword_t *words, struct ewah_bitmap *ewah)
+{
+	size_t pointer = 0, i = 0;
+
+	while (pointer < ewah->buffer_size) {
+		const eword_t *rlw = &ewah->buffer[pointer];
+		size_t running = rlw_get_running_len(rlw);
+		size_t literals = ewah_literal_words(ewah, pointer);
+		size_t k;
+
+		if (rlw_get_run_bit(rlw))
+			memset(words + i, 0xff, running * sizeof(eword_t));
+		i += running;
+
+		for (k = 0; k < literals; k++)
+			words[i + k] |= rlw[1 + k];
+		i += literals;
+
+		pointer += 1 + literals;
+	}
+}
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(ewah_word_count(ewah));
+
+	ewah_or_words(bitmap->words, ewah);
 	return bitmap;
 }
 
@@ -141,10 +188,7 @@ void bitmap_or(struct bitmap *self, const struct bitmap *other)
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
-	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	size_t other_final = ewah_word_count(other);
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -153,10 +197,7 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 			(self->word_alloc - original_size) * sizeof(eword_t));
 	}
 
-	ewah_iterator_init(&it, other);
-
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	ewah_or_words(self->words, other);
 }
 
 size_t bitmap_popcount(struct bitmap *self)
@@ -216,6 +257,19 @@ int bitmap_is_subset(struct bitmap *self, struct bitmap *other)
 	return 0;
 }
 
+int bitmap_intersects(struct bitmap *self, struct bitmap *other)
+{
+	size_t common_size = self->word_alloc < other->word_alloc ?
+			     self->word_alloc : other->word_alloc;
+	size_t i;
+
+	for (i = 0; i < common_size; i++) {
+		if (self->words[i] & other->words[i])
+			return 1;
+	}
+	return 0;
+}
+
 void bitmap_reset(struct bitmap *bitmap)
 {
 	memset(bitmap->words, 0x0, bitmap->word_alloc * sizeof(eword_t));
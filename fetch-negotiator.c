@@ -1,6 +1,7 @@
 #include "git-compat-util.h"
 #include "fetch-negotiator.h"
 #include "negotiator/default.h"
+#include "negotiator/generation.h"
 #include "negotiator/skipping.h"
 #include "negotiator/noop.h"
 #include "repository.h"
@@ -14,6 +15,10 @@ void fetch_negotiator_init(struct repository *r,
 		skipping_negotiator_init(negotiator);
 		return;
 
+	case FETCH_NEGOTIATION_GENERATION:
+		generation_negotiator_init(negotiator);
+		return;
+
 	case FETCH_NEGOTIATION_NOOP:
 		noop_negotiator_init(negotiator);
 		return;
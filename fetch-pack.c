@@ -1563,6 +1563,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	struct string_list packfile_uris = STRING_LIST_INIT_DUP;
 	int i;
 	struct strvec index_pack_args = STRVEC_INIT;
+	struct child_process *http_fetch;
 
 	negotiator = &negotiator_alloc;
 	fetch_negotiator_init(r, negotiator);
@@ -1673,43 +1674,56 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 		}
 	}
 
+	/*
+	 * Download and index all the packs at once; they do not depend on
+	 * each other, and we only need them all before the connectivity
+	 * check.
+	 */
+	CALLOC_ARRAY(http_fetch, packfile_uris.nr);
 	for (i = 0; i < packfile_uris.nr; i++) {
 		int j;
-		struct child_process cmd = CHILD_PROCESS_INIT;
-		char packname[GIT_MAX_HEXSZ + 1];
+		struct child_process *cmd = &http_fetch[i];
 		const char *uri = packfile_uris.items[i].string +
 			the_hash_algo->hexsz + 1;
 
-		strvec_push(&cmd.args, "http-fetch");
-		strvec_pushf(&cmd.args, "--packfile=%.*s",
+		child_process_init(cmd);
+		strvec_push(&cmd->args, "http-fetch");
+		strvec_pushf(&cmd->args, "--packfile=%.*s",
 			     (int) the_hash_algo->hexsz,
 			     packfile_uris.items[i].string);
 		for (j = 0; j < index_pack_args.nr; j++)
-			strvec_pushf(&cmd.args, "--index-pack-arg=%s",
+			strvec_pushf(&cmd->args, "--index-pack-arg=%s",
 				     index_pack_args.v[j]);
-		strvec_push(&cmd.args, uri);
-		cmd.git_cmd = 1;
-		cmd.no_stdin = 1;
-		cmd.out = -1;
-		if (start_command(&cmd))
+		strvec_push(&cmd->args, uri);
+		cmd->git_cmd = 1;
+		cmd->no_stdin = 1;
+		cmd->out = -1;
+		if (start_command(cmd))
 			die("fetch-pack: unable to spawn http-fetch");
+	}
+
+	for (i = 0; i < packfile_uris.nr; i++) {
+		struct child_process *cmd = &http_fetch[i];
+		char packname[GIT_MAX_HEXSZ + 1];
+		const char *uri = packfile_uris.items[i].string +
+			the_hash_algo->hexsz + 1;
 
-		if (read_in_full(cmd.out, packname, 5) < 0 ||
+		if (read_in_full(cmd->out, packname, 5) < 0 ||
 		    memcmp(packname, "keep\t", 5))
 			die("fetch-pack: expected keep then TAB at start of http-fetch output");
 
-		if (read_in_full(cmd.out, packname,
+		if (read_in_full(cmd->out, packname,
 				 the_hash_algo->hexsz + 1) < 0 ||
 		    packname[the_hash_algo->hexsz] != '\n')
 			die("fetch-pack: expected hash then LF at end of http-fetch output");
 
 		packname[the_hash_algo->hexsz] = '\0';
 
-		parse_gitmodules_oids(cmd.out, &fsck_options.gitmodules_found);
+		parse_gitmodules_oids(cmd->out, &fsck_options.gitmodules_found);
 
-		close(cmd.out);
+		close(cmd->out);
 
-		if (finish_command(&cmd))
+		if (finish_command(cmd))
 			die("fetch-pack: unable to finish http-fetch");
 
 		if (memcmp(packfile_uris.items[i].string, packname,
@@ -1723,6 +1737,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 						 get_object_directory(),
 						 packname));
 	}
+	free(http_fetch);
 	string_list_clear(&packfile_uris, 0);
 	strvec_clear(&index_pack_args);
 
@@ -167,6 +167,16 @@ int fsck_walk(struct object *obj, void *data, struct fsck_options *options);
 int fsck_object(struct object *obj, void *data, unsigned long size,
 	struct fsck_options *options);
 
+/*
+ * Same as fsck_object(), but for an object that has not been looked up
+ * (and may not even be parsed).  The checks of trees, commits and tags
+ * only look at the buffer and "options", so they can run in several
+ * threads at once, each with its own "options".
+ */
+int fsck_buffer(const struct object_id *oid, enum object_type type,
+		void *data, unsigned long size,
+		struct fsck_options *options);
+
 /*
  * fsck a tag, and pass info about it back to the caller. This is
  * exposed fsck_object() internals for git-mktag(1).
@@ -176,6 +186,14 @@ int fsck_tag_standalone(const struct object_id *oid, const char *buffer,
 			struct object_id *tagged_oid,
 			int *tag_type);
 
+/*
+ * Call this before checking objects from several threads at once, each
+ * with its own fsck_options.  The threads may share the msg_type and
+ * skiplist of their options, but not the .gitmodules sets, and their
+ * error_func must be safe to call concurrently.
+ */
+void fsck_prepare_for_threads(void);
+
 /*
  * Some fsck checks are context-dependent, and may end up queued; run this
  * after completing all fsck_object() calls in order to resolve any remaining
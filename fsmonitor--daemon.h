@@ -0,0 +1,77 @@
+#ifndef FSMONITOR_DAEMON_H
+#define FSMONITOR_DAEMON_H
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+#include "cache.h"
+#include "dir.h"
+#include "run-command.h"
+#include "simple-ipc.h"
+#include "strmap.h"
+#include "thread-utils.h"
+
+struct fsm_listen_data; /* opaque platform-specific data for listener thread */
+
+/*
+ * A path reported as changed by the listener, along with the sequence
+ * number of the batch of events it arrived in.
+ */
+struct fsmonitor_change {
+	uint64_t seq;
+	char *path;
+};
+
+struct fsmonitor_daemon_state {
+	pthread_t listener_thread;
+	pthread_mutex_t main_lock;
+	pthread_cond_t cookies_cond;
+
+	/* Absolute path of the worktree root. */
+	struct strbuf path_worktree_watch;
+	/* Absolute path of the directory holding the cookie files. */
+	struct strbuf path_cookie_dir;
+
+	/*
+	 * The tokens we hand out are "builtin:<token_id>:<seq>". The
+	 * id changes whenever we lose track of the changes (e.g. when
+	 * the kernel event queue overflows), so that clients holding an
+	 * older token get a trivial "everything may have changed"
+	 * response.
+	 *
+	 * All of these, as well as the cookies, are guarded by
+	 * main_lock.
+	 */
+	struct strbuf token_id;
+	uint64_t current_seq;
+	struct fsmonitor_change *changes;
+	size_t changes_nr, changes_alloc;
+
+	/* Cookie name -> enum fsmonitor_cookie_state. */
+	struct strintmap cookies;
+	int cookie_seq;
+
+	int error_code;
+	struct fsm_listen_data *listen_data;
+
+	struct ipc_server_data *ipc_server_data;
+};
+
+/*
+ * Record a batch of changed paths (relative to the root of the
+ * worktree, directories with a trailing slash) and the names of the
+ * cookie files that were seen with them. Called by the listener
+ * thread.
+ */
+void fsmonitor_publish(struct fsmonitor_daemon_state *state,
+		       const struct string_list *paths,
+		       const struct string_list *cookie_names);
+
+/*
+ * Forget all changes and start handing out a new token id, so that
+ * clients rescan the whole worktree. Called by the listener thread
+ * when it has missed events.
+ */
+void fsmonitor_force_resync(struct fsmonitor_daemon_state *state);
+
+#endif /* HAVE_FSMONITOR_DAEMON_BACKEND */
+#endif /* FSMONITOR_DAEMON_H */
@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "run-command.h"
 #include "strbuf.h"
 
@@ -156,6 +157,14 @@ static int query_fsmonitor(int version, const char *last_update, struct strbuf *
 	if (!core_fsmonitor)
 		return -1;
 
+	if (core_use_builtin_fsmonitor) {
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+		return fsmonitor_ipc__send_query(last_update, query_result);
+#else
+		return -1;
+#endif
+	}
+
 	strvec_push(&cp.args, core_fsmonitor);
 	strvec_pushf(&cp.args, "%d", version);
 	strvec_pushf(&cp.args, "%s", last_update);
@@ -242,7 +251,9 @@ void refresh_fsmonitor(struct index_state *istate)
 	if (!core_fsmonitor || istate->fsmonitor_has_run_once)
 		return;
 
-	hook_version = fsmonitor_hook_version();
+	/* The built-in daemon always speaks version 2 */
+	hook_version = core_use_builtin_fsmonitor ?
+		HOOK_INTERFACE_VERSION2 : fsmonitor_hook_version();
 
 	istate->fsmonitor_has_run_once = 1;
 
@@ -301,6 +312,14 @@ void refresh_fsmonitor(struct index_state *istate)
 			core_fsmonitor, query_success ? "success" : "failure");
 	}
 
+	/*
+	 * If we could not talk to the built-in daemon, we still need a
+	 * token; one it does not understand makes it send a trivial
+	 * response the next time.
+	 */
+	if (core_use_builtin_fsmonitor && !last_update_token.len)
+		strbuf_addf(&last_update_token, "%"PRIu64"", last_update);
+
 	/* a fsmonitor process can return '/' to indicate all entries are invalid */
 	if (query_success && query_result.buf[bol] != '/') {
 		/* Mark all entries returned by the monitor as dirty */
@@ -339,6 +358,15 @@ void refresh_fsmonitor(struct index_state *istate)
 	}
 	strbuf_release(&query_result);
 
+	/*
+	 * The built-in daemon's tokens are exact, so it pays to save a
+	 * new one even if no entry changed: otherwise the next query
+	 * gets the same paths back again.
+	 */
+	if (core_use_builtin_fsmonitor && istate->fsmonitor_last_update &&
+	    strcmp(last_update_token.buf, istate->fsmonitor_last_update))
+		istate->cache_changed |= FSMONITOR_CHANGED;
+
 	/* Now that we've updated istate, save the last_update_token */
 	FREE_AND_NULL(istate->fsmonitor_last_update);
 	istate->fsmonitor_last_update = strbuf_detach(&last_update_token, NULL);
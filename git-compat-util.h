@@ -354,6 +354,15 @@ static inline int noop_core_config(const char *var, const char *value, void *cb)
 #define platform_core_config noop_core_config
 #endif
 
+/*
+ * Platforms where lstat() is expensive may cache its results while
+ * the working tree is scanned; see compat/win32/fscache.h.
+ */
+#ifndef enable_fscache
+#define enable_fscache() /* noop */
+#define disable_fscache() /* noop */
+#endif
+
 int lstat_cache_aware_rmdir(const char *path);
 #if !defined(__MINGW32__) && !defined(_MSC_VER)
 #define rmdir lstat_cache_aware_rmdir
@@ -707,6 +716,17 @@ int git_lstat(const char *, struct stat *);
 #define pread git_pread
 ssize_t git_pread(int fd, void *buf, size_t count, off_t offset);
 #endif
+
+#ifdef NO_WRITEV
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#define writev git_writev
+ssize_t git_writev(int fd, const struct iovec *iov, int iovcnt);
+#else
+#include <sys/uio.h>
+#endif
 /*
  * Forward decl that will remind us if its twin in cache.h changes.
  * This function is used in compat/pread.c.  But we can't include
@@ -875,10 +895,34 @@ void *xmemdupz(const void *data, size_t len);
 char *xstrndup(const char *str, size_t len);
 void *xrealloc(void *ptr, size_t size);
 void *xcalloc(size_t nmemb, size_t size);
+
+/*
+ * Count the allocations made through the x*alloc() family and
+ * xstrdup() between these calls.  The count is not thread-safe; it is
+ * meant for single-threaded measurements like "test-tool microbench".
+ */
+void start_counting_xallocs(void);
+uintmax_t stop_counting_xallocs(void);
+
 void *xmmap(void *start, size_t length, int prot, int flags, int fd, off_t offset);
 const char *mmap_os_err(void);
 void *xmmap_gently(void *start, size_t length, int prot, int flags, int fd, off_t offset);
 int xopen(const char *path, int flags, ...);
+
+enum fsync_action {
+	/* Write dirty pages out to the storage device. */
+	FSYNC_WRITEOUT_ONLY,
+	/* Write dirty pages out and flush the device's own cache. */
+	FSYNC_HARDWARE_FLUSH
+};
+
+/*
+ * Like fsync(2), but lets the caller ask for a cheaper operation that
+ * merely starts and waits for writeback without flushing the disk
+ * cache.  Returns -1 with errno set to ENOSYS when the platform has no
+ * way to do that; the caller is expected to do a full fsync() then.
+ */
+int git_fsync(int fd, enum fsync_action action);
 ssize_t xread(int fd, void *buf, size_t len);
 ssize_t xwrite(int fd, const void *buf, size_t len);
 ssize_t xpread(int fd, void *buf, size_t len, off_t offset);
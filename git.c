@@ -416,6 +416,10 @@ static int handle_alias(int *argcp, const char ***argv)
 	return ret;
 }
 
+/* set by run_set_up_builtin(), whose caller did the setup already */
+static int setup_done;
+static const char *setup_done_prefix;
+
 static int run_builtin(struct cmd_struct *p, int argc, const char **argv)
 {
 	int status, help;
@@ -425,7 +429,9 @@ static int run_builtin(struct cmd_struct *p, int argc, const char **argv)
 	prefix = NULL;
 	help = argc == 2 && !strcmp(argv[1], "-h");
 	if (!help) {
-		if (p->option & RUN_SETUP)
+		if (setup_done)
+			prefix = setup_done_prefix;
+		else if (p->option & RUN_SETUP)
 			prefix = setup_git_directory();
 		else if (p->option & RUN_SETUP_GENTLY) {
 			int nongit_ok;
@@ -510,6 +516,7 @@ static struct cmd_struct commands[] = {
 	{ "commit", cmd_commit, RUN_SETUP | NEED_WORK_TREE },
 	{ "commit-graph", cmd_commit_graph, RUN_SETUP },
 	{ "commit-tree", cmd_commit_tree, RUN_SETUP | NO_PARSEOPT },
+	{ "command--daemon", cmd_command__daemon, RUN_SETUP },
 	{ "config", cmd_config, RUN_SETUP_GENTLY | DELAY_PAGER_CONFIG },
 	{ "count-objects", cmd_count_objects, RUN_SETUP },
 	{ "credential", cmd_credential, RUN_SETUP_GENTLY | NO_PARSEOPT },
@@ -533,6 +540,7 @@ static struct cmd_struct commands[] = {
 	{ "format-patch", cmd_format_patch, RUN_SETUP },
 	{ "fsck", cmd_fsck, RUN_SETUP },
 	{ "fsck-objects", cmd_fsck, RUN_SETUP },
+	{ "fsmonitor--daemon", cmd_fsmonitor__daemon, RUN_SETUP | NEED_WORK_TREE },
 	{ "gc", cmd_gc, RUN_SETUP },
 	{ "get-tar-commit-id", cmd_get_tar_commit_id, NO_PARSEOPT },
 	{ "grep", cmd_grep, RUN_SETUP_GENTLY },
@@ -558,7 +566,7 @@ static struct cmd_struct commands[] = {
 	{ "merge-recursive-ours", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
 	{ "merge-recursive-theirs", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
 	{ "merge-subtree", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
-	{ "merge-tree", cmd_merge_tree, RUN_SETUP | NO_PARSEOPT },
+	{ "merge-tree", cmd_merge_tree, RUN_SETUP },
 	{ "mktag", cmd_mktag, RUN_SETUP | NO_PARSEOPT },
 	{ "mktree", cmd_mktree, RUN_SETUP },
 	{ "multi-pack-index", cmd_multi_pack_index, RUN_SETUP_GENTLY },
@@ -715,6 +723,38 @@ static void handle_builtin(int argc, const char **argv)
 	strvec_clear(&args);
 }
 
+int run_set_up_builtin(int argc, const char **argv, const char *prefix)
+{
+	struct cmd_struct *p = argc ? get_builtin(argv[0]) : NULL;
+
+	if (!p || p->fn == cmd_command__daemon)
+		return error(_("'%s' cannot be run by command--daemon"),
+			     argc ? argv[0] : "");
+
+	if (!(p->option & (RUN_SETUP | RUN_SETUP_GENTLY))) {
+		/*
+		 * It finds the repository, if it needs one, on its own:
+		 * point it there from the directory it is run from.
+		 */
+		if (startup_info->have_repository) {
+			setenv(GIT_DIR_ENVIRONMENT,
+			       absolute_path(get_git_dir()), 1);
+			if (get_git_work_tree())
+				setenv(GIT_WORK_TREE_ENVIRONMENT,
+				       get_git_work_tree(), 1);
+		}
+		if (prefix && chdir(prefix))
+			die_errno(_("cannot change to '%s'"), prefix);
+		return run_builtin(p, argc, argv);
+	}
+
+	setup_done = 1;
+	setup_done_prefix = prefix;
+	startup_info->prefix = prefix;
+	setenv(GIT_PREFIX_ENVIRONMENT, prefix ? prefix : "", 1);
+	return run_builtin(p, argc, argv);
+}
+
 static void execv_dashed_external(const char **argv)
 {
 	struct child_process cmd = CHILD_PROCESS_INIT;
@@ -5,10 +5,13 @@
 #include "strbuf.h"
 #include "gpg-interface.h"
 #include "sigchain.h"
+#include "strmap.h"
 #include "tempfile.h"
+#include "thread-utils.h"
 
 static char *configured_signing_key;
 static enum signature_trust_level configured_min_trust_level = TRUST_UNDEFINED;
+static int configured_verify_jobs;
 
 struct gpg_format {
 	const char *name;
@@ -306,6 +309,241 @@ static int verify_signed_buffer(const char *payload, size_t payload_size,
 	return ret;
 }
 
+/*
+ * The outcome of running the verifier on a payload and its signature,
+ * kept so that asking again does not run it again.  The cache holds
+ * the most recent SIGNATURE_CACHE_SIZE results, which is plenty for
+ * prefetch_signatures() to hand its results to check_signature().
+ */
+struct verified_signature {
+	int status;
+	char *output;
+	char *gpg_status;
+};
+
+#define SIGNATURE_CACHE_SIZE 1024
+
+static struct strmap signature_cache = STRMAP_INIT;
+static char *signature_cache_keys[SIGNATURE_CACHE_SIZE];
+static size_t signature_cache_next;
+
+static void signature_cache_key(char *hex,
+				const char *payload, size_t plen,
+				const char *signature, size_t slen)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct strbuf len = STRBUF_INIT;
+
+	/* the length keeps payload and signature from running together */
+	strbuf_addf(&len, "%"PRIuMAX, (uintmax_t)plen);
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, len.buf, len.len + 1);
+	the_hash_algo->update_fn(&ctx, payload, plen);
+	the_hash_algo->update_fn(&ctx, signature, slen);
+	the_hash_algo->final_fn(hash, &ctx);
+	hash_to_hex_algop_r(hex, hash, the_hash_algo);
+	strbuf_release(&len);
+}
+
+static void free_verified_signature(struct verified_signature *v)
+{
+	if (!v)
+		return;
+	free(v->output);
+	free(v->gpg_status);
+	free(v);
+}
+
+static void signature_cache_put(const char *key, int status,
+				const struct strbuf *output,
+				const struct strbuf *gpg_status)
+{
+	struct verified_signature *v;
+	char **slot = &signature_cache_keys[signature_cache_next];
+
+	if (strmap_contains(&signature_cache, key))
+		return;
+
+	if (*slot) {
+		free_verified_signature(strmap_get(&signature_cache, *slot));
+		strmap_remove(&signature_cache, *slot, 0);
+		free(*slot);
+	}
+	*slot = xstrdup(key);
+	signature_cache_next = (signature_cache_next + 1) % SIGNATURE_CACHE_SIZE;
+
+	CALLOC_ARRAY(v, 1);
+	v->status = status;
+	v->output = xmemdupz(output->buf, output->len);
+	v->gpg_status = xmemdupz(gpg_status->buf, gpg_status->len);
+	strmap_put(&signature_cache, key, v);
+}
+
+static int verify_signed_buffer_cached(const char *payload, size_t plen,
+				       const char *signature, size_t slen,
+				       struct strbuf *gpg_output,
+				       struct strbuf *gpg_status)
+{
+	char key[GIT_MAX_HEXSZ + 1];
+	struct verified_signature *v;
+	int status;
+
+	signature_cache_key(key, payload, plen, signature, slen);
+	v = strmap_get(&signature_cache, key);
+	if (v) {
+		strbuf_addstr(gpg_output, v->output);
+		strbuf_addstr(gpg_status, v->gpg_status);
+		return v->status;
+	}
+
+	status = verify_signed_buffer(payload, plen, signature, slen,
+				      gpg_output, gpg_status);
+	/* do not remember failures to run the verifier at all */
+	if (gpg_output->len || gpg_status->len)
+		signature_cache_put(key, status, gpg_output, gpg_status);
+	return status;
+}
+
+int get_signature_verify_jobs(void)
+{
+	if (configured_verify_jobs > 0)
+		return configured_verify_jobs;
+	return online_cpus();
+}
+
+/*
+ * One verifier running on behalf of prefetch_signatures().  Unlike
+ * verify_signed_buffer(), the payload is fed and the output collected
+ * through temporary files, so that several verifiers can run at once
+ * without us having to juggle their pipes.
+ */
+struct verify_job {
+	struct child_process gpg;
+	struct tempfile *signature;
+	struct tempfile *payload;
+	struct tempfile *output;
+	struct tempfile *gpg_status;
+	char key[GIT_MAX_HEXSZ + 1];
+};
+
+static struct tempfile *write_verify_tempfile(const char *buf, size_t len)
+{
+	struct tempfile *temp = mks_tempfile_t(".git_vtag_tmpXXXXXX");
+
+	if (!temp) {
+		error_errno(_("could not create temporary file"));
+		return NULL;
+	}
+	if (write_in_full(temp->fd, buf, len) < 0 ||
+	    close_tempfile_gently(temp) < 0) {
+		error_errno(_("failed writing detached signature to '%s'"),
+			    temp->filename.buf);
+		delete_tempfile(&temp);
+	}
+	return temp;
+}
+
+static void clear_verify_job(struct verify_job *job)
+{
+	delete_tempfile(&job->signature);
+	delete_tempfile(&job->payload);
+	delete_tempfile(&job->output);
+	delete_tempfile(&job->gpg_status);
+}
+
+static int start_verify_job(struct verify_job *job,
+			    const struct signed_payload *item)
+{
+	struct gpg_format *fmt = get_format_by_sig(item->signature.buf);
+
+	if (!fmt)
+		BUG("bad signature '%s'", item->signature.buf);
+
+	child_process_init(&job->gpg);
+	job->signature = write_verify_tempfile(item->signature.buf,
+					       item->signature.len);
+	job->payload = write_verify_tempfile(item->payload.buf,
+					     item->payload.len);
+	job->output = write_verify_tempfile("", 0);
+	job->gpg_status = write_verify_tempfile("", 0);
+	if (!job->signature || !job->payload ||
+	    !job->output || !job->gpg_status)
+		goto fail;
+
+	strvec_push(&job->gpg.args, fmt->program);
+	strvec_pushv(&job->gpg.args, fmt->verify_args);
+	strvec_pushl(&job->gpg.args,
+		     "--status-fd=1",
+		     "--verify", job->signature->filename.buf, "-",
+		     NULL);
+	job->gpg.in = xopen(job->payload->filename.buf, O_RDONLY);
+	job->gpg.out = xopen(job->gpg_status->filename.buf, O_WRONLY);
+	job->gpg.err = xopen(job->output->filename.buf, O_WRONLY);
+	if (start_command(&job->gpg))
+		goto fail;
+	return 0;
+
+fail:
+	clear_verify_job(job);
+	return -1;
+}
+
+static void finish_verify_job(struct verify_job *job)
+{
+	struct strbuf output = STRBUF_INIT;
+	struct strbuf gpg_status = STRBUF_INIT;
+	int status = finish_command(&job->gpg);
+
+	if (strbuf_read_file(&output, job->output->filename.buf, 0) < 0 ||
+	    strbuf_read_file(&gpg_status, job->gpg_status->filename.buf, 0) < 0)
+		goto out;
+
+	status |= !strstr(gpg_status.buf, "\n[GNUPG:] GOODSIG ");
+	if (output.len || gpg_status.len)
+		signature_cache_put(job->key, status, &output, &gpg_status);
+
+out:
+	clear_verify_job(job);
+	strbuf_release(&output);
+	strbuf_release(&gpg_status);
+}
+
+void prefetch_signatures(const struct signed_payload *items, size_t nr)
+{
+	int jobs = get_signature_verify_jobs();
+	struct verify_job *job;
+	size_t i, started = 0, finished = 0;
+
+	if (jobs <= 1 || nr <= 1)
+		return;
+	CALLOC_ARRAY(job, jobs);
+
+	/*
+	 * Keep up to "jobs" verifiers running, and collect them in the
+	 * order they were started; they take about the same time each.
+	 */
+	for (i = 0; i < nr || finished < started; ) {
+		while (i < nr && started - finished < (size_t)jobs) {
+			struct verify_job *j = &job[started % jobs];
+			const struct signed_payload *item = &items[i++];
+
+			signature_cache_key(j->key,
+					    item->payload.buf, item->payload.len,
+					    item->signature.buf, item->signature.len);
+			if (strmap_contains(&signature_cache, j->key))
+				continue;
+			if (start_verify_job(j, item))
+				continue;
+			started++;
+		}
+		if (finished < started)
+			finish_verify_job(&job[finished++ % jobs]);
+	}
+
+	free(job);
+}
+
 int check_signature(const char *payload, size_t plen, const char *signature,
 	size_t slen, struct signature_check *sigc)
 {
@@ -316,8 +554,8 @@ int check_signature(const char *payload, size_t plen, const char *signature,
 	sigc->result = 'N';
 	sigc->trust_level = -1;
 
-	status = verify_signed_buffer(payload, plen, signature, slen,
-				      &gpg_output, &gpg_status);
+	status = verify_signed_buffer_cached(payload, plen, signature, slen,
+					     &gpg_output, &gpg_status);
 	if (status && !gpg_output.len)
 		goto out;
 	sigc->payload = xmemdupz(payload, plen);
@@ -419,6 +657,14 @@ int git_gpg_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "gpg.verifyjobs")) {
+		configured_verify_jobs = git_config_int(var, value);
+		if (configured_verify_jobs < 0)
+			return error("unsupported value for %s: %s", var,
+				     value);
+		return 0;
+	}
+
 	if (!strcmp(var, "gpg.program") || !strcmp(var, "gpg.openpgp.program"))
 		fmtname = "openpgp";
 
@@ -1,7 +1,7 @@
 #ifndef GPG_INTERFACE_H
 #define GPG_INTERFACE_H
 
-struct strbuf;
+#include "strbuf.h"
 
 #define GPG_VERIFY_VERBOSE		1
 #define GPG_VERIFY_RAW			2
@@ -67,6 +67,30 @@ const char *get_signing_key(void);
 int check_signature(const char *payload, size_t plen,
 		    const char *signature, size_t slen,
 		    struct signature_check *sigc);
+
+/*
+ * The number of verifiers prefetch_signatures() keeps running at once,
+ * from gpg.verifyJobs.
+ */
+int get_signature_verify_jobs(void);
+
+struct signed_payload {
+	struct strbuf payload;
+	struct strbuf signature;
+};
+
+/*
+ * Verify the signatures of "items" with several verifiers running at
+ * once, and remember the results, so that check_signature() on any of
+ * them afterwards does not have to wait for a verifier.  Does nothing
+ * when gpg.verifyJobs allows only one verifier.
+ *
+ * Only the most recent results are remembered; callers should check
+ * the signatures of at most SIGNATURE_PREFETCH_MAX items at a time.
+ */
+#define SIGNATURE_PREFETCH_MAX 64
+
+void prefetch_signatures(const struct signed_payload *items, size_t nr);
 void print_signature_buffer(const struct signature_check *sigc,
 			    unsigned flags);
 
@@ -24,6 +24,7 @@ typedef int pcre2_general_context;
 #include "userdiff.h"
 
 struct repository;
+struct kwset_t;
 
 enum grep_pat_token {
 	GREP_PATTERN,
@@ -120,6 +121,13 @@ struct grep_opt {
 	struct grep_pat *header_list;
 	struct grep_pat **header_tail;
 	struct grep_expr *pattern_expression;
+
+	/*
+	 * All of pattern_list in one keyword set, when it consists of
+	 * several fixed strings of which any may match.
+	 */
+	struct kwset_t *kws;
+
 	struct repository *repo;
 	const char *prefix;
 	int prefix_length;
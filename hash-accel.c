@@ -0,0 +1,184 @@
+#include "git-compat-util.h"
+#include "config.h"
+#include "hash-accel.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HASH_ACCEL_SHA_NI
+#endif
+
+#ifdef HASH_ACCEL_SHA_NI
+#include <immintrin.h>
+#include <cpuid.h>
+
+#define SHA_NI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+SHA_NI_TARGET
+static void sha1_blocks_sha_ni(uint32_t state[5], const unsigned char *data,
+			       size_t nr)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i abcd, e0, e1 = _mm_setzero_si128(), abcd_save, e0_save, msg[4];
+	int f, g;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+	e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	for (; nr; nr--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/*
+		 * Twenty groups of four rounds; group "g" uses the
+		 * message words 4g..4g+3, kept in msg[g % 4].
+		 */
+		for (f = 0; f < 4; f++) {
+			for (g = 5 * f; g < 5 * f + 5; g++) {
+				__m128i *m = &msg[g % 4];
+
+				if (g < 4)
+					*m = _mm_shuffle_epi8(_mm_loadu_si128(
+						(const __m128i *)(data + 16 * g)), bswap);
+				else
+					*m = _mm_sha1msg2_epu32(
+						_mm_xor_si128(_mm_sha1msg1_epu32(*m, msg[(g + 1) % 4]),
+							      msg[(g + 2) % 4]),
+						msg[(g + 3) % 4]);
+
+				if (!g)
+					e0 = _mm_add_epi32(e0, *m);
+				else
+					e0 = _mm_sha1nexte_epu32(e1, *m);
+				e1 = abcd;
+				/* the round function must be an immediate */
+				switch (f) {
+				case 0:
+					abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+					break;
+				case 1:
+					abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+					break;
+				case 2:
+					abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+					break;
+				default:
+					abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+					break;
+				}
+			}
+		}
+
+		e0 = _mm_sha1nexte_epu32(e1, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+SHA_NI_TARGET
+static void sha256_blocks_sha_ni(uint32_t state[8], const unsigned char *data,
+				 size_t nr)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i state0, state1, tmp, abef_save, cdgh_save, msg[4];
+	int g;
+
+	/* the instructions want the state as ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; nr; nr--, data += 64) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		/*
+		 * Sixteen groups of four rounds; group "g" uses the
+		 * message words 4g..4g+3, kept in msg[g % 4].
+		 */
+		for (g = 0; g < 16; g++) {
+			__m128i *m = &msg[g % 4], w;
+
+			if (g < 4)
+				*m = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *)(data + 16 * g)), bswap);
+			else
+				*m = _mm_sha256msg2_epu32(
+					_mm_add_epi32(_mm_sha256msg1_epu32(*m, msg[(g + 1) % 4]),
+						      _mm_alignr_epi8(msg[(g + 3) % 4],
+								      msg[(g + 2) % 4], 4)),
+					msg[(g + 3) % 4]);
+
+			w = _mm_add_epi32(*m, _mm_loadu_si128(
+				(const __m128i *)&sha256_k[4 * g]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, w);
+			state0 = _mm_sha256rnds2_epu32(state0, state1,
+						       _mm_shuffle_epi32(w, 0x0e));
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xf0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static int have_sha_ni(void)
+{
+	static int sha_ni = -1;
+
+	if (sha_ni < 0) {
+		unsigned int a, b, c, d;
+
+		sha_ni = 0;
+		/* the SHA extensions are bit 29 of EBX in leaf 7 */
+		if (__get_cpuid(1, &a, &b, &c, &d) &&
+		    (c & bit_SSE4_1) && (c & bit_SSSE3) &&
+		    __get_cpuid_max(0, NULL) >= 7) {
+			__cpuid_count(7, 0, a, b, c, d);
+			sha_ni = !!(b & (1 << 29));
+		}
+		if (sha_ni && !git_env_bool("GIT_TEST_HASH_ACCEL", 1))
+			sha_ni = 0;
+	}
+	return sha_ni;
+}
+#endif /* HASH_ACCEL_SHA_NI */
+
+sha1_blocks_fn sha1_accel_blocks(void)
+{
+#ifdef HASH_ACCEL_SHA_NI
+	if (have_sha_ni())
+		return sha1_blocks_sha_ni;
+#endif
+	return NULL;
+}
+
+sha256_blocks_fn sha256_accel_blocks(void)
+{
+#ifdef HASH_ACCEL_SHA_NI
+	if (have_sha_ni())
+		return sha256_blocks_sha_ni;
+#endif
+	return NULL;
+}
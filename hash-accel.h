@@ -0,0 +1,23 @@
+#ifndef HASH_ACCEL_H
+#define HASH_ACCEL_H
+
+/*
+ * Block functions that use the SHA instructions of the CPU, for our
+ * own SHA-1 and SHA-256 implementations to hand their full blocks to.
+ * Which CPU features exist is only known at runtime, so that a single
+ * binary runs everywhere and is fast where it can be.
+ *
+ * Each function processes "nr" consecutive 64-byte blocks and updates
+ * the state words in place, just like the portable code would.  The
+ * getters return NULL when the CPU (or the compiler) lacks support, or
+ * when GIT_TEST_HASH_ACCEL is set to false.
+ */
+typedef void (*sha1_blocks_fn)(uint32_t state[5], const unsigned char *data,
+			       size_t nr);
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const unsigned char *data,
+				 size_t nr);
+
+sha1_blocks_fn sha1_accel_blocks(void);
+sha256_blocks_fn sha256_accel_blocks(void);
+
+#endif /* HASH_ACCEL_H */
@@ -0,0 +1,352 @@
+#include "cache.h"
+#include "hash-accel.h"
+#include "hash-batch.h"
+#include "object-store.h"
+
+#define MAX_HEADER_LEN 32
+
+/*
+ * Objects larger than this are hashed on their own; keeping seven
+ * lanes idle while one of them works through a big blob would be
+ * slower than the plain code.
+ */
+#define HASH_BATCH_MAX_LEN (64 * 1024)
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HASH_BATCH_AVX2
+#endif
+
+#ifdef HASH_BATCH_AVX2
+#include <immintrin.h>
+
+#define LANES 8
+
+/*
+ * The state of all lanes, transposed so that word "w" of every lane
+ * can be loaded into one register: state[w][lane].
+ */
+typedef uint32_t lane_state[8][LANES];
+typedef void (*lane_compress_fn)(lane_state st, const unsigned char **blocks);
+
+#define ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+				   _mm256_slli_epi32((x), 32 - (n)))
+#define ROTL(x, n) ROTR((x), 32 - (n))
+#define ADD(a, b) _mm256_add_epi32((a), (b))
+#define XOR(a, b) _mm256_xor_si256((a), (b))
+#define AND(a, b) _mm256_and_si256((a), (b))
+#define OR(a, b) _mm256_or_si256((a), (b))
+#define ANDNOT(a, b) _mm256_andnot_si256((a), (b))
+#define SET1(x) _mm256_set1_epi32((int)(x))
+
+#define LOAD_BE32(blocks, i) _mm256_setr_epi32( \
+	get_be32((blocks)[0] + 4 * (i)), get_be32((blocks)[1] + 4 * (i)), \
+	get_be32((blocks)[2] + 4 * (i)), get_be32((blocks)[3] + 4 * (i)), \
+	get_be32((blocks)[4] + 4 * (i)), get_be32((blocks)[5] + 4 * (i)), \
+	get_be32((blocks)[6] + 4 * (i)), get_be32((blocks)[7] + 4 * (i)))
+
+#ifdef SHA256_BLK
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_init[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+__attribute__((target("avx2")))
+static void sha256_compress_x8(lane_state st, const unsigned char **blocks)
+{
+	__m256i w[16], s[8];
+	__m256i a, b, c, d, e, f, g, h;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = LOAD_BE32(blocks, i);
+	for (i = 0; i < 8; i++)
+		s[i] = _mm256_loadu_si256((const __m256i *)st[i]);
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	for (i = 0; i < 64; i++) {
+		__m256i wi, t1, t2;
+
+		if (i < 16) {
+			wi = w[i];
+		} else {
+			__m256i w2 = w[(i - 2) & 15], w15 = w[(i - 15) & 15];
+			__m256i s0 = XOR(XOR(ROTR(w15, 7), ROTR(w15, 18)),
+					 _mm256_srli_epi32(w15, 3));
+			__m256i s1 = XOR(XOR(ROTR(w2, 17), ROTR(w2, 19)),
+					 _mm256_srli_epi32(w2, 10));
+			wi = ADD(ADD(s1, w[(i - 7) & 15]), ADD(s0, w[i & 15]));
+			w[i & 15] = wi;
+		}
+
+		t1 = ADD(h, XOR(XOR(ROTR(e, 6), ROTR(e, 11)), ROTR(e, 25)));
+		t1 = ADD(t1, XOR(AND(e, f), ANDNOT(e, g)));
+		t1 = ADD(t1, ADD(SET1(sha256_k[i]), wi));
+		t2 = ADD(XOR(XOR(ROTR(a, 2), ROTR(a, 13)), ROTR(a, 22)),
+			 OR(AND(a, b), AND(c, OR(a, b))));
+
+		h = g; g = f; f = e; e = ADD(d, t1);
+		d = c; c = b; b = a; a = ADD(t1, t2);
+	}
+
+	s[0] = ADD(s[0], a); s[1] = ADD(s[1], b);
+	s[2] = ADD(s[2], c); s[3] = ADD(s[3], d);
+	s[4] = ADD(s[4], e); s[5] = ADD(s[5], f);
+	s[6] = ADD(s[6], g); s[7] = ADD(s[7], h);
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((__m256i *)st[i], s[i]);
+}
+#endif /* SHA256_BLK */
+
+#ifdef SHA1_BLK
+static const uint32_t sha1_init[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+__attribute__((target("avx2")))
+static void sha1_compress_x8(lane_state st, const unsigned char **blocks)
+{
+	__m256i w[16], s[5];
+	__m256i a, b, c, d, e;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = LOAD_BE32(blocks, i);
+	for (i = 0; i < 5; i++)
+		s[i] = _mm256_loadu_si256((const __m256i *)st[i]);
+	a = s[0]; b = s[1]; c = s[2]; d = s[3]; e = s[4];
+
+	for (i = 0; i < 80; i++) {
+		__m256i wi, f, k, t;
+
+		if (i < 16) {
+			wi = w[i];
+		} else {
+			wi = XOR(XOR(w[(i - 3) & 15], w[(i - 8) & 15]),
+				 XOR(w[(i - 14) & 15], w[i & 15]));
+			wi = ROTL(wi, 1);
+			w[i & 15] = wi;
+		}
+
+		if (i < 20) {
+			f = OR(AND(b, c), ANDNOT(b, d));
+			k = SET1(0x5a827999);
+		} else if (i < 40) {
+			f = XOR(XOR(b, c), d);
+			k = SET1(0x6ed9eba1);
+		} else if (i < 60) {
+			f = OR(AND(b, c), AND(d, OR(b, c)));
+			k = SET1(0x8f1bbcdc);
+		} else {
+			f = XOR(XOR(b, c), d);
+			k = SET1(0xca62c1d6);
+		}
+
+		t = ADD(ADD(ROTL(a, 5), f), ADD(ADD(e, k), wi));
+		e = d; d = c; c = ROTL(b, 30); b = a; a = t;
+	}
+
+	s[0] = ADD(s[0], a); s[1] = ADD(s[1], b); s[2] = ADD(s[2], c);
+	s[3] = ADD(s[3], d); s[4] = ADD(s[4], e);
+	for (i = 0; i < 5; i++)
+		_mm256_storeu_si256((__m256i *)st[i], s[i]);
+}
+#endif /* SHA1_BLK */
+
+/*
+ * One object being hashed in a lane, seen as the stream of bytes
+ * "<header> <data> <padding>" that the compression function eats 64
+ * bytes at a time.
+ */
+struct lane {
+	struct hash_batch_item *item;
+	char hdr[MAX_HEADER_LEN];
+	size_t hdrlen;
+	uint64_t total, padded, pos;
+	unsigned char block[64];
+};
+
+static void lane_start(struct lane *l, struct hash_batch_item *item)
+{
+	l->item = item;
+	l->hdrlen = xsnprintf(l->hdr, sizeof(l->hdr), "%s %"PRIuMAX,
+			      item->type, (uintmax_t)item->len) + 1;
+	l->total = l->hdrlen + item->len;
+	/* room for at least the 0x80 byte and the 64-bit length */
+	l->padded = (l->total + 8) / 64 * 64 + 64;
+	l->pos = 0;
+}
+
+static const unsigned char *lane_next_block(struct lane *l)
+{
+	const unsigned char *buf = l->item->buf;
+	uint64_t pos = l->pos;
+	size_t filled = 0;
+
+	/* Most blocks lie entirely within the object data */
+	if (pos >= l->hdrlen && pos + 64 <= l->total) {
+		l->pos += 64;
+		return buf + (pos - l->hdrlen);
+	}
+
+	while (filled < 64) {
+		size_t n = 64 - filled;
+
+		if (pos < l->hdrlen) {
+			if (n > l->hdrlen - pos)
+				n = l->hdrlen - pos;
+			memcpy(l->block + filled, l->hdr + pos, n);
+		} else if (pos < l->total) {
+			if (n > l->total - pos)
+				n = l->total - pos;
+			memcpy(l->block + filled, buf + (pos - l->hdrlen), n);
+		} else {
+			memset(l->block + filled, 0, n);
+			if (pos == l->total)
+				l->block[filled] = 0x80;
+		}
+		filled += n;
+		pos += n;
+	}
+	if (pos == l->padded)
+		put_be64(l->block + 56, l->total * 8);
+	l->pos = pos;
+	return l->block;
+}
+
+static void hash_lanes(const struct git_hash_algo *algo,
+		       lane_compress_fn compress,
+		       const uint32_t *init, int nr_words,
+		       struct hash_batch_item *items, size_t nr)
+{
+	static const unsigned char idle_block[64];
+	struct lane lanes[LANES];
+	const unsigned char *blocks[LANES];
+	lane_state st;
+	size_t next = 0;
+	int active = 0, i, w;
+
+	for (i = 0; i < LANES; i++) {
+		lanes[i].item = NULL;
+		for (w = 0; w < nr_words; w++)
+			st[w][i] = init[w];
+	}
+
+	for (;;) {
+		for (i = 0; i < LANES; i++) {
+			if (lanes[i].item || next >= nr)
+				continue;
+			lane_start(&lanes[i], &items[next++]);
+			for (w = 0; w < nr_words; w++)
+				st[w][i] = init[w];
+			active++;
+		}
+		if (!active)
+			break;
+
+		for (i = 0; i < LANES; i++)
+			blocks[i] = lanes[i].item ? lane_next_block(&lanes[i])
+						  : idle_block;
+		compress(st, blocks);
+
+		for (i = 0; i < LANES; i++) {
+			struct object_id *oid;
+
+			if (!lanes[i].item || lanes[i].pos < lanes[i].padded)
+				continue;
+			oid = lanes[i].item->oid;
+			for (w = 0; w < nr_words; w++)
+				put_be32(oid->hash + 4 * w, st[w][i]);
+			memset(oid->hash + algo->rawsz, 0,
+			       GIT_MAX_RAWSZ - algo->rawsz);
+			oid->algo = hash_algo_by_ptr(algo);
+			lanes[i].item = NULL;
+			active--;
+		}
+	}
+}
+
+static int have_avx2(void)
+{
+	static int avx2 = -1;
+
+	if (avx2 < 0)
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	return avx2;
+}
+#endif /* HASH_BATCH_AVX2 */
+
+void hash_object_file_batch(const struct git_hash_algo *algo,
+			    struct hash_batch_item *items, size_t nr)
+{
+	size_t i;
+
+#ifdef HASH_BATCH_AVX2
+	lane_compress_fn compress = NULL;
+	const uint32_t *init = NULL;
+	int nr_words = 0;
+
+	/*
+	 * Only take over from our own block implementations; OpenSSL
+	 * and friends may well use the CPU's SHA instructions, which
+	 * beat the lanes, and SHA-1 collision detection cannot be done
+	 * in them at all.  The same goes for our own code when it has
+	 * the SHA instructions to hand the blocks to.
+	 */
+#if defined(SHA1_BLK)
+	if (hash_algo_by_ptr(algo) == GIT_HASH_SHA1 && !sha1_accel_blocks()) {
+		compress = sha1_compress_x8;
+		init = sha1_init;
+		nr_words = 5;
+	}
+#endif
+#if defined(SHA256_BLK)
+	if (hash_algo_by_ptr(algo) == GIT_HASH_SHA256 &&
+	    !sha256_accel_blocks()) {
+		compress = sha256_compress_x8;
+		init = sha256_init;
+		nr_words = 8;
+	}
+#endif
+
+	if (compress && nr > 1 && have_avx2()) {
+		/*
+		 * Hash the big objects one by one, and collect the
+		 * small ones at the front of a scratch copy.
+		 */
+		struct hash_batch_item *small;
+		size_t j;
+
+		ALLOC_ARRAY(small, nr);
+		for (i = j = 0; i < nr; i++) {
+			if (items[i].len <= HASH_BATCH_MAX_LEN)
+				small[j++] = items[i];
+			else
+				hash_object_file(algo, items[i].buf,
+						 items[i].len, items[i].type,
+						 items[i].oid);
+		}
+		hash_lanes(algo, compress, init, nr_words, small, j);
+		free(small);
+		return;
+	}
+#endif
+
+	for (i = 0; i < nr; i++)
+		hash_object_file(algo, items[i].buf, items[i].len,
+				 items[i].type, items[i].oid);
+}
@@ -0,0 +1,31 @@
+#ifndef HASH_BATCH_H
+#define HASH_BATCH_H
+
+struct git_hash_algo;
+struct object_id;
+
+struct hash_batch_item {
+	/* input */
+	const char *type;
+	const void *buf;
+	unsigned long len;
+
+	/* output */
+	struct object_id *oid;
+};
+
+/*
+ * Compute the names of "nr" objects, as hash_object_file() would for
+ * each of them.
+ *
+ * Where the CPU allows, this hashes several small objects at once in
+ * the lanes of vector registers, which is much faster than hashing
+ * them one after another.  This is only done for hash implementations
+ * that are no faster on a single object than the vector code is; in
+ * particular, SHA-1 with collision detection (the default) is always
+ * computed one object at a time.
+ */
+void hash_object_file_batch(const struct git_hash_algo *algo,
+			    struct hash_batch_item *items, size_t nr);
+
+#endif /* HASH_BATCH_H */
@@ -100,27 +100,67 @@ int oid_pos(const struct object_id *oid, const void *table, size_t nr,
 	return index_pos_to_insert_pos(lo);
 }
 
+/*
+ * The four bytes after the first one of a hash, which the fanout has
+ * already taken care of.
+ */
+static uint64_t take4(const unsigned char *hash)
+{
+	return get_be32(hash + 1);
+}
+
+/*
+ * How many slots bsearch_hash() guesses before it falls back to
+ * bisecting; uniformly distributed hashes are found in less than four.
+ */
+#define MAX_HASH_GUESSES 6
+
 int bsearch_hash(const unsigned char *hash, const uint32_t *fanout_nbo,
 		 const unsigned char *table, size_t stride, uint32_t *result)
 {
 	uint32_t hi, lo;
+	uint64_t lov, hiv, miv = take4(hash);
+	int guesses = 0;
 
 	hi = ntohl(fanout_nbo[*hash]);
 	lo = ((*hash == 0x0) ? 0 : ntohl(fanout_nbo[*hash - 1]));
 
+	/*
+	 * Hashes are uniformly distributed, so instead of the middle,
+	 * pick the slot where the target would be if the entries between
+	 * lo and hi were evenly spread between the entries we have seen
+	 * around them.  lov and hiv are the four bytes after the first
+	 * one of those entries, which start out as anything.
+	 */
+	lov = 0;
+	hiv = (uint64_t)1 << 32;
+
 	while (lo < hi) {
-		unsigned mi = lo + (hi - lo) / 2;
-		int cmp = hashcmp(table + mi * stride, hash);
+		uint32_t range = hi - lo;
+		unsigned mi;
+		int cmp;
+
+		if (range <= 2 || hiv <= lov || ++guesses > MAX_HASH_GUESSES) {
+			mi = lo + range / 2;
+		} else {
+			mi = lo + range * (miv - lov) / (hiv - lov);
+			if (mi >= hi)
+				mi = hi - 1;
+		}
+		cmp = hashcmp(table + mi * stride, hash);
 
 		if (!cmp) {
 			if (result)
 				*result = mi;
 			return 1;
 		}
-		if (cmp > 0)
+		if (cmp > 0) {
 			hi = mi;
-		else
+			hiv = take4(table + mi * stride);
+		} else {
 			lo = mi + 1;
+			lov = take4(table + mi * stride);
+		}
 	}
 
 	if (result)
@@ -2,6 +2,7 @@
  * Generic implementation of hash-based key value mappings.
  */
 #include "cache.h"
+#include "config.h"
 #include "hashmap.h"
 
 #define FNV32_BASE ((unsigned int) 0x811c9dc5)
@@ -72,6 +73,8 @@ unsigned int memihash_cont(unsigned int hash_seed, const void *buf, size_t len)
 #define HASHMAP_RESIZE_BITS 2
 /* load factor in percent */
 #define HASHMAP_LOAD_FACTOR 80
+/* buckets moved to the new table by each addition when growing incrementally */
+#define HASHMAP_RESIZE_STEP 8
 
 static void alloc_table(struct hashmap *map, unsigned int size)
 {
@@ -112,24 +115,59 @@ int hashmap_bucket(const struct hashmap *map, unsigned int hash)
 	return hash & (map->tablesize - 1);
 }
 
+static void move_bucket(struct hashmap *map, unsigned int i)
+{
+	struct hashmap_entry *e = map->old_table[i];
+
+	map->old_table[i] = NULL;
+	while (e) {
+		struct hashmap_entry *next = e->next;
+		unsigned int b = bucket(map, e);
+		e->next = map->table[b];
+		map->table[b] = e;
+		e = next;
+	}
+}
+
+/* Move up to nr buckets of the old table to the new one. */
+static void resize_step(struct hashmap *map, unsigned int nr)
+{
+	while (nr-- && map->old_pos < map->old_tablesize)
+		move_bucket(map, map->old_pos++);
+
+	if (map->old_pos >= map->old_tablesize) {
+		FREE_AND_NULL(map->old_table);
+		map->old_tablesize = 0;
+		map->old_pos = 0;
+	}
+}
+
+static int resize_incrementally(const struct hashmap *map)
+{
+	static int force = -1;
+
+	if (force < 0)
+		force = git_env_bool("GIT_TEST_HASHMAP_INCREMENTAL", 0);
+	return map->incremental_resize || force;
+}
+
 static void rehash(struct hashmap *map, unsigned int newsize)
 {
 	/* map->table MUST NOT be NULL when this function is called */
-	unsigned int i, oldsize = map->tablesize;
+	unsigned int oldsize = map->tablesize;
 	struct hashmap_entry **oldtable = map->table;
 
+	/* finish an incremental resize still in progress first */
+	if (map->old_table)
+		resize_step(map, map->old_tablesize);
+
 	alloc_table(map, newsize);
-	for (i = 0; i < oldsize; i++) {
-		struct hashmap_entry *e = oldtable[i];
-		while (e) {
-			struct hashmap_entry *next = e->next;
-			unsigned int b = bucket(map, e);
-			e->next = map->table[b];
-			map->table[b] = e;
-			e = next;
-		}
-	}
-	free(oldtable);
+	map->old_table = oldtable;
+	map->old_tablesize = oldsize;
+	map->old_pos = 0;
+
+	if (newsize < oldsize || !resize_incrementally(map))
+		resize_step(map, oldsize);
 }
 
 static inline struct hashmap_entry **find_entry_ptr(const struct hashmap *map,
@@ -139,6 +177,16 @@ static inline struct hashmap_entry **find_entry_ptr(const struct hashmap *map,
 	struct hashmap_entry **e = &map->table[bucket(map, key)];
 	while (*e && !entry_equals(map, *e, key, keydata))
 		e = &(*e)->next;
+
+	if (!*e && map->old_table) {
+		struct hashmap_entry **old;
+
+		old = &map->old_table[key->hash & (map->old_tablesize - 1)];
+		while (*old && !entry_equals(map, *old, key, keydata))
+			old = &(*old)->next;
+		if (*old)
+			return old;
+	}
 	return e;
 }
 
@@ -195,6 +243,9 @@ void hashmap_partial_clear_(struct hashmap *map, ssize_t entry_offset)
 	if (entry_offset >= 0)  /* called by hashmap_clear_entries */
 		free_individual_entries(map, entry_offset);
 	memset(map->table, 0, map->tablesize * sizeof(struct hashmap_entry *));
+	FREE_AND_NULL(map->old_table);
+	map->old_tablesize = 0;
+	map->old_pos = 0;
 	map->shrink_at = 0;
 	map->private_size = 0;
 }
@@ -206,6 +257,7 @@ void hashmap_clear_(struct hashmap *map, ssize_t entry_offset)
 	if (entry_offset >= 0)  /* called by hashmap_clear_and_free */
 		free_individual_entries(map, entry_offset);
 	free(map->table);
+	free(map->old_table);
 	memset(map, 0, sizeof(*map));
 }
 
@@ -235,6 +287,15 @@ void hashmap_add(struct hashmap *map, struct hashmap_entry *entry)
 	if (!map->table)
 		alloc_table(map, HASHMAP_INITIAL_SIZE);
 
+	/*
+	 * Keep the entries with the same hash in the same table, so that
+	 * hashmap_get_next() finds all of them.
+	 */
+	if (map->old_table) {
+		move_bucket(map, entry->hash & (map->old_tablesize - 1));
+		resize_step(map, HASHMAP_RESIZE_STEP);
+	}
+
 	b = bucket(map, entry);
 	/* add entry */
 	entry->next = map->table[b];
@@ -279,8 +340,24 @@ struct hashmap_entry *hashmap_remove(struct hashmap *map,
 struct hashmap_entry *hashmap_put(struct hashmap *map,
 				  struct hashmap_entry *entry)
 {
-	struct hashmap_entry *old = hashmap_remove(map, entry, NULL);
-	hashmap_add(map, entry);
+	struct hashmap_entry *old;
+	struct hashmap_entry **e;
+
+	if (!map->table) {
+		hashmap_add(map, entry);
+		return NULL;
+	}
+	e = find_entry_ptr(map, entry, NULL);
+	if (!*e) {
+		hashmap_add(map, entry);
+		return NULL;
+	}
+
+	/* replace the existing entry where it is */
+	old = *e;
+	entry->next = old->next;
+	*e = entry;
+	old->next = NULL;
 	return old;
 }
 
@@ -300,10 +377,14 @@ struct hashmap_entry *hashmap_iter_next(struct hashmap_iter *iter)
 			return current;
 		}
 
-		if (iter->tablepos >= iter->map->tablesize)
+		if (iter->tablepos < iter->map->tablesize)
+			current = iter->map->table[iter->tablepos++];
+		else if (iter->tablepos - iter->map->tablesize <
+			 iter->map->old_tablesize)
+			current = iter->map->old_table[iter->tablepos++ -
+						       iter->map->tablesize];
+		else
 			return NULL;
-
-		current = iter->map->table[iter->tablepos++];
 	}
 }
 
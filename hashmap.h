@@ -205,7 +205,17 @@ struct hashmap {
 	unsigned int grow_at;
 	unsigned int shrink_at;
 
+	/*
+	 * While the map is growing incrementally, the entries that have
+	 * not been moved to `table` yet are still in `old_table`, in the
+	 * buckets from `old_pos` on.
+	 */
+	struct hashmap_entry **old_table;
+	unsigned int old_tablesize;
+	unsigned int old_pos;
+
 	unsigned int do_count_items : 1;
+	unsigned int incremental_resize : 1;
 };
 
 /* hashmap functions */
@@ -538,6 +548,24 @@ static inline struct hashmap_entry *hashmap_iter_first(struct hashmap *map,
 		var; \
 		var = hashmap_get_next_entry(map, var, member))
 
+/*
+ * Grow the map incrementally.
+ *
+ * Normally, the hashmap moves all of its entries to a larger table at
+ * once when it becomes too full, which can take a noticeable while for
+ * maps with millions of entries.  With this, the old table is kept
+ * around instead and each of the additions that follow moves a few of
+ * its buckets to the new table, so no single addition pays for more
+ * than a handful of them.  Lookups look at both tables meanwhile.
+ *
+ * Only additions move entries around; shrinking the map when entries
+ * are removed still happens all at once.
+ */
+static inline void hashmap_enable_incremental_resize(struct hashmap *map)
+{
+	map->incremental_resize = 1;
+}
+
 /*
  * Disable item counting and automatic rehashing when adding/removing items.
  *
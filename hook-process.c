@@ -0,0 +1,145 @@
+#include "cache.h"
+#include "config.h"
+#include "hook-process.h"
+#include "pkt-line.h"
+#include "sigchain.h"
+#include "sub-process.h"
+
+#define CAP_REFERENCE_TRANSACTION (1u<<0)
+
+/* The hooks a long-running process can serve */
+static struct subprocess_capability hook_capabilities[] = {
+	{ "reference-transaction", CAP_REFERENCE_TRANSACTION },
+	{ NULL, 0 }
+};
+
+struct hook_process {
+	struct subprocess_entry subprocess; /* must be the first member! */
+	unsigned int supported_capabilities;
+};
+
+static int hook_process_map_initialized;
+static struct hashmap hook_process_map;
+
+static unsigned int hook_capability(const char *name)
+{
+	struct subprocess_capability *cap;
+
+	for (cap = hook_capabilities; cap->name; cap++)
+		if (!strcmp(cap->name, name))
+			return cap->flag;
+	return 0;
+}
+
+const char *find_hook_process(const char *name)
+{
+	const char *cmd;
+	char *key;
+	int ret;
+
+	if (!hook_capability(name))
+		return NULL;
+	key = xstrfmt("hook.%s.process", name);
+	ret = git_config_get_string_tmp(key, &cmd);
+	free(key);
+	return ret || !*cmd ? NULL : cmd;
+}
+
+static int start_hook_process_fn(struct subprocess_entry *subprocess)
+{
+	static int versions[] = {1, 0};
+	struct hook_process *entry = (struct hook_process *)subprocess;
+
+	return subprocess_handshake(subprocess, "git-hook", versions, NULL,
+				    hook_capabilities,
+				    &entry->supported_capabilities);
+}
+
+static void stop_hook_process(struct hook_process *entry)
+{
+	char *cmd = (char *)entry->subprocess.cmd;
+
+	subprocess_stop(&hook_process_map, &entry->subprocess);
+	free(cmd);
+	free(entry);
+}
+
+int run_hook_process(const char *name, const char **args,
+		     const struct strbuf *input)
+{
+	const char *cmd = find_hook_process(name);
+	unsigned int capability = hook_capability(name);
+	struct hook_process *entry;
+	struct child_process *process;
+	struct strbuf status = STRBUF_INIT;
+	int err;
+
+	if (!cmd)
+		BUG("no process serves the '%s' hook", name);
+
+	if (!hook_process_map_initialized) {
+		hook_process_map_initialized = 1;
+		hashmap_init(&hook_process_map, cmd2process_cmp, NULL, 0);
+		entry = NULL;
+	} else {
+		entry = (struct hook_process *)
+			subprocess_find_entry(&hook_process_map, cmd);
+	}
+
+	fflush(NULL);
+
+	if (!entry) {
+		char *dup = xstrdup(cmd);
+
+		entry = xmalloc(sizeof(*entry));
+		entry->supported_capabilities = 0;
+		if (subprocess_start(&hook_process_map, &entry->subprocess,
+				     dup, start_hook_process_fn)) {
+			free(dup);
+			free(entry);
+			return -1;
+		}
+	}
+	process = &entry->subprocess.process;
+
+	if (!(entry->supported_capabilities & capability))
+		return error(_("hook process '%s' does not handle the '%s' hook"),
+			     cmd, name);
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	err = packet_write_fmt_gently(process->in, "command=%s\n", name);
+	for (; !err && args && *args; args++) {
+		err = strlen(*args) > LARGE_PACKET_DATA_MAX - strlen("arg=\n");
+		if (err) {
+			error(_("argument too long for hook process"));
+			break;
+		}
+		err = packet_write_fmt_gently(process->in, "arg=%s\n", *args);
+	}
+	if (!err)
+		err = packet_flush_gently(process->in);
+	if (!err)
+		err = write_packetized_from_buf_no_flush(input->buf, input->len,
+							 process->in);
+	if (!err)
+		err = packet_flush_gently(process->in);
+	if (!err)
+		err = subprocess_read_status(process->out, &status);
+	if (!err)
+		err = strcmp(status.buf, "success");
+
+	sigchain_pop(SIGPIPE);
+
+	if (err && strcmp(status.buf, "error")) {
+		/*
+		 * Anything but a clean refusal means we cannot trust
+		 * where we are in the conversation; start afresh the
+		 * next time the hook fires.
+		 */
+		error(_("hook process '%s' failed"), cmd);
+		stop_hook_process(entry);
+	}
+	strbuf_release(&status);
+	return err ? -1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef HOOK_PROCESS_H
+#define HOOK_PROCESS_H
+
+struct strbuf;
+
+/*
+ * A hook can be served by a long-running process configured with
+ * "hook.<name>.process" instead of a new $GIT_DIR/hooks/<name> every
+ * time it fires.  The process is started on first use, talks the
+ * protocol described in linkgit:githooks[5] and lives as long as we
+ * do.  Only the hooks listed in hook-process.c can be served that way.
+ */
+
+/*
+ * Returns the command of the process serving hook "name", or NULL if
+ * it is to be run as usual.
+ */
+const char *find_hook_process(const char *name);
+
+/*
+ * Hand the event to the process serving hook "name".  "args" is the
+ * NULL-terminated list of arguments the hook would have been given and
+ * "input" what it would have read from its standard input.  Returns 0
+ * if the process answered with "status=success", and non-zero if it
+ * refused the event or could not be talked to.
+ */
+int run_hook_process(const char *name, const char **args,
+		     const struct strbuf *input);
+
+#endif /* HOOK_PROCESS_H */
@@ -49,25 +49,29 @@ static void fetch_single_packfile(struct object_id *packfile_hash,
 				  const char **index_pack_args) {
 	struct http_pack_request *preq;
 	struct slot_results results;
-	int ret;
+	int ret, attempt;
 
 	http_init(NULL, url, 0);
 
-	preq = new_direct_http_pack_request(packfile_hash->hash, xstrdup(url));
-	if (preq == NULL)
-		die("couldn't create http pack request");
-	preq->slot->results = &results;
-	preq->index_pack_args = index_pack_args;
-	preq->preserve_index_pack_stdout = 1;
-
-	if (start_active_slot(preq->slot)) {
+	for (attempt = 0;; attempt++) {
+		/* picks up after what an earlier attempt left in the .temp file */
+		preq = new_direct_http_pack_request(packfile_hash->hash,
+						    xstrdup(url));
+		if (preq == NULL)
+			die("couldn't create http pack request");
+		preq->slot->results = &results;
+		preq->index_pack_args = index_pack_args;
+		preq->preserve_index_pack_stdout = 1;
+
+		if (!start_active_slot(preq->slot))
+			die("Unable to start request");
 		run_active_slot(preq->slot);
-		if (results.curl_result != CURLE_OK) {
+		if (results.curl_result == CURLE_OK)
+			break;
+		if (!http_resume_download(results.curl_result, attempt, url))
 			die("Unable to get pack file %s\n%s", preq->url,
 			    curl_errorstr);
-		}
-	} else {
-		die("Unable to start request");
+		release_http_pack_request(preq);
 	}
 
 	if ((ret = finish_http_pack_request(preq)))
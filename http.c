@@ -28,6 +28,7 @@ static int min_curl_sessions = 1;
 static int curl_session_count;
 static int max_requests = -1;
 static CURLM *curlm;
+static CURLSH *curlsh;
 static CURL *curl_default;
 
 #define PREV_BUF_SIZE 4096
@@ -37,6 +38,7 @@ char curl_errorstr[CURL_ERROR_SIZE];
 static int curl_ssl_verify = -1;
 static int curl_ssl_try;
 static const char *curl_http_version = NULL;
+static int curl_multiplex = 1;
 static const char *ssl_cert;
 static const char *ssl_cipherlist;
 static const char *ssl_version;
@@ -65,6 +67,9 @@ static const char *ssl_pinnedkey;
 static const char *ssl_cainfo;
 static long curl_low_speed_limit = -1;
 static long curl_low_speed_time = -1;
+static int http_resume_retries = 5;
+/* the outcome of the last request, for http_get_file() */
+static CURLcode last_curl_result;
 static int curl_ftp_no_epsv;
 static const char *curl_http_proxy;
 static const char *http_proxy_authmethod;
@@ -253,6 +258,10 @@ static int http_options(const char *var, const char *value, void *cb)
 	if (!strcmp("http.version", var)) {
 		return git_config_string(&curl_http_version, var, value);
 	}
+	if (!strcmp("http.multiplex", var)) {
+		curl_multiplex = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp("http.sslverify", var)) {
 		curl_ssl_verify = git_config_bool(var, value);
 		return 0;
@@ -303,6 +312,10 @@ static int http_options(const char *var, const char *value, void *cb)
 		max_requests = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp("http.resumeretries", var)) {
+		http_resume_retries = git_config_int(var, value);
+		return 0;
+	}
 	if (!strcmp("http.lowspeedlimit", var)) {
 		curl_low_speed_limit = (long)git_config_int(var, value);
 		return 0;
@@ -783,6 +796,16 @@ static CURL *get_curl_handle(void)
 		}
     }
 #endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/*
+	 * Rather than opening a connection of our own, wait to see
+	 * whether the one being opened for another request can carry
+	 * ours, too, as HTTP/2 ones can.
+	 */
+	if (curl_multiplex)
+		curl_easy_setopt(result, CURLOPT_PIPEWAIT, 1L);
+#endif
+	curl_easy_setopt(result, CURLOPT_SHARE, curlsh);
 
 	curl_easy_setopt(result, CURLOPT_NETRC, CURL_NETRC_OPTIONAL);
 	curl_easy_setopt(result, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
@@ -1058,6 +1081,24 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 	curlm = curl_multi_init();
 	if (!curlm)
 		die("curl_multi_init failed");
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING,
+			  curl_multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+#endif
+
+	/*
+	 * The connections are kept by curlm, but each handle has its own
+	 * DNS and TLS session caches, which are lost when a slot's handle
+	 * is cleaned up.  Share them, so that a new handle can resume a
+	 * TLS session instead of going through a full handshake again.
+	 */
+	curlsh = curl_share_init();
+	if (!curlsh)
+		die("curl_share_init failed");
+	curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x071700
+	curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#endif
 
 	if (getenv("GIT_SSL_NO_VERIFY"))
 		curl_ssl_verify = 0;
@@ -1122,6 +1163,8 @@ void http_cleanup(void)
 	curl_easy_cleanup(curl_default);
 
 	curl_multi_cleanup(curlm);
+	curl_share_cleanup(curlsh);
+	curlsh = NULL;
 	curl_global_cleanup();
 
 	string_list_clear(&extra_http_headers, 0);
@@ -1221,6 +1264,7 @@ struct active_request_slot *get_active_slot(void)
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPGET, 1);
 	curl_easy_setopt(slot->curl, CURLOPT_FAILONERROR, 1);
 	curl_easy_setopt(slot->curl, CURLOPT_RANGE, NULL);
+	curl_easy_setopt(slot->curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)0);
 
 	/*
 	 * Default following to off unless "ALWAYS" is configured; this gives
@@ -1475,6 +1519,7 @@ static int handle_curl_result(struct slot_results *results)
 {
 	normalize_curl_result(&results->curl_result, results->http_code,
 			      curl_errorstr, sizeof(curl_errorstr));
+	last_curl_result = results->curl_result;
 
 	if (results->curl_result == CURLE_OK) {
 		credential_approve(&http_auth);
@@ -1740,11 +1785,39 @@ static const char *get_accept_language(void)
 	return cached_accept_language;
 }
 
+/*
+ * Unlike a plain Range header, this has curl fail the request when the
+ * server sends the whole file instead of the rest, rather than have it
+ * appended to what we have.
+ */
 static void http_opt_request_remainder(CURL *curl, off_t pos)
 {
-	char buf[128];
-	xsnprintf(buf, sizeof(buf), "%"PRIuMAX"-", (uintmax_t)pos);
-	curl_easy_setopt(curl, CURLOPT_RANGE, buf);
+	curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)pos);
+}
+
+int http_resume_download(CURLcode result, int attempt, const char *url)
+{
+	switch (result) {
+	case CURLE_PARTIAL_FILE:
+	case CURLE_RECV_ERROR:
+	case CURLE_SEND_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_COULDNT_CONNECT:
+		break;
+	default:
+		return 0;
+	}
+	if (attempt >= http_resume_retries)
+		return 0;
+
+	/* give a flaky link a moment to come back */
+	warning(_("download of '%s' interrupted: %s; resuming in %d s"),
+		url, curl_errorstr[0] ? curl_errorstr : curl_easy_strerror(result),
+		attempt + 1);
+	sleep_millisec(1000 * (attempt + 1));
+	curl_errorstr[0] = '\0';
+	return 1;
 }
 
 /* http_request() targets */
@@ -1936,16 +2009,10 @@ int http_get_strbuf(const char *url,
 	return http_request_reauth(url, result, HTTP_REQUEST_STRBUF, options);
 }
 
-/*
- * Downloads a URL and stores the result in the given file.
- *
- * If a previous interrupted download is detected (i.e. a previous temporary
- * file is still around) the download is resumed.
- */
-static int http_get_file(const char *url, const char *filename,
-			 struct http_get_options *options)
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options)
 {
-	int ret;
+	int ret, attempt;
 	struct strbuf tmpfile = STRBUF_INIT;
 	FILE *result;
 
@@ -1957,7 +2024,15 @@ static int http_get_file(const char *url, const char *filename,
 		goto cleanup;
 	}
 
-	ret = http_request_reauth(url, result, HTTP_REQUEST_FILE, options);
+	for (attempt = 0;; attempt++) {
+		ret = http_request_reauth(url, result, HTTP_REQUEST_FILE,
+					  options);
+		if (ret != HTTP_ERROR ||
+		    !http_resume_download(last_curl_result, attempt, url))
+			break;
+		/* the next request asks for what comes after */
+		fflush(result);
+	}
 	fclose(result);
 
 	if (ret == HTTP_OK && finalize_object_file(tmpfile.buf, filename))
@@ -2017,29 +2092,15 @@ static char *fetch_pack_index(unsigned char *hash, const char *base_url)
 	return tmp;
 }
 
-static int fetch_and_setup_pack_index(struct packed_git **packs_head,
-	unsigned char *sha1, const char *base_url)
+static int setup_pack_index(struct packed_git **packs_head,
+			    unsigned char *sha1, char *tmp_idx)
 {
 	struct packed_git *new_pack;
-	char *tmp_idx = NULL;
 	int ret;
 
-	if (has_pack_index(sha1)) {
-		new_pack = parse_pack_index(sha1, sha1_pack_index_name(sha1));
-		if (!new_pack)
-			return -1; /* parse_pack_index() already issued error message */
-		goto add_pack;
-	}
-
-	tmp_idx = fetch_pack_index(sha1, base_url);
-	if (!tmp_idx)
-		return -1;
-
 	new_pack = parse_pack_index(sha1, tmp_idx);
 	if (!new_pack) {
 		unlink(tmp_idx);
-		free(tmp_idx);
-
 		return -1; /* parse_pack_index() already issued error message */
 	}
 
@@ -2048,16 +2109,120 @@ static int fetch_and_setup_pack_index(struct packed_git **packs_head,
 		close_pack_index(new_pack);
 		ret = finalize_object_file(tmp_idx, sha1_pack_index_name(sha1));
 	}
-	free(tmp_idx);
 	if (ret)
 		return -1;
 
-add_pack:
 	new_pack->next = *packs_head;
 	*packs_head = new_pack;
 	return 0;
 }
 
+static int fetch_and_setup_pack_index(struct packed_git **packs_head,
+	unsigned char *sha1, const char *base_url)
+{
+	struct packed_git *new_pack;
+	char *tmp_idx = NULL;
+	int ret;
+
+	if (has_pack_index(sha1)) {
+		new_pack = parse_pack_index(sha1, sha1_pack_index_name(sha1));
+		if (!new_pack)
+			return -1; /* parse_pack_index() already issued error message */
+		new_pack->next = *packs_head;
+		*packs_head = new_pack;
+		return 0;
+	}
+
+	tmp_idx = fetch_pack_index(sha1, base_url);
+	if (!tmp_idx)
+		return -1;
+
+	ret = setup_pack_index(packs_head, sha1, tmp_idx);
+	free(tmp_idx);
+	return ret;
+}
+
+/*
+ * The download of the index of a pack we do not have, started by
+ * http_get_info_packs() alongside the others.
+ */
+struct pack_index_request {
+	unsigned char hash[GIT_MAX_RAWSZ];
+	char *url;
+	char *tmp;
+	FILE *file;
+	struct active_request_slot *slot;
+	struct slot_results results;
+	unsigned started : 1,
+		 done : 1;
+};
+
+static void process_pack_index_response(void *callback_data)
+{
+	struct pack_index_request *ireq = callback_data;
+
+	ireq->done = 1;
+}
+
+static void start_pack_index_request(struct pack_index_request *ireq,
+				     const char *base_url)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	end_url_with_slash(&buf, base_url);
+	strbuf_addf(&buf, "objects/pack/pack-%s.idx", hash_to_hex(ireq->hash));
+	ireq->url = strbuf_detach(&buf, NULL);
+	ireq->tmp = xstrfmt("%s.temp", sha1_pack_index_name(ireq->hash));
+
+	ireq->file = fopen(ireq->tmp, "w");
+	if (!ireq->file)
+		return;
+
+	if (http_is_verbose)
+		fprintf(stderr, "Getting index for pack %s\n",
+			hash_to_hex(ireq->hash));
+
+	ireq->slot = get_active_slot();
+	ireq->slot->results = &ireq->results;
+	ireq->slot->callback_func = process_pack_index_response;
+	ireq->slot->callback_data = ireq;
+	curl_easy_setopt(ireq->slot->curl, CURLOPT_WRITEDATA, ireq->file);
+	curl_easy_setopt(ireq->slot->curl, CURLOPT_WRITEFUNCTION, fwrite);
+	curl_easy_setopt(ireq->slot->curl, CURLOPT_URL, ireq->url);
+	curl_easy_setopt(ireq->slot->curl, CURLOPT_HTTPHEADER,
+			 no_pragma_header);
+	ireq->started = start_active_slot(ireq->slot);
+}
+
+/*
+ * Set up the index of a pack listed in objects/info/packs.  Those we
+ * did not have were all requested at once; we fall back to asking for
+ * one on its own, which takes care of authentication and of reporting
+ * errors, only when that did not work out.
+ */
+static void finish_pack_index_request(struct packed_git **packs_head,
+				      struct pack_index_request *ireq,
+				      const char *base_url)
+{
+	int ok = ireq->started;
+
+	while (ireq->started && !ireq->done)
+		run_active_slot(ireq->slot);
+
+	if (ireq->file && fclose(ireq->file))
+		ok = 0;
+	if (ok && ireq->results.curl_result == CURLE_OK)
+		ok = !setup_pack_index(packs_head, ireq->hash, ireq->tmp);
+	else if (ireq->file)
+		unlink(ireq->tmp);
+
+	if (!ok)
+		fetch_and_setup_pack_index(packs_head, ireq->hash, base_url);
+
+	free(ireq->url);
+	free(ireq->tmp);
+}
+
 int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 {
 	struct http_get_options options = {0};
@@ -2066,6 +2231,8 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 	const char *data;
 	struct strbuf buf = STRBUF_INIT;
 	struct object_id oid;
+	struct pack_index_request *ireq = NULL;
+	size_t nr = 0, alloc = 0, i;
 
 	end_url_with_slash(&buf, base_url);
 	strbuf_addstr(&buf, "objects/info/packs");
@@ -2082,7 +2249,10 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 		    !parse_oid_hex(data, &oid, &data) &&
 		    skip_prefix(data, ".pack", &data) &&
 		    (*data == '\n' || *data == '\0')) {
-			fetch_and_setup_pack_index(packs_head, oid.hash, base_url);
+			ALLOC_GROW(ireq, nr + 1, alloc);
+			memset(&ireq[nr], 0, sizeof(*ireq));
+			hashcpy(ireq[nr].hash, oid.hash);
+			nr++;
 		} else {
 			data = strchrnul(data, '\n');
 		}
@@ -2090,7 +2260,25 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 			data++; /* skip past newline */
 	}
 
+	/*
+	 * Ask for all the indices we lack at once, as many at a time as
+	 * http.maxRequests allows, and only then wait for them in turn.
+	 */
+	for (i = 0; i < nr; i++)
+		if (!has_pack_index(ireq[i].hash))
+			start_pack_index_request(&ireq[i], base_url);
+	for (i = 0; i < nr; i++) {
+		if (ireq[i].url)
+			finish_pack_index_request(packs_head, &ireq[i],
+						  base_url);
+		else
+			fetch_and_setup_pack_index(packs_head, ireq[i].hash,
+						   base_url);
+	}
+
 cleanup:
+	free(ireq);
+	strbuf_release(&buf);
 	free(url);
 	return ret;
 }
@@ -162,6 +162,16 @@ struct http_get_options {
  */
 int http_get_strbuf(const char *url, struct strbuf *result, struct http_get_options *options);
 
+/*
+ * Downloads a URL and stores the result in the given file.
+ *
+ * If a previous interrupted download is detected (i.e. a previous temporary
+ * file is still around) the download is resumed, as is one that gets
+ * interrupted now (see http_resume_download()).
+ */
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options);
+
 int http_fetch_ref(const char *base, struct ref *ref);
 
 /* Helpers for fetching packs */
@@ -189,6 +199,14 @@ struct http_pack_request *new_http_pack_request(
 struct http_pack_request *new_direct_http_pack_request(
 	const unsigned char *packed_git_hash, char *url);
 int finish_http_pack_request(struct http_pack_request *preq);
+
+/*
+ * Whether a download that failed with "result" on its "attempt"th try
+ * (counting from 0) is worth resuming, after waiting a little, with a
+ * request for the rest of the file: up to http.resumeRetries times,
+ * when the transfer was cut off rather than refused.
+ */
+int http_resume_download(CURLcode result, int attempt, const char *url);
 void release_http_pack_request(struct http_pack_request *preq);
 
 /*
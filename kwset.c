@@ -84,6 +84,8 @@ struct kwset
   struct trie *next[NCHAR];	/* Table of children of the root. */
   char *target;			/* Target string if there's only one. */
   int mind2;			/* Used in Boyer-Moore search for one string. */
+  int rare;			/* Offset in target of the byte to memchr for. */
+  unsigned char rarebyte;	/* The text byte to memchr for. */
   unsigned char const *trans;  /* Character translation table. */
 };
 
@@ -115,6 +117,7 @@ kwsalloc (unsigned char const *trans)
   kwset->mind = INT_MAX;
   kwset->maxd = -1;
   kwset->target = NULL;
+  kwset->rare = -1;
   kwset->trans = trans;
 
   return (kwset_t) kwset;
@@ -377,6 +380,48 @@ treenext (struct tree const *tree, struct trie *next[])
   next[tree->label] = tree->trie;
 }
 
+/* Bytes in roughly decreasing order of how often they appear in source
+   code and prose.  Bytes not listed are taken to be rarer than any that
+   are. */
+static char const common_bytes[] =
+  " etaoinsrlcdhu\n\t.pm_(),;=fgb\"y-/*w:0>{}1vxk'E#T2SIRACLNO<D[]P&M!F"
+  "3+4B5UH6G98q7z|jV%WKYXJQZ$@?\\^~`";
+
+/* Pick the byte of a single keyword least likely to be in the text, for
+   memexec() to look for with memchr(), which the C library typically
+   vectorizes.  memchr() looks for one byte only, so with a translation
+   table only a byte that no other byte translates to will do. */
+static void
+findrare (struct kwset *kwset)
+{
+  unsigned char rank[NCHAR];
+  unsigned char const *trans = kwset->trans;
+  int i, c, b, n, only;
+
+  memset(rank, UCHAR_MAX, NCHAR);
+  for (i = 0; common_bytes[i]; ++i)
+    rank[U(common_bytes[i])] = i;
+
+  for (i = 0; i < kwset->mind; ++i)
+    {
+      c = U(kwset->target[i]);
+      if (trans)
+	{
+	  for (b = n = only = 0; b < NCHAR && n < 2; ++b)
+	    if (trans[b] == c)
+	      only = b, ++n;
+	  if (n != 1)
+	    continue;
+	  c = only;
+	}
+      if (kwset->rare < 0 || rank[c] > rank[kwset->rarebyte])
+	{
+	  kwset->rare = i;
+	  kwset->rarebyte = c;
+	}
+    }
+}
+
 /* Compute the shift for each trie node, as well as the delta
    table and next cache for the given keyword set. */
 const char *
@@ -395,12 +440,8 @@ kwsprep (kwset_t kws)
      node at which an outgoing edge is labeled by that character. */
   memset(delta, kwset->mind < UCHAR_MAX ? kwset->mind : UCHAR_MAX, NCHAR);
 
-  /* Check if we can use the simple boyer-moore algorithm, instead
-     of the hairy commentz-walter algorithm. */
-  if (kwset->words == 1 && kwset->trans == NULL)
+  if (kwset->words == 1)
     {
-      char c;
-
       /* Looking for just one string.  Extract it from the trie. */
       kwset->target = obstack_alloc(&kwset->obstack, kwset->mind);
       if (!kwset->target)
@@ -410,6 +451,15 @@ kwsprep (kwset_t kws)
 	  kwset->target[i] = curr->links->label;
 	  curr = curr->links->trie;
 	}
+      findrare(kwset);
+    }
+
+  /* Check if we can use the simple boyer-moore algorithm, instead
+     of the hairy commentz-walter algorithm. */
+  if (kwset->words == 1 && kwset->trans == NULL)
+    {
+      char c;
+
       /* Build the Boyer Moore delta.  Boy that's easy compared to CW. */
       for (i = 0; i < kwset->mind; ++i)
 	delta[U(kwset->target[i])] = kwset->mind - (i + 1);
@@ -736,6 +786,56 @@ cwexec (kwset_t kws, char const *text, size_t len, struct kwsmatch *kwsmatch)
   return mch - text;
 }
 
+/* How many bytes memchr() has to skip per candidate on average, in
+   multiples of the keyword length, for memexec() to keep using it. */
+#define MEMEXEC_MIN_SKIP 4
+/* How many candidates memexec() checks between looking at that. */
+#define MEMEXEC_TRIES 64
+
+/* Search for a single keyword by looking for its rarest byte with
+   memchr() and checking the keyword around each one found.  When that
+   byte turns out not to be rare in this text, leave the rest of it to
+   the other searches, which skip ahead by table lookups instead. */
+static size_t
+memexec (kwset_t kws, char const *text, size_t size)
+{
+  struct kwset const *kwset = (struct kwset const *) kws;
+  unsigned char const *trans = kwset->trans;
+  char const *target = kwset->target;
+  size_t len = kwset->mind, tries = 0, i, ret;
+  char const *tp = text, *lim, *cand;
+
+  if (len > size)
+    return -1;
+  lim = text + size - len;
+  while (tp <= lim)
+    {
+      cand = memchr(tp + kwset->rare, kwset->rarebyte, lim - tp + 1);
+      if (!cand)
+	return -1;
+      cand -= kwset->rare;
+      if (trans)
+	for (i = 0; i < len && trans[U(cand[i])] == U(target[i]); ++i)
+	  ;
+      else
+	i = memcmp(cand, target, len) ? 0 : len;
+      if (i == len)
+	return cand - text;
+      tp = cand + 1;
+      if (++tries % MEMEXEC_TRIES == 0 &&
+	  tp - text < tries * len * MEMEXEC_MIN_SKIP)
+	break;
+    }
+  if (tp > lim)
+    return -1;
+
+  if (trans)
+    ret = cwexec(kws, tp, text + size - tp, NULL);
+  else
+    ret = bmexec(kws, tp, text + size - tp);
+  return ret == (size_t) -1 ? ret : ret + (tp - text);
+}
+
 /* Search through the given text for a match of any member of the
    given keyword set.  Return a pointer to the first character of
    the matching substring, or NULL if no match is found.  If FOUNDLEN
@@ -748,9 +848,10 @@ kwsexec (kwset_t kws, char const *text, size_t size,
 	 struct kwsmatch *kwsmatch)
 {
   struct kwset const *kwset = (struct kwset *) kws;
-  if (kwset->words == 1 && kwset->trans == NULL)
+  if (kwset->rare >= 0 || (kwset->words == 1 && kwset->trans == NULL))
     {
-      size_t ret = bmexec (kws, text, size);
+      size_t ret = kwset->rare >= 0 ? memexec(kws, text, size)
+				    : bmexec(kws, text, size);
       if (kwsmatch != NULL && ret != (size_t) -1)
 	{
 	  kwsmatch->index = 0;
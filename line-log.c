@@ -16,6 +16,8 @@
 #include "line-log.h"
 #include "strvec.h"
 #include "bloom.h"
+#include "strmap.h"
+#include "json-writer.h"
 
 static void range_set_grow(struct range_set *rs, size_t extra)
 {
@@ -1147,35 +1149,84 @@ int line_log_print(struct rev_info *rev, struct commit *commit)
 	return 1;
 }
 
+/*
+ * The Bloom keys of the tracked paths (and their leading directories),
+ * so that they are hashed once instead of once for every commit.
+ * The paths change only when we follow a rename, so there are few.
+ */
+static struct strmap bloom_keyvecs = STRMAP_INIT;
+
+static int bloom_filter_atexit_registered;
+static intmax_t count_bloom_filter_not_present;
+static intmax_t count_bloom_filter_maybe;
+static intmax_t count_bloom_filter_definitely_not;
+
+static void trace2_bloom_filter_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "filter_not_present", count_bloom_filter_not_present);
+	jw_object_intmax(&jw, "maybe", count_bloom_filter_maybe);
+	jw_object_intmax(&jw, "definitely_not", count_bloom_filter_definitely_not);
+	jw_end(&jw);
+
+	trace2_data_json("bloom", the_repository, "line-log/statistics", &jw);
+
+	jw_release(&jw);
+}
+
+static const struct bloom_keyvec *get_bloom_keyvec(struct rev_info *rev,
+						   const char *path)
+{
+	struct bloom_keyvec *vec = strmap_get(&bloom_keyvecs, path);
+
+	if (!vec) {
+		vec = bloom_keyvec_new(path, strlen(path),
+				       rev->bloom_filter_settings);
+		strmap_put(&bloom_keyvecs, path, vec);
+	}
+	return vec;
+}
+
+/*
+ * Return 0 if the changed-path Bloom filter of "commit" says that none
+ * of the paths in "range" changed relative to its first parent, and 1
+ * if they may have (or there is no filter to tell).
+ */
 static int bloom_filter_check(struct rev_info *rev,
 			      struct commit *commit,
 			      struct line_log_data *range)
 {
 	struct bloom_filter *filter;
-	struct bloom_key key;
 	int result = 0;
 
 	if (!commit->parents)
 		return 1;
 
-	if (!rev->bloom_filter_settings ||
-	    !(filter = get_bloom_filter(rev->repo, commit)))
+	if (!rev->bloom_filter_settings)
 		return 1;
 
-	if (!range)
-		return 0;
-
-	while (!result && range) {
-		fill_bloom_key(range->path, strlen(range->path), &key, rev->bloom_filter_settings);
-
-		if (bloom_filter_contains(filter, &key, rev->bloom_filter_settings))
-			result = 1;
+	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
+		atexit(trace2_bloom_filter_statistics_atexit);
+		bloom_filter_atexit_registered = 1;
+	}
 
-		clear_bloom_key(&key);
-		range = range->next;
+	if (!(filter = get_bloom_filter(rev->repo, commit))) {
+		count_bloom_filter_not_present++;
+		return 1;
 	}
 
-	return result;
+	for (; !result && range; range = range->next)
+		result = bloom_filter_contains_vec(filter,
+						   get_bloom_keyvec(rev, range->path),
+						   rev->bloom_filter_settings);
+
+	if (result)
+		count_bloom_filter_maybe++;
+	else
+		count_bloom_filter_definitely_not++;
+	return !!result;
 }
 
 static int process_ranges_ordinary_commit(struct rev_info *rev, struct commit *commit,
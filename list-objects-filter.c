@@ -828,3 +828,8 @@ void list_objects_filter__free(struct filter *filter)
 	filter->free_fn(filter->filter_data);
 	free(filter);
 }
+
+void list_objects_filter__clear_marks(void)
+{
+	clear_object_flags(FILTER_SHOWN_BUT_REVISIT);
+}
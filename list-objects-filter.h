@@ -94,4 +94,10 @@ enum list_objects_filter_result list_objects_filter__filter_object(
  */
 void list_objects_filter__free(struct filter *filter);
 
+/*
+ * Clears the marks that filters leave on the objects they have seen, so
+ * that another filtered traversal over the same objects starts afresh.
+ */
+void list_objects_filter__clear_marks(void);
+
 #endif /* LIST_OBJECTS_FILTER_H */
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "tag.h"
 #include "commit.h"
 #include "tree.h"
@@ -12,6 +13,11 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "trace.h"
+#include "oidmap.h"
+#include "thread-utils.h"
+#include "promisor-remote.h"
+
+struct tree_prefetch;
 
 struct traversal_context {
 	struct rev_info *revs;
@@ -19,8 +25,14 @@ struct traversal_context {
 	show_commit_fn show_commit;
 	void *show_data;
 	struct filter *filter;
+	enum list_objects_filter_choice filter_choice;
+	struct tree_prefetch *prefetch;
 };
 
+static void *take_prefetched_tree(struct tree_prefetch *pf,
+				  const struct object_id *oid,
+				  unsigned long *size);
+
 static void process_blob(struct traversal_context *ctx,
 			 struct blob *blob,
 			 struct strbuf *path,
@@ -168,6 +180,16 @@ static void process_tree(struct traversal_context *ctx,
 	    !revs->include_check_obj(&tree->object, revs->include_check_data))
 		return;
 
+	if (ctx->prefetch) {
+		unsigned long size;
+		void *buf = take_prefetched_tree(ctx->prefetch, &obj->oid, &size);
+
+		if (buf && !obj->parsed)
+			parse_tree_buffer(tree, buf, size);
+		else
+			free(buf);
+	}
+
 	failed_parse = parse_tree_gently(tree, 1);
 	if (failed_parse) {
 		if (revs->ignore_missing_links)
@@ -337,6 +359,285 @@ static void add_pending_tree(struct rev_info *revs, struct tree *tree)
 	add_pending_object(revs, &tree->object, "");
 }
 
+/*
+ * The traversal has to go in order on a single thread to show the
+ * objects in the same order every time, but it spends much of its
+ * time waiting for trees to be read and inflated.  Worker threads
+ * read the trees ahead of it: they share a stack of trees to read,
+ * seeded with the root trees to traverse, and push the subtrees of
+ * each tree they read so that the stack follows the depth-first order
+ * of the traversal.  The buffers are parked in "trees" until
+ * process_tree() asks for them.
+ *
+ * The workers only read objects.  Object lookups, flags and everything
+ * else stay with the traversal, which takes the object read lock
+ * around the show_object callback, as that may look into packs.
+ */
+
+/* Stop reading ahead while this much is parked */
+#define TREE_PREFETCH_LIMIT (64 * 1024 * 1024)
+
+/* Do not bother with threads for fewer root trees */
+#define MIN_TREE_PREFETCH_ROOTS 4
+
+enum prefetched_state {
+	PREFETCH_READING,
+	PREFETCH_READY,
+	/* taken or to be read by the traversal itself */
+	PREFETCH_TAKEN
+};
+
+struct prefetched_tree {
+	struct oidmap_entry entry;
+	enum prefetched_state state;
+	void *buf;
+	unsigned long size;
+};
+
+struct tree_prefetch {
+	struct repository *repo;
+
+	show_object_fn show_object;
+	void *show_data;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int nr_threads;
+	/* the fields below are protected by "mutex" */
+	struct object_id *todo;
+	size_t nr_todo, alloc_todo;
+	int busy;
+	struct oidmap trees;
+	size_t parked;
+	int stop;
+};
+
+static void show_object_locked(struct object *obj, const char *name,
+			       void *data)
+{
+	struct tree_prefetch *pf = data;
+
+	obj_read_lock();
+	pf->show_object(obj, name, pf->show_data);
+	obj_read_unlock();
+}
+
+/* Push the trees that nobody has claimed yet, the first one last. */
+static void push_prefetch_todo(struct tree_prefetch *pf,
+			       const struct object_id *oid, size_t nr)
+{
+	while (nr--) {
+		if (oidmap_get(&pf->trees, &oid[nr]))
+			continue;
+		ALLOC_GROW(pf->todo, pf->nr_todo + 1, pf->alloc_todo);
+		oidcpy(&pf->todo[pf->nr_todo++], &oid[nr]);
+	}
+}
+
+static void *tree_prefetch_worker(void *data)
+{
+	struct tree_prefetch *pf = data;
+	struct object_id *subtrees = NULL;
+	size_t nr_subtrees, alloc_subtrees = 0;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		struct prefetched_tree *t;
+		struct object_id oid;
+		struct tree_desc desc;
+		struct name_entry entry;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		if (!pf->stop &&
+		    (pf->parked > TREE_PREFETCH_LIMIT || !pf->nr_todo)) {
+			/* nothing left to read once the others are done */
+			if (!pf->nr_todo && !pf->busy)
+				break;
+			pthread_cond_wait(&pf->cond, &pf->mutex);
+			continue;
+		}
+		if (pf->stop)
+			break;
+
+		oidcpy(&oid, &pf->todo[--pf->nr_todo]);
+		if (oidmap_get(&pf->trees, &oid))
+			continue;
+		CALLOC_ARRAY(t, 1);
+		oidcpy(&t->entry.oid, &oid);
+		t->state = PREFETCH_READING;
+		oidmap_put(&pf->trees, t);
+		pf->busy++;
+		pthread_mutex_unlock(&pf->mutex);
+
+		buf = repo_read_object_file(pf->repo, &oid, &type, &size);
+		if (buf && type != OBJ_TREE)
+			FREE_AND_NULL(buf);
+
+		/* look inside before the traversal may take it from us */
+		nr_subtrees = 0;
+		if (buf && !init_tree_desc_gently(&desc, buf, size)) {
+			while (tree_entry_gently(&desc, &entry)) {
+				if (!S_ISDIR(entry.mode))
+					continue;
+				ALLOC_GROW(subtrees, nr_subtrees + 1,
+					   alloc_subtrees);
+				oidcpy(&subtrees[nr_subtrees++], &entry.oid);
+			}
+		}
+
+		pthread_mutex_lock(&pf->mutex);
+		t = oidmap_get(&pf->trees, &oid);
+		if (buf) {
+			t->state = PREFETCH_READY;
+			t->buf = buf;
+			t->size = size;
+			pf->parked += size;
+		} else {
+			t->state = PREFETCH_TAKEN;
+		}
+		push_prefetch_todo(pf, subtrees, nr_subtrees);
+		pf->busy--;
+		pthread_cond_broadcast(&pf->cond);
+	}
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+
+	free(subtrees);
+	return NULL;
+}
+
+static struct tree_prefetch *start_tree_prefetch(struct traversal_context *ctx)
+{
+	struct rev_info *revs = ctx->revs;
+	struct tree_prefetch *pf;
+	struct object_id *roots = NULL;
+	size_t nr_roots = 0, alloc_roots = 0;
+	int nr_threads, i;
+
+	if (!HAVE_THREADS || !revs->tree_objects || revs->diffopt.pathspec.nr ||
+	    revs->exclude_promisor_objects || has_promisor_remote())
+		return NULL;
+	/* these may leave most of the trees alone */
+	if (ctx->filter_choice != LOFC_DISABLED &&
+	    ctx->filter_choice != LOFC_BLOB_NONE &&
+	    ctx->filter_choice != LOFC_BLOB_LIMIT)
+		return NULL;
+	nr_threads = git_env_ulong("GIT_TEST_LIST_OBJECTS_THREADS", 0);
+	if (!nr_threads && (nr_threads = online_cpus()) < 2)
+		return NULL;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+
+		if (obj->type != OBJ_TREE ||
+		    (obj->flags & (UNINTERESTING | SEEN)) || obj->parsed)
+			continue;
+		ALLOC_GROW(roots, nr_roots + 1, alloc_roots);
+		oidcpy(&roots[nr_roots++], &obj->oid);
+	}
+	if (!nr_roots || (nr_roots < MIN_TREE_PREFETCH_ROOTS &&
+			  !git_env_ulong("GIT_TEST_LIST_OBJECTS_THREADS", 0))) {
+		free(roots);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(pf, 1);
+	pf->repo = revs->repo;
+	oidmap_init(&pf->trees, 0);
+	push_prefetch_todo(pf, roots, nr_roots);
+	free(roots);
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+	enable_obj_read_lock();
+
+	pf->show_object = ctx->show_object;
+	pf->show_data = ctx->show_data;
+	ctx->show_object = show_object_locked;
+	ctx->show_data = pf;
+
+	CALLOC_ARRAY(pf->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&pf->threads[pf->nr_threads], NULL,
+				   tree_prefetch_worker, pf))
+			break;
+		pf->nr_threads++;
+	}
+	trace2_data_intmax("list-objects", revs->repo,
+			   "prefetch/threads", pf->nr_threads);
+	return pf;
+}
+
+static void stop_tree_prefetch(struct traversal_context *ctx)
+{
+	struct tree_prefetch *pf = ctx->prefetch;
+	struct oidmap_iter iter;
+	struct prefetched_tree *t;
+	int i;
+
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->stop = 1;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+	for (i = 0; i < pf->nr_threads; i++)
+		pthread_join(pf->threads[i], NULL);
+	disable_obj_read_lock();
+
+	ctx->show_object = pf->show_object;
+	ctx->show_data = pf->show_data;
+	ctx->prefetch = NULL;
+
+	oidmap_iter_init(&pf->trees, &iter);
+	while ((t = oidmap_iter_next(&iter)))
+		free(t->buf);
+	oidmap_free(&pf->trees, 1);
+	pthread_cond_destroy(&pf->cond);
+	pthread_mutex_destroy(&pf->mutex);
+	free(pf->threads);
+	free(pf->todo);
+	free(pf);
+}
+
+/*
+ * Return the buffer of the tree "oid" if a worker has read it, waiting
+ * for it if it is being read right now, or NULL if the caller has to
+ * read it itself.
+ */
+static void *take_prefetched_tree(struct tree_prefetch *pf,
+				  const struct object_id *oid,
+				  unsigned long *size)
+{
+	struct prefetched_tree *t;
+	void *buf = NULL;
+
+	pthread_mutex_lock(&pf->mutex);
+	t = oidmap_get(&pf->trees, oid);
+	if (!t) {
+		/* do not let the workers read it after all */
+		CALLOC_ARRAY(t, 1);
+		oidcpy(&t->entry.oid, oid);
+		t->state = PREFETCH_TAKEN;
+		oidmap_put(&pf->trees, t);
+	}
+	while (t->state == PREFETCH_READING)
+		pthread_cond_wait(&pf->cond, &pf->mutex);
+	if (t->state == PREFETCH_READY) {
+		buf = t->buf;
+		*size = t->size;
+		t->buf = NULL;
+		t->state = PREFETCH_TAKEN;
+		pf->parked -= *size;
+		pthread_cond_broadcast(&pf->cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return buf;
+}
+
 static void traverse_trees_and_blobs(struct traversal_context *ctx,
 				     struct strbuf *base)
 {
@@ -344,6 +645,8 @@ static void traverse_trees_and_blobs(struct traversal_context *ctx,
 
 	assert(base->len == 0);
 
+	ctx->prefetch = start_tree_prefetch(ctx);
+
 	for (i = 0; i < ctx->revs->pending.nr; i++) {
 		struct object_array_entry *pending = ctx->revs->pending.objects + i;
 		struct object *obj = pending->item;
@@ -368,6 +671,7 @@ static void traverse_trees_and_blobs(struct traversal_context *ctx,
 		die("unknown pending object %s (%s)",
 		    oid_to_hex(&obj->oid), name);
 	}
+	stop_tree_prefetch(ctx);
 	object_array_clear(&ctx->revs->pending);
 }
 
@@ -427,6 +731,8 @@ void traverse_commit_list(struct rev_info *revs,
 	ctx.show_object = show_object;
 	ctx.show_data = show_data;
 	ctx.filter = NULL;
+	ctx.filter_choice = LOFC_DISABLED;
+	ctx.prefetch = NULL;
 	do_traverse(&ctx);
 }
 
@@ -445,6 +751,9 @@ void traverse_commit_list_filtered(
 	ctx.show_commit = show_commit;
 	ctx.show_data = show_data;
 	ctx.filter = list_objects_filter__init(omitted, filter_options);
+	ctx.filter_choice = filter_options ? filter_options->choice :
+					     LOFC_DISABLED;
+	ctx.prefetch = NULL;
 	do_traverse(&ctx);
 	list_objects_filter__free(ctx.filter);
 }
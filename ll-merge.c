@@ -128,6 +128,7 @@ static int ll_xdl_merge(const struct ll_merge_driver *drv_unused,
 	xmp.xpp.flags = opts->xdl_opts;
 	if (git_xmerge_style >= 0)
 		xmp.style = git_xmerge_style;
+	xmp.segment_size = git_xmerge_segment_size;
 	if (marker_size > 0)
 		xmp.marker_size = marker_size;
 	xmp.ancestor = orig_name;
@@ -406,6 +407,49 @@ int ll_merge(mmbuffer_t *result_buf,
 			  opts, marker_size);
 }
 
+int ll_merge_text_marker_size(struct index_state *istate, const char *path,
+			      const struct ll_merge_options *opts)
+{
+	struct attr_check *check = load_merge_attributes();
+	int marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	const struct ll_merge_driver *driver;
+
+	if (opts->renormalize)
+		return -1;
+
+	git_check_attr(istate, path, check);
+	if (check->items[1].value) {
+		marker_size = atoi(check->items[1].value);
+		if (marker_size <= 0)
+			marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	}
+	driver = find_ll_merge_driver(check->items[0].value);
+	if (opts->virtual_ancestor && driver->recursive)
+		driver = find_ll_merge_driver(driver->recursive);
+	if (driver->fn != ll_xdl_merge)
+		return -1;
+	return marker_size + opts->extra_marker_size;
+}
+
+int ll_merge_text(mmbuffer_t *result_buf,
+		  mmfile_t *ancestor, const char *ancestor_label,
+		  mmfile_t *ours, const char *our_label,
+		  mmfile_t *theirs, const char *their_label,
+		  const struct ll_merge_options *opts, int marker_size)
+{
+	if (ancestor->size > MAX_XDIFF_SIZE ||
+	    ours->size > MAX_XDIFF_SIZE ||
+	    theirs->size > MAX_XDIFF_SIZE ||
+	    buffer_is_binary(ancestor->ptr, ancestor->size) ||
+	    buffer_is_binary(ours->ptr, ours->size) ||
+	    buffer_is_binary(theirs->ptr, theirs->size))
+		return -1;
+	return ll_xdl_merge(NULL, result_buf, NULL,
+			    ancestor, ancestor_label,
+			    ours, our_label, theirs, their_label,
+			    opts, marker_size);
+}
+
 int ll_merge_marker_size(struct index_state *istate, const char *path)
 {
 	static struct attr_check *check;
@@ -96,6 +96,27 @@ int ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts);
 
+/**
+ * The two halves of ll_merge() for paths that are merged by the built-in
+ * "text" driver, so that the merge itself can be done without looking
+ * at attributes, e.g. in another thread.
+ *
+ * ll_merge_text_marker_size() returns the size of the conflict markers
+ * ll_merge() would use for `path` with `opts`, or -1 if ll_merge() would
+ * use another driver or renormalize the files first.
+ *
+ * ll_merge_text() then merges like ll_merge() would, given that marker
+ * size, except that it returns -1 without doing anything when any of
+ * the files is binary or too large; ll_merge() must be used for those.
+ */
+int ll_merge_text_marker_size(struct index_state *istate, const char *path,
+			      const struct ll_merge_options *opts);
+int ll_merge_text(mmbuffer_t *result_buf,
+		  mmfile_t *ancestor, const char *ancestor_label,
+		  mmfile_t *ours, const char *our_label,
+		  mmfile_t *theirs, const char *their_label,
+		  const struct ll_merge_options *opts, int marker_size);
+
 int ll_merge_marker_size(struct index_state *istate, const char *path);
 void reset_merge_attributes(void);
 
@@ -6,10 +6,14 @@
 #include "ls-refs.h"
 #include "pkt-line.h"
 #include "config.h"
+#include "dir.h"
+#include "tempfile.h"
 
 static int config_read;
 static int advertise_unborn;
 static int allow_unborn;
+static int use_cache;
+static int cache_limit = 16;
 
 static void ensure_config_read(void)
 {
@@ -37,6 +41,10 @@ static void ensure_config_read(void)
 			die(_("invalid value '%s' for lsrefs.unborn"), str);
 		}
 	}
+	repo_config_get_bool(the_repository, "lsrefs.cache", &use_cache);
+	if (!repo_config_get_int(the_repository, "lsrefs.cachelimit",
+				 &cache_limit) && cache_limit < 1)
+		die(_("lsrefs.cacheLimit must be positive"));
 	config_read = 1;
 }
 
@@ -66,6 +74,14 @@ struct ls_refs_data {
 	unsigned symrefs;
 	struct strvec prefixes;
 	unsigned unborn : 1;
+
+	/* if non-NULL, the advertisement is collected here */
+	struct strbuf *out;
+	/* otherwise it is sent with this */
+	struct packet_writer writer;
+
+	/* what the hideRefs configuration adds to the cache key */
+	struct strbuf hidden;
 };
 
 static int send_ref(const char *refname, const struct object_id *oid,
@@ -105,7 +121,10 @@ static int send_ref(const char *refname, const struct object_id *oid,
 	}
 
 	strbuf_addch(&refline, '\n');
-	packet_write(1, refline.buf, refline.len);
+	if (data->out)
+		packet_buf_write_len(data->out, refline.buf, refline.len);
+	else
+		packet_writer_write_len(&data->writer, refline.buf, refline.len);
 
 	strbuf_release(&refline);
 	return 0;
@@ -128,8 +147,14 @@ static void send_possibly_unborn_head(struct ls_refs_data *data)
 	strbuf_release(&namespaced);
 }
 
-static int ls_refs_config(const char *var, const char *value, void *data)
+static int ls_refs_config(const char *var, const char *value, void *cb_data)
 {
+	struct ls_refs_data *data = cb_data;
+
+	if (value && (!strcmp(var, "transfer.hiderefs") ||
+		      !strcmp(var, "uploadpack.hiderefs")))
+		strbuf_addf(&data->hidden, "%s=%s\n", var, value);
+
 	/*
 	 * We only serve fetches over v2 for now, so respect only "uploadpack"
 	 * config. This may need to eventually be expanded to "receive", but we
@@ -138,16 +163,216 @@ static int ls_refs_config(const char *var, const char *value, void *data)
 	return parse_hide_refs_config(var, value, "uploadpack");
 }
 
+static void add_stat_to_cache_key(struct strbuf *key, const char *path,
+				  const struct stat *st, timestamp_t *newest)
+{
+	strbuf_addf(key, "%s %"PRIuMAX" %"PRIuMAX" %"PRIuMAX".%u %"PRIuMAX"\n",
+		    path, (uintmax_t)st->st_ino, (uintmax_t)st->st_size,
+		    (uintmax_t)st->st_mtime, (unsigned)ST_MTIME_NSEC(*st),
+		    (uintmax_t)st->st_ctime);
+	if (*newest < st->st_mtime)
+		*newest = st->st_mtime;
+}
+
+/*
+ * Every update of a loose ref renames a lockfile into its directory,
+ * and packed-refs is replaced as a whole, so the stat information of
+ * these directories and files changes whenever any ref does.
+ */
+static void add_refs_dir_to_cache_key(struct strbuf *key, struct strbuf *path,
+				      timestamp_t *newest)
+{
+	size_t len = path->len;
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+
+	if (lstat(path->buf, &st))
+		return;
+	add_stat_to_cache_key(key, path->buf, &st, newest);
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return;
+	while ((de = readdir(dir))) {
+		int dtype = DTYPE(de);
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, de->d_name);
+		if (dtype == DT_UNKNOWN && !lstat(path->buf, &st))
+			dtype = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		if (dtype == DT_DIR)
+			add_refs_dir_to_cache_key(key, path, newest);
+		strbuf_setlen(path, len);
+	}
+	closedir(dir);
+}
+
+static void add_ref_files_to_cache_key(struct strbuf *key, const char *path,
+				       timestamp_t *newest)
+{
+	struct stat st;
+
+	if (!lstat(path, &st))
+		add_stat_to_cache_key(key, path, &st, newest);
+	else
+		strbuf_addf(key, "%s missing\n", path);
+}
+
+/*
+ * The cached advertisement for a request is named after a hash of the
+ * request, the configuration that affects it and a snapshot of the
+ * stat information of the ref store.  Returns NULL when the ref store
+ * changed too recently for that snapshot to be trusted.
+ */
+static char *ls_refs_cache_path(struct repository *r,
+				struct ls_refs_data *data)
+{
+	struct strbuf key = STRBUF_INIT, path = STRBUF_INIT;
+	timestamp_t newest = 0;
+	struct object_id oid;
+	git_hash_ctx ctx;
+	char *ret = NULL;
+	int i;
+
+	strbuf_addf(&key, "namespace %s\npeel %u\nsymrefs %u\nunborn %u\n",
+		    get_git_namespace(), data->peel, data->symrefs,
+		    data->unborn);
+	for (i = 0; i < data->prefixes.nr; i++)
+		strbuf_addf(&key, "prefix %s\n", data->prefixes.v[i]);
+	strbuf_addbuf(&key, &data->hidden);
+
+	strbuf_addf(&path, "%s/HEAD", r->gitdir);
+	add_ref_files_to_cache_key(&key, path.buf, &newest);
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/packed-refs", r->commondir);
+	add_ref_files_to_cache_key(&key, path.buf, &newest);
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/refs", r->commondir);
+	add_refs_dir_to_cache_key(&key, &path, &newest);
+	if (strcmp(r->gitdir, r->commondir)) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/refs", r->gitdir);
+		add_refs_dir_to_cache_key(&key, &path, &newest);
+	}
+
+	/*
+	 * A change made within the same second as the last one may not
+	 * show up in the stat information; wait for things to settle.
+	 */
+	if (newest + 1 < time(NULL)) {
+		r->hash_algo->init_fn(&ctx);
+		r->hash_algo->update_fn(&ctx, key.buf, key.len);
+		r->hash_algo->final_oid_fn(&oid, &ctx);
+		ret = repo_git_path(r, "ls-refs-cache/%s.refs",
+				    oid_to_hex(&oid));
+	}
+
+	strbuf_release(&path);
+	strbuf_release(&key);
+	return ret;
+}
+
+struct ls_refs_cache_entry {
+	char *path;
+	timestamp_t mtime;
+};
+
+static int ls_refs_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct ls_refs_cache_entry *a = va, *b = vb;
+
+	if (a->mtime < b->mtime)
+		return -1;
+	return a->mtime > b->mtime;
+}
+
+/* Drop the least recently used advertisements to keep at most "limit". */
+static void prune_ls_refs_cache(struct repository *r, int limit)
+{
+	char *dir = repo_git_path(r, "ls-refs-cache");
+	struct ls_refs_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d) {
+		free(dir);
+		return;
+	}
+	while ((de = readdir(d))) {
+		struct stat st;
+		char *path;
+
+		if (!ends_with(de->d_name, ".refs"))
+			continue;
+		path = xstrfmt("%s/%s", dir, de->d_name);
+		if (stat(path, &st)) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = path;
+		entries[nr].mtime = st.st_mtime;
+		nr++;
+	}
+	closedir(d);
+
+	QSORT(entries, nr, ls_refs_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (i + limit < nr)
+			unlink_or_warn(entries[i].path);
+		free(entries[i].path);
+	}
+	free(entries);
+	free(dir);
+}
+
+static void write_ls_refs_cache(struct repository *r, const char *cache_path,
+				const struct strbuf *advertisement)
+{
+	struct strbuf tmp = STRBUF_INIT;
+	struct tempfile *cache;
+
+	if (safe_create_leading_directories_const(cache_path)) {
+		warning_errno(_("unable to create ls-refs cache directory"));
+		return;
+	}
+	strbuf_addstr(&tmp, cache_path);
+	strbuf_setlen(&tmp, find_last_dir_sep(tmp.buf) - tmp.buf);
+	strbuf_addstr(&tmp, "/tmp_refs_XXXXXX");
+	cache = mks_tempfile(tmp.buf);
+	strbuf_release(&tmp);
+
+	if (!cache ||
+	    write_in_full(get_tempfile_fd(cache), advertisement->buf,
+			  advertisement->len) < 0 ||
+	    rename_tempfile(&cache, cache_path)) {
+		warning_errno(_("unable to write ls-refs cache"));
+		delete_tempfile(&cache);
+		return;
+	}
+	prune_ls_refs_cache(r, cache_limit);
+}
+
 int ls_refs(struct repository *r, struct strvec *keys,
 	    struct packet_reader *request)
 {
 	struct ls_refs_data data;
+	struct strbuf advertisement = STRBUF_INIT;
+	char *cache_path = NULL;
 
 	memset(&data, 0, sizeof(data));
 	strvec_init(&data.prefixes);
+	strbuf_init(&data.hidden, 0);
+	packet_writer_init(&data.writer, 1);
+	data.writer.buffered = 1;
 
 	ensure_config_read();
-	git_config(ls_refs_config, NULL);
+	git_config(ls_refs_config, &data);
 
 	while (packet_reader_read(request) == PACKET_READ_NORMAL) {
 		const char *arg = request->line;
@@ -166,12 +391,37 @@ int ls_refs(struct repository *r, struct strvec *keys,
 	if (request->status != PACKET_READ_FLUSH)
 		die(_("expected flush after ls-refs arguments"));
 
+	if (use_cache)
+		cache_path = ls_refs_cache_path(r, &data);
+	if (cache_path) {
+		if (strbuf_read_file(&advertisement, cache_path, 0) >= 0) {
+			trace2_data_string("ls-refs", r, "cache", "hit");
+			utime(cache_path, NULL);
+			write_or_die(1, advertisement.buf, advertisement.len);
+			packet_flush(1);
+			goto out;
+		}
+		trace2_data_string("ls-refs", r, "cache", "miss");
+		strbuf_reset(&advertisement);
+		data.out = &advertisement;
+	}
+
 	send_possibly_unborn_head(&data);
 	if (!data.prefixes.nr)
 		strvec_push(&data.prefixes, "");
 	for_each_fullref_in_prefixes(get_git_namespace(), data.prefixes.v,
 				     send_ref, &data, 0);
-	packet_flush(1);
+	if (data.out) {
+		write_or_die(1, advertisement.buf, advertisement.len);
+		write_ls_refs_cache(r, cache_path, &advertisement);
+	}
+	packet_writer_flush(&data.writer);
+
+out:
+	free(cache_path);
+	strbuf_release(&advertisement);
+	strbuf_release(&data.hidden);
+	packet_writer_release(&data.writer);
 	strvec_clear(&data.prefixes);
 	return 0;
 }
@@ -20,6 +20,8 @@ static struct mp_block *mem_pool_alloc_block(struct mem_pool *pool,
 
 	pool->pool_alloc += sizeof(struct mp_block) + block_alloc;
 	p = xmalloc(st_add(sizeof(struct mp_block), block_alloc));
+	trace2_memory_add(TRACE2_MEMORY_ID_MEM_POOL,
+			  sizeof(struct mp_block) + block_alloc);
 
 	p->next_free = (char *)p->space;
 	p->end = p->next_free + block_alloc;
@@ -60,6 +62,7 @@ void mem_pool_discard(struct mem_pool *pool, int invalidate_memory)
 		free(block_to_free);
 	}
 
+	trace2_memory_add(TRACE2_MEMORY_ID_MEM_POOL, -(intmax_t)pool->pool_alloc);
 	pool->mp_block = NULL;
 	pool->pool_alloc = 0;
 }
@@ -156,3 +159,58 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src)
 	src->pool_alloc = 0;
 	src->mp_block = NULL;
 }
+
+void mem_pool_set_init(struct mem_pool_set *set, size_t initial_size)
+{
+	memset(set, 0, sizeof(*set));
+	set->initial_size = initial_size;
+	pthread_key_create(&set->key, NULL);
+	pthread_mutex_init(&set->mutex, NULL);
+}
+
+struct mem_pool *mem_pool_set_get(struct mem_pool_set *set)
+{
+	struct mem_pool *pool;
+
+	if (!HAVE_THREADS && set->nr)
+		return set->pools[0];
+	pool = pthread_getspecific(set->key);
+	if (pool)
+		return pool;
+
+	pool = xmalloc(sizeof(*pool));
+	mem_pool_init(pool, set->initial_size);
+	pthread_mutex_lock(&set->mutex);
+	ALLOC_GROW(set->pools, set->nr + 1, set->alloc);
+	set->pools[set->nr++] = pool;
+	pthread_mutex_unlock(&set->mutex);
+	pthread_setspecific(set->key, pool);
+	return pool;
+}
+
+static void mem_pool_set_release(struct mem_pool_set *set,
+				 struct mem_pool *dst, int invalidate_memory)
+{
+	size_t i;
+
+	for (i = 0; i < set->nr; i++) {
+		if (dst)
+			mem_pool_combine(dst, set->pools[i]);
+		mem_pool_discard(set->pools[i], invalidate_memory);
+		free(set->pools[i]);
+	}
+	FREE_AND_NULL(set->pools);
+	set->nr = set->alloc = 0;
+	pthread_key_delete(set->key);
+	pthread_mutex_destroy(&set->mutex);
+}
+
+void mem_pool_set_combine(struct mem_pool *dst, struct mem_pool_set *set)
+{
+	mem_pool_set_release(set, dst, 0);
+}
+
+void mem_pool_set_discard(struct mem_pool_set *set, int invalidate_memory)
+{
+	mem_pool_set_release(set, NULL, invalidate_memory);
+}
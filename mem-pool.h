@@ -1,6 +1,8 @@
 #ifndef MEM_POOL_H
 #define MEM_POOL_H
 
+#include "thread-utils.h"
+
 struct mp_block {
 	struct mp_block *next_block;
 	char *next_free;
@@ -60,4 +62,42 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src);
  */
 int mem_pool_contains(struct mem_pool *pool, void *mem);
 
+/*
+ * A set of memory pools, one for each thread that allocates from it,
+ * so that threads working on the same job do not need to take a lock
+ * or go through malloc() for each allocation.  Once the threads are
+ * done, their memory is handed over to a single pool (or discarded)
+ * in one go.
+ */
+struct mem_pool_set {
+	struct mem_pool **pools;
+	size_t nr, alloc;
+	size_t initial_size;
+	pthread_key_t key;
+	pthread_mutex_t mutex;
+};
+
+/*
+ * Initialize the set; the pool of each thread is created on its first
+ * use with the specified initial size.
+ */
+void mem_pool_set_init(struct mem_pool_set *set, size_t initial_size);
+
+/*
+ * Return the pool of the calling thread.
+ */
+struct mem_pool *mem_pool_set_get(struct mem_pool_set *set);
+
+/*
+ * Move the memory of all the pools of the set to 'dst' and release the
+ * set, which needs a new `mem_pool_set_init` before it is used again.
+ * No thread may be allocating from the set anymore.
+ */
+void mem_pool_set_combine(struct mem_pool *dst, struct mem_pool_set *set);
+
+/*
+ * Discard all the memory of the set and release it, as above.
+ */
+void mem_pool_set_discard(struct mem_pool_set *set, int invalidate_memory);
+
 #endif
@@ -23,6 +23,7 @@
 #include "cache-tree.h"
 #include "commit.h"
 #include "commit-reach.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "dir.h"
@@ -33,6 +34,7 @@
 #include "revision.h"
 #include "strmap.h"
 #include "submodule.h"
+#include "thread-utils.h"
 #include "tree.h"
 #include "unpack-trees.h"
 #include "xdiff-interface.h"
@@ -384,6 +386,14 @@ struct merge_options_internal {
 
 	/* call_depth: recursion level counter for merging merge bases */
 	int call_depth;
+
+	/*
+	 * content_merges: results of content merges done ahead of time
+	 *
+	 * While process_entries() runs, maps paths to the struct
+	 * content_merge computed for them by merge_contents_in_parallel().
+	 */
+	struct strmap *content_merges;
 };
 
 struct version_info {
@@ -1724,54 +1734,133 @@ static void initialize_attr_index(struct merge_options *opt)
 	}
 }
 
-static int merge_3way(struct merge_options *opt,
-		      const char *path,
-		      const struct object_id *o,
-		      const struct object_id *a,
-		      const struct object_id *b,
-		      const char *pathnames[3],
-		      const int extra_marker_size,
-		      mmbuffer_t *result_buf)
+static void init_ll_merge_options(struct merge_options *opt,
+				  const int extra_marker_size,
+				  struct ll_merge_options *ll_opts)
 {
-	mmfile_t orig, src1, src2;
-	struct ll_merge_options ll_opts = {0};
-	char *base, *name1, *name2;
-	int merge_status;
-
-	if (!opt->priv->attr_index.initialized)
-		initialize_attr_index(opt);
-
-	ll_opts.renormalize = opt->renormalize;
-	ll_opts.extra_marker_size = extra_marker_size;
-	ll_opts.xdl_opts = opt->xdl_opts;
+	memset(ll_opts, 0, sizeof(*ll_opts));
+	ll_opts->renormalize = opt->renormalize;
+	ll_opts->extra_marker_size = extra_marker_size;
+	ll_opts->xdl_opts = opt->xdl_opts;
 
 	if (opt->priv->call_depth) {
-		ll_opts.virtual_ancestor = 1;
-		ll_opts.variant = 0;
+		ll_opts->virtual_ancestor = 1;
+		ll_opts->variant = 0;
 	} else {
 		switch (opt->recursive_variant) {
 		case MERGE_VARIANT_OURS:
-			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+			ll_opts->variant = XDL_MERGE_FAVOR_OURS;
 			break;
 		case MERGE_VARIANT_THEIRS:
-			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+			ll_opts->variant = XDL_MERGE_FAVOR_THEIRS;
 			break;
 		default:
-			ll_opts.variant = 0;
+			ll_opts->variant = 0;
 			break;
 		}
 	}
+}
 
+static void merge_3way_labels(struct merge_options *opt,
+			      const char *pathnames[3],
+			      char **base, char **name1, char **name2)
+{
 	assert(pathnames[0] && pathnames[1] && pathnames[2] && opt->ancestor);
 	if (pathnames[0] == pathnames[1] && pathnames[1] == pathnames[2]) {
-		base  = mkpathdup("%s", opt->ancestor);
-		name1 = mkpathdup("%s", opt->branch1);
-		name2 = mkpathdup("%s", opt->branch2);
+		*base  = mkpathdup("%s", opt->ancestor);
+		*name1 = mkpathdup("%s", opt->branch1);
+		*name2 = mkpathdup("%s", opt->branch2);
 	} else {
-		base  = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
-		name1 = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
-		name2 = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
+		*base  = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
+		*name1 = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
+		*name2 = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
 	}
+}
+
+/* A content merge done ahead of time by merge_contents_in_parallel() */
+struct content_merge {
+	const char *path;
+	struct object_id o, a, b;
+	char *base, *name1, *name2;
+	struct ll_merge_options ll_opts;
+	int marker_size;
+
+	/* -1 if it could not be done without ll_merge() */
+	int status;
+	mmbuffer_t result;
+};
+
+static void free_content_merge(struct content_merge *cm)
+{
+	free(cm->base);
+	free(cm->name1);
+	free(cm->name2);
+	free(cm->result.ptr);
+	free(cm);
+}
+
+/*
+ * Take the result of merging "path" from the content merges done ahead
+ * of time, if there is one for the very same merge.
+ */
+static int take_content_merge(struct merge_options *opt,
+			      const char *path,
+			      const struct object_id *o,
+			      const struct object_id *a,
+			      const struct object_id *b,
+			      const char *base, const char *name1,
+			      const char *name2,
+			      const struct ll_merge_options *ll_opts,
+			      mmbuffer_t *result_buf)
+{
+	struct content_merge *cm;
+	int status;
+
+	if (!opt->priv->content_merges ||
+	    !(cm = strmap_get(opt->priv->content_merges, path)))
+		return -1;
+	strmap_remove(opt->priv->content_merges, path, 0);
+
+	status = cm->status;
+	if (status < 0 ||
+	    !oideq(&cm->o, o) || !oideq(&cm->a, a) || !oideq(&cm->b, b) ||
+	    strcmp(cm->base, base) || strcmp(cm->name1, name1) ||
+	    strcmp(cm->name2, name2) ||
+	    cm->ll_opts.extra_marker_size != ll_opts->extra_marker_size)
+		status = -1;
+	else {
+		*result_buf = cm->result;
+		cm->result.ptr = NULL;
+	}
+	free_content_merge(cm);
+	return status;
+}
+
+static int merge_3way(struct merge_options *opt,
+		      const char *path,
+		      const struct object_id *o,
+		      const struct object_id *a,
+		      const struct object_id *b,
+		      const char *pathnames[3],
+		      const int extra_marker_size,
+		      mmbuffer_t *result_buf)
+{
+	mmfile_t orig, src1, src2;
+	struct ll_merge_options ll_opts;
+	char *base, *name1, *name2;
+	int merge_status;
+
+	if (!opt->priv->attr_index.initialized)
+		initialize_attr_index(opt);
+
+	init_ll_merge_options(opt, extra_marker_size, &ll_opts);
+	merge_3way_labels(opt, pathnames, &base, &name1, &name2);
+
+	merge_status = take_content_merge(opt, path, o, a, b,
+					  base, name1, name2, &ll_opts,
+					  result_buf);
+	if (merge_status >= 0)
+		goto out;
 
 	read_mmblob(&orig, o);
 	read_mmblob(&src1, a);
@@ -1781,12 +1870,13 @@ static int merge_3way(struct merge_options *opt,
 				&src1, name1, &src2, name2,
 				&opt->priv->attr_index, &ll_opts);
 
-	free(base);
-	free(name1);
-	free(name2);
 	free(orig.ptr);
 	free(src1.ptr);
 	free(src2.ptr);
+out:
+	free(base);
+	free(name1);
+	free(name2);
 	return merge_status;
 }
 
@@ -3927,6 +4017,157 @@ static void prefetch_for_content_merges(struct merge_options *opt,
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * Below this many content merges, they are not worth spreading across
+ * threads.
+ */
+#define MIN_PARALLEL_CONTENT_MERGES 16
+
+struct content_merge_threads {
+	struct content_merge **jobs;
+	int nr;
+
+	/* protected by "mutex" */
+	pthread_mutex_t mutex;
+	int next;
+};
+
+static void *content_merge_worker(void *data)
+{
+	struct content_merge_threads *t = data;
+
+	for (;;) {
+		struct content_merge *cm;
+		mmfile_t orig, src1, src2;
+
+		pthread_mutex_lock(&t->mutex);
+		if (t->next >= t->nr) {
+			pthread_mutex_unlock(&t->mutex);
+			break;
+		}
+		cm = t->jobs[t->next++];
+		pthread_mutex_unlock(&t->mutex);
+
+		read_mmblob(&orig, &cm->o);
+		read_mmblob(&src1, &cm->a);
+		read_mmblob(&src2, &cm->b);
+		cm->status = ll_merge_text(&cm->result, &orig, cm->base,
+					   &src1, cm->name1, &src2, cm->name2,
+					   &cm->ll_opts, cm->marker_size);
+		if (cm->status < 0 || !cm->result.ptr) {
+			cm->status = -1;
+			FREE_AND_NULL(cm->result.ptr);
+		}
+		free(orig.ptr);
+		free(src1.ptr);
+		free(src2.ptr);
+	}
+	return NULL;
+}
+
+/*
+ * Do the content merges that process_entry() is going to need for
+ * "plist" on several threads, and record their results in "merges" for
+ * merge_3way() to pick up.  Attributes are looked up and objects are
+ * written here and in process_entry() respectively, so this only runs
+ * the reading of the blobs and xdl_merge() in parallel, and the order
+ * of everything else is unchanged.  Paths that do not use the built-in
+ * text merge are left alone.
+ */
+static void merge_contents_in_parallel(struct merge_options *opt,
+				       struct string_list *plist,
+				       struct strmap *merges)
+{
+	struct content_merge_threads t = { 0 };
+	struct string_list_item *e;
+	pthread_t *threads;
+	int nr_threads, nr_started, alloc = 0, i;
+
+	nr_threads = git_env_ulong("GIT_TEST_MERGE_THREADS", 0);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS || nr_threads < 2 ||
+	    (opt->repo == the_repository && has_promisor_remote()))
+		return;
+
+	if (!opt->priv->attr_index.initialized)
+		initialize_attr_index(opt);
+
+	for (e = &plist->items[plist->nr-1]; e >= plist->items; --e) {
+		struct conflict_info *ci = e->util;
+		struct version_info *o = &ci->stages[0];
+		struct version_info *a = &ci->stages[1];
+		struct version_info *b = &ci->stages[2];
+		struct content_merge *cm;
+		int marker_size;
+
+		/* The same entries as in prefetch_for_content_merges() */
+		if (ci->merged.clean || ci->match_mask || ci->filemask < 6 ||
+		    !S_ISREG(a->mode) || !S_ISREG(b->mode) ||
+		    oideq(&a->oid, &b->oid))
+			continue;
+		if (ci->filemask == 7 && S_ISREG(o->mode) &&
+		    (oideq(&o->oid, &a->oid) || oideq(&o->oid, &b->oid)))
+			continue;
+
+		CALLOC_ARRAY(cm, 1);
+		cm->path = e->string;
+		init_ll_merge_options(opt, opt->priv->call_depth * 2,
+				      &cm->ll_opts);
+		marker_size = ll_merge_text_marker_size(&opt->priv->attr_index,
+							e->string,
+							&cm->ll_opts);
+		if (marker_size < 0) {
+			free(cm);
+			continue;
+		}
+		cm->marker_size = marker_size;
+		/* a two-way merge, as in handle_content_merge() */
+		oidcpy(&cm->o, (S_IFMT & o->mode) != (S_IFMT & a->mode) ?
+			       null_oid() : &o->oid);
+		oidcpy(&cm->a, &a->oid);
+		oidcpy(&cm->b, &b->oid);
+		merge_3way_labels(opt, ci->pathnames,
+				  &cm->base, &cm->name1, &cm->name2);
+
+		ALLOC_GROW(t.jobs, t.nr + 1, alloc);
+		t.jobs[t.nr++] = cm;
+	}
+
+	if (t.nr < MIN_PARALLEL_CONTENT_MERGES &&
+	    !git_env_ulong("GIT_TEST_MERGE_THREADS", 0)) {
+		for (i = 0; i < t.nr; i++)
+			free_content_merge(t.jobs[i]);
+		free(t.jobs);
+		return;
+	}
+
+	trace2_region_enter("merge", "parallel content merges", opt->repo);
+	if (nr_threads > t.nr)
+		nr_threads = t.nr;
+	pthread_mutex_init(&t.mutex, NULL);
+	enable_obj_read_lock();
+	ALLOC_ARRAY(threads, nr_threads);
+	for (nr_started = 0; nr_started < nr_threads; nr_started++)
+		if (pthread_create(&threads[nr_started], NULL,
+				   content_merge_worker, &t))
+			break;
+	if (!nr_started)
+		content_merge_worker(&t);
+	for (i = 0; i < nr_started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&t.mutex);
+	trace2_data_intmax("merge", opt->repo, "parallel content merges",
+			   t.nr);
+	trace2_region_leave("merge", "parallel content merges", opt->repo);
+
+	for (i = 0; i < t.nr; i++)
+		strmap_put(merges, t.jobs[i]->path, t.jobs[i]);
+	free(t.jobs);
+}
+
 static void process_entries(struct merge_options *opt,
 			    struct object_id *result_oid)
 {
@@ -3934,6 +4175,7 @@ static void process_entries(struct merge_options *opt,
 	struct strmap_entry *e;
 	struct string_list plist = STRING_LIST_INIT_NODUP;
 	struct string_list_item *entry;
+	struct strmap content_merges;
 	struct directory_versions dir_metadata = { STRING_LIST_INIT_NODUP,
 						   STRING_LIST_INIT_NODUP,
 						   NULL, 0 };
@@ -3974,6 +4216,9 @@ static void process_entries(struct merge_options *opt,
 	 */
 	trace2_region_enter("merge", "processing", opt->repo);
 	prefetch_for_content_merges(opt, &plist);
+	strmap_init_with_options(&content_merges, NULL, 0);
+	merge_contents_in_parallel(opt, &plist, &content_merges);
+	opt->priv->content_merges = &content_merges;
 	for (entry = &plist.items[plist.nr-1]; entry >= plist.items; --entry) {
 		char *path = entry->string;
 		/*
@@ -3992,6 +4237,10 @@ static void process_entries(struct merge_options *opt,
 			process_entry(opt, path, ci, &dir_metadata);
 		}
 	}
+	opt->priv->content_merges = NULL;
+	strmap_for_each_entry(&content_merges, &iter, e)
+		free_content_merge(e->value);
+	strmap_clear(&content_merges, 0);
 	trace2_region_leave("merge", "processing", opt->repo);
 
 	trace2_region_enter("merge", "process_entries cleanup", opt->repo);
@@ -4219,41 +4468,86 @@ void merge_switch_to_result(struct merge_options *opt,
 		trace2_region_leave("merge", "write_auto_merge", opt->repo);
 	}
 
-	if (display_update_msgs) {
-		struct merge_options_internal *opti = result->priv;
-		struct hashmap_iter iter;
-		struct strmap_entry *e;
-		struct string_list olist = STRING_LIST_INIT_NODUP;
-		int i;
+	if (display_update_msgs)
+		merge_display_update_messages(opt, result);
 
-		trace2_region_enter("merge", "display messages", opt->repo);
+	merge_finalize(opt, result);
+}
 
-		/* Hack to pre-allocate olist to the desired size */
-		ALLOC_GROW(olist.items, strmap_get_size(&opti->output),
-			   olist.alloc);
+void merge_display_update_messages(struct merge_options *opt,
+				   struct merge_result *result)
+{
+	struct merge_options_internal *opti = result->priv;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct string_list olist = STRING_LIST_INIT_NODUP;
+	int i;
 
-		/* Put every entry from output into olist, then sort */
-		strmap_for_each_entry(&opti->output, &iter, e) {
-			string_list_append(&olist, e->key)->util = e->value;
-		}
-		string_list_sort(&olist);
+	trace2_region_enter("merge", "display messages", opt->repo);
 
-		/* Iterate over the items, printing them */
-		for (i = 0; i < olist.nr; ++i) {
-			struct strbuf *sb = olist.items[i].util;
+	/* Hack to pre-allocate olist to the desired size */
+	ALLOC_GROW(olist.items, strmap_get_size(&opti->output),
+		   olist.alloc);
 
-			printf("%s", sb->buf);
-		}
-		string_list_clear(&olist, 0);
+	/* Put every entry from output into olist, then sort */
+	strmap_for_each_entry(&opti->output, &iter, e) {
+		string_list_append(&olist, e->key)->util = e->value;
+	}
+	string_list_sort(&olist);
 
-		/* Also include needed rename limit adjustment now */
-		diff_warn_rename_limit("merge.renamelimit",
-				       opti->renames.needed_limit, 0);
+	/* Iterate over the items, printing them */
+	for (i = 0; i < olist.nr; ++i) {
+		struct strbuf *sb = olist.items[i].util;
 
-		trace2_region_leave("merge", "display messages", opt->repo);
+		printf("%s", sb->buf);
 	}
+	string_list_clear(&olist, 0);
 
-	merge_finalize(opt, result);
+	/* Also include needed rename limit adjustment now */
+	diff_warn_rename_limit("merge.renamelimit",
+			       opti->renames.needed_limit, 0);
+
+	trace2_region_leave("merge", "display messages", opt->repo);
+}
+
+static int cmp_conflicted_files(const void *a_, const void *b_)
+{
+	const struct string_list_item *a = a_, *b = b_;
+	const struct stage_info *sa = a->util, *sb = b->util;
+	int cmp = strcmp(a->string, b->string);
+
+	return cmp ? cmp : sa->stage - sb->stage;
+}
+
+void merge_get_conflicted_files(struct merge_result *result,
+				struct string_list *conflicted_files)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct merge_options_internal *opti = result->priv;
+
+	strmap_for_each_entry(&opti->conflicted, &iter, e) {
+		const char *path = e->key;
+		struct conflict_info *ci = e->value;
+		int i;
+
+		VERIFY_CI(ci);
+
+		for (i = MERGE_BASE; i <= MERGE_SIDE2; i++) {
+			struct stage_info *si;
+
+			if (!(ci->filemask & (1ul << i)))
+				continue;
+
+			si = xmalloc(sizeof(*si));
+			si->stage = i + 1;
+			si->mode = ci->stages[i].mode;
+			oidcpy(&si->oid, &ci->stages[i].oid);
+			string_list_append(conflicted_files, path)->util = si;
+		}
+	}
+	QSORT(conflicted_files->items, conflicted_files->nr,
+	      cmp_conflicted_files);
 }
 
 void merge_finalize(struct merge_options *opt,
@@ -4475,6 +4769,162 @@ static void merge_check_renames_reusable(struct merge_options *opt,
 		renames->cached_pairs_valid_side = 0; /* neither side valid */
 }
 
+/*
+ * The rename cache is saved as a sequence of NUL-terminated fields:
+ * the merge base, the two sides and the result of the merge, followed
+ * by records for each side of the form
+ *
+ *   "r<side> <old path>" "<new path>"		a rename
+ *   "d<side> <old path>"			a deletion
+ *   "i<side> <path>"				an irrelevant source
+ *   "c<side> <old dir>" "<new dir>" "<count>"	directory rename counts
+ */
+void merge_save_rename_cache(struct merge_result *result, struct strbuf *out)
+{
+	struct merge_options_internal *opti = result->priv;
+	struct rename_info *renames;
+	struct hashmap_iter iter, count_iter;
+	struct strmap_entry *e, *count_e;
+	int i, side;
+
+	if (!opti || result->clean < 0)
+		return;
+	renames = &opti->renames;
+	/* e.g. rename/rename(1to1) makes the cached renames invalid */
+	if (!renames->merge_trees[0])
+		return;
+
+	for (i = 0; i < 3; i++)
+		strbuf_addf(out, "%s%c",
+			    oid_to_hex(&renames->merge_trees[i]->object.oid),
+			    '\0');
+	strbuf_addf(out, "%s%c", oid_to_hex(&result->tree->object.oid), '\0');
+
+	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++) {
+		strmap_for_each_entry(&renames->cached_pairs[side], &iter, e) {
+			if (e->value)
+				strbuf_addf(out, "r%d %s%c%s%c", side, e->key,
+					    '\0', (char *)e->value, '\0');
+			else
+				strbuf_addf(out, "d%d %s%c", side, e->key, '\0');
+		}
+		strset_for_each_entry(&renames->cached_irrelevant[side],
+				      &iter, e)
+			strbuf_addf(out, "i%d %s%c", side, e->key, '\0');
+		strmap_for_each_entry(&renames->dir_rename_count[side],
+				      &iter, e) {
+			struct strintmap *counts = e->value;
+
+			strintmap_for_each_entry(counts, &count_iter, count_e)
+				strbuf_addf(out, "c%d %s%c%s%c%"PRIuMAX"%c",
+					    side, e->key, '\0',
+					    count_e->key, '\0',
+					    (uintmax_t)(intptr_t)count_e->value,
+					    '\0');
+		}
+	}
+}
+
+static const char *next_cache_field(const char **p, const char *end)
+{
+	const char *field = *p;
+	const char *nul = memchr(field, '\0', end - field);
+
+	if (!nul)
+		return NULL;
+	*p = nul + 1;
+	return field;
+}
+
+static int load_rename_cache_records(struct rename_info *renames,
+				     const char *p, const char *end)
+{
+	while (p < end) {
+		const char *field = next_cache_field(&p, end);
+		const char *path, *other, *count;
+		int side;
+
+		if (!field || !strchr("rdic", field[0]) ||
+		    (field[1] != '1' && field[1] != '2') || field[2] != ' ')
+			return -1;
+		side = field[1] - '0';
+		path = field + 3;
+
+		switch (field[0]) {
+		case 'r':
+			if (!(other = next_cache_field(&p, end)))
+				return -1;
+			cache_new_pair(renames, side, (char *)path,
+				       (char *)other, 1);
+			break;
+		case 'd':
+			strmap_put(&renames->cached_pairs[side], path, NULL);
+			break;
+		case 'i':
+			strset_add(&renames->cached_irrelevant[side], path);
+			break;
+		case 'c': {
+			struct strintmap *counts;
+
+			if (!(other = next_cache_field(&p, end)) ||
+			    !(count = next_cache_field(&p, end)))
+				return -1;
+			counts = strmap_get(&renames->dir_rename_count[side],
+					    path);
+			if (!counts) {
+				counts = xmalloc(sizeof(*counts));
+				strintmap_init_with_options(counts, 0, NULL, 1);
+				strmap_put(&renames->dir_rename_count[side],
+					   path, counts);
+			}
+			strintmap_set(counts, other, strtol(count, NULL, 10));
+			break;
+		}
+		}
+	}
+	return 0;
+}
+
+int merge_load_rename_cache(struct merge_options *opt,
+			    struct merge_result *result,
+			    const char *buf, size_t len)
+{
+	const char *p = buf, *end = buf + len;
+	struct merge_options_internal *opti;
+	struct tree *trees[4];
+	int i;
+
+	if (result->priv)
+		BUG("merge_load_rename_cache() needs a zeroed merge_result");
+
+	for (i = 0; i < 4; i++) {
+		const char *field = next_cache_field(&p, end);
+		struct object_id oid;
+
+		if (!field || get_oid_hex(field, &oid) ||
+		    !(trees[i] = lookup_tree(opt->repo, &oid)))
+			return -1;
+	}
+
+	merge_start(opt, result);
+	opti = opt->priv;
+	result->priv = opti;
+	result->_properly_initialized = RESULT_INITIALIZED;
+	opt->priv = NULL;
+
+	if (load_rename_cache_records(&opti->renames, p, end)) {
+		merge_finalize(opt, result);
+		memset(result, 0, sizeof(*result));
+		return -1;
+	}
+
+	for (i = 0; i < 3; i++)
+		opti->renames.merge_trees[i] = trees[i];
+	result->tree = trees[3];
+	result->clean = 1;
+	return 0;
+}
+
 /*** Function Grouping: merge_incore_*() and their internal variants ***/
 
 /*
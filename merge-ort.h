@@ -2,9 +2,12 @@
 #define MERGE_ORT_H
 
 #include "merge-recursive.h"
+#include "hash.h"
 
 struct commit;
 struct tree;
+struct string_list;
+struct strbuf;
 
 struct merge_result {
 	/*
@@ -70,6 +73,52 @@ void merge_switch_to_result(struct merge_options *opt,
 			    int update_worktree_and_index,
 			    int display_update_msgs);
 
+/*
+ * Display messages about conflicts and which files were 3-way merged.
+ * Automatically called by merge_switch_to_result() when asked to, so
+ * only call this when bypassing merge_switch_to_result().
+ */
+void merge_display_update_messages(struct merge_options *opt,
+				   struct merge_result *result);
+
+struct stage_info {
+	struct object_id oid;
+	int mode;
+	int stage;
+};
+
+/*
+ * Provide a list of path -> {struct stage_info*} mappings for all
+ * conflicted files, sorted by path and stage.  Each path can appear up
+ * to three times in the list, once for each of its stages; in short,
+ * this is the information "ls-files -u" would show after the merge.
+ *
+ * result should have been populated by a call to one of the
+ * merge_incore_[non]recursive() functions, and conflicted_files should
+ * be empty before calling this function.  The caller owns the
+ * stage_info structs (free them with string_list_clear(..., 1)).
+ */
+void merge_get_conflicted_files(struct merge_result *result,
+				struct string_list *conflicted_files);
+
+/*
+ * Save the renames that the merge in result found and cached for a
+ * next merge of a cherry-pick or rebase sequence (see the "cached_*"
+ * fields in merge-ort.c) to out, so that the sequence can carry on in
+ * another process.  Nothing is written when they cannot be reused.
+ */
+void merge_save_rename_cache(struct merge_result *result, struct strbuf *out);
+
+/*
+ * Fill a zeroed result with renames saved by merge_save_rename_cache(),
+ * for the next merge_incore_nonrecursive() with the same options to
+ * use when its trees allow it.  Returns -1, leaving result zeroed, if
+ * buf cannot be parsed.
+ */
+int merge_load_rename_cache(struct merge_options *opt,
+			    struct merge_result *result,
+			    const char *buf, size_t len);
+
 /* Do needed cleanup when not calling merge_switch_to_result() */
 void merge_finalize(struct merge_options *opt,
 		    struct merge_result *result);
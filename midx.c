@@ -13,6 +13,11 @@
 #include "repository.h"
 #include "chunk-format.h"
 #include "pack.h"
+#include "pack-bitmap.h"
+#include "pack-revindex.h"
+#include "refs.h"
+#include "revision.h"
+#include "list-objects.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
@@ -29,11 +34,25 @@
 #define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKID_OBJECTFILTER 0x4f424c46 /* "OBLF" */
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
 #define MIDX_LARGE_OFFSET_NEEDED 0x80000000
 
+/*
+ * The object filter is a blocked Bloom filter: each object sets
+ * MIDX_FILTER_HASHES bits in one block of MIDX_FILTER_BLOCK_SIZE bytes,
+ * all of them taken from its name, which is random enough as it is.
+ * The block is picked by bytes 4 to 7 and the bits by the pairs of
+ * bytes from 8 on.  About MIDX_FILTER_BITS_PER_OBJECT bits are used
+ * per object, which lets less than 2% of the missing objects through.
+ */
+#define MIDX_FILTER_HEADER_SIZE 4
+#define MIDX_FILTER_BLOCK_SIZE 64
+#define MIDX_FILTER_HASHES 6
+#define MIDX_FILTER_BITS_PER_OBJECT 10
+
 #define PACK_EXPIRED UINT_MAX
 
 static uint8_t oid_version(void)
@@ -48,22 +67,50 @@ static uint8_t oid_version(void)
 	}
 }
 
-static const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
 {
 	return m->data + m->data_len - the_hash_algo->rawsz;
 }
 
-static char *get_midx_filename(const char *object_dir)
+char *get_midx_filename(const char *object_dir)
 {
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
+char *get_midx_chain_dirname(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d", object_dir);
+}
+
+char *get_midx_chain_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-chain",
+		       object_dir);
+}
+
+static char *get_midx_layer_filename(const char *object_dir, const char *hex)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-%s.midx",
+		       object_dir, hex);
+}
+
 char *get_midx_rev_filename(struct multi_pack_index *m)
 {
 	return xstrfmt("%s/pack/multi-pack-index-%s.rev",
 		       m->object_dir, hash_to_hex(get_midx_checksum(m)));
 }
 
+static int midx_bitmap_exists(struct multi_pack_index *m)
+{
+	char *rev_name = get_midx_rev_filename(m);
+	char *bitmap_name = midx_bitmap_filename(m);
+	int ret = file_exists(rev_name) && file_exists(bitmap_name);
+
+	free(rev_name);
+	free(bitmap_name);
+	return ret;
+}
+
 static int midx_read_oid_fanout(const unsigned char *chunk_start,
 				size_t chunk_size, void *data)
 {
@@ -77,7 +124,62 @@ static int midx_read_oid_fanout(const unsigned char *chunk_start,
 	return 0;
 }
 
-struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+static int midx_read_object_filter(const unsigned char *chunk_start,
+				   size_t chunk_size, void *data)
+{
+	struct multi_pack_index *m = data;
+	uint32_t hashes;
+
+	if (chunk_size < MIDX_FILTER_HEADER_SIZE + MIDX_FILTER_BLOCK_SIZE ||
+	    (chunk_size - MIDX_FILTER_HEADER_SIZE) % MIDX_FILTER_BLOCK_SIZE ||
+	    (hashes = get_be32(chunk_start)) < 1 ||
+	    hashes > MIDX_FILTER_HASHES) {
+		warning(_("ignoring malformed multi-pack-index object filter"));
+		return 0;
+	}
+
+	m->chunk_object_filter = chunk_start + MIDX_FILTER_HEADER_SIZE;
+	m->object_filter_blocks = (chunk_size - MIDX_FILTER_HEADER_SIZE) /
+				  MIDX_FILTER_BLOCK_SIZE;
+	m->object_filter_hashes = hashes;
+	return 0;
+}
+
+static const unsigned char *object_filter_block(const unsigned char *filter,
+						uint32_t nr_blocks,
+						const unsigned char *hash)
+{
+	uint32_t block = ((uint64_t)get_be32(hash + 4) * nr_blocks) >> 32;
+	return filter + (size_t)block * MIDX_FILTER_BLOCK_SIZE;
+}
+
+static uint32_t object_filter_bit(const unsigned char *hash, uint32_t i)
+{
+	return get_be16(hash + 8 + 2 * i) % (MIDX_FILTER_BLOCK_SIZE * 8);
+}
+
+static int midx_may_contain(struct multi_pack_index *m,
+			    const struct object_id *oid)
+{
+	const unsigned char *block;
+	uint32_t i;
+
+	if (!m->chunk_object_filter)
+		return 1;
+
+	block = object_filter_block(m->chunk_object_filter,
+				    m->object_filter_blocks, oid->hash);
+	for (i = 0; i < m->object_filter_hashes; i++) {
+		uint32_t bit = object_filter_bit(oid->hash, i);
+		if (!(block[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+	return 1;
+}
+
+static struct multi_pack_index *load_multi_pack_index_one(const char *object_dir,
+							 const char *midx_name,
+							 int local)
 {
 	struct multi_pack_index *m = NULL;
 	int fd;
@@ -85,7 +187,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	size_t midx_size;
 	void *midx_map = NULL;
 	uint32_t hash_version;
-	char *midx_name = get_midx_filename(object_dir);
 	uint32_t i;
 	const char *cur_pack_name;
 	struct chunkfile *cf = NULL;
@@ -106,8 +207,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 		goto cleanup_fail;
 	}
 
-	FREE_AND_NULL(midx_name);
-
 	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
 
@@ -154,6 +253,7 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 		die(_("multi-pack-index missing required object offsets chunk"));
 
 	pair_chunk(cf, MIDX_CHUNKID_LARGEOFFSETS, &m->chunk_large_offsets);
+	read_chunk(cf, MIDX_CHUNKID_OBJECTFILTER, midx_read_object_filter, m);
 
 	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
 
@@ -179,7 +279,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 cleanup_fail:
 	free(m);
-	free(midx_name);
 	free(cf);
 	if (midx_map)
 		munmap(midx_map, midx_size);
@@ -188,6 +287,67 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	return NULL;
 }
 
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	char *midx_name = get_midx_filename(object_dir);
+	struct multi_pack_index *m;
+
+	m = load_multi_pack_index_one(object_dir, midx_name, local);
+	free(midx_name);
+	return m;
+}
+
+struct multi_pack_index *load_multi_pack_index_chain(const char *object_dir, int local)
+{
+	struct multi_pack_index *chain = NULL;
+	struct strbuf line = STRBUF_INIT;
+	char *chain_name = get_midx_chain_filename(object_dir);
+	FILE *fp;
+
+	fp = fopen(chain_name, "r");
+	free(chain_name);
+	if (!fp)
+		return NULL;
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct multi_pack_index *m;
+		struct object_id oid;
+		char *layer_name;
+
+		if (get_oid_hex(line.buf, &oid) ||
+		    line.len != the_hash_algo->hexsz) {
+			warning(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				line.buf);
+			break;
+		}
+
+		layer_name = get_midx_layer_filename(object_dir, line.buf);
+		m = load_multi_pack_index_one(object_dir, layer_name, local);
+		free(layer_name);
+
+		if (!m) {
+			warning(_("unable to find all multi-pack-index layers"));
+			break;
+		}
+		if (!hasheq(get_midx_checksum(m), oid.hash)) {
+			warning(_("multi-pack-index layer %s does not match its checksum"),
+				line.buf);
+			close_midx(m);
+			free(m);
+			break;
+		}
+
+		m->in_chain = 1;
+		m->base_midx = chain;
+		m->next = chain;
+		chain = m;
+	}
+
+	fclose(fp);
+	strbuf_release(&line);
+	return chain;
+}
+
 void close_midx(struct multi_pack_index *m)
 {
 	uint32_t i;
@@ -203,6 +363,11 @@ void close_midx(struct multi_pack_index *m)
 	}
 	FREE_AND_NULL(m->packs);
 	FREE_AND_NULL(m->pack_names);
+
+	if (m->base_midx) {
+		close_midx(m->base_midx);
+		FREE_AND_NULL(m->base_midx);
+	}
 }
 
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id)
@@ -326,6 +491,8 @@ int fill_midx_entry(struct repository * r,
 {
 	uint32_t pos;
 
+	if (!midx_may_contain(m, oid))
+		return 0;
 	if (!bsearch_midx(oid, m, &pos))
 		return 0;
 
@@ -364,7 +531,8 @@ static int cmp_idx_or_pack_name(const char *idx_or_pack_name,
 	return strcmp(idx_or_pack_name, idx_name);
 }
 
-int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+static int midx_layer_contains_pack(struct multi_pack_index *m,
+				    const char *idx_or_pack_name)
 {
 	uint32_t first = 0, last = m->num_packs;
 
@@ -387,6 +555,14 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
 	return 0;
 }
 
+int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+{
+	for (; m; m = m->base_midx)
+		if (midx_layer_contains_pack(m, idx_or_pack_name))
+			return 1;
+	return 0;
+}
+
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
 {
 	struct multi_pack_index *m;
@@ -400,12 +576,23 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 		if (!strcmp(object_dir, m_search->object_dir))
 			return 1;
 
+	/*
+	 * A standalone MIDX takes precedence over a chain: it is only
+	 * written (by a non-incremental write, possibly from an older
+	 * version of Git) after everything the chain covers.
+	 */
 	m = load_multi_pack_index(object_dir, local);
+	if (!m)
+		m = load_multi_pack_index_chain(object_dir, local);
 
 	if (m) {
 		struct multi_pack_index *mp = r->objects->multi_pack_index;
 		if (mp) {
-			m->next = mp->next;
+			struct multi_pack_index *last = m;
+
+			while (last->base_midx)
+				last = last->base_midx;
+			last->next = mp->next;
 			mp->next = m;
 		} else
 			r->objects->multi_pack_index = m;
@@ -467,6 +654,8 @@ struct write_midx_context {
 	unsigned large_offsets_needed:1;
 	uint32_t num_large_offsets;
 
+	uint32_t object_filter_blocks;
+
 	int preferred_pack_idx;
 };
 
@@ -818,6 +1007,32 @@ static int write_midx_large_offsets(struct hashfile *f,
 	return 0;
 }
 
+static int write_midx_object_filter(struct hashfile *f,
+				    void *data)
+{
+	struct write_midx_context *ctx = data;
+	size_t size = (size_t)ctx->object_filter_blocks * MIDX_FILTER_BLOCK_SIZE;
+	unsigned char *filter = xcalloc(1, size);
+	uint32_t i, j;
+
+	for (i = 0; i < ctx->entries_nr; i++) {
+		const unsigned char *hash = ctx->entries[i].oid.hash;
+		unsigned char *block = (unsigned char *)
+			object_filter_block(filter, ctx->object_filter_blocks,
+					    hash);
+
+		for (j = 0; j < MIDX_FILTER_HASHES; j++) {
+			uint32_t bit = object_filter_bit(hash, j);
+			block[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	hashwrite_be32(f, MIDX_FILTER_HASHES);
+	hashwrite(f, filter, size);
+	free(filter);
+	return 0;
+}
+
 struct midx_pack_order_data {
 	uint32_t nr;
 	uint32_t pack;
@@ -882,8 +1097,301 @@ static void write_midx_reverse_index(char *midx_name, unsigned char *midx_hash,
 	strbuf_release(&buf);
 }
 
+/*
+ * Returns whether the given MIDX's preferred pack (the first pack in its
+ * pseudo-pack order) is something other than "preferred_pack_name".
+ */
+static int midx_preferred_pack_changed(struct multi_pack_index *m,
+				       const char *preferred_pack_name)
+{
+	uint32_t pack_int_id;
+
+	if (!preferred_pack_name)
+		return 0;
+	if (!m->num_objects || load_midx_revindex(m) < 0)
+		return 1;
+
+	pack_int_id = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0));
+	return cmp_idx_or_pack_name(preferred_pack_name,
+				    m->pack_names[pack_int_id]);
+}
+
+static void prepare_midx_packing_data(struct packing_data *pdata,
+				      struct write_midx_context *ctx)
+{
+	struct packed_git **packs;
+	uint32_t i;
+
+	memset(pdata, 0, sizeof(struct packing_data));
+	prepare_packing_data(the_repository, pdata);
+
+	/* entries refer to packs by their original (pre-sort) pack-int-id */
+	CALLOC_ARRAY(packs, ctx->nr);
+	for (i = 0; i < ctx->nr; i++)
+		packs[ctx->info[i].orig_pack_int_id] = ctx->info[i].p;
+
+	for (i = 0; i < ctx->entries_nr; i++) {
+		struct pack_midx_entry *from = &ctx->entries[i];
+		struct object_entry *to = packlist_alloc(pdata, &from->oid);
+		struct packed_git *p = packs[from->pack_int_id];
+		enum object_type type = OBJ_NONE;
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		oi.typep = &type;
+		if (packed_object_info(the_repository, p, from->offset, &oi) < 0)
+			die(_("could not determine type of %s"),
+			    oid_to_hex(&from->oid));
+		oe_set_type(to, type);
+	}
+
+	free(packs);
+}
+
+struct bitmap_commit_cb {
+	struct commit **commits;
+	size_t commits_nr, commits_alloc;
+
+	struct write_midx_context *ctx;
+};
+
+static const struct object_id *bitmap_oid_access(size_t index,
+						 const void *_entries)
+{
+	const struct pack_midx_entry *entries = _entries;
+	return &entries[index].oid;
+}
+
+static void bitmap_show_commit(struct commit *commit, void *_data)
+{
+	struct bitmap_commit_cb *data = _data;
+	int pos = oid_pos(&commit->object.oid, data->ctx->entries,
+			  data->ctx->entries_nr,
+			  bitmap_oid_access);
+	if (pos < 0)
+		return;
+
+	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
+	data->commits[data->commits_nr++] = commit;
+}
+
+static int add_ref_to_pending(const char *refname,
+			      const struct object_id *oid,
+			      int flag, void *cb_data)
+{
+	struct rev_info *revs = (struct rev_info*)cb_data;
+	struct object_id peeled;
+	struct object *object;
+
+	if ((flag & REF_ISSYMREF) && (flag & REF_ISBROKEN)) {
+		warning("symbolic ref is dangling: %s", refname);
+		return 0;
+	}
+
+	if (!peel_iterated_oid(oid, &peeled))
+		oid = &peeled;
+
+	object = parse_object_or_die(oid, refname);
+	if (object->type != OBJ_COMMIT)
+		return 0;
+
+	add_pending_object(revs, object, "");
+	if (bitmap_is_preferred_refname(revs->repo, refname))
+		object->flags |= NEEDS_BITMAP;
+	return 0;
+}
+
+/*
+ * The on-disk size of each object of the MIDX, by its position in the
+ * pseudo-pack order.
+ */
+static off_t *midx_disk_sizes(struct packing_data *pdata,
+			      struct write_midx_context *ctx)
+{
+	struct packed_git **packs;
+	off_t *sizes;
+	uint32_t i;
+
+	CALLOC_ARRAY(packs, ctx->nr);
+	for (i = 0; i < ctx->nr; i++)
+		packs[ctx->info[i].orig_pack_int_id] = ctx->info[i].p;
+
+	ALLOC_ARRAY(sizes, pdata->nr_objects);
+	for (i = 0; i < ctx->entries_nr; i++) {
+		struct pack_midx_entry *e = &ctx->entries[i];
+		struct object_info oi = OBJECT_INFO_INIT;
+		uint32_t pos = oe_in_pack_pos(pdata, &pdata->objects[i]);
+
+		oi.disk_sizep = &sizes[pos];
+		if (packed_object_info(the_repository, packs[e->pack_int_id],
+				       e->offset, &oi) < 0)
+			die(_("could not determine size of %s"),
+			    oid_to_hex(&e->oid));
+	}
+
+	free(packs);
+	return sizes;
+}
+
+static struct commit **find_commits_for_midx_bitmap(uint32_t *indexed_commits_nr,
+						    struct write_midx_context *ctx)
+{
+	struct rev_info revs;
+	struct bitmap_commit_cb cb = { 0 };
+
+	cb.ctx = ctx;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	setup_revisions(0, NULL, &revs, NULL);
+	for_each_ref(add_ref_to_pending, &revs);
+
+	/*
+	 * Skipping promisor objects here is intentional, since it only excludes
+	 * them from the list of reachable commits that we want to select from
+	 * when computing the selection of MIDX'd commits to receive bitmaps.
+	 *
+	 * Reachability bitmaps do require that their objects be closed under
+	 * reachability, but fetching any objects missing from promisors at this
+	 * point is too late. But, if one of those objects can be reached from
+	 * an another object that is included in the bitmap, then we will
+	 * complain later that we don't have reachability closure (and fail
+	 * appropriately).
+	 */
+	fetch_if_missing = 0;
+	revs.exclude_promisor_objects = 1;
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+
+	traverse_commit_list(&revs, bitmap_show_commit, NULL, &cb);
+	if (indexed_commits_nr)
+		*indexed_commits_nr = cb.commits_nr;
+
+	return cb.commits;
+}
+
+static int write_midx_bitmap(char *midx_name, unsigned char *midx_hash,
+			     struct write_midx_context *ctx,
+			     unsigned flags)
+{
+	struct packing_data pdata;
+	struct pack_idx_entry **index;
+	struct commit **commits = NULL;
+	uint32_t i, commits_nr;
+	char *bitmap_name = xstrfmt("%s-%s.bitmap", midx_name, hash_to_hex(midx_hash));
+	uint16_t options = 0;
+	int lookup_table = 0, commit_stats = 0;
+	off_t *disk_sizes = NULL;
+
+	if (!git_config_get_bool("pack.writebitmaplookuptable", &lookup_table) &&
+	    lookup_table)
+		options |= BITMAP_OPT_LOOKUP_TABLE;
+	if (!git_config_get_bool("pack.writebitmapcommitstats", &commit_stats) &&
+	    commit_stats)
+		options |= BITMAP_OPT_COMMIT_STATS;
+
+	prepare_midx_packing_data(&pdata, ctx);
+
+	commits = find_commits_for_midx_bitmap(&commits_nr, ctx);
+
+	/*
+	 * The type index (and the in-pack positions it assigns) is built
+	 * over the MIDX's pseudo-pack order, which is the object order used
+	 * by the bitmaps themselves.
+	 */
+	ALLOC_ARRAY(index, pdata.nr_objects);
+	for (i = 0; i < pdata.nr_objects; i++)
+		index[i] = &pdata.objects[ctx->pack_order[i]].idx;
+
+	bitmap_writer_show_progress(flags & MIDX_PROGRESS);
+	bitmap_writer_build_type_index(&pdata, index, pdata.nr_objects);
+
+	if (options & BITMAP_OPT_COMMIT_STATS) {
+		disk_sizes = midx_disk_sizes(&pdata, ctx);
+		bitmap_writer_set_disk_sizes(disk_sizes);
+	}
+
+	/*
+	 * bitmap_writer_finish() on the other hand expects the objects in
+	 * lexicographic order, which is the order of the MIDX itself (and
+	 * hence of pdata.objects).
+	 */
+	for (i = 0; i < pdata.nr_objects; i++)
+		index[i] = &pdata.objects[i].idx;
+
+	bitmap_writer_select_commits(commits, commits_nr, -1);
+	bitmap_writer_build(&pdata);
+
+	bitmap_writer_set_checksum(midx_hash);
+	bitmap_writer_finish(index, pdata.nr_objects, bitmap_name, options);
+
+	free(disk_sizes);
+	free(index);
+	free(commits);
+	free(bitmap_name);
+	clear_packing_data(&pdata);
+	return 0;
+}
+
 static void clear_midx_files_ext(struct repository *r, const char *ext,
 				 unsigned char *keep_hash);
+static void clear_midx_chain(const char *object_dir);
+
+/*
+ * Write the chunks of a MIDX covering the (non-expired) packs and the
+ * entries of "ctx" to "f", and finalize it, storing its checksum in
+ * "midx_hash".
+ */
+static int want_object_filter(void)
+{
+	int object_filter = 0;
+
+	git_config_get_bool("pack.writeobjectfilter", &object_filter);
+	return object_filter;
+}
+
+static void write_midx_chunks(struct hashfile *f,
+			      struct write_midx_context *ctx,
+			      int pack_name_concat_len, uint32_t num_packs,
+			      unsigned char *midx_hash)
+{
+	struct chunkfile *cf = init_chunkfile(f);
+
+	add_chunk(cf, MIDX_CHUNKID_PACKNAMES, pack_name_concat_len,
+		  write_midx_pack_names);
+	add_chunk(cf, MIDX_CHUNKID_OIDFANOUT, MIDX_CHUNK_FANOUT_SIZE,
+		  write_midx_oid_fanout);
+	add_chunk(cf, MIDX_CHUNKID_OIDLOOKUP,
+		  (size_t)ctx->entries_nr * the_hash_algo->rawsz,
+		  write_midx_oid_lookup);
+	add_chunk(cf, MIDX_CHUNKID_OBJECTOFFSETS,
+		  (size_t)ctx->entries_nr * MIDX_CHUNK_OFFSET_WIDTH,
+		  write_midx_object_offsets);
+
+	if (ctx->large_offsets_needed)
+		add_chunk(cf, MIDX_CHUNKID_LARGEOFFSETS,
+			(size_t)ctx->num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH,
+			write_midx_large_offsets);
+
+	if (want_object_filter()) {
+		uint64_t bits = (uint64_t)ctx->entries_nr *
+				MIDX_FILTER_BITS_PER_OBJECT;
+
+		ctx->object_filter_blocks =
+			DIV_ROUND_UP(bits, MIDX_FILTER_BLOCK_SIZE * 8);
+		if (!ctx->object_filter_blocks)
+			ctx->object_filter_blocks = 1;
+		add_chunk(cf, MIDX_CHUNKID_OBJECTFILTER,
+			  MIDX_FILTER_HEADER_SIZE +
+			  (size_t)ctx->object_filter_blocks * MIDX_FILTER_BLOCK_SIZE,
+			  write_midx_object_filter);
+	}
+
+	write_midx_header(f, get_num_chunks(cf), num_packs);
+	write_chunkfile(cf, ctx);
+
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	free_chunkfile(cf);
+}
 
 static int midx_checksum_valid(struct multi_pack_index *m)
 {
@@ -904,7 +1412,6 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
 	int result = 0;
-	struct chunkfile *cf;
 
 	midx_name = get_midx_filename(object_dir);
 	if (safe_create_leading_directories(midx_name))
@@ -947,8 +1454,46 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &ctx);
 	stop_progress(&ctx.progress);
 
-	if (ctx.m && ctx.nr == ctx.m->num_packs && !packs_to_drop)
-		goto cleanup;
+	if (ctx.m && ctx.nr == ctx.m->num_packs && !packs_to_drop &&
+	    !ctx.m->chunk_object_filter == !want_object_filter()) {
+		int want_bitmap = flags & MIDX_WRITE_BITMAP;
+
+		if (!want_bitmap ||
+		    (midx_bitmap_exists(ctx.m) &&
+		     !midx_preferred_pack_changed(ctx.m, preferred_pack_name))) {
+			/*
+			 * The correct MIDX already exists, and so does a
+			 * corresponding bitmap (or one wasn't requested).
+			 */
+			if (!want_bitmap)
+				clear_midx_files_ext(the_repository, ".bitmap", NULL);
+			goto cleanup;
+		}
+	}
+
+	if (flags & MIDX_WRITE_BITMAP) {
+		/*
+		 * A bitmap requires every object of the preferred pack to be
+		 * attributed to it, which the de-duplicated entries of an
+		 * existing MIDX cannot guarantee. Read every pack's .idx
+		 * instead of reusing the old MIDX's object list.
+		 */
+		for (i = 0; i < ctx.nr; i++) {
+			char *pack_path;
+
+			if (ctx.info[i].p)
+				continue;
+
+			pack_path = xstrfmt("%s/pack/%s", object_dir,
+					    ctx.info[i].pack_name);
+			ctx.info[i].p = add_packed_git(pack_path,
+						       strlen(pack_path), 0);
+			if (!ctx.info[i].p || open_pack_index(ctx.info[i].p))
+				die(_("could not load pack %s"),
+				    ctx.info[i].pack_name);
+			free(pack_path);
+		}
+	}
 
 	ctx.preferred_pack_idx = -1;
 	if (preferred_pack_name) {
@@ -959,9 +1504,28 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 				break;
 			}
 		}
+	} else if (ctx.nr && (flags & MIDX_WRITE_BITMAP)) {
+		/*
+		 * Without an explicit preferred pack, break ties in favor of
+		 * the oldest non-empty pack, matching the default tie-breaker
+		 * for objects which appear in more than one pack.
+		 */
+		time_t oldest = 0;
+
+		for (i = 0; i < ctx.nr; i++) {
+			struct packed_git *p = ctx.info[i].p;
+
+			if (!p->num_objects)
+				continue;
+			if (ctx.preferred_pack_idx < 0 || p->mtime < oldest) {
+				ctx.preferred_pack_idx = i;
+				oldest = p->mtime;
+			}
+		}
 	}
 
-	ctx.entries = get_sorted_entries(ctx.m, ctx.info, ctx.nr, &ctx.entries_nr,
+	ctx.entries = get_sorted_entries((flags & MIDX_WRITE_BITMAP) ? NULL : ctx.m,
+					 ctx.info, ctx.nr, &ctx.entries_nr,
 					 ctx.preferred_pack_idx);
 
 	ctx.large_offsets_needed = 0;
@@ -1047,6 +1611,7 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 
 	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
 	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashfile_write_in_background(f);
 
 	if (ctx.m)
 		close_midx(ctx.m);
@@ -1057,38 +1622,22 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		goto cleanup;
 	}
 
-	cf = init_chunkfile(f);
-
-	add_chunk(cf, MIDX_CHUNKID_PACKNAMES, pack_name_concat_len,
-		  write_midx_pack_names);
-	add_chunk(cf, MIDX_CHUNKID_OIDFANOUT, MIDX_CHUNK_FANOUT_SIZE,
-		  write_midx_oid_fanout);
-	add_chunk(cf, MIDX_CHUNKID_OIDLOOKUP,
-		  (size_t)ctx.entries_nr * the_hash_algo->rawsz,
-		  write_midx_oid_lookup);
-	add_chunk(cf, MIDX_CHUNKID_OBJECTOFFSETS,
-		  (size_t)ctx.entries_nr * MIDX_CHUNK_OFFSET_WIDTH,
-		  write_midx_object_offsets);
-
-	if (ctx.large_offsets_needed)
-		add_chunk(cf, MIDX_CHUNKID_LARGEOFFSETS,
-			(size_t)ctx.num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH,
-			write_midx_large_offsets);
-
-	write_midx_header(f, get_num_chunks(cf), ctx.nr - dropped_packs);
-	write_chunkfile(cf, &ctx);
-
-	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
-	free_chunkfile(cf);
+	write_midx_chunks(f, &ctx, pack_name_concat_len,
+			  ctx.nr - dropped_packs, midx_hash);
 
-	if (flags & MIDX_WRITE_REV_INDEX)
+	if (flags & (MIDX_WRITE_REV_INDEX | MIDX_WRITE_BITMAP))
 		ctx.pack_order = midx_pack_order(&ctx);
 
-	if (flags & MIDX_WRITE_REV_INDEX)
+	if (flags & (MIDX_WRITE_REV_INDEX | MIDX_WRITE_BITMAP))
 		write_midx_reverse_index(midx_name, midx_hash, &ctx);
+	if (flags & MIDX_WRITE_BITMAP)
+		write_midx_bitmap(midx_name, midx_hash, &ctx, flags);
+
+	clear_midx_files_ext(the_repository, ".bitmap", midx_hash);
 	clear_midx_files_ext(the_repository, ".rev", midx_hash);
 
 	commit_lock_file(&lk);
+	clear_midx_chain(object_dir);
 
 cleanup:
 	for (i = 0; i < ctx.nr; i++) {
@@ -1107,10 +1656,330 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	return result;
 }
 
+/*
+ * A new layer absorbs the layers below it for as long as they are no
+ * larger than this multiple of its own size, which keeps the number of
+ * layers logarithmic in the number of objects.
+ */
+#define MIDX_CHAIN_SIZE_MULTIPLE 2
+
+static void add_layer_packs_to_midx(const char *object_dir,
+				    struct multi_pack_index *m,
+				    struct write_midx_context *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+		char *pack_path = xstrfmt("%s/pack/%s", object_dir,
+					  m->pack_names[i]);
+
+		p = add_packed_git(pack_path, strlen(pack_path), 0);
+		free(pack_path);
+
+		/* Packs that have since been removed are simply dropped. */
+		if (!p)
+			continue;
+		if (open_pack_index(p)) {
+			close_pack(p);
+			free(p);
+			continue;
+		}
+
+		ALLOC_GROW(ctx->info, ctx->nr + 1, ctx->alloc);
+		ctx->info[ctx->nr].p = p;
+		ctx->info[ctx->nr].pack_name = xstrdup(m->pack_names[i]);
+		ctx->info[ctx->nr].orig_pack_int_id = ctx->nr;
+		ctx->info[ctx->nr].expired = 0;
+		ctx->nr++;
+	}
+}
+
+static void clear_midx_layer(const char *full_path, size_t full_path_len,
+			     const char *file_name, void *data)
+{
+	struct string_list *keep = data;
+
+	if (!starts_with(file_name, "multi-pack-index-") ||
+	    !ends_with(file_name, ".midx"))
+		return;
+	if (unsorted_string_list_has_string(keep, file_name))
+		return;
+
+	if (unlink(full_path))
+		warning_errno(_("failed to remove %s"), full_path);
+}
+
+static void clear_unused_midx_layers(const char *object_dir,
+				     struct string_list *keep)
+{
+	char *chain_dir = get_midx_chain_dirname(object_dir);
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(chain_dir);
+	if (!dir) {
+		free(chain_dir);
+		return;
+	}
+
+	strbuf_addf(&path, "%s/", chain_dir);
+	while ((de = readdir_skip_dot_and_dotdot(dir)) != NULL) {
+		size_t len = path.len;
+
+		strbuf_addstr(&path, de->d_name);
+		clear_midx_layer(path.buf, path.len, de->d_name, keep);
+		strbuf_setlen(&path, len);
+	}
+
+	closedir(dir);
+	strbuf_release(&path);
+	free(chain_dir);
+}
+
+/*
+ * Write a MIDX layer covering the packs of "ctx" to the chain directory
+ * of "object_dir", omitting any object already indexed by "base" or the
+ * layers below it.
+ */
+static int write_midx_layer(const char *object_dir,
+			    struct write_midx_context *ctx,
+			    struct multi_pack_index *base,
+			    const char *preferred_pack_name,
+			    unsigned char *midx_hash)
+{
+	struct multi_pack_index *m;
+	struct tempfile *layer;
+	struct hashfile *f;
+	char *layer_name;
+	int pack_name_concat_len = 0;
+	uint32_t i, j;
+
+	ctx->preferred_pack_idx = -1;
+	if (preferred_pack_name) {
+		for (i = 0; i < ctx->nr; i++) {
+			if (!cmp_idx_or_pack_name(preferred_pack_name,
+						  ctx->info[i].pack_name)) {
+				ctx->preferred_pack_idx = i;
+				break;
+			}
+		}
+	}
+
+	ctx->entries = get_sorted_entries(NULL, ctx->info, ctx->nr,
+					  &ctx->entries_nr,
+					  ctx->preferred_pack_idx);
+
+	for (i = j = 0; i < ctx->entries_nr; i++) {
+		for (m = base; m; m = m->base_midx)
+			if (bsearch_midx(&ctx->entries[i].oid, m, NULL))
+				break;
+		if (!m)
+			ctx->entries[j++] = ctx->entries[i];
+	}
+	ctx->entries_nr = j;
+
+	for (i = 0; i < ctx->entries_nr; i++) {
+		if (ctx->entries[i].offset > 0x7fffffff)
+			ctx->num_large_offsets++;
+		if (ctx->entries[i].offset > 0xffffffff)
+			ctx->large_offsets_needed = 1;
+	}
+
+	QSORT(ctx->info, ctx->nr, pack_info_compare);
+	ALLOC_ARRAY(ctx->pack_perm, ctx->nr);
+	for (i = 0; i < ctx->nr; i++) {
+		if (i && !strcmp(ctx->info[i].pack_name, ctx->info[i - 1].pack_name))
+			BUG("pack %s appears twice in a multi-pack-index layer",
+			    ctx->info[i].pack_name);
+		ctx->pack_perm[ctx->info[i].orig_pack_int_id] = i;
+		pack_name_concat_len += strlen(ctx->info[i].pack_name) + 1;
+	}
+	if (pack_name_concat_len % MIDX_CHUNK_ALIGNMENT)
+		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
+					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
+
+	layer_name = xstrfmt("%s/pack/multi-pack-index.d/tmp_midx_XXXXXX",
+			     object_dir);
+	layer = mks_tempfile_m(layer_name, 0444);
+	if (!layer)
+		die_errno(_("unable to create '%s'"), layer_name);
+	free(layer_name);
+
+	f = hashfd(get_tempfile_fd(layer), get_tempfile_path(layer));
+	write_midx_chunks(f, ctx, pack_name_concat_len, ctx->nr, midx_hash);
+
+	layer_name = get_midx_layer_filename(object_dir, hash_to_hex(midx_hash));
+	if (rename_tempfile(&layer, layer_name)) {
+		error_errno(_("unable to rename multi-pack-index layer to %s"),
+			    layer_name);
+		free(layer_name);
+		return -1;
+	}
+	free(layer_name);
+
+	trace2_data_intmax("midx", the_repository, "incremental/num_packs",
+			   ctx->nr);
+	trace2_data_intmax("midx", the_repository, "incremental/num_objects",
+			   ctx->entries_nr);
+	return 0;
+}
+
+/*
+ * Add a layer covering the packs of "object_dir" that are not yet in its
+ * multi-pack-index chain, merging it with the layers below it according
+ * to MIDX_CHAIN_SIZE_MULTIPLE. An existing standalone MIDX becomes the
+ * bottom layer of the new chain.
+ */
+static int write_midx_incremental(const char *object_dir,
+				  const char *preferred_pack_name,
+				  unsigned flags)
+{
+	struct write_midx_context ctx = { 0 };
+	struct multi_pack_index *chain = NULL, *base, *m;
+	struct lock_file lk = LOCK_INIT, midx_lk = LOCK_INIT;
+	struct string_list keep = STRING_LIST_INIT_DUP;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
+	char *chain_name = get_midx_chain_filename(object_dir);
+	char *midx_name = get_midx_filename(object_dir);
+	int converted = 0;
+	uint32_t num_objects = 0;
+	uint32_t i;
+	FILE *fp;
+	int result = 0;
+
+	if (flags & MIDX_WRITE_BITMAP) {
+		result = error(_("cannot write a multi-pack bitmap for an "
+				 "incremental multi-pack-index"));
+		goto out;
+	}
+
+	if (safe_create_leading_directories(chain_name))
+		die_errno(_("unable to create leading directories of %s"),
+			  chain_name);
+	/*
+	 * Hold the standalone MIDX lock too, taken first as
+	 * write_midx_internal() does, so that it is not replaced or
+	 * removed under us while we turn it into a layer.
+	 */
+	hold_lock_file_for_update(&midx_lk, midx_name, LOCK_DIE_ON_ERROR);
+	hold_lock_file_for_update(&lk, chain_name, LOCK_DIE_ON_ERROR);
+
+	chain = load_multi_pack_index(object_dir, 1);
+	if (chain && midx_checksum_valid(chain)) {
+		/*
+		 * Any existing chain is older than the standalone MIDX,
+		 * which becomes the sole layer the new chain is built on.
+		 * Readers keep using the standalone MIDX until the new
+		 * chain is committed, so leave it in place until then.
+		 */
+		char *layer_name = get_midx_layer_filename(object_dir,
+				hash_to_hex(get_midx_checksum(chain)));
+
+		if (!file_exists(layer_name) &&
+		    link(midx_name, layer_name) &&
+		    copy_file(layer_name, midx_name, 0444))
+			die_errno(_("unable to copy %s to %s"),
+				  midx_name, layer_name);
+		free(layer_name);
+		chain->in_chain = 1;
+		converted = 1;
+	} else {
+		if (chain) {
+			warning(_("ignoring existing multi-pack-index; checksum mismatch"));
+			close_midx(chain);
+			free(chain);
+		}
+		chain = load_multi_pack_index_chain(object_dir, 1);
+	}
+
+	ctx.m = chain;
+	ctx.alloc = 16;
+	ALLOC_ARRAY(ctx.info, ctx.alloc);
+	if (flags & MIDX_PROGRESS)
+		ctx.progress = start_delayed_progress(_("Adding packfiles to multi-pack-index"), 0);
+	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &ctx);
+	stop_progress(&ctx.progress);
+
+	if (!ctx.nr && !converted)
+		goto out; /* nothing new to index */
+
+	for (i = 0; i < ctx.nr; i++)
+		num_objects += ctx.info[i].p->num_objects;
+
+	base = chain;
+	if (ctx.nr) {
+		while (base &&
+		       base->num_objects <= MIDX_CHAIN_SIZE_MULTIPLE * num_objects) {
+			add_layer_packs_to_midx(object_dir, base, &ctx);
+			num_objects += base->num_objects;
+			base = base->base_midx;
+		}
+	}
+
+	if (ctx.nr) {
+		result = write_midx_layer(object_dir, &ctx, base,
+					  preferred_pack_name, midx_hash);
+		if (result)
+			goto out;
+	}
+
+	/* The chain file lists the layers from the bottom up. */
+	for (m = base; m; m = m->base_midx)
+		string_list_append_nodup(&keep, xstrfmt("multi-pack-index-%s.midx",
+					 hash_to_hex(get_midx_checksum(m))))->util = m;
+	fp = fdopen_lock_file(&lk, "w");
+	if (!fp)
+		die_errno(_("unable to open %s"), get_lock_file_path(&lk));
+	for (i = keep.nr; i; i--)
+		fprintf(fp, "%s\n",
+			hash_to_hex(get_midx_checksum(keep.items[i - 1].util)));
+	if (ctx.nr) {
+		fprintf(fp, "%s\n", hash_to_hex(midx_hash));
+		string_list_append_nodup(&keep, xstrfmt("multi-pack-index-%s.midx",
+					 hash_to_hex(midx_hash)));
+	}
+	if (commit_lock_file(&lk))
+		die_errno(_("unable to write %s"), chain_name);
+
+	if (converted) {
+		unlink_or_warn(midx_name);
+		clear_midx_files_ext(the_repository, ".bitmap", NULL);
+		clear_midx_files_ext(the_repository, ".rev", NULL);
+	}
+	clear_unused_midx_layers(object_dir, &keep);
+
+out:
+	rollback_lock_file(&lk);
+	rollback_lock_file(&midx_lk);
+	for (i = 0; i < ctx.nr; i++) {
+		if (ctx.info[i].p) {
+			close_pack(ctx.info[i].p);
+			free(ctx.info[i].p);
+		}
+		free(ctx.info[i].pack_name);
+	}
+	free(ctx.info);
+	free(ctx.entries);
+	free(ctx.pack_perm);
+	if (chain) {
+		close_midx(chain);
+		free(chain);
+	}
+	string_list_clear(&keep, 0);
+	free(chain_name);
+	free(midx_name);
+	return result;
+}
+
 int write_midx_file(const char *object_dir,
 		    const char *preferred_pack_name,
 		    unsigned flags)
 {
+	if (flags & MIDX_WRITE_INCREMENTAL)
+		return write_midx_incremental(object_dir, preferred_pack_name,
+					      flags);
 	return write_midx_internal(object_dir, NULL, NULL, preferred_pack_name,
 				   flags);
 }
@@ -1153,6 +2022,19 @@ static void clear_midx_files_ext(struct repository *r, const char *ext,
 	free(data.keep);
 }
 
+static void clear_midx_chain(const char *object_dir)
+{
+	struct strbuf path = STRBUF_INIT;
+	char *chain_dir = get_midx_chain_dirname(object_dir);
+
+	strbuf_addstr(&path, chain_dir);
+	if (remove_dir_recursively(&path, 0))
+		die_errno(_("failed to remove %s"), chain_dir);
+
+	strbuf_release(&path);
+	free(chain_dir);
+}
+
 void clear_midx_file(struct repository *r)
 {
 	char *midx = get_midx_filename(r->objects->odb->path);
@@ -1164,7 +2046,9 @@ void clear_midx_file(struct repository *r)
 
 	if (remove_path(midx))
 		die(_("failed to clear multi-pack-index at %s"), midx);
+	clear_midx_chain(r->objects->odb->path);
 
+	clear_midx_files_ext(r, ".bitmap", NULL);
 	clear_midx_files_ext(r, ".rev", NULL);
 
 	free(midx);
@@ -1209,25 +2093,12 @@ static int compare_pair_pos_vs_id(const void *_a, const void *_b)
 			display_progress(progress, _n); \
 	} while (0)
 
-int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+static void verify_midx_one(struct repository *r, struct multi_pack_index *m,
+			    unsigned flags)
 {
 	struct pair_pos_vs_id *pairs = NULL;
 	uint32_t i;
 	struct progress *progress = NULL;
-	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
-	verify_midx_error = 0;
-
-	if (!m) {
-		int result = 0;
-		struct stat sb;
-		char *filename = get_midx_filename(object_dir);
-		if (!stat(filename, &sb)) {
-			error(_("multi-pack-index file exists, but failed to parse"));
-			result = 1;
-		}
-		free(filename);
-		return result;
-	}
 
 	if (!midx_checksum_valid(m))
 		midx_report(_("incorrect checksum"));
@@ -1253,12 +2124,17 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	}
 
 	if (m->num_objects == 0) {
-		midx_report(_("the midx contains no oid"));
+		/*
+		 * A layer of a chain may legitimately be empty, when all
+		 * of its packs' objects are found in the layers below.
+		 */
+		if (!m->in_chain)
+			midx_report(_("the midx contains no oid"));
 		/*
 		 * Remaining tests assume that we have objects, so we can
 		 * return here.
 		 */
-		return verify_midx_error;
+		return;
 	}
 
 	if (flags & MIDX_PROGRESS)
@@ -1337,6 +2213,32 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	stop_progress(&progress);
 
 	free(pairs);
+}
+
+int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	struct multi_pack_index *layer;
+	verify_midx_error = 0;
+
+	if (!m)
+		m = load_multi_pack_index_chain(object_dir, 1);
+	if (!m) {
+		int result = 0;
+		struct stat sb;
+		char *filename = get_midx_filename(object_dir);
+		char *chain_name = get_midx_chain_filename(object_dir);
+		if (!stat(filename, &sb) || !stat(chain_name, &sb)) {
+			error(_("multi-pack-index file exists, but failed to parse"));
+			result = 1;
+		}
+		free(filename);
+		free(chain_name);
+		return result;
+	}
+
+	for (layer = m; layer; layer = layer->base_midx)
+		verify_midx_one(r, layer, flags);
 
 	return verify_midx_error;
 }
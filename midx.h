@@ -12,6 +12,12 @@ struct repository;
 struct multi_pack_index {
 	struct multi_pack_index *next;
 
+	/*
+	 * For a layer of a multi-pack-index chain, the layer below it
+	 * (NULL for the bottom layer, or for a standalone MIDX).
+	 */
+	struct multi_pack_index *base_midx;
+
 	const unsigned char *data;
 	size_t data_len;
 
@@ -27,12 +33,16 @@ struct multi_pack_index {
 	uint32_t num_objects;
 
 	int local;
+	unsigned in_chain : 1;
 
 	const unsigned char *chunk_pack_names;
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
+	const unsigned char *chunk_object_filter;
+	uint32_t object_filter_blocks;
+	uint32_t object_filter_hashes;
 
 	const char **pack_names;
 	struct packed_git **packs;
@@ -41,10 +51,22 @@ struct multi_pack_index {
 
 #define MIDX_PROGRESS     (1 << 0)
 #define MIDX_WRITE_REV_INDEX (1 << 1)
+#define MIDX_WRITE_BITMAP (1 << 2)
+#define MIDX_WRITE_INCREMENTAL (1 << 3)
 
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_filename(const char *object_dir);
 char *get_midx_rev_filename(struct multi_pack_index *m);
+char *get_midx_chain_dirname(const char *object_dir);
+char *get_midx_chain_filename(const char *object_dir);
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
+/*
+ * Load the layers listed in the multi-pack-index chain of "object_dir",
+ * returning the topmost one (or NULL if there is no chain). Lower layers
+ * are reachable through both "base_midx" and "next".
+ */
+struct multi_pack_index *load_multi_pack_index_chain(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
 off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
@@ -151,21 +151,6 @@ static int lazy_nr_dir_threads;
  */
 #define LAZY_THREAD_COST (2000)
 
-/*
- * We use n mutexes to guard n partitions of the "istate->dir_hash"
- * hashtable.  Since "find" and "insert" operations will hash to a
- * particular bucket and modify/search a single chain, we can say
- * that "all chains mod n" are guarded by the same mutex -- rather
- * than having a single mutex to guard the entire table.  (This does
- * require that we disable "rehashing" on the hashtable.)
- *
- * So, a larger value here decreases the probability of a collision
- * and the time that each thread must wait for the mutex.
- */
-#define LAZY_MAX_MUTEX   (32)
-
-static pthread_mutex_t *lazy_dir_mutex_array;
-
 /*
  * An array of lazy_entry items is used by the n threads in
  * the directory parse (first) phase to (lock-free) store the
@@ -178,6 +163,27 @@ struct lazy_entry {
 	unsigned int hash_name;
 };
 
+/*
+ * Each "dir" thread collects the directories it sees in a hashmap
+ * of its own, so the threads never have to synchronize with each
+ * other.  A directory that straddles the boundary between two
+ * threads' ranges (or that only differs in case) is found by more
+ * than one of them; those duplicates are folded together when the
+ * private tables are merged into "istate->dir_hash".
+ */
+struct lazy_dir_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct lazy_entry *lazy_entries;
+	int k_start;
+	int k_end;
+
+	struct hashmap dir_hash;
+	/* in creation order, i.e., parents before their children */
+	struct dir_entry **dirs;
+	int dirs_nr, dirs_alloc;
+};
+
 /*
  * Decide if we want to use threads (if available) to load
  * the hash tables.  We set "lazy_nr_dir_threads" to zero when
@@ -213,63 +219,13 @@ static int lookup_lazy_params(struct index_state *istate)
 	return lazy_nr_dir_threads;
 }
 
-/*
- * Initialize n mutexes for use when searching and inserting
- * into "istate->dir_hash".  All "dir" threads are trying
- * to insert partial pathnames into the hash as they iterate
- * over their portions of the index, so lock contention is
- * high.
- *
- * However, the hashmap is going to put items into bucket
- * chains based on their hash values.  Use that to create n
- * mutexes and lock on mutex[bucket(hash) % n].  This will
- * decrease the collision rate by (hopefully) a factor of n.
- */
-static void init_dir_mutex(void)
-{
-	int j;
-
-	CALLOC_ARRAY(lazy_dir_mutex_array, LAZY_MAX_MUTEX);
-
-	for (j = 0; j < LAZY_MAX_MUTEX; j++)
-		init_recursive_mutex(&lazy_dir_mutex_array[j]);
-}
-
-static void cleanup_dir_mutex(void)
-{
-	int j;
-
-	for (j = 0; j < LAZY_MAX_MUTEX; j++)
-		pthread_mutex_destroy(&lazy_dir_mutex_array[j]);
-
-	free(lazy_dir_mutex_array);
-}
-
-static void lock_dir_mutex(int j)
-{
-	pthread_mutex_lock(&lazy_dir_mutex_array[j]);
-}
-
-static void unlock_dir_mutex(int j)
-{
-	pthread_mutex_unlock(&lazy_dir_mutex_array[j]);
-}
-
-static inline int compute_dir_lock_nr(
-	const struct hashmap *map,
-	unsigned int hash)
-{
-	return hashmap_bucket(map, hash) % LAZY_MAX_MUTEX;
-}
-
 static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	struct dir_entry *parent,
 	struct strbuf *prefix)
 {
-	struct dir_entry *dir;
+	struct dir_entry *dir, key;
 	unsigned int hash;
-	int lock_nr;
 
 	/*
 	 * Either we have a parent directory and path with slash(es)
@@ -284,29 +240,20 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
 	else
 		hash = memihash(prefix->buf, prefix->len);
 
-	lock_nr = compute_dir_lock_nr(&istate->dir_hash, hash);
-	lock_dir_mutex(lock_nr);
-
-	dir = find_dir_entry__hash(istate, prefix->buf, prefix->len, hash);
+	hashmap_entry_init(&key.ent, hash);
+	key.namelen = prefix->len;
+	dir = hashmap_get_entry(&d->dir_hash, &key, ent, prefix->buf);
 	if (!dir) {
 		FLEX_ALLOC_MEM(dir, name, prefix->buf, prefix->len);
 		hashmap_entry_init(&dir->ent, hash);
 		dir->namelen = prefix->len;
 		dir->parent = parent;
-		hashmap_add(&istate->dir_hash, &dir->ent);
-
-		if (parent) {
-			unlock_dir_mutex(lock_nr);
+		hashmap_add(&d->dir_hash, &dir->ent);
 
-			/* All I really need here is an InterlockedIncrement(&(parent->nr)) */
-			lock_nr = compute_dir_lock_nr(&istate->dir_hash, parent->ent.hash);
-			lock_dir_mutex(lock_nr);
-			parent->nr++;
-		}
+		ALLOC_GROW(d->dirs, d->dirs_nr + 1, d->dirs_alloc);
+		d->dirs[d->dirs_nr++] = dir;
 	}
 
-	unlock_dir_mutex(lock_nr);
-
 	return dir;
 }
 
@@ -318,7 +265,7 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
  * directory.
  */
 static int handle_range_1(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
@@ -326,7 +273,7 @@ static int handle_range_1(
 	struct lazy_entry *lazy_entries);
 
 static int handle_range_dir(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
@@ -334,11 +281,12 @@ static int handle_range_dir(
 	struct lazy_entry *lazy_entries,
 	struct dir_entry **dir_new_out)
 {
+	struct index_state *istate = d->istate;
 	int rc, k;
 	int input_prefix_len = prefix->len;
 	struct dir_entry *dir_new;
 
-	dir_new = hash_dir_entry_with_parent_and_prefix(istate, parent, prefix);
+	dir_new = hash_dir_entry_with_parent_and_prefix(d, parent, prefix);
 
 	strbuf_addch(prefix, '/');
 
@@ -372,7 +320,7 @@ static int handle_range_dir(
 	/*
 	 * Recurse and process what we can of this subset [k_start, k).
 	 */
-	rc = handle_range_1(istate, k_start, k, dir_new, prefix, lazy_entries);
+	rc = handle_range_1(d, k_start, k, dir_new, prefix, lazy_entries);
 
 	strbuf_setlen(prefix, input_prefix_len);
 
@@ -381,13 +329,14 @@ static int handle_range_dir(
 }
 
 static int handle_range_1(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
 	struct strbuf *prefix,
 	struct lazy_entry *lazy_entries)
 {
+	struct index_state *istate = d->istate;
 	int input_prefix_len = prefix->len;
 	int k = k_start;
 
@@ -407,7 +356,7 @@ static int handle_range_1(
 			struct dir_entry *dir_new;
 
 			strbuf_add(prefix, name, len);
-			processed = handle_range_dir(istate, k, k_end, parent, prefix, lazy_entries, &dir_new);
+			processed = handle_range_dir(d, k, k_end, parent, prefix, lazy_entries, &dir_new);
 			if (processed) {
 				k += processed;
 				strbuf_setlen(prefix, input_prefix_len);
@@ -415,7 +364,7 @@ static int handle_range_1(
 			}
 
 			strbuf_addch(prefix, '/');
-			processed = handle_range_1(istate, k, k_end, dir_new, prefix, lazy_entries);
+			processed = handle_range_1(d, k, k_end, dir_new, prefix, lazy_entries);
 			k += processed;
 			strbuf_setlen(prefix, input_prefix_len);
 			continue;
@@ -451,19 +400,11 @@ static int handle_range_1(
 	return k - k_start;
 }
 
-struct lazy_dir_thread_data {
-	pthread_t pthread;
-	struct index_state *istate;
-	struct lazy_entry *lazy_entries;
-	int k_start;
-	int k_end;
-};
-
 static void *lazy_dir_thread_proc(void *_data)
 {
 	struct lazy_dir_thread_data *d = _data;
 	struct strbuf prefix = STRBUF_INIT;
-	handle_range_1(d->istate, d->k_start, d->k_end, NULL, &prefix, d->lazy_entries);
+	handle_range_1(d, d->k_start, d->k_end, NULL, &prefix, d->lazy_entries);
 	strbuf_release(&prefix);
 	return NULL;
 }
@@ -489,15 +430,86 @@ static void *lazy_name_thread_proc(void *_data)
 	return NULL;
 }
 
+/*
+ * A directory that was folded into an equivalent entry found
+ * earlier is marked with a negative "nr", and its "parent" then
+ * points to the entry that replaced it.
+ */
+static inline struct dir_entry *lazy_merged_dir(struct dir_entry *dir)
+{
+	return (dir && dir->nr < 0) ? dir->parent : dir;
+}
+
+/*
+ * Move the directories collected by each "dir" thread into
+ * "istate->dir_hash".  Going through the threads in order, and
+ * through each thread's directories in the order they were created,
+ * means that the first spelling of a directory in index order wins,
+ * just like it does in the single-threaded code, and that parents
+ * are always merged before their children.
+ */
+static void lazy_merge_dir_hashes(
+	struct index_state *istate,
+	struct lazy_dir_thread_data *td_dir)
+{
+	int t, j;
+
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		struct lazy_dir_thread_data *d = td_dir + t;
+
+		for (j = 0; j < d->dirs_nr; j++) {
+			struct dir_entry *dir = d->dirs[j];
+			struct dir_entry *found;
+
+			dir->parent = lazy_merged_dir(dir->parent);
+			found = find_dir_entry__hash(istate, dir->name,
+						     dir->namelen,
+						     dir->ent.hash);
+			if (found) {
+				dir->nr = -1;
+				dir->parent = found;
+			} else {
+				hashmap_add(&istate->dir_hash, &dir->ent);
+			}
+		}
+
+		/* Drop the private table, but not the entries. */
+		hashmap_clear(&d->dir_hash);
+	}
+}
+
 static inline void lazy_update_dir_ref_counts(
 	struct index_state *istate,
-	struct lazy_entry *lazy_entries)
+	struct lazy_entry *lazy_entries,
+	struct lazy_dir_thread_data *td_dir)
 {
-	int k;
+	struct dir_entry *dir;
+	int k, t, j;
+
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		for (j = 0; j < td_dir[t].dirs_nr; j++) {
+			dir = td_dir[t].dirs[j];
+			if (dir->nr >= 0 && dir->parent)
+				dir->parent->nr++;
+		}
+	}
 
 	for (k = 0; k < istate->cache_nr; k++) {
-		if (lazy_entries[k].dir)
-			lazy_entries[k].dir->nr++;
+		dir = lazy_merged_dir(lazy_entries[k].dir);
+		if (dir)
+			dir->nr++;
+	}
+}
+
+static void lazy_free_merged_dirs(struct lazy_dir_thread_data *td_dir)
+{
+	int t, j;
+
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		for (j = 0; j < td_dir[t].dirs_nr; j++)
+			if (td_dir[t].dirs[j]->nr < 0)
+				free(td_dir[t].dirs[j]);
+		free(td_dir[t].dirs);
 	}
 }
 
@@ -522,11 +534,10 @@ static void threaded_lazy_init_name_hash(
 	CALLOC_ARRAY(td_dir, lazy_nr_dir_threads);
 	CALLOC_ARRAY(td_name, 1);
 
-	init_dir_mutex();
-
 	/*
 	 * Phase 1:
-	 * Build "istate->dir_hash" using n "dir" threads (and a read-only index).
+	 * Collect the directories using n "dir" threads (and a read-only
+	 * index), each into a private hashmap.
 	 */
 	for (t = 0; t < lazy_nr_dir_threads; t++) {
 		struct lazy_dir_thread_data *td_dir_t = td_dir + t;
@@ -537,6 +548,7 @@ static void threaded_lazy_init_name_hash(
 		if (k_start > istate->cache_nr)
 			k_start = istate->cache_nr;
 		td_dir_t->k_end = k_start;
+		hashmap_init(&td_dir_t->dir_hash, dir_entry_cmp, NULL, 0);
 		err = pthread_create(&td_dir_t->pthread, NULL, lazy_dir_thread_proc, td_dir_t);
 		if (err)
 			die(_("unable to create lazy_dir thread: %s"), strerror(err));
@@ -553,9 +565,10 @@ static void threaded_lazy_init_name_hash(
 	 * using a single "name" background thread.
 	 * (Testing showed it wasn't worth running more than 1 thread for this.)
 	 *
-	 * Meanwhile, finish updating the parent directory ref-counts for each
-	 * index entry using the current thread.  (This step is very fast and
-	 * doesn't need threading.)
+	 * Meanwhile, merge the directories into "istate->dir_hash" and
+	 * compute their ref-counts using the current thread.  (There are
+	 * far fewer directories than index entries, so this step is fast
+	 * and does not need threading.)
 	 */
 	td_name->istate = istate;
 	td_name->lazy_entries = lazy_entries;
@@ -563,14 +576,14 @@ static void threaded_lazy_init_name_hash(
 	if (err)
 		die(_("unable to create lazy_name thread: %s"), strerror(err));
 
-	lazy_update_dir_ref_counts(istate, lazy_entries);
+	lazy_merge_dir_hashes(istate, td_dir);
+	lazy_update_dir_ref_counts(istate, lazy_entries, td_dir);
+	lazy_free_merged_dirs(td_dir);
 
 	err = pthread_join(td_name->pthread, NULL);
 	if (err)
 		die(_("unable to join lazy_name thread: %s"), strerror(err));
 
-	cleanup_dir_mutex();
-
 	free(td_name);
 	free(td_dir);
 	free(lazy_entries);
@@ -587,15 +600,7 @@ static void lazy_init_name_hash(struct index_state *istate)
 	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
 
 	if (lookup_lazy_params(istate)) {
-		/*
-		 * Disable item counting and automatic rehashing because
-		 * we do per-chain (mod n) locking rather than whole hashmap
-		 * locking and we need to prevent the table-size from changing
-		 * and bucket items from being redistributed.
-		 */
-		hashmap_disable_item_counting(&istate->dir_hash);
 		threaded_lazy_init_name_hash(istate);
-		hashmap_enable_item_counting(&istate->dir_hash);
 	} else {
 		int nr;
 		for (nr = 0; nr < istate->cache_nr; nr++)
@@ -0,0 +1,331 @@
+#include "cache.h"
+#include "generation.h"
+#include "../commit.h"
+#include "../commit-slab.h"
+#include "../fetch-negotiator.h"
+#include "../prio-queue.h"
+#include "../refs.h"
+#include "../tag.h"
+
+/*
+ * Like the skipping negotiator, this sends "have" lines at exponentially
+ * growing distances from the tips, but it walks the commits in
+ * generation number order instead of commit date order.  With a
+ * commit-graph, that order is topological: every child of a commit is
+ * popped before the commit itself, so the distance of a commit from its
+ * tip is known exactly by the time it is popped, and clock skew cannot
+ * make the walk pass over a commit.
+ *
+ * The skip distance is not kept per path.  All the commits reached from
+ * one tip share a "band", and the band sends one commit each time the walk
+ * crosses its next distance, whichever line of history that commit is on.
+ * A tip that is reachable from another tip joins the band of that tip,
+ * as its descendants are always popped first.
+ * On histories with many parallel lines merged together this sends one
+ * "have" per step of the band rather than one per line, so the unknown
+ * region is narrowed down with fewer "have" lines and round trips.
+ */
+
+/* Remember to update object flag allocation in object.h */
+/*
+ * Both us and the server know that both parties have this object.
+ */
+#define COMMON		(1U << 2)
+/*
+ * The server has told us that it has this object. We still need to tell the
+ * server that we have this object (or one of its descendants), but since we are
+ * going to do that, we do not need to tell the server about its ancestors.
+ */
+#define ADVERTISED	(1U << 3)
+/*
+ * This commit has entered the priority queue.
+ */
+#define SEEN		(1U << 4)
+/*
+ * This commit has left the priority queue.
+ */
+#define POPPED		(1U << 5)
+
+static int marked;
+
+/*
+ * The skip state shared by the commits reached from one tip.
+ */
+struct band {
+	/*
+	 * The next commit at this distance from the tip, or further, is
+	 * sent.
+	 */
+	int next_depth;
+	int stride;
+};
+
+/*
+ * An entry in the priority queue.
+ */
+struct entry {
+	struct commit *commit;
+
+	/*
+	 * Used only if commit is not COMMON.  An entry without a band is
+	 * sent as soon as it is popped; if it is not ADVERTISED, it is a tip
+	 * not reachable from any other tip and starts a band of its own.
+	 */
+	struct band *band;
+	int depth;
+};
+
+define_commit_slab(entry_slab, struct entry *);
+
+struct data {
+	struct prio_queue rev_list;
+	struct entry_slab entries;
+
+	struct band **bands;
+	size_t bands_nr, bands_alloc;
+
+	/*
+	 * The number of non-COMMON commits in rev_list.
+	 */
+	int non_common_revs;
+};
+
+static int compare(const void *a_, const void *b_, void *unused)
+{
+	const struct entry *a = a_;
+	const struct entry *b = b_;
+	return compare_commits_by_gen_then_commit_date(a->commit, b->commit, NULL);
+}
+
+static struct band *new_band(struct data *data)
+{
+	struct band *band;
+
+	CALLOC_ARRAY(band, 1);
+	band->stride = 2;
+	ALLOC_GROW(data->bands, data->bands_nr + 1, data->bands_alloc);
+	data->bands[data->bands_nr++] = band;
+	return band;
+}
+
+static struct entry *rev_list_push(struct data *data, struct commit *commit, int mark)
+{
+	struct entry *entry;
+	commit->object.flags |= mark | SEEN;
+
+	/* the queue order needs the generation number */
+	parse_commit(commit);
+
+	CALLOC_ARRAY(entry, 1);
+	entry->commit = commit;
+	*entry_slab_at(&data->entries, commit) = entry;
+	prio_queue_put(&data->rev_list, entry);
+
+	if (!(mark & COMMON))
+		data->non_common_revs++;
+	return entry;
+}
+
+static int clear_marks(const char *refname, const struct object_id *oid,
+		       int flag, void *cb_data)
+{
+	struct object *o = deref_tag(the_repository, parse_object(the_repository, oid), refname, 0);
+
+	if (o && o->type == OBJ_COMMIT)
+		clear_commit_marks((struct commit *)o,
+				   COMMON | ADVERTISED | SEEN | POPPED);
+	return 0;
+}
+
+/*
+ * Mark this SEEN commit and all its SEEN ancestors as COMMON.
+ */
+static void mark_common(struct data *data, struct commit *c)
+{
+	struct commit_list *p;
+
+	if (c->object.flags & COMMON)
+		return;
+	c->object.flags |= COMMON;
+	if (!(c->object.flags & POPPED))
+		data->non_common_revs--;
+
+	if (!c->object.parsed)
+		return;
+	for (p = c->parents; p; p = p->next) {
+		if (p->item->object.flags & SEEN)
+			mark_common(data, p->item);
+	}
+}
+
+/*
+ * How many more steps from this commit until its band sends a commit.
+ */
+static int remaining(struct band *band, int depth)
+{
+	return band->next_depth - depth;
+}
+
+/*
+ * Ensure that the priority queue has an entry for to_push, and ensure that the
+ * entry has the correct flags, band and depth.  When the commit is reached
+ * from two bands, it stays with the one that sends a commit sooner.
+ *
+ * This function returns 1 if an entry was found or created, and 0 otherwise
+ * (because the entry for this commit had already been popped).
+ */
+static int push_parent(struct data *data, struct entry *entry,
+		       struct commit *to_push)
+{
+	struct entry *parent_entry;
+	int depth = entry->depth + 1;
+
+	if (to_push->object.flags & SEEN) {
+		if (to_push->object.flags & POPPED)
+			/*
+			 * The entry for this commit has already been popped,
+			 * which can only happen without generation numbers,
+			 * due to clock skew. Pretend that this parent does
+			 * not exist.
+			 */
+			return 0;
+		parent_entry = *entry_slab_at(&data->entries, to_push);
+		if (!parent_entry)
+			BUG("missing parent in priority queue");
+	} else {
+		parent_entry = rev_list_push(data, to_push, 0);
+	}
+
+	if (entry->commit->object.flags & (COMMON | ADVERTISED)) {
+		mark_common(data, to_push);
+	} else if (!parent_entry->band) {
+		parent_entry->band = entry->band;
+		parent_entry->depth = depth;
+	} else if (parent_entry->band == entry->band) {
+		if (parent_entry->depth < depth)
+			parent_entry->depth = depth;
+	} else if (entry->band &&
+		   remaining(entry->band, depth) <
+		   remaining(parent_entry->band, parent_entry->depth)) {
+		parent_entry->band = entry->band;
+		parent_entry->depth = depth;
+	}
+
+	return 1;
+}
+
+static const struct object_id *get_rev(struct data *data)
+{
+	struct commit *to_send = NULL;
+
+	while (to_send == NULL) {
+		struct entry *entry;
+		struct commit *commit;
+		struct commit_list *p;
+		int parent_pushed = 0;
+
+		if (data->rev_list.nr == 0 || data->non_common_revs == 0)
+			return NULL;
+
+		entry = prio_queue_get(&data->rev_list);
+		commit = entry->commit;
+		commit->object.flags |= POPPED;
+		*entry_slab_at(&data->entries, commit) = NULL;
+		if (!(commit->object.flags & COMMON))
+			data->non_common_revs--;
+
+		if (!(commit->object.flags & COMMON) &&
+		    (!entry->band || remaining(entry->band, entry->depth) <= 0)) {
+			struct band *band = entry->band;
+
+			to_send = commit;
+			if (!band && !(commit->object.flags & ADVERTISED))
+				band = entry->band = new_band(data);
+			if (band) {
+				band->next_depth = entry->depth + band->stride;
+				if (band->stride < (1 << 20))
+					band->stride *= 2;
+			}
+		}
+
+		for (p = commit->parents; p; p = p->next)
+			parent_pushed |= push_parent(data, entry, p->item);
+
+		if (!(commit->object.flags & COMMON) && !parent_pushed)
+			/*
+			 * This commit has no parents, or all of its parents
+			 * have already been popped (due to clock skew), so send
+			 * it anyway.
+			 */
+			to_send = commit;
+
+		free(entry);
+	}
+
+	return &to_send->object.oid;
+}
+
+static void known_common(struct fetch_negotiator *n, struct commit *c)
+{
+	if (c->object.flags & SEEN)
+		return;
+	rev_list_push(n->data, c, ADVERTISED);
+}
+
+static void add_tip(struct fetch_negotiator *n, struct commit *c)
+{
+	n->known_common = NULL;
+	if (c->object.flags & SEEN)
+		return;
+	rev_list_push(n->data, c, 0);
+}
+
+static const struct object_id *next(struct fetch_negotiator *n)
+{
+	n->known_common = NULL;
+	n->add_tip = NULL;
+	return get_rev(n->data);
+}
+
+static int ack(struct fetch_negotiator *n, struct commit *c)
+{
+	int known_to_be_common = !!(c->object.flags & COMMON);
+	if (!(c->object.flags & SEEN))
+		die("received ack for commit %s not sent as 'have'\n",
+		    oid_to_hex(&c->object.oid));
+	mark_common(n->data, c);
+	return known_to_be_common;
+}
+
+static void release(struct fetch_negotiator *n)
+{
+	struct data *data = n->data;
+	struct entry *entry;
+	size_t i;
+
+	while ((entry = prio_queue_get(&data->rev_list)))
+		free(entry);
+	clear_prio_queue(&data->rev_list);
+	clear_entry_slab(&data->entries);
+	for (i = 0; i < data->bands_nr; i++)
+		free(data->bands[i]);
+	free(data->bands);
+	FREE_AND_NULL(n->data);
+}
+
+void generation_negotiator_init(struct fetch_negotiator *negotiator)
+{
+	struct data *data;
+	negotiator->known_common = known_common;
+	negotiator->add_tip = add_tip;
+	negotiator->next = next;
+	negotiator->ack = ack;
+	negotiator->release = release;
+	negotiator->data = CALLOC_ARRAY(data, 1);
+	data->rev_list.compare = compare;
+	init_entry_slab(&data->entries);
+
+	if (marked)
+		for_each_ref(clear_marks, NULL);
+	marked = 1;
+}
@@ -0,0 +1,477 @@
+#include "cache.h"
+#include "commit.h"
+#include "notes-index.h"
+#include "csum-file.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "notes.h"
+#include "object-store.h"
+#include "oidset.h"
+#include "refs.h"
+#include "repository.h"
+#include "tree-walk.h"
+
+/*
+ * The file format is:
+ *
+ *   - the 4-byte signature "NIDX", a 1-byte version (1), the 1-byte
+ *     hash algorithm (1 for SHA-1, 2 for SHA-256), and two
+ *     zero bytes;
+ *
+ *   - the name of the notes tree that was indexed;
+ *
+ *   - a fanout table of 256 4-byte entries in network byte order,
+ *     the nth of which is the number of entries whose object name
+ *     starts with a byte not greater than n;
+ *
+ *   - the entries, sorted by object name, each being the name of an
+ *     annotated object followed by the name of its note blob;
+ *
+ *   - a checksum of all of the above.
+ */
+#define NOTES_INDEX_SIGNATURE 0x4e494458 /* "NIDX" */
+#define NOTES_INDEX_VERSION 1
+#define NOTES_INDEX_HEADER_SIZE 8
+#define NOTES_INDEX_FANOUT_SIZE (256 * 4)
+
+struct notes_index {
+	const unsigned char *data;
+	size_t data_len;
+	const unsigned char *fanout;
+	const unsigned char *entries;
+	uint32_t nr;
+};
+
+static void notes_index_path(struct repository *r, struct strbuf *sb,
+			     const struct object_id *tree_oid)
+{
+	strbuf_git_common_path(sb, r, "notes-index/%s.idx",
+			       oid_to_hex(tree_oid));
+}
+
+static size_t entry_size(void)
+{
+	return 2 * the_hash_algo->rawsz;
+}
+
+struct notes_index *load_notes_index(struct repository *r,
+				     const struct object_id *tree_oid)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct notes_index *ni;
+	const unsigned char *data;
+	struct stat st;
+	size_t len, min_len;
+	uint32_t nr;
+	int fd;
+
+	notes_index_path(r, &path, tree_oid);
+	fd = git_open(path.buf);
+	if (fd < 0) {
+		strbuf_release(&path);
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		strbuf_release(&path);
+		return NULL;
+	}
+
+	len = xsize_t(st.st_size);
+	min_len = NOTES_INDEX_HEADER_SIZE + the_hash_algo->rawsz +
+		  NOTES_INDEX_FANOUT_SIZE + the_hash_algo->rawsz;
+	if (len < min_len) {
+		close(fd);
+		error(_("notes index file %s is too small"), path.buf);
+		strbuf_release(&path);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != NOTES_INDEX_SIGNATURE ||
+	    data[4] != NOTES_INDEX_VERSION ||
+	    data[5] != hash_algo_by_ptr(the_hash_algo) ||
+	    !hasheq(data + NOTES_INDEX_HEADER_SIZE, tree_oid->hash))
+		goto bad;
+
+	nr = get_be32(data + NOTES_INDEX_HEADER_SIZE +
+		      the_hash_algo->rawsz + NOTES_INDEX_FANOUT_SIZE - 4);
+	if ((len - min_len) / entry_size() != nr ||
+	    (len - min_len) % entry_size())
+		goto bad;
+
+	CALLOC_ARRAY(ni, 1);
+	ni->data = data;
+	ni->data_len = len;
+	ni->fanout = data + NOTES_INDEX_HEADER_SIZE + the_hash_algo->rawsz;
+	ni->entries = ni->fanout + NOTES_INDEX_FANOUT_SIZE;
+	ni->nr = nr;
+	strbuf_release(&path);
+	return ni;
+
+bad:
+	error(_("notes index file %s is corrupt"), path.buf);
+	munmap((void *)data, len);
+	strbuf_release(&path);
+	return NULL;
+}
+
+int notes_index_lookup(struct notes_index *ni, const struct object_id *oid,
+		       struct object_id *note_oid)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	unsigned char first = oid->hash[0];
+	uint32_t lo, hi;
+
+	lo = first ? get_be32(ni->fanout + 4 * (first - 1)) : 0;
+	hi = get_be32(ni->fanout + 4 * first);
+	if (hi > ni->nr || lo > hi)
+		return 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *e = ni->entries + (size_t)mi * entry_size();
+		int cmp = hashcmp(oid->hash, e);
+
+		if (!cmp) {
+			oidread(note_oid, e + rawsz);
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+void free_notes_index(struct notes_index *ni)
+{
+	if (!ni)
+		return;
+	munmap((void *)ni->data, ni->data_len);
+	free(ni);
+}
+
+struct index_entry {
+	struct object_id object;
+	struct object_id note;
+};
+
+struct index_entries {
+	struct index_entry *e;
+	size_t nr, alloc;
+};
+
+static void add_entry(struct index_entries *list,
+		      const struct object_id *object,
+		      const struct object_id *note)
+{
+	ALLOC_GROW(list->e, list->nr + 1, list->alloc);
+	oidcpy(&list->e[list->nr].object, object);
+	oidcpy(&list->e[list->nr].note, note);
+	list->nr++;
+}
+
+static int entry_cmp(const void *va, const void *vb)
+{
+	const struct index_entry *a = va, *b = vb;
+	return oidcmp(&a->object, &b->object);
+}
+
+/*
+ * Sort the entries and, like load_subtree() in notes.c does, combine
+ * the notes of an object that has several in the notes tree (under
+ * different fanouts) by concatenating them.
+ */
+static void sort_entries(struct index_entries *list)
+{
+	size_t src, dst = 0;
+
+	QSORT(list->e, list->nr, entry_cmp);
+	for (src = 0; src < list->nr; src++) {
+		if (dst && oideq(&list->e[dst - 1].object, &list->e[src].object)) {
+			combine_notes_concatenate(&list->e[dst - 1].note,
+						  &list->e[src].note);
+			continue;
+		}
+		if (dst != src)
+			list->e[dst] = list->e[src];
+		dst++;
+	}
+	list->nr = dst;
+}
+
+/*
+ * Tell whether path names a note in a notes tree, i.e. whether it is
+ * made of the hexadecimal name of an object, split by the fanout
+ * directories into components of two characters but the last one.
+ */
+static int note_path_to_oid(const char *path, struct object_id *oid)
+{
+	char hex[GIT_MAX_HEXSZ];
+	size_t len = 0;
+
+	for (;;) {
+		const char *slash = strchr(path, '/');
+
+		if (!slash)
+			break;
+		if (slash - path != 2 || len + 2 >= the_hash_algo->hexsz)
+			return -1;
+		memcpy(hex + len, path, 2);
+		len += 2;
+		path = slash + 1;
+	}
+	if (len + strlen(path) != the_hash_algo->hexsz)
+		return -1;
+	memcpy(hex + len, path, the_hash_algo->hexsz - len);
+	return get_oid_hex_algop(hex, oid, the_hash_algo);
+}
+
+static void read_notes_subtree(struct repository *r,
+			       const struct object_id *tree_oid,
+			       struct strbuf *prefix,
+			       struct index_entries *list)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	size_t baselen = prefix->len;
+	void *buf;
+
+	buf = fill_tree_descriptor(r, &desc, tree_oid);
+	if (!buf)
+		die(_("could not read notes tree %s"), oid_to_hex(tree_oid));
+
+	while (tree_entry(&desc, &entry)) {
+		struct object_id object;
+
+		strbuf_setlen(prefix, baselen);
+		strbuf_addstr(prefix, entry.path);
+		if (S_ISDIR(entry.mode) && strlen(entry.path) == 2) {
+			strbuf_addch(prefix, '/');
+			read_notes_subtree(r, &entry.oid, prefix, list);
+		} else if (S_ISREG(entry.mode) &&
+			   !note_path_to_oid(prefix->buf, &object)) {
+			add_entry(list, &object, &entry.oid);
+		}
+	}
+	strbuf_setlen(prefix, baselen);
+	free(buf);
+}
+
+/*
+ * Take the entries of the index of base_tree and apply the changes
+ * between base_tree and new_tree to them.
+ */
+static void update_entries(struct repository *r, struct notes_index *base,
+			   const struct object_id *base_tree,
+			   const struct object_id *new_tree,
+			   struct index_entries *list)
+{
+	struct oid_array deleted = OID_ARRAY_INIT;
+	struct index_entries added = { 0 };
+	struct diff_options opt;
+	uint32_t i;
+	size_t j;
+
+	repo_diff_setup(r, &opt);
+	opt.flags.recursive = 1;
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+	diff_tree_oid(base_tree, new_tree, "", &opt);
+
+	for (j = 0; j < diff_queued_diff.nr; j++) {
+		struct diff_filepair *p = diff_queued_diff.queue[j];
+		struct object_id object;
+
+		if (DIFF_FILE_VALID(p->one) && S_ISREG(p->one->mode) &&
+		    !note_path_to_oid(p->one->path, &object))
+			oid_array_append(&deleted, &object);
+		if (DIFF_FILE_VALID(p->two) && S_ISREG(p->two->mode) &&
+		    !note_path_to_oid(p->two->path, &object))
+			add_entry(&added, &object, &p->two->oid);
+	}
+	diff_flush(&opt);
+
+	for (i = 0; i < base->nr; i++) {
+		const unsigned char *e = base->entries + (size_t)i * entry_size();
+		struct object_id object, note;
+
+		oidread(&object, e);
+		if (oid_array_lookup(&deleted, &object) >= 0)
+			continue;
+		oidread(&note, e + the_hash_algo->rawsz);
+		add_entry(list, &object, &note);
+	}
+	for (j = 0; j < added.nr; j++)
+		add_entry(list, &added.e[j].object, &added.e[j].note);
+
+	oid_array_clear(&deleted);
+	free(added.e);
+}
+
+int write_notes_index(struct repository *r, const struct object_id *base_tree,
+		      const struct object_id *new_tree)
+{
+	struct index_entries list = { 0 };
+	struct notes_index *base = NULL;
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf path = STRBUF_INIT;
+	struct hashfile *f;
+	unsigned char header[NOTES_INDEX_HEADER_SIZE];
+	uint32_t fanout[256];
+	size_t i;
+	int ret = 0;
+
+	if (base_tree && !oideq(base_tree, new_tree))
+		base = load_notes_index(r, base_tree);
+
+	if (base) {
+		update_entries(r, base, base_tree, new_tree, &list);
+		free_notes_index(base);
+	} else {
+		struct strbuf prefix = STRBUF_INIT;
+		read_notes_subtree(r, new_tree, &prefix, &list);
+		strbuf_release(&prefix);
+	}
+	sort_entries(&list);
+
+	notes_index_path(r, &path, new_tree);
+	if (safe_create_leading_directories(path.buf)) {
+		ret = error_errno(_("unable to create leading directories of %s"),
+				  path.buf);
+		goto out;
+	}
+	if (hold_lock_file_for_update(&lk, path.buf, 0) < 0) {
+		ret = error_errno(_("unable to create '%s.lock'"), path.buf);
+		goto out;
+	}
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+
+	put_be32(header, NOTES_INDEX_SIGNATURE);
+	header[4] = NOTES_INDEX_VERSION;
+	header[5] = hash_algo_by_ptr(the_hash_algo);
+	header[6] = header[7] = 0;
+	hashwrite(f, header, sizeof(header));
+	hashwrite(f, new_tree->hash, the_hash_algo->rawsz);
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < list.nr; i++)
+		fanout[list.e[i].object.hash[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+	for (i = 0; i < 256; i++)
+		hashwrite_be32(f, fanout[i]);
+
+	for (i = 0; i < list.nr; i++) {
+		hashwrite(f, list.e[i].object.hash, the_hash_algo->rawsz);
+		hashwrite(f, list.e[i].note.hash, the_hash_algo->rawsz);
+	}
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM);
+	if (commit_lock_file(&lk) < 0)
+		ret = error_errno(_("unable to write '%s'"), path.buf);
+
+out:
+	free(list.e);
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * How far back in the history of a notes ref to look for an index to
+ * start from, before reading the whole notes tree instead.
+ */
+#define NOTES_INDEX_MAX_BASE_DISTANCE 1000
+
+int update_notes_index(struct repository *r,
+		       const struct object_id *notes_commit)
+{
+	struct commit *commit = lookup_commit_reference(r, notes_commit);
+	struct commit *c;
+	const struct object_id *base_tree = NULL;
+	int distance, ret;
+
+	if (!commit || repo_parse_commit(r, commit))
+		return error(_("notes ref does not point to a commit: %s"),
+			     oid_to_hex(notes_commit));
+
+	for (c = commit, distance = 0;
+	     c && distance < NOTES_INDEX_MAX_BASE_DISTANCE;
+	     c = c->parents ? c->parents->item : NULL, distance++) {
+		struct strbuf path = STRBUF_INIT;
+		int found;
+
+		if (repo_parse_commit(r, c))
+			break;
+		notes_index_path(r, &path, get_commit_tree_oid(c));
+		found = !access(path.buf, F_OK);
+		strbuf_release(&path);
+		if (found) {
+			base_tree = get_commit_tree_oid(c);
+			break;
+		}
+	}
+
+	if (base_tree && oideq(base_tree, get_commit_tree_oid(commit)))
+		ret = 0; /* already up to date */
+	else
+		ret = write_notes_index(r, base_tree,
+					get_commit_tree_oid(commit));
+	if (!ret)
+		prune_notes_indexes(r);
+	return ret;
+}
+
+static int collect_notes_tree(const char *refname, const struct object_id *oid,
+			      int flags, void *data)
+{
+	struct oidset *trees = data;
+	struct object_id tree_oid;
+	unsigned short mode;
+
+	if (!get_tree_entry(the_repository, oid, "", &tree_oid, &mode))
+		oidset_insert(trees, &tree_oid);
+	return 0;
+}
+
+void prune_notes_indexes(struct repository *r)
+{
+	struct oidset trees = OIDSET_INIT;
+	struct strbuf path = STRBUF_INIT;
+	size_t baselen;
+	DIR *dir;
+	struct dirent *de;
+
+	strbuf_git_common_path(&path, r, "notes-index");
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	baselen = path.len;
+
+	refs_for_each_ref_in(get_main_ref_store(r), "refs/notes/",
+			     collect_notes_tree, &trees);
+
+	while ((de = readdir(dir))) {
+		struct object_id tree_oid;
+		const char *end;
+
+		if (parse_oid_hex(de->d_name, &tree_oid, &end) ||
+		    strcmp(end, ".idx") ||
+		    oidset_contains(&trees, &tree_oid))
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		unlink_or_warn(path.buf);
+	}
+	closedir(dir);
+	oidset_clear(&trees);
+	strbuf_release(&path);
+}
@@ -0,0 +1,57 @@
+#ifndef NOTES_INDEX_H
+#define NOTES_INDEX_H
+
+struct object_id;
+struct repository;
+
+/*
+ * A notes index maps the annotated objects of one notes tree to their
+ * note blobs, as a sorted table that can be searched without reading
+ * any of the tree objects.  It lives in "$GIT_COMMON_DIR/notes-index/<tree>.idx", named after the
+ * notes tree it describes, so an index is never out of date; a notes
+ * ref that has moved on simply has no index until one is written.
+ */
+struct notes_index;
+
+/*
+ * Load the index of the notes tree tree_oid, if there is one.
+ * Returns NULL, silently, if there is none, and with an error if it
+ * cannot be used.
+ */
+struct notes_index *load_notes_index(struct repository *r,
+				     const struct object_id *tree_oid);
+
+/*
+ * Look up the note of the given object.  Returns 1 and fills note_oid
+ * if it has one, or 0.
+ */
+int notes_index_lookup(struct notes_index *ni, const struct object_id *oid,
+		       struct object_id *note_oid);
+
+void free_notes_index(struct notes_index *ni);
+
+/*
+ * Write the index of the notes tree new_tree.  When there is an index
+ * of base_tree, which may be NULL, it is brought up to date with the
+ * differences between the two trees; otherwise all of new_tree is
+ * read.  Returns 0 on success, or -1 after showing an error.
+ */
+int write_notes_index(struct repository *r, const struct object_id *base_tree,
+		      const struct object_id *new_tree);
+
+/*
+ * Remove the indexes of the notes trees that no ref under refs/notes/
+ * points to.
+ */
+void prune_notes_indexes(struct repository *r);
+
+/*
+ * Write the index of the tree of the notes commit notes_commit, based
+ * on the index of the closest first-parent ancestor that has one, and
+ * prune the indexes no longer needed.  notes_commit should be where a
+ * notes ref points to by now.
+ */
+int update_notes_index(struct repository *r,
+		       const struct object_id *notes_commit);
+
+#endif /* NOTES_INDEX_H */
@@ -3,6 +3,7 @@
 #include "commit.h"
 #include "refs.h"
 #include "notes-utils.h"
+#include "notes-index.h"
 #include "repository.h"
 
 void create_notes_commit(struct repository *r,
@@ -39,6 +40,7 @@ void commit_notes(struct repository *r, struct notes_tree *t, const char *msg)
 {
 	struct strbuf buf = STRBUF_INIT;
 	struct object_id commit_oid;
+	int write_index = 0;
 
 	if (!t)
 		t = &default_notes_tree;
@@ -56,6 +58,10 @@ void commit_notes(struct repository *r, struct notes_tree *t, const char *msg)
 	update_ref(buf.buf, t->update_ref, &commit_oid, NULL, 0,
 		   UPDATE_REFS_DIE_ON_ERR);
 
+	if (!repo_config_get_bool(r, "notes.index", &write_index) &&
+	    write_index)
+		update_notes_index(r, &commit_oid);
+
 	strbuf_release(&buf);
 }
 
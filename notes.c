@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "notes.h"
+#include "notes-index.h"
 #include "object-store.h"
 #include "blob.h"
 #include "tree.h"
@@ -1030,6 +1031,9 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	oidclr(&root_tree.key_oid);
 	oidcpy(&root_tree.val_oid, &oid);
 	load_subtree(t, &root_tree, t->root, 0);
+
+	if (!(flags & NOTES_INIT_WRITABLE))
+		t->index = load_notes_index(the_repository, &oid);
 }
 
 struct notes_tree **load_notes_trees(struct string_list *refs, int flags)
@@ -1230,6 +1234,7 @@ void free_notes(struct notes_tree *t)
 		t->first_non_note = t->prev_non_note;
 	}
 	free(t->ref);
+	free_notes_index(t->index);
 	memset(t, 0, sizeof(struct notes_tree));
 }
 
@@ -1249,6 +1254,7 @@ static void format_note(struct notes_tree *t, const struct object_id *object_oid
 {
 	static const char utf8[] = "utf-8";
 	const struct object_id *oid;
+	struct object_id indexed_oid;
 	char *msg, *msg_p;
 	unsigned long linelen, msglen;
 	enum object_type type;
@@ -1258,7 +1264,16 @@ static void format_note(struct notes_tree *t, const struct object_id *object_oid
 	if (!t->initialized)
 		init_notes(t, NULL, NULL, 0);
 
-	oid = get_note(t, object_oid);
+	/*
+	 * With an index of the notes tree, there is no need to load the
+	 * part of the tree where the note would be, as long as the tree
+	 * has not been changed since.
+	 */
+	if (t->index && !t->dirty)
+		oid = notes_index_lookup(t->index, object_oid, &indexed_oid) ?
+			&indexed_oid : NULL;
+	else
+		oid = get_note(t, object_oid);
 	if (!oid)
 		return;
 
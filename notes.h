@@ -5,6 +5,7 @@
 
 struct object_id;
 struct strbuf;
+struct notes_index;
 
 /*
  * Function type for combining two notes annotating the same object.
@@ -56,6 +57,7 @@ extern struct notes_tree {
 	combine_notes_fn combine_notes;
 	int initialized;
 	int dirty;
+	struct notes_index *index;
 } default_notes_tree;
 
 /*
@@ -31,6 +31,7 @@
 #include "quote.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "oid-array.h"
 #include "promisor-remote.h"
 
 /* The maximum size for an object header. */
@@ -1076,7 +1077,10 @@ int check_object_signature(struct repository *r, const struct object_id *oid,
 		return !oideq(oid, &real_oid) ? -1 : 0;
 	}
 
+	/* hash outside of the object read lock, see enable_obj_read_lock() */
+	obj_read_lock();
 	st = open_istream(r, oid, &obj_type, &size, NULL);
+	obj_read_unlock();
 	if (!st)
 		return -1;
 
@@ -1088,10 +1092,15 @@ int check_object_signature(struct repository *r, const struct object_id *oid,
 	r->hash_algo->update_fn(&c, hdr, hdrlen);
 	for (;;) {
 		char buf[1024 * 16];
-		ssize_t readlen = read_istream(st, buf, sizeof(buf));
+		ssize_t readlen;
 
+		obj_read_lock();
+		readlen = read_istream(st, buf, sizeof(buf));
+		obj_read_unlock();
 		if (readlen < 0) {
+			obj_read_lock();
 			close_istream(st);
+			obj_read_unlock();
 			return -1;
 		}
 		if (!readlen)
@@ -1099,7 +1108,9 @@ int check_object_signature(struct repository *r, const struct object_id *oid,
 		r->hash_algo->update_fn(&c, buf, readlen);
 	}
 	r->hash_algo->final_oid_fn(&real_oid, &c);
+	obj_read_lock();
 	close_istream(st);
+	obj_read_unlock();
 	return !oideq(oid, &real_oid) ? -1 : 0;
 }
 
@@ -1517,8 +1528,12 @@ pthread_mutex_t obj_read_mutex;
 
 void enable_obj_read_lock(void)
 {
-	if (obj_read_use_lock)
+	if (obj_read_use_lock) {
+		obj_read_lock();
+		obj_read_use_lock++;
+		obj_read_unlock();
 		return;
+	}
 
 	obj_read_use_lock = 1;
 	init_recursive_mutex(&obj_read_mutex);
@@ -1526,11 +1541,16 @@ void enable_obj_read_lock(void)
 
 void disable_obj_read_lock(void)
 {
+	int users;
+
 	if (!obj_read_use_lock)
 		return;
 
-	obj_read_use_lock = 0;
-	pthread_mutex_destroy(&obj_read_mutex);
+	obj_read_lock();
+	users = --obj_read_use_lock;
+	pthread_mutex_unlock(&obj_read_mutex);
+	if (!users)
+		pthread_mutex_destroy(&obj_read_mutex);
 }
 
 int fetch_if_missing = 1;
@@ -1860,10 +1880,12 @@ int hash_object_file(const struct git_hash_algo *algo, const void *buf,
 }
 
 /* Finalize a file on disk, and close it. */
-static void close_loose_object(int fd)
+static void close_loose_object(int fd, const char *filename)
 {
-	if (fsync_object_files)
-		fsync_or_die(fd, "loose object file");
+	if (fsync_object_files == FSYNC_OBJECT_FILES_BATCH)
+		fsync_loose_object_bulk_checkin(fd, filename);
+	else if (fsync_object_files)
+		fsync_or_die(fd, filename);
 	if (close(fd) != 0)
 		die_errno(_("error when closing loose object file"));
 }
@@ -1913,6 +1935,51 @@ static int create_tmpfile(struct strbuf *tmp, const char *filename)
 	return fd;
 }
 
+char *loose_object_journal_path(struct repository *r, const char *suffix)
+{
+	return xstrfmt("%s/info/loose-journal%s", r->objects->odb->path,
+		       suffix ? suffix : "");
+}
+
+void journal_loose_object(struct repository *r, const struct object_id *oid)
+{
+	char *path;
+	char line[GIT_MAX_HEXSZ + 1];
+	size_t len;
+	int tries;
+
+	if (!core_loose_object_journal)
+		return;
+
+	path = loose_object_journal_path(r, NULL);
+	len = xsnprintf(line, sizeof(line), "%s\n", oid_to_hex(oid));
+
+	/*
+	 * The journal is never created here: until it exists, the
+	 * maintenance task scans the object directory and does not need
+	 * it.  When the task swaps in a new journal while we are
+	 * appending to the old one, our entry may come too late for it;
+	 * append to the new journal, too, as duplicates do no harm.
+	 */
+	for (tries = 0; tries < 3; tries++) {
+		struct stat st_fd, st_path;
+		int fd = open(path, O_WRONLY | O_APPEND);
+
+		if (fd < 0)
+			break;
+		if (write_in_full(fd, line, len) < 0 || fstat(fd, &st_fd)) {
+			close(fd);
+			break;
+		}
+		close(fd);
+		if (stat(path, &st_path) ||
+		    (st_fd.st_ino == st_path.st_ino &&
+		     st_fd.st_dev == st_path.st_dev))
+			break;
+	}
+	free(path);
+}
+
 static int write_loose_object(const struct object_id *oid, char *hdr,
 			      int hdrlen, const void *buf, unsigned long len,
 			      time_t mtime)
@@ -1924,8 +1991,15 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	struct object_id parano_oid;
 	static struct strbuf tmp_file = STRBUF_INIT;
 	static struct strbuf filename = STRBUF_INIT;
+	const char *bulk_objdir = prepare_loose_object_bulk_checkin();
 
-	loose_object_path(the_repository, &filename, oid);
+	if (bulk_objdir) {
+		strbuf_reset(&filename);
+		strbuf_addf(&filename, "%s/", bulk_objdir);
+		fill_loose_path(&filename, oid);
+	} else {
+		loose_object_path(the_repository, &filename, oid);
+	}
 
 	fd = create_tmpfile(&tmp_file, filename.buf);
 	if (fd < 0) {
@@ -1973,7 +2047,7 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 		die(_("confused by unstable object source data for %s"),
 		    oid_to_hex(oid));
 
-	close_loose_object(fd);
+	close_loose_object(fd, tmp_file.buf);
 
 	if (mtime) {
 		struct utimbuf utb;
@@ -1983,7 +2057,13 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 			warning_errno(_("failed utime() on %s"), tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename.buf);
+	if (finalize_object_file(tmp_file.buf, filename.buf))
+		return -1;
+	if (bulk_objdir)
+		journal_loose_object_bulk_checkin(oid);
+	else
+		journal_loose_object(the_repository, oid);
+	return 0;
 }
 
 static int freshen_loose_object(const struct object_id *oid)
@@ -1991,6 +2071,126 @@ static int freshen_loose_object(const struct object_id *oid)
 	return check_and_freshen(oid, 1);
 }
 
+static int freshen_packed_object(const struct object_id *oid);
+
+int stream_loose_object(struct input_stream *in_stream, size_t len,
+			struct object_id *oid)
+{
+	int fd, ret, err = 0, flush = 0;
+	unsigned char compressed[4096];
+	git_zstream stream;
+	git_hash_ctx c;
+	char hdr[MAX_HEADER_LEN];
+	int hdrlen;
+	static struct strbuf tmp_file = STRBUF_INIT;
+	static struct strbuf filename = STRBUF_INIT;
+	const char *bulk_objdir = prepare_loose_object_bulk_checkin();
+	int dirlen;
+
+	/*
+	 * We do not know the name of the object until it is all
+	 * written, so start with a temporary file at the top of the
+	 * object directory, and move it into its fan-out directory
+	 * at the end.
+	 */
+	strbuf_reset(&filename);
+	strbuf_addf(&filename, "%s/",
+		    bulk_objdir ? bulk_objdir : get_object_directory());
+	fd = create_tmpfile(&tmp_file, filename.buf);
+	if (fd < 0) {
+		if (errno == EACCES)
+			return error(_("insufficient permission for adding an object to repository database %s"), get_object_directory());
+		else
+			return error_errno(_("unable to create temporary file"));
+	}
+
+	hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
+			   type_name(OBJ_BLOB), (uintmax_t)len) + 1;
+
+	/* Set it up */
+	git_deflate_init(&stream, zlib_compression_level);
+	stream.next_out = compressed;
+	stream.avail_out = sizeof(compressed);
+	the_hash_algo->init_fn(&c);
+
+	/* First header.. */
+	stream.next_in = (unsigned char *)hdr;
+	stream.avail_in = hdrlen;
+	while (git_deflate(&stream, 0) == Z_OK)
+		; /* nothing */
+	the_hash_algo->update_fn(&c, hdr, hdrlen);
+
+	/* Then the data itself, as the stream hands it to us.. */
+	do {
+		unsigned char *in0;
+
+		if (!stream.avail_in && !in_stream->is_finished) {
+			const void *in = in_stream->read(in_stream, &stream.avail_in);
+			stream.next_in = (void *)in;
+			if (in_stream->is_finished)
+				flush = Z_FINISH;
+		}
+		in0 = stream.next_in;
+		ret = git_deflate(&stream, flush);
+		the_hash_algo->update_fn(&c, in0, stream.next_in - in0);
+		if (write_buffer(fd, compressed, stream.next_out - compressed) < 0)
+			die(_("unable to write loose object file"));
+		stream.next_out = compressed;
+		stream.avail_out = sizeof(compressed);
+		/*
+		 * Unlike write_loose_object(), we do not have the entire
+		 * buffer.  If we get Z_BUF_ERROR due to too few input
+		 * bytes, that's OK; we'll get more on the next round.
+		 */
+	} while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+	if (ret != Z_STREAM_END)
+		die(_("unable to stream deflate new object (%d)"), ret);
+	if (stream.total_in != len + hdrlen)
+		die(_("write stream object %lu != %"PRIuMAX), stream.total_in,
+		    (uintmax_t)len + hdrlen);
+	ret = git_deflate_end_gently(&stream);
+	if (ret != Z_OK)
+		die(_("deflateEnd on stream object failed (%d)"), ret);
+	the_hash_algo->final_oid_fn(oid, &c);
+
+	close_loose_object(fd, tmp_file.buf);
+
+	if (freshen_packed_object(oid) || freshen_loose_object(oid)) {
+		unlink_or_warn(tmp_file.buf);
+		return 0;
+	}
+
+	if (bulk_objdir)
+		fill_loose_path(&filename, oid);
+	else
+		loose_object_path(the_repository, &filename, oid);
+
+	/* We finally know the object path; make sure its directory exists */
+	dirlen = directory_size(filename.buf);
+	if (dirlen) {
+		struct strbuf dir = STRBUF_INIT;
+		strbuf_add(&dir, filename.buf, dirlen - 1);
+		if (mkdir(dir.buf, 0777) && errno != EEXIST)
+			err = error_errno(_("unable to create directory %s"), dir.buf);
+		else if (adjust_shared_perm(dir.buf))
+			err = error(_("unable to set permission to '%s'"), dir.buf);
+		strbuf_release(&dir);
+		if (err) {
+			unlink_or_warn(tmp_file.buf);
+			return err;
+		}
+	}
+
+	if (finalize_object_file(tmp_file.buf, filename.buf))
+		return -1;
+	if (bulk_objdir)
+		journal_loose_object_bulk_checkin(oid);
+	else
+		journal_loose_object(the_repository, oid);
+	return 0;
+}
+
 static int freshen_packed_object(const struct object_id *oid)
 {
 	struct pack_entry e;
@@ -2268,7 +2468,10 @@ int index_fd(struct index_state *istate, struct object_id *oid,
 		ret = index_stream_convert_blob(istate, oid, fd, path, flags);
 	else if (!S_ISREG(st->st_mode))
 		ret = index_pipe(istate, oid, fd, type, path, flags);
-	else if (st->st_size <= big_file_threshold || type != OBJ_BLOB ||
+	else if ((st->st_size <= big_file_threshold &&
+		  !((flags & HASH_WRITE_OBJECT) &&
+		    bulk_checkin_wants_all_files())) ||
+		 type != OBJ_BLOB ||
 		 (path && would_convert_to_git(istate, path)))
 		ret = index_core(istate, oid, fd, xsize_t(st->st_size),
 				 type, path, flags);
@@ -2460,50 +2663,138 @@ int for_each_loose_object(each_loose_object_fn cb, void *data,
 	return 0;
 }
 
+struct loose_subdir_data {
+	struct oidtree *cache;
+	/* what the cache had for the subdirectory before reading it */
+	struct oid_array cached;
+	char *still_there;
+};
+
+static enum cb_next collect_cached_loose(const struct object_id *oid,
+					 void *data)
+{
+	struct loose_subdir_data *d = data;
+
+	oid_array_append(&d->cached, oid);
+	return CB_CONTINUE;
+}
+
 static int append_loose_object(const struct object_id *oid, const char *path,
 			       void *data)
 {
-	oidtree_insert(data, oid);
+	struct loose_subdir_data *d = data;
+	int pos = d->cached.nr ? oid_array_lookup(&d->cached, oid) : -1;
+
+	if (pos >= 0)
+		d->still_there[pos] = 1;
+	else
+		oidtree_insert(d->cache, oid);
 	return 0;
 }
 
+static int bit_is_set(const uint32_t *bitmap, int nr)
+{
+	return bitmap[nr / 32] & (1u << (nr % 32));
+}
+
+static void set_bit(uint32_t *bitmap, int nr)
+{
+	bitmap[nr / 32] |= 1u << (nr % 32);
+}
+
+static void clear_bit(uint32_t *bitmap, int nr)
+{
+	bitmap[nr / 32] &= ~(1u << (nr % 32));
+}
+
+/*
+ * Bring the cache up to date with subdirectory "subdir_nr", unless it
+ * did not change since we last read it.  The directory is stat'ed
+ * before it is read, so that whatever is added while we read it shows
+ * up as a change the next time.  We cannot tell about changes made
+ * within the same second as our stat(), though, so a directory that
+ * changed that recently is read again the next time no matter what.
+ */
+static void read_loose_subdir(struct object_directory *odb, int subdir_nr)
+{
+	struct loose_subdir_data d = { odb->loose_objects_cache, OID_ARRAY_INIT };
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id prefix = { { subdir_nr } };
+	struct stat st;
+	time_t now = time(NULL);
+	int have_stat;
+	size_t i;
+
+	if (!odb->loose_objects_subdir_stat)
+		CALLOC_ARRAY(odb->loose_objects_subdir_stat, 256);
+
+	strbuf_addf(&buf, "%s/%02x", odb->path, subdir_nr);
+	have_stat = !stat(buf.buf, &st);
+	if (have_stat &&
+	    bit_is_set(odb->loose_objects_subdir_stat_valid, subdir_nr) &&
+	    !match_stat_data(&odb->loose_objects_subdir_stat[subdir_nr], &st))
+		goto out;
+
+	oid_set_algo(&prefix, the_hash_algo);
+	oidtree_each(d.cache, &prefix, 2, collect_cached_loose, &d);
+	d.still_there = xcalloc(1, d.cached.nr + 1);
+
+	strbuf_setlen(&buf, strlen(odb->path));
+	for_each_file_in_obj_subdir(subdir_nr, &buf, append_loose_object,
+				    NULL, NULL, &d);
+
+	for (i = 0; i < d.cached.nr; i++)
+		if (!d.still_there[i])
+			oidtree_remove(d.cache, &d.cached.oid[i]);
+
+	if (have_stat && st.st_mtime < now) {
+		fill_stat_data(&odb->loose_objects_subdir_stat[subdir_nr], &st);
+		set_bit(odb->loose_objects_subdir_stat_valid, subdir_nr);
+	} else {
+		clear_bit(odb->loose_objects_subdir_stat_valid, subdir_nr);
+	}
+
+	oid_array_clear(&d.cached);
+	free(d.still_there);
+out:
+	strbuf_release(&buf);
+}
+
 struct oidtree *odb_loose_cache(struct object_directory *odb,
 				  const struct object_id *oid)
 {
 	int subdir_nr = oid->hash[0];
-	struct strbuf buf = STRBUF_INIT;
-	size_t word_bits = bitsizeof(odb->loose_objects_subdir_seen[0]);
-	size_t word_index = subdir_nr / word_bits;
-	size_t mask = 1u << (subdir_nr % word_bits);
-	uint32_t *bitmap;
 
 	if (subdir_nr < 0 ||
 	    subdir_nr >= bitsizeof(odb->loose_objects_subdir_seen))
 		BUG("subdir_nr out of range");
 
-	bitmap = &odb->loose_objects_subdir_seen[word_index];
-	if (*bitmap & mask)
+	if (bit_is_set(odb->loose_objects_subdir_seen, subdir_nr))
 		return odb->loose_objects_cache;
 	if (!odb->loose_objects_cache) {
 		ALLOC_ARRAY(odb->loose_objects_cache, 1);
 		oidtree_init(odb->loose_objects_cache);
 	}
-	strbuf_addstr(&buf, odb->path);
-	for_each_file_in_obj_subdir(subdir_nr, &buf,
-				    append_loose_object,
-				    NULL, NULL,
-				    odb->loose_objects_cache);
-	*bitmap |= mask;
-	strbuf_release(&buf);
+	read_loose_subdir(odb, subdir_nr);
+	set_bit(odb->loose_objects_subdir_seen, subdir_nr);
 	return odb->loose_objects_cache;
 }
 
+void odb_refresh_loose_cache(struct object_directory *odb)
+{
+	memset(&odb->loose_objects_subdir_seen, 0,
+	       sizeof(odb->loose_objects_subdir_seen));
+}
+
 void odb_clear_loose_cache(struct object_directory *odb)
 {
 	oidtree_clear(odb->loose_objects_cache);
 	FREE_AND_NULL(odb->loose_objects_cache);
 	memset(&odb->loose_objects_subdir_seen, 0,
 	       sizeof(odb->loose_objects_subdir_seen));
+	memset(&odb->loose_objects_subdir_stat_valid, 0,
+	       sizeof(odb->loose_objects_subdir_stat_valid));
+	FREE_AND_NULL(odb->loose_objects_subdir_stat);
 }
 
 static int check_stream_oid(git_zstream *stream,
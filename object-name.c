@@ -660,6 +660,43 @@ static void find_abbrev_len_packed(struct min_abbrev_data *mad)
 		find_abbrev_len_for_pack(p, mad);
 }
 
+/*
+ * Bound the memory spent on remembering abbreviations; most callers
+ * abbreviate each object only a few times, close together.
+ */
+#define ABBREV_CACHE_MAX (1 << 20)
+
+static int lookup_abbrev_cache(struct repository *r,
+			       const struct object_id *oid, int len)
+{
+	kh_oid_pos_t *cache = r->objects->abbrev_cache;
+	khiter_t pos;
+
+	if (!cache)
+		return -1;
+	pos = kh_get_oid_pos(cache, *oid);
+	if (pos == kh_end(cache) || (kh_value(cache, pos) >> 8) != len)
+		return -1;
+	return kh_value(cache, pos) & 0xff;
+}
+
+static void update_abbrev_cache(struct repository *r,
+				const struct object_id *oid,
+				int len, int found)
+{
+	kh_oid_pos_t *cache = r->objects->abbrev_cache;
+	khiter_t pos;
+	int hashret;
+
+	if (!cache)
+		cache = r->objects->abbrev_cache = kh_init_oid_pos();
+	else if (kh_size(cache) >= ABBREV_CACHE_MAX)
+		kh_clear_oid_pos(cache);
+
+	pos = kh_put_oid_pos(cache, *oid, &hashret);
+	kh_value(cache, pos) = (len << 8) | found;
+}
+
 int repo_find_unique_abbrev_r(struct repository *r, char *hex,
 			      const struct object_id *oid, int len)
 {
@@ -667,6 +704,7 @@ int repo_find_unique_abbrev_r(struct repository *r, char *hex,
 	struct min_abbrev_data mad;
 	struct object_id oid_ret;
 	const unsigned hexsz = r->hash_algo->hexsz;
+	int cached;
 
 	if (len < 0) {
 		unsigned long count = repo_approximate_object_count(r);
@@ -694,6 +732,16 @@ int repo_find_unique_abbrev_r(struct repository *r, char *hex,
 	if (len == hexsz || !len)
 		return hexsz;
 
+	/*
+	 * Log output with parents, blame and the like abbreviate the
+	 * same objects over and over again.
+	 */
+	cached = lookup_abbrev_cache(r, oid, len);
+	if (cached >= 0) {
+		hex[cached] = 0;
+		return cached;
+	}
+
 	mad.repo = r;
 	mad.init_len = len;
 	mad.cur_len = len;
@@ -712,6 +760,7 @@ int repo_find_unique_abbrev_r(struct repository *r, char *hex,
 	find_short_object_filename(&ds);
 	(void)finish_object_disambiguation(&ds, &oid_ret);
 
+	update_abbrev_cache(r, oid, len, mad.cur_len);
 	hex[mad.cur_len] = 0;
 	return mad.cur_len;
 }
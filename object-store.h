@@ -26,6 +26,15 @@ struct object_directory {
 	uint32_t loose_objects_subdir_seen[8]; /* 256 bits */
 	struct oidtree *loose_objects_cache;
 
+	/*
+	 * How each subdirectory looked when it was last read, so that
+	 * odb_refresh_loose_cache() only has to read again those that
+	 * changed since.  Only the entries whose bit is set in
+	 * loose_objects_subdir_stat_valid can be trusted.
+	 */
+	uint32_t loose_objects_subdir_stat_valid[8]; /* 256 bits */
+	struct stat_data *loose_objects_subdir_stat;
+
 	/*
 	 * Path to the alternative object store. If this is a relative path,
 	 * it is relative to the current working directory.
@@ -63,6 +72,14 @@ void add_to_alternates_memory(const char *dir);
 struct oidtree *odb_loose_cache(struct object_directory *odb,
 				  const struct object_id *oid);
 
+/*
+ * Make the loose object cache for the specified object directory check
+ * again whether objects were added to or removed from a subdirectory
+ * the next time it is used.  Only the subdirectories that changed are
+ * read again.
+ */
+void odb_refresh_loose_cache(struct object_directory *odb);
+
 /* Empty the loose object cache for the specified object directory. */
 void odb_clear_loose_cache(struct object_directory *odb);
 
@@ -88,12 +105,17 @@ struct packed_git {
 		 freshened:1,
 		 do_not_close:1,
 		 pack_promisor:1,
-		 multi_pack_index:1;
+		 multi_pack_index:1,
+		 is_cruft:1,
+		 sequential_access:1;
 	unsigned char hash[GIT_MAX_RAWSZ];
 	struct revindex_entry *revindex;
 	const uint32_t *revindex_data;
 	const uint32_t *revindex_map;
 	size_t revindex_size;
+	/* per-object mtimes of a cruft pack, see pack-mtimes.h */
+	const uint32_t *mtimes_map;
+	size_t mtimes_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
@@ -180,6 +202,14 @@ struct raw_object_store {
 	unsigned long approximate_object_count;
 	unsigned approximate_object_count_valid : 1;
 
+	/*
+	 * The abbreviations computed by repo_find_unique_abbrev_r(), each
+	 * stored as the length asked for, shifted left by 8 bits, ORed
+	 * with the length found.  The cache is dropped whenever the packs
+	 * and loose objects are looked at again.
+	 */
+	kh_oid_pos_t *abbrev_cache;
+
 	/*
 	 * Whether packed_git has already been populated with this repository's
 	 * packs.
@@ -229,6 +259,24 @@ int hash_object_file_literally(const void *buf, unsigned long len,
 			       const char *type, struct object_id *oid,
 			       unsigned flags);
 
+struct input_stream {
+	/*
+	 * Return the next chunk of data and its length in *len, setting
+	 * is_finished when it is the last one.
+	 */
+	const void *(*read)(struct input_stream *, unsigned long *len);
+	void *data;
+	int is_finished;
+};
+
+/*
+ * Write a blob of len bytes read from in_stream as a loose object,
+ * deflating and hashing it as it comes in, without ever holding it in
+ * memory as a whole.  Its name is stored in oid.
+ */
+int stream_loose_object(struct input_stream *in_stream, size_t len,
+			struct object_id *oid);
+
 /*
  * Add an object file to the in-memory object store, without writing it
  * to disk.
@@ -242,6 +290,16 @@ int pretend_object_file(void *, unsigned long, enum object_type,
 
 int force_object_loose(const struct object_id *oid, time_t mtime);
 
+/*
+ * With core.looseObjectJournal, the name of every loose object written
+ * to the object directory is appended to the journal, if it exists,
+ * so that "git maintenance" can pack the new loose objects without
+ * looking at all the others.  See builtin/gc.c for how the journal is
+ * consumed.
+ */
+char *loose_object_journal_path(struct repository *r, const char *suffix);
+void journal_loose_object(struct repository *r, const struct object_id *oid);
+
 /*
  * Open the loose object at path, check its hash, and return the contents,
  * type, and size. If the object is a blob, then "contents" may return NULL,
@@ -311,6 +369,11 @@ void assert_oid_type(const struct object_id *oid, enum object_type expect);
  * reading functions. However, beware that in these cases zlib inflation won't
  * be performed in parallel, losing performance.
  *
+ * Calls nest: the lock stays in use until each enable_obj_read_lock() has
+ * been matched by a disable_obj_read_lock(), so that code running threads
+ * of its own can be called from a thread while the lock is enabled.  Only
+ * the outermost pair must not race with other threads.
+ *
  * TODO: oid_object_info_extended()'s call stack has a recursive behavior. If
  * any of its callees end up calling it, this recursive call won't benefit from
  * parallel inflation.
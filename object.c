@@ -10,6 +10,17 @@
 #include "packfile.h"
 #include "commit-graph.h"
 
+/*
+ * Each slot of obj_hash keeps the hash of the object name next to the
+ * object, so that probing the table only touches the table itself
+ * until a likely match is found, and growing it does not need to
+ * look at the objects at all.
+ */
+struct obj_hash_entry {
+	unsigned int hash;
+	struct object *obj;
+};
+
 unsigned int get_max_object_index(void)
 {
 	return the_repository->parsed_objects->obj_hash_size;
@@ -17,7 +28,7 @@ unsigned int get_max_object_index(void)
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return the_repository->parsed_objects->obj_hash[idx];
+	return the_repository->parsed_objects->obj_hash[idx].obj;
 }
 
 static const char *object_type_strings[] = {
@@ -54,13 +65,13 @@ int type_from_string_gently(const char *str, ssize_t len, int gentle)
 }
 
 /*
- * Return a numerical hash value between 0 and n-1 for the object with
- * the specified sha1.  n must be a power of 2.  Please note that the
+ * Return a numerical hash value between 0 and n-1 for the given hash
+ * of an object name.  n must be a power of 2.  Please note that the
  * return value is *not* consistent across computer architectures.
  */
-static unsigned int hash_obj(const struct object_id *oid, unsigned int n)
+static unsigned int hash_obj(unsigned int hash, unsigned int n)
 {
-	return oidhash(oid) & (n - 1);
+	return hash & (n - 1);
 }
 
 /*
@@ -68,36 +79,42 @@ static unsigned int hash_obj(const struct object_id *oid, unsigned int n)
  * must be a power of 2).  On collisions, simply overflow to the next
  * empty bucket.
  */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static void insert_obj_hash(unsigned int hash, struct object *obj,
+			    struct obj_hash_entry *table, unsigned int size)
 {
-	unsigned int j = hash_obj(&obj->oid, size);
+	unsigned int j = hash_obj(hash, size);
 
-	while (hash[j]) {
+	while (table[j].obj) {
 		j++;
 		if (j >= size)
 			j = 0;
 	}
-	hash[j] = obj;
+	table[j].hash = hash;
+	table[j].obj = obj;
 }
 
 /*
  * Look up the record for the given sha1 in the hash map stored in
  * obj_hash.  Return NULL if it was not found.
  */
-struct object *lookup_object(struct repository *r, const struct object_id *oid)
+static struct object *lookup_object_unlocked(struct repository *r,
+					     const struct object_id *oid)
 {
-	unsigned int i, first;
+	struct obj_hash_entry *table = r->parsed_objects->obj_hash;
+	unsigned int size = r->parsed_objects->obj_hash_size;
+	unsigned int hash, i, first;
 	struct object *obj;
 
-	if (!r->parsed_objects->obj_hash)
+	if (!table)
 		return NULL;
 
-	first = i = hash_obj(oid, r->parsed_objects->obj_hash_size);
-	while ((obj = r->parsed_objects->obj_hash[i]) != NULL) {
-		if (oideq(oid, &obj->oid))
+	hash = oidhash(oid);
+	first = i = hash_obj(hash, size);
+	while ((obj = table[i].obj) != NULL) {
+		if (table[i].hash == hash && oideq(oid, &obj->oid))
 			break;
 		i++;
-		if (i == r->parsed_objects->obj_hash_size)
+		if (i == size)
 			i = 0;
 	}
 	if (obj && i != first) {
@@ -106,12 +123,21 @@ struct object *lookup_object(struct repository *r, const struct object_id *oid)
 		 * that we do not need to walk the hash table the next
 		 * time we look for it.
 		 */
-		SWAP(r->parsed_objects->obj_hash[i],
-		     r->parsed_objects->obj_hash[first]);
+		SWAP(table[i], table[first]);
 	}
 	return obj;
 }
 
+struct object *lookup_object(struct repository *r, const struct object_id *oid)
+{
+	struct object *obj;
+
+	parsed_object_lock();
+	obj = lookup_object_unlocked(r, oid);
+	parsed_object_unlock();
+	return obj;
+}
+
 /*
  * Increase the size of the hash map stored in obj_hash to the next
  * power of 2 (but at least 32).  Copy the existing values to the new
@@ -125,15 +151,15 @@ static void grow_object_hash(struct repository *r)
 	 * above.
 	 */
 	int new_hash_size = r->parsed_objects->obj_hash_size < 32 ? 32 : 2 * r->parsed_objects->obj_hash_size;
-	struct object **new_hash;
+	struct obj_hash_entry *new_hash;
 
 	CALLOC_ARRAY(new_hash, new_hash_size);
 	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
+		struct obj_hash_entry *e = &r->parsed_objects->obj_hash[i];
 
-		if (!obj)
+		if (!e->obj)
 			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
+		insert_obj_hash(e->hash, e->obj, new_hash, new_hash_size);
 	}
 	free(r->parsed_objects->obj_hash);
 	r->parsed_objects->obj_hash = new_hash;
@@ -148,33 +174,83 @@ void *create_object(struct repository *r, const struct object_id *oid, void *o)
 	obj->flags = 0;
 	oidcpy(&obj->oid, oid);
 
-	if (r->parsed_objects->obj_hash_size - 1 <= r->parsed_objects->nr_objs * 2)
+	parsed_object_lock();
+	if (parsed_object_use_lock) {
+		struct object *existing = lookup_object_unlocked(r, oid);
+
+		if (existing) {
+			if (obj->type != OBJ_NONE)
+				existing = object_as_type(existing, obj->type, 0);
+			parsed_object_unlock();
+			return existing;
+		}
+	}
+
+	/*
+	 * Keep the table at most 3/4 full; comparing the hashes kept in
+	 * the table makes the longer runs of the probes cheap.
+	 */
+	if (((uint64_t)r->parsed_objects->nr_objs + 1) * 4 >=
+	    (uint64_t)r->parsed_objects->obj_hash_size * 3)
 		grow_object_hash(r);
 
-	insert_obj_hash(obj, r->parsed_objects->obj_hash,
+	insert_obj_hash(oidhash(oid), obj, r->parsed_objects->obj_hash,
 			r->parsed_objects->obj_hash_size);
 	r->parsed_objects->nr_objs++;
+	parsed_object_unlock();
 	return obj;
 }
 
 void *object_as_type(struct object *obj, enum object_type type, int quiet)
 {
-	if (obj->type == type)
-		return obj;
-	else if (obj->type == OBJ_NONE) {
+	void *ret = obj;
+
+	parsed_object_lock();
+	if (obj->type == OBJ_NONE) {
 		if (type == OBJ_COMMIT)
 			init_commit_node((struct commit *) obj);
 		else
 			obj->type = type;
-		return obj;
 	}
-	else {
+	else if (obj->type != type) {
 		if (!quiet)
 			error(_("object %s is a %s, not a %s"),
 			      oid_to_hex(&obj->oid),
 			      type_name(obj->type), type_name(type));
-		return NULL;
+		ret = NULL;
+	}
+	parsed_object_unlock();
+	return ret;
+}
+
+int parsed_object_use_lock;
+pthread_mutex_t parsed_object_mutex;
+
+void enable_parsed_object_lock(void)
+{
+	if (parsed_object_use_lock) {
+		parsed_object_lock();
+		parsed_object_use_lock++;
+		parsed_object_unlock();
+		return;
 	}
+
+	parsed_object_use_lock = 1;
+	init_recursive_mutex(&parsed_object_mutex);
+}
+
+void disable_parsed_object_lock(void)
+{
+	int users;
+
+	if (!parsed_object_use_lock)
+		return;
+
+	parsed_object_lock();
+	users = --parsed_object_use_lock;
+	pthread_mutex_unlock(&parsed_object_mutex);
+	if (!users)
+		pthread_mutex_destroy(&parsed_object_mutex);
 }
 
 struct object *lookup_unknown_object(struct repository *r, const struct object_id *oid)
@@ -466,7 +542,7 @@ void clear_object_flags(unsigned flags)
 	int i;
 
 	for (i=0; i < the_repository->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = the_repository->parsed_objects->obj_hash[i];
+		struct object *obj = the_repository->parsed_objects->obj_hash[i].obj;
 		if (obj)
 			obj->flags &= ~flags;
 	}
@@ -477,7 +553,7 @@ void repo_clear_commit_marks(struct repository *r, unsigned int flags)
 	int i;
 
 	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
+		struct object *obj = r->parsed_objects->obj_hash[i].obj;
 		if (obj && obj->type == OBJ_COMMIT)
 			obj->flags &= ~flags;
 	}
@@ -554,6 +630,9 @@ void raw_object_store_clear(struct raw_object_store *o)
 	o->packed_git = NULL;
 
 	hashmap_clear(&o->pack_map);
+
+	kh_destroy_oid_pos(o->abbrev_cache);
+	o->abbrev_cache = NULL;
 }
 
 void parsed_object_pool_clear(struct parsed_object_pool *o)
@@ -568,7 +647,7 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 	unsigned i;
 
 	for (i = 0; i < o->obj_hash_size; i++) {
-		struct object *obj = o->obj_hash[i];
+		struct object *obj = o->obj_hash[i].obj;
 
 		if (!obj)
 			continue;
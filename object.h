@@ -2,11 +2,13 @@
 #define OBJECT_H
 
 #include "cache.h"
+#include "thread-utils.h"
 
 struct buffer_slab;
+struct obj_hash_entry;
 
 struct parsed_object_pool {
-	struct object **obj_hash;
+	struct obj_hash_entry *obj_hash;
 	int nr_objs, obj_hash_size;
 
 	/* TODO: migrate alloc_states to mem-pool? */
@@ -120,10 +122,47 @@ struct object *get_indexed_object(unsigned int);
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid);
 
+/*
+ * Add the newly allocated obj under the name oid.  If another thread got
+ * there first (see enable_parsed_object_lock()), obj is discarded and
+ * the object already known is returned instead, as object_as_type()
+ * would for the type of obj.
+ */
 void *create_object(struct repository *r, const struct object_id *oid, void *obj);
 
 void *object_as_type(struct object *obj, enum object_type type, int quiet);
 
+/*
+ * Enabling the parsed object lock allows multiple threads to safely call
+ * the following functions in parallel: lookup_object(), create_object(),
+ * object_as_type(), lookup_unknown_object(), lookup_blob(), lookup_tree(),
+ * lookup_commit(), lookup_tag() and the alloc_*_node() functions.  Along
+ * with the object read lock (see enable_obj_read_lock()), this makes
+ * parse_tree() safe to call from several threads, as long as no two of
+ * them parse the same tree.  Parsing commits and tags still needs to be
+ * serialized by the caller, and so do the functions iterating over all
+ * parsed objects.
+ *
+ * Like the object read lock, calls nest and the lock is recursive.
+ */
+void enable_parsed_object_lock(void);
+void disable_parsed_object_lock(void);
+
+extern int parsed_object_use_lock;
+extern pthread_mutex_t parsed_object_mutex;
+
+static inline void parsed_object_lock(void)
+{
+	if (parsed_object_use_lock)
+		pthread_mutex_lock(&parsed_object_mutex);
+}
+
+static inline void parsed_object_unlock(void)
+{
+	if (parsed_object_use_lock)
+		pthread_mutex_unlock(&parsed_object_mutex);
+}
+
 /*
  * Returns the object, having parsed it to find out what it is.
  *
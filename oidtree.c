@@ -54,6 +54,13 @@ void oidtree_insert(struct oidtree *ot, const struct object_id *oid)
 	cb_insert(&ot->tree, on, sizeof(*oid));
 }
 
+void oidtree_remove(struct oidtree *ot, const struct object_id *oid)
+{
+	struct object_id k;
+
+	oidcpy_with_padding(&k, oid);
+	cb_unlink(&ot->tree, (const uint8_t *)&k, sizeof(*oid));
+}
 
 int oidtree_contains(struct oidtree *ot, const struct object_id *oid)
 {
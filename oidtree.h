@@ -13,6 +13,12 @@ struct oidtree {
 void oidtree_init(struct oidtree *);
 void oidtree_clear(struct oidtree *);
 void oidtree_insert(struct oidtree *, const struct object_id *);
+
+/*
+ * Remove an oid from the tree.  Its memory is only given back by
+ * oidtree_clear().
+ */
+void oidtree_remove(struct oidtree *, const struct object_id *);
 int oidtree_contains(struct oidtree *, const struct object_id *);
 
 typedef enum cb_next (*oidtree_iter)(const struct object_id *, void *data);
@@ -13,6 +13,8 @@
 #include "pack-objects.h"
 #include "commit-reach.h"
 #include "prio-queue.h"
+#include "refs.h"
+#include "config.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -21,6 +23,18 @@ struct bitmapped_commit {
 	int flags;
 	int xor_offset;
 	uint32_t commit_pos;
+	off_t offset;
+};
+
+/*
+ * A pseudo-merge: a group of commits that is given a single bitmap of
+ * everything reachable from any of them, as if they were the parents
+ * of a merge commit that does not exist.
+ */
+struct pseudo_merge {
+	uint32_t *parents; /* bit positions, sorted */
+	uint32_t parents_nr;
+	struct ewah_bitmap *bitmap;
 };
 
 struct bitmap_writer {
@@ -35,6 +49,11 @@ struct bitmap_writer {
 	struct bitmapped_commit *selected;
 	unsigned int selected_nr, selected_alloc;
 
+	struct pseudo_merge *pseudo_merges;
+	size_t pseudo_merges_nr, pseudo_merges_alloc;
+
+	const off_t *disk_sizes;
+
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
@@ -375,7 +394,8 @@ static void fill_bitmap_commit(struct bb_commit *ent,
 			       struct prio_queue *queue,
 			       struct prio_queue *tree_queue,
 			       struct bitmap_index *old_bitmap,
-			       const uint32_t *mapping)
+			       const uint32_t *mapping,
+			       kh_oid_map_t *stored)
 {
 	if (!ent->bitmap)
 		ent->bitmap = bitmap_new();
@@ -397,6 +417,18 @@ static void fill_bitmap_commit(struct bb_commit *ent,
 				continue;
 		}
 
+		if (stored) {
+			khiter_t pos = kh_get_oid_map(stored, c->object.oid);
+			/*
+			 * The same goes for the bitmaps we have just built.
+			 */
+			if (pos < kh_end(stored)) {
+				struct bitmapped_commit *bc = kh_value(stored, pos);
+				bitmap_or_ewah(ent->bitmap, bc->bitmap);
+				continue;
+			}
+		}
+
 		/*
 		 * Mark ourselves and queue our tree. The commit
 		 * walk ensures we cover all parents.
@@ -432,6 +464,132 @@ static void store_selected(struct bb_commit *ent, struct commit *commit)
 	kh_value(writer.bitmaps, hash_pos) = stored;
 }
 
+struct pseudo_merge_tips {
+	const struct string_list *patterns;
+	timestamp_t cutoff;
+	struct commit **commits;
+	size_t nr, alloc;
+};
+
+static int add_pseudo_merge_tip(const char *refname,
+				const struct object_id *oid,
+				int flags, void *_data)
+{
+	struct pseudo_merge_tips *data = _data;
+	struct string_list_item *item;
+	struct object_id peeled;
+	struct commit *commit;
+	int match = 0;
+
+	for_each_string_list_item(item, data->patterns) {
+		if (starts_with(refname, item->string)) {
+			match = 1;
+			break;
+		}
+	}
+	if (!match)
+		return 0;
+
+	if (!peel_iterated_oid(oid, &peeled))
+		oid = &peeled;
+	if (!packlist_find(writer.to_pack, oid))
+		return 0;
+
+	/* only tips that have not moved for a while are worth grouping */
+	commit = lookup_commit_reference_gently(writer.to_pack->repo, oid, 1);
+	if (!commit || parse_commit(commit) || commit->date >= data->cutoff)
+		return 0;
+
+	ALLOC_GROW(data->commits, data->nr + 1, data->alloc);
+	data->commits[data->nr++] = commit;
+	return 0;
+}
+
+static int pseudo_merge_tip_cmp(const void *_a, const void *_b)
+{
+	const struct commit *a = *(const struct commit **)_a;
+	const struct commit *b = *(const struct commit **)_b;
+
+	if (a->date != b->date)
+		return a->date < b->date ? -1 : 1;
+	return oidcmp(&a->object.oid, &b->object.oid);
+}
+
+static int uint32_cmp(const void *_a, const void *_b)
+{
+	uint32_t a = *(const uint32_t *)_a;
+	uint32_t b = *(const uint32_t *)_b;
+
+	if (a < b)
+		return -1;
+	return a > b;
+}
+
+/*
+ * Group the commits at the tips of the refs matching
+ * pack.bitmapPseudoMergeTips, oldest first, and compute a bitmap for
+ * each group.
+ */
+static void build_pseudo_merges(struct prio_queue *queue,
+				struct prio_queue *tree_queue,
+				struct bitmap_index *old_bitmap,
+				const uint32_t *mapping)
+{
+	struct pseudo_merge_tips data = { 0 };
+	int group_size = 64;
+	size_t i, j;
+
+	data.patterns =
+		repo_config_get_value_multi(writer.to_pack->repo,
+					    "pack.bitmappseudomergetips");
+	if (!data.patterns)
+		return;
+	git_config_get_int("pack.bitmappseudomergesize", &group_size);
+	if (group_size <= 0)
+		return;
+	data.cutoff = time(NULL) - 14 * 86400;
+	git_config_get_expiry_in_days("pack.bitmappseudomergestableage",
+				      &data.cutoff, time(NULL));
+
+	for_each_ref(add_pseudo_merge_tip, &data);
+	QSORT(data.commits, data.nr, pseudo_merge_tip_cmp);
+
+	/* several refs may point at the same commit */
+	for (i = j = 0; i < data.nr; i++)
+		if (!j || data.commits[j - 1] != data.commits[i])
+			data.commits[j++] = data.commits[i];
+	data.nr = j;
+
+	i = 0;
+	while (i < data.nr) {
+		struct bb_commit ent = { 0 };
+		struct pseudo_merge *merge;
+
+		ALLOC_GROW(writer.pseudo_merges, writer.pseudo_merges_nr + 1,
+			   writer.pseudo_merges_alloc);
+		merge = &writer.pseudo_merges[writer.pseudo_merges_nr++];
+		memset(merge, 0, sizeof(*merge));
+
+		for (; i < data.nr && merge->parents_nr < group_size; i++) {
+			struct commit *c = data.commits[i];
+
+			fill_bitmap_commit(&ent, c, queue, tree_queue,
+					   old_bitmap, mapping, writer.bitmaps);
+			REALLOC_ARRAY(merge->parents, merge->parents_nr + 1);
+			merge->parents[merge->parents_nr++] =
+				find_object_pos(&c->object.oid);
+		}
+		QSORT(merge->parents, merge->parents_nr, uint32_cmp);
+
+		merge->bitmap = bitmap_to_ewah(ent.bitmap);
+		bitmap_free(ent.bitmap);
+	}
+
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "num_pseudo_merges", writer.pseudo_merges_nr);
+	free(data.commits);
+}
+
 void bitmap_writer_build(struct packing_data *to_pack)
 {
 	struct bitmap_builder bb;
@@ -464,7 +622,7 @@ void bitmap_writer_build(struct packing_data *to_pack)
 		int reused = 0;
 
 		fill_bitmap_commit(ent, commit, &queue, &tree_queue,
-				   old_bitmap, mapping);
+				   old_bitmap, mapping, NULL);
 
 		if (ent->selected) {
 			store_selected(ent, commit);
@@ -489,16 +647,18 @@ void bitmap_writer_build(struct packing_data *to_pack)
 			bitmap_free(ent->bitmap);
 		ent->bitmap = NULL;
 	}
+	bitmap_builder_clear(&bb);
+	stop_progress(&writer.progress);
+
+	build_pseudo_merges(&queue, &tree_queue, old_bitmap, mapping);
+
 	clear_prio_queue(&queue);
 	clear_prio_queue(&tree_queue);
-	bitmap_builder_clear(&bb);
 	free(mapping);
 
 	trace2_region_leave("pack-bitmap-write", "building_bitmaps_total",
 			    the_repository);
 
-	stop_progress(&writer.progress);
-
 	compute_xor_offsets();
 }
 
@@ -630,6 +790,8 @@ static void write_selected_commits_v1(struct hashfile *f,
 
 		if (commit_pos < 0)
 			BUG("trying to write commit not in index");
+		stored->commit_pos = commit_pos;
+		stored->offset = hashfile_total(f);
 
 		hashwrite_be32(f, commit_pos);
 		hashwrite_u8(f, stored->xor_offset);
@@ -639,6 +801,129 @@ static void write_selected_commits_v1(struct hashfile *f,
 	}
 }
 
+static int table_cmp(const void *_a, const void *_b, void *_commits)
+{
+	const struct bitmapped_commit *commits = _commits;
+	uint32_t a = commits[*(const uint32_t *)_a].commit_pos;
+	uint32_t b = commits[*(const uint32_t *)_b].commit_pos;
+
+	if (a < b)
+		return -1;
+	return a > b;
+}
+
+/* The indices of the selected commits, in the order of their positions */
+static uint32_t *selected_by_commit_pos(void)
+{
+	uint32_t *table;
+	uint32_t i;
+
+	ALLOC_ARRAY(table, writer.selected_nr);
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+	QSORT_S(table, writer.selected_nr, table_cmp, writer.selected);
+	return table;
+}
+
+static void write_lookup_table(struct hashfile *f)
+{
+	uint32_t *table = selected_by_commit_pos(), *row_of;
+	uint32_t i;
+
+	ALLOC_ARRAY(row_of, writer.selected_nr);
+	for (i = 0; i < writer.selected_nr; i++)
+		row_of[table[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[table[i]];
+		uint32_t xor_row = BITMAP_NO_XOR_ROW;
+
+		if (stored->xor_offset)
+			xor_row = row_of[table[i] - stored->xor_offset];
+
+		hashwrite_be32(f, stored->commit_pos);
+		hashwrite_be64(f, stored->offset);
+		hashwrite_be32(f, xor_row);
+	}
+
+	free(table);
+	free(row_of);
+}
+
+struct commit_stats {
+	struct bitmap *types[4];
+	uint32_t count[4];
+	uint64_t size[4];
+};
+
+static void add_to_commit_stats(size_t pos, void *data)
+{
+	struct commit_stats *stats = data;
+	int t;
+
+	for (t = 0; t < 4; t++) {
+		if (bitmap_get(stats->types[t], pos)) {
+			stats->count[t]++;
+			stats->size[t] += writer.disk_sizes[pos];
+			return;
+		}
+	}
+}
+
+static void write_commit_stats(struct hashfile *f)
+{
+	uint32_t *table = selected_by_commit_pos();
+	struct commit_stats stats;
+	uint32_t i;
+	int t;
+
+	if (!writer.disk_sizes)
+		BUG("writing bitmap commit stats without object sizes");
+
+	/* in the order of OBJ_COMMIT, OBJ_TREE, OBJ_BLOB and OBJ_TAG */
+	stats.types[0] = ewah_to_bitmap(writer.commits);
+	stats.types[1] = ewah_to_bitmap(writer.trees);
+	stats.types[2] = ewah_to_bitmap(writer.blobs);
+	stats.types[3] = ewah_to_bitmap(writer.tags);
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[table[i]];
+
+		memset(stats.count, 0, sizeof(stats.count));
+		memset(stats.size, 0, sizeof(stats.size));
+		ewah_each_bit(stored->bitmap, add_to_commit_stats, &stats);
+
+		hashwrite_be32(f, stored->commit_pos);
+		for (t = 0; t < 4; t++)
+			hashwrite_be32(f, stats.count[t]);
+		for (t = 0; t < 4; t++)
+			hashwrite_be64(f, stats.size[t]);
+	}
+
+	for (t = 0; t < 4; t++)
+		bitmap_free(stats.types[t]);
+	free(table);
+}
+
+static void write_pseudo_merges(struct hashfile *f)
+{
+	off_t start = hashfile_total(f);
+	size_t i;
+	uint32_t j;
+
+	for (i = 0; i < writer.pseudo_merges_nr; i++) {
+		struct pseudo_merge *merge = &writer.pseudo_merges[i];
+
+		hashwrite_be32(f, merge->parents_nr);
+		for (j = 0; j < merge->parents_nr; j++)
+			hashwrite_be32(f, merge->parents[j]);
+		dump_bitmap(f, merge->bitmap);
+	}
+
+	hashwrite_be32(f, writer.pseudo_merges_nr);
+	hashwrite_be64(f, hashfile_total(f) - start - 4);
+}
+
 static void write_hash_cache(struct hashfile *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -651,6 +936,11 @@ static void write_hash_cache(struct hashfile *f,
 	}
 }
 
+void bitmap_writer_set_disk_sizes(const off_t *sizes)
+{
+	writer.disk_sizes = sizes;
+}
+
 void bitmap_writer_set_checksum(unsigned char *sha1)
 {
 	hashcpy(writer.pack_checksum, sha1);
@@ -670,6 +960,9 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 
 	int fd = odb_mkstemp(&tmp_file, "pack/tmp_bitmap_XXXXXX");
 
+	if (writer.pseudo_merges_nr)
+		options |= BITMAP_OPT_PSEUDO_MERGES;
+
 	f = hashfd(fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
@@ -685,6 +978,12 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.tags);
 	write_selected_commits_v1(f, index, index_nr);
 
+	if (options & BITMAP_OPT_PSEUDO_MERGES)
+		write_pseudo_merges(f);
+	if (options & BITMAP_OPT_COMMIT_STATS)
+		write_commit_stats(f);
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f);
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
 
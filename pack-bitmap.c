@@ -13,7 +13,9 @@
 #include "repository.h"
 #include "object-store.h"
 #include "list-objects-filter-options.h"
+#include "list-objects-filter.h"
 #include "config.h"
+#include "midx.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -29,14 +31,22 @@ struct stored_bitmap {
 /*
  * The active bitmap index for a repository. By design, repositories only have
  * a single bitmap index available (the index for the biggest packfile in
- * the repository), since bitmap indexes need full closure.
+ * the repository, or the index for the multi-pack-index), since bitmap
+ * indexes need full closure.
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
+	/*
+	 * The pack or multi-pack index (MIDX) that this bitmap index belongs
+	 * to.
+	 *
+	 * Exactly one of these must be non-NULL; this specifies the object
+	 * order used to interpret this bitmap.
+	 */
 	struct packed_git *pack;
+	struct multi_pack_index *midx;
 
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
@@ -50,6 +60,9 @@ struct bitmap_index {
 	size_t map_size; /* size of the mmaped buffer */
 	size_t map_pos; /* current position when loading the index */
 
+	/* bytes reported to trace2_memory_add() */
+	size_t accounted_size;
+
 	/*
 	 * Type indexes.
 	 *
@@ -68,9 +81,35 @@ struct bitmap_index {
 	/* Number of bitmapped commits */
 	uint32_t entry_count;
 
+	/*
+	 * If not NULL, the lookup table pointing into map.  The entries
+	 * are then only read as bitmap_for_commit() asks for them.
+	 */
+	const unsigned char *table;
+
 	/* If not NULL, this is a name-hash cache pointing into map. */
 	uint32_t *hashes;
 
+	/*
+	 * Pseudo-merges: groups of commits, each with a bitmap of all
+	 * that is reachable from any of them.  "pseudo_merge_map" points
+	 * to their section in map until they are loaded.
+	 */
+	struct pseudo_merge {
+		const unsigned char *parents; /* be32 bit positions */
+		uint32_t parents_nr;
+		struct ewah_bitmap *bitmap;
+	} *pseudo_merges;
+	uint32_t pseudo_merges_nr;
+	const unsigned char *pseudo_merge_map;
+	size_t pseudo_merge_size;
+
+	/*
+	 * If not NULL, the object counts and on-disk sizes of what each
+	 * bitmapped commit reaches, pointing into map.
+	 */
+	const unsigned char *commit_stats;
+
 	/*
 	 * Extended index.
 	 *
@@ -91,10 +130,84 @@ struct bitmap_index {
 	/* "have" bitmap from the last performed walk */
 	struct bitmap *haves;
 
+	/*
+	 * The row of "commit_stats" for the last performed walk, if its
+	 * result is exactly what a bitmapped commit reaches.
+	 */
+	const unsigned char *result_stats;
+
 	/* Version of the bitmap index */
 	unsigned int version;
+
+	/* Checksum of the pack or MIDX this bitmap was written for */
+	const unsigned char *checksum;
 };
 
+int bitmap_is_midx(struct bitmap_index *bitmap_git)
+{
+	return !!bitmap_git->midx;
+}
+
+/*
+ * Return the number of objects covered by the bitmap's "pack" (either a
+ * packfile, or the pseudo-pack described by a MIDX).
+ */
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
+/*
+ * For a MIDX bitmap, the pack whose objects can be reused verbatim in whole
+ * words is the preferred pack: its objects are the first ones in the MIDX's
+ * pseudo-pack order, which makes their bitmap positions identical to their
+ * positions in the pack.
+ */
+static struct packed_git *bitmap_reuse_pack(struct bitmap_index *index)
+{
+	if (index->midx) {
+		struct multi_pack_index *m = index->midx;
+		return m->packs[nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0))];
+	}
+	return index->pack;
+}
+
+/*
+ * Fill in the object id, pack and offset of the object at the given bitmap
+ * position, and return its index position (the position used for the name-hash
+ * cache).
+ */
+static uint32_t bitmap_object_at(struct bitmap_index *bitmap_git, uint32_t pos,
+				 struct object_id *oid,
+				 struct packed_git **pack, off_t *ofs)
+{
+	uint32_t index_pos;
+
+	if (bitmap_git->midx) {
+		struct multi_pack_index *m = bitmap_git->midx;
+
+		index_pos = pack_pos_to_midx(m, pos);
+		if (oid)
+			nth_midxed_object_oid(oid, m, index_pos);
+		if (pack)
+			*pack = m->packs[nth_midxed_pack_int_id(m, index_pos)];
+		if (ofs)
+			*ofs = nth_midxed_offset(m, index_pos);
+	} else {
+		index_pos = pack_pos_to_index(bitmap_git->pack, pos);
+		if (oid)
+			nth_packed_object_id(oid, bitmap_git->pack, index_pos);
+		if (pack)
+			*pack = bitmap_git->pack;
+		if (ofs)
+			*ofs = pack_pos_to_offset(bitmap_git->pack, pos);
+	}
+
+	return index_pos;
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -114,6 +227,12 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 	return composed;
 }
 
+static void account_bitmap_memory(struct bitmap_index *index, size_t size)
+{
+	index->accounted_size += size;
+	trace2_memory_add(TRACE2_MEMORY_ID_BITMAP_INDEX, size);
+}
+
 /*
  * Read a bitmap from the current read position on the mmaped
  * index, and increase the read position accordingly
@@ -133,6 +252,7 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 	}
 
 	index->map_pos += bitmap_size;
+	account_bitmap_memory(index, sizeof(*b) + b->alloc_size * sizeof(eword_t));
 	return b;
 }
 
@@ -154,7 +274,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
-		size_t cache_size = st_mult(index->pack->num_objects, sizeof(uint32_t));
+		size_t cache_size = st_mult(bitmap_num_objects(index), sizeof(uint32_t));
 		unsigned char *index_end = index->map + index->map_size - the_hash_algo->rawsz;
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
@@ -167,9 +287,43 @@ static int load_bitmap_header(struct bitmap_index *index)
 			index->hashes = (void *)(index_end - cache_size);
 			index_end -= cache_size;
 		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			size_t table_size = st_mult(ntohl(header->entry_count),
+						    BITMAP_LOOKUP_TABLE_ROW_WIDTH);
+			if (table_size > index_end - index->map - header_size)
+				return error("corrupted bitmap index file (too short to fit lookup table)");
+			index->table = index_end - table_size;
+			index_end -= table_size;
+		}
+
+		if (flags & BITMAP_OPT_COMMIT_STATS) {
+			size_t stats_size = st_mult(ntohl(header->entry_count),
+						    BITMAP_COMMIT_STATS_ROW_WIDTH);
+			if (stats_size > index_end - index->map - header_size)
+				return error("corrupted bitmap index file (too short to fit commit stats)");
+			index->commit_stats = index_end - stats_size;
+			index_end -= stats_size;
+		}
+
+		if (flags & BITMAP_OPT_PSEUDO_MERGES) {
+			uint64_t size;
+
+			if (BITMAP_PSEUDO_MERGE_TRAILER_SIZE > index_end - index->map - header_size)
+				return error("corrupted bitmap index file (too short to fit pseudo-merges)");
+			index_end -= BITMAP_PSEUDO_MERGE_TRAILER_SIZE;
+			index->pseudo_merges_nr = get_be32(index_end);
+			size = get_be64(index_end + 4);
+			if (size > index_end - index->map - header_size)
+				return error("corrupted bitmap index file (too short to fit pseudo-merges)");
+			index->pseudo_merge_map = index_end - size;
+			index->pseudo_merge_size = size;
+			index_end -= size;
+		}
 	}
 
 	index->entry_count = ntohl(header->entry_count);
+	index->checksum = header->checksum;
 	index->map_pos += header_size;
 	return 0;
 }
@@ -216,6 +370,19 @@ static inline uint8_t read_u8(const unsigned char *buffer, size_t *pos)
 	return buffer[(*pos)++];
 }
 
+static int nth_bitmap_object_oid(struct bitmap_index *index,
+				 struct object_id *oid,
+				 uint32_t n)
+{
+	if (index->midx) {
+		if (n >= index->midx->num_objects)
+			return -1;
+		nth_midxed_object_oid(oid, index->midx, n);
+		return 0;
+	}
+	return nth_packed_object_id(oid, index->pack, n);
+}
+
 #define MAX_XOR_OFFSET 160
 
 static int load_bitmap_entries_v1(struct bitmap_index *index)
@@ -237,7 +404,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		if (nth_packed_object_id(&oid, index->pack, commit_idx_pos) < 0)
+		if (nth_bitmap_object_oid(index, &oid, commit_idx_pos) < 0)
 			return error("corrupt ewah bitmap: commit index %u out of range",
 				     (unsigned)commit_idx_pos);
 
@@ -262,7 +429,163 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
-static char *pack_bitmap_filename(struct packed_git *p)
+/*
+ * Read the entry at "offset" for the commit at "commit_pos", to be
+ * XOR'ed with "xor" (if not NULL), and store it.
+ */
+static struct stored_bitmap *load_bitmap_entry(struct bitmap_index *index,
+					       uint32_t commit_pos,
+					       uint64_t offset,
+					       struct stored_bitmap *xor)
+{
+	struct ewah_bitmap *bitmap;
+	struct object_id oid;
+	int xor_offset, flags;
+
+	if (offset > index->map_size - 6)
+		goto corrupt;
+	index->map_pos = offset;
+	if (read_be32(index->map, &index->map_pos) != commit_pos)
+		goto corrupt;
+	xor_offset = read_u8(index->map, &index->map_pos);
+	flags = read_u8(index->map, &index->map_pos);
+	if (!xor_offset != !xor)
+		goto corrupt;
+
+	if (nth_bitmap_object_oid(index, &oid, commit_pos) < 0)
+		goto corrupt;
+	bitmap = read_bitmap_1(index);
+	if (!bitmap)
+		return NULL;
+	return store_bitmap(index, bitmap, &oid, xor, flags);
+
+corrupt:
+	error("corrupt bitmap lookup table: bad entry for commit index %u",
+	      (unsigned)commit_pos);
+	return NULL;
+}
+
+/*
+ * Load the bitmap of the given row of the lookup table, along with
+ * the bitmaps it is XOR'ed against that are not loaded yet.
+ */
+static struct stored_bitmap *lazy_bitmap_for_row(struct bitmap_index *index,
+						 uint32_t row)
+{
+	struct stored_bitmap *stored = NULL;
+	uint32_t *chain = NULL;
+	size_t nr = 0, alloc = 0;
+
+	/* find the first bitmap down the XOR chain that we already have */
+	for (;;) {
+		const unsigned char *p;
+		struct object_id oid;
+		khiter_t pos;
+
+		if (row >= index->entry_count || nr > index->entry_count) {
+			error("corrupt bitmap lookup table: bad XOR row %u",
+			      (unsigned)row);
+			goto out;
+		}
+		p = index->table + st_mult(row, BITMAP_LOOKUP_TABLE_ROW_WIDTH);
+		if (nth_bitmap_object_oid(index, &oid, get_be32(p)) < 0) {
+			error("corrupt bitmap lookup table: commit index %u out of range",
+			      (unsigned)get_be32(p));
+			goto out;
+		}
+		pos = kh_get_oid_map(index->bitmaps, oid);
+		if (pos < kh_end(index->bitmaps)) {
+			stored = kh_value(index->bitmaps, pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, nr + 1, alloc);
+		chain[nr++] = row;
+		row = get_be32(p + 12);
+		if (row == BITMAP_NO_XOR_ROW)
+			break;
+	}
+
+	/* then load the rest, bases first */
+	while (nr--) {
+		const unsigned char *p =
+			index->table + st_mult(chain[nr], BITMAP_LOOKUP_TABLE_ROW_WIDTH);
+
+		stored = load_bitmap_entry(index, get_be32(p), get_be64(p + 4),
+					   stored);
+		if (!stored)
+			break;
+	}
+
+out:
+	free(chain);
+	return stored;
+}
+
+/*
+ * Find the row for "oid" in "table", whose rows of "width" bytes each
+ * start with a commit position and are sorted by it.
+ */
+static int find_commit_row(struct bitmap_index *index,
+			   const unsigned char *table, size_t width,
+			   const struct object_id *oid, uint32_t *row)
+{
+	uint32_t commit_pos, lo = 0, hi = index->entry_count;
+
+	if (index->midx) {
+		if (!bsearch_midx(oid, index->midx, &commit_pos))
+			return 0;
+	} else if (!bsearch_pack(oid, index->pack, &commit_pos)) {
+		return 0;
+	}
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t pos = get_be32(table + st_mult(mi, width));
+
+		if (pos == commit_pos) {
+			*row = mi;
+			return 1;
+		}
+		if (pos < commit_pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static int find_table_row(struct bitmap_index *index,
+			  const struct object_id *oid, uint32_t *row)
+{
+	return find_commit_row(index, index->table,
+			       BITMAP_LOOKUP_TABLE_ROW_WIDTH, oid, row);
+}
+
+/* The row of the commit statistics for "commit", if any */
+static const unsigned char *commit_stats_for(struct bitmap_index *index,
+					     struct commit *commit)
+{
+	uint32_t row;
+
+	if (!index->commit_stats ||
+	    !find_commit_row(index, index->commit_stats,
+			     BITMAP_COMMIT_STATS_ROW_WIDTH,
+			     &commit->object.oid, &row))
+		return NULL;
+	return index->commit_stats + st_mult(row, BITMAP_COMMIT_STATS_ROW_WIDTH);
+}
+
+char *midx_bitmap_filename(struct multi_pack_index *midx)
+{
+	char *midx_name = get_midx_filename(midx->object_dir);
+	char *ret = xstrfmt("%s-%s.bitmap", midx_name,
+			    hash_to_hex(get_midx_checksum(midx)));
+	free(midx_name);
+	return ret;
+}
+
+char *pack_bitmap_filename(struct packed_git *p)
 {
 	size_t len;
 
@@ -271,6 +594,74 @@ static char *pack_bitmap_filename(struct packed_git *p)
 	return xstrfmt("%.*s.bitmap", (int)len, p->pack_name);
 }
 
+static int open_midx_bitmap_1(struct repository *r,
+			      struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	struct stat st;
+	char *idx_name = midx_bitmap_filename(midx);
+	int fd = git_open(idx_name);
+	uint32_t i;
+
+	free(idx_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	if (bitmap_git->pack || bitmap_git->midx) {
+		/* ignore extra bitmap file; we can only handle one */
+		char *midx_name = get_midx_filename(midx->object_dir);
+		warning("ignoring extra bitmap file: %s", midx_name);
+		free(midx_name);
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map_pos = 0;
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ,
+				MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0)
+		goto cleanup;
+
+	if (!hasheq(get_midx_checksum(bitmap_git->midx), bitmap_git->checksum)) {
+		warning(_("ignoring stale multi-pack bitmap; "
+			  "checksum doesn't match MIDX"));
+		goto cleanup;
+	}
+
+	if (load_midx_revindex(bitmap_git->midx) < 0) {
+		warning(_("multi-pack bitmap is missing required reverse index"));
+		goto cleanup;
+	}
+
+	for (i = 0; i < bitmap_git->midx->num_packs; i++) {
+		if (prepare_midx_pack(r, bitmap_git->midx, i)) {
+			warning(_("could not open pack %s"),
+				bitmap_git->midx->pack_names[i]);
+			goto cleanup;
+		}
+	}
+
+	account_bitmap_memory(bitmap_git, bitmap_git->map_size);
+	return 0;
+
+cleanup:
+	munmap(bitmap_git->map, bitmap_git->map_size);
+	bitmap_git->map_size = 0;
+	bitmap_git->map = NULL;
+	bitmap_git->midx = NULL;
+	return -1;
+}
+
 static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git *packfile)
 {
 	int fd;
@@ -292,7 +683,7 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		return -1;
 	}
 
-	if (bitmap_git->pack) {
+	if (bitmap_git->pack || bitmap_git->midx) {
 		warning("ignoring extra bitmap file: %s", packfile->pack_name);
 		close(fd);
 		return -1;
@@ -316,16 +707,69 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		return -1;
 	}
 
+	account_bitmap_memory(bitmap_git, bitmap_git->map_size);
 	return 0;
 }
 
+static void free_pseudo_merges(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	if (!index->pseudo_merges)
+		return;
+	for (i = 0; i < index->pseudo_merges_nr; i++)
+		ewah_pool_free(index->pseudo_merges[i].bitmap);
+	FREE_AND_NULL(index->pseudo_merges);
+}
+
+static int load_pseudo_merges(struct bitmap_index *index)
+{
+	const unsigned char *p = index->pseudo_merge_map;
+	const unsigned char *end = p + index->pseudo_merge_size;
+	uint32_t i = 0, j;
+
+	if (index->pseudo_merges_nr > index->pseudo_merge_size / 4)
+		goto corrupt;
+	CALLOC_ARRAY(index->pseudo_merges, index->pseudo_merges_nr);
+	for (i = 0; i < index->pseudo_merges_nr; i++) {
+		struct pseudo_merge *merge = &index->pseudo_merges[i];
+		ssize_t bitmap_size;
+
+		if (end - p < 4)
+			goto corrupt;
+		merge->parents_nr = get_be32(p);
+		p += 4;
+		if ((end - p) / 4 < merge->parents_nr)
+			goto corrupt;
+		merge->parents = p;
+		for (j = 0; j < merge->parents_nr; j++)
+			if (get_be32(p + st_mult(j, 4)) >= bitmap_num_objects(index))
+				goto corrupt;
+		p += st_mult(merge->parents_nr, 4);
+
+		merge->bitmap = ewah_pool_new();
+		bitmap_size = ewah_read_mmap(merge->bitmap, p, end - p);
+		if (bitmap_size < 0)
+			goto corrupt;
+		p += bitmap_size;
+	}
+	if (p != end)
+		goto corrupt;
+	return 0;
+
+corrupt:
+	error("corrupted bitmap index file (bad pseudo-merge %u)", (unsigned)i);
+	free_pseudo_merges(index);
+	return -1;
+}
+
 static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
 
 	bitmap_git->bitmaps = kh_init_oid_map();
 	bitmap_git->ext_index.positions = kh_init_oid_pos();
-	if (load_pack_revindex(bitmap_git->pack))
+	if (load_pack_revindex(bitmap_reuse_pack(bitmap_git)))
 		goto failed;
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
@@ -334,7 +778,10 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(bitmap_git) < 0)
+	if (!bitmap_git->table && load_bitmap_entries_v1(bitmap_git) < 0)
+		goto failed;
+
+	if (bitmap_git->pseudo_merge_map && load_pseudo_merges(bitmap_git) < 0)
 		goto failed;
 
 	return 0;
@@ -369,11 +816,40 @@ static int open_pack_bitmap(struct repository *r,
 	return ret;
 }
 
+static int open_midx_bitmap(struct repository *r,
+			    struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *midx;
+
+	assert(!bitmap_git->map);
+
+	for (midx = get_multi_pack_index(r); midx; midx = midx->next) {
+		/* bitmaps are never written for chained layers */
+		if (!midx->local || midx->in_chain)
+			continue;
+		if (!open_midx_bitmap_1(r, bitmap_git, midx))
+			return 0;
+	}
+	return -1;
+}
+
+static int open_bitmap(struct repository *r,
+		       struct bitmap_index *bitmap_git)
+{
+	/*
+	 * A MIDX bitmap covers (at least) the objects of every pack it
+	 * indexes, so prefer it over any single-pack bitmap.
+	 */
+	if (!open_midx_bitmap(r, bitmap_git))
+		return 0;
+	return open_pack_bitmap(r, bitmap_git);
+}
+
 struct bitmap_index *prepare_bitmap_git(struct repository *r)
 {
 	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 
-	if (!open_pack_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
+	if (!open_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
 		return bitmap_git;
 
 	free_bitmap_index(bitmap_git);
@@ -391,9 +867,19 @@ struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 {
 	khiter_t hash_pos = kh_get_oid_map(bitmap_git->bitmaps,
 					   commit->object.oid);
-	if (hash_pos >= kh_end(bitmap_git->bitmaps))
+	struct stored_bitmap *stored;
+	uint32_t row;
+
+	if (hash_pos < kh_end(bitmap_git->bitmaps))
+		return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+
+	if (!bitmap_git->table ||
+	    !find_table_row(bitmap_git, &commit->object.oid, &row))
 		return NULL;
-	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+	stored = lazy_bitmap_for_row(bitmap_git, row);
+	if (!stored)
+		return NULL;
+	return lookup_stored_bitmap(stored);
 }
 
 static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
@@ -404,7 +890,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
@@ -423,10 +909,26 @@ static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 	return pos;
 }
 
+static int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				const struct object_id *oid)
+{
+	uint32_t want, got;
+	if (!bsearch_midx(oid, bitmap_git->midx, &want))
+		return -1;
+
+	if (midx_to_pack_pos(bitmap_git->midx, want, &got) < 0)
+		return -1;
+	return got;
+}
+
 static int bitmap_position(struct bitmap_index *bitmap_git,
 			   const struct object_id *oid)
 {
-	int pos = bitmap_position_packfile(bitmap_git, oid);
+	int pos;
+	if (bitmap_is_midx(bitmap_git))
+		pos = bitmap_position_midx(bitmap_git, oid);
+	else
+		pos = bitmap_position_packfile(bitmap_git, oid);
 	return (pos >= 0) ? pos : bitmap_position_extended(bitmap_git, oid);
 }
 
@@ -456,7 +958,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -563,6 +1065,70 @@ static int add_commit_to_bitmap(struct bitmap_index *bitmap_git,
 	return 1;
 }
 
+/*
+ * Add to "base" the bitmap of every pseudo-merge whose parents are all
+ * among "roots" or already in "base".  As "base" is closed under
+ * reachability, roots that end up in it need no walk.
+ */
+static void apply_pseudo_merges(struct bitmap_index *bitmap_git,
+				struct bitmap **base,
+				struct object_list *roots)
+{
+	struct bitmap *tips = bitmap_new();
+	char *done = xcalloc(bitmap_git->pseudo_merges_nr, 1);
+	uint32_t i, j, applied = 0;
+	int changed;
+
+	for (; roots; roots = roots->next) {
+		struct object *object = roots->item;
+		int pos;
+
+		while (object && object->type == OBJ_TAG)
+			object = ((struct tag *)object)->tagged;
+		if (!object || object->type != OBJ_COMMIT)
+			continue;
+		pos = bitmap_position(bitmap_git, &object->oid);
+		if (pos >= 0)
+			bitmap_set(tips, pos);
+	}
+
+	do {
+		changed = 0;
+		for (i = 0; i < bitmap_git->pseudo_merges_nr; i++) {
+			struct pseudo_merge *merge = &bitmap_git->pseudo_merges[i];
+			int any_tip = 0;
+
+			if (done[i])
+				continue;
+			for (j = 0; j < merge->parents_nr; j++) {
+				uint32_t pos = get_be32(merge->parents + st_mult(j, 4));
+
+				if (bitmap_get(tips, pos))
+					any_tip = 1;
+				else if (!*base || !bitmap_get(*base, pos))
+					break;
+			}
+			if (j < merge->parents_nr)
+				continue;
+
+			done[i] = 1;
+			/* everything is in "base" already otherwise */
+			if (!any_tip)
+				continue;
+			if (!*base)
+				*base = bitmap_new();
+			bitmap_or_ewah(*base, merge->bitmap);
+			applied++;
+			changed = 1;
+		}
+	} while (changed);
+
+	trace2_data_intmax("bitmap", the_repository,
+			   "pseudo_merges_applied", applied);
+	bitmap_free(tips);
+	free(done);
+}
+
 static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 				   struct rev_info *revs,
 				   struct object_list *roots,
@@ -602,6 +1168,9 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 	if (not_mapped == NULL)
 		return base;
 
+	if (bitmap_git->pseudo_merges_nr)
+		apply_pseudo_merges(bitmap_git, &base, not_mapped);
+
 	roots = not_mapped;
 
 	/*
@@ -673,7 +1242,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -738,6 +1307,7 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
+			struct packed_git *pack;
 			uint32_t hash = 0, index_pos;
 			off_t ofs;
 
@@ -746,14 +1316,13 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			index_pos = pack_pos_to_index(bitmap_git->pack, pos + offset);
-			ofs = pack_pos_to_offset(bitmap_git->pack, pos + offset);
-			nth_packed_object_id(&oid, bitmap_git->pack, index_pos);
+			index_pos = bitmap_object_at(bitmap_git, pos + offset,
+						     &oid, &pack, &ofs);
 
 			if (bitmap_git->hashes)
 				hash = get_be32(bitmap_git->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, ofs);
+			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
 	}
 }
@@ -765,8 +1334,13 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
-			return 1;
+		if (bitmap_is_midx(bitmap_git)) {
+			if (bsearch_midx(&object->oid, bitmap_git->midx, NULL))
+				return 1;
+		} else {
+			if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+				return 1;
+		}
 	}
 
 	return 0;
@@ -832,7 +1406,7 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 	 * them individually.
 	 */
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == type &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos))
@@ -853,23 +1427,24 @@ static void filter_bitmap_blob_none(struct bitmap_index *bitmap_git,
 static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 				     uint32_t pos)
 {
-	struct packed_git *pack = bitmap_git->pack;
 	unsigned long size;
 	struct object_info oi = OBJECT_INFO_INIT;
 
 	oi.sizep = &size;
 
-	if (pos < pack->num_objects) {
-		off_t ofs = pack_pos_to_offset(pack, pos);
+	if (pos < bitmap_num_objects(bitmap_git)) {
+		struct packed_git *pack;
+		off_t ofs;
+
+		bitmap_object_at(bitmap_git, pos, NULL, &pack, &ofs);
 		if (packed_object_info(the_repository, pack, ofs, &oi) < 0) {
 			struct object_id oid;
-			nth_packed_object_id(&oid, pack,
-					     pack_pos_to_index(pack, pos));
+			bitmap_object_at(bitmap_git, pos, &oid, NULL, NULL);
 			die(_("unable to get size of %s"), oid_to_hex(&oid));
 		}
 	} else {
 		struct eindex *eindex = &bitmap_git->ext_index;
-		struct object *obj = eindex->objects[pos - pack->num_objects];
+		struct object *obj = eindex->objects[pos - bitmap_num_objects(bitmap_git)];
 		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
 			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
 	}
@@ -911,7 +1486,7 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	}
 
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == OBJ_BLOB &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos) &&
@@ -936,6 +1511,169 @@ static void filter_bitmap_tree_depth(struct bitmap_index *bitmap_git,
 				   OBJ_BLOB);
 }
 
+struct filter_walk_data {
+	struct bitmap_index *bitmap_git;
+	struct bitmap *keep;
+};
+
+static void filter_walk_show_commit(struct commit *commit, void *data)
+{
+}
+
+static void filter_walk_show_object(struct object *obj, const char *name,
+				    void *data)
+{
+	struct filter_walk_data *fw = data;
+	int pos = bitmap_position(fw->bitmap_git, &obj->oid);
+
+	if (pos >= 0)
+		bitmap_set(fw->keep, pos);
+}
+
+/*
+ * Queue the root tree of a commit the way the commit walk would, so
+ * that the filter counts its depth and path from there.
+ */
+static void add_filter_walk_root(struct rev_info *revs, struct tree *tree)
+{
+	tree->object.flags |= NOT_USER_GIVEN;
+	add_pending_object(revs, &tree->object, "");
+}
+
+/*
+ * Clear the trees and blobs in "to_filter" that are neither in "keep"
+ * nor asked for by name.
+ */
+static void filter_bitmap_keep_only(struct bitmap_index *bitmap_git,
+				    struct bitmap *tips,
+				    struct bitmap *to_filter,
+				    struct bitmap *keep,
+				    enum object_type type)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	for (i = 0, init_type_iterator(&it, bitmap_git, type);
+	     i < to_filter->word_alloc && ewah_iterator_next(&mask, &it);
+	     i++) {
+		if (i < tips->word_alloc)
+			mask &= ~tips->words[i];
+		if (i < keep->word_alloc)
+			mask &= ~keep->words[i];
+		to_filter->words[i] &= ~mask;
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
+		if (eindex->objects[i]->type == type &&
+		    bitmap_get(to_filter, pos) &&
+		    !bitmap_get(tips, pos) &&
+		    !bitmap_get(keep, pos))
+			bitmap_unset(to_filter, pos);
+	}
+}
+
+/*
+ * Path-based filters (sparse:oid, and tree:<depth> with a non-zero
+ * depth) cannot be answered from the bitmaps alone, as those know
+ * nothing about paths.  But the bitmaps still spare us the commit walk
+ * and the walk of everything the other side has: run the regular
+ * filter over the root trees of the commits in the result (and the
+ * trees asked for by name) only, and keep the trees and blobs it would
+ * have shown.  Trees that are not part of the result are not entered,
+ * and tree:<depth> does not look below its depth, so the walk is
+ * usually much smaller than the one it replaces.
+ */
+static void filter_bitmap_by_walk(struct bitmap_index *bitmap_git,
+				  struct object_list *wants,
+				  struct object_list *tip_objects,
+				  struct bitmap *to_filter,
+				  struct list_objects_filter_options *filter)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct filter_walk_data fw;
+	struct rev_info revs;
+	struct bitmap *tips;
+	struct object_list *p;
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	/* the bitmap walks may have left their marks behind */
+	reset_revision_walk();
+	list_objects_filter__clear_marks();
+
+	/*
+	 * As in the regular walk, trees asked for by name come first and
+	 * are not filtered themselves, only their contents.
+	 */
+	for (p = wants; p; p = p->next) {
+		if (p->item->type != OBJ_TREE)
+			continue;
+		p->item->flags &= ~NOT_USER_GIVEN;
+		add_pending_object(&revs, p->item, "");
+	}
+
+	for (i = 0, init_type_iterator(&it, bitmap_git, OBJ_COMMIT);
+	     i < to_filter->word_alloc && ewah_iterator_next(&mask, &it);
+	     i++) {
+		eword_t word = to_filter->words[i] & mask;
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			struct object_id oid;
+			struct commit *c;
+
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			bitmap_object_at(bitmap_git, i * BITS_IN_EWORD + offset,
+					 &oid, NULL, NULL);
+			c = lookup_commit(the_repository, &oid);
+			if (!c || repo_parse_commit(the_repository, c))
+				die(_("unable to parse commit %s"),
+				    oid_to_hex(&oid));
+			add_filter_walk_root(&revs, get_commit_tree(c));
+		}
+	}
+	for (i = 0; i < eindex->count; i++) {
+		struct object *obj = eindex->objects[i];
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
+
+		if (obj->type != OBJ_COMMIT || !bitmap_get(to_filter, pos))
+			continue;
+		if (repo_parse_commit(the_repository, (struct commit *)obj))
+			die(_("unable to parse commit %s"),
+			    oid_to_hex(&obj->oid));
+		add_filter_walk_root(&revs,
+				     get_commit_tree((struct commit *)obj));
+	}
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+
+	fw.bitmap_git = bitmap_git;
+	fw.keep = bitmap_new();
+	traverse_commit_list_filtered(filter, &revs, filter_walk_show_commit,
+				      filter_walk_show_object, &fw, NULL);
+	reset_revision_walk();
+
+	tips = find_tip_objects(bitmap_git, tip_objects, OBJ_TREE);
+	filter_bitmap_keep_only(bitmap_git, tips, to_filter, fw.keep, OBJ_TREE);
+	bitmap_free(tips);
+	tips = find_tip_objects(bitmap_git, tip_objects, OBJ_BLOB);
+	filter_bitmap_keep_only(bitmap_git, tips, to_filter, fw.keep, OBJ_BLOB);
+	bitmap_free(tips);
+
+	bitmap_free(fw.keep);
+}
+
 static void filter_bitmap_object_type(struct bitmap_index *bitmap_git,
 				      struct object_list *tip_objects,
 				      struct bitmap *to_filter,
@@ -954,7 +1692,22 @@ static void filter_bitmap_object_type(struct bitmap_index *bitmap_git,
 		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter, OBJ_BLOB);
 }
 
+static int filter_needs_walk(struct list_objects_filter_options *filter)
+{
+	int i;
+
+	if (filter->choice == LOFC_SPARSE_OID ||
+	    (filter->choice == LOFC_TREE_DEPTH && filter->tree_exclude_depth))
+		return 1;
+	if (filter->choice == LOFC_COMBINE)
+		for (i = 0; i < filter->sub_nr; i++)
+			if (filter_needs_walk(&filter->sub[i]))
+				return 1;
+	return 0;
+}
+
 static int filter_bitmap(struct bitmap_index *bitmap_git,
+			 struct object_list *wants,
 			 struct object_list *tip_objects,
 			 struct bitmap *to_filter,
 			 struct list_objects_filter_options *filter)
@@ -986,6 +1739,14 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 		return 0;
 	}
 
+	if (filter->choice == LOFC_TREE_DEPTH ||
+	    filter->choice == LOFC_SPARSE_OID) {
+		if (bitmap_git)
+			filter_bitmap_by_walk(bitmap_git, wants, tip_objects,
+					      to_filter, filter);
+		return 0;
+	}
+
 	if (filter->choice == LOFC_OBJECT_TYPE) {
 		if (bitmap_git)
 			filter_bitmap_object_type(bitmap_git, tip_objects,
@@ -995,12 +1756,24 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 	}
 
 	if (filter->choice == LOFC_COMBINE) {
-		int i;
+		int i, walk = 0;
 		for (i = 0; i < filter->sub_nr; i++) {
-			if (filter_bitmap(bitmap_git, tip_objects, to_filter,
-					  &filter->sub[i]) < 0)
+			/*
+			 * The path-based filters do not combine by simply
+			 * intersecting their results, so they are walked
+			 * together, as the combined filter.
+			 */
+			if (filter_needs_walk(&filter->sub[i])) {
+				walk = 1;
+				continue;
+			}
+			if (filter_bitmap(bitmap_git, wants, tip_objects,
+					  to_filter, &filter->sub[i]) < 0)
 				return -1;
 		}
+		if (walk && bitmap_git)
+			filter_bitmap_by_walk(bitmap_git, wants, tip_objects,
+					      to_filter, filter);
 		return 0;
 	}
 
@@ -1010,7 +1783,16 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 
 static int can_filter_bitmap(struct list_objects_filter_options *filter)
 {
-	return !filter_bitmap(NULL, NULL, NULL, filter);
+	return !filter_bitmap(NULL, NULL, NULL, NULL, filter);
+}
+
+static struct bitmap_index *spare_bitmap_git;
+
+void set_spare_bitmap_index(struct bitmap_index *bitmap_git)
+{
+	if (spare_bitmap_git)
+		free_bitmap_index(spare_bitmap_git);
+	spare_bitmap_git = bitmap_git;
 }
 
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
@@ -1040,9 +1822,15 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
-	CALLOC_ARRAY(bitmap_git, 1);
-	if (open_pack_bitmap(revs->repo, bitmap_git) < 0)
-		goto cleanup;
+	if (spare_bitmap_git) {
+		bitmap_git = spare_bitmap_git;
+		spare_bitmap_git = NULL;
+		trace2_data_string("bitmap", the_repository, "index", "spare");
+	} else {
+		CALLOC_ARRAY(bitmap_git, 1);
+		if (open_bitmap(revs->repo, bitmap_git) < 0)
+			goto cleanup;
+	}
 
 	for (i = 0; i < revs->pending.nr; ++i) {
 		struct object *object = revs->pending.objects[i].item;
@@ -1085,7 +1873,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	 * from disk. this is the point of no return; after this the rev_list
 	 * becomes invalidated and we must perform the revwalk through bitmaps
 	 */
-	if (load_pack_bitmap(bitmap_git) < 0)
+	if (!bitmap_git->bitmaps && load_pack_bitmap(bitmap_git) < 0)
 		goto cleanup;
 
 	object_array_clear(&revs->pending);
@@ -1110,12 +1898,23 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
-	filter_bitmap(bitmap_git, (filter && filter_provided_objects) ? NULL : wants,
+	filter_bitmap(bitmap_git, wants,
+		      (filter && filter_provided_objects) ? NULL : wants,
 		      wants_bitmap, filter);
 
 	bitmap_git->result = wants_bitmap;
 	bitmap_git->haves = haves_bitmap;
 
+	/* a single bitmapped commit reaches exactly what its bitmap says */
+	if (!haves && !wants->next && wants->item->type == OBJ_COMMIT &&
+	    (!filter || filter->choice == LOFC_DISABLED))
+		bitmap_git->result_stats =
+			commit_stats_for(bitmap_git,
+					 (struct commit *)wants->item);
+	if (bitmap_git->result_stats)
+		trace2_data_string("bitmap", the_repository,
+				   "result", "from commit stats");
+
 	object_list_free(&wants);
 	object_list_free(&haves);
 
@@ -1128,7 +1927,62 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	return NULL;
 }
 
+/*
+ * Whether the objects of "pack" take all of its bit positions in pack
+ * order, so that a position is the pack position plus "bitmap_pos".
+ * This is always the case for a single-pack bitmap and for the
+ * preferred pack of a MIDX bitmap.
+ */
+static int bitmapped_pack_is_whole(struct bitmapped_pack *pack)
+{
+	return pack->bitmap_nr == pack->p->num_objects;
+}
+
+off_t bitmap_reused_offset(struct bitmap_index *bitmap_git,
+			   struct bitmapped_pack *pack, uint32_t pos,
+			   uint32_t *pack_pos)
+{
+	off_t ofs;
+
+	if (bitmapped_pack_is_whole(pack)) {
+		if (pack_pos)
+			*pack_pos = pos - pack->bitmap_pos;
+		return pack_pos_to_offset(pack->p, pos - pack->bitmap_pos);
+	}
+
+	ofs = nth_midxed_offset(bitmap_git->midx,
+				pack_pos_to_midx(bitmap_git->midx, pos));
+	if (pack_pos && offset_to_pack_pos(pack->p, ofs, pack_pos) < 0)
+		return 0;
+	return ofs;
+}
+
+int bitmap_reused_base_position(struct bitmap_index *bitmap_git,
+				struct bitmapped_pack *pack,
+				uint32_t base_pack_pos, uint32_t *base_pos)
+{
+	struct object_id base_oid;
+	uint32_t midx_pos;
+
+	if (bitmapped_pack_is_whole(pack)) {
+		*base_pos = pack->bitmap_pos + base_pack_pos;
+		return 0;
+	}
+
+	/*
+	 * The MIDX may have picked the base from another pack; a delta
+	 * against it can still be reused if that copy is, with its
+	 * offset rewritten by the caller.
+	 */
+	nth_packed_object_id(&base_oid, pack->p,
+			     pack_pos_to_index(pack->p, base_pack_pos));
+	if (!bsearch_midx(&base_oid, bitmap_git->midx, &midx_pos))
+		return -1;
+	return midx_to_pack_pos(bitmap_git->midx, midx_pos, base_pos);
+}
+
 static void try_partial_reuse(struct bitmap_index *bitmap_git,
+			      struct bitmapped_pack *pack,
 			      size_t pos,
 			      struct bitmap *reuse,
 			      struct pack_window **w_curs)
@@ -1136,18 +1990,18 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 	off_t offset, header;
 	enum object_type type;
 	unsigned long size;
+	uint32_t pack_pos;
 
-	if (pos >= bitmap_git->pack->num_objects)
-		return; /* not actually in the pack */
-
-	offset = header = pack_pos_to_offset(bitmap_git->pack, pos);
-	type = unpack_object_header(bitmap_git->pack, w_curs, &offset, &size);
+	offset = header = bitmap_reused_offset(bitmap_git, pack, pos, &pack_pos);
+	if (!offset)
+		return; /* not in the revindex; the pack is corrupt */
+	type = unpack_object_header(pack->p, w_curs, &offset, &size);
 	if (type < 0)
 		return; /* broken packfile, punt */
 
 	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
 		off_t base_offset;
-		uint32_t base_pos;
+		uint32_t base_pack_pos, base_pos;
 
 		/*
 		 * Find the position of the base object so we can look it up
@@ -1157,11 +2011,14 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 		 * and the normal slow path will complain about it in
 		 * more detail.
 		 */
-		base_offset = get_delta_base(bitmap_git->pack, w_curs,
+		base_offset = get_delta_base(pack->p, w_curs,
 					     &offset, type, header);
 		if (!base_offset)
 			return;
-		if (offset_to_pack_pos(bitmap_git->pack, base_offset, &base_pos) < 0)
+		if (offset_to_pack_pos(pack->p, base_offset, &base_pack_pos) < 0)
+			return;
+		if (bitmap_reused_base_position(bitmap_git, pack,
+						base_pack_pos, &base_pos) < 0)
 			return;
 
 		/*
@@ -1194,11 +2051,89 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 	bitmap_set(reuse, pos);
 }
 
+/*
+ * In the pseudo-pack order of a MIDX, the objects it picked from the
+ * preferred pack come first, followed by those of every other pack in
+ * pack id order, so each pack takes a contiguous range of positions.
+ * Return the first position whose pack sorts at or after "key", where
+ * the preferred pack has key 0 and pack id "n" has key n + 1.
+ */
+static uint32_t midx_pack_range_start(struct multi_pack_index *m,
+				      uint32_t preferred, uint32_t key)
+{
+	uint32_t lo = 0, hi = m->num_objects;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t id = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, mi));
+		uint32_t mi_key = id == preferred ? 0 : id + 1;
+
+		if (mi_key < key)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+static void add_bitmapped_pack(struct bitmapped_pack **packs, size_t *nr,
+			       size_t *alloc, struct packed_git *p,
+			       uint32_t bitmap_pos, uint32_t bitmap_nr)
+{
+	if (!bitmap_nr)
+		return;
+	ALLOC_GROW(*packs, *nr + 1, *alloc);
+	(*packs)[*nr].p = p;
+	(*packs)[*nr].bitmap_pos = bitmap_pos;
+	(*packs)[*nr].bitmap_nr = bitmap_nr;
+	(*nr)++;
+}
+
+static void collect_bitmapped_packs(struct bitmap_index *bitmap_git,
+				    struct bitmapped_pack **packs,
+				    size_t *nr)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	size_t alloc = 0;
+	uint32_t preferred, i;
+
+	*packs = NULL;
+	*nr = 0;
+
+	if (!m) {
+		add_bitmapped_pack(packs, nr, &alloc, bitmap_git->pack,
+				   0, bitmap_git->pack->num_objects);
+		return;
+	}
+	if (!m->num_objects)
+		return;
+
+	preferred = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0));
+	add_bitmapped_pack(packs, nr, &alloc, m->packs[preferred], 0,
+			   midx_pack_range_start(m, preferred, 1));
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p = m->packs[i];
+		uint32_t start, end;
+
+		if (i == preferred)
+			continue;
+		start = midx_pack_range_start(m, preferred, i + 1);
+		end = midx_pack_range_start(m, preferred, i + 2);
+		if (start == end || load_pack_revindex(p) < 0)
+			continue;
+		add_bitmapped_pack(packs, nr, &alloc, p, start, end - start);
+	}
+}
+
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
-				       struct packed_git **packfile_out,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
 				       uint32_t *entries,
 				       struct bitmap **reuse_out)
 {
+	struct bitmapped_pack *packs;
+	size_t packs_nr, cur = 0;
 	struct bitmap *result = bitmap_git->result;
 	struct bitmap *reuse;
 	struct pack_window *w_curs = NULL;
@@ -1207,12 +2142,21 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 
 	assert(result);
 
+	collect_bitmapped_packs(bitmap_git, &packs, &packs_nr);
+	if (!packs_nr)
+		return -1;
+
 	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
 		i++;
 
-	/* Don't mark objects not in the packfile */
-	if (i > bitmap_git->pack->num_objects / BITS_IN_EWORD)
-		i = bitmap_git->pack->num_objects / BITS_IN_EWORD;
+	/*
+	 * Don't mark objects not in the first packfile; only it can be
+	 * sent wholesale without looking at each object.
+	 */
+	if (!bitmapped_pack_is_whole(&packs[0]))
+		i = 0;
+	else if (i > packs[0].bitmap_nr / BITS_IN_EWORD)
+		i = packs[0].bitmap_nr / BITS_IN_EWORD;
 
 	reuse = bitmap_word_alloc(i);
 	memset(reuse->words, 0xFF, i * sizeof(eword_t));
@@ -1226,15 +2170,29 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
-			try_partial_reuse(bitmap_git, pos + offset, reuse, &w_curs);
+			while (cur < packs_nr &&
+			       pos + offset >= packs[cur].bitmap_pos +
+					       packs[cur].bitmap_nr) {
+				/* windows belong to a single pack */
+				unuse_pack(&w_curs);
+				cur++;
+			}
+			if (cur == packs_nr)
+				goto done; /* not actually in any pack */
+			if (pos + offset < packs[cur].bitmap_pos)
+				continue;
+			try_partial_reuse(bitmap_git, &packs[cur], pos + offset,
+					  reuse, &w_curs);
 		}
 	}
 
+done:
 	unuse_pack(&w_curs);
 
 	*entries = bitmap_popcount(reuse);
 	if (!*entries) {
 		bitmap_free(reuse);
+		free(packs);
 		return -1;
 	}
 
@@ -1243,7 +2201,8 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	 * need to be handled separately.
 	 */
 	bitmap_and_not(result, reuse);
-	*packfile_out = bitmap_git->pack;
+	*packs_out = packs;
+	*packs_nr_out = packs_nr;
 	*reuse_out = reuse;
 	return 0;
 }
@@ -1260,6 +2219,61 @@ int bitmap_walk_contains(struct bitmap_index *bitmap_git,
 	return idx >= 0 && bitmap_get(bitmap, idx);
 }
 
+int bitmap_set_object(struct bitmap_index *bitmap_git,
+		      struct bitmap *bitmap, const struct object_id *oid)
+{
+	int idx = bitmap_position(bitmap_git, oid);
+
+	if (idx < 0)
+		return -1;
+	bitmap_set(bitmap, idx);
+	return 0;
+}
+
+struct bitmap *bitmap_commit_reachability(struct bitmap_index *bitmap_git,
+					  struct commit *commit)
+{
+	struct bitmap *result = bitmap_new();
+	struct commit **stack = NULL;
+	size_t nr = 0, alloc = 0;
+
+	ALLOC_GROW(stack, nr + 1, alloc);
+	stack[nr++] = commit;
+	while (nr) {
+		struct commit_list *p;
+		struct ewah_bitmap *stored;
+		int pos;
+
+		commit = stack[--nr];
+		pos = bitmap_position(bitmap_git, &commit->object.oid);
+		if (pos < 0)
+			goto fail;
+		if (bitmap_get(result, pos))
+			continue;
+
+		stored = bitmap_for_commit(bitmap_git, commit);
+		if (stored) {
+			bitmap_or_ewah(result, stored);
+			continue;
+		}
+
+		bitmap_set(result, pos);
+		if (parse_commit(commit))
+			goto fail;
+		for (p = commit->parents; p; p = p->next) {
+			ALLOC_GROW(stack, nr + 1, alloc);
+			stack[nr++] = p->item;
+		}
+	}
+	free(stack);
+	return result;
+
+fail:
+	free(stack);
+	bitmap_free(result);
+	return NULL;
+}
+
 void traverse_bitmap_commit_list(struct bitmap_index *bitmap_git,
 				 struct rev_info *revs,
 				 show_reachable_fn show_reachable)
@@ -1296,7 +2310,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -1309,6 +2323,20 @@ void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 {
 	assert(bitmap_git->result);
 
+	if (bitmap_git->result_stats) {
+		const unsigned char *counts = bitmap_git->result_stats + 4;
+
+		if (commits)
+			*commits = get_be32(counts);
+		if (trees)
+			*trees = get_be32(counts + 4);
+		if (blobs)
+			*blobs = get_be32(counts + 8);
+		if (tags)
+			*tags = get_be32(counts + 12);
+		return;
+	}
+
 	if (commits)
 		*commits = count_object_type(bitmap_git, OBJ_COMMIT);
 
@@ -1375,6 +2403,9 @@ void test_bitmap_walk(struct rev_info *revs)
 	fprintf(stderr, "Bitmap v%d test (%d entries loaded)\n",
 		bitmap_git->version, bitmap_git->entry_count);
 
+	if (bitmap_is_midx(bitmap_git))
+		fprintf(stderr, "Using multi-pack bitmap\n");
+
 	root = revs->pending.objects[0].item;
 	bm = bitmap_for_commit(bitmap_git, (struct commit *)root);
 
@@ -1423,6 +2454,14 @@ int test_bitmap_commits(struct repository *r)
 	if (!bitmap_git)
 		die("failed to load bitmap indexes");
 
+	if (bitmap_git->table) {
+		uint32_t i;
+
+		for (i = 0; i < bitmap_git->entry_count; i++)
+			if (!lazy_bitmap_for_row(bitmap_git, i))
+				die("failed to load bitmap indexes");
+	}
+
 	kh_foreach(bitmap_git->bitmaps, oid, value, {
 		printf("%s\n", oid_to_hex(&oid));
 	});
@@ -1469,15 +2508,14 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 	uint32_t i, num_objects;
 	uint32_t *reposition;
 
-	num_objects = bitmap_git->pack->num_objects;
+	num_objects = bitmap_num_objects(bitmap_git);
 	CALLOC_ARRAY(reposition, num_objects);
 
 	for (i = 0; i < num_objects; ++i) {
 		struct object_id oid;
 		struct object_entry *oe;
 
-		nth_packed_object_id(&oid, bitmap_git->pack,
-				     pack_pos_to_index(bitmap_git->pack, i));
+		bitmap_object_at(bitmap_git, i, &oid, NULL, NULL);
 		oe = packlist_find(mapping, &oid);
 
 		if (oe)
@@ -1494,11 +2532,14 @@ void free_bitmap_index(struct bitmap_index *b)
 
 	if (b->map)
 		munmap(b->map, b->map_size);
+	trace2_memory_add(TRACE2_MEMORY_ID_BITMAP_INDEX,
+			  -(intmax_t)b->accounted_size);
 	ewah_pool_free(b->commits);
 	ewah_pool_free(b->trees);
 	ewah_pool_free(b->blobs);
 	ewah_pool_free(b->tags);
 	kh_destroy_oid_map(b->bitmaps);
+	free_pseudo_merges(b);
 	free(b->ext_index.objects);
 	free(b->ext_index.hashes);
 	bitmap_free(b->result);
@@ -1513,11 +2554,17 @@ int bitmap_has_oid_in_uninteresting(struct bitmap_index *bitmap_git,
 		bitmap_walk_contains(bitmap_git, bitmap_git->haves, oid);
 }
 
+int bitmap_has_oid_in_result(struct bitmap_index *bitmap_git,
+			     const struct object_id *oid)
+{
+	return bitmap_git &&
+		bitmap_walk_contains(bitmap_git, bitmap_git->result, oid);
+}
+
 static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 				     enum object_type object_type)
 {
 	struct bitmap *result = bitmap_git->result;
-	struct packed_git *pack = bitmap_git->pack;
 	off_t total = 0;
 	struct ewah_iterator it;
 	eword_t filter;
@@ -1534,15 +2581,33 @@ static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 			continue;
 
 		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			struct packed_git *pack;
 			size_t pos;
+			uint32_t pack_pos;
+			off_t ofs;
 
 			if ((word >> offset) == 0)
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
 			pos = base + offset;
-			total += pack_pos_to_offset(pack, pos + 1) -
-				 pack_pos_to_offset(pack, pos);
+
+			if (!bitmap_is_midx(bitmap_git)) {
+				pack = bitmap_git->pack;
+				total += pack_pos_to_offset(pack, pos + 1) -
+					 pack_pos_to_offset(pack, pos);
+				continue;
+			}
+
+			bitmap_object_at(bitmap_git, pos, NULL, &pack, &ofs);
+			if (offset_to_pack_pos(pack, ofs, &pack_pos) < 0) {
+				struct object_id oid;
+				bitmap_object_at(bitmap_git, pos, &oid, NULL, NULL);
+				die(_("could not find %s in pack %s at offset %"PRIuMAX),
+				    oid_to_hex(&oid), pack->pack_name,
+				    (uintmax_t)ofs);
+			}
+			total += pack_pos_to_offset(pack, pack_pos + 1) - ofs;
 		}
 	}
 
@@ -1552,7 +2617,6 @@ static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 static off_t get_disk_usage_for_extended(struct bitmap_index *bitmap_git)
 {
 	struct bitmap *result = bitmap_git->result;
-	struct packed_git *pack = bitmap_git->pack;
 	struct eindex *eindex = &bitmap_git->ext_index;
 	off_t total = 0;
 	struct object_info oi = OBJECT_INFO_INIT;
@@ -1564,7 +2628,7 @@ static off_t get_disk_usage_for_extended(struct bitmap_index *bitmap_git)
 	for (i = 0; i < eindex->count; i++) {
 		struct object *obj = eindex->objects[i];
 
-		if (!bitmap_get(result, pack->num_objects + i))
+		if (!bitmap_get(result, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
@@ -1581,6 +2645,19 @@ off_t get_disk_usage_from_bitmap(struct bitmap_index *bitmap_git,
 {
 	off_t total = 0;
 
+	if (bitmap_git->result_stats) {
+		const unsigned char *sizes = bitmap_git->result_stats + 4 + 4 * 4;
+
+		total += get_be64(sizes);
+		if (revs->tree_objects)
+			total += get_be64(sizes + 8);
+		if (revs->blob_objects)
+			total += get_be64(sizes + 16);
+		if (revs->tag_objects)
+			total += get_be64(sizes + 24);
+		return total;
+	}
+
 	total += get_disk_usage_for_type(bitmap_git, OBJ_COMMIT);
 	if (revs->tree_objects)
 		total += get_disk_usage_for_type(bitmap_git, OBJ_TREE);
@@ -1598,3 +2675,19 @@ const struct string_list *bitmap_preferred_tips(struct repository *r)
 {
 	return repo_config_get_value_multi(r, "pack.preferbitmaptips");
 }
+
+int bitmap_is_preferred_refname(struct repository *r, const char *refname)
+{
+	const struct string_list *preferred_tips = bitmap_preferred_tips(r);
+	struct string_list_item *item;
+
+	if (!preferred_tips)
+		return 0;
+
+	for_each_string_list_item(item, preferred_tips) {
+		if (starts_with(refname, item->string))
+			return 1;
+	}
+
+	return 0;
+}
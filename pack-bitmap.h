@@ -8,6 +8,7 @@
 #include "string-list.h"
 
 struct commit;
+struct multi_pack_index;
 struct repository;
 struct rev_info;
 struct list_objects_filter_options;
@@ -27,8 +28,24 @@ struct bitmap_disk_header {
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
+	BITMAP_OPT_PSEUDO_MERGES = 32,
+	BITMAP_OPT_COMMIT_STATS = 64,
 };
 
+/* Size of a row of the lookup table, and its "no XOR base" value */
+#define BITMAP_LOOKUP_TABLE_ROW_WIDTH (4 + 8 + 4)
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
+/*
+ * Size of a row of the commit statistics: the commit position, then the
+ * number and the total on-disk size of reachable objects of each type
+ */
+#define BITMAP_COMMIT_STATS_ROW_WIDTH (4 + 4 * 4 + 4 * 8)
+
+/* Size of the trailer of the pseudo-merge section */
+#define BITMAP_PSEUDO_MERGE_TRAILER_SIZE (4 + 8)
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -54,16 +71,80 @@ int test_bitmap_commits(struct repository *r);
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 					 struct list_objects_filter_options *filter,
 					 int filter_provided_objects);
+
+/*
+ * Hand a bitmap index returned by prepare_bitmap_git() over to the next
+ * prepare_bitmap_walk(), which then uses it instead of opening and
+ * loading the same files again.  The caller must not use or free it
+ * anymore.
+ */
+void set_spare_bitmap_index(struct bitmap_index *bitmap_git);
+
+/*
+ * A pack from which pack-objects can reuse objects verbatim, and the
+ * range of bitmap positions of the objects it provides.  For a MIDX
+ * bitmap these are the objects the MIDX picked from the pack, which may
+ * be fewer than the pack has.
+ */
+struct bitmapped_pack {
+	struct packed_git *p;
+	uint32_t bitmap_pos;
+	uint32_t bitmap_nr;
+};
+
+/*
+ * Find the objects of the bitmap walk's result that can be sent by
+ * copying them from the packs they are stored in, and drop them from
+ * the result.  The packs are returned in bitmap position order, which
+ * is also the order their objects must be written in: a reused delta
+ * always comes after its base, though for a MIDX bitmap the base may
+ * have been reused from an earlier pack.
+ */
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
-				       struct packed_git **packfile,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
 				       uint32_t *entries,
 				       struct bitmap **reuse_out);
+
+/*
+ * Return the offset in "pack" of the object at bitmap position "pos",
+ * which must be within the pack's range, and store its position in the
+ * pack in "pack_pos" when it is not NULL.
+ */
+off_t bitmap_reused_offset(struct bitmap_index *,
+			   struct bitmapped_pack *pack, uint32_t pos,
+			   uint32_t *pack_pos);
+
+/*
+ * Find the bitmap position of the object at "base_pack_pos" in "pack",
+ * which may be a position in the range of another pack.  Returns -1
+ * when the object is not covered by the bitmap.
+ */
+int bitmap_reused_base_position(struct bitmap_index *,
+				struct bitmapped_pack *pack,
+				uint32_t base_pack_pos, uint32_t *base_pos);
+
 int rebuild_existing_bitmaps(struct bitmap_index *, struct packing_data *mapping,
 			     kh_oid_map_t *reused_bitmaps, int show_progress);
 void free_bitmap_index(struct bitmap_index *);
 int bitmap_walk_contains(struct bitmap_index *,
 			 struct bitmap *bitmap, const struct object_id *oid);
 
+/*
+ * Set the bit of "oid" in "bitmap".  Returns -1 when the object is not
+ * covered by the bitmap index.
+ */
+int bitmap_set_object(struct bitmap_index *,
+		      struct bitmap *bitmap, const struct object_id *oid);
+
+/*
+ * Return a bitmap with (at least) the bits of all commits reachable
+ * from "commit" set, using the stored bitmaps where there are some,
+ * or NULL if any of these commits is not covered by the bitmap index.
+ */
+struct bitmap *bitmap_commit_reachability(struct bitmap_index *,
+					  struct commit *commit);
+
 /*
  * After a traversal has been performed by prepare_bitmap_walk(), this can be
  * queried to see if a particular object was reachable from any of the
@@ -71,6 +152,12 @@ int bitmap_walk_contains(struct bitmap_index *,
  */
 int bitmap_has_oid_in_uninteresting(struct bitmap_index *, const struct object_id *oid);
 
+/*
+ * After a traversal has been performed by prepare_bitmap_walk(), this can be
+ * queried to see if a particular object is part of its result.
+ */
+int bitmap_has_oid_in_result(struct bitmap_index *, const struct object_id *oid);
+
 off_t get_disk_usage_from_bitmap(struct bitmap_index *, struct rev_info *);
 
 void bitmap_writer_show_progress(int show);
@@ -88,11 +175,24 @@ struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 void bitmap_writer_select_commits(struct commit **indexed_commits,
 		unsigned int indexed_commits_nr, int max_bitmaps);
 void bitmap_writer_build(struct packing_data *to_pack);
+
+/*
+ * Give the on-disk size of the object at each bit position, which
+ * writing BITMAP_OPT_COMMIT_STATS needs.  The array is used by
+ * bitmap_writer_finish() and must stay valid until then.
+ */
+void bitmap_writer_set_disk_sizes(const off_t *sizes);
 void bitmap_writer_finish(struct pack_idx_entry **index,
 			  uint32_t index_nr,
 			  const char *filename,
 			  uint16_t options);
 
+char *midx_bitmap_filename(struct multi_pack_index *midx);
+char *pack_bitmap_filename(struct packed_git *p);
+
+int bitmap_is_midx(struct bitmap_index *bitmap_git);
+
 const struct string_list *bitmap_preferred_tips(struct repository *r);
+int bitmap_is_preferred_refname(struct repository *r, const char *refname);
 
 #endif
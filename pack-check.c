@@ -5,12 +5,28 @@
 #include "progress.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "hash-batch.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
 	unsigned int nr;
 };
 
+/*
+ * Objects are unpacked a few at a time, so that the names of the
+ * small ones can be computed together.
+ */
+#define VERIFY_BATCH_NR 64
+#define VERIFY_BATCH_SIZE (4 * 1024 * 1024)
+
+struct verify_entry {
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	void *data;
+};
+
 static int compare_entries(const void *e1, const void *e2)
 {
 	const struct idx_entry *entry1 = e1;
@@ -30,7 +46,12 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 
 	do {
 		unsigned long avail;
-		void *data = use_pack(p, w_curs, offset, &avail);
+		void *data;
+
+		/* the window stays in use until the next use_pack() */
+		obj_read_lock();
+		data = use_pack(p, w_curs, offset, &avail);
+		obj_read_unlock();
 		if (avail > len)
 			avail = len;
 		data_crc = crc32(data_crc, data, avail);
@@ -44,61 +65,112 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
-static int verify_packfile(struct repository *r,
-			   struct packed_git *p,
-			   struct pack_window **w_curs,
-			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+static int verify_batch(struct repository *r, struct packed_git *p,
+			struct verify_entry *v, int nr, verify_fn fn)
+{
+	struct hash_batch_item items[VERIFY_BATCH_NR];
+	struct object_id real_oid[VERIFY_BATCH_NR];
+	int i, nr_items = 0, err = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (!v[i].data)
+			continue;
+		items[nr_items].type = type_name(v[i].type);
+		items[nr_items].buf = v[i].data;
+		items[nr_items].len = v[i].size;
+		items[nr_items].oid = &real_oid[i];
+		nr_items++;
+	}
+	hash_object_file_batch(r->hash_algo, items, nr_items);
 
+	for (i = 0; i < nr; i++) {
+		int corrupt;
+
+		if (v[i].data)
+			corrupt = !oideq(&v[i].oid, &real_oid[i]);
+		else {
+			/*
+			 * Let check_object_signature() check it with
+			 * the streaming interface; no point slurping
+			 * the data in-core only to discard.  It only
+			 * holds the object read lock while reading, so
+			 * that large blobs are inflated and hashed by
+			 * several threads at once.
+			 */
+			corrupt = !!check_object_signature(r, &v[i].oid, NULL,
+							   v[i].size,
+							   type_name(v[i].type));
+		}
+
+		if (corrupt)
+			err = error("packed %s from %s is corrupt",
+				    oid_to_hex(&v[i].oid), p->pack_name);
+		else if (fn) {
+			int eaten = 0;
+			err |= fn(&v[i].oid, v[i].type, v[i].size, v[i].data,
+				  &eaten);
+			if (eaten)
+				v[i].data = NULL;
+		}
+		free(v[i].data);
+	}
+	return err;
+}
+
+static int verify_pack_checksum(struct repository *r, struct packed_git *p,
+				struct pack_window **w_curs)
 {
-	off_t index_size = p->index_size;
 	const unsigned char *index_base = p->index_data;
+	off_t pack_sig_ofs = p->pack_size - r->hash_algo->rawsz;
+	off_t offset = 0;
 	git_hash_ctx ctx;
 	unsigned char hash[GIT_MAX_RAWSZ], *pack_sig;
-	off_t offset = 0, pack_sig_ofs = 0;
-	uint32_t nr_objects, i;
 	int err = 0;
-	struct idx_entry *entries;
-
-	if (!is_pack_valid(p))
-		return error("packfile %s cannot be accessed", p->pack_name);
 
 	r->hash_algo->init_fn(&ctx);
 	do {
 		unsigned long remaining;
-		unsigned char *in = use_pack(p, w_curs, offset, &remaining);
+		unsigned char *in;
+
+		obj_read_lock();
+		in = use_pack(p, w_curs, offset, &remaining);
+		obj_read_unlock();
 		offset += remaining;
-		if (!pack_sig_ofs)
-			pack_sig_ofs = p->pack_size - r->hash_algo->rawsz;
 		if (offset > pack_sig_ofs)
 			remaining -= (unsigned int)(offset - pack_sig_ofs);
 		r->hash_algo->update_fn(&ctx, in, remaining);
 	} while (offset < pack_sig_ofs);
 	r->hash_algo->final_fn(hash, &ctx);
+	obj_read_lock();
 	pack_sig = use_pack(p, w_curs, pack_sig_ofs, NULL);
 	if (!hasheq(hash, pack_sig))
 		err = error("%s pack checksum mismatch",
 			    p->pack_name);
-	if (!hasheq(index_base + index_size - r->hash_algo->hexsz, pack_sig))
+	if (!hasheq(index_base + p->index_size - r->hash_algo->hexsz, pack_sig))
 		err = error("%s pack checksum does not match its index",
 			    p->pack_name);
 	unuse_pack(w_curs);
+	obj_read_unlock();
+	return err;
+}
 
-	/* Make sure everything reachable from idx is valid.  Since we
-	 * have verified that nr_objects matches between idx and pack,
-	 * we do not do scan-streaming check on the pack file.
-	 */
-	nr_objects = p->num_objects;
-	ALLOC_ARRAY(entries, nr_objects + 1);
-	entries[nr_objects].offset = pack_sig_ofs;
-	/* first sort entries by pack offset, since unpacking them is more efficient that way */
-	for (i = 0; i < nr_objects; i++) {
-		entries[i].offset = nth_packed_object_offset(p, i);
-		entries[i].nr = i;
-	}
-	QSORT(entries, nr_objects, compare_entries);
+/*
+ * Check the objects entries[first] up to (but excluding) entries[last]
+ * and feed them to "fn".  The entry after the last one must exist, as
+ * it is used to compute the size of the last one for its CRC.
+ */
+static int verify_objects(struct repository *r, struct packed_git *p,
+			  struct pack_window **w_curs,
+			  struct idx_entry *entries,
+			  uint32_t first, uint32_t last, verify_fn fn)
+{
+	struct verify_entry batch[VERIFY_BATCH_NR];
+	int batch_nr = 0;
+	unsigned long batch_size = 0;
+	uint32_t i;
+	int err = 0;
 
-	for (i = 0; i < nr_objects; i++) {
+	for (i = first; i < last; i++) {
 		void *data;
 		struct object_id oid;
 		enum object_type type;
@@ -122,41 +194,184 @@ static int verify_packfile(struct repository *r,
 		}
 
 		curpos = entries[i].offset;
+		obj_read_lock();
 		type = unpack_object_header(p, w_curs, &curpos, &size);
 		unuse_pack(w_curs);
 
 		if (type == OBJ_BLOB && big_file_threshold <= size) {
-			/*
-			 * Let check_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
+			/* verify_batch() streams it */
 			data = NULL;
 			data_valid = 0;
 		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
 			data_valid = 1;
+			data = unpack_entry(r, p, entries[i].offset, &type, &size);
+			batch_size += size;
 		}
+		obj_read_unlock();
 
-		if (data_valid && !data)
+		if (data_valid && !data) {
 			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
 				    oid_to_hex(&oid), p->pack_name,
 				    (uintmax_t)entries[i].offset);
-		else if (check_object_signature(r, &oid, data, size, type_name(type)))
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(&oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
+		} else {
+			oidcpy(&batch[batch_nr].oid, &oid);
+			batch[batch_nr].type = type;
+			batch[batch_nr].size = size;
+			batch[batch_nr].data = data;
+			batch_nr++;
+		}
+		if (batch_nr == VERIFY_BATCH_NR ||
+		    batch_size >= VERIFY_BATCH_SIZE) {
+			err |= verify_batch(r, p, batch, batch_nr, fn);
+			batch_nr = 0;
+			batch_size = 0;
 		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
+	}
+	err |= verify_batch(r, p, batch, batch_nr, fn);
+	return err;
+}
+
+/*
+ * Objects a thread takes at a time; keep it a multiple of the batches.
+ * Packs with fewer objects, e.g. of large blobs, are handed out in
+ * smaller chunks so that each thread still gets a share.
+ */
+#define VERIFY_CHUNK_NR (4 * VERIFY_BATCH_NR)
+
+struct verify_threads {
+	struct repository *r;
+	struct packed_git *p;
+	struct idx_entry *entries;
+	uint32_t nr_objects;
+	verify_fn fn;
+	uint32_t chunk;
 
+	pthread_mutex_t mutex;
+	uint32_t next;
+	struct progress *progress;
+	uint32_t base_count, done;
+	int err;
+};
+
+static void *verify_objects_thread(void *data)
+{
+	struct verify_threads *vt = data;
+	struct pack_window *w_curs = NULL;
+	int err = 0;
+
+	for (;;) {
+		uint32_t first, last;
+
+		pthread_mutex_lock(&vt->mutex);
+		first = vt->next;
+		last = first + vt->chunk;
+		if (last > vt->nr_objects || last < first)
+			last = vt->nr_objects;
+		vt->next = last;
+		pthread_mutex_unlock(&vt->mutex);
+		if (first >= last)
+			break;
+
+		err |= verify_objects(vt->r, vt->p, &w_curs, vt->entries,
+				      first, last, vt->fn);
+
+		pthread_mutex_lock(&vt->mutex);
+		vt->done += last - first;
+		display_progress(vt->progress, vt->base_count + vt->done);
+		pthread_mutex_unlock(&vt->mutex);
+	}
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+
+	pthread_mutex_lock(&vt->mutex);
+	vt->err |= err;
+	pthread_mutex_unlock(&vt->mutex);
+	return NULL;
+}
+
+static int verify_packfile(struct repository *r,
+			   struct packed_git *p,
+			   struct pack_window **w_curs,
+			   verify_fn fn,
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
+
+{
+	uint32_t nr_objects, i;
+	int err = 0;
+	struct idx_entry *entries;
+
+	if (!is_pack_valid(p))
+		return error("packfile %s cannot be accessed", p->pack_name);
+
+	/* Make sure everything reachable from idx is valid.  Since we
+	 * have verified that nr_objects matches between idx and pack,
+	 * we do not do scan-streaming check on the pack file.
+	 */
+	nr_objects = p->num_objects;
+	ALLOC_ARRAY(entries, nr_objects + 1);
+	entries[nr_objects].offset = p->pack_size - r->hash_algo->rawsz;
+	/* first sort entries by pack offset, since unpacking them is more efficient that way */
+	for (i = 0; i < nr_objects; i++) {
+		entries[i].offset = nth_packed_object_offset(p, i);
+		entries[i].nr = i;
+	}
+	QSORT(entries, nr_objects, compare_entries);
+	pack_advise_sequential(p, 1);
+
+	if (HAVE_THREADS && nr_threads > 1 && nr_objects > 1) {
+		struct verify_threads vt = {
+			.r = r,
+			.p = p,
+			.entries = entries,
+			.nr_objects = nr_objects,
+			.fn = fn,
+			.progress = progress,
+			.base_count = base_count,
+		};
+		pthread_t *threads;
+		int t;
+
+		vt.chunk = DIV_ROUND_UP(nr_objects, 4 * nr_threads);
+		if (vt.chunk > VERIFY_CHUNK_NR)
+			vt.chunk = VERIFY_CHUNK_NR;
+		if (nr_threads > nr_objects)
+			nr_threads = nr_objects;
+
+		/*
+		 * The threads take turns at the object store (which
+		 * unpack_entry() leaves while inflating) and share the
+		 * delta base cache, while we checksum the whole pack.
+		 */
+		enable_obj_read_lock();
+		pthread_mutex_init(&vt.mutex, NULL);
+		CALLOC_ARRAY(threads, nr_threads);
+		for (t = 0; t < nr_threads; t++)
+			if (pthread_create(&threads[t], NULL,
+					   verify_objects_thread, &vt))
+				die(_("unable to create thread"));
+		err |= verify_pack_checksum(r, p, w_curs);
+		for (t = 0; t < nr_threads; t++)
+			pthread_join(threads[t], NULL);
+		free(threads);
+		pthread_mutex_destroy(&vt.mutex);
+		disable_obj_read_lock();
+		err |= vt.err;
+	} else {
+		err |= verify_pack_checksum(r, p, w_curs);
+		for (i = 0; i < nr_objects; i += VERIFY_CHUNK_NR) {
+			uint32_t last = i + VERIFY_CHUNK_NR;
+
+			if (last > nr_objects)
+				last = nr_objects;
+			err |= verify_objects(r, p, w_curs, entries, i, last, fn);
+			display_progress(progress, base_count + last);
+		}
 	}
-	display_progress(progress, base_count + i);
+	display_progress(progress, base_count + nr_objects);
+	pack_advise_sequential(p, 0);
 	free(entries);
 
 	return err;
@@ -177,7 +392,7 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count, int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -186,7 +401,8 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
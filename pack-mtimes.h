@@ -0,0 +1,31 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+#include "git-compat-util.h"
+
+/*
+ * A cruft pack holds unreachable objects that are not old enough to be
+ * pruned yet.  Next to it, a ".mtimes" file records the modification
+ * time of each of its objects, in the order of the ".idx" file, so that
+ * the objects can be expired one by one without being loosened first.
+ * The format is described in Documentation/technical/pack-format.txt.
+ */
+
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+
+struct packed_git;
+
+/*
+ * Loads the ".mtimes" file of the cruft pack "p", returning zero on
+ * success and a negative value otherwise.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/*
+ * Returns the mtime of the object at index position "pos" in the cruft
+ * pack "p", whose mtimes must have been loaded with load_pack_mtimes().
+ */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+#endif
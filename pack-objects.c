@@ -4,6 +4,7 @@
 #include "pack-objects.h"
 #include "packfile.h"
 #include "config.h"
+#include "tempfile.h"
 
 static uint32_t locate_object_entry_hash(struct packing_data *pdata,
 					 const struct object_id *oid,
@@ -130,6 +131,48 @@ void oe_map_new_pack(struct packing_data *pack)
 	FREE_AND_NULL(pack->in_pack_by_idx);
 }
 
+int spill_cold_fields(struct packing_data *pdata)
+{
+#if defined(NO_MMAP) || defined(USE_WIN32_MMAP)
+	return -1;
+#else
+	struct strbuf template = STRBUF_INIT;
+
+	if (pdata->nr_alloc)
+		BUG("cold fields must be spilled before adding objects");
+
+	strbuf_addf(&template, "%s/pack/tmp_cold_XXXXXX",
+		    pdata->repo->objects->odb->path);
+	if (safe_create_leading_directories(template.buf) >= 0)
+		pdata->cold_file = mks_tempfile(template.buf);
+	strbuf_release(&template);
+	return pdata->cold_file ? 0 : -1;
+#endif
+}
+
+/* Resize the arrays of cold fields to nr_alloc entries. */
+static void alloc_cold_fields(struct packing_data *pdata)
+{
+	size_t size;
+	int fd;
+
+	if (!pdata->cold_file) {
+		REALLOC_ARRAY(pdata->in_pack_offset, pdata->nr_alloc);
+		return;
+	}
+
+	size = st_mult(sizeof(*pdata->in_pack_offset), pdata->nr_alloc);
+	fd = get_tempfile_fd(pdata->cold_file);
+	if (pdata->in_pack_offset)
+		munmap(pdata->in_pack_offset, pdata->cold_size);
+	if (ftruncate(fd, size) < 0)
+		die_errno(_("unable to extend '%s'"),
+			  get_tempfile_path(pdata->cold_file));
+	pdata->in_pack_offset = xmmap(NULL, size, PROT_READ | PROT_WRITE,
+				      MAP_SHARED, fd, 0);
+	pdata->cold_size = size;
+}
+
 /* assume pdata is already zero'd by caller */
 void prepare_packing_data(struct repository *r, struct packing_data *pdata)
 {
@@ -151,6 +194,33 @@ void prepare_packing_data(struct repository *r, struct packing_data *pdata)
 	init_recursive_mutex(&pdata->odb_lock);
 }
 
+void clear_packing_data(struct packing_data *pdata)
+{
+	if (!pdata)
+		return;
+
+	free(pdata->objects);
+	free(pdata->index);
+	free(pdata->in_pack_pos);
+	free(pdata->delta_size);
+	free(pdata->in_pack_by_idx);
+	free(pdata->in_pack);
+	free(pdata->ext_bases);
+	free(pdata->tree_depth);
+	free(pdata->layer);
+	free(pdata->cruft_mtime);
+	if (pdata->cold_file) {
+		if (pdata->in_pack_offset)
+			munmap(pdata->in_pack_offset, pdata->cold_size);
+		delete_tempfile(&pdata->cold_file);
+	} else {
+		free(pdata->in_pack_offset);
+	}
+	pthread_mutex_destroy(&pdata->odb_lock);
+
+	memset(pdata, 0, sizeof(*pdata));
+}
+
 struct object_entry *packlist_alloc(struct packing_data *pdata,
 				    const struct object_id *oid)
 {
@@ -159,6 +229,7 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	if (pdata->nr_objects >= pdata->nr_alloc) {
 		pdata->nr_alloc = (pdata->nr_alloc  + 1024) * 3 / 2;
 		REALLOC_ARRAY(pdata->objects, pdata->nr_alloc);
+		alloc_cold_fields(pdata);
 
 		if (!pdata->in_pack_by_idx)
 			REALLOC_ARRAY(pdata->in_pack, pdata->nr_alloc);
@@ -170,6 +241,9 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 		if (pdata->layer)
 			REALLOC_ARRAY(pdata->layer, pdata->nr_alloc);
+
+		if (pdata->cruft_mtime)
+			REALLOC_ARRAY(pdata->cruft_mtime, pdata->nr_alloc);
 	}
 
 	new_entry = pdata->objects + pdata->nr_objects++;
@@ -189,6 +263,8 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 		pdata->index[pos] = pdata->nr_objects;
 	}
 
+	pdata->in_pack_offset[pdata->nr_objects - 1] = 0;
+
 	if (pdata->in_pack)
 		pdata->in_pack[pdata->nr_objects - 1] = NULL;
 
@@ -198,6 +274,9 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	if (pdata->layer)
 		pdata->layer[pdata->nr_objects - 1] = 0;
 
+	if (pdata->cruft_mtime)
+		pdata->cruft_mtime[pdata->nr_objects - 1] = 0;
+
 	return new_entry;
 }
 
@@ -61,6 +61,9 @@ enum dfs_state {
  * The (in_pack, in_pack_offset) tuple contains the location of the
  * object in the source pack. in_pack_header_size allows quickly
  * skipping the header and going straight to the zlib stream.
+ * in_pack_offset is not needed while searching for deltas and lives
+ * outside of this struct (see oe_in_pack_offset()), as a "cold"
+ * field.
  *
  * "type" and "in_pack_type" both describe object type. in_pack_type
  * may contain a delta type, while type is always the canonical type.
@@ -87,7 +90,6 @@ enum dfs_state {
 struct object_entry {
 	struct pack_idx_entry idx;
 	void *delta_data;	/* cached delta (uncompressed) */
-	off_t in_pack_offset;
 	uint32_t hash;			/* name hint hash */
 	unsigned size_:OE_SIZE_BITS;
 	unsigned size_valid:1;
@@ -120,11 +122,11 @@ struct object_entry {
 	/*
 	 * pahole results on 64-bit linux (gcc and clang)
 	 *
-	 *   size: 80, bit_padding: 9 bits
+	 *   size: 88, bit_padding: 9 bits
 	 *
 	 * and on 32-bit (gcc)
 	 *
-	 *   size: 76, bit_padding: 9 bits
+	 *   size: 84, bit_padding: 9 bits
 	 */
 };
 
@@ -139,6 +141,16 @@ struct packing_data {
 	unsigned int *in_pack_pos;
 	unsigned long *delta_size;
 
+	/*
+	 * "Cold" fields of the objects, which the delta search does not
+	 * use.  After spill_cold_fields(), they are kept in cold_file,
+	 * mapped into memory, so that the kernel can write them out
+	 * rather than keep them in anonymous memory.
+	 */
+	off_t *in_pack_offset;
+	struct tempfile *cold_file;
+	size_t cold_size;
+
 	/*
 	 * Only one of these can be non-NULL and they have different
 	 * sizes. if in_pack_by_idx is allocated, oe_in_pack() returns
@@ -168,9 +180,20 @@ struct packing_data {
 	/* delta islands */
 	unsigned int *tree_depth;
 	unsigned char *layer;
+
+	/* modification times of the objects in a cruft pack */
+	uint32_t *cruft_mtime;
 };
 
 void prepare_packing_data(struct repository *r, struct packing_data *pdata);
+void clear_packing_data(struct packing_data *pdata);
+
+/*
+ * Keep the cold fields of pdata in a temporary file in the object
+ * directory.  Must be called before the first packlist_alloc().
+ * Returns -1, leaving them in memory, if this is not possible.
+ */
+int spill_cold_fields(struct packing_data *pdata);
 
 /* Protect access to object database */
 static inline void packing_data_lock(struct packing_data *pdata)
@@ -236,6 +259,19 @@ static inline void oe_set_in_pack_pos(const struct packing_data *pack,
 	pack->in_pack_pos[e - pack->objects] = pos;
 }
 
+static inline off_t oe_in_pack_offset(const struct packing_data *pack,
+				      const struct object_entry *e)
+{
+	return pack->in_pack_offset[e - pack->objects];
+}
+
+static inline void oe_set_in_pack_offset(struct packing_data *pack,
+					 const struct object_entry *e,
+					 off_t offset)
+{
+	pack->in_pack_offset[e - pack->objects] = offset;
+}
+
 static inline struct packed_git *oe_in_pack(const struct packing_data *pack,
 					    const struct object_entry *e)
 {
@@ -289,4 +325,21 @@ static inline void oe_set_layer(struct packing_data *pack,
 	pack->layer[e - pack->objects] = layer;
 }
 
+static inline uint32_t oe_cruft_mtime(struct packing_data *pack,
+				      struct object_entry *e)
+{
+	if (!pack->cruft_mtime)
+		return 0;
+	return pack->cruft_mtime[e - pack->objects];
+}
+
+static inline void oe_set_cruft_mtime(struct packing_data *pack,
+				      struct object_entry *e,
+				      uint32_t mtime)
+{
+	if (!pack->cruft_mtime)
+		CALLOC_ARRAY(pack->cruft_mtime, pack->nr_alloc);
+	pack->cruft_mtime[e - pack->objects] = mtime;
+}
+
 #endif
@@ -0,0 +1,90 @@
+#include "cache.h"
+#include "pack-oidset.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "midx.h"
+#include "ewah/ewok.h"
+
+void pack_oidset_init(struct pack_oidset *set, struct repository *r)
+{
+	struct packed_git *p;
+	uint32_t nr = 0;
+
+	memset(set, 0, sizeof(*set));
+	oidset_init(&set->other, 0);
+
+	set->midx = get_multi_pack_index(r);
+	if (set->midx) {
+		nr = set->midx->num_objects;
+	} else {
+		for (p = get_all_packs(r); p; p = p->next) {
+			if (set->pack || open_pack_index(p)) {
+				set->pack = NULL;
+				return;
+			}
+			set->pack = p;
+		}
+		if (!set->pack)
+			return;
+		nr = set->pack->num_objects;
+	}
+	set->bits = bitmap_word_alloc(DIV_ROUND_UP(nr, BITS_IN_EWORD));
+}
+
+/*
+ * Find the position of an object in the key space of the bits, or
+ * return 0 if it is not in there.
+ */
+static int find_pos(struct pack_oidset *set, const struct object_id *oid,
+		    uint32_t *pos)
+{
+	if (set->midx)
+		return bsearch_midx(oid, set->midx, pos);
+	if (set->pack)
+		return bsearch_pack(oid, set->pack, pos);
+	return 0;
+}
+
+static int insert_pos(struct pack_oidset *set, uint32_t pos)
+{
+	if (bitmap_get(set->bits, pos))
+		return 1;
+	bitmap_set(set->bits, pos);
+	return 0;
+}
+
+int pack_oidset_insert(struct pack_oidset *set, const struct object_id *oid)
+{
+	uint32_t pos;
+
+	if (find_pos(set, oid, &pos))
+		return insert_pos(set, pos);
+	return oidset_insert(&set->other, oid);
+}
+
+int pack_oidset_insert_packed(struct pack_oidset *set,
+			      const struct object_id *oid,
+			      struct packed_git *p, uint32_t pos)
+{
+	if (set->pack && p == set->pack)
+		return insert_pos(set, pos);
+	return pack_oidset_insert(set, oid);
+}
+
+int pack_oidset_contains(struct pack_oidset *set, const struct object_id *oid)
+{
+	uint32_t pos;
+
+	if (find_pos(set, oid, &pos))
+		return bitmap_get(set->bits, pos);
+	return oidset_contains(&set->other, oid);
+}
+
+void pack_oidset_clear(struct pack_oidset *set)
+{
+	bitmap_free(set->bits);
+	set->bits = NULL;
+	set->pack = NULL;
+	set->midx = NULL;
+	oidset_clear(&set->other);
+}
@@ -0,0 +1,61 @@
+#ifndef PACK_OIDSET_H
+#define PACK_OIDSET_H
+
+#include "oidset.h"
+
+struct repository;
+struct packed_git;
+struct multi_pack_index;
+struct bitmap;
+
+/**
+ * A set of object ids for walks that may visit every object of a
+ * repository, like an oidset, but which stores the objects that are in
+ * the multi-pack-index of the repository, or in its only pack when it
+ * has no multi-pack-index, as one bit per object at their position in
+ * there.  Other objects go to an oidset.
+ *
+ * This needs far less memory than an oidset for large sets, and when
+ * the caller already knows the pack position of an object, as the
+ * callbacks of for_each_packed_object() do, no lookup at all.
+ */
+struct pack_oidset {
+	struct packed_git *pack;
+	struct multi_pack_index *midx;
+	struct bitmap *bits;
+	struct oidset other;
+};
+
+#define PACK_OIDSET_INIT { NULL, NULL, NULL, OIDSET_INIT }
+
+/**
+ * Initialize the set for the objects of the repository `r`.  The set
+ * must not be used after the packs of `r` have been reprepared.
+ */
+void pack_oidset_init(struct pack_oidset *set, struct repository *r);
+
+/**
+ * Insert the oid into the set.  Returns 1 if the oid was already in the
+ * set, 0 otherwise, like oidset_insert().
+ */
+int pack_oidset_insert(struct pack_oidset *set, const struct object_id *oid);
+
+/**
+ * Like pack_oidset_insert(), for an object the caller found at index
+ * position `pos` of pack `p`.
+ */
+int pack_oidset_insert_packed(struct pack_oidset *set,
+			      const struct object_id *oid,
+			      struct packed_git *p, uint32_t pos);
+
+/**
+ * Returns true iff `set` contains `oid`.
+ */
+int pack_oidset_contains(struct pack_oidset *set, const struct object_id *oid);
+
+/**
+ * Empty the set and release its memory.
+ */
+void pack_oidset_clear(struct pack_oidset *set);
+
+#endif /* PACK_OIDSET_H */
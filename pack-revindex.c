@@ -4,6 +4,7 @@
 #include "packfile.h"
 #include "config.h"
 #include "midx.h"
+#include "pack.h"
 
 struct revindex_entry {
 	off_t offset;
@@ -166,6 +167,63 @@ static void create_pack_revindex(struct packed_git *p)
 	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
+static char *pack_revindex_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
+}
+
+static int share_reverse_index = -1;
+
+/*
+ * Write the reverse index we just computed next to the pack, so that
+ * other processes, including those in other worktrees of the
+ * repository, map the same file instead of computing their own.
+ * This is best effort: a repository we cannot write to simply keeps
+ * computing it in memory.
+ */
+static void share_pack_revindex(struct packed_git *p)
+{
+	const unsigned char *pack_hash;
+	struct strbuf dir = STRBUF_INIT;
+	uint32_t *pack_order;
+	const char *tmp_name;
+	char *rev_name;
+	uint32_t i;
+
+	if (share_reverse_index < 0 &&
+	    git_config_get_bool("pack.sharereverseindex", &share_reverse_index))
+		share_reverse_index = 0;
+	if (!share_reverse_index || !p->pack_local)
+		return;
+
+	strbuf_addstr(&dir, p->pack_name);
+	strbuf_setlen(&dir, find_last_dir_sep(dir.buf) - dir.buf);
+	if (access(dir.buf, W_OK)) {
+		strbuf_release(&dir);
+		return;
+	}
+	strbuf_release(&dir);
+
+	ALLOC_ARRAY(pack_order, p->num_objects);
+	for (i = 0; i < p->num_objects; i++)
+		pack_order[i] = p->revindex[i].nr;
+
+	/* the .idx trailer records the checksum of its pack */
+	pack_hash = (const unsigned char *)p->index_data + p->index_size -
+		2 * the_hash_algo->rawsz;
+	tmp_name = write_rev_file_order(NULL, pack_order, p->num_objects,
+					pack_hash, WRITE_REV);
+	rev_name = pack_revindex_filename(p);
+	finalize_object_file(tmp_name, rev_name);
+
+	free(rev_name);
+	free((char *)tmp_name);
+	free(pack_order);
+}
+
 static int create_pack_revindex_in_memory(struct packed_git *p)
 {
 	if (git_env_bool(GIT_TEST_REV_INDEX_DIE_IN_MEMORY, 0))
@@ -174,17 +232,10 @@ static int create_pack_revindex_in_memory(struct packed_git *p)
 	if (open_pack_index(p))
 		return -1;
 	create_pack_revindex(p);
+	share_pack_revindex(p);
 	return 0;
 }
 
-static char *pack_revindex_filename(struct packed_git *p)
-{
-	size_t len;
-	if (!strip_suffix(p->pack_name, ".pack", &len))
-		BUG("pack_name does not end in .pack");
-	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
-}
-
 #define RIDX_HEADER_SIZE (12)
 #define RIDX_MIN_SIZE (RIDX_HEADER_SIZE + (2 * the_hash_algo->rawsz))
 
@@ -2,6 +2,7 @@
 #include "pack.h"
 #include "csum-file.h"
 #include "remote.h"
+#include "pack-mtimes.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -81,6 +82,7 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 		}
 		f = hashfd(fd, index_name);
 	}
+	hashfile_write_in_background(f);
 
 	/* if last object's offset is >= 2^31 we should use index V2 */
 	index_version = need_large_offset(last_obj_offset, opts) ? 2 : opts->version;
@@ -288,6 +290,42 @@ const char *write_rev_file_order(const char *rev_name,
 	return rev_name;
 }
 
+const char *write_mtimes_file(const char *mtimes_name,
+			      const uint32_t *mtimes,
+			      uint32_t nr_objects,
+			      const unsigned char *hash)
+{
+	struct hashfile *f;
+	uint32_t i;
+	int fd;
+
+	if (!mtimes_name) {
+		struct strbuf tmp_file = STRBUF_INIT;
+		fd = odb_mkstemp(&tmp_file, "pack/tmp_mtimes_XXXXXX");
+		mtimes_name = strbuf_detach(&tmp_file, NULL);
+	} else {
+		unlink(mtimes_name);
+		fd = open(mtimes_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+		if (fd < 0)
+			die_errno("unable to create '%s'", mtimes_name);
+	}
+	f = hashfd(fd, mtimes_name);
+
+	hashwrite_be32(f, MTIMES_SIGNATURE);
+	hashwrite_be32(f, MTIMES_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(the_hash_algo) == GIT_HASH_SHA256 ? 2 : 1);
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, mtimes[i]);
+	hashwrite(f, hash, the_hash_algo->rawsz);
+
+	if (adjust_shared_perm(mtimes_name) < 0)
+		die(_("failed to make %s readable"), mtimes_name);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	return mtimes_name;
+}
+
 off_t write_pack_header(struct hashfile *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
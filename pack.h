@@ -78,13 +78,17 @@ struct pack_idx_entry {
 
 
 struct progress;
-/* Note, the data argument could be NULL if object type is blob */
+/*
+ * Note, the data argument could be NULL if object type is blob.  When
+ * verify_pack() is asked to use more than one thread, the function is
+ * called from all of them at once.
+ */
 typedef int (*verify_fn)(const struct object_id *, enum object_type, unsigned long, void*, int*);
 
 const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
 int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 int verify_pack_index(struct packed_git *);
-int verify_pack(struct repository *, struct packed_git *, verify_fn fn, struct progress *, uint32_t);
+int verify_pack(struct repository *, struct packed_git *, verify_fn fn, struct progress *, uint32_t, int nr_threads);
 off_t write_pack_header(struct hashfile *f, uint32_t);
 void fixup_pack_header_footer(int, unsigned char *, const char *, uint32_t, unsigned char *, off_t);
 char *index_pack_lockfile(int fd, int *is_well_formed);
@@ -96,6 +100,12 @@ void write_promisor_file(const char *promisor_name, struct ref **sought, int nr_
 const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *hash, unsigned flags);
 const char *write_rev_file_order(const char *rev_name, uint32_t *pack_order, uint32_t nr_objects, const unsigned char *hash, unsigned flags);
 
+/*
+ * Write the .mtimes file of a cruft pack; "mtimes" has one entry per
+ * object, in the order of its .idx file.
+ */
+const char *write_mtimes_file(const char *mtimes_name, const uint32_t *mtimes, uint32_t nr_objects, const unsigned char *hash);
+
 /*
  * The "hdr" output buffer should be at least this big, which will handle sizes
  * up to 2^67.
@@ -17,6 +17,7 @@
 #include "midx.h"
 #include "commit-graph.h"
 #include "promisor-remote.h"
+#include "json-writer.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *hash,
@@ -333,12 +334,22 @@ void close_pack_revindex(struct packed_git *p) {
 	p->revindex_data = NULL;
 }
 
+static void close_pack_mtimes(struct packed_git *p)
+{
+	if (!p->mtimes_map)
+		return;
+
+	munmap((void *)p->mtimes_map, p->mtimes_size);
+	p->mtimes_map = NULL;
+}
+
 void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
 	close_pack_index(p);
 	close_pack_revindex(p);
+	close_pack_mtimes(p);
 }
 
 void close_object_store(struct raw_object_store *o)
@@ -361,7 +372,7 @@ void close_object_store(struct raw_object_store *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".pack", ".idx", ".rev", ".keep", ".bitmap", ".promisor"};
+	static const char *exts[] = {".pack", ".idx", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -605,6 +616,40 @@ static int in_window(struct pack_window *win, off_t offset)
 		&& (offset + the_hash_algo->rawsz) <= (win_off + win->len);
 }
 
+static int map_whole_pack(struct packed_git *p)
+{
+#ifdef NO_MMAP
+	return 0;
+#else
+	return packed_git_map_whole && (uintmax_t)p->pack_size <= SIZE_MAX;
+#endif
+}
+
+static void advise_pack_window(struct packed_git *p, struct pack_window *win)
+{
+	if (win->offset || win->len != p->pack_size)
+		return;
+#if defined(MADV_RANDOM) && defined(MADV_SEQUENTIAL)
+	madvise(win->base, win->len,
+		p->sequential_access ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+#ifdef MADV_HUGEPAGE
+	/* only honored by kernels that can back files with huge pages */
+	madvise(win->base, win->len, MADV_HUGEPAGE);
+#endif
+}
+
+void pack_advise_sequential(struct packed_git *p, int sequential)
+{
+	struct pack_window *win;
+
+	p->sequential_access = !!sequential;
+	if (!packed_git_map_whole)
+		return;
+	for (win = p->windows; win; win = win->next)
+		advise_pack_window(p, win);
+}
+
 unsigned char *use_pack(struct packed_git *p,
 		struct pack_window **w_cursor,
 		off_t offset,
@@ -633,19 +678,29 @@ unsigned char *use_pack(struct packed_git *p,
 		}
 		if (!win) {
 			size_t window_align = packed_git_window_size / 2;
+			int whole = map_whole_pack(p);
 			off_t len;
 
 			if (p->pack_fd == -1 && open_packed_git(p))
 				die("packfile %s cannot be accessed", p->pack_name);
 
 			CALLOC_ARRAY(win, 1);
-			win->offset = (offset / window_align) * window_align;
-			len = p->pack_size - win->offset;
-			if (len > packed_git_window_size)
-				len = packed_git_window_size;
+			if (whole) {
+				/*
+				 * The one window covers the whole pack and
+				 * is never unmapped to make room for others.
+				 */
+				win->offset = 0;
+				len = p->pack_size;
+			} else {
+				win->offset = (offset / window_align) * window_align;
+				len = p->pack_size - win->offset;
+				if (len > packed_git_window_size)
+					len = packed_git_window_size;
+			}
 			win->len = (size_t)len;
 			pack_mapped += win->len;
-			while (packed_git_limit < pack_mapped
+			while (!whole && packed_git_limit < pack_mapped
 				&& unuse_one_window(p))
 				; /* nothing */
 			win->base = xmmap_gently(NULL, win->len,
@@ -654,6 +709,8 @@ unsigned char *use_pack(struct packed_git *p,
 			if (win->base == MAP_FAILED)
 				die_errno(_("packfile %s cannot be mapped%s"),
 					  p->pack_name, mmap_os_err());
+			if (whole)
+				advise_pack_window(p, win);
 			if (!win->offset && win->len == p->pack_size
 				&& !p->do_not_close)
 				close_pack_fd(p);
@@ -716,6 +773,10 @@ struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_promisor = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -857,7 +918,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!report_garbage)
 		return;
 
-	if (!strcmp(file_name, "multi-pack-index"))
+	if (!strcmp(file_name, "multi-pack-index") ||
+	    !strcmp(file_name, "multi-pack-index.d"))
 		return;
 	if (starts_with(file_name, "multi-pack-index") &&
 	    ends_with(file_name, ".rev"))
@@ -867,7 +929,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	    ends_with(file_name, ".pack") ||
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
-	    ends_with(file_name, ".promisor"))
+	    ends_with(file_name, ".promisor") ||
+	    ends_with(file_name, ".mtimes"))
 		string_list_append(data->garbage, full_name);
 	else
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
@@ -1004,9 +1067,11 @@ void reprepare_packed_git(struct repository *r)
 
 	obj_read_lock();
 	for (odb = r->objects->odb; odb; odb = odb->next)
-		odb_clear_loose_cache(odb);
+		odb_refresh_loose_cache(odb);
 
 	r->objects->approximate_object_count_valid = 0;
+	kh_destroy_oid_pos(r->objects->abbrev_cache);
+	r->objects->abbrev_cache = NULL;
 	r->objects->packed_git_initialized = 0;
 	prepare_packed_git(r);
 	obj_read_unlock();
@@ -1354,6 +1419,32 @@ static size_t delta_base_cached;
 
 static LIST_HEAD(delta_base_cache_lru);
 
+/*
+ * Counters for the delta base cache; like the cache itself they are only
+ * touched while holding the obj_read_mutex (when it is in use).
+ */
+static int delta_base_cache_atexit_registered;
+static intmax_t delta_base_cache_hits;
+static intmax_t delta_base_cache_misses;
+static intmax_t delta_base_cache_evictions;
+static size_t delta_base_cache_peak;
+
+static void trace2_delta_base_cache_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "hits", delta_base_cache_hits);
+	jw_object_intmax(&jw, "misses", delta_base_cache_misses);
+	jw_object_intmax(&jw, "evictions", delta_base_cache_evictions);
+	jw_object_intmax(&jw, "peak_bytes", delta_base_cache_peak);
+	jw_end(&jw);
+
+	trace2_data_json("delta_base_cache", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
 struct delta_base_cache_key {
 	struct packed_git *p;
 	off_t base_offset;
@@ -1431,6 +1522,8 @@ static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
 	list_del(&ent->lru);
 	delta_base_cached -= ent->size;
+	trace2_memory_add(TRACE2_MEMORY_ID_DELTA_BASE_CACHE,
+			  -(intmax_t)ent->size);
 	free(ent);
 }
 
@@ -1444,6 +1537,8 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
 
+	delta_base_cache_hits++;
+
 	if (type)
 		*type = ent->type;
 	if (base_size)
@@ -1484,6 +1579,7 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	}
 
 	delta_base_cached += base_size;
+	trace2_memory_add(TRACE2_MEMORY_ID_DELTA_BASE_CACHE, base_size);
 
 	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
 		struct delta_base_cache_entry *f =
@@ -1491,7 +1587,10 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 		if (delta_base_cached <= delta_base_cache_limit)
 			break;
 		release_delta_base_cache(f);
+		delta_base_cache_evictions++;
 	}
+	if (delta_base_cached > delta_base_cache_peak)
+		delta_base_cache_peak = delta_base_cached;
 
 	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
@@ -1608,6 +1707,23 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	if (HAVE_INFLATE_BUFFER) {
+		unsigned long avail;
+		int ret;
+
+		/*
+		 * Usually the whole stream is in this window; if not, or
+		 * if anything else goes wrong, take the slow path below.
+		 */
+		in = use_pack(p, w_curs, curpos, &avail);
+		obj_read_unlock();
+		ret = git_inflate_buffer(buffer, size, in, avail);
+		obj_read_lock();
+		if (!ret)
+			return buffer;
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1686,7 +1802,13 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
 
+	if (trace2_is_enabled() && !delta_base_cache_atexit_registered) {
+		atexit(trace2_delta_base_cache_statistics_atexit);
+		delta_base_cache_atexit_registered = 1;
+	}
+
 	write_pack_access_log(p, obj_offset);
+	trace2_timer_start(TRACE2_TIMER_ID_UNPACK_ENTRY);
 
 	/* PHASE 1: drill down to the innermost base object */
 	for (;;) {
@@ -1701,8 +1823,10 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			size = ent->size;
 			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
+			delta_base_cache_hits++;
 			break;
 		}
+		delta_base_cache_misses++;
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			uint32_t pack_pos, index_pos;
@@ -1833,8 +1957,16 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Neither `base` nor `delta_data` is reachable from
+			 * the delta base cache at this point, so other threads
+			 * may safely use the object store (and resolve their
+			 * own delta chains) while we apply the delta.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -1875,6 +2007,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	if (delta_stack != small_delta_stack)
 		free(delta_stack);
 
+	trace2_timer_stop(TRACE2_TIMER_ID_UNPACK_ENTRY);
 	return data;
 }
 
@@ -94,6 +94,13 @@ void close_pack_revindex(struct packed_git *);
 void close_pack(struct packed_git *);
 void close_object_store(struct raw_object_store *o);
 void unuse_pack(struct pack_window **);
+
+/*
+ * Tell the kernel whether the pack is about to be read from start to
+ * end rather than at random.  Only packs that core.packedGitMapWhole
+ * maps in one piece are affected.
+ */
+void pack_advise_sequential(struct packed_git *p, int sequential);
 void clear_delta_base_cache(void);
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
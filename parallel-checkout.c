@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "entry.h"
+#include "object-store.h"
 #include "parallel-checkout.h"
 #include "pkt-line.h"
 #include "progress.h"
@@ -12,7 +13,12 @@
 
 struct pc_worker {
 	struct child_process cp;
-	size_t next_item_to_complete, nr_items_to_complete;
+	/*
+	 * The worker was sent the items in [first_item, first_item + nr_items).
+	 * It reports them in that order, except for the ones it had to wait
+	 * for a delaying filter on, which come last.
+	 */
+	size_t first_item, nr_items, nr_items_to_complete;
 };
 
 struct parallel_checkout {
@@ -79,6 +85,7 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 					     const struct conv_attrs *ca)
 {
 	enum conv_attrs_classification c;
+	const char *driver;
 	size_t packed_item_size;
 
 	/*
@@ -90,8 +97,10 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 	if (!S_ISREG(ce->ce_mode))
 		return 0;
 
+	driver = convert_driver_name(ca);
 	packed_item_size = sizeof(struct pc_item_fixed_portion) + ce->ce_namelen +
-		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0);
+		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0) +
+		(driver ? strlen(driver) : 0);
 
 	/*
 	 * The amount of data we send to the workers per checkout item is
@@ -112,28 +121,21 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 		 * It would be safe to allow concurrent instances of
 		 * single-file smudge filters, like rot13, but we should not
 		 * assume that all filters are parallel-process safe. So we
-		 * don't allow this.
+		 * only allow this for the ones configured as such.
 		 */
-		return 0;
+		return convert_driver_is_parallel(ca);
 
 	case CA_CLASS_INCORE_PROCESS:
 		/*
-		 * The parallel queue and the delayed queue are not compatible,
-		 * so they must be kept completely separated. And we can't tell
-		 * if a long-running process will delay its response without
-		 * actually asking it to perform the filtering. Therefore, this
-		 * type of filter is not allowed in parallel checkout.
-		 *
-		 * Furthermore, there should only be one instance of the
-		 * long-running process filter as we don't know how it is
-		 * managing its own concurrency. So, spreading the entries that
-		 * requisite such a filter among the parallel workers would
-		 * require a lot more inter-process communication. We would
-		 * probably have to designate a single process to interact with
-		 * the filter and send all the necessary data to it, for each
-		 * entry.
+		 * Likewise, we don't know how a long-running process filter
+		 * manages its own concurrency, so by default there is a single
+		 * instance of it, in the main process. A filter configured as
+		 * parallel-safe is instead started by each worker that needs
+		 * it, and the worker waits for the entries the filter delays
+		 * itself, before reporting them back. The delayed queue of the
+		 * main process only sees the entries it writes on its own.
 		 */
-		return 0;
+		return convert_driver_is_parallel(ca);
 
 	case CA_CLASS_STREAMABLE:
 		return 1;
@@ -202,6 +204,9 @@ static int handle_results(struct checkout *state)
 		case PC_ITEM_WRITTEN:
 			/* Already handled */
 			break;
+		case PC_ITEM_DELAYED:
+			/* Left for finish_delayed_checkout() */
+			break;
 		case PC_ITEM_COLLIDED:
 			/*
 			 * The entry could not be checked out due to a path
@@ -254,12 +259,18 @@ static int reset_fd(int fd, const char *path)
 	return 0;
 }
 
+/*
+ * Returns 0 on success, -1 on error and 1 if the filter of the entry
+ * delayed it, in which case nothing was written.
+ */
 static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
-			       const char *path)
+			       const char *path, struct checkout *state)
 {
 	int ret;
 	struct stream_filter *filter;
 	struct strbuf buf = STRBUF_INIT;
+	struct delayed_checkout *dco = state->delayed_checkout;
+	struct checkout_metadata meta;
 	char *blob;
 	unsigned long size;
 	ssize_t wrote;
@@ -278,19 +289,36 @@ static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
 		}
 	}
 
-	blob = read_blob_entry(pc_item->ce, &size);
-	if (!blob)
-		return error("cannot read object %s '%s'",
-			     oid_to_hex(&pc_item->ce->oid), pc_item->ce->name);
-
 	/*
-	 * checkout metadata is used to give context for external process
-	 * filters. Files requiring such filters are not eligible for parallel
-	 * checkout, so pass NULL. Note: if that changes, the metadata must also
-	 * be passed from the main process to the workers.
+	 * We do not send the blob in case of a retry, so do not bother
+	 * reading it at all.
 	 */
-	ret = convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name,
-					 blob, size, &buf, NULL);
+	if (dco && dco->state == CE_RETRY) {
+		blob = NULL;
+		size = 0;
+	} else {
+		blob = read_blob_entry(pc_item->ce, &size);
+		if (!blob)
+			return error("cannot read object %s '%s'",
+				     oid_to_hex(&pc_item->ce->oid),
+				     pc_item->ce->name);
+	}
+
+	clone_checkout_metadata(&meta, &state->meta, &pc_item->ce->oid);
+	if (dco && dco->state != CE_NO_DELAY) {
+		ret = async_convert_to_working_tree_ca(&pc_item->ca,
+						       pc_item->ce->name,
+						       blob, size, &buf,
+						       &meta, dco);
+		if (ret && string_list_has_string(&dco->paths,
+						  pc_item->ce->name)) {
+			free(blob);
+			return 1;
+		}
+	} else {
+		ret = convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name,
+						 blob, size, &buf, &meta);
+	}
 
 	if (ret) {
 		size_t newsize;
@@ -319,11 +347,15 @@ static int close_and_clear(int *fd)
 	return ret;
 }
 
-void write_pc_item(struct parallel_checkout_item *pc_item,
-		   struct checkout *state)
+/*
+ * Write the item, checking its leading directories through "cache" if
+ * given (a thread must use its own), or the lstat() cache otherwise.
+ */
+static void write_pc_item_1(struct parallel_checkout_item *pc_item,
+			    struct checkout *state, struct cache_def *cache)
 {
 	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
-	int fd = -1, fstat_done = 0;
+	int fd = -1, fstat_done = 0, ret;
 	struct strbuf path = STRBUF_INIT;
 	const char *dir_sep;
 
@@ -338,8 +370,12 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	 * a symlink (checked out after we enqueued this entry for parallel
 	 * checkout). Thus, we must check the leading dirs again.
 	 */
-	if (dir_sep && !has_dirs_only_path(path.buf, dir_sep - path.buf,
-					   state->base_dir_len)) {
+	if (dir_sep &&
+	    !(cache ? threaded_has_dirs_only_path(cache, path.buf,
+						  dir_sep - path.buf,
+						  state->base_dir_len) :
+		      has_dirs_only_path(path.buf, dir_sep - path.buf,
+					 state->base_dir_len))) {
 		pc_item->status = PC_ITEM_COLLIDED;
 		trace2_data_string("pcheckout", NULL, "collision/dirname", path.buf);
 		goto out;
@@ -366,9 +402,10 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 		goto out;
 	}
 
-	if (write_pc_item_to_fd(pc_item, fd, path.buf)) {
+	ret = write_pc_item_to_fd(pc_item, fd, path.buf, state);
+	if (ret) {
 		/* Error was already reported. */
-		pc_item->status = PC_ITEM_FAILED;
+		pc_item->status = ret > 0 ? PC_ITEM_DELAYED : PC_ITEM_FAILED;
 		close_and_clear(&fd);
 		unlink(path.buf);
 		goto out;
@@ -394,22 +431,30 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	strbuf_release(&path);
 }
 
+void write_pc_item(struct parallel_checkout_item *pc_item,
+		   struct checkout *state)
+{
+	write_pc_item_1(pc_item, state, NULL);
+}
+
 static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 {
 	size_t len_data;
 	char *data, *variant;
 	struct pc_item_fixed_portion *fixed_portion;
 	const char *working_tree_encoding = pc_item->ca.working_tree_encoding;
+	const char *driver = convert_driver_name(&pc_item->ca);
 	size_t name_len = pc_item->ce->ce_namelen;
 	size_t working_tree_encoding_len = working_tree_encoding ?
 					   strlen(working_tree_encoding) : 0;
+	size_t driver_len = driver ? strlen(driver) : 0;
 
 	/*
 	 * Any changes in the calculation of the message size must also be made
 	 * in is_eligible_for_parallel_checkout().
 	 */
 	len_data = sizeof(struct pc_item_fixed_portion) + name_len +
-		   working_tree_encoding_len;
+		   working_tree_encoding_len + driver_len;
 
 	data = xmalloc(len_data);
 
@@ -420,6 +465,7 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 	fixed_portion->ident = pc_item->ca.ident;
 	fixed_portion->name_len = name_len;
 	fixed_portion->working_tree_encoding_len = working_tree_encoding_len;
+	fixed_portion->driver_len = driver_len;
 	/*
 	 * We pad the unused bytes in the hash array because, otherwise,
 	 * Valgrind would complain about passing uninitialized bytes to a
@@ -433,6 +479,10 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 		memcpy(variant, working_tree_encoding, working_tree_encoding_len);
 		variant += working_tree_encoding_len;
 	}
+	if (driver_len) {
+		memcpy(variant, driver, driver_len);
+		variant += driver_len;
+	}
 	memcpy(variant, pc_item->ce->name, name_len);
 
 	packet_write(fd, data, len_data);
@@ -469,6 +519,15 @@ static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
 		strvec_push(&cp->args, "checkout--worker");
 		if (state->base_dir_len)
 			strvec_pushf(&cp->args, "--prefix=%s", state->base_dir);
+		/* for the process filters the workers may run */
+		if (state->delayed_checkout)
+			strvec_push(&cp->args, "--delay");
+		if (state->meta.refname)
+			strvec_pushf(&cp->args, "--refname=%s",
+				     state->meta.refname);
+		if (!is_null_oid(&state->meta.treeish))
+			strvec_pushf(&cp->args, "--treeish=%s",
+				     oid_to_hex(&state->meta.treeish));
 		if (start_command(cp))
 			die("failed to spawn checkout worker");
 	}
@@ -485,7 +544,8 @@ static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
 			batch_size++;
 
 		send_batch(worker->cp.in, batch_beginning, batch_size);
-		worker->next_item_to_complete = batch_beginning;
+		worker->first_item = batch_beginning;
+		worker->nr_items = batch_size;
 		worker->nr_items_to_complete = batch_size;
 
 		batch_beginning += batch_size;
@@ -545,6 +605,10 @@ static void parse_and_save_result(const char *buffer, int len,
 
 	res = (struct pc_item_result *)buffer;
 
+	if (res->status == PC_ITEM_PENDING || res->status == PC_ITEM_DELAYED)
+		BUG("unexpected item status from checkout worker: %d",
+		    res->status);
+
 	/*
 	 * Worker should send either the full result struct on success, or
 	 * just the base (i.e. no stat data), otherwise.
@@ -558,11 +622,13 @@ static void parse_and_save_result(const char *buffer, int len,
 
 	if (!worker->nr_items_to_complete)
 		BUG("received result from supposedly finished checkout worker");
-	if (res->id != worker->next_item_to_complete)
-		BUG("unexpected item id from checkout worker (got %"PRIuMAX", exp %"PRIuMAX")",
-		    (uintmax_t)res->id, (uintmax_t)worker->next_item_to_complete);
+	if (res->id < worker->first_item ||
+	    res->id - worker->first_item >= worker->nr_items ||
+	    parallel_checkout.items[res->id].status != PC_ITEM_PENDING)
+		BUG("unexpected item id from checkout worker (got %"PRIuMAX", exp %"PRIuMAX"..%"PRIuMAX")",
+		    (uintmax_t)res->id, (uintmax_t)worker->first_item,
+		    (uintmax_t)(worker->first_item + worker->nr_items - 1));
 
-	worker->next_item_to_complete++;
 	worker->nr_items_to_complete--;
 
 	pc_item = &parallel_checkout.items[res->id];
@@ -642,6 +708,102 @@ static void write_items_sequentially(struct checkout *state)
 	}
 }
 
+#ifndef NO_PTHREADS
+struct pc_threads {
+	struct checkout *state;
+	pthread_mutex_t mutex; /* protects next_item and the progress meter */
+	size_t next_item;
+};
+
+static void *checkout_thread(void *data)
+{
+	struct pc_threads *t = data;
+	struct cache_def cache = CACHE_DEF_INIT;
+
+	trace2_thread_start("checkout_worker");
+
+	for (;;) {
+		struct parallel_checkout_item *pc_item;
+
+		pthread_mutex_lock(&t->mutex);
+		if (t->next_item >= parallel_checkout.nr) {
+			pthread_mutex_unlock(&t->mutex);
+			break;
+		}
+		pc_item = &parallel_checkout.items[t->next_item++];
+		pthread_mutex_unlock(&t->mutex);
+
+		write_pc_item_1(pc_item, t->state, &cache);
+
+		if (pc_item->status != PC_ITEM_COLLIDED) {
+			pthread_mutex_lock(&t->mutex);
+			advance_progress_meter();
+			pthread_mutex_unlock(&t->mutex);
+		}
+	}
+
+	cache_def_clear(&cache);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Write the queue from threads of this process, which hand out the items
+ * one at a time and share its object store.
+ */
+static void write_items_in_threads(struct checkout *state, int num_threads)
+{
+	struct pc_threads t = { .state = state };
+	pthread_t *threads;
+	int i;
+
+	ALLOC_ARRAY(threads, num_threads);
+	pthread_mutex_init(&t.mutex, NULL);
+	enable_obj_read_lock();
+
+	for (i = 0; i < num_threads; i++)
+		if (pthread_create(&threads[i], NULL, checkout_thread, &t))
+			die(_("unable to create checkout thread"));
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&t.mutex);
+	free(threads);
+}
+#endif
+
+/*
+ * Whether to use threads rather than checkout--worker processes. The
+ * items using an external filter need processes: several threads
+ * would share the single instance of each process filter.
+ */
+static int use_worker_threads(void)
+{
+	int threads;
+	size_t i;
+
+	if (!HAVE_THREADS)
+		return 0;
+	threads = git_env_bool("GIT_TEST_CHECKOUT_WORKER_THREADS", -1);
+	if (threads < 0 &&
+	    git_config_get_bool("checkout.workerthreads", &threads))
+		threads = 0;
+	if (!threads)
+		return 0;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		switch (classify_conv_attrs(&parallel_checkout.items[i].ca)) {
+		case CA_CLASS_INCORE_FILTER:
+		case CA_CLASS_INCORE_PROCESS:
+			return 0;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+
 int run_parallel_checkout(struct checkout *state, int num_workers, int threshold,
 			  struct progress *progress, unsigned int *progress_cnt)
 {
@@ -659,6 +821,10 @@ int run_parallel_checkout(struct checkout *state, int num_workers, int threshold
 
 	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
 		write_items_sequentially(state);
+#ifndef NO_PTHREADS
+	} else if (use_worker_threads()) {
+		write_items_in_threads(state, num_workers);
+#endif
 	} else {
 		struct pc_worker *workers = setup_workers(state, num_workers);
 		gather_results_from_workers(workers, num_workers);
@@ -58,6 +58,12 @@ enum pc_item_status {
 	 */
 	PC_ITEM_COLLIDED,
 	PC_ITEM_FAILED,
+	/*
+	 * The entry's long-running process filter delayed it. In the main
+	 * process, it is left for finish_delayed_checkout(); workers wait
+	 * for the filter themselves and never report this status.
+	 */
+	PC_ITEM_DELAYED,
 };
 
 struct parallel_checkout_item {
@@ -76,9 +82,9 @@ struct parallel_checkout_item {
 
 /*
  * The fixed-size portion of `struct parallel_checkout_item` that is sent to the
- * workers. Following this will be 2 strings: ca.working_tree_encoding and
- * ce.name; These are NOT null terminated, since we have the size in the fixed
- * portion.
+ * workers. Following this will be 3 strings: ca.working_tree_encoding, the
+ * name of ca.drv and ce.name; These are NOT null terminated, since we have the
+ * size in the fixed portion.
  *
  * Note that not all fields of conv_attrs and cache_entry are passed, only the
  * ones that will be required by the workers to smudge and write the entry.
@@ -90,6 +96,7 @@ struct pc_item_fixed_portion {
 	enum convert_crlf_action crlf_action;
 	int ident;
 	size_t working_tree_encoding_len;
+	size_t driver_len;
 	size_t name_len;
 };
 
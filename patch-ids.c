@@ -3,6 +3,8 @@
 #include "commit.h"
 #include "hash-lookup.h"
 #include "patch-ids.h"
+#include "config.h"
+#include "notes-cache.h"
 
 static int patch_id_defined(struct commit *commit)
 {
@@ -25,6 +27,78 @@ int commit_patch_id(struct commit *commit, struct diff_options *options,
 	return diff_flush_patch_id(options, oid, diff_header_only, stable);
 }
 
+/*
+ * The cache maps a commit to a note with the hex of its header-only
+ * patch ID and, once it has been needed, that of its full patch ID
+ * on the same line.  It is not used when limited by a pathspec, as the
+ * patch IDs then depend on it.
+ */
+static int cacheable(struct patch_ids *ids)
+{
+	return ids->cache && !ids->diffopts.pathspec.nr;
+}
+
+static int cached_patch_id(struct commit *commit, struct patch_ids *ids,
+			   struct object_id *oid, int diff_header_only)
+{
+	struct object_id ids_in_note[2];
+	const char *p;
+	char *note;
+	size_t size;
+	int nr = 0, ret = -1;
+
+	if (!cacheable(ids) ||
+	    !(note = notes_cache_get(ids->cache, &commit->object.oid, &size)))
+		return -1;
+
+	p = note;
+	while (nr < 2 && !parse_oid_hex(p, &ids_in_note[nr], &p)) {
+		nr++;
+		if (*p++ != ' ')
+			break;
+	}
+
+	if (diff_header_only && nr >= 1) {
+		oidcpy(oid, &ids_in_note[0]);
+		ret = 0;
+	} else if (!diff_header_only && nr >= 2) {
+		oidcpy(oid, &ids_in_note[1]);
+		ret = 0;
+	}
+	free(note);
+	return ret;
+}
+
+static void cache_patch_id(struct commit *commit, struct patch_ids *ids,
+			   const struct object_id *header_only,
+			   const struct object_id *full)
+{
+	struct strbuf note = STRBUF_INIT;
+
+	if (!cacheable(ids))
+		return;
+	strbuf_addstr(&note, oid_to_hex(header_only));
+	if (full)
+		strbuf_addf(&note, " %s", oid_to_hex(full));
+	strbuf_addch(&note, '\n');
+	notes_cache_put(ids->cache, &commit->object.oid, note.buf, note.len);
+	strbuf_release(&note);
+}
+
+static int full_patch_id(struct commit *commit, struct patch_ids *ids,
+			 struct object_id *oid)
+{
+	struct object_id header_only;
+
+	if (!cached_patch_id(commit, ids, oid, 0))
+		return 0;
+	if (commit_patch_id(commit, &ids->diffopts, oid, 0, 0))
+		return -1;
+	if (!cached_patch_id(commit, ids, &header_only, 1))
+		cache_patch_id(commit, ids, &header_only, oid);
+	return 0;
+}
+
 /*
  * When we cannot load the full patch-id for both commits for whatever
  * reason, the function returns -1 (i.e. return error(...)). Despite
@@ -41,23 +115,49 @@ static int patch_id_neq(const void *cmpfn_data,
 			const void *unused_keydata)
 {
 	/* NEEDSWORK: const correctness? */
-	struct diff_options *opt = (void *)cmpfn_data;
+	struct patch_ids *ids = (void *)cmpfn_data;
 	struct patch_id *a, *b;
 
 	a = container_of(eptr, struct patch_id, ent);
 	b = container_of(entry_or_key, struct patch_id, ent);
 
 	if (is_null_oid(&a->patch_id) &&
-	    commit_patch_id(a->commit, opt, &a->patch_id, 0, 0))
+	    full_patch_id(a->commit, ids, &a->patch_id))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&a->commit->object.oid));
 	if (is_null_oid(&b->patch_id) &&
-	    commit_patch_id(b->commit, opt, &b->patch_id, 0, 0))
+	    full_patch_id(b->commit, ids, &b->patch_id))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&b->commit->object.oid));
 	return !oideq(&a->patch_id, &b->patch_id);
 }
 
+/*
+ * Patch IDs are always computed with the same diff algorithm and
+ * context, but the order of the files and the submodule changes that
+ * show up still depend on the configuration.
+ */
+static void init_patch_id_cache(struct repository *r, struct patch_ids *ids)
+{
+	struct strbuf validity = STRBUF_INIT;
+	int enabled = 0;
+
+	if (repo_config_get_bool(r, "diff.cachepatchids", &enabled) ||
+	    !enabled)
+		return;
+
+	strbuf_addf(&validity, "patch-id 1 submodules=%d%d%d",
+		    ids->diffopts.flags.ignore_submodules,
+		    ids->diffopts.flags.ignore_untracked_in_submodules,
+		    ids->diffopts.flags.ignore_dirty_submodules);
+	if (ids->diffopts.orderfile)
+		strbuf_addf(&validity, " order=%s", ids->diffopts.orderfile);
+
+	CALLOC_ARRAY(ids->cache, 1);
+	notes_cache_init(r, ids->cache, "patch-id", validity.buf);
+	strbuf_release(&validity);
+}
+
 int init_patch_ids(struct repository *r, struct patch_ids *ids)
 {
 	memset(ids, 0, sizeof(*ids));
@@ -65,13 +165,20 @@ int init_patch_ids(struct repository *r, struct patch_ids *ids)
 	ids->diffopts.detect_rename = 0;
 	ids->diffopts.flags.recursive = 1;
 	diff_setup_done(&ids->diffopts);
-	hashmap_init(&ids->patches, patch_id_neq, &ids->diffopts, 256);
+	hashmap_init(&ids->patches, patch_id_neq, ids, 256);
+	init_patch_id_cache(r, ids);
 	return 0;
 }
 
 int free_patch_ids(struct patch_ids *ids)
 {
 	hashmap_clear_and_free(&ids->patches, struct patch_id, ent);
+	if (ids->cache) {
+		notes_cache_write(ids->cache);
+		free_notes(&ids->cache->tree);
+		free(ids->cache->validity);
+		FREE_AND_NULL(ids->cache);
+	}
 	return 0;
 }
 
@@ -82,8 +189,12 @@ static int init_patch_id_entry(struct patch_id *patch,
 	struct object_id header_only_patch_id;
 
 	patch->commit = commit;
-	if (commit_patch_id(commit, &ids->diffopts, &header_only_patch_id, 1, 0))
-		return -1;
+	if (cached_patch_id(commit, ids, &header_only_patch_id, 1)) {
+		if (commit_patch_id(commit, &ids->diffopts,
+				    &header_only_patch_id, 1, 0))
+			return -1;
+		cache_patch_id(commit, ids, &header_only_patch_id, NULL);
+	}
 
 	hashmap_entry_init(&patch->ent, oidhash(&header_only_patch_id));
 	return 0;
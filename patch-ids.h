@@ -5,6 +5,7 @@
 #include "hashmap.h"
 
 struct commit;
+struct notes_cache;
 struct object_id;
 struct repository;
 
@@ -17,6 +18,9 @@ struct patch_id {
 struct patch_ids {
 	struct hashmap patches;
 	struct diff_options diffopts;
+
+	/* patch IDs remembered across runs, with diff.cachePatchIds */
+	struct notes_cache *cache;
 };
 
 int commit_patch_id(struct commit *commit, struct diff_options *options,
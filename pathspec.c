@@ -5,6 +5,7 @@
 #include "attr.h"
 #include "strvec.h"
 #include "quote.h"
+#include "hashmap.h"
 
 /*
  * Finds which of the given pathspecs match items in the index.
@@ -551,6 +552,223 @@ static void NORETURN unsupported_magic(const char *pattern,
 	    pattern, sb.buf);
 }
 
+/* Below this many items without wildcards, we just try them all */
+#define MIN_INDEXED_LITERALS 16
+
+struct literal_entry {
+	struct hashmap_entry ent;
+	const char *key;
+	int len;
+	int nr;
+};
+
+/*
+ * What we look for: the first "prefix" bytes of the items, which they
+ * all share, followed by "name" and, with "slash", a '/'.
+ */
+struct literal_key {
+	int prefix;
+	const char *name;
+	int len;
+	int slash;
+};
+
+struct pathspec_literals {
+	/* items without wildcards by their match ... */
+	struct hashmap matches;
+	/* ... and by each leading directory of it */
+	struct hashmap dirs;
+	struct literal_entry *entries;
+	/* the bytes all of them start with */
+	const char *base;
+	int base_len;
+	/* the other items */
+	int *others;
+	int others_nr;
+};
+
+static unsigned int hash_more(unsigned int hash, const char *buf, size_t len)
+{
+	while (len--)
+		hash = (hash * 0x01000193) ^ (unsigned char)*buf++;
+	return hash;
+}
+
+static int literal_entry_cmp(const void *unused_cmp_data,
+			     const struct hashmap_entry *eptr,
+			     const struct hashmap_entry *entry_or_key,
+			     const void *keydata)
+{
+	const struct literal_entry *e1, *e2;
+	const struct literal_key *key = keydata;
+
+	e1 = container_of(eptr, const struct literal_entry, ent);
+	if (!key) {
+		e2 = container_of(entry_or_key, const struct literal_entry, ent);
+		return e1->len != e2->len || memcmp(e1->key, e2->key, e1->len);
+	}
+	return e1->len != key->prefix + key->len + key->slash ||
+	       memcmp(e1->key + key->prefix, key->name, key->len) ||
+	       (key->slash && e1->key[e1->len - 1] != '/');
+}
+
+static int is_indexed_literal(const struct pathspec_item *item)
+{
+	return item->nowildcard_len == item->len && !item->attr_match_nr &&
+	       !(item->magic & (PATHSPEC_ICASE | PATHSPEC_EXCLUDE));
+}
+
+static void add_literal(struct hashmap *map, struct literal_entry *e,
+			const char *key, int len, int nr)
+{
+	e->key = key;
+	e->len = len;
+	e->nr = nr;
+	hashmap_entry_init(&e->ent, hash_more(0x811c9dc5, key, len));
+	hashmap_add(map, &e->ent);
+}
+
+static void index_pathspec_literals(struct pathspec *ps)
+{
+	struct pathspec_literals *literals;
+	int i, nr = 0, nr_entries = 0, base_len = -1;
+	const char *base = NULL;
+	struct literal_entry *e;
+
+	for (i = 0; i < ps->nr; i++) {
+		const struct pathspec_item *item = &ps->items[i];
+		int j;
+
+		if (!is_indexed_literal(item))
+			continue;
+		nr++;
+		nr_entries++;
+		for (j = 0; j < item->len; j++)
+			if (item->match[j] == '/')
+				nr_entries++;
+		if (!base) {
+			base = item->match;
+			base_len = item->len;
+		}
+		for (j = 0; j < base_len && base[j] == item->match[j]; j++)
+			; /* nothing */
+		base_len = j;
+	}
+	if (!nr || (nr < MIN_INDEXED_LITERALS &&
+		    !git_env_bool("GIT_TEST_PATHSPEC_LITERALS", 0)))
+		return;
+
+	CALLOC_ARRAY(literals, 1);
+	hashmap_init(&literals->matches, literal_entry_cmp, NULL, nr);
+	hashmap_init(&literals->dirs, literal_entry_cmp, NULL, nr);
+	ALLOC_ARRAY(literals->entries, nr_entries);
+	ALLOC_ARRAY(literals->others, ps->nr - nr);
+	literals->base = base;
+	literals->base_len = base_len;
+
+	e = literals->entries;
+	for (i = 0; i < ps->nr; i++) {
+		const struct pathspec_item *item = &ps->items[i];
+		int j;
+
+		if (!is_indexed_literal(item)) {
+			literals->others[literals->others_nr++] = i;
+			continue;
+		}
+		add_literal(&literals->matches, e++, item->match, item->len, i);
+		for (j = 0; j < item->len; j++)
+			if (item->match[j] == '/')
+				add_literal(&literals->dirs, e++, item->match, j, i);
+	}
+	ps->literals = literals;
+}
+
+static void clear_pathspec_literals(struct pathspec *ps)
+{
+	if (!ps->literals)
+		return;
+	hashmap_clear(&ps->literals->matches);
+	hashmap_clear(&ps->literals->dirs);
+	free(ps->literals->entries);
+	free(ps->literals->others);
+	FREE_AND_NULL(ps->literals);
+}
+
+static void call_for_literals(struct hashmap *map, unsigned int hash,
+			      struct literal_key *key,
+			      void (*fn)(int nr, void *data), void *data)
+{
+	struct literal_entry *e;
+
+	e = hashmap_get_entry_from_hash(map, hash, key,
+					struct literal_entry, ent);
+	for (; e; e = hashmap_get_next_entry(map, e, ent))
+		fn(e->nr, data);
+}
+
+int for_each_candidate_pathspec_item(const struct pathspec *ps,
+				     const char *name, int namelen,
+				     int prefix, int leading,
+				     void (*fn)(int nr, void *data),
+				     void *data)
+{
+	struct pathspec_literals *literals = ps->literals;
+	struct literal_key key = { prefix, name + prefix };
+	unsigned int hash;
+	int i;
+
+	if (!literals || prefix > literals->base_len ||
+	    prefix > namelen || (leading && prefix == namelen))
+		return -1;
+
+	for (i = 0; i < literals->others_nr; i++)
+		fn(literals->others[i], data);
+
+	/*
+	 * match_pathspec_item() does not look at the first "prefix"
+	 * bytes of "name"; neither do we.
+	 */
+	name += prefix;
+	namelen -= prefix;
+	hash = hash_more(0x811c9dc5, literals->base, prefix);
+
+	/*
+	 * The items that are the name or a leading directory of it,
+	 * with or without the slash.
+	 */
+	for (i = 0; i <= namelen; i++) {
+		if (!i || i == namelen ||
+		    name[i] == '/' || name[i - 1] == '/') {
+			key.len = i;
+			call_for_literals(&literals->matches, hash, &key,
+					  fn, data);
+		}
+		if (i < namelen)
+			hash = hash_more(hash, name + i, 1);
+	}
+
+	/* The name as a directory */
+	if (!namelen || name[namelen - 1] != '/') {
+		key.len = namelen;
+		key.slash = 1;
+		call_for_literals(&literals->matches, hash_more(hash, "/", 1),
+				  &key, fn, data);
+		key.slash = 0;
+	}
+
+	/* The items the name is a leading directory of */
+	if (leading) {
+		key.len = namelen;
+		if (name[namelen - 1] == '/') {
+			key.len--;
+			hash = hash_more(0x811c9dc5, literals->base, prefix);
+			hash = hash_more(hash, name, key.len);
+		}
+		call_for_literals(&literals->dirs, hash, &key, fn, data);
+	}
+	return 0;
+}
+
 void parse_pathspec(struct pathspec *pathspec,
 		    unsigned magic_mask, unsigned flags,
 		    const char *prefix, const char **argv)
@@ -637,6 +855,8 @@ void parse_pathspec(struct pathspec *pathspec,
 			BUG("PATHSPEC_MAXDEPTH_VALID and PATHSPEC_KEEP_ORDER are incompatible");
 		QSORT(pathspec->items, pathspec->nr, pathspec_item_cmp);
 	}
+
+	index_pathspec_literals(pathspec);
 }
 
 void parse_pathspec_file(struct pathspec *pathspec, unsigned magic_mask,
@@ -680,6 +900,7 @@ void copy_pathspec(struct pathspec *dst, const struct pathspec *src)
 	int i, j;
 
 	*dst = *src;
+	dst->literals = NULL;
 	ALLOC_ARRAY(dst->items, dst->nr);
 	COPY_ARRAY(dst->items, src->items, dst->nr);
 
@@ -699,6 +920,8 @@ void copy_pathspec(struct pathspec *dst, const struct pathspec *src)
 
 		d->attr_check = attr_check_dup(s->attr_check);
 	}
+
+	index_pathspec_literals(dst);
 }
 
 void clear_pathspec(struct pathspec *pathspec)
@@ -717,6 +940,7 @@ void clear_pathspec(struct pathspec *pathspec)
 			attr_check_free(pathspec->items[i].attr_check);
 	}
 
+	clear_pathspec_literals(pathspec);
 	FREE_AND_NULL(pathspec->items);
 	pathspec->nr = 0;
 }
@@ -2,6 +2,7 @@
 #define PATHSPEC_H
 
 struct index_state;
+struct pathspec_literals;
 
 /* Pathspec magic */
 #define PATHSPEC_FROMTOP	(1<<0)
@@ -53,6 +54,7 @@ struct pathspec {
 		} *attr_match;
 		struct attr_check *attr_check;
 	} *items;
+	struct pathspec_literals *literals; /* see pathspec.c */
 };
 
 #define GUARD_PATHSPEC(ps, mask) \
@@ -172,4 +174,22 @@ int match_pathspec_attrs(struct index_state *istate,
 			 const char *name, int namelen,
 			 const struct pathspec_item *item);
 
+/*
+ * Calls "fn" with the index of each item of "ps" that may match "name",
+ * to spare trying each of a long list of pathspecs against it.  The
+ * first "prefix" bytes of "name" are taken to match, as with
+ * match_pathspec().  An item without wildcards nor magic can only match
+ * a name it is a leading directory of, the name itself, or, with
+ * "leading", a name that is a leading directory of it; such items are
+ * looked up that way, and the others are all passed to "fn".
+ *
+ * Returns -1 without calling "fn" if "ps" has too few items for it to
+ * be worth it, in which case the caller must try them all.
+ */
+int for_each_candidate_pathspec_item(const struct pathspec *ps,
+				     const char *name, int namelen,
+				     int prefix, int leading,
+				     void (*fn)(int nr, void *data),
+				     void *data);
+
 #endif /* PATHSPEC_H */
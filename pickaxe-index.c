@@ -0,0 +1,271 @@
+#include "cache.h"
+#include "object-store.h"
+#include "oidmap.h"
+#include "pickaxe-index.h"
+
+/*
+ * The file starts with PICKAXE_INDEX_SIGNATURE, the version and the
+ * format id of the hash algorithm, all in network byte order.  Each
+ * entry that follows is a raw object name, the number of bits in its
+ * filter (a multiple of 64, or 0 for "anything may be in there") and
+ * the filter itself.
+ */
+#define PICKAXE_INDEX_SIGNATURE 0x504b5849 /* "PKXI" */
+#define PICKAXE_INDEX_VERSION 1
+#define PICKAXE_INDEX_HEADER_SIZE 12
+
+/* Bits per distinct trigram; each trigram sets two of them. */
+#define BITS_PER_TRIGRAM 8
+
+/* Do not bother with a filter for blobs with more distinct trigrams */
+#define MAX_TRIGRAMS (1 << 20)
+
+struct pickaxe_index_entry {
+	struct oidmap_entry entry;
+	uint32_t nr_bits;
+	const unsigned char *bits;
+};
+
+static struct pickaxe_index {
+	struct repository *repo;
+	struct oidmap map;
+	char *path;
+	void *data;
+	size_t data_len;
+	int fd;
+	/* set when we must not or cannot append to the file */
+	unsigned read_only : 1;
+} pickaxe_index;
+
+static void add_be32(struct strbuf *sb, uint32_t value)
+{
+	value = htonl(value);
+	strbuf_add(sb, &value, sizeof(value));
+}
+
+static uint32_t trigram_at(const char *p)
+{
+	return ((uint32_t)tolower((unsigned char)p[0]) << 16) |
+	       ((uint32_t)tolower((unsigned char)p[1]) << 8) |
+	       (uint32_t)tolower((unsigned char)p[2]);
+}
+
+static void trigram_bits(uint32_t trigram, uint32_t nr_bits,
+			 uint32_t *bit1, uint32_t *bit2)
+{
+	uint32_t h = trigram * 0x9e3779b1;
+
+	*bit1 = h % nr_bits;
+	*bit2 = ((h >> 16) ^ (h * 0x85ebca6b)) % nr_bits;
+}
+
+static int bit_is_set(const unsigned char *bits, uint32_t bit)
+{
+	return bits[bit / 8] & (1 << (bit % 8));
+}
+
+static int load_entries(struct pickaxe_index *pi)
+{
+	const unsigned char *p = pi->data, *end = p + pi->data_len;
+	size_t rawsz = pi->repo->hash_algo->rawsz;
+
+	if (pi->data_len < PICKAXE_INDEX_HEADER_SIZE ||
+	    get_be32(p) != PICKAXE_INDEX_SIGNATURE ||
+	    get_be32(p + 4) != PICKAXE_INDEX_VERSION ||
+	    get_be32(p + 8) != pi->repo->hash_algo->format_id)
+		return -1;
+	p += PICKAXE_INDEX_HEADER_SIZE;
+
+	/* a truncated entry at the end is one still being written */
+	while (end - p >= rawsz + 4) {
+		struct pickaxe_index_entry *e;
+		uint32_t nr_bits = get_be32(p + rawsz);
+
+		if (nr_bits % 64 || end - p - rawsz - 4 < nr_bits / 8)
+			break;
+		CALLOC_ARRAY(e, 1);
+		oidread(&e->entry.oid, p);
+		e->nr_bits = nr_bits;
+		e->bits = p + rawsz + 4;
+		p += rawsz + 4 + nr_bits / 8;
+		if (oidmap_get(&pi->map, &e->entry.oid))
+			free(e);
+		else
+			oidmap_put(&pi->map, e);
+	}
+	return 0;
+}
+
+static struct pickaxe_index *get_pickaxe_index(struct repository *r)
+{
+	struct pickaxe_index *pi = &pickaxe_index;
+	struct stat st;
+	int fd;
+
+	if (pi->repo)
+		return pi->repo == r ? pi : NULL;
+
+	pi->repo = r;
+	oidmap_init(&pi->map, 0);
+	pi->path = xstrfmt("%s/info/pickaxe-index", r->objects->odb->path);
+	pi->fd = -1;
+
+	fd = git_open(pi->path);
+	if (fd < 0)
+		return pi;
+	if (!fstat(fd, &st) && st.st_size) {
+		pi->data_len = xsize_t(st.st_size);
+		pi->data = xmmap_gently(NULL, pi->data_len, PROT_READ,
+					MAP_PRIVATE, fd, 0);
+		if (pi->data == MAP_FAILED) {
+			pi->data = NULL;
+			pi->data_len = 0;
+		}
+	}
+	close(fd);
+
+	/* do not add to a file we do not understand */
+	if (!pi->data || load_entries(pi))
+		pi->read_only = 1;
+	return pi;
+}
+
+int pickaxe_index_may_contain(struct repository *r,
+			      const struct object_id *oid,
+			      const char *needle, size_t len)
+{
+	struct pickaxe_index *pi = get_pickaxe_index(r);
+	struct pickaxe_index_entry *e;
+	size_t i;
+
+	if (!pi || !(e = oidmap_get(&pi->map, oid)))
+		return -1;
+	if (!e->nr_bits || len < 3)
+		return 1;
+
+	for (i = 0; i + 3 <= len; i++) {
+		uint32_t bit1, bit2;
+
+		trigram_bits(trigram_at(needle + i), e->nr_bits, &bit1, &bit2);
+		if (!bit_is_set(e->bits, bit1) || !bit_is_set(e->bits, bit2))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Compute the filter of "data" into "out", after its entry header.
+ * A trigram is a 24-bit number, so the distinct ones are found with a
+ * bitmap of all of them, which is cleared again afterwards.
+ */
+static void build_filter(struct strbuf *out, const char *data,
+			 unsigned long size)
+{
+	static unsigned char *seen;
+	uint32_t *trigrams = NULL;
+	size_t nr = 0, alloc = 0, i;
+	uint32_t nr_bits;
+	unsigned char *bits;
+
+	if (!seen)
+		seen = xcalloc(1, (1 << 24) / 8);
+
+	for (i = 0; i + 3 <= size; i++) {
+		uint32_t t = trigram_at(data + i);
+
+		if (seen[t / 8] & (1 << (t % 8)))
+			continue;
+		seen[t / 8] |= 1 << (t % 8);
+		ALLOC_GROW(trigrams, nr + 1, alloc);
+		trigrams[nr++] = t;
+	}
+	for (i = 0; i < nr; i++)
+		seen[trigrams[i] / 8] = 0;
+
+	if (nr > MAX_TRIGRAMS) {
+		add_be32(out, 0);
+		free(trigrams);
+		return;
+	}
+
+	nr_bits = st_mult(DIV_ROUND_UP(nr * BITS_PER_TRIGRAM, 64), 64);
+	if (!nr_bits)
+		nr_bits = 64;
+	add_be32(out, nr_bits);
+	bits = xcalloc(1, nr_bits / 8);
+	for (i = 0; i < nr; i++) {
+		uint32_t bit1, bit2;
+
+		trigram_bits(trigrams[i], nr_bits, &bit1, &bit2);
+		bits[bit1 / 8] |= 1 << (bit1 % 8);
+		bits[bit2 / 8] |= 1 << (bit2 % 8);
+	}
+	strbuf_add(out, bits, nr_bits / 8);
+	free(bits);
+	free(trigrams);
+}
+
+static int open_for_append(struct pickaxe_index *pi)
+{
+	if (pi->fd >= 0)
+		return 0;
+	if (pi->read_only)
+		return -1;
+
+	if (pi->data) {
+		pi->fd = open(pi->path, O_WRONLY | O_APPEND);
+	} else {
+		struct strbuf header = STRBUF_INIT;
+
+		pi->fd = open(pi->path,
+			      O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0666);
+		add_be32(&header, PICKAXE_INDEX_SIGNATURE);
+		add_be32(&header, PICKAXE_INDEX_VERSION);
+		add_be32(&header, pi->repo->hash_algo->format_id);
+		if (pi->fd >= 0 &&
+		    write_in_full(pi->fd, header.buf, header.len) < 0) {
+			close(pi->fd);
+			pi->fd = -1;
+		}
+		strbuf_release(&header);
+	}
+
+	if (pi->fd < 0) {
+		pi->read_only = 1;
+		return -1;
+	}
+	return 0;
+}
+
+void pickaxe_index_add(struct repository *r, const struct object_id *oid,
+		       const char *data, unsigned long size)
+{
+	struct pickaxe_index *pi = get_pickaxe_index(r);
+	struct pickaxe_index_entry *e;
+	struct strbuf buf = STRBUF_INIT;
+	size_t rawsz;
+
+	if (!pi || oidmap_get(&pi->map, oid))
+		return;
+
+	rawsz = r->hash_algo->rawsz;
+	strbuf_add(&buf, oid->hash, rawsz);
+	build_filter(&buf, data, size);
+
+	/*
+	 * Write the whole entry at once, so that others appending
+	 * at the same time cannot end up in the middle of it.
+	 */
+	if (!open_for_append(pi) &&
+	    write_in_full(pi->fd, buf.buf, buf.len) < 0) {
+		close(pi->fd);
+		pi->fd = -1;
+		pi->read_only = 1;
+	}
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->entry.oid, oid);
+	e->nr_bits = get_be32(buf.buf + rawsz);
+	e->bits = (unsigned char *)strbuf_detach(&buf, NULL) + rawsz + 4;
+	oidmap_put(&pi->map, e);
+}
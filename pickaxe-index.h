@@ -0,0 +1,31 @@
+#ifndef PICKAXE_INDEX_H
+#define PICKAXE_INDEX_H
+
+struct object_id;
+struct repository;
+
+/*
+ * The pickaxe index, $GIT_DIR/objects/info/pickaxe-index, records for
+ * each blob it knows about a Bloom filter of the byte trigrams found in
+ * it, with ASCII letters folded to lowercase.  It lets "git log -S"
+ * rule out a blob without reading it when one of the trigrams of the
+ * string it looks for is missing.
+ *
+ * Entries are only ever appended, by whoever happens to read a blob
+ * that is not in the index yet.
+ */
+
+/*
+ * Returns 0 if the blob "oid" cannot contain "needle", not even when
+ * ignoring the case of ASCII letters, 1 if it may, and -1 if the blob
+ * is not in the index.
+ */
+int pickaxe_index_may_contain(struct repository *r,
+			      const struct object_id *oid,
+			      const char *needle, size_t len);
+
+/* Add the blob "oid" with the given contents to the index. */
+void pickaxe_index_add(struct repository *r, const struct object_id *oid,
+		       const char *data, unsigned long size);
+
+#endif /* PICKAXE_INDEX_H */
@@ -199,6 +199,7 @@ static int do_packet_write(const int fd_out, const char *buf, size_t size,
 {
 	char header[4];
 	size_t packet_size;
+	struct iovec iov[2];
 
 	if (size > LARGE_PACKET_DATA_MAX) {
 		strbuf_addstr(err, _("packet write failed - data exceeds max packet size"));
@@ -211,14 +212,18 @@ static int do_packet_write(const int fd_out, const char *buf, size_t size,
 	set_packet_header(header, packet_size);
 
 	/*
-	 * Write the header and the buffer in 2 parts so that we do
-	 * not need to allocate a buffer or rely on a static buffer.
-	 * This also avoids putting a large buffer on the stack which
-	 * might have multi-threading issues.
+	 * Hand the header and the buffer to writev() so that we do
+	 * not need to allocate a buffer or rely on a static buffer,
+	 * and still issue a single system call.  This also avoids
+	 * putting a large buffer on the stack which might have
+	 * multi-threading issues.
 	 */
+	iov[0].iov_base = header;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = size;
 
-	if (write_in_full(fd_out, header, 4) < 0 ||
-	    write_in_full(fd_out, buf, size) < 0) {
+	if (writev_in_full(fd_out, iov, 2) < 0) {
 		strbuf_addf(err, _("packet write failed: %s"), strerror(errno));
 		return -1;
 	}
@@ -590,10 +595,42 @@ enum packet_read_status packet_reader_peek(struct packet_reader *reader)
 	return reader->status;
 }
 
+/*
+ * A buffered writer writes out what it collected once it grows past
+ * PACKET_WRITER_BUFFER_SIZE.  Payloads larger than PACKET_WRITER_COPY_MAX
+ * are not copied into it, but handed to writev() right behind it.
+ */
+#define PACKET_WRITER_BUFFER_SIZE LARGE_PACKET_MAX
+#define PACKET_WRITER_COPY_MAX 1024
+
 void packet_writer_init(struct packet_writer *writer, int dest_fd)
 {
 	writer->dest_fd = dest_fd;
 	writer->use_sideband = 0;
+	writer->buffered = 0;
+	strbuf_init(&writer->buf, 0);
+}
+
+void packet_writer_release(struct packet_writer *writer)
+{
+	strbuf_release(&writer->buf);
+}
+
+void packet_writer_drain(struct packet_writer *writer)
+{
+	if (!writer->buf.len)
+		return;
+	if (write_in_full(writer->dest_fd, writer->buf.buf, writer->buf.len) < 0) {
+		check_pipe(errno);
+		die_errno(_("packet write failed"));
+	}
+	strbuf_reset(&writer->buf);
+}
+
+static void packet_writer_maybe_drain(struct packet_writer *writer)
+{
+	if (writer->buf.len >= PACKET_WRITER_BUFFER_SIZE)
+		packet_writer_drain(writer);
 }
 
 void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
@@ -601,27 +638,85 @@ void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\001" : "", fmt, args);
+	if (writer->buffered) {
+		format_packet(&writer->buf, writer->use_sideband ? "\001" : "",
+			      fmt, args);
+		packet_writer_maybe_drain(writer);
+	} else {
+		packet_write_fmt_1(writer->dest_fd, 0,
+				   writer->use_sideband ? "\001" : "", fmt, args);
+	}
 	va_end(args);
 }
 
+void packet_writer_write_len(struct packet_writer *writer,
+			     const char *data, size_t len)
+{
+	char header[4];
+	struct iovec iov[3];
+
+	if (writer->use_sideband) {
+		packet_writer_write(writer, "%.*s", (int)len, data);
+		return;
+	}
+
+	if (writer->buffered && len <= PACKET_WRITER_COPY_MAX) {
+		packet_buf_write_len(&writer->buf, data, len);
+		packet_writer_maybe_drain(writer);
+		return;
+	}
+
+	if (len > LARGE_PACKET_DATA_MAX)
+		die(_("protocol error: impossibly long line"));
+	packet_trace(data, len, 1);
+	set_packet_header(header, len + 4);
+
+	iov[0].iov_base = writer->buf.buf;
+	iov[0].iov_len = writer->buf.len;
+	iov[1].iov_base = header;
+	iov[1].iov_len = 4;
+	iov[2].iov_base = (void *)data;
+	iov[2].iov_len = len;
+	if (writev_in_full(writer->dest_fd, iov, 3) < 0) {
+		check_pipe(errno);
+		die_errno(_("packet write failed"));
+	}
+	strbuf_reset(&writer->buf);
+}
+
 void packet_writer_error(struct packet_writer *writer, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\003" : "ERR ", fmt, args);
+	if (writer->buffered) {
+		format_packet(&writer->buf, writer->use_sideband ? "\003" : "ERR ",
+			      fmt, args);
+		packet_writer_drain(writer);
+	} else {
+		packet_write_fmt_1(writer->dest_fd, 0,
+				   writer->use_sideband ? "\003" : "ERR ",
+				   fmt, args);
+	}
 	va_end(args);
 }
 
 void packet_writer_delim(struct packet_writer *writer)
 {
-	packet_delim(writer->dest_fd);
+	if (writer->buffered) {
+		packet_buf_delim(&writer->buf);
+		packet_writer_drain(writer);
+	} else {
+		packet_delim(writer->dest_fd);
+	}
 }
 
 void packet_writer_flush(struct packet_writer *writer)
 {
-	packet_flush(writer->dest_fd);
+	if (writer->buffered) {
+		packet_buf_flush(&writer->buf);
+		packet_writer_drain(writer);
+	} else {
+		packet_flush(writer->dest_fd);
+	}
 }
@@ -225,16 +225,31 @@ extern char packet_buffer[LARGE_PACKET_MAX];
 struct packet_writer {
 	int dest_fd;
 	unsigned use_sideband : 1;
+
+	/*
+	 * If set, packets are collected in "buf" and only written out
+	 * along with the next delim or flush packet, an error, or once
+	 * enough of them piled up.  Whoever writes to "dest_fd" behind
+	 * the writer's back must call packet_writer_drain() first.
+	 */
+	unsigned buffered : 1;
+	struct strbuf buf;
 };
 
 void packet_writer_init(struct packet_writer *writer, int dest_fd);
+void packet_writer_release(struct packet_writer *writer);
 
 /* These functions die upon failure. */
 __attribute__((format (printf, 2, 3)))
 void packet_writer_write(struct packet_writer *writer, const char *fmt, ...);
+void packet_writer_write_len(struct packet_writer *writer,
+			     const char *data, size_t len);
 __attribute__((format (printf, 2, 3)))
 void packet_writer_error(struct packet_writer *writer, const char *fmt, ...);
 void packet_writer_delim(struct packet_writer *writer);
 void packet_writer_flush(struct packet_writer *writer);
 
+/* Write out whatever a buffered writer has collected so far. */
+void packet_writer_drain(struct packet_writer *writer);
+
 #endif
@@ -9,6 +9,7 @@
 #include "progress.h"
 #include "thread-utils.h"
 #include "repository.h"
+#include "compat/lstat-batch.h"
 
 /*
  * Mostly randomly chosen maximum thread counts: we
@@ -19,6 +20,12 @@
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
 
+/*
+ * Where the platform lets us, each thread hands this many lstat's
+ * to the kernel at once.
+ */
+#define LSTAT_BATCH (64)
+
 struct progress_data {
 	unsigned long n;
 	struct progress *progress;
@@ -32,8 +39,39 @@ struct thread_data {
 	struct progress_data *progress;
 	int offset, nr;
 	int t2_nr_lstat;
+
+	struct lstat_batch *batch;
+	struct cache_entry *batch_ce[LSTAT_BATCH];
+	int batch_nr;
 };
 
+static void preload_entry(struct index_state *index, struct cache_entry *ce,
+			  struct stat *st)
+{
+	if (ie_match_stat(index, ce, st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		return;
+	ce_mark_uptodate(ce);
+	mark_fsmonitor_valid(index, ce);
+}
+
+static void flush_lstat_batch(struct thread_data *p)
+{
+	const char *path[LSTAT_BATCH];
+	struct stat st[LSTAT_BATCH];
+	int err[LSTAT_BATCH];
+	int i;
+
+	if (!p->batch_nr)
+		return;
+	for (i = 0; i < p->batch_nr; i++)
+		path[i] = p->batch_ce[i]->name;
+	lstat_batch(p->batch, p->batch_nr, path, st, err);
+	for (i = 0; i < p->batch_nr; i++)
+		if (!err[i])
+			preload_entry(p->index, p->batch_ce[i], &st[i]);
+	p->batch_nr = 0;
+}
+
 static void *preload_thread(void *_data)
 {
 	int nr, last_nr;
@@ -46,6 +84,7 @@ static void *preload_thread(void *_data)
 	if (nr + p->offset > index->cache_nr)
 		nr = index->cache_nr - p->offset;
 	last_nr = nr;
+	p->batch = lstat_batch_init(LSTAT_BATCH);
 
 	do {
 		struct cache_entry *ce = *cep++;
@@ -75,13 +114,21 @@ static void *preload_thread(void *_data)
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
 		p->t2_nr_lstat++;
-		if (lstat(ce->name, &st))
+		if (p->batch) {
+			p->batch_ce[p->batch_nr++] = ce;
+			if (p->batch_nr == LSTAT_BATCH)
+				flush_lstat_batch(p);
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		}
+		if (lstat(ce->name, &st))
 			continue;
-		ce_mark_uptodate(ce);
-		mark_fsmonitor_valid(index, ce);
+		preload_entry(index, ce, &st);
 	} while (--nr > 0);
+	if (p->batch) {
+		flush_lstat_batch(p);
+		lstat_batch_release(p->batch);
+		p->batch = NULL;
+	}
 	if (p->progress) {
 		struct progress_data *pd = p->progress;
 
@@ -114,6 +161,7 @@ void preload_index(struct index_state *index,
 	trace2_region_enter("index", "preload", NULL);
 
 	trace_performance_enter();
+	enable_fscache();
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
 	offset = 0;
@@ -150,6 +198,7 @@ void preload_index(struct index_state *index,
 		t2_sum_lstat += p->t2_nr_lstat;
 	}
 	stop_progress(&pd.progress);
+	disable_fscache();
 
 	trace_performance_leave("preload index");
 
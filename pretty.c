@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "utf8.h"
 #include "diff.h"
 #include "revision.h"
@@ -15,6 +16,32 @@
 #include "run-command.h"
 
 static char *user_format;
+
+/*
+ * The expansion of "user_format" for the first commit, recorded as the
+ * literal text before each placeholder and how much of the format that
+ * placeholder took, so that later commits do not have to look for the
+ * placeholders again.
+ */
+struct user_format_step {
+	size_t literal_off, literal_len;
+	const char *placeholder; /* NULL for the final literal */
+	size_t consumed;
+};
+
+static struct user_format_program {
+	struct strbuf literals;
+	struct user_format_step *step;
+	size_t nr, alloc;
+} user_format_program = { .literals = STRBUF_INIT };
+
+static void clear_user_format_program(struct user_format_program *p)
+{
+	strbuf_release(&p->literals);
+	FREE_AND_NULL(p->step);
+	p->nr = p->alloc = 0;
+}
+
 static struct cmt_fmt_map {
 	const char *name;
 	enum cmit_fmt format;
@@ -38,6 +65,7 @@ static void save_user_format(struct rev_info *rev, const char *cp, int is_tforma
 {
 	free(user_format);
 	user_format = xstrdup(cp);
+	clear_user_format_program(&user_format_program);
 	if (is_tformat)
 		rev->use_terminator = 1;
 	rev->commit_format = CMIT_FMT_USERFORMAT;
@@ -797,6 +825,9 @@ struct format_commit_context {
 	enum trunc_type truncate;
 	const char *message;
 	char *commit_encoding;
+	/* 1 if "metadata" came from the commit-graph, -1 if it cannot */
+	int graph_metadata;
+	struct commit_graph_metadata metadata;
 	size_t width, indent1, indent2;
 	int auto_color;
 	int padding;
@@ -1238,6 +1269,48 @@ static size_t parse_describe_args(const char *start, struct strvec *args)
 	return arg - start;
 }
 
+/*
+ * Show the author, committer and subject from the commit-graph when it
+ * has them, so that the commit object does not have to be read just
+ * for those.
+ */
+static size_t format_commit_from_graph(struct strbuf *sb, /* in UTF-8 */
+				       const char *placeholder,
+				       struct format_commit_context *c)
+{
+	const struct commit_graph_metadata *md = &c->metadata;
+	struct strbuf ident = STRBUF_INIT;
+	size_t res;
+
+	if (!c->graph_metadata)
+		c->graph_metadata = commit_graph_metadata(c->repository,
+							  c->commit,
+							  &c->metadata) ? -1 : 1;
+	if (c->graph_metadata < 0)
+		return 0;
+
+	switch (placeholder[0]) {
+	case 'a':
+		strbuf_addf(&ident, "%s %"PRItime" %+05d",
+			    md->author, md->author_date, md->author_tz);
+		break;
+	case 'c':
+		strbuf_addf(&ident, "%s %"PRItime" %+05d",
+			    md->committer, md->committer_date, md->committer_tz);
+		break;
+	case 's':
+		strbuf_addstr(sb, md->subject);
+		return 1;
+	default:
+		return 0;
+	}
+
+	res = format_person_part(sb, placeholder[1], ident.buf, ident.len,
+				 &c->pretty_ctx->date_mode);
+	strbuf_release(&ident);
+	return res;
+}
+
 static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 				const char *placeholder,
 				void *context)
@@ -1498,6 +1571,12 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 		return 2;
 	}
 
+	if (!c->commit_header_parsed) {
+		res = format_commit_from_graph(sb, placeholder, c);
+		if (res)
+			return res;
+	}
+
 	/* For the rest we have to parse the commit header. */
 	if (!c->commit_header_parsed) {
 		msg = c->message =
@@ -1720,6 +1799,86 @@ static size_t format_commit_item(struct strbuf *sb, /* in UTF-8 */
 	return consumed + 1;
 }
 
+static void add_user_format_step(struct user_format_program *p,
+				 size_t *literal_off,
+				 const char *placeholder, size_t consumed)
+{
+	ALLOC_GROW(p->step, p->nr + 1, p->alloc);
+	p->step[p->nr].literal_off = *literal_off;
+	p->step[p->nr].literal_len = p->literals.len - *literal_off;
+	p->step[p->nr].placeholder = placeholder;
+	p->step[p->nr].consumed = consumed;
+	p->nr++;
+	*literal_off = p->literals.len;
+}
+
+/* Like strbuf_expand() with format_commit_item(), but recording it in "p" */
+static void record_user_format(struct strbuf *sb, const char *format,
+			       struct format_commit_context *c,
+			       struct user_format_program *p)
+{
+	size_t literal_off = 0;
+
+	for (;;) {
+		const char *percent;
+		size_t consumed;
+
+		percent = strchrnul(format, '%');
+		strbuf_add(sb, format, percent - format);
+		strbuf_add(&p->literals, format, percent - format);
+		if (!*percent)
+			break;
+		format = percent + 1;
+
+		if (*format == '%') {
+			strbuf_addch(sb, '%');
+			strbuf_addch(&p->literals, '%');
+			format++;
+			continue;
+		}
+
+		consumed = format_commit_item(sb, format, c);
+		add_user_format_step(p, &literal_off, format, consumed);
+		if (consumed)
+			format += consumed;
+		else
+			strbuf_addch(sb, '%');
+	}
+	add_user_format_step(p, &literal_off, NULL, 0);
+}
+
+/*
+ * Replay "p".  How much of the format a placeholder takes can depend on
+ * the commit (e.g. "%aN" for a commit without a valid author), so when
+ * it differs from the recording, the rest of the format is expanded
+ * from scratch.
+ */
+static void replay_user_format(struct strbuf *sb,
+			       struct format_commit_context *c,
+			       const struct user_format_program *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->nr; i++) {
+		const struct user_format_step *step = &p->step[i];
+		size_t consumed;
+
+		strbuf_add(sb, p->literals.buf + step->literal_off,
+			   step->literal_len);
+		if (!step->placeholder)
+			break;
+
+		consumed = format_commit_item(sb, step->placeholder, c);
+		if (!consumed)
+			strbuf_addch(sb, '%');
+		if (consumed != step->consumed) {
+			strbuf_expand(sb, step->placeholder + consumed,
+				      format_commit_item, c);
+			return;
+		}
+	}
+}
+
 static size_t userformat_want_item(struct strbuf *sb, const char *placeholder,
 				   void *context)
 {
@@ -1739,6 +1898,9 @@ static size_t userformat_want_item(struct strbuf *sb, const char *placeholder,
 	case 'D':
 		w->decorate = 1;
 		break;
+	case 'G':
+		w->signature = 1;
+		break;
 	}
 	return 0;
 }
@@ -1770,7 +1932,12 @@ void repo_format_commit_message(struct repository *r,
 	const char *output_enc = pretty_ctx->output_encoding;
 	const char *utf8 = "UTF-8";
 
-	strbuf_expand(sb, format, format_commit_item, &context);
+	if (format != user_format)
+		strbuf_expand(sb, format, format_commit_item, &context);
+	else if (user_format_program.nr)
+		replay_user_format(sb, &context, &user_format_program);
+	else
+		record_user_format(sb, format, &context, &user_format_program);
 	rewrap_message_tail(sb, &context, 0, 0, 0);
 
 	/*
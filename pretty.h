@@ -74,6 +74,7 @@ struct userformat_want {
 	unsigned notes:1;
 	unsigned source:1;
 	unsigned decorate:1;
+	unsigned signature:1;
 };
 void userformat_find_requirements(const char *fmt, struct userformat_want *w);
 
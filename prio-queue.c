@@ -1,12 +1,34 @@
 #include "cache.h"
 #include "prio-queue.h"
 
+/*
+ * The queue is a 4-ary heap: the children of the entry at ix are at
+ * 4 * ix + 1 to 4 * ix + 4.  That makes it half as deep as a binary
+ * heap, and the children of an entry are next to each other in memory.
+ */
+#define PRIO_QUEUE_ARITY 4
+
+static inline int is_lifo(struct prio_queue *queue)
+{
+	return !queue->compare && !queue->key;
+}
+
 static inline int compare(struct prio_queue *queue, int i, int j)
 {
-	int cmp = queue->compare(queue->array[i].data, queue->array[j].data,
-				 queue->cb_data);
+	struct prio_queue_entry *a = &queue->array[i], *b = &queue->array[j];
+	int cmp;
+
+	if (queue->key) {
+		if (a->key[0] != b->key[0])
+			return a->key[0] < b->key[0] ? -1 : 1;
+		if (a->key[1] != b->key[1])
+			return a->key[1] < b->key[1] ? -1 : 1;
+		cmp = 0;
+	} else {
+		cmp = queue->compare(a->data, b->data, queue->cb_data);
+	}
 	if (!cmp)
-		cmp = queue->array[i].ctr - queue->array[j].ctr;
+		cmp = a->ctr - b->ctr;
 	return cmp;
 }
 
@@ -19,7 +41,7 @@ void prio_queue_reverse(struct prio_queue *queue)
 {
 	int i, j;
 
-	if (queue->compare != NULL)
+	if (!is_lifo(queue))
 		BUG("prio_queue_reverse() on non-LIFO queue");
 	for (i = 0; i < (j = (queue->nr - 1) - i); i++)
 		swap(queue, i, j);
@@ -41,13 +63,15 @@ void prio_queue_put(struct prio_queue *queue, void *thing)
 	ALLOC_GROW(queue->array, queue->nr + 1, queue->alloc);
 	queue->array[queue->nr].ctr = queue->insertion_ctr++;
 	queue->array[queue->nr].data = thing;
+	if (queue->key)
+		queue->key(thing, queue->array[queue->nr].key, queue->cb_data);
 	queue->nr++;
-	if (!queue->compare)
+	if (is_lifo(queue))
 		return; /* LIFO */
 
 	/* Bubble up the new one */
 	for (ix = queue->nr - 1; ix; ix = parent) {
-		parent = (ix - 1) / 2;
+		parent = (ix - 1) / PRIO_QUEUE_ARITY;
 		if (compare(queue, parent, ix) <= 0)
 			break;
 
@@ -62,7 +86,7 @@ void *prio_queue_get(struct prio_queue *queue)
 
 	if (!queue->nr)
 		return NULL;
-	if (!queue->compare)
+	if (is_lifo(queue))
 		return queue->array[--queue->nr].data; /* LIFO */
 
 	result = queue->array[0].data;
@@ -72,11 +96,17 @@ void *prio_queue_get(struct prio_queue *queue)
 	queue->array[0] = queue->array[queue->nr];
 
 	/* Push down the one at the root */
-	for (ix = 0; ix * 2 + 1 < queue->nr; ix = child) {
-		child = ix * 2 + 1; /* left */
-		if (child + 1 < queue->nr &&
-		    compare(queue, child, child + 1) >= 0)
-			child++; /* use right child */
+	for (ix = 0; ix * PRIO_QUEUE_ARITY + 1 < queue->nr; ix = child) {
+		int i, last;
+
+		/* find the smallest child */
+		child = ix * PRIO_QUEUE_ARITY + 1;
+		last = child + PRIO_QUEUE_ARITY - 1;
+		if (last >= queue->nr)
+			last = queue->nr - 1;
+		for (i = child + 1; i <= last; i++)
+			if (compare(queue, i, child) < 0)
+				child = i;
 
 		if (compare(queue, ix, child) <= 0)
 			break;
@@ -90,7 +120,7 @@ void *prio_queue_peek(struct prio_queue *queue)
 {
 	if (!queue->nr)
 		return NULL;
-	if (!queue->compare)
+	if (is_lifo(queue))
 		return queue->array[queue->nr - 1].data;
 	return queue->array[0].data;
 }
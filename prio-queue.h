@@ -9,7 +9,7 @@
  * compare two "things".
  *
  * Alternatively, this data structure can also be used as a LIFO stack
- * by specifying NULL as the comparison function.
+ * by specifying neither a comparison function nor a key function.
  */
 
 /*
@@ -21,9 +21,21 @@
  */
 typedef int (*prio_queue_compare_fn)(const void *one, const void *two, void *cb_data);
 
+/*
+ * Instead of a comparison function, a queue can be given a function
+ * that stores the sort keys of a "thing" in key[0] and key[1].  They
+ * are computed once, when the "thing" is added, and kept in the queue
+ * next to it, so that keeping the queue in order never needs to look
+ * at the "things" themselves: they sort by key[0], then by key[1],
+ * smallest first.  This is only correct for "things" whose keys do not
+ * change while they are in the queue.
+ */
+typedef void (*prio_queue_key_fn)(const void *thing, uint64_t *key, void *cb_data);
+
 struct prio_queue_entry {
 	unsigned ctr;
 	void *data;
+	uint64_t key[2];
 };
 
 struct prio_queue {
@@ -32,6 +44,7 @@ struct prio_queue {
 	void *cb_data;
 	int alloc, nr;
 	struct prio_queue_entry *array;
+	prio_queue_key_fn key;
 };
 
 /*
@@ -41,8 +54,8 @@ void prio_queue_put(struct prio_queue *, void *thing);
 
 /*
  * Extract the "thing" that compares the smallest out of the queue,
- * or NULL.  If compare function is NULL, the queue acts as a LIFO
- * stack.
+ * or NULL.  If both the compare and the key function are NULL, the
+ * queue acts as a LIFO stack.
  */
 void *prio_queue_get(struct prio_queue *);
 
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "range-diff.h"
 #include "string-list.h"
 #include "run-command.h"
@@ -12,6 +13,7 @@
 #include "userdiff.h"
 #include "apply.h"
 #include "revision.h"
+#include "thread-utils.h"
 
 struct patch_util {
 	/* For the search for an exact match */
@@ -308,65 +310,240 @@ static int diffsize(const char *a, const char *b)
 	return COST_MAX;
 }
 
-static void get_correspondences(struct string_list *a, struct string_list *b,
-				int creation_factor)
+/*
+ * Sorted hashes of the lines of "util->diff".  Every line that occurs
+ * more often in one diff than in the other shows up in the diff between
+ * the two, so the size of the multiset difference is a lower bound of
+ * their diffsize().  Colliding hashes only make that bound smaller.
+ */
+struct line_hashes {
+	unsigned int *hash;
+	int nr;
+};
+
+static int line_hash_cmp(const void *a_, const void *b_)
 {
-	int n = a->nr + b->nr;
-	int *cost, c, *a2b, *b2a;
-	int i, j;
+	unsigned int a = *(const unsigned int *)a_;
+	unsigned int b = *(const unsigned int *)b_;
 
-	ALLOC_ARRAY(cost, st_mult(n, n));
-	ALLOC_ARRAY(a2b, n);
-	ALLOC_ARRAY(b2a, n);
+	return a < b ? -1 : a > b;
+}
 
-	for (i = 0; i < a->nr; i++) {
-		struct patch_util *a_util = a->items[i].util;
+static void hash_lines(struct line_hashes *lh, const char *diff)
+{
+	int alloc = 0;
+
+	lh->hash = NULL;
+	lh->nr = 0;
+	while (*diff) {
+		const char *eol = strchrnul(diff, '\n');
 
-		for (j = 0; j < b->nr; j++) {
-			struct patch_util *b_util = b->items[j].util;
+		ALLOC_GROW(lh->hash, lh->nr + 1, alloc);
+		lh->hash[lh->nr++] = memhash(diff, eol - diff);
+		diff = *eol ? eol + 1 : eol;
+	}
+	QSORT(lh->hash, lh->nr, line_hash_cmp);
+}
+
+static int lines_differing(const struct line_hashes *a,
+			   const struct line_hashes *b)
+{
+	int i = 0, j = 0, count = 0;
 
-			if (a_util->matching == j)
-				c = 0;
-			else if (a_util->matching < 0 && b_util->matching < 0)
-				c = diffsize(a_util->diff, b_util->diff);
+	while (i < a->nr && j < b->nr) {
+		if (a->hash[i] == b->hash[j]) {
+			i++;
+			j++;
+		} else {
+			count++;
+			if (a->hash[i] < b->hash[j])
+				i++;
 			else
-				c = COST_MAX;
-			cost[i + n * j] = c;
+				j++;
 		}
+	}
+	return count + (a->nr - i) + (b->nr - j);
+}
+
+/*
+ * Below this many candidate pairs, the cost matrix is not worth
+ * spreading across threads.
+ */
+#define MIN_THREADED_RANGE_DIFF_PAIRS 64
+
+struct cost_matrix {
+	struct patch_util **a, **b;
+	struct line_hashes *a_lines, *b_lines;
+	int a_nr, b_nr, n;
+	int creation_factor;
+	int *cost;
+
+	/* protected by "mutex" */
+	pthread_mutex_t mutex;
+	int next_row;
+};
+
+/*
+ * Fill the costs of pairing the i-th unmatched patch of "a" with each
+ * unmatched patch of "b".  A pair whose lower bound already costs more
+ * than creating one patch and deleting the other is never part of an
+ * optimal assignment, so it is not diffed at all.
+ */
+static void fill_cost_row(struct cost_matrix *m, int i)
+{
+	int j;
+
+	for (j = 0; j < m->b_nr; j++) {
+		int unmatched = m->a[i]->diffsize * m->creation_factor / 100 +
+			m->b[j]->diffsize * m->creation_factor / 100;
+		int *c = &m->cost[i + m->n * j];
+
+		if (lines_differing(&m->a_lines[i], &m->b_lines[j]) > unmatched)
+			*c = COST_MAX;
+		else
+			*c = diffsize(m->a[i]->diff, m->b[j]->diff);
+	}
+}
+
+static void *cost_matrix_worker(void *data)
+{
+	struct cost_matrix *m = data;
+
+	for (;;) {
+		int row;
+
+		pthread_mutex_lock(&m->mutex);
+		row = m->next_row++;
+		pthread_mutex_unlock(&m->mutex);
+		if (row >= m->a_nr)
+			break;
+		fill_cost_row(m, row);
+	}
+	return NULL;
+}
 
-		c = a_util->matching < 0 ?
-			a_util->diffsize * creation_factor / 100 : COST_MAX;
-		for (j = b->nr; j < n; j++)
-			cost[i + n * j] = c;
+static void fill_cost_matrix(struct cost_matrix *m)
+{
+	int i, nr_threads;
+
+	ALLOC_ARRAY(m->a_lines, m->a_nr);
+	for (i = 0; i < m->a_nr; i++)
+		hash_lines(&m->a_lines[i], m->a[i]->diff);
+	ALLOC_ARRAY(m->b_lines, m->b_nr);
+	for (i = 0; i < m->b_nr; i++)
+		hash_lines(&m->b_lines[i], m->b[i]->diff);
+
+	nr_threads = git_env_ulong("GIT_TEST_RANGE_DIFF_THREADS", 0);
+	if (!nr_threads &&
+	    (uint64_t)m->a_nr * m->b_nr >= MIN_THREADED_RANGE_DIFF_PAIRS)
+		nr_threads = online_cpus();
+	if (nr_threads > m->a_nr)
+		nr_threads = m->a_nr;
+
+	if (HAVE_THREADS && nr_threads > 1) {
+		pthread_t *threads;
+		int nr_started;
+
+		pthread_mutex_init(&m->mutex, NULL);
+		ALLOC_ARRAY(threads, nr_threads);
+		for (nr_started = 0; nr_started < nr_threads; nr_started++)
+			if (pthread_create(&threads[nr_started], NULL,
+					   cost_matrix_worker, m))
+				break;
+		if (!nr_started)
+			cost_matrix_worker(m);
+		for (i = 0; i < nr_started; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+		pthread_mutex_destroy(&m->mutex);
+	} else {
+		for (i = 0; i < m->a_nr; i++)
+			fill_cost_row(m, i);
 	}
 
+	for (i = 0; i < m->a_nr; i++)
+		free(m->a_lines[i].hash);
+	free(m->a_lines);
+	for (i = 0; i < m->b_nr; i++)
+		free(m->b_lines[i].hash);
+	free(m->b_lines);
+}
+
+/*
+ * Patches that were matched exactly are left alone, so the assignment
+ * is only solved for the ones that were not, which for a typical
+ * rebase are far fewer.
+ */
+static void get_correspondences(struct string_list *a, struct string_list *b,
+				int creation_factor)
+{
+	struct cost_matrix m = { 0 };
+	int *a_index, *b_index, *a2b, *b2a;
+	int i, j, n, c;
+
+	ALLOC_ARRAY(m.a, a->nr);
+	ALLOC_ARRAY(a_index, a->nr);
+	for (i = 0; i < a->nr; i++) {
+		struct patch_util *util = a->items[i].util;
+
+		if (util->matching >= 0)
+			continue;
+		a_index[m.a_nr] = i;
+		m.a[m.a_nr++] = util;
+	}
+	ALLOC_ARRAY(m.b, b->nr);
+	ALLOC_ARRAY(b_index, b->nr);
 	for (j = 0; j < b->nr; j++) {
 		struct patch_util *util = b->items[j].util;
 
-		c = util->matching < 0 ?
-			util->diffsize * creation_factor / 100 : COST_MAX;
-		for (i = a->nr; i < n; i++)
-			cost[i + n * j] = c;
+		if (util->matching >= 0)
+			continue;
+		b_index[m.b_nr] = j;
+		m.b[m.b_nr++] = util;
 	}
+	if (!m.a_nr || !m.b_nr)
+		goto out;
 
-	for (i = a->nr; i < n; i++)
-		for (j = b->nr; j < n; j++)
-			cost[i + n * j] = 0;
+	n = m.n = m.a_nr + m.b_nr;
+	m.creation_factor = creation_factor;
+	ALLOC_ARRAY(m.cost, st_mult(n, n));
+	ALLOC_ARRAY(a2b, n);
+	ALLOC_ARRAY(b2a, n);
+
+	fill_cost_matrix(&m);
+
+	for (i = 0; i < m.a_nr; i++) {
+		c = m.a[i]->diffsize * creation_factor / 100;
+		for (j = m.b_nr; j < n; j++)
+			m.cost[i + n * j] = c;
+	}
+
+	for (j = 0; j < m.b_nr; j++) {
+		c = m.b[j]->diffsize * creation_factor / 100;
+		for (i = m.a_nr; i < n; i++)
+			m.cost[i + n * j] = c;
+	}
 
-	compute_assignment(n, n, cost, a2b, b2a);
+	for (i = m.a_nr; i < n; i++)
+		for (j = m.b_nr; j < n; j++)
+			m.cost[i + n * j] = 0;
 
-	for (i = 0; i < a->nr; i++)
-		if (a2b[i] >= 0 && a2b[i] < b->nr) {
-			struct patch_util *a_util = a->items[i].util;
-			struct patch_util *b_util = b->items[a2b[i]].util;
+	compute_assignment(n, n, m.cost, a2b, b2a);
 
-			a_util->matching = a2b[i];
-			b_util->matching = i;
+	for (i = 0; i < m.a_nr; i++)
+		if (a2b[i] >= 0 && a2b[i] < m.b_nr) {
+			m.a[i]->matching = b_index[a2b[i]];
+			m.b[a2b[i]]->matching = a_index[i];
 		}
 
-	free(cost);
+	free(m.cost);
 	free(a2b);
 	free(b2a);
+out:
+	free(m.a);
+	free(m.b);
+	free(a_index);
+	free(b_index);
 }
 
 static void output_pair_header(struct diff_options *diffopt,
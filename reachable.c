@@ -13,6 +13,7 @@
 #include "worktree.h"
 #include "object-store.h"
 #include "pack-bitmap.h"
+#include "pack-mtimes.h"
 
 struct connectivity_progress {
 	struct progress *progress;
@@ -60,8 +61,18 @@ static void mark_commit(struct commit *c, void *data)
 struct recent_data {
 	struct rev_info *revs;
 	timestamp_t timestamp;
+	int ignore_in_core_kept_packs;
 };
 
+static int want_recent_object(struct recent_data *data,
+			      const struct object_id *oid)
+{
+	if (data->ignore_in_core_kept_packs &&
+	    has_object_kept_pack(oid, IN_CORE_KEEP_PACKS))
+		return 0;
+	return 1;
+}
+
 static void add_recent_object(const struct object_id *oid,
 			      timestamp_t mtime,
 			      struct recent_data *data)
@@ -113,6 +124,8 @@ static int add_recent_loose(const struct object_id *oid,
 
 	if (obj && obj->flags & SEEN)
 		return 0;
+	if (!want_recent_object(data, oid))
+		return 0;
 
 	if (stat(path, &st) < 0) {
 		/*
@@ -135,21 +148,31 @@ static int add_recent_packed(const struct object_id *oid,
 			     void *data)
 {
 	struct object *obj = lookup_object(the_repository, oid);
+	timestamp_t mtime = p->mtime;
 
 	if (obj && obj->flags & SEEN)
 		return 0;
-	add_recent_object(oid, p->mtime, data);
+	if (!want_recent_object(data, oid))
+		return 0;
+	if (p->is_cruft) {
+		if (load_pack_mtimes(p) < 0)
+			die(_("could not load cruft pack .mtimes"));
+		mtime = nth_packed_mtime(p, pos);
+	}
+	add_recent_object(oid, mtime, data);
 	return 0;
 }
 
 int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
-					   timestamp_t timestamp)
+					   timestamp_t timestamp,
+					   int ignore_in_core_kept_packs)
 {
 	struct recent_data data;
 	int r;
 
 	data.revs = revs;
 	data.timestamp = timestamp;
+	data.ignore_in_core_kept_packs = ignore_in_core_kept_packs;
 
 	r = for_each_loose_object(add_recent_loose, &data,
 				  FOR_EACH_OBJECT_LOCAL_ONLY);
@@ -217,7 +240,7 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 
 	if (mark_recent) {
 		revs->ignore_missing_links = 1;
-		if (add_unseen_recent_objects_to_traversal(revs, mark_recent))
+		if (add_unseen_recent_objects_to_traversal(revs, mark_recent, 0))
 			die("unable to mark recent objects");
 		if (prepare_revision_walk(revs))
 			die("revision walk setup failed");
@@ -4,8 +4,14 @@
 struct progress;
 struct rev_info;
 
+/*
+ * Add the objects modified after "timestamp" that the traversal has
+ * not seen yet to its pending list.  With "ignore_in_core_kept_packs",
+ * objects in packs kept in-core are left out.
+ */
 int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
-					   timestamp_t timestamp);
+					   timestamp_t timestamp,
+					   int ignore_in_core_kept_packs);
 void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 			    timestamp_t mark_recent, struct progress *);
 
@@ -1584,6 +1584,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	 * cache entries quickly then in the single threaded loop below,
 	 * we only have to do the special cases that are left.
 	 */
+	enable_fscache();
 	preload_index(istate, pathspec, 0);
 	trace2_region_enter("index", "refresh", NULL);
 
@@ -1670,6 +1671,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	trace2_data_intmax("index", NULL, "refresh/sum_lstat", t2_sum_lstat);
 	trace2_data_intmax("index", NULL, "refresh/sum_scan", t2_sum_scan);
 	trace2_region_leave("index", "refresh", NULL);
+	disable_fscache();
 	display_progress(progress, istate->cache_nr);
 	stop_progress(&progress);
 	trace_performance_leave("refresh index");
@@ -2105,7 +2107,7 @@ struct load_cache_entries_thread_data
 {
 	pthread_t pthread;
 	struct index_state *istate;
-	struct mem_pool *ce_mem_pool;
+	struct mem_pool_set *ce_mem_pools;
 	int offset;
 	const char *mmap;
 	struct index_entry_offset_table *ieot;
@@ -2121,11 +2123,12 @@ struct load_cache_entries_thread_data
 static void *load_cache_entries_thread(void *_data)
 {
 	struct load_cache_entries_thread_data *p = _data;
+	struct mem_pool *ce_mem_pool = mem_pool_set_get(p->ce_mem_pools);
 	int i;
 
 	/* iterate across all ieot blocks assigned to this thread */
 	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
-		p->consumed += load_cache_entry_block(p->istate, p->ce_mem_pool,
+		p->consumed += load_cache_entry_block(p->istate, ce_mem_pool,
 			p->offset, p->ieot->entries[i].nr, p->mmap, p->ieot->entries[i].offset, NULL);
 		p->offset += p->ieot->entries[i].nr;
 	}
@@ -2137,6 +2140,7 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 {
 	int i, offset, ieot_blocks, ieot_start, err;
 	struct load_cache_entries_thread_data *data;
+	struct mem_pool_set ce_mem_pools;
 	unsigned long consumed = 0;
 
 	/* a little sanity checking */
@@ -2151,35 +2155,31 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 		nr_threads = ieot->nr;
 	CALLOC_ARRAY(data, nr_threads);
 
+	/* each thread allocates from a mem_pool of its own */
+	if (istate->version == 4)
+		mem_pool_set_init(&ce_mem_pools,
+			estimate_cache_size_from_compressed(istate->cache_nr / nr_threads));
+	else
+		mem_pool_set_init(&ce_mem_pools,
+			estimate_cache_size(mmap_size / nr_threads, istate->cache_nr / nr_threads));
+
 	offset = ieot_start = 0;
 	ieot_blocks = DIV_ROUND_UP(ieot->nr, nr_threads);
 	for (i = 0; i < nr_threads; i++) {
 		struct load_cache_entries_thread_data *p = &data[i];
-		int nr, j;
+		int j;
 
 		if (ieot_start + ieot_blocks > ieot->nr)
 			ieot_blocks = ieot->nr - ieot_start;
 
 		p->istate = istate;
+		p->ce_mem_pools = &ce_mem_pools;
 		p->offset = offset;
 		p->mmap = mmap;
 		p->ieot = ieot;
 		p->ieot_start = ieot_start;
 		p->ieot_blocks = ieot_blocks;
 
-		/* create a mem_pool for each thread */
-		nr = 0;
-		for (j = p->ieot_start; j < p->ieot_start + p->ieot_blocks; j++)
-			nr += p->ieot->entries[j].nr;
-		p->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
-		if (istate->version == 4) {
-			mem_pool_init(p->ce_mem_pool,
-				estimate_cache_size_from_compressed(nr));
-		} else {
-			mem_pool_init(p->ce_mem_pool,
-				estimate_cache_size(mmap_size, nr));
-		}
-
 		err = pthread_create(&p->pthread, NULL, load_cache_entries_thread, p);
 		if (err)
 			die(_("unable to create load_cache_entries thread: %s"), strerror(err));
@@ -2196,9 +2196,9 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 		err = pthread_join(p->pthread, NULL);
 		if (err)
 			die(_("unable to join load_cache_entries thread: %s"), strerror(err));
-		mem_pool_combine(istate->ce_mem_pool, p->ce_mem_pool);
 		consumed += p->consumed;
 	}
+	mem_pool_set_combine(istate->ce_mem_pool, &ce_mem_pools);
 
 	free(data);
 
@@ -2407,6 +2407,197 @@ int read_index_from(struct index_state *istate, const char *path,
 	return ret;
 }
 
+/*
+ * Find out the name of the on-disk entry "ondisk" and how many bytes
+ * it takes up, without creating a cache_entry for it. For index v4,
+ * "previous" is the name of the entry before it, or NULL at the start
+ * of a block of the offset table.
+ */
+static unsigned long skim_ondisk_entry(unsigned int version,
+				       const struct ondisk_cache_entry *ondisk,
+				       const struct strbuf *previous,
+				       struct strbuf *name)
+{
+	const uint16_t *flagsp =
+		(const uint16_t *)(ondisk->data + the_hash_algo->rawsz);
+	unsigned int flags = get_be16(flagsp);
+	const char *p = (const char *)(flagsp + ((flags & CE_EXTENDED) ? 2 : 1));
+	size_t len;
+
+	strbuf_reset(name);
+	if (version == 4) {
+		const unsigned char *cp = (const unsigned char *)p;
+		size_t strip_len = decode_varint(&cp);
+
+		if (previous) {
+			if (previous->len < strip_len)
+				die(_("malformed name field in the index, near path '%s'"),
+				    previous->buf);
+			strbuf_add(name, previous->buf, previous->len - strip_len);
+		}
+		p = (const char *)cp;
+		len = strlen(p);
+		strbuf_add(name, p, len);
+		return p + len + 1 - (const char *)ondisk;
+	}
+
+	len = flags & CE_NAMEMASK;
+	if (len == CE_NAMEMASK)
+		len = strlen(p);
+	strbuf_add(name, p, len);
+	return ondisk_cache_entry_size(ondisk_data_size(flags, len));
+}
+
+/*
+ * Extensions whose name starts with a lowercase letter change what
+ * the entries mean and cannot be ignored.
+ */
+static int has_required_extension(const char *mmap, size_t mmap_size,
+				  size_t offset)
+{
+	while (offset <= mmap_size - the_hash_algo->rawsz - 8) {
+		if (!isupper(mmap[offset]))
+			return 1;
+		offset += 8 + get_be32(mmap + offset + 4);
+	}
+	return 0;
+}
+
+int read_index_prefix_from(struct index_state *istate, const char *path,
+			   const char *prefix, size_t prefix_len)
+{
+	int fd;
+	struct stat st;
+	const struct cache_header *hdr;
+	const char *mmap;
+	size_t mmap_size, extension_offset;
+	unsigned long src_offset;
+	unsigned int version, i, nr;
+	struct index_entry_offset_table *ieot = NULL;
+	struct strbuf previous = STRBUF_INIT, name = STRBUF_INIT;
+	struct cache_entry *previous_ce = NULL;
+	int ret = -1;
+
+	if (istate->initialized)
+		return istate->cache_nr;
+
+	/* Leave all kinds of trouble to do_read_index() */
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	mmap_size = xsize_t(st.st_size);
+	if (mmap_size < sizeof(struct cache_header) + the_hash_algo->rawsz) {
+		close(fd);
+		return -1;
+	}
+	mmap = xmmap_gently(NULL, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mmap == MAP_FAILED)
+		return -1;
+
+	hdr = (const struct cache_header *)mmap;
+	if (verify_hdr(hdr, mmap_size) < 0)
+		goto out;
+	version = ntohl(hdr->hdr_version);
+	nr = ntohl(hdr->hdr_entries);
+	src_offset = sizeof(*hdr);
+
+	/*
+	 * Knowing where the extensions are lets us check them up front,
+	 * and stop as soon as we are past the prefix.
+	 */
+	extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (extension_offset) {
+		if (has_required_extension(mmap, mmap_size, extension_offset))
+			goto out;
+		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
+	}
+
+	/* Jump to the last block starting before the prefix */
+	if (ieot) {
+		for (i = 1; i < ieot->nr; i++) {
+			skim_ondisk_entry(version,
+					  (const struct ondisk_cache_entry *)
+					  (mmap + ieot->entries[i].offset),
+					  NULL, &name);
+			if (strncmp(name.buf, prefix, prefix_len) >= 0)
+				break;
+			src_offset = ieot->entries[i].offset;
+			nr -= ieot->entries[i - 1].nr;
+		}
+	}
+
+	istate->version = version;
+	istate->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
+	mem_pool_init(istate->ce_mem_pool, 0);
+
+	for (i = 0; i < nr; i++) {
+		const struct ondisk_cache_entry *ondisk =
+			(const struct ondisk_cache_entry *)(mmap + src_offset);
+		unsigned long consumed;
+		int cmp;
+
+		consumed = skim_ondisk_entry(version, ondisk,
+					     i ? &previous : NULL, &name);
+		cmp = strncmp(name.buf, prefix, prefix_len);
+		if (cmp > 0 && extension_offset)
+			break;
+		if (!cmp) {
+			struct cache_entry *ce;
+
+			/*
+			 * For index v4, create_from_disk() wants the name
+			 * of the entry before, which we may have skipped.
+			 */
+			if (version == 4 && i && !previous_ce) {
+				previous_ce = mem_pool__ce_alloc(istate->ce_mem_pool,
+								 previous.len);
+				memcpy(previous_ce->name, previous.buf,
+				       previous.len + 1);
+				previous_ce->ce_namelen = previous.len;
+			}
+			ce = create_from_disk(istate->ce_mem_pool, version,
+					      (struct ondisk_cache_entry *)ondisk,
+					      &consumed, previous_ce);
+			ALLOC_GROW(istate->cache, istate->cache_nr + 1,
+				   istate->cache_alloc);
+			set_index_entry(istate, istate->cache_nr++, ce);
+			previous_ce = ce;
+		} else {
+			previous_ce = NULL;
+		}
+		src_offset += consumed;
+		strbuf_swap(&previous, &name);
+	}
+
+	if (!extension_offset &&
+	    has_required_extension(mmap, mmap_size, src_offset)) {
+		discard_index(istate);
+		goto out;
+	}
+
+	oidread(&istate->oid, (const unsigned char *)hdr + mmap_size - the_hash_algo->rawsz);
+	istate->timestamp.sec = st.st_mtime;
+	istate->timestamp.nsec = ST_MTIME_NSEC(st);
+	istate->initialized = 1;
+	istate->partially_read = 1;
+	ret = istate->cache_nr;
+
+	trace2_data_intmax("index", the_repository, "read/prefix_cache_nr",
+			   istate->cache_nr);
+
+out:
+	free(ieot);
+	strbuf_release(&previous);
+	strbuf_release(&name);
+	munmap((void *)mmap, mmap_size);
+	return ret;
+}
+
 int is_index_unborn(struct index_state *istate)
 {
 	return (!istate->cache_nr && !istate->timestamp.sec);
@@ -2431,6 +2622,7 @@ int discard_index(struct index_state *istate)
 	free_name_hash(istate);
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
+	istate->partially_read = 0;
 	istate->fsmonitor_has_run_once = 0;
 	FREE_AND_NULL(istate->fsmonitor_last_update);
 	FREE_AND_NULL(istate->cache);
@@ -2623,7 +2815,21 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
+/*
+ * Write to "f", or, when there is no hashfile (as in the threads of
+ * write_entries_threaded()), append to "sb".
+ */
+static void ce_write(struct hashfile *f, struct strbuf *sb,
+		     const void *data, unsigned int len)
+{
+	if (f)
+		hashwrite(f, data, len);
+	else
+		strbuf_add(sb, data, len);
+}
+
+static int ce_write_entry(struct hashfile *f, struct strbuf *sb,
+			  struct cache_entry *ce,
 			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
 {
 	int size;
@@ -2642,9 +2848,9 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, ce->name, len);
-		hashwrite(f, padding, align_padding_size(size, len));
+		ce_write(f, sb, ondisk, size);
+		ce_write(f, sb, ce->name, len);
+		ce_write(f, sb, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2658,10 +2864,10 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, to_remove_vi, prefix_size);
-		hashwrite(f, ce->name + common, ce_namelen(ce) - common);
-		hashwrite(f, padding, 1);
+		ce_write(f, sb, ondisk, size);
+		ce_write(f, sb, to_remove_vi, prefix_size);
+		ce_write(f, sb, ce->name + common, ce_namelen(ce) - common);
+		ce_write(f, sb, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2772,6 +2978,223 @@ static int record_ieot(void)
 	return !git_config_get_index_threads(&val) && val != 1;
 }
 
+/*
+ * With an offset table, the entries can be serialized by several
+ * threads: the blocks it describes start from scratch, so the only
+ * state an entry depends on is the name of the one written before it
+ * (for the prefix compression of index v4), which we can tell ahead
+ * of time. The entries are cut into chunks, none of them straddling
+ * a block boundary, which the threads serialize into buffers of their
+ * own, while this thread hashes and writes out the finished ones in
+ * order.
+ */
+#define WRITE_CHUNK_ENTRIES 4096
+
+struct write_chunk {
+	int start, end;
+	/* the first entry of "start" begins a new offset table block */
+	int block_start;
+	/* name of the last entry written before "start", if any */
+	const char *previous_name;
+};
+
+struct write_chunk_buf {
+	struct strbuf sb;
+	int nr;
+	int full;
+};
+
+struct write_entries_data {
+	struct index_state *istate;
+	struct write_chunk *chunks;
+	int nr_chunks, nr_threads;
+	int v4;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct write_entries_worker {
+	pthread_t thread;
+	struct write_entries_data *data;
+	int id;
+	/* one buffer is written out while the other one is filled */
+	struct write_chunk_buf buf[2];
+};
+
+static void *write_entries_thread(void *arg)
+{
+	struct write_entries_worker *w = arg;
+	struct write_entries_data *d = w->data;
+	struct strbuf previous_name = STRBUF_INIT;
+	struct ondisk_cache_entry ondisk;
+	int c, n;
+
+	for (c = w->id, n = 0; c < d->nr_chunks; c += d->nr_threads, n++) {
+		struct write_chunk *chunk = &d->chunks[c];
+		struct write_chunk_buf *buf = &w->buf[n % 2];
+		int i;
+
+		pthread_mutex_lock(&d->mutex);
+		while (buf->full)
+			pthread_cond_wait(&d->cond, &d->mutex);
+		pthread_mutex_unlock(&d->mutex);
+
+		strbuf_reset(&buf->sb);
+		buf->nr = 0;
+		strbuf_reset(&previous_name);
+		if (chunk->previous_name)
+			strbuf_addstr(&previous_name, chunk->previous_name);
+		/* see the corresponding code in do_write_index() */
+		if (chunk->block_start && previous_name.len)
+			previous_name.buf[0] = 0;
+
+		for (i = chunk->start; i < chunk->end; i++) {
+			struct cache_entry *ce = d->istate->cache[i];
+
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			ce_write_entry(NULL, &buf->sb, ce,
+				       d->v4 ? &previous_name : NULL, &ondisk);
+			buf->nr++;
+		}
+
+		pthread_mutex_lock(&d->mutex);
+		buf->full = 1;
+		pthread_cond_broadcast(&d->cond);
+		pthread_mutex_unlock(&d->mutex);
+	}
+
+	strbuf_release(&previous_name);
+	return NULL;
+}
+
+static int write_entries_threaded(struct index_state *istate,
+				  struct hashfile *f, int v4,
+				  struct index_entry_offset_table *ieot,
+				  int ieot_entries, int nr_threads,
+				  int *drop_cache_tree)
+{
+	struct write_entries_data d = { 0 };
+	struct write_entries_worker *workers;
+	const char *previous_name = NULL;
+	off_t offset = hashfile_total(f);
+	int i, c, nr = 0, err = 0;
+
+	/*
+	 * Do what might need to look at the worktree or complain up
+	 * front, so that the threads only have to serialize.
+	 */
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(istate, ce);
+		if (is_null_oid(&ce->oid)) {
+			static const char msg[] = "cache entry has null sha1: %s";
+			static int allow = -1;
+
+			if (allow < 0)
+				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
+			if (allow)
+				warning(msg, ce->name);
+			else
+				return error(msg, ce->name);
+
+			*drop_cache_tree = 1;
+		}
+	}
+
+	d.istate = istate;
+	d.v4 = v4;
+	ALLOC_ARRAY(d.chunks,
+		    DIV_ROUND_UP(istate->cache_nr, WRITE_CHUNK_ENTRIES) +
+		    DIV_ROUND_UP(istate->cache_nr, ieot_entries));
+	for (i = 0; i < istate->cache_nr; ) {
+		struct write_chunk *chunk = &d.chunks[d.nr_chunks++];
+		int block_end = (i / ieot_entries + 1) * ieot_entries;
+
+		chunk->start = i;
+		chunk->end = i + WRITE_CHUNK_ENTRIES;
+		if (chunk->end > block_end)
+			chunk->end = block_end;
+		if (chunk->end > istate->cache_nr)
+			chunk->end = istate->cache_nr;
+		/* like in do_write_index(), removed entries start no block */
+		chunk->block_start = i && !(i % ieot_entries) &&
+			!(istate->cache[i]->ce_flags & CE_REMOVE);
+		chunk->previous_name = previous_name;
+
+		for (; i < chunk->end; i++)
+			if (!(istate->cache[i]->ce_flags & CE_REMOVE))
+				previous_name = istate->cache[i]->name;
+	}
+
+	if (nr_threads > d.nr_chunks)
+		nr_threads = d.nr_chunks;
+	d.nr_threads = nr_threads;
+	pthread_mutex_init(&d.mutex, NULL);
+	pthread_cond_init(&d.cond, NULL);
+
+	CALLOC_ARRAY(workers, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		struct write_entries_worker *w = &workers[i];
+
+		w->data = &d;
+		w->id = i;
+		strbuf_init(&w->buf[0].sb, 0);
+		strbuf_init(&w->buf[1].sb, 0);
+		err = pthread_create(&w->thread, NULL, write_entries_thread, w);
+		if (err)
+			die(_("unable to create write_entries thread: %s"),
+			    strerror(err));
+	}
+
+	for (c = 0; c < d.nr_chunks; c++) {
+		struct write_chunk_buf *buf =
+			&workers[c % nr_threads].buf[(c / nr_threads) % 2];
+
+		pthread_mutex_lock(&d.mutex);
+		while (!buf->full)
+			pthread_cond_wait(&d.cond, &d.mutex);
+		pthread_mutex_unlock(&d.mutex);
+
+		if (d.chunks[c].block_start) {
+			ieot->entries[ieot->nr].nr = nr;
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->nr++;
+			nr = 0;
+			offset = hashfile_total(f);
+		}
+		hashwrite(f, buf->sb.buf, buf->sb.len);
+		nr += buf->nr;
+
+		pthread_mutex_lock(&d.mutex);
+		buf->full = 0;
+		pthread_cond_broadcast(&d.cond);
+		pthread_mutex_unlock(&d.mutex);
+	}
+	if (nr) {
+		ieot->entries[ieot->nr].nr = nr;
+		ieot->entries[ieot->nr].offset = offset;
+		ieot->nr++;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		err = pthread_join(workers[i].thread, NULL);
+		if (err)
+			die(_("unable to join write_entries thread: %s"),
+			    strerror(err));
+		strbuf_release(&workers[i].buf[0].sb);
+		strbuf_release(&workers[i].buf[1].sb);
+	}
+	free(workers);
+	free(d.chunks);
+	pthread_cond_destroy(&d.cond);
+	pthread_mutex_destroy(&d.mutex);
+	return 0;
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2786,7 +3209,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct hashfile *f;
 	git_hash_ctx *eoie_c = NULL;
 	struct cache_header hdr;
-	int i, err = 0, removed, extended, hdr_version;
+	int i, err = 0, removed, extended, stripped, hdr_version;
 	struct cache_entry **cache = istate->cache;
 	int entries = istate->cache_nr;
 	struct stat st;
@@ -2794,15 +3217,20 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 	int drop_cache_tree = istate->drop_cache_tree;
 	off_t offset;
-	int ieot_entries = 1;
+	int ieot_entries = 1, ieot_blocks = 1;
 	struct index_entry_offset_table *ieot = NULL;
 	int nr, nr_threads;
 
+	if (istate->partially_read)
+		BUG("cannot write a partially read index");
+
 	f = hashfd(tempfile->fd, tempfile->filename.buf);
 
-	for (i = removed = extended = 0; i < entries; i++) {
+	for (i = removed = extended = stripped = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
 			removed++;
+		if (cache[i]->ce_flags & CE_STRIP_NAME)
+			stripped++;
 
 		/* reduce extended entries if possible */
 		cache[i]->ce_flags &= ~CE_EXTENDED;
@@ -2834,7 +3262,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		nr_threads = 1;
 
 	if (nr_threads != 1 && record_ieot()) {
-		int ieot_blocks, cpus;
+		int cpus;
 
 		/*
 		 * ensure default number of ieot blocks maps evenly to the
@@ -2868,51 +3296,61 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	nr = 0;
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 
-	for (i = 0; i < entries; i++) {
-		struct cache_entry *ce = cache[i];
-		if (ce->ce_flags & CE_REMOVE)
-			continue;
-		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
-			ce_smudge_racily_clean_entry(istate, ce);
-		if (is_null_oid(&ce->oid)) {
-			static const char msg[] = "cache entry has null sha1: %s";
-			static int allow = -1;
+	/*
+	 * The threads serialize the entries as they are; entries whose
+	 * name is to be stripped are left to the loop below.
+	 */
+	if (ieot && !stripped) {
+		err = write_entries_threaded(istate, f, hdr_version == 4, ieot,
+					     ieot_entries, ieot_blocks,
+					     &drop_cache_tree);
+	} else {
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+				ce_smudge_racily_clean_entry(istate, ce);
+			if (is_null_oid(&ce->oid)) {
+				static const char msg[] = "cache entry has null sha1: %s";
+				static int allow = -1;
+
+				if (allow < 0)
+					allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
+				if (allow)
+					warning(msg, ce->name);
+				else
+					err = error(msg, ce->name);
+
+				drop_cache_tree = 1;
+			}
+			if (ieot && i && (i % ieot_entries == 0)) {
+				ieot->entries[ieot->nr].nr = nr;
+				ieot->entries[ieot->nr].offset = offset;
+				ieot->nr++;
+				/*
+				 * If we have a V4 index, set the first byte to an invalid
+				 * character to ensure there is nothing common with the previous
+				 * entry
+				 */
+				if (previous_name)
+					previous_name->buf[0] = 0;
+				nr = 0;
 
-			if (allow < 0)
-				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
-			if (allow)
-				warning(msg, ce->name);
-			else
-				err = error(msg, ce->name);
+				offset = hashfile_total(f);
+			}
+			if (ce_write_entry(f, NULL, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
+				err = -1;
 
-			drop_cache_tree = 1;
+			if (err)
+				break;
+			nr++;
 		}
-		if (ieot && i && (i % ieot_entries == 0)) {
+		if (ieot && nr) {
 			ieot->entries[ieot->nr].nr = nr;
 			ieot->entries[ieot->nr].offset = offset;
 			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
-			nr = 0;
-
-			offset = hashfile_total(f);
 		}
-		if (ce_write_entry(f, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
-
-		if (err)
-			break;
-		nr++;
-	}
-	if (ieot && nr) {
-		ieot->entries[ieot->nr].nr = nr;
-		ieot->entries[ieot->nr].offset = offset;
-		ieot->nr++;
 	}
 	strbuf_release(&previous_name_buf);
 
@@ -3212,7 +3650,7 @@ static int write_shared_index(struct index_state *istate,
 
 static const int default_max_percent_split_change = 20;
 
-static int too_many_not_shared_entries(struct index_state *istate)
+int too_many_not_shared_entries(struct index_state *istate)
 {
 	int i, not_shared = 0;
 	int max_split = git_config_get_max_percent_split_change();
@@ -3271,8 +3709,19 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		if ((v & 15) < 6)
 			istate->cache_changed |= SPLIT_INDEX_ORDERED;
 	}
-	if (too_many_not_shared_entries(istate))
-		istate->cache_changed |= SPLIT_INDEX_ORDERED;
+	if (!(istate->cache_changed & SPLIT_INDEX_ORDERED) &&
+	    too_many_not_shared_entries(istate)) {
+		/*
+		 * Writing a new shared index means writing all the entries;
+		 * leave it to "git maintenance" if asked to, and write the
+		 * (oversized) split index only.
+		 */
+		if (git_config_get_defer_shared_index())
+			trace2_data_intmax("index", the_repository,
+					   "split/deferred_shared_index", 1);
+		else
+			istate->cache_changed |= SPLIT_INDEX_ORDERED;
+	}
 
 	new_shared_index = istate->cache_changed & SPLIT_INDEX_ORDERED;
 
@@ -3380,13 +3829,10 @@ int index_name_is_other(struct index_state *istate, const char *name,
 	return 1;
 }
 
-void *read_blob_data_from_index(struct index_state *istate,
-				const char *path, unsigned long *size)
+const struct object_id *blob_oid_from_index(struct index_state *istate,
+					    const char *path)
 {
 	int pos, len;
-	unsigned long sz;
-	enum object_type type;
-	void *data;
 
 	len = strlen(path);
 	pos = index_name_pos(istate, path, len);
@@ -3405,7 +3851,20 @@ void *read_blob_data_from_index(struct index_state *istate,
 	}
 	if (pos < 0)
 		return NULL;
-	data = read_object_file(&istate->cache[pos]->oid, &type, &sz);
+	return &istate->cache[pos]->oid;
+}
+
+void *read_blob_data_from_index(struct index_state *istate,
+				const char *path, unsigned long *size)
+{
+	const struct object_id *oid = blob_oid_from_index(istate, path);
+	unsigned long sz;
+	enum object_type type;
+	void *data;
+
+	if (!oid)
+		return NULL;
+	data = read_object_file(oid, &type, &sz);
 	if (!data || type != OBJ_BLOB) {
 		free(data);
 		return NULL;
@@ -147,6 +147,7 @@ enum atom_type {
 	ATOM_RAW,
 	ATOM_UPSTREAM,
 	ATOM_PUSH,
+	ATOM_AHEADBEHIND,
 	ATOM_SYMREF,
 	ATOM_FLAG,
 	ATOM_HEAD,
@@ -175,6 +176,8 @@ static struct used_atom {
 	const char *name;
 	cmp_type type;
 	info_source source;
+	/* only used as a sort key, never shown by the format */
+	unsigned int sort_only : 1;
 	union {
 		char color[COLOR_MAXLEN];
 		struct align align;
@@ -210,9 +213,14 @@ static struct used_atom {
 		} email_option;
 		struct refname_atom refname;
 		char *head;
+		struct {
+			struct commit *base;
+			/* index among the bases of all ahead-behind atoms */
+			int nth;
+		} ahead_behind;
 	} u;
 } *used_atom;
-static int used_atom_cnt, need_tagged, need_symref;
+static int used_atom_cnt, need_tagged, need_symref, ahead_behind_bases;
 
 /*
  * Expand string, append it to strbuf *sb, then return error code ret.
@@ -577,6 +585,18 @@ static int head_atom_parser(struct ref_format *format, struct used_atom *atom,
 	return 0;
 }
 
+static int ahead_behind_atom_parser(struct ref_format *format, struct used_atom *atom,
+				    const char *arg, struct strbuf *err)
+{
+	if (!arg)
+		return strbuf_addf_ret(err, -1, _("expected format: %%(ahead-behind:<committish>)"));
+	atom->u.ahead_behind.base = lookup_commit_reference_by_name(arg);
+	if (!atom->u.ahead_behind.base)
+		return strbuf_addf_ret(err, -1, _("failed to find '%s'"), arg);
+	atom->u.ahead_behind.nth = ahead_behind_bases++;
+	return 0;
+}
+
 static struct {
 	const char *name;
 	info_source source;
@@ -616,6 +636,7 @@ static struct {
 	[ATOM_RAW] = { "raw", SOURCE_OBJ, FIELD_STR, raw_atom_parser },
 	[ATOM_UPSTREAM] = { "upstream", SOURCE_NONE, FIELD_STR, remote_ref_atom_parser },
 	[ATOM_PUSH] = { "push", SOURCE_NONE, FIELD_STR, remote_ref_atom_parser },
+	[ATOM_AHEADBEHIND] = { "ahead-behind", SOURCE_NONE, FIELD_STR, ahead_behind_atom_parser },
 	[ATOM_SYMREF] = { "symref", SOURCE_NONE, FIELD_STR, refname_atom_parser },
 	[ATOM_FLAG] = { "flag", SOURCE_NONE },
 	[ATOM_HEAD] = { "HEAD", SOURCE_NONE, FIELD_STR, head_atom_parser },
@@ -692,8 +713,10 @@ static int parse_ref_filter_atom(struct ref_format *format,
 	/* Do we have the atom already used elsewhere? */
 	for (i = 0; i < used_atom_cnt; i++) {
 		int len = strlen(used_atom[i].name);
-		if (len == ep - atom && !memcmp(used_atom[i].name, atom, len))
+		if (len == ep - atom && !memcmp(used_atom[i].name, atom, len)) {
+			used_atom[i].sort_only = 0;
 			return i;
+		}
 	}
 
 	/* Is the atom a valid one? */
@@ -719,6 +742,7 @@ static int parse_ref_filter_atom(struct ref_format *format,
 	used_atom[at].name = xmemdupz(atom, ep - atom);
 	used_atom[at].type = valid_atom[i].cmp_type;
 	used_atom[at].source = valid_atom[i].source;
+	used_atom[at].sort_only = 0;
 	if (used_atom[at].source == SOURCE_OBJ) {
 		if (*atom == '*')
 			oi_deref.info.contentp = &oi_deref.content;
@@ -1013,9 +1037,53 @@ static int reject_atom(enum atom_type atom_type)
  * Make sure the format string is well formed, and parse out
  * the used atoms.
  */
+/*
+ * The format split into the literal text before each atom, with "%%"
+ * and "%xx" already unquoted, and the atom, so that formatting each ref
+ * does not have to parse the format again.
+ */
+struct ref_format_step {
+	size_t literal_off, literal_len;
+	int atom; /* index into used_atom[], or -1 for the final literal */
+};
+
+struct ref_format_program {
+	const char *format; /* what it was compiled from */
+	struct strbuf literals;
+	struct ref_format_step *step;
+	size_t nr, alloc;
+};
+
+static void append_literal(const char *cp, const char *ep, struct strbuf *s);
+
+static void add_format_step(struct ref_format_program *p,
+			    const char *cp, const char *ep, int atom)
+{
+	ALLOC_GROW(p->step, p->nr + 1, p->alloc);
+	p->step[p->nr].literal_off = p->literals.len;
+	append_literal(cp, ep, &p->literals);
+	p->step[p->nr].literal_len = p->literals.len - p->step[p->nr].literal_off;
+	p->step[p->nr].atom = atom;
+	p->nr++;
+}
+
+static void free_format_program(struct ref_format_program *p)
+{
+	if (!p)
+		return;
+	strbuf_release(&p->literals);
+	free(p->step);
+	free(p);
+}
+
 int verify_ref_format(struct ref_format *format)
 {
 	const char *cp, *sp;
+	struct ref_format_program *program;
+
+	CALLOC_ARRAY(program, 1);
+	program->format = format->format;
+	strbuf_init(&program->literals, 0);
 
 	format->need_color_reset_at_eol = 0;
 	for (cp = format->format; *cp && (sp = find_next(cp)); ) {
@@ -1023,12 +1091,15 @@ int verify_ref_format(struct ref_format *format)
 		const char *color, *ep = strchr(sp, ')');
 		int at;
 
-		if (!ep)
+		if (!ep) {
+			free_format_program(program);
 			return error(_("malformed format string %s"), sp);
+		}
 		/* sp points at "%(" and ep points at the closing ")" */
 		at = parse_ref_filter_atom(format, sp + 2, ep, &err);
 		if (at < 0)
 			die("%s", err.buf);
+		add_format_step(program, cp, sp, at);
 		if (reject_atom(used_atom[at].atom_type))
 			die(_("this command reject atom %%(%.*s)"), (int)(ep - sp - 2), sp + 2);
 
@@ -1045,6 +1116,10 @@ int verify_ref_format(struct ref_format *format)
 			format->need_color_reset_at_eol = !!strcmp(color, "reset");
 		strbuf_release(&err);
 	}
+	add_format_step(program, cp, NULL, -1);
+	free_format_program(format->program);
+	format->program = program;
+
 	if (format->need_color_reset_at_eol && !want_color(format->use_color))
 		format->need_color_reset_at_eol = 0;
 	return 0;
@@ -1245,13 +1320,8 @@ static char *copy_subject(const char *buf, unsigned long len)
 	return strbuf_detach(&sb, NULL);
 }
 
-static void grab_date(const char *buf, struct atom_value *v, const char *atomname)
+static void get_date_mode(const char *atomname, struct date_mode *date_mode)
 {
-	const char *eoemail = strstr(buf, "> ");
-	char *zone;
-	timestamp_t timestamp;
-	long tz;
-	struct date_mode date_mode = { DATE_NORMAL };
 	const char *formatp;
 
 	/*
@@ -1260,12 +1330,23 @@ static void grab_date(const char *buf, struct atom_value *v, const char *atomnam
 	 * parse_ref_filter_atom() wouldn't have allowed it, so we can assume that no
 	 * ":" means no format is specified, and use the default.
 	 */
+	date_mode->type = DATE_NORMAL;
 	formatp = strchr(atomname, ':');
 	if (formatp != NULL) {
 		formatp++;
-		parse_date_format(formatp, &date_mode);
+		parse_date_format(formatp, date_mode);
 	}
+}
+
+static void grab_date(const char *buf, struct atom_value *v, const char *atomname)
+{
+	const char *eoemail = strstr(buf, "> ");
+	char *zone;
+	timestamp_t timestamp;
+	long tz;
+	struct date_mode date_mode = { DATE_NORMAL };
 
+	get_date_mode(atomname, &date_mode);
 	if (!eoemail)
 		goto bad;
 	timestamp = parse_timestamp(eoemail + 2, &zone, 10);
@@ -1818,6 +1899,93 @@ static char *get_worktree_path(const struct used_atom *atom, const struct ref_ar
 	return xstrdup(lookup_result->wt->path);
 }
 
+/*
+ * Can the values of the object atoms in use be filled from the
+ * commit-graph alone when the ref points at a commit in there?  It
+ * records the committer date but not its timezone, so dates can only
+ * be taken from there when they are sort keys or shown in a format
+ * that ignores the timezone.  Deref atoms are left empty for a commit.
+ */
+static int date_atom_needs_tz(const char *atomname)
+{
+	struct date_mode date_mode = { DATE_NORMAL };
+
+	get_date_mode(atomname, &date_mode);
+	return !date_mode.local &&
+	       date_mode.type != DATE_UNIX &&
+	       date_mode.type != DATE_RELATIVE;
+}
+
+static int can_use_commit_graph(void)
+{
+	int i;
+
+	for (i = 0; i < used_atom_cnt; i++) {
+		struct used_atom *atom = &used_atom[i];
+
+		if (atom->source == SOURCE_NONE || *atom->name == '*')
+			continue;
+		switch (atom->atom_type) {
+		case ATOM_OBJECTNAME:
+		case ATOM_OBJECTTYPE:
+			continue;
+		case ATOM_COMMITTERDATE:
+		case ATOM_CREATORDATE:
+			if (atom->sort_only || !date_atom_needs_tz(atom->name))
+				continue;
+			return 0;
+		default:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Fill the values of the object atoms from the commit-graph without
+ * reading the object; returns 0 if the ref does not point at a commit
+ * found there, in which case the object has to be read.
+ */
+static int populate_value_from_graph(struct ref_array_item *ref)
+{
+	struct commit *commit;
+	int i;
+
+	if (!can_use_commit_graph())
+		return 0;
+	commit = lookup_commit_in_graph(the_repository, &ref->objectname);
+	if (!commit)
+		return 0;
+
+	for (i = 0; i < used_atom_cnt; i++) {
+		struct used_atom *atom = &used_atom[i];
+		struct atom_value *v = &ref->value[i];
+		struct date_mode date_mode = { DATE_NORMAL };
+
+		if (atom->source == SOURCE_NONE || *atom->name == '*')
+			continue;
+		switch (atom->atom_type) {
+		case ATOM_OBJECTTYPE:
+			v->s = xstrdup(type_name(OBJ_COMMIT));
+			break;
+		case ATOM_COMMITTERDATE:
+		case ATOM_CREATORDATE:
+			/* a sort key only needs the timestamp */
+			if (date_atom_needs_tz(atom->name)) {
+				v->s = xstrdup("");
+			} else {
+				get_date_mode(atom->name, &date_mode);
+				v->s = xstrdup(show_date(commit->date, 0, &date_mode));
+			}
+			v->value = commit->date;
+			break;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+
 /*
  * Parse the object referred by ref, and grab needed value.
  */
@@ -1864,6 +2032,16 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 				v->s = xstrdup("");
 			continue;
 		}
+		else if (atom_type == ATOM_AHEADBEHIND) {
+			/* computed by filter_ahead_behind() for commits */
+			if (ref->counts) {
+				const struct ahead_behind_count *count =
+					&ref->counts[atom->u.ahead_behind.nth];
+				v->s = xstrfmt("%u %u", count->ahead, count->behind);
+			} else
+				v->s = xstrdup("");
+			continue;
+		}
 		else if (atom_type == ATOM_SYMREF)
 			refname = get_symref(atom, ref);
 		else if (atom_type == ATOM_UPSTREAM) {
@@ -1979,6 +2157,8 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 	    !memcmp(&oi_deref.info, &empty, sizeof(empty)))
 		return 0;
 
+	if (populate_value_from_graph(ref))
+		return 0;
 
 	oi.oid = ref->objectname;
 	if (get_object(ref, 0, &obj, &oi, err))
@@ -2318,6 +2498,8 @@ void ref_array_clear(struct ref_array *array)
 		free_array_item(array->items[i]);
 	FREE_AND_NULL(array->items);
 	array->nr = array->alloc = 0;
+	FREE_AND_NULL(array->counts);
+	array->counts_nr = 0;
 
 	for (i = 0; i < used_atom_cnt; i++) {
 		struct used_atom *atom = &used_atom[i];
@@ -2327,6 +2509,7 @@ void ref_array_clear(struct ref_array *array)
 	}
 	FREE_AND_NULL(used_atom);
 	used_atom_cnt = 0;
+	ahead_behind_bases = 0;
 
 	if (ref_to_worktree_map.worktrees) {
 		hashmap_clear_and_free(&(ref_to_worktree_map.map),
@@ -2395,6 +2578,45 @@ static void reach_filter(struct ref_array *array,
 	free(to_clear);
 }
 
+void filter_ahead_behind(struct repository *r, struct ref_array *array)
+{
+	struct commit **commits;
+	size_t commits_nr = ahead_behind_bases;
+	int i, j;
+
+	if (!ahead_behind_bases || !array->nr)
+		return;
+
+	ALLOC_ARRAY(commits, st_add(ahead_behind_bases, array->nr));
+	for (i = 0; i < used_atom_cnt; i++) {
+		struct used_atom *atom = &used_atom[i];
+		if (atom->atom_type == ATOM_AHEADBEHIND)
+			commits[atom->u.ahead_behind.nth] = atom->u.ahead_behind.base;
+	}
+
+	ALLOC_ARRAY(array->counts, st_mult(ahead_behind_bases, array->nr));
+	array->counts_nr = 0;
+	for (i = 0; i < array->nr; i++) {
+		struct ref_array_item *item = array->items[i];
+		struct commit *commit =
+			lookup_commit_reference_gently(r, &item->objectname, 1);
+
+		if (!commit)
+			continue;
+		item->counts = &array->counts[array->counts_nr];
+		for (j = 0; j < ahead_behind_bases; j++) {
+			struct ahead_behind_count *count =
+				&array->counts[array->counts_nr++];
+			count->tip_index = commits_nr;
+			count->base_index = j;
+		}
+		commits[commits_nr++] = commit;
+	}
+
+	ahead_behind(r, commits, commits_nr, array->counts, array->counts_nr);
+	free(commits);
+}
+
 /*
  * API for filtering a set of refs. Based on the type of refs the user
  * has requested, we iterate through those refs and apply filters
@@ -2563,10 +2785,8 @@ void ref_array_sort(struct ref_sorting *sorting, struct ref_array *array)
 	QSORT_S(array->items, array->nr, compare_refs, sorting);
 }
 
-static void append_literal(const char *cp, const char *ep, struct ref_formatting_state *state)
+static void append_literal(const char *cp, const char *ep, struct strbuf *s)
 {
-	struct strbuf *s = &state->stack->output;
-
 	while (*cp && (!ep || cp < ep)) {
 		if (*cp == '%') {
 			if (cp[1] == '%')
@@ -2592,17 +2812,39 @@ int format_ref_array_item(struct ref_array_item *info,
 {
 	const char *cp, *sp, *ep;
 	struct ref_formatting_state state = REF_FORMATTING_STATE_INIT;
+	const struct ref_format_program *program = format->program;
 
 	state.quote_style = format->quote_style;
 	push_stack_element(&state.stack);
 
+	if (program && program->format == format->format) {
+		size_t i;
+
+		for (i = 0; i < program->nr; i++) {
+			const struct ref_format_step *step = &program->step[i];
+			struct atom_value *atomv;
+
+			strbuf_add(&state.stack->output,
+				   program->literals.buf + step->literal_off,
+				   step->literal_len);
+			if (step->atom < 0)
+				break;
+			if (get_ref_atom_value(info, step->atom, &atomv, error_buf) ||
+			    atomv->handler(atomv, &state, error_buf)) {
+				pop_stack_element(&state.stack);
+				return -1;
+			}
+		}
+		goto done;
+	}
+
 	for (cp = format->format; *cp && (sp = find_next(cp)); cp = ep + 1) {
 		struct atom_value *atomv;
 		int pos;
 
 		ep = strchr(sp, ')');
 		if (cp < sp)
-			append_literal(cp, sp, &state);
+			append_literal(cp, sp, &state.stack->output);
 		pos = parse_ref_filter_atom(format, sp + 2, ep, error_buf);
 		if (pos < 0 || get_ref_atom_value(info, pos, &atomv, error_buf) ||
 		    atomv->handler(atomv, &state, error_buf)) {
@@ -2612,8 +2854,10 @@ int format_ref_array_item(struct ref_array_item *info,
 	}
 	if (*cp) {
 		sp = cp + strlen(cp);
-		append_literal(cp, sp, &state);
+		append_literal(cp, sp, &state.stack->output);
 	}
+
+done:
 	if (format->need_color_reset_at_eol) {
 		struct atom_value resetv = ATOM_VALUE_INIT;
 		resetv.s = GIT_COLOR_RESET;
@@ -2659,9 +2903,12 @@ static int parse_sorting_atom(const char *atom)
 	struct ref_format dummy = REF_FORMAT_INIT;
 	const char *end = atom + strlen(atom);
 	struct strbuf err = STRBUF_INIT;
+	int nr = used_atom_cnt;
 	int res = parse_ref_filter_atom(&dummy, atom, end, &err);
 	if (res < 0)
 		die("%s", err.buf);
+	if (res >= nr)
+		used_atom[res].sort_only = 1;
 	strbuf_release(&err);
 	return res;
 }
@@ -44,6 +44,8 @@ struct ref_array_item {
 	const char *symref;
 	struct commit *commit;
 	struct atom_value *value;
+	/* one for each %(ahead-behind) base, pointing into ref_array */
+	struct ahead_behind_count *counts;
 	char refname[FLEX_ARRAY];
 };
 
@@ -51,6 +53,9 @@ struct ref_array {
 	int nr, alloc;
 	struct ref_array_item **items;
 	struct rev_info *revs;
+
+	struct ahead_behind_count *counts;
+	size_t counts_nr;
 };
 
 struct ref_filter {
@@ -84,6 +89,7 @@ struct ref_format {
 
 	/* Internal state to ref-filter */
 	int need_color_reset_at_eol;
+	struct ref_format_program *program;
 };
 
 #define REF_FORMAT_INIT { .use_color = -1 }
@@ -109,6 +115,13 @@ struct ref_format {
  * filtered refs in the ref_array structure.
  */
 int filter_refs(struct ref_array *array, struct ref_filter *filter, unsigned int type);
+/*
+ * Compute the values of the %(ahead-behind:<committish>) atoms of the
+ * format last verified with verify_ref_format(), for all the refs in
+ * the array at once.  Must be called after filter_refs() if the format
+ * uses them.
+ */
+void filter_ahead_behind(struct repository *r, struct ref_array *array);
 /*  Clear all memory allocated to ref_array */
 void ref_array_clear(struct ref_array *array);
 /*  Used to verify if the given format is correct and to parse out the used atoms */
@@ -10,6 +10,7 @@
 #include "refs.h"
 #include "refs/refs-internal.h"
 #include "run-command.h"
+#include "hook-process.h"
 #include "object-store.h"
 #include "object.h"
 #include "tag.h"
@@ -880,6 +881,7 @@ struct read_ref_at_cb {
 	timestamp_t *cutoff_time;
 	int *cutoff_tz;
 	int *cutoff_cnt;
+	int skipped;
 };
 
 static void set_read_ref_cutoffs(struct read_ref_at_cb *cb,
@@ -905,6 +907,13 @@ static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
 	cb->tz = tz;
 	cb->date = timestamp;
 
+	/* account for the newer entries the backend did not show us */
+	if (!cb->reccnt && cb->skipped) {
+		cb->reccnt = cb->skipped;
+		if (cb->cnt > 0)
+			cb->cnt -= cb->skipped;
+	}
+
 	/*
 	 * It is not possible for cb->cnt == 0 on the first iteration because
 	 * that special case is handled in read_ref_at().
@@ -985,7 +994,13 @@ int read_ref_at(struct ref_store *refs, const char *refname,
 		return 0;
 	}
 
-	refs_for_each_reflog_ent_reverse(refs, refname, read_ref_at_ent, &cb);
+	if (refs->be->for_each_reflog_ent_reverse_from)
+		refs->be->for_each_reflog_ent_reverse_from(refs, refname,
+							   at_time, cnt,
+							   &cb.skipped,
+							   read_ref_at_ent, &cb);
+	else
+		refs_for_each_reflog_ent_reverse(refs, refname, read_ref_at_ent, &cb);
 
 	if (!cb.reccnt) {
 		if (flags & GET_OID_QUIETLY)
@@ -2064,38 +2079,52 @@ static int run_transaction_hook(struct ref_transaction *transaction,
 	struct child_process proc = CHILD_PROCESS_INIT;
 	struct strbuf buf = STRBUF_INIT;
 	const char *hook;
-	int ret = 0, i;
+	int use_process, ret = 0, i, skipped = 0;
 
-	hook = find_hook("reference-transaction");
-	if (!hook)
+	use_process = !!find_hook_process("reference-transaction");
+	hook = use_process ? NULL : find_hook("reference-transaction");
+	if (!hook && !use_process)
 		return ret;
 
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+
+		if (update->flags & REF_SKIP_HOOK) {
+			skipped++;
+			continue;
+		}
+		strbuf_addf(&buf, "%s %s %s\n",
+			    oid_to_hex(&update->old_oid),
+			    oid_to_hex(&update->new_oid),
+			    update->refname);
+	}
+	/* everything in here has been reported elsewhere */
+	if (skipped && skipped == transaction->nr)
+		return ret;
+
+	if (use_process) {
+		const char *args[] = { state, NULL };
+
+		ret = run_hook_process("reference-transaction", args, &buf);
+		strbuf_release(&buf);
+		return ret;
+	}
+
 	strvec_pushl(&proc.args, hook, state, NULL);
 	proc.in = -1;
 	proc.stdout_to_stderr = 1;
 	proc.trace2_hook_name = "reference-transaction";
 
 	ret = start_command(&proc);
-	if (ret)
+	if (ret) {
+		strbuf_release(&buf);
 		return ret;
+	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
 
-	for (i = 0; i < transaction->nr; i++) {
-		struct ref_update *update = transaction->updates[i];
-
-		strbuf_reset(&buf);
-		strbuf_addf(&buf, "%s %s %s\n",
-			    oid_to_hex(&update->old_oid),
-			    oid_to_hex(&update->new_oid),
-			    update->refname);
-
-		if (write_in_full(proc.in, buf.buf, buf.len) < 0) {
-			if (errno != EPIPE)
-				ret = -1;
-			break;
-		}
-	}
+	if (write_in_full(proc.in, buf.buf, buf.len) < 0 && errno != EPIPE)
+		ret = -1;
 
 	close(proc.in);
 	sigchain_pop(SIGPIPE);
@@ -331,6 +331,34 @@ static int debug_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	return res;
 }
 
+static int debug_for_each_reflog_ent_reverse_from(struct ref_store *ref_store,
+						  const char *refname,
+						  timestamp_t at_time, int cnt,
+						  int *skipped,
+						  each_reflog_ent_fn fn,
+						  void *cb_data)
+{
+	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
+	struct debug_reflog dbg = {
+		.refname = refname,
+		.fn = fn,
+		.cb_data = cb_data,
+	};
+	int res;
+
+	if (!drefs->refs->be->for_each_reflog_ent_reverse_from) {
+		*skipped = 0;
+		return debug_for_each_reflog_ent_reverse(ref_store, refname,
+							 fn, cb_data);
+	}
+	res = drefs->refs->be->for_each_reflog_ent_reverse_from(
+		drefs->refs, refname, at_time, cnt, skipped,
+		&debug_print_reflog_ent, &dbg);
+	trace_printf_key(&trace_refs, "for_each_reflog_reverse_from: %s: %d (skipped %d)\n",
+			 refname, res, *skipped);
+	return res;
+}
+
 static int debug_reflog_exists(struct ref_store *ref_store, const char *refname)
 {
 	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
@@ -436,6 +464,7 @@ struct ref_storage_be refs_be_debug = {
 	debug_reflog_iterator_begin,
 	debug_for_each_reflog_ent,
 	debug_for_each_reflog_ent_reverse,
+	debug_for_each_reflog_ent_reverse_from,
 	debug_reflog_exists,
 	debug_create_reflog,
 	debug_delete_reflog,
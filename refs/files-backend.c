@@ -11,6 +11,7 @@
 #include "../dir.h"
 #include "../chdir-notify.h"
 #include "worktree.h"
+#include "../thread-utils.h"
 
 /*
  * This backend uses the following flags in `ref_update::flags` for
@@ -50,6 +51,13 @@
  */
 #define REF_DELETED_RMDIR (1 << 9)
 
+/*
+ * Used as a flag in ref_update::flags when the new value of the
+ * reference is to be written to the `packed-refs` file instead of to
+ * its loose lockfile (see `core.packedRefsUpdateThreshold`).
+ */
+#define REF_NEEDS_PACKED_COMMIT (1 << 10)
+
 struct ref_lock {
 	char *ref_name;
 	struct lock_file lk;
@@ -143,6 +151,7 @@ static struct files_ref_store *files_downcast(struct ref_store *ref_store,
 
 static void files_reflog_path_other_worktrees(struct files_ref_store *refs,
 					      struct strbuf *sb,
+					      const char *logs,
 					      const char *refname)
 {
 	const char *real_ref;
@@ -153,28 +162,32 @@ static void files_reflog_path_other_worktrees(struct files_ref_store *refs,
 		BUG("refname %s is not a other-worktree ref", refname);
 
 	if (worktree_name)
-		strbuf_addf(sb, "%s/worktrees/%.*s/logs/%s", refs->gitcommondir,
-			    length, worktree_name, real_ref);
+		strbuf_addf(sb, "%s/worktrees/%.*s/%s/%s", refs->gitcommondir,
+			    length, worktree_name, logs, real_ref);
 	else
-		strbuf_addf(sb, "%s/logs/%s", refs->gitcommondir,
+		strbuf_addf(sb, "%s/%s/%s", refs->gitcommondir, logs,
 			    real_ref);
 }
 
-static void files_reflog_path(struct files_ref_store *refs,
-			      struct strbuf *sb,
-			      const char *refname)
+/*
+ * Add the path of the file for `refname` below the directory `logs`
+ * (that is, "logs" for its reflog) of the repository it belongs to.
+ */
+static void files_log_path(struct files_ref_store *refs,
+			   struct strbuf *sb, const char *logs,
+			   const char *refname)
 {
 	switch (ref_type(refname)) {
 	case REF_TYPE_PER_WORKTREE:
 	case REF_TYPE_PSEUDOREF:
-		strbuf_addf(sb, "%s/logs/%s", refs->base.gitdir, refname);
+		strbuf_addf(sb, "%s/%s/%s", refs->base.gitdir, logs, refname);
 		break;
 	case REF_TYPE_OTHER_PSEUDOREF:
 	case REF_TYPE_MAIN_PSEUDOREF:
-		files_reflog_path_other_worktrees(refs, sb, refname);
+		files_reflog_path_other_worktrees(refs, sb, logs, refname);
 		break;
 	case REF_TYPE_NORMAL:
-		strbuf_addf(sb, "%s/logs/%s", refs->gitcommondir, refname);
+		strbuf_addf(sb, "%s/%s/%s", refs->gitcommondir, logs, refname);
 		break;
 	default:
 		BUG("unknown ref type %d of ref %s",
@@ -182,6 +195,25 @@ static void files_reflog_path(struct files_ref_store *refs,
 	}
 }
 
+static void files_reflog_path(struct files_ref_store *refs,
+			      struct strbuf *sb,
+			      const char *refname)
+{
+	files_log_path(refs, sb, "logs", refname);
+}
+
+static void files_reflog_index_path(struct files_ref_store *refs,
+				    struct strbuf *sb,
+				    const char *refname)
+{
+	files_log_path(refs, sb, "logs-index", refname);
+}
+
+static void update_reflog_index(struct files_ref_store *refs,
+				const char *refname);
+static void delete_reflog_index(struct files_ref_store *refs,
+				const char *refname);
+
 static void files_ref_path(struct files_ref_store *refs,
 			   struct strbuf *sb,
 			   const char *refname)
@@ -233,23 +265,34 @@ static void add_per_worktree_entries_to_dir(struct ref_dir *dir, const char *dir
 }
 
 /*
- * Read the loose references from the namespace dirname into dir
- * (without recursing).  dirname must end with '/'.  dir must be the
- * directory entry corresponding to dirname.
+ * A directory of loose references being read into the cache: its
+ * entries as returned by readdir(), and for the plain files among
+ * them, the object name they hold if they could be read without
+ * help from the rest of the ref store.
  */
-static void loose_fill_ref_dir(struct ref_store *ref_store,
-			       struct ref_dir *dir, const char *dirname)
+struct loose_dir_entry {
+	char *name;
+	unsigned is_dir : 1,
+		 have_oid : 1;
+	struct object_id oid;
+};
+
+struct loose_dir_listing {
+	struct ref_dir *dir;
+	const char *dirname;
+	struct loose_dir_entry *entries;
+	size_t nr, alloc;
+};
+
+static void list_loose_ref_dir(struct files_ref_store *refs,
+			       struct loose_dir_listing *listing)
 {
-	struct files_ref_store *refs =
-		files_downcast(ref_store, REF_STORE_READ, "fill_ref_dir");
-	DIR *d;
-	struct dirent *de;
-	int dirnamelen = strlen(dirname);
-	struct strbuf refname;
 	struct strbuf path = STRBUF_INIT;
 	size_t path_baselen;
+	DIR *d;
+	struct dirent *de;
 
-	files_ref_path(refs, &path, dirname);
+	files_ref_path(refs, &path, listing->dirname);
 	path_baselen = path.len;
 
 	d = opendir(path.buf);
@@ -258,35 +301,97 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 		return;
 	}
 
-	strbuf_init(&refname, dirnamelen + 257);
-	strbuf_add(&refname, dirname, dirnamelen);
-
 	while ((de = readdir(d)) != NULL) {
-		struct object_id oid;
+		struct loose_dir_entry *entry;
 		struct stat st;
-		int flag;
 
 		if (de->d_name[0] == '.')
 			continue;
 		if (ends_with(de->d_name, ".lock"))
 			continue;
-		strbuf_addstr(&refname, de->d_name);
 		strbuf_addstr(&path, de->d_name);
 		if (stat(path.buf, &st) < 0) {
 			; /* silently ignore */
-		} else if (S_ISDIR(st.st_mode)) {
+		} else {
+			ALLOC_GROW(listing->entries, listing->nr + 1,
+				   listing->alloc);
+			entry = &listing->entries[listing->nr++];
+			memset(entry, 0, sizeof(*entry));
+			entry->name = xstrdup(de->d_name);
+			entry->is_dir = !!S_ISDIR(st.st_mode);
+		}
+		strbuf_setlen(&path, path_baselen);
+	}
+	strbuf_release(&path);
+	closedir(d);
+}
+
+/*
+ * Read a loose reference that is a regular file holding an object
+ * name.  Anything else (symbolic refs, symlinks, files that vanished
+ * or do not parse) is left for refs_resolve_ref_unsafe() to sort out.
+ */
+static void read_loose_ref_entry(struct files_ref_store *refs,
+				 const char *dirname,
+				 struct loose_dir_entry *entry,
+				 struct strbuf *path, struct strbuf *contents)
+{
+	struct strbuf referent = STRBUF_INIT;
+	unsigned int type = 0;
+	struct stat st;
+
+	strbuf_reset(path);
+	files_ref_path(refs, path, dirname);
+	strbuf_addstr(path, entry->name);
+	if (lstat(path->buf, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	strbuf_reset(contents);
+	if (strbuf_read_file(contents, path->buf, 256) < 0)
+		return;
+	strbuf_rtrim(contents);
+	if (!parse_loose_ref_contents(contents->buf, &entry->oid,
+				      &referent, &type) &&
+	    !(type & REF_ISSYMREF))
+		entry->have_oid = 1;
+	strbuf_release(&referent);
+}
+
+static void add_loose_dir_listing(struct files_ref_store *refs,
+				  struct loose_dir_listing *listing)
+{
+	struct ref_dir *dir = listing->dir;
+	int dirnamelen = strlen(listing->dirname);
+	struct strbuf refname;
+	size_t i;
+
+	strbuf_init(&refname, dirnamelen + 257);
+	strbuf_add(&refname, listing->dirname, dirnamelen);
+
+	for (i = 0; i < listing->nr; i++) {
+		struct loose_dir_entry *entry = &listing->entries[i];
+		struct object_id oid;
+		int flag = 0;
+
+		strbuf_addstr(&refname, entry->name);
+		if (entry->is_dir) {
 			strbuf_addch(&refname, '/');
 			add_entry_to_dir(dir,
 					 create_dir_entry(dir->cache, refname.buf,
 							  refname.len, 1));
 		} else {
-			if (!refs_resolve_ref_unsafe(&refs->base,
-						     refname.buf,
-						     RESOLVE_REF_READING,
-						     &oid, &flag)) {
+			if (entry->have_oid &&
+			    !check_refname_format(refname.buf,
+						  REFNAME_ALLOW_ONELEVEL)) {
+				oidcpy(&oid, &entry->oid);
+			} else if (!refs_resolve_ref_unsafe(&refs->base,
+							    refname.buf,
+							    RESOLVE_REF_READING,
+							    &oid, &flag)) {
 				oidclr(&oid);
 				flag |= REF_ISBROKEN;
-			} else if (is_null_oid(&oid)) {
+			}
+			if (is_null_oid(&oid)) {
 				/*
 				 * It is so astronomically unlikely
 				 * that null_oid is the OID of an
@@ -309,13 +414,186 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 					 create_ref_entry(refname.buf, &oid, flag));
 		}
 		strbuf_setlen(&refname, dirnamelen);
-		strbuf_setlen(&path, path_baselen);
+		free(entry->name);
 	}
 	strbuf_release(&refname);
+	free(listing->entries);
+
+	add_per_worktree_entries_to_dir(dir, listing->dirname);
+}
+
+/*
+ * Read the loose references from the namespace dirname into dir
+ * (without recursing).  dirname must end with '/'.  dir must be the
+ * directory entry corresponding to dirname.
+ */
+static void loose_fill_ref_dir(struct ref_store *ref_store,
+			       struct ref_dir *dir, const char *dirname)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "fill_ref_dir");
+	struct loose_dir_listing listing = { dir, dirname };
+	struct strbuf path = STRBUF_INIT, contents = STRBUF_INIT;
+	size_t i;
+
+	list_loose_ref_dir(refs, &listing);
+	for (i = 0; i < listing.nr; i++)
+		if (!listing.entries[i].is_dir)
+			read_loose_ref_entry(refs, dirname, &listing.entries[i],
+					     &path, &contents);
 	strbuf_release(&path);
-	closedir(d);
+	strbuf_release(&contents);
+
+	add_loose_dir_listing(refs, &listing);
+}
+
+/*
+ * When the cache is primed, all the directories at one depth of the
+ * hierarchy are filled together: threads list the directories, then
+ * read the loose refs found in them, and the results are added to the
+ * cache in the order the directories were given and readdir() listed
+ * their entries, as if they had been filled one by one.
+ */
+#define MIN_PARALLEL_LOOSE_REF_DIRS 8
+#define MIN_PARALLEL_LOOSE_REFS 64
+
+struct loose_ref_item {
+	const char *dirname;
+	struct loose_dir_entry *entry;
+};
+
+struct parallel_loose_fill {
+	struct files_ref_store *refs;
+	struct loose_dir_listing *listings;
+	size_t nr_listings;
+	struct loose_ref_item *items;
+	size_t nr_items;
+
+	pthread_mutex_t mutex;
+	size_t next;
+};
+
+static int next_loose_work(struct parallel_loose_fill *lf, size_t nr,
+			   size_t *pos)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&lf->mutex);
+	if (lf->next < nr) {
+		*pos = lf->next++;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&lf->mutex);
+	return ret;
+}
+
+static void *list_loose_ref_dirs_thread(void *data)
+{
+	struct parallel_loose_fill *lf = data;
+	size_t pos;
+
+	while (next_loose_work(lf, lf->nr_listings, &pos))
+		list_loose_ref_dir(lf->refs, &lf->listings[pos]);
+	return NULL;
+}
 
-	add_per_worktree_entries_to_dir(dir, dirname);
+static void *read_loose_refs_thread(void *data)
+{
+	struct parallel_loose_fill *lf = data;
+	struct strbuf path = STRBUF_INIT, contents = STRBUF_INIT;
+	size_t pos;
+
+	while (next_loose_work(lf, lf->nr_items, &pos))
+		read_loose_ref_entry(lf->refs, lf->items[pos].dirname,
+				     lf->items[pos].entry, &path, &contents);
+	strbuf_release(&path);
+	strbuf_release(&contents);
+	return NULL;
+}
+
+/*
+ * Run "fn" on up to "nr_threads" threads (the current one included)
+ * until they have taken all "nr" pieces of work.
+ */
+static void run_loose_ref_threads(struct parallel_loose_fill *lf,
+				  void *(*fn)(void *), int nr_threads,
+				  size_t nr)
+{
+	pthread_t *threads;
+	int i, started = 0;
+
+	if (nr_threads > nr)
+		nr_threads = nr;
+	lf->next = 0;
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 1; i < nr_threads; i++) {
+		if (pthread_create(&threads[started], NULL, fn, lf))
+			break;
+		started++;
+	}
+	fn(lf);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static void loose_fill_ref_dirs(struct ref_store *ref_store,
+				struct ref_dir **dirs, const char **dirnames,
+				size_t nr)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "fill_ref_dirs");
+	struct parallel_loose_fill lf = { refs };
+	size_t i, j, alloc = 0;
+	int nr_threads;
+
+	nr_threads = git_env_ulong("GIT_TEST_LOOSE_REFS_THREADS", 0);
+	if (!nr_threads && HAVE_THREADS) {
+		nr_threads = online_cpus();
+		if (nr < MIN_PARALLEL_LOOSE_REF_DIRS)
+			nr_threads = 1;
+	}
+	if (!HAVE_THREADS || nr_threads < 2) {
+		for (i = 0; i < nr; i++)
+			loose_fill_ref_dir(ref_store, dirs[i], dirnames[i]);
+		return;
+	}
+
+	CALLOC_ARRAY(lf.listings, nr);
+	for (i = 0; i < nr; i++) {
+		lf.listings[i].dir = dirs[i];
+		lf.listings[i].dirname = dirnames[i];
+	}
+	lf.nr_listings = nr;
+	pthread_mutex_init(&lf.mutex, NULL);
+
+	run_loose_ref_threads(&lf, list_loose_ref_dirs_thread,
+			      nr_threads, lf.nr_listings);
+
+	for (i = 0; i < nr; i++) {
+		struct loose_dir_listing *listing = &lf.listings[i];
+		for (j = 0; j < listing->nr; j++) {
+			if (listing->entries[j].is_dir)
+				continue;
+			ALLOC_GROW(lf.items, lf.nr_items + 1, alloc);
+			lf.items[lf.nr_items].dirname = listing->dirname;
+			lf.items[lf.nr_items++].entry = &listing->entries[j];
+		}
+	}
+	if (lf.nr_items < MIN_PARALLEL_LOOSE_REFS &&
+	    !git_env_ulong("GIT_TEST_LOOSE_REFS_THREADS", 0))
+		nr_threads = 1;
+	if (lf.nr_items)
+		run_loose_ref_threads(&lf, read_loose_refs_thread,
+				      nr_threads, lf.nr_items);
+	trace2_data_intmax("refs", NULL, "loose/parallel-dirs", nr);
+
+	for (i = 0; i < nr; i++)
+		add_loose_dir_listing(refs, &lf.listings[i]);
+
+	pthread_mutex_destroy(&lf.mutex);
+	free(lf.items);
+	free(lf.listings);
 }
 
 static struct ref_cache *get_loose_ref_cache(struct files_ref_store *refs)
@@ -327,6 +605,7 @@ static struct ref_cache *get_loose_ref_cache(struct files_ref_store *refs)
 		 * hold references:
 		 */
 		refs->loose = create_ref_cache(&refs->base, loose_fill_ref_dir);
+		refs->loose->fill_ref_dirs = loose_fill_ref_dirs;
 
 		/* We're going to fill the top level ourselves: */
 		refs->loose->root->flag &= ~REF_INCOMPLETE;
@@ -1414,6 +1693,9 @@ static int files_copy_or_rename_ref(struct ref_store *ref_store,
 		goto rollback;
 
 	logmoved = log;
+	delete_reflog_index(refs, newrefname);
+	if (!copy)
+		delete_reflog_index(refs, oldrefname);
 
 	lock = lock_ref_oid_basic(refs, newrefname, NULL, NULL, NULL,
 				  REF_NO_DEREF, NULL, &err);
@@ -1488,6 +1770,59 @@ static int files_copy_ref(struct ref_store *ref_store,
 				 newrefname, logmsg, 1);
 }
 
+/*
+ * Set when a ref or reflog file has been written out with
+ * core.fsyncRefFiles=batch but not made durable yet.
+ */
+static int ref_fsync_pending;
+
+/*
+ * Make what was written to `fd` durable as core.fsyncRefFiles asks,
+ * returning -1 (with errno set) on failure. In batch mode, it is only
+ * written out, and flush_ref_files() must be called before it takes
+ * effect.
+ */
+static int fsync_ref_file(int fd)
+{
+	switch (fsync_ref_files) {
+	case FSYNC_OBJECT_FILES_OFF:
+		return 0;
+	case FSYNC_OBJECT_FILES_BATCH:
+		if (!git_fsync(fd, FSYNC_WRITEOUT_ONLY)) {
+			ref_fsync_pending = 1;
+			return 0;
+		}
+		/* fallthrough */
+	default:
+		return git_fsync(fd, FSYNC_HARDWARE_FLUSH);
+	}
+}
+
+/*
+ * Make the ref files written out by fsync_ref_file() in batch mode
+ * durable, with a single flush of the disk cache.
+ */
+static void flush_ref_files(struct files_ref_store *refs)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *temp;
+
+	if (!ref_fsync_pending)
+		return;
+
+	/*
+	 * On common filesystems, fsync()ing any file on the same
+	 * device flushes the cache for all of them. Keep it out of
+	 * "refs/", where it would look like a broken ref.
+	 */
+	strbuf_addf(&path, "%s/fsync_refs_XXXXXX", refs->gitcommondir);
+	temp = xmks_tempfile(path.buf);
+	fsync_or_die(get_tempfile_fd(temp), get_tempfile_path(temp));
+	delete_tempfile(&temp);
+	strbuf_release(&path);
+	ref_fsync_pending = 0;
+}
+
 static int close_ref_gently(struct ref_lock *lock)
 {
 	if (close_lock_file_gently(&lock->lk))
@@ -1634,6 +1969,15 @@ static int log_ref_write_fd(int fd, const struct object_id *old_oid,
 	return ret;
 }
 
+static int reflog_index_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled < 0 && git_config_get_bool("core.reflogindex", &enabled))
+		enabled = 0;
+	return enabled;
+}
+
 static int files_log_ref_write(struct files_ref_store *refs,
 			       const char *refname, const struct object_id *old_oid,
 			       const struct object_id *new_oid, const char *msg,
@@ -1655,6 +1999,8 @@ static int files_log_ref_write(struct files_ref_store *refs,
 		return 0;
 	result = log_ref_write_fd(logfd, old_oid, new_oid,
 				  git_committer_info(0), msg);
+	if (!result)
+		result = fsync_ref_file(logfd);
 	if (result) {
 		struct strbuf sb = STRBUF_INIT;
 		int save_errno = errno;
@@ -1676,6 +2022,8 @@ static int files_log_ref_write(struct files_ref_store *refs,
 		strbuf_release(&sb);
 		return -1;
 	}
+	if (reflog_index_enabled())
+		update_reflog_index(refs, refname);
 	return 0;
 }
 
@@ -1683,31 +2031,45 @@ static int files_log_ref_write(struct files_ref_store *refs,
  * Write oid into the open lockfile, then close the lockfile. On
  * errors, rollback the lockfile, fill in *err and return -1.
  */
-static int write_ref_to_lockfile(struct ref_lock *lock,
-				 const struct object_id *oid, struct strbuf *err)
+/*
+ * Check that `oid` names an object that `refname` may point at: it
+ * must exist, and branches may only point at commits.
+ */
+static int check_ref_target(const char *refname,
+			    const struct object_id *oid, struct strbuf *err)
 {
-	static char term = '\n';
 	struct object *o;
-	int fd;
 
 	o = parse_object(the_repository, oid);
 	if (!o) {
 		strbuf_addf(err,
 			    "trying to write ref '%s' with nonexistent object %s",
-			    lock->ref_name, oid_to_hex(oid));
-		unlock_ref(lock);
+			    refname, oid_to_hex(oid));
 		return -1;
 	}
-	if (o->type != OBJ_COMMIT && is_branch(lock->ref_name)) {
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
 		strbuf_addf(err,
 			    "trying to write non-commit object %s to branch '%s'",
-			    oid_to_hex(oid), lock->ref_name);
+			    oid_to_hex(oid), refname);
+		return -1;
+	}
+	return 0;
+}
+
+static int write_ref_to_lockfile(struct ref_lock *lock,
+				 const struct object_id *oid, struct strbuf *err)
+{
+	static char term = '\n';
+	int fd;
+
+	if (check_ref_target(lock->ref_name, oid, err)) {
 		unlock_ref(lock);
 		return -1;
 	}
 	fd = get_lock_file_fd(&lock->lk);
 	if (write_in_full(fd, oid_to_hex(oid), the_hash_algo->hexsz) < 0 ||
 	    write_in_full(fd, &term, 1) < 0 ||
+	    fsync_ref_file(fd) < 0 ||
 	    close_ref_gently(lock) < 0) {
 		strbuf_addf(err,
 			    "couldn't write '%s'", get_lock_file_path(&lock->lk));
@@ -1772,6 +2134,7 @@ static int commit_ref_update(struct files_ref_store *refs,
 		}
 	}
 
+	flush_ref_files(refs);
 	if (commit_ref(lock)) {
 		strbuf_addf(err, "couldn't set '%s'", lock->ref_name);
 		unlock_ref(lock);
@@ -1830,6 +2193,11 @@ static int create_symref_locked(struct files_ref_store *refs,
 
 	/* no error check; commit_ref will check ferror */
 	fprintf(get_lock_file_fp(&lock->lk), "ref: %s\n", target);
+	if (fflush(get_lock_file_fp(&lock->lk)) ||
+	    fsync_ref_file(get_lock_file_fd(&lock->lk)) < 0)
+		return error("unable to write symref for %s: %s", refname,
+			     strerror(errno));
+	flush_ref_files(refs);
 	if (commit_ref(lock) < 0)
 		return error("unable to write symref for %s: %s", refname,
 			     strerror(errno));
@@ -1885,29 +2253,50 @@ static int files_delete_reflog(struct ref_store *ref_store,
 
 	files_reflog_path(refs, &sb, refname);
 	ret = remove_path(sb.buf);
+	delete_reflog_index(refs, refname);
 	strbuf_release(&sb);
 	return ret;
 }
 
+/*
+ * Parse the reflog entry in `buf`, which must end with its LF.  On
+ * success, `*email` points at the committer and `*email_end` at the
+ * '>' that ends it, and `*message` at the timezone that follows the
+ * timestamp.
+ */
+static int parse_reflog_ent(const char *buf, size_t len,
+			    struct object_id *ooid, struct object_id *noid,
+			    const char **email, char **email_end,
+			    timestamp_t *timestamp, char **message)
+{
+	const char *p = buf;
+
+	/* old SP new SP name <email> SP time TAB msg LF */
+	if (!len || buf[len - 1] != '\n' ||
+	    parse_oid_hex(p, ooid, &p) || *p++ != ' ' ||
+	    parse_oid_hex(p, noid, &p) || *p++ != ' ' ||
+	    !(*email_end = memchr(p, '>', buf + len - p)) ||
+	    (*email_end)[1] != ' ' ||
+	    !(*timestamp = parse_timestamp(*email_end + 2, message, 10)) ||
+	    !*message || (*message)[0] != ' ' ||
+	    ((*message)[1] != '+' && (*message)[1] != '-') ||
+	    !isdigit((*message)[2]) || !isdigit((*message)[3]) ||
+	    !isdigit((*message)[4]) || !isdigit((*message)[5]))
+		return -1; /* corrupt? */
+	*email = p;
+	return 0;
+}
+
 static int show_one_reflog_ent(struct strbuf *sb, each_reflog_ent_fn fn, void *cb_data)
 {
 	struct object_id ooid, noid;
 	char *email_end, *message;
 	timestamp_t timestamp;
 	int tz;
-	const char *p = sb->buf;
+	const char *p;
 
-	/* old SP new SP name <email> SP time TAB msg LF */
-	if (!sb->len || sb->buf[sb->len - 1] != '\n' ||
-	    parse_oid_hex(p, &ooid, &p) || *p++ != ' ' ||
-	    parse_oid_hex(p, &noid, &p) || *p++ != ' ' ||
-	    !(email_end = strchr(p, '>')) ||
-	    email_end[1] != ' ' ||
-	    !(timestamp = parse_timestamp(email_end + 2, &message, 10)) ||
-	    !message || message[0] != ' ' ||
-	    (message[1] != '+' && message[1] != '-') ||
-	    !isdigit(message[2]) || !isdigit(message[3]) ||
-	    !isdigit(message[4]) || !isdigit(message[5]))
+	if (parse_reflog_ent(sb->buf, sb->len, &ooid, &noid,
+			     &p, &email_end, &timestamp, &message))
 		return 0; /* corrupt? */
 	email_end[1] = '\0';
 	tz = strtol(message + 1, NULL, 10);
@@ -1929,30 +2318,16 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
-					     const char *refname,
-					     each_reflog_ent_fn fn,
-					     void *cb_data)
+/*
+ * Feed the entries of the reflog `logfp` that end at or before `pos`
+ * to `fn`, newest first.
+ */
+static int reflog_ent_reverse(FILE *logfp, const char *refname, long pos,
+			      each_reflog_ent_fn fn, void *cb_data)
 {
-	struct files_ref_store *refs =
-		files_downcast(ref_store, REF_STORE_READ,
-			       "for_each_reflog_ent_reverse");
 	struct strbuf sb = STRBUF_INIT;
-	FILE *logfp;
-	long pos;
 	int ret = 0, at_tail = 1;
 
-	files_reflog_path(refs, &sb, refname);
-	logfp = fopen(sb.buf, "r");
-	strbuf_release(&sb);
-	if (!logfp)
-		return -1;
-
-	/* Jump to the end */
-	if (fseek(logfp, 0, SEEK_END) < 0)
-		ret = error("cannot seek back reflog for %s: %s",
-			    refname, strerror(errno));
-	pos = ftell(logfp);
 	while (!ret && 0 < pos) {
 		int cnt;
 		size_t nread;
@@ -2038,11 +2413,41 @@ static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	if (!ret && sb.len)
 		BUG("reverse reflog parser had leftover data");
 
-	fclose(logfp);
 	strbuf_release(&sb);
 	return ret;
 }
 
+static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+					     const char *refname,
+					     each_reflog_ent_fn fn,
+					     void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse");
+	struct strbuf sb = STRBUF_INIT;
+	FILE *logfp;
+	long pos;
+	int ret = 0;
+
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
+	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+
+	/* Jump to the end */
+	if (fseek(logfp, 0, SEEK_END) < 0)
+		ret = error("cannot seek back reflog for %s: %s",
+			    refname, strerror(errno));
+	pos = ftell(logfp);
+	if (!ret)
+		ret = reflog_ent_reverse(logfp, refname, pos, fn, cb_data);
+
+	fclose(logfp);
+	return ret;
+}
+
 static int files_for_each_reflog_ent(struct ref_store *ref_store,
 				     const char *refname,
 				     each_reflog_ent_fn fn, void *cb_data)
@@ -2067,6 +2472,371 @@ static int files_for_each_reflog_ent(struct ref_store *ref_store,
 	return ret;
 }
 
+/*
+ * With core.reflogIndex, each reflog "logs/<refname>" is accompanied
+ * by an index "logs-index/<refname>" of its entries, so that finding
+ * the entry for "<ref>@{<date>}" or "<ref>@{<n>}" does not need to
+ * read the reflog from its end.  The index is an 8-byte header
+ * ("RLIX" and a version number) followed by one record per valid
+ * entry, oldest first, each made of four network-order 64-bit words:
+ *
+ *  - the offset in the reflog just past the entry's LF;
+ *  - its timestamp;
+ *  - the highest timestamp of this and all older entries;
+ *  - one more than the position of the newest entry up to this one
+ *    that is older than an entry before it (clocks do go backwards),
+ *    or 0 if there is none.
+ *
+ * The index is only appended to, by whoever appends to the reflog
+ * (under the ref's lock).  Readers use it only if it covers the
+ * reflog exactly, and otherwise read the reflog as usual.
+ */
+#define REFLOG_INDEX_SIGNATURE 0x524c4958 /* "RLIX" */
+#define REFLOG_INDEX_VERSION 1
+#define REFLOG_INDEX_HEADER_SIZE 8
+#define REFLOG_INDEX_RECORD_SIZE 32
+
+struct reflog_index_record {
+	uint64_t end;
+	timestamp_t timestamp;
+	timestamp_t max_timestamp;
+	uint64_t last_descent;
+};
+
+static void read_reflog_index_record(const unsigned char *p,
+				     struct reflog_index_record *rec)
+{
+	rec->end = get_be64(p);
+	rec->timestamp = get_be64(p + 8);
+	rec->max_timestamp = get_be64(p + 16);
+	rec->last_descent = get_be64(p + 24);
+}
+
+static void add_reflog_index_record(struct strbuf *out,
+				    struct reflog_index_record *prev,
+				    uint64_t pos, uint64_t end,
+				    timestamp_t timestamp)
+{
+	unsigned char buf[REFLOG_INDEX_RECORD_SIZE];
+	struct reflog_index_record rec;
+
+	rec.end = end;
+	rec.timestamp = timestamp;
+	if (pos && timestamp < prev->max_timestamp) {
+		rec.max_timestamp = prev->max_timestamp;
+		rec.last_descent = pos + 1;
+	} else {
+		rec.max_timestamp = timestamp;
+		rec.last_descent = pos ? prev->last_descent : 0;
+	}
+
+	put_be64(buf, rec.end);
+	put_be64(buf + 8, rec.timestamp);
+	put_be64(buf + 16, rec.max_timestamp);
+	put_be64(buf + 24, rec.last_descent);
+	strbuf_add(out, buf, sizeof(buf));
+	*prev = rec;
+}
+
+/*
+ * Bring the index of the reflog of `refname` up to date with the
+ * reflog, appending records for the entries it does not cover yet, or
+ * writing it anew if it does not match the reflog.  The caller holds
+ * the lock of the ref.  Failing to do so is not an error: readers
+ * simply do without.
+ */
+static void update_reflog_index(struct files_ref_store *refs,
+				const char *refname)
+{
+	struct strbuf log_path = STRBUF_INIT, index_path = STRBUF_INIT;
+	struct strbuf records = STRBUF_INIT, line = STRBUF_INIT;
+	struct reflog_index_record last = { 0 };
+	struct lock_file lk = LOCK_INIT;
+	uint64_t nr = 0, pos = 0;
+	FILE *logfp;
+	struct stat st;
+	int fd;
+
+	files_reflog_path(refs, &log_path, refname);
+	files_reflog_index_path(refs, &index_path, refname);
+	logfp = fopen(log_path.buf, "r");
+	if (!logfp || fstat(fileno(logfp), &st))
+		goto out;
+
+	fd = open(index_path.buf, O_RDWR);
+	if (fd >= 0) {
+		unsigned char buf[REFLOG_INDEX_RECORD_SIZE];
+		struct stat ist;
+
+		if (fstat(fd, &ist) ||
+		    ist.st_size < REFLOG_INDEX_HEADER_SIZE ||
+		    (ist.st_size - REFLOG_INDEX_HEADER_SIZE) %
+		    REFLOG_INDEX_RECORD_SIZE ||
+		    pread_in_full(fd, buf, 8, 0) != 8 ||
+		    get_be32(buf) != REFLOG_INDEX_SIGNATURE ||
+		    get_be32(buf + 4) != REFLOG_INDEX_VERSION)
+			goto rewrite;
+		nr = (ist.st_size - REFLOG_INDEX_HEADER_SIZE) /
+			REFLOG_INDEX_RECORD_SIZE;
+		if (nr) {
+			int c;
+
+			if (pread_in_full(fd, buf, sizeof(buf),
+					  ist.st_size - sizeof(buf)) != sizeof(buf))
+				goto rewrite;
+			read_reflog_index_record(buf, &last);
+			/* it must end at the end of an entry of ours */
+			if (last.end > st.st_size ||
+			    fseek(logfp, last.end - 1, SEEK_SET) ||
+			    (c = getc(logfp)) != '\n')
+				goto rewrite;
+			pos = last.end;
+		}
+		if (fseek(logfp, pos, SEEK_SET))
+			goto rewrite;
+		goto scan;
+	rewrite:
+		close(fd);
+		fd = -1;
+		nr = pos = 0;
+		memset(&last, 0, sizeof(last));
+		rewind(logfp);
+	}
+
+scan:
+	while (!strbuf_getwholeline(&line, logfp, '\n')) {
+		struct object_id ooid, noid;
+		const char *email;
+		char *email_end, *message;
+		timestamp_t timestamp;
+
+		pos += line.len;
+		if (parse_reflog_ent(line.buf, line.len, &ooid, &noid, &email,
+				     &email_end, &timestamp, &message))
+			continue;
+		add_reflog_index_record(&records, &last, nr++, pos, timestamp);
+	}
+
+	if (fd >= 0) {
+		if (records.len)
+			write_in_full(fd, records.buf, records.len);
+		close(fd);
+	} else if (safe_create_leading_directories(index_path.buf) >= 0 &&
+		   hold_lock_file_for_update(&lk, index_path.buf, 0) >= 0) {
+		unsigned char hdr[REFLOG_INDEX_HEADER_SIZE];
+
+		put_be32(hdr, REFLOG_INDEX_SIGNATURE);
+		put_be32(hdr + 4, REFLOG_INDEX_VERSION);
+		if (write_in_full(get_lock_file_fd(&lk), hdr, sizeof(hdr)) < 0 ||
+		    write_in_full(get_lock_file_fd(&lk),
+				  records.buf, records.len) < 0 ||
+		    commit_lock_file(&lk))
+			rollback_lock_file(&lk);
+	}
+
+out:
+	if (logfp)
+		fclose(logfp);
+	strbuf_release(&log_path);
+	strbuf_release(&index_path);
+	strbuf_release(&records);
+	strbuf_release(&line);
+}
+
+static void delete_reflog_index(struct files_ref_store *refs,
+				const char *refname)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	files_reflog_index_path(refs, &sb, refname);
+	unlink(sb.buf);
+	strbuf_release(&sb);
+}
+
+struct reflog_index {
+	const unsigned char *map;
+	size_t map_size;
+	uint64_t nr;
+};
+
+static const unsigned char *reflog_index_at(struct reflog_index *index,
+					    uint64_t pos)
+{
+	return index->map + REFLOG_INDEX_HEADER_SIZE +
+		pos * REFLOG_INDEX_RECORD_SIZE;
+}
+
+/*
+ * Map the index of the reflog of `refname` if there is one that
+ * covers the `log_size` bytes of the reflog exactly.
+ */
+static int open_reflog_index(struct files_ref_store *refs,
+			     const char *refname, off_t log_size,
+			     struct reflog_index *index)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct reflog_index_record last;
+	struct stat st;
+	int fd;
+
+	files_reflog_index_path(refs, &sb, refname);
+	fd = git_open(sb.buf);
+	strbuf_release(&sb);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) ||
+	    st.st_size < REFLOG_INDEX_HEADER_SIZE + REFLOG_INDEX_RECORD_SIZE ||
+	    (st.st_size - REFLOG_INDEX_HEADER_SIZE) % REFLOG_INDEX_RECORD_SIZE) {
+		close(fd);
+		return -1;
+	}
+	index->map_size = xsize_t(st.st_size);
+	index->map = xmmap(NULL, index->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	index->nr = (index->map_size - REFLOG_INDEX_HEADER_SIZE) /
+		REFLOG_INDEX_RECORD_SIZE;
+
+	read_reflog_index_record(reflog_index_at(index, index->nr - 1), &last);
+	if (get_be32(index->map) != REFLOG_INDEX_SIGNATURE ||
+	    get_be32(index->map + 4) != REFLOG_INDEX_VERSION ||
+	    last.end != log_size) {
+		munmap((void *)index->map, index->map_size);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Return the position of the entry a reverse walk looking for the
+ * newest entry at or before `at_time`, or for the `cnt`-th newest
+ * entry, can start from: the one just newer than the first that could
+ * be it, or the newest entry.
+ */
+static uint64_t reflog_index_seek(struct reflog_index *index,
+				  timestamp_t at_time, int cnt)
+{
+	struct reflog_index_record rec;
+	uint64_t lo = 0, hi = index->nr, found;
+
+	/* the entries up to "lo" are all at or before "at_time" */
+	while (lo < hi) {
+		uint64_t mi = lo + (hi - lo) / 2;
+
+		read_reflog_index_record(reflog_index_at(index, mi), &rec);
+		if (rec.max_timestamp <= at_time)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	found = lo;
+	if (cnt > 0 && cnt <= index->nr && index->nr - cnt + 1 > found)
+		found = index->nr - cnt + 1;
+
+	/*
+	 * Any newer entry at or before "at_time" would have to be older
+	 * than an entry before it; if there is one, look for it.
+	 */
+	read_reflog_index_record(reflog_index_at(index, index->nr - 1), &rec);
+	if (rec.last_descent > found) {
+		uint64_t pos;
+
+		for (pos = index->nr; pos > found; pos--) {
+			read_reflog_index_record(reflog_index_at(index, pos - 1),
+						 &rec);
+			if (rec.timestamp <= at_time)
+				break;
+		}
+		found = pos;
+	}
+	return found < index->nr ? found : index->nr - 1;
+}
+
+/*
+ * Check that the entry at `pos` of the index is where the index says
+ * it is in the reflog, with the timestamp the index says it has.
+ */
+static int reflog_index_matches(struct reflog_index *index, uint64_t pos,
+				FILE *logfp)
+{
+	struct reflog_index_record rec;
+	uint64_t begin = 0;
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id ooid, noid;
+	const char *email;
+	char *email_end, *message, *bol;
+	timestamp_t timestamp;
+	int ret = 0;
+
+	if (pos) {
+		read_reflog_index_record(reflog_index_at(index, pos - 1), &rec);
+		begin = rec.end;
+	}
+	read_reflog_index_record(reflog_index_at(index, pos), &rec);
+	if (rec.end <= begin || fseek(logfp, begin, SEEK_SET) ||
+	    strbuf_fread(&buf, rec.end - begin, logfp) != rec.end - begin)
+		goto out;
+
+	/* there may be corrupt lines before it, which the index skips */
+	bol = find_beginning_of_line(buf.buf, buf.buf + buf.len - 1);
+	if (*bol == '\n')
+		bol++;
+	ret = !parse_reflog_ent(bol, buf.buf + buf.len - bol, &ooid, &noid,
+				&email, &email_end, &timestamp, &message) &&
+		timestamp == rec.timestamp;
+out:
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int files_for_each_reflog_ent_reverse_from(struct ref_store *ref_store,
+						  const char *refname,
+						  timestamp_t at_time, int cnt,
+						  int *skipped,
+						  each_reflog_ent_fn fn,
+						  void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse_from");
+	struct strbuf sb = STRBUF_INIT;
+	struct reflog_index index;
+	struct stat st;
+	FILE *logfp;
+	long pos;
+	int ret;
+
+	*skipped = 0;
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
+	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+	if (fstat(fileno(logfp), &st)) {
+		fclose(logfp);
+		return error_errno(_("cannot stat reflog for %s"), refname);
+	}
+
+	pos = st.st_size;
+	if (!open_reflog_index(refs, refname, st.st_size, &index)) {
+		uint64_t start = reflog_index_seek(&index, at_time, cnt);
+
+		if (start + 1 < index.nr &&
+		    reflog_index_matches(&index, start, logfp)) {
+			struct reflog_index_record rec;
+
+			read_reflog_index_record(reflog_index_at(&index, start),
+						 &rec);
+			pos = rec.end;
+			*skipped = index.nr - 1 - start;
+		}
+		munmap((void *)index.map, index.map_size);
+	}
+
+	ret = reflog_ent_reverse(logfp, refname, pos, fn, cb_data);
+	fclose(logfp);
+	return ret;
+}
+
 struct files_reflog_iterator {
 	struct ref_iterator base;
 
@@ -2389,12 +3159,16 @@ static int check_old_oid(struct ref_update *update, struct object_id *oid,
  *   the referent to transaction.
  * - If it is an update of head_ref, add a corresponding REF_LOG_ONLY
  *   update of HEAD.
+ * - If `pack_update` is set and the reference has no loose file, mark
+ *   its new value to be written to `packed-refs` rather than to the
+ *   lockfile.
  */
 static int lock_ref_for_update(struct files_ref_store *refs,
 			       struct ref_update *update,
 			       struct ref_transaction *transaction,
 			       const char *head_ref,
 			       struct string_list *affected_refnames,
+			       int pack_update,
 			       struct strbuf *err)
 {
 	struct strbuf referent = STRBUF_INIT;
@@ -2496,6 +3270,31 @@ static int lock_ref_for_update(struct files_ref_store *refs,
 			 * The reference already has the desired
 			 * value, so we don't need to write it.
 			 */
+		} else if (pack_update &&
+			   starts_with(update->refname, "refs/") &&
+			   ref_type(update->refname) == REF_TYPE_NORMAL &&
+			   !(update->type & (REF_ISSYMREF | REF_ISBROKEN)) &&
+			   ((update->type & REF_ISPACKED) ||
+			    is_null_oid(&lock->old_oid))) {
+			/*
+			 * This is a shared reference with no loose
+			 * file that would shadow a packed value, so
+			 * the new value can go
+			 * straight into `packed-refs`. We keep holding
+			 * the loose lock to exclude other writers.
+			 */
+			if (check_ref_target(update->refname,
+					     &update->new_oid, err)) {
+				char *write_err = strbuf_detach(err, NULL);
+
+				strbuf_addf(err,
+					    "cannot update ref '%s': %s",
+					    update->refname, write_err);
+				free(write_err);
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+			update->flags |= REF_NEEDS_PACKED_COMMIT;
 		} else if (write_ref_to_lockfile(lock, &update->new_oid,
 						 err)) {
 			char *write_err = strbuf_detach(err, NULL);
@@ -2591,12 +3390,17 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 	int head_type;
 	struct files_transaction_backend_data *backend_data;
 	struct ref_transaction *packed_transaction = NULL;
+	int pack_threshold = 0;
+	int pack_updates;
 
 	assert(err);
 
 	if (!transaction->nr)
 		goto cleanup;
 
+	git_config_get_int("core.packedrefsupdatethreshold", &pack_threshold);
+	pack_updates = pack_threshold > 0 && transaction->nr >= pack_threshold;
+
 	CALLOC_ARRAY(backend_data, 1);
 	transaction->backend_data = backend_data;
 
@@ -2668,16 +3472,19 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 		struct ref_update *update = transaction->updates[i];
 
 		ret = lock_ref_for_update(refs, update, transaction,
-					  head_ref, &affected_refnames, err);
+					  head_ref, &affected_refnames,
+					  pack_updates, err);
 		if (ret)
 			goto cleanup;
 
-		if (update->flags & REF_DELETING &&
-		    !(update->flags & REF_LOG_ONLY) &&
-		    !(update->flags & REF_IS_PRUNING)) {
+		if ((update->flags & REF_DELETING &&
+		     !(update->flags & REF_LOG_ONLY) &&
+		     !(update->flags & REF_IS_PRUNING)) ||
+		    update->flags & REF_NEEDS_PACKED_COMMIT) {
 			/*
 			 * This reference has to be deleted from
-			 * packed-refs if it exists there.
+			 * packed-refs if it exists there, or have its
+			 * new value written there.
 			 */
 			if (!packed_transaction) {
 				packed_transaction = ref_store_transaction_begin(
@@ -2691,9 +3498,17 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 					packed_transaction;
 			}
 
+			/*
+			 * Our own transaction already reports the
+			 * new values to the reference-transaction hook;
+			 * only the deletions are reported again, as
+			 * they always have been.
+			 */
 			ref_transaction_add_update(
 					packed_transaction, update->refname,
-					REF_HAVE_NEW | REF_NO_DEREF,
+					REF_HAVE_NEW | REF_NO_DEREF |
+					(update->flags & REF_NEEDS_PACKED_COMMIT ?
+					 REF_SKIP_HOOK : 0),
 					&update->new_oid, NULL,
 					NULL);
 		}
@@ -2750,6 +3565,29 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 	return ret;
 }
 
+/*
+ * Rename the lockfile of `update` into place if it needs it, and
+ * return 0, or TRANSACTION_GENERIC_ERROR on failure.
+ */
+static int commit_transaction_update(struct files_ref_store *refs,
+				     struct ref_update *update,
+				     struct strbuf *err)
+{
+	struct ref_lock *lock = update->backend_data;
+
+	if (!(update->flags & REF_NEEDS_COMMIT))
+		return 0;
+
+	clear_loose_ref_cache(refs);
+	if (commit_ref(lock)) {
+		strbuf_addf(err, "couldn't set '%s'", lock->ref_name);
+		unlock_ref(lock);
+		update->backend_data = NULL;
+		return TRANSACTION_GENERIC_ERROR;
+	}
+	return 0;
+}
+
 static int files_transaction_finish(struct ref_store *ref_store,
 				    struct ref_transaction *transaction,
 				    struct strbuf *err)
@@ -2761,6 +3599,7 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	struct strbuf sb = STRBUF_INIT;
 	struct files_transaction_backend_data *backend_data;
 	struct ref_transaction *packed_transaction;
+	int batch_fsync;
 
 
 	assert(err);
@@ -2773,12 +3612,19 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	backend_data = transaction->backend_data;
 	packed_transaction = backend_data->packed_transaction;
 
-	/* Perform updates first so live commits remain referenced */
+	/*
+	 * Perform updates first so live commits remain referenced.
+	 * With core.fsyncRefFiles=batch, write all of the reflog
+	 * entries before renaming any ref into place, so that a single
+	 * flush makes them durable together with the new values.
+	 */
+	batch_fsync = fsync_ref_files == FSYNC_OBJECT_FILES_BATCH;
 	for (i = 0; i < transaction->nr; i++) {
 		struct ref_update *update = transaction->updates[i];
 		struct ref_lock *lock = update->backend_data;
 
 		if (update->flags & REF_NEEDS_COMMIT ||
+		    update->flags & REF_NEEDS_PACKED_COMMIT ||
 		    update->flags & REF_LOG_ONLY) {
 			if (files_log_ref_write(refs,
 						lock->ref_name,
@@ -2797,16 +3643,16 @@ static int files_transaction_finish(struct ref_store *ref_store,
 				goto cleanup;
 			}
 		}
-		if (update->flags & REF_NEEDS_COMMIT) {
-			clear_loose_ref_cache(refs);
-			if (commit_ref(lock)) {
-				strbuf_addf(err, "couldn't set '%s'", lock->ref_name);
-				unlock_ref(lock);
-				update->backend_data = NULL;
-				ret = TRANSACTION_GENERIC_ERROR;
+		if (!batch_fsync && (ret = commit_transaction_update(refs, update, err)))
+			goto cleanup;
+	}
+	if (batch_fsync) {
+		flush_ref_files(refs);
+		for (i = 0; i < transaction->nr; i++)
+			if ((ret = commit_transaction_update(refs,
+							     transaction->updates[i],
+							     err)))
 				goto cleanup;
-			}
-		}
 	}
 
 	/*
@@ -2827,6 +3673,7 @@ static int files_transaction_finish(struct ref_store *ref_store,
 			if (!unlink_or_warn(sb.buf))
 				try_remove_empty_parents(refs, update->refname,
 							 REMOVE_EMPTY_PARENTS_REFLOG);
+			delete_reflog_index(refs, update->refname);
 		}
 	}
 
@@ -2834,7 +3681,9 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	 * Perform deletes now that updates are safely completed.
 	 *
 	 * First delete any packed versions of the references, while
-	 * retaining the packed-refs lock:
+	 * retaining the packed-refs lock. This also writes the new
+	 * values of any references marked REF_NEEDS_PACKED_COMMIT; their
+	 * loose lockfiles are simply rolled back by the cleanup below.
 	 */
 	if (packed_transaction) {
 		ret = ref_transaction_commit(packed_transaction, err);
@@ -3005,6 +3854,7 @@ struct expire_reflog_cb {
 	void *policy_cb;
 	FILE *newlog;
 	struct object_id last_kept_oid;
+	int changed;
 };
 
 static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
@@ -3014,11 +3864,15 @@ static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
 	struct expire_reflog_cb *cb = cb_data;
 	struct expire_reflog_policy_cb *policy_cb = cb->policy_cb;
 
-	if (cb->flags & EXPIRE_REFLOGS_REWRITE)
+	if (cb->flags & EXPIRE_REFLOGS_REWRITE) {
+		if (!oideq(ooid, &cb->last_kept_oid))
+			cb->changed = 1;
 		ooid = &cb->last_kept_oid;
+	}
 
 	if ((*cb->should_prune_fn)(ooid, noid, email, timestamp, tz,
 				   message, policy_cb)) {
+		cb->changed = 1;
 		if (!cb->newlog)
 			printf("would prune %s", message);
 		else if (cb->flags & EXPIRE_REFLOGS_VERBOSE)
@@ -3119,7 +3973,10 @@ static int files_reflog_expire(struct ref_store *ref_store,
 			!(type & REF_ISSYMREF) &&
 			!is_null_oid(&cb.last_kept_oid);
 
-		if (close_lock_file_gently(&reflog_lock)) {
+		if (!cb.changed && !update) {
+			/* nothing expired; leave the reflog alone */
+			rollback_lock_file(&reflog_lock);
+		} else if (close_lock_file_gently(&reflog_lock)) {
 			status |= error("couldn't write %s: %s", log_file,
 					strerror(errno));
 			rollback_lock_file(&reflog_lock);
@@ -3134,8 +3991,13 @@ static int files_reflog_expire(struct ref_store *ref_store,
 		} else if (commit_lock_file(&reflog_lock)) {
 			status |= error("unable to write reflog '%s' (%s)",
 					log_file, strerror(errno));
-		} else if (update && commit_ref(lock)) {
-			status |= error("couldn't set %s", lock->ref_name);
+		} else {
+			/* the entries have moved; index them anew */
+			delete_reflog_index(refs, refname);
+			if (reflog_index_enabled())
+				update_reflog_index(refs, refname);
+			if (update && commit_ref(lock))
+				status |= error("couldn't set %s", lock->ref_name);
 		}
 	}
 	free(log_file);
@@ -3191,6 +4053,7 @@ struct ref_storage_be refs_be_files = {
 	files_reflog_iterator_begin,
 	files_for_each_reflog_ent,
 	files_for_each_reflog_ent_reverse,
+	files_for_each_reflog_ent_reverse_from,
 	files_reflog_exists,
 	files_create_reflog,
 	files_delete_reflog,
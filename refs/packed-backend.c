@@ -6,6 +6,7 @@
 #include "../iterator.h"
 #include "../lockfile.h"
 #include "../chdir-notify.h"
+#include "../csum-file.h"
 
 enum mmap_strategy {
 	/*
@@ -106,6 +107,39 @@ struct snapshot {
 	 * replaced since we read it.
 	 */
 	struct stat_validity validity;
+
+	/*
+	 * If a valid `packed-refs.idx` file was found for this
+	 * snapshot, `index_data` holds its contents and `nr` is the
+	 * number of records; `fanout` and `offsets` point into it (see
+	 * "PACKED-REFS INDEX" below). Otherwise `index_data` is NULL.
+	 */
+	unsigned char *index_data;
+	size_t index_size;
+	int index_mmapped;
+	const unsigned char *fanout;
+	const unsigned char *offsets;
+	uint32_t nr;
+
+	/*
+	 * Is this a snapshot of the `packed-refs.delta` file rather
+	 * than of `packed-refs` (see "PACKED-REFS DELTA" below)?
+	 */
+	int is_delta;
+
+	/*
+	 * The "id=" trait of a `packed-refs` file, or the "delta-for="
+	 * trait of a `packed-refs.delta` file, if any.
+	 */
+	char *id;
+
+	/*
+	 * For a `packed-refs` snapshot with an id, the snapshot of the
+	 * `packed-refs.delta` file that applies to it (or NULL), and
+	 * the metadata of that file, used to tell if it has changed.
+	 */
+	struct snapshot *delta;
+	struct stat_validity delta_validity;
 };
 
 /*
@@ -131,6 +165,12 @@ struct packed_ref_store {
 	/* The path of the "packed-refs" file: */
 	char *path;
 
+	/* The path of its "packed-refs.idx" file: */
+	char *index_path;
+
+	/* The path of its "packed-refs.delta" file: */
+	char *delta_path;
+
 	/*
 	 * A snapshot of the values read from the `packed-refs` file,
 	 * if it might still be current; otherwise, NULL.
@@ -149,8 +189,32 @@ struct packed_ref_store {
 	 * `packed_ref_store`) must not be freed.
 	 */
 	struct tempfile *tempfile;
+
+	/*
+	 * The record offsets and fanout counts of the contents written
+	 * to `tempfile`, used to write "packed-refs.idx" once it has
+	 * been renamed into place. `new_index_ok` is cleared if the new
+	 * contents cannot be indexed.
+	 */
+	uint32_t *new_offsets;
+	size_t new_nr, new_alloc;
+	uint32_t new_fanout[256];
+	size_t new_header_len;
+	int new_index_ok;
+
+	/*
+	 * Set if `tempfile` holds a new `packed-refs.delta` file
+	 * rather than a new `packed-refs` file.
+	 */
+	int writing_delta;
 };
 
+static const char *snapshot_path(struct snapshot *snapshot)
+{
+	return snapshot->is_delta ? snapshot->refs->delta_path :
+		snapshot->refs->path;
+}
+
 /*
  * Increment the reference count of `*snapshot`.
  */
@@ -169,7 +233,7 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 	if (snapshot->mmapped) {
 		if (munmap(snapshot->buf, snapshot->eof - snapshot->buf))
 			die_errno("error ummapping packed-refs file %s",
-				  snapshot->refs->path);
+				  snapshot_path(snapshot));
 		snapshot->mmapped = 0;
 	} else {
 		free(snapshot->buf);
@@ -181,11 +245,27 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
  * Decrease the reference count of `*snapshot`. If it goes to zero,
  * free `*snapshot` and return true; otherwise return false.
  */
+static void clear_snapshot_index(struct snapshot *snapshot)
+{
+	if (snapshot->index_mmapped)
+		munmap(snapshot->index_data, snapshot->index_size);
+	else
+		free(snapshot->index_data);
+	snapshot->index_data = NULL;
+	snapshot->fanout = snapshot->offsets = NULL;
+	snapshot->nr = 0;
+}
+
 static int release_snapshot(struct snapshot *snapshot)
 {
 	if (!--snapshot->referrers) {
 		stat_validity_clear(&snapshot->validity);
+		stat_validity_clear(&snapshot->delta_validity);
+		if (snapshot->delta)
+			release_snapshot(snapshot->delta);
+		clear_snapshot_index(snapshot);
 		clear_snapshot_buffer(snapshot);
+		free(snapshot->id);
 		free(snapshot);
 		return 1;
 	} else {
@@ -205,6 +285,10 @@ struct ref_store *packed_ref_store_create(const char *path,
 
 	refs->path = xstrdup(path);
 	chdir_notify_reparent("packed-refs", &refs->path);
+	refs->index_path = xstrfmt("%s.idx", path);
+	chdir_notify_reparent("packed-refs index", &refs->index_path);
+	refs->delta_path = xstrfmt("%s.delta", path);
+	chdir_notify_reparent("packed-refs delta", &refs->delta_path);
 
 	return ref_store;
 }
@@ -346,7 +430,7 @@ static void sort_snapshot(struct snapshot *snapshot)
 			/* The safety check should prevent this. */
 			BUG("unterminated line found in packed-refs");
 		if (eol - pos < the_hash_algo->hexsz + 2)
-			die_invalid_line(snapshot->refs->path,
+			die_invalid_line(snapshot_path(snapshot),
 					 pos, eof - pos);
 		eol++;
 		if (eol < eof && *eol == '^') {
@@ -458,7 +542,7 @@ static void verify_buffer_safe(struct snapshot *snapshot)
 
 	last_line = find_start_of_record(start, eof - 1);
 	if (*(eof - 1) != '\n' || eof - last_line < the_hash_algo->hexsz + 2)
-		die_invalid_line(snapshot->refs->path,
+		die_invalid_line(snapshot_path(snapshot),
 				 last_line, eof - last_line);
 }
 
@@ -470,14 +554,14 @@ static void verify_buffer_safe(struct snapshot *snapshot)
  * existed and was read, or 0 if the file was absent or empty. Die on
  * errors.
  */
-static int load_contents(struct snapshot *snapshot)
+static int load_contents(struct snapshot *snapshot, struct stat *st_out)
 {
 	int fd;
 	struct stat st;
 	size_t size;
 	ssize_t bytes_read;
 
-	fd = open(snapshot->refs->path, O_RDONLY);
+	fd = open(snapshot_path(snapshot), O_RDONLY);
 	if (fd < 0) {
 		if (errno == ENOENT) {
 			/*
@@ -489,15 +573,16 @@ static int load_contents(struct snapshot *snapshot)
 			 */
 			return 0;
 		} else {
-			die_errno("couldn't read %s", snapshot->refs->path);
+			die_errno("couldn't read %s", snapshot_path(snapshot));
 		}
 	}
 
 	stat_validity_update(&snapshot->validity, fd);
 
 	if (fstat(fd, &st) < 0)
-		die_errno("couldn't stat %s", snapshot->refs->path);
+		die_errno("couldn't stat %s", snapshot_path(snapshot));
 	size = xsize_t(st.st_size);
+	*st_out = st;
 
 	if (!size) {
 		close(fd);
@@ -506,7 +591,7 @@ static int load_contents(struct snapshot *snapshot)
 		snapshot->buf = xmalloc(size);
 		bytes_read = read_in_full(fd, snapshot->buf, size);
 		if (bytes_read < 0 || bytes_read != size)
-			die_errno("couldn't read %s", snapshot->refs->path);
+			die_errno("couldn't read %s", snapshot_path(snapshot));
 		snapshot->mmapped = 0;
 	} else {
 		snapshot->buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
@@ -534,6 +619,230 @@ static int load_contents(struct snapshot *snapshot)
  * The record is sought using a binary search, so `snapshot->buf` must
  * be sorted.
  */
+/*
+ * PACKED-REFS INDEX
+ *
+ * A sorted `packed-refs` file may be accompanied by a `packed-refs.idx`
+ * file (written when `core.packedRefsIndex` is set), which lets us find
+ * records without scanning for line boundaries. It consists of:
+ *
+ *   - a 4-byte signature, "PRIX", and a 4-byte version number (1)
+ *   - the stat data (as in the index: ctime, mtime, dev, ino, uid,
+ *     gid and size, nine 4-byte words) of the `packed-refs` file it
+ *     describes, a reserved 4-byte word, and the length of that
+ *     file's header line
+ *   - the 4-byte number of records
+ *   - a fanout table of 256 4-byte entries; entry `c` is the number of
+ *     records whose refname has a byte no greater than `c` right after
+ *     the leading "refs/" (every indexed refname starts with "refs/")
+ *   - a 4-byte offset for each record, relative to the end of the
+ *     header line, in refname order
+ *   - a trailing checksum
+ *
+ * All integers are in network byte order. If the stat data does not
+ * match the `packed-refs` file we read, the index is ignored, so a
+ * `packed-refs` file rewritten by a Git that does not know about the
+ * index is still read correctly.
+ */
+#define PACKED_REFS_INDEX_SIGNATURE 0x50524958 /* "PRIX" */
+#define PACKED_REFS_INDEX_VERSION 1
+#define PACKED_REFS_INDEX_HEADER_SIZE (4 * 14)
+#define PACKED_REFS_INDEX_FANOUT_SIZE (4 * 256)
+
+static void stat_data_to_index(unsigned char *out, const struct stat_data *sd)
+{
+	put_be32(out, sd->sd_ctime.sec);
+	put_be32(out + 4, sd->sd_ctime.nsec);
+	put_be32(out + 8, sd->sd_mtime.sec);
+	put_be32(out + 12, sd->sd_mtime.nsec);
+	put_be32(out + 16, sd->sd_dev);
+	put_be32(out + 20, sd->sd_ino);
+	put_be32(out + 24, sd->sd_uid);
+	put_be32(out + 28, sd->sd_gid);
+	put_be32(out + 32, sd->sd_size);
+}
+
+static void stat_data_from_index(struct stat_data *sd, const unsigned char *in)
+{
+	sd->sd_ctime.sec = get_be32(in);
+	sd->sd_ctime.nsec = get_be32(in + 4);
+	sd->sd_mtime.sec = get_be32(in + 8);
+	sd->sd_mtime.nsec = get_be32(in + 12);
+	sd->sd_dev = get_be32(in + 16);
+	sd->sd_ino = get_be32(in + 20);
+	sd->sd_uid = get_be32(in + 24);
+	sd->sd_gid = get_be32(in + 28);
+	sd->sd_size = get_be32(in + 32);
+}
+
+/*
+ * Load `packed-refs.idx` into `snapshot` if it describes the
+ * `packed-refs` file we read (whose stat information is `st`).
+ * Silently ignore a missing, stale or malformed index.
+ */
+static void load_snapshot_index(struct snapshot *snapshot, struct stat *st)
+{
+	const char *path = snapshot->refs->index_path;
+	const size_t hashsz = the_hash_algo->rawsz;
+	struct stat_data sd;
+	struct stat idx_st;
+	unsigned char *data;
+	size_t size;
+	uint32_t nr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &idx_st) < 0) {
+		close(fd);
+		return;
+	}
+	size = xsize_t(idx_st.st_size);
+	if (size < PACKED_REFS_INDEX_HEADER_SIZE +
+		   PACKED_REFS_INDEX_FANOUT_SIZE + hashsz) {
+		close(fd);
+		return;
+	}
+	if (mmap_strategy == MMAP_OK) {
+		data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		snapshot->index_mmapped = 1;
+	} else {
+		data = xmalloc(size);
+		if (read_in_full(fd, data, size) != size) {
+			free(data);
+			close(fd);
+			return;
+		}
+		snapshot->index_mmapped = 0;
+	}
+	close(fd);
+	snapshot->index_data = data;
+	snapshot->index_size = size;
+
+	if (get_be32(data) != PACKED_REFS_INDEX_SIGNATURE ||
+	    get_be32(data + 4) != PACKED_REFS_INDEX_VERSION)
+		goto ignore;
+
+	stat_data_from_index(&sd, data + 8);
+	if (match_stat_data(&sd, st))
+		goto ignore;
+	if (get_be32(data + 48) != snapshot->start - snapshot->buf)
+		goto ignore;
+
+	nr = get_be32(data + 52);
+	if (size != PACKED_REFS_INDEX_HEADER_SIZE +
+		    PACKED_REFS_INDEX_FANOUT_SIZE +
+		    st_mult(4, nr) + hashsz)
+		goto ignore;
+
+	snapshot->fanout = data + PACKED_REFS_INDEX_HEADER_SIZE;
+	snapshot->offsets = snapshot->fanout + PACKED_REFS_INDEX_FANOUT_SIZE;
+	snapshot->nr = nr;
+	if (get_be32(snapshot->fanout + 4 * 255) != nr)
+		goto ignore;
+	return;
+
+ignore:
+	clear_snapshot_index(snapshot);
+}
+
+/*
+ * Return the record at position `pos` of the index, making sure it
+ * lies within the buffer.
+ */
+static const char *indexed_record(struct snapshot *snapshot, uint32_t pos)
+{
+	uint32_t ofs = get_be32(snapshot->offsets + 4 * (size_t)pos);
+	const char *rec = snapshot->start + ofs;
+
+	if (ofs >= snapshot->eof - snapshot->start ||
+	    snapshot->eof - rec < the_hash_algo->hexsz + 2 ||
+	    (ofs && rec[-1] != '\n'))
+		die("packed-refs index %s is corrupt",
+		    snapshot->refs->index_path);
+	return rec;
+}
+
+/*
+ * Narrow the range of records that may contain `refname`, or names
+ * starting with it, using the fanout table.
+ */
+static void indexed_range(struct snapshot *snapshot, const char *refname,
+			  uint32_t *lo, uint32_t *hi)
+{
+	const char *rest;
+	unsigned char c;
+
+	*lo = 0;
+	*hi = snapshot->nr;
+
+	if (!skip_prefix(refname, "refs/", &rest) || !*rest) {
+		/*
+		 * Every indexed record starts with "refs/", so whatever
+		 * sorts before it comes at the start of the file.
+		 */
+		if (strcmp(refname, "refs/") < 0 && !starts_with("refs/", refname))
+			*hi = 0;
+		return;
+	}
+
+	c = *rest;
+	if (c)
+		*lo = get_be32(snapshot->fanout + 4 * (c - 1));
+	*hi = get_be32(snapshot->fanout + 4 * c);
+}
+
+/*
+ * Like `find_reference_location()`, but using the index. If `prefix`
+ * is true, instead find the first record whose refname neither starts
+ * with `refname` nor sorts before it.
+ */
+static const char *find_indexed_location(struct snapshot *snapshot,
+					 const char *refname, int mustexist,
+					 int prefix)
+{
+	uint32_t lo, hi;
+	size_t len = strlen(refname);
+
+	indexed_range(snapshot, refname, &lo, &hi);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const char *rec = indexed_record(snapshot, mi);
+		int cmp;
+
+		if (prefix) {
+			const char *name = rec + the_hash_algo->hexsz + 1;
+			const char *eol = memchr(name, '\n', snapshot->eof - name);
+			size_t namelen = eol - name;
+
+			/*
+			 * A name that starts with `refname`, or that is
+			 * a prefix of it, sorts before our target.
+			 */
+			cmp = memcmp(name, refname, namelen < len ? namelen : len);
+			if (!cmp)
+				cmp = -1;
+		} else {
+			cmp = cmp_record_to_refname(rec, refname);
+		}
+
+		if (cmp < 0)
+			lo = mi + 1;
+		else if (cmp > 0)
+			hi = mi;
+		else
+			return rec;
+	}
+
+	if (mustexist)
+		return NULL;
+	if (lo == snapshot->nr)
+		return snapshot->eof;
+	return indexed_record(snapshot, lo);
+}
+
 static const char *find_reference_location(struct snapshot *snapshot,
 					   const char *refname, int mustexist)
 {
@@ -559,6 +868,9 @@ static const char *find_reference_location(struct snapshot *snapshot,
 	 */
 	const char *hi = snapshot->eof;
 
+	if (snapshot->index_data)
+		return find_indexed_location(snapshot, refname, mustexist, 0);
+
 	while (lo != hi) {
 		const char *mid, *rec;
 		int cmp;
@@ -613,35 +925,43 @@ static const char *find_reference_location(struct snapshot *snapshot,
  *   `sorted`:
  *
  *      The references in this file are known to be sorted by refname.
+ *
+ *   `id=<id>`, `delta-for=<id>`:
+ *
+ *      See "PACKED-REFS DELTA" below.
  */
-static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+static struct snapshot *load_snapshot(struct packed_ref_store *refs,
+				      int is_delta)
 {
 	struct snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
 	int sorted = 0;
+	struct stat st;
 
 	snapshot->refs = refs;
+	snapshot->is_delta = is_delta;
 	acquire_snapshot(snapshot);
 	snapshot->peeled = PEELED_NONE;
 
-	if (!load_contents(snapshot))
+	if (!load_contents(snapshot, &st))
 		return snapshot;
 
 	/* If the file has a header line, process it: */
 	if (snapshot->buf < snapshot->eof && *snapshot->buf == '#') {
 		char *tmp, *p, *eol;
 		struct string_list traits = STRING_LIST_INIT_NODUP;
+		int i;
 
 		eol = memchr(snapshot->buf, '\n',
 			     snapshot->eof - snapshot->buf);
 		if (!eol)
-			die_unterminated_line(refs->path,
+			die_unterminated_line(snapshot_path(snapshot),
 					      snapshot->buf,
 					      snapshot->eof - snapshot->buf);
 
 		tmp = xmemdupz(snapshot->buf, eol - snapshot->buf);
 
 		if (!skip_prefix(tmp, "# pack-refs with:", (const char **)&p))
-			die_invalid_line(refs->path,
+			die_invalid_line(snapshot_path(snapshot),
 					 snapshot->buf,
 					 snapshot->eof - snapshot->buf);
 
@@ -654,6 +974,17 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 
 		sorted = unsorted_string_list_has_string(&traits, "sorted");
 
+		for (i = 0; i < traits.nr; i++) {
+			const char *id;
+
+			if (skip_prefix(traits.items[i].string,
+					is_delta ? "delta-for=" : "id=", &id) &&
+			    *id) {
+				free(snapshot->id);
+				snapshot->id = xstrdup(id);
+			}
+		}
+
 		/* perhaps other traits later as well */
 
 		/* The "+ 1" is for the LF character. */
@@ -674,6 +1005,8 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		 * safety again:
 		 */
 		verify_buffer_safe(snapshot);
+	} else if (!is_delta) {
+		load_snapshot_index(snapshot, &st);
 	}
 
 	if (mmap_strategy != MMAP_OK && snapshot->mmapped) {
@@ -693,6 +1026,53 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 	return snapshot;
 }
 
+/*
+ * PACKED-REFS DELTA
+ *
+ * With `core.packedRefsDeltaLimit`, small updates to the packed refs
+ * are not written by rewriting the whole `packed-refs` file, but by
+ * rewriting a small `packed-refs.delta` file next to it. It has the
+ * same format as `packed-refs` (sorted, with all peeled values),
+ * except that a record with the null object name says that the
+ * reference is deleted. Its records take precedence over those of
+ * `packed-refs`.
+ *
+ * Once the delta grows past the limit, the next update rewrites
+ * `packed-refs` with the delta folded in and removes the delta.
+ *
+ * So that a delta is never applied to a `packed-refs` file it was not
+ * written for (e.g., one rewritten by a Git that does not know about
+ * deltas), every `packed-refs` file written while deltas are enabled
+ * carries a unique "id=<id>" trait in its header, and the delta a
+ * "delta-for=<id>" trait naming it. A delta for another id is ignored.
+ */
+
+/*
+ * Create a newly-allocated `snapshot` of the `packed-refs` file,
+ * together with its delta, in their current state and return it. The
+ * return value will already have its reference count incremented.
+ */
+static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+{
+	struct snapshot *snapshot = load_snapshot(refs, 0);
+	struct snapshot *delta;
+
+	/* older Git ignores deltas, so they only exist with the extension */
+	if (!snapshot->id || !repository_format_packed_refs_delta)
+		return snapshot;
+
+	delta = load_snapshot(refs, 1);
+	/* our own validity is that of the delta file we read */
+	snapshot->delta_validity = delta->validity;
+	delta->validity.sd = NULL;
+
+	if (delta->id && !strcmp(delta->id, snapshot->id))
+		snapshot->delta = delta;
+	else
+		release_snapshot(delta);
+	return snapshot;
+}
+
 /*
  * Check that `refs->snapshot` (if present) still reflects the
  * contents of the `packed-refs` file. If not, clear the snapshot.
@@ -700,7 +1080,10 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 static void validate_snapshot(struct packed_ref_store *refs)
 {
 	if (refs->snapshot &&
-	    !stat_validity_check(&refs->snapshot->validity, refs->path))
+	    (!stat_validity_check(&refs->snapshot->validity, refs->path) ||
+	     (refs->snapshot->id &&
+	      !stat_validity_check(&refs->snapshot->delta_validity,
+				   refs->delta_path))))
 		clear_snapshot(refs);
 }
 
@@ -724,6 +1107,36 @@ static struct snapshot *get_snapshot(struct packed_ref_store *refs)
 	return refs->snapshot;
 }
 
+/*
+ * Look `refname` up in `snapshot` alone, not taking its delta into
+ * account, and store its value in `oid`. Return 0 if it was found.
+ */
+static int snapshot_read_ref_layer(struct snapshot *snapshot,
+				   const char *refname, struct object_id *oid)
+{
+	const char *rec = find_reference_location(snapshot, refname, 1);
+
+	if (!rec)
+		return -1;
+	if (get_oid_hex(rec, oid))
+		die_invalid_line(snapshot_path(snapshot), rec,
+				 snapshot->eof - rec);
+	return 0;
+}
+
+/*
+ * Look `refname` up in `snapshot` and its delta, and store its value
+ * in `oid`. Return 0 if it was found.
+ */
+static int snapshot_read_ref(struct snapshot *snapshot,
+			     const char *refname, struct object_id *oid)
+{
+	if (snapshot->delta &&
+	    !snapshot_read_ref_layer(snapshot->delta, refname, oid))
+		return is_null_oid(oid) ? -1 : 0;
+	return snapshot_read_ref_layer(snapshot, refname, oid);
+}
+
 static int packed_read_raw_ref(struct ref_store *ref_store,
 			       const char *refname, struct object_id *oid,
 			       struct strbuf *referent, unsigned int *type)
@@ -731,21 +1144,15 @@ static int packed_read_raw_ref(struct ref_store *ref_store,
 	struct packed_ref_store *refs =
 		packed_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
 	struct snapshot *snapshot = get_snapshot(refs);
-	const char *rec;
 
 	*type = 0;
 
-	rec = find_reference_location(snapshot, refname, 1);
-
-	if (!rec) {
+	if (snapshot_read_ref(snapshot, refname, oid)) {
 		/* refname is not a packed reference. */
 		errno = ENOENT;
 		return -1;
 	}
 
-	if (get_oid_hex(rec, oid))
-		die_invalid_line(refs->path, rec, snapshot->eof - rec);
-
 	*type = REF_ISPACKED;
 	return 0;
 }
@@ -800,12 +1207,12 @@ static int next_record(struct packed_ref_iterator *iter)
 	if (iter->eof - p < the_hash_algo->hexsz + 2 ||
 	    parse_oid_hex(p, &iter->oid, &p) ||
 	    !isspace(*p++))
-		die_invalid_line(iter->snapshot->refs->path,
+		die_invalid_line(snapshot_path(iter->snapshot),
 				 iter->pos, iter->eof - iter->pos);
 
 	eol = memchr(p, '\n', iter->eof - p);
 	if (!eol)
-		die_unterminated_line(iter->snapshot->refs->path,
+		die_unterminated_line(snapshot_path(iter->snapshot),
 				      iter->pos, iter->eof - iter->pos);
 
 	strbuf_add(&iter->refname_buf, p, eol - p);
@@ -830,7 +1237,7 @@ static int next_record(struct packed_ref_iterator *iter)
 		if (iter->eof - p < the_hash_algo->hexsz + 1 ||
 		    parse_oid_hex(p, &iter->peeled, &p) ||
 		    *p++ != '\n')
-			die_invalid_line(iter->snapshot->refs->path,
+			die_invalid_line(snapshot_path(iter->snapshot),
 					 iter->pos, iter->eof - iter->pos);
 		iter->pos = p;
 
@@ -911,27 +1318,18 @@ static struct ref_iterator_vtable packed_ref_iterator_vtable = {
 	packed_ref_iterator_abort
 };
 
-static struct ref_iterator *packed_ref_iterator_begin(
-		struct ref_store *ref_store,
-		const char *prefix, unsigned int flags)
+/*
+ * Iterate over the records of `snapshot` alone, not taking its delta
+ * into account, starting with those that start with `prefix`; the
+ * caller must stop the iteration once past them.
+ */
+static struct ref_iterator *snapshot_iterator_begin(struct snapshot *snapshot,
+						   const char *prefix,
+						   unsigned int flags)
 {
-	struct packed_ref_store *refs;
-	struct snapshot *snapshot;
-	const char *start;
+	const char *start, *eof;
 	struct packed_ref_iterator *iter;
 	struct ref_iterator *ref_iterator;
-	unsigned int required_flags = REF_STORE_READ;
-
-	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
-		required_flags |= REF_STORE_ODB;
-	refs = packed_downcast(ref_store, required_flags, "ref_iterator_begin");
-
-	/*
-	 * Note that `get_snapshot()` internally checks whether the
-	 * snapshot is up to date with what is on disk, and re-reads
-	 * it if not.
-	 */
-	snapshot = get_snapshot(refs);
 
 	if (prefix && *prefix)
 		start = find_reference_location(snapshot, prefix, 0);
@@ -941,6 +1339,12 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	if (start == snapshot->eof)
 		return empty_ref_iterator_begin();
 
+	/* With an index, we can also tell where the prefix ends: */
+	if (prefix && *prefix && snapshot->index_data)
+		eof = find_indexed_location(snapshot, prefix, 0, 1);
+	else
+		eof = snapshot->eof;
+
 	CALLOC_ARRAY(iter, 1);
 	ref_iterator = &iter->base;
 	base_ref_iterator_init(ref_iterator, &packed_ref_iterator_vtable, 1);
@@ -949,13 +1353,99 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	acquire_snapshot(snapshot);
 
 	iter->pos = start;
-	iter->eof = snapshot->eof;
+	iter->eof = eof;
 	strbuf_init(&iter->refname_buf, 0);
 
 	iter->base.oid = &iter->oid;
 
 	iter->flags = flags;
 
+	return ref_iterator;
+}
+
+/*
+ * A ref_iterator_select_fn that overlays the records of a delta on
+ * top of those of its `packed-refs` file, leaving out the references
+ * that the delta deletes. If `check_objects` is set, leave out the
+ * references that the delta sets to missing objects, as the iterator
+ * over `packed-refs` does for its own.
+ */
+static enum iterator_selection select_delta(struct ref_iterator *delta,
+					    struct ref_iterator *base,
+					    int check_objects)
+{
+	int cmp;
+
+	if (!delta)
+		return base ? ITER_SELECT_1 : ITER_SELECT_DONE;
+
+	cmp = base ? strcmp(delta->refname, base->refname) : -1;
+	if (cmp > 0)
+		return ITER_SELECT_1;
+
+	if (is_null_oid(delta->oid) ||
+	    (check_objects &&
+	     !ref_resolves_to_object(delta->refname, delta->oid, delta->flags)))
+		/* drop the record of `base`, then that of `delta` */
+		return cmp ? ITER_SKIP_0 : ITER_SKIP_1;
+
+	return cmp ? ITER_SELECT_0 : ITER_SELECT_0_SKIP_1;
+}
+
+static enum iterator_selection delta_iterator_select(
+		struct ref_iterator *delta, struct ref_iterator *base,
+		void *cb_data)
+{
+	return select_delta(delta, base, 0);
+}
+
+static enum iterator_selection delta_iterator_select_valid(
+		struct ref_iterator *delta, struct ref_iterator *base,
+		void *cb_data)
+{
+	return select_delta(delta, base, 1);
+}
+
+static struct ref_iterator *packed_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct packed_ref_store *refs;
+	struct snapshot *snapshot;
+	struct ref_iterator *ref_iterator;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = packed_downcast(ref_store, required_flags, "ref_iterator_begin");
+
+	/*
+	 * Note that `get_snapshot()` internally checks whether the
+	 * snapshot is up to date with what is on disk, and re-reads
+	 * it if not.
+	 */
+	snapshot = get_snapshot(refs);
+
+	ref_iterator = snapshot_iterator_begin(snapshot, prefix, flags);
+	if (snapshot->delta) {
+		/* we need to see deletions to apply them */
+		struct ref_iterator *delta_iterator =
+			snapshot_iterator_begin(snapshot->delta, prefix,
+						flags | DO_FOR_EACH_INCLUDE_BROKEN);
+
+		if (is_empty_ref_iterator(delta_iterator))
+			ref_iterator_abort(delta_iterator);
+		else
+			ref_iterator = merge_ref_iterator_begin(
+				1, delta_iterator, ref_iterator,
+				(flags & DO_FOR_EACH_INCLUDE_BROKEN) ?
+				delta_iterator_select :
+				delta_iterator_select_valid, NULL);
+	}
+
+	if (is_empty_ref_iterator(ref_iterator))
+		return ref_iterator;
+
 	if (prefix && *prefix)
 		/* Stop iteration after we've gone *past* prefix: */
 		ref_iterator = prefix_ref_iterator_begin(ref_iterator, prefix, 0);
@@ -980,6 +1470,32 @@ static int write_packed_entry(FILE *fh, const char *refname,
 	return 0;
 }
 
+/*
+ * Remember where the record for `refname` starts in the new
+ * `packed-refs` file, and advance `*pos` past it.
+ */
+static void note_packed_entry(struct packed_ref_store *refs, size_t *pos,
+			      const char *refname, int peeled)
+{
+	const char *rest;
+
+	if (refs->new_index_ok) {
+		if (*pos > UINT32_MAX ||
+		    !skip_prefix(refname, "refs/", &rest) || !*rest) {
+			refs->new_index_ok = 0;
+		} else {
+			ALLOC_GROW(refs->new_offsets, refs->new_nr + 1,
+				   refs->new_alloc);
+			refs->new_offsets[refs->new_nr++] = *pos;
+			refs->new_fanout[(unsigned char)*rest]++;
+		}
+	}
+
+	*pos += the_hash_algo->hexsz + 1 + strlen(refname) + 1;
+	if (peeled)
+		*pos += the_hash_algo->hexsz + 2;
+}
+
 int packed_refs_lock(struct ref_store *ref_store, int flags, struct strbuf *err)
 {
 	struct packed_ref_store *refs =
@@ -1078,6 +1594,199 @@ static int packed_init_db(struct ref_store *ref_store, struct strbuf *err)
 	return 0;
 }
 
+/*
+ * Write `packed-refs.idx` for the `packed-refs` file that was just
+ * renamed into place at `packed_refs_path`.
+ */
+static int write_packed_refs_index(struct packed_ref_store *refs,
+				   const char *packed_refs_path)
+{
+	struct lock_file lock = LOCK_INIT;
+	unsigned char buf[PACKED_REFS_INDEX_HEADER_SIZE];
+	struct stat_data sd;
+	struct stat st;
+	struct hashfile *f;
+	uint32_t total = 0;
+	size_t i;
+	int fd;
+
+	if (stat(packed_refs_path, &st) < 0)
+		return error_errno("unable to stat %s", packed_refs_path);
+	fill_stat_data(&sd, &st);
+
+	fd = hold_lock_file_for_update(&lock, refs->index_path, 0);
+	if (fd < 0)
+		return error_errno("unable to lock %s", refs->index_path);
+
+	put_be32(buf, PACKED_REFS_INDEX_SIGNATURE);
+	put_be32(buf + 4, PACKED_REFS_INDEX_VERSION);
+	stat_data_to_index(buf + 8, &sd);
+	put_be32(buf + 44, 0);
+	put_be32(buf + 48, refs->new_header_len);
+	put_be32(buf + 52, refs->new_nr);
+
+	f = hashfd(fd, get_lock_file_path(&lock));
+	hashwrite(f, buf, sizeof(buf));
+	for (i = 0; i < ARRAY_SIZE(refs->new_fanout); i++) {
+		total += refs->new_fanout[i];
+		hashwrite_be32(f, total);
+	}
+	for (i = 0; i < refs->new_nr; i++)
+		hashwrite_be32(f, refs->new_offsets[i]);
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM);
+
+	if (commit_lock_file(&lock) < 0)
+		return error_errno("unable to write %s", refs->index_path);
+	return 0;
+}
+
+static void clear_new_index(struct packed_ref_store *refs)
+{
+	FREE_AND_NULL(refs->new_offsets);
+	refs->new_nr = refs->new_alloc = 0;
+	memset(refs->new_fanout, 0, sizeof(refs->new_fanout));
+	refs->new_header_len = 0;
+	refs->new_index_ok = 0;
+}
+
+/*
+ * Return the number of references recorded in the delta of
+ * `snapshot`, deleted ones included.
+ */
+static size_t count_delta_records(struct snapshot *snapshot)
+{
+	struct snapshot *delta = snapshot->delta;
+	const char *p;
+	size_t nr = 0;
+
+	if (!delta)
+		return 0;
+	for (p = delta->start; p < delta->eof; p = find_end_of_record(p, delta->eof))
+		nr++;
+	return nr;
+}
+
+/*
+ * Write to `out` the records of a new delta for `snapshot`, made of
+ * those of its current delta with `updates` applied (see
+ * `write_with_updates()`). On error, write an error message to `err`
+ * and return a nonzero value.
+ */
+static int write_delta_with_updates(struct snapshot *snapshot,
+				    struct string_list *updates,
+				    FILE *out, struct strbuf *err)
+{
+	struct ref_iterator *iter = NULL;
+	int ok = ITER_DONE;
+	size_t i = 0;
+
+	if (snapshot->delta) {
+		iter = snapshot_iterator_begin(snapshot->delta, "",
+					       DO_FOR_EACH_INCLUDE_BROKEN);
+		if ((ok = ref_iterator_advance(iter)) != ITER_OK)
+			iter = NULL;
+	}
+
+	while (iter || i < updates->nr) {
+		struct ref_update *update;
+		struct object_id old_oid, base_oid, peeled;
+		int cmp, exists, in_base;
+
+		if (i >= updates->nr)
+			cmp = -1;
+		else if (!iter)
+			cmp = +1;
+		else
+			cmp = strcmp(iter->refname,
+				     ((struct ref_update *)updates->items[i].util)->refname);
+
+		if (cmp < 0) {
+			/* Pass the old record through. */
+			int peel_error = ref_iterator_peel(iter, &peeled);
+
+			if (write_packed_entry(out, iter->refname, iter->oid,
+					       peel_error ? NULL : &peeled))
+				goto write_error;
+			if ((ok = ref_iterator_advance(iter)) != ITER_OK)
+				iter = NULL;
+			continue;
+		}
+
+		update = updates->items[i++].util;
+		in_base = !snapshot_read_ref_layer(snapshot, update->refname,
+						   &base_oid);
+		if (!cmp) {
+			oidcpy(&old_oid, iter->oid);
+			exists = !is_null_oid(&old_oid);
+		} else {
+			oidcpy(&old_oid, &base_oid);
+			exists = in_base;
+		}
+
+		if ((update->flags & REF_HAVE_OLD)) {
+			if (exists && is_null_oid(&update->old_oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "reference already exists",
+					    update->refname);
+				goto error;
+			} else if (exists && !oideq(&update->old_oid, &old_oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "is at %s but expected %s",
+					    update->refname,
+					    oid_to_hex(&old_oid),
+					    oid_to_hex(&update->old_oid));
+				goto error;
+			} else if (!exists && !is_null_oid(&update->old_oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "reference is missing but expected %s",
+					    update->refname,
+					    oid_to_hex(&update->old_oid));
+				goto error;
+			}
+		}
+
+		if (!(update->flags & REF_HAVE_NEW)) {
+			/* Keep whatever the delta said about it. */
+			if (!cmp)
+				continue;
+		} else if (is_null_oid(&update->new_oid)) {
+			/*
+			 * Only a reference that `packed-refs` has needs
+			 * a record saying that it is gone.
+			 */
+			if (in_base &&
+			    write_packed_entry(out, update->refname,
+					       null_oid(), NULL))
+				goto write_error;
+		} else {
+			int peel_error = peel_object(&update->new_oid, &peeled);
+
+			if (write_packed_entry(out, update->refname,
+					       &update->new_oid,
+					       peel_error ? NULL : &peeled))
+				goto write_error;
+		}
+
+		if (!cmp && (ok = ref_iterator_advance(iter)) != ITER_OK)
+			iter = NULL;
+	}
+
+	if (ok != ITER_DONE) {
+		strbuf_addstr(err, "unable to write packed-refs delta: "
+			      "error iterating over old contents");
+		goto error;
+	}
+	return 0;
+
+write_error:
+	strbuf_addf(err, "error writing packed-refs delta: %s",
+		    strerror(errno));
+error:
+	if (iter)
+		ref_iterator_abort(iter);
+	return -1;
+}
+
 /*
  * Write the packed refs from the current snapshot to the packed-refs
  * tempfile, incorporating any changes from `updates`. `updates` must
@@ -1085,6 +1794,9 @@ static int packed_init_db(struct ref_store *ref_store, struct strbuf *err)
  * values are `struct ref_update *`. On error, rollback the tempfile,
  * write an error message to `err`, and return a nonzero value.
  *
+ * If the updates fit in the delta (see "PACKED-REFS DELTA"), write a
+ * new delta to the tempfile instead, and set `refs->writing_delta`.
+ *
  * The packfile must be locked before calling this function and will
  * remain locked when it is done.
  */
@@ -1093,28 +1805,66 @@ static int write_with_updates(struct packed_ref_store *refs,
 			      struct strbuf *err)
 {
 	struct ref_iterator *iter = NULL;
+	struct snapshot *snapshot;
 	size_t i;
 	int ok;
 	FILE *out;
 	struct strbuf sb = STRBUF_INIT;
+	struct strbuf header = STRBUF_INIT;
 	char *packed_refs_path;
+	size_t pos = 0;
+	int want_index = 0;
+	int delta_limit = 0;
 
 	if (!is_lock_file_locked(&refs->lock))
 		BUG("write_with_updates() called while unlocked");
 
-	/*
-	 * If packed-refs is a symlink, we want to overwrite the
-	 * symlinked-to file, not the symlink itself. Also, put the
-	 * staging file next to it:
-	 */
-	packed_refs_path = get_locked_file_path(&refs->lock);
-	strbuf_addf(&sb, "%s.new", packed_refs_path);
-	free(packed_refs_path);
+	clear_new_index(refs);
+	snapshot = get_snapshot(refs);
+	git_config_get_int("core.packedrefsdeltalimit", &delta_limit);
+	if (delta_limit > 0 && !repository_format_packed_refs_delta) {
+		static int warned;
+
+		if (!warned++)
+			warning(_("ignoring core.packedRefsDeltaLimit without "
+				  "extensions.packedRefsDelta"));
+		delta_limit = 0;
+	}
+	refs->writing_delta = delta_limit > 0 && snapshot->id &&
+		count_delta_records(snapshot) + updates->nr <= delta_limit;
+
+	if (refs->writing_delta) {
+		strbuf_addf(&header, "# pack-refs with: peeled fully-peeled "
+			    "sorted delta-for=%s \n", snapshot->id);
+		strbuf_addf(&sb, "%s.new", refs->delta_path);
+	} else {
+		git_config_get_bool("core.packedrefsindex", &want_index);
+		refs->new_index_ok = want_index;
+
+		if (delta_limit > 0)
+			/* a fresh id, so that no old delta applies to us */
+			strbuf_addf(&header, "# pack-refs with: peeled "
+				    "fully-peeled sorted id=%"PRIx64"-%"PRIuMAX" \n",
+				    getnanotime(), (uintmax_t)getpid());
+		else
+			strbuf_addstr(&header, PACKED_REFS_HEADER);
+		refs->new_header_len = header.len;
+
+		/*
+		 * If packed-refs is a symlink, we want to overwrite the
+		 * symlinked-to file, not the symlink itself. Also, put
+		 * the staging file next to it:
+		 */
+		packed_refs_path = get_locked_file_path(&refs->lock);
+		strbuf_addf(&sb, "%s.new", packed_refs_path);
+		free(packed_refs_path);
+	}
 	refs->tempfile = create_tempfile(sb.buf);
 	if (!refs->tempfile) {
 		strbuf_addf(err, "unable to create file %s: %s",
 			    sb.buf, strerror(errno));
 		strbuf_release(&sb);
+		strbuf_release(&header);
 		return -1;
 	}
 	strbuf_release(&sb);
@@ -1126,9 +1876,15 @@ static int write_with_updates(struct packed_ref_store *refs,
 		goto error;
 	}
 
-	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
+	if (fprintf(out, "%s", header.buf) < 0)
 		goto write_error;
 
+	if (refs->writing_delta) {
+		if (write_delta_with_updates(snapshot, updates, out, err))
+			goto error;
+		goto close;
+	}
+
 	/*
 	 * We iterate in parallel through the current list of refs and
 	 * the list of updates, processing an entry from at least one
@@ -1224,6 +1980,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 					       iter->oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
+			note_packed_entry(refs, &pos, iter->refname, !peel_error);
 
 			if ((ok = ref_iterator_advance(iter)) != ITER_OK)
 				iter = NULL;
@@ -1245,6 +2002,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 					       &update->new_oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
+			note_packed_entry(refs, &pos, update->refname, !peel_error);
 
 			i++;
 		}
@@ -1256,6 +2014,13 @@ static int write_with_updates(struct packed_ref_store *refs,
 		goto error;
 	}
 
+close:
+	strbuf_release(&header);
+	/* one file, so there is nothing to batch */
+	if (fsync_ref_files != FSYNC_OBJECT_FILES_OFF &&
+	    (fflush(out) ||
+	     git_fsync(fileno(out), FSYNC_HARDWARE_FLUSH) < 0))
+		goto write_error;
 	if (close_tempfile_gently(refs->tempfile)) {
 		strbuf_addf(err, "error closing file %s: %s",
 			    get_tempfile_path(refs->tempfile),
@@ -1275,6 +2040,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (iter)
 		ref_iterator_abort(iter);
 
+	strbuf_release(&header);
 	delete_tempfile(&refs->tempfile);
 	return -1;
 }
@@ -1390,6 +2156,8 @@ static void packed_transaction_cleanup(struct packed_ref_store *refs,
 
 		if (is_tempfile_active(refs->tempfile))
 			delete_tempfile(&refs->tempfile);
+		clear_new_index(refs);
+		refs->writing_delta = 0;
 
 		if (data->own_lock && is_lock_file_locked(&refs->lock)) {
 			packed_refs_unlock(&refs->base);
@@ -1490,12 +2258,37 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 	clear_snapshot(refs);
 
 	packed_refs_path = get_locked_file_path(&refs->lock);
+	if (refs->writing_delta) {
+		/* `packed-refs` and its index are left as they are */
+		if (rename_tempfile(&refs->tempfile, refs->delta_path)) {
+			strbuf_addf(err, "error replacing %s: %s",
+				    refs->delta_path, strerror(errno));
+			goto cleanup;
+		}
+		ret = 0;
+		goto cleanup;
+	}
+
 	if (rename_tempfile(&refs->tempfile, packed_refs_path)) {
 		strbuf_addf(err, "error replacing %s: %s",
 			    refs->path, strerror(errno));
 		goto cleanup;
 	}
 
+	/*
+	 * The new contents include those of the delta, which no
+	 * longer applies to them.
+	 */
+	unlink_or_warn(refs->delta_path);
+
+	/*
+	 * An index left over from the old contents would be ignored
+	 * anyway, but do not leave it around:
+	 */
+	if (!refs->new_index_ok ||
+	    write_packed_refs_index(refs, packed_refs_path))
+		unlink_or_warn(refs->index_path);
+
 	ret = 0;
 
 cleanup:
@@ -1663,6 +2456,7 @@ struct ref_storage_be refs_be_packed = {
 	packed_reflog_iterator_begin,
 	packed_for_each_reflog_ent,
 	packed_for_each_reflog_ent_reverse,
+	NULL,
 	packed_reflog_exists,
 	packed_create_reflog,
 	packed_delete_reflog,
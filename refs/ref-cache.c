@@ -338,19 +338,29 @@ static enum prefix_state overlaps_prefix(const char *dirname,
 		return PREFIX_EXCLUDES_DIR;
 }
 
+struct prime_todo {
+	struct ref_entry **entries;
+	const char **prefixes;
+	size_t nr, alloc;
+};
+
+static void push_prime_todo(struct prime_todo *todo,
+			    struct ref_entry *entry, const char *prefix)
+{
+	ALLOC_GROW(todo->entries, todo->nr + 1, todo->alloc);
+	REALLOC_ARRAY(todo->prefixes, todo->alloc);
+	todo->entries[todo->nr] = entry;
+	todo->prefixes[todo->nr++] = prefix;
+}
+
 /*
- * Load all of the refs from `dir` (recursively) that could possibly
- * contain references matching `prefix` into our in-memory cache. If
- * `prefix` is NULL, prime unconditionally.
+ * Queue the subdirectories of `dir` that could contain references
+ * matching `prefix` (any of them if `prefix` is NULL), along with the
+ * prefix their own subdirectories still have to be checked against.
  */
-static void prime_ref_dir(struct ref_dir *dir, const char *prefix)
+static void push_prime_subdirs(struct prime_todo *todo,
+			       struct ref_dir *dir, const char *prefix)
 {
-	/*
-	 * The hard work of loading loose refs is done by get_ref_dir(), so we
-	 * just need to recurse through all of the sub-directories. We do not
-	 * even need to care about sorting, as traversal order does not matter
-	 * to us.
-	 */
 	int i;
 	for (i = 0; i < dir->nr; i++) {
 		struct ref_entry *entry = dir->entries[i];
@@ -358,7 +368,7 @@ static void prime_ref_dir(struct ref_dir *dir, const char *prefix)
 			/* Not a directory; no need to recurse. */
 		} else if (!prefix) {
 			/* Recurse in any case: */
-			prime_ref_dir(get_ref_dir(entry), NULL);
+			push_prime_todo(todo, entry, NULL);
 		} else {
 			switch (overlaps_prefix(entry->name, prefix)) {
 			case PREFIX_CONTAINS_DIR:
@@ -367,10 +377,10 @@ static void prime_ref_dir(struct ref_dir *dir, const char *prefix)
 				 * don't have to check the prefix
 				 * anymore:
 				 */
-				prime_ref_dir(get_ref_dir(entry), NULL);
+				push_prime_todo(todo, entry, NULL);
 				break;
 			case PREFIX_WITHIN_DIR:
-				prime_ref_dir(get_ref_dir(entry), prefix);
+				push_prime_todo(todo, entry, prefix);
 				break;
 			case PREFIX_EXCLUDES_DIR:
 				/* No need to prime this directory. */
@@ -380,6 +390,71 @@ static void prime_ref_dir(struct ref_dir *dir, const char *prefix)
 	}
 }
 
+/*
+ * Fill the incomplete directories among `todo` in one go, if the
+ * cache knows how to; get_ref_dir() fills the rest one by one.
+ */
+static void fill_prime_todo(struct ref_cache *cache, struct prime_todo *todo)
+{
+	struct ref_dir **dirs;
+	const char **dirnames;
+	size_t i, nr = 0;
+
+	if (!cache->fill_ref_dirs)
+		return;
+
+	ALLOC_ARRAY(dirs, todo->nr);
+	ALLOC_ARRAY(dirnames, todo->nr);
+	for (i = 0; i < todo->nr; i++) {
+		struct ref_entry *entry = todo->entries[i];
+		if (!(entry->flag & REF_INCOMPLETE))
+			continue;
+		dirs[nr] = &entry->u.subdir;
+		dirnames[nr++] = entry->name;
+	}
+	if (nr)
+		cache->fill_ref_dirs(cache->ref_store, dirs, dirnames, nr);
+	for (i = 0; i < todo->nr; i++)
+		todo->entries[i]->flag &= ~REF_INCOMPLETE;
+
+	free(dirs);
+	free(dirnames);
+}
+
+/*
+ * Load all of the refs from `dir` (recursively) that could possibly
+ * contain references matching `prefix` into our in-memory cache. If
+ * `prefix` is NULL, prime unconditionally.
+ */
+static void prime_ref_dir(struct ref_dir *dir, const char *prefix)
+{
+	/*
+	 * The hard work of loading loose refs is done by get_ref_dir(), so we
+	 * just need to go through all of the sub-directories. We do not
+	 * even need to care about sorting, as traversal order does not matter
+	 * to us.  We go one depth at a time, so that the cache can fill all
+	 * of the directories at each depth together.
+	 */
+	struct prime_todo todo = { 0 }, next = { 0 };
+
+	push_prime_subdirs(&todo, dir, prefix);
+	while (todo.nr) {
+		size_t i;
+
+		fill_prime_todo(dir->cache, &todo);
+		next.nr = 0;
+		for (i = 0; i < todo.nr; i++)
+			push_prime_subdirs(&next, get_ref_dir(todo.entries[i]),
+					   todo.prefixes[i]);
+		SWAP(todo, next);
+	}
+
+	free(todo.entries);
+	free(todo.prefixes);
+	free(next.entries);
+	free(next.prefixes);
+}
+
 /*
  * A level in the reference hierarchy that is currently being iterated
  * through.
@@ -14,6 +14,14 @@ struct ref_store;
 typedef void fill_ref_dir_fn(struct ref_store *ref_store,
 			     struct ref_dir *dir, const char *dirname);
 
+/*
+ * Like fill_ref_dir_fn, but fills several directories at once (each
+ * of them shallowly), so that the ref_store can load them in parallel.
+ */
+typedef void fill_ref_dirs_fn(struct ref_store *ref_store,
+			      struct ref_dir **dirs, const char **dirnames,
+			      size_t nr);
+
 struct ref_cache {
 	struct ref_entry *root;
 
@@ -25,6 +33,13 @@ struct ref_cache {
 	 * NULL.
 	 */
 	fill_ref_dir_fn *fill_ref_dir;
+
+	/*
+	 * Function used (if set) to fill all the incomplete directories
+	 * at one depth of the tree at once when priming the cache.  May
+	 * be NULL.
+	 */
+	fill_ref_dirs_fn *fill_ref_dirs;
 };
 
 /*
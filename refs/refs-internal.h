@@ -38,6 +38,12 @@ struct ref_transaction;
  */
 #define REF_LOG_ONLY (1 << 7)
 
+/*
+ * Do not report this update to the reference-transaction hook, e.g.
+ * because an enclosing transaction has already reported it.
+ */
+#define REF_SKIP_HOOK (1 << 11)
+
 /*
  * Return the length of time to retry acquiring a loose reference lock
  * before giving up, in milliseconds:
@@ -588,6 +594,21 @@ typedef int for_each_reflog_ent_reverse_fn(struct ref_store *ref_store,
 					   const char *refname,
 					   each_reflog_ent_fn fn,
 					   void *cb_data);
+/*
+ * Like for_each_reflog_ent_reverse_fn, but the backend may leave out
+ * newer entries that can neither be the newest one at or before
+ * `at_time` nor the `cnt`-th newest one (if `cnt` is positive), as
+ * long as it leaves in the entry just newer than those.  The number of
+ * entries left out is stored in `*skipped` before `fn` is first
+ * called.  Backends that cannot do better than reading the whole log
+ * need not implement it.
+ */
+typedef int for_each_reflog_ent_reverse_from_fn(struct ref_store *ref_store,
+						const char *refname,
+						timestamp_t at_time, int cnt,
+						int *skipped,
+						each_reflog_ent_fn fn,
+						void *cb_data);
 typedef int reflog_exists_fn(struct ref_store *ref_store, const char *refname);
 typedef int create_reflog_fn(struct ref_store *ref_store, const char *refname,
 			     int force_create, struct strbuf *err);
@@ -665,6 +686,7 @@ struct ref_storage_be {
 	reflog_iterator_begin_fn *reflog_iterator_begin;
 	for_each_reflog_ent_fn *for_each_reflog_ent;
 	for_each_reflog_ent_reverse_fn *for_each_reflog_ent_reverse;
+	for_each_reflog_ent_reverse_from_fn *for_each_reflog_ent_reverse_from;
 	reflog_exists_fn *reflog_exists;
 	create_reflog_fn *create_reflog;
 	delete_reflog_fn *delete_reflog;
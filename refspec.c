@@ -2,6 +2,7 @@
 #include "strvec.h"
 #include "refs.h"
 #include "refspec.h"
+#include "strmap.h"
 
 static struct refspec_item s_tag_refspec = {
 	0,
@@ -192,6 +193,7 @@ static void refspec_append_nodup(struct refspec *rs, char *refspec)
 
 	refspec_item_init_or_die(&item, refspec, rs->fetch);
 
+	refspec_forget_index(rs);
 	ALLOC_GROW(rs->items, rs->nr + 1, rs->alloc);
 	rs->items[rs->nr++] = item;
 
@@ -224,6 +226,7 @@ void refspec_clear(struct refspec *rs)
 {
 	int i;
 
+	refspec_forget_index(rs);
 	for (i = 0; i < rs->nr; i++)
 		refspec_item_clear(&rs->items[i]);
 
@@ -240,6 +243,190 @@ void refspec_clear(struct refspec *rs)
 	rs->fetch = 0;
 }
 
+struct refspec_positions {
+	int *pos;
+	size_t nr, alloc;
+};
+
+struct refspec_side_index {
+	struct strmap exact;
+	struct strmap prefixes;
+	/* the distinct lengths of the keys of "prefixes", ascending */
+	size_t *lengths;
+	size_t lengths_nr, lengths_alloc;
+	struct refspec_positions always;
+};
+
+struct refspec_index {
+	unsigned built;
+	struct refspec_side_index side[2];
+	struct refspec_positions result;
+	struct strbuf scratch;
+};
+
+static void add_position(struct refspec_positions *p, int pos)
+{
+	ALLOC_GROW(p->pos, p->nr + 1, p->alloc);
+	p->pos[p->nr++] = pos;
+}
+
+static void add_keyed_position(struct strmap *map, const char *key, int pos)
+{
+	struct refspec_positions *p = strmap_get(map, key);
+
+	if (!p) {
+		CALLOC_ARRAY(p, 1);
+		strmap_put(map, key, p);
+	}
+	add_position(p, pos);
+}
+
+static int compare_sizes(const void *a_, const void *b_)
+{
+	size_t a = *(const size_t *)a_, b = *(const size_t *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static void build_side_index(struct refspec *rs, struct refspec_side_index *side,
+			     int use_dst)
+{
+	struct strbuf prefix = STRBUF_INIT;
+	size_t i, j;
+
+	strmap_init(&side->exact);
+	strmap_init(&side->prefixes);
+
+	for (i = 0; i < rs->nr; i++) {
+		const struct refspec_item *item = &rs->items[i];
+		const char *key = use_dst && item->dst ? item->dst : item->src;
+		const char *star;
+
+		if (!key || item->matching) {
+			add_position(&side->always, i);
+		} else if (!item->pattern) {
+			add_keyed_position(&side->exact, key, i);
+		} else if (!(star = strchr(key, '*'))) {
+			/* leave the complaint to whoever matches it */
+			add_position(&side->always, i);
+		} else {
+			strbuf_reset(&prefix);
+			strbuf_add(&prefix, key, star - key);
+			add_keyed_position(&side->prefixes, prefix.buf, i);
+			ALLOC_GROW(side->lengths, side->lengths_nr + 1,
+				   side->lengths_alloc);
+			side->lengths[side->lengths_nr++] = prefix.len;
+		}
+	}
+	strbuf_release(&prefix);
+
+	QSORT(side->lengths, side->lengths_nr, compare_sizes);
+	for (i = j = 0; i < side->lengths_nr; i++)
+		if (!j || side->lengths[j - 1] != side->lengths[i])
+			side->lengths[j++] = side->lengths[i];
+	side->lengths_nr = j;
+}
+
+static void add_positions(struct refspec_positions *dst,
+			  const struct refspec_positions *src)
+{
+	if (!src)
+		return;
+	ALLOC_GROW(dst->pos, dst->nr + src->nr, dst->alloc);
+	COPY_ARRAY(dst->pos + dst->nr, src->pos, src->nr);
+	dst->nr += src->nr;
+}
+
+static int compare_ints(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+const int *refspec_candidates(struct refspec *rs, unsigned sides,
+			      const char *name, int *nr)
+{
+	struct refspec_index *index = rs->index;
+	size_t namelen = strlen(name);
+	size_t i, j;
+	int s;
+
+	if (!index) {
+		CALLOC_ARRAY(index, 1);
+		strbuf_init(&index->scratch, 0);
+		rs->index = index;
+	}
+	index->result.nr = 0;
+
+	for (s = 0; s < 2; s++) {
+		struct refspec_side_index *side = &index->side[s];
+
+		if (!(sides & (1 << s)))
+			continue;
+		if (!(index->built & (1 << s))) {
+			build_side_index(rs, side, s);
+			index->built |= 1 << s;
+		}
+
+		add_positions(&index->result, &side->always);
+		add_positions(&index->result, strmap_get(&side->exact, name));
+		for (i = 0; i < side->lengths_nr; i++) {
+			if (side->lengths[i] > namelen)
+				break;
+			strbuf_reset(&index->scratch);
+			strbuf_add(&index->scratch, name, side->lengths[i]);
+			add_positions(&index->result,
+				      strmap_get(&side->prefixes,
+						 index->scratch.buf));
+		}
+	}
+
+	QSORT(index->result.pos, index->result.nr, compare_ints);
+	for (i = j = 0; i < index->result.nr; i++)
+		if (!j || index->result.pos[j - 1] != index->result.pos[i])
+			index->result.pos[j++] = index->result.pos[i];
+	index->result.nr = j;
+
+	*nr = index->result.nr;
+	return index->result.pos;
+}
+
+static void clear_keyed_positions(struct strmap *map)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	strmap_for_each_entry(map, &iter, e) {
+		struct refspec_positions *p = e->value;
+		free(p->pos);
+	}
+	strmap_clear(map, 1);
+}
+
+void refspec_forget_index(struct refspec *rs)
+{
+	struct refspec_index *index = rs->index;
+	int s;
+
+	if (!index)
+		return;
+
+	for (s = 0; s < 2; s++) {
+		struct refspec_side_index *side = &index->side[s];
+
+		if (!(index->built & (1 << s)))
+			continue;
+		clear_keyed_positions(&side->exact);
+		clear_keyed_positions(&side->prefixes);
+		free(side->lengths);
+		free(side->always.pos);
+	}
+	free(index->result.pos);
+	strbuf_release(&index->scratch);
+	FREE_AND_NULL(rs->index);
+}
+
 int valid_fetch_refspec(const char *fetch_refspec_str)
 {
 	struct refspec_item refspec;
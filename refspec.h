@@ -32,6 +32,8 @@ struct refspec_item {
 #define REFSPEC_FETCH 1
 #define REFSPEC_PUSH 0
 
+struct refspec_index;
+
 #define REFSPEC_INIT_FETCH { .fetch = REFSPEC_FETCH }
 #define REFSPEC_INIT_PUSH { .fetch = REFSPEC_PUSH }
 
@@ -49,6 +51,9 @@ struct refspec {
 	int raw_nr;
 
 	int fetch;
+
+	/* built on demand by refspec_candidates() */
+	struct refspec_index *index;
 };
 
 int refspec_item_init(struct refspec_item *item, const char *refspec,
@@ -63,6 +68,28 @@ void refspec_appendf(struct refspec *rs, const char *fmt, ...);
 void refspec_appendn(struct refspec *rs, const char **refspecs, int nr);
 void refspec_clear(struct refspec *rs);
 
+#define REFSPEC_MATCH_SRC (1 << 0)
+#define REFSPEC_MATCH_DST (1 << 1)
+
+/*
+ * Find the items of "rs" that may match "name", without looking at
+ * every item: "sides" says whether to look at the "src" of the items,
+ * at their "dst" (or "src" where there is no "dst"), or at both.
+ * Exact items are found by their full name and patterns by the part
+ * that precedes their '*', so the caller still has to check whether
+ * the suffix of a pattern matches.  Items that cannot be told apart
+ * this way, such as ":", are always returned.
+ *
+ * The positions of the items in "rs->items" are returned in increasing
+ * order, in an array that belongs to "rs" and is overwritten by the
+ * next call.  The index behind this is built on the first call, and
+ * thrown away when items are added with refspec_append() or when
+ * refspec_forget_index() is called after changing them otherwise.
+ */
+const int *refspec_candidates(struct refspec *rs, unsigned sides,
+			      const char *name, int *nr);
+void refspec_forget_index(struct refspec *rs);
+
 int valid_fetch_refspec(const char *refspec);
 int valid_remote_name(const char *name);
 
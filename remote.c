@@ -14,6 +14,7 @@
 #include "strvec.h"
 #include "commit-reach.h"
 #include "advice.h"
+#include "strmap.h"
 
 enum map_direction { FROM_SRC, FROM_DST };
 
@@ -693,10 +694,14 @@ static int refspec_match(const struct refspec_item *refspec,
 
 static int omit_name_by_refspec(const char *name, struct refspec *rs)
 {
-	int i;
+	const int *pos;
+	int i, nr;
 
-	for (i = 0; i < rs->nr; i++) {
-		if (rs->items[i].negative && refspec_match(&rs->items[i], name))
+	pos = refspec_candidates(rs, REFSPEC_MATCH_SRC, name, &nr);
+	for (i = 0; i < nr; i++) {
+		struct refspec_item *item = &rs->items[pos[i]];
+
+		if (item->negative && refspec_match(item, name))
 			return 1;
 	}
 	return 0;
@@ -722,10 +727,11 @@ struct ref *apply_negative_refspecs(struct ref *ref_map, struct refspec *rs)
 
 static int query_matches_negative_refspec(struct refspec *rs, struct refspec_item *query)
 {
-	int i, matched_negative = 0;
+	int i, nr, matched_negative = 0;
 	int find_src = !query->src;
 	struct string_list reversed = STRING_LIST_INIT_NODUP;
 	const char *needle = find_src ? query->dst : query->src;
+	const int *pos;
 
 	/*
 	 * Check whether the queried ref matches any negative refpsec. If so,
@@ -743,8 +749,10 @@ static int query_matches_negative_refspec(struct refspec *rs, struct refspec_ite
 	 * The second loop checks if any of the results of the first loop
 	 * match any negative refspec.
 	 */
-	for (i = 0; i < rs->nr; i++) {
-		struct refspec_item *refspec = &rs->items[i];
+	pos = refspec_candidates(rs, REFSPEC_MATCH_SRC | REFSPEC_MATCH_DST,
+				 needle, &nr);
+	for (i = 0; i < nr; i++) {
+		struct refspec_item *refspec = &rs->items[pos[i]];
 		char *expn_name;
 
 		if (refspec->negative)
@@ -781,8 +789,11 @@ static void query_refspecs_multiple(struct refspec *rs,
 				    struct refspec_item *query,
 				    struct string_list *results)
 {
-	int i;
+	int i, nr;
 	int find_src = !query->src;
+	const char *needle = find_src ? query->dst : query->src;
+	char **result = find_src ? &query->src : &query->dst;
+	const int *pos;
 
 	if (find_src && !query->dst)
 		BUG("query_refspecs_multiple: need either src or dst");
@@ -790,12 +801,12 @@ static void query_refspecs_multiple(struct refspec *rs,
 	if (query_matches_negative_refspec(rs, query))
 		return;
 
-	for (i = 0; i < rs->nr; i++) {
-		struct refspec_item *refspec = &rs->items[i];
+	pos = refspec_candidates(rs, find_src ? REFSPEC_MATCH_DST : REFSPEC_MATCH_SRC,
+				 needle, &nr);
+	for (i = 0; i < nr; i++) {
+		struct refspec_item *refspec = &rs->items[pos[i]];
 		const char *key = find_src ? refspec->dst : refspec->src;
 		const char *value = find_src ? refspec->src : refspec->dst;
-		const char *needle = find_src ? query->dst : query->src;
-		char **result = find_src ? &query->src : &query->dst;
 
 		if (!refspec->dst || refspec->negative)
 			continue;
@@ -810,10 +821,11 @@ static void query_refspecs_multiple(struct refspec *rs,
 
 int query_refspecs(struct refspec *rs, struct refspec_item *query)
 {
-	int i;
+	int i, nr;
 	int find_src = !query->src;
 	const char *needle = find_src ? query->dst : query->src;
 	char **result = find_src ? &query->src : &query->dst;
+	const int *pos;
 
 	if (find_src && !query->dst)
 		BUG("query_refspecs: need either src or dst");
@@ -821,8 +833,10 @@ int query_refspecs(struct refspec *rs, struct refspec_item *query)
 	if (query_matches_negative_refspec(rs, query))
 		return -1;
 
-	for (i = 0; i < rs->nr; i++) {
-		struct refspec_item *refspec = &rs->items[i];
+	pos = refspec_candidates(rs, find_src ? REFSPEC_MATCH_DST : REFSPEC_MATCH_SRC,
+				 needle, &nr);
+	for (i = 0; i < nr; i++) {
+		struct refspec_item *refspec = &rs->items[pos[i]];
 		const char *key = find_src ? refspec->dst : refspec->src;
 		const char *value = find_src ? refspec->src : refspec->dst;
 
@@ -1221,23 +1235,28 @@ static int match_explicit_refs(struct ref *src, struct ref *dst,
 	return errs;
 }
 
-static char *get_ref_match(const struct refspec *rs, const struct ref *ref,
+static char *get_ref_match(struct refspec *rs, const struct ref *ref,
 			   int send_mirror, int direction,
 			   const struct refspec_item **ret_pat)
 {
 	const struct refspec_item *pat;
 	char *name;
-	int i;
+	const int *pos;
+	int i, nr;
 	int matching_refs = -1;
-	for (i = 0; i < rs->nr; i++) {
-		const struct refspec_item *item = &rs->items[i];
+
+	pos = refspec_candidates(rs, direction == FROM_SRC ?
+				 REFSPEC_MATCH_SRC : REFSPEC_MATCH_DST,
+				 ref->name, &nr);
+	for (i = 0; i < nr; i++) {
+		const struct refspec_item *item = &rs->items[pos[i]];
 
 		if (item->negative)
 			continue;
 
 		if (item->matching &&
 		    (matching_refs == -1 || item->force)) {
-			matching_refs = i;
+			matching_refs = pos[i];
 			continue;
 		}
 
@@ -1249,7 +1268,7 @@ static char *get_ref_match(const struct refspec *rs, const struct ref *ref,
 			else
 				match = match_name_with_pattern(dst_side, ref->name, item->src, &name);
 			if (match) {
-				matching_refs = i;
+				matching_refs = pos[i];
 				break;
 			}
 		}
@@ -1838,6 +1857,29 @@ static int ignore_symref_update(const char *refname)
 	return (flag & REF_ISSYMREF);
 }
 
+/*
+ * If the remote "ref" matches the pattern refspec, return a copy of
+ * it whose peer_ref describes the local tracking ref to which it maps,
+ * unless that would be an existing local symbolic ref.
+ */
+static struct ref *expand_fetch_ref(const struct ref *ref,
+				    const struct refspec_item *refspec)
+{
+	struct ref *cpy = NULL;
+	char *expn_name = NULL;
+
+	if (match_name_with_pattern(refspec->src, ref->name,
+				    refspec->dst, &expn_name) &&
+	    !ignore_symref_update(expn_name)) {
+		cpy = copy_ref(ref);
+		cpy->peer_ref = alloc_ref(expn_name);
+		if (refspec->force)
+			cpy->peer_ref->force = 1;
+	}
+	free(expn_name);
+	return cpy;
+}
+
 /*
  * Create and return a list of (struct ref) consisting of copies of
  * each remote_ref that matches refspec.  refspec must be a pattern.
@@ -1853,22 +1895,15 @@ static struct ref *get_expanded_map(const struct ref *remote_refs,
 	struct ref **tail = &ret;
 
 	for (ref = remote_refs; ref; ref = ref->next) {
-		char *expn_name = NULL;
+		struct ref *cpy;
 
 		if (strchr(ref->name, '^'))
 			continue; /* a dereference item */
-		if (match_name_with_pattern(refspec->src, ref->name,
-					    refspec->dst, &expn_name) &&
-		    !ignore_symref_update(expn_name)) {
-			struct ref *cpy = copy_ref(ref);
-
-			cpy->peer_ref = alloc_ref(expn_name);
-			if (refspec->force)
-				cpy->peer_ref->force = 1;
+		cpy = expand_fetch_ref(ref, refspec);
+		if (cpy) {
 			*tail = cpy;
 			tail = &cpy->next;
 		}
-		free(expn_name);
 	}
 
 	return ret;
@@ -1917,36 +1952,61 @@ static struct ref *get_local_ref(const char *name)
 	return alloc_ref_with_prefix("refs/heads/", 11, name);
 }
 
-int get_fetch_map(const struct ref *remote_refs,
-		  const struct refspec_item *refspec,
-		  struct ref ***tail,
-		  int missing_ok)
+/*
+ * Like get_remote_ref(), but looking the possible meanings of "name"
+ * up in "by_name", which maps the names of the remote refs to the
+ * first of them with that name.
+ */
+static struct ref *get_remote_ref_by_name(const struct ref *remote_refs,
+					  struct strmap *by_name,
+					  const char *name)
 {
-	struct ref *ref_map, **rmp;
+	struct strvec names = STRVEC_INIT;
+	const struct ref *ref = NULL;
+	int i;
 
-	if (refspec->negative)
-		return 0;
+	/* refname_match() would clean these up as paths */
+	if (starts_with(name, "./"))
+		return get_remote_ref(remote_refs, name);
 
-	if (refspec->pattern) {
-		ref_map = get_expanded_map(remote_refs, refspec);
-	} else {
-		const char *name = refspec->src[0] ? refspec->src : "HEAD";
+	expand_ref_prefix(&names, name);
+	for (i = 0; !ref && i < names.nr; i++)
+		ref = strmap_get(by_name, names.v[i]);
+	strvec_clear(&names);
 
-		if (refspec->exact_sha1) {
-			ref_map = alloc_ref(name);
-			get_oid_hex(name, &ref_map->old_oid);
-			ref_map->exact_oid = 1;
-		} else {
-			ref_map = get_remote_ref(remote_refs, name);
-		}
-		if (!missing_ok && !ref_map)
-			die(_("couldn't find remote ref %s"), name);
-		if (ref_map) {
-			ref_map->peer_ref = get_local_ref(refspec->dst);
-			if (ref_map->peer_ref && refspec->force)
-				ref_map->peer_ref->force = 1;
-		}
+	return ref ? copy_ref(ref) : NULL;
+}
+
+static struct ref *get_exact_map(const struct ref *remote_refs,
+				 struct strmap *by_name,
+				 const struct refspec_item *refspec,
+				 int missing_ok)
+{
+	const char *name = refspec->src[0] ? refspec->src : "HEAD";
+	struct ref *ref_map;
+
+	if (refspec->exact_sha1) {
+		ref_map = alloc_ref(name);
+		get_oid_hex(name, &ref_map->old_oid);
+		ref_map->exact_oid = 1;
+	} else if (by_name) {
+		ref_map = get_remote_ref_by_name(remote_refs, by_name, name);
+	} else {
+		ref_map = get_remote_ref(remote_refs, name);
 	}
+	if (!missing_ok && !ref_map)
+		die(_("couldn't find remote ref %s"), name);
+	if (ref_map) {
+		ref_map->peer_ref = get_local_ref(refspec->dst);
+		if (ref_map->peer_ref && refspec->force)
+			ref_map->peer_ref->force = 1;
+	}
+	return ref_map;
+}
+
+static void link_fetch_map(struct ref *ref_map, struct ref ***tail)
+{
+	struct ref **rmp;
 
 	for (rmp = &ref_map; *rmp; ) {
 		if ((*rmp)->peer_ref) {
@@ -1966,7 +2026,91 @@ int get_fetch_map(const struct ref *remote_refs,
 
 	if (ref_map)
 		tail_link_ref(ref_map, tail);
+}
+
+int get_fetch_map(const struct ref *remote_refs,
+		  const struct refspec_item *refspec,
+		  struct ref ***tail,
+		  int missing_ok)
+{
+	struct ref *ref_map;
+
+	if (refspec->negative)
+		return 0;
+
+	if (refspec->pattern)
+		ref_map = get_expanded_map(remote_refs, refspec);
+	else
+		ref_map = get_exact_map(remote_refs, NULL, refspec, missing_ok);
+
+	link_fetch_map(ref_map, tail);
+	return 0;
+}
+
+int get_fetch_maps(const struct ref *remote_refs,
+		   struct refspec *rs,
+		   struct ref ***tail,
+		   int missing_ok)
+{
+	struct ref **maps, ***map_tails;
+	struct strmap by_name = STRMAP_INIT;
+	int want_by_name = 0;
+	const struct ref *ref;
+	int i;
+
+	CALLOC_ARRAY(maps, rs->nr);
+	ALLOC_ARRAY(map_tails, rs->nr);
+	for (i = 0; i < rs->nr; i++) {
+		const struct refspec_item *item = &rs->items[i];
+
+		map_tails[i] = &maps[i];
+		if (!item->pattern && !item->negative && !item->exact_sha1)
+			want_by_name = 1;
+	}
+
+	/*
+	 * Go over the remote refs once, and give each of them to the
+	 * patterns it may match, rather than go over all of them for
+	 * each pattern.
+	 */
+	for (ref = remote_refs; ref; ref = ref->next) {
+		const int *pos;
+		int nr;
+
+		if (want_by_name && !strmap_contains(&by_name, ref->name))
+			strmap_put(&by_name, ref->name, (void *)ref);
+
+		if (strchr(ref->name, '^'))
+			continue; /* a dereference item */
+		pos = refspec_candidates(rs, REFSPEC_MATCH_SRC, ref->name, &nr);
+		for (i = 0; i < nr; i++) {
+			const struct refspec_item *item = &rs->items[pos[i]];
+			struct ref *cpy;
+
+			if (!item->pattern || item->negative)
+				continue;
+			cpy = expand_fetch_ref(ref, item);
+			if (cpy) {
+				*map_tails[pos[i]] = cpy;
+				map_tails[pos[i]] = &cpy->next;
+			}
+		}
+	}
+
+	for (i = 0; i < rs->nr; i++) {
+		const struct refspec_item *item = &rs->items[i];
+
+		if (item->negative)
+			continue;
+		if (!item->pattern)
+			maps[i] = get_exact_map(remote_refs, &by_name,
+						item, missing_ok);
+		link_fetch_map(maps[i], tail);
+	}
 
+	strmap_clear(&by_name, 0);
+	free(maps);
+	free(map_tails);
 	return 0;
 }
 
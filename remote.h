@@ -244,6 +244,14 @@ void set_ref_status_for_push(struct ref *remote_refs, int send_mirror,
 int get_fetch_map(const struct ref *remote_refs, const struct refspec_item *refspec,
 		  struct ref ***tail, int missing_ok);
 
+/*
+ * The same as calling get_fetch_map() for each item of "rs" in turn,
+ * but going over "remote_refs" only once, so that the cost does not
+ * grow with the product of the number of refs and of refspecs.
+ */
+int get_fetch_maps(const struct ref *remote_refs, struct refspec *rs,
+		   struct ref ***tail, int missing_ok);
+
 struct ref *get_remote_ref(const struct ref *remote_refs, const char *name);
 
 /*
@@ -292,6 +292,27 @@ int repo_read_index(struct repository *repo)
 	return res;
 }
 
+int repo_read_index_prefix(struct repository *repo,
+			   const char *prefix, size_t prefix_len)
+{
+	int res;
+
+	if (!repo->index)
+		CALLOC_ARRAY(repo->index, 1);
+
+	/* Complete the double-reference */
+	if (!repo->index->repo)
+		repo->index->repo = repo;
+	else if (repo->index->repo != repo)
+		BUG("repo's index should point back at itself");
+
+	res = read_index_prefix_from(repo->index, repo->index_file,
+				     prefix, prefix_len);
+	if (res < 0)
+		res = repo_read_index(repo);
+	return res;
+}
+
 int repo_hold_locked_index(struct repository *repo,
 			   struct lock_file *lf,
 			   int flags)
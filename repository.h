@@ -25,6 +25,7 @@ enum fetch_negotiation_setting {
 	FETCH_NEGOTIATION_DEFAULT = 1,
 	FETCH_NEGOTIATION_SKIPPING = 2,
 	FETCH_NEGOTIATION_NOOP = 3,
+	FETCH_NEGOTIATION_GENERATION = 4,
 };
 
 struct repo_settings {
@@ -192,6 +193,14 @@ void repo_clear(struct repository *repo);
  * populated then the number of entries will simply be returned.
  */
 int repo_read_index(struct repository *repo);
+
+/*
+ * Like repo_read_index(), but may leave out the entries whose names do
+ * not start with "prefix" (see read_index_prefix_from()). The index
+ * must not be written out afterwards.
+ */
+int repo_read_index_prefix(struct repository *repo,
+			   const char *prefix, size_t prefix_len);
 int repo_hold_locked_index(struct repository *repo,
 			   struct lock_file *lf,
 			   int flags);
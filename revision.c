@@ -629,6 +629,9 @@ static unsigned int count_bloom_filter_maybe;
 static unsigned int count_bloom_filter_definitely_not;
 static unsigned int count_bloom_filter_false_positive;
 static unsigned int count_bloom_filter_not_present;
+static unsigned int count_merge_bloom_filter_maybe;
+static unsigned int count_merge_bloom_filter_definitely_not;
+static unsigned int count_merge_bloom_filter_false_positive;
 
 static void trace2_bloom_filter_statistics_atexit(void)
 {
@@ -644,29 +647,62 @@ static void trace2_bloom_filter_statistics_atexit(void)
 	trace2_data_json("bloom", the_repository, "statistics", &jw);
 
 	jw_release(&jw);
+
+	if (!count_merge_bloom_filter_maybe &&
+	    !count_merge_bloom_filter_definitely_not)
+		return;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "maybe", count_merge_bloom_filter_maybe);
+	jw_object_intmax(&jw, "definitely_not", count_merge_bloom_filter_definitely_not);
+	jw_object_intmax(&jw, "false_positive", count_merge_bloom_filter_false_positive);
+	jw_end(&jw);
+
+	trace2_data_json("bloom", the_repository, "merge_statistics", &jw);
+
+	jw_release(&jw);
 }
 
 static int forbid_bloom_filters(struct pathspec *spec)
 {
-	if (spec->has_wildcard)
-		return 1;
-	if (spec->nr > 1)
-		return 1;
-	if (spec->magic & ~PATHSPEC_LITERAL)
-		return 1;
-	if (spec->nr && (spec->items[0].magic & ~PATHSPEC_LITERAL))
+	int i;
+
+	if (spec->magic & ~(PATHSPEC_LITERAL | PATHSPEC_GLOB))
 		return 1;
+	for (i = 0; i < spec->nr; i++)
+		if (spec->items[i].magic & ~(PATHSPEC_LITERAL | PATHSPEC_GLOB))
+			return 1;
 
 	return 0;
 }
 
+/*
+ * Return the length of the leading directory shared by all the paths
+ * "pi" can match, i.e. the path itself if it has no wildcards and
+ * otherwise the literal directory part in front of the first wildcard
+ * (without the trailing slash). Return 0 if there is no such directory.
+ */
+static size_t bloom_pathspec_prefix_len(const struct pathspec_item *pi)
+{
+	size_t len = pi->len;
+
+	if (pi->nowildcard_len < pi->len) {
+		len = pi->nowildcard_len;
+		while (len > 0 && pi->match[len - 1] != '/')
+			len--;
+	}
+
+	/* remove single trailing slash from path, if needed */
+	if (len > 0 && pi->match[len - 1] == '/')
+		len--;
+
+	return len;
+}
+
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
 {
-	struct pathspec_item *pi;
-	char *path_alloc = NULL;
-	const char *path, *p;
-	size_t len;
-	int path_component_nr = 1;
+	struct pathspec *spec = &revs->pruning.pathspec;
+	int i;
 
 	if (!revs->commits)
 		return;
@@ -680,66 +716,42 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->bloom_filter_settings)
 		return;
 
-	if (!revs->pruning.pathspec.nr)
-		return;
-
-	pi = &revs->pruning.pathspec.items[0];
-
-	/* remove single trailing slash from path, if needed */
-	if (pi->len > 0 && pi->match[pi->len - 1] == '/') {
-		path_alloc = xmemdupz(pi->match, pi->len - 1);
-		path = path_alloc;
-	} else
-		path = pi->match;
-
-	len = strlen(path);
-	if (!len) {
-		revs->bloom_filter_settings = NULL;
-		free(path_alloc);
+	if (!spec->nr)
 		return;
-	}
 
-	p = path;
-	while (*p) {
-		/*
-		 * At this point, the path is normalized to use Unix-style
-		 * path separators. This is required due to how the
-		 * changed-path Bloom filters store the paths.
-		 */
-		if (*p == '/')
-			path_component_nr++;
-		p++;
+	/*
+	 * A commit can only be TREESAME if its filter rules out every
+	 * pathspec item, so each item needs a usable prefix.
+	 */
+	for (i = 0; i < spec->nr; i++) {
+		if (!bloom_pathspec_prefix_len(&spec->items[i])) {
+			revs->bloom_filter_settings = NULL;
+			return;
+		}
 	}
 
-	revs->bloom_keys_nr = path_component_nr;
-	ALLOC_ARRAY(revs->bloom_keys, revs->bloom_keys_nr);
+	revs->bloom_keyvecs_nr = spec->nr;
+	ALLOC_ARRAY(revs->bloom_keyvecs, revs->bloom_keyvecs_nr);
+	for (i = 0; i < spec->nr; i++) {
+		const struct pathspec_item *pi = &spec->items[i];
 
-	fill_bloom_key(path, len, &revs->bloom_keys[0],
-		       revs->bloom_filter_settings);
-	path_component_nr = 1;
-
-	p = path + len - 1;
-	while (p > path) {
-		if (*p == '/')
-			fill_bloom_key(path, p - path,
-				       &revs->bloom_keys[path_component_nr++],
-				       revs->bloom_filter_settings);
-		p--;
+		revs->bloom_keyvecs[i] =
+			bloom_keyvec_new(pi->match,
+					 bloom_pathspec_prefix_len(pi),
+					 revs->bloom_filter_settings);
 	}
 
 	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
 		atexit(trace2_bloom_filter_statistics_atexit);
 		bloom_filter_atexit_registered = 1;
 	}
-
-	free(path_alloc);
 }
 
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 						 struct commit *commit)
 {
 	struct bloom_filter *filter;
-	int result = 1, j;
+	int result = 0, j;
 
 	if (!revs->repo->objects->commit_graph)
 		return -1;
@@ -754,10 +766,10 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 		return -1;
 	}
 
-	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
-		result = bloom_filter_contains(filter,
-					       &revs->bloom_keys[j],
-					       revs->bloom_filter_settings);
+	for (j = 0; !result && j < revs->bloom_keyvecs_nr; j++) {
+		result = bloom_filter_contains_vec(filter,
+						   revs->bloom_keyvecs[j],
+						   revs->bloom_filter_settings);
 	}
 
 	if (result)
@@ -768,6 +780,41 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 	return result;
 }
 
+/*
+ * Like check_maybe_different_in_bloom_filter(), but for the diffs of a
+ * merge commit against its other parents, which not every commit-graph
+ * stores filters for.
+ */
+static int check_maybe_different_in_merge_bloom_filter(struct rev_info *revs,
+						       struct commit *commit)
+{
+	struct bloom_filter *filter;
+	int result = 0, j;
+
+	if (!revs->repo->objects->commit_graph)
+		return -1;
+
+	if (commit_graph_generation(commit) == GENERATION_NUMBER_INFINITY)
+		return -1;
+
+	filter = get_merge_bloom_filter(revs->repo, commit);
+	if (!filter)
+		return -1;
+
+	for (j = 0; !result && j < revs->bloom_keyvecs_nr; j++) {
+		result = bloom_filter_contains_vec(filter,
+						   revs->bloom_keyvecs[j],
+						   revs->bloom_filter_settings);
+	}
+
+	if (result)
+		count_merge_bloom_filter_maybe++;
+	else
+		count_merge_bloom_filter_definitely_not++;
+
+	return result;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
 			    struct commit *parent, struct commit *commit, int nth_parent)
 {
@@ -798,8 +845,11 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keys_nr && !nth_parent) {
-		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+	if (revs->bloom_keyvecs_nr) {
+		if (!nth_parent)
+			bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+		else
+			bloom_ret = check_maybe_different_in_merge_bloom_filter(revs, commit);
 
 		if (bloom_ret == 0)
 			return REV_TREE_SAME;
@@ -809,9 +859,12 @@ static int rev_compare_tree(struct rev_info *revs,
 	revs->pruning.flags.has_changes = 0;
 	diff_tree_oid(&t1->object.oid, &t2->object.oid, "", &revs->pruning);
 
-	if (!nth_parent)
-		if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+	if (bloom_ret == 1 && tree_difference == REV_TREE_SAME) {
+		if (!nth_parent)
 			count_bloom_filter_false_positive++;
+		else if (revs->bloom_keyvecs_nr)
+			count_merge_bloom_filter_false_positive++;
+	}
 
 	return tree_difference;
 }
@@ -3442,7 +3495,7 @@ static void init_topo_walk(struct rev_info *revs)
 		info->topo_queue.compare = NULL;
 		break;
 	case REV_SORT_BY_COMMIT_DATE:
-		info->topo_queue.compare = compare_commits_by_commit_date;
+		info->topo_queue.key = commit_key_by_commit_date;
 		break;
 	case REV_SORT_BY_AUTHOR_DATE:
 		init_author_date_slab(&info->author_date);
@@ -3451,8 +3504,8 @@ static void init_topo_walk(struct rev_info *revs)
 		break;
 	}
 
-	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
-	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
+	info->explore_queue.key = commit_key_by_gen_then_commit_date;
+	info->indegree_queue.key = commit_key_by_gen_then_commit_date;
 
 	info->min_generation = GENERATION_NUMBER_INFINITY;
 	for (list = revs->commits; list; list = list->next) {
@@ -3651,7 +3704,7 @@ static void merge_queue_into_list(struct prio_queue *q, struct commit_list **lis
 
 static enum rewrite_result rewrite_one(struct rev_info *revs, struct commit **pp)
 {
-	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct prio_queue queue = { .key = commit_key_by_commit_date };
 	enum rewrite_result ret = rewrite_one_1(revs, pp, &queue);
 	merge_queue_into_list(&queue, &revs->commits);
 	clear_prio_queue(&queue);
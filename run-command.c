@@ -9,6 +9,10 @@
 #include "quote.h"
 #include "config.h"
 
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+
 void child_process_init(struct child_process *child)
 {
 	struct child_process blank = CHILD_PROCESS_INIT;
@@ -667,6 +671,101 @@ static void trace_run_command(const struct child_process *cp)
 	strbuf_release(&buf);
 }
 
+#ifdef HAVE_POSIX_SPAWN
+/*
+ * Without a directory to change to, the child needs nothing but a few
+ * dup2() and close() calls before its exec, which posix_spawn() can do
+ * without copying our page tables the way fork() does.
+ */
+static int can_posix_spawn(const struct child_process *cmd)
+{
+	return !cmd->dir && !cmd->in_process &&
+	       !git_env_bool("GIT_TEST_NO_POSIX_SPAWN", 0);
+}
+
+/*
+ * The posix_spawn() counterpart of the fork() and exec() in
+ * start_command(); "fdin", "fdout" and "fderr" are the pipes it created,
+ * or NULL.  Sets cmd->pid and returns 0 on success, or reports the
+ * error like the child of fork() would and returns the errno.
+ */
+static int spawn_command(struct child_process *cmd, const struct strvec *argv,
+			 char **childenv, int null_fd,
+			 int *fdin, int *fdout, int *fderr)
+{
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	int err;
+
+	if ((err = posix_spawn_file_actions_init(&actions)))
+		goto fail;
+
+	if (cmd->no_stdin)
+		posix_spawn_file_actions_adddup2(&actions, null_fd, 0);
+	else if (fdin) {
+		posix_spawn_file_actions_adddup2(&actions, fdin[0], 0);
+		posix_spawn_file_actions_addclose(&actions, fdin[0]);
+		posix_spawn_file_actions_addclose(&actions, fdin[1]);
+	} else if (cmd->in) {
+		posix_spawn_file_actions_adddup2(&actions, cmd->in, 0);
+		posix_spawn_file_actions_addclose(&actions, cmd->in);
+	}
+
+	if (cmd->no_stderr)
+		posix_spawn_file_actions_adddup2(&actions, null_fd, 2);
+	else if (fderr) {
+		posix_spawn_file_actions_adddup2(&actions, fderr[1], 2);
+		posix_spawn_file_actions_addclose(&actions, fderr[0]);
+		posix_spawn_file_actions_addclose(&actions, fderr[1]);
+	} else if (cmd->err > 1) {
+		posix_spawn_file_actions_adddup2(&actions, cmd->err, 2);
+		posix_spawn_file_actions_addclose(&actions, cmd->err);
+	}
+
+	if (cmd->no_stdout)
+		posix_spawn_file_actions_adddup2(&actions, null_fd, 1);
+	else if (cmd->stdout_to_stderr)
+		posix_spawn_file_actions_adddup2(&actions, 2, 1);
+	else if (fdout) {
+		posix_spawn_file_actions_adddup2(&actions, fdout[1], 1);
+		posix_spawn_file_actions_addclose(&actions, fdout[0]);
+		posix_spawn_file_actions_addclose(&actions, fdout[1]);
+	} else if (cmd->out > 1) {
+		posix_spawn_file_actions_adddup2(&actions, cmd->out, 1);
+		posix_spawn_file_actions_addclose(&actions, cmd->out);
+	}
+
+	/* See the execve() calls in start_command() for argv.v[0] */
+	err = posix_spawn(&pid, argv->v[1], &actions, NULL,
+			  (char *const *) argv->v + 1, childenv);
+	if (err == ENOEXEC)
+		err = posix_spawn(&pid, argv->v[0], &actions, NULL,
+				  (char *const *) argv->v, childenv);
+	posix_spawn_file_actions_destroy(&actions);
+
+fail:
+	if (err) {
+		struct child_err cerr;
+
+		if (err != ENOENT)
+			cerr.err = CHILD_ERR_ERRNO;
+		else if (cmd->silent_exec_failure)
+			cerr.err = CHILD_ERR_SILENT;
+		else
+			cerr.err = CHILD_ERR_ENOENT;
+		cerr.syserr = err;
+		child_err_spew(cmd, &cerr);
+		cmd->pid = -1;
+		return err;
+	}
+
+	cmd->pid = pid;
+	if (cmd->clean_on_exit)
+		mark_child_for_cleanup(cmd->pid, cmd);
+	return 0;
+}
+#endif
+
 int start_command(struct child_process *cmd)
 {
 	int need_in, need_out, need_err;
@@ -757,9 +856,6 @@ int start_command(struct child_process *cmd)
 		goto end_of_spawn;
 	}
 
-	if (pipe(notify_pipe))
-		notify_pipe[0] = notify_pipe[1] = -1;
-
 	if (cmd->no_stdin || cmd->no_stdout || cmd->no_stderr) {
 		null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
 		if (null_fd < 0)
@@ -768,6 +864,24 @@ int start_command(struct child_process *cmd)
 	}
 
 	childenv = prep_childenv(cmd->env);
+
+#ifdef HAVE_POSIX_SPAWN
+	if (can_posix_spawn(cmd)) {
+		failed_errno = spawn_command(cmd, &argv, childenv, null_fd,
+					     need_in ? fdin : NULL,
+					     need_out ? fdout : NULL,
+					     need_err ? fderr : NULL);
+		goto spawned;
+	}
+#endif
+
+	if (pipe(notify_pipe))
+		notify_pipe[0] = notify_pipe[1] = -1;
+
+	/* do not let the child flush what we buffered a second time */
+	if (cmd->in_process)
+		fflush(NULL);
+
 	atfork_prepare(&as);
 
 	/*
@@ -785,11 +899,14 @@ int start_command(struct child_process *cmd)
 		int sig;
 		/*
 		 * Ensure the default die/error/warn routines do not get
-		 * called, they can take stdio locks and malloc.
+		 * called, they can take stdio locks and malloc.  A child
+		 * running in-process is going to call them anyway.
 		 */
-		set_die_routine(child_die_fn);
-		set_error_routine(child_error_fn);
-		set_warn_routine(child_warn_fn);
+		if (!cmd->in_process) {
+			set_die_routine(child_die_fn);
+			set_error_routine(child_error_fn);
+			set_warn_routine(child_warn_fn);
+		}
 
 		close(notify_pipe[0]);
 		set_cloexec(notify_pipe[1]);
@@ -843,6 +960,21 @@ int start_command(struct child_process *cmd)
 		if (sigprocmask(SIG_SETMASK, &as.old, NULL) != 0)
 			child_die(CHILD_ERR_SIGPROCMASK);
 
+		if (cmd->in_process) {
+			int argc = 0, ret;
+
+			/* there is no exec for the parent to wait for */
+			close(notify_pipe[1]);
+			/* and the children to clean up are not ours */
+			children_to_clean = NULL;
+
+			while (cmd->argv[argc])
+				argc++;
+			ret = cmd->in_process(argc, cmd->argv, NULL);
+			fflush(NULL);
+			_exit(ret & 0xff);
+		}
+
 		/*
 		 * Attempt to exec using the command and arguments starting at
 		 * argv.argv[1].  argv.argv[0] contains SHELL_PATH which will
@@ -889,6 +1021,9 @@ int start_command(struct child_process *cmd)
 	}
 	close(notify_pipe[0]);
 
+#ifdef HAVE_POSIX_SPAWN
+spawned:
+#endif
 	if (null_fd >= 0)
 		close(null_fd);
 	strvec_clear(&argv);
@@ -1702,7 +1837,8 @@ static int pp_start_one(struct parallel_processes *pp)
 		return 1;
 	}
 	pp->children[i].process.err = -1;
-	pp->children[i].process.stdout_to_stderr = 1;
+	if (!pp->children[i].process.out)
+		pp->children[i].process.stdout_to_stderr = 1;
 	pp->children[i].process.no_stdin = 1;
 
 	if (start_command(&pp->children[i].process)) {
@@ -135,6 +135,19 @@ struct child_process {
 	unsigned use_shell:1;
 
 	unsigned stdout_to_stderr:1;
+
+	/**
+	 * If set, the child does not exec .argv, but calls this function
+	 * with it (.argv[0] being the name of the command, without any
+	 * "git") in the copy of the current process fork() gave it, and
+	 * exits with what it returns.  It thereby gets to use all that was
+	 * set up already, such as the repository and its object store.  As
+	 * the child runs arbitrary code, the current process must not have
+	 * any other thread running.  Platforms without fork() exec .argv as
+	 * usual, so it still has to be a command that does the same thing.
+	 */
+	int (*in_process)(int argc, const char **argv, const char *prefix);
+
 	unsigned clean_on_exit:1;
 	unsigned wait_after_clean:1;
 	void (*clean_on_exit_handler)(struct child_process *process);
@@ -410,6 +423,8 @@ void check_pipe(int err);
  * This callback should initialize the child process and preload the
  * error channel if desired. The preloading of is useful if you want to
  * have a message printed directly before the output of the child process.
+ * The standard output of the child goes to the error channel, too, unless
+ * the callback points `cp->out` at a file descriptor of its own.
  * pp_cb is the callback cookie as passed to run_processes_parallel.
  * You can store a child process specific callback cookie in pp_task_cb.
  *
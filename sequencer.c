@@ -48,6 +48,7 @@ static GIT_PATH_FUNC(git_path_todo_file, "sequencer/todo")
 static GIT_PATH_FUNC(git_path_opts_file, "sequencer/opts")
 static GIT_PATH_FUNC(git_path_head_file, "sequencer/head")
 static GIT_PATH_FUNC(git_path_abort_safety_file, "sequencer/abort-safety")
+static GIT_PATH_FUNC(git_path_rename_cache_file, "sequencer/rename-cache")
 
 static GIT_PATH_FUNC(rebase_path, "rebase-merge")
 /*
@@ -134,6 +135,13 @@ static GIT_PATH_FUNC(rebase_path_rewritten_list, "rebase-merge/rewritten-list")
 static GIT_PATH_FUNC(rebase_path_rewritten_pending,
 	"rebase-merge/rewritten-pending")
 
+/*
+ * The renames that the "ort" strategy found while picking the last
+ * commit, which the next pick can reuse even when it is done by
+ * another process, e.g. after "git rebase --continue".
+ */
+static GIT_PATH_FUNC(rebase_path_rename_cache, "rebase-merge/rename-cache")
+
 /*
  * The path of the file containing the OID of the "squash onto" commit, i.e.
  * the dummy commit used for `reset [new root]`.
@@ -603,6 +611,42 @@ void append_conflicts_hint(struct index_state *istate,
 	}
 }
 
+static const char *get_rename_cache_path(const struct replay_opts *opts)
+{
+	if (is_rebase_i(opts))
+		return rebase_path_rename_cache();
+	return git_path_rename_cache_file();
+}
+
+static void read_rename_cache(struct merge_options *o,
+			      struct merge_result *result,
+			      const struct replay_opts *opts)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (strbuf_read_file(&buf, get_rename_cache_path(opts), 0) > 0)
+		merge_load_rename_cache(o, result, buf.buf, buf.len);
+	strbuf_release(&buf);
+}
+
+static void write_rename_cache(struct merge_result *result,
+			       const struct replay_opts *opts)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *path = get_rename_cache_path(opts);
+
+	/* a single cherry-pick or revert keeps no state */
+	if (!is_directory(get_dir(opts)))
+		return;
+
+	merge_save_rename_cache(result, &buf);
+	if (buf.len)
+		write_message(buf.buf, buf.len, path, 0);
+	else
+		unlink(path);
+	strbuf_release(&buf);
+}
+
 static int do_recursive_merge(struct repository *r,
 			      struct commit *base, struct commit *next,
 			      const char *base_label, const char *next_label,
@@ -638,8 +682,10 @@ static int do_recursive_merge(struct repository *r,
 
 	if (opts->strategy && !strcmp(opts->strategy, "ort")) {
 		memset(&result, 0, sizeof(result));
+		read_rename_cache(&o, &result, opts);
 		merge_incore_nonrecursive(&o, base_tree, head_tree, next_tree,
 					    &result);
+		write_rename_cache(&result, opts);
 		show_output = !is_rebase_i(opts) || !result.clean;
 		/*
 		 * TODO: merge_switch_to_result will update index/working tree;
@@ -1367,9 +1413,13 @@ static int parse_head(struct repository *r, struct commit **head)
  *   0 - success
  *   1 - run 'git commit'
  */
+/*
+ * Commit "tree", or the index if "tree" is NULL, on top of HEAD.
+ */
 static int try_to_commit(struct repository *r,
 			 struct strbuf *msg, const char *author,
 			 struct replay_opts *opts, unsigned int flags,
+			 const struct object_id *tree_oid,
 			 struct object_id *oid)
 {
 	struct object_id tree;
@@ -1417,7 +1467,9 @@ static int try_to_commit(struct repository *r,
 		commit_list_insert(current_head, &parents);
 	}
 
-	if (write_index_as_tree(&tree, r->index, r->index_file, 0, NULL)) {
+	if (tree_oid)
+		oidcpy(&tree, tree_oid);
+	else if (write_index_as_tree(&tree, r->index, r->index_file, 0, NULL)) {
 		res = error(_("git write-tree failed to write a tree"));
 		goto out;
 	}
@@ -1576,7 +1628,7 @@ static int do_commit(struct repository *r,
 					   msg_file);
 
 		res = try_to_commit(r, msg_file ? &sb : NULL,
-				    author, opts, flags, &oid);
+				    author, opts, flags, NULL, &oid);
 		strbuf_release(&sb);
 		if (!res) {
 			refs_delete_ref(get_main_ref_store(r), "",
@@ -4265,11 +4317,158 @@ N_("Could not execute the todo command\n"
 "    git rebase --edit-todo\n"
 "    git rebase --continue\n");
 
+/*
+ * With rebase.inMemory, runs of "pick" commands are replayed without
+ * touching the index or the working tree, which are only brought up to
+ * date once the run ends.  A pick that does not apply cleanly, or that
+ * needs anything else than a plain commit of the merge result, ends the
+ * run and is done the usual way.
+ */
+struct in_memory_picks {
+	int active;
+	struct merge_options o;
+	struct merge_result result;
+	/* the commit that the index and the working tree still match */
+	struct object_id worktree;
+	/* the todo item that started the run */
+	int first;
+};
+
+static int can_pick_in_memory(struct replay_opts *opts,
+			      struct todo_item *item)
+{
+	struct commit *commit = item->commit;
+
+	return item->command == TODO_PICK &&
+		commit->parents && !commit->parents->next &&
+		!should_edit(opts) && !opts->record_origin &&
+		!opts->have_squash_onto &&
+		(!opts->strategy || !strcmp(opts->strategy, "ort"));
+}
+
+/*
+ * Returns 0 if "item" was picked, and 1 if it needs to be picked by
+ * do_pick_commit() instead.
+ */
+static int pick_in_memory(struct repository *r, struct todo_item *item,
+			  struct replay_opts *opts,
+			  struct in_memory_picks *mem, int current)
+{
+	struct commit *commit = item->commit, *parent, *head;
+	struct commit_message msg = { NULL, NULL, NULL, NULL };
+	struct strbuf msgbuf = STRBUF_INIT;
+	struct object_id head_oid, oid;
+	const char *p;
+	char *author = NULL;
+	int i, res = 1;
+
+	if (get_oid("HEAD", &head_oid) ||
+	    !(head = lookup_commit_reference(r, &head_oid)))
+		return 1;
+
+	if (!mem->active) {
+		/* do_pick_commit() complains about a dirty index */
+		if (repo_read_index(r) < 0 ||
+		    index_differs_from(r, "HEAD", NULL, 0))
+			return 1;
+		init_merge_options(&mem->o, r);
+		mem->o.ancestor = "parent of picked commit";
+		mem->o.branch1 = "HEAD";
+		mem->o.branch2 = "picked commit";
+		for (i = 0; i < opts->xopts_nr; i++)
+			parse_merge_opt(&mem->o, opts->xopts[i]);
+		memset(&mem->result, 0, sizeof(mem->result));
+		read_rename_cache(&mem->o, &mem->result, opts);
+		oidcpy(&mem->worktree, &head_oid);
+		mem->first = current;
+		mem->active = 1;
+	}
+
+	parent = commit->parents->item;
+	if (parse_commit(parent) ||
+	    oideq(get_commit_tree_oid(parent), get_commit_tree_oid(commit)))
+		return 1;
+
+	if (opts->allow_ff && oideq(&parent->object.oid, &head_oid)) {
+		strbuf_addf(&msgbuf, _("%s: fast-forward"),
+			    _(action_name(opts)));
+		res = update_ref(msgbuf.buf, "HEAD", &commit->object.oid,
+				 &head_oid, 0, UPDATE_REFS_MSG_ON_ERR) ? 1 : 0;
+		strbuf_release(&msgbuf);
+		return res;
+	}
+
+	merge_incore_nonrecursive(&mem->o, get_commit_tree(parent),
+				  get_commit_tree(head), get_commit_tree(commit),
+				  &mem->result);
+	if (mem->result.clean <= 0 ||
+	    oideq(&mem->result.tree->object.oid, get_commit_tree_oid(head)))
+		return 1;
+
+	if (get_message(commit, &msg))
+		return 1;
+	if (find_commit_subject(msg.message, &p))
+		strbuf_addstr(&msgbuf, p);
+	if (opts->signoff)
+		append_signoff(&msgbuf, 0, 0);
+	author = get_author(msg.message);
+	if (author)
+		res = try_to_commit(r, &msgbuf, author, opts, 0,
+				    &mem->result.tree->object.oid, &oid) ? 1 : 0;
+
+	free(author);
+	strbuf_release(&msgbuf);
+	free_message(commit, &msg);
+	return res;
+}
+
+/*
+ * Bring the index and the working tree up to date with HEAD at the end
+ * of a run of picks in memory.  If that fails, e.g. because an
+ * untracked file would be overwritten, HEAD is reset to the commit they
+ * still match and the picks of the run are rescheduled.
+ */
+static int finish_in_memory_picks(struct repository *r,
+				  struct todo_list *todo_list,
+				  struct replay_opts *opts,
+				  struct in_memory_picks *mem)
+{
+	struct object_id head;
+
+	if (!mem->active)
+		return 0;
+	mem->active = 0;
+	if (mem->result.priv) {
+		write_rename_cache(&mem->result, opts);
+		merge_finalize(&mem->o, &mem->result);
+	}
+
+	if (get_oid("HEAD", &head))
+		return error(_("could not resolve HEAD commit"));
+	if (oideq(&head, &mem->worktree))
+		return 0;
+
+	repo_read_index(r);
+	if (!checkout_fast_forward(r, &mem->worktree, &head, 1))
+		return 0;
+
+	if (update_ref(NULL, "HEAD", &mem->worktree, &head, 0,
+		       UPDATE_REFS_MSG_ON_ERR))
+		return -1;
+	todo_list->current = mem->first - 1;
+	if (save_todo(todo_list, opts))
+		return -1;
+	return error(_("could not update the working tree; the picks "
+		       "since %s have been rescheduled"),
+		     short_commit_name(todo_list->items[mem->first].commit));
+}
+
 static int pick_commits(struct repository *r,
 			struct todo_list *todo_list,
 			struct replay_opts *opts)
 {
-	int res = 0, reschedule = 0;
+	int res = 0, reschedule = 0, in_memory = 0;
+	struct in_memory_picks mem = { 0 };
 	char *prev_reflog_action;
 
 	/* Note that 0 for 3rd parameter of setenv means set only if not set */
@@ -4283,11 +4482,20 @@ static int pick_commits(struct repository *r,
 	if (read_and_refresh_cache(r, opts))
 		return -1;
 
+	/* hooks might look at the index or the working tree */
+	if (is_rebase_i(opts) &&
+	    !git_config_get_bool("rebase.inmemory", &in_memory) && in_memory)
+		in_memory = !find_hook("prepare-commit-msg") &&
+			!find_hook("post-commit");
+
 	while (todo_list->current < todo_list->nr) {
 		struct todo_item *item = todo_list->items + todo_list->current;
 		const char *arg = todo_item_get_arg(todo_list, item);
 		int check_todo = 0;
 
+		if (mem.active && !can_pick_in_memory(opts, item) &&
+		    finish_in_memory_picks(r, todo_list, opts, &mem))
+			return -1;
 		if (save_todo(todo_list, opts))
 			return -1;
 		if (is_rebase_i(opts)) {
@@ -4325,9 +4533,17 @@ static int pick_commits(struct repository *r,
 				setenv(GIT_REFLOG_ACTION, reflog_message(opts,
 					command_to_string(item->command), NULL),
 					1);
-			res = do_pick_commit(r, item, opts,
-					     is_final_fixup(todo_list),
-					     &check_todo);
+			if (in_memory && can_pick_in_memory(opts, item) &&
+			    !pick_in_memory(r, item, opts, &mem,
+					    todo_list->current))
+				res = 0;
+			else if (finish_in_memory_picks(r, todo_list, opts,
+							&mem))
+				return -1;
+			else
+				res = do_pick_commit(r, item, opts,
+						     is_final_fixup(todo_list),
+						     &check_todo);
 			if (is_rebase_i(opts))
 				setenv(GIT_REFLOG_ACTION, prev_reflog_action, 1);
 			if (is_rebase_i(opts) && res < 0) {
@@ -4454,6 +4670,9 @@ static int pick_commits(struct repository *r,
 			return res;
 	}
 
+	if (finish_in_memory_picks(r, todo_list, opts, &mem))
+		return -1;
+
 	if (is_rebase_i(opts)) {
 		struct strbuf head_ref = STRBUF_INIT, buf = STRBUF_INIT;
 		struct stat st;
@@ -5717,7 +5936,7 @@ int todo_list_rearrange_squash(struct todo_list *todo_list)
 	struct commit_todo_item commit_todo;
 	struct todo_item *items = NULL;
 
-	init_commit_todo_item(&commit_todo);
+	init_commit_todo_item_sparse(&commit_todo);
 	/*
 	 * The hashmap maps onelines to the respective todo list index.
 	 *
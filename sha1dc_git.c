@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "hash-accel.h"
 
 #ifdef DC_SHA1_EXTERNAL
 /*
@@ -22,6 +23,314 @@ void git_SHA1DCFinal(unsigned char hash[20], SHA1_CTX *ctx)
 	    hash_to_hex_algop(hash, &hash_algos[GIT_HASH_SHA1]));
 }
 
+#ifdef SHA1DC_UBC_LANES
+/*
+ * sha1dc only takes a closer look at a block whose expanded message
+ * meets the "unavoidable bit conditions" of one of the disturbance
+ * vectors it knows about, which it checks in ubc_check().  Each of
+ * these conditions says that two bits of the expanded message must be
+ * equal (EQ) or differ (NE) for the vectors in its mask to remain
+ * candidates.  The statements below are the same conditions, one per
+ * statement of sha1dc/ubc_check.c and in the same order, evaluated on
+ * SHA1DC_UBC_LANES blocks at once; the portable code remains what
+ * looks at the blocks that have candidates left.  "test-tool
+ * sha1dc-ubc" checks that both agree, and has to keep passing when
+ * sha1dc is updated.
+ */
+typedef uint32_t ubc_vec __attribute__((vector_size(4 * SHA1DC_UBC_LANES)));
+typedef int32_t ubc_svec __attribute__((vector_size(4 * SHA1DC_UBC_LANES)));
+
+/* all ones in the lanes where bit p of x and bit q of y differ */
+#define UBC_DIFFER(x, p, y, q) \
+	((ubc_vec)((ubc_svec)(((x) << (31 - (p))) ^ ((y) << (31 - (q)))) >> 31))
+#define UBC_EQ(differ) (differ)
+#define UBC_NE(differ) (~(differ))
+#define UBC(a, p, b, q, cond, dvs) \
+	mask &= ~(UBC_##cond(UBC_DIFFER(W[a], p, W[b], q)) & (dvs))
+
+static inline __attribute__((always_inline))
+void ubc_check_lanes(const unsigned char *data, size_t nr, uint32_t *dvmask)
+{
+	/* no condition looks further than W[64] */
+	ubc_vec W[65], mask;
+	const unsigned char *b[SHA1DC_UBC_LANES];
+	size_t i;
+	int t;
+
+	/* unused lanes look at the first block again */
+	for (i = 0; i < SHA1DC_UBC_LANES; i++)
+		b[i] = data + 64 * (i < nr ? i : 0);
+	for (t = 0; t < 16; t++)
+		W[t] = (ubc_vec){
+			get_be32(b[0] + 4 * t), get_be32(b[1] + 4 * t),
+			get_be32(b[2] + 4 * t), get_be32(b[3] + 4 * t),
+			get_be32(b[4] + 4 * t), get_be32(b[5] + 4 * t),
+			get_be32(b[6] + 4 * t), get_be32(b[7] + 4 * t),
+		};
+	for (t = 16; t < 65; t++) {
+		ubc_vec x = W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16];
+		W[t] = (x << 1) | (x >> 31);
+	}
+
+	mask = ~(ubc_vec){ 0 };
+	UBC(44, 29, 45, 29, EQ, 0x0283a080);
+	UBC(49, 29, 50, 29, EQ, 0xc2810008);
+	UBC(48, 29, 49, 29, EQ, 0x60a08004);
+	UBC(47, 4, 50, 29, EQ, 0x82012220);
+	UBC(47, 29, 48, 29, EQ, 0x30302002);
+	UBC(46, 4, 49, 29, EQ, 0x40808888);
+	UBC(46, 29, 47, 29, EQ, 0x18180801);
+	UBC(45, 4, 48, 29, EQ, 0x20202224);
+	UBC(45, 29, 46, 29, EQ, 0x0a0a8200);
+	UBC(44, 4, 47, 29, EQ, 0x1010088a);
+	UBC(43, 4, 46, 29, EQ, 0x08080225);
+	UBC(43, 29, 44, 29, EQ, 0x00a12820);
+	UBC(42, 4, 45, 29, EQ, 0x0202808a);
+	UBC(41, 4, 44, 29, EQ, 0x00812025);
+	UBC(40, 29, 41, 29, EQ, 0x800a00a2);
+	UBC(54, 29, 55, 29, EQ, 0xc0882000);
+	UBC(53, 29, 54, 29, EQ, 0x60220800);
+	UBC(52, 29, 53, 29, EQ, 0x30110200);
+	UBC(50, 4, 53, 29, EQ, 0x20128800);
+	UBC(50, 29, 51, 29, EQ, 0x8a020020);
+	UBC(49, 4, 52, 29, EQ, 0x10092200);
+	UBC(48, 4, 51, 29, EQ, 0x08028880);
+	UBC(42, 29, 43, 29, EQ, 0x00300a08);
+	UBC(41, 29, 42, 29, EQ, 0x00180284);
+	UBC(40, 4, 43, 29, EQ, 0x8020080a);
+	UBC(39, 4, 42, 29, EQ, 0x40100205);
+	UBC(38, 4, 41, 29, EQ, 0xa0080082);
+	UBC(37, 4, 40, 29, EQ, 0x50020021);
+	UBC(55, 29, 56, 29, EQ, 0x82108000);
+	UBC(52, 4, 55, 29, EQ, 0x80908000);
+	UBC(51, 4, 54, 29, EQ, 0x40282000);
+	UBC(51, 29, 52, 29, EQ, 0x18080080);
+	UBC(36, 4, 40, 29, EQ, 0x00110208);
+	UBC(53, 29, 56, 29, NE, 0x00308000);
+	UBC(51, 29, 54, 29, NE, 0x000a0800);
+	UBC(50, 29, 52, 29, NE, 0x00012200);
+	UBC(49, 29, 51, 29, NE, 0x00008880);
+	UBC(48, 29, 50, 29, NE, 0x00002220);
+	UBC(47, 29, 49, 29, NE, 0x00000888);
+	UBC(46, 29, 48, 29, NE, 0x00000224);
+	UBC(45, 6, 47, 6, EQ, 0x00004440);
+	UBC(45, 29, 47, 29, NE, 0x0000008a);
+	UBC(44, 6, 46, 6, EQ, 0x00001110);
+	UBC(44, 29, 46, 29, NE, 0x00000025);
+	UBC(41, 1, 42, 6, NE, 0x04040100);
+	UBC(40, 1, 41, 6, NE, 0x01004040);
+	UBC(40, 4, 42, 4, NE, 0x8000000a);
+	UBC(39, 1, 40, 6, NE, 0x00401010);
+	UBC(39, 4, 41, 4, NE, 0x40000005);
+	UBC(38, 4, 40, 4, NE, 0xa0000002);
+	UBC(37, 4, 39, 4, NE, 0x50000001);
+	UBC(36, 1, 37, 6, NE, 0x00041040);
+	UBC(35, 4, 39, 29, EQ, 0x00080084);
+	UBC(63, 0, 64, 5, NE, 0x00100080);
+	UBC(63, 1, 64, 6, NE, 0x00010004);
+	UBC(62, 0, 63, 5, NE, 0x00080020);
+	UBC(61, 0, 62, 5, NE, 0x00020008);
+	UBC(61, 2, 62, 7, NE, 0x00040010);
+	UBC(60, 0, 61, 5, NE, 0x00010004);
+	UBC(58, 29, 59, 29, EQ, 0x22000000);
+	UBC(57, 29, 58, 29, EQ, 0x10800000);
+	UBC(56, 4, 59, 29, EQ, 0x28000000);
+	UBC(56, 29, 59, 29, NE, 0x0a000000);
+	UBC(56, 29, 57, 29, EQ, 0x08200000);
+	UBC(55, 4, 58, 29, EQ, 0x12000000);
+	UBC(54, 4, 57, 29, EQ, 0x08800000);
+	UBC(53, 4, 56, 29, EQ, 0x02200000);
+	UBC(50, 6, 51, 1, EQ, 0x00041000);
+	UBC(48, 6, 50, 6, EQ, 0x00041000);
+	UBC(48, 29, 55, 29, NE, 0x0000a000);
+	UBC(47, 6, 49, 6, EQ, 0x00004400);
+	UBC(47, 6, 48, 1, EQ, 0x04000040);
+	UBC(46, 6, 48, 6, EQ, 0x00001100);
+	UBC(46, 6, 47, 1, EQ, 0x01000010);
+	UBC(44, 1, 45, 6, NE, 0x00404000);
+	UBC(43, 6, 45, 6, EQ, 0x00000440);
+	UBC(42, 6, 44, 6, EQ, 0x00000110);
+	UBC(42, 6, 43, 1, EQ, 0x04040000);
+	UBC(41, 6, 42, 1, EQ, 0x01004000);
+	UBC(40, 6, 41, 1, EQ, 0x00401000);
+	UBC(39, 4, 43, 29, EQ, 0x02008000);
+	UBC(38, 4, 42, 29, EQ, 0x00802000);
+	UBC(37, 1, 38, 6, NE, 0x00004100);
+	UBC(37, 4, 41, 29, EQ, 0x00200800);
+	UBC(36, 4, 38, 4, NE, 0x28000000);
+	UBC(35, 1, 36, 6, NE, 0x00000410);
+	UBC(35, 3, 39, 28, EQ, 0x00082000);
+	UBC(61, 1, 62, 6, NE, 0x00000001);
+	UBC(59, 5, 63, 30, EQ, 0x00000001);
+	UBC(58, 0, 63, 30, NE, 0x00000001);
+	UBC(62, 1, 63, 6, NE, 0x00000002);
+	UBC(60, 5, 64, 30, EQ, 0x00000002);
+	UBC(59, 0, 64, 30, NE, 0x00000002);
+	UBC(40, 6, 42, 6, EQ, 0x00000010);
+	UBC(62, 2, 63, 7, NE, 0x00000040);
+	UBC(41, 6, 43, 6, EQ, 0x00000040);
+	UBC(63, 2, 64, 7, NE, 0x00000100);
+	UBC(48, 6, 49, 1, EQ, 0x00000100);
+	UBC(49, 6, 50, 1, EQ, 0x00000400);
+	UBC(42, 1, 50, 1, NE, 0x00000400);
+	UBC(39, 6, 40, 1, EQ, 0x00000400);
+	UBC(38, 1, 40, 1, NE, 0x00000400);
+	UBC(36, 4, 37, 4, NE, 0x00000800);
+	UBC(43, 1, 51, 1, NE, 0x00001000);
+	UBC(37, 4, 38, 4, NE, 0x00002000);
+	UBC(51, 6, 52, 1, EQ, 0x00004000);
+	UBC(49, 6, 51, 6, EQ, 0x00004000);
+	UBC(37, 1, 37, 6, EQ, 0x00004000);
+	UBC(35, 5, 39, 30, EQ, 0x00004000);
+	UBC(38, 4, 39, 4, NE, 0x00008000);
+	UBC(47, 1, 51, 1, NE, 0x00040000);
+	UBC(36, 3, 40, 28, EQ, 0x00100000);
+	UBC(35, 30, 40, 28, NE, 0x00100000);
+	UBC(37, 3, 41, 28, EQ, 0x00200000);
+	UBC(36, 30, 41, 28, NE, 0x00200000);
+	UBC(53, 6, 54, 1, EQ, 0x00400000);
+	UBC(51, 6, 53, 6, EQ, 0x00400000);
+	UBC(50, 1, 54, 1, NE, 0x00400000);
+	UBC(45, 6, 46, 1, EQ, 0x00400000);
+	UBC(37, 5, 41, 30, EQ, 0x00400000);
+	UBC(36, 0, 41, 30, NE, 0x00400000);
+	UBC(55, 29, 58, 29, NE, 0x00800000);
+	UBC(38, 3, 42, 28, EQ, 0x00800000);
+	UBC(37, 30, 42, 28, NE, 0x00800000);
+	UBC(54, 6, 55, 1, EQ, 0x01000000);
+	UBC(52, 6, 54, 6, EQ, 0x01000000);
+	UBC(51, 1, 55, 1, NE, 0x01000000);
+	UBC(45, 1, 47, 1, NE, 0x01000000);
+	UBC(38, 5, 42, 30, EQ, 0x01000000);
+	UBC(37, 0, 42, 30, NE, 0x01000000);
+	UBC(39, 3, 43, 28, EQ, 0x02000000);
+	UBC(38, 30, 43, 28, NE, 0x02000000);
+	UBC(55, 6, 56, 1, EQ, 0x04000000);
+	UBC(53, 6, 55, 6, EQ, 0x04000000);
+	UBC(52, 1, 56, 1, NE, 0x04000000);
+	UBC(46, 1, 48, 1, NE, 0x04000000);
+	UBC(39, 5, 43, 30, EQ, 0x04000000);
+	UBC(38, 0, 43, 30, NE, 0x04000000);
+	UBC(59, 29, 60, 29, EQ, 0x08000000);
+	UBC(40, 3, 44, 28, EQ, 0x08000000);
+	UBC(40, 4, 44, 29, EQ, 0x08000000);
+	UBC(39, 30, 44, 28, NE, 0x08000000);
+	UBC(58, 29, 61, 29, NE, 0x10000000);
+	UBC(57, 4, 61, 29, EQ, 0x10000000);
+	UBC(41, 3, 45, 28, EQ, 0x10000000);
+	UBC(41, 4, 45, 29, EQ, 0x10000000);
+	UBC(58, 4, 62, 29, EQ, 0x20000000);
+	UBC(42, 3, 46, 28, EQ, 0x20000000);
+	UBC(42, 4, 46, 29, EQ, 0x20000000);
+	UBC(59, 4, 63, 29, EQ, 0x40000000);
+	UBC(57, 4, 59, 29, EQ, 0x40000000);
+	UBC(43, 3, 47, 28, EQ, 0x40000000);
+	UBC(43, 4, 47, 29, EQ, 0x40000000);
+	UBC(60, 4, 64, 29, EQ, 0x80000000);
+	UBC(44, 3, 48, 28, EQ, 0x80000000);
+	UBC(44, 4, 48, 29, EQ, 0x80000000);
+
+	memcpy(dvmask, &mask, nr * sizeof(*dvmask));
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void ubc_check_avx2(const unsigned char *data, size_t nr,
+			   uint32_t *dvmask)
+{
+	ubc_check_lanes(data, nr, dvmask);
+}
+#endif
+
+static void ubc_check_generic(const unsigned char *data, size_t nr,
+			      uint32_t *dvmask)
+{
+	ubc_check_lanes(data, nr, dvmask);
+}
+
+void sha1dc_ubc_check_blocks(const unsigned char *data, size_t nr,
+			     uint32_t *dvmask)
+{
+	static void (*check)(const unsigned char *, size_t, uint32_t *);
+
+	if (!check) {
+		check = ubc_check_generic;
+#if defined(__x86_64__)
+		if (__builtin_cpu_supports("avx2"))
+			check = ubc_check_avx2;
+#endif
+	}
+	check(data, nr, dvmask);
+}
+
+/*
+ * Hash whole blocks, checking them all up front, so that only the few
+ * with candidates left go through collision detection.  The others
+ * only need to be compressed, with the CPU's SHA instructions when it
+ * has them.
+ */
+static void sha1dc_update_blocks(SHA1_CTX *ctx, const unsigned char *data,
+				 size_t nr)
+{
+	sha1_blocks_fn accel = sha1_accel_blocks();
+
+	while (nr) {
+		uint32_t dvmask[SHA1DC_UBC_LANES];
+		size_t n = nr < SHA1DC_UBC_LANES ? nr : SHA1DC_UBC_LANES;
+		size_t i, run;
+
+		sha1dc_ubc_check_blocks(data, n, dvmask);
+		for (i = 0; i < n; i += run) {
+			run = 1;
+			if (dvmask[i]) {
+				SHA1DCUpdate(ctx, (const char *)data + 64 * i, 64);
+				continue;
+			}
+			while (i + run < n && !dvmask[i + run])
+				run++;
+			if (accel) {
+				accel(ctx->ihv, data + 64 * i, run);
+				ctx->total += 64 * run;
+			} else {
+				SHA1DCSetUseDetectColl(ctx, 0);
+				SHA1DCUpdate(ctx, (const char *)data + 64 * i,
+					     64 * run);
+				SHA1DCSetUseDetectColl(ctx, 1);
+			}
+		}
+		data += 64 * n;
+		nr -= n;
+	}
+}
+
+/*
+ * Feed sha1dc what does not fill whole blocks, and everything when it
+ * has been told to do things differently.
+ */
+static void sha1dc_update(SHA1_CTX *ctx, const char *data, size_t len)
+{
+	size_t fill = (64 - (ctx->total & 63)) & 63;
+
+	if (!ctx->detect_coll || !ctx->ubc_check ||
+	    len < fill + SHA1DC_UBC_MIN_BLOCKS * 64) {
+		SHA1DCUpdate(ctx, data, len);
+		return;
+	}
+	if (fill) {
+		SHA1DCUpdate(ctx, data, fill);
+		data += fill;
+		len -= fill;
+	}
+	sha1dc_update_blocks(ctx, (const unsigned char *)data, len / 64);
+	data += len & ~(size_t)63;
+	len &= 63;
+	if (len)
+		SHA1DCUpdate(ctx, data, len);
+}
+#else
+#define sha1dc_update(ctx, data, len) SHA1DCUpdate(ctx, data, len)
+#endif
+
 /*
  * Same as SHA1DCUpdate, but adjust types to match git's usual interface.
  */
@@ -30,9 +339,9 @@ void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *vdata, unsigned long len)
 	const char *data = vdata;
 	/* We expect an unsigned long, but sha1dc only takes an int */
 	while (len > INT_MAX) {
-		SHA1DCUpdate(ctx, data, INT_MAX);
+		sha1dc_update(ctx, data, INT_MAX);
 		data += INT_MAX;
 		len -= INT_MAX;
 	}
-	SHA1DCUpdate(ctx, data, len);
+	sha1dc_update(ctx, data, len);
 }
@@ -17,6 +17,25 @@ void git_SHA1DCInit(SHA1_CTX *);
 void git_SHA1DCFinal(unsigned char [20], SHA1_CTX *);
 void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *data, unsigned long len);
 
+#if defined(__GNUC__) || defined(__clang__)
+/*
+ * With compiler support for vector types, git_SHA1DCUpdate() checks
+ * this many blocks for collision attacks at once, when given at least
+ * SHA1DC_UBC_MIN_BLOCKS of them.  The loading of the blocks in
+ * sha1dc_git.c is written out for eight.
+ */
+#define SHA1DC_UBC_LANES 8
+#define SHA1DC_UBC_MIN_BLOCKS 4
+
+/*
+ * Compute what sha1dc's ubc_check() would for each of the "nr" (at
+ * most SHA1DC_UBC_LANES) 64-byte blocks at "data".  A block whose mask
+ * is zero cannot be part of a known collision attack.
+ */
+void sha1dc_ubc_check_blocks(const unsigned char *data, size_t nr,
+			     uint32_t *dvmask);
+#endif
+
 #define platform_SHA_CTX SHA1_CTX
 #define platform_SHA1_Init git_SHA1DCInit
 #define platform_SHA1_Update git_SHA1DCUpdate
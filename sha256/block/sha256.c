@@ -1,4 +1,5 @@
 #include "git-compat-util.h"
+#include "hash-accel.h"
 #include "./sha256.h"
 
 #undef RND
@@ -148,6 +149,19 @@ static void blk_SHA256_Transform(blk_SHA256_CTX *ctx, const unsigned char *buf)
 		ctx->state[i] += S[i];
 }
 
+static void blk_SHA256_Blocks(blk_SHA256_CTX *ctx, const unsigned char *buf,
+			      size_t nr)
+{
+	sha256_blocks_fn accel = sha256_accel_blocks();
+
+	if (accel) {
+		accel(ctx->state, buf, nr);
+		return;
+	}
+	for (; nr; nr--, buf += 64)
+		blk_SHA256_Transform(ctx, buf);
+}
+
 void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
 {
 	unsigned int len_buf = ctx->size & 63;
@@ -165,12 +179,12 @@ void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
 		data = ((const char *)data + left);
 		if (len_buf)
 			return;
-		blk_SHA256_Transform(ctx, ctx->buf);
+		blk_SHA256_Blocks(ctx, ctx->buf, 1);
 	}
-	while (len >= 64) {
-		blk_SHA256_Transform(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		blk_SHA256_Blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~(size_t)63));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->buf, data, len);
@@ -106,81 +106,79 @@ void rollback_shallow_file(struct repository *r, struct shallow_lock *lk)
 }
 
 /*
- * TODO: use "int" elemtype instead of "int *" when/if commit-slab
- * supports a "valid" flag.
+ * Only tells whether a commit has been queued yet; the walk below goes
+ * breadth-first, so the first time a commit is reached is by one of
+ * its shortest paths from the heads.
  */
-define_commit_slab(commit_depth, int *);
-static void free_depth_in_slab(int **ptr)
-{
-	FREE_AND_NULL(*ptr);
-}
+define_commit_slab(commit_seen, int);
+
 struct commit_list *get_shallow_commits(struct object_array *heads, int depth,
 		int shallow_flag, int not_shallow_flag)
 {
-	int i = 0, cur_depth = 0;
+	int i, cur_depth = 0;
 	struct commit_list *result = NULL;
-	struct object_array stack = OBJECT_ARRAY_INIT;
-	struct commit *commit = NULL;
+	struct commit **level = NULL, **next = NULL;
+	size_t level_nr = 0, level_alloc = 0, next_nr = 0, next_alloc = 0;
 	struct commit_graft *graft;
-	struct commit_depth depths;
+	struct commit_seen seen;
 
-	init_commit_depth(&depths);
-	while (commit || i < heads->nr || stack.nr) {
-		struct commit_list *p;
-		if (!commit) {
-			if (i < heads->nr) {
-				int **depth_slot;
-				commit = (struct commit *)
-					deref_tag(the_repository,
-						  heads->objects[i++].item,
-						  NULL, 0);
-				if (!commit || commit->object.type != OBJ_COMMIT) {
-					commit = NULL;
-					continue;
-				}
-				depth_slot = commit_depth_at(&depths, commit);
-				if (!*depth_slot)
-					*depth_slot = xmalloc(sizeof(int));
-				**depth_slot = 0;
-				cur_depth = 0;
-			} else {
-				commit = (struct commit *)
-					object_array_pop(&stack);
-				cur_depth = **commit_depth_at(&depths, commit);
-			}
-		}
-		parse_commit_or_die(commit);
-		cur_depth++;
-		if ((depth != INFINITE_DEPTH && cur_depth >= depth) ||
-		    (is_repository_shallow(the_repository) && !commit->parents &&
-		     (graft = lookup_commit_graft(the_repository, &commit->object.oid)) != NULL &&
-		     graft->nr_parent < 0)) {
-			commit_list_insert(commit, &result);
-			commit->object.flags |= shallow_flag;
-			commit = NULL;
+	init_commit_seen(&seen);
+	for (i = 0; i < heads->nr; i++) {
+		struct commit *commit = (struct commit *)
+			deref_tag(the_repository, heads->objects[i].item,
+				  NULL, 0);
+		int *seen_slot;
+
+		if (!commit || commit->object.type != OBJ_COMMIT)
 			continue;
-		}
-		commit->object.flags |= not_shallow_flag;
-		for (p = commit->parents, commit = NULL; p; p = p->next) {
-			int **depth_slot = commit_depth_at(&depths, p->item);
-			if (!*depth_slot) {
-				*depth_slot = xmalloc(sizeof(int));
-				**depth_slot = cur_depth;
-			} else {
-				if (cur_depth >= **depth_slot)
-					continue;
-				**depth_slot = cur_depth;
+		seen_slot = commit_seen_at(&seen, commit);
+		if (*seen_slot)
+			continue;
+		*seen_slot = 1;
+		ALLOC_GROW(level, level_nr + 1, level_alloc);
+		level[level_nr++] = commit;
+	}
+
+	/*
+	 * Each commit is visited once, at its smallest depth, instead of
+	 * again whenever a shorter path to it turns up, which used to
+	 * make wide histories with many merges expensive.
+	 */
+	while (level_nr) {
+		size_t j;
+
+		cur_depth++;
+		next_nr = 0;
+		for (j = 0; j < level_nr; j++) {
+			struct commit *commit = level[j];
+			struct commit_list *p;
+
+			parse_commit_or_die(commit);
+			if ((depth != INFINITE_DEPTH && cur_depth >= depth) ||
+			    (is_repository_shallow(the_repository) && !commit->parents &&
+			     (graft = lookup_commit_graft(the_repository, &commit->object.oid)) != NULL &&
+			     graft->nr_parent < 0)) {
+				commit_list_insert(commit, &result);
+				commit->object.flags |= shallow_flag;
+				continue;
 			}
-			if (p->next)
-				add_object_array(&p->item->object,
-						NULL, &stack);
-			else {
-				commit = p->item;
-				cur_depth = **commit_depth_at(&depths, commit);
+			commit->object.flags |= not_shallow_flag;
+			for (p = commit->parents; p; p = p->next) {
+				int *seen_slot = commit_seen_at(&seen, p->item);
+				if (*seen_slot)
+					continue;
+				*seen_slot = 1;
+				ALLOC_GROW(next, next_nr + 1, next_alloc);
+				next[next_nr++] = p->item;
 			}
 		}
+		SWAP(level, next);
+		SWAP(level_nr, next_nr);
+		SWAP(level_alloc, next_alloc);
 	}
-	deep_clear_commit_depth(&depths, free_depth_in_slab);
+	free(level);
+	free(next);
+	clear_commit_seen(&seen);
 
 	return result;
 }
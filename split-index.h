@@ -34,6 +34,12 @@ void prepare_to_write_split_index(struct index_state *istate);
 void finish_writing_split_index(struct index_state *istate);
 void discard_split_index(struct index_state *istate);
 void add_split_index(struct index_state *istate);
+
+/*
+ * Return 1 if the split index of "istate" holds enough entries that a
+ * new shared index should be written, as per splitIndex.maxPercentChange.
+ */
+int too_many_not_shared_entries(struct index_state *istate);
 void remove_split_index(struct index_state *istate);
 
 #endif
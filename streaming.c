@@ -7,6 +7,7 @@
 #include "object-store.h"
 #include "replace-object.h"
 #include "packfile.h"
+#include "delta.h"
 
 typedef int (*open_istream_fn)(struct git_istream *,
 			       struct repository *,
@@ -16,6 +17,11 @@ typedef int (*close_istream_fn)(struct git_istream *);
 typedef ssize_t (*read_istream_fn)(struct git_istream *, char *, size_t);
 
 #define FILTER_BUFFER (1024*16)
+#define BASE_WINDOW (1024*1024)
+
+static struct git_istream *open_istream_raw(struct repository *r,
+					    const struct object_id *oid,
+					    enum object_type *type);
 
 struct filtered_istream {
 	struct git_istream *upstream;
@@ -27,6 +33,25 @@ struct filtered_istream {
 	int input_finished;
 };
 
+struct pack_delta_istream {
+	struct packed_git *pack;
+	off_t pos; /* of the next compressed delta byte */
+	/*
+	 * The delta base, either in core or as a stream read forward,
+	 * with the last BASE_WINDOW bytes read from it kept in a ring.
+	 */
+	char *base;
+	struct git_istream *base_st;
+	char *base_window;
+	unsigned long base_pos;
+	unsigned long base_size;
+	unsigned char dbuf[FILTER_BUFFER]; /* inflated delta data */
+	size_t d_ptr, d_end;
+	unsigned long copy_off, copy_left; /* current copy from the base */
+	unsigned long insert_left; /* current literal data in the delta */
+	unsigned long left; /* bytes of the result yet to be produced */
+};
+
 struct git_istream {
 	open_istream_fn open;
 	close_istream_fn close;
@@ -55,6 +80,8 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct pack_delta_istream in_pack_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -283,7 +310,14 @@ static ssize_t read_istream_pack_non_delta(struct git_istream *st, char *buf,
 		st->z.next_out = (unsigned char *)buf + total_read;
 		st->z.avail_out = sz - total_read;
 		st->z.next_in = mapped;
+		/*
+		 * The window stays in use until unuse_pack(), so other
+		 * threads may read objects while we inflate; see
+		 * unpack_compressed_entry().
+		 */
+		obj_read_unlock();
 		status = git_inflate(&st->z, Z_FINISH);
+		obj_read_lock();
 
 		st->u.in_pack.pos += st->z.next_in - mapped;
 		total_read = st->z.next_out - (unsigned char *)buf;
@@ -350,6 +384,403 @@ static int open_istream_pack_non_delta(struct git_istream *st,
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ * The delta data is inflated a buffer at a time and its instructions
+ * are applied as the caller reads, so that the result is never
+ * materialized as a whole.  The base is held in core, unless it is
+ * large and the delta never copies from much before the furthest point
+ * it has copied from so far, in which case the base is itself read as
+ * a stream, remembering only the last BASE_WINDOW bytes of it.
+ *
+ *****************************************************************/
+
+static int pack_delta_error(struct git_istream *st)
+{
+	close_deflated_stream(st);
+	st->z_state = z_error;
+	return -1;
+}
+
+/*
+ * Inflate more delta data after whatever is still unused in dbuf.
+ */
+static int fill_pack_delta(struct git_istream *st)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+
+	memmove(ds->dbuf, ds->dbuf + ds->d_ptr, ds->d_end - ds->d_ptr);
+	ds->d_end -= ds->d_ptr;
+	ds->d_ptr = 0;
+
+	while (ds->d_end < sizeof(ds->dbuf) && st->z_state == z_used) {
+		int status;
+		struct pack_window *window = NULL;
+		unsigned char *mapped;
+
+		mapped = use_pack(ds->pack, &window, ds->pos, &st->z.avail_in);
+
+		st->z.next_out = ds->dbuf + ds->d_end;
+		st->z.avail_out = sizeof(ds->dbuf) - ds->d_end;
+		st->z.next_in = mapped;
+		status = git_inflate(&st->z, Z_FINISH);
+
+		ds->pos += st->z.next_in - mapped;
+		ds->d_end = st->z.next_out - ds->dbuf;
+		unuse_pack(&window);
+
+		if (status == Z_STREAM_END) {
+			git_inflate_end(&st->z);
+			st->z_state = z_done;
+			break;
+		}
+		/* see read_istream_pack_non_delta() about Z_BUF_ERROR */
+		if (status != Z_OK && status != Z_BUF_ERROR)
+			return pack_delta_error(st);
+	}
+	return 0;
+}
+
+/*
+ * Start inflating the delta data at ds->pos and read its header,
+ * which must agree with ds->base_size.
+ */
+static int start_pack_delta(struct git_istream *st)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+	const unsigned char *hdr, *top;
+	unsigned long src_size;
+
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->z_state = z_used;
+
+	if (fill_pack_delta(st))
+		return -1;
+	if (ds->d_end < DELTA_SIZE_MIN)
+		return pack_delta_error(st);
+	hdr = ds->dbuf;
+	top = ds->dbuf + ds->d_end;
+	src_size = get_delta_hdr_size(&hdr, top);
+	st->size = get_delta_hdr_size(&hdr, top);
+	if (src_size != ds->base_size || hdr >= top)
+		return pack_delta_error(st);
+	ds->d_ptr = hdr - ds->dbuf;
+	ds->left = st->size;
+	return 0;
+}
+
+/*
+ * Decode the next delta instruction; see patch_delta() for the format.
+ */
+static int next_pack_delta_op(struct git_istream *st)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+	unsigned char cmd;
+	unsigned long off = 0, size = 0;
+	int i;
+
+	/* an instruction takes at most 8 bytes */
+	if (ds->d_end - ds->d_ptr < 8 && fill_pack_delta(st))
+		return -1;
+	if (ds->d_ptr == ds->d_end)
+		return pack_delta_error(st); /* delta data ended early */
+
+	cmd = ds->dbuf[ds->d_ptr++];
+	if (!cmd)
+		return pack_delta_error(st); /* reserved for future use */
+	if (!(cmd & 0x80)) {
+		if (cmd > ds->left)
+			return pack_delta_error(st);
+		ds->insert_left = cmd;
+		return 0;
+	}
+
+	for (i = 0; i < 7; i++) {
+		unsigned long byte;
+
+		if (!(cmd & (1 << i)))
+			continue;
+		if (ds->d_ptr == ds->d_end)
+			return pack_delta_error(st);
+		byte = ds->dbuf[ds->d_ptr++];
+		if (i < 4)
+			off |= byte << (8 * i);
+		else
+			size |= byte << (8 * (i - 4));
+	}
+	if (!size)
+		size = 0x10000;
+	if (unsigned_add_overflows(off, size) ||
+	    off + size > ds->base_size ||
+	    size > ds->left)
+		return pack_delta_error(st);
+	ds->copy_off = off;
+	ds->copy_left = size;
+	return 0;
+}
+
+/*
+ * Take up to "sz" bytes of the current insert instruction into "buf",
+ * or drop them if "buf" is NULL.  Returns the number of bytes taken.
+ */
+static ssize_t take_pack_delta_insert(struct git_istream *st, char *buf,
+				      size_t sz)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+
+	if (ds->d_ptr == ds->d_end && fill_pack_delta(st))
+		return -1;
+	if (ds->d_ptr == ds->d_end)
+		return pack_delta_error(st);
+	if (ds->insert_left < sz)
+		sz = ds->insert_left;
+	if (ds->d_end - ds->d_ptr < sz)
+		sz = ds->d_end - ds->d_ptr;
+	if (buf)
+		memcpy(buf, ds->dbuf + ds->d_ptr, sz);
+	ds->d_ptr += sz;
+	ds->insert_left -= sz;
+	return sz;
+}
+
+/*
+ * Read up to "sz" bytes from the base stream into "buf", remembering
+ * them in the window.
+ */
+static ssize_t read_pack_delta_base(struct pack_delta_istream *ds, char *buf,
+				    size_t sz)
+{
+	ssize_t got = read_istream(ds->base_st, buf, sz);
+	const char *data = buf;
+	unsigned long pos = ds->base_pos;
+	size_t len;
+
+	if (got <= 0)
+		return -1;
+	ds->base_pos += got;
+
+	len = got;
+	if (len > BASE_WINDOW) {
+		data += len - BASE_WINDOW;
+		pos += len - BASE_WINDOW;
+		len = BASE_WINDOW;
+	}
+	while (len) {
+		size_t i = pos % BASE_WINDOW;
+		size_t n = BASE_WINDOW - i;
+
+		if (len < n)
+			n = len;
+		memcpy(ds->base_window + i, data, n);
+		data += n;
+		pos += n;
+		len -= n;
+	}
+	return got;
+}
+
+/*
+ * Take up to "sz" bytes of the current copy instruction into "buf",
+ * reading the base stream forward when it is not held in core.
+ */
+static ssize_t take_pack_delta_copy(struct git_istream *st, char *buf,
+				    size_t sz)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+
+	if (ds->copy_left < sz)
+		sz = ds->copy_left;
+	if (ds->base) {
+		memcpy(buf, ds->base + ds->copy_off, sz);
+	} else if (ds->copy_off < ds->base_pos) {
+		size_t i = ds->copy_off % BASE_WINDOW;
+
+		if (ds->base_pos - ds->copy_off > BASE_WINDOW)
+			return pack_delta_error(st);
+		if (ds->base_pos - ds->copy_off < sz)
+			sz = ds->base_pos - ds->copy_off;
+		if (BASE_WINDOW - i < sz)
+			sz = BASE_WINDOW - i;
+		memcpy(buf, ds->base_window + i, sz);
+	} else {
+		ssize_t got;
+
+		/* skip what the delta does not want, using "buf" as scratch */
+		while (ds->base_pos < ds->copy_off) {
+			size_t skip = ds->copy_off - ds->base_pos;
+
+			if (sz < skip)
+				skip = sz;
+			if (read_pack_delta_base(ds, buf, skip) < 0)
+				return pack_delta_error(st);
+		}
+		got = read_pack_delta_base(ds, buf, sz);
+		if (got < 0)
+			return pack_delta_error(st);
+		sz = got;
+	}
+	ds->copy_off += sz;
+	ds->copy_left -= sz;
+	return sz;
+}
+
+static ssize_t read_istream_pack_delta(struct git_istream *st, char *buf,
+				       size_t sz)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+	size_t total_read = 0;
+
+	if (st->z_state == z_error)
+		return -1;
+
+	while (total_read < sz && ds->left) {
+		ssize_t n;
+
+		if (ds->copy_left)
+			n = take_pack_delta_copy(st, buf + total_read,
+						 sz - total_read);
+		else if (ds->insert_left)
+			n = take_pack_delta_insert(st, buf + total_read,
+						   sz - total_read);
+		else if (next_pack_delta_op(st))
+			return -1;
+		else
+			continue;
+		if (n < 0)
+			return -1;
+		total_read += n;
+		ds->left -= n;
+	}
+	return total_read;
+}
+
+/*
+ * Walk the instructions of the delta data at "pos" without producing
+ * anything, and tell whether no copy starts more than BASE_WINDOW
+ * bytes before the end of the furthest one so far, i.e. whether the
+ * base can be read as a stream.
+ */
+static int pack_delta_reads_forward(struct packed_git *p, off_t pos,
+				    unsigned long base_size)
+{
+	struct git_istream *scan = xcalloc(1, sizeof(*scan));
+	struct pack_delta_istream *ds = &scan->u.in_pack_delta;
+	unsigned long base_end = 0;
+	int ret = 0;
+
+	ds->pack = p;
+	ds->pos = pos;
+	ds->base_size = base_size;
+	if (start_pack_delta(scan))
+		goto out;
+
+	while (ds->left) {
+		if (next_pack_delta_op(scan))
+			goto out;
+		if (ds->copy_left) {
+			if (ds->copy_off + BASE_WINDOW < base_end)
+				goto out;
+			if (base_end < ds->copy_off + ds->copy_left)
+				base_end = ds->copy_off + ds->copy_left;
+			ds->left -= ds->copy_left;
+			ds->copy_left = 0;
+		}
+		while (ds->insert_left) {
+			ssize_t n = take_pack_delta_insert(scan, NULL,
+							   ds->insert_left);
+			if (n < 0)
+				goto out;
+			ds->left -= n;
+		}
+	}
+	ret = 1;
+
+out:
+	close_deflated_stream(scan);
+	free(scan);
+	return ret;
+}
+
+static int close_istream_pack_delta(struct git_istream *st)
+{
+	close_deflated_stream(st);
+	free(st->u.in_pack_delta.base);
+	free(st->u.in_pack_delta.base_window);
+	if (st->u.in_pack_delta.base_st)
+		close_istream(st->u.in_pack_delta.base_st);
+	return 0;
+}
+
+static int open_istream_pack_delta(struct git_istream *st,
+				   struct repository *r,
+				   const struct object_id *oid,
+				   enum object_type *type)
+{
+	struct packed_git *p = st->u.in_pack.pack;
+	off_t obj_offset = st->u.in_pack.pos;
+	off_t pos = obj_offset, base_offset;
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+	struct pack_window *window = NULL;
+	struct object_info oi = OBJECT_INFO_INIT;
+	struct object_info base_oi = OBJECT_INFO_INIT;
+	struct object_id base_oid;
+	enum object_type in_pack_type, base_type;
+	unsigned long delta_size, base_size;
+	struct git_istream *base_st = NULL;
+	char *base = NULL;
+
+	in_pack_type = unpack_object_header(p, &window, &pos, &delta_size);
+	if (in_pack_type != OBJ_OFS_DELTA && in_pack_type != OBJ_REF_DELTA) {
+		unuse_pack(&window);
+		return -1;
+	}
+	base_offset = get_delta_base(p, &window, &pos, in_pack_type,
+				     obj_offset);
+	unuse_pack(&window);
+	if (!base_offset)
+		return -1;
+
+	base_oi.sizep = &base_size;
+	if (packed_object_info(r, p, base_offset, &base_oi) < 0)
+		return -1;
+	if (big_file_threshold < base_size &&
+	    pack_delta_reads_forward(p, pos, base_size)) {
+		oi.delta_base_oid = &base_oid;
+		if (packed_object_info(r, p, obj_offset, &oi) >= 0)
+			base_st = open_istream_raw(r, &base_oid, &base_type);
+		if (base_st && base_st->size != base_size) {
+			close_istream(base_st);
+			base_st = NULL;
+		}
+	}
+	if (!base_st) {
+		base = unpack_entry(r, p, base_offset, &base_type, &base_size);
+		if (!base)
+			return -1;
+	}
+
+	memset(ds, 0, sizeof(*ds));
+	ds->pack = p;
+	ds->pos = pos;
+	ds->base = base;
+	ds->base_st = base_st;
+	if (base_st)
+		ds->base_window = xmalloc(BASE_WINDOW);
+	ds->base_size = base_size;
+	if (start_pack_delta(st)) {
+		close_istream_pack_delta(st);
+		return -1;
+	}
+
+	st->close = close_istream_pack_delta;
+	st->read = read_istream_pack_delta;
+	return 0;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -411,10 +842,12 @@ static int istream_source(struct git_istream *st,
 		st->open = open_istream_loose;
 		return 0;
 	case OI_PACKED:
-		if (!oi.u.packed.is_delta && big_file_threshold < size) {
+		if (big_file_threshold < size) {
 			st->u.in_pack.pack = oi.u.packed.pack;
 			st->u.in_pack.pos = oi.u.packed.offset;
-			st->open = open_istream_pack_non_delta;
+			st->open = oi.u.packed.is_delta ?
+				open_istream_pack_delta :
+				open_istream_pack_non_delta;
 			return 0;
 		}
 		/* fallthru */
@@ -440,27 +873,42 @@ ssize_t read_istream(struct git_istream *st, void *buf, size_t sz)
 	return st->read(st, buf, sz);
 }
 
-struct git_istream *open_istream(struct repository *r,
-				 const struct object_id *oid,
-				 enum object_type *type,
-				 unsigned long *size,
-				 struct stream_filter *filter)
+/*
+ * Open a stream of the object named by "oid" itself, without looking
+ * up its replacement.
+ */
+static struct git_istream *open_istream_raw(struct repository *r,
+					    const struct object_id *oid,
+					    enum object_type *type)
 {
 	struct git_istream *st = xmalloc(sizeof(*st));
-	const struct object_id *real = lookup_replace_object(r, oid);
-	int ret = istream_source(st, r, real, type);
+	int ret = istream_source(st, r, oid, type);
 
 	if (ret) {
 		free(st);
 		return NULL;
 	}
 
-	if (st->open(st, r, real, type)) {
-		if (open_istream_incore(st, r, real, type)) {
+	if (st->open(st, r, oid, type)) {
+		if (open_istream_incore(st, r, oid, type)) {
 			free(st);
 			return NULL;
 		}
 	}
+	return st;
+}
+
+struct git_istream *open_istream(struct repository *r,
+				 const struct object_id *oid,
+				 enum object_type *type,
+				 unsigned long *size,
+				 struct stream_filter *filter)
+{
+	const struct object_id *real = lookup_replace_object(r, oid);
+	struct git_istream *st = open_istream_raw(r, real, type);
+
+	if (!st)
+		return NULL;
 	if (filter) {
 		/* Add "&& !is_null_stream_filter(filter)" for performance */
 		struct git_istream *nst = attach_stream_filter(st, filter);
@@ -484,7 +932,13 @@ int stream_blob_to_fd(int fd, const struct object_id *oid, struct stream_filter
 	ssize_t kept = 0;
 	int result = -1;
 
+	/*
+	 * Reading may happen in several threads at once under the object
+	 * read lock (see enable_obj_read_lock()); writing does not need it.
+	 */
+	obj_read_lock();
 	st = open_istream(the_repository, oid, &type, &sz, filter);
+	obj_read_unlock();
 	if (!st) {
 		if (filter)
 			free_stream_filter(filter);
@@ -495,7 +949,11 @@ int stream_blob_to_fd(int fd, const struct object_id *oid, struct stream_filter
 	for (;;) {
 		char buf[1024 * 16];
 		ssize_t wrote, holeto;
-		ssize_t readlen = read_istream(st, buf, sizeof(buf));
+		ssize_t readlen;
+
+		obj_read_lock();
+		readlen = read_istream(st, buf, sizeof(buf));
+		obj_read_unlock();
 
 		if (readlen < 0)
 			goto close_and_exit;
@@ -526,6 +984,8 @@ int stream_blob_to_fd(int fd, const struct object_id *oid, struct stream_filter
 	result = 0;
 
  close_and_exit:
+	obj_read_lock();
 	close_istream(st);
+	obj_read_unlock();
 	return result;
 }
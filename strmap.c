@@ -34,6 +34,7 @@ void strmap_init_with_options(struct strmap *map,
 			      int strdup_strings)
 {
 	hashmap_init(&map->map, cmp_strmap_entry, NULL, 0);
+	hashmap_enable_incremental_resize(&map->map);
 	map->pool = pool;
 	map->strdup_strings = strdup_strings;
 }
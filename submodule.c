@@ -22,6 +22,8 @@
 #include "parse-options.h"
 #include "object-store.h"
 #include "commit-reach.h"
+#include "strmap.h"
+#include "tempfile.h"
 
 static int config_update_recurse_submodules = RECURSE_SUBMODULES_OFF;
 static int initialized_fetch_ref_tips;
@@ -1647,68 +1649,130 @@ int fetch_populated_submodules(struct repository *r,
 	return spf.result;
 }
 
+/*
+ * Fold one line of "git status --porcelain=2" output from a submodule
+ * into "dirty_submodule".  Returns 1 once the line has told us all we
+ * could ever want to know, so that the rest of the output can be
+ * ignored.
+ */
+static int parse_status_porcelain(const char *line, size_t len,
+				  unsigned *dirty_submodule,
+				  int ignore_untracked)
+{
+	/* regular untracked files */
+	if (line[0] == '?')
+		*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+	if (line[0] == 'u' ||
+	    line[0] == '1' ||
+	    line[0] == '2') {
+		/* T = line type, XY = status, SSSS = submodule state */
+		if (len < strlen("T XY SSSS"))
+			BUG("invalid status --porcelain=2 line %.*s",
+			    (int)len, line);
+
+		if (line[5] == 'S' && line[8] == 'U')
+			/* nested untracked file */
+			*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+		if (line[0] == 'u' ||
+		    line[0] == '2' ||
+		    memcmp(line + 5, "S..U", 4))
+			/* other change */
+			*dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
+	}
+
+	return (*dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
+	       ((*dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
+		ignore_untracked);
+}
+
+/*
+ * Returns 1 if the submodule at "path" is checked out, 0 if it is not,
+ * and -1 if there is a directory where its git directory should be
+ * that is not a repository.
+ */
+static int submodule_git_dir_state(const char *path, struct strbuf *buf)
+{
+	const char *git_dir;
+
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%s/.git", path);
+	git_dir = read_gitfile(buf->buf);
+	if (!git_dir)
+		git_dir = buf->buf;
+	if (is_git_directory(git_dir))
+		return 1;
+	if (is_directory(git_dir)) {
+		if (git_dir != buf->buf) {
+			strbuf_reset(buf);
+			strbuf_addstr(buf, git_dir);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+static void prepare_submodule_status(struct child_process *cp,
+				     const char *path, int ignore_untracked)
+{
+	strvec_pushl(&cp->args, "status", "--porcelain=2", NULL);
+	if (ignore_untracked)
+		strvec_push(&cp->args, "-uno");
+
+	prepare_submodule_repo_env(&cp->env_array);
+	cp->git_cmd = 1;
+	cp->no_stdin = 1;
+	cp->dir = path;
+}
+
+/*
+ * Results of get_submodules_status(), waiting for is_submodule_modified()
+ * to ask for them.
+ */
+struct submodule_status_result {
+	int ignore_untracked;
+	unsigned dirty_submodule;
+};
+
+static struct strmap submodule_status_results = STRMAP_INIT;
+
 unsigned is_submodule_modified(const char *path, int ignore_untracked)
 {
 	struct child_process cp = CHILD_PROCESS_INIT;
 	struct strbuf buf = STRBUF_INIT;
 	FILE *fp;
 	unsigned dirty_submodule = 0;
-	const char *git_dir;
+	struct submodule_status_result *result;
 	int ignore_cp_exit_code = 0;
 
-	strbuf_addf(&buf, "%s/.git", path);
-	git_dir = read_gitfile(buf.buf);
-	if (!git_dir)
-		git_dir = buf.buf;
-	if (!is_git_directory(git_dir)) {
-		if (is_directory(git_dir))
-			die(_("'%s' not recognized as a git repository"), git_dir);
+	result = strmap_get(&submodule_status_results, path);
+	if (result && result->ignore_untracked == ignore_untracked) {
+		dirty_submodule = result->dirty_submodule;
+		/* the working tree may change before we are asked again */
+		strmap_remove(&submodule_status_results, path, 1);
+		return dirty_submodule;
+	}
+
+	switch (submodule_git_dir_state(path, &buf)) {
+	case -1:
+		die(_("'%s' not recognized as a git repository"), buf.buf);
+	case 0:
 		strbuf_release(&buf);
 		/* The submodule is not checked out, so it is not modified */
 		return 0;
 	}
 	strbuf_reset(&buf);
 
-	strvec_pushl(&cp.args, "status", "--porcelain=2", NULL);
-	if (ignore_untracked)
-		strvec_push(&cp.args, "-uno");
-
-	prepare_submodule_repo_env(&cp.env_array);
-	cp.git_cmd = 1;
-	cp.no_stdin = 1;
+	prepare_submodule_status(&cp, path, ignore_untracked);
 	cp.out = -1;
-	cp.dir = path;
 	if (start_command(&cp))
 		die(_("Could not run 'git status --porcelain=2' in submodule %s"), path);
 
 	fp = xfdopen(cp.out, "r");
 	while (strbuf_getwholeline(&buf, fp, '\n') != EOF) {
-		/* regular untracked files */
-		if (buf.buf[0] == '?')
-			dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-		if (buf.buf[0] == 'u' ||
-		    buf.buf[0] == '1' ||
-		    buf.buf[0] == '2') {
-			/* T = line type, XY = status, SSSS = submodule state */
-			if (buf.len < strlen("T XY SSSS"))
-				BUG("invalid status --porcelain=2 line %s",
-				    buf.buf);
-
-			if (buf.buf[5] == 'S' && buf.buf[8] == 'U')
-				/* nested untracked file */
-				dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-			if (buf.buf[0] == 'u' ||
-			    buf.buf[0] == '2' ||
-			    memcmp(buf.buf + 5, "S..U", 4))
-				/* other change */
-				dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
-		}
-
-		if ((dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
-		    ((dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
-		     ignore_untracked)) {
+		if (parse_status_porcelain(buf.buf, buf.len, &dirty_submodule,
+					   ignore_untracked)) {
 			/*
 			 * We're not interested in any further information from
 			 * the child any more, neither output nor its exit code.
@@ -1726,6 +1790,140 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 	return dirty_submodule;
 }
 
+struct submodule_parallel_status {
+	struct string_list *paths;
+	size_t next;
+	struct strbuf buf;
+	const char *failed;
+};
+
+struct submodule_status_task {
+	struct string_list_item *item;
+	struct tempfile *out;
+};
+
+static int get_next_submodule_status(struct child_process *cp,
+				     struct strbuf *err, void *data,
+				     void **task_cb)
+{
+	struct submodule_parallel_status *sps = data;
+
+	while (sps->next < sps->paths->nr) {
+		struct string_list_item *item = &sps->paths->items[sps->next++];
+		struct submodule_status_task *task;
+
+		/*
+		 * Leave submodules that are not checked out, or that are
+		 * broken, to is_submodule_modified() to deal with.
+		 */
+		if (submodule_git_dir_state(item->string, &sps->buf) != 1)
+			continue;
+
+		CALLOC_ARRAY(task, 1);
+		task->item = item;
+		task->out = mks_tempfile_t(".git_status_tmpXXXXXX");
+		if (!task->out)
+			die_errno(_("could not create temporary file"));
+
+		prepare_submodule_status(cp, item->string, !!item->util);
+		/* keep the status apart from what the child says on stderr */
+		cp->out = xopen(get_tempfile_path(task->out), O_WRONLY);
+		*task_cb = task;
+		return 1;
+	}
+	return 0;
+}
+
+static void submodule_status_task_free(struct submodule_status_task *task)
+{
+	delete_tempfile(&task->out);
+	free(task);
+}
+
+static int submodule_status_start_failure(struct strbuf *err, void *data,
+					  void *task_cb)
+{
+	struct submodule_parallel_status *sps = data;
+	struct submodule_status_task *task = task_cb;
+
+	if (!sps->failed)
+		sps->failed = task->item->string;
+	submodule_status_task_free(task);
+	return 0;
+}
+
+static int submodule_status_finish(int retvalue, struct strbuf *err,
+				   void *data, void *task_cb)
+{
+	struct submodule_parallel_status *sps = data;
+	struct submodule_status_task *task = task_cb;
+	struct string_list_item *item = task->item;
+	struct submodule_status_result *result;
+	const char *line;
+
+	strbuf_reset(&sps->buf);
+	if (retvalue ||
+	    strbuf_read_file(&sps->buf, get_tempfile_path(task->out), 0) < 0) {
+		if (!sps->failed)
+			sps->failed = item->string;
+		submodule_status_task_free(task);
+		return 0;
+	}
+	submodule_status_task_free(task);
+
+	CALLOC_ARRAY(result, 1);
+	result->ignore_untracked = !!item->util;
+	for (line = sps->buf.buf; *line; ) {
+		const char *eol = strchrnul(line, '\n');
+
+		if (parse_status_porcelain(line, eol - line,
+					   &result->dirty_submodule,
+					   result->ignore_untracked))
+			break;
+		line = *eol ? eol + 1 : eol;
+	}
+
+	free(strmap_put(&submodule_status_results, item->string, result));
+	return 0;
+}
+
+void get_submodules_status(struct repository *r, struct string_list *paths)
+{
+	struct submodule_parallel_status sps = { paths, 0, STRBUF_INIT };
+	int max_jobs = submodule_diff_jobs(r);
+
+	if (max_jobs <= 1 || paths->nr <= 1)
+		return;
+
+	run_processes_parallel_tr2(max_jobs,
+				   get_next_submodule_status,
+				   submodule_status_start_failure,
+				   submodule_status_finish,
+				   &sps,
+				   "submodule", "parallel/status");
+	strbuf_release(&sps.buf);
+
+	if (sps.failed)
+		die(_("'git status --porcelain=2' failed in submodule %s"),
+		    sps.failed);
+}
+
+void clear_submodules_status(void)
+{
+	strmap_partial_clear(&submodule_status_results, 1);
+}
+
+int submodule_diff_jobs(struct repository *r)
+{
+	int jobs;
+
+	if (repo_config_get_int(r, "submodule.diffjobs", &jobs))
+		return 1;
+	if (jobs < 0)
+		die(_("negative values not allowed for submodule.diffJobs"));
+	return jobs ? jobs : online_cpus();
+}
+
 int submodule_uses_gitfile(const char *path)
 {
 	struct child_process cp = CHILD_PROCESS_INIT;
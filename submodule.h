@@ -90,6 +90,18 @@ int fetch_populated_submodules(struct repository *r,
 			       int default_option,
 			       int quiet, int max_parallel_jobs);
 unsigned is_submodule_modified(const char *path, int ignore_untracked);
+
+/*
+ * Run "git status" in the submodules at the given paths, up to
+ * submodule.diffJobs of them at a time, so that is_submodule_modified()
+ * can answer for them without running anything.  The util of each item
+ * is non-NULL if untracked files are to be ignored in that submodule.
+ * Each answer is handed out once; clear_submodules_status() discards
+ * the ones nobody asked for.
+ */
+void get_submodules_status(struct repository *r, struct string_list *paths);
+void clear_submodules_status(void);
+int submodule_diff_jobs(struct repository *r);
 int submodule_uses_gitfile(const char *path);
 
 #define SUBMODULE_REMOVAL_DIE_ON_ERROR (1<<0)
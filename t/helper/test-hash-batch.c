@@ -0,0 +1,58 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "hash-batch.h"
+#include "object-store.h"
+
+/*
+ * Print the blob names of the given files, computed all at once with
+ * hash_object_file_batch(), or one by one with hash_object_file().
+ */
+int cmd__hash_batch(int ac, const char **av)
+{
+	const struct git_hash_algo *algo = NULL;
+	struct hash_batch_item *items;
+	struct strbuf *bufs;
+	struct object_id *oids;
+	int one_by_one = 0;
+	int i, algo_id, nr;
+
+	if (ac > 1 && !strcmp(av[1], "--one-by-one")) {
+		one_by_one = 1;
+		ac--;
+		av++;
+	}
+	if (ac < 2 || (algo_id = hash_algo_by_name(av[1])) == GIT_HASH_UNKNOWN)
+		die("usage: test-tool hash-batch [--one-by-one] <algo> <file>...");
+	algo = &hash_algos[algo_id];
+
+	nr = ac - 2;
+	CALLOC_ARRAY(items, nr);
+	CALLOC_ARRAY(bufs, nr);
+	CALLOC_ARRAY(oids, nr);
+	for (i = 0; i < nr; i++) {
+		strbuf_init(&bufs[i], 0);
+		if (strbuf_read_file(&bufs[i], av[i + 2], 0) < 0)
+			die_errno("cannot read '%s'", av[i + 2]);
+		items[i].type = "blob";
+		items[i].buf = bufs[i].buf;
+		items[i].len = bufs[i].len;
+		items[i].oid = &oids[i];
+	}
+
+	if (one_by_one) {
+		for (i = 0; i < nr; i++)
+			hash_object_file(algo, items[i].buf, items[i].len,
+					 items[i].type, items[i].oid);
+	} else {
+		hash_object_file_batch(algo, items, nr);
+	}
+
+	for (i = 0; i < nr; i++) {
+		printf("%s\n", hash_to_hex_algop(oids[i].hash, algo));
+		strbuf_release(&bufs[i]);
+	}
+	free(items);
+	free(bufs);
+	free(oids);
+	return 0;
+}
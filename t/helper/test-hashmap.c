@@ -147,15 +147,24 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
  * size -> tablesize numentries
  *
  * perfhashmap method rounds -> test hashmap.[ch] performance
+ *
+ * The map ignores the case of the keys if "ignorecase" is given on the
+ * command line, and grows incrementally if "incremental" is.
  */
 int cmd__hashmap(int argc, const char **argv)
 {
 	struct strbuf line = STRBUF_INIT;
-	int icase;
+	int icase, i;
 	struct hashmap map = HASHMAP_INIT(test_entry_cmp, &icase);
 
 	/* init hash map */
-	icase = argc > 1 && !strcmp("ignorecase", argv[1]);
+	icase = 0;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp("ignorecase", argv[i]))
+			icase = 1;
+		else if (!strcmp("incremental", argv[i]))
+			hashmap_enable_incremental_resize(&map);
+	}
 
 	/* process commands from stdin */
 	while (strbuf_getline(&line, stdin) != EOF) {
@@ -0,0 +1,452 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "delta.h"
+#include "ewah/ewok.h"
+#include "hashmap.h"
+#include "mem-pool.h"
+#include "oidmap.h"
+#include "oidset.h"
+#include "parse-options.h"
+#include "prio-queue.h"
+#include "strmap.h"
+
+/*
+ * Microbenchmarks of the core data structures.  Each benchmark works
+ * on "size" items: setup() prepares everything that is not measured,
+ * run() does the measured work and returns the number of operations
+ * it did, and teardown() releases what the two allocated.  This is
+ * repeated for each round and the fastest round is reported, with the
+ * number of allocations it made through xmalloc() and friends.
+ *
+ * For the ewah and delta benchmarks, an operation is one bit or one
+ * byte of the bitmap or buffer, so that the numbers of different sizes
+ * compare.
+ */
+
+struct bench_entry {
+	struct hashmap_entry ent;
+	const char *key;
+};
+
+static struct bench_data {
+	size_t size;
+	char **keys;
+	struct object_id *oids;
+	struct bench_entry *entries;
+	struct oidmap_entry *oidmap_entries;
+	int *ints;
+
+	struct hashmap hashmap;
+	struct strmap strmap;
+	struct oidset oidset;
+	struct oidmap oidmap;
+	struct mem_pool pool;
+	struct bitmap *bitmap;
+	struct ewah_bitmap *ewah;
+	char *src, *trg, *delta;
+	unsigned long delta_size;
+} data;
+
+/* keep the compiler from optimizing away what we measure */
+static volatile uintptr_t sink;
+
+static uint32_t next_random(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state;
+}
+
+static int entry_cmp(const void *cmp_data, const struct hashmap_entry *eptr,
+		     const struct hashmap_entry *entry_or_key,
+		     const void *keydata)
+{
+	const struct bench_entry *a, *b;
+
+	a = container_of(eptr, const struct bench_entry, ent);
+	b = container_of(entry_or_key, const struct bench_entry, ent);
+	return strcmp(a->key, keydata ? keydata : b->key);
+}
+
+static int int_cmp(const void *va, const void *vb, void *cb_data)
+{
+	const int *a = va, *b = vb;
+	return *a < *b ? -1 : *a > *b;
+}
+
+static void fill_hashmap(void)
+{
+	size_t i;
+
+	hashmap_init(&data.hashmap, entry_cmp, NULL, 0);
+	for (i = 0; i < data.size; i++)
+		hashmap_add(&data.hashmap, &data.entries[i].ent);
+}
+
+static void empty_hashmap(void)
+{
+	hashmap_clear(&data.hashmap);
+}
+
+static uintmax_t hashmap_add_run(void)
+{
+	fill_hashmap();
+	return data.size;
+}
+
+static uintmax_t hashmap_get_run(void)
+{
+	size_t i;
+
+	for (i = 0; i < data.size; i++)
+		sink += (uintptr_t)hashmap_get_from_hash(&data.hashmap,
+							 strhash(data.keys[i]),
+							 data.keys[i]);
+	return data.size;
+}
+
+static void fill_strmap(void)
+{
+	size_t i;
+
+	strmap_init(&data.strmap);
+	for (i = 0; i < data.size; i++)
+		strmap_put(&data.strmap, data.keys[i], data.keys[i]);
+}
+
+static void empty_strmap(void)
+{
+	strmap_clear(&data.strmap, 0);
+}
+
+static uintmax_t strmap_put_run(void)
+{
+	fill_strmap();
+	return data.size;
+}
+
+static uintmax_t strmap_get_run(void)
+{
+	size_t i;
+
+	for (i = 0; i < data.size; i++)
+		sink += (uintptr_t)strmap_get(&data.strmap, data.keys[i]);
+	return data.size;
+}
+
+static void fill_oidset(void)
+{
+	size_t i;
+
+	oidset_init(&data.oidset, 0);
+	for (i = 0; i < data.size; i++)
+		oidset_insert(&data.oidset, &data.oids[i]);
+}
+
+static void empty_oidset(void)
+{
+	oidset_clear(&data.oidset);
+}
+
+static uintmax_t oidset_insert_run(void)
+{
+	fill_oidset();
+	return data.size;
+}
+
+static uintmax_t oidset_contains_run(void)
+{
+	size_t i;
+
+	for (i = 0; i < data.size; i++)
+		sink += oidset_contains(&data.oidset, &data.oids[i]);
+	return data.size;
+}
+
+static void fill_oidmap(void)
+{
+	size_t i;
+
+	oidmap_init(&data.oidmap, 0);
+	for (i = 0; i < data.size; i++)
+		oidmap_put(&data.oidmap, &data.oidmap_entries[i]);
+}
+
+static void empty_oidmap(void)
+{
+	oidmap_free(&data.oidmap, 0);
+}
+
+static uintmax_t oidmap_put_run(void)
+{
+	fill_oidmap();
+	return data.size;
+}
+
+static uintmax_t oidmap_get_run(void)
+{
+	size_t i;
+
+	for (i = 0; i < data.size; i++)
+		sink += (uintptr_t)oidmap_get(&data.oidmap, &data.oids[i]);
+	return data.size;
+}
+
+/* put each item and get it back, in random order */
+static uintmax_t prio_queue_run(void)
+{
+	struct prio_queue queue = { int_cmp };
+	size_t i;
+
+	for (i = 0; i < data.size; i++)
+		prio_queue_put(&queue, &data.ints[i]);
+	while (queue.nr)
+		sink += (uintptr_t)prio_queue_get(&queue);
+	clear_prio_queue(&queue);
+	return data.size;
+}
+
+/* allocate 32-byte chunks and discard the pool */
+static uintmax_t mem_pool_run(void)
+{
+	size_t i;
+
+	mem_pool_init(&data.pool, 0);
+	for (i = 0; i < data.size; i++)
+		sink += (uintptr_t)mem_pool_alloc(&data.pool, 32);
+	mem_pool_discard(&data.pool, 0);
+	return data.size;
+}
+
+/*
+ * The bitmaps have "size" bits, in runs of set and unset ones of
+ * random lengths, like those of reachability bitmaps.
+ */
+static void bitmap_setup(void)
+{
+	uint32_t state = 1;
+	size_t i = 0;
+
+	data.bitmap = bitmap_new();
+	while (i < data.size) {
+		size_t run = next_random(&state) % 512 + 1;
+		int set = next_random(&state) & 0x10000;
+
+		for (; run && i < data.size; run--, i++)
+			if (set)
+				bitmap_set(data.bitmap, i);
+	}
+}
+
+static void bitmap_teardown(void)
+{
+	bitmap_free(data.bitmap);
+	ewah_free(data.ewah);
+	data.ewah = NULL;
+}
+
+static uintmax_t ewah_compress_run(void)
+{
+	data.ewah = bitmap_to_ewah(data.bitmap);
+	return data.size;
+}
+
+static void ewah_iterate_setup(void)
+{
+	bitmap_setup();
+	data.ewah = bitmap_to_ewah(data.bitmap);
+}
+
+static uintmax_t ewah_iterate_run(void)
+{
+	struct ewah_iterator it;
+	eword_t word;
+
+	ewah_iterator_init(&it, data.ewah);
+	while (ewah_iterator_next(&word, &it))
+		sink += word;
+	return data.size;
+}
+
+/*
+ * The target is the source with a small change every 4 KiB, like
+ * consecutive versions of a file.
+ */
+static void delta_setup(void)
+{
+	uint32_t state = 1;
+	size_t i;
+
+	data.src = xmalloc(data.size);
+	for (i = 0; i < data.size; i++)
+		data.src[i] = 'a' + next_random(&state) % 26;
+	data.trg = xmemdupz(data.src, data.size);
+	for (i = 0; i < data.size; i += 4096)
+		data.trg[i] = '-';
+}
+
+static void delta_teardown(void)
+{
+	FREE_AND_NULL(data.src);
+	FREE_AND_NULL(data.trg);
+	FREE_AND_NULL(data.delta);
+}
+
+static uintmax_t delta_create_run(void)
+{
+	data.delta = diff_delta(data.src, data.size, data.trg, data.size,
+				&data.delta_size, 0);
+	if (!data.delta)
+		die("diff_delta failed");
+	return data.size;
+}
+
+static void delta_apply_setup(void)
+{
+	delta_setup();
+	delta_create_run();
+}
+
+static uintmax_t delta_apply_run(void)
+{
+	unsigned long size;
+	void *result = patch_delta(data.src, data.size, data.delta,
+				   data.delta_size, &size);
+
+	if (!result || size != data.size)
+		die("patch_delta failed");
+	free(result);
+	return data.size;
+}
+
+struct benchmark {
+	const char *name;
+	void (*setup)(void);
+	uintmax_t (*run)(void);
+	void (*teardown)(void);
+};
+
+static struct benchmark benchmarks[] = {
+	{ "hashmap-add", NULL, hashmap_add_run, empty_hashmap },
+	{ "hashmap-get", fill_hashmap, hashmap_get_run, empty_hashmap },
+	{ "strmap-put", NULL, strmap_put_run, empty_strmap },
+	{ "strmap-get", fill_strmap, strmap_get_run, empty_strmap },
+	{ "oidset-insert", NULL, oidset_insert_run, empty_oidset },
+	{ "oidset-contains", fill_oidset, oidset_contains_run, empty_oidset },
+	{ "oidmap-put", NULL, oidmap_put_run, empty_oidmap },
+	{ "oidmap-get", fill_oidmap, oidmap_get_run, empty_oidmap },
+	{ "prio-queue", NULL, prio_queue_run, NULL },
+	{ "mem-pool", NULL, mem_pool_run, NULL },
+	{ "ewah-compress", bitmap_setup, ewah_compress_run, bitmap_teardown },
+	{ "ewah-iterate", ewah_iterate_setup, ewah_iterate_run, bitmap_teardown },
+	{ "delta-create", delta_setup, delta_create_run, delta_teardown },
+	{ "delta-apply", delta_apply_setup, delta_apply_run, delta_teardown },
+};
+
+static void prepare_inputs(size_t size)
+{
+	uint32_t state = 42;
+	size_t i, j;
+
+	data.size = size;
+	ALLOC_ARRAY(data.keys, size);
+	ALLOC_ARRAY(data.oids, size);
+	CALLOC_ARRAY(data.entries, size);
+	CALLOC_ARRAY(data.oidmap_entries, size);
+	ALLOC_ARRAY(data.ints, size);
+
+	for (i = 0; i < size; i++) {
+		data.keys[i] = xstrfmt("refs/heads/topic-%"PRIuMAX, (uintmax_t)i);
+		hashmap_entry_init(&data.entries[i].ent, strhash(data.keys[i]));
+		data.entries[i].key = data.keys[i];
+
+		oidclr(&data.oids[i]);
+		for (j = 0; j < the_hash_algo->rawsz; j++)
+			data.oids[i].hash[j] = next_random(&state) >> 16;
+		oidcpy(&data.oidmap_entries[i].oid, &data.oids[i]);
+
+		data.ints[i] = next_random(&state) >> 1;
+	}
+}
+
+static void run_benchmark(struct benchmark *b, int rounds)
+{
+	uint64_t best_ns = UINT64_MAX;
+	uintmax_t ops = 0, allocs = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		uint64_t start, ns;
+
+		if (b->setup)
+			b->setup();
+		start = getnanotime();
+		start_counting_xallocs();
+		ops = b->run();
+		allocs = stop_counting_xallocs();
+		ns = getnanotime() - start;
+		if (ns < best_ns)
+			best_ns = ns;
+		if (b->teardown)
+			b->teardown();
+	}
+
+	if (!ops)
+		ops = 1;
+	printf("%-16s %12.2f ns/op %12"PRIuMAX" allocs %10.4f allocs/op\n",
+	       b->name, (double)best_ns / ops, allocs, (double)allocs / ops);
+}
+
+static int wanted(const char *name, int argc, const char **argv)
+{
+	int i;
+
+	if (!argc)
+		return 1;
+	for (i = 0; i < argc; i++) {
+		const char *rest;
+
+		if (skip_prefix(name, argv[i], &rest) &&
+		    (!*rest || *rest == '-'))
+			return 1;
+	}
+	return 0;
+}
+
+int cmd__microbench(int argc, const char **argv)
+{
+	int size = 100000, rounds = 5;
+	const char * const usage[] = {
+		"test-tool microbench [--size=<n>] [--rounds=<n>] [<benchmark>...]",
+		NULL
+	};
+	struct option options[] = {
+		OPT_INTEGER(0, "size", &size, "number of items to work on"),
+		OPT_INTEGER(0, "rounds", &rounds, "number of rounds to run"),
+		OPT_END()
+	};
+	int i, nr = 0;
+
+	argc = parse_options(argc, argv, NULL, options, usage, 0);
+	if (size < 1 || rounds < 1)
+		usage_with_options(usage, options);
+
+	for (i = 0; i < argc; i++) {
+		int j, found = 0;
+
+		for (j = 0; j < ARRAY_SIZE(benchmarks); j++)
+			found |= wanted(benchmarks[j].name, 1, &argv[i]);
+		if (!found)
+			die("unknown benchmark '%s'", argv[i]);
+	}
+
+	prepare_inputs(size);
+	printf("size %d, best of %d rounds\n", size, rounds);
+
+	for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		if (!wanted(benchmarks[i].name, argc, argv))
+			continue;
+		run_benchmark(&benchmarks[i], rounds);
+		nr++;
+	}
+	return !nr;
+}
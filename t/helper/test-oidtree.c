@@ -27,6 +27,10 @@ int cmd__oidtree(int argc, const char **argv)
 				die("insert not a hexadecimal oid: %s", arg);
 			algo = oid.algo;
 			oidtree_insert(&ot, &oid);
+		} else if (skip_prefix(line.buf, "remove ", &arg)) {
+			if (get_oid_hex(arg, &oid))
+				die("remove not a hexadecimal oid: %s", arg);
+			oidtree_remove(&ot, &oid);
 		} else if (skip_prefix(line.buf, "contains ", &arg)) {
 			if (get_oid_hex(arg, &oid))
 				die("contains not a hexadecimal oid: %s", arg);
@@ -8,6 +8,34 @@ static int intcmp(const void *va, const void *vb, void *data)
 	return *a - *b;
 }
 
+static void intkey(const void *va, uint64_t *key, void *data)
+{
+	const int *a = va;
+	key[0] = (uint64_t)*a ^ ((uint64_t)1 << 63);
+	key[1] = 0;
+}
+
+/*
+ * Put and get n numbers, two puts for each get, like a walk adding
+ * the parents of each commit it takes out of the queue does.
+ */
+static void perf(struct prio_queue *pq, int n)
+{
+	int *v;
+	int i;
+
+	ALLOC_ARRAY(v, n);
+	for (i = 0; i < n; i++) {
+		v[i] = (int)((i * 2654435761u) >> 8);
+		prio_queue_put(pq, &v[i]);
+		if (i % 2)
+			prio_queue_get(pq);
+	}
+	while (prio_queue_get(pq))
+		; /* drain */
+	free(v);
+}
+
 static void show(int *v)
 {
 	if (!v)
@@ -20,6 +48,7 @@ static void show(int *v)
 int cmd__prio_queue(int argc, const char **argv)
 {
 	struct prio_queue pq = { intcmp };
+	const char *arg;
 
 	while (*++argv) {
 		if (!strcmp(*argv, "get")) {
@@ -39,6 +68,11 @@ int cmd__prio_queue(int argc, const char **argv)
 			}
 		} else if (!strcmp(*argv, "stack")) {
 			pq.compare = NULL;
+		} else if (!strcmp(*argv, "key")) {
+			pq.compare = NULL;
+			pq.key = intkey;
+		} else if (skip_prefix(*argv, "perf:", &arg)) {
+			perf(&pq, atoi(arg));
 		} else {
 			int *v = xmalloc(sizeof(*v));
 			*v = atoi(*argv);
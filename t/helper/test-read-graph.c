@@ -43,6 +43,14 @@ int cmd__read_graph(int argc, const char **argv)
 		printf(" bloom_indexes");
 	if (graph->chunk_bloom_data)
 		printf(" bloom_data");
+	if (graph->chunk_bloom_merge_indexes)
+		printf(" bloom_merge_indexes");
+	if (graph->chunk_bloom_merge_data)
+		printf(" bloom_merge_data");
+	if (graph->chunk_commit_metadata)
+		printf(" metadata");
+	if (graph->chunk_commit_strings)
+		printf(" metadata_strings");
 	printf("\n");
 
 	UNLEAK(graph);
@@ -0,0 +1,74 @@
+#include "test-tool.h"
+#include "cache.h"
+
+#if defined(SHA1_DC) && !defined(DC_SHA1_EXTERNAL) && defined(SHA1DC_UBC_LANES)
+#ifdef DC_SHA1_SUBMODULE
+#include "sha1collisiondetection/lib/ubc_check.h"
+#else
+#include "sha1dc/ubc_check.h"
+#endif
+
+static uint32_t ubc_check_one(const unsigned char *block)
+{
+	uint32_t W[80], dvmask[DVMASKSIZE];
+	int t;
+
+	for (t = 0; t < 16; t++)
+		W[t] = get_be32(block + 4 * t);
+	for (; t < 80; t++) {
+		uint32_t x = W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16];
+		W[t] = (x << 1) | (x >> 31);
+	}
+	ubc_check(W, dvmask);
+	return dvmask[0];
+}
+
+/*
+ * Check the blocks read from stdin with both sha1dc_ubc_check_blocks()
+ * and sha1dc's own ubc_check(), a varying number of them at a time,
+ * and report the blocks that need a closer look.
+ */
+int cmd__sha1dc_ubc(int ac, const char **av)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t i, nr, pos = 0, flagged = 0;
+	int bad = 0;
+
+	if (ac != 1)
+		die("usage: test-tool sha1dc-ubc <blocks");
+	if (strbuf_read(&buf, 0, 0) < 0)
+		die_errno("cannot read stdin");
+	nr = buf.len / 64;
+
+	for (i = 0; pos < nr; i++) {
+		uint32_t dvmask[SHA1DC_UBC_LANES];
+		size_t n = i % SHA1DC_UBC_LANES + 1, j;
+
+		if (n > nr - pos)
+			n = nr - pos;
+		sha1dc_ubc_check_blocks((unsigned char *)buf.buf + 64 * pos,
+					n, dvmask);
+		for (j = 0; j < n; j++, pos++) {
+			uint32_t expect =
+				ubc_check_one((unsigned char *)buf.buf + 64 * pos);
+
+			if (dvmask[j] != expect) {
+				printf("block %"PRIuMAX": %08x, expected %08x\n",
+				       (uintmax_t)pos, dvmask[j], expect);
+				bad = 1;
+			}
+			if (expect)
+				flagged++;
+		}
+	}
+	printf("%"PRIuMAX" of %"PRIuMAX" blocks flagged\n",
+	       (uintmax_t)flagged, (uintmax_t)nr);
+	strbuf_release(&buf);
+	return bad;
+}
+#else
+int cmd__sha1dc_ubc(int ac, const char **av)
+{
+	die("not built with a vectorized sha1dc check");
+}
+#endif
@@ -206,6 +206,145 @@ static int ut_007bug(int argc, const char **argv)
 	BUG("the bug message");
 }
 
+/*
+ * Run TRACE2_TIMER_ID_TEST1 and TRACE2_TIMER_ID_TEST2 over <count>
+ * intervals of <ms_delay> milliseconds each, TEST2 nested twice to
+ * check that only the outermost start and stop count.
+ */
+static void run_timers(int count, int delay)
+{
+	while (count--) {
+		trace2_timer_start(TRACE2_TIMER_ID_TEST1);
+		trace2_timer_start(TRACE2_TIMER_ID_TEST2);
+		trace2_timer_start(TRACE2_TIMER_ID_TEST2);
+		sleep_millisec(delay);
+		trace2_timer_stop(TRACE2_TIMER_ID_TEST2);
+		trace2_timer_stop(TRACE2_TIMER_ID_TEST2);
+		trace2_timer_stop(TRACE2_TIMER_ID_TEST1);
+	}
+}
+
+static int ut_008timer(int argc, const char **argv)
+{
+	const char *usage_error = "expect <count> <ms_delay>";
+	int count, delay;
+
+	if (argc != 2 || get_i(&count, argv[0]) || get_i(&delay, argv[1]))
+		die("%s", usage_error);
+
+	run_timers(count, delay);
+	return 0;
+}
+
+static void run_counters(int count)
+{
+	while (count--) {
+		trace2_counter_add(TRACE2_COUNTER_ID_TEST1, 1);
+		trace2_counter_add(TRACE2_COUNTER_ID_TEST2, 2);
+	}
+}
+
+static int ut_009counter(int argc, const char **argv)
+{
+	const char *usage_error = "expect <count>";
+	int count;
+
+	if (argc != 1 || get_i(&count, argv[0]))
+		die("%s", usage_error);
+
+	run_counters(count);
+	return 0;
+}
+
+struct ut_010_data {
+	int count;
+	int delay;
+};
+
+static void *ut_010_thread_proc(void *_ut_010_data)
+{
+	struct ut_010_data *data = _ut_010_data;
+
+	trace2_thread_start("ut_010");
+	run_timers(data->count, data->delay);
+	run_counters(data->count);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Run the timers and counters of 008timer and 009counter on
+ * <threads> threads.
+ */
+static int ut_010threads(int argc, const char **argv)
+{
+	const char *usage_error = "expect <count> <ms_delay> <threads>";
+	struct ut_010_data data;
+	pthread_t *pids;
+	int nr_threads, k;
+
+	if (argc != 3 || get_i(&data.count, argv[0]) ||
+	    get_i(&data.delay, argv[1]) || get_i(&nr_threads, argv[2]) ||
+	    nr_threads < 1)
+		die("%s", usage_error);
+
+	CALLOC_ARRAY(pids, nr_threads);
+	for (k = 0; k < nr_threads; k++)
+		if (pthread_create(&pids[k], NULL, ut_010_thread_proc, &data))
+			die("failed to create thread[%d]", k);
+	for (k = 0; k < nr_threads; k++)
+		pthread_join(pids[k], NULL);
+	free(pids);
+	return 0;
+}
+
+/*
+ * Burn <ms_cpu> milliseconds of CPU time in a region nested in
+ * another one, so that the profile target has something to sample.
+ */
+static void run_spin(int ms_cpu)
+{
+	clock_t end = clock() + (clock_t)ms_cpu * CLOCKS_PER_SEC / 1000;
+	volatile unsigned long spin = 0;
+
+	trace2_region_enter("test", "outer", the_repository);
+	trace2_region_enter("test", "spin", the_repository);
+	while (clock() < end)
+		spin++;
+	trace2_region_leave("test", "spin", the_repository);
+	trace2_region_leave("test", "outer", the_repository);
+}
+
+static void *ut_011_thread_proc(void *_ms_cpu)
+{
+	trace2_thread_start("ut_011");
+	run_spin(*(int *)_ms_cpu);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Spin on the main thread, or on a new thread if <thread> is set.
+ */
+static int ut_011spin(int argc, const char **argv)
+{
+	const char *usage_error = "expect <ms_cpu> <thread>";
+	int ms_cpu, thread;
+	pthread_t pid;
+
+	if (argc != 2 || get_i(&ms_cpu, argv[0]) || get_i(&thread, argv[1]))
+		die("%s", usage_error);
+
+	if (!thread) {
+		run_spin(ms_cpu);
+		return 0;
+	}
+	if (pthread_create(&pid, NULL, ut_011_thread_proc, &ms_cpu))
+		die("failed to create thread");
+	pthread_join(pid, NULL);
+	return 0;
+}
+
 /*
  * Usage:
  *     test-tool trace2 <ut_name_1> <ut_usage_1>
@@ -223,6 +362,10 @@ static struct unit_test ut_table[] = {
 	{ ut_005exec,     "005exec",   "<git_command_args>" },
 	{ ut_006data,     "006data",   "[<category> <key> <value>]+" },
 	{ ut_007bug,      "007bug",    "" },
+	{ ut_008timer,    "008timer",  "<count> <ms_delay>" },
+	{ ut_009counter,  "009counter", "<count>" },
+	{ ut_010threads,  "010threads", "<count> <ms_delay> <threads>" },
+	{ ut_011spin,     "011spin",   "<ms_cpu> <thread>" },
 };
 /* clang-format on */
 
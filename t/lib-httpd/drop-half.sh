@@ -0,0 +1,30 @@
+#!/bin/sh
+
+# Serve a file from the document root like a plain static file, except
+# that a response with the whole file is cut off halfway through, as if
+# the connection dropped.  Requests for the rest of it (with a "Range:
+# bytes=<start>-" header) are answered in full.
+
+file="$DOCUMENT_ROOT$PATH_INFO"
+size=$(wc -c <"$file")
+
+case "$HTTP_RANGE" in
+bytes=*-)
+	start=${HTTP_RANGE#bytes=}
+	start=${start%-}
+	printf "Status: 206 Partial Content\r\n"
+	printf "Content-Type: application/octet-stream\r\n"
+	printf "Content-Range: bytes %d-%d/%d\r\n" $start $(($size - 1)) $size
+	printf "Content-Length: %d\r\n" $(($size - $start))
+	printf "\r\n"
+	perl -e 'binmode STDOUT; open(F, "<", $ARGV[0]) or die; binmode F;
+		 seek(F, $ARGV[1], 0); local $/; print <F>' "$file" $start
+	;;
+*)
+	printf "Content-Type: application/octet-stream\r\n"
+	printf "Content-Length: %d\r\n" $size
+	printf "\r\n"
+	perl -e 'binmode STDOUT; open(F, "<", $ARGV[0]) or die; binmode F;
+		 read(F, my $buf, $ARGV[1]); print $buf' "$file" $(($size / 2))
+	;;
+esac
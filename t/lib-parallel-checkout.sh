@@ -13,7 +13,8 @@ set_checkout_config () {
 	test_config_global checkout.thresholdForParallelism $2
 }
 
-# Run "${@:2}" and check that $1 checkout workers were used
+# Run "${@:2}" and check that $1 checkout workers were used, be they
+# checkout--worker processes or threads
 test_checkout_workers () {
 	if test $# -lt 2
 	then
@@ -25,9 +26,11 @@ test_checkout_workers () {
 
 	local trace_file=trace-test-checkout-workers &&
 	rm -f "$trace_file" &&
-	GIT_TRACE2="$(pwd)/$trace_file" "$@" 2>&8 &&
+	GIT_TRACE2_EVENT="$(pwd)/$trace_file" "$@" 2>&8 &&
 
-	local workers="$(grep "child_start\[..*\] git checkout--worker" "$trace_file" | wc -l)" &&
+	local workers="$(grep -e "\"event\":\"child_start\".*\"argv\":\\[\"git\",\"checkout--worker\"" \
+			      -e "\"event\":\"thread_start\".*\"thread\":\"th[0-9]*:checkout_worker\"" \
+			      "$trace_file" | wc -l)" &&
 	test $workers -eq $expected_workers &&
 	rm "$trace_file"
 } 8>&2 2>&4
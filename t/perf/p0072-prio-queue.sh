@@ -0,0 +1,24 @@
+#!/bin/sh
+
+test_description='Tests the performance of the priority queue'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_perf 'prio_queue with a comparison function' '
+	test-tool prio-queue perf:1000000
+'
+
+test_perf 'prio_queue with sort keys' '
+	test-tool prio-queue key perf:1000000
+'
+
+test_perf 'rev-list --topo-order' '
+	git rev-list --topo-order HEAD >/dev/null
+'
+
+test_perf 'merge-base --all' '
+	git merge-base --all HEAD HEAD~1000 >/dev/null
+'
+
+test_done
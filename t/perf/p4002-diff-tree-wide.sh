@@ -0,0 +1,30 @@
+#!/bin/sh
+
+test_description='Tests the performance of diffing wide trees
+
+A flat directory with many entries, of which only a few differ between
+the two sides, is what a vendored directory looks like after a small
+update.
+'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup wide trees' '
+	blob=$(echo content | git hash-object -w --stdin) &&
+	other=$(echo other | git hash-object -w --stdin) &&
+	test_seq 100000 | sed "s/.*/100644 blob $blob	file&/" >entries &&
+	git mktree <entries >tree1 &&
+	sed -e "s/$blob	file50000\$/$other	file50000/" \
+	    -e "s/$blob	file99999\$/$other	file99999/" <entries |
+	git mktree >tree2
+'
+
+test_perf 'diff-tree with a few changes in a wide tree' '
+	for i in $(test_seq 20)
+	do
+		git diff-tree $(cat tree1) $(cat tree2) >/dev/null || return 1
+	done
+'
+
+test_done
@@ -0,0 +1,203 @@
+#!/bin/sh
+
+test_description='performance of a server under many concurrent clients
+
+Each test drives the same protocol v2 request from several clients at
+once against the test repository, and reports the wall-clock time of
+the whole batch, the throughput and the tail latency of the individual
+requests.  The requests are fed straight to "git upload-pack
+--stateless-rpc" the way a smart HTTP server would, so that the numbers
+are those of the server side alone; pushes go through "git push" to a
+local receive-pack.
+
+The number of concurrent clients and of requests each of them makes
+in a batch can be set with GIT_PERF_5552_CLIENTS (default 8) and
+GIT_PERF_5552_REQUESTS (default 4).  Pushes update
+GIT_PERF_5552_PUSH_REFS (default 1000) refs each.
+'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+GIT_PERF_5552_CLIENTS=${GIT_PERF_5552_CLIENTS:-8}
+GIT_PERF_5552_REQUESTS=${GIT_PERF_5552_REQUESTS:-4}
+GIT_PERF_5552_PUSH_REFS=${GIT_PERF_5552_PUSH_REFS:-1000}
+export GIT_PERF_5552_CLIENTS GIT_PERF_5552_REQUESTS GIT_PERF_5552_PUSH_REFS
+
+test_expect_success 'set up server repository' '
+	git config pack.writebitmaps true &&
+	git config uploadpack.allowfilter true &&
+	git repack -adb &&
+	git update-ref refs/perf/base HEAD
+'
+
+test_expect_success 'set up client driver' '
+	# run-clients <name> <command>: run <command> $GIT_PERF_5552_REQUESTS
+	# times in a row in each of $GIT_PERF_5552_CLIENTS parallel clients,
+	# recording the latency of each request in <name>.<client> and the
+	# wall-clock time of the whole batch in <name>.wall.  <command> sees
+	# its client and request numbers as $CLIENT and $REQUEST.
+	write_script run-clients "$PERL_PATH" <<-\EOF &&
+	use strict;
+	use Time::HiRes qw(time);
+
+	my ($name, $cmd) = @ARGV;
+	my $clients = $ENV{GIT_PERF_5552_CLIENTS};
+	my $requests = $ENV{GIT_PERF_5552_REQUESTS};
+	my $start = time;
+	my @pids;
+
+	for my $client (1..$clients) {
+		my $pid = fork;
+		die "fork failed: $!" unless defined $pid;
+		if (!$pid) {
+			open(my $fh, ">", "$name.$client") or die;
+			for my $request (1..$requests) {
+				$ENV{CLIENT} = $client;
+				$ENV{REQUEST} = $request;
+				my $t = time;
+				system($cmd) == 0 or exit 1;
+				printf $fh "%.3f\n", (time - $t) * 1000;
+			}
+			exit 0;
+		}
+		push @pids, $pid;
+	}
+
+	my $ok = 1;
+	for my $pid (@pids) {
+		waitpid($pid, 0);
+		$ok = 0 if $?;
+	}
+	open(my $fh, ">", "$name.wall") or die;
+	printf $fh "%.6f\n", time - $start;
+	exit($ok ? 0 : 1);
+	EOF
+
+	# latency <name> <percentile>: print the given percentile (nearest
+	# rank) of the request latencies, in milliseconds
+	write_script latency "$PERL_PATH" <<-\EOF &&
+	my ($name, $p) = @ARGV;
+	my @l = sort { $a <=> $b } map { chomp; $_ } `cat $name.[0-9]*`;
+	my $i = int(($p * @l + 99) / 100) - 1;
+	printf "%.0f\n", $l[$i < 0 ? 0 : $i];
+	EOF
+
+	# throughput <name>: print the requests per second of the batch
+	write_script throughput "$PERL_PATH" <<-\EOF
+	my ($name) = @ARGV;
+	my $n = () = `cat $name.[0-9]*`;
+	my $wall = `cat $name.wall`;
+	printf "%.0f\n", $wall > 0 ? $n / $wall : 0;
+	EOF
+'
+
+test_expect_success 'set up requests' '
+	format=$(git rev-parse --show-object-format) &&
+	head=$(git rev-parse HEAD) &&
+	old=$(git rev-list --first-parent --skip=50 -1 HEAD) &&
+	if test -z "$old"
+	then
+		old=$(git rev-list --max-parents=0 -1 HEAD)
+	fi &&
+
+	test-tool pkt-line pack >ls-refs.req <<-EOF &&
+	command=ls-refs
+	object-format=$format
+	0001
+	peel
+	symrefs
+	ref-prefix HEAD
+	ref-prefix refs/heads/
+	ref-prefix refs/tags/
+	0000
+	EOF
+
+	test-tool pkt-line pack >clone.req <<-EOF &&
+	command=fetch
+	object-format=$format
+	0001
+	thin-pack
+	ofs-delta
+	want $head
+	done
+	0000
+	EOF
+
+	test-tool pkt-line pack >fetch.req <<-EOF &&
+	command=fetch
+	object-format=$format
+	0001
+	thin-pack
+	ofs-delta
+	want $head
+	have $old
+	done
+	0000
+	EOF
+
+	test-tool pkt-line pack >partial-clone.req <<-EOF
+	command=fetch
+	object-format=$format
+	0001
+	thin-pack
+	ofs-delta
+	filter blob:none
+	want $head
+	done
+	0000
+	EOF
+'
+
+test_expect_success 'set up pushing clients' '
+	git clone --bare --shared . pusher.git &&
+	git -C pusher.git rev-list --first-parent -n 2 HEAD >tips &&
+	# two sets of refs at different commits, so that every push
+	# has all of its refs to update
+	for set in 0 1
+	do
+		tip=$(sed -n "$(($set + 1))p" tips) &&
+		test_seq $GIT_PERF_5552_PUSH_REFS |
+		sed "s,.*,create refs/perf-src/$set/ref-& $tip," |
+		git -C pusher.git update-ref --stdin || return 1
+	done
+'
+
+for request in ls-refs clone fetch partial-clone
+do
+	test_perf "$request ($GIT_PERF_5552_CLIENTS clients)" "
+		GIT_PROTOCOL=version=2 ./run-clients $request \
+			'git upload-pack --stateless-rpc . <$request.req >/dev/null'
+	"
+
+	test_size "$request throughput (requests/s)" "
+		./throughput $request
+	"
+
+	test_size "$request p50 latency (ms)" "
+		./latency $request 50
+	"
+
+	test_size "$request p99 latency (ms)" "
+		./latency $request 99
+	"
+done
+
+test_perf "push $GIT_PERF_5552_PUSH_REFS refs ($GIT_PERF_5552_CLIENTS clients)" '
+	./run-clients push "git -C pusher.git push -q --force .. \
+		\"refs/perf-src/\$((\$REQUEST % 2))/*:refs/perf/\$CLIENT/*\""
+'
+
+test_size "push throughput (requests/s)" '
+	./throughput push
+'
+
+test_size "push p50 latency (ms)" '
+	./latency push 50
+'
+
+test_size "push p99 latency (ms)" '
+	./latency push 99
+'
+
+test_done
@@ -342,6 +342,38 @@ test_expect_success 'query binary macro directly' '
 	test_cmp expect actual
 '
 
+test_expect_success 'patterns by extension keep their order' '
+	test_when_finished "rm -f .gitattributes" &&
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16
+	do
+		echo "*.ext$i test=ext$i" || return 1
+	done >.gitattributes &&
+	cat >>.gitattributes <<-\EOF &&
+	*.c test=c
+	*.tar.gz test=tar
+	*gz test=gz
+	*.gz test=dotgz
+	*.x test=x
+	x/*.x test=in-x
+	*. test=dot
+	*.C test=upper
+	EOF
+	attr_check file.ext3 ext3 &&
+	attr_check x/file.ext16 ext16 &&
+	attr_check file.c c &&
+	attr_check file.C upper &&
+	attr_check file.tar.gz dotgz &&
+	attr_check file.tgz gz &&
+	attr_check x/file.x in-x &&
+	attr_check y/file.x x &&
+	attr_check file. dot &&
+	attr_check file unspecified &&
+	attr_check .c c &&
+	attr_check file.c upper "-c core.ignorecase=1" &&
+	attr_check file.Ext3 ext3 "-c core.ignorecase=1" &&
+	attr_check file.Ext3 unspecified
+'
+
 test_expect_success SYMLINKS 'set up symlink tests' '
 	echo "* test" >attr &&
 	rm -f .gitattributes
@@ -899,4 +899,70 @@ test_expect_success SYMLINKS 'symlinks not respected in-tree' '
 	test_i18ngrep "unable to access.*gitignore" err
 '
 
+test_expect_success 'many patterns without wildcards' '
+	test_create_repo many-patterns &&
+	(
+		cd many-patterns &&
+		test_seq 1 40 | sed "s/^/lit/" >.gitignore &&
+		cat >>.gitignore <<-\EOF &&
+		sub/deep
+		/top
+		dir/
+		!lit7
+		*.tmp
+		!keep.tmp
+		lit9.tmp
+		lit3
+		!sub/deep
+		a/b/c
+		!lit12
+		lit12
+		/sub/lit5
+		EOF
+		mkdir dir sub &&
+		cat >paths <<-\EOF &&
+		lit1
+		lit7
+		sub/lit7
+		lit12
+		sub/deep
+		x/sub/deep
+		top
+		sub/top
+		dir
+		sub/dir
+		foo.tmp
+		keep.tmp
+		lit9.tmp
+		a/b/c
+		x/a/b/c
+		sub/lit5
+		lit5
+		nothing
+		EOF
+		cat >expect <<-\EOF &&
+		.gitignore:1:lit1	lit1
+		.gitignore:44:!lit7	lit7
+		.gitignore:44:!lit7	sub/lit7
+		.gitignore:52:lit12	lit12
+		.gitignore:49:!sub/deep	sub/deep
+		::	x/sub/deep
+		.gitignore:42:/top	top
+		::	sub/top
+		.gitignore:43:dir/	dir
+		::	sub/dir
+		.gitignore:45:*.tmp	foo.tmp
+		.gitignore:46:!keep.tmp	keep.tmp
+		.gitignore:47:lit9.tmp	lit9.tmp
+		.gitignore:50:a/b/c	a/b/c
+		::	x/a/b/c
+		.gitignore:53:/sub/lit5	sub/lit5
+		.gitignore:5:lit5	lit5
+		::	nothing
+		EOF
+		git check-ignore -v -n --no-index --stdin <paths >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -61,4 +61,38 @@ test_expect_success 'stack order' '
 	test_cmp expect actual
 '
 
+cat >expect <<'EOF'
+-5
+1
+2
+3
+4
+5
+5
+6
+7
+8
+9
+10
+EOF
+test_expect_success 'ordering by key' '
+	test-tool prio-queue key 2 6 3 10 9 5 7 -5 4 5 8 1 dump >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'interleaved gets by key' '
+	test-tool prio-queue 6 2 4 get 5 3 get get 1 dump >expect &&
+	test-tool prio-queue key 6 2 4 get 5 3 get get 1 dump >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'many entries come out in order' '
+	test_seq 200 | awk "{ print (\$1 * 37) % 101 }" >input &&
+	sort -n input >expect &&
+	test-tool prio-queue $(cat input) dump >actual &&
+	test_cmp expect actual &&
+	test-tool prio-queue key $(cat input) dump >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -242,6 +242,54 @@ test_expect_success 'grow / shrink' '
 
 '
 
+test_expect_success 'grow incrementally' '
+	rm -f in expect &&
+	for n in $(test_seq 52)
+	do
+		echo put key$n value$n >>in &&
+		echo NULL >>expect || return 1
+	done &&
+	echo size >>in &&
+	echo 256 52 >>expect &&
+	for n in $(test_seq 52)
+	do
+		echo get key$n >>in &&
+		echo value$n >>expect || return 1
+	done &&
+	cat >>in <<-\EOF &&
+	add key7 value7b
+	get key7
+	put key9 value9b
+	remove key11
+	get key11
+	size
+	EOF
+	cat >>expect <<-\EOF &&
+	value7b
+	value7
+	value9
+	value11
+	NULL
+	256 52
+	EOF
+	test-tool hashmap incremental <in >out &&
+	test_cmp expect out &&
+
+	echo iterate >>in &&
+	test-tool hashmap incremental <in >out &&
+	grep "^key" out | sort >actual &&
+	for n in $(test_seq 52)
+	do
+		case $n in
+		7) echo key7 value7 && echo key7 value7b ;;
+		9) echo key9 value9b ;;
+		11) ;;
+		*) echo key$n value$n ;;
+		esac || return 1
+	done | sort >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success 'string interning' '
 
 test_hashmap "intern value1
@@ -16,4 +16,13 @@ test_expect_success 'test-sha1 detects shattered pdf' '
 	grep 38762cf7f55934b34d179ae6a4c80cadccbb7f0a err
 '
 
+test_lazy_prereq SHA1DC_UBC '
+	test-tool sha1dc-ubc </dev/null
+'
+
+test_expect_success SHA1DC_UBC 'vectorized bit condition checks match sha1dc' '
+	test-tool genrandom ubc 32000000 | test-tool sha1dc-ubc >out &&
+	grep "of 500000 blocks flagged" out
+'
+
 test_done
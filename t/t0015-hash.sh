@@ -52,4 +52,34 @@ test_expect_success 'test basic SHA-256 hash values' '
 	grep 6ef19b41225c5369f1c104d45d8d85efa9b057b53b14b4b9b939dd74decc5321 actual
 '
 
+test_expect_success 'hashing objects in a batch' '
+	# sizes around the block and padding boundaries, plus a few
+	# larger ones so that the lanes finish at different times
+	for size in 0 1 40 47 48 49 55 56 57 63 64 65 111 112 113 128 \
+		    1000 4095 70000 100000
+	do
+		test-tool genrandom $size $size >file-$size || return 1
+	done &&
+	files=$(ls file-*) &&
+	for algo in sha1 sha256
+	do
+		test-tool hash-batch --one-by-one $algo $files >expect &&
+		test-tool hash-batch $algo $files >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	printf abc >abc &&
+	test-tool hash-batch sha256 abc abc >actual &&
+	grep c1cf6e465077930e88dc5136641d402f72a229ddd996f627d60e9639eaba35a6 actual
+'
+
+test_expect_success 'SHA instructions give the same hashes' '
+	test-tool genrandom accel 1000000 >accel &&
+	for algo in sha1 sha256
+	do
+		GIT_TEST_HASH_ACCEL=false test-tool $algo <accel >expect &&
+		test-tool $algo <accel >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+test_description='test-tool microbench runs every benchmark'
+
+. ./test-lib.sh
+
+test_expect_success 'all benchmarks run on small inputs' '
+	test-tool microbench --size=100 --rounds=1 >out &&
+	sed -n "s/ .*//p" out >actual &&
+	cat >expect <<-\EOF &&
+	size
+	hashmap-add
+	hashmap-get
+	strmap-put
+	strmap-get
+	oidset-insert
+	oidset-contains
+	oidmap-put
+	oidmap-get
+	prio-queue
+	mem-pool
+	ewah-compress
+	ewah-iterate
+	delta-create
+	delta-apply
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'benchmarks can be selected by prefix' '
+	test-tool microbench --size=100 --rounds=1 strmap delta-apply >out &&
+	grep "^strmap-put .* 10[0-9] allocs " out &&
+	grep "^strmap-get .* 0 allocs " out &&
+	grep "^delta-apply " out &&
+	test_line_count = 4 out &&
+	test_must_fail test-tool microbench nonexistent
+'
+
+test_done
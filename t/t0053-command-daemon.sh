@@ -0,0 +1,107 @@
+#!/bin/sh
+
+test_description='git command--daemon'
+
+. ./test-lib.sh
+
+test-tool simple-ipc SUPPORTS_SIMPLE_IPC || {
+	skip_all='simple IPC not supported on this platform'
+	test_done
+}
+
+if test_have_prereq MINGW
+then
+	skip_all='command--daemon is not supported on Windows'
+	test_done
+fi
+
+stop_daemon () {
+	test_might_fail git command--daemon stop
+}
+
+test_expect_success 'exec without a daemon runs the command' '
+	test_commit one &&
+	mkdir sub &&
+	echo content >sub/file &&
+	git add sub &&
+	git commit -m two &&
+	test_must_fail git command--daemon status &&
+	git rev-parse HEAD >expect &&
+	git command--daemon exec rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'start and stop the daemon' '
+	git command--daemon start &&
+	git command--daemon status &&
+	git command--daemon stop &&
+	test_must_fail git command--daemon status
+'
+
+test_expect_success 'exec runs commands through the daemon' '
+	test_atexit stop_daemon &&
+	git command--daemon start &&
+	for cmd in "rev-parse HEAD HEAD^{tree}" "cat-file -p HEAD:sub/file" \
+		"for-each-ref" "config --get-regexp core" "log --oneline"
+	do
+		git $cmd >expect &&
+		git command--daemon exec $cmd >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	git command--daemon status
+'
+
+test_expect_success 'exec runs commands from the current directory' '
+	(
+		cd sub &&
+		git rev-parse --show-prefix --show-toplevel >expect &&
+		git command--daemon exec rev-parse --show-prefix --show-toplevel >actual &&
+		test_cmp expect actual &&
+		git ls-files >expect &&
+		git command--daemon exec ls-files >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'exec honors the environment of the client' '
+	test_when_finished "rm -f tmp-index new-file" &&
+	cp .git/index tmp-index &&
+	echo new >new-file &&
+	GIT_INDEX_FILE=tmp-index git add new-file &&
+	GIT_INDEX_FILE=tmp-index git ls-files >expect &&
+	GIT_INDEX_FILE=tmp-index git command--daemon exec ls-files >actual &&
+	test_cmp expect actual &&
+	git ls-files >expect &&
+	git command--daemon exec ls-files >actual &&
+	test_cmp expect actual &&
+	echo from-client >expect &&
+	git -c test.value=from-client command--daemon exec config test.value >actual &&
+	test_cmp expect actual &&
+	GIT_AUTHOR_NAME=Someone git command--daemon exec var GIT_AUTHOR_IDENT >actual &&
+	grep "^Someone <" actual &&
+	git command--daemon status
+'
+
+test_expect_success 'exec relays errors and exit codes' '
+	test_expect_code 128 git command--daemon exec cat-file -p nosuch 2>err &&
+	test_i18ngrep "Not a valid object name nosuch" err &&
+	test_expect_code 1 git command--daemon exec config no.such.key &&
+	git command--daemon status
+'
+
+test_expect_success 'the daemon steps down when the configuration changes' '
+	git config test.value 1 &&
+	git command--daemon exec config test.value >actual &&
+	echo 1 >expect &&
+	test_cmp expect actual &&
+	for i in $(test_seq 1 100)
+	do
+		git command--daemon status >/dev/null || break
+		sleep 0.1
+	done &&
+	test_must_fail git command--daemon status &&
+	git command--daemon exec config test.value >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -62,6 +62,23 @@ test_expect_success !MINGW 'run_command can run a script without a #! line' '
 	test_must_be_empty err
 '
 
+test_expect_success !MINGW 'fork() and posix_spawn() run commands alike' '
+	cat >hello <<-\EOF &&
+	cat hello-script
+	EOF
+	chmod +x hello &&
+	for no_spawn in false true
+	do
+		GIT_TEST_NO_POSIX_SPAWN=$no_spawn \
+			test-tool run-command run-command ./hello >actual 2>err &&
+		test_cmp hello-script actual &&
+		test_must_be_empty err &&
+		GIT_TEST_NO_POSIX_SPAWN=$no_spawn \
+			test-tool run-command start-command-ENOENT ./does-not-exist 2>err &&
+		test_i18ngrep "\./does-not-exist" err || return 1
+	done
+'
+
 test_expect_success 'run_command does not try to execute a directory' '
 	test_when_finished "rm -rf bin1 bin2" &&
 	mkdir -p bin1/greet bin2 &&
@@ -46,4 +46,28 @@ test_expect_success 'oidtree each' '
 	test_cmp expect actual
 '
 
+test_expect_success 'oidtree remove' '
+	cat >expect <<-\EOF &&
+		0
+		1
+		0
+	EOF
+	{
+		echoid insert 444 1 2 3 &&
+		echoid remove 444 5 &&
+		echoid contains 444 1 5 &&
+		echo clear
+	} | test-tool oidtree >actual &&
+	test_cmp expect actual &&
+	echoid "" 2 3 >expect &&
+	{
+		echoid insert 1 2 3 &&
+		echoid remove 1 &&
+		echo each 10 &&
+		echo each 20 &&
+		echo each 30
+	} | test-tool oidtree >actual &&
+	test_cmp expect actual
+'
+
 test_done
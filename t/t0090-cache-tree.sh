@@ -276,4 +276,51 @@ test_expect_success 'switching trees does not invalidate shared index' '
 	)
 '
 
+
+test_expect_success 'cache-tree is the same when computed by several threads' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in 1 2 3 4 5 6
+		do
+			for j in a b c
+			do
+				mkdir -p d$i/$j/sub &&
+				echo $i$j >d$i/$j/file &&
+				echo $i$j >d$i/$j/sub/file || return 1
+			done
+		done &&
+		echo top >top &&
+		git add . &&
+		git -c index.threads=1 write-tree >expect &&
+		test-tool scrap-cache-tree &&
+		git -c index.threads=4 write-tree >actual &&
+		test_cmp expect actual &&
+		test-tool dump-cache-tree >dump &&
+		! grep invalid dump &&
+
+		echo changed >d3/b/sub/file &&
+		echo changed >d5/c/file &&
+		git add . &&
+		git -c index.threads=4 write-tree >actual &&
+		test-tool scrap-cache-tree &&
+		git -c index.threads=1 write-tree >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'threaded cache-tree reports the first invalid object' '
+	(
+		cd threads &&
+		for i in 2 4
+		do
+			git update-index --add --cacheinfo \
+				100644,$(test_oid deadbeef),d$i/a/sub/missing || return 1
+		done &&
+		test_must_fail git -c index.threads=4 write-tree 2>err &&
+		grep "invalid object .* for .d2/a/sub/missing." err &&
+		! grep d4/a/sub/missing err
+	)
+'
+
 test_done
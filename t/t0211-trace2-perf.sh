@@ -171,4 +171,13 @@ test_expect_success 'using global config, perf stream, return code 0' '
 	test_cmp expect actual
 '
 
+test_expect_success 'timer and counter events' '
+	test_when_finished "rm trace.perf" &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" test-tool trace2 008timer 2 1 &&
+	grep "| timer .*| test .*| name:test1 intervals:2 total:" trace.perf &&
+	grep "| th_timer .*| test .*| name:test2 intervals:2 total:" trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" test-tool trace2 009counter 3 &&
+	grep "| counter .*| test .*| name:test1 value:3\$" trace.perf
+'
+
 test_done
@@ -321,4 +321,58 @@ test_expect_success 'discard traces when there are too many files' '
 	head -n2 trace_target_dir/git-trace2-discard | tail -n1 | grep \"event\":\"too_many_files\"
 '
 
+test_expect_success 'timer events' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" test-tool trace2 008timer 3 1 &&
+	grep "\"event\":\"timer\".*\"name\":\"test1\",\"intervals\":3," trace.event &&
+	grep "\"event\":\"timer\".*\"name\":\"test2\",\"intervals\":3," trace.event &&
+	grep "\"event\":\"th_timer\".*\"name\":\"test2\",\"intervals\":3," trace.event &&
+	! grep "\"event\":\"th_timer\".*\"name\":\"test1\"" trace.event
+'
+
+test_expect_success 'counter events' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" test-tool trace2 009counter 5 &&
+	grep "\"event\":\"counter\".*\"name\":\"test1\",\"count\":5}" trace.event &&
+	grep "\"event\":\"counter\".*\"name\":\"test2\",\"count\":10}" trace.event
+'
+
+test_expect_success 'timers and counters are summed over threads' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" test-tool trace2 010threads 2 1 3 &&
+	grep "\"event\":\"th_timer\".*\"name\":\"test2\",\"intervals\":2," trace.event >th_timers &&
+	test_line_count = 3 th_timers &&
+	grep "\"event\":\"th_counter\".*\"name\":\"test2\",\"count\":4}" trace.event >th_counters &&
+	test_line_count = 3 th_counters &&
+	grep "\"event\":\"timer\".*\"name\":\"test1\",\"intervals\":6," trace.event &&
+	grep "\"event\":\"counter\".*\"name\":\"test1\",\"count\":6}" trace.event &&
+	grep "\"event\":\"counter\".*\"name\":\"test2\",\"count\":12}" trace.event
+'
+
+test_expect_success 'memory usage is reported at exit' '
+	test_when_finished "rm trace.event" &&
+	test_seq 1000 >memory.t &&
+	git add memory.t &&
+	git commit -m base &&
+	test_seq 1001 >memory.t &&
+	git commit -a -m delta &&
+	git repack -adf &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git cat-file --batch-all-objects --batch >/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git rev-list --topo-order --all &&
+	grep "\"category\":\"memory\",\"key\":\"delta_base_cache\",\"value\":{\"peak_bytes\":[1-9]" trace.event &&
+	grep "\"category\":\"memory\",\"key\":\"objects\",\"value\":{\"peak_bytes\":[1-9]" trace.event &&
+	grep "\"category\":\"memory\",\"key\":\"commit_slab\",\"value\":{\"peak_bytes\":[1-9]" trace.event
+'
+
+test_lazy_prereq PROCINFO_LINUX '
+	test "$(uname -s)" = Linux
+'
+
+test_expect_success PROCINFO_LINUX 'peak RSS is reported at exit' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git rev-list --all &&
+	grep "\"key\":\"linux/memory\",\"value\":{\"peak_rss_bytes\":[1-9]" trace.event
+'
+
 test_done
@@ -0,0 +1,62 @@
+#!/bin/sh
+
+test_description='test trace2 facility (profile target)'
+. ./test-lib.sh
+
+# Turn off any inherited trace2 settings for this test.
+sane_unset GIT_TRACE2 GIT_TRACE2_PERF GIT_TRACE2_EVENT
+sane_unset GIT_TRACE2_PROFILE GIT_TRACE2_PROFILE_FREQUENCY
+sane_unset GIT_TRACE2_CONFIG_PARAMS
+
+# The profile target needs setitimer(ITIMER_PROF).
+if test_have_prereq MINGW
+then
+	skip_all='skipping profile target tests; no profiling timer'
+	test_done
+fi
+
+# Every line is "git <command>;<frame>;... <samples>".
+check_folded () {
+	! grep -v "^git [^;]*\(;[^ ;][^ ;]*\)* [1-9][0-9]*$" "$1"
+}
+
+test_expect_success 'samples are counted against the innermost region' '
+	test_when_finished "rm -f trace.profile" &&
+	GIT_TRACE2_PROFILE="$(pwd)/trace.profile" \
+	GIT_TRACE2_PROFILE_FREQUENCY=1000 \
+		test-tool trace2 011spin 200 0 &&
+	check_folded trace.profile &&
+	grep "^git trace2;main;test:outer;test:spin [0-9]*$" trace.profile
+'
+
+test_expect_success 'threads get stacks of their own' '
+	test_when_finished "rm -f trace.profile" &&
+	GIT_TRACE2_PROFILE="$(pwd)/trace.profile" \
+	GIT_TRACE2_PROFILE_FREQUENCY=1000 \
+		test-tool trace2 011spin 200 1 &&
+	check_folded trace.profile &&
+	grep "^git trace2;ut_011;test:outer;test:spin [0-9]*$" trace.profile &&
+	! grep ";main;test:spin" trace.profile
+'
+
+test_expect_success 'processes append to the same file' '
+	test_when_finished "rm -f trace.profile" &&
+	GIT_TRACE2_PROFILE="$(pwd)/trace.profile" \
+	GIT_TRACE2_PROFILE_FREQUENCY=1000 \
+		test-tool trace2 011spin 100 0 &&
+	GIT_TRACE2_PROFILE="$(pwd)/trace.profile" \
+	GIT_TRACE2_PROFILE_FREQUENCY=1000 \
+		test-tool trace2 011spin 100 0 &&
+	grep ";test:spin " trace.profile >spin &&
+	test_line_count = 2 spin
+'
+
+test_expect_success 'trace2.profileTarget from the global config' '
+	test_when_finished "rm -f trace.profile" &&
+	test_config_global trace2.profileTarget "$(pwd)/trace.profile" &&
+	test_config_global trace2.profileFrequency 1000 &&
+	test-tool trace2 011spin 200 0 &&
+	grep ";test:spin " trace.profile
+'
+
+test_done
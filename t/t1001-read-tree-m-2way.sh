@@ -414,4 +414,58 @@ test_expect_success '-m references the correct modified tree' '
 	test_cmp expect actual
 '
 
+test_expect_success 'subtrees read ahead on threads give the same result' '
+	test_when_finished "git reset --hard initial-mod" &&
+	mkdir -p dir1/sub dir2 dir3 dir4 dir5 &&
+	for d in dir1/sub dir2 dir3 dir4 dir5
+	do
+		echo one >$d/file && echo two >$d/other || return 1
+	done &&
+	git add dir1 dir2 dir3 dir4 dir5 &&
+	git commit -m "many directories" &&
+	git rm -r -q dir3 &&
+	echo changed >dir1/sub/file &&
+	echo new >dir4/new &&
+	git add dir1 dir4 &&
+	git commit -m "change some" &&
+	rm -f .git/index &&
+	read_tree_must_succeed -m HEAD^ HEAD &&
+	git ls-files -s >expect &&
+	rm -f .git/index &&
+	GIT_TEST_UNPACK_TREES_THREADS=2 GIT_TRACE2_EVENT_NESTING=10 \
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git read-tree -m HEAD^ HEAD &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	grep "prefetch/threads" trace.event
+'
+
+test_expect_success 'switching keeps unchanged subtrees of the index' '
+	test_when_finished "git reset --hard initial-mod" &&
+	mkdir -p same/deeper staged changed &&
+	echo one >same/file &&
+	echo two >same/deeper/file &&
+	echo three >staged/file &&
+	echo four >changed/file &&
+	git add same staged changed &&
+	git commit -m "before" &&
+	git branch before &&
+	echo five >changed/file &&
+	git commit -a -m "after" &&
+	echo local >same/deeper/file &&
+	echo staged >staged/file &&
+	git add staged/file &&
+	git checkout before &&
+	echo local >expect &&
+	test_cmp expect same/deeper/file &&
+	git diff --cached --name-only >actual &&
+	echo staged/file >expect &&
+	test_cmp expect actual &&
+	echo four >expect &&
+	test_cmp expect changed/file &&
+	git ls-files -s same >actual &&
+	git ls-tree -r before same | sed "s/ blob / /; s/\t/ 0\t/" >expect &&
+	test_cmp expect actual
+'
+
 test_done
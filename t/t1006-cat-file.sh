@@ -586,6 +586,38 @@ test_expect_success 'cat-file --unordered works' '
 	test_cmp expect actual
 '
 
+test_expect_success 'cat-file --unordered with one pack and a multi-pack-index' '
+	git init all-three &&
+	(
+		cd all-three &&
+		echo content >file &&
+		git add file &&
+		git commit -qm base &&
+		# keep the loose copies next to the pack
+		git repack -a &&
+		git cat-file --batch-all-objects \
+			--batch-check="%(objectname)" >expect &&
+		test_line_count = 3 expect &&
+		git cat-file --batch-all-objects --unordered \
+			--batch-check="%(objectname)" >actual.unsorted &&
+		sort <actual.unsorted >actual &&
+		test_cmp expect actual &&
+
+		echo more >file &&
+		git commit -qam more &&
+		git repack &&
+		git multi-pack-index write &&
+		git repack -a &&
+		git cat-file --batch-all-objects \
+			--batch-check="%(objectname)" >expect &&
+		test_line_count = 6 expect &&
+		git cat-file --batch-all-objects --unordered \
+			--batch-check="%(objectname)" >actual.unsorted &&
+		sort <actual.unsorted >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success 'set up object list for --batch-all-objects tests' '
 	git -C all-two cat-file --batch-all-objects --batch-check="%(objectname)" >objects
 '
@@ -608,4 +640,37 @@ test_expect_success 'cat-file --batch="batman" with --batch-all-objects will wor
 	cmp expect actual
 '
 
+test_expect_success '--buffer reads ahead but answers in order' '
+	git -C all-two cat-file --batch-all-objects --batch-check="%(objectname)" >input &&
+	cat >>input <<-\EOF &&
+	HEAD:file some rest
+	HEAD:does-not-exist
+	HEAD
+	0000000000000000000000000000000000000000
+	HEAD^{tree}
+	EOF
+	sort -r input >>input.more &&
+	cat input.more >>input &&
+	for batch in --batch --batch-check "--batch=%(objectsize) %(rest)" \
+		"--batch-check=%(objecttype) %(objectsize:disk) %(deltabase)"
+	do
+		git -C all-two cat-file "$batch" <input >expect &&
+		for n in 1 3 1000
+		do
+			GIT_TEST_CAT_FILE_READAHEAD=$n \
+				git -C all-two cat-file --buffer "$batch" <input >actual &&
+			cmp expect actual || return 1
+		done || return 1
+	done
+'
+
+test_expect_success '--buffer reads ahead with --follow-symlinks' '
+	printf "HEAD:%s\n" morx loop1 same-dir-link broken-same-dir-link \
+		out-of-repo-link dir/subdir/grandparent-dir-link >input &&
+	git cat-file --batch --follow-symlinks <input >expect &&
+	GIT_TEST_CAT_FILE_READAHEAD=2 \
+		git cat-file --batch --follow-symlinks --buffer <input >actual &&
+	cmp expect actual
+'
+
 test_done
@@ -129,6 +129,58 @@ test_expect_success 'packsize limit' '
 	)
 '
 
+test_expect_success 'add large files with several threads' '
+	test_create_repo threads &&
+	(
+		cd threads &&
+		git config core.bigfilethreshold 64k &&
+		git config core.bulkcheckinthreads 3 &&
+
+		for i in 1 2 3 4 5
+		do
+			test-tool genrandom "$i" $(( 100 * 1024 )) >big$i || return 1
+		done &&
+		cp big1 copy1 &&
+		git add big* copy1 &&
+
+		git ls-files -s | cut -d" " -f2 | sort -u >expect &&
+		test_line_count = 5 expect &&
+		for pi in .git/objects/pack/pack-*.idx
+		do
+			git show-index <"$pi" || return 1
+		done |
+		sed -e "s/^[0-9]* \([0-9a-f]*\) .*/\1/" |
+		sort >actual &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_expect_success 'core.bulkCheckinAllFiles avoids loose objects' '
+	test_create_repo allfiles &&
+	(
+		cd allfiles &&
+		git config core.bulkcheckinallfiles true &&
+		echo one >one &&
+		echo two >two &&
+		echo "*.crlf text eol=crlf" >.gitattributes &&
+		printf "a\nb\n" >three.crlf &&
+		git add one two three.crlf &&
+
+		git hash-object one two >expect &&
+		sort expect >expect.sorted &&
+		idx=$(echo .git/objects/pack/pack-*.idx) &&
+		git show-index <"$idx" |
+		sed -e "s/^[0-9]* \([0-9a-f]*\) .*/\1/" |
+		sort >actual &&
+		test_cmp expect.sorted actual &&
+
+		# files that need conversion are still written loose
+		oid=$(git rev-parse :three.crlf) &&
+		test_path_is_file .git/objects/$(test_oid_to_path $oid)
+	)
+'
+
 test_expect_success 'diff --raw' '
 	git commit -q -m initial &&
 	echo modified >>large1 &&
@@ -191,6 +243,77 @@ test_expect_success 'pack-objects with large loose object' '
 	test_cmp huge actual
 '
 
+test_expect_success 'cat-file streams a large deltified blob' '
+	test_create_repo delta &&
+	test-tool genrandom base $((1000 * 1024)) >delta-base &&
+	{
+		cat delta-base &&
+		test_seq 100000 120000 &&
+		cat delta-base
+	} >delta-target &&
+	# fast-import deltifies each blob against the one before it,
+	# even when the result is the larger of the two
+	{
+		echo blob &&
+		echo "data $(test_file_size delta-base)" &&
+		cat delta-base &&
+		echo &&
+		echo blob &&
+		echo "data $(test_file_size delta-target)" &&
+		cat delta-target &&
+		echo
+	} >delta-stream &&
+	GIT_ALLOC_LIMIT=0 git -C delta -c core.bigfilethreshold=10m \
+		-c fastimport.unpacklimit=0 fast-import <delta-stream &&
+	oid=$(git hash-object delta-target) &&
+	GIT_ALLOC_LIMIT=0 git verify-pack -v delta/.git/objects/pack/pack-*.idx >verify &&
+	grep "^$oid blob  *[0-9]* [0-9]* [0-9]* 1 " verify &&
+
+	# the target does not fit within GIT_ALLOC_LIMIT, its base does
+	git -C delta cat-file blob $oid >actual &&
+	test_cmp delta-target actual &&
+	{
+		echo "$oid blob $(test_file_size delta-target)" &&
+		cat delta-target &&
+		echo
+	} >expect &&
+	echo $oid | git -C delta cat-file --batch >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file streams a delta chain over a large base' '
+	test_create_repo chain &&
+	"$PERL_PATH" -e "print \"line \$_\\n\" for 1..120000" >chain-1 &&
+	"$PERL_PATH" -e "print \"another \$_\\n\" for 1..80000" >chain-tail &&
+	cat chain-tail >>chain-1 &&
+	{
+		"$PERL_PATH" -e "print \"line \$_\\n\" for 1..120000" &&
+		test_seq 1000 &&
+		cat chain-tail
+	} >chain-2 &&
+	cp chain-2 chain-3 &&
+	"$PERL_PATH" -e "print \"more \$_\\n\" for 1..2000" >>chain-3 &&
+	for i in 1 2 3
+	do
+		echo blob &&
+		echo "data $(test_file_size chain-$i)" &&
+		cat chain-$i &&
+		echo || return 1
+	done >chain-stream &&
+	GIT_ALLOC_LIMIT=0 git -C chain -c core.bigfilethreshold=10m \
+		-c fastimport.unpacklimit=0 fast-import <chain-stream &&
+	GIT_ALLOC_LIMIT=0 git verify-pack -v chain/.git/objects/pack/pack-*.idx >verify &&
+	grep "^$(git hash-object chain-3) blob  *[0-9]* [0-9]* [0-9]* 2 " verify &&
+
+	# none of these fit within GIT_ALLOC_LIMIT; each delta reads its
+	# base front to back, so the bases are streamed as well
+	for i in 1 2 3
+	do
+		git -C chain cat-file blob $(git hash-object chain-$i) >actual &&
+		test_cmp chain-$i actual || return 1
+	done
+'
+
 test_expect_success 'tar archiving' '
 	git archive --format=tar HEAD >/dev/null
 '
@@ -647,7 +647,34 @@ test_expect_success 'sparse-index is not expanded' '
 	echo >>sparse-index/extra.txt &&
 	ensure_not_expanded add extra.txt &&
 	echo >>sparse-index/untracked.txt &&
-	ensure_not_expanded add .
+	ensure_not_expanded add . &&
+
+	ensure_not_expanded diff &&
+	ensure_not_expanded diff --staged &&
+	ensure_not_expanded diff HEAD &&
+	ensure_not_expanded grep --cached a &&
+	ensure_not_expanded grep a &&
+	ensure_not_expanded blame deep/a &&
+	ensure_not_expanded ls-files --sparse
+'
+
+test_expect_success 'grep, diff and ls-files with sparse directories' '
+	init_repos &&
+
+	test_all_match git grep --cached a &&
+	test_all_match git grep --cached a -- folder1 &&
+	test_all_match git grep -e a HEAD -- deep &&
+	test_all_match git diff update-folder1 &&
+	test_all_match git diff --staged update-deep -- deep &&
+	test_all_match git ls-files &&
+	test_all_match git ls-files -s -- folder1 &&
+	test_sparse_match git ls-files --stage -- deep/deeper1 &&
+
+	git -C sparse-checkout ls-files --sparse >sparse-checkout-out &&
+	git -C sparse-index ls-files --sparse >sparse-index-out &&
+	grep "^folder1/a\$" sparse-checkout-out &&
+	! grep "^folder1/a\$" sparse-index-out &&
+	grep "^folder1/\$" sparse-index-out
 '
 
 # NEEDSWORK: a sparse-checkout behaves differently from a full checkout
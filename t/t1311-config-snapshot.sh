@@ -0,0 +1,109 @@
+#!/bin/sh
+
+test_description='reading the configuration through core.configSnapshot'
+
+. ./test-lib.sh
+
+# Run "test-tool config get_value" for $1, noting in "trace" whether the
+# snapshot was used or written.
+get_value () {
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool config get_value "$1"
+}
+
+# Age the configuration files, so that they are not racy.
+age_config () {
+	test-tool chmtime =-10 .git/config "$@"
+}
+
+test_expect_success 'setup' '
+	git config core.configSnapshot true &&
+	git config snap.value one &&
+	age_config
+'
+
+test_expect_success 'snapshot is written and then used' '
+	echo one >expect &&
+	get_value snap.value >actual &&
+	test_cmp expect actual &&
+	grep "\"value\":\"written\"" trace &&
+	test_path_is_file .git/config-snapshot &&
+	get_value snap.value >actual &&
+	test_cmp expect actual &&
+	grep "\"value\":\"used\"" trace
+'
+
+test_expect_success 'racily changed files are not snapshotted' '
+	git config snap.value two &&
+	get_value snap.value >actual &&
+	echo two >expect &&
+	test_cmp expect actual &&
+	! grep "\"value\":\"written\"" trace &&
+	get_value snap.value &&
+	! grep "\"value\":\"used\"" trace
+'
+
+test_expect_success 'changing a file invalidates the snapshot' '
+	age_config &&
+	get_value snap.value &&
+	grep "\"value\":\"written\"" trace &&
+	git config snap.value three &&
+	age_config &&
+	echo three >expect &&
+	get_value snap.value >actual &&
+	test_cmp expect actual &&
+	grep "\"value\":\"written\"" trace
+'
+
+test_expect_success 'included files are part of the snapshot' '
+	echo "[snap] included = one" >.git/included &&
+	git config include.path included &&
+	age_config .git/included &&
+	get_value snap.included &&
+	grep "\"value\":\"written\"" trace &&
+	echo "[snap] included = two" >.git/included &&
+	age_config .git/included &&
+	echo two >expect &&
+	get_value snap.included >actual &&
+	test_cmp expect actual &&
+	grep "\"value\":\"written\"" trace
+'
+
+test_expect_success 'a new global config file invalidates the snapshot' '
+	get_value snap.value &&
+	grep "\"value\":\"used\"" trace &&
+	git config --global snap.global yes &&
+	test-tool chmtime =-10 "$HOME/.gitconfig" &&
+	echo yes >expect &&
+	get_value snap.global >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'command-line values are applied on top' '
+	get_value snap.value &&
+	grep "\"value\":\"used\"" trace &&
+	echo four >expect &&
+	GIT_CONFIG_COUNT=1 GIT_CONFIG_KEY_0=snap.value GIT_CONFIG_VALUE_0=four \
+		test-tool config get_value snap.value >actual &&
+	test_cmp expect actual &&
+	grep "\"value\":\"used\"" trace
+'
+
+test_expect_success 'origins survive the snapshot' '
+	rm .git/config-snapshot &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool config iterate >expect &&
+	grep "\"value\":\"written\"" trace &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool config iterate >actual &&
+	grep "\"value\":\"used\"" trace &&
+	test_cmp expect actual
+'
+
+test_expect_success 'turning it off removes the snapshot' '
+	git config core.configSnapshot false &&
+	age_config &&
+	get_value snap.value &&
+	test_path_is_missing .git/config-snapshot
+'
+
+test_done
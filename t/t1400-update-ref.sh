@@ -1607,4 +1607,22 @@ test_expect_success 'directory not created deleting packed ref' '
 	test_path_is_missing .git/refs/heads/d1
 '
 
+for mode in true batch
+do
+	test_expect_success "update refs with core.fsyncRefFiles=$mode" '
+		test_seq 100 | sed "s,.*,create refs/fsync-$mode/& $A," >stdin &&
+		git -c core.fsyncRefFiles=$mode -c core.logAllRefUpdates=always \
+			update-ref -m fsync --stdin <stdin &&
+		git for-each-ref --format="%(objectname)" refs/fsync-$mode >actual &&
+		test_line_count = 100 actual &&
+		git reflog exists refs/fsync-$mode/100 &&
+		git -c core.fsyncRefFiles=$mode symbolic-ref refs/fsync-$mode/sym \
+			refs/fsync-$mode/1 &&
+		git -c core.fsyncRefFiles=$mode branch fsync-$mode $A &&
+		git -c core.fsyncRefFiles=$mode branch -m fsync-$mode fsync-$mode-moved &&
+		git rev-parse fsync-$mode-moved &&
+		test_path_is_missing ".git/fsync_refs_*"
+	'
+done
+
 test_done
@@ -422,4 +422,102 @@ test_expect_success 'expire with multiple worktrees' '
 	)
 '
 
+# Look up the same reflog entries in "indexed" and in a copy of it
+# without the reflog index, and compare.
+compare_reflog_lookups () {
+	rm -rf unindexed &&
+	cp -R indexed unindexed &&
+	rm -rf unindexed/.git/logs-index &&
+	for spec in "$@"
+	do
+		git -C unindexed rev-parse --verify -q "$spec" >expect
+		git -C indexed rev-parse --verify -q "$spec" >actual
+		test_cmp expect actual || return 1
+	done
+}
+
+test_expect_success 'core.reflogIndex indexes reflogs' '
+	git init indexed &&
+	(
+		cd indexed &&
+		git config core.reflogIndex true &&
+		test_commit one &&
+		commits=$(git rev-list HEAD) &&
+		for i in $(test_seq 1 60)
+		do
+			# every tenth update goes back in time
+			ts=$((1500000000 + $i * 100)) &&
+			if test $(($i % 10)) = 0
+			then
+				ts=$(($ts - 2500))
+			fi &&
+			blob=$(echo $i | git hash-object -w --stdin) &&
+			tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+			commit=$(git commit-tree -p HEAD -m $i $tree) &&
+			GIT_COMMITTER_DATE="$ts +0000" \
+				git update-ref -m "update $i" refs/heads/main $commit ||
+			return 1
+		done
+	) &&
+	test_path_is_file indexed/.git/logs-index/refs/heads/main
+'
+
+test_expect_success 'indexed reflog lookups match unindexed ones' '
+	specs="main@{0} main@{1} main@{5} main@{10} main@{59} main@{60}" &&
+	specs="$specs main@{61} main@{100}" &&
+	for ts in 1400000000 1500000100 1500001050 1500002000 1500003550 \
+		  1500003999 1500004000 1500004001 1500009000
+	do
+		specs="$specs main@{$ts}" || return 1
+	done &&
+	compare_reflog_lookups $specs &&
+	GIT_TRACE_REFS="$(pwd)/trace" \
+		git -C indexed rev-parse main@{1500001050} main@{5} &&
+	test $(grep -c "for_each_reflog_reverse_from: .* (skipped [1-9]" trace) = 2
+'
+
+test_expect_success 'stale reflog index is ignored and rewritten' '
+	test_commit -C indexed --no-tag two &&
+	git -C indexed -c core.reflogIndex=false commit --allow-empty -m three &&
+	compare_reflog_lookups main@{0} main@{1} main@{2} main@{1500003000} &&
+	git -C indexed commit --allow-empty -m four &&
+	compare_reflog_lookups main@{0} main@{1} main@{3} main@{1500003000}
+'
+
+test_expect_success 'reflog expire and delete keep the index in sync' '
+	git -C indexed reflog expire --expire=1500003000 refs/heads/main &&
+	compare_reflog_lookups main@{0} main@{5} main@{1500004000} &&
+	git -C indexed reflog delete main@{2} &&
+	compare_reflog_lookups main@{0} main@{1} main@{2} main@{3} &&
+	git -C indexed branch -m main renamed &&
+	test_path_is_missing indexed/.git/logs-index/refs/heads/main &&
+	compare_reflog_lookups renamed@{0} renamed@{2} renamed@{4} &&
+	git -C indexed checkout --detach &&
+	git -C indexed branch -D renamed &&
+	test_path_is_missing indexed/.git/logs-index/refs/heads/renamed
+'
+
+test_expect_success 'reflog expire leaves reflogs without expired entries alone' '
+	git init unchanged &&
+	test_commit -C unchanged one &&
+	test_commit -C unchanged two &&
+	git -C unchanged branch side &&
+	test_commit -C unchanged three &&
+	for log in HEAD refs/heads/main refs/heads/side
+	do
+		test-tool chmtime =-1000 unchanged/.git/logs/$log || return 1
+	done &&
+	test-tool chmtime --get unchanged/.git/logs/HEAD \
+		unchanged/.git/logs/refs/heads/side >expect &&
+	git -C unchanged reflog expire --expire=never \
+		--expire-unreachable=never --all &&
+	test-tool chmtime --get unchanged/.git/logs/HEAD \
+		unchanged/.git/logs/refs/heads/side >actual &&
+	test_cmp expect actual &&
+	test_line_count = 3 unchanged/.git/logs/HEAD &&
+	git -C unchanged reflog expire --expire=$test_tick --all &&
+	test_line_count = 1 unchanged/.git/logs/HEAD &&
+	test_must_be_empty unchanged/.git/logs/refs/heads/side
+'
+
 test_done
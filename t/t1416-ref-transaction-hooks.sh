@@ -136,4 +136,88 @@ test_expect_success 'interleaving hook calls succeed' '
 	test_cmp expect target-repo.git/actual
 '
 
+test_expect_success PERL 'long-running process serves all transactions' '
+	test_when_finished "rm -f hook.log" &&
+	write_script hook-process.pl "$PERL_PATH" \
+		<"$TEST_DIRECTORY"/t1416/hook-process.pl &&
+	test_config hook.reference-transaction.process \
+		"./hook-process.pl hook.log" &&
+	cat >expect <<-EOF &&
+		START
+		prepared
+		$ZERO_OID $PRE_OID refs/heads/one
+		committed
+		$ZERO_OID $PRE_OID refs/heads/one
+		prepared
+		$ZERO_OID $POST_OID refs/heads/two
+		aborted
+		$ZERO_OID $POST_OID refs/heads/two
+		STOP
+	EOF
+	git update-ref --stdin <<-EOF &&
+		start
+		create refs/heads/one $PRE_OID
+		commit
+		start
+		create refs/heads/two $POST_OID
+		prepare
+		abort
+	EOF
+	test_cmp expect hook.log
+'
+
+test_expect_success PERL 'long-running process can abort transactions' '
+	test_when_finished "rm -f hook.log" &&
+	test_config hook.reference-transaction.process \
+		"./hook-process.pl hook.log" &&
+	test_must_fail git update-ref refs/heads/reject $PRE_OID 2>err &&
+	test_i18ngrep "ref updates aborted by hook" err &&
+	test_must_fail git rev-parse --verify refs/heads/reject
+'
+
+test_expect_success PERL 'long-running process takes precedence over hook' '
+	test_when_finished "rm -f hook.log .git/hooks/reference-transaction" &&
+	write_script .git/hooks/reference-transaction <<-\EOF &&
+		echo "$*" >>actual
+	EOF
+	test_config hook.reference-transaction.process \
+		"./hook-process.pl hook.log" &&
+	rm -f actual &&
+	git update-ref refs/heads/three $PRE_OID &&
+	test_path_is_missing actual &&
+	grep "refs/heads/three" hook.log
+'
+
+test_expect_success 'deletions are reported when new refs go to packed-refs' '
+	test_when_finished "rm -f .git/hooks/reference-transaction actual" &&
+	git update-ref refs/heads/to-delete $PRE_OID &&
+	git pack-refs --all &&
+	write_script .git/hooks/reference-transaction <<-\EOF &&
+		echo "$*" >>actual &&
+		cat >>actual
+	EOF
+	cat >expect <<-EOF &&
+		prepared
+		$ZERO_OID $ZERO_OID refs/heads/to-delete
+		prepared
+		$ZERO_OID $POST_OID refs/heads/packed-1
+		$ZERO_OID $POST_OID refs/heads/packed-2
+		$PRE_OID $ZERO_OID refs/heads/to-delete
+		committed
+		$ZERO_OID $ZERO_OID refs/heads/to-delete
+		committed
+		$ZERO_OID $POST_OID refs/heads/packed-1
+		$ZERO_OID $POST_OID refs/heads/packed-2
+		$PRE_OID $ZERO_OID refs/heads/to-delete
+	EOF
+	git -c core.packedRefsUpdateThreshold=2 update-ref --stdin <<-EOF &&
+		create refs/heads/packed-1 $POST_OID
+		create refs/heads/packed-2 $POST_OID
+		delete refs/heads/to-delete $PRE_OID
+	EOF
+	test_cmp expect actual &&
+	test_path_is_missing .git/refs/heads/packed-1 &&
+	git rev-parse refs/heads/packed-1
+'
+
 test_done
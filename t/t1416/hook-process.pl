@@ -0,0 +1,68 @@
+#
+# Example implementation of a long-running reference-transaction hook.
+# See Documentation/githooks.txt, section "LONG-RUNNING HOOK PROCESSES".
+#
+# Usage: hook-process.pl <log path>
+#
+# Every invocation is appended to the log as "<state>" followed by the
+# lines the hook got on its standard input.  The "prepared" state of a
+# transaction that updates "refs/heads/reject" is refused.
+#
+
+use 5.008;
+sub gitperllib {
+	# See t/t0021/rot13-filter.pl for why this is needed.
+	if ($ENV{GITPERLLIB} =~ /;/) {
+		return split(/;/, $ENV{GITPERLLIB});
+	}
+	return split(/:/, $ENV{GITPERLLIB});
+}
+use lib (gitperllib());
+use strict;
+use warnings;
+use IO::File;
+use Git::Packet;
+
+my $log_file = shift @ARGV;
+open my $log, ">>", $log_file or die "cannot open log file: $!";
+$log->autoflush(1);
+
+print $log "START\n";
+
+packet_initialize("git-hook", 1);
+my %remote_caps = packet_read_and_check_capabilities("reference-transaction");
+packet_check_and_write_capabilities(\%remote_caps, "reference-transaction");
+
+while (1) {
+	my ( $res, $command ) = packet_key_val_read("command");
+	if ( $res == -1 ) {
+		print $log "STOP\n";
+		exit();
+	}
+	$command eq "reference-transaction" or die "bad command '$command'";
+
+	my $state;
+	while (1) {
+		( $res, my $buf ) = packet_bin_read();
+		last if $res;
+		$buf = Git::Packet::remove_final_lf_or_die($buf);
+		$buf =~ s/^arg=// or die "bad argument '$buf'";
+		$state = $buf;
+	}
+	print $log "$state\n";
+
+	my $input = "";
+	while (1) {
+		( $res, my $buf ) = packet_bin_read();
+		last if $res;
+		$input .= $buf;
+	}
+	print $log $input;
+
+	if ( $state eq "prepared" && $input =~ / refs\/heads\/reject$/m ) {
+		packet_txt_write("status=error");
+	} else {
+		packet_txt_write("status=success");
+	}
+	packet_flush();
+}
@@ -703,6 +703,50 @@ test_expect_success 'fsck errors in packed objects' '
 	! grep corrupt out
 '
 
+test_expect_success 'fsck errors in packed objects with threads' '
+	git cat-file commit HEAD >basis &&
+	sed "s/</one/" basis >one &&
+	one=$(git hash-object -t commit -w one) &&
+	mkdir blobs &&
+	test_when_finished "rm -rf blobs" &&
+	for i in $(test_seq 300)
+	do
+		echo $i >blobs/$i || return 1
+	done &&
+	ls blobs/* | git hash-object -w --stdin-paths >oids &&
+	echo $one >>oids &&
+	pack=$(git pack-objects .git/objects/pack/pack <oids) &&
+	test_when_finished "rm -f .git/objects/pack/pack-$pack.*" &&
+	remove_object $one &&
+	test_must_fail git fsck --threads=4 2>out &&
+	test_i18ngrep "error in commit $one.* - bad name" out &&
+	! grep corrupt out
+'
+
+test_expect_success 'fsck streams large blobs of a small pack with threads' '
+	mkdir blobs &&
+	test_when_finished "rm -rf blobs" &&
+	for i in 1 2 3
+	do
+		test-tool genrandom $i 20000 >blobs/$i || return 1
+	done &&
+	ls blobs/* | git hash-object -w --stdin-paths >oids &&
+	pack=$(git pack-objects .git/objects/pack/pack <oids) &&
+	test_when_finished "rm -f .git/objects/pack/pack-$pack.*" &&
+	git -c core.bigFileThreshold=1k fsck --threads=3 &&
+
+	# garble the middle of the last blob in the pack
+	git show-index <.git/objects/pack/pack-$pack.idx |
+	sort -n | tail -n 1 >last &&
+	read offset oid crc <last &&
+	chmod a+w .git/objects/pack/pack-$pack.pack &&
+	printf "\377\377\377\377" |
+	dd of=.git/objects/pack/pack-$pack.pack bs=1 conv=notrunc \
+		seek=$(($offset + 10000)) &&
+	test_must_fail git -c core.bigFileThreshold=1k fsck --threads=3 2>out &&
+	test_i18ngrep "packed $oid from .* is corrupt" out
+'
+
 test_expect_success 'fsck fails on corrupt packfile' '
 	hsh=$(git commit-tree -m mycommit HEAD^{tree}) &&
 	pack=$(echo $hsh | git pack-objects .git/objects/pack/pack) &&
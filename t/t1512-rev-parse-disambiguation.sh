@@ -401,4 +401,16 @@ test_expect_success 'cat-file --batch and --batch-check show ambiguous' '
 	test_i18ngrep hint: err
 '
 
+test_expect_success 'repeated abbreviations in one process stay the same' '
+	git log --all --format="%H %P" >full &&
+	tr " " "\n" <full | sed "/^$/d" >oids &&
+	while read oid
+	do
+		git rev-parse --short=4 $oid || return 1
+	done <oids >expect &&
+	git log --all --format="%h %p" --abbrev=4 >abbrev &&
+	tr " " "\n" <abbrev | sed "/^$/d" >actual &&
+	test_cmp expect actual
+'
+
 test_done
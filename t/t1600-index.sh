@@ -97,4 +97,32 @@ test_expect_success 'index version config precedence' '
 	test_index_version 0 true 2 2
 '
 
+test_expect_success PTHREADS 'index written with several threads reads back' '
+	git init threaded &&
+	(
+		cd threaded &&
+		sane_unset GIT_TEST_INDEX_THREADS &&
+		for i in $(test_seq 100)
+		do
+			echo $i >file$i &&
+			mkdir -p dir$i &&
+			echo $i >dir$i/file || return 1
+		done &&
+		git add . &&
+		git ls-files -s >expect &&
+		for v in 2 4
+		do
+			git update-index --index-version=$v &&
+			git -c index.threads=1 update-index --force-write-index &&
+			git -c index.threads=1 ls-files -s >actual &&
+			test_cmp expect actual &&
+			git -c index.threads=4 update-index --force-write-index &&
+			git -c index.threads=1 ls-files -s >actual &&
+			test_cmp expect actual &&
+			git -c index.threads=4 ls-files -s >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
 test_done
@@ -510,4 +510,41 @@ test_expect_success 'do not refresh null base index' '
 	)
 '
 
+
+test_expect_success 'splitIndex.deferSharedIndex leaves the shared index to maintenance' '
+	test_create_repo defer &&
+	(
+		cd defer &&
+		git config core.splitIndex true &&
+		git config splitIndex.maxPercentChange 20 &&
+		git config splitIndex.deferSharedIndex true &&
+		test_commit initial &&
+		git update-index --split-index &&
+		BASE=$(test-tool dump-split-index .git/index | grep "^base") &&
+
+		for i in 1 2 3
+		do
+			create_non_racy_file file$i &&
+			git update-index --add file$i || return 1
+		done &&
+		test-tool dump-split-index .git/index | grep "^base" >actual &&
+		echo "$BASE" >expect &&
+		test_cmp expect actual &&
+
+		git maintenance run --auto --task=split-index &&
+		test-tool dump-split-index .git/index | grep "^base" >actual &&
+		! test_cmp expect actual &&
+		git ls-files >actual &&
+		test_write_lines file1 file2 file3 initial.t >expect &&
+		test_cmp expect actual &&
+
+		# nothing to do now
+		BASE=$(test-tool dump-split-index .git/index | grep "^base") &&
+		git maintenance run --task=split-index &&
+		test-tool dump-split-index .git/index | grep "^base" >actual &&
+		echo "$BASE" >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_done
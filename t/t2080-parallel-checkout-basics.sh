@@ -226,4 +226,26 @@ test_expect_success SYMLINKS 'parallel checkout checks for symlinks in leading d
 	)
 '
 
+test_expect_success 'parallel checkout can run its workers as threads' '
+	set_checkout_config 2 0 &&
+	test_config_global checkout.workerThreads true &&
+	git init threads &&
+	(
+		cd threads &&
+		mkdir D &&
+		test_commit D/A &&
+		test_commit D/B &&
+		test_commit C &&
+		rm -rf D C.t &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace" git checkout --force HEAD &&
+		grep "\"thread\":\"th[0-9]*:checkout_worker\"" trace >threads &&
+		test_line_count -gt 0 threads &&
+		! grep "\"argv\":\\[\"git\",\"checkout--worker\"" trace &&
+		grep D/A D/A.t &&
+		grep D/B D/B.t &&
+		grep C C.t
+	)
+'
+
 test_done
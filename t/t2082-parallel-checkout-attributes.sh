@@ -191,4 +191,51 @@ test_expect_success PERL 'parallel-checkout and delayed checkout' '
 	test_cmp delayed/Z original
 '
 
+# Print the starts of the given command from the perf trace $2 by the
+# checkout workers, i.e. by processes one level down.
+filter_starts_in_workers () {
+	grep "| d1 | .* | child_start .*$1" "$2"
+}
+
+test_expect_success 'parallel-safe external filter runs in the workers' '
+	set_checkout_config 2 0 &&
+	test_config -C filter filter.rot13.parallel true &&
+	rm -f filter.trace &&
+	(
+		cd filter &&
+		rm A B C &&
+		test_checkout_workers 2 env GIT_TRACE2_PERF="$(pwd)/../filter.trace" \
+			git checkout A B C &&
+		test_cmp original A &&
+		test_cmp original B &&
+		test_cmp original C
+	) &&
+	filter_starts_in_workers rot13.sh filter.trace >starts &&
+	test_line_count = 1 starts
+'
+
+test_expect_success PERL 'parallel-safe process filter delays in the workers' '
+	test_config_global filter.delay.process \
+		"\"$(pwd)/rot13-filter.pl\" --always-delay \"$(pwd)/delayed.log\" clean smudge delay" &&
+	test_config_global filter.delay.required true &&
+	test_config_global filter.delay.parallel true &&
+
+	rm -f delayed.log delayed.trace delayed/W.d delayed/X.d delayed/Y delayed/Z &&
+	set_checkout_config 2 0 &&
+	test_checkout_workers 2 env GIT_TRACE2_PERF="$(pwd)/delayed.trace" \
+		git -C delayed checkout -f &&
+	verify_checkout delayed &&
+
+	grep "smudge W.d .* \[DELAYED\]" delayed.log &&
+	grep "smudge X.d .* \[DELAYED\]" delayed.log &&
+	test_cmp delayed/W.d original &&
+	test_cmp delayed/X.d original &&
+	test_cmp delayed/Y original &&
+	test_cmp delayed/Z original &&
+
+	filter_starts_in_workers rot13-filter.pl delayed.trace >starts &&
+	test_file_not_empty starts &&
+	! grep "| d0 | main *| child_start .*rot13-filter.pl" delayed.trace
+'
+
 test_done
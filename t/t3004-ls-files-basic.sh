@@ -51,4 +51,118 @@ test_expect_success SYMLINKS 'ls-files with absolute paths to symlinks' '
 	test_cmp expect actual
 '
 
+test_expect_success 'ls-files reads only the entries below the common prefix' '
+	git init prefix &&
+	(
+		cd prefix &&
+		mkdir a b c &&
+		for d in a b c
+		do
+			for f in 1 2 3
+			do
+				echo $d$f >$d/$f || return 1
+			done
+		done &&
+		git add . &&
+		for v in 2 4
+		do
+			for t in 1 2
+			do
+				git update-index --index-version=$v &&
+				git -c index.threads=$t update-index --force-write-index &&
+				for ps in a b/ b/2 "c/1 c/3" nothere/
+				do
+					# -f needs the whole index
+					git ls-files -f -- $ps | sed "s/^. //" >expect &&
+					GIT_TRACE2_EVENT="$(pwd)/trace" \
+						git ls-files -- $ps >actual &&
+					test_cmp expect actual || return 1
+				done &&
+				grep prefix_cache_nr trace &&
+				rm trace || return 1
+			done
+		done
+	)
+'
+
+test_expect_success 'many pathspecs without wildcards' '
+	test_create_repo many-pathspecs &&
+	(
+		cd many-pathspecs &&
+		for d in a b c d
+		do
+			mkdir -p $d/sub &&
+			for f in 1 2 3 4 5
+			do
+				>$d/$f &&
+				>$d/sub/$f || return 1
+			done
+		done &&
+		git add . &&
+		cat >pathspecs <<-\EOF &&
+		a/1
+		a/2
+		a/sub
+		b/sub/
+		b/3
+		c
+		d/sub/1
+		d/sub/5
+		d/4/
+		d/nothere
+		e/1
+		x
+		y
+		z
+		v
+		w
+		:(glob)b/s*/2
+		:(exclude)a/sub/3
+		:(icase)C/SUB/2
+		EOF
+		git ls-files -- $(cat pathspecs) >actual &&
+		cat >expect <<-\EOF &&
+		a/1
+		a/2
+		a/sub/1
+		a/sub/2
+		a/sub/4
+		a/sub/5
+		b/3
+		b/sub/1
+		b/sub/2
+		b/sub/3
+		b/sub/4
+		b/sub/5
+		c/1
+		c/2
+		c/3
+		c/4
+		c/5
+		c/sub/1
+		c/sub/2
+		c/sub/3
+		c/sub/4
+		c/sub/5
+		d/sub/1
+		d/sub/5
+		EOF
+		test_cmp expect actual &&
+		test_must_fail git ls-files --error-unmatch -- \
+			$(cat pathspecs) 2>err &&
+		cat >expect <<-\EOF &&
+		error: pathspec '\''d/4/'\'' did not match any file(s) known to git
+		error: pathspec '\''d/nothere'\'' did not match any file(s) known to git
+		error: pathspec '\''e/1'\'' did not match any file(s) known to git
+		error: pathspec '\''x'\'' did not match any file(s) known to git
+		error: pathspec '\''y'\'' did not match any file(s) known to git
+		error: pathspec '\''z'\'' did not match any file(s) known to git
+		error: pathspec '\''v'\'' did not match any file(s) known to git
+		error: pathspec '\''w'\'' did not match any file(s) known to git
+		Did you forget to '\''git add'\''?
+		EOF
+		test_cmp expect err
+	)
+'
+
 test_done
@@ -24,4 +24,22 @@ test_expect_success 'no buffer overflow in lazy_init_name_hash' '
 	test-tool lazy-init-name-hash -m
 '
 
+test_expect_success 'single and multi threaded name hashes agree' '
+	git read-tree --empty &&
+	(
+	    test_seq $LAZY_THREAD_COST | sed "s|.*|a/b_&/c|" &&
+	    test_seq $LAZY_THREAD_COST | sed "s|.*|A/B_&/d|" &&
+	    test_seq $LAZY_THREAD_COST | sed "s|.*|e/f/g_&|"
+	) |
+	sort |
+	sed "s/^/100644 $EMPTY_BLOB	/" |
+	git update-index --index-info &&
+	test_config core.ignorecase true &&
+	test-tool lazy-init-name-hash -d -s >single.raw &&
+	test-tool lazy-init-name-hash -d -m >multi.raw &&
+	sort single.raw >single &&
+	sort multi.raw >multi &&
+	test_cmp single multi
+'
+
 test_done
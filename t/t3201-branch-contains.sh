@@ -267,4 +267,35 @@ test_expect_success 'branch --merged with --verbose' '
 	test_cmp expect actual
 '
 
+test_expect_success 'branch --contains with many branches and a commit-graph' '
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	git checkout -b many main &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_commit --no-tag many-$i &&
+		git branch many-$i || return 1
+	done &&
+	git checkout -b fork many-3 &&
+	test_commit --no-tag fork &&
+	git commit-graph write --reachable &&
+	for commit in main many-2 many-5 fork
+	do
+		git -c core.commitGraph=false branch --contains $commit >expect &&
+		git branch --contains $commit >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=false branch --no-contains $commit >expect &&
+		git branch --no-contains $commit >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	git branch --contains many-5 >actual &&
+	cat >expect <<-\EOF &&
+	  many
+	  many-5
+	  many-6
+	  many-7
+	  many-8
+	EOF
+	test_cmp expect actual
+'
+
 test_done
@@ -439,6 +439,17 @@ test_expect_success 'no commits on one side' '
 	git range-diff main HEAD@{1} HEAD
 '
 
+test_expect_success 'cost matrix computed on threads gives the same answer' '
+	for range in topic...changed topic...renamed-file topic...mode-only-change
+	do
+		GIT_TEST_RANGE_DIFF_THREADS=1 \
+			git range-diff --no-color $range >expect &&
+		GIT_TEST_RANGE_DIFF_THREADS=4 \
+			git range-diff --no-color $range >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_expect_success 'changed message' '
 	git range-diff --no-color topic...changed-message >actual &&
 	sed s/Z/\ /g >expect <<-EOF &&
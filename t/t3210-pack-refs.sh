@@ -256,4 +256,234 @@ test_expect_success SYMLINKS 'pack symlinked packed-refs' '
 	test "$(test_readlink .git/packed-refs)" = "my-deviant-packed-refs"
 '
 
+test_expect_success 'setup refs for packed-refs index' '
+	git init indexed &&
+	(
+		cd indexed &&
+		test_commit base &&
+		git tag -a -m annotated annotated &&
+		for i in $(test_seq 50)
+		do
+			echo "create refs/pull/$i/head HEAD" &&
+			echo "create refs/heads/topic-$i HEAD" || return 1
+		done >in &&
+		echo "create refs/remotes/origin/main HEAD" >>in &&
+		git update-ref --stdin <in &&
+		git pack-refs --all --prune &&
+		test_path_is_missing .git/packed-refs.idx &&
+		git for-each-ref >../expect-all &&
+		for prefix in refs/pull/ refs/pull/1 refs/pull/1/ refs/heads/ \
+			      refs/tags/ refs/a refs/zzz refs/
+		do
+			git for-each-ref "$prefix" >"../expect-$(echo $prefix | tr / _)" ||
+			return 1
+		done
+	)
+'
+
+test_expect_success 'packed-refs index is written and used' '
+	(
+		cd indexed &&
+		git -c core.packedRefsIndex=true pack-refs --all --prune &&
+		test_path_is_file .git/packed-refs.idx &&
+		git for-each-ref >actual &&
+		test_cmp ../expect-all actual &&
+		for prefix in refs/pull/ refs/pull/1 refs/pull/1/ refs/heads/ \
+			      refs/tags/ refs/a refs/zzz refs/
+		do
+			git for-each-ref "$prefix" >actual &&
+			test_cmp "../expect-$(echo $prefix | tr / _)" actual ||
+			return 1
+		done &&
+		git show-ref --verify refs/pull/17/head &&
+		test_must_fail git show-ref --verify refs/pull/17 &&
+		git rev-parse annotated^{commit} >expect &&
+		git rev-parse refs/tags/annotated^{} >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'packed-refs index is kept up to date' '
+	(
+		cd indexed &&
+		git config core.packedRefsIndex true &&
+		git update-ref -d refs/pull/17/head &&
+		test_path_is_file .git/packed-refs.idx &&
+		test_must_fail git show-ref --verify refs/pull/17/head &&
+		git show-ref --verify refs/pull/18/head &&
+		git for-each-ref refs/pull/ >actual &&
+		grep -v refs/pull/17/ ../expect-refs_pull_ >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'stale packed-refs index is ignored' '
+	(
+		cd indexed &&
+		cp .git/packed-refs.idx stale.idx &&
+		git update-ref refs/pull/17/head HEAD &&
+		git pack-refs --all --prune &&
+		cp stale.idx .git/packed-refs.idx &&
+		git for-each-ref >actual &&
+		test_cmp ../expect-all actual
+	)
+'
+
+test_expect_success 'packed-refs index is removed when disabled' '
+	(
+		cd indexed &&
+		git config core.packedRefsIndex false &&
+		git update-ref -d refs/pull/18/head &&
+		test_path_is_missing .git/packed-refs.idx
+	)
+'
+
+test_expect_success 'large transactions write new refs to packed-refs' '
+	test_create_repo batched &&
+	(
+		cd batched &&
+		test_commit base &&
+		git update-ref refs/heads/loose HEAD &&
+		git config core.logAllRefUpdates true &&
+		git config core.packedRefsUpdateThreshold 4 &&
+		cat >in <<-EOF &&
+		create refs/heads/one HEAD
+		create refs/heads/two HEAD^{tree}
+		create refs/tags/three HEAD
+		update refs/heads/loose HEAD
+		EOF
+		test_must_fail git update-ref --stdin <in 2>err &&
+		grep "non-commit object" err &&
+		test_path_is_missing .git/refs/heads/one &&
+		test_must_fail git show-ref --verify refs/heads/one &&
+
+		printf "create refs/tags/t%d HEAD\n" 1 2 3 4 5 >in &&
+		echo "update refs/heads/loose base^{}" >>in &&
+		git update-ref --stdin <in &&
+		test_path_is_missing .git/refs/tags/t1 &&
+		test_path_is_missing .git/refs/tags/t5 &&
+		test_path_is_file .git/refs/heads/loose &&
+		grep refs/tags/t3 .git/packed-refs &&
+		git rev-parse HEAD >expect &&
+		git rev-parse refs/tags/t3 >actual &&
+		test_cmp expect actual &&
+
+		printf "create refs/heads/b%d HEAD\n" 1 2 3 4 >in &&
+		git update-ref --stdin <in &&
+		test_path_is_missing .git/refs/heads/b1 &&
+		git reflog exists refs/heads/b1 &&
+
+		printf "create refs/heads/few%d HEAD\n" 1 2 >in &&
+		git update-ref --stdin <in &&
+		test_path_is_file .git/refs/heads/few1
+	)
+'
+
+test_expect_success 'packed updates follow existing packed refs' '
+	(
+		cd batched &&
+		test_commit next &&
+		printf "update refs/tags/t%d HEAD\n" 1 2 3 4 >in &&
+		git update-ref --stdin <in &&
+		test_path_is_missing .git/refs/tags/t1 &&
+		git rev-parse HEAD >expect &&
+		git rev-parse refs/tags/t4 >actual &&
+		test_cmp expect actual &&
+		git rev-parse base >expect &&
+		git rev-parse refs/tags/t5 >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'packed-refs delta needs its extension' '
+	test_when_finished "rm -rf no-ext" &&
+	git init no-ext &&
+	(
+		cd no-ext &&
+		git config core.packedRefsDeltaLimit 4 &&
+		test_commit base &&
+		git tag one &&
+		git pack-refs --all 2>err &&
+		test_i18ngrep "ignoring core.packedRefsDeltaLimit" err &&
+		! grep " id=" .git/packed-refs &&
+		git tag two &&
+		git pack-refs --all &&
+		test_path_is_missing .git/packed-refs.delta &&
+		grep refs/tags/two .git/packed-refs &&
+
+		git config extensions.packedRefsDelta true &&
+		test_must_fail git rev-parse HEAD 2>err &&
+		test_i18ngrep "repo version is 0, but v1-only extension found" err
+	)
+'
+
+test_expect_success 'small packed updates go to a delta' '
+	git init layered &&
+	(
+		cd layered &&
+		git config core.repositoryFormatVersion 1 &&
+		git config extensions.packedRefsDelta true &&
+		git config core.packedRefsDeltaLimit 4 &&
+		test_commit base &&
+		for i in $(test_seq 1 8)
+		do
+			git tag -a -m "tag $i" d$i || return 1
+		done &&
+		git pack-refs --all &&
+		test_path_is_missing .git/packed-refs.delta &&
+		head -n 1 .git/packed-refs >header &&
+		grep " id=" header &&
+		cp .git/packed-refs packed-refs.orig &&
+
+		git tag -d d3 &&
+		git tag -f -a -m moved d5 base^{} &&
+		git branch side &&
+		git pack-refs --all &&
+		test_cmp packed-refs.orig .git/packed-refs &&
+		test_path_is_file .git/packed-refs.delta &&
+		test_path_is_missing .git/refs/heads/side &&
+
+		test_must_fail git rev-parse --verify -q d3 &&
+		git cat-file tag d5 >tag &&
+		grep moved tag &&
+		git for-each-ref --format="%(refname) %(objectname) %(*objectname)" >expect &&
+		! grep d3 expect &&
+		git for-each-ref --format="%(refname) %(objectname) %(*objectname)" \
+			refs/tags/d5 >actual &&
+		grep refs/tags/d5 expect >expect.d5 &&
+		test_cmp expect.d5 actual
+	)
+'
+
+test_expect_success 'a delta past the limit is folded into packed-refs' '
+	(
+		cd layered &&
+		git for-each-ref >expect &&
+		git tag -d d1 d2 &&
+		grep -v "refs/tags/d[12]$" expect >expect.deleted &&
+		test_path_is_missing .git/packed-refs.delta &&
+		! grep refs/tags/d3 .git/packed-refs &&
+		! grep refs/tags/d1 .git/packed-refs &&
+		git for-each-ref >actual &&
+		test_cmp expect.deleted actual &&
+		grep " id=" .git/packed-refs
+	)
+'
+
+test_expect_success 'a delta for another packed-refs is ignored' '
+	(
+		cd layered &&
+		git tag -d d4 &&
+		test_path_is_file .git/packed-refs.delta &&
+		cp .git/packed-refs.delta delta.old &&
+		git -c core.packedRefsDeltaLimit=0 pack-refs --all &&
+		test_path_is_missing .git/packed-refs.delta &&
+		! grep " id=" .git/packed-refs &&
+		git for-each-ref >expect &&
+		cp delta.old .git/packed-refs.delta &&
+		git for-each-ref >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='notes index'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+# Rewrite the tree of refs/notes/commits so that every note sits
+# in a two-character fanout directory.
+fan_out_notes () {
+	tree=$(git ls-tree refs/notes/commits |
+		while read mode type oid path
+		do
+			dir=$(echo "$path" | cut -c1-2) &&
+			rest=$(echo "$path" | cut -c3-) &&
+			sub=$(printf "100644 blob %s\t%s\n" $oid $rest | git mktree) &&
+			printf "040000 tree %s\t%s\n" $sub $dir || return 1
+		done | git mktree) &&
+	commit=$(echo fanout | git commit-tree $tree -p refs/notes/commits) &&
+	git update-ref refs/notes/commits $commit
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	test_commit three &&
+	git notes add -m "note one" one &&
+	git notes add -m "note two" two &&
+	git notes add -m "note three" three &&
+	test_path_is_missing .git/notes-index
+'
+
+test_expect_success 'write-index writes an index of the notes tree' '
+	git notes write-index &&
+	tree=$(git rev-parse refs/notes/commits^{tree}) &&
+	test_path_is_file .git/notes-index/$tree.idx &&
+	git log --notes >actual &&
+	rm -r .git/notes-index &&
+	git log --notes >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'notes are shown from the index without reading the tree' '
+	fan_out_notes &&
+	git log --notes >expect &&
+	git notes write-index &&
+	subtree=$(git rev-parse "refs/notes/commits^{tree}:$(git rev-parse one | cut -c1-2)") &&
+	mv .git/objects/$(test_oid_to_path $subtree) subtree.obj &&
+	test_when_finished "mv subtree.obj .git/objects/$(test_oid_to_path $subtree)" &&
+	git log --notes >actual &&
+	test_cmp expect actual &&
+	rm -r .git/notes-index &&
+	test_must_fail git log --notes >/dev/null 2>&1
+'
+
+test_expect_success 'an index of another notes tree is not used' '
+	git notes write-index &&
+	git notes add -m "note one again" -f one &&
+	git log --notes >actual &&
+	test_i18ngrep "note one again" actual
+'
+
+test_expect_success 'notes.index keeps the index up to date' '
+	test_config notes.index true &&
+	old=$(git rev-parse refs/notes/commits^{tree}) &&
+	git notes add -m "note one, third" -f one &&
+	new=$(git rev-parse refs/notes/commits^{tree}) &&
+	test_path_is_file .git/notes-index/$new.idx &&
+	git notes remove two &&
+	newer=$(git rev-parse refs/notes/commits^{tree}) &&
+	test_path_is_file .git/notes-index/$newer.idx &&
+	test_path_is_missing .git/notes-index/$new.idx &&
+	git log --notes >actual &&
+	rm -r .git/notes-index &&
+	git log --notes >expect &&
+	test_cmp expect actual &&
+	test_i18ngrep "note one, third" actual &&
+	! grep "note two" actual
+'
+
+test_expect_success 'write-index starts from the index of an earlier notes commit' '
+	git notes write-index &&
+	git notes add -m "note two, again" two &&
+	git notes add -m "note three, again" -f three &&
+	git notes write-index &&
+	ls .git/notes-index >indexes &&
+	test_line_count = 1 indexes &&
+	git log --notes >actual &&
+	rm -r .git/notes-index &&
+	git log --notes >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'notes of other refs and %N use their own index' '
+	git notes --ref=other add -m "other note" two &&
+	git notes --ref=other write-index &&
+	git notes write-index &&
+	ls .git/notes-index >indexes &&
+	test_line_count = 2 indexes &&
+	git log --notes=other --notes --format="%s %N" >actual &&
+	rm -r .git/notes-index &&
+	git log --notes=other --notes --format="%s %N" >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -406,6 +406,88 @@ test_expect_success 'refuse to switch to branch checked out elsewhere' '
 	test_i18ngrep "already checked out" err
 '
 
+test_expect_success 'setup for rebase.inMemory' '
+	git init inmem &&
+	(
+		cd inmem &&
+		test_commit base &&
+		test_commit upstream &&
+		git checkout -b topic base &&
+		test_commit one &&
+		test_commit two &&
+		test_commit three file &&
+		test_commit four
+	)
+'
+
+test_expect_success 'rebase.inMemory gives the same result' '
+	(
+		cd inmem &&
+		git checkout -B plain topic &&
+		git rebase -f upstream &&
+		git checkout -B in-memory topic &&
+		git -c rebase.inMemory=true rebase -f upstream &&
+		test_cmp_rev plain^{tree} HEAD^{tree} &&
+		git log --format="%an %ae %ad%n%B" plain >expect &&
+		git log --format="%an %ae %ad%n%B" in-memory >actual &&
+		test_cmp expect actual &&
+		git diff --exit-code HEAD &&
+		test_path_is_file one.t &&
+		test_path_is_file file
+	)
+'
+
+test_expect_success 'rebase.inMemory updates the worktree before exec' '
+	(
+		cd inmem &&
+		git checkout -B in-memory topic &&
+		git -c rebase.inMemory=true rebase -f \
+			-x "git diff --exit-code HEAD" upstream
+	)
+'
+
+test_expect_success 'rebase.inMemory stops at a conflict as usual' '
+	(
+		cd inmem &&
+		git checkout -B conflict upstream &&
+		echo conflict >file &&
+		git add file &&
+		git commit -m conflict &&
+		git checkout -B in-memory topic &&
+		test_must_fail git -c rebase.inMemory=true rebase conflict &&
+		test_cmp_rev REBASE_HEAD three &&
+		test "$(git log -1 --format=%s HEAD)" = two &&
+		test_path_is_file two.t &&
+		git rebase --abort
+	)
+'
+
+test_expect_success 'rebase.inMemory reschedules picks the worktree cannot take' '
+	(
+		cd inmem &&
+		git checkout -B in-memory topic &&
+		write_script add-untracked <<-\EOF &&
+		{
+			echo "exec echo precious >two.t" &&
+			cat "$1"
+		} >"$1.new" &&
+		mv "$1.new" "$1"
+		EOF
+		test_must_fail env GIT_SEQUENCE_EDITOR=./add-untracked \
+			git -c rebase.inMemory=true rebase -i -f upstream 2>err &&
+		test_i18ngrep "picks since .* have been rescheduled" err &&
+		test_cmp_rev HEAD upstream &&
+		echo precious >expect &&
+		test_cmp expect two.t &&
+		rm two.t &&
+		git -c rebase.inMemory=true rebase --continue &&
+		git log --format=%s upstream..HEAD >actual &&
+		test_write_lines four three two one >expect &&
+		test_cmp expect actual &&
+		git diff --exit-code HEAD
+	)
+'
+
 test_expect_success MINGW,SYMLINKS_WINDOWS 'rebase when .git/logs is a symlink' '
 	git checkout main &&
 	mv .git/logs actual_logs &&
@@ -58,6 +58,28 @@ test_expect_success \
      expr "$(echo $(git cherry main my-topic-branch) )" : "+ [^ ]* - .*"
 '
 
+test_expect_success 'cherry remembers patch IDs with diff.cachePatchIds' '
+	git cherry main my-topic-branch >expect &&
+	git -c diff.cachePatchIds=true cherry main my-topic-branch >actual &&
+	test_cmp expect actual &&
+	git -c diff.cachePatchIds=true cherry main my-topic-branch >actual &&
+	test_cmp expect actual &&
+
+	# give the new patch the patch IDs of the one upstream
+	new=$(sed -n "s/^+ //p" expect) &&
+	git notes --ref=patch-id show main >note &&
+	validity=$(git log -1 --format=%s refs/notes/patch-id) &&
+	git notes --ref=patch-id add -f -F note $new &&
+	tree=$(git rev-parse refs/notes/patch-id^{tree}) &&
+	git update-ref refs/notes/patch-id \
+		$(git commit-tree -m "$validity" $tree) &&
+	git -c diff.cachePatchIds=true cherry main my-topic-branch >actual &&
+	sed "s/^+/-/" expect >expect.cached &&
+	test_cmp expect.cached actual &&
+	git cherry main my-topic-branch >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'cherry ignores whitespace' '
 	git switch --orphan=upstream-with-space &&
 	test_commit initial file &&
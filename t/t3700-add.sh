@@ -462,6 +462,30 @@ test_expect_success 'all statuses changed in folder if . is given' '
 	)
 '
 
+test_expect_success 'add with core.fsyncObjectFiles=batch' '
+	git init batch &&
+	(
+		cd batch &&
+		mkdir -p dir &&
+		for i in 1 2 3 4 5
+		do
+			echo "content $i" >file$i &&
+			echo "other $i" >dir/file$i || return 1
+		done &&
+		git -c core.fsyncObjectFiles=batch add . &&
+		git ls-files -s >entries &&
+		test_line_count = 10 entries &&
+		cut -d" " -f2 entries >oids &&
+		while read oid
+		do
+			test_path_is_file .git/objects/$(test_oid_to_path $oid) || return 1
+		done <oids &&
+		find .git/objects -name "incoming-*" >leftover &&
+		test_must_be_empty leftover &&
+		git fsck
+	)
+'
+
 test_expect_success CASE_INSENSITIVE_FS 'path is case-insensitive' '
 	path="$(pwd)/BLUB" &&
 	touch "$path" &&
@@ -9,6 +9,7 @@ GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
 export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
 
 . ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-merge.sh
 
 diff_cmp () {
 	for i in "$1" "$2"
@@ -1307,4 +1308,26 @@ test_expect_success 'stash -c stash.useBuiltin=false warning ' '
 	test_must_be_empty err
 '
 
+test_expect_merge_algorithm failure success 'apply --index follows renames of staged changes' '
+	git reset --hard &&
+	test_seq 1 20 >numbers &&
+	git add numbers &&
+	git commit -m "add numbers" &&
+	test_seq 0 20 >numbers &&
+	git add numbers &&
+	test_seq 0 21 >numbers &&
+	git stash &&
+
+	git mv numbers sequence &&
+	git commit -m "rename numbers" &&
+	git stash apply --index &&
+
+	test_path_is_missing numbers &&
+	test_seq 0 21 >expect &&
+	test_cmp expect sequence &&
+	test_seq 0 20 >expect &&
+	git show :sequence >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -286,4 +286,30 @@ test_expect_success 'basename similarity vs best similarity' '
 	test_cmp expected actual
 '
 
+test_expect_success 'inexact renames among many candidates' '
+	mkdir many &&
+	for i in $(test_seq 20)
+	do
+		test_seq $i $((i * 10 + 20)) >many/old-$i || return 1
+	done &&
+	git add many &&
+	git commit -m "many files" &&
+	for i in $(test_seq 20)
+	do
+		git mv many/old-$i many/new-$i &&
+		echo edited >>many/new-$i || return 1
+	done &&
+	git add many &&
+	git commit -m "many renames" &&
+	GIT_TEST_RENAME_THREADS=1 \
+		git diff-tree -r -M --name-status HEAD^ HEAD >expect &&
+	for i in $(test_seq 20)
+	do
+		grep "^R[0-9]*	many/old-$i	many/new-$i\$" expect || return 1
+	done &&
+	GIT_TEST_RENAME_THREADS=4 \
+		git diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -179,4 +179,48 @@ test_expect_success 'diff --break-rewrites fetches only if necessary, and batche
 	test_line_count = 1 done_lines
 '
 
+test_expect_success 'blame batches blobs' '
+	test_when_finished "rm -rf server client trace" &&
+
+	test_create_repo server &&
+	for i in 1 2 3 4 5
+	do
+		echo line $i >>server/file &&
+		git -C server add file &&
+		git -C server commit -m "commit $i" || return 1
+	done &&
+
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --bare --filter=blob:none "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client blame HEAD -- file >actual &&
+	test_line_count = 5 actual &&
+	grep "fetch> done" trace >done_lines &&
+	test_line_count = 1 done_lines
+'
+
+test_expect_success 'grep batches blobs' '
+	test_when_finished "rm -rf server client trace" &&
+
+	test_create_repo server &&
+	mkdir server/dir &&
+	echo a >server/a &&
+	echo b >server/dir/b &&
+	echo c >server/dir/c &&
+	git -C server add a dir &&
+	git -C server commit -m x &&
+
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --bare --filter=blob:none "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client grep -e . HEAD -- dir >actual &&
+	test_line_count = 2 actual &&
+	grep "fetch> done" trace >done_lines &&
+	test_line_count = 1 done_lines &&
+	git -C client rev-list --objects --missing=print HEAD >missing &&
+	grep "^?$(git -C server rev-parse HEAD:a)" missing
+'
+
 test_done
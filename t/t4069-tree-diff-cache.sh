@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='reuse of tree diff results within a process'
+
+. ./test-lib.sh
+
+# Turn off any inherited trace2 settings for this test.
+sane_unset GIT_TRACE2 GIT_TRACE2_PERF GIT_TRACE2_EVENT
+sane_unset GIT_TRACE2_PERF_BRIEF
+sane_unset GIT_TRACE2_CONFIG_PARAMS
+
+test_expect_success 'setup' '
+	mkdir dir dir/sub &&
+	test_seq 1 20 >dir/file &&
+	test_seq 21 40 >dir/sub/file &&
+	echo top >top &&
+	git add . &&
+	git commit -m one &&
+	test_seq 1 21 >dir/file &&
+	echo changed >top &&
+	git commit -am two &&
+	git mv dir/sub/file dir/sub/moved &&
+	echo 41 >>dir/sub/moved &&
+	git commit -am three &&
+	git rev-list HEAD >commits
+'
+
+cached_hits () {
+	sed -n "s/.*| tree-diff .*| name:cache-hit value:\([0-9]*\)$/\1/p" trace.perf
+}
+
+test_expect_success 'diffing the same trees again reuses the result' '
+	cat commits commits commits >input &&
+	git -c core.treeDiffCacheLimit=0 diff-tree -r --stdin <input >expect &&
+	rm -f trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git diff-tree -r --stdin <input >actual &&
+	test_cmp expect actual &&
+	test "$(cached_hits)" = 4
+'
+
+test_expect_success 'results depend on the pathspec and tree options' '
+	cat commits commits >input &&
+	for args in "-r" "-r -t" "-r --find-copies-harder" ""
+	do
+		for path in "" dir/sub
+		do
+			git -c core.treeDiffCacheLimit=0 \
+				diff-tree $args --stdin $path <input >expect &&
+			git diff-tree $args --stdin $path <input >actual &&
+			test_cmp expect actual || return 1
+		done
+	done
+'
+
+test_expect_success 'log --follow sees the same renames' '
+	git -c core.treeDiffCacheLimit=0 log --follow --stat -- dir/sub/moved >expect &&
+	git log --follow --stat -- dir/sub/moved >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'results that do not fit are not kept' '
+	cat commits commits >input &&
+	git -c core.treeDiffCacheLimit=0 diff-tree -r --stdin <input >expect &&
+	rm -f trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c core.treeDiffCacheLimit=1 diff-tree -r --stdin <input >actual &&
+	test_cmp expect actual &&
+	test -z "$(cached_hits)"
+'
+
+test_done
@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='patches computed by several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 40)
+	do
+		test_seq $i 100 >file$i || return 1
+	done &&
+	printf "\0binary\0" >binary &&
+	test_seq 1 50 >text.conv &&
+	echo target >link-target &&
+	test_ln_s_add link-target link &&
+	echo "*.conv diff=upcase" >.gitattributes &&
+	git add . &&
+	git commit -m one &&
+
+	for i in $(test_seq 1 40 | sed -n "p;n")
+	do
+		test_seq 0 $i >>file$i || return 1
+	done &&
+	git mv file2 renamed2 &&
+	git rm -q file4 &&
+	chmod +x file6 &&
+	git update-index --chmod=+x file6 &&
+	printf "\0binary\0changed\0" >binary &&
+	test_seq 2 51 >text.conv &&
+	git rm -q --cached link &&
+	rm link &&
+	echo no-longer-a-link >link &&
+	git add . &&
+	git commit -m two
+'
+
+test_expect_success 'patches are the same with several threads' '
+	git config diff.upcase.textconv "tr a-z A-Z <" &&
+	for args in "-p" "-p -M --stat" "--word-diff" "--color -w" \
+		"--binary" "-R --function-context" "--no-textconv" \
+		"--relative=file" "-B -M" "--word-diff-regex=[0-9]+"
+	do
+		git -c diff.threads=1 diff $args HEAD^ HEAD >expect &&
+		git -c diff.threads=4 diff $args HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		git -c diff.threads=1 log -p $args >expect &&
+		git -c diff.threads=4 log -p $args >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'the threads compute the patches' '
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c diff.threads=4 diff HEAD^ HEAD >/dev/null &&
+	grep "patch-threads:4" trace.perf &&
+	grep "diff-patch.*thread_start" trace.perf &&
+	rm -f trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c diff.threads=4 diff --color-moved HEAD^ HEAD >/dev/null &&
+	! grep patch-threads trace.perf
+'
+
+test_expect_success 'external diff drivers are run in order' '
+	write_script ext-diff <<-\EOF &&
+	echo "external: $1"
+	EOF
+	git -c diff.threads=1 -c diff.external=./ext-diff \
+		diff --ext-diff HEAD^ HEAD >expect &&
+	git -c diff.threads=4 -c diff.external=./ext-diff \
+		diff --ext-diff HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	git -c diff.threads=4 -c diff.upcase.command=./ext-diff \
+		diff --ext-diff HEAD^ HEAD >actual &&
+	grep "^external: text.conv" actual &&
+	grep "^diff --git a/file1 " actual
+'
+
+
+test_expect_success 'setup octopus merge' '
+	for side in 1 2 3
+	do
+		git checkout -q -b side$side HEAD~$((side - 1)) &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq $i 100 | sed "${side}0s/\$/ side$side/" >file$i || return 1
+		done &&
+		printf "\0binary\0side$side\0" >binary &&
+		test_seq $side 52 >text.conv &&
+		git add file* binary text.conv &&
+		git commit -q -m side$side || return 1
+	done &&
+	for i in $(test_seq 1 40)
+	do
+		test_seq $i 100 | sed -e "10s/\$/ side1/" -e "30s/\$/ merged/" \
+			>file$i || return 1
+	done &&
+	printf "\0binary\0merged\0" >binary &&
+	test_seq 0 52 >text.conv &&
+	git add file* binary text.conv &&
+	tree=$(git write-tree) &&
+	merge=$(git commit-tree -p side1 -p side2 -p side3 -m octopus $tree) &&
+	git update-ref refs/heads/octopus $merge
+'
+
+test_expect_success 'combined patches are the same with several threads' '
+	for args in "-c" "--cc" "--cc --stat" "-c --color" "-c --no-textconv" \
+		"--cc -U1" "-c --combined-all-paths -M" "--cc -w"
+	do
+		git -c diff.threads=1 show $args octopus >expect &&
+		git -c diff.threads=4 show $args octopus >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c diff.threads=4 show --cc octopus >/dev/null &&
+	grep "combined-patch-threads:4" trace.perf &&
+	grep "combine-diff.*thread_start" trace.perf
+'
+
+test_done
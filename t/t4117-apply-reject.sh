@@ -116,4 +116,40 @@ test_expect_success 'apply cleanly with --verbose' '
 	test_cmp file1 clean
 '
 
+test_expect_success 'fragments applied on threads are reported in order' '
+	mkdir threads &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_write_lines a b c d e f g h i j >threads/$i || return 1
+	done &&
+	git add threads &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_write_lines a b c d "e$i" f g h i j >threads/$i || return 1
+	done &&
+	git diff threads >threads.patch &&
+	git checkout threads &&
+	test_write_lines a b c d x f g h i j >threads/3 &&
+	test_write_lines 0 a b c d e f g h i j >threads/5 &&
+	test_write_lines a B c d e f g h i j >threads/6 &&
+	rm threads/8 &&
+	cp -R threads threads.orig &&
+
+	test_must_fail env GIT_TEST_APPLY_THREADS=0 \
+		git apply -C2 threads.patch 2>expect &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/threads.event" \
+		GIT_TEST_APPLY_THREADS=2 git apply -C2 threads.patch 2>actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"threads\",\"value\":\"2\"" threads.event &&
+
+	GIT_TEST_APPLY_THREADS=0 git apply -C2 --exclude=threads/3 \
+		--exclude=threads/8 threads.patch 2>expect &&
+	mv threads expect.threads &&
+	cp -R threads.orig threads &&
+	GIT_TEST_APPLY_THREADS=2 git apply -C2 --exclude=threads/3 \
+		--exclude=threads/8 threads.patch 2>actual &&
+	test_cmp expect actual &&
+	diff -r expect.threads threads
+'
+
 test_done
@@ -1002,4 +1002,22 @@ test_expect_success '%(describe:exclude=...) vs git describe --exclude ...' '
 	test_cmp expect actual
 '
 
+test_expect_success 'placeholders that depend on the commit are not replayed blindly' '
+	test_when_finished "git update-ref -d refs/heads/no-author" &&
+	tree=$(git rev-parse HEAD^{tree}) &&
+	head=$(git rev-parse HEAD) &&
+	printf "tree %s\nparent %s\ncommitter C <c@example.com> 0 +0000\n\nno author\n" \
+		$tree $head >commit &&
+	bogus=$(git hash-object -t commit -w --literally commit) &&
+	git update-ref refs/heads/no-author $bogus &&
+	git log -1 --format="%aN|%s" $head >good &&
+	echo "%aN|no author" >expect &&
+	cat good >>expect &&
+	git log -2 --format="%aN|%s" no-author >actual &&
+	test_cmp expect actual &&
+	echo "%aN|no author" >>good &&
+	git log -2 --reverse --format="%aN|%s" no-author >actual &&
+	test_cmp good actual
+'
+
 test_done
@@ -223,4 +223,45 @@ test_expect_success 'log -S --pickaxe-regex looks into binary files' '
 	test_cmp log full-log
 '
 
+test_expect_success 'setup log -S with diff.pickaxeIndex' '
+	test_create_repo GS-index &&
+	test_commit -C GS-index --append A data.txt "needle one" &&
+	test_commit -C GS-index --append B other.txt "no match here" &&
+	test_commit -C GS-index --append C data.txt "Needle two" &&
+	test_commit -C GS-index D data.txt "" &&
+	for needle in needle Needle "needle one" haystack
+	do
+		git -C GS-index log -S"$needle" --format=%s --stat &&
+		git -C GS-index log -i -S"$needle" --format=%s --stat ||
+		return 1
+	done >expect-index
+'
+
+test_expect_success 'log -S with diff.pickaxeIndex' '
+	for needle in needle Needle "needle one" haystack
+	do
+		git -C GS-index -c diff.pickaxeIndex=true \
+			log -S"$needle" --format=%s --stat &&
+		git -C GS-index -c diff.pickaxeIndex=true \
+			log -i -S"$needle" --format=%s --stat ||
+		return 1
+	done >actual &&
+	test_path_is_file GS-index/.git/objects/info/pickaxe-index &&
+	test_cmp expect-index actual
+'
+
+test_expect_success 'log -S uses an existing pickaxe index' '
+	cp GS-index/.git/objects/info/pickaxe-index index.before &&
+	for needle in needle Needle "needle one" haystack
+	do
+		git -C GS-index -c diff.pickaxeIndex=true \
+			log -S"$needle" --format=%s --stat &&
+		git -C GS-index -c diff.pickaxeIndex=true \
+			log -i -S"$needle" --format=%s --stat ||
+		return 1
+	done >actual &&
+	test_cmp expect-index actual &&
+	test_cmp_bin index.before GS-index/.git/objects/info/pickaxe-index
+'
+
 test_done
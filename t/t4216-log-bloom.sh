@@ -120,8 +120,13 @@ test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
 	test_bloom_filters_not_used "--walk-reflogs -- A"
 '
 
-test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
-	test_bloom_filters_not_used "-- file4 A/file1"
+test_expect_success 'git log -- multiple path specs uses Bloom filters' '
+	test_bloom_filters_used "-- file4 A/file1" &&
+	test_bloom_filters_used "-- A/B/file2 A/B/C/file3 file5"
+'
+
+test_expect_success 'git log -- multiple path specs including "." does not use Bloom filters' '
+	test_bloom_filters_not_used "-- file4 ."
 '
 
 test_expect_success 'git log -- "." pathspec at root does not use Bloom filters' '
@@ -133,9 +138,21 @@ test_expect_success 'git log with wildcard that resolves to a single path uses B
 	test_bloom_filters_used "-- *renamed"
 '
 
-test_expect_success 'git log with wildcard that resolves to a multiple paths does not uses Bloom filters' '
-	test_bloom_filters_not_used "-- *" &&
-	test_bloom_filters_not_used "-- file*"
+test_expect_success 'git log with wildcard that resolves to a multiple paths uses Bloom filters' '
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- file*"
+'
+
+test_expect_success 'git log with wildcard below a literal directory uses Bloom filters' '
+	test_bloom_filters_used "-- :(glob)A/**/file*" &&
+	test_bloom_filters_used "-- :(glob)A/B/*" &&
+	test_bloom_filters_used "-- :(glob)A/B/**/file3 file4"
+'
+
+test_expect_success 'git log with wildcard in the leading directory does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(glob)**/file3" &&
+	test_bloom_filters_not_used "-- :(glob)A*/file1" &&
+	test_bloom_filters_not_used "-- :(glob)*/file1 file4"
 '
 
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
@@ -405,4 +422,121 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+test_expect_success 'git log -L uses Bloom filters' '
+	for range in 1,1:A/file1 1,1:A/B/C/file3 1,1:file4
+	do
+		rm -f trace.perf &&
+		git -c core.commitGraph=false log -L$range >expect &&
+		GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+			git -c core.commitGraph=true log -L$range >actual &&
+		test_cmp expect actual &&
+		grep "line-log/statistics:{\"filter_not_present\":0,\"maybe\":[1-9][0-9]*,\"definitely_not\":[1-9]" trace.perf ||
+		return 1
+	done
+'
+
+test_expect_success PTHREADS 'Bloom filters computed in parallel match serial ones' '
+	git init parallel &&
+	(
+		cd parallel &&
+		for i in $(test_seq 1 20)
+		do
+			mkdir -p dir$i &&
+			echo $i >dir$i/file &&
+			git add dir$i &&
+			git commit -m "$i" || return 1
+		done &&
+
+		git -c commitGraph.threads=1 commit-graph write --reachable \
+			--changed-paths &&
+		mv .git/objects/info/commit-graph serial.graph &&
+
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c commitGraph.threads=4 commit-graph write \
+				--reachable --changed-paths &&
+		grep "\"key\":\"bloom/threads\",\"value\":\"4\"" trace.event &&
+		test_filter_computed 20 trace.event &&
+		test_cmp_bin serial.graph .git/objects/info/commit-graph
+	)
+'
+
+test_expect_success 'setup - history with merges touching other parents' '
+	git init merges &&
+	(
+		cd merges &&
+		mkdir A B &&
+		test_commit base A/file &&
+		for i in $(test_seq 1 6)
+		do
+			git checkout -b side$i main &&
+			test_commit side$i-a B/file$i &&
+			test_commit side$i-b A/side$i &&
+			git checkout main &&
+			test_commit main$i A/file &&
+			git merge -m "merge $i" side$i || return 1
+		done &&
+		git checkout -b octo1 main &&
+		test_commit octo1 B/octo1 &&
+		git checkout -b octo2 main &&
+		test_commit octo2 A/octo2 &&
+		git checkout main &&
+		test_commit main7 A/file &&
+		git merge -m "octopus" octo1 octo2
+	)
+'
+
+test_expect_success 'commit-graph write --merge-changed-paths' '
+	(
+		cd merges &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git commit-graph write --reachable --merge-changed-paths &&
+		grep "\"key\":\"merge-filter-computed\",\"value\":\"7\"" trace.event &&
+		test-tool read-graph >graph &&
+		grep "bloom_data bloom_merge_indexes bloom_merge_data" graph &&
+
+		# the filters are kept by later writes...
+		git commit-graph write --reachable &&
+		test-tool read-graph >graph &&
+		grep "bloom_merge_data" graph &&
+
+		# ...unless asked otherwise
+		git commit-graph write --reachable --no-merge-changed-paths &&
+		test-tool read-graph >graph &&
+		grep "bloom_data" graph &&
+		! grep "bloom_merge" graph &&
+		test_must_fail git commit-graph write --reachable \
+			--merge-changed-paths --no-changed-paths
+	)
+'
+
+test_expect_success 'git log --full-history uses the filters of merges' '
+	(
+		cd merges &&
+		git commit-graph write --reachable --changed-paths \
+			--merge-changed-paths &&
+		for path in A A/file A/side3 B/file2 C
+		do
+			for opts in "--full-history" "" "--full-history --simplify-merges"
+			do
+				git -c core.commitGraph=false log --format=%s $opts \
+					-- $path >expect &&
+				rm -f trace.perf &&
+				GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+					git log --format=%s $opts -- $path >actual &&
+				test_cmp expect actual || return 1
+			done
+		done &&
+		grep "merge_statistics:{\"maybe\":[0-9]*,\"definitely_not\":[1-9]" trace.perf &&
+
+		git commit-graph write --reachable --no-merge-changed-paths &&
+		rm -f trace.perf &&
+		GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+			git log --full-history --format=%s -- C >actual &&
+		test_cmp expect actual &&
+		! grep merge_statistics trace.perf
+	)
+'
+
 test_done
@@ -0,0 +1,167 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 >numbers &&
+	echo hello >greeting &&
+	echo foo >whatever &&
+	git add numbers greeting whatever &&
+	test_tick &&
+	git commit -m initial &&
+	git tag initial &&
+
+	git branch side1 &&
+	git branch side2 &&
+	git branch side3 &&
+
+	git checkout side1 &&
+	test_write_lines 1 2 3 4 5 6 >numbers &&
+	echo hi >greeting &&
+	echo bar >whatever &&
+	git add numbers greeting whatever &&
+	test_tick &&
+	git commit -m modify-stuff &&
+
+	git checkout side2 &&
+	test_write_lines 0 1 2 3 4 5 >numbers &&
+	echo yo >greeting &&
+	git rm whatever &&
+	mkdir whatever &&
+	>whatever/empty &&
+	git add numbers greeting whatever/empty &&
+	test_tick &&
+	git commit -m other-modifications &&
+
+	git checkout side3 &&
+	git mv numbers sequence &&
+	test_tick &&
+	git commit -m rename-numbers &&
+
+	git switch --orphan unrelated &&
+	>something-else &&
+	git add something-else &&
+	test_tick &&
+	git commit -m first-commit
+'
+
+test_expect_success 'clean merge' '
+	TREE_OID=$(git merge-tree --write-tree side1 side3) &&
+	q_to_tab <<-EOF >expect &&
+	100644 blob $(git rev-parse side1:greeting)Qgreeting
+	100644 blob $(git rev-parse side1:numbers)Qsequence
+	100644 blob $(git rev-parse side1:whatever)Qwhatever
+	EOF
+
+	git ls-tree $TREE_OID >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'two arguments default to --write-tree' '
+	git merge-tree --write-tree side1 side3 >expect &&
+	git merge-tree side1 side3 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'content merge and a few conflicts' '
+	test_expect_code 1 git merge-tree --write-tree side1 side2 >out &&
+
+	sed -e 1d -e "/^\$/,\$d" out >actual &&
+	q_to_tab <<-EOF >expect &&
+	100644 $(git rev-parse initial:greeting) 1Qgreeting
+	100644 $(git rev-parse side1:greeting) 2Qgreeting
+	100644 $(git rev-parse side2:greeting) 3Qgreeting
+	100644 $(git rev-parse initial:whatever) 1Qwhatever~side1
+	100644 $(git rev-parse side1:whatever) 2Qwhatever~side1
+	EOF
+	test_cmp expect actual &&
+
+	sed -e "1,/^\$/d" out >messages &&
+	grep "Auto-merging numbers" messages &&
+	grep "CONFLICT (content): Merge conflict in greeting" messages &&
+	grep "CONFLICT (modify/delete)" messages &&
+
+	tree=$(head -n 1 out) &&
+	git cat-file -p $tree:numbers >numbers &&
+	test_write_lines 0 1 2 3 4 5 6 >expect &&
+	test_cmp expect numbers &&
+	git cat-file -p $tree:greeting >greeting &&
+	grep "^<<<<<<< side1" greeting &&
+	grep "^>>>>>>> side2" greeting
+'
+
+test_expect_success '--name-only lists each conflicted path once' '
+	test_expect_code 1 git merge-tree --write-tree --name-only side1 side2 >out &&
+	sed -e 1d -e "/^\$/,\$d" out >actual &&
+	test_write_lines greeting whatever~side1 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '--no-messages omits the messages' '
+	test_expect_code 1 git merge-tree --write-tree --no-messages side1 side2 >out &&
+	! grep Auto-merging out &&
+	test_line_count = 6 out
+'
+
+test_expect_success '--messages shows the messages of a clean merge' '
+	git merge-tree --write-tree side1 side3 >out &&
+	test_line_count = 1 out &&
+	git merge-tree --write-tree --messages side1 side3 >out &&
+	test_line_count -gt 1 out
+'
+
+test_expect_success '-z separates paths with NUL' '
+	test_expect_code 1 git merge-tree --write-tree -z --name-only side1 side2 >out &&
+	tree=$(git merge-tree --write-tree side1 side2 | head -n 1) &&
+	printf "%s\0greeting\0whatever~side1\0\0" $tree >expect &&
+	test_copy_bytes $(wc -c <expect) <out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'merge-tree works in a bare repository' '
+	git clone --bare . bare.git &&
+	git -C bare.git merge-tree --write-tree side1 side3 >actual &&
+	git merge-tree --write-tree side1 side3 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unrelated histories are refused unless allowed' '
+	test_must_fail git merge-tree --write-tree side1 unrelated 2>err &&
+	grep "refusing to merge unrelated histories" err &&
+
+	TREE=$(git merge-tree --write-tree --allow-unrelated-histories side1 unrelated) &&
+	git ls-tree --name-only $TREE >actual &&
+	test_write_lines greeting numbers something-else whatever >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '--trivial-merge is incompatible with other options' '
+	test_must_fail git merge-tree --trivial-merge --messages initial side1 side2 2>err &&
+	grep "incompatible" err
+'
+
+test_expect_success '--stdin performs several merges' '
+	printf "side1 side3\nside1 side2\nside1 side3\n" >input &&
+	git merge-tree --stdin <input >out &&
+
+	clean=$(git merge-tree --write-tree side1 side3) &&
+	conflicted=$(git merge-tree --write-tree side1 side2 | head -n 1) &&
+	tr "\000" "\n" <out >actual.lines &&
+	printf "1\n%s\n\n" $clean >expect.clean &&
+	head -n 3 actual.lines >actual &&
+	test_cmp expect.clean actual &&
+	sed -n -e 4p -e 5p actual.lines >actual &&
+	printf "0\n%s\n" $conflicted >expect &&
+	test_cmp expect actual &&
+	tail -n 3 actual.lines >actual &&
+	test_cmp expect.clean actual
+'
+
+test_expect_success '--stdin rejects malformed lines' '
+	echo "side1" | test_must_fail git merge-tree --stdin 2>err &&
+	grep "malformed input line" err
+'
+
+test_done
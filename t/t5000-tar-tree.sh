@@ -363,6 +363,25 @@ test_expect_success GZIP 'extract tgz file' '
 	test_cmp_bin b.tar j.tar
 '
 
+test_expect_success GZIP 'internal gzip output does not depend on tar.threads' '
+	git init big &&
+	test-tool genrandom big 3000000 >big/file &&
+	git -C big add file &&
+	git -C big commit -m big &&
+	git -C big archive --format=tar HEAD >big.tar &&
+	git -C big -c tar.threads=1 archive --format=tgz HEAD >big1.tgz &&
+	git -C big -c tar.threads=3 archive --format=tgz HEAD >big3.tgz &&
+	test_cmp_bin big1.tgz big3.tgz &&
+	gzip -d -c <big3.tgz >big3.tar &&
+	test_cmp_bin big.tar big3.tar
+'
+
+test_expect_success GZIP 'external gzip can still be configured' '
+	git -c tar.tgz.command="gzip -cn" archive --format=tgz HEAD >k.tgz &&
+	gzip -d -c <k.tgz >k.tar &&
+	test_cmp_bin b.tar k.tar
+'
+
 test_expect_success GZIP 'remote tar.gz is allowed by default' '
 	git archive --remote=. --format=tar.gz HEAD >remote.tar.gz &&
 	test_cmp_bin j.tgz remote.tar.gz
@@ -388,6 +407,58 @@ test_expect_success 'catch non-matching pathspec' '
 	test_must_fail git archive -v HEAD -- "*.abc" >/dev/null
 '
 
+test_expect_success 'archive.cache stores and serves archives' '
+	test_when_finished "rm -rf .git/archive-cache" &&
+	git archive HEAD -- a/bin >expect.tar &&
+	test_config archive.cache true &&
+	git archive HEAD -- a/bin >first.tar &&
+	test_cmp expect.tar first.tar &&
+	ls .git/archive-cache >cached &&
+	test_line_count = 1 cached &&
+	test_cmp expect.tar .git/archive-cache/$(cat cached) &&
+	echo marker >.git/archive-cache/$(cat cached) &&
+	git archive HEAD -- a/bin >second.tar &&
+	echo marker >expect &&
+	test_cmp expect second.tar &&
+	git archive --remote=. HEAD -- a/bin >remote.tar &&
+	test_cmp expect remote.tar &&
+	git archive --prefix=other/ HEAD -- a/bin >/dev/null &&
+	ls .git/archive-cache >cached &&
+	test_line_count = 2 cached
+'
+
+test_expect_success 'archive.cache notices attributes outside the tree' '
+	test_when_finished "rm -rf .git/archive-cache global-attributes" &&
+	test_config archive.cache true &&
+	test_config core.attributesFile "$(pwd)/global-attributes" &&
+	git archive HEAD -- a/bin >first.tar &&
+	echo "a/bin/* export-ignore" >global-attributes &&
+	git archive HEAD -- a/bin >second.tar &&
+	! test_cmp first.tar second.tar &&
+	ls .git/archive-cache >cached &&
+	test_line_count = 2 cached
+'
+
+test_expect_success 'archive.cache does not keep substituted archives' '
+	test_when_finished "rm -rf .git/archive-cache" &&
+	git -c archive.cache=true archive HEAD >/dev/null &&
+	ls .git/archive-cache >cached &&
+	test_must_be_empty cached
+'
+
+test_expect_success 'archive.cacheLimit drops the oldest archives' '
+	test_when_finished "rm -rf .git/archive-cache" &&
+	git -c archive.cache=true archive HEAD -- a/bin >/dev/null &&
+	old=$(ls .git/archive-cache) &&
+	test-tool chmtime -3600 .git/archive-cache/$old &&
+	size=$(test_file_size .git/archive-cache/$old) &&
+	git -c archive.cache=true -c archive.cacheLimit=$(($size + 1)) \
+		archive --prefix=new/ HEAD -- a/bin >/dev/null &&
+	ls .git/archive-cache >cached &&
+	test_line_count = 1 cached &&
+	! grep $old cached
+'
+
 # Pull the size and date of each entry in a tarfile using the system tar.
 #
 # We'll pull out only the year from the date; that avoids any question of
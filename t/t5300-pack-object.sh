@@ -340,6 +340,24 @@ test_expect_success \
 
      :'
 
+test_expect_success 'index-pack checks the end of a pack on disk' '
+	test-tool genrandom big 3000000 >big &&
+	blob=$(git hash-object -w big) &&
+	echo $blob | git pack-objects --stdout >big.pack &&
+	git index-pack --stdin -o stdin.idx <big.pack &&
+	git index-pack -o file.idx big.pack &&
+	test_cmp stdin.idx file.idx &&
+
+	cp big.pack padded.pack &&
+	echo junk >>padded.pack &&
+	test_must_fail git index-pack -o padded.idx padded.pack 2>err &&
+	test_i18ngrep "junk at the end" err &&
+
+	size=$(test_file_size big.pack) &&
+	test_copy_bytes $(($size - 100)) <big.pack >truncated.pack &&
+	test_must_fail git index-pack -o truncated.idx truncated.pack
+'
+
 test_expect_success 'unpacking with --strict' '
 
 	for j in a b c d e f g
@@ -518,6 +536,18 @@ test_expect_success 'pack-objects in too-many-packs mode' '
 	git fsck
 '
 
+test_expect_success !MINGW 'pack-objects with cold fields in a file' '
+	git pack-objects --stdout --all </dev/null >expect.pack &&
+	git -c pack.spillColdFields=true \
+		pack-objects --stdout --all </dev/null >actual.pack 2>err &&
+	test_must_be_empty err &&
+	test_cmp expect.pack actual.pack &&
+	git -c pack.spillColdFields=true repack -adf &&
+	git fsck &&
+	ls .git/objects/pack >files &&
+	! grep tmp_cold files
+'
+
 test_expect_success 'setup: fake a SHA1 hash collision' '
 	git init corrupt &&
 	(
@@ -722,4 +752,162 @@ test_expect_success 'negative window clamps to 0' '
 	check_deltas stderr = 0
 '
 
+test_expect_success 'pack-objects records and reuses delta decisions' '
+	test_when_finished "rm -fr decisions" &&
+	git init decisions &&
+	(
+		cd decisions &&
+		for i in 1 2 3 4
+		do
+			test_seq 1000 >file &&
+			echo $i >>file &&
+			git add file &&
+			git commit -m $i || return 1
+		done &&
+
+		git repack -adf --window=10 &&
+		test_path_is_missing .git/objects/info/delta-decisions &&
+
+		git -c pack.deltaDecisions=true repack -adf &&
+		test_path_is_file .git/objects/info/delta-decisions &&
+		git verify-pack -v .git/objects/pack/*.idx >before &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c pack.deltaDecisions=true repack -adf &&
+		grep "\"delta_decisions_hits\",\"value\":\"[1-9]" trace &&
+		git verify-pack -v .git/objects/pack/*.idx >after &&
+		grep "^chain length" before >expect &&
+		grep "^chain length" after >actual &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_expect_success 'delta decisions are ignored when islands change' '
+	test_when_finished "rm -fr decisions" &&
+	git init decisions &&
+	(
+		cd decisions &&
+		for i in 1 2 3
+		do
+			test_seq 1000 >file &&
+			echo $i >>file &&
+			git add file &&
+			git commit -m $i || return 1
+		done &&
+		git -c pack.deltaDecisions=true repack -adf &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c pack.deltaDecisions=true \
+			    -c pack.island="refs/heads/(.*)" repack -adfi &&
+		grep "\"delta_decisions_hits\",\"value\":\"0\"" trace
+	)
+'
+
+test_expect_success 'delta decisions with a bad checksum are ignored' '
+	test_when_finished "rm -fr decisions" &&
+	git init decisions &&
+	(
+		cd decisions &&
+		for i in 1 2 3
+		do
+			test_seq 1000 >file &&
+			echo $i >>file &&
+			git add file &&
+			git commit -m $i || return 1
+		done &&
+		git -c pack.deltaDecisions=true repack -adf &&
+
+		# Damage the base of the last record, just before the trailer.
+		file=.git/objects/info/delta-decisions &&
+		size=$(wc -c <$file) &&
+		printf "\377" |
+		dd of=$file bs=1 conv=notrunc seek=$(($size - $(test_oid rawsz) - 1)) &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c pack.deltaDecisions=true repack -adf 2>err &&
+		grep "bad checksum" err &&
+		grep "\"delta_decisions_hits\",\"value\":\"0\"" trace &&
+		git fsck
+	)
+'
+
+test_expect_success PTHREADS 'pack-objects deflates ahead of the writer' '
+	git pack-objects --threads=1 --window=0 --no-reuse-object \
+		--stdout <obj-list >single.pack &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git pack-objects --threads=4 --window=0 --no-reuse-object \
+		--stdout <obj-list >threaded.pack &&
+	grep "\"write_ahead_deflated\",\"value\":\"[1-9]" trace &&
+	test_cmp single.pack threaded.pack &&
+
+	git pack-objects --threads=4 --no-reuse-object \
+		--stdout <obj-list >threaded.pack &&
+	git index-pack -o threaded.idx threaded.pack &&
+	git verify-pack threaded.idx
+'
+
+test_expect_success 'pack-objects --access-profile lays out accessed objects first' '
+	git init access-profile &&
+	(
+		cd access-profile &&
+		for i in 1 2 3 4 5
+		do
+			echo "content $i" >file$i &&
+			git add file$i &&
+			git commit -m $i || return 1
+		done &&
+		git repack -adq &&
+
+		git rev-parse HEAD:file2 HEAD:file4 >profile &&
+		pack=$(git rev-list --objects --all |
+			git pack-objects --access-profile=profile test) &&
+		git show-index <test-$pack.idx | sort -n >index &&
+		head -n 2 index | cut -d" " -f2 >actual &&
+		test_cmp profile actual &&
+
+		git rev-parse HEAD:file5 >expect &&
+		GIT_TRACE_PACK_ACCESS="$(pwd)/access" \
+			git cat-file blob $(cat expect) &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git repack -adq --access-profile=access &&
+		grep "\"access_profile_objects\",\"value\":\"1\"" trace &&
+		idx=$(ls .git/objects/pack/pack-*.idx) &&
+		git show-index <$idx | sort -n >index &&
+		head -n 1 index | cut -d" " -f2 >actual &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_expect_success 'index-pack --fix-thin reads the local bases ahead' '
+	git init fix-thin &&
+	(
+		cd fix-thin &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			test_seq ${i}000 ${i}100 >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			echo more >>file$i || return 1
+		done &&
+		git commit -am more &&
+		git repack -adq &&
+
+		printf "HEAD\n^HEAD^\n" |
+			git pack-objects --revs --thin --stdout >thin.pack &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git index-pack --threads=4 --stdin --fix-thin \
+			threaded.pack <thin.pack &&
+		grep "\"thin_bases\",\"value\":\"8\"" trace &&
+		git index-pack --threads=1 --stdin --fix-thin \
+			single.pack <thin.pack &&
+		test_cmp single.pack threaded.pack &&
+		git verify-pack threaded.idx
+	)
+'
+
 test_done
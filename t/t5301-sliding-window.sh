@@ -57,4 +57,17 @@ test_expect_success \
      git config --unset core.packedGitLimit &&
      git verify-pack -v "$pack2"'
 
+test_expect_success 'fsck and cat-file, packedGitMapWhole' '
+	git -c core.packedGitMapWhole=true \
+		-c core.packedGitWindowSize=512 -c core.packedGitLimit=512 \
+		fsck --full --strict &&
+	for i in a b c d
+	do
+		git -c core.packedGitMapWhole=true \
+			-c core.packedGitWindowSize=512 \
+			cat-file blob HEAD:$i >actual &&
+		test_cmp $i actual || return 1
+	done
+'
+
 test_done
@@ -309,6 +309,23 @@ test_expect_success 'prune: handle expire option correctly' '
 	git prune --no-expire
 '
 
+test_expect_success 'prune --threads reports and removes the same objects' '
+	for i in $(test_seq 1 40)
+	do
+		echo "unreachable $i" | git hash-object -w --stdin || return 1
+	done >unreachable &&
+	git prune -n -v --threads=1 >expect &&
+	test_line_count = 40 expect &&
+	git prune -n -v --threads=4 >actual &&
+	test_cmp expect actual &&
+	git prune -v --threads=4 >actual &&
+	test_cmp expect actual &&
+	while read oid
+	do
+		test_must_fail git cat-file -e $oid || return 1
+	done <unreachable
+'
+
 test_expect_success 'trivial prune with bitmaps enabled' '
 	git repack -adb &&
 	blob=$(echo bitmap-unreachable-blob | git hash-object -w --stdin) &&
@@ -193,6 +193,57 @@ rev_list_tests () {
 
 rev_list_tests 'full bitmap'
 
+test_expect_success 'bitmaps with a lookup table give the same answers' '
+	test-tool bitmap list-commits | sort >expect &&
+	git rev-list --use-bitmap-index --count --all >expect.count &&
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	test-tool bitmap list-commits | sort >actual &&
+	test_cmp expect actual &&
+	git rev-list --use-bitmap-index --count --all >actual.count &&
+	test_cmp expect.count actual.count &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err
+'
+
+test_expect_success 'pseudo-merge bitmaps give the same answers' '
+	git rev-list --all >commits &&
+	awk "NR % 3 == 2 { print \"create refs/pseudo/\" NR \" \" \$1 }" \
+		<commits >input &&
+	git update-ref --stdin <input &&
+	git rev-list --objects --all >expect.objects &&
+	git -c pack.bitmapPseudoMergeTips=refs/pseudo/ \
+		-c pack.bitmapPseudoMergeSize=8 repack -adb &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --use-bitmap-index --objects --all >actual.objects &&
+	grep "\"key\":\"pseudo_merges_applied\",\"value\":\"[1-9]" trace &&
+	cut -d" " -f1 expect.objects | sort >expect &&
+	cut -d" " -f1 actual.objects | sort >actual &&
+	test_cmp expect actual &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err &&
+	git for-each-ref --format="delete %(refname)" refs/pseudo/ >input &&
+	git update-ref --stdin <input
+'
+
+test_expect_success 'bitmaps with commit stats give the same answers' '
+	commit=$(test-tool bitmap list-commits | head -n 1) &&
+	git rev-list --count $commit >expect &&
+	git rev-list --count --objects $commit >>expect &&
+	git rev-list --disk-usage $commit >>expect &&
+	git rev-list --disk-usage --objects $commit >>expect &&
+	rm -f .git/objects/pack/*.bitmap &&
+	git -c pack.writeBitmapCommitStats=true repack -adb &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --use-bitmap-index --count $commit >actual &&
+	grep "\"key\":\"result\",\"value\":\"from commit stats\"" trace &&
+	git rev-list --use-bitmap-index --count --objects $commit >>actual &&
+	git rev-list --use-bitmap-index --disk-usage $commit >>actual &&
+	git rev-list --use-bitmap-index --disk-usage --objects $commit >>actual &&
+	test_cmp expect actual &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err
+'
+
 test_expect_success 'clone from bitmapped repository' '
 	git clone --no-local --bare . clone.git &&
 	git rev-parse HEAD >expect &&
@@ -615,4 +666,85 @@ test_expect_success 'pack.preferBitmapTips' '
 	)
 '
 
+test_expect_success 'upload-pack negotiates with bitmaps' '
+	git init negotiation-server &&
+	test_commit -C negotiation-server base &&
+	for bitmaps in true false
+	do
+		git clone --no-local negotiation-server client-$bitmaps &&
+		test_commit_bulk -C client-$bitmaps --id=client 40 || return 1
+	done &&
+	test_commit_bulk -C negotiation-server --id=server 20 &&
+	git -C negotiation-server repack -adb &&
+	git -C negotiation-server rev-parse HEAD >expect &&
+
+	for bitmaps in true false
+	do
+		git -C negotiation-server config uploadpack.negotiationBitmaps $bitmaps &&
+		GIT_TRACE2_EVENT="$(pwd)/trace-$bitmaps" \
+		git -C client-$bitmaps fetch origin HEAD:refs/remotes/new &&
+		git -C client-$bitmaps rev-parse refs/remotes/new >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	grep "\"key\":\"negotiation\",\"value\":\"bitmap\"" trace-true &&
+	! grep "\"key\":\"negotiation\",\"value\":\"walk\"" trace-true &&
+	grep "\"key\":\"negotiation\",\"value\":\"walk\"" trace-false
+'
+
+test_expect_success 'pack-objects run in-process takes over the bitmaps' '
+	git clone --no-local negotiation-server client-in-process &&
+	test_commit_bulk -C client-in-process --id=client 40 &&
+	test_commit_bulk -C negotiation-server --id=more 5 &&
+	git -C negotiation-server repack -adb &&
+	git -C negotiation-server rev-parse HEAD >expect &&
+	git -C negotiation-server config uploadpack.negotiationBitmaps true &&
+	git -C negotiation-server config uploadpack.packObjectsInProcess true &&
+	GIT_TRACE2_EVENT="$(pwd)/trace-in-process" \
+	git -C client-in-process fetch origin HEAD:refs/remotes/new &&
+	git -C client-in-process rev-parse refs/remotes/new >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"negotiation\",\"value\":\"bitmap\"" trace-in-process &&
+	grep "\"key\":\"index\",\"value\":\"spare\"" trace-in-process &&
+	! grep "\"event\":\"start\".*\"pack-objects\"" trace-in-process
+'
+
+test_expect_success 'connectivity checks use bitmaps' '
+	git init connectivity-dst &&
+	test_commit -C connectivity-dst base &&
+	git -C connectivity-dst repack -adb &&
+	git clone --no-local connectivity-dst connectivity-src &&
+	test_commit -C connectivity-src fetched &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+	git -C connectivity-dst fetch ../connectivity-src HEAD:refs/heads/fetched &&
+	grep "\"key\":\"bitmap/walked\"" trace &&
+	! grep "\"argv\":\[\"git\",\"rev-list\"" trace &&
+
+	test_commit -C connectivity-src pushed &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+	git -C connectivity-src push ../connectivity-dst HEAD:refs/heads/pushed &&
+	grep "\"key\":\"bitmap/walked\"" trace &&
+	! grep "\"argv\":\[\"git\",\"rev-list\"" trace &&
+	git -C connectivity-dst fsck
+'
+
+test_expect_success 'connectivity check falls back to rev-list on missing objects' '
+	echo unique >connectivity-src/unique &&
+	blob=$(git -C connectivity-src hash-object -w unique) &&
+	tree=$(printf "100644 blob $blob\tunique\n" | git -C connectivity-src mktree) &&
+	commit=$(git -C connectivity-src commit-tree -m broken $tree) &&
+	git -C connectivity-src update-ref refs/heads/broken $commit &&
+
+	# the commit made it over, but not the tree it points to
+	git -C connectivity-src cat-file commit $commit |
+	git -C connectivity-dst hash-object -w -t commit --stdin &&
+
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+	git -C connectivity-dst fetch ../connectivity-src refs/heads/broken:refs/heads/broken &&
+	grep "\"argv\":\[\"git\",\"rev-list\"" trace &&
+	git -C connectivity-dst cat-file -e $blob
+'
+
 test_done
@@ -109,4 +109,12 @@ test_expect_success 'negative depth disables deltas' '
 	test_cmp expect actual
 '
 
+test_expect_success 'delta base cache reports statistics via trace2' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git cat-file --batch-all-objects --batch >/dev/null &&
+	grep "\"category\":\"delta_base_cache\",\"key\":\"statistics\"" trace.event >stats &&
+	grep "\"hits\":[1-9]" stats &&
+	grep "\"misses\":[1-9]" stats
+'
+
 test_done
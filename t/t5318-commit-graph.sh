@@ -663,6 +663,25 @@ test_expect_success 'detect incorrect parent for octopus merge' '
 		"invalid parent"
 '
 
+test_expect_success 'verify reads the commits with several threads' '
+	corrupt_graph_setup &&
+	printf "\01" |
+	dd of="$objdir/info/commit-graph" bs=1 conv=notrunc \
+		seek="$GRAPH_BYTE_COMMIT_TREE" &&
+	printf "\01" |
+	dd of="$objdir/info/commit-graph" bs=1 conv=notrunc \
+		seek="$GRAPH_BYTE_COMMIT_DATE" &&
+	test_must_fail git -c commitGraph.threads=1 commit-graph verify \
+		2>expect &&
+	test_i18ngrep "root tree OID for commit" expect &&
+	test_i18ngrep "commit date" expect &&
+	rm -f trace.event &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c commitGraph.threads=4 commit-graph verify 2>actual &&
+	grep "\"key\":\"verify/threads\",\"value\":\"4\"" trace.event &&
+	test_cmp expect actual
+'
+
 test_expect_success 'detect invalid checksum hash' '
 	corrupt_graph_and_verify $GRAPH_BYTE_FOOTER "\00" \
 		"incorrect checksum"
@@ -815,4 +834,32 @@ test_expect_success 'set up and verify repo with generation data overflow chunk'
 
 graph_git_behavior 'generation data overflow chunk repo' repo left right
 
+test_expect_success 'commit metadata chunk' '
+	cd "$TRASH_DIRECTORY" &&
+	git init metadata &&
+	(
+		cd metadata &&
+		test_commit one &&
+		test_commit --author "Some One <one@example.com>" two &&
+		test_commit three &&
+		git commit --allow-empty -m "multi-line
+subject
+
+and a body" &&
+		git -c i18n.commitEncoding=ISO-8859-1 commit --allow-empty \
+			-m "$(printf "caf\351")" &&
+		git commit-graph write --reachable --commit-metadata &&
+		graph_read_expect 5 "generation_data metadata metadata_strings" &&
+		for fmt in "%an <%ae> %ad %s" "%cn %cE %ci %cr %aN %ar %e" \
+			   "%al %at %cs %s%n%b"
+		do
+			graph_git_two_modes "log --format=\"$fmt\"" || return 1
+		done &&
+		git commit-graph write --reachable &&
+		graph_read_expect 5 "generation_data metadata metadata_strings" &&
+		git commit-graph write --reachable --no-commit-metadata &&
+		graph_read_expect 5 generation_data
+	)
+'
+
 test_done
@@ -201,6 +201,24 @@ test_expect_success 'write midx with twelve packs' '
 
 compare_results_with_midx "twelve packs"
 
+test_expect_success 'write midx with an object filter' '
+	git -c pack.writeObjectFilter=true \
+		multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 12 74 5 $objdir " object-filter" &&
+	git multi-pack-index --object-dir=$objdir verify &&
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >present &&
+	git cat-file --batch-check <present >actual &&
+	! grep missing actual &&
+	test_must_fail git cat-file -e $(test_oid deadbeef)
+'
+
+compare_results_with_midx "twelve packs with an object filter"
+
+test_expect_success 'write midx without an object filter' '
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 12 74 4 $objdir
+'
+
 test_expect_success 'warn on improper hash version' '
 	git init --object-format=sha1 sha1 &&
 	(
@@ -837,6 +855,134 @@ test_expect_success 'load reverse index when missing .idx, .pack' '
 	)
 '
 
+test_expect_success 'incremental write creates a chain' '
+	git init chain &&
+	(
+		cd chain &&
+		git config core.multiPackIndex true &&
+		test_commit_bulk --id=base 50 &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing $objdir/pack/multi-pack-index &&
+		test_line_count = 1 $objdir/pack/multi-pack-index.d/multi-pack-index-chain &&
+
+		test_commit one &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $objdir/pack/multi-pack-index.d/multi-pack-index-chain &&
+		ls $objdir/pack/multi-pack-index.d/*.midx >layers &&
+		test_line_count = 2 layers &&
+
+		git multi-pack-index verify &&
+		git count-objects -v >out &&
+		grep "^garbage: 0" out &&
+		git fsck
+	)
+'
+
+test_expect_success 'small layers are merged' '
+	(
+		cd chain &&
+		head -n 1 $objdir/pack/multi-pack-index.d/multi-pack-index-chain >base &&
+		test_commit two &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $objdir/pack/multi-pack-index.d/multi-pack-index-chain &&
+		head -n 1 $objdir/pack/multi-pack-index.d/multi-pack-index-chain >actual &&
+		test_cmp base actual &&
+		ls $objdir/pack/multi-pack-index.d/*.midx >layers &&
+		test_line_count = 2 layers &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'objects are found through every layer' '
+	(
+		cd chain &&
+		git rev-list --objects --no-object-names --all >objects &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+			git cat-file --batch-check <objects >out &&
+		! grep missing out &&
+		grep "\"key\":\"load/num_packs\"" trace.txt >loads &&
+		test_line_count = 2 loads &&
+
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $objdir/pack/multi-pack-index.d/multi-pack-index-chain
+	)
+'
+
+test_expect_success 'incremental write converts an existing multi-pack-index' '
+	(
+		cd chain &&
+		git multi-pack-index write &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+		test_path_is_missing $objdir/pack/multi-pack-index.d &&
+
+		test_commit three &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing $objdir/pack/multi-pack-index &&
+		test_line_count = 2 $objdir/pack/multi-pack-index.d/multi-pack-index-chain &&
+		git multi-pack-index verify &&
+		git fsck
+	)
+'
+
+test_expect_success 'failed conversion keeps the multi-pack-index' '
+	(
+		cd chain &&
+		chain=$objdir/pack/multi-pack-index.d/multi-pack-index-chain &&
+		git multi-pack-index write &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+
+		# Another writer holds the multi-pack-index.
+		touch $objdir/pack/multi-pack-index.lock &&
+		test_commit four &&
+		git repack -d &&
+		test_must_fail git multi-pack-index write --incremental &&
+		rm $objdir/pack/multi-pack-index.lock &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+
+		# The new chain cannot be committed.
+		mkdir -p $chain &&
+		>$chain/block &&
+		test_must_fail git multi-pack-index write --incremental &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+		git multi-pack-index verify &&
+		git rev-list --objects --no-object-names --all >objects &&
+		git cat-file --batch-check <objects >out &&
+		! grep missing out &&
+
+		rm -r $chain &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing $objdir/pack/multi-pack-index &&
+		git multi-pack-index verify &&
+		git fsck
+	)
+'
+
+test_expect_success 'broken chain is ignored past the broken layer' '
+	(
+		cd chain &&
+		chain=$objdir/pack/multi-pack-index.d/multi-pack-index-chain &&
+		cp $chain chain.bak &&
+		echo $ZERO_OID >>$chain &&
+		git rev-list --objects --no-object-names --all >objects &&
+		git cat-file --batch-check <objects >out 2>err &&
+		! grep missing out &&
+		test_i18ngrep "unable to find all multi-pack-index layers" err &&
+		cp chain.bak $chain
+	)
+'
+
+test_expect_success 'incremental write refuses --bitmap' '
+	(
+		cd chain &&
+		test_must_fail git multi-pack-index write --incremental --bitmap 2>err &&
+		test_i18ngrep "cannot write a multi-pack bitmap" err
+	)
+'
+
 test_expect_success 'usage shown without sub-command' '
 	test_expect_code 129 git multi-pack-index 2>err &&
 	! test_i18ngrep "unrecognized subcommand" err
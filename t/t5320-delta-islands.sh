@@ -140,4 +140,25 @@ test_expect_success 'unmatched island core is not fatal' '
 	git -c "pack.islandcore=one" repack -adfi
 '
 
+
+test_expect_success 'objects in the same islands share one set of marks' '
+	git init sets &&
+	(
+		cd sets &&
+		test_commit_bulk --id=base 10 &&
+		for i in 1 2 3
+		do
+			git branch b$i &&
+			test_commit_bulk --ref=refs/heads/b$i --id=b$i 10 || return 1
+		done &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+		sed -n "s/.*\"key\":\"island-sets\",\"value\":\"\([0-9]*\)\".*/\1/p" \
+			trace >sets &&
+		# the base history is in all four islands, the rest of each
+		# branch only in its own
+		test "$(cat sets)" -le 4
+	)
+'
+
 test_done
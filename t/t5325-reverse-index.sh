@@ -117,4 +117,23 @@ test_expect_success 'revindex in-memory vs on-disk' '
 		test_cmp on-disk in-core
 	)
 '
+test_expect_success 'pack.shareReverseIndex writes the in-memory reverse index' '
+	test_when_finished "rm -f $rev; git worktree remove --force wt" &&
+	rm -f $rev &&
+	git rev-parse HEAD >tip &&
+	git cat-file --batch-check="%(objectsize:disk)" <tip >expect &&
+	test_path_is_missing $rev &&
+
+	git -c pack.shareReverseIndex=true \
+		cat-file --batch-check="%(objectsize:disk)" <tip >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $rev &&
+	git index-pack --rev-index --verify $packdir/pack-$pack.pack &&
+
+	git worktree add wt &&
+	GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 git -C wt \
+		cat-file --batch-check="%(objectsize:disk)" <tip >actual &&
+	test_cmp expect actual
+'
+
 test_done
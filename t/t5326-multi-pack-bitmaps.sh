@@ -0,0 +1,202 @@
+#!/bin/sh
+
+test_description='exercise basic multi-pack bitmap functionality'
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-bitmap.sh
+
+# We'll be writing our own midx and bitmaps, so avoid getting confused by the
+# automatic ones.
+GIT_TEST_MULTI_PACK_INDEX=0
+export GIT_TEST_MULTI_PACK_INDEX
+
+midx_checksum () {
+	test-tool read-midx --checksum "$1"
+}
+
+objdir=.git/objects
+midx=$objdir/pack/multi-pack-index
+
+test_expect_success 'setup multiple packs' '
+	for i in 1 2 3 4 5
+	do
+		test_commit_bulk --id=pack$i 10 &&
+		git repack -d || return 1
+	done &&
+	git branch other HEAD~15 &&
+	git tag -a -m "annotated" annotated HEAD~3 &&
+	ls $objdir/pack/*.pack >packs &&
+	test_line_count = 5 packs
+'
+
+test_expect_success 'write midx with a bitmap' '
+	git multi-pack-index write --bitmap &&
+
+	test_path_is_file $midx &&
+	test_path_is_file $midx-$(midx_checksum $objdir).bitmap &&
+	test_path_is_file $midx-$(midx_checksum $objdir).rev
+'
+
+test_expect_success 'bitmap is used and consistent' '
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "Using multi-pack bitmap" err &&
+	grep "OK!" err
+'
+
+test_expect_success 'rev-list --use-bitmap-index matches non-bitmap output' '
+	git rev-list --objects --no-object-names HEAD other >expect.raw &&
+	git rev-list --objects --use-bitmap-index HEAD other >actual.raw &&
+	test_bitmap_traversal expect.raw actual.raw &&
+
+	git rev-list --objects --no-object-names HEAD ^other >expect.raw &&
+	git rev-list --objects --use-bitmap-index HEAD ^other >actual.raw &&
+	test_bitmap_traversal expect.raw actual.raw
+'
+
+test_expect_success 'counting and disk usage match non-bitmap output' '
+	git rev-list --count --objects HEAD >expect &&
+	git rev-list --count --objects --use-bitmap-index HEAD >actual &&
+	test_cmp expect actual &&
+
+	git rev-list --disk-usage --objects HEAD >expect &&
+	git rev-list --disk-usage --objects --use-bitmap-index HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'filters work with multi-pack bitmaps' '
+	git rev-list --objects --no-object-names --filter=blob:none HEAD >expect.raw &&
+	git rev-list --objects --use-bitmap-index --filter=blob:none HEAD >actual.raw &&
+	test_bitmap_traversal expect.raw actual.raw
+'
+
+test_expect_success 'clone from a repository with a multi-pack bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'pack-objects reuses objects from the preferred pack' '
+	preferred=$(ls $objdir/pack/pack-*.idx | head -n 1) &&
+	git multi-pack-index write --bitmap \
+		--preferred-pack=$(basename $preferred) &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err &&
+
+	git pack-objects --stdout --revs --use-bitmap-index --progress \
+		--delta-base-offset <<-EOF >out.pack 2>err &&
+	HEAD
+	other
+	EOF
+	grep "pack-reused [1-9]" err &&
+
+	git index-pack --stdin <out.pack
+'
+
+test_expect_success 'pack-objects reuses objects from every pack' '
+	test_when_finished "rm -fr multi" &&
+	git init multi &&
+	(
+		cd multi &&
+		for i in 1 2 3
+		do
+			for j in 1 2 3 4 5
+			do
+				test_seq $i$j $((i * 300 + j)) >file &&
+				git add file &&
+				git commit -q -m "$i $j" || return 1
+			done &&
+			git repack -d || return 1
+		done &&
+		git multi-pack-index write --bitmap &&
+		git rev-list --objects --all >objects &&
+
+		for ofs in --delta-base-offset ""
+		do
+			git pack-objects --stdout --revs --use-bitmap-index \
+				--progress $ofs --all </dev/null >out.pack 2>err &&
+			grep "pack-reused $(wc -l <objects)" err &&
+			git index-pack --strict -o out.idx out.pack &&
+			git show-index <out.idx >out.objects &&
+			test_line_count = $(wc -l <objects) out.objects &&
+			git verify-pack -v out.idx >out.verify &&
+			grep "chain length" out.verify &&
+			rm out.pack out.idx || return 1
+		done &&
+
+		# A pack overlapping the others makes the MIDX pick only
+		# some objects of each pack, and some delta bases from
+		# another pack than their deltas.
+		git rev-list --objects HEAD~12..HEAD~3 |
+			git pack-objects --window=50 --depth=5 .git/objects/pack/pack &&
+		git multi-pack-index write --bitmap &&
+		git rev-list --test-bitmap HEAD 2>err &&
+		grep "OK!" err &&
+
+		for ofs in --delta-base-offset ""
+		do
+			git pack-objects --stdout --revs --use-bitmap-index \
+				--progress $ofs --all </dev/null >out.pack 2>err &&
+			grep "pack-reused [1-9]" err &&
+			git index-pack --strict -o out.idx out.pack &&
+			git show-index <out.idx >out.objects &&
+			test_line_count = $(wc -l <objects) out.objects &&
+			rm out.pack out.idx || return 1
+		done
+	)
+'
+
+test_expect_success 'writing a midx without --bitmap removes stale bitmaps' '
+	test_commit_bulk --id=loose 2 &&
+	git repack -d &&
+	git multi-pack-index write &&
+	ls $objdir/pack >files &&
+	! grep "^multi-pack-index-.*\.bitmap$" files
+'
+
+test_expect_success 'midx bitmap takes priority over a pack bitmap' '
+	git repack -adb &&
+	ls $objdir/pack/pack-*.bitmap >pack-bitmaps &&
+	test_line_count = 1 pack-bitmaps &&
+	test_commit_bulk --id=after 2 &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "Using multi-pack bitmap" err &&
+	grep "OK!" err
+'
+
+test_expect_success 'stale midx bitmap is ignored' '
+	test_when_finished "rm -fr stale" &&
+	git clone --no-local . stale &&
+	(
+		cd stale &&
+		git repack -d &&
+		git multi-pack-index write --bitmap &&
+		old_checksum=$(midx_checksum $objdir) &&
+		cp $midx-$old_checksum.bitmap ../stale.bitmap &&
+
+		test_commit_bulk --id=stale 2 &&
+		git repack -d &&
+		git multi-pack-index write &&
+		cp ../stale.bitmap $midx-$(midx_checksum $objdir).bitmap &&
+
+		git rev-list --count --use-bitmap-index HEAD >actual 2>err &&
+		git rev-list --count HEAD >expect &&
+		test_cmp expect actual &&
+		grep "ignoring stale multi-pack bitmap" err
+	)
+'
+
+test_expect_success 'midx bitmap with a lookup table' '
+	git rev-list --objects --no-object-names --all | sort >expect &&
+	git -c pack.writeBitmapLookupTable=true \
+		multi-pack-index write --bitmap &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err &&
+	git rev-list --objects --no-object-names --use-bitmap-index \
+		--all | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,90 @@
+#!/bin/sh
+
+test_description='git unpack-objects with large objects'
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-pack.sh
+
+prepare_dest () {
+	test_when_finished "rm -rf dest.git" &&
+	git init --bare dest.git &&
+	git -C dest.git config core.bigFileThreshold "$1"
+}
+
+test_expect_success 'setup' '
+	test-tool genrandom foo 1000000 >big-blob &&
+	test-tool genrandom bar 1000000 >big-blob-2 &&
+	echo small >small-blob &&
+	git add big-blob big-blob-2 small-blob &&
+	test_commit --no-tag one &&
+	PACK=$(echo HEAD | git pack-objects --revs --window=0 test) &&
+	git rev-list --objects HEAD | cut -d" " -f1 | sort >expect
+'
+
+list_loose () {
+	(
+		cd "$1/objects" &&
+		find ?? -type f | tr -d / | sort
+	)
+}
+
+test_expect_success 'unpack-objects works with a large threshold' '
+	prepare_dest 2m &&
+	git -C dest.git unpack-objects <test-$PACK.pack &&
+	list_loose dest.git >actual &&
+	test_cmp expect actual &&
+	git -C dest.git fsck --full
+'
+
+test_expect_success 'unpack-objects streams blobs above the threshold' '
+	prepare_dest 1k &&
+	git -C dest.git unpack-objects <test-$PACK.pack &&
+	list_loose dest.git >actual &&
+	test_cmp expect actual &&
+	git -C dest.git fsck --full &&
+	git -C dest.git cat-file blob $(git rev-parse HEAD:big-blob) >got &&
+	test_cmp big-blob got
+'
+
+test_expect_success 'unpack-objects --strict streams blobs, too' '
+	prepare_dest 1k &&
+	git -C dest.git unpack-objects --strict <test-$PACK.pack &&
+	list_loose dest.git >actual &&
+	test_cmp expect actual &&
+	git -C dest.git fsck --full
+'
+
+test_expect_success 'unpack-objects -n writes nothing' '
+	prepare_dest 1k &&
+	git -C dest.git unpack-objects -n <test-$PACK.pack &&
+	list_loose dest.git >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'streaming a blob that already exists is fine' '
+	prepare_dest 1k &&
+	git -C dest.git unpack-objects <test-$PACK.pack &&
+	git -C dest.git unpack-objects <test-$PACK.pack &&
+	list_loose dest.git >actual &&
+	test_cmp expect actual &&
+	find dest.git/objects -name "tmp_obj_*" >tmp &&
+	test_must_be_empty tmp
+'
+
+test_expect_success 'a streamed blob can be the base of an earlier delta' '
+	A=$(test_oid packlib_7_0) &&
+	B=$(test_oid packlib_7_76) &&
+	{
+		pack_header 2 &&
+		pack_obj $A $B &&
+		pack_obj $B
+	} >ab.pack &&
+	pack_trailer ab.pack &&
+	prepare_dest 1 &&
+	git -C dest.git unpack-objects <ab.pack &&
+	git -C dest.git cat-file -e $A &&
+	git -C dest.git cat-file -e $B &&
+	git -C dest.git fsck --full
+'
+
+test_done
@@ -883,6 +883,41 @@ test_expect_success 'shallow since with commit graph and already-seen commit' '
 	)
 '
 
+test_expect_success 'shallow boundaries do not depend on the commit-graph' '
+	test_create_repo shallow-graph-merges &&
+	(
+	cd shallow-graph-merges &&
+	test_commit A &&
+	for i in 1 2 3
+	do
+		git checkout -b side$i A &&
+		test_commit B$i &&
+		test_commit C$i || return 1
+	done &&
+	git checkout main &&
+	test_commit D &&
+	git merge side1 side2 side3 &&
+	test_commit E &&
+	git merge -s ours side2 &&
+	git commit-graph write --reachable
+	) &&
+	for opts in "--depth=2" "--depth=3" "--depth=4" \
+		"--shallow-since=$(git -C shallow-graph-merges log -1 --format=%ct C2)" \
+		"--shallow-exclude=D"
+	do
+		rm -rf with-graph without-graph &&
+		git -c core.commitGraph=true clone --no-local \
+			--upload-pack="git -c core.commitGraph=true upload-pack" \
+			$opts shallow-graph-merges with-graph &&
+		git clone --no-local \
+			--upload-pack="git -c core.commitGraph=false upload-pack" \
+			$opts shallow-graph-merges without-graph &&
+		sort with-graph/.git/shallow >expect &&
+		sort without-graph/.git/shallow >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_expect_success 'shallow clone exclude tag two' '
 	test_create_repo shallow-exclude &&
 	(
@@ -797,6 +797,29 @@ test_expect_success 'fetch.writeCommitGraph with submodules' '
 	)
 '
 
+test_expect_success 'fetch.writeCommitGraph only adds the fetched commits' '
+	git clone three write-tips &&
+	(
+		cd write-tips &&
+		git commit-graph write --reachable --split &&
+		git checkout -b local &&
+		test_commit local-only
+	) &&
+	(
+		cd three &&
+		test_commit fetched-1 &&
+		test_commit fetched-2
+	) &&
+	(
+		cd write-tips &&
+		git -c fetch.writeCommitGraph fetch origin &&
+		test_line_count = 2 .git/objects/info/commit-graphs/commit-graph-chain &&
+		test-tool read-graph >graph &&
+		grep "num_commits: 2" graph &&
+		git commit-graph verify
+	)
+'
+
 # configured prune tests
 
 set_config_tristate () {
@@ -1150,6 +1173,108 @@ test_expect_success '--no-show-forced-updates' '
 	)
 '
 
+test_expect_success 'fast-forward checks of many branches share one walk' '
+	git init shared-walk &&
+	test_commit -C shared-walk base &&
+	git -C shared-walk branch ff &&
+	git -C shared-walk branch forced &&
+	git clone shared-walk shared-walk-clone &&
+	test_commit -C shared-walk --no-tag one &&
+	git -C shared-walk update-ref refs/heads/ff HEAD &&
+	git -C shared-walk checkout --orphan other &&
+	test_commit -C shared-walk --no-tag two &&
+	git -C shared-walk update-ref refs/heads/forced HEAD &&
+	git -C shared-walk-clone commit-graph write --reachable &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C shared-walk-clone fetch origin 2>output &&
+	grep "\"fast_forward_checks/refs\",\"value\":\"3\"" trace.event &&
+	grep "  ff .*origin/ff$" output &&
+	grep "+ .*forced .*(forced update)" output &&
+	git -C shared-walk rev-parse forced >expect &&
+	git -C shared-walk-clone rev-parse origin/forced >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch updates refs in a single transaction' '
+	git init batched &&
+	test_commit -C batched base &&
+	git -C batched branch one &&
+	git -C batched branch two &&
+	git -C batched tag -a -m tag annotated &&
+	git init batched-clone &&
+	write_script batched-clone/.git/hooks/reference-transaction <<-\EOF &&
+	echo "$1" >>../transactions
+	EOF
+	rm -f transactions &&
+	git -C batched-clone fetch ../batched \
+		"refs/heads/*:refs/remotes/origin/*" "refs/tags/*:refs/tags/*" &&
+	echo committed >expect &&
+	grep committed transactions >actual &&
+	test_cmp expect actual &&
+	git -C batched-clone rev-parse refs/remotes/origin/one \
+		refs/remotes/origin/two refs/tags/annotated
+'
+
+test_expect_success 'a batch that fails is redone one ref at a time' '
+	git -C batched branch dir/conflict &&
+	git -C batched branch three &&
+	git -C batched-clone update-ref refs/remotes/origin/dir \
+		refs/remotes/origin/one &&
+	test_must_fail git -C batched-clone fetch ../batched \
+		"refs/heads/*:refs/remotes/origin/*" 2>err &&
+	test_i18ngrep "git remote prune" err &&
+	test_i18ngrep "origin/three" err &&
+	git -C batched rev-parse three >expect &&
+	git -C batched-clone rev-parse refs/remotes/origin/three >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C batched-clone rev-parse --verify -q \
+		refs/remotes/origin/dir/conflict
+'
+
+test_expect_success 'fetch and prune with many refspecs' '
+	git init many-refspecs &&
+	test_commit -C many-refspecs base &&
+	for b in a/1 a/2 b/1 b/2 c/x.keep c/y
+	do
+		git -C many-refspecs branch $b || return 1
+	done &&
+	git init many-refspecs-clone &&
+	(
+		cd many-refspecs-clone &&
+		git remote add origin ../many-refspecs &&
+		git config --unset-all remote.origin.fetch &&
+		for i in $(test_seq 20)
+		do
+			git config --add remote.origin.fetch \
+				"refs/heads/none-$i/*:refs/remotes/none-$i/*" || return 1
+		done &&
+		git config --add remote.origin.fetch "+refs/heads/a/*:refs/remotes/a/*" &&
+		git config --add remote.origin.fetch "^refs/heads/a/2" &&
+		git config --add remote.origin.fetch "refs/heads/b/1:refs/remotes/exact-b1" &&
+		git config --add remote.origin.fetch "refs/heads/*.keep:refs/remotes/kept/*" &&
+		git config --add remote.origin.fetch "refs/heads/*:refs/remotes/all/*" &&
+		git config --add remote.origin.fetch "^refs/heads/b/2" &&
+		git fetch origin &&
+		cat >expect <<-\EOF &&
+		refs/remotes/a/1
+		refs/remotes/all/a/1
+		refs/remotes/all/b/1
+		refs/remotes/all/c/x.keep
+		refs/remotes/all/c/y
+		refs/remotes/all/main
+		refs/remotes/exact-b1
+		refs/remotes/kept/c/x
+		EOF
+		git for-each-ref --format="%(refname)" refs/remotes >actual &&
+		test_cmp expect actual &&
+		git update-ref refs/remotes/all/gone refs/remotes/a/1 &&
+		git update-ref refs/remotes/all/b/2 refs/remotes/a/1 &&
+		git fetch --prune --dry-run origin 2>err &&
+		grep "\[deleted\].*all/gone" err &&
+		! grep "all/b/2" err
+	)
+'
+
 setup_negotiation_tip () {
 	SERVER="$1"
 	URL="$2"
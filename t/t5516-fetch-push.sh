@@ -1770,4 +1770,20 @@ test_expect_success 'denyCurrentBranch and worktrees' '
 	git -C cloned push origin HEAD:new-wt &&
 	test_must_fail git -C cloned push --delete origin new-wt
 '
+
+test_expect_success 'receive.writeCommitGraph adds the pushed commits' '
+	mk_empty testrepo &&
+	git -C testrepo config receive.writeCommitGraph true &&
+	git push testrepo main^:refs/heads/main &&
+	test_path_is_file testrepo/.git/objects/info/commit-graphs/commit-graph-chain &&
+	git push testrepo main:refs/heads/main &&
+	test_line_count = 2 testrepo/.git/objects/info/commit-graphs/commit-graph-chain &&
+	(
+		cd testrepo &&
+		test-tool read-graph >graph &&
+		grep "num_commits: 1" graph &&
+		git commit-graph verify
+	)
+'
+
 test_done
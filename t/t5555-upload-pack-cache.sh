@@ -0,0 +1,79 @@
+#!/bin/sh
+
+test_description='upload-pack serves repeated requests from its pack cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated three
+'
+
+cache_hits () {
+	grep "\"key\":\"pack-cache\",\"value\":\"$1\"" trace
+}
+
+test_expect_success 'first clone fills the cache' '
+	test_config uploadpack.packCache true &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local --bare . miss.git &&
+	cache_hits miss &&
+	ls .git/upload-pack-cache/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	test_config uploadpack.packCache true &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local --bare . hit.git &&
+	cache_hits hit &&
+	git -C hit.git fsck &&
+	git -C miss.git for-each-ref >expect &&
+	git -C hit.git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cache hit works with protocol v2' '
+	test_config uploadpack.packCache true &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c protocol.version=2 clone --no-local --bare . v2.git &&
+	cache_hits hit &&
+	git -C v2.git fsck
+'
+
+test_expect_success 'different request misses the cache' '
+	test_config uploadpack.packCache true &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git clone --no-local --bare --depth=1 . shallow.git &&
+	cache_hits miss &&
+	git -C shallow.git fsck
+'
+
+test_expect_success 'new tags change the response' '
+	test_config uploadpack.packCache true &&
+	test_commit four &&
+	git tag -d four &&
+	git tag -a -m "points at two" new-tag two &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local --bare . tags.git &&
+	cache_hits miss &&
+	git -C tags.git rev-parse --verify refs/tags/new-tag
+'
+
+test_expect_success 'cache is pruned to uploadpack.packCacheLimit entries' '
+	test_config uploadpack.packCache true &&
+	test_config uploadpack.packCacheLimit 1 &&
+	git clone --no-local --bare --depth=2 . limit.git &&
+	ls .git/upload-pack-cache/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'cache is not used without uploadpack.packCache' '
+	rm -fr .git/upload-pack-cache &&
+	test_config uploadpack.packCache false &&
+	git clone --no-local --bare . off.git &&
+	test_path_is_missing .git/upload-pack-cache
+'
+
+test_done
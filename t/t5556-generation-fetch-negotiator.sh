@@ -0,0 +1,175 @@
+#!/bin/sh
+
+test_description='test generation fetch negotiator'
+. ./test-lib.sh
+
+have_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -ne 0
+		then
+			echo "No have $(git -C client rev-parse $1) ($1)"
+			return 1
+		fi
+		shift
+	done
+}
+
+have_not_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -eq 0
+		then
+			return 1
+		fi
+		shift
+	done
+}
+
+# trace_fetch <client_dir> <server_dir> [args]
+#
+# Trace the packet output of fetch, but make sure we disable the variable
+# in the child upload-pack, so we don't combine the results in the same file.
+trace_fetch () {
+	client=$1; shift
+	server=$1; shift
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git -C "$client" fetch \
+	  --upload-pack 'unset GIT_TRACE_PACKET; git-upload-pack' \
+	  "$server" "$@"
+}
+
+test_expect_success 'skips grow along the history of a tip' '
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	for i in $(test_seq 7)
+	do
+		test_commit -C client c$i
+	done &&
+	git -C client commit-graph write --reachable &&
+
+	# The tags on "c6" to "c1" are reachable from "c7", so they do not
+	# start skips of their own. We send "c7" (skip 1) "c5" (skip 3), and
+	# "c1" as it has no parent.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent c7 c5 c1 &&
+	have_not_sent c6 c4 c3 c2
+'
+
+test_expect_success 'walk in generation order despite clock skew' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+
+	# 2 regular commits
+	test_tick=2000000000 &&
+	test_commit -C client c1 &&
+	test_commit -C client c2 &&
+
+	# 4 old commits
+	test_tick=1000000000 &&
+	git -C client checkout c1 &&
+	test_commit -C client old1 &&
+	test_commit -C client old2 &&
+	test_commit -C client old3 &&
+	test_commit -C client old4 &&
+	git -C client commit-graph write --reachable &&
+
+	# "old1" is popped before its parent "c1" and is skipped as usual.
+	# "c1" is reached from "c2" first and sent as it has no parent.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent c2 old4 old2 c1 &&
+	have_not_sent old3 old1
+'
+
+test_expect_success 'parallel lines share their skips' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	test_commit -C client base &&
+	for i in $(test_seq 16)
+	do
+		git -C client checkout -b side$i &&
+		test_commit -C client --no-tag s$i.1 &&
+		test_commit -C client --no-tag s$i.2 &&
+		test_commit -C client --no-tag s$i.3 &&
+		git -C client checkout - &&
+		test_commit -C client --no-tag m$i &&
+		git -C client merge -q --no-ff -m merge$i side$i &&
+		git -C client branch -D side$i || return 1
+	done &&
+	git -C client tag -d base &&
+	git -C client commit-graph write --reachable &&
+	cp -R client client.skipping &&
+
+	test_config -C client.skipping fetch.negotiationalgorithm skipping &&
+	trace_fetch client.skipping "$(pwd)/server" &&
+	grep "fetch> have" trace >skipping &&
+
+	rm trace &&
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	grep "fetch> have" trace >generation &&
+
+	test_line_count -lt $(wc -l <skipping) generation
+'
+
+test_expect_success 'do not send "have" with ancestors of commits that server ACKed' '
+	rm -rf server client client.skipping trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	for i in $(test_seq 8)
+	do
+		git -C client checkout --orphan b$i &&
+		test_commit -C client b$i.c0
+	done &&
+	for j in $(test_seq 19)
+	do
+		for i in $(test_seq 8)
+		do
+			git -C client checkout b$i &&
+			test_commit -C client b$i.c$j
+		done
+	done &&
+	git -C client commit-graph write --reachable &&
+
+	# Copy this branch over to the server and add a commit on it so that it
+	# is reachable but not advertised.
+	git -C server fetch --no-tags "$(pwd)/client" b1:refs/heads/b1 &&
+	git -C server checkout b1 &&
+	test_commit -C server commit-on-b1 &&
+
+	test_config -C client fetch.negotiationalgorithm generation &&
+	(
+		# Force protocol v0, in which local transport is stateful (in
+		# protocol v2 it is stateless).
+		GIT_TEST_PROTOCOL_VERSION=0 &&
+		export GIT_TEST_PROTOCOL_VERSION &&
+		trace_fetch client "$(pwd)/server" to_fetch
+	) &&
+
+	# fetch-pack sends 2 requests each containing 16 "have" lines before
+	# processing the first response. In these 2 requests, 4 commits from
+	# each branch are sent. Just check the first branch.
+	have_sent b1.c19 b1.c17 b1.c13 b1.c5 &&
+	grep "fetch< ACK $(git -C client rev-parse b1.c19) common" trace &&
+
+	# fetch-pack should thus not send the root of the b1 branch, but
+	# should still send those of the others (in this test, just check b2).
+	have_not_sent b1.c0 &&
+	have_sent b2.c0
+'
+
+test_done
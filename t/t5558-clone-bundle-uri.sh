@@ -0,0 +1,123 @@
+#!/bin/sh
+
+test_description='test fetching bundles with --bundle-uri'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server A &&
+	test_commit -C server B &&
+	git -C server bundle create ../B.bundle main &&
+	test_commit -C server C &&
+	git -C server bundle create ../BC.bundle main~1..main &&
+	test_commit -C server D
+'
+
+test_expect_success 'fail to clone from a missing bundle' '
+	git clone --bundle-uri=missing.bundle server test-missing 2>err &&
+	grep "failed to download bundle from URI" err &&
+	git -C test-missing rev-parse main >actual &&
+	git -C server rev-parse main >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fail to clone from a file that is not a bundle' '
+	echo garbage >garbage &&
+	git clone --bundle-uri=garbage server test-garbage 2>err &&
+	grep "is not a bundle" err &&
+	git -C test-garbage rev-parse main >actual &&
+	git -C server rev-parse main >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone with a path bundle' '
+	git clone --bundle-uri="$(pwd)/B.bundle" \
+		--no-local server test-path &&
+	git -C test-path rev-parse refs/bundles/main >actual &&
+	git -C server rev-parse B >expect &&
+	test_cmp expect actual &&
+	git -C test-path rev-parse main >actual &&
+	git -C server rev-parse main >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone only fetches what the bundle lacks' '
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git clone --bundle-uri="file://$(pwd)/B.bundle" \
+		"file://$(pwd)/server" test-file &&
+	git -C test-file rev-parse refs/bundles/main >actual &&
+	git -C server rev-parse B >expect &&
+	test_cmp expect actual &&
+	grep "clone> have $(git -C server rev-parse B)" trace &&
+	git -C test-file fsck &&
+
+	# A and B came only with the bundle
+	for pack in test-file/.git/objects/pack/*.idx
+	do
+		git show-index <$pack || return 1
+	done >objects &&
+	grep -c "$(git -C server rev-parse A:A.t)" objects >count &&
+	echo 1 >expect &&
+	test_cmp expect count
+'
+
+test_expect_success 'clone with bundles that build on each other' '
+	git clone --bundle-uri=B.bundle --bundle-uri=BC.bundle \
+		--no-local server test-two &&
+	git -C test-two rev-parse refs/bundles/main >actual &&
+	git -C server rev-parse C >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a bundle whose prerequisites are missing is skipped' '
+	git clone --bundle-uri=BC.bundle --no-local server test-prereq 2>err &&
+	grep "failed to unbundle bundle from URI" err &&
+	test_must_fail git -C test-prereq rev-parse --verify refs/bundles/main &&
+	git -C test-prereq rev-parse main >actual &&
+	git -C server rev-parse main >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch with a bundle' '
+	git clone --no-local server test-fetch &&
+	git -C test-fetch reset --hard B &&
+	git -C test-fetch update-ref -d refs/remotes/origin/main &&
+	git -C test-fetch fetch --bundle-uri="$(pwd)/BC.bundle" origin &&
+	git -C test-fetch rev-parse refs/bundles/main >actual &&
+	git -C server rev-parse C >expect &&
+	test_cmp expect actual &&
+	git -C test-fetch rev-parse origin/main >actual &&
+	git -C server rev-parse main >expect &&
+	test_cmp expect actual
+'
+
+#########################################################################
+# HTTP tests begin here
+
+. "$TEST_DIRECTORY"/lib-httpd.sh
+start_httpd
+
+test_expect_success 'fail to fetch from non-existent HTTP URL' '
+	test_when_finished rm -rf test &&
+	git clone --bundle-uri="$HTTPD_URL/does-not-exist" \
+		--no-local server test 2>err &&
+	grep "failed to download bundle from URI" err
+'
+
+test_expect_success 'clone HTTP bundle' '
+	cp B.bundle "$HTTPD_DOCUMENT_ROOT_PATH/B.bundle" &&
+	git clone --bundle-uri="$HTTPD_URL/B.bundle" \
+		--no-local server test-http &&
+	git -C test-http rev-parse refs/bundles/main >actual &&
+	git -C server rev-parse B >expect &&
+	test_cmp expect actual
+'
+
+# Do not add tests here unless they use the HTTP server, as they will
+# not run unless the HTTP dependencies exist.
+
+test_done
@@ -207,4 +207,33 @@ test_expect_success FAKENC 'hostname interpolation works after LF-stripping' '
 	test_cmp expect actual
 '
 
+stop_git_daemon
+start_git_daemon --workers=2
+
+test_expect_success 'clone and fetch through a pool of workers' '
+	repo="$GIT_DAEMON_DOCUMENT_ROOT_PATH/pool.git" &&
+	git init --bare "$repo" &&
+	git push "$repo" HEAD &&
+	>"$repo"/git-daemon-export-ok &&
+	rm -rf workers &&
+	git clone "$GIT_DAEMON_URL/pool.git" workers &&
+	git -C workers fetch &&
+	git -C "$repo" rev-parse HEAD >expect &&
+	git -C workers rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'workers serve several clients at once' '
+	pids= &&
+	for i in 1 2 3
+	do
+		git ls-remote "$GIT_DAEMON_URL/pool.git" >out$i &
+		pids="$pids $!" || return 1
+	done &&
+	wait $pids &&
+	test_file_not_empty out1 &&
+	test_cmp out1 out2 &&
+	test_cmp out1 out3
+'
+
 test_done
@@ -358,4 +358,42 @@ test_expect_success SYMLINKS 'clone repo with symlinked or unknown files at obje
 	test_must_be_empty T--shared.objects-symlinks.raw
 '
 
+
+test_lazy_prereq REFLINK '
+	git init reflink-probe &&
+	test_commit -C reflink-probe one &&
+	git clone --reflink=always reflink-probe reflink-probe-clone
+'
+
+test_expect_success 'clone --reflink=auto copies instead of hardlinking' '
+	git init R &&
+	test_commit -C R one &&
+	git -C R repack -ad &&
+	git clone --reflink=auto R R-auto &&
+	git -C R-auto fsck &&
+	for f in R-auto/.git/objects/pack/*
+	do
+		perl -e "exit((stat(shift))[3] != 1)" "$f" || return 1
+	done &&
+	test_cmp_bin R/.git/objects/pack/*.pack R-auto/.git/objects/pack/*.pack
+'
+
+test_expect_success REFLINK 'clone --reflink=always' '
+	git clone --reflink=always R R-always &&
+	git -C R-always fsck
+'
+
+test_expect_success !REFLINK 'clone --reflink=always fails without reflinks' '
+	test_must_fail git clone --reflink=always R R-always 2>err &&
+	grep "failed to reflink" err &&
+	test_path_is_missing R-always
+'
+
+test_expect_success 'clone.reflink and --no-reflink' '
+	test_must_fail git -c clone.reflink=bogus clone R R-bogus &&
+	test_must_fail git clone --reflink=bogus R R-bogus &&
+	git -c clone.reflink=always clone --no-reflink R R-never &&
+	git -C R-never fsck
+'
+
 test_done
@@ -223,6 +223,46 @@ test_expect_success 'sending server-options' '
 	test_cmp expect actual
 '
 
+test_expect_success 'ls-refs answers from its cache' '
+	test_config lsrefs.cache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	peel
+	symrefs
+	ref-prefix refs/heads/
+	ref-prefix refs/tags/
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >expect &&
+	find .git/HEAD .git/refs -exec test-tool chmtime =-10 {} + &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache\",\"value\":\"miss\"" trace &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache\",\"value\":\"hit\"" trace &&
+
+	# a recent change is not trusted to show in the stat information
+	git branch cached two &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >actual &&
+	! grep "\"key\":\"cache\"" trace &&
+	test-tool pkt-line unpack <actual >refs &&
+	grep refs/heads/cached refs &&
+
+	find .git/HEAD .git/refs -exec test-tool chmtime =-20 {} + &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >cached &&
+	test_cmp actual cached &&
+	grep "\"key\":\"cache\",\"value\":\"miss\"" trace &&
+	git branch -d cached
+'
+
 test_expect_success 'unexpected lines are not allowed in fetch request' '
 	git init server &&
 
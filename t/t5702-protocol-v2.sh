@@ -940,6 +940,59 @@ test_expect_success 'part of packfile response provided as URI' '
 	test_line_count = 6 filelist
 '
 
+test_expect_success 'packfile URI download resumes after being cut off' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
+	rm -rf "$P" http_child &&
+
+	git init "$P" &&
+	git -C "$P" config "uploadpack.allowsidebandall" "true" &&
+
+	test_seq 1000 >"$P/my-blob" &&
+	git -C "$P" add my-blob &&
+	git -C "$P" commit -m x &&
+
+	git -C "$P" hash-object my-blob >objh &&
+	git -C "$P" pack-objects "$HTTPD_DOCUMENT_ROOT_PATH/mypack" <objh >packh &&
+	git -C "$P" config "uploadpack.blobpackfileuri" \
+		"$(cat objh) $(cat packh) $HTTPD_URL/drop_half/mypack-$(cat packh).pack" &&
+
+	GIT_TEST_SIDEBAND_ALL=1 \
+	git -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		clone "$HTTPD_URL/smart/http_parent" http_child 2>err &&
+	test_i18ngrep "interrupted.*resuming" err &&
+	git -C http_child fsck &&
+	git -C http_child cat-file -e $(cat objh)
+'
+
+test_expect_success 'whole pack provided as URI on clone' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
+	rm -rf "$P" http_child &&
+
+	git init "$P" &&
+	git -C "$P" config "uploadpack.allowsidebandall" "true" &&
+
+	test_commit -C "$P" base &&
+	git -C "$P" repack -a -d &&
+	pack=$(echo "$P"/.git/objects/pack/pack-*.pack) &&
+	packh=$(basename "$pack" .pack | sed "s/^pack-//") &&
+	cp "$pack" "$HTTPD_DOCUMENT_ROOT_PATH/" &&
+	git -C "$P" config "uploadpack.packpackfileuri" \
+		"$packh $HTTPD_URL/dumb/pack-$packh.pack" &&
+	test_commit -C "$P" on-top &&
+
+	GIT_TEST_SIDEBAND_ALL=1 \
+	git -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		clone "$HTTPD_URL/smart/http_parent" http_child &&
+
+	# The base pack came from its URI, the new commit from upload-pack.
+	test_path_is_file http_child/.git/objects/pack/pack-$packh.idx &&
+	ls http_child/.git/objects/pack/*.pack >packlist &&
+	test_line_count = 2 packlist &&
+	git -C http_child fsck
+'
+
 test_expect_success 'packfile URIs with fetch instead of clone' '
 	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
 	rm -rf "$P" http_child log &&
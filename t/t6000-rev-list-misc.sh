@@ -169,4 +169,17 @@ test_expect_success 'rev-list --count --objects' '
 	test_line_count = $count actual
 '
 
+test_expect_success 'rev-list --objects reading trees ahead on threads' '
+	git rev-list --objects --all >expect &&
+	rm -f trace.event &&
+	GIT_TEST_LIST_OBJECTS_THREADS=3 GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git rev-list --objects --all >actual &&
+	test_cmp expect actual &&
+	grep "prefetch/threads" trace.event &&
+	git pack-objects --all --stdout </dev/null >expect.pack &&
+	GIT_TEST_LIST_OBJECTS_THREADS=3 \
+		git pack-objects --all --stdout </dev/null >actual.pack &&
+	test_cmp_bin expect.pack actual.pack
+'
+
 test_done
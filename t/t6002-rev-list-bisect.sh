@@ -308,4 +308,17 @@ test_expect_success '--bisect-all --first-parent' '
 	test_cmp expect actual
 '
 
+test_expect_success '--bisect-all counts the same with generation numbers' '
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	for range in "l5 ^root" "a4 ^root" "c3 ^a0" "b4 ^c1" "E ^F" "V ^U"
+	do
+		git -c core.commitGraph=false \
+			rev-list --bisect-all $range >expect &&
+		git commit-graph write --reachable &&
+		git rev-list --bisect-all $range >actual &&
+		rm .git/objects/info/commit-graph &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
@@ -444,4 +444,13 @@ EOF
 #
 #
 
+test_expect_success 'commit slabs in a huge page arena' '
+	for args in "--topo-order --all" "--date-order --all" "--topo-order --parents a4 l3"
+	do
+		git rev-list $args >expect &&
+		git -c core.commitSlabHugePages=true rev-list $args >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
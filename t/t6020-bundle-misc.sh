@@ -475,4 +475,27 @@ test_expect_success 'clone from bundle' '
 	test_cmp expect actual
 '
 
+test_expect_success 'full bundles do not walk the history' '
+	git repack -adb &&
+	rm -f trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git bundle create full.bdl --all &&
+	! grep "region_enter.*write-prerequisites" trace.perf &&
+	git bundle verify full.bdl >out &&
+	grep "complete history" out &&
+	git clone --mirror full.bdl full.git &&
+	git show-ref >expect &&
+	git -C full.git show-ref >actual &&
+	test_cmp expect actual &&
+
+	rm -f trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git bundle create count.bdl --max-count=1000 --all &&
+	grep "region_enter.*write-prerequisites" trace.perf &&
+	rm -f trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git bundle create range.bdl main~1..main &&
+	grep "region_enter.*write-prerequisites" trace.perf
+'
+
 test_done
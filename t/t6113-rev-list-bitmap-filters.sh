@@ -14,15 +14,12 @@ test_expect_success 'set up bitmapped repo' '
 	git tag tag
 '
 
-test_expect_success 'filters fallback to non-bitmap traversal' '
-	# use a path-based filter, since they are inherently incompatible with
-	# bitmaps (i.e., this test will never get confused by later code to
-	# combine the features)
+test_expect_success 'sparse:oid filter' '
 	filter=$(echo "!one" | git hash-object -w --stdin) &&
 	git rev-list --objects --filter=sparse:oid=$filter HEAD >expect &&
 	git rev-list --use-bitmap-index \
 		     --objects --filter=sparse:oid=$filter HEAD >actual &&
-	test_cmp expect actual
+	test_bitmap_traversal expect actual
 '
 
 test_expect_success 'blob:none filter' '
@@ -73,7 +70,7 @@ test_expect_success 'tree:1 filter' '
 	git rev-list --objects --filter=tree:1 HEAD >expect &&
 	git rev-list --use-bitmap-index \
 		     --objects --filter=tree:1 HEAD >actual &&
-	test_cmp expect actual
+	test_bitmap_traversal expect actual
 '
 
 test_expect_success 'object:type filter' '
@@ -141,4 +138,70 @@ test_expect_success 'combine filter with --filter-provided-objects' '
 	done <objects
 '
 
+test_expect_success 'set up bitmapped repo with directories' '
+	git init nested &&
+	(
+		cd nested &&
+		mkdir -p a/b/c d &&
+		for i in 1 2 3
+		do
+			for f in top-$i.t a/one-$i.t a/b/two-$i.t \
+				 a/b/c/three-$i.t d/other-$i.t
+			do
+				echo $f >$f || return 1
+			done &&
+			git add . &&
+			git commit -m $i &&
+			git tag v$i || return 1
+		done &&
+		git repack -adb
+	)
+'
+
+test_expect_success 'tree:<depth> filters' '
+	for depth in 1 2 3 4
+	do
+		git -C nested rev-list --objects --filter=tree:$depth HEAD >expect &&
+		git -C nested rev-list --use-bitmap-index \
+			--objects --filter=tree:$depth HEAD >actual &&
+		test_bitmap_traversal expect actual || return 1
+	done
+'
+
+test_expect_success 'tree:<depth> filter with haves and a specified tree' '
+	git -C nested rev-list --objects --filter=tree:2 \
+		v1..v3 v2:a >expect &&
+	git -C nested rev-list --use-bitmap-index --objects --filter=tree:2 \
+		v1..v3 v2:a >actual &&
+	test_bitmap_traversal expect actual
+'
+
+test_expect_success 'sparse:oid filter with directories' '
+	filter=$(printf "/*\n!/a/\n/a/b/\n" | git -C nested hash-object -w --stdin) &&
+	git -C nested rev-list --objects --filter=sparse:oid=$filter \
+		v1..v3 >expect &&
+	git -C nested rev-list --use-bitmap-index \
+		--objects --filter=sparse:oid=$filter v1..v3 >actual &&
+	test_bitmap_traversal expect actual &&
+	grep $(git -C nested rev-parse v3:a/b/c/three-3.t) actual &&
+	! grep $(git -C nested rev-parse v3:a/one-3.t) actual
+'
+
+test_expect_success 'combine filter with sparse:oid' '
+	filter=$(printf "/a/\n" | git -C nested hash-object -w --stdin) &&
+	git -C nested rev-list --objects --filter=sparse:oid=$filter \
+		--filter=tree:3 HEAD >expect &&
+	git -C nested rev-list --use-bitmap-index --objects \
+		--filter=sparse:oid=$filter --filter=tree:3 HEAD >actual &&
+	test_bitmap_traversal expect actual &&
+
+	other=$(printf "/*\n!/a/b/c/\n" | git -C nested hash-object -w --stdin) &&
+	git -C nested rev-list --objects --filter=sparse:oid=$filter \
+		--filter=sparse:oid=$other v1..v3 >expect &&
+	git -C nested rev-list --use-bitmap-index --objects \
+		--filter=sparse:oid=$filter --filter=sparse:oid=$other \
+		v1..v3 >actual &&
+	test_bitmap_traversal expect actual
+'
+
 test_done
@@ -283,6 +283,29 @@ test_expect_success 'name-rev --stdin' '
 	test_cmp expect actual
 '
 
+test_expect_success 'name-rev with a commit-graph' '
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	git rev-list --all --max-count=10 >revs &&
+	git -c core.commitGraph=false name-rev $(cat revs) >expect &&
+	git commit-graph write --reachable &&
+	git name-rev $(cat revs) >actual &&
+	test_cmp expect actual &&
+	git name-rev --tags $(cat revs) >actual &&
+	git -c core.commitGraph=false name-rev --tags $(cat revs) >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'describe --stdin' '
+	git rev-list --all -- file >revs &&
+	git describe --always $(cat revs) >expect &&
+	git describe --always --stdin <revs >actual &&
+	test_cmp expect actual &&
+	git describe --contains --always $(cat revs) >expect &&
+	git describe --contains --always --stdin <revs >actual &&
+	test_cmp expect actual &&
+	test_must_fail git describe --stdin HEAD </dev/null
+'
+
 test_expect_success 'describe --contains with the exact tags' '
 	echo "A^0" >expect &&
 	tag_object=$(git rev-parse refs/tags/A) &&
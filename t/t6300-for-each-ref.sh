@@ -1379,4 +1379,35 @@ test_expect_success 'for-each-ref reports broken tags' '
 		refs/tags/broken-tag-*
 '
 
+test_expect_success 'loose refs read in parallel are listed the same' '
+	test_when_finished "rm -rf loose" &&
+	git init loose &&
+	test_commit -C loose base &&
+	oid=$(git -C loose rev-parse HEAD) &&
+	for i in $(test_seq 40)
+	do
+		echo "create refs/pull/$i/head $oid" &&
+		echo "create refs/pull/$i/merge $oid" || return 1
+	done | git -C loose update-ref --stdin &&
+	git -C loose symbolic-ref refs/heads/sym refs/tags/base &&
+	echo garbage >loose/.git/refs/heads/broken &&
+	echo $ZERO_OID >loose/.git/refs/heads/zero &&
+
+	GIT_TEST_LOOSE_REFS_THREADS=1 git -C loose for-each-ref \
+		--format="%(refname) %(objectname) %(symref)" \
+		>expect 2>expect.err &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" GIT_TEST_LOOSE_REFS_THREADS=4 \
+		git -C loose for-each-ref \
+		--format="%(refname) %(objectname) %(symref)" \
+		>actual 2>actual.err &&
+	test_cmp expect actual &&
+	test_cmp expect.err actual.err &&
+	test_line_count = 83 actual &&
+	grep "\"key\":\"loose/parallel-dirs\",\"value\":\"40\"" trace.event &&
+
+	GIT_TEST_LOOSE_REFS_THREADS=4 git -C loose show-ref --head >actual &&
+	GIT_TEST_LOOSE_REFS_THREADS=1 git -C loose show-ref --head >expect &&
+	test_cmp expect actual
+'
+
 test_done
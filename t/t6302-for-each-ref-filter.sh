@@ -477,4 +477,24 @@ test_expect_success 'validate worktree atom' '
 	test_cmp expect actual
 '
 
+test_expect_success 'object atoms taken from the commit-graph' '
+	git commit-graph write --reachable &&
+	while read sort format
+	do
+		git -c core.commitGraph=false for-each-ref \
+			--sort="$sort" --format="$format" >expect &&
+		git -c core.commitGraph=true for-each-ref \
+			--sort="$sort" --format="$format" >actual &&
+		test_cmp expect actual || return 1
+	done <<-\EOF &&
+	-committerdate %(refname)
+	creatordate %(refname) %(objecttype)
+	refname %(objectname) %(objecttype) %(committerdate:unix)
+	refname %(committerdate:relative) %(creatordate:iso-local)
+	committerdate %(committerdate) %(*objectname)
+	-creatordate %(committerdate:raw) %(*objecttype)
+	EOF
+	rm -f .git/objects/info/commit-graph
+'
+
 test_done
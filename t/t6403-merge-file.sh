@@ -387,4 +387,42 @@ test_expect_success 'conflict sections match existing line endings' '
 	test $(tr "\015" Q <nolf.txt | grep "^[<=>].*Q$" | wc -l) = 0
 '
 
+
+test_expect_success 'merging in segments gives the same result' '
+	test_seq 1 2000 >seg-orig.txt &&
+	sed -e "300d" -e "500s/$/ ours/" -e "1000s/$/ ours/" \
+		-e "1800a\\
+new" seg-orig.txt >seg-diff1.txt &&
+	sed -e "500s/$/ theirs/" -e "1200s/$/ theirs/" \
+		-e "1500s/$/ theirs/" seg-orig.txt >seg-diff2.txt &&
+	sed -e "1500s/$/ different/" seg-diff1.txt >seg-diff1b.txt &&
+	for opts in "" "--diff3"
+	do
+		test_expect_code 2 git merge-file -p $opts \
+			seg-diff1b.txt seg-orig.txt seg-diff2.txt >expect.txt &&
+		test_expect_code 2 git -c merge.segmentSize=1k merge-file -p $opts \
+			seg-diff1b.txt seg-orig.txt seg-diff2.txt >output.txt &&
+		test_cmp expect.txt output.txt || return 1
+	done &&
+	git merge-file -p --union \
+		seg-diff1b.txt seg-orig.txt seg-diff2.txt >expect.txt &&
+	git -c merge.segmentSize=1k merge-file -p --union \
+		seg-diff1b.txt seg-orig.txt seg-diff2.txt >output.txt &&
+	test_cmp expect.txt output.txt &&
+	git -c merge.segmentSize=1k merge-file -p \
+		seg-diff1.txt seg-orig.txt seg-diff1.txt >output.txt &&
+	test_cmp seg-diff1.txt output.txt
+'
+
+test_expect_success 'merging in segments without lines to cut at' '
+	for i in $(test_seq 1 1000); do echo same; done >same-orig.txt &&
+	sed -e "10s/same/ours/" same-orig.txt >same-diff1.txt &&
+	sed -e "900s/same/theirs/" same-orig.txt >same-diff2.txt &&
+	git -c merge.segmentSize=1k merge-file -p \
+		same-diff1.txt same-orig.txt same-diff2.txt >output.txt &&
+	grep -n "ours\|theirs" output.txt >actual &&
+	printf "10:ours\n900:theirs\n" >expect &&
+	test_cmp expect actual
+'
+
 test_done
@@ -225,4 +225,52 @@ test_expect_success 'binary files with union attribute' '
 	grep -i "warning.*cannot merge.*HEAD vs. bin-main" stderr
 '
 
+test_expect_success 'content merges on threads honor merge attributes' '
+	git init parallel &&
+	(
+		cd parallel &&
+		cat >.gitattributes <<-\EOF &&
+		union merge=union
+		binary -merge
+		marker conflict-marker-size=12
+		EOF
+		for f in text marker union binary clean
+		do
+			test_write_lines 1 2 3 4 5 6 7 8 9 >$f || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		git checkout -b side &&
+		for f in text marker union binary
+		do
+			test_write_lines 1 2 3 side 5 6 7 8 9 >$f || return 1
+		done &&
+		test_write_lines 1 2 3 4 5 6 7 8 side >clean &&
+		git commit -am side &&
+		git checkout main &&
+		for f in text marker union binary
+		do
+			test_write_lines 1 2 3 main 5 6 7 8 9 >$f || return 1
+		done &&
+		test_write_lines main 2 3 4 5 6 7 8 9 >clean &&
+		git commit -am main &&
+
+		test_must_fail env GIT_TEST_MERGE_THREADS=1 \
+			git merge -s ort side &&
+		git ls-files -s >expect.index &&
+		cat text marker union binary clean >expect.files &&
+		git reset --hard &&
+
+		test_must_fail env GIT_TEST_MERGE_THREADS=4 \
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			GIT_TRACE2_EVENT_NESTING=10 \
+			git merge -s ort side &&
+		git ls-files -s >actual.index &&
+		cat text marker union binary clean >actual.files &&
+		test_cmp expect.index actual.index &&
+		test_cmp expect.files actual.files &&
+		grep "\"key\":\"parallel content merges\",\"value\":\"3\"" trace.event
+	)
+'
+
 test_done
@@ -4888,8 +4888,11 @@ test_expect_merge_algorithm failure success '12f: Trivial directory resolve, cac
 		git rev-parse Bmod:folder/subdir/newsubdir/e >actual &&
 		test_cmp expect actual &&
 
+		# The pick of B1 redoes collect_merge_info after finding
+		# the directory rename; the pick of B2 reuses the renames
+		# cached by the first one and need not.
 		grep region_enter.*collect_merge_info trace.output >collect &&
-		test_line_count = 4 collect &&
+		test_line_count = 3 collect &&
 		grep region_enter.*process_entries$ trace.output >process &&
 		test_line_count = 2 process
 	)
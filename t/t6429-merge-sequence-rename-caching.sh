@@ -3,6 +3,7 @@
 test_description="remember regular & dir renames in sequence of merges"
 
 . ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-rebase.sh
 
 #
 # NOTE 1: this testfile tends to not only rename files, but modify on both
@@ -17,8 +18,10 @@ test_description="remember regular & dir renames in sequence of merges"
 #         after EACH merge, which updates the index and working copy AND
 #         throws away the cached results (because merge_switch_to_result()
 #         is only supposed to be called at the end of the sequence).
-#         Integrating them more deeply is a big task, so for now the tests
-#         use 'test-tool fast-rebase'.
+#         Only the cached renames are kept from one pick to the next, in
+#         the sequencer's state directory.  Integrating them more deeply
+#         is a big task, so except for the last tests, the tests use
+#         'test-tool fast-rebase'.
 #
 
 
@@ -697,4 +700,76 @@ test_expect_success 'caching renames only on upstream side, part 2' '
 	)
 '
 
+
+#
+# The same two picks as in "cherry-pick both a commit and its immediate
+# revert", but done by the sequencer, which keeps the cached renames in
+# its state directory from one merge to the next.  Without the cache the
+# revert would not apply.
+#
+test_expect_success 'sequencer keeps cached renames between picks' '
+	test_create_repo sequencer-rename-cache &&
+	(
+		cd sequencer-rename-cache &&
+
+		test_seq 11 30 >numbers &&
+		git add numbers &&
+		git commit -m orig &&
+
+		git branch upstream &&
+		git branch topic &&
+
+		git switch upstream &&
+		test_seq 1 30 >numbers &&
+		git add numbers &&
+		git mv numbers sequence &&
+		git commit -m "Renamed (and modified) numbers -> sequence" &&
+
+		git switch topic &&
+
+		test_seq 11 13 >numbers &&
+		git add numbers &&
+		git commit -m A &&
+
+		git revert HEAD &&
+
+		#
+		# Actual testing
+		#
+
+		git switch upstream &&
+
+		GIT_TRACE2_PERF="$(pwd)/trace.output" \
+			git cherry-pick --strategy=ort upstream~1..topic &&
+
+		grep region_enter.*diffcore_rename trace.output >calls &&
+		test_line_count = 1 calls &&
+		test_seq 1 30 >expect &&
+		test_cmp expect sequence
+	)
+'
+
+test_expect_success 'cached renames survive a stop of rebase -i' '
+	(
+		cd sequencer-rename-cache &&
+
+		git switch -c rebased upstream~1 &&
+		git reset --hard topic &&
+
+		(
+			set_fake_editor &&
+			FAKE_LINES="1 break 2" \
+				git rebase -i --strategy=ort upstream
+		) &&
+		test_path_is_file .git/rebase-merge/rename-cache &&
+
+		rm -f trace.output &&
+		GIT_TRACE2_PERF="$(pwd)/trace.output" git rebase --continue &&
+
+		! grep region_enter.*diffcore_rename trace.output &&
+		test_seq 1 30 >expect &&
+		test_cmp expect sequence
+	)
+'
+
 test_done
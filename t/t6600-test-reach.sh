@@ -443,4 +443,28 @@ test_expect_success 'get_reachable_subset:none' '
 	test_all_modes get_reachable_subset
 '
 
+test_expect_success 'for-each-ref ahead-behind' '
+	>input &&
+	cat >expect <<-\EOF &&
+	commit-1-10 5 20 2 8
+	commit-10-1 5 20 8 14
+	commit-5-5 0 0 15 6
+	commit-7-3 6 10 15 10
+	commit-9-9 56 0 65 0
+	tag-7-3 6 10 15 10
+	EOF
+	run_all_modes git for-each-ref \
+		--format="%(refname:lstrip=2) %(ahead-behind:commit-5-5) %(ahead-behind:commit-2-8)" \
+		refs/heads/commit-1-10 refs/heads/commit-10-1 \
+		refs/heads/commit-5-5 refs/heads/commit-7-3 \
+		refs/heads/commit-9-9 refs/tags/tag-7-3
+'
+
+test_expect_success 'for-each-ref ahead-behind needs a commit' '
+	test_must_fail git for-each-ref --format="%(ahead-behind)" 2>err &&
+	grep "expected format" err &&
+	test_must_fail git for-each-ref --format="%(ahead-behind:missing)" 2>err &&
+	grep "failed to find" err
+'
+
 test_done
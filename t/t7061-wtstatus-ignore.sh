@@ -313,4 +313,25 @@ test_expect_success 'status ignores submodule in excluded directory' '
 	test_cmp expected actual
 '
 
+test_expect_success PTHREADS 'searching with several threads gives the same results' '
+	mkdir -p wide/a/b wide/c/d wide/ignored/e wide/empty &&
+	for f in wide/a/1 wide/a/b/2 wide/c/d/3 wide/ignored/e/4 wide/c/5.o
+	do
+		: >$f || return 1
+	done &&
+	echo "*.o" >wide/.gitignore &&
+	echo "/ignored/" >>wide/.gitignore &&
+	git init wide/c/nested &&
+	for args in "" "-uall" "--ignored" "-uall --ignored" \
+		    "--ignored=matching" "-uall --ignored=matching"
+	do
+		git -c core.untrackedThreads=1 status --porcelain $args >expect &&
+		git -c core.untrackedThreads=4 status --porcelain $args >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	git -c core.untrackedThreads=1 clean -ndx >expect &&
+	git -c core.untrackedThreads=4 clean -ndx >actual &&
+	test_cmp expect actual
+'
+
 test_done
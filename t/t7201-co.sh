@@ -657,4 +657,41 @@ test_expect_success 'custom merge driver with checkout -m' '
 	test_cmp expect arm
 '
 
+test_expect_success 'checkout.closeThreads leaves the index up to date' '
+	git init close-threads &&
+	(
+		cd close-threads &&
+		mkdir -p a/b/c &&
+		for i in $(test_seq 20)
+		do
+			echo $i >a/b/c/file$i &&
+			echo $i >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m "many files"
+	) &&
+	git -c checkout.closeThreads=3 clone close-threads close-threads-clone &&
+	git -C close-threads-clone diff-files --exit-code &&
+	test_cmp close-threads/a/b/c/file20 close-threads-clone/a/b/c/file20
+'
+
+test_expect_success ULIMIT_FILE_DESCRIPTORS 'checkout.closeThreads keeps few files open' '
+	git init close-threads-limit &&
+	(
+		cd close-threads-limit &&
+		for i in $(test_seq 200)
+		do
+			echo $i >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m "more files than open file descriptors" &&
+		rm file* &&
+		run_with_limited_open_files \
+			git -c checkout.closeThreads=4 checkout -f HEAD &&
+		git diff-files --exit-code &&
+		echo 200 >expect &&
+		test_cmp expect file200
+	)
+'
+
 test_done
@@ -129,6 +129,15 @@ test_expect_success 'transfer.fsckObjects handles odd pack (index)' '
 	test_must_fail git -C dst.git index-pack --strict --stdin <odd.pack
 '
 
+test_expect_success 'transfer.fsckObjects handles odd pack (threaded index)' '
+	rm -rf dst.git &&
+	git init --bare dst.git &&
+	test_must_fail env GIT_FORCE_THREADS=1 \
+		git -C dst.git index-pack --strict --threads=2 --stdin \
+		<odd.pack 2>output &&
+	grep gitmodulesName output
+'
+
 test_expect_success 'index-pack --strict works for non-repo pack' '
 	rm -rf dst.git &&
 	git init --bare dst.git &&
@@ -409,4 +409,25 @@ test_expect_success 'status with added file in nested submodule (short)' '
 	EOF
 '
 
+test_expect_success 'status and diff ask submodules in parallel' '
+	git -C super status --porcelain=2 >expect.status &&
+	git -C super diff HEAD >expect.diff-index &&
+	git -C super diff --submodule=short >expect.diff-files &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C super -c submodule.diffJobs=3 status --porcelain=2 \
+		>actual.status &&
+	git -C super -c submodule.diffJobs=3 diff HEAD >actual.diff-index &&
+	git -C super -c submodule.diffJobs=0 diff --submodule=short \
+		>actual.diff-files &&
+	test_cmp expect.status actual.status &&
+	test_cmp expect.diff-index actual.diff-index &&
+	test_cmp expect.diff-files actual.diff-files &&
+	grep "\"region_enter\".*\"label\":\"parallel/status\"" trace.event
+'
+
+test_expect_success 'submodule.diffJobs must not be negative' '
+	test_must_fail git -C super -c submodule.diffJobs=-1 status 2>err &&
+	test_i18ngrep "negative values not allowed" err
+'
+
 test_done
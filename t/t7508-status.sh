@@ -1656,4 +1656,23 @@ test_expect_success '--no-optional-locks prevents index update' '
 	! grep ^1234567890 out
 '
 
+test_expect_success 'untracked files collected on a thread give the same status' '
+	mkdir -p parallel/sub &&
+	>parallel/tracked &&
+	>parallel/sub/tracked &&
+	git add parallel &&
+	echo change >parallel/tracked &&
+	>parallel/untracked &&
+	>parallel/sub/untracked &&
+	>parallel/ignored.log &&
+	echo "*.log" >parallel/.gitignore &&
+	git rm --cached -q parallel/sub/tracked &&
+	GIT_TEST_PARALLEL_STATUS=0 git status --porcelain --ignored >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/.git/trace.event" GIT_TEST_PARALLEL_STATUS=1 \
+		git status --porcelain --ignored >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"parallel\",\"value\":\"1\"" .git/trace.event &&
+	grep "status_untracked" .git/trace.event
+'
+
 test_done
@@ -337,6 +337,30 @@ test_expect_success GPG 'show double signature with custom format' '
 	test_cmp expect actual
 '
 
+test_expect_success GPG 'verify-commit runs several verifiers at once' '
+	commits="initial second merge fourth-unsigned fourth-signed \
+		 fifth-signed sixth-signed eighth-signed-alt \
+		 $(cat double-commit.commit)" &&
+	test_must_fail git -c gpg.verifyJobs=1 \
+		verify-commit --raw $commits 2>expect &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c gpg.verifyJobs=4 verify-commit --raw $commits 2>actual &&
+	test_cmp expect actual &&
+	grep -o "\"event\":\"child_[a-z]*\"" trace.event >events &&
+	head -n 2 events >first &&
+	test_line_count = 2 first &&
+	! grep child_exit first &&
+	test $(grep -c child_start events) = 8
+'
+
+test_expect_success GPG 'log --show-signature runs several verifiers at once' '
+	git -c gpg.verifyJobs=1 log --show-signature --format="%h %G? %GK" \
+		main sixth-signed $(cat double-commit.commit) >expect &&
+	git -c gpg.verifyJobs=4 log --show-signature --format="%h %G? %GK" \
+		main sixth-signed $(cat double-commit.commit) >actual &&
+	test_cmp expect actual
+'
+
 
 test_expect_success GPG 'verify-commit verifies multiply signed commits' '
 	git init multiply-signed &&
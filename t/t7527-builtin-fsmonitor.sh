@@ -0,0 +1,190 @@
+#!/bin/sh
+
+test_description='built-in file system watcher'
+
+. ./test-lib.sh
+
+if test -z "$FSMONITOR_DAEMON_BACKEND"
+then
+	skip_all="fsmonitor--daemon is not supported on this platform"
+	test_done
+fi
+
+stop_daemon_delete_repo () {
+	r=$1 &&
+	test_might_fail git -C $r fsmonitor--daemon stop &&
+	rm -rf $r
+}
+
+start_daemon () {
+	git -C "${1:-.}" fsmonitor--daemon start
+}
+
+# Ask the daemon watching "repo" for the changes since the token in
+# its index, and list the paths it reports.
+changed_paths () {
+	GIT_TRACE_FSMONITOR="$(pwd)/trace.fsm" \
+		git -C repo status --porcelain >/dev/null &&
+	sed -n "s/.*fsmonitor_refresh_callback '\(.*\)'$/\1/p" trace.fsm | sort &&
+	rm -f trace.fsm
+}
+
+test_expect_success 'explicit daemon start and stop' '
+	test_when_finished "stop_daemon_delete_repo test_explicit" &&
+
+	git init test_explicit &&
+	start_daemon test_explicit &&
+
+	git -C test_explicit fsmonitor--daemon status &&
+	git -C test_explicit fsmonitor--daemon stop &&
+	test_must_fail git -C test_explicit fsmonitor--daemon status
+'
+
+test_expect_success 'cannot start a second daemon' '
+	test_when_finished "stop_daemon_delete_repo test_twice" &&
+
+	git init test_twice &&
+	start_daemon test_twice &&
+	test_must_fail git -C test_twice fsmonitor--daemon start 2>err &&
+	grep "already running" err
+'
+
+test_expect_success 'implicit daemon start' '
+	test_when_finished "stop_daemon_delete_repo test_implicit" &&
+
+	git init test_implicit &&
+	test_must_fail git -C test_implicit fsmonitor--daemon status &&
+
+	# query will implicitly start the daemon.
+	GIT_TRACE2_EVENT="$(pwd)/.git/trace" \
+		git -C test_implicit -c core.fsmonitor=true status >actual &&
+	grep "\"category\":\"fsm_client\"" .git/trace &&
+
+	git -C test_implicit fsmonitor--daemon status
+'
+
+# Ask whether a daemon is listening on the socket in the repository
+# "test_removed.git", which may have lost its worktree.
+removed_daemon_status () {
+	git --git-dir=test_removed.git --work-tree=. fsmonitor--daemon status
+}
+
+test_expect_success 'daemon stops when the worktree is removed' '
+	test_when_finished "rm -rf test_removed test_removed.git" &&
+
+	# Keep the repository, and the daemon socket in it, out of the
+	# worktree, so that removing the worktree leaves them behind.
+	git init --separate-git-dir test_removed.git test_removed &&
+	start_daemon test_removed &&
+	removed_daemon_status &&
+	rm -rf test_removed &&
+
+	for i in $(test_seq 1 100)
+	do
+		test_expect_code 1 removed_daemon_status && return 0
+		sleep 0.1
+	done &&
+	echo "daemon did not stop after its worktree was removed" >&2 &&
+	false
+'
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		mkdir -p dir1/sub dir2 &&
+		for f in modified delete rename dir1/modified dir1/delete \
+			 dir1/sub/file dir2/modified
+		do
+			echo 1 >$f || return 1
+		done &&
+		git add . &&
+		test_tick &&
+		git commit -m initial &&
+
+		git config core.fsmonitor true &&
+		start_daemon &&
+		git update-index --fsmonitor &&
+		# The first query has no token from the daemon yet
+		git status
+	)
+'
+
+test_expect_success 'no changes are reported without changes' '
+	changed_paths >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'modified, new and deleted files are reported' '
+	echo 2 >repo/modified &&
+	echo 2 >repo/dir1/modified &&
+	echo 1 >repo/new &&
+	echo 1 >repo/dir2/new &&
+	rm repo/delete repo/dir1/delete &&
+
+	cat >expect <<-\EOF &&
+	delete
+	dir1/delete
+	dir1/modified
+	dir2/new
+	modified
+	new
+	EOF
+	changed_paths >actual &&
+	test_cmp expect actual &&
+
+	changed_paths >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'directory renames and new directories are reported' '
+	mv repo/dir1 repo/dir3 &&
+	mkdir repo/newdir &&
+
+	cat >expect <<-\EOF &&
+	dir1
+	dir3
+	newdir
+	EOF
+	changed_paths >actual &&
+	test_cmp expect actual &&
+
+	# the new and renamed directories are watched, too
+	echo 3 >repo/dir3/sub/file &&
+	: >repo/newdir/file &&
+	cat >expect <<-\EOF &&
+	dir3/sub/file
+	newdir/file
+	EOF
+	changed_paths >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status matches the one without fsmonitor' '
+	(
+		cd repo &&
+		echo 4 >rename &&
+		git mv rename renamed &&
+		echo 5 >dir2/modified &&
+		git -c core.fsmonitor=false status --porcelain >../expect &&
+		git status --porcelain >../actual
+	) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a restarted daemon sends a trivial response' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.restart" git -C repo status &&
+	! grep "query/trivial-response" trace.restart &&
+
+	git -C repo fsmonitor--daemon stop &&
+	start_daemon repo &&
+	rm -f trace.restart &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.restart" git -C repo status &&
+	grep "query/trivial-response" trace.restart
+'
+
+test_expect_success 'cleanup' '
+	git -C repo fsmonitor--daemon stop
+'
+
+test_done
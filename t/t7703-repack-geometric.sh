@@ -180,4 +180,38 @@ test_expect_success '--geometric ignores kept packs' '
 	)
 '
 
+test_expect_success '--geometric --write-midx writes a multi-pack bitmap' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 --message="large" 8 &&
+		git repack -d &&
+		test_commit_bulk --start=9 1 &&
+		git repack &&
+		test_commit_bulk --start=10 1 &&
+		git repack &&
+
+		test_must_fail git repack --geometric 2 -d -b 2>err &&
+		test_i18ngrep "incompatible with bitmap" err &&
+
+		git repack --geometric 2 -d -b --write-midx &&
+		find $objdir/pack -name "*.pack" >packs &&
+		test_line_count = 2 packs &&
+
+		test_path_is_file $midx &&
+		ls $midx-*.bitmap >bitmaps &&
+		test_line_count = 1 bitmaps &&
+		git multi-pack-index verify &&
+
+		git rev-list --objects --no-object-names HEAD >expect.raw &&
+		git rev-list --objects --no-object-names --use-bitmap-index \
+			HEAD >actual.raw &&
+		sort expect.raw >expect &&
+		sort actual.raw >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
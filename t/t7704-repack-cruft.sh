@@ -0,0 +1,107 @@
+#!/bin/sh
+
+test_description='git repack --cruft packs unreachable objects separately'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+loose_path () {
+	echo $objdir/$(test_oid_to_path "$1")
+}
+
+# Write an unreachable blob with the given contents and mtime (relative
+# to now), and print its name.
+unreachable_blob () {
+	oid=$(echo "$1" | git hash-object -w --stdin) &&
+	test-tool chmtime =$2 "$(loose_path $oid)" &&
+	echo $oid
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git checkout -b transient &&
+	test_commit --no-tag transient &&
+	git rev-parse HEAD >transient &&
+	git checkout main &&
+	git branch -D transient &&
+	git reflog expire --expire=all --all &&
+	git repack -ad
+'
+
+test_expect_success '--cruft is incompatible with -A and -k' '
+	test_must_fail git repack -d --cruft -A 2>err &&
+	test_i18ngrep "incompatible" err &&
+	test_must_fail git repack -d --cruft -k 2>err &&
+	test_i18ngrep "incompatible" err &&
+	test_must_fail git repack -ad --cruft-expiration=now 2>err &&
+	test_i18ngrep "requires --cruft" err
+'
+
+test_expect_success '--cruft without -d writes no cruft pack' '
+	git repack --cruft &&
+	test_path_is_missing $packdir/pack-*.mtimes
+'
+
+test_expect_success '--cruft -d packs unreachable objects' '
+	blob=$(unreachable_blob recent -3600) &&
+	git repack -d --cruft &&
+	test_path_is_missing "$(loose_path $blob)" &&
+	ls $packdir/pack-*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	cruft=$(sed -e "s/\.mtimes$/.idx/" mtimes) &&
+	git show-index <$cruft >objects &&
+	grep $blob objects &&
+	grep $(cat transient) objects &&
+	! grep $(git rev-parse HEAD) objects &&
+	git cat-file -e $blob &&
+	git fsck
+'
+
+test_expect_success 'cruft objects keep their own mtimes' '
+	old=$(unreachable_blob old -2000000) &&
+	young=$(unreachable_blob young -3600) &&
+	git repack -d --cruft &&
+	test_path_is_missing "$(loose_path $old)" &&
+	git cat-file -e $old &&
+	git repack -d --cruft --cruft-expiration=2.weeks.ago &&
+	test_must_fail git cat-file -e $old &&
+	git cat-file -e $young &&
+	git cat-file -e $(cat transient)
+'
+
+test_expect_success 'old objects reachable from recent cruft are kept' '
+	old=$(unreachable_blob dependency -2000000) &&
+	tree=$(printf "100644 blob $old\tfile\n" | git mktree) &&
+	commit=$(git commit-tree -m recent $tree) &&
+	git repack -d --cruft --cruft-expiration=2.weeks.ago &&
+	git cat-file -e $commit &&
+	git cat-file -e $old &&
+	test_path_is_missing "$(loose_path $old)"
+'
+
+test_expect_success '-A loosens cruft objects with their own mtimes' '
+	young=$(unreachable_blob loosened -3600) &&
+	git repack -d --cruft &&
+	test_path_is_missing "$(loose_path $young)" &&
+	git repack -Ad --unpack-unreachable=2.weeks.ago &&
+	test_path_is_missing $packdir/pack-*.mtimes &&
+	test-tool chmtime --get "$(loose_path $young)" >actual &&
+	now=$(test-tool chmtime --get $packdir/pack-*.pack) &&
+	test $(cat actual) -lt $(($now - 1800))
+'
+
+test_expect_success 'gc.cruftPacks packs unreachable objects' '
+	blob=$(unreachable_blob gc -3600) &&
+	git -c gc.cruftPacks=true gc &&
+	test_path_is_missing "$(loose_path $blob)" &&
+	ls $packdir/pack-*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	git cat-file -e $blob
+'
+
+test_done
@@ -978,6 +978,18 @@ do
 	"
 done
 
+test_expect_success 'grep --threads=N in a revision' '
+	git grep --threads=1 -n . HEAD >expect &&
+	git grep --threads=1 -n . HEAD -- t >expect.t &&
+	for threads in 2 4 8
+	do
+		git grep --threads=$threads -n . HEAD >actual &&
+		test_cmp expect actual &&
+		git grep --threads=$threads -n . HEAD -- t >actual &&
+		test_cmp expect.t actual || return 1
+	done
+'
+
 test_expect_success !PTHREADS,!FAIL_PREREQS \
 	'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
@@ -1022,6 +1034,50 @@ test_expect_success 'grep -Fi' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep -F with many fixed strings' '
+	cat >patterns <<-\EOF &&
+	CHAR *
+	world.
+	nothing like this
+	HeLLo_
+	EOF
+	cat >expected <<-\EOF &&
+	hello.c:	printf("Hello world.\n");
+	hello_world:HeLLo_world
+	hello.ps1:  echo "Hello world."
+	EOF
+	git grep -F -f patterns >actual &&
+	sort expected >expected.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expected.sorted actual.sorted
+'
+
+test_expect_success 'grep -Fi with many fixed strings' '
+	cat >patterns <<-\EOF &&
+	CHAR *
+	hello_
+	EOF
+	cat >expected <<-\EOF &&
+	hello.c:int main(int argc, const char **argv)
+	hello_world:Hello_world
+	hello_world:HeLLo_world
+	EOF
+	git grep -Fi -f patterns >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep -Fw with many fixed strings' '
+	cat >expected <<-\EOF &&
+	file:foo mmap bar
+	file:foo_mmap bar mmap
+	file:foo mmap bar_mmap
+	file:foo_mmap bar mmap baz
+	hello_world:Hello world
+	EOF
+	git grep -Fw -e mmap -e Hello -e bar_ file hello_world >actual &&
+	test_cmp expected actual
+'
+
 test_expect_success 'outside of git repository' '
 	rm -fr non &&
 	mkdir -p non/git/sub &&
@@ -1749,4 +1805,25 @@ test_expect_success 'grep does not report i-t-a and assume unchanged with -L' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep -F when the rarest byte of the string is common' '
+	{
+		printf "%0500d" 0 | tr 0 z &&
+		echo qzx &&
+		printf "%0500d" 0 | tr 0 9 &&
+		echo X9Y
+	} >common &&
+	cat >expect <<-\EOF &&
+	common:1:qzx
+	common:2:X9Y
+	EOF
+	git grep --no-index -n -o -F -e qzx -e X9Y common >actual &&
+	test_cmp expect actual &&
+	git grep --no-index -n -o -F qzx common >actual &&
+	head -n 1 expect >expect.1 &&
+	test_cmp expect.1 actual &&
+	git grep --no-index -n -o -F -i x9y common >actual &&
+	tail -n 1 expect >expect.2 &&
+	test_cmp expect.2 actual
+'
+
 test_done
@@ -162,6 +162,29 @@ test_expect_success 'prefetch multiple remotes' '
 	test_subcommand git fetch remote2 $fetchargs <skip-remote1.txt
 '
 
+test_expect_success 'promisor-prefetch fetches the blobs of the upstream' '
+	test_when_finished "rm -rf server client" &&
+	git init server &&
+	test_commit -C server one &&
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --filter=blob:none "file://$(pwd)/server" client &&
+
+	test_commit -C server two &&
+	git -C client fetch origin &&
+	git -C client rev-list --objects --missing=print origin/HEAD >missing &&
+	grep "^?$(git -C server rev-parse HEAD:two.t)" missing &&
+
+	git -C client maintenance run --task=promisor-prefetch &&
+	git -C client rev-list --objects --missing=print origin/HEAD >missing &&
+	! grep "^?" missing
+'
+
+test_expect_success 'promisor-prefetch without a promisor remote' '
+	git maintenance run --task=promisor-prefetch 2>err &&
+	test_must_be_empty err
+'
+
 test_expect_success 'prefetch and existing log.excludeDecoration values' '
 	git config --unset-all log.excludeDecoration &&
 	git config log.excludeDecoration refs/remotes/remote1/ &&
@@ -243,6 +266,41 @@ test_expect_success 'maintenance.loose-objects.auto' '
 	test_subcommand git prune-packed --quiet <trace-loC
 '
 
+test_expect_success 'loose-objects task with core.looseObjectJournal' '
+	test_when_finished "rm -f .git/objects/info/loose-journal*" &&
+	git repack -adk &&
+	git config core.looseObjectJournal true &&
+	test_when_finished "git config --unset core.looseObjectJournal" &&
+	git maintenance run --task=loose-objects &&
+	test_must_be_empty .git/objects/info/loose-journal &&
+
+	journaled=$(echo journaled | git hash-object -w --stdin) &&
+	hidden=$(echo hidden |
+		 git -c core.looseObjectJournal=false hash-object -w --stdin) &&
+	echo $journaled >expect &&
+	test_cmp expect .git/objects/info/loose-journal &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace-journal" \
+		git -c maintenance.loose-objects.auto=2 \
+		maintenance run --auto --task=loose-objects 2>/dev/null &&
+	test_subcommand ! git prune-packed --quiet <trace-journal &&
+
+	git maintenance run --task=loose-objects &&
+	test_must_be_empty .git/objects/info/loose-journal &&
+	test_path_is_missing .git/objects/info/loose-journal.packing &&
+	git maintenance run --task=loose-objects &&
+	test_path_is_missing .git/objects/$(test_oid_to_path $journaled) &&
+	test_path_is_file .git/objects/$(test_oid_to_path $hidden) &&
+	git cat-file -e $journaled &&
+
+	git -c core.looseObjectJournal=false \
+		maintenance run --task=loose-objects &&
+	test_path_is_missing .git/objects/info/loose-journal &&
+	git -c core.looseObjectJournal=false \
+		maintenance run --task=loose-objects &&
+	test_path_is_missing .git/objects/$(test_oid_to_path $hidden)
+'
+
 test_expect_success 'incremental-repack task' '
 	packDir=.git/objects/pack &&
 	for i in $(test_seq 1 5)
@@ -0,0 +1,67 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+. ./test-lib.sh
+
+test_expect_success setup '
+	for i in $(test_seq 12)
+	do
+		test_seq $((i * 3)) | sed "s/^$i\$/changed $i/" >file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git mv file renamed &&
+	echo more >>renamed &&
+	git commit -a -m rename
+'
+
+test_expect_success 'cached blame is written and reused' '
+	git blame --porcelain HEAD~4 -- file >expect &&
+	git -c blame.cache=true blame --porcelain HEAD~4 -- file >actual &&
+	test_cmp expect actual &&
+	test_path_is_dir .git/blame-cache &&
+	git -c blame.cache=true blame --porcelain --show-stats HEAD~4 -- file >actual &&
+	grep "^num commits: 0" actual &&
+	sed "/^num /d" actual >actual.blame &&
+	test_cmp expect actual.blame
+'
+
+test_expect_success 'blame of a descendant starts from the cache' '
+	git blame --porcelain HEAD -- renamed >expect &&
+	git -c blame.cache=true blame --porcelain --show-stats HEAD -- renamed >actual &&
+	grep "^num commits: [1-5]\$" actual &&
+	sed "/^num /d" actual >actual.blame &&
+	test_cmp expect actual.blame
+'
+
+test_expect_success 'blame of the working tree uses the cache' '
+	echo local >>renamed &&
+	git blame renamed >expect &&
+	git -c blame.cache=true blame renamed >actual &&
+	test_cmp expect actual &&
+	git checkout renamed
+'
+
+test_expect_success 'cache is keyed on options that change the result' '
+	git -c blame.cache=true blame --show-stats -w HEAD -- renamed >actual &&
+	! grep "^num commits: [01]\$" actual
+'
+
+test_expect_success 'partial blame is not cached' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame -L1,3 HEAD~2 -- file &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'corrupt cache files are ignored' '
+	git -c blame.cache=true blame HEAD~2 -- file >expect &&
+	for f in $(find .git/blame-cache -type f)
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	git -c blame.cache=true blame HEAD~2 -- file >actual &&
+	test_cmp expect actual
+'
+
+test_done
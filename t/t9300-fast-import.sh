@@ -3533,4 +3533,44 @@ test_expect_success 'Y: rewrite submodules' '
 	)
 '
 
+###
+### series Z (threads)
+###
+
+test_expect_success 'Z: --threads imports the same history' '
+	test-tool genrandom Z 1500000 >Z-random &&
+	for i in $(test_seq 1 30)
+	do
+		cat <<-EOF &&
+		blob
+		mark :$i
+		data <<EOD
+		EOF
+		test_copy_bytes $((50000 * $i)) <Z-random &&
+		echo &&
+		echo EOD || return 1
+	done >Z-input &&
+	cat >>Z-input <<-EOF &&
+	commit refs/heads/Z
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+	data 0
+	EOF
+	for i in $(test_seq 1 30)
+	do
+		echo "M 100644 :$i file$i" || return 1
+	done >>Z-input &&
+
+	git init Z-serial &&
+	git -C Z-serial fast-import --threads=1 <Z-input &&
+	git init Z-threaded &&
+	git -C Z-threaded -c fastimport.unpackLimit=0 \
+		fast-import --threads=4 --max-pack-size=1m <Z-input &&
+	ls Z-threaded/.git/objects/pack/*.pack >packs &&
+	test_line_count -gt 1 packs &&
+	git -C Z-serial rev-parse Z >expect &&
+	git -C Z-threaded rev-parse Z >actual &&
+	test_cmp expect actual &&
+	git -C Z-threaded fsck
+'
+
 test_done
@@ -219,6 +219,28 @@ test_expect_success 'import/export-marks' '
 
 '
 
+test_expect_success 'binary marks' '
+	git fast-export --export-marks=text-marks HEAD~ >/dev/null &&
+	git fast-export --marks-format=binary \
+		--export-marks=binary-marks HEAD~ >/dev/null &&
+	! test_cmp text-marks binary-marks &&
+	git fast-export --import-marks=text-marks HEAD >expect &&
+	git fast-export --import-marks=binary-marks \
+		--marks-format=binary --export-marks=binary-marks \
+		HEAD >actual &&
+	test_cmp expect actual &&
+	test $(grep ^commit\  actual | wc -l) -eq 1 &&
+	git fast-export --import-marks=binary-marks HEAD >actual &&
+	! grep ^commit actual &&
+	test_must_fail git fast-export --marks-format=nonsense HEAD
+'
+
+test_expect_success '--threads does not change the output' '
+	git fast-export --threads=1 --all >expect &&
+	git fast-export --threads=4 --all >actual &&
+	test_cmp expect actual
+'
+
 cat > signed-tag-import << EOF
 tag sign-your-name
 from $(git rev-parse HEAD)
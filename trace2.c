@@ -8,11 +8,14 @@
 #include "version.h"
 #include "trace2/tr2_cfg.h"
 #include "trace2/tr2_cmd_name.h"
+#include "trace2/tr2_ctr.h"
+#include "trace2/tr2_mem.h"
 #include "trace2/tr2_dst.h"
 #include "trace2/tr2_sid.h"
 #include "trace2/tr2_sysenv.h"
 #include "trace2/tr2_tgt.h"
 #include "trace2/tr2_tls.h"
+#include "trace2/tr2_tmr.h"
 
 static int trace2_enabled;
 
@@ -31,6 +34,7 @@ static struct tr2_tgt *tr2_tgt_builtins[] =
 	&tr2_tgt_normal,
 	&tr2_tgt_perf,
 	&tr2_tgt_event,
+	&tr2_tgt_profile,
 	NULL
 };
 /* clang-format on */
@@ -93,6 +97,43 @@ static int tr2main_exit_code;
  * the pager's atexit routine (since it closes them to shutdown
  * the pipes).
  */
+/*
+ * Add the timers and counters of the current thread to the totals,
+ * reporting them on their own first if they want to.
+ */
+static void tr2_report_thread_timers_and_counters(void)
+{
+	struct tr2_tgt *tgt_j;
+	int j;
+
+	for_each_wanted_builtin (j, tgt_j) {
+		if (tgt_j->pfn_timer)
+			tr2_emit_per_thread_timers(tgt_j->pfn_timer);
+		if (tgt_j->pfn_counter)
+			tr2_emit_per_thread_counters(tgt_j->pfn_counter);
+	}
+
+	tr2tls_lock();
+	tr2_update_final_timers();
+	tr2_update_final_counters();
+	tr2tls_unlock();
+}
+
+static void tr2_report_final_timers_and_counters(void)
+{
+	struct tr2_tgt *tgt_j;
+	int j;
+
+	tr2_report_thread_timers_and_counters();
+
+	for_each_wanted_builtin (j, tgt_j) {
+		if (tgt_j->pfn_timer)
+			tr2_emit_final_timers(tgt_j->pfn_timer);
+		if (tgt_j->pfn_counter)
+			tr2_emit_final_counters(tgt_j->pfn_counter);
+	}
+}
+
 static void tr2main_atexit_handler(void)
 {
 	struct tr2_tgt *tgt_j;
@@ -110,6 +151,8 @@ static void tr2main_atexit_handler(void)
 	 */
 	tr2tls_pop_unwind_self();
 
+	tr2_report_final_timers_and_counters();
+
 	for_each_wanted_builtin (j, tgt_j)
 		if (tgt_j->pfn_atexit)
 			tgt_j->pfn_atexit(us_elapsed_absolute,
@@ -183,6 +226,24 @@ int trace2_is_enabled(void)
 	return trace2_enabled;
 }
 
+void trace2_fork_prepare(void)
+{
+	if (trace2_enabled)
+		tr2tls_lock();
+}
+
+void trace2_fork_parent(void)
+{
+	if (trace2_enabled)
+		tr2tls_unlock();
+}
+
+void trace2_fork_child(void)
+{
+	if (trace2_enabled)
+		tr2tls_reset_lock();
+}
+
 void trace2_cmd_start_fl(const char *file, int line, const char **argv)
 {
 	struct tr2_tgt *tgt_j;
@@ -214,6 +275,7 @@ int trace2_cmd_exit_fl(const char *file, int line, int code)
 	if (!trace2_enabled)
 		return code;
 
+	tr2_emit_memory_usage();
 	trace2_collect_process_info(TRACE2_PROCESS_INFO_EXIT);
 
 	tr2main_exit_code = code;
@@ -519,6 +581,8 @@ void trace2_thread_exit_fl(const char *file, int line)
 						  us_elapsed_absolute,
 						  us_elapsed_thread);
 
+	tr2_report_thread_timers_and_counters();
+
 	tr2tls_unset_self();
 }
 
@@ -806,6 +870,50 @@ void trace2_printf(const char *fmt, ...)
 }
 #endif
 
+void trace2_timer_start(enum trace2_timer_id tid)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (tid < 0 || tid >= TRACE2_NUMBER_OF_TIMERS)
+		BUG("trace2_timer_start: invalid timer id: %d", tid);
+
+	tr2_start_timer(tid);
+}
+
+void trace2_timer_stop(enum trace2_timer_id tid)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (tid < 0 || tid >= TRACE2_NUMBER_OF_TIMERS)
+		BUG("trace2_timer_stop: invalid timer id: %d", tid);
+
+	tr2_stop_timer(tid);
+}
+
+void trace2_counter_add(enum trace2_counter_id cid, uint64_t value)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (cid < 0 || cid >= TRACE2_NUMBER_OF_COUNTERS)
+		BUG("trace2_counter_add: invalid counter id: %d", cid);
+
+	tr2_counter_increment(cid, value);
+}
+
+void trace2_memory_add(enum trace2_memory_id mid, intmax_t bytes)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (mid < 0 || mid >= TRACE2_NUMBER_OF_MEMORY_IDS)
+		BUG("trace2_memory_add: invalid memory id: %d", mid);
+
+	tr2_memory_add(mid, bytes);
+}
+
 const char *trace2_session_id(void)
 {
 	return tr2_sid_get();
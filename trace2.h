@@ -92,6 +92,17 @@ void trace2_initialize_fl(const char *file, int line);
  */
 int trace2_is_enabled(void);
 
+/*
+ * Other threads may hold the lock trace2 keeps for its shared data at
+ * the time a thread calls fork(), and the child would then wait for it
+ * forever. A process that forks while running several threads installs
+ * these with pthread_atfork(), so that the forking thread holds the
+ * lock across fork() and both sides get it back released.
+ */
+void trace2_fork_prepare(void);
+void trace2_fork_parent(void);
+void trace2_fork_child(void);
+
 /*
  * Emit a 'start' event with the original (unmodified) argv.
  */
@@ -490,6 +501,74 @@ void trace2_printf(const char *fmt, ...);
 /* clang-format on */
 #endif
 
+/*
+ * Stopwatch timers and global counters.
+ *
+ * Regions and data events write an event every time, which is too
+ * expensive in hot loops.  Timers and counters instead accumulate in
+ * the calling thread and are only reported as "timer" and "counter"
+ * events when a thread exits (if the metadata in trace2/tr2_tmr.c or
+ * trace2/tr2_ctr.c asks for per-thread events) and, summed over all
+ * threads, when the process exits.  A timer reports the number of
+ * intervals it measured and their total, minimum and maximum time.
+ *
+ * To add one, add an id here and its category and name to the
+ * metadata table.  Timers and counters are not ordered by nesting
+ * and do not show up in the other events.
+ */
+enum trace2_timer_id {
+	TRACE2_TIMER_ID_TEST1, /* emits summary event only */
+	TRACE2_TIMER_ID_TEST2, /* emits summary and per-thread events */
+
+	TRACE2_TIMER_ID_UNPACK_ENTRY, /* packfile.c:unpack_entry() */
+
+	/* Leave as final value */
+	TRACE2_NUMBER_OF_TIMERS
+};
+
+void trace2_timer_start(enum trace2_timer_id tid);
+void trace2_timer_stop(enum trace2_timer_id tid);
+
+enum trace2_counter_id {
+	TRACE2_COUNTER_ID_TEST1, /* emits summary event only */
+	TRACE2_COUNTER_ID_TEST2, /* emits summary and per-thread events */
+
+	TRACE2_COUNTER_ID_TREE_DIFF_CACHE_HIT, /* tree-diff.c */
+	TRACE2_COUNTER_ID_TREE_DIFF_CACHE_MISS, /* tree-diff.c */
+
+	/* Leave as final value */
+	TRACE2_NUMBER_OF_COUNTERS
+};
+
+void trace2_counter_add(enum trace2_counter_id cid, uint64_t value);
+
+/*
+ * Memory accounting for the subsystems that tend to dominate the
+ * footprint of large operations.  A subsystem reports the bytes it
+ * allocates (positive) and releases (negative), and the peak and
+ * current usage of each is reported as a "memory" data_json event
+ * when the process exits, next to the peak RSS that
+ * trace2_collect_process_info() finds (where the platform supports
+ * it).
+ *
+ * Only bulk allocations are worth accounting for; the calls take a
+ * lock when trace2 is enabled.
+ */
+enum trace2_memory_id {
+	TRACE2_MEMORY_ID_OBJECTS, /* alloc.c object pools */
+	TRACE2_MEMORY_ID_MEM_POOL, /* mem-pool.c */
+	TRACE2_MEMORY_ID_DELTA_CACHE, /* builtin/pack-objects.c */
+	TRACE2_MEMORY_ID_DELTA_BASE_CACHE, /* packfile.c */
+	TRACE2_MEMORY_ID_BITMAP_INDEX, /* pack-bitmap.c */
+	TRACE2_MEMORY_ID_TREE_DIFF_CACHE, /* tree-diff.c */
+	TRACE2_MEMORY_ID_COMMIT_SLAB, /* commit-slab.c */
+
+	/* Leave as final value */
+	TRACE2_NUMBER_OF_MEMORY_IDS
+};
+
+void trace2_memory_add(enum trace2_memory_id mid, intmax_t bytes);
+
 /*
  * Optional platform-specific code to dump information about the
  * current and any parent process(es).  This is intended to allow
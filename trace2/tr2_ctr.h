@@ -0,0 +1,43 @@
+#ifndef TR2_CTR_H
+#define TR2_CTR_H
+
+#include "trace2.h"
+#include "trace2/tr2_tgt.h"
+
+/*
+ * Global counters.
+ *
+ * Like timers (see tr2_tmr.h), counters are accumulated in the TLS
+ * data of the calling thread, added to a process-wide total when the
+ * thread exits, and only reported in "counter" events at thread and
+ * process exit.
+ */
+
+struct tr2_counter {
+	uint64_t value;
+};
+
+struct tr2_counter_block {
+	struct tr2_counter counter[TRACE2_NUMBER_OF_COUNTERS];
+};
+
+struct tr2_counter_metadata {
+	const char *category;
+	const char *name;
+
+	/* also emit a "counter" event for each thread that used it */
+	unsigned int want_per_thread_events:1;
+};
+
+void tr2_counter_increment(enum trace2_counter_id cid, uint64_t value);
+
+/*
+ * Add the counters of the current thread to the process-wide totals.
+ * The caller must hold the TLS lock.
+ */
+void tr2_update_final_counters(void);
+
+void tr2_emit_per_thread_counters(tr2_tgt_evt_counter_t *fn);
+void tr2_emit_final_counters(tr2_tgt_evt_counter_t *fn);
+
+#endif /* TR2_CTR_H */
@@ -0,0 +1,60 @@
+#include "cache.h"
+#include "json-writer.h"
+#include "trace2/tr2_mem.h"
+#include "trace2/tr2_tls.h"
+
+struct tr2_memory {
+	intmax_t current;
+	intmax_t peak;
+};
+
+/* modified only under the TLS lock */
+static struct tr2_memory tr2_memory[TRACE2_NUMBER_OF_MEMORY_IDS];
+
+static const char *tr2_memory_names[TRACE2_NUMBER_OF_MEMORY_IDS] = {
+	[TRACE2_MEMORY_ID_OBJECTS] = "objects",
+	[TRACE2_MEMORY_ID_MEM_POOL] = "mem_pool",
+	[TRACE2_MEMORY_ID_DELTA_CACHE] = "delta_cache",
+	[TRACE2_MEMORY_ID_DELTA_BASE_CACHE] = "delta_base_cache",
+	[TRACE2_MEMORY_ID_BITMAP_INDEX] = "bitmap_index",
+	[TRACE2_MEMORY_ID_TREE_DIFF_CACHE] = "tree_diff_cache",
+	[TRACE2_MEMORY_ID_COMMIT_SLAB] = "commit_slab",
+};
+
+void tr2_memory_add(enum trace2_memory_id mid, intmax_t bytes)
+{
+	struct tr2_memory *m = &tr2_memory[mid];
+
+	tr2tls_lock();
+	m->current += bytes;
+	/*
+	 * Memory allocated before trace2 was initialized is not
+	 * accounted for, but may still be released.
+	 */
+	if (m->current < 0)
+		m->current = 0;
+	if (m->current > m->peak)
+		m->peak = m->current;
+	tr2tls_unlock();
+}
+
+void tr2_emit_memory_usage(void)
+{
+	int mid;
+
+	for (mid = 0; mid < TRACE2_NUMBER_OF_MEMORY_IDS; mid++) {
+		struct tr2_memory *m = &tr2_memory[mid];
+		struct json_writer jw = JSON_WRITER_INIT;
+
+		if (!m->peak)
+			continue;
+
+		jw_object_begin(&jw, 0);
+		jw_object_intmax(&jw, "peak_bytes", m->peak);
+		jw_object_intmax(&jw, "current_bytes", m->current);
+		jw_end(&jw);
+
+		trace2_data_json("memory", NULL, tr2_memory_names[mid], &jw);
+		jw_release(&jw);
+	}
+}
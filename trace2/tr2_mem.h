@@ -0,0 +1,22 @@
+#ifndef TR2_MEM_H
+#define TR2_MEM_H
+
+#include "trace2.h"
+
+/*
+ * Memory accounting.
+ *
+ * Subsystems report the bytes they allocate and release; we keep the
+ * process-wide current and peak usage of each and report them in
+ * "data_json" events when the process exits.
+ */
+
+void tr2_memory_add(enum trace2_memory_id mid, intmax_t bytes);
+
+/*
+ * Emit a "memory" data event for every subsystem that allocated
+ * anything.
+ */
+void tr2_emit_memory_usage(void);
+
+#endif /* TR2_MEM_H */
@@ -52,6 +52,11 @@ static struct tr2_sysenv_entry tr2_sysenv_settings[] = {
 	[TR2_SYSENV_PERF_BRIEF]    = { "GIT_TRACE2_PERF_BRIEF",
 				       "trace2.perfbrief" },
 
+	[TR2_SYSENV_PROFILE]       = { "GIT_TRACE2_PROFILE",
+				       "trace2.profiletarget" },
+	[TR2_SYSENV_PROFILE_FREQUENCY] = { "GIT_TRACE2_PROFILE_FREQUENCY",
+					   "trace2.profilefrequency" },
+
 	[TR2_SYSENV_MAX_FILES]     = { "GIT_TRACE2_MAX_FILES",
 				       "trace2.maxfiles" },
 };
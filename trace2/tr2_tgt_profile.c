@@ -0,0 +1,333 @@
+#include "cache.h"
+#include "strmap.h"
+#include "thread-utils.h"
+#include "trace2/tr2_dst.h"
+#include "trace2/tr2_sysenv.h"
+#include "trace2/tr2_tgt.h"
+#include "trace2/tr2_tls.h"
+
+/*
+ * The profile target does not write events as they happen.  Instead,
+ * a profiling timer periodically interrupts whichever thread is using
+ * the CPU, and the handler counts one sample against the region that
+ * thread is in.  At exit, the samples are written as "folded" stacks,
+ * one line per stack:
+ *
+ *     git <command>;<thread>;<category>:<label>;... <samples>
+ *
+ * which is what flame graph tools take as input.
+ */
+static struct tr2_dst tr2dst_profile = { TR2_SYSENV_PROFILE, 0, 0, 0, 0 };
+
+#if defined(ITIMER_PROF) && defined(SIGPROF) && !defined(NO_SETITIMER)
+#define TR2_PROFILE_SUPPORTED 1
+#endif
+
+#define TR2_PROFILE_DEFAULT_FREQUENCY (100)
+#define TR2_PROFILE_MAX_FREQUENCY (10000)
+
+/*
+ * Each thread builds its own tree of the region stacks it has been
+ * in, so that the signal handler only needs to bump the counter of
+ * the current frame.  The tree is folded into "profile_stacks" when
+ * the thread exits.
+ */
+struct profile_frame {
+	struct profile_frame *parent;
+	struct profile_frame *children;
+	struct profile_frame *next_sibling;
+	char *name;
+	volatile uint64_t samples;
+};
+
+static pthread_key_t profile_key;
+static struct strintmap profile_stacks;
+static struct strbuf profile_command = STRBUF_INIT;
+static pid_t profile_pid;
+static int profile_frequency = TR2_PROFILE_DEFAULT_FREQUENCY;
+
+#ifdef TR2_PROFILE_SUPPORTED
+static void profile_signal_handler(int signo)
+{
+	struct profile_frame *frame = pthread_getspecific(profile_key);
+
+	if (frame)
+		frame->samples++;
+}
+
+static void profile_set_timer(int frequency)
+{
+	struct itimerval v;
+
+	v.it_interval.tv_sec = 0;
+	v.it_interval.tv_usec = frequency ? 1000000 / frequency : 0;
+	v.it_value = v.it_interval;
+	setitimer(ITIMER_PROF, &v, NULL);
+}
+
+static void profile_start_timer(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = profile_signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGPROF, &sa, NULL);
+	profile_set_timer(profile_frequency);
+}
+
+static void profile_stop_timer(void)
+{
+	profile_set_timer(0);
+}
+#else
+static void profile_start_timer(void)
+{
+}
+
+static void profile_stop_timer(void)
+{
+}
+#endif
+
+static struct profile_frame *profile_frame_new(struct profile_frame *parent,
+					       const char *name)
+{
+	struct profile_frame *frame;
+
+	CALLOC_ARRAY(frame, 1);
+	frame->parent = parent;
+	frame->name = xstrdup(name);
+	if (parent) {
+		frame->next_sibling = parent->children;
+		parent->children = frame;
+	}
+	return frame;
+}
+
+static void profile_thread_begin(const char *name)
+{
+	pthread_setspecific(profile_key, profile_frame_new(NULL, name));
+}
+
+static void profile_fold(struct profile_frame *frame, struct strbuf *stack)
+{
+	size_t len = stack->len;
+	struct profile_frame *child;
+
+	if (len)
+		strbuf_addch(stack, ';');
+	strbuf_addstr(stack, frame->name);
+	if (frame->samples)
+		strintmap_incr(&profile_stacks, stack->buf,
+			       (intptr_t)frame->samples);
+
+	for (child = frame->children; child; child = child->next_sibling)
+		profile_fold(child, stack);
+	strbuf_setlen(stack, len);
+}
+
+static void profile_free(struct profile_frame *frame)
+{
+	while (frame->children) {
+		struct profile_frame *child = frame->children;
+		frame->children = child->next_sibling;
+		profile_free(child);
+	}
+	free(frame->name);
+	free(frame);
+}
+
+static void profile_thread_end(void)
+{
+	struct profile_frame *frame = pthread_getspecific(profile_key);
+	struct strbuf stack = STRBUF_INIT;
+
+	if (!frame)
+		return;
+	/* stop counting before we take the tree apart */
+	pthread_setspecific(profile_key, NULL);
+
+	while (frame->parent)
+		frame = frame->parent;
+
+	tr2tls_lock();
+	profile_fold(frame, &stack);
+	tr2tls_unlock();
+
+	strbuf_release(&stack);
+	profile_free(frame);
+}
+
+static int fn_init(void)
+{
+	int want = tr2_dst_trace_want(&tr2dst_profile);
+	const char *frequency;
+
+	if (!want)
+		return want;
+#ifndef TR2_PROFILE_SUPPORTED
+	/* without a profiling timer there would be nothing to report */
+	tr2_dst_trace_disable(&tr2dst_profile);
+	return 0;
+#endif
+
+	frequency = tr2_sysenv_get(TR2_SYSENV_PROFILE_FREQUENCY);
+	if (frequency && *frequency) {
+		int f = atoi(frequency);
+		if (f > 0)
+			profile_frequency = f < TR2_PROFILE_MAX_FREQUENCY ?
+				f : TR2_PROFILE_MAX_FREQUENCY;
+	}
+
+	pthread_key_create(&profile_key, NULL);
+	strintmap_init(&profile_stacks, 0);
+	profile_pid = getpid();
+
+	/*
+	 * trace2_initialize() runs us on the main thread, before the
+	 * TLS machinery that would tell us so is set up.
+	 */
+	profile_thread_begin("main");
+	profile_start_timer();
+
+	return want;
+}
+
+static void fn_term(void)
+{
+	tr2_dst_trace_disable(&tr2dst_profile);
+}
+
+static void fn_atexit(uint64_t us_elapsed_absolute, int code)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	profile_stop_timer();
+	profile_thread_end();
+
+	/* a forked child carries a copy of samples that are not its own */
+	if (getpid() != profile_pid)
+		return;
+
+	strintmap_for_each_entry(&profile_stacks, &iter, e) {
+		strbuf_reset(&line);
+		strbuf_addstr(&line, "git");
+		if (profile_command.len)
+			strbuf_addf(&line, " %s", profile_command.buf);
+		strbuf_addf(&line, ";%s %"PRIuMAX, e->key,
+			    (uintmax_t)(intptr_t)e->value);
+		tr2_dst_write_line(&tr2dst_profile, &line);
+	}
+	strbuf_release(&line);
+	strintmap_clear(&profile_stacks);
+}
+
+static void fn_command_name_fl(const char *file, int line, const char *name,
+			       const char *hierarchy)
+{
+	strbuf_reset(&profile_command);
+	strbuf_addstr(&profile_command,
+		      hierarchy && *hierarchy ? hierarchy : name);
+}
+
+static void fn_thread_start_fl(const char *file, int line,
+			       uint64_t us_elapsed_absolute)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	const char *name = ctx->thread_name.buf;
+	const char *colon;
+
+	/* drop the "thNN:" prefix so that like threads share a stack */
+	if (starts_with(name, "th") && (colon = strchr(name, ':')))
+		name = colon + 1;
+	profile_thread_begin(name);
+}
+
+static void fn_thread_exit_fl(const char *file, int line,
+			      uint64_t us_elapsed_absolute,
+			      uint64_t us_elapsed_thread)
+{
+	profile_thread_end();
+}
+
+static void fn_region_enter_printf_va_fl(const char *file, int line,
+					 uint64_t us_elapsed_absolute,
+					 const char *category,
+					 const char *label,
+					 const struct repository *repo,
+					 const char *fmt, va_list ap)
+{
+	struct profile_frame *frame = pthread_getspecific(profile_key);
+	struct profile_frame *child;
+	struct strbuf name = STRBUF_INIT;
+	size_t i;
+
+	if (!frame)
+		return;
+
+	if (category)
+		strbuf_addf(&name, "%s:", category);
+	strbuf_addstr(&name, label ? label : "");
+	/* ';' separates frames and the last ' ' precedes the count */
+	for (i = 0; i < name.len; i++)
+		if (name.buf[i] == ';' || name.buf[i] == ' ')
+			name.buf[i] = '_';
+
+	for (child = frame->children; child; child = child->next_sibling)
+		if (!strcmp(child->name, name.buf))
+			break;
+	if (!child)
+		child = profile_frame_new(frame, name.buf);
+	strbuf_release(&name);
+
+	pthread_setspecific(profile_key, child);
+}
+
+static void fn_region_leave_printf_va_fl(
+	const char *file, int line, uint64_t us_elapsed_absolute,
+	uint64_t us_elapsed_region, const char *category, const char *label,
+	const struct repository *repo, const char *fmt, va_list ap)
+{
+	struct profile_frame *frame = pthread_getspecific(profile_key);
+
+	if (frame && frame->parent)
+		pthread_setspecific(profile_key, frame->parent);
+}
+
+struct tr2_tgt tr2_tgt_profile = {
+	&tr2dst_profile,
+
+	fn_init,
+	fn_term,
+
+	NULL, /* version */
+	NULL, /* start */
+	NULL, /* exit */
+	NULL, /* signal */
+	fn_atexit,
+	NULL, /* error */
+	NULL, /* command_path */
+	NULL, /* command_ancestry */
+	fn_command_name_fl,
+	NULL, /* command_mode */
+	NULL, /* alias */
+	NULL, /* child_start */
+	NULL, /* child_exit */
+	fn_thread_start_fl,
+	fn_thread_exit_fl,
+	NULL, /* exec */
+	NULL, /* exec_result */
+	NULL, /* param */
+	NULL, /* repo */
+	fn_region_enter_printf_va_fl,
+	fn_region_leave_printf_va_fl,
+	NULL, /* data */
+	NULL, /* data_json */
+	NULL, /* printf */
+	NULL, /* timer */
+	NULL, /* counter */
+};
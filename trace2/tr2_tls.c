@@ -167,6 +167,21 @@ void tr2tls_release(void)
 	pthread_key_delete(tr2tls_key);
 }
 
+void tr2tls_lock(void)
+{
+	pthread_mutex_lock(&tr2tls_mutex);
+}
+
+void tr2tls_unlock(void)
+{
+	pthread_mutex_unlock(&tr2tls_mutex);
+}
+
+void tr2tls_reset_lock(void)
+{
+	init_recursive_mutex(&tr2tls_mutex);
+}
+
 int tr2tls_locked_increment(int *p)
 {
 	int current_value;
@@ -0,0 +1,107 @@
+#include "cache.h"
+#include "thread-utils.h"
+#include "trace2/tr2_tgt.h"
+#include "trace2/tr2_tls.h"
+#include "trace2/tr2_tmr.h"
+
+/*
+ * The totals of all timers over all threads that have exited so far,
+ * modified only under the TLS lock.
+ */
+static struct tr2_timer_block final_timer_block;
+
+static struct tr2_timer_metadata tr2_timer_metadata[TRACE2_NUMBER_OF_TIMERS] = {
+	[TRACE2_TIMER_ID_TEST1] = {
+		.category = "test",
+		.name = "test1",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_TIMER_ID_TEST2] = {
+		.category = "test",
+		.name = "test2",
+		.want_per_thread_events = 1,
+	},
+	[TRACE2_TIMER_ID_UNPACK_ENTRY] = {
+		.category = "pack",
+		.name = "unpack_entry",
+		.want_per_thread_events = 0,
+	},
+};
+
+void tr2_start_timer(enum trace2_timer_id tid)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	struct tr2_timer *t = &ctx->timer_block.timer[tid];
+
+	if (!t->recursion_count++)
+		t->start_ns = getnanotime();
+}
+
+void tr2_stop_timer(enum trace2_timer_id tid)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	struct tr2_timer *t = &ctx->timer_block.timer[tid];
+	uint64_t interval;
+
+	if (!t->recursion_count)
+		BUG("trace2 timer '%s' stopped without being started",
+		    tr2_timer_metadata[tid].name);
+	if (--t->recursion_count)
+		return;
+
+	interval = getnanotime() - t->start_ns;
+	t->total_ns += interval;
+	if (!t->interval_count || interval < t->min_ns)
+		t->min_ns = interval;
+	if (interval > t->max_ns)
+		t->max_ns = interval;
+	t->interval_count++;
+}
+
+static void merge_timer(struct tr2_timer *dst, const struct tr2_timer *src)
+{
+	if (!src->interval_count)
+		return;
+	if (!dst->interval_count || src->min_ns < dst->min_ns)
+		dst->min_ns = src->min_ns;
+	if (src->max_ns > dst->max_ns)
+		dst->max_ns = src->max_ns;
+	dst->total_ns += src->total_ns;
+	dst->interval_count += src->interval_count;
+}
+
+void tr2_update_final_timers(void)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	int tid;
+
+	for (tid = 0; tid < TRACE2_NUMBER_OF_TIMERS; tid++)
+		merge_timer(&final_timer_block.timer[tid],
+			    &ctx->timer_block.timer[tid]);
+}
+
+void tr2_emit_per_thread_timers(tr2_tgt_evt_timer_t *fn)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	int tid;
+
+	for (tid = 0; tid < TRACE2_NUMBER_OF_TIMERS; tid++) {
+		struct tr2_timer *t = &ctx->timer_block.timer[tid];
+
+		if (t->interval_count &&
+		    tr2_timer_metadata[tid].want_per_thread_events)
+			fn(&tr2_timer_metadata[tid], t, 0);
+	}
+}
+
+void tr2_emit_final_timers(tr2_tgt_evt_timer_t *fn)
+{
+	int tid;
+
+	for (tid = 0; tid < TRACE2_NUMBER_OF_TIMERS; tid++) {
+		struct tr2_timer *t = &final_timer_block.timer[tid];
+
+		if (t->interval_count)
+			fn(&tr2_timer_metadata[tid], t, 1);
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef TR2_TMR_H
+#define TR2_TMR_H
+
+#include "trace2.h"
+#include "trace2/tr2_tgt.h"
+
+/*
+ * Stopwatch timers.
+ *
+ * Timers accumulate the time spent between trace2_timer_start() and
+ * trace2_timer_stop() calls into the TLS data of the calling thread,
+ * so that they can be used in hot paths without taking a lock or
+ * writing an event every time.  When a thread exits, its timers are
+ * added to a process-wide total and, if the timer wants it, reported
+ * in a per-thread "timer" event.  The totals are reported once when
+ * the process exits.
+ *
+ * Nested (recursive) starts of the same timer on a thread are only
+ * counted once: time is accounted from the outermost start to the
+ * matching stop.
+ */
+
+struct tr2_timer {
+	uint64_t recursion_count;
+	uint64_t start_ns;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t interval_count;
+};
+
+struct tr2_timer_block {
+	struct tr2_timer timer[TRACE2_NUMBER_OF_TIMERS];
+};
+
+struct tr2_timer_metadata {
+	const char *category;
+	const char *name;
+
+	/* also emit a "timer" event for each thread that used it */
+	unsigned int want_per_thread_events:1;
+};
+
+void tr2_start_timer(enum trace2_timer_id tid);
+void tr2_stop_timer(enum trace2_timer_id tid);
+
+/*
+ * Add the timers of the current thread to the process-wide totals.
+ * The caller must hold the TLS lock.
+ */
+void tr2_update_final_timers(void);
+
+/*
+ * Call "fn" for each timer of the current thread that was used and
+ * wants per-thread events.
+ */
+void tr2_emit_per_thread_timers(tr2_tgt_evt_timer_t *fn);
+
+/*
+ * Call "fn" for each process-wide total that was used.
+ */
+void tr2_emit_final_timers(tr2_tgt_evt_timer_t *fn);
+
+#endif /* TR2_TMR_H */
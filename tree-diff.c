@@ -5,6 +5,8 @@
 #include "diff.h"
 #include "diffcore.h"
 #include "tree.h"
+#include "hashmap.h"
+#include "list.h"
 
 /*
  * internal mode marker, saying a tree entry != entry of tp[imin]
@@ -394,6 +396,61 @@ static void skip_uninteresting(struct tree_desc *t, struct strbuf *base,
  */
 
 
+/*
+ * Return the length of the common prefix of the first n bytes of a
+ * and b, comparing a word at a time.
+ */
+static size_t common_prefix_len(const unsigned char *a, const unsigned char *b,
+				size_t n)
+{
+	size_t i = 0;
+
+	for (; i + sizeof(uintmax_t) <= n; i += sizeof(uintmax_t)) {
+		uintmax_t x, y;
+
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		if (x != y)
+			break;
+	}
+	while (i < n && a[i] == b[i])
+		i++;
+	return i;
+}
+
+/*
+ * Skip the run of byte-for-byte identical entries at the front of two
+ * trees, without decoding and comparing them one by one.  Identical
+ * entries cannot produce a change, and wide trees (think of a vendored
+ * directory where a single file changed) have long runs of them.
+ */
+static void skip_identical_entries(struct tree_desc *t1, struct tree_desc *t2)
+{
+	const char *a = t1->buffer, *b = t2->buffer;
+	size_t same = common_prefix_len((const unsigned char *)a,
+					(const unsigned char *)b,
+					t1->size < t2->size ? t1->size : t2->size);
+	size_t skip = 0;
+
+	/* stop at the last entry that ends within the common prefix */
+	while (skip < same) {
+		const char *nul = memchr(a + skip, '\0', same - skip);
+		size_t end;
+
+		if (!nul)
+			break;
+		end = nul - a + 1 + the_hash_algo->rawsz;
+		if (end > same)
+			break;
+		skip = end;
+	}
+
+	if (skip) {
+		init_tree_desc(t1, a + skip, t1->size - skip);
+		init_tree_desc(t2, b + skip, t2->size - skip);
+	}
+}
+
 /* ∀ pi=p[imin]  pi↓ */
 static inline void update_tp_entries(struct tree_desc *tp, int nparent)
 {
@@ -437,6 +494,11 @@ static struct combine_diff_path *ll_diff_tree_paths(
 		if (opt->max_changes && diff_queued_diff.nr > opt->max_changes)
 			break;
 
+		/* unchanged entries are not shown unless they may be copy sources */
+		if (nparent == 1 && !opt->flags.find_copies_harder &&
+		    t.size && tp[0].size)
+			skip_identical_entries(&t, &tp[0]);
+
 		if (opt->pathspec.nr) {
 			skip_uninteresting(&t, base, opt);
 			for (i = 0; i < nparent; i++)
@@ -676,17 +738,236 @@ static void try_to_follow_renames(const struct object_id *old_oid,
 	q->nr = 1;
 }
 
+/*
+ * Many commands diff the same pair of trees more than once: "git log
+ * -p --follow" diffs every commit again to find renames, blame and
+ * line-log diff a commit against its parent for each path they track,
+ * and so on.  The changes a tree diff found are therefore remembered,
+ * keyed by the two trees and everything else in the diff options
+ * that decides which entries the walk emits, and are fed to the
+ * change and add_remove callbacks again the next time the same diff
+ * is asked for.  The least recently used results are dropped once
+ * they take up more than core.treeDiffCacheLimit bytes.
+ *
+ * Like diff_queued_diff, the cache is not thread-safe; tree diffs run
+ * from several threads at once must set flags.no_tree_diff_cache.
+ */
+struct tree_diff_cache_change {
+	unsigned old_mode, new_mode;
+	struct object_id old_oid, new_oid;
+	char *path;
+};
+
+struct tree_diff_cache_entry {
+	struct hashmap_entry ent;
+	struct list_head lru;
+	struct object_id old_oid, new_oid;
+	char *key;
+	struct tree_diff_cache_change *changes;
+	size_t nr;
+	size_t size;
+};
+
+static struct hashmap tree_diff_cache;
+static LIST_HEAD(tree_diff_cache_lru);
+static size_t tree_diff_cache_size;
+
+static int tree_diff_cache_cmp(const void *unused_cmp_data,
+			       const struct hashmap_entry *eptr,
+			       const struct hashmap_entry *entry_or_key,
+			       const void *unused_keydata)
+{
+	const struct tree_diff_cache_entry *a, *b;
+
+	a = container_of(eptr, const struct tree_diff_cache_entry, ent);
+	b = container_of(entry_or_key, const struct tree_diff_cache_entry, ent);
+	return !oideq(&a->old_oid, &b->old_oid) ||
+	       !oideq(&a->new_oid, &b->new_oid) ||
+	       strcmp(a->key, b->key);
+}
+
+/*
+ * Describe the options that affect the result of the tree walk in
+ * "key", or return 0 if this diff should bypass the cache.
+ */
+static int tree_diff_cache_key(struct diff_options *opt, struct strbuf *base,
+			       struct strbuf *key)
+{
+	int i;
+
+	if (!tree_diff_cache_limit || opt->flags.no_tree_diff_cache)
+		return 0;
+	/* the walk would stop before it even started */
+	if (diff_can_quit_early(opt) ||
+	    (opt->max_changes && diff_queued_diff.nr > opt->max_changes))
+		return 0;
+	/* attributes may change under us */
+	if (opt->pathspec.magic & PATHSPEC_ATTR)
+		return 0;
+
+	strbuf_addf(key, "%u%u%u:%d:%"PRIuMAX":%s",
+		    opt->flags.recursive, opt->flags.tree_in_recursive,
+		    opt->flags.find_copies_harder, opt->pathspec.max_depth,
+		    (uintmax_t)base->len, base->buf);
+	for (i = 0; i < opt->pathspec.nr; i++) {
+		const struct pathspec_item *item = &opt->pathspec.items[i];
+		strbuf_addf(key, ":%x:%d:%s", item->magic, item->len,
+			    item->match);
+	}
+	return 1;
+}
+
+static void free_tree_diff_cache_entry(struct tree_diff_cache_entry *e)
+{
+	size_t i;
+
+	hashmap_remove(&tree_diff_cache, &e->ent, NULL);
+	list_del(&e->lru);
+	tree_diff_cache_size -= e->size;
+	trace2_memory_add(TRACE2_MEMORY_ID_TREE_DIFF_CACHE, -(intmax_t)e->size);
+
+	for (i = 0; i < e->nr; i++)
+		free(e->changes[i].path);
+	free(e->changes);
+	free(e->key);
+	free(e);
+}
+
+static struct tree_diff_cache_entry *tree_diff_cache_lookup(
+	const struct object_id *old_oid, const struct object_id *new_oid,
+	const char *key)
+{
+	struct tree_diff_cache_entry k, *e;
+
+	if (!tree_diff_cache.cmpfn)
+		return NULL;
+
+	oidcpy(&k.old_oid, old_oid ? old_oid : null_oid());
+	oidcpy(&k.new_oid, new_oid);
+	k.key = (char *)key;
+	hashmap_entry_init(&k.ent, oidhash(&k.old_oid) ^ oidhash(&k.new_oid) ^
+			   strhash(key));
+	e = hashmap_get_entry(&tree_diff_cache, &k, ent, NULL);
+	if (e) {
+		list_del(&e->lru);
+		list_add(&e->lru, &tree_diff_cache_lru);
+	}
+	return e;
+}
+
+static void tree_diff_cache_store(const struct object_id *old_oid,
+				  const struct object_id *new_oid,
+				  struct strbuf *key,
+				  struct combine_diff_path *paths)
+{
+	struct tree_diff_cache_entry *e;
+	struct combine_diff_path *p;
+	size_t alloc = 0;
+
+	if (!tree_diff_cache.cmpfn)
+		hashmap_init(&tree_diff_cache, tree_diff_cache_cmp, NULL, 0);
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->old_oid, old_oid ? old_oid : null_oid());
+	oidcpy(&e->new_oid, new_oid);
+	hashmap_entry_init(&e->ent, oidhash(&e->old_oid) ^
+			   oidhash(&e->new_oid) ^ strhash(key->buf));
+	e->size = sizeof(*e) + key->len + 1;
+	e->key = strbuf_detach(key, NULL);
+
+	for (p = paths; p; p = p->next) {
+		struct tree_diff_cache_change *c;
+
+		ALLOC_GROW(e->changes, e->nr + 1, alloc);
+		c = &e->changes[e->nr++];
+		c->old_mode = p->parent[0].mode;
+		c->new_mode = p->mode;
+		oidcpy(&c->old_oid, &p->parent[0].oid);
+		oidcpy(&c->new_oid, &p->oid);
+		c->path = xstrdup(p->path);
+		e->size += sizeof(*c) + strlen(p->path) + 1;
+	}
+
+	hashmap_add(&tree_diff_cache, &e->ent);
+	list_add(&e->lru, &tree_diff_cache_lru);
+	tree_diff_cache_size += e->size;
+	trace2_memory_add(TRACE2_MEMORY_ID_TREE_DIFF_CACHE, e->size);
+
+	/* make room, possibly by dropping what we just added */
+	while (tree_diff_cache_size > tree_diff_cache_limit)
+		free_tree_diff_cache_entry(list_entry(tree_diff_cache_lru.prev,
+						      struct tree_diff_cache_entry,
+						      lru));
+}
+
+static void tree_diff_cache_replay(struct tree_diff_cache_entry *e,
+				   struct diff_options *opt)
+{
+	size_t i;
+
+	for (i = 0; i < e->nr; i++) {
+		const struct tree_diff_cache_change *c = &e->changes[i];
+
+		/* stop where ll_diff_tree_paths() would */
+		if (diff_can_quit_early(opt))
+			break;
+		if (opt->max_changes && diff_queued_diff.nr > opt->max_changes)
+			break;
+
+		if (c->old_mode && c->new_mode)
+			opt->change(opt, c->old_mode, c->new_mode,
+				    &c->old_oid, &c->new_oid, 1, 1, c->path,
+				    0, 0);
+		else if (c->new_mode)
+			opt->add_remove(opt, '+', c->new_mode, &c->new_oid, 1,
+					c->path, 0);
+		else
+			opt->add_remove(opt, '-', c->old_mode, &c->old_oid, 1,
+					c->path, 0);
+	}
+}
+
+/* Like emit_diff_first_parent_only(), but keep p for the cache. */
+static int emit_diff_first_parent_only_keep(struct diff_options *opt,
+					    struct combine_diff_path *p)
+{
+	emit_diff_first_parent_only(opt, p);
+	return 1;
+}
+
 static void ll_diff_tree_oid(const struct object_id *old_oid,
 			     const struct object_id *new_oid,
 			     struct strbuf *base, struct diff_options *opt)
 {
 	struct combine_diff_path phead, *p;
 	pathchange_fn_t pathchange_old = opt->pathchange;
+	struct strbuf key = STRBUF_INIT;
+	int cacheable = tree_diff_cache_key(opt, base, &key);
+
+	if (cacheable) {
+		struct tree_diff_cache_entry *e;
+
+		e = tree_diff_cache_lookup(old_oid, new_oid, key.buf);
+		if (e) {
+			trace2_counter_add(TRACE2_COUNTER_ID_TREE_DIFF_CACHE_HIT, 1);
+			tree_diff_cache_replay(e, opt);
+			strbuf_release(&key);
+			return;
+		}
+		trace2_counter_add(TRACE2_COUNTER_ID_TREE_DIFF_CACHE_MISS, 1);
+	}
 
 	phead.next = NULL;
-	opt->pathchange = emit_diff_first_parent_only;
+	opt->pathchange = cacheable ? emit_diff_first_parent_only_keep :
+				      emit_diff_first_parent_only;
 	diff_tree_paths(&phead, new_oid, &old_oid, 1, base, opt);
 
+	/* a walk that stopped early has not seen all the changes */
+	if (cacheable && !diff_can_quit_early(opt) &&
+	    !(opt->max_changes && diff_queued_diff.nr > opt->max_changes))
+		tree_diff_cache_store(old_oid, new_oid, &key, phead.next);
+	strbuf_release(&key);
+
 	for (p = phead.next; p;) {
 		struct combine_diff_path *pprev = p;
 		p = p->next;
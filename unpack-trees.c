@@ -3,6 +3,7 @@
 #include "repository.h"
 #include "config.h"
 #include "dir.h"
+#include "pathspec.h"
 #include "tree.h"
 #include "tree-walk.h"
 #include "cache-tree.h"
@@ -18,6 +19,9 @@
 #include "promisor-remote.h"
 #include "entry.h"
 #include "parallel-checkout.h"
+#include "oidmap.h"
+#include "oidset.h"
+#include "thread-utils.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -457,6 +461,7 @@ static int check_updates(struct unpack_trees_options *o,
 	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
 
 	enable_delayed_checkout(&state);
+	enable_async_close(&state);
 	if (pc_workers > 1)
 		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
@@ -480,6 +485,7 @@ static int check_updates(struct unpack_trees_options *o,
 					      progress, &cnt);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state, NULL);
+	errs |= finish_async_close(&state);
 	git_attr_set_direction(GIT_ATTR_CHECKIN);
 
 	if (o->clone)
@@ -780,8 +786,46 @@ static int index_pos_by_traverse_info(struct name_entry *names,
  * path. We'll walk these trees in an iterative loop using cache-tree/index
  * instead of ODB since we already know what these trees contain.
  */
+/*
+ * A two-way merge keeps the index entries of a subtree that is the same
+ * in both trees and in the cache-tree as they are.  They already form a
+ * valid part of an index, so unless the result has something in the way
+ * we can append copies of them without looking at them one by one.
+ */
+static int append_cache_tree_entries(int pos, int nr_entries, size_t dirlen,
+				     struct unpack_trees_options *o)
+{
+	struct index_state *result = &o->result;
+	const struct cache_entry *first = o->src_index->cache[pos];
+	int i;
+
+	if (o->fn != twoway_merge)
+		return 0;
+	if (result->cache_nr &&
+	    strcmp(result->cache[result->cache_nr - 1]->name, first->name) >= 0)
+		return 0;
+	/* a file where the directory goes? */
+	if (index_name_pos(result, first->name, dirlen) >= 0)
+		return 0;
+	for (i = 0; i < nr_entries; i++)
+		if (o->src_index->cache[pos + i]->ce_flags & CE_CONFLICTED)
+			return 0;
+
+	ALLOC_GROW(result->cache, result->cache_nr + nr_entries,
+		   result->cache_alloc);
+	for (i = 0; i < nr_entries; i++) {
+		struct cache_entry *ce = o->src_index->cache[pos + i];
+		struct cache_entry *copy = dup_cache_entry(ce, result);
+
+		copy->ce_flags &= ~CE_HASHED;
+		add_index_entry(result, copy, ADD_CACHE_JUST_APPEND);
+		mark_ce_used(ce, o);
+	}
+	return 1;
+}
+
 static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
-				  struct traverse_info *info)
+				  size_t dirlen, struct traverse_info *info)
 {
 	struct cache_entry *src[MAX_UNPACK_TREES + 1] = { NULL, };
 	struct unpack_trees_options *o = info->data;
@@ -792,6 +836,9 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	if (!o->merge)
 		BUG("We need cache-tree to do this optimization");
 
+	if (append_cache_tree_entries(pos, nr_entries, dirlen, o))
+		return 0;
+
 	/*
 	 * Do what unpack_callback() and unpack_single_entry() normally
 	 * do. But we walk all paths in an iterative loop instead.
@@ -842,6 +889,336 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	return 0;
 }
 
+/*
+ * The traversal itself has to go in order on a single thread, but it
+ * spends much of its time waiting for subtrees to be read and inflated.
+ * Worker threads read the subtrees of the top-level directories ahead
+ * of it, one directory at a time, and park the buffers in "trees"
+ * until traverse_trees_recursive() asks for them.
+ */
+
+/* Stop reading ahead while this much is parked */
+#define TREE_PREFETCH_LIMIT (64 * 1024 * 1024)
+
+/* Do not bother with threads for fewer top-level directories */
+#define MIN_TREE_PREFETCH_JOBS 4
+
+struct prefetch_dir {
+	/* the trees at this path, for the bits set in "present" */
+	struct object_id oid[MAX_UNPACK_TREES];
+	unsigned long present;
+};
+
+enum prefetched_state {
+	PREFETCH_READING,
+	PREFETCH_READY,
+	/* taken or to be read by the traversal itself */
+	PREFETCH_TAKEN
+};
+
+struct prefetched_tree {
+	struct oidmap_entry entry;
+	enum prefetched_state state;
+	void *buf;
+	unsigned long size;
+};
+
+struct tree_prefetch {
+	struct repository *repo;
+	int n;
+
+	/* trees the traversal can skip thanks to the cache-tree */
+	struct oidset cache_tree_oids;
+
+	struct prefetch_dir *jobs;
+	int nr_jobs, alloc_jobs;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int nr_threads;
+	/* the fields below are protected by "mutex" */
+	int next_job;
+	struct oidmap trees;
+	size_t parked;
+	int stop;
+};
+
+static void add_cache_tree_oids(struct oidset *set, struct cache_tree *it)
+{
+	int i;
+
+	if (!it)
+		return;
+	if (it->entry_count >= 0)
+		oidset_insert(set, &it->oid);
+	for (i = 0; i < it->subtree_nr; i++)
+		add_cache_tree_oids(set, it->down[i]->cache_tree);
+}
+
+/*
+ * Mark "oid" as being read by us, unless somebody else got there first
+ * or we should let the traversal catch up.
+ */
+static int claim_prefetch(struct tree_prefetch *pf,
+			  const struct object_id *oid)
+{
+	struct prefetched_tree *t;
+	int ret = 0;
+
+	pthread_mutex_lock(&pf->mutex);
+	while (!pf->stop && pf->parked > TREE_PREFETCH_LIMIT)
+		pthread_cond_wait(&pf->cond, &pf->mutex);
+	if (!pf->stop && !oidmap_get(&pf->trees, oid)) {
+		CALLOC_ARRAY(t, 1);
+		oidcpy(&t->entry.oid, oid);
+		t->state = PREFETCH_READING;
+		oidmap_put(&pf->trees, t);
+		ret = 1;
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return ret;
+}
+
+static void publish_prefetch(struct tree_prefetch *pf,
+			     const struct object_id *oid,
+			     void *buf, unsigned long size)
+{
+	struct prefetched_tree *t;
+
+	pthread_mutex_lock(&pf->mutex);
+	t = oidmap_get(&pf->trees, oid);
+	if (buf) {
+		t->state = PREFETCH_READY;
+		t->buf = buf;
+		t->size = size;
+		pf->parked += size;
+	} else {
+		t->state = PREFETCH_TAKEN;
+	}
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+static void prefetch_dir(struct tree_prefetch *pf,
+			 const struct prefetch_dir *dir)
+{
+	struct string_list subdirs = STRING_LIST_INIT_DUP;
+	unsigned long all = (1ul << pf->n) - 1;
+	int i, j;
+
+	if (dir->present == all && oidset_contains(&pf->cache_tree_oids,
+						   &dir->oid[0])) {
+		for (i = 1; i < pf->n; i++)
+			if (!oideq(&dir->oid[0], &dir->oid[i]))
+				break;
+		if (i == pf->n)
+			return;
+	}
+
+	for (i = 0; i < pf->n; i++) {
+		enum object_type type;
+		struct tree_desc desc;
+		struct name_entry entry;
+		unsigned long size;
+		void *buf;
+
+		if (!(dir->present & (1ul << i)))
+			continue;
+		for (j = 0; j < i; j++)
+			if ((dir->present & (1ul << j)) &&
+			    oideq(&dir->oid[i], &dir->oid[j]))
+				break;
+		if (j < i || !claim_prefetch(pf, &dir->oid[i]))
+			continue;
+
+		buf = repo_read_object_file(pf->repo, &dir->oid[i],
+					    &type, &size);
+		if (buf && type != OBJ_TREE)
+			FREE_AND_NULL(buf);
+
+		/* look inside before the traversal may take it from us */
+		if (buf && !init_tree_desc_gently(&desc, buf, size)) {
+			while (tree_entry_gently(&desc, &entry)) {
+				struct string_list_item *item;
+				struct prefetch_dir *sub;
+
+				if (!S_ISDIR(entry.mode))
+					continue;
+				item = string_list_insert(&subdirs, entry.path);
+				if (!item->util)
+					item->util = xcalloc(1, sizeof(*sub));
+				sub = item->util;
+				oidcpy(&sub->oid[i], &entry.oid);
+				sub->present |= 1ul << i;
+			}
+		}
+		publish_prefetch(pf, &dir->oid[i], buf, size);
+	}
+
+	for (i = 0; i < subdirs.nr; i++)
+		prefetch_dir(pf, subdirs.items[i].util);
+	string_list_clear(&subdirs, 1);
+}
+
+static void *tree_prefetch_worker(void *data)
+{
+	struct tree_prefetch *pf = data;
+
+	for (;;) {
+		int job;
+
+		pthread_mutex_lock(&pf->mutex);
+		job = pf->stop ? pf->nr_jobs : pf->next_job++;
+		pthread_mutex_unlock(&pf->mutex);
+		if (job >= pf->nr_jobs)
+			break;
+		prefetch_dir(pf, &pf->jobs[job]);
+	}
+	return NULL;
+}
+
+static struct tree_prefetch *start_tree_prefetch(struct unpack_trees_options *o,
+						 int n, struct tree_desc *t)
+{
+	struct string_list top = STRING_LIST_INIT_DUP;
+	struct tree_prefetch *pf;
+	int nr_threads, i;
+
+	if (!HAVE_THREADS || !n || (o->pathspec && o->pathspec->nr) ||
+	    has_promisor_remote() || o->src_index->sparse_index)
+		return NULL;
+	nr_threads = git_env_ulong("GIT_TEST_UNPACK_TREES_THREADS", 0);
+	if (!nr_threads && (nr_threads = online_cpus()) < 2)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		struct tree_desc desc = t[i];
+		struct name_entry entry;
+
+		while (tree_entry_gently(&desc, &entry)) {
+			struct string_list_item *item;
+			struct prefetch_dir *dir;
+
+			if (!S_ISDIR(entry.mode))
+				continue;
+			item = string_list_insert(&top, entry.path);
+			if (!item->util)
+				item->util = xcalloc(1, sizeof(*dir));
+			dir = item->util;
+			oidcpy(&dir->oid[i], &entry.oid);
+			dir->present |= 1ul << i;
+		}
+	}
+	if (top.nr < MIN_TREE_PREFETCH_JOBS &&
+	    !git_env_ulong("GIT_TEST_UNPACK_TREES_THREADS", 0)) {
+		string_list_clear(&top, 1);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(pf, 1);
+	pf->repo = the_repository;
+	pf->n = n;
+	oidset_init(&pf->cache_tree_oids, 0);
+	if (o->merge)
+		add_cache_tree_oids(&pf->cache_tree_oids,
+				    o->src_index->cache_tree);
+	ALLOC_ARRAY(pf->jobs, top.nr);
+	for (i = 0; i < top.nr; i++)
+		pf->jobs[pf->nr_jobs++] = *(struct prefetch_dir *)top.items[i].util;
+	string_list_clear(&top, 1);
+
+	oidmap_init(&pf->trees, 0);
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+	enable_obj_read_lock();
+
+	if (nr_threads > pf->nr_jobs)
+		nr_threads = pf->nr_jobs;
+	CALLOC_ARRAY(pf->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&pf->threads[pf->nr_threads], NULL,
+				   tree_prefetch_worker, pf))
+			break;
+		pf->nr_threads++;
+	}
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "prefetch/threads", pf->nr_threads);
+	return pf;
+}
+
+static void stop_tree_prefetch(struct tree_prefetch *pf)
+{
+	struct oidmap_iter iter;
+	struct prefetched_tree *t;
+	int i;
+
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->stop = 1;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+	for (i = 0; i < pf->nr_threads; i++)
+		pthread_join(pf->threads[i], NULL);
+	disable_obj_read_lock();
+
+	oidmap_iter_init(&pf->trees, &iter);
+	while ((t = oidmap_iter_next(&iter)))
+		free(t->buf);
+	oidmap_free(&pf->trees, 1);
+	oidset_clear(&pf->cache_tree_oids);
+	pthread_cond_destroy(&pf->cond);
+	pthread_mutex_destroy(&pf->mutex);
+	free(pf->threads);
+	free(pf->jobs);
+	free(pf);
+}
+
+/*
+ * Like fill_tree_descriptor(), but take the tree from the prefetcher,
+ * waiting for it if it is being read right now.
+ */
+static void *fill_tree_descriptor_prefetched(struct unpack_trees_options *o,
+					     struct tree_desc *desc,
+					     const struct object_id *oid)
+{
+	struct tree_prefetch *pf = o->prefetch;
+	struct prefetched_tree *t;
+	void *buf = NULL;
+	unsigned long size = 0;
+
+	if (!pf || !oid)
+		return fill_tree_descriptor(the_repository, desc, oid);
+
+	pthread_mutex_lock(&pf->mutex);
+	t = oidmap_get(&pf->trees, oid);
+	if (!t) {
+		/* not worth reading ahead any more */
+		CALLOC_ARRAY(t, 1);
+		oidcpy(&t->entry.oid, oid);
+		t->state = PREFETCH_TAKEN;
+		oidmap_put(&pf->trees, t);
+	}
+	while (t->state == PREFETCH_READING)
+		pthread_cond_wait(&pf->cond, &pf->mutex);
+	if (t->state == PREFETCH_READY) {
+		buf = t->buf;
+		size = t->size;
+		t->buf = NULL;
+		t->state = PREFETCH_TAKEN;
+		pf->parked -= size;
+		pthread_cond_broadcast(&pf->cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	if (!buf)
+		return fill_tree_descriptor(the_repository, desc, oid);
+	init_tree_desc(desc, buf, size);
+	return buf;
+}
+
 static int traverse_trees_recursive(int n, unsigned long dirmask,
 				    unsigned long df_conflicts,
 				    struct name_entry *names,
@@ -870,7 +1247,9 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 		 * unprocessed entries before 'pos'.
 		 */
 		bottom = o->cache_bottom;
-		ret = traverse_by_cache_tree(pos, nr_entries, n, info);
+		ret = traverse_by_cache_tree(pos, nr_entries, n,
+					     traverse_path_len(info, tree_entry_len(names)),
+					     info);
 		o->cache_bottom = bottom;
 		return ret;
 	}
@@ -913,7 +1292,7 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 			const struct object_id *oid = NULL;
 			if (dirmask & 1)
 				oid = &names[i].oid;
-			buf[nr_buf++] = fill_tree_descriptor(the_repository, t + i, oid);
+			buf[nr_buf++] = fill_tree_descriptor_prefetched(o, t + i, oid);
 		}
 	}
 
@@ -1779,7 +2158,10 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
+		o->prefetch = start_tree_prefetch(o, len, t);
 		ret = traverse_trees(o->src_index, len, t, &info);
+		stop_tree_prefetch(o->prefetch);
+		o->prefetch = NULL;
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
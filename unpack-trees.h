@@ -11,6 +11,7 @@
 struct cache_entry;
 struct unpack_trees_options;
 struct pattern_list;
+struct tree_prefetch;
 
 typedef int (*merge_fn_t)(const struct cache_entry * const *src,
 		struct unpack_trees_options *options);
@@ -88,6 +89,7 @@ struct unpack_trees_options {
 	struct index_state result;
 
 	struct pattern_list *pl; /* for internal use */
+	struct tree_prefetch *prefetch; /* for internal use */
 	struct checkout_metadata meta;
 };
 
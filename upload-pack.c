@@ -27,6 +27,10 @@
 #include "commit-graph.h"
 #include "commit-reach.h"
 #include "shallow.h"
+#include "tempfile.h"
+#include "dir.h"
+#include "pack-bitmap.h"
+#include "ewah/ewok.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -74,6 +78,20 @@ struct upload_pack_data {
 	int shallow_nr;
 	timestamp_t oldest_have;
 
+	/*
+	 * What ok_to_give_up() found out with reachability bitmaps: the
+	 * bits of the commits flagged THEY_HAVE, how many entries of
+	 * have_obj are in there already, and per want whether it reaches
+	 * one of them or else (within a memory budget) what it reaches.
+	 */
+	struct bitmap_index *negotiation_bitmap_git;
+	struct bitmap *negotiation_haves;
+	int negotiation_haves_nr;
+	struct bitmap **negotiation_wants;
+	char *negotiation_want_reached;
+	int negotiation_wants_nr;
+	size_t negotiation_wants_size;
+
 	unsigned int timeout;					/* v0 only */
 	enum {
 		NO_MULTI_ACK = 0,
@@ -94,6 +112,8 @@ struct upload_pack_data {
 
 	const char *pack_objects_hook;
 
+	int pack_cache_limit;
+
 	unsigned stateless_rpc : 1;				/* v0 only */
 	unsigned no_done : 1;					/* v0 only */
 	unsigned daemon_mode : 1;				/* v0 only */
@@ -112,6 +132,9 @@ struct upload_pack_data {
 	unsigned allow_ref_in_want : 1;				/* v2 only */
 	unsigned allow_sideband_all : 1;			/* v2 only */
 	unsigned advertise_sid : 1;
+	unsigned pack_cache : 1;
+	unsigned negotiation_bitmaps : 1;
+	unsigned pack_objects_in_process : 1;
 };
 
 static void upload_pack_data_init(struct upload_pack_data *data)
@@ -144,10 +167,16 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 
 	data->keepalive = 5;
 	data->advertise_sid = 0;
+	data->pack_cache_limit = 16;
+	data->negotiation_bitmaps = 1;
+	data->pack_objects_in_process =
+		git_env_bool("GIT_TEST_UPLOAD_PACK_IN_PROCESS", 0);
 }
 
 static void upload_pack_data_clear(struct upload_pack_data *data)
 {
+	int i;
+
 	string_list_clear(&data->symref, 1);
 	string_list_clear(&data->wanted_refs, 1);
 	object_array_clear(&data->want_obj);
@@ -160,6 +189,14 @@ static void upload_pack_data_clear(struct upload_pack_data *data)
 	string_list_clear(&data->allowed_filters, 0);
 
 	free((char *)data->pack_objects_hook);
+	packet_writer_release(&data->writer);
+
+	for (i = 0; i < data->negotiation_wants_nr; i++)
+		bitmap_free(data->negotiation_wants[i]);
+	free(data->negotiation_wants);
+	free(data->negotiation_want_reached);
+	bitmap_free(data->negotiation_haves);
+	free_bitmap_index(data->negotiation_bitmap_git);
 }
 
 static void reset_timeout(unsigned int timeout)
@@ -187,9 +224,9 @@ static void send_client_data(int fd, const char *data, ssize_t sz,
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct strbuf *out = cb_data;
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", oid_to_hex(&graft->oid));
+		strbuf_addf(out, "--shallow %s\n", oid_to_hex(&graft->oid));
 	return 0;
 }
 
@@ -198,8 +235,187 @@ struct output_state {
 	int used;
 	unsigned packfile_uris_started : 1;
 	unsigned packfile_started : 1;
+
+	/* if non-NULL, a copy of everything we relay is written here */
+	struct tempfile *cache;
 };
 
+static int add_tag_to_pack_cache_key(const char *refname,
+				     const struct object_id *oid,
+				     int flag, void *cb_data)
+{
+	strbuf_addf(cb_data, "%s %s\n", oid_to_hex(oid), refname);
+	return 0;
+}
+
+/*
+ * The cached response to a request is named after a hash of everything
+ * that determines the output of pack-objects: its arguments (except for
+ * progress, which does not affect the pack), the request we feed it, and,
+ * with --include-tag, the tags it may add.
+ */
+static char *pack_cache_path(struct upload_pack_data *pack_data,
+			     const struct strvec *args,
+			     const struct strbuf *input)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct object_id oid;
+	git_hash_ctx ctx;
+	char *path;
+	int i;
+
+	for (i = 0; i < args->nr; i++) {
+		if (!strcmp(args->v[i], "--progress"))
+			continue;
+		strbuf_addstr(&key, args->v[i]);
+		strbuf_addch(&key, '\0');
+	}
+	strbuf_addch(&key, '\n');
+	strbuf_addbuf(&key, input);
+	if (pack_data->use_include_tag)
+		for_each_tag_ref(add_tag_to_pack_cache_key, &key);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, key.buf, key.len);
+	the_hash_algo->final_oid_fn(&oid, &ctx);
+
+	path = git_pathdup("upload-pack-cache/%s.pack", oid_to_hex(&oid));
+	strbuf_release(&key);
+	return path;
+}
+
+struct pack_cache_entry {
+	char *path;
+	timestamp_t mtime;
+};
+
+static int pack_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_cache_entry *a = va, *b = vb;
+
+	if (a->mtime < b->mtime)
+		return -1;
+	return a->mtime > b->mtime;
+}
+
+/* Drop the least recently used responses to keep at most "limit". */
+static void prune_pack_cache(int limit)
+{
+	char *dir = git_pathdup("upload-pack-cache");
+	struct pack_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d) {
+		free(dir);
+		return;
+	}
+	while ((de = readdir(d))) {
+		struct stat st;
+		char *path;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		path = xstrfmt("%s/%s", dir, de->d_name);
+		if (stat(path, &st)) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = path;
+		entries[nr].mtime = st.st_mtime;
+		nr++;
+	}
+	closedir(d);
+
+	QSORT(entries, nr, pack_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (i + limit < nr)
+			unlink_or_warn(entries[i].path);
+		free(entries[i].path);
+	}
+	free(entries);
+	free(dir);
+}
+
+#ifdef HAVE_SPLICE
+static int output_can_splice(void)
+{
+	static int ret = -1;
+
+	if (ret < 0) {
+		struct stat st;
+
+		ret = !fstat(1, &st) && (S_ISSOCK(st.st_mode) ||
+					 S_ISFIFO(st.st_mode));
+	}
+	return ret;
+}
+
+/*
+ * Once the pack itself is flowing, move it from the pack-objects pipe
+ * to our output with splice(2) instead of copying it into our buffer
+ * and out again; only the sideband header and the byte we hold back
+ * (see relay_pack_data()) go through our hands.  This also lets us
+ * send packets of the largest size the sideband allows, whatever the
+ * size of our buffer.
+ *
+ * Returns the number of bytes taken from the pipe, or 0 if the caller
+ * should read it as usual.
+ */
+static ssize_t splice_pack_data(int pack_objects_out, struct output_state *os,
+				int use_sideband)
+{
+	char hdr[6];
+	int avail;
+	size_t n, len;
+	ssize_t taken;
+
+	if (!os->packfile_started || os->cache ||
+	    use_sideband != LARGE_PACKET_MAX || !output_can_splice())
+		return 0;
+	if (ioctl(pack_objects_out, FIONREAD, &avail) < 0 || avail < 2)
+		return 0;
+
+	/* everything but the last byte we can see */
+	n = os->used + avail - 1;
+	if (n > LARGE_PACKET_MAX - 5)
+		n = LARGE_PACKET_MAX - 5;
+
+	xsnprintf(hdr, sizeof(hdr), "%04x", (unsigned)n + 5);
+	hdr[4] = 1;
+	if (os->used)
+		hdr[5] = os->buffer[0];
+	write_or_die(1, hdr, 5 + os->used);
+
+	len = taken = n - os->used;
+	while (len) {
+		ssize_t ret = splice(pack_objects_out, NULL, 1, NULL, len,
+				     SPLICE_F_MORE);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			check_pipe(errno);
+			die_errno("unable to splice pack data");
+		}
+		if (!ret)
+			die("unexpected end of pack data");
+		len -= ret;
+	}
+
+	os->used = 0;
+	if (taken == avail - 1) {
+		if (xread(pack_objects_out, os->buffer, 1) != 1)
+			die_errno("unable to read pack data");
+		os->used = 1;
+		taken++;
+	}
+	return taken;
+}
+#endif
+
 static int relay_pack_data(int pack_objects_out, struct output_state *os,
 			   int use_sideband, int write_packfile_line)
 {
@@ -215,11 +431,23 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	 */
 	ssize_t readsz;
 
+#ifdef HAVE_SPLICE
+	readsz = splice_pack_data(pack_objects_out, os, use_sideband);
+	if (readsz)
+		return readsz;
+#endif
+
 	readsz = xread(pack_objects_out, os->buffer + os->used,
 		       sizeof(os->buffer) - os->used);
 	if (readsz < 0) {
 		return readsz;
 	}
+	if (os->cache && readsz &&
+	    write_in_full(get_tempfile_fd(os->cache),
+			  os->buffer + os->used, readsz) < 0) {
+		warning_errno("unable to write upload-pack cache");
+		delete_tempfile(&os->cache);
+	}
 	os->used += readsz;
 
 	while (!os->packfile_started) {
@@ -265,6 +493,32 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	return readsz;
 }
 
+int (*upload_pack_pack_objects)(int argc, const char **argv,
+				const char *prefix);
+
+/*
+ * The bitmap index our negotiation loaded, for pack-objects to take
+ * over when it runs in our process.
+ */
+static struct bitmap_index *pack_objects_bitmap_git;
+
+/*
+ * Run pack-objects in the child start_command() forked off us, where
+ * the repository, its packs and our parsed objects are all set up
+ * already.  This is only done when we have not touched the commit
+ * grafts for shallow clients, as pack-objects must see the history as
+ * it is.
+ */
+static int run_pack_objects_in_process(int argc, const char **argv,
+				       const char *prefix)
+{
+	/* our flags would confuse its revision walk */
+	clear_object_flags(~0);
+	if (pack_objects_bitmap_git)
+		set_spare_bitmap_index(pack_objects_bitmap_git);
+	return upload_pack_pack_objects(argc, argv, prefix);
+}
+
 static void create_pack_file(struct upload_pack_data *pack_data,
 			     const struct string_list *uri_protocols)
 {
@@ -275,11 +529,18 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		"corruption on the remote side.";
 	ssize_t sz;
 	int i;
-	FILE *pipe_fd;
+	struct strbuf input = STRBUF_INIT;
+	char *cache_path = NULL;
 
-	if (!pack_data->pack_objects_hook)
+	if (!pack_data->pack_objects_hook) {
 		pack_objects.git_cmd = 1;
-	else {
+		if (pack_data->pack_objects_in_process &&
+		    upload_pack_pack_objects && !pack_data->shallow_nr) {
+			pack_objects.in_process = run_pack_objects_in_process;
+			pack_objects_bitmap_git =
+				pack_data->negotiation_bitmap_git;
+		}
+	} else {
 		strvec_push(&pack_objects.args, pack_data->pack_objects_hook);
 		strvec_push(&pack_objects.args, "git");
 		pack_objects.use_shell = 1;
@@ -314,6 +575,63 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 					 uri_protocols->items[i].string);
 	}
 
+	if (pack_data->shallow_nr)
+		for_each_commit_graft(write_one_shallow, &input);
+
+	for (i = 0; i < pack_data->want_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
+	strbuf_addstr(&input, "--not\n");
+	for (i = 0; i < pack_data->have_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
+	for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
+	strbuf_addch(&input, '\n');
+
+	if (pack_data->pack_cache) {
+		int fd;
+
+		cache_path = pack_cache_path(pack_data, &pack_objects.args,
+					     &input);
+		fd = git_open(cache_path);
+		if (fd >= 0) {
+			int result;
+
+			trace2_data_string("upload-pack", the_repository,
+					   "pack-cache", "hit");
+			utime(cache_path, NULL);
+			do {
+				reset_timeout(pack_data->timeout);
+				result = relay_pack_data(fd, &output_state,
+							 pack_data->use_sideband,
+							 !!uri_protocols);
+			} while (result > 0);
+			close(fd);
+			if (result < 0)
+				goto fail;
+			child_process_clear(&pack_objects);
+			goto flush;
+		}
+
+		trace2_data_string("upload-pack", the_repository,
+				   "pack-cache", "miss");
+		if (safe_create_leading_directories(cache_path))
+			warning_errno("unable to create upload-pack cache directory");
+		else {
+			struct strbuf tmp = STRBUF_INIT;
+
+			strbuf_addstr(&tmp, cache_path);
+			strbuf_setlen(&tmp, find_last_dir_sep(tmp.buf) - tmp.buf);
+			strbuf_addstr(&tmp, "/tmp_pack_XXXXXX");
+			output_state.cache = mks_tempfile(tmp.buf);
+			if (!output_state.cache)
+				warning_errno("unable to create upload-pack cache file");
+			strbuf_release(&tmp);
+		}
+	}
+
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
@@ -322,24 +640,8 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	if (start_command(&pack_objects))
 		die("git upload-pack: unable to fork git-pack-objects");
 
-	pipe_fd = xfdopen(pack_objects.in, "w");
-
-	if (pack_data->shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
-
-	for (i = 0; i < pack_data->want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < pack_data->have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
-	for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
-	fflush(pipe_fd);
-	fclose(pipe_fd);
+	write_or_die(pack_objects.in, input.buf, input.len);
+	close(pack_objects.in);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -437,6 +739,14 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		goto fail;
 	}
 
+	if (output_state.cache) {
+		if (rename_tempfile(&output_state.cache, cache_path))
+			warning_errno("unable to write upload-pack cache");
+		else
+			prune_pack_cache(pack_data->pack_cache_limit);
+	}
+
+flush:
 	/* flush the data */
 	if (output_state.used > 0) {
 		send_client_data(1, output_state.buffer, output_state.used,
@@ -445,6 +755,8 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	}
 	if (pack_data->use_sideband)
 		packet_flush(1);
+	strbuf_release(&input);
+	free(cache_path);
 	return;
 
  fail:
@@ -492,13 +804,111 @@ static int got_oid(struct upload_pack_data *data,
 	return do_got_oid(data, oid);
 }
 
+/* Stop keeping the bitmaps of wants once they take this much memory */
+#define NEGOTIATION_BITMAP_CACHE_LIMIT (64 * 1024 * 1024)
+
+/*
+ * Answer ok_to_give_up() with reachability bitmaps, without walking
+ * the history between the wants and the haves over and over again.
+ * A want whose bitmap cannot be computed because part of its history
+ * is not covered by the bitmap index makes us return -1, and the
+ * caller then has to walk after all.
+ */
+static int bitmap_ok_to_give_up(struct upload_pack_data *data)
+{
+	struct bitmap_index *bitmap_git = data->negotiation_bitmap_git;
+	int i;
+
+	if (!data->negotiation_bitmaps)
+		return -1;
+	if (!bitmap_git) {
+		bitmap_git = prepare_bitmap_git(the_repository);
+		if (!bitmap_git) {
+			data->negotiation_bitmaps = 0;
+			return -1;
+		}
+		data->negotiation_bitmap_git = bitmap_git;
+		data->negotiation_haves = bitmap_new();
+		data->negotiation_wants_nr = data->want_obj.nr;
+		CALLOC_ARRAY(data->negotiation_wants, data->want_obj.nr);
+		CALLOC_ARRAY(data->negotiation_want_reached, data->want_obj.nr);
+	}
+	if (data->negotiation_wants_nr != data->want_obj.nr)
+		BUG("wants changed during negotiation");
+
+	/* mirror what do_got_oid() flags THEY_HAVE */
+	for (; data->negotiation_haves_nr < data->have_obj.nr;
+	     data->negotiation_haves_nr++) {
+		struct object *o =
+			data->have_obj.objects[data->negotiation_haves_nr].item;
+		struct commit_list *parents;
+
+		if (o->type != OBJ_COMMIT)
+			continue;
+		/* what is not in the bitmaps cannot be reached from them */
+		bitmap_set_object(bitmap_git, data->negotiation_haves, &o->oid);
+		for (parents = ((struct commit *)o)->parents;
+		     parents;
+		     parents = parents->next)
+			bitmap_set_object(bitmap_git, data->negotiation_haves,
+					  &parents->item->object.oid);
+	}
+
+	for (i = 0; i < data->want_obj.nr; i++) {
+		struct object *o = data->want_obj.objects[i].item;
+		struct bitmap *reach = data->negotiation_wants[i];
+		int reached;
+
+		if (data->negotiation_want_reached[i])
+			continue;
+
+		/* as can_all_from_reach_with_flag(), trust non-commits */
+		o = deref_tag(the_repository, o, NULL, 0);
+		if (!o || o->type != OBJ_COMMIT) {
+			data->negotiation_want_reached[i] = 1;
+			continue;
+		}
+
+		if (!reach) {
+			size_t size;
+
+			reach = bitmap_commit_reachability(bitmap_git,
+							   (struct commit *)o);
+			if (!reach) {
+				data->negotiation_bitmaps = 0;
+				return -1;
+			}
+			size = st_mult(reach->word_alloc, sizeof(eword_t));
+			if (data->negotiation_wants_size + size <=
+			    NEGOTIATION_BITMAP_CACHE_LIMIT) {
+				data->negotiation_wants[i] = reach;
+				data->negotiation_wants_size += size;
+			}
+		}
+		reached = bitmap_intersects(reach, data->negotiation_haves);
+		if (reach != data->negotiation_wants[i])
+			bitmap_free(reach);
+		if (!reached)
+			return 0;
+		data->negotiation_want_reached[i] = 1;
+	}
+	return 1;
+}
+
 static int ok_to_give_up(struct upload_pack_data *data)
 {
 	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
+	int ret;
 
 	if (!data->have_obj.nr)
 		return 0;
 
+	ret = bitmap_ok_to_give_up(data);
+	trace2_data_string("upload-pack", the_repository, "negotiation",
+			   ret >= 0 ? "bitmap" : "walk");
+	if (ret >= 0)
+		return ret;
+
 	return can_all_from_reach_with_flag(&data->want_obj, THEY_HAVE,
 					    COMMON_KNOWN, data->oldest_have,
 					    min_generation);
@@ -512,7 +922,13 @@ static int get_common_commits(struct upload_pack_data *data,
 	int got_common = 0;
 	int got_other = 0;
 	int sent_ready = 0;
+	int ret;
 
+	/*
+	 * The client only reads our ACKs after it sent a flush, so
+	 * collect them until then instead of writing each on its own.
+	 */
+	data->writer.buffered = 1;
 	save_commit_buffer = 0;
 
 	for (;;) {
@@ -526,15 +942,17 @@ static int get_common_commits(struct upload_pack_data *data,
 			    && !got_other
 			    && ok_to_give_up(data)) {
 				sent_ready = 1;
-				packet_write_fmt(1, "ACK %s ready\n", last_hex);
+				packet_writer_write(&data->writer, "ACK %s ready\n", last_hex);
 			}
 			if (data->have_obj.nr == 0 || data->multi_ack)
-				packet_write_fmt(1, "NAK\n");
+				packet_writer_write(&data->writer, "NAK\n");
 
 			if (data->no_done && sent_ready) {
-				packet_write_fmt(1, "ACK %s\n", last_hex);
-				return 0;
+				packet_writer_write(&data->writer, "ACK %s\n", last_hex);
+				ret = 0;
+				break;
 			}
+			packet_writer_drain(&data->writer);
 			if (data->stateless_rpc)
 				exit(0);
 			got_common = 0;
@@ -550,20 +968,20 @@ static int get_common_commits(struct upload_pack_data *data,
 					const char *hex = oid_to_hex(&oid);
 					if (data->multi_ack == MULTI_ACK_DETAILED) {
 						sent_ready = 1;
-						packet_write_fmt(1, "ACK %s ready\n", hex);
+						packet_writer_write(&data->writer, "ACK %s ready\n", hex);
 					} else
-						packet_write_fmt(1, "ACK %s continue\n", hex);
+						packet_writer_write(&data->writer, "ACK %s continue\n", hex);
 				}
 				break;
 			default:
 				got_common = 1;
 				oid_to_hex_r(last_hex, &oid);
 				if (data->multi_ack == MULTI_ACK_DETAILED)
-					packet_write_fmt(1, "ACK %s common\n", last_hex);
+					packet_writer_write(&data->writer, "ACK %s common\n", last_hex);
 				else if (data->multi_ack)
-					packet_write_fmt(1, "ACK %s continue\n", last_hex);
+					packet_writer_write(&data->writer, "ACK %s continue\n", last_hex);
 				else if (data->have_obj.nr == 1)
-					packet_write_fmt(1, "ACK %s\n", last_hex);
+					packet_writer_write(&data->writer, "ACK %s\n", last_hex);
 				break;
 			}
 			continue;
@@ -571,14 +989,20 @@ static int get_common_commits(struct upload_pack_data *data,
 		if (!strcmp(reader->line, "done")) {
 			if (data->have_obj.nr > 0) {
 				if (data->multi_ack)
-					packet_write_fmt(1, "ACK %s\n", last_hex);
-				return 0;
+					packet_writer_write(&data->writer, "ACK %s\n", last_hex);
+				ret = 0;
+				break;
 			}
-			packet_write_fmt(1, "NAK\n");
-			return -1;
+			packet_writer_write(&data->writer, "NAK\n");
+			ret = -1;
+			break;
 		}
 		die("git upload-pack: expected SHA1 list, got '%s'", reader->line);
 	}
+
+	packet_writer_drain(&data->writer);
+	data->writer.buffered = 0;
+	return ret;
 }
 
 static int is_our_ref(struct object *o, enum allow_uor allow_uor)
@@ -864,8 +1288,17 @@ static void deepen_by_rev_list(struct upload_pack_data *data,
 {
 	struct commit_list *result;
 
-	disable_commit_graph(the_repository);
+	/*
+	 * The walk may take the commits and their parents from the
+	 * commit-graph, unless our own history is cut short by grafts
+	 * the graph does not know about.  But send_shallow() registers
+	 * what it sends as grafts, which commits parsed from the graph
+	 * later on would not see; stop using it from then on.
+	 */
+	if (is_repository_shallow(the_repository))
+		disable_commit_graph(the_repository);
 	result = get_shallow_commits_by_rev_list(ac, av, SHALLOW, NOT_SHALLOW);
+	disable_commit_graph(the_repository);
 	send_shallow(data, result);
 	free_commit_list(result);
 	send_unshallow(data);
@@ -1315,6 +1748,16 @@ static int upload_pack_config(const char *var, const char *value, void *cb_data)
 		precomposed_unicode = git_config_bool(var, value);
 	} else if (!strcmp("transfer.advertisesid", var)) {
 		data->advertise_sid = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		data->pack_cache = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachelimit", var)) {
+		data->pack_cache_limit = git_config_int(var, value);
+		if (data->pack_cache_limit < 1)
+			die("uploadpack.packCacheLimit must be positive");
+	} else if (!strcmp("uploadpack.packobjectsinprocess", var)) {
+		data->pack_objects_in_process = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.negotiationbitmaps", var)) {
+		data->negotiation_bitmaps = git_config_bool(var, value);
 	}
 
 	if (current_config_scope() != CONFIG_SCOPE_LOCAL &&
@@ -1645,7 +2088,7 @@ static void send_shallow_info(struct upload_pack_data *data)
 	    is_repository_shallow(the_repository))
 		deepen(data, INFINITE_DEPTH);
 
-	packet_delim(1);
+	packet_writer_delim(&data->writer);
 }
 
 enum fetch_state {
@@ -1665,6 +2108,7 @@ int upload_pack_v2(struct repository *r, struct strvec *keys,
 
 	upload_pack_data_init(&data);
 	data.use_sideband = LARGE_PACKET_MAX;
+	data.writer.buffered = 1;
 
 	git_config(upload_pack_config, &data);
 
@@ -1709,6 +2153,7 @@ int upload_pack_v2(struct repository *r, struct strvec *keys,
 				create_pack_file(&data, &data.uri_protocols);
 			} else {
 				packet_writer_write(&data.writer, "packfile\n");
+				packet_writer_drain(&data.writer);
 				create_pack_file(&data, NULL);
 			}
 			state = FETCH_DONE;
@@ -1752,10 +2197,12 @@ int upload_pack_advertise(struct repository *r,
 		     allow_sideband_all_value))
 			strbuf_addstr(value, " sideband-all");
 
-		if (!repo_config_get_string(the_repository,
-					    "uploadpack.blobpackfileuri",
-					    &str) &&
-		    str) {
+		if ((!repo_config_get_string(the_repository,
+					     "uploadpack.blobpackfileuri",
+					     &str) && str) ||
+		    (!repo_config_get_string(the_repository,
+					     "uploadpack.packpackfileuri",
+					     &str) && str)) {
 			strbuf_addstr(value, " packfile-uris");
 			free(str);
 		}
@@ -10,6 +10,13 @@ struct upload_pack_options {
 
 void upload_pack(struct upload_pack_options *options);
 
+/*
+ * Set by the upload-pack builtin to cmd_pack_objects(), which
+ * uploadpack.packObjectsInProcess needs at hand.
+ */
+extern int (*upload_pack_pack_objects)(int argc, const char **argv,
+				       const char *prefix);
+
 struct repository;
 struct strvec;
 struct packet_reader;
@@ -4,9 +4,26 @@
 #include "cache.h"
 #include "config.h"
 
+static int counting_xallocs;
+static uintmax_t nr_xallocs;
+
+void start_counting_xallocs(void)
+{
+	nr_xallocs = 0;
+	counting_xallocs = 1;
+}
+
+uintmax_t stop_counting_xallocs(void)
+{
+	counting_xallocs = 0;
+	return nr_xallocs;
+}
+
 static int memory_limit_check(size_t size, int gentle)
 {
 	static size_t limit = 0;
+	if (counting_xallocs)
+		nr_xallocs++;
 	if (!limit) {
 		limit = git_env_ulong("GIT_ALLOC_LIMIT", 0);
 		if (!limit)
@@ -27,6 +44,8 @@ static int memory_limit_check(size_t size, int gentle)
 char *xstrdup(const char *str)
 {
 	char *ret = strdup(str);
+	if (counting_xallocs)
+		nr_xallocs++;
 	if (!ret)
 		die("Out of memory, strdup failed");
 	return ret;
@@ -202,6 +221,41 @@ int xopen(const char *path, int oflag, ...)
 	}
 }
 
+int git_fsync(int fd, enum fsync_action action)
+{
+	switch (action) {
+	case FSYNC_WRITEOUT_ONLY:
+#ifdef HAVE_SYNC_FILE_RANGE
+		/*
+		 * On Linux, this only starts and waits for the writeback
+		 * of the file's data; it neither updates its metadata
+		 * nor flushes the disk's write cache.
+		 */
+		for (;;) {
+			if (!sync_file_range(fd, 0, 0,
+					     SYNC_FILE_RANGE_WAIT_BEFORE |
+					     SYNC_FILE_RANGE_WRITE |
+					     SYNC_FILE_RANGE_WAIT_AFTER))
+				return 0;
+			if (errno != EINTR)
+				return -1;
+		}
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	case FSYNC_HARDWARE_FLUSH:
+		for (;;) {
+			if (!fsync(fd))
+				return 0;
+			if (errno != EINTR)
+				return -1;
+		}
+	default:
+		BUG("unexpected git_fsync(%d) call", action);
+	}
+}
+
 static int handle_nonblock(int fd, short poll_events, int err)
 {
 	struct pollfd pfd;
@@ -323,6 +377,45 @@ ssize_t write_in_full(int fd, const void *buf, size_t count)
 	return total;
 }
 
+ssize_t writev_in_full(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+
+	while (iovcnt > 0) {
+		ssize_t written;
+
+		if (!iov->iov_len) {
+			iov++;
+			iovcnt--;
+			continue;
+		}
+		written = writev(fd, iov, iovcnt);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (handle_nonblock(fd, POLLOUT, errno))
+				continue;
+			return -1;
+		}
+		if (!written) {
+			errno = ENOSPC;
+			return -1;
+		}
+		total += written;
+		while (iovcnt > 0 && written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (written) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return total;
+}
+
 ssize_t pread_in_full(int fd, void *buf, size_t count, off_t offset)
 {
 	char *p = buf;
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "wt-status.h"
+#include "config.h"
 #include "object.h"
 #include "dir.h"
 #include "commit.h"
@@ -18,6 +19,8 @@
 #include "worktree.h"
 #include "lockfile.h"
 #include "sequencer.h"
+#include "object-store.h"
+#include "thread-utils.h"
 
 #define AB_DELAY_WARNING_IN_MS (2 * 1000)
 
@@ -804,8 +807,62 @@ static int has_unmerged(struct wt_status *s)
 	return 0;
 }
 
+#define MIN_PARALLEL_STATUS_ENTRIES 1000
+
+/*
+ * Whether to collect the untracked files on a thread of their own while
+ * the two diffs run.  Both sides only read the index, but for bits that
+ * only one of them touches: the flags of the entries the diffs find up
+ * to date, and the untracked cache.  That no longer holds with fsmonitor,
+ * which both would refresh, nor with a sparse index, which either might
+ * expand.
+ */
+static int collect_untracked_in_parallel(struct wt_status *s)
+{
+	struct index_state *istate = s->repo->index;
+
+	if (!HAVE_THREADS || !s->show_untracked_files || core_fsmonitor ||
+	    istate->sparse_index)
+		return 0;
+	if (git_env_bool("GIT_TEST_PARALLEL_STATUS", 0))
+		return 1;
+	return online_cpus() > 1 &&
+	       istate->cache_nr >= MIN_PARALLEL_STATUS_ENTRIES;
+}
+
+static void *collect_untracked_thread(void *data)
+{
+	struct wt_status *s = data;
+
+	trace2_thread_start("status_untracked");
+	trace2_region_enter("status", "untracked", s->repo);
+	wt_status_collect_untracked(s);
+	trace2_region_leave("status", "untracked", s->repo);
+	trace2_thread_exit();
+	return NULL;
+}
+
 void wt_status_collect(struct wt_status *s)
 {
+	int parallel = collect_untracked_in_parallel(s);
+	pthread_t untracked;
+
+	trace2_data_intmax("status", s->repo, "parallel", parallel);
+	if (parallel) {
+		int err;
+
+		/*
+		 * The name hash is initialized lazily on first use; do it
+		 * now rather than while the diffs may look at the index.
+		 */
+		index_file_exists(s->repo->index, "", 0, 0);
+		enable_obj_read_lock();
+		err = pthread_create(&untracked, NULL,
+				     collect_untracked_thread, s);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
 	trace2_region_enter("status", "worktrees", s->repo);
 	wt_status_collect_changes_worktree(s);
 	trace2_region_leave("status", "worktrees", s->repo);
@@ -820,9 +877,17 @@ void wt_status_collect(struct wt_status *s)
 		trace2_region_leave("status", "index", s->repo);
 	}
 
-	trace2_region_enter("status", "untracked", s->repo);
-	wt_status_collect_untracked(s);
-	trace2_region_leave("status", "untracked", s->repo);
+	if (parallel) {
+		int err = pthread_join(untracked, NULL);
+
+		if (err)
+			die(_("unable to join thread: %s"), strerror(err));
+		disable_obj_read_lock();
+	} else {
+		trace2_region_enter("status", "untracked", s->repo);
+		wt_status_collect_untracked(s);
+		trace2_region_leave("status", "untracked", s->repo);
+	}
 
 	wt_status_get_state(s->repo, &s->state, s->branch && !strcmp(s->branch, "HEAD"));
 	if (s->state.merge_in_progress && !has_unmerged(s))
@@ -197,10 +197,115 @@ int buffer_is_binary(const char *ptr, unsigned long size)
 	return !!memchr(ptr, 0, size);
 }
 
+/*
+ * Compiling a regex can take longer than running it over the few lines
+ * of a diff it is needed for, and the diffs of many files keep using the
+ * same few hunk header and word regexes.  Keep them compiled for the
+ * rest of the process instead, handing each out to one user at a time;
+ * a regex asked for while in use (by another thread) is compiled once
+ * more, and kept as well when put back.
+ */
+struct cached_regex {
+	regex_t re;
+	struct regex_cache_entry *entry;
+	struct cached_regex *next;
+};
+
+struct regex_cache_entry {
+	struct hashmap_entry ent;
+	int cflags;
+	struct cached_regex *free;
+	char pattern[FLEX_ARRAY];
+};
+
+static struct hashmap regex_cache;
+static int regex_cache_use_lock;
+static pthread_mutex_t regex_cache_mutex;
+
+static int regex_cache_entry_cmp(const void *unused_cmp_data,
+				 const struct hashmap_entry *eptr,
+				 const struct hashmap_entry *entry_or_key,
+				 const void *keydata)
+{
+	const struct regex_cache_entry *a, *b;
+
+	a = container_of(eptr, const struct regex_cache_entry, ent);
+	b = container_of(entry_or_key, const struct regex_cache_entry, ent);
+	return a->cflags != b->cflags ||
+		strcmp(a->pattern, keydata ? keydata : b->pattern);
+}
+
+static inline void regex_cache_lock(void)
+{
+	if (regex_cache_use_lock)
+		pthread_mutex_lock(&regex_cache_mutex);
+}
+
+static inline void regex_cache_unlock(void)
+{
+	if (regex_cache_use_lock)
+		pthread_mutex_unlock(&regex_cache_mutex);
+}
+
+void enable_xdiff_regex_lock(void)
+{
+	if (!regex_cache_use_lock++)
+		pthread_mutex_init(&regex_cache_mutex, NULL);
+}
+
+void disable_xdiff_regex_lock(void)
+{
+	if (regex_cache_use_lock && !--regex_cache_use_lock)
+		pthread_mutex_destroy(&regex_cache_mutex);
+}
+
+regex_t *xdiff_get_regex(const char *pattern, int cflags)
+{
+	struct regex_cache_entry key, *entry;
+	struct cached_regex *cached;
+
+	regex_cache_lock();
+	if (!regex_cache.cmpfn)
+		hashmap_init(&regex_cache, regex_cache_entry_cmp, NULL, 0);
+	hashmap_entry_init(&key.ent, strhash(pattern) ^ cflags);
+	key.cflags = cflags;
+	entry = hashmap_get_entry(&regex_cache, &key, ent, pattern);
+	if (!entry) {
+		FLEX_ALLOC_STR(entry, pattern, pattern);
+		hashmap_entry_init(&entry->ent, key.ent.hash);
+		entry->cflags = cflags;
+		hashmap_add(&regex_cache, &entry->ent);
+	}
+	cached = entry->free;
+	if (cached)
+		entry->free = cached->next;
+	regex_cache_unlock();
+
+	if (!cached) {
+		CALLOC_ARRAY(cached, 1);
+		if (regcomp(&cached->re, pattern, cflags)) {
+			free(cached);
+			return NULL;
+		}
+		cached->entry = entry;
+	}
+	return &cached->re;
+}
+
+void xdiff_put_regex(regex_t *re)
+{
+	struct cached_regex *cached = container_of(re, struct cached_regex, re);
+
+	regex_cache_lock();
+	cached->next = cached->entry->free;
+	cached->entry->free = cached;
+	regex_cache_unlock();
+}
+
 struct ff_regs {
 	int nr;
 	struct ff_reg {
-		regex_t re;
+		regex_t *re;
 		int negate;
 	} *array;
 };
@@ -223,7 +328,7 @@ static long ff_regexp(const char *line, long len,
 
 	for (i = 0; i < regs->nr; i++) {
 		struct ff_reg *reg = regs->array + i;
-		if (!regexec_buf(&reg->re, line, len, 2, pmatch, 0)) {
+		if (!regexec_buf(reg->re, line, len, 2, pmatch, 0)) {
 			if (reg->negate)
 				return -1;
 			break;
@@ -271,7 +376,8 @@ void xdiff_set_find_func(xdemitconf_t *xecfg, const char *value, int cflags)
 			expression = buffer = xstrndup(value, ep - value);
 		else
 			expression = value;
-		if (regcomp(&reg->re, expression, cflags))
+		reg->re = xdiff_get_regex(expression, cflags);
+		if (!reg->re)
 			die("Invalid regexp to look for hunk header: %s", expression);
 		free(buffer);
 		value = ep ? ep + 1 : NULL;
@@ -285,7 +391,7 @@ void xdiff_clear_find_func(xdemitconf_t *xecfg)
 		struct ff_regs *regs = xecfg->find_func_priv;
 
 		for (i = 0; i < regs->nr; i++)
-			regfree(&regs->array[i].re);
+			xdiff_put_regex(regs->array[i].re);
 		free(regs->array);
 		free(regs);
 		xecfg->find_func = NULL;
@@ -305,6 +411,7 @@ int xdiff_compare_lines(const char *l1, long s1,
 }
 
 int git_xmerge_style = -1;
+unsigned long git_xmerge_segment_size;
 
 int git_xmerge_config(const char *var, const char *value, void *cb)
 {
@@ -324,5 +431,9 @@ int git_xmerge_config(const char *var, const char *value, void *cb)
 			    value, var);
 		return 0;
 	}
+	if (!strcmp(var, "merge.segmentsize")) {
+		git_xmerge_segment_size = git_config_ulong(var, value);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
@@ -50,8 +50,23 @@ int buffer_is_binary(const char *ptr, unsigned long size);
 
 void xdiff_set_find_func(xdemitconf_t *xecfg, const char *line, int cflags);
 void xdiff_clear_find_func(xdemitconf_t *xecfg);
+
+/*
+ * Return the regex compiled from pattern with cflags, or NULL if it
+ * does not compile.  Compiled regexes are kept for reuse by later
+ * calls; give it back with xdiff_put_regex() instead of regfree()-ing
+ * it.  xdiff_set_find_func() gets its regexes from here as well.
+ *
+ * Threads may only use these (and thus xdiff_set_find_func()) between
+ * enable_xdiff_regex_lock() and disable_xdiff_regex_lock().
+ */
+regex_t *xdiff_get_regex(const char *pattern, int cflags);
+void xdiff_put_regex(regex_t *re);
+void enable_xdiff_regex_lock(void);
+void disable_xdiff_regex_lock(void);
 int git_xmerge_config(const char *var, const char *value, void *cb);
 extern int git_xmerge_style;
+extern unsigned long git_xmerge_segment_size;
 
 /*
  * Compare the strings l1 with l2 which are of size s1 and s2 respectively.
@@ -137,6 +137,7 @@ typedef struct s_xmparam {
 	const char *ancestor;	/* label for orig */
 	const char *file1;	/* label for mf1 */
 	const char *file2;	/* label for mf2 */
+	long segment_size;	/* if > 0, merge in segments of about that size */
 } xmparam_t;
 
 #define DEFAULT_CONFLICT_MARKER_SIZE 7
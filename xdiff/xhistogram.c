@@ -61,6 +61,13 @@ struct histindex {
 		     records_size,
 		     line_map_size;
 
+	/*
+	 * The index is reused by every find_lcs() of one diff; these
+	 * are the sizes allocated so far.
+	 */
+	unsigned int records_alloc,
+		     line_map_alloc;
+
 	unsigned int max_chain_length,
 		     key_shift,
 		     ptr_shift;
@@ -150,6 +157,7 @@ static int scanA(struct histindex *index, int line1, int count1)
 		rec->next = *rec_chain;
 		*rec_chain = rec;
 		LINE_MAP(index, ptr) = rec;
+		NEXT_PTR(index, ptr) = 0;
 
 continue_scan:
 		; /* no op */
@@ -251,71 +259,82 @@ static inline void free_index(struct histindex *index)
 	xdl_cha_free(&index->rcha);
 }
 
-static int find_lcs(xpparam_t const *xpp, xdfenv_t *env,
-		    struct region *lcs,
-		    int line1, int count1, int line2, int count2)
+static int init_index(struct histindex *index, xpparam_t const *xpp,
+		      xdfenv_t *env, int count1)
 {
-	int b_ptr;
-	int sz, ret = -1;
-	struct histindex index;
+	memset(index, 0, sizeof(*index));
 
-	memset(&index, 0, sizeof(index));
+	index->env = env;
+	index->xpp = xpp;
+	index->max_chain_length = 64;
 
-	index.env = env;
-	index.xpp = xpp;
-
-	index.records = NULL;
-	index.line_map = NULL;
-	/* in case of early xdl_cha_free() */
-	index.rcha.head = NULL;
+	/* lines / 4 + 1 comes from xprepare.c:xdl_prepare_ctx() */
+	return xdl_cha_init(&index->rcha, sizeof(struct record), count1 / 4 + 1);
+}
 
-	index.table_bits = xdl_hashbits(count1);
-	sz = index.records_size = 1 << index.table_bits;
-	sz *= sizeof(struct record *);
-	if (!(index.records = (struct record **) xdl_malloc(sz)))
-		goto cleanup;
-	memset(index.records, 0, sz);
+static int find_lcs(struct histindex *index, struct region *lcs,
+		    int line1, int count1, int line2, int count2)
+{
+	int b_ptr;
+	size_t sz;
 
-	sz = index.line_map_size = count1;
-	sz *= sizeof(struct record *);
-	if (!(index.line_map = (struct record **) xdl_malloc(sz)))
-		goto cleanup;
-	memset(index.line_map, 0, sz);
+	index->table_bits = xdl_hashbits(count1);
+	index->records_size = 1 << index->table_bits;
+	if (index->records_alloc < index->records_size) {
+		struct record **records;
 
-	sz = index.line_map_size;
-	sz *= sizeof(unsigned int);
-	if (!(index.next_ptrs = (unsigned int *) xdl_malloc(sz)))
-		goto cleanup;
-	memset(index.next_ptrs, 0, sz);
+		sz = index->records_size * sizeof(struct record *);
+		if (!(records = (struct record **) xdl_realloc(index->records, sz)))
+			return -1;
+		index->records = records;
+		index->records_alloc = index->records_size;
+	}
+	memset(index->records, 0, index->records_size * sizeof(struct record *));
+
+	/*
+	 * scanA() fills in every entry of line_map and next_ptrs in the
+	 * range it indexes, so they need not be cleared.
+	 */
+	index->line_map_size = count1;
+	if (index->line_map_alloc < index->line_map_size) {
+		struct record **line_map;
+		unsigned int *next_ptrs;
+
+		sz = index->line_map_size * sizeof(struct record *);
+		if (!(line_map = (struct record **) xdl_realloc(index->line_map, sz)))
+			return -1;
+		index->line_map = line_map;
+		sz = index->line_map_size * sizeof(unsigned int);
+		if (!(next_ptrs = (unsigned int *) xdl_realloc(index->next_ptrs, sz)))
+			return -1;
+		index->next_ptrs = next_ptrs;
+		index->line_map_alloc = index->line_map_size;
+	}
 
-	/* lines / 4 + 1 comes from xprepare.c:xdl_prepare_ctx() */
-	if (xdl_cha_init(&index.rcha, sizeof(struct record), count1 / 4 + 1) < 0)
-		goto cleanup;
+	xdl_cha_clear(&index->rcha);
 
-	index.ptr_shift = line1;
-	index.max_chain_length = 64;
+	index->ptr_shift = line1;
+	index->has_common = 0;
 
-	if (scanA(&index, line1, count1))
-		goto cleanup;
+	if (scanA(index, line1, count1))
+		return -1;
 
-	index.cnt = index.max_chain_length + 1;
+	index->cnt = index->max_chain_length + 1;
 
 	for (b_ptr = line2; b_ptr <= LINE_END(2); )
-		b_ptr = try_lcs(&index, lcs, b_ptr, line1, count1, line2, count2);
+		b_ptr = try_lcs(index, lcs, b_ptr, line1, count1, line2, count2);
 
-	if (index.has_common && index.max_chain_length < index.cnt)
-		ret = 1;
+	if (index->has_common && index->max_chain_length < index->cnt)
+		return 1;
 	else
-		ret = 0;
-
-cleanup:
-	free_index(&index);
-	return ret;
+		return 0;
 }
 
-static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
+static int histogram_diff(struct histindex *index,
 	int line1, int count1, int line2, int count2)
 {
+	xpparam_t const *xpp = index->xpp;
+	xdfenv_t *env = index->env;
 	struct region lcs;
 	int lcs_found;
 	int result;
@@ -339,7 +358,7 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 	}
 
 	memset(&lcs, 0, sizeof(lcs));
-	lcs_found = find_lcs(xpp, env, &lcs, line1, count1, line2, count2);
+	lcs_found = find_lcs(index, &lcs, line1, count1, line2, count2);
 	if (lcs_found < 0)
 		goto out;
 	else if (lcs_found)
@@ -352,13 +371,13 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 				env->xdf2.rchg[line2++ - 1] = 1;
 			result = 0;
 		} else {
-			result = histogram_diff(xpp, env,
+			result = histogram_diff(index,
 						line1, lcs.begin1 - line1,
 						line2, lcs.begin2 - line2);
 			if (result)
 				goto out;
 			/*
-			 * result = histogram_diff(xpp, env,
+			 * result = histogram_diff(index,
 			 *            lcs.end1 + 1, LINE_END(1) - lcs.end1,
 			 *            lcs.end2 + 1, LINE_END(2) - lcs.end2);
 			 * but let's optimize tail recursion ourself:
@@ -377,10 +396,20 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 int xdl_do_histogram_diff(mmfile_t *file1, mmfile_t *file2,
 	xpparam_t const *xpp, xdfenv_t *env)
 {
+	struct histindex index;
+	int result;
+
 	if (xdl_prepare_env(file1, file2, xpp, env) < 0)
 		return -1;
 
-	return histogram_diff(xpp, env,
+	if (init_index(&index, xpp, env,
+		       env->xdf1.dend - env->xdf1.dstart + 1) < 0)
+		return -1;
+
+	result = histogram_diff(&index,
 		env->xdf1.dstart + 1, env->xdf1.dend - env->xdf1.dstart + 1,
 		env->xdf2.dstart + 1, env->xdf2.dend - env->xdf2.dstart + 1);
+
+	free_index(&index);
+	return result;
 }
@@ -630,6 +630,190 @@ static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1,
 	return xdl_cleanup_merge(changes);
 }
 
+/*
+ * Very large files can be merged in segments, cut after lines that
+ * occur exactly once in each of the three files, in the same order.
+ * Neither side can have changed such a line, and the diffs of a full
+ * merge would normally match it too, so merging the segments one after
+ * the other gives the same result (save that conflicts on both sides of
+ * a cut are never coalesced) while only ever holding the diffs of one
+ * segment in memory.  A cut is tried about every segment_size bytes of
+ * the ancestor, after one of the XDL_MERGE_ANCHOR_LINES lines that
+ * follow that point.
+ */
+#define XDL_MERGE_ANCHOR_LINES 64
+
+typedef struct s_xdanchor {
+	unsigned long ha;
+	char const *ptr;
+	long size;	/* including the LF */
+	long window;	/* the cut it is a candidate for */
+	long count[3];
+	long end[3];	/* offset after the line in each file */
+	long next;	/* in the hash chain */
+} xdanchor_t;
+
+static long xdl_find_anchor(xdanchor_t *anchors, long *table,
+			    unsigned int hbits, unsigned long ha,
+			    char const *ptr, long size)
+{
+	long i;
+
+	for (i = table[XDL_HASHLONG(ha, hbits)]; i >= 0; i = anchors[i].next)
+		if (anchors[i].ha == ha && anchors[i].size == size &&
+		    !memcmp(anchors[i].ptr, ptr, size))
+			return i;
+	return -1;
+}
+
+/*
+ * Find where to cut mf[0] (the ancestor), mf[1] and mf[2] into segments
+ * of about segment_size bytes.  Returns the number of cuts, whose
+ * offsets are stored by three in *cuts, or -1 on error.
+ */
+static long xdl_find_cuts(mmfile_t *mf[3], long segment_size, long **cuts)
+{
+	xdanchor_t *anchors;
+	long *table, nr = 0, nr_cuts = 0, nr_windows, window, i, f;
+	long last[3] = { 0, 0, 0 };
+	unsigned int hbits;
+	char const *ptr, *top, *prev = mf[0]->ptr;
+
+	*cuts = NULL;
+	nr_windows = (mf[0]->size - 1) / segment_size;
+	if (nr_windows <= 0)
+		return 0;
+
+	anchors = xdl_malloc(nr_windows * XDL_MERGE_ANCHOR_LINES *
+			     sizeof(*anchors));
+	hbits = xdl_hashbits((unsigned int)(nr_windows * XDL_MERGE_ANCHOR_LINES));
+	table = xdl_malloc(sizeof(*table) << hbits);
+	*cuts = xdl_malloc(nr_windows * 3 * sizeof(**cuts));
+	if (!anchors || !table || !*cuts) {
+		xdl_free(anchors);
+		xdl_free(table);
+		xdl_free(*cuts);
+		*cuts = NULL;
+		return -1;
+	}
+	for (i = 0; i < (1L << hbits); i++)
+		table[i] = -1;
+
+	/* the candidates, in the order of the ancestor */
+	top = mf[0]->ptr + mf[0]->size;
+	for (window = 1; window <= nr_windows; window++) {
+		ptr = mf[0]->ptr + window * segment_size;
+		if (ptr < prev)
+			ptr = prev;
+		else if (ptr[-1] != '\n') {
+			ptr = memchr(ptr, '\n', top - ptr);
+			if (!ptr)
+				break;
+			ptr++;
+		}
+		for (i = 0; i < XDL_MERGE_ANCHOR_LINES && ptr < top; i++) {
+			char const *line = ptr;
+			unsigned long ha = xdl_hash_record(&ptr, top, 0);
+			long h;
+
+			if (ptr[-1] != '\n' ||
+			    xdl_find_anchor(anchors, table, hbits, ha,
+					    line, ptr - line) >= 0)
+				continue;
+			h = XDL_HASHLONG(ha, hbits);
+			anchors[nr].ha = ha;
+			anchors[nr].ptr = line;
+			anchors[nr].size = ptr - line;
+			anchors[nr].window = window;
+			for (f = 0; f < 3; f++)
+				anchors[nr].count[f] = anchors[nr].end[f] = 0;
+			anchors[nr].next = table[h];
+			table[h] = nr++;
+		}
+		prev = ptr;
+	}
+
+	/* how often, and where, they occur in each file */
+	for (f = 0; f < 3; f++) {
+		ptr = mf[f]->ptr;
+		top = ptr + mf[f]->size;
+		while (ptr < top) {
+			char const *line = ptr;
+			unsigned long ha = xdl_hash_record(&ptr, top, 0);
+
+			i = xdl_find_anchor(anchors, table, hbits, ha,
+					    line, ptr - line);
+			if (i >= 0) {
+				anchors[i].count[f]++;
+				anchors[i].end[f] = ptr - mf[f]->ptr;
+			}
+		}
+	}
+
+	/* the first usable candidate of each window */
+	for (window = 0, i = 0; i < nr; i++) {
+		xdanchor_t *a = &anchors[i];
+
+		if (a->window == window ||
+		    a->count[0] != 1 || a->count[1] != 1 || a->count[2] != 1 ||
+		    a->end[1] <= last[1] || a->end[2] <= last[2])
+			continue;
+		for (f = 0; f < 3; f++)
+			(*cuts)[3 * nr_cuts + f] = last[f] = a->end[f];
+		nr_cuts++;
+		window = a->window;
+	}
+
+	xdl_free(anchors);
+	xdl_free(table);
+	if (!nr_cuts) {
+		xdl_free(*cuts);
+		*cuts = NULL;
+	}
+	return nr_cuts;
+}
+
+static int xdl_merge_segments(mmfile_t *mf[3], long *cuts, long nr_cuts,
+			      xmparam_t const *xmp, mmbuffer_t *result)
+{
+	xmparam_t segment_xmp = *xmp;
+	long start[3] = { 0, 0, 0 }, alloc = 0, i, f;
+	int conflicts = 0;
+
+	segment_xmp.segment_size = 0;
+	for (i = 0; i <= nr_cuts; i++) {
+		mmfile_t segment[3];
+		mmbuffer_t out;
+		int status;
+
+		for (f = 0; f < 3; f++) {
+			long end = i < nr_cuts ? cuts[3 * i + f] : mf[f]->size;
+
+			segment[f].ptr = mf[f]->ptr + start[f];
+			segment[f].size = end - start[f];
+			start[f] = end;
+		}
+		status = xdl_merge(&segment[0], &segment[1], &segment[2],
+				   &segment_xmp, &out);
+		if (status < 0) {
+			xdl_free(result->ptr);
+			result->ptr = NULL;
+			result->size = 0;
+			return -1;
+		}
+		conflicts += status;
+
+		if (alloc < result->size + out.size) {
+			alloc = (result->size + out.size) * 3 / 2;
+			result->ptr = xdl_realloc(result->ptr, alloc);
+		}
+		memcpy(result->ptr + result->size, out.ptr, out.size);
+		result->size += out.size;
+		xdl_free(out.ptr);
+	}
+	return conflicts;
+}
+
 int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
 		xmparam_t const *xmp, mmbuffer_t *result)
 {
@@ -641,6 +825,24 @@ int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
 	result->ptr = NULL;
 	result->size = 0;
 
+	if (xmp->segment_size > 0) {
+		mmfile_t *mf[3];
+		long *cuts, nr_cuts;
+
+		mf[0] = orig;
+		mf[1] = mf1;
+		mf[2] = mf2;
+		nr_cuts = xdl_find_cuts(mf, xmp->segment_size, &cuts);
+		if (nr_cuts < 0)
+			return -1;
+		if (nr_cuts) {
+			status = xdl_merge_segments(mf, cuts, nr_cuts,
+						    xmp, result);
+			xdl_free(cuts);
+			return status;
+		}
+	}
+
 	if (xdl_do_diff(orig, mf1, xpp, &xe1) < 0) {
 		return -1;
 	}
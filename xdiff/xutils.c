@@ -97,7 +97,12 @@ void *xdl_cha_alloc(chastore_t *cha) {
 	chanode_t *ancur;
 	void *data;
 
-	if (!(ancur = cha->ancur) || ancur->icurr == cha->nsize) {
+	if ((ancur = cha->ancur) && ancur->icurr == cha->nsize && ancur->next) {
+		/* reuse a node kept by xdl_cha_clear() */
+		ancur = ancur->next;
+		ancur->icurr = 0;
+		cha->ancur = ancur;
+	} else if (!ancur || ancur->icurr == cha->nsize) {
 		if (!(ancur = (chanode_t *) xdl_malloc(sizeof(chanode_t) + cha->nsize))) {
 
 			return NULL;
@@ -118,6 +123,17 @@ void *xdl_cha_alloc(chastore_t *cha) {
 	return data;
 }
 
+/*
+ * Forget everything allocated from the store, but keep its nodes around
+ * to be handed out again by xdl_cha_alloc().
+ */
+void xdl_cha_clear(chastore_t *cha) {
+
+	cha->ancur = cha->head;
+	if (cha->ancur)
+		cha->ancur->icurr = 0;
+}
+
 long xdl_guess_lines(mmfile_t *mf, long sample) {
 	long nl = 0, size, tsize = 0;
 	char const *data, *cur, *top;
@@ -294,20 +310,45 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 	return ha;
 }
 
+/*
+ * Unlike the whitespace-aware variant above, which has to make
+ * equivalent lines hash the same, this only needs identical lines to
+ * do so, and can therefore mix in eight bytes at a time.
+ */
+static unsigned long xdl_hash_bytes(char const *ptr, size_t len) {
+	const uint64_t k = 0x9e3779b97f4a7c15ULL;
+	uint64_t ha = 5381 + len, w;
+
+	for (; len >= sizeof(w); ptr += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, ptr, sizeof(w));
+		ha = (ha ^ w) * k;
+		ha ^= ha >> 29;
+	}
+	if (len) {
+		w = 0;
+		memcpy(&w, ptr, len);
+		ha = (ha ^ w) * k;
+	}
+	ha ^= ha >> 32;
+	ha *= k;
+	ha ^= ha >> 29;
+
+	return (unsigned long) ha;
+}
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
-	char const *ptr = *data;
+	char const *ptr = *data, *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+	if (!(eol = memchr(ptr, '\n', top - ptr))) {
+		*data = top;
+		return xdl_hash_bytes(ptr, top - ptr);
 	}
-	*data = ptr < top ? ptr + 1: ptr;
+	*data = eol + 1;
 
-	return ha;
+	return xdl_hash_bytes(ptr, eol - ptr);
 }
 
 unsigned int xdl_hashbits(unsigned int size) {
@@ -271,3 +271,33 @@ int git_deflate(git_zstream *strm, int flush)
 	      strm->z.msg ? strm->z.msg : "no message");
 	return status;
 }
+
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+
+int git_inflate_buffer(void *out, unsigned long outlen,
+		       const void *in, unsigned long inlen)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result res;
+	size_t consumed;
+
+	/*
+	 * A decompressor is cheap to set up compared to the inflate
+	 * itself, and having one per call keeps us thread-safe.
+	 */
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		return -1;
+	res = libdeflate_zlib_decompress_ex(d, in, inlen, out, outlen,
+					    &consumed, NULL);
+	libdeflate_free_decompressor(d);
+	return res == LIBDEFLATE_SUCCESS ? 0 : -1;
+}
+#else
+int git_inflate_buffer(void *out, unsigned long outlen,
+		       const void *in, unsigned long inlen)
+{
+	return -1;
+}
+#endif